@@ -0,0 +1,440 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/* Micro-benchmarks of the core kernels.
+ *
+ * Each benchmark is run until it reaches --min_time seconds, the time
+ * per iteration is reported in ns. The results can be written in the
+ * JSON format of Google Benchmark (--json), and compared with a previous
+ * run (--compare), in which case the exit code is 1 if a benchmark is
+ * slower than the baseline by more than --threshold.
+ *
+ *   bench_kernels --json base.json
+ *   (update faiss)
+ *   bench_kernels --compare base.json --threshold 0.1
+ *
+ * The benchmarks run with 1 OpenMP thread unless --threads is given.
+ */
+
+#include <cinttypes>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <omp.h>
+
+#include <faiss/IndexHNSW.h>
+#include <faiss/IndexPQFastScan.h>
+#include <faiss/impl/ScalarQuantizer.h>
+#include <faiss/utils/cpu_dispatch.h>
+#include <faiss/utils/distances.h>
+#include <faiss/utils/hamming.h>
+#include <faiss/utils/partitioning.h>
+#include <faiss/utils/random.h>
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+/*****************************************************
+ * Benchmark runner
+ *****************************************************/
+
+struct Result {
+    std::string name;
+    int64_t iterations;
+    double ns_per_iter;
+    double items_per_second;
+};
+
+std::string filter;
+double min_time = 0.2;
+std::vector<Result> results;
+
+// prevents the compiler from optimizing out the benchmarked code
+volatile float sink;
+
+double now_ns ()
+{
+    return std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// run fn until min_time is reached. items is the nb of elements
+/// processed per call (for the throughput)
+void run (const std::string & name, double items,
+          const std::function<void()> & fn)
+{
+    if (!filter.empty() && name.find (filter) == std::string::npos) {
+        return;
+    }
+    fn (); // warmup
+
+    int64_t niter = 1;
+    double t;
+    for (;;) {
+        double t0 = now_ns ();
+        for (int64_t i = 0; i < niter; i++) {
+            fn ();
+        }
+        t = now_ns () - t0;
+        if (t >= min_time * 1e9 || niter >= (int64_t(1) << 40)) {
+            break;
+        }
+        // aim at 1.2 * min_time for the next round
+        double scale = t > 0 ? 1.2 * min_time * 1e9 / t : 100;
+        niter = std::max (niter + 1,
+                          int64_t (niter * std::min (scale, 100.0)));
+    }
+
+    Result r;
+    r.name = name;
+    r.iterations = niter;
+    r.ns_per_iter = t / niter;
+    r.items_per_second = items * 1e9 / r.ns_per_iter;
+    results.push_back (r);
+    printf ("%-56s %14.1f ns %12.4g items/s\n", name.c_str(),
+            r.ns_per_iter, r.items_per_second);
+    fflush (stdout);
+}
+
+std::string fmt (const char *format, ...)
+    __attribute__((format(printf, 1, 2)));
+
+std::string fmt (const char *format, ...)
+{
+    char buf[256];
+    va_list args;
+    va_start (args, format);
+    vsnprintf (buf, sizeof(buf), format, args);
+    va_end (args);
+    return buf;
+}
+
+std::vector<float> rand_vec (size_t n, int seed)
+{
+    std::vector<float> x (n);
+    float_rand (x.data(), n, seed);
+    return x;
+}
+
+/*****************************************************
+ * Benchmarks
+ *****************************************************/
+
+void bench_distances ()
+{
+    size_t ny = 1024;
+    for (size_t d : {4, 8, 12, 16, 32, 64, 128, 256, 768}) {
+        std::vector<float> x = rand_vec (d, 1);
+        std::vector<float> y = rand_vec (d * ny, 2);
+        std::vector<float> dis (ny);
+        run (fmt ("fvec_L2sqr/d:%zd", d), 1, [&]() {
+            sink = fvec_L2sqr (x.data(), y.data(), d);
+        });
+        run (fmt ("fvec_L2sqr_ny/d:%zd/ny:%zd", d, ny), ny, [&]() {
+            fvec_L2sqr_ny (dis.data(), x.data(), y.data(), d, ny);
+            sink = dis[0];
+        });
+    }
+}
+
+void bench_knn ()
+{
+    size_t nb = 10000;
+    for (size_t d : {32, 128}) {
+        std::vector<float> xb = rand_vec (d * nb, 1);
+        for (size_t nq : {1, 16, 256}) {
+            std::vector<float> xq = rand_vec (d * nq, 2);
+            for (size_t k : {1, 10, 100}) {
+                std::vector<float> D (nq * k);
+                std::vector<idx_t> I (nq * k);
+                run (fmt ("knn_L2sqr/d:%zd/nq:%zd/nb:%zd/k:%zd",
+                          d, nq, nb, k),
+                     nq * nb, [&]() {
+                    float_maxheap_array_t res = {nq, k, I.data(), D.data()};
+                    knn_L2sqr (xq.data(), xb.data(), d, nq, nb, &res);
+                    sink = D[0];
+                });
+            }
+        }
+    }
+}
+
+void bench_pq4_scan ()
+{
+    int d = 64;
+    size_t nb = 65536, nt = 10000;
+    std::vector<float> xt = rand_vec (d * nt, 1);
+    std::vector<float> xb = rand_vec (d * nb, 2);
+    for (size_t M : {16, 32}) {
+        IndexPQFastScan index (d, M);
+        index.train (nt, xt.data());
+        index.add (nb, xb.data());
+        for (size_t nq : {1, 16, 64}) {
+            std::vector<float> xq = rand_vec (d * nq, 3);
+            int k = 10;
+            std::vector<float> D (nq * k);
+            std::vector<idx_t> I (nq * k);
+            run (fmt ("pq4_scan/M:%zd/nq:%zd/nb:%zd/k:%d", M, nq, nb, k),
+                 nq * nb, [&]() {
+                index.search (nq, xq.data(), k, D.data(), I.data());
+                sink = D[0];
+            });
+        }
+    }
+}
+
+void bench_hamming ()
+{
+    size_t nb = 65536;
+    for (size_t code_size : {8, 16, 32, 64}) {
+        std::vector<uint8_t> b (nb * code_size);
+        byte_rand (b.data(), b.size(), 1);
+        for (size_t nq : {1, 16, 256}) {
+            std::vector<uint8_t> a (nq * code_size);
+            byte_rand (a.data(), a.size(), 2);
+            size_t k = 10;
+            std::vector<int> D (nq * k);
+            std::vector<idx_t> I (nq * k);
+            run (fmt ("hammings_knn_hc/code_size:%zd/nq:%zd/nb:%zd/k:%zd",
+                      code_size, nq, nb, k),
+                 nq * nb, [&]() {
+                int_maxheap_array_t res = {nq, k, I.data(), D.data()};
+                hammings_knn_hc (&res, a.data(), b.data(), nb, code_size, 1);
+                sink = D[0];
+            });
+        }
+    }
+}
+
+void bench_scalar_quantizer ()
+{
+    int d = 128;
+    size_t n = 4096;
+    std::vector<float> x = rand_vec (d * n, 1);
+    std::vector<float> x2 (d * n);
+
+    std::vector<std::pair<const char*, ScalarQuantizer::QuantizerType> >
+        qts = {
+        {"8bit", ScalarQuantizer::QT_8bit},
+        {"8bit_uniform", ScalarQuantizer::QT_8bit_uniform},
+        {"6bit", ScalarQuantizer::QT_6bit},
+        {"4bit", ScalarQuantizer::QT_4bit},
+        {"fp16", ScalarQuantizer::QT_fp16},
+    };
+
+    for (auto qt : qts) {
+        ScalarQuantizer sq (d, qt.second);
+        sq.train (n, x.data());
+        std::vector<uint8_t> codes (sq.code_size * n);
+
+        run (fmt ("sq_encode/%s/d:%d", qt.first, d), n, [&]() {
+            sq.compute_codes (x.data(), codes.data(), n);
+            sink = codes[0];
+        });
+        run (fmt ("sq_decode/%s/d:%d", qt.first, d), n, [&]() {
+            sq.decode (codes.data(), x2.data(), n);
+            sink = x2[0];
+        });
+
+        std::unique_ptr<ScalarQuantizer::SQDistanceComputer> dc (
+            sq.get_distance_computer ());
+        dc->codes = codes.data();
+        dc->code_size = sq.code_size;
+        dc->set_query (x.data());
+        run (fmt ("sq_distance/%s/d:%d", qt.first, d), n, [&]() {
+            float s = 0;
+            for (size_t j = 0; j < n; j++) {
+                s += (*dc) (j);
+            }
+            sink = s;
+        });
+    }
+}
+
+void bench_partition ()
+{
+    for (size_t n : {1000, 10000, 100000}) {
+        std::vector<float> vals = rand_vec (n, 1);
+        std::vector<int64_t> ids (n);
+        for (size_t i = 0; i < n; i++) {
+            ids[i] = i;
+        }
+        std::vector<float> v2 (n);
+        std::vector<int64_t> i2 (n);
+        for (size_t q : {10, 100}) {
+            // the copy of the input is included in the timing
+            run (fmt ("partition_fuzzy/n:%zd/q:%zd", n, q), n, [&]() {
+                memcpy (v2.data(), vals.data(), n * sizeof (float));
+                memcpy (i2.data(), ids.data(), n * sizeof (int64_t));
+                size_t q_out;
+                sink = partition_fuzzy<CMax<float, int64_t> > (
+                    v2.data(), i2.data(), n, q, q + q / 10, &q_out);
+            });
+        }
+    }
+}
+
+void bench_hnsw ()
+{
+    int d = 64;
+    size_t nb = 20000, nq = 100;
+    std::vector<float> xb = rand_vec (d * nb, 1);
+    std::vector<float> xq = rand_vec (d * nq, 2);
+    IndexHNSWFlat index (d, 32);
+    index.add (nb, xb.data());
+    int k = 10;
+    std::vector<float> D (nq * k);
+    std::vector<idx_t> I (nq * k);
+    for (int efSearch : {16, 64, 256}) {
+        index.hnsw.efSearch = efSearch;
+        run (fmt ("hnsw_search/nb:%zd/efSearch:%d/k:%d", nb, efSearch, k),
+             nq, [&]() {
+            index.search (nq, xq.data(), k, D.data(), I.data());
+            sink = D[0];
+        });
+    }
+}
+
+/*****************************************************
+ * Output and comparison
+ *****************************************************/
+
+void write_json (const char *fname, int nthreads)
+{
+    FILE *f = fopen (fname, "w");
+    if (!f) {
+        fprintf (stderr, "cannot open %s\n", fname);
+        exit (1);
+    }
+    fprintf (f, "{\n  \"context\": {\"library\": \"faiss\", "
+             "\"simd_level\": %d, \"num_threads\": %d},\n",
+             int (get_simd_level ()), nthreads);
+    fprintf (f, "  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result & r = results[i];
+        // one benchmark per line, read back by read_json
+        fprintf (f, "    {\"name\": \"%s\", \"iterations\": %" PRId64
+                 ", \"real_time\": %.3f, \"time_unit\": \"ns\", "
+                 "\"items_per_second\": %.6g}%s\n",
+                 r.name.c_str(), r.iterations, r.ns_per_iter,
+                 r.items_per_second, i + 1 < results.size() ? "," : "");
+    }
+    fprintf (f, "  ]\n}\n");
+    fclose (f);
+}
+
+/// reads the name -> real_time of a file written by write_json
+std::map<std::string, double> read_json (const char *fname)
+{
+    std::map<std::string, double> times;
+    FILE *f = fopen (fname, "r");
+    if (!f) {
+        fprintf (stderr, "cannot open %s\n", fname);
+        exit (1);
+    }
+    char line[1024];
+    while (fgets (line, sizeof(line), f)) {
+        const char *pn = strstr (line, "\"name\": \"");
+        const char *pt = strstr (line, "\"real_time\": ");
+        if (!pn || !pt) continue;
+        pn += strlen ("\"name\": \"");
+        const char *pe = strchr (pn, '"');
+        if (!pe) continue;
+        times[std::string (pn, pe)] = atof (pt + strlen ("\"real_time\": "));
+    }
+    fclose (f);
+    return times;
+}
+
+/// @return nb of regressions
+int compare (const char *fname, double threshold)
+{
+    std::map<std::string, double> base = read_json (fname);
+    int nreg = 0;
+    printf ("\n%-56s %10s %10s %8s\n", "benchmark", "base ns", "ns", "ratio");
+    for (const Result & r : results) {
+        auto it = base.find (r.name);
+        if (it == base.end()) continue;
+        double ratio = r.ns_per_iter / it->second;
+        bool reg = ratio > 1 + threshold;
+        nreg += reg;
+        printf ("%-56s %10.1f %10.1f %8.3f%s\n", r.name.c_str(),
+                it->second, r.ns_per_iter, ratio, reg ? " REGRESSION" : "");
+    }
+    printf ("%d regressions (threshold %g)\n", nreg, threshold);
+    return nreg;
+}
+
+void usage ()
+{
+    printf ("usage: bench_kernels [--filter str] [--min_time s] "
+            "[--threads n] [--json out.json]\n"
+            "                     [--compare base.json] [--threshold t]\n");
+}
+
+} // anonymous namespace
+
+
+int main (int argc, char **argv)
+{
+    const char *json_out = nullptr;
+    const char *compare_with = nullptr;
+    double threshold = 0.1;
+    int nthreads = 1;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (i + 1 < argc && a == "--filter") {
+            filter = argv[++i];
+        } else if (i + 1 < argc && a == "--min_time") {
+            min_time = atof (argv[++i]);
+        } else if (i + 1 < argc && a == "--threads") {
+            nthreads = atoi (argv[++i]);
+        } else if (i + 1 < argc && a == "--json") {
+            json_out = argv[++i];
+        } else if (i + 1 < argc && a == "--compare") {
+            compare_with = argv[++i];
+        } else if (i + 1 < argc && a == "--threshold") {
+            threshold = atof (argv[++i]);
+        } else {
+            usage ();
+            return a == "-h" || a == "--help" ? 0 : 1;
+        }
+    }
+
+    omp_set_num_threads (nthreads);
+    printf ("simd_level=%d threads=%d\n", int (get_simd_level ()), nthreads);
+
+    bench_distances ();
+    bench_knn ();
+    bench_pq4_scan ();
+    bench_hamming ();
+    bench_scalar_quantizer ();
+    bench_partition ();
+    bench_hnsw ();
+
+    if (json_out) {
+        write_json (json_out, nthreads);
+    }
+    if (compare_with) {
+        return compare (compare_with, threshold) > 0 ? 1 : 0;
+    }
+    return 0;
+}
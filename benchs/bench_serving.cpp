@@ -0,0 +1,439 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/* Serving benchmark: replays queries on an index with several client
+ * threads and reports the latency percentiles, the QPS and the recall.
+ *
+ * Each request is a batch of --batch consecutive queries of the query
+ * file (cycling over it). The client threads take the requests in order.
+ *
+ * - closed loop (default): each client sends its next request as soon as
+ *   the previous one returns, the latency is the search time.
+ * - open loop (--qps R): the requests arrive following a Poisson process
+ *   with a total rate of R queries / s. The latency is measured from the
+ *   arrival, so it includes the time the request waited for a free
+ *   client. This is what shows the tail latency under load.
+ *
+ * Examples:
+ *
+ *   bench_serving --factory IVF4096,Flat --train learn.fvecs \
+ *       --base base.fvecs --queries query.fvecs --gt gt.ivecs \
+ *       --params nprobe=16 --clients 8 --batch 1 --qps 2000
+ *
+ *   bench_serving --index index.faiss --queries query.fvecs --clients 4
+ *
+ *   bench_serving --factory HNSW32 --synthetic 64,100000,1000
+ *
+ * With --synthetic d,nb,nq, random data is used and the ground truth is
+ * computed with an IndexFlat. With --gpu (if compiled with GPU support),
+ * the index is copied to GPU 0, and the searches are serialized because
+ * the GPU indexes cannot be searched from several threads at a time.
+ */
+
+#include <cassert>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <omp.h>
+
+#include <faiss/AutoTune.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/index_factory.h>
+#include <faiss/index_io.h>
+#include <faiss/utils/random.h>
+
+#ifdef BENCH_WITH_GPU
+#include <faiss/gpu/GpuCloner.h>
+#include <faiss/gpu/StandardGpuResources.h>
+#endif
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+typedef std::chrono::steady_clock Clock;
+
+std::vector<float> fvecs_read (const char *fname, size_t *d_out,
+                               size_t *n_out)
+{
+    FILE *f = fopen (fname, "r");
+    if (!f) {
+        fprintf (stderr, "could not open %s\n", fname);
+        exit (1);
+    }
+    int d;
+    if (fread (&d, 1, sizeof (int), f) != sizeof (int) ||
+        d <= 0 || d >= 1000000) {
+        fprintf (stderr, "%s: bad dimension\n", fname);
+        exit (1);
+    }
+    struct stat st;
+    fstat (fileno (f), &st);
+    size_t sz = st.st_size;
+    if (sz % ((d + 1) * 4) != 0) {
+        fprintf (stderr, "%s: bad file size\n", fname);
+        exit (1);
+    }
+    size_t n = sz / ((d + 1) * 4);
+    fseek (f, 0, SEEK_SET);
+
+    std::vector<float> raw (n * (d + 1));
+    size_t nr = fread (raw.data(), sizeof (float), raw.size(), f);
+    fclose (f);
+    assert (nr == raw.size() || !"could not read whole file");
+
+    // shift the vectors to remove the dimension headers
+    std::vector<float> x (n * d);
+    for (size_t i = 0; i < n; i++) {
+        memcpy (x.data() + i * d, raw.data() + 1 + i * (d + 1),
+                sizeof (float) * d);
+    }
+    *d_out = d;
+    *n_out = n;
+    return x;
+}
+
+std::vector<idx_t> ivecs_read (const char *fname, size_t *d_out,
+                               size_t *n_out)
+{
+    std::vector<float> raw = fvecs_read (fname, d_out, n_out);
+    std::vector<idx_t> x (raw.size());
+    for (size_t i = 0; i < raw.size(); i++) {
+        int v;
+        memcpy (&v, &raw[i], sizeof (int));
+        x[i] = v;
+    }
+    return x;
+}
+
+double percentile (const std::vector<double> & sorted, double p)
+{
+    if (sorted.empty()) return 0;
+    size_t i = size_t (p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min (i, sorted.size() - 1)];
+}
+
+void usage ()
+{
+    printf (
+        "usage: bench_serving\n"
+        "  (--index file | --factory key [--train f.fvecs] --base f.fvecs)\n"
+        "  --queries f.fvecs [--gt f.ivecs]   or   --synthetic d,nb,nq\n"
+        "  [--params str]      ParameterSpace parameters, eg. nprobe=16\n"
+        "  [--k k]             nb of results (default 10)\n"
+        "  [--clients n]       nb of client threads (default 1)\n"
+        "  [--batch b]         queries per request (default 1)\n"
+        "  [--qps r]           Poisson arrivals at r queries/s (default:\n"
+        "                      closed loop)\n"
+        "  [--nrequest n]      nb of requests (default: 1 pass over the\n"
+        "                      queries)\n"
+        "  [--omp n]           OpenMP threads per search (default 1)\n"
+        "  [--gpu]             run the index on GPU 0\n");
+}
+
+} // anonymous namespace
+
+
+int main (int argc, char **argv)
+{
+    const char *index_file = nullptr, *factory = nullptr;
+    const char *train_file = nullptr, *base_file = nullptr;
+    const char *query_file = nullptr, *gt_file = nullptr;
+    const char *params = nullptr;
+    size_t syn_d = 0, syn_nb = 0, syn_nq = 0;
+    int k = 10, nclient = 1, batch = 1, nomp = 1;
+    double qps = 0;
+    size_t nrequest = 0;
+    bool use_gpu = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        bool has_arg = i + 1 < argc;
+        if (a == "--index" && has_arg) {
+            index_file = argv[++i];
+        } else if (a == "--factory" && has_arg) {
+            factory = argv[++i];
+        } else if (a == "--train" && has_arg) {
+            train_file = argv[++i];
+        } else if (a == "--base" && has_arg) {
+            base_file = argv[++i];
+        } else if (a == "--queries" && has_arg) {
+            query_file = argv[++i];
+        } else if (a == "--gt" && has_arg) {
+            gt_file = argv[++i];
+        } else if (a == "--synthetic" && has_arg) {
+            if (sscanf (argv[++i], "%zd,%zd,%zd",
+                        &syn_d, &syn_nb, &syn_nq) != 3) {
+                usage ();
+                return 1;
+            }
+        } else if (a == "--params" && has_arg) {
+            params = argv[++i];
+        } else if (a == "--k" && has_arg) {
+            k = atoi (argv[++i]);
+        } else if (a == "--clients" && has_arg) {
+            nclient = atoi (argv[++i]);
+        } else if (a == "--batch" && has_arg) {
+            batch = atoi (argv[++i]);
+        } else if (a == "--qps" && has_arg) {
+            qps = atof (argv[++i]);
+        } else if (a == "--nrequest" && has_arg) {
+            nrequest = strtoul (argv[++i], nullptr, 10);
+        } else if (a == "--omp" && has_arg) {
+            nomp = atoi (argv[++i]);
+        } else if (a == "--gpu") {
+            use_gpu = true;
+        } else {
+            usage ();
+            return a == "-h" || a == "--help" ? 0 : 1;
+        }
+    }
+
+    bool synthetic = syn_d > 0;
+    if ((!index_file && !factory) || (!query_file && !synthetic) ||
+        (factory && !base_file && !synthetic) ||
+        k <= 0 || nclient <= 0 || batch <= 0) {
+        usage ();
+        return 1;
+    }
+#ifndef BENCH_WITH_GPU
+    if (use_gpu) {
+        fprintf (stderr, "compiled without GPU support\n");
+        return 1;
+    }
+#endif
+
+    /*************** load the data and the index */
+
+    size_t d, nq, nb = 0;
+    std::vector<float> xq, xb;
+    std::unique_ptr<Index> index;
+
+    if (synthetic) {
+        d = syn_d;
+        nb = syn_nb;
+        nq = syn_nq;
+        xb.resize (nb * d);
+        xq.resize (nq * d);
+        float_rand (xb.data(), xb.size(), 1234);
+        float_rand (xq.data(), xq.size(), 4567);
+    } else {
+        xq = fvecs_read (query_file, &d, &nq);
+    }
+
+    if (index_file) {
+        printf ("reading %s\n", index_file);
+        index.reset (read_index (index_file));
+    } else {
+        index.reset (index_factory (d, factory));
+        if (!index->is_trained) {
+            std::vector<float> xt;
+            size_t nt, dt;
+            if (train_file) {
+                xt = fvecs_read (train_file, &dt, &nt);
+            } else if (synthetic) {
+                xt = xb;
+                nt = nb;
+                dt = d;
+            } else {
+                xt = fvecs_read (base_file, &dt, &nt);
+            }
+            printf ("training on %zd vectors\n", nt);
+            index->train (nt, xt.data());
+        }
+        if (!synthetic) {
+            size_t db;
+            xb = fvecs_read (base_file, &db, &nb);
+        }
+        printf ("adding %zd vectors\n", nb);
+        index->add (nb, xb.data());
+    }
+    if (index->d != d) {
+        fprintf (stderr, "index has d=%d, queries d=%zd\n", index->d, d);
+        return 1;
+    }
+
+    // ground truth: nearest neighbors of the queries, gt_k per query
+    std::vector<idx_t> gt;
+    size_t gt_k = 0;
+    if (gt_file) {
+        size_t gt_n;
+        gt = ivecs_read (gt_file, &gt_k, &gt_n);
+        if (gt_n != nq) {
+            fprintf (stderr, "ground truth has %zd entries, expected %zd\n",
+                     gt_n, nq);
+            return 1;
+        }
+    } else if (synthetic) {
+        printf ("computing the ground truth\n");
+        IndexFlat flat (d, index->metric_type);
+        flat.add (nb, xb.data());
+        gt_k = k;
+        gt.resize (nq * gt_k);
+        std::vector<float> D (nq * gt_k);
+        flat.search (nq, xq.data(), gt_k, D.data(), gt.data());
+    }
+    xb.clear ();
+    xb.shrink_to_fit ();
+
+    if (params) {
+        ParameterSpace ().set_index_parameters (index.get(), params);
+    }
+
+    Index *search_index = index.get();
+    std::mutex search_mutex;
+#ifdef BENCH_WITH_GPU
+    gpu::StandardGpuResources res;
+    std::unique_ptr<Index> gpu_index;
+    if (use_gpu) {
+        gpu_index.reset (gpu::index_cpu_to_gpu (&res, 0, index.get()));
+        search_index = gpu_index.get();
+    }
+#endif
+
+    /*************** replay the queries */
+
+    if (nrequest == 0) {
+        nrequest = (nq + batch - 1) / batch;
+    }
+
+    // arrival times of the requests, in s from the start
+    std::vector<double> arrival (nrequest, 0);
+    if (qps > 0) {
+        std::mt19937 rng (123);
+        std::exponential_distribution<double> interval (qps / batch);
+        double t = 0;
+        for (size_t r = 0; r < nrequest; r++) {
+            t += interval (rng);
+            arrival[r] = t;
+        }
+    }
+
+    std::vector<double> latency (nrequest);
+    std::vector<idx_t> labels (nq * k, -1);
+    std::atomic<size_t> next_request (0);
+
+    printf ("replaying %zd requests of %d queries with %d clients, %s\n",
+            nrequest, batch, nclient,
+            qps > 0 ? "Poisson arrivals" : "closed loop");
+
+    Clock::time_point t_start = Clock::now ();
+
+    auto client = [&] () {
+        omp_set_num_threads (nomp);
+        std::vector<float> xbatch (batch * d);
+        std::vector<float> D (batch * k);
+        std::vector<idx_t> I (batch * k);
+
+        for (;;) {
+            size_t r = next_request++;
+            if (r >= nrequest) break;
+
+            Clock::time_point t0 = Clock::now ();
+            if (qps > 0) {
+                t0 = t_start + std::chrono::duration_cast<Clock::duration> (
+                        std::chrono::duration<double> (arrival[r]));
+                std::this_thread::sleep_until (t0);
+            }
+
+            size_t q0 = (r * batch) % nq;
+            for (int j = 0; j < batch; j++) {
+                memcpy (xbatch.data() + j * d,
+                        xq.data() + ((q0 + j) % nq) * d,
+                        sizeof (float) * d);
+            }
+
+            if (use_gpu) {
+                std::lock_guard<std::mutex> lock (search_mutex);
+                search_index->search (batch, xbatch.data(), k,
+                                      D.data(), I.data());
+            } else {
+                search_index->search (batch, xbatch.data(), k,
+                                      D.data(), I.data());
+            }
+
+            latency[r] = std::chrono::duration<double> (
+                Clock::now () - t0).count ();
+
+            // keep the results of the first pass over the queries
+            for (int j = 0; j < batch && r * batch + j < nq; j++) {
+                memcpy (labels.data() + (q0 + j) * k,
+                        I.data() + j * k, sizeof (idx_t) * k);
+            }
+        }
+    };
+
+    std::vector<std::thread> clients;
+    for (int c = 0; c < nclient; c++) {
+        clients.emplace_back (client);
+    }
+    for (auto & th : clients) {
+        th.join ();
+    }
+    double t_total = std::chrono::duration<double> (
+        Clock::now () - t_start).count ();
+
+    /*************** report */
+
+    std::vector<double> sorted (latency);
+    std::sort (sorted.begin(), sorted.end());
+    double mean = 0;
+    for (double l : sorted) mean += l;
+    mean /= sorted.size();
+
+    printf ("requests: %zd  queries: %zd  time: %.3f s\n",
+            nrequest, nrequest * batch, t_total);
+    printf ("QPS: %.1f  requests/s: %.1f\n",
+            nrequest * batch / t_total, nrequest / t_total);
+    printf ("latency (ms): mean %.3f  p50 %.3f  p90 %.3f  p99 %.3f  "
+            "p99.9 %.3f  max %.3f\n",
+            mean * 1e3, percentile (sorted, 0.5) * 1e3,
+            percentile (sorted, 0.9) * 1e3, percentile (sorted, 0.99) * 1e3,
+            percentile (sorted, 0.999) * 1e3, sorted.back() * 1e3);
+
+    if (gt_k > 0) {
+        // 1-recall@1, 1-recall@k and k-recall@k (intersection)
+        size_t n_1 = 0, n_k = 0, n_inter = 0, n_eval = 0;
+        size_t kk = std::min (size_t (k), gt_k);
+        for (size_t i = 0; i < nq; i++) {
+            const idx_t *I = labels.data() + i * k;
+            if (I[0] == -1 && I[k - 1] == -1) continue; // not searched
+            n_eval++;
+            const idx_t *G = gt.data() + i * gt_k;
+            n_1 += I[0] == G[0];
+            std::unordered_set<idx_t> found (I, I + k);
+            n_k += found.count (G[0]);
+            for (size_t j = 0; j < kk; j++) {
+                n_inter += found.count (G[j]);
+            }
+        }
+        if (n_eval > 0) {
+            printf ("recall: 1-R@1 %.4f  1-R@%d %.4f  %zd-R@%d %.4f "
+                    "(%zd queries)\n",
+                    n_1 / double (n_eval), k, n_k / double (n_eval),
+                    kk, k, n_inter / double (n_eval * kk), n_eval);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,180 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/* Exact k-NN ground truth or k-NN graph of datasets that do not fit in
+ * RAM, with StreamingKnn.
+ *
+ * The base and query vectors are read by blocks from .fvecs, .bvecs or
+ * .npy files. The results are written to .npy files (float32 distances,
+ * int64 ids) after each block of queries. If the computation is
+ * interrupted, running the same command again resumes it.
+ *
+ * Examples:
+ *
+ *   knn_ground_truth --base base.bvecs --queries query.bvecs --k 100 \
+ *       --D gt_D.npy --I gt_I.npy
+ *
+ *   knn_ground_truth --base base.fvecs --k 32 --I knn_graph.npy --gpu 4
+ *
+ * Without --queries, the k-NN graph of the base vectors is computed (each
+ * vector is excluded from its own neighbors), eg. for
+ * IndexHNSW::add_with_knn_graph. With --gpu n (if compiled with GPU
+ * support), the distances are computed on n GPUs, each with a shard of
+ * the database blocks.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <omp.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/StreamingKnn.h>
+#include <faiss/impl/FaissException.h>
+
+#ifdef BENCH_WITH_GPU
+#include <faiss/gpu/GpuCloner.h>
+#include <faiss/gpu/StandardGpuResources.h>
+#endif
+
+using namespace faiss;
+
+namespace {
+
+void usage ()
+{
+    printf (
+        "usage: knn_ground_truth\n"
+        "  --base f            database vectors (.fvecs, .bvecs or .npy)\n"
+        "  [--queries f]       query vectors (default: k-NN graph of the\n"
+        "                      database)\n"
+        "  [--k k]             nb of neighbors (default 100)\n"
+        "  [--metric L2|IP]    (default L2)\n"
+        "  [--D f.npy]         output distances\n"
+        "  [--I f.npy]         output ids (default gt_I.npy)\n"
+        "  [--qbs n]           queries per block (default 65536)\n"
+        "  [--dbbs n]          database vectors per block (default 1M)\n"
+        "  [--omp n]           nb of OpenMP threads\n"
+        "  [--gpu n]           compute the distances on n GPUs\n");
+}
+
+} // anonymous namespace
+
+
+int main (int argc, char **argv)
+{
+    const char *base_file = nullptr, *query_file = nullptr;
+    const char *D_file = nullptr, *I_file = "gt_I.npy";
+    std::string metric = "L2";
+    int k = 100, nomp = 0, ngpu = 0;
+    size_t qbs = 0, dbbs = 0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        bool has_arg = i + 1 < argc;
+        if (a == "--base" && has_arg) {
+            base_file = argv[++i];
+        } else if (a == "--queries" && has_arg) {
+            query_file = argv[++i];
+        } else if (a == "--k" && has_arg) {
+            k = atoi (argv[++i]);
+        } else if (a == "--metric" && has_arg) {
+            metric = argv[++i];
+        } else if (a == "--D" && has_arg) {
+            D_file = argv[++i];
+        } else if (a == "--I" && has_arg) {
+            I_file = argv[++i];
+        } else if (a == "--qbs" && has_arg) {
+            qbs = strtoul (argv[++i], nullptr, 10);
+        } else if (a == "--dbbs" && has_arg) {
+            dbbs = strtoul (argv[++i], nullptr, 10);
+        } else if (a == "--omp" && has_arg) {
+            nomp = atoi (argv[++i]);
+        } else if (a == "--gpu" && has_arg) {
+            ngpu = atoi (argv[++i]);
+        } else {
+            usage ();
+            return a == "-h" || a == "--help" ? 0 : 1;
+        }
+    }
+
+    if (!base_file || k <= 0 || (metric != "L2" && metric != "IP")) {
+        usage ();
+        return 1;
+    }
+#ifndef BENCH_WITH_GPU
+    if (ngpu > 0) {
+        fprintf (stderr, "compiled without GPU support\n");
+        return 1;
+    }
+#endif
+    if (nomp > 0) {
+        omp_set_num_threads (nomp);
+    }
+
+    try {
+        FileVectorSource xb (base_file);
+        std::unique_ptr<FileVectorSource> xq_file;
+        if (query_file) {
+            xq_file.reset (new FileVectorSource (query_file));
+        }
+        const VectorSource & xq = query_file ?
+            static_cast<const VectorSource &>(*xq_file) : xb;
+        printf ("database: %zd vectors of dimension %zd, queries: %zd "
+                "vectors%s\n", xb.n, xb.d, xq.n,
+                query_file ? "" : " (k-NN graph)");
+
+        MetricType mt = metric == "L2" ? METRIC_L2 : METRIC_INNER_PRODUCT;
+        StreamingKnn sk (k, mt);
+        sk.exclude_self = !query_file;
+        sk.verbose = true;
+        if (qbs > 0) {
+            sk.query_block_size = qbs;
+        }
+        if (dbbs > 0) {
+            sk.db_block_size = dbbs;
+        }
+
+#ifdef BENCH_WITH_GPU
+        std::vector<std::unique_ptr<gpu::StandardGpuResources>> res;
+        std::vector<gpu::GpuResourcesProvider*> providers;
+        std::vector<int> devices;
+        std::unique_ptr<Index> gpu_index;
+        if (ngpu > 0) {
+            for (int i = 0; i < ngpu; i++) {
+                res.emplace_back (new gpu::StandardGpuResources ());
+                providers.push_back (res.back().get());
+                devices.push_back (i);
+            }
+            IndexFlat index (xb.d, mt);
+            gpu::GpuMultipleClonerOptions opt;
+            opt.shard = true;
+            gpu_index.reset (gpu::index_cpu_to_gpu_multiple (
+                  providers, devices, &index, &opt));
+            sk.index = gpu_index.get();
+        }
+#endif
+
+        std::string D_tmp;
+        if (!D_file) {
+            // the distances are needed for the checkpoint anyways
+            D_tmp = std::string (I_file) + ".D.npy";
+            D_file = D_tmp.c_str();
+        }
+        sk.search_to_files (xq, xb, D_file, I_file);
+        printf ("wrote %s and %s\n", D_file, I_file);
+    } catch (const FaissException & e) {
+        fprintf (stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
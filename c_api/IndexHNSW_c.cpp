@@ -0,0 +1,83 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include "IndexHNSW_c.h"
+#include "IndexHNSW.h"
+#include "macros_impl.h"
+
+using faiss::IndexHNSW;
+using faiss::IndexHNSWFlat;
+using faiss::IndexHNSWSQ;
+using faiss::IndexHNSWPQ;
+using faiss::MetricType;
+using faiss::ScalarQuantizer;
+using faiss::SearchParametersHNSW;
+
+DEFINE_DESTRUCTOR(IndexHNSW)
+DEFINE_INDEX_DOWNCAST(IndexHNSW)
+
+int faiss_IndexHNSW_efSearch(const FaissIndexHNSW* index) {
+    return reinterpret_cast<const IndexHNSW*>(index)->hnsw.efSearch;
+}
+
+void faiss_IndexHNSW_set_efSearch(FaissIndexHNSW* index, int val) {
+    reinterpret_cast<IndexHNSW*>(index)->hnsw.efSearch = val;
+}
+
+int faiss_IndexHNSW_efConstruction(const FaissIndexHNSW* index) {
+    return reinterpret_cast<const IndexHNSW*>(index)->hnsw.efConstruction;
+}
+
+void faiss_IndexHNSW_set_efConstruction(FaissIndexHNSW* index, int val) {
+    reinterpret_cast<IndexHNSW*>(index)->hnsw.efConstruction = val;
+}
+
+int faiss_IndexHNSWFlat_new_with(FaissIndexHNSWFlat** p_index,
+    int d, int M, FaissMetricType metric)
+{
+    try {
+        *p_index = reinterpret_cast<FaissIndexHNSWFlat*>(
+            new IndexHNSWFlat(d, M, static_cast<MetricType>(metric)));
+    } CATCH_AND_HANDLE
+}
+
+int faiss_IndexHNSWSQ_new_with(FaissIndexHNSWSQ** p_index,
+    int d, FaissQuantizerType qt, int M, FaissMetricType metric)
+{
+    try {
+        *p_index = reinterpret_cast<FaissIndexHNSWSQ*>(
+            new IndexHNSWSQ(d, static_cast<ScalarQuantizer::QuantizerType>(qt),
+                            M, static_cast<MetricType>(metric)));
+    } CATCH_AND_HANDLE
+}
+
+int faiss_IndexHNSWPQ_new_with(FaissIndexHNSWPQ** p_index,
+    int d, int pq_m, int M)
+{
+    try {
+        *p_index = reinterpret_cast<FaissIndexHNSWPQ*>(
+            new IndexHNSWPQ(d, pq_m, M));
+    } CATCH_AND_HANDLE
+}
+
+DEFINE_DESTRUCTOR(SearchParametersHNSW)
+
+int faiss_SearchParametersHNSW_new(FaissSearchParametersHNSW** p_params,
+    const FaissIDSelector* sel, int efSearch)
+{
+    try {
+        auto params = new SearchParametersHNSW();
+        params->sel = reinterpret_cast<const faiss::IDSelector*>(sel);
+        params->efSearch = efSearch;
+        *p_params = reinterpret_cast<FaissSearchParametersHNSW*>(params);
+    } CATCH_AND_HANDLE
+}
+
+DEFINE_GETTER(SearchParametersHNSW, int, efSearch)
+DEFINE_SETTER(SearchParametersHNSW, int, efSearch)
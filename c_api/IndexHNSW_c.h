@@ -0,0 +1,69 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c -*-
+
+#ifndef FAISS_INDEX_HNSW_C_H
+#define FAISS_INDEX_HNSW_C_H
+
+#include "faiss_c.h"
+#include "Index_c.h"
+#include "IndexScalarQuantizer_c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** The HNSW index is a normal random-access index with a HNSW link
+ * structure built on top. The sub-classes differ by the storage of the
+ * vectors. */
+FAISS_DECLARE_CLASS_INHERITED(IndexHNSW, Index)
+FAISS_DECLARE_DESTRUCTOR(IndexHNSW)
+FAISS_DECLARE_INDEX_DOWNCAST(IndexHNSW)
+
+/// expansion factor at search time
+FAISS_DECLARE_GETTER_SETTER(IndexHNSW, int, efSearch)
+/// expansion factor at construction time
+FAISS_DECLARE_GETTER_SETTER(IndexHNSW, int, efConstruction)
+
+/// HNSW on flat vectors
+FAISS_DECLARE_CLASS_INHERITED(IndexHNSWFlat, Index)
+
+int faiss_IndexHNSWFlat_new_with(FaissIndexHNSWFlat** p_index,
+    int d, int M, FaissMetricType metric);
+
+/// HNSW on scalar quantizer codes
+FAISS_DECLARE_CLASS_INHERITED(IndexHNSWSQ, Index)
+
+int faiss_IndexHNSWSQ_new_with(FaissIndexHNSWSQ** p_index,
+    int d, FaissQuantizerType qt, int M, FaissMetricType metric);
+
+/// HNSW on PQ codes (L2 only)
+FAISS_DECLARE_CLASS_INHERITED(IndexHNSWPQ, Index)
+
+int faiss_IndexHNSWPQ_new_with(FaissIndexHNSWPQ** p_index,
+    int d, int pq_m, int M);
+
+/** Search parameters of a HNSW index, they override its efSearch for
+ * one search call (see faiss_Index_search_with_params) */
+FAISS_DECLARE_CLASS_INHERITED(SearchParametersHNSW, SearchParameters)
+FAISS_DECLARE_DESTRUCTOR(SearchParametersHNSW)
+
+/**
+ * @param sel       if non-null, only these ids are considered (not owned)
+ * @param efSearch  expansion factor at search time
+ */
+int faiss_SearchParametersHNSW_new(FaissSearchParametersHNSW** p_params,
+    const FaissIDSelector* sel, int efSearch);
+
+FAISS_DECLARE_GETTER_SETTER(SearchParametersHNSW, int, efSearch)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,70 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include "IndexIVFPQ_c.h"
+#include "IndexIVFPQ.h"
+#include "macros_impl.h"
+
+using faiss::Index;
+using faiss::IndexIVFPQ;
+using faiss::IVFPQSearchParameters;
+using faiss::MetricType;
+
+DEFINE_DESTRUCTOR(IndexIVFPQ)
+DEFINE_INDEX_DOWNCAST(IndexIVFPQ)
+
+DEFINE_GETTER(IndexIVFPQ, size_t, scan_table_threshold)
+DEFINE_SETTER(IndexIVFPQ, size_t, scan_table_threshold)
+DEFINE_GETTER(IndexIVFPQ, int, polysemous_ht)
+DEFINE_SETTER(IndexIVFPQ, int, polysemous_ht)
+DEFINE_GETTER(IndexIVFPQ, int, use_precomputed_table)
+DEFINE_SETTER(IndexIVFPQ, int, use_precomputed_table)
+
+int faiss_IndexIVFPQ_new(FaissIndexIVFPQ** p_index) {
+    try {
+        *p_index = reinterpret_cast<FaissIndexIVFPQ*>(new IndexIVFPQ());
+    } CATCH_AND_HANDLE
+}
+
+int faiss_IndexIVFPQ_new_with(FaissIndexIVFPQ** p_index,
+    FaissIndex* quantizer, size_t d, size_t nlist, size_t M,
+    size_t nbits_per_idx, FaissMetricType metric)
+{
+    try {
+        auto q = reinterpret_cast<Index*>(quantizer);
+        *p_index = reinterpret_cast<FaissIndexIVFPQ*>(
+            new IndexIVFPQ(q, d, nlist, M, nbits_per_idx,
+                           static_cast<MetricType>(metric)));
+    } CATCH_AND_HANDLE
+}
+
+int faiss_IndexIVFPQ_precompute_table(FaissIndexIVFPQ* index) {
+    try {
+        reinterpret_cast<IndexIVFPQ*>(index)->precompute_table();
+    } CATCH_AND_HANDLE
+}
+
+void faiss_SearchParametersIVFPQ_free(FaissSearchParametersIVFPQ* obj) {
+    delete reinterpret_cast<IVFPQSearchParameters*>(obj);
+}
+
+int faiss_SearchParametersIVFPQ_new(FaissSearchParametersIVFPQ** p_params,
+    const FaissIDSelector* sel, size_t nprobe, size_t max_codes,
+    size_t scan_table_threshold, int polysemous_ht)
+{
+    try {
+        auto params = new IVFPQSearchParameters();
+        params->sel = reinterpret_cast<const faiss::IDSelector*>(sel);
+        params->nprobe = nprobe;
+        params->max_codes = max_codes;
+        params->scan_table_threshold = scan_table_threshold;
+        params->polysemous_ht = polysemous_ht;
+        *p_params = reinterpret_cast<FaissSearchParametersIVFPQ*>(params);
+    } CATCH_AND_HANDLE
+}
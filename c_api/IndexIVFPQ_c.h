@@ -0,0 +1,61 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c -*-
+
+#ifndef FAISS_INDEX_IVF_PQ_C_H
+#define FAISS_INDEX_IVF_PQ_C_H
+
+#include "faiss_c.h"
+#include "Index_c.h"
+#include "IndexIVF_c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Inverted file with Product Quantizer encoding. Each residual
+ * vector is encoded as a product quantizer code.
+ */
+FAISS_DECLARE_CLASS_INHERITED(IndexIVFPQ, Index)
+FAISS_DECLARE_DESTRUCTOR(IndexIVFPQ)
+FAISS_DECLARE_INDEX_DOWNCAST(IndexIVFPQ)
+
+int faiss_IndexIVFPQ_new(FaissIndexIVFPQ** p_index);
+
+/**
+ * @param M              number of subquantizers
+ * @param nbits_per_idx  number of bit per subvector index
+ */
+int faiss_IndexIVFPQ_new_with(FaissIndexIVFPQ** p_index,
+    FaissIndex* quantizer, size_t d, size_t nlist, size_t M,
+    size_t nbits_per_idx, FaissMetricType metric);
+
+/// use table computation or on-the-fly?
+FAISS_DECLARE_GETTER_SETTER(IndexIVFPQ, size_t, scan_table_threshold)
+/// Hamming threshold for polysemous filtering
+FAISS_DECLARE_GETTER_SETTER(IndexIVFPQ, int, polysemous_ht)
+/// precomputed tables mode, see IndexIVFPQ::use_precomputed_table
+FAISS_DECLARE_GETTER_SETTER(IndexIVFPQ, int, use_precomputed_table)
+
+/// build the precomputed tables, after changing use_precomputed_table
+int faiss_IndexIVFPQ_precompute_table(FaissIndexIVFPQ* index);
+
+/** Search parameters of an IVFPQ index: the IVF parameters, and the
+ * polysemous filtering and table computation thresholds */
+FAISS_DECLARE_CLASS_INHERITED(SearchParametersIVFPQ, SearchParameters)
+FAISS_DECLARE_DESTRUCTOR(SearchParametersIVFPQ)
+
+int faiss_SearchParametersIVFPQ_new(FaissSearchParametersIVFPQ** p_params,
+    const FaissIDSelector* sel, size_t nprobe, size_t max_codes,
+    size_t scan_table_threshold, int polysemous_ht);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
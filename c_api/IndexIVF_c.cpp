@@ -24,6 +24,7 @@ DEFINE_INDEX_DOWNCAST(IndexIVF)
 DEFINE_GETTER(IndexIVF, size_t, nlist)
 /// number of probes at query time
 DEFINE_GETTER(IndexIVF, size_t, nprobe)
+DEFINE_SETTER(IndexIVF, size_t, nprobe)
 /// quantizer that maps vectors to inverted lists
 DEFINE_GETTER_PERMISSIVE(IndexIVF, FaissIndex*, quantizer)
 
@@ -94,6 +95,51 @@ void faiss_IndexIVF_invlists_get_ids (const FaissIndexIVF* index, size_t list_no
     memcpy(invlist, list, list_size*sizeof(idx_t));
 }
 
+void faiss_SearchParametersIVF_free(FaissSearchParametersIVF* obj) {
+    delete reinterpret_cast<faiss::IVFSearchParameters*>(obj);
+}
+
+int faiss_SearchParametersIVF_new(FaissSearchParametersIVF** p_params,
+    const FaissIDSelector* sel, size_t nprobe, size_t max_codes) {
+    try {
+        auto params = new faiss::IVFSearchParameters();
+        params->sel = reinterpret_cast<const faiss::IDSelector*>(sel);
+        params->nprobe = nprobe;
+        params->max_codes = max_codes;
+        *p_params = reinterpret_cast<FaissSearchParametersIVF*>(params);
+    } CATCH_AND_HANDLE
+}
+
+size_t faiss_SearchParametersIVF_nprobe(const FaissSearchParametersIVF* obj) {
+    return reinterpret_cast<const faiss::IVFSearchParameters*>(obj)->nprobe;
+}
+
+void faiss_SearchParametersIVF_set_nprobe(FaissSearchParametersIVF* obj,
+    size_t val) {
+    reinterpret_cast<faiss::IVFSearchParameters*>(obj)->nprobe = val;
+}
+
+size_t faiss_SearchParametersIVF_max_codes(const FaissSearchParametersIVF* obj) {
+    return reinterpret_cast<const faiss::IVFSearchParameters*>(obj)->max_codes;
+}
+
+void faiss_SearchParametersIVF_set_max_codes(FaissSearchParametersIVF* obj,
+    size_t val) {
+    reinterpret_cast<faiss::IVFSearchParameters*>(obj)->max_codes = val;
+}
+
+DEFINE_DESTRUCTOR(InvertedLists)
+
+DEFINE_GETTER_PERMISSIVE(IndexIVF, FaissInvertedLists*, invlists)
+
+int faiss_IndexIVF_replace_invlists(FaissIndexIVF* index,
+    FaissInvertedLists* il, int own) {
+    try {
+        reinterpret_cast<IndexIVF*>(index)->replace_invlists(
+            reinterpret_cast<faiss::InvertedLists*>(il), own);
+    } CATCH_AND_HANDLE
+}
+
 void faiss_IndexIVFStats_reset(FaissIndexIVFStats* stats) {
     reinterpret_cast<IndexIVFStats*>(stats)->reset();    
 }
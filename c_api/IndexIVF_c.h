@@ -43,7 +43,7 @@ FAISS_DECLARE_INDEX_DOWNCAST(IndexIVF)
 /// number of possible key values
 FAISS_DECLARE_GETTER(IndexIVF, size_t, nlist)
 /// number of probes at query time
-FAISS_DECLARE_GETTER(IndexIVF, size_t, nprobe)
+FAISS_DECLARE_GETTER_SETTER(IndexIVF, size_t, nprobe)
 /// quantizer that maps vectors to inverted lists
 FAISS_DECLARE_GETTER(IndexIVF, FaissIndex*, quantizer)
 /**
@@ -122,6 +122,36 @@ void faiss_IndexIVF_print_stats (const FaissIndexIVF* index);
 /// @see faiss_IndexIVF_get_list_size(size_t) 
 void faiss_IndexIVF_invlists_get_ids (const FaissIndexIVF* index, size_t list_no, idx_t* invlist);
 
+/** Search parameters of an IVF index, they override its nprobe and
+ * max_codes for one search call (see faiss_Index_search_with_params) */
+FAISS_DECLARE_CLASS_INHERITED(SearchParametersIVF, SearchParameters)
+FAISS_DECLARE_DESTRUCTOR(SearchParametersIVF)
+
+/**
+ * @param sel        if non-null, only these ids are considered (not owned)
+ * @param nprobe     number of probes at query time
+ * @param max_codes  max nb of codes to visit per query (0 = no limit)
+ */
+int faiss_SearchParametersIVF_new(FaissSearchParametersIVF** p_params,
+    const FaissIDSelector* sel, size_t nprobe, size_t max_codes);
+
+FAISS_DECLARE_GETTER_SETTER(SearchParametersIVF, size_t, nprobe)
+FAISS_DECLARE_GETTER_SETTER(SearchParametersIVF, size_t, max_codes)
+
+/// Opaque type for the inverted lists of an IVF index
+FAISS_DECLARE_CLASS(InvertedLists)
+FAISS_DECLARE_DESTRUCTOR(InvertedLists)
+
+/// inverted lists of the index (owned by the index)
+FAISS_DECLARE_GETTER(IndexIVF, FaissInvertedLists*, invlists)
+
+/** replace the inverted lists of the index, eg. by on-disk lists
+ *
+ * @param own  if true, the index takes ownership of il
+ */
+int faiss_IndexIVF_replace_invlists(FaissIndexIVF* index,
+    FaissInvertedLists* il, int own);
+
 typedef struct FaissIndexIVFStats {
     size_t nq;       // nb of queries run
     size_t nlist;    // nb of inverted lists scanned
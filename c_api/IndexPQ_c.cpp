@@ -0,0 +1,36 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include "IndexPQ_c.h"
+#include "IndexPQ.h"
+#include "macros_impl.h"
+
+using faiss::IndexPQ;
+using faiss::MetricType;
+
+DEFINE_DESTRUCTOR(IndexPQ)
+DEFINE_INDEX_DOWNCAST(IndexPQ)
+
+DEFINE_GETTER(IndexPQ, int, polysemous_ht)
+DEFINE_SETTER(IndexPQ, int, polysemous_ht)
+
+int faiss_IndexPQ_new(FaissIndexPQ** p_index) {
+    try {
+        *p_index = reinterpret_cast<FaissIndexPQ*>(new IndexPQ());
+    } CATCH_AND_HANDLE
+}
+
+int faiss_IndexPQ_new_with(FaissIndexPQ** p_index,
+    int d, size_t M, size_t nbits, FaissMetricType metric)
+{
+    try {
+        *p_index = reinterpret_cast<FaissIndexPQ*>(
+            new IndexPQ(d, M, nbits, static_cast<MetricType>(metric)));
+    } CATCH_AND_HANDLE
+}
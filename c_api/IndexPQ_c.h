@@ -0,0 +1,42 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c -*-
+
+#ifndef FAISS_INDEX_PQ_C_H
+#define FAISS_INDEX_PQ_C_H
+
+#include "faiss_c.h"
+#include "Index_c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Index based on a product quantizer. Stored vectors are
+ * approximated by PQ codes. */
+FAISS_DECLARE_CLASS_INHERITED(IndexPQ, Index)
+FAISS_DECLARE_DESTRUCTOR(IndexPQ)
+FAISS_DECLARE_INDEX_DOWNCAST(IndexPQ)
+
+int faiss_IndexPQ_new(FaissIndexPQ** p_index);
+
+/**
+ * @param M      number of subquantizers
+ * @param nbits  number of bit per subvector index
+ */
+int faiss_IndexPQ_new_with(FaissIndexPQ** p_index,
+    int d, size_t M, size_t nbits, FaissMetricType metric);
+
+/// Hamming threshold used for polysemous search
+FAISS_DECLARE_GETTER_SETTER(IndexPQ, int, polysemous_ht)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
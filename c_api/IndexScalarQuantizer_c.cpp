@@ -0,0 +1,71 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include "IndexScalarQuantizer_c.h"
+#include "IndexScalarQuantizer.h"
+#include "macros_impl.h"
+
+using faiss::Index;
+using faiss::IndexScalarQuantizer;
+using faiss::IndexIVFScalarQuantizer;
+using faiss::MetricType;
+using faiss::ScalarQuantizer;
+
+DEFINE_DESTRUCTOR(IndexScalarQuantizer)
+DEFINE_INDEX_DOWNCAST(IndexScalarQuantizer)
+
+int faiss_IndexScalarQuantizer_new(FaissIndexScalarQuantizer** p_index) {
+    try {
+        *p_index = reinterpret_cast<FaissIndexScalarQuantizer*>(
+            new IndexScalarQuantizer());
+    } CATCH_AND_HANDLE
+}
+
+int faiss_IndexScalarQuantizer_new_with(FaissIndexScalarQuantizer** p_index,
+    idx_t d, FaissQuantizerType qt, FaissMetricType metric)
+{
+    try {
+        *p_index = reinterpret_cast<FaissIndexScalarQuantizer*>(
+            new IndexScalarQuantizer(
+                d, static_cast<ScalarQuantizer::QuantizerType>(qt),
+                static_cast<MetricType>(metric)));
+    } CATCH_AND_HANDLE
+}
+
+size_t faiss_IndexScalarQuantizer_code_size(
+    const FaissIndexScalarQuantizer* index)
+{
+    return reinterpret_cast<const IndexScalarQuantizer*>(index)->code_size;
+}
+
+DEFINE_DESTRUCTOR(IndexIVFScalarQuantizer)
+DEFINE_INDEX_DOWNCAST(IndexIVFScalarQuantizer)
+
+DEFINE_GETTER(IndexIVFScalarQuantizer, int, by_residual)
+
+int faiss_IndexIVFScalarQuantizer_new(FaissIndexIVFScalarQuantizer** p_index) {
+    try {
+        *p_index = reinterpret_cast<FaissIndexIVFScalarQuantizer*>(
+            new IndexIVFScalarQuantizer());
+    } CATCH_AND_HANDLE
+}
+
+int faiss_IndexIVFScalarQuantizer_new_with(
+    FaissIndexIVFScalarQuantizer** p_index, FaissIndex* quantizer,
+    size_t d, size_t nlist, FaissQuantizerType qt, FaissMetricType metric,
+    int encode_residual)
+{
+    try {
+        auto q = reinterpret_cast<Index*>(quantizer);
+        *p_index = reinterpret_cast<FaissIndexIVFScalarQuantizer*>(
+            new IndexIVFScalarQuantizer(
+                q, d, nlist, static_cast<ScalarQuantizer::QuantizerType>(qt),
+                static_cast<MetricType>(metric), encode_residual != 0));
+    } CATCH_AND_HANDLE
+}
@@ -0,0 +1,72 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c -*-
+
+#ifndef FAISS_INDEX_SCALAR_QUANTIZER_C_H
+#define FAISS_INDEX_SCALAR_QUANTIZER_C_H
+
+#include "faiss_c.h"
+#include "Index_c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// type of the scalar quantizer, see ScalarQuantizer::QuantizerType
+typedef enum FaissQuantizerType {
+    QT_8bit,             ///< 8 bits per component
+    QT_4bit,             ///< 4 bits per component
+    QT_8bit_uniform,     ///< same, shared range for all dimensions
+    QT_4bit_uniform,
+    QT_fp16,
+    QT_8bit_direct,      ///< fast indexing of uint8s
+    QT_6bit,             ///< 6 bits per component
+    QT_4bit_lloyd,       ///< 4 bits per component, 1D k-means codebooks
+    QT_3bit_vbits,       ///< 3 bits per component on average
+    QT_4bit_vbits,       ///< 4 bits per component on average
+    QT_8bit_direct_signed, ///< fast indexing of int8s
+} FaissQuantizerType;
+
+/** Flat index built on a scalar quantizer. */
+FAISS_DECLARE_CLASS_INHERITED(IndexScalarQuantizer, Index)
+FAISS_DECLARE_DESTRUCTOR(IndexScalarQuantizer)
+FAISS_DECLARE_INDEX_DOWNCAST(IndexScalarQuantizer)
+
+int faiss_IndexScalarQuantizer_new(FaissIndexScalarQuantizer** p_index);
+
+int faiss_IndexScalarQuantizer_new_with(FaissIndexScalarQuantizer** p_index,
+    idx_t d, FaissQuantizerType qt, FaissMetricType metric);
+
+/// size of the code of a vector in bytes
+size_t faiss_IndexScalarQuantizer_code_size(
+    const FaissIndexScalarQuantizer* index);
+
+/** An IVF implementation where the components of the residuals are
+ * encoded with a scalar quantizer. */
+FAISS_DECLARE_CLASS_INHERITED(IndexIVFScalarQuantizer, Index)
+FAISS_DECLARE_DESTRUCTOR(IndexIVFScalarQuantizer)
+FAISS_DECLARE_INDEX_DOWNCAST(IndexIVFScalarQuantizer)
+
+int faiss_IndexIVFScalarQuantizer_new(FaissIndexIVFScalarQuantizer** p_index);
+
+/**
+ * @param encode_residual  encode the residual w.r.t. the centroid
+ *                         rather than the vector itself
+ */
+int faiss_IndexIVFScalarQuantizer_new_with(
+    FaissIndexIVFScalarQuantizer** p_index, FaissIndex* quantizer,
+    size_t d, size_t nlist, FaissQuantizerType qt, FaissMetricType metric,
+    int encode_residual);
+
+FAISS_DECLARE_GETTER(IndexIVFScalarQuantizer, int, by_residual)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -10,10 +10,22 @@
 
 #include "Index_c.h"
 #include "Index.h"
+#include "utils/vector_view.h"
 #include "macros_impl.h"
 
 extern "C" {
 
+DEFINE_DESTRUCTOR(SearchParameters)
+
+int faiss_SearchParameters_new(FaissSearchParameters** p_params,
+                               const FaissIDSelector* sel) {
+    try {
+        auto params = new faiss::SearchParameters();
+        params->sel = reinterpret_cast<const faiss::IDSelector*>(sel);
+        *p_params = reinterpret_cast<FaissSearchParameters*>(params);
+    } CATCH_AND_HANDLE
+}
+
 DEFINE_DESTRUCTOR(Index)
 
 DEFINE_GETTER(Index, int, d)
@@ -49,6 +61,41 @@ int faiss_Index_search(const FaissIndex* index, idx_t n, const float* x, idx_t k
     } CATCH_AND_HANDLE
 }
 
+int faiss_Index_search_with_params(const FaissIndex* index, idx_t n,
+                                   const float* x, idx_t k,
+                                   const FaissSearchParameters* params,
+                                   float* distances, idx_t* labels) {
+    try {
+        reinterpret_cast<const faiss::Index*>(index)->search(
+            n, x, k, distances, labels,
+            reinterpret_cast<const faiss::SearchParameters*>(params));
+    } CATCH_AND_HANDLE
+}
+
+int faiss_Index_add_view(FaissIndex* index, FaissVectorElementType type,
+                         const void* x, idx_t n, size_t stride) {
+    try {
+        auto idx = reinterpret_cast<faiss::Index*>(index);
+        faiss::VectorArrayView view(
+            static_cast<faiss::VectorElementType>(type), x, n, idx->d, stride);
+        idx->add_view(view);
+    } CATCH_AND_HANDLE
+}
+
+int faiss_Index_search_view(const FaissIndex* index,
+                            FaissVectorElementType type, const void* x,
+                            idx_t n, size_t stride, idx_t k,
+                            const FaissSearchParameters* params,
+                            float* distances, idx_t* labels) {
+    try {
+        auto idx = reinterpret_cast<const faiss::Index*>(index);
+        faiss::VectorArrayView view(
+            static_cast<faiss::VectorElementType>(type), x, n, idx->d, stride);
+        idx->search_view(view, k, distances, labels,
+            reinterpret_cast<const faiss::SearchParameters*>(params));
+    } CATCH_AND_HANDLE
+}
+
 int faiss_Index_range_search(const FaissIndex* index, idx_t n, const float* x, float radius,
                              FaissRangeSearchResult* result) {
     try {
@@ -38,6 +38,33 @@ typedef enum FaissMetricType {
     METRIC_JensenShannon,    
 } FaissMetricType;
 
+/** Parent class of the optional search parameters, that override the
+ * fields of the index for one search call only. The sub-classes (eg.
+ * SearchParametersIVF, SearchParametersHNSW) can be passed where a
+ * FaissSearchParameters is expected.
+ */
+FAISS_DECLARE_CLASS(SearchParameters)
+FAISS_DECLARE_DESTRUCTOR(SearchParameters)
+
+/** Create search parameters that only restrict the search to a subset
+ * of ids.
+ *
+ * @param sel  if non-null, only these ids are considered (not owned,
+ *             only supported by some indexes)
+ */
+int faiss_SearchParameters_new(FaissSearchParameters** p_params,
+                               const FaissIDSelector* sel);
+
+/// element type of the vectors passed to faiss_Index_add_view and
+/// faiss_Index_search_view
+typedef enum FaissVectorElementType {
+    VET_float32 = 0,
+    VET_float16,     ///< IEEE half precision
+    VET_bfloat16,
+    VET_uint8,
+    VET_int8,
+} FaissVectorElementType;
+
 /// Opaque type for referencing to an index object
 FAISS_DECLARE_CLASS(Index)
 FAISS_DECLARE_DESTRUCTOR(Index)
@@ -95,6 +122,42 @@ int faiss_Index_add_with_ids(FaissIndex* index, idx_t n, const float* x, const i
 int faiss_Index_search(const FaissIndex* index, idx_t n, const float* x, idx_t k,
                        float* distances, idx_t* labels);
 
+/** Same as faiss_Index_search, with search parameters that override the
+ * fields of the index (nprobe, efSearch, ...) for this call only. The
+ * same index can then be searched concurrently with different
+ * parameters.
+ *
+ * @param params      search parameters, of a type that matches the index
+ *                    (may be NULL)
+ */
+int faiss_Index_search_with_params(const FaissIndex* index, idx_t n,
+                                   const float* x, idx_t k,
+                                   const FaissSearchParameters* params,
+                                   float* distances, idx_t* labels);
+
+/** Add n vectors stored with any element type and with a stride
+ * between them. They are converted to float by blocks, without a full
+ * copy of the input.
+ *
+ * @param x       first element of the first vector
+ * @param stride  nb of elements between the starts of 2 vectors (0 = d)
+ */
+int faiss_Index_add_view(FaissIndex* index, FaissVectorElementType type,
+                         const void* x, idx_t n, size_t stride);
+
+/** Search n query vectors stored with any element type and stride, see
+ * faiss_Index_add_view. The outputs are pre-allocated by the caller.
+ *
+ * @param params      search parameters (may be NULL)
+ * @param distances   output distances, size n*k
+ * @param labels      output labels of the NNs, size n*k
+ */
+int faiss_Index_search_view(const FaissIndex* index,
+                            FaissVectorElementType type, const void* x,
+                            idx_t n, size_t stride, idx_t k,
+                            const FaissSearchParameters* params,
+                            float* distances, idx_t* labels);
+
 /** query n vectors of dimension d to the index.
  *
  * return all vectors with distance < radius. Note that many
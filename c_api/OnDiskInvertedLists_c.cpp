@@ -0,0 +1,38 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include "OnDiskInvertedLists_c.h"
+#include "OnDiskInvertedLists.h"
+#include "macros_impl.h"
+
+using faiss::InvertedLists;
+using faiss::OnDiskInvertedLists;
+
+DEFINE_DESTRUCTOR(OnDiskInvertedLists)
+
+int faiss_OnDiskInvertedLists_new(FaissOnDiskInvertedLists** p_il,
+    size_t nlist, size_t code_size, const char* filename)
+{
+    try {
+        *p_il = reinterpret_cast<FaissOnDiskInvertedLists*>(
+            new OnDiskInvertedLists(nlist, code_size, filename));
+    } CATCH_AND_HANDLE
+}
+
+int faiss_OnDiskInvertedLists_merge_from(FaissOnDiskInvertedLists* il,
+    const FaissInvertedLists** ils, int n_il, size_t* p_ntotal)
+{
+    try {
+        size_t ntotal = reinterpret_cast<OnDiskInvertedLists*>(il)->merge_from(
+            reinterpret_cast<const InvertedLists**>(ils), n_il);
+        if (p_ntotal) {
+            *p_ntotal = ntotal;
+        }
+    } CATCH_AND_HANDLE
+}
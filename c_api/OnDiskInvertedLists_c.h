@@ -0,0 +1,46 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c -*-
+
+#ifndef FAISS_ON_DISK_INVERTED_LISTS_C_H
+#define FAISS_ON_DISK_INVERTED_LISTS_C_H
+
+#include "faiss_c.h"
+#include "IndexIVF_c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** On-disk storage of inverted lists, in a memory-mapped file. Attach
+ * it to an index with faiss_IndexIVF_replace_invlists. When an index
+ * written with on-disk lists is read back, the lists are mapped from
+ * their file (use FAISS_IO_FLAG_ONDISK_SAME_DIR if it was moved along
+ * with the index file). FAISS_IO_FLAG_MMAP is for indexes whose lists
+ * are stored in the index file.
+ */
+FAISS_DECLARE_CLASS_INHERITED(OnDiskInvertedLists, InvertedLists)
+FAISS_DECLARE_DESTRUCTOR(OnDiskInvertedLists)
+
+int faiss_OnDiskInvertedLists_new(FaissOnDiskInvertedLists** p_il,
+    size_t nlist, size_t code_size, const char* filename);
+
+/** merge the inverted lists of several IVF indexes into this one, that
+ * must be empty
+ *
+ * @param ils   the inverted lists to merge, size n_il
+ * @return      total size of the merged lists in *p_ntotal
+ */
+int faiss_OnDiskInvertedLists_merge_from(FaissOnDiskInvertedLists* il,
+    const FaissInvertedLists** ils, int n_il, size_t* p_ntotal);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
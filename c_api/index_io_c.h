@@ -31,8 +31,15 @@ int faiss_write_index(const FaissIndex *idx, FILE *f);
  */
 int faiss_write_index_fname(const FaissIndex *idx, const char *fname);
 
-#define FAISS_IO_FLAG_MMAP 1
+// same values as the IO_FLAG_* of index_io.h
 #define FAISS_IO_FLAG_READ_ONLY 2
+/// strip directory component from ondisk filename, and assume it's in
+/// the same directory as the index file
+#define FAISS_IO_FLAG_ONDISK_SAME_DIR 4
+/// don't load IVF data to RAM, only list sizes
+#define FAISS_IO_FLAG_SKIP_IVF_DATA 8
+/// memory-map the inverted lists and the codes instead of reading them
+#define FAISS_IO_FLAG_MMAP (FAISS_IO_FLAG_SKIP_IVF_DATA | 0x646f0000)
 
 /** Read index from a file.
  * This is equivalent to `faiss:read_index` when a file descriptor is given.
@@ -23,7 +23,7 @@ def swig_ptr_from_HalfTensor(x):
     assert x.dtype == torch.float16
     # no canonical half type in C/C++
     return faiss.cast_integer_to_void_ptr(
-        x.storage().data_ptr() + x.storage_offset() * 4)
+        x.storage().data_ptr() + x.storage_offset() * 2)
 
 def swig_ptr_from_FloatTensor(x):
     """ gets a Faiss SWIG pointer from a pytorch tensor (on CPU or GPU) """
@@ -37,7 +37,7 @@ def swig_ptr_from_IntTensor(x):
     assert x.is_contiguous()
     assert x.dtype == torch.int32, 'dtype=%s' % x.dtype
     return faiss.cast_integer_to_int_ptr(
-        x.storage().data_ptr() + x.storage_offset() * 8)
+        x.storage().data_ptr() + x.storage_offset() * 4)
 
 def swig_ptr_from_IndicesTensor(x):
     """ gets a Faiss SWIG pointer from a pytorch tensor (on CPU or GPU) """
@@ -46,6 +46,44 @@ def swig_ptr_from_IndicesTensor(x):
     return faiss.cast_integer_to_idx_t_ptr(
         x.storage().data_ptr() + x.storage_offset() * 8)
 
+# element types of faiss/utils/vector_view.h
+torch_vector_view_types = {
+    torch.float32: faiss.VET_float32,
+    torch.float16: faiss.VET_float16,
+    torch.bfloat16: faiss.VET_bfloat16,
+    torch.uint8: faiss.VET_uint8,
+    torch.int8: faiss.VET_int8,
+}
+
+def vector_array_view_from_tensor(x):
+    """ gets a VectorArrayView on the rows of a 2D pytorch tensor on CPU,
+    without copy. Returns None if the dtype or strides are not supported """
+    if x.is_cuda or x.dim() != 2 or x.dtype not in torch_vector_view_types:
+        return None
+    n, d = x.shape
+    if d > 1 and x.stride(1) != 1:
+        return None
+    if n > 1 and x.stride(0) < d:
+        return None
+    stride = x.stride(0) if n > 1 else d
+    return faiss.VectorArrayView(
+        torch_vector_view_types[x.dtype],
+        faiss.cast_integer_to_void_ptr(x.data_ptr()), n, d, stride)
+
+def needs_vector_view(x):
+    """ CPU tensors that are not contiguous float32 are read through a
+    VectorArrayView rather than copied """
+    return not x.is_cuda and not (
+        x.dtype == torch.float32 and x.is_contiguous())
+
+def gpu_float_tensor(x):
+    """ the GPU indexes read contiguous float32 vectors: CUDA tensors of
+    other dtypes or strides are converted on the device, without going
+    through host memory """
+    if x.is_cuda and not (x.dtype == torch.float32 and x.is_contiguous()):
+        return x.to(torch.float32).contiguous()
+    return x
+
 @contextlib.contextmanager
 def using_stream(res, pytorch_stream=None):
     """ Creates a scoping object to make Faiss GPU use the same stream
@@ -98,6 +136,15 @@ def handle_torch_Index(the_class):
         assert type(x) is torch.Tensor
         n, d = x.shape
         assert d == self.d
+
+        if needs_vector_view(x):
+            view = vector_array_view_from_tensor(x)
+            assert view is not None, 'unsupported tensor %s' % x.dtype
+            self.add_view(view)
+            return
+
+        x = gpu_float_tensor(x)
+
         x_ptr = swig_ptr_from_FloatTensor(x)
 
         if x.is_cuda:
@@ -118,6 +165,7 @@ def handle_torch_Index(the_class):
         assert type(x) is torch.Tensor
         n, d = x.shape
         assert d == self.d
+        x = gpu_float_tensor(x)
         x_ptr = swig_ptr_from_FloatTensor(x)
 
         assert type(ids) is torch.Tensor
@@ -191,7 +239,6 @@ def handle_torch_Index(the_class):
         assert type(x) is torch.Tensor
         n, d = x.shape
         assert d == self.d
-        x_ptr = swig_ptr_from_FloatTensor(x)
 
         if D is None:
             D = torch.empty(n, k, device=x.device, dtype=torch.float32)
@@ -207,6 +254,15 @@ def handle_torch_Index(the_class):
             assert I.shape == (n, k)
         I_ptr = swig_ptr_from_IndicesTensor(I)
 
+        if needs_vector_view(x):
+            view = vector_array_view_from_tensor(x)
+            assert view is not None, 'unsupported tensor %s' % x.dtype
+            self.search_view(view, k, D_ptr, I_ptr)
+            return D, I
+
+        x = gpu_float_tensor(x)
+        x_ptr = swig_ptr_from_FloatTensor(x)
+
         if x.is_cuda:
             assert hasattr(self, 'getDevice'), 'GPU tensor on CPU index not allowed'
 
@@ -358,8 +414,9 @@ def handle_torch_Index(the_class):
             # CPU torch
             self.update_vectors_c(n, keys_ptr, x_ptr)
 
-    # Until the GPU version is implemented, we do not support pre-allocated
-    # output buffers
+    # The size of the output is not known in advance, so there are no
+    # pre-allocated output buffers. The results are CPU tensors, also for
+    # GPU indexes (the RangeSearchResult is in host memory)
     def torch_replacement_range_search(self, x, thresh):
         if type(x) is np.ndarray:
             # Forward to faiss __init__.py base method
@@ -368,22 +425,26 @@ def handle_torch_Index(the_class):
         assert type(x) is torch.Tensor
         n, d = x.shape
         assert d == self.d
+        x = gpu_float_tensor(x)
         x_ptr = swig_ptr_from_FloatTensor(x)
 
-        assert not x.is_cuda, 'Range search using GPU tensor not yet implemented'
-        assert not hasattr(self, 'getDevice'), 'Range search on GPU index not yet implemented'
-
         res = faiss.RangeSearchResult(n)
-        self.range_search_c(n, x_ptr, thresh, res)
+        if hasattr(self, 'getDevice'):
+            # On the GPU, use proper stream ordering
+            with using_stream(self.getResources()):
+                self.range_search_c(n, x_ptr, thresh, res)
+        else:
+            assert not x.is_cuda, 'GPU tensor on CPU index not allowed'
+            self.range_search_c(n, x_ptr, thresh, res)
 
-        # get pointers and copy them
-        # FIXME: no rev_swig_ptr equivalent for torch.Tensor, just convert
-        # np to torch
+        # wrap the result arrays without copy, they keep res alive
         # NOTE: torch does not support np.uint64, just np.int64
-        lims = torch.from_numpy(faiss.rev_swig_ptr(res.lims, n + 1).copy().astype('int64'))
+        def wrap(ptr, size):
+            return faiss.array_with_owner(faiss.rev_swig_ptr(ptr, size), res)
+        lims = torch.from_numpy(wrap(res.lims, n + 1).view('int64'))
         nd = int(lims[-1])
-        D = torch.from_numpy(faiss.rev_swig_ptr(res.distances, nd).copy())
-        I = torch.from_numpy(faiss.rev_swig_ptr(res.labels, nd).copy())
+        D = torch.from_numpy(wrap(res.distances, nd))
+        I = torch.from_numpy(wrap(res.labels, nd))
 
         return lims, D, I
 
@@ -0,0 +1,140 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/AsyncSearchExecutor.h>
+
+#include <algorithm>
+#include <memory>
+
+#include <omp.h>
+
+#include <faiss/impl/FaissAssert.h>
+
+
+namespace faiss {
+
+
+AsyncSearchExecutor::AsyncSearchExecutor (const Index *index, int nworker,
+                                          int omp_threads_per_search):
+    index (index), n_running (0), stopping (false)
+{
+    FAISS_THROW_IF_NOT (nworker > 0);
+    int nt = omp_threads_per_search;
+    if (nt == 0) {
+        nt = std::max (1, omp_get_max_threads () / nworker);
+    }
+    for (int i = 0; i < nworker; i++) {
+        workers.emplace_back (&AsyncSearchExecutor::worker_loop, this, nt);
+    }
+}
+
+
+AsyncSearchExecutor::~AsyncSearchExecutor ()
+{
+    {
+        std::unique_lock<std::mutex> lock (mutex);
+        stopping = true;
+    }
+    cv_task.notify_all ();
+    for (std::thread & t: workers) {
+        t.join ();
+    }
+}
+
+
+void AsyncSearchExecutor::worker_loop (int omp_threads)
+{
+    // the OpenMP thread count is per calling thread
+    omp_set_num_threads (omp_threads);
+
+    std::unique_lock<std::mutex> lock (mutex);
+    for (;;) {
+        cv_task.wait (lock, [this] { return stopping || !queue.empty (); });
+        if (queue.empty ()) {
+            // stopping and all the tasks are done
+            return;
+        }
+        Task task = std::move (queue.front ());
+        queue.pop_front ();
+        n_running++;
+        lock.unlock ();
+
+        std::exception_ptr error;
+        try {
+            index->search (task.n, task.x, task.k,
+                           task.distances, task.labels, task.params);
+        } catch (...) {
+            error = std::current_exception ();
+        }
+        try {
+            task.callback (error);
+        } catch (...) {
+            // nowhere to report it
+        }
+
+        lock.lock ();
+        n_running--;
+        cv_done.notify_all ();
+    }
+}
+
+
+void AsyncSearchExecutor::search (
+        idx_t n, const float *x, idx_t k,
+        float *distances, idx_t *labels,
+        Callback callback,
+        const SearchParameters *params)
+{
+    FAISS_THROW_IF_NOT (callback);
+    {
+        std::unique_lock<std::mutex> lock (mutex);
+        FAISS_THROW_IF_NOT_MSG (!stopping, "executor is stopping");
+        queue.push_back (
+              Task {n, x, k, distances, labels, params, std::move (callback)});
+    }
+    cv_task.notify_one ();
+}
+
+
+std::future<void> AsyncSearchExecutor::search (
+        idx_t n, const float *x, idx_t k,
+        float *distances, idx_t *labels,
+        const SearchParameters *params)
+{
+    // std::function requires a copyable callable
+    auto promise = std::make_shared<std::promise<void>> ();
+    std::future<void> future = promise->get_future ();
+    search (n, x, k, distances, labels,
+            [promise] (std::exception_ptr error) {
+                if (error) {
+                    promise->set_exception (error);
+                } else {
+                    promise->set_value ();
+                }
+            },
+            params);
+    return future;
+}
+
+
+size_t AsyncSearchExecutor::n_pending ()
+{
+    std::unique_lock<std::mutex> lock (mutex);
+    return queue.size () + n_running;
+}
+
+
+void AsyncSearchExecutor::wait ()
+{
+    std::unique_lock<std::mutex> lock (mutex);
+    cv_done.wait (lock, [this] { return queue.empty () && n_running == 0; });
+}
+
+
+} // namespace faiss
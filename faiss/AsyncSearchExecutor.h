@@ -0,0 +1,104 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#ifndef FAISS_ASYNC_SEARCH_EXECUTOR_H
+#define FAISS_ASYNC_SEARCH_EXECUTOR_H
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <faiss/Index.h>
+
+
+namespace faiss {
+
+/** Non-blocking search front-end for an Index.
+ *
+ * The searches are queued and run in submission order by a fixed pool
+ * of worker threads, so that a server can have many requests in flight
+ * without dedicating a thread to each of them. Completion is signaled
+ * either with a std::future or with a callback, that is called from the
+ * worker thread (eg. to resume a coroutine or to post the response).
+ *
+ * The query vectors and result arrays must remain valid until the search
+ * completes. The index must not be modified while searches are pending
+ * (see the thread safety notes of Index).
+ */
+struct AsyncSearchExecutor {
+    typedef Index::idx_t idx_t;
+
+    /// called when a search completes, with a null exception_ptr if it
+    /// succeeded. It should not throw (exceptions are ignored).
+    typedef std::function<void (std::exception_ptr)> Callback;
+
+    const Index *index;
+
+    /** @param nworker   nb of searches that run concurrently
+     *  @param omp_threads_per_search  nb of OpenMP threads of each
+     *                   search (0 = omp_get_max_threads() / nworker)
+     */
+    explicit AsyncSearchExecutor (const Index *index, int nworker = 1,
+                                  int omp_threads_per_search = 0);
+
+    /// waits for the pending searches, then stops the workers
+    ~AsyncSearchExecutor ();
+
+    /// queue a search, the future becomes ready when it completes
+    std::future<void> search (
+            idx_t n, const float *x, idx_t k,
+            float *distances, idx_t *labels,
+            const SearchParameters *params = nullptr);
+
+    /// queue a search, the callback is called when it completes
+    void search (
+            idx_t n, const float *x, idx_t k,
+            float *distances, idx_t *labels,
+            Callback callback,
+            const SearchParameters *params = nullptr);
+
+    /// nb of searches queued or running
+    size_t n_pending ();
+
+    /// blocks until all the searches submitted so far have completed
+    void wait ();
+
+  private:
+    struct Task {
+        idx_t n;
+        const float *x;
+        idx_t k;
+        float *distances;
+        idx_t *labels;
+        const SearchParameters *params;
+        Callback callback;
+    };
+
+    void worker_loop (int omp_threads);
+
+    std::mutex mutex;
+    std::condition_variable cv_task;  ///< a task is queued or stopping
+    std::condition_variable cv_done;  ///< a task has completed
+
+    std::deque<Task> queue;
+    size_t n_running;
+    bool stopping;
+
+    std::vector<std::thread> workers;
+};
+
+
+} // namespace faiss
+
+#endif
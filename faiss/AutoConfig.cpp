@@ -0,0 +1,301 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/AutoConfig.h>
+
+#include <cctype>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <memory>
+
+#include <faiss/AutoTune.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexHNSW.h>
+#include <faiss/IndexIVF.h>
+#include <faiss/IndexPreTransform.h>
+#include <faiss/IVFlib.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/index_factory.h>
+
+namespace faiss {
+
+
+AutoConfigResult::AutoConfigResult ():
+    recall (0), latency (0), memory (0), feasible (false)
+{}
+
+
+AutoConfig::AutoConfig (int d, size_t ntotal, MetricType metric):
+    d (d), metric_type (metric), ntotal (ntotal),
+    memory_budget (0), latency_target (0), recall_target (0.9), R (1),
+    nq (200), verbose (0)
+{}
+
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+/// power of 2 closest to 4 sqrt(n), with at least 39 training points
+/// per centroid, 0 if n is too small for an IVF
+size_t default_nlist (size_t n)
+{
+    double target = 4 * sqrt (double (n));
+    size_t nlist = size_t (1) << std::min (int (round (log2 (target))), 16);
+    while (nlist > n / 39) {
+        nlist /= 2;
+    }
+    return nlist < 4 ? 0 : nlist;
+}
+
+/** replace the nb of lists of the IVF<nlist> of the key with nlist_sub
+ * if it is smaller. Returns the nlist of the key (0 if there is none) */
+size_t scale_ivf_key (const std::string & key, size_t nlist_sub,
+                      std::string & sub_key)
+{
+    sub_key = key;
+    size_t pos = 0;
+    while ((pos = key.find ("IVF", pos)) != std::string::npos) {
+        pos += 3;
+        if (pos < key.size() && isdigit (key[pos])) {
+            char *end;
+            size_t nlist = strtoul (key.c_str() + pos, &end, 10);
+            size_t len = end - (key.c_str() + pos);
+            if (nlist > nlist_sub) {
+                sub_key = key.substr (0, pos) + std::to_string (nlist_sub) +
+                    key.substr (pos + len);
+            }
+            return nlist;
+        }
+    }
+    return 0;
+}
+
+/// the search parameters of combination cno at full scale, with nprobe
+/// multiplied by nprobe_scale
+std::string scaled_combination (const ParameterSpace & ps, size_t cno,
+                                double nprobe_scale, size_t nlist_full,
+                                size_t *nprobe_sub)
+{
+    std::string name;
+    *nprobe_sub = 0;
+    char buf[100];
+    for (int i = 0; i < ps.parameter_ranges.size(); i++) {
+        const ParameterRange & pr = ps.parameter_ranges[i];
+        size_t j = cno % pr.values.size();
+        cno /= pr.values.size();
+        double val = pr.values[j];
+        if (pr.name == "nprobe") {
+            *nprobe_sub = size_t (val);
+            val = std::min (double (nlist_full),
+                            std::max (1.0, round (val * nprobe_scale)));
+        }
+        snprintf (buf, sizeof (buf), "%s%s=%g",
+                  i == 0 ? "" : ",", pr.name.c_str(), val);
+        name += buf;
+    }
+    return name;
+}
+
+const IndexHNSW *try_extract_index_hnsw (const Index *index)
+{
+    if (auto *pt = dynamic_cast<const IndexPreTransform*> (index)) {
+        index = pt->index;
+    }
+    return dynamic_cast<const IndexHNSW*> (index);
+}
+
+/// order of preference among the feasible configurations
+bool is_better (const AutoConfigResult & a, const AutoConfigResult & b)
+{
+    if (a.latency != b.latency) {
+        return a.latency < b.latency;
+    }
+    return a.memory < b.memory;
+}
+
+} // anonymous namespace
+
+
+std::vector<std::string> AutoConfig::default_candidates () const
+{
+    std::vector<std::string> keys;
+    keys.push_back ("Flat");
+    keys.push_back ("HNSW32");
+
+    size_t nlist = default_nlist (ntotal);
+    if (nlist == 0) {
+        return keys;
+    }
+    std::string ivf = "IVF" + std::to_string (nlist);
+    keys.push_back (ivf + ",Flat");
+    keys.push_back (ivf + ",SQ8");
+    for (int m : {d / 2, d / 4, d / 8}) {
+        if (m < 2 || m > 64 || d % m != 0) {
+            continue;
+        }
+        std::string pq = "PQ" + std::to_string (m);
+        keys.push_back (ivf + "," + pq);
+        keys.push_back ("O" + pq + "," + ivf + "," + pq);
+    }
+    return keys;
+}
+
+
+AutoConfigResult AutoConfig::configure (idx_t n, const float *x)
+{
+    FAISS_THROW_IF_NOT_FMT (n > nq, "need more than %zd sample vectors", nq);
+    FAISS_THROW_IF_NOT (ntotal > 0);
+
+    const float *xq = x;
+    size_t nb = n - nq;
+    const float *xb = x + nq * d;
+
+    // ground truth on the sample
+    std::vector<float> gt_D (nq);
+    std::vector<idx_t> gt_I (nq);
+    {
+        IndexFlat flat (d, metric_type);
+        flat.add (nb, xb);
+        flat.search (nq, xq, 1, gt_D.data(), gt_I.data());
+    }
+    OneRecallAtRCriterion crit (nq, R);
+    crit.set_groundtruth (1, gt_D.data(), gt_I.data());
+
+    std::vector<std::string> keys = candidates;
+    if (keys.empty()) {
+        keys = default_candidates ();
+    }
+    size_t nlist_sub = std::max (default_nlist (nb), size_t (1));
+
+    all_results.clear ();
+
+    for (const std::string & key : keys) {
+        std::string sub_key;
+        size_t nlist_full = scale_ivf_key (key, nlist_sub, sub_key);
+        size_t nlist = std::min (nlist_full, nlist_sub);
+
+        if (verbose) {
+            printf ("AutoConfig: evaluating %s on %zd vectors as %s\n",
+                    key.c_str(), nb, sub_key.c_str());
+        }
+
+        std::unique_ptr<Index> index;
+        size_t mem_trained, mem_added;
+        try {
+            index.reset (index_factory (d, sub_key.c_str(), metric_type));
+            index->train (nb, xb);
+            mem_trained = index->memory_usage ().total_size ();
+            index->add (nb, xb);
+            mem_added = index->memory_usage ().total_size ();
+        } catch (const FaissException & e) {
+            // eg. not enough training points for the sample
+            if (verbose) {
+                printf ("  skipped: %s\n", e.what());
+            }
+            continue;
+        }
+
+        size_t mem_per_vector = mem_added > mem_trained ?
+            (mem_added - mem_trained) / nb : 0;
+        size_t memory = mem_trained + mem_per_vector * ntotal;
+
+        const IndexIVF *ivf = ivflib::try_extract_index_ivf (index.get());
+        if (ivf) {
+            // the coarse centroids that are missing at this scale
+            memory += (nlist_full - nlist) * ivf->quantizer->d * sizeof (float);
+        }
+
+        ParameterSpace ps;
+        ps.verbose = std::max (verbose - 1, 0);
+        ps.initialize (index.get());
+        OperatingPoints ops;
+        ps.explore (index.get(), nq, xq, crit, &ops);
+
+        for (const OperatingPoint & op : ops.all_pts) {
+            AutoConfigResult res;
+            res.factory_key = key;
+            res.recall = op.perf;
+            res.memory = memory;
+
+            size_t nprobe_sub;
+            double nprobe_scale = ivf ? double (nlist_full) / nlist : 1.0;
+            res.search_params = scaled_combination (
+                  ps, op.cno, nprobe_scale, nlist_full, &nprobe_sub);
+
+            double scale;
+            if (ivf && nprobe_sub > 0) {
+                // nb of codes scanned + nb of centroids compared
+                double frac = double (nprobe_sub) / nlist;
+                scale = (frac * ntotal + nlist_full) / (frac * nb + nlist);
+            } else if (try_extract_index_hnsw (index.get())) {
+                scale = log (double (std::max (ntotal, size_t (2)))) /
+                    log (double (std::max (nb, size_t (2))));
+            } else {
+                scale = double (ntotal) / nb;
+            }
+            res.latency = op.t * 1e3 / nq * scale;
+
+            res.feasible = res.recall >= recall_target &&
+                (memory_budget == 0 || res.memory <= memory_budget) &&
+                (latency_target == 0 || res.latency <= latency_target);
+
+            if (verbose) {
+                printf ("  %s: recall=%.3f latency=%.3f ms memory=%zd%s\n",
+                        res.search_params.c_str(), res.recall, res.latency,
+                        res.memory, res.feasible ? " feasible" : "");
+            }
+            all_results.push_back (res);
+        }
+    }
+
+    FAISS_THROW_IF_NOT_MSG (!all_results.empty(),
+                            "AutoConfig: no candidate could be evaluated");
+
+    const AutoConfigResult *best = nullptr;
+    for (const AutoConfigResult & res : all_results) {
+        if (res.feasible && (!best || is_better (res, *best))) {
+            best = &res;
+        }
+    }
+    if (best) {
+        return *best;
+    }
+
+    // fallback: best recall within the memory budget, or smallest index
+    for (const AutoConfigResult & res : all_results) {
+        bool fits = memory_budget == 0 || res.memory <= memory_budget;
+        if (!best) {
+            best = &res;
+            continue;
+        }
+        bool best_fits = memory_budget == 0 || best->memory <= memory_budget;
+        if (fits != best_fits) {
+            if (fits) {
+                best = &res;
+            }
+        } else if (fits) {
+            if (res.recall > best->recall ||
+                (res.recall == best->recall && is_better (res, *best))) {
+                best = &res;
+            }
+        } else if (res.memory < best->memory) {
+            best = &res;
+        }
+    }
+    return *best;
+}
+
+
+} // namespace faiss
@@ -0,0 +1,100 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <faiss/Index.h>
+
+namespace faiss {
+
+
+/// an index configuration evaluated by AutoConfig
+struct AutoConfigResult {
+    /// index_factory key, at the scale of AutoConfig::ntotal
+    std::string factory_key;
+    /// for ParameterSpace::set_index_parameters on the full index
+    std::string search_params;
+    double recall;   ///< 1-recall@R measured on the sample
+    double latency;  ///< extrapolated search time per query (ms)
+    size_t memory;   ///< extrapolated memory usage for ntotal vectors (bytes)
+    bool feasible;   ///< whether the three targets are met
+
+    AutoConfigResult ();
+};
+
+
+/** Chooses an index_factory key and search parameters for a database of
+ * ntotal vectors from a sample of the data, a memory budget, a latency
+ * target and a recall target.
+ *
+ * Each candidate key is built on the sample, with the nb of inverted
+ * lists scaled down to the sample size (the IVF<nlist> of the key is
+ * replaced), and its operating points are measured with
+ * ParameterSpace::explore. The points are extrapolated to ntotal
+ * vectors:
+ *  - the memory is the memory_usage of the trained index plus the
+ *    memory per added vector times ntotal (plus the missing centroids
+ *    for IVF),
+ *  - for IVF, nprobe is scaled to keep the same fraction of lists
+ *    visited, and the time follows the nb of scanned codes and
+ *    centroids, for HNSW it grows with the log of the database size,
+ *    otherwise linearly.
+ *  - the recall is the one measured on the sample, that is optimistic
+ *    for a larger database.
+ *
+ * The extrapolation is rough: the result should be validated on the
+ * full dataset, but it avoids sweeping over all configurations at full
+ * scale.
+ */
+struct AutoConfig {
+    typedef Index::idx_t idx_t;
+
+    int d;
+    MetricType metric_type;
+
+    size_t ntotal;          ///< nb of vectors of the target database
+    size_t memory_budget;   ///< in bytes, 0 = no budget
+    double latency_target;  ///< in ms per query, 0 = no target
+    double recall_target;   ///< on the 1-recall@R
+    idx_t R;                ///< rank for the recall
+
+    /// nb of vectors of the sample used as queries, the others are the
+    /// training and database vectors
+    size_t nq;
+
+    /// keys to evaluate, filled in with default_candidates if empty
+    std::vector<std::string> candidates;
+
+    /// ParameterSpace verbosity is verbose - 1
+    int verbose;
+
+    /// all the operating points evaluated by the last configure
+    std::vector<AutoConfigResult> all_results;
+
+    AutoConfig (int d, size_t ntotal, MetricType metric = METRIC_L2);
+
+    /** Flat, HNSW32 and IVF<nlist> with Flat, SQ8, PQ and OPQ+PQ
+     * encodings, with nlist ~ 4 sqrt(ntotal) */
+    std::vector<std::string> default_candidates () const;
+
+    /** evaluate the candidates on a sample and return the feasible
+     * configuration with the lowest latency. If there is none, the one
+     * with the best recall within the memory budget is returned, with
+     * feasible = false.
+     *
+     * @param x  sample of the data, size n * d, n > nq
+     */
+    AutoConfigResult configure (idx_t n, const float *x);
+};
+
+
+} // namespace faiss
@@ -15,6 +15,11 @@
 
 #include <cinttypes>
 #include <cmath>
+#include <cstring>
+
+#include <algorithm>
+#include <map>
+#include <unordered_map>
 
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/utils/utils.h>
@@ -23,6 +28,7 @@
 #include <faiss/IndexFlat.h>
 #include <faiss/VectorTransform.h>
 #include <faiss/IndexPreTransform.h>
+#include <faiss/IndexRefine.h>
 #include <faiss/IndexLSH.h>
 #include <faiss/IndexPQ.h>
 #include <faiss/IndexIVF.h>
@@ -261,7 +267,7 @@ void OperatingPoints::display (bool only_optimal) const
 ParameterSpace::ParameterSpace ():
     verbose (1), n_experiments (500),
     batchsize (1<<30), thread_over_batches (false),
-    min_test_duration (0)
+    min_test_duration (0), use_cost_model (false), list_cost (10)
 {
 }
 
@@ -359,6 +365,13 @@ void ParameterSpace::initialize (const Index * index)
         }
         index = ix->base_index;
     }
+    if (DC (IndexRefine)) {
+        ParameterRange & pr = add_range("k_factor_rf");
+        for (int i = 0; i <= 6; i++) {
+            pr.values.push_back (1 << i);
+        }
+        index = ix->base_index;
+    }
     if (DC (IndexPreTransform)) {
         index = ix->index;
     }
@@ -497,6 +510,15 @@ void ParameterSpace::set_index_parameter (
         set_index_parameter (&ix->refine_index, name, val);
         return;
     }
+    if (DC (IndexRefine)) {
+        if (name == "k_factor_rf") {
+            ix->k_factor = int(val);
+            return;
+        }
+        // otherwise it is for the base index
+        set_index_parameter (ix->base_index, name, val);
+        return;
+    }
 
     if (name == "verbose") {
         index->verbose = int(val);
@@ -544,6 +566,24 @@ void ParameterSpace::set_index_parameter (
             return;
         }
     }
+    if (name == "early_stop_ratio") {
+        if (DC (IndexIVF)) {
+            ix->early_stop_ratio = val;
+            return;
+        }
+    }
+    if (name == "early_stop_stable") {
+        if (DC (IndexIVF)) {
+            ix->early_stop_stable = size_t(val);
+            return;
+        }
+    }
+    if (name == "prefetch_distance") {
+        if (DC (IndexIVF)) {
+            ix->prefetch_distance = size_t(val);
+            return;
+        }
+    }
 
     if (name == "efSearch") {
         if (DC (IndexHNSW)) {
@@ -596,6 +636,24 @@ void ParameterSpace::update_bounds (size_t cno, const OperatingPoint & op,
 
 
 
+namespace {
+
+void reset_search_stats ()
+{
+    indexIVF_stats.reset ();
+    hnsw_stats.reset ();
+}
+
+/// deterministic cost per query of the searches since reset_search_stats
+double search_cost (size_t nq, double list_cost)
+{
+    double cost = indexIVF_stats.ndis + hnsw_stats.ndis +
+        list_cost * indexIVF_stats.nlist;
+    return cost / nq;
+}
+
+} // anonymous namespace
+
 void ParameterSpace::explore (Index *index,
                               size_t nq, const float *xq,
                               const AutoTuneCriterion & crit,
@@ -613,9 +671,12 @@ void ParameterSpace::explore (Index *index,
             std::vector<Index::idx_t> I(nq * crit.nnn);
             std::vector<float> D(nq * crit.nnn);
 
+            reset_search_stats ();
             double t0 = getmillisecs ();
             index->search (nq, xq, crit.nnn, D.data(), I.data());
-            double t_search = (getmillisecs() - t0) / 1e3;
+            double t_search = use_cost_model ?
+                search_cost (nq, list_cost) :
+                (getmillisecs() - t0) / 1e3;
 
             double perf = crit.evaluate (D.data(), I.data());
 
@@ -668,6 +729,7 @@ void ParameterSpace::explore (Index *index,
         std::vector<Index::idx_t> I(nq * crit.nnn);
         std::vector<float> D(nq * crit.nnn);
 
+        reset_search_stats ();
         double t0 = getmillisecs ();
 
         int nrun = 0;
@@ -675,7 +737,7 @@ void ParameterSpace::explore (Index *index,
 
         do {
 
-            if (thread_over_batches) {
+            if (thread_over_batches && !use_cost_model) {
 #pragma omp parallel for
                 for (Index::idx_t q0 = 0; q0 < nq; q0 += batchsize) {
                     size_t q1 = q0 + batchsize;
@@ -698,9 +760,13 @@ void ParameterSpace::explore (Index *index,
             nrun ++;
             t_search = (getmillisecs() - t0) / 1e3;
 
-        } while (t_search < min_test_duration);
+        } while (!use_cost_model && t_search < min_test_duration);
 
-        t_search /= nrun;
+        if (use_cost_model) {
+            t_search = search_cost (nq, list_cost);
+        } else {
+            t_search /= nrun;
+        }
 
         double perf = crit.evaluate (D.data(), I.data());
 
@@ -714,6 +780,214 @@ void ParameterSpace::explore (Index *index,
 }
 
 
+/***************************************************************
+ * IndexIVFAdaptiveNprobe
+ ***************************************************************/
+
+
+IndexIVFAdaptiveNprobe::IndexIVFAdaptiveNprobe (
+        IndexIVF *index, size_t max_nprobe, int nbin):
+    Index (index->d, index->metric_type),
+    index (index), max_nprobe (max_nprobe), nfeat (10), nbin (nbin)
+{
+    FAISS_THROW_IF_NOT (nbin > 0 && max_nprobe > 0);
+    ntotal = index->ntotal;
+    is_trained = index->is_trained;
+}
+
+namespace {
+
+float nprobe_feature (const float *dis, size_t m)
+{
+    if (m < 2 || !std::isfinite (dis[1])) {
+        return 1.0;
+    }
+    while (!std::isfinite (dis[m - 1])) {
+        m--;
+    }
+    float g1 = std::fabs (dis[1] - dis[0]);
+    float gm = std::fabs (dis[m - 1] - dis[0]);
+    return gm > 0 ? g1 / gm : 1.0;
+}
+
+} // anonymous namespace
+
+void IndexIVFAdaptiveNprobe::predict_nprobe (
+        idx_t n, const float *coarse_dis, size_t ldd, size_t *nprobes) const
+{
+    FAISS_THROW_IF_NOT_MSG (bin_nprobe.size() == nbin,
+                            "predictor not trained");
+    size_t m = std::min (nfeat, ldd);
+    for (idx_t i = 0; i < n; i++) {
+        float f = nprobe_feature (coarse_dis + i * ldd, m);
+        size_t b = std::upper_bound (bin_bounds.begin(), bin_bounds.end(), f)
+            - bin_bounds.begin();
+        nprobes[i] = bin_nprobe[b];
+    }
+}
+
+void IndexIVFAdaptiveNprobe::train_predictor (
+        idx_t nq, const float *xq, const idx_t *gt_I, double target_recall)
+{
+    FAISS_THROW_IF_NOT (index->is_trained && nq > 0);
+    FAISS_THROW_IF_NOT (target_recall > 0 && target_recall <= 1);
+
+    size_t mp = std::min (max_nprobe, index->nlist);
+    size_t ldd = std::max (mp, std::min (nfeat, index->nlist));
+    std::vector<float> dis (nq * ldd);
+    std::vector<idx_t> keys (nq * ldd);
+    index->quantizer->search (nq, xq, ldd, dis.data(), keys.data());
+
+    // find the inverted list of each ground-truth vector
+    std::unordered_map<idx_t, idx_t> gt_list;
+    for (idx_t i = 0; i < nq; i++) {
+        gt_list[gt_I[i]] = -1;
+    }
+    const InvertedLists *invlists = index->invlists;
+    for (size_t l = 0; l < invlists->nlist; l++) {
+        size_t ls = invlists->list_size (l);
+        if (ls == 0) continue;
+        InvertedLists::ScopedIds ids (invlists, l);
+        for (size_t j = 0; j < ls; j++) {
+            auto it = gt_list.find (ids[j]);
+            if (it != gt_list.end()) {
+                it->second = l;
+            }
+        }
+    }
+
+    // nprobe needed by each query, mp + 1 if the NN is not reachable
+    std::vector<size_t> needed (nq, mp + 1);
+    std::vector<float> feat (nq);
+    for (idx_t i = 0; i < nq; i++) {
+        idx_t list_no = gt_list[gt_I[i]];
+        for (size_t r = 0; r < mp; r++) {
+            if (list_no >= 0 && keys[i * ldd + r] == list_no) {
+                needed[i] = r + 1;
+                break;
+            }
+        }
+        feat[i] = nprobe_feature (dis.data() + i * ldd,
+                                  std::min (nfeat, ldd));
+    }
+
+    std::vector<float> sorted_feat (feat);
+    std::sort (sorted_feat.begin(), sorted_feat.end());
+    bin_bounds.resize (nbin - 1);
+    for (int b = 0; b + 1 < nbin; b++) {
+        bin_bounds[b] = sorted_feat[(b + 1) * nq / nbin];
+    }
+
+    std::vector<std::vector<size_t> > bin_needed (nbin);
+    for (idx_t i = 0; i < nq; i++) {
+        size_t b = std::upper_bound (bin_bounds.begin(), bin_bounds.end(),
+                                     feat[i]) - bin_bounds.begin();
+        bin_needed[b].push_back (needed[i]);
+    }
+
+    bin_nprobe.resize (nbin);
+    for (int b = 0; b < nbin; b++) {
+        std::vector<size_t> & v = bin_needed[b];
+        if (v.empty()) {
+            bin_nprobe[b] = mp;
+            continue;
+        }
+        std::sort (v.begin(), v.end());
+        size_t rank = size_t (std::ceil (target_recall * v.size()));
+        rank = std::max (rank, size_t(1)) - 1;
+        bin_nprobe[b] = std::min (v[rank], mp);
+    }
+}
+
+void IndexIVFAdaptiveNprobe::train (idx_t n, const float *x)
+{
+    index->train (n, x);
+    is_trained = index->is_trained;
+}
+
+void IndexIVFAdaptiveNprobe::add (idx_t n, const float *x)
+{
+    index->add (n, x);
+    ntotal = index->ntotal;
+}
+
+void IndexIVFAdaptiveNprobe::reset ()
+{
+    index->reset ();
+    ntotal = index->ntotal;
+}
+
+void IndexIVFAdaptiveNprobe::search (
+        idx_t n, const float *x, idx_t k,
+        float *distances, idx_t *labels,
+        const SearchParameters *params_in) const
+{
+    IVFSearchParameters params;
+    params.max_codes = index->max_codes;
+    params.early_stop_ratio = index->early_stop_ratio;
+    params.early_stop_stable = index->early_stop_stable;
+    if (params_in) {
+        auto ivf_params = dynamic_cast<const IVFSearchParameters *>(params_in);
+        FAISS_THROW_IF_NOT_MSG (ivf_params,
+                                "IndexIVF params have incorrect type");
+        params = *ivf_params;
+    }
+    FAISS_THROW_IF_NOT_MSG (bin_nprobe.size() == nbin,
+                            "predictor not trained");
+
+    size_t np_max = *std::max_element (bin_nprobe.begin(), bin_nprobe.end());
+    size_t ldd = std::max (np_max, std::max (nfeat, size_t(2)));
+
+    std::vector<float> dis (n * ldd);
+    std::vector<idx_t> keys (n * ldd);
+    double t0 = getmillisecs();
+    index->quantizer->search (n, x, ldd, dis.data(), keys.data(),
+                              params.quantizer_params);
+    indexIVF_stats.quantization_time += getmillisecs() - t0;
+
+    std::vector<size_t> nprobes (n);
+    predict_nprobe (n, dis.data(), ldd, nprobes.data());
+
+    // group the queries by nprobe
+    std::map<size_t, std::vector<idx_t> > groups;
+    for (idx_t i = 0; i < n; i++) {
+        groups[nprobes[i]].push_back (i);
+    }
+
+    t0 = getmillisecs();
+    for (const auto & g : groups) {
+        size_t np = g.first;
+        const std::vector<idx_t> & qs = g.second;
+        size_t nsub = qs.size();
+
+        std::vector<float> xsub (nsub * d), dsub (nsub * np);
+        std::vector<idx_t> ksub (nsub * np);
+        for (size_t i = 0; i < nsub; i++) {
+            memcpy (xsub.data() + i * d, x + qs[i] * d, sizeof(float) * d);
+            memcpy (dsub.data() + i * np, dis.data() + qs[i] * ldd,
+                    sizeof(float) * np);
+            memcpy (ksub.data() + i * np, keys.data() + qs[i] * ldd,
+                    sizeof(idx_t) * np);
+        }
+
+        std::vector<float> D (nsub * k);
+        std::vector<idx_t> I (nsub * k);
+        params.nprobe = np;
+        index->invlists->prefetch_lists (ksub.data(), nsub * np);
+        index->search_preassigned (nsub, xsub.data(), k,
+                                   ksub.data(), dsub.data(),
+                                   D.data(), I.data(), false, &params);
+
+        for (size_t i = 0; i < nsub; i++) {
+            memcpy (distances + qs[i] * k, D.data() + i * k,
+                    sizeof(float) * k);
+            memcpy (labels + qs[i] * k, I.data() + i * k,
+                    sizeof(idx_t) * k);
+        }
+    }
+    indexIVF_stats.search_time += getmillisecs() - t0;
+}
+
 
 
 } // namespace faiss
@@ -153,6 +153,18 @@ struct ParameterSpace {
     /// duration (to avoid jittering in MT mode)
     double min_test_duration;
 
+    /** if true, the time of an operating point is replaced by a
+     * deterministic cost per query, computed from the search statistics:
+     * the nb of distances computed (indexIVF_stats.ndis +
+     * hnsw_stats.ndis) plus list_cost times the nb of inverted lists
+     * scanned. Each configuration is searched once (thread_over_batches
+     * and min_test_duration are ignored) and the operating points do not
+     * depend on the machine load. */
+    bool use_cost_model;
+
+    /// cost of visiting an inverted list, in distance computations
+    double list_cost;
+
     ParameterSpace ();
 
     /// nb of combinations, = product of values sizes
@@ -204,6 +216,63 @@ struct ParameterSpace {
 };
 
 
+struct IndexIVF;
+
+/** Wraps an IndexIVF and chooses the nprobe of each query with a
+ * predictor trained for a target recall.
+ *
+ * The feature of a query is the gap between its two nearest centroids,
+ * relative to the gap between the nearest and the nfeat-th nearest
+ * centroid: a query that is well inside a cluster needs fewer probes.
+ * The feature range is split in nbin quantile bins, and each bin gets
+ * the smallest nprobe such that a fraction target_recall of the
+ * training queries in the bin have their nearest neighbor in the
+ * probed lists.
+ *
+ * At search time, the coarse quantizer is searched once with the
+ * largest nprobe, and the queries are grouped by predicted nprobe to
+ * call search_preassigned.
+ */
+struct IndexIVFAdaptiveNprobe: Index {
+    IndexIVF *index;   ///< the wrapped index (not owned)
+    size_t max_nprobe; ///< largest nprobe considered in training
+    size_t nfeat;      ///< rank of the centroid used to normalize the gap
+    int nbin;          ///< nb of bins of the predictor
+
+    /// upper bounds of the bins, size nbin - 1
+    std::vector<float> bin_bounds;
+    /// nprobe for each bin, size nbin (empty = not trained)
+    std::vector<size_t> bin_nprobe;
+
+    explicit IndexIVFAdaptiveNprobe (IndexIVF *index,
+                                     size_t max_nprobe = 256,
+                                     int nbin = 16);
+
+    /** train the predictor
+     * @param xq     training queries, size nq * d
+     * @param gt_I   nearest neighbor of each query, size nq
+     */
+    void train_predictor (idx_t nq, const float *xq, const idx_t *gt_I,
+                          double target_recall);
+
+    /** predict the nprobes from the coarse distances
+     * @param coarse_dis  size n * max(nfeat, 2), sorted per query
+     * @param nprobes     output, size n
+     */
+    void predict_nprobe (idx_t n, const float *coarse_dis,
+                         size_t ldd, size_t *nprobes) const;
+
+    void train (idx_t n, const float *x) override;
+    void add (idx_t n, const float *x) override;
+    void reset () override;
+
+    /// params must be IVFSearchParameters or nullptr, its nprobe is ignored
+    void search (idx_t n, const float *x, idx_t k,
+                 float *distances, idx_t *labels,
+                 const SearchParameters *params = nullptr) const override;
+};
+
+
 
 } // namespace faiss
 
@@ -0,0 +1,94 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#ifndef FAISS_BLOCK_INVERTED_LISTS_H
+#define FAISS_BLOCK_INVERTED_LISTS_H
+
+#include <vector>
+
+#include <faiss/InvertedLists.h>
+#include <faiss/index_io.h>
+
+
+namespace faiss {
+
+/** Inverted lists that are organized by blocks.
+ *
+ * Different from the regular inverted lists, the codes are organized by
+ * blocks of size block_size bytes that represent a set of n_per_block
+ * vectors (eg. the interleaved layout of pq4_fast_scan.h). Therefore, code
+ * allocations are always rounded up to block_size bytes.
+ *
+ * To avoid misinterpretations, the code_size is set to INVALID_CODE_SIZE,
+ * even if arguably the amount of memory consumed by a code is
+ * block_size / n_per_block.
+ *
+ * The writing functions add_entries and update_entries operate on
+ * block-aligned data.
+ */
+struct BlockInvertedLists: InvertedLists {
+
+    size_t n_per_block;  ///< nb of vectors stored per block
+    size_t block_size;   ///< nb bytes per block
+
+    std::vector < std::vector<uint8_t> > codes;
+    std::vector < std::vector<idx_t> > ids;
+
+    BlockInvertedLists (size_t nlist, size_t n_per_block, size_t block_size);
+
+    BlockInvertedLists ();
+
+    size_t list_size(size_t list_no) const override;
+    const uint8_t * get_codes (size_t list_no) const override;
+    const idx_t * get_ids (size_t list_no) const override;
+
+    /// not supported: the codes are not stored contiguously
+    const uint8_t * get_single_code (
+                size_t list_no, size_t offset) const override;
+
+    /** append a set of entries. The codes are full blocks
+     * (n_entry is rounded up to n_per_block), so the list size before the
+     * call must be a multiple of n_per_block. */
+    size_t add_entries (
+           size_t list_no, size_t n_entry,
+           const idx_t* ids, const uint8_t *code) override;
+
+    /// not implemented
+    void update_entries (size_t list_no, size_t offset, size_t n_entry,
+                         const idx_t *ids, const uint8_t *code) override;
+
+    /// resize the ids and the codes (rounded up to whole blocks). The new
+    /// blocks are filled with 0s
+    void resize (size_t list_no, size_t new_size) override;
+
+    MemoryUsage memory_usage () const override;
+
+    ~BlockInvertedLists () override;
+
+};
+
+#ifndef _MSC_VER
+
+struct BlockInvertedListsIOHook: InvertedListsIOHook {
+    BlockInvertedListsIOHook();
+    void write(const InvertedLists *ils, IOWriter *f) const override;
+    InvertedLists * read(IOReader *f, int io_flags) const override;
+    /// not supported, the array codes are not in block format
+    InvertedLists * read_ArrayInvertedLists(
+            IOReader *f, int io_flags,
+            size_t nlist, size_t code_size,
+            const std::vector<size_t> &sizes) const override;
+};
+
+#endif // !_MSC_VER
+
+
+} // namespace faiss
+
+#endif
@@ -20,8 +20,14 @@
 #include <faiss/utils/utils.h>
 #include <faiss/utils/random.h>
 #include <faiss/utils/distances.h>
+#include <algorithm>
+#include <exception>
+#include <mutex>
+
 #include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/io.h>
 #include <faiss/IndexFlat.h>
+#include <faiss/IndexHNSW.h>
 
 namespace faiss {
 
@@ -36,7 +42,14 @@ ClusteringParameters::ClusteringParameters ():
     min_points_per_centroid(39),
     max_points_per_centroid(256),
     seed(1234),
-    decode_block_size(32768)
+    decode_block_size(32768),
+    batch_size(8192),
+    assign_hnsw_M(0),
+    assign_hnsw_efSearch(16),
+    skip_stable_points(false),
+    init_kmeans_parallel(false),
+    init_rounds(5),
+    init_oversampling(0.5)
 {}
 // 39 corresponds to 10000 / 256 -> to avoid warnings on PQ tests with randu10k
 
@@ -85,6 +98,19 @@ void Clustering::train (idx_t nx, const float *x_in, Index & index,
                    index, weights);
 }
 
+void Clustering::train_distributed (idx_t nx, const float *x_in,
+                                    Index & index, ClusteringComm & comm,
+                                    const float *weights) {
+    train_encoded_distributed (nx, reinterpret_cast<const uint8_t *>(x_in),
+                               nullptr, index, &comm, weights);
+}
+
+void Clustering::train_encoded (idx_t nx, const uint8_t *x_in,
+                                const Index * codec, Index & index,
+                                const float *weights) {
+    train_encoded_distributed (nx, x_in, codec, index, nullptr, weights);
+}
+
 
 namespace {
 
@@ -93,27 +119,25 @@ using idx_t = Clustering::idx_t;
 idx_t subsample_training_set(
           const Clustering &clus, idx_t nx, const uint8_t *x,
           size_t line_size, const float * weights,
+          idx_t nx_new,
           uint8_t **x_out,
           float **weights_out
 )
 {
     if (clus.verbose) {
-        printf("Sampling a subset of %zd / %" PRId64 " for training\n",
-               clus.k * clus.max_points_per_centroid, nx);
+        printf("Sampling a subset of %" PRId64 " / %" PRId64
+               " for training\n", nx_new, nx);
     }
-    std::vector<int> perm (nx);
-    rand_perm (perm.data (), nx, clus.seed);
-    nx = clus.k * clus.max_points_per_centroid;
+    std::vector<int64_t> subset (nx_new);
+    rand_subset (subset.data (), nx, nx_new, clus.seed);
+    nx = nx_new;
     uint8_t * x_new = new uint8_t [nx * line_size];
     *x_out = x_new;
-    for (idx_t i = 0; i < nx; i++) {
-        memcpy (x_new + i * line_size, x + perm[i] * line_size, line_size);
-    }
+    gather_rows (line_size, x, subset.data(), nx, x_new);
     if (weights) {
         float *weights_new = new float[nx];
-        for (idx_t i = 0; i < nx; i++) {
-            weights_new[i] = weights[perm[i]];
-        }
+        gather_rows (sizeof(float), (const uint8_t*)weights,
+                     subset.data(), nx, (uint8_t*)weights_new);
         *weights_out = weights_new;
     } else {
         *weights_out = nullptr;
@@ -121,6 +145,39 @@ idx_t subsample_training_set(
     return nx;
 }
 
+/** split k centroids among clusters of sizes n_i, proportionally to the
+ * sizes (largest remainder), with k_i <= n_i */
+void allocate_centroids (size_t k, const std::vector<size_t> & sizes,
+                         std::vector<size_t> & sub_k)
+{
+    size_t nc = sizes.size();
+    size_t n = 0;
+    for (size_t s: sizes) {
+        n += s;
+    }
+    sub_k.resize (nc);
+    std::vector<std::pair<double, size_t> > remainders;
+    size_t kalloc = 0;
+    for (size_t i = 0; i < nc; i++) {
+        double ki = k * double(sizes[i]) / n;
+        sub_k[i] = std::min (size_t(ki), sizes[i]);
+        kalloc += sub_k[i];
+        remainders.push_back (std::make_pair (ki - sub_k[i], i));
+    }
+    std::sort (remainders.begin(), remainders.end(),
+               std::greater<std::pair<double, size_t> >());
+    // n >= k, so this terminates
+    while (kalloc < k) {
+        for (auto & r: remainders) {
+            size_t i = r.second;
+            if (kalloc < k && sub_k[i] < sizes[i]) {
+                sub_k[i]++;
+                kalloc++;
+            }
+        }
+    }
+}
+
 /** compute centroids as (weighted) sum of training points
  *
  * @param x            training vectors, size n * code_size (from codec)
@@ -204,16 +261,323 @@ void compute_centroids (size_t d, size_t k, size_t n,
 
 }
 
-// a bit above machine epsilon for float16
-#define EPS (1 / 1024.)
+/** sum the centroids computed by compute_centroids on the workers,
+ * weighted by their hassign, and the hassign (size k - k_frozen) */
+void allreduce_centroids (ClusteringComm & comm, size_t d, size_t k,
+                          size_t k_frozen, float * hassign,
+                          float * centroids)
+{
+    k -= k_frozen;
+    centroids += k_frozen * d;
 
-/** Handle empty clusters by splitting larger ones.
- *
- * It works by slightly changing the centroids to make 2 clusters from
- * a single one. Takes the same arguments as compute_centroids.
+    std::vector<float> buf (k * (d + 1));
+    for (size_t ci = 0; ci < k; ci++) {
+        for (size_t j = 0; j < d; j++) {
+            buf[ci * d + j] = centroids[ci * d + j] * hassign[ci];
+        }
+        buf[k * d + ci] = hassign[ci];
+    }
+
+    comm.allreduce_sum (buf.size(), buf.data());
+
+    for (size_t ci = 0; ci < k; ci++) {
+        hassign[ci] = buf[k * d + ci];
+        float norm = hassign[ci] == 0 ? 0 : 1 / hassign[ci];
+        for (size_t j = 0; j < d; j++) {
+            centroids[ci * d + j] = buf[ci * d + j] * norm;
+        }
+    }
+}
+
+/** initialize k centroids with training vectors of all the workers:
+ * worker r contributes a nb of vectors proportional to its nb of
+ * vectors nx, the first ones of perm */
+void distributed_random_init (ClusteringComm & comm, size_t d, size_t k,
+                              size_t nx, const uint8_t * x,
+                              const Index *codec, const int *perm,
+                              float * centroids)
+{
+    if (k == 0) {
+        return;
+    }
+    std::vector<double> sizes_d (comm.nworker);
+    sizes_d[comm.rank] = nx;
+    comm.allreduce_sum (sizes_d.size(), sizes_d.data());
+
+    std::vector<size_t> sizes (comm.nworker), kw;
+    for (int r = 0; r < comm.nworker; r++) {
+        sizes[r] = size_t(sizes_d[r]);
+    }
+    allocate_centroids (k, sizes, kw);
+    size_t ofs = 0;
+    for (int r = 0; r < comm.rank; r++) {
+        ofs += kw[r];
+    }
+
+    size_t line_size = codec ? codec->sa_code_size() : d * sizeof (float);
+    memset (centroids, 0, sizeof (float) * k * d);
+    for (size_t i = 0; i < kw[comm.rank]; i++) {
+        float *c = centroids + (ofs + i) * d;
+        if (!codec) {
+            memcpy (c, x + perm[i] * line_size, line_size);
+        } else {
+            codec->sa_decode (1, x + perm[i] * line_size, c);
+        }
+    }
+    comm.allreduce_sum (k * d, centroids);
+}
+
+/** assign the training vectors to their nearest centroid with index
  *
- * @return           nb of spliting operations (larger is worse)
+ * @param lower      if not NULL (L2 only), lower bound on the distance
+ *                   of each vector to its second nearest centroid (not
+ *                   squared), size n. It is updated.
+ * @param max_move   largest displacement of a centroid since the
+ *                   previous assignment, < 0 if there is no previous
+ *                   assignment
+ * @return nb of vectors that were searched
  */
+size_t assign_training_set (size_t d, size_t n,
+                            const uint8_t * x, const Index *codec,
+                            size_t block_size, const Index & index,
+                            const float *centroids, float max_move,
+                            int64_t * assign, float * dis, float * lower)
+{
+    size_t line_size = codec ? codec->sa_code_size() : d * sizeof (float);
+
+    if (!lower && !codec) {
+        index.search (n, reinterpret_cast<const float *>(x), 1,
+                      dis, assign);
+        return n;
+    }
+
+    std::vector<float> decode_buffer (codec ? block_size * d : 0);
+    std::vector<float> xa, Da;
+    std::vector<int64_t> Ia;
+    std::vector<char> stable (lower ? block_size : 0);
+    size_t nsearch = 0;
+
+    for (size_t i0 = 0; i0 < n; i0 += block_size) {
+        size_t i1 = std::min (i0 + block_size, n);
+        const float *xb;
+        if (codec) {
+            codec->sa_decode (i1 - i0, x + line_size * i0,
+                              decode_buffer.data ());
+            xb = decode_buffer.data ();
+        } else {
+            xb = reinterpret_cast<const float *>(x + line_size * i0);
+        }
+
+        if (!lower) {
+            index.search (i1 - i0, xb, 1, dis + i0, assign + i0);
+            nsearch += i1 - i0;
+            continue;
+        }
+
+        // the vectors that are closer to their centroid than to any
+        // other one keep it
+        size_t na = i1 - i0;
+        if (max_move >= 0) {
+#pragma omp parallel for reduction(-: na)
+            for (int64_t i = i0; i < (int64_t)i1; i++) {
+                float l = lower[i] - max_move;
+                const float *xi = xb + (i - i0) * d;
+                float da = fvec_L2sqr (xi, centroids + assign[i] * d, d);
+                stable[i - i0] = l > 0 && da < l * l;
+                if (stable[i - i0]) {
+                    dis[i] = da;
+                    lower[i] = l;
+                    na--;
+                }
+            }
+        } else {
+            std::fill (stable.begin(), stable.end(), 0);
+        }
+        if (na == 0) {
+            continue;
+        }
+
+        // search the others with 2 results, for the bound
+        const float *xs = xb;
+        if (na < i1 - i0) {
+            xa.resize (na * d);
+            size_t j = 0;
+            for (size_t i = i0; i < i1; i++) {
+                if (!stable[i - i0]) {
+                    memcpy (xa.data() + j * d, xb + (i - i0) * d,
+                            sizeof (float) * d);
+                    j++;
+                }
+            }
+            xs = xa.data();
+        }
+        Da.resize (na * 2);
+        Ia.resize (na * 2);
+        index.search (na, xs, 2, Da.data(), Ia.data());
+        size_t j = 0;
+        for (size_t i = i0; i < i1; i++) {
+            if (stable[i - i0]) {
+                continue;
+            }
+            assign[i] = Ia[2 * j];
+            dis[i] = Da[2 * j];
+            lower[i] = Ia[2 * j + 1] >= 0 ?
+                sqrtf (std::max (Da[2 * j + 1], 0.0f)) : HUGE_VALF;
+            j++;
+        }
+        nsearch += na;
+    }
+    return nsearch;
+}
+
+/** k-means|| initialization of centroids n_input:k, see
+ * ClusteringParameters::init_kmeans_parallel. The centroids 0:n_input
+ * are given. */
+void kmeans_parallel_init (size_t d, size_t k, size_t n, size_t n_input,
+                          const uint8_t * x, const Index *codec,
+                          size_t block_size, const float * weights,
+                          int rounds, float oversampling,
+                          int64_t seed, float * centroids)
+{
+    size_t line_size = codec ? codec->sa_code_size() : d * sizeof (float);
+    RandomGenerator rng (seed);
+
+    std::vector<float> cand (centroids, centroids + n_input * d);
+    std::vector<float> xi (d);
+    auto add_candidate = [&] (size_t i) {
+        if (codec) {
+            codec->sa_decode (1, x + i * line_size, xi.data());
+        } else {
+            memcpy (xi.data(), x + i * line_size, line_size);
+        }
+        cand.insert (cand.end(), xi.begin(), xi.end());
+    };
+    if (n_input == 0) {
+        add_candidate (rng.rand_int64 () % n);
+    }
+
+    // squared distance of each point to its nearest candidate
+    std::vector<float> min_dis (n, HUGE_VALF);
+    std::vector<int64_t> nearest (n, -1);
+    std::vector<float> decode_buffer (codec ? block_size * d : 0);
+    std::vector<float> D (std::min (n, block_size));
+    std::vector<int64_t> I (std::min (n, block_size));
+
+    // update with the candidates c0:c1
+    auto update_min_dis = [&] (size_t c0, size_t c1) {
+        for (size_t i0 = 0; i0 < n; i0 += block_size) {
+            size_t i1 = std::min (i0 + block_size, n);
+            const float *xb;
+            if (codec) {
+                codec->sa_decode (i1 - i0, x + line_size * i0,
+                                  decode_buffer.data ());
+                xb = decode_buffer.data ();
+            } else {
+                xb = reinterpret_cast<const float *>(x + line_size * i0);
+            }
+            float_maxheap_array_t res = {i1 - i0, 1, I.data(), D.data()};
+            knn_L2sqr (xb, cand.data() + c0 * d, d, i1 - i0, c1 - c0, &res);
+            for (size_t i = i0; i < i1; i++) {
+                if (D[i - i0] < min_dis[i]) {
+                    min_dis[i] = D[i - i0];
+                    nearest[i] = c0 + I[i - i0];
+                }
+            }
+        }
+    };
+
+    size_t nc = cand.size() / d;
+    update_min_dis (0, nc);
+
+    double l = oversampling * (k - n_input);
+    for (int r = 0; r < rounds; r++) {
+        double psi = 0;
+        for (size_t i = 0; i < n; i++) {
+            psi += (weights ? weights[i] : 1) * min_dis[i];
+        }
+        if (psi == 0) {
+            break;
+        }
+        for (size_t i = 0; i < n; i++) {
+            double p = l * (weights ? weights[i] : 1) * min_dis[i] / psi;
+            if (p > 0 && rng.rand_double () < p) {
+                add_candidate (i);
+            }
+        }
+        size_t nc2 = cand.size() / d;
+        if (nc2 > nc) {
+            update_min_dis (nc, nc2);
+            nc = nc2;
+        }
+    }
+
+    // weight of a candidate = weight of the points it is nearest to
+    std::vector<double> cw (nc);
+    for (size_t i = 0; i < n; i++) {
+        cw[nearest[i]] += weights ? weights[i] : 1;
+    }
+
+    // weighted k-means++ on the candidates, the input centroids are kept
+    std::vector<float> cdis (nc, HUGE_VALF);
+    std::vector<bool> chosen (nc);
+    auto choose = [&] (size_t c) {
+        chosen[c] = true;
+        const float *y = cand.data() + c * d;
+#pragma omp parallel for if (nc > 1000)
+        for (int64_t j = 0; j < nc; j++) {
+            cdis[j] = std::min (
+                  cdis[j], fvec_L2sqr (cand.data() + j * d, y, d));
+        }
+    };
+    for (size_t c = 0; c < n_input; c++) {
+        choose (c);
+    }
+    size_t nout = n_input;
+    while (nout < k && nout < nc) {
+        double tot = 0;
+        for (size_t j = 0; j < nc; j++) {
+            if (!chosen[j]) {
+                tot += cw[j] * std::min (cdis[j], HUGE_VALF / 2);
+            }
+        }
+        size_t c = nc;
+        if (tot > 0) {
+            double r = rng.rand_double () * tot;
+            for (size_t j = 0; j < nc; j++) {
+                if (chosen[j]) {
+                    continue;
+                }
+                c = j;
+                r -= cw[j] * std::min (cdis[j], HUGE_VALF / 2);
+                if (r < 0) {
+                    break;
+                }
+            }
+        } else { // only zero-weight candidates left
+            for (c = 0; chosen[c]; c++) {}
+        }
+        memcpy (centroids + nout * d, cand.data() + c * d,
+                sizeof (float) * d);
+        choose (c);
+        nout++;
+    }
+
+    // not enough candidates (eg. duplicate points): random points
+    for (; nout < k; nout++) {
+        size_t i = rng.rand_int64 () % n;
+        if (codec) {
+            codec->sa_decode (1, x + i * line_size, centroids + nout * d);
+        } else {
+            memcpy (centroids + nout * d, x + i * line_size, line_size);
+        }
+    }
+}
+
+} // anonymous namespace
+
+// a bit above machine epsilon for float16
+#define EPS (1 / 1024.)
+
 int split_clusters (size_t d, size_t k, size_t n,
                     size_t k_frozen,
                     float * hassign,
@@ -262,17 +626,24 @@ int split_clusters (size_t d, size_t k, size_t n,
 
 
 
-};
-
-
-void Clustering::train_encoded (idx_t nx, const uint8_t *x_in,
-                                const Index * codec, Index & index,
-                                const float *weights) {
+void Clustering::train_encoded_distributed (idx_t nx, const uint8_t *x_in,
+                                            const Index * codec,
+                                            Index & index,
+                                            ClusteringComm *comm,
+                                            const float *weights) {
 
+    // nb of training vectors of all the workers
+    double nx_global = nx;
+    if (comm) {
+        comm->allreduce_sum (1, &nx_global);
+    }
 
-    FAISS_THROW_IF_NOT_FMT (nx >= k,
+    FAISS_THROW_IF_NOT_FMT (nx_global >= k,
              "Number of training points (%" PRId64 ") should be at least "
-             "as large as number of clusters (%zd)", nx, k);
+             "as large as number of clusters (%zd)", idx_t(nx_global), k);
+    FAISS_THROW_IF_NOT_MSG (!(comm && init_kmeans_parallel),
+             "k-means|| initialization not supported for distributed "
+             "k-means");
 
     FAISS_THROW_IF_NOT_FMT ((!codec || codec->d == d),
              "Codec dimension %d not the same as data dimension %d",
@@ -300,21 +671,30 @@ void Clustering::train_encoded (idx_t nx, const uint8_t *x_in,
     std::unique_ptr<float []> del3;
     size_t line_size = codec ? codec->sa_code_size() : sizeof(float) * d;
 
-    if (nx > k * max_points_per_centroid) {
+    if (nx_global > k * max_points_per_centroid) {
+        // each worker keeps its share of the sample
+        idx_t nx_new = comm ?
+            idx_t(double(k * max_points_per_centroid) * nx / nx_global) :
+            idx_t(k * max_points_per_centroid);
         uint8_t *x_new;
         float *weights_new;
         nx = subsample_training_set (*this, nx, x, line_size, weights,
-                                &x_new, &weights_new);
+                                     nx_new, &x_new, &weights_new);
         del1.reset (x_new); x = x_new;
         del3.reset (weights_new); weights = weights_new;
-    } else if (nx < k * min_points_per_centroid) {
+        nx_global = nx;
+        if (comm) {
+            comm->allreduce_sum (1, &nx_global);
+        }
+    } else if (nx_global < k * min_points_per_centroid &&
+               (!comm || comm->rank == 0)) {
         fprintf (stderr,
                  "WARNING clustering %" PRId64 " points to %zd centroids: "
                  "please provide at least %" PRId64 " training points\n",
-                 nx, k, idx_t(k) * min_points_per_centroid);
+                 idx_t(nx_global), k, idx_t(k) * min_points_per_centroid);
     }
 
-    if (nx == k) {
+    if (!comm && nx == k) {
         // this is a corner case, just copy training set to clusters
         if (verbose) {
             printf("Number of training points (%" PRId64 ") same as number of "
@@ -328,7 +708,7 @@ void Clustering::train_encoded (idx_t nx, const uint8_t *x_in,
         }
 
         // one fake iteration...
-        ClusteringIterationStats stats = { 0.0, 0.0, 0.0, 1.0, 0 };
+        ClusteringIterationStats stats = { 0.0, 0.0, 0.0, 1.0, 0, 0 };
         iteration_stats.push_back (stats);
 
         index.reset();
@@ -340,7 +720,7 @@ void Clustering::train_encoded (idx_t nx, const uint8_t *x_in,
     if (verbose) {
         printf("Clustering %" PRId64 " points in %zdD to %zd clusters, "
                "redo %d times, %d iterations\n",
-               nx, d, k, nredo, niter);
+               idx_t(nx_global), d, k, nredo, niter);
         if (codec) {
             printf("Input data encoded in %zd bytes per vector\n",
                    codec->sa_code_size ());
@@ -377,9 +757,17 @@ void Clustering::train_encoded (idx_t nx, const uint8_t *x_in,
     }
     t0 = getmillisecs();
 
-    // temporary buffer to decode vectors during the optimization
-    std::vector<float> decode_buffer
-        (codec ? d * decode_block_size : 0);
+    // approximate assignment index, rebuilt at each iteration
+    std::unique_ptr<IndexHNSWFlat> hnsw;
+    if (assign_hnsw_M > 0) {
+        hnsw.reset (new IndexHNSWFlat (d, assign_hnsw_M, index.metric_type));
+        hnsw->hnsw.efSearch = std::max (assign_hnsw_efSearch, 2);
+    }
+    const Index & assign_index = hnsw ? *hnsw : index;
+
+    bool use_bounds = skip_stable_points && index.metric_type == METRIC_L2;
+    std::vector<float> lower (use_bounds ? nx : 0);
+    std::vector<float> prev_centroids;
 
     for (int redo = 0; redo < nredo; redo++) {
 
@@ -393,7 +781,17 @@ void Clustering::train_encoded (idx_t nx, const uint8_t *x_in,
 
         rand_perm (perm.data(), nx, seed + 1 + redo * 15486557L);
 
-        if (!codec) {
+        if (comm) {
+            distributed_random_init (
+                  *comm, d, k - n_input_centroids, nx, x, codec,
+                  perm.data(), centroids.data() + n_input_centroids * d);
+        } else if (init_kmeans_parallel) {
+            kmeans_parallel_init (
+                  d, k, nx, n_input_centroids, x, codec,
+                  decode_block_size, weights,
+                  init_rounds, init_oversampling,
+                  seed + 1 + redo * 15486557L, centroids.data());
+        } else if (!codec) {
             for (int i = n_input_centroids; i < k ; i++) {
                 memcpy (&centroids[i * d], x + perm[i] * line_size, line_size);
             }
@@ -415,29 +813,25 @@ void Clustering::train_encoded (idx_t nx, const uint8_t *x_in,
             index.train (k, centroids.data());
         }
 
-        index.add (k, centroids.data());
+        if (hnsw && niter > 0) {
+            hnsw->reset ();
+            hnsw->add (k, centroids.data());
+        } else {
+            index.add (k, centroids.data());
+        }
 
         // k-means iterations
 
         float obj = 0;
+        float max_move = -1;
         for (int i = 0; i < niter; i++) {
             double t0s = getmillisecs();
 
-            if (!codec) {
-                index.search (nx, reinterpret_cast<const float *>(x), 1,
-                              dis.get(), assign.get());
-            } else {
-                // search by blocks of decode_block_size vectors
-                size_t code_size = codec->sa_code_size ();
-                for (size_t i0 = 0; i0 < nx; i0 += decode_block_size) {
-                    size_t i1 = i0 + decode_block_size;
-                    if (i1 > nx) { i1 = nx; }
-                    codec->sa_decode (i1 - i0, x + code_size * i0,
-                                      decode_buffer.data ());
-                    index.search (i1 - i0, decode_buffer.data (), 1,
-                                  dis.get() + i0, assign.get() + i0);
-                }
-            }
+            size_t nsearch = assign_training_set (
+                  d, nx, x, codec, decode_block_size, assign_index,
+                  centroids.data(), max_move,
+                  assign.get(), dis.get(),
+                  use_bounds ? lower.data() : nullptr);
 
             InterruptCallback::check();
             t_search_tot += getmillisecs() - t0s;
@@ -447,9 +841,17 @@ void Clustering::train_encoded (idx_t nx, const uint8_t *x_in,
             for (int j = 0; j < nx; j++) {
                 obj += dis[j];
             }
+            if (comm) {
+                double obj_global = obj;
+                comm->allreduce_sum (1, &obj_global);
+                obj = obj_global;
+            }
 
             // update the centroids
             std::vector<float> hassign (k);
+            if (use_bounds) {
+                prev_centroids = centroids;
+            }
 
             size_t k_frozen = frozen_centroids ? n_input_centroids : 0;
             compute_centroids (
@@ -458,8 +860,13 @@ void Clustering::train_encoded (idx_t nx, const uint8_t *x_in,
                   hassign.data(), centroids.data()
             );
 
+            if (comm) {
+                allreduce_centroids (*comm, d, k, k_frozen,
+                                     hassign.data(), centroids.data());
+            }
+
             int nsplit = split_clusters (
-                  d, k, nx, k_frozen,
+                  d, k, size_t(nx_global), k_frozen,
                   hassign.data(), centroids.data()
             );
 
@@ -468,7 +875,7 @@ void Clustering::train_encoded (idx_t nx, const uint8_t *x_in,
                 { obj, (getmillisecs() - t0) / 1000.0,
                   t_search_tot / 1000,
                   imbalance_factor (nx, k, assign.get()),
-                  nsplit };
+                  nsplit, nsearch };
             iteration_stats.push_back(stats);
 
             if (verbose) {
@@ -481,8 +888,26 @@ void Clustering::train_encoded (idx_t nx, const uint8_t *x_in,
 
             post_process_centroids ();
 
+            if (use_bounds) {
+                max_move = 0;
+#pragma omp parallel for reduction(max: max_move)
+                for (idx_t c = 0; c < k; c++) {
+                    float move = fvec_L2sqr (prev_centroids.data() + c * d,
+                                             centroids.data() + c * d, d);
+                    max_move = std::max (max_move, move);
+                }
+                max_move = sqrtf (max_move);
+            }
+
             // add centroids to index for the next iteration (or for output)
 
+            if (hnsw && i < niter - 1) {
+                hnsw->reset ();
+                hnsw->add (k, centroids.data());
+                InterruptCallback::check ();
+                continue;
+            }
+
             index.reset ();
             if (update_index) {
                 index.train (k, centroids.data());
@@ -515,6 +940,780 @@ void Clustering::train_encoded (idx_t nx, const uint8_t *x_in,
 
 }
 
+/*************************************************************
+ * Mini-batch k-means
+ *************************************************************/
+
+ClusteringDataSourceArray::ClusteringDataSourceArray (
+        size_t d, size_t n, const float *x, int npass, int64_t seed):
+    d(d), n(n), x(x), npass(npass), seed(seed), pass(-1), ofs(n)
+{}
+
+size_t ClusteringDataSourceArray::next_batch (size_t nb, float *x_out)
+{
+    if (ofs == n) {
+        if (pass + 1 >= npass || n == 0) {
+            return 0;
+        }
+        pass++;
+        perm.resize (n);
+        rand_perm (perm.data(), n, seed + pass * 15486557L);
+        ofs = 0;
+    }
+    nb = std::min (nb, n - ofs);
+    for (size_t i = 0; i < nb; i++) {
+        memcpy (x_out + i * d, x + perm[ofs + i] * d, sizeof (float) * d);
+    }
+    ofs += nb;
+    return nb;
+}
+
+ClusteringDataSourceReader::ClusteringDataSourceReader (
+        IOReader *reader, size_t d):
+    reader(reader), d(d)
+{}
+
+size_t ClusteringDataSourceReader::next_batch (size_t n, float *x)
+{
+    return (*reader) (x, sizeof (float) * d, n);
+}
+
+
+namespace {
+
+// fill a buffer of n vectors from the source, return the nb of vectors read
+size_t read_batch (ClusteringDataSource & source, size_t d,
+                   size_t n, float *x)
+{
+    size_t nread = 0;
+    while (nread < n) {
+        size_t nr = source.next_batch (n - nread, x + nread * d);
+        if (nr == 0) {
+            break;
+        }
+        nread += nr;
+    }
+    return nread;
+}
+
+} // anonymous namespace
+
+
+void Clustering::train_minibatch (idx_t n, const float *x, Index & index)
+{
+    FAISS_THROW_IF_NOT_FMT (n >= k,
+             "Number of training points (%" PRId64 ") should be at least "
+             "as large as number of clusters (%zd)", n, k);
+    ClusteringDataSourceArray source (d, n, x, niter, seed + 1);
+    train_minibatch (source, index);
+}
+
+
+void Clustering::train_minibatch (ClusteringDataSource & source,
+                                  Index & index)
+{
+    FAISS_THROW_IF_NOT_FMT (index.d == d,
+            "Index dimension %d not the same as data dimension %d",
+            int(index.d), int(d));
+    FAISS_THROW_IF_NOT (batch_size > 0);
+    FAISS_THROW_IF_NOT_MSG (
+       centroids.size() % d == 0,
+       "size of provided input centroids not a multiple of dimension"
+    );
+
+    double t0 = getmillisecs();
+    size_t n_input_centroids = centroids.size() / d;
+    size_t k_frozen = frozen_centroids ? n_input_centroids : 0;
+
+    if (verbose) {
+        printf("Mini-batch clustering in %zdD to %zd clusters, "
+               "batches of %zd vectors\n", d, k, batch_size);
+        if (n_input_centroids > 0) {
+            printf ("  Using %zd centroids provided as input (%sfrozen)\n",
+                    n_input_centroids, frozen_centroids ? "" : "not ");
+        }
+    }
+
+    // initialize the remaining centroids with the first vectors
+    centroids.resize (d * k);
+    size_t ninit = n_input_centroids < k ?
+        read_batch (source, d, k - n_input_centroids,
+                    centroids.data() + n_input_centroids * d) : 0;
+    FAISS_THROW_IF_NOT_FMT (n_input_centroids + ninit == k,
+             "Number of training points (%zd) should be at least "
+             "as large as number of clusters (%zd)", ninit, k);
+
+    post_process_centroids ();
+
+    if (index.ntotal != 0) {
+        index.reset();
+    }
+    if (!index.is_trained) {
+        index.train (k, centroids.data());
+    }
+    index.add (k, centroids.data());
+
+    // nb of vectors assigned to each centroid so far
+    std::vector<int64_t> counts (k);
+    std::vector<float> batch (batch_size * d);
+    std::vector<idx_t> assign (batch_size);
+    std::vector<float> dis (batch_size);
+    RandomGenerator rng (seed);
+    double t_search_tot = 0;
+
+    for (int it = 0; ; it++) {
+        size_t nb = read_batch (source, d, batch_size, batch.data());
+        if (nb == 0) {
+            break;
+        }
+        for (size_t i = 0; i < nb * d; i++) {
+            FAISS_THROW_IF_NOT_MSG (std::isfinite (batch[i]),
+                                    "input contains NaN's or Inf's");
+        }
+
+        double t0s = getmillisecs();
+        index.search (nb, batch.data(), 1, dis.data(), assign.data());
+        InterruptCallback::check();
+        t_search_tot += getmillisecs() - t0s;
+
+        float obj = 0;
+        for (size_t i = 0; i < nb; i++) {
+            obj += dis[i];
+        }
+
+        // each thread updates a slice of the centroids, in the order of
+        // the batch: c += (x - c) / count
+#pragma omp parallel
+        {
+            int nt = omp_get_num_threads();
+            int rank = omp_get_thread_num();
+            size_t c0 = (k * rank) / nt;
+            size_t c1 = (k * (rank + 1)) / nt;
+
+            for (size_t i = 0; i < nb; i++) {
+                if (assign[i] < 0) {
+                    continue;
+                }
+                size_t ci = assign[i];
+                if (ci < c0 || ci >= c1 || ci < k_frozen) {
+                    continue;
+                }
+                counts[ci]++;
+                float eta = 1.0f / counts[ci];
+                float *c = centroids.data() + ci * d;
+                const float *xi = batch.data() + i * d;
+                for (size_t j = 0; j < d; j++) {
+                    c[j] += eta * (xi[j] - c[j]);
+                }
+            }
+        }
+
+        // re-seed the centroids that never got a vector
+        int nsplit = 0;
+        for (size_t ci = k_frozen; ci < k; ci++) {
+            if (counts[ci] == 0) {
+                size_t i = rng.rand_int (int(nb));
+                memcpy (centroids.data() + ci * d, batch.data() + i * d,
+                        sizeof (float) * d);
+                nsplit++;
+            }
+        }
+
+        ClusteringIterationStats stats =
+            { obj, (getmillisecs() - t0) / 1000.0,
+              t_search_tot / 1000,
+              imbalance_factor (nb, k, assign.data()),
+              nsplit, nb };
+        iteration_stats.push_back(stats);
+
+        if (verbose) {
+            printf ("  Batch %d (%.2f s, search %.2f s): "
+                    "objective=%g imbalance=%.3f nsplit=%d       \r",
+                    it, stats.time, stats.time_search, stats.obj,
+                    stats.imbalance_factor, nsplit);
+            fflush (stdout);
+        }
+
+        post_process_centroids ();
+
+        index.reset ();
+        if (update_index) {
+            index.train (k, centroids.data());
+        }
+        index.add (k, centroids.data());
+        InterruptCallback::check ();
+    }
+    if (verbose) printf("\n");
+}
+
+
+void Clustering::train_minibatch_distributed (ClusteringDataSource & source,
+                                              Index & index,
+                                              ClusteringComm & comm)
+{
+    FAISS_THROW_IF_NOT_FMT (index.d == d,
+            "Index dimension %d not the same as data dimension %d",
+            int(index.d), int(d));
+    FAISS_THROW_IF_NOT (batch_size > 0);
+    FAISS_THROW_IF_NOT_MSG (
+       centroids.size() % d == 0,
+       "size of provided input centroids not a multiple of dimension"
+    );
+
+    double t0 = getmillisecs();
+    size_t n_input_centroids = centroids.size() / d;
+    size_t k_frozen = frozen_centroids ? n_input_centroids : 0;
+    bool print = verbose && comm.rank == 0;
+
+    if (print) {
+        printf("Distributed mini-batch clustering in %zdD to %zd clusters, "
+               "%d workers, batches of %zd vectors\n",
+               d, k, comm.nworker, batch_size);
+    }
+
+    // initialize the remaining centroids with the first vectors of
+    // worker 0
+    centroids.resize (d * k);
+    int64_t ninit = 0;
+    if (comm.rank == 0 && n_input_centroids < k) {
+        ninit = read_batch (source, d, k - n_input_centroids,
+                            centroids.data() + n_input_centroids * d);
+    }
+    comm.broadcast (sizeof (ninit), &ninit);
+    FAISS_THROW_IF_NOT_FMT (n_input_centroids + ninit == k,
+             "Number of training points (%" PRId64 ") should be at least "
+             "as large as number of clusters (%zd)", ninit, k);
+    comm.broadcast (sizeof (float) * d * k, centroids.data());
+
+    post_process_centroids ();
+
+    if (index.ntotal != 0) {
+        index.reset();
+    }
+    if (!index.is_trained) {
+        index.train (k, centroids.data());
+    }
+    index.add (k, centroids.data());
+
+    // nb of vectors assigned to each centroid so far
+    std::vector<int64_t> counts (k);
+    std::vector<float> batch (batch_size * d);
+    std::vector<idx_t> assign (batch_size);
+    std::vector<float> dis (batch_size);
+    // sums of the vectors of the batch per centroid, then their nb
+    std::vector<float> sums (k * (d + 1));
+    RandomGenerator rng (seed + comm.rank);
+    double t_search_tot = 0;
+
+    for (int it = 0; ; it++) {
+        size_t nb = read_batch (source, d, batch_size, batch.data());
+        for (size_t i = 0; i < nb * d; i++) {
+            FAISS_THROW_IF_NOT_MSG (std::isfinite (batch[i]),
+                                    "input contains NaN's or Inf's");
+        }
+
+        double t0s = getmillisecs();
+        index.search (nb, batch.data(), 1, dis.data(), assign.data());
+        InterruptCallback::check();
+        t_search_tot += getmillisecs() - t0s;
+
+        // global nb of vectors and objective
+        double nb_obj[2] = {double(nb), 0};
+        for (size_t i = 0; i < nb; i++) {
+            nb_obj[1] += dis[i];
+        }
+        comm.allreduce_sum (2, nb_obj);
+        if (nb_obj[0] == 0) {
+            break;
+        }
+
+        std::fill (sums.begin(), sums.end(), 0);
+        float *batch_counts = sums.data() + k * d;
+#pragma omp parallel
+        {
+            int nt = omp_get_num_threads();
+            int rank = omp_get_thread_num();
+            size_t c0 = (k * rank) / nt;
+            size_t c1 = (k * (rank + 1)) / nt;
+
+            for (size_t i = 0; i < nb; i++) {
+                if (assign[i] < 0) {
+                    continue;
+                }
+                size_t ci = assign[i];
+                if (ci < c0 || ci >= c1) {
+                    continue;
+                }
+                batch_counts[ci] += 1;
+                float *s = sums.data() + ci * d;
+                const float *xi = batch.data() + i * d;
+                for (size_t j = 0; j < d; j++) {
+                    s[j] += xi[j];
+                }
+            }
+        }
+
+        comm.allreduce_sum (sums.size(), sums.data());
+
+        // running means: c += (sum - count * c) / total count
+#pragma omp parallel for
+        for (idx_t ci = k_frozen; ci < k; ci++) {
+            if (batch_counts[ci] == 0) {
+                continue;
+            }
+            counts[ci] += int64_t(batch_counts[ci]);
+            float eta = 1.0f / counts[ci];
+            float *c = centroids.data() + ci * d;
+            const float *s = sums.data() + ci * d;
+            for (size_t j = 0; j < d; j++) {
+                c[j] += eta * (s[j] - batch_counts[ci] * c[j]);
+            }
+        }
+
+        // re-seed the centroids that never got a vector: empty centroid
+        // number i is taken from the batch of worker i % nworker
+        std::vector<size_t> empty;
+        for (size_t ci = k_frozen; ci < k; ci++) {
+            if (counts[ci] == 0) {
+                empty.push_back (ci);
+            }
+        }
+        int nsplit = empty.size();
+        if (nsplit > 0) {
+            std::vector<float> seeds (empty.size() * d);
+            for (size_t i = comm.rank; i < empty.size() && nb > 0;
+                 i += comm.nworker) {
+                size_t j = rng.rand_int (int(nb));
+                memcpy (seeds.data() + i * d, batch.data() + j * d,
+                        sizeof (float) * d);
+            }
+            comm.allreduce_sum (seeds.size(), seeds.data());
+            for (size_t i = 0; i < empty.size(); i++) {
+                memcpy (centroids.data() + empty[i] * d,
+                        seeds.data() + i * d, sizeof (float) * d);
+            }
+        }
+
+        ClusteringIterationStats stats =
+            { float(nb_obj[1]), (getmillisecs() - t0) / 1000.0,
+              t_search_tot / 1000,
+              imbalance_factor (nb, k, assign.data()),
+              nsplit, nb };
+        iteration_stats.push_back(stats);
+
+        if (print) {
+            printf ("  Batch %d (%.2f s, search %.2f s): "
+                    "objective=%g nsplit=%d       \r",
+                    it, stats.time, stats.time_search, stats.obj, nsplit);
+            fflush (stdout);
+        }
+
+        post_process_centroids ();
+
+        index.reset ();
+        if (update_index) {
+            index.train (k, centroids.data());
+        }
+        index.add (k, centroids.data());
+        InterruptCallback::check ();
+    }
+    if (print) printf("\n");
+}
+
+
+/*************************************************************
+ * Two-level k-means
+ *************************************************************/
+
+HierarchicalClustering::HierarchicalClustering (int d, int k):
+    d(d), k(k), nc1(0), balance_factor(0), balance_niter(5) {}
+
+HierarchicalClustering::HierarchicalClustering (
+        int d, int k, const ClusteringParameters &cp):
+    ClusteringParameters (cp), d(d), k(k), nc1(0),
+    balance_factor(0), balance_niter(5) {}
+
+
+namespace {
+
+/** capacity-constrained re-assignment of n vectors to k centroids
+ * followed by a centroid update, repeated niter times. Each vector goes
+ * to the nearest of its nprobe nearest centroids that is not full, or to
+ * its nearest centroid if all of them are full. The vectors are
+ * processed by increasing distance, so that those close to a centroid
+ * get it. */
+void balance_clusters (size_t d, size_t n, size_t k, const float *x,
+                       MetricType metric, size_t capacity, int niter,
+                       bool spherical, float *centroids)
+{
+    size_t nprobe = std::min (k, size_t(8));
+    bool lower_is_better = metric != METRIC_INNER_PRODUCT;
+    std::vector<float> dis (n * nprobe);
+    std::vector<idx_t> labels (n * nprobe);
+    std::vector<idx_t> assign (n);
+    std::vector<size_t> fill (k);
+    std::vector<std::pair<float, size_t> > order (n * nprobe);
+
+    for (int iter = 0; iter < niter; iter++) {
+        IndexFlat index (d, metric);
+        index.add (k, centroids);
+        index.search (n, x, nprobe, dis.data(), labels.data());
+
+        for (size_t i = 0; i < n * nprobe; i++) {
+            order[i] = std::make_pair (
+                  lower_is_better ? dis[i] : -dis[i], i);
+        }
+        std::sort (order.begin(), order.end());
+
+        std::fill (assign.begin(), assign.end(), -1);
+        std::fill (fill.begin(), fill.end(), 0);
+        for (auto & o: order) {
+            size_t i = o.second / nprobe;
+            idx_t c = labels[o.second];
+            if (assign[i] >= 0 || c < 0 || fill[c] >= capacity) {
+                continue;
+            }
+            assign[i] = c;
+            fill[c]++;
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (assign[i] < 0) {
+                assign[i] = labels[i * nprobe];
+                fill[assign[i]]++;
+            }
+        }
+
+        // update the centroids that are not empty
+        std::vector<float> sums (k * d);
+        for (size_t i = 0; i < n; i++) {
+            float *c = sums.data() + assign[i] * d;
+            const float *xi = x + i * d;
+            for (size_t j = 0; j < d; j++) {
+                c[j] += xi[j];
+            }
+        }
+        for (size_t c = 0; c < k; c++) {
+            if (fill[c] == 0) {
+                continue;
+            }
+            for (size_t j = 0; j < d; j++) {
+                centroids[c * d + j] = sums[c * d + j] / fill[c];
+            }
+        }
+        if (spherical) {
+            fvec_renorm_L2 (d, k, centroids);
+        }
+    }
+}
+
+} // anonymous namespace
+
+
+void HierarchicalClustering::train (idx_t n, const float *x, Index & index)
+{
+    FAISS_THROW_IF_NOT_FMT (n >= k,
+             "Number of training points (%" PRId64 ") should be at least "
+             "as large as number of clusters (%zd)", n, k);
+    FAISS_THROW_IF_NOT_FMT (index.d == d,
+            "Index dimension %d not the same as data dimension %d",
+            int(index.d), int(d));
+    double t0 = getmillisecs();
+    MetricType metric = index.metric_type;
+
+    size_t nc = nc1 > 0 ? nc1 : size_t(sqrt (double(k)) + 0.5);
+    nc = std::max (std::min (nc, k), size_t(1));
+
+    if (verbose) {
+        printf ("Two-level clustering of %" PRId64 " points in %zdD to "
+                "%zd clusters, %zd coarse clusters\n", n, d, k, nc);
+    }
+
+    // coarse level
+    Clustering clus1 (d, nc, *this);
+    IndexFlat index1 (d, metric);
+    clus1.train (n, x, index1);
+
+    std::vector<idx_t> assign1 (n);
+    {
+        std::vector<float> dis1 (n);
+        index1.search (n, x, 1, dis1.data(), assign1.data());
+    }
+
+    std::vector<size_t> sizes (nc);
+    for (idx_t i = 0; i < n; i++) {
+        sizes[assign1[i]]++;
+    }
+    allocate_centroids (k, sizes, sub_k);
+
+    // offset of the first sub-centroid of each coarse cluster
+    std::vector<size_t> c_ofs (nc + 1);
+    for (size_t i = 0; i < nc; i++) {
+        c_ofs[i + 1] = c_ofs[i] + sub_k[i];
+    }
+
+    // vectors of each coarse cluster
+    std::vector<std::vector<idx_t> > members (nc);
+    for (idx_t i = 0; i < n; i++) {
+        members[assign1[i]].push_back (i);
+    }
+
+    if (verbose) {
+        printf ("  Coarse level done in %.2f s, "
+                "largest coarse cluster: %zd points\n",
+                (getmillisecs() - t0) / 1000.,
+                *std::max_element (sizes.begin(), sizes.end()));
+    }
+
+    centroids.resize (k * d);
+    ClusteringParameters cp2 = *this;
+    cp2.verbose = false;
+
+    std::vector<std::pair<int, std::exception_ptr> > exceptions;
+    std::mutex exceptions_mutex;
+
+    // second level, largest clusters first
+    std::vector<std::pair<size_t, size_t> > order (nc);
+    for (size_t i = 0; i < nc; i++) {
+        order[i] = std::make_pair (sizes[i], i);
+    }
+    std::sort (order.begin(), order.end(),
+               std::greater<std::pair<size_t, size_t> >());
+
+#pragma omp parallel for schedule(dynamic)
+    for (size_t oi = 0; oi < nc; oi++) {
+        size_t i = order[oi].second;
+        size_t ki = sub_k[i];
+        if (ki == 0) {
+            continue;
+        }
+        try {
+            size_t ni = members[i].size();
+            std::vector<float> xi (ni * d);
+            for (size_t j = 0; j < ni; j++) {
+                memcpy (xi.data() + j * d, x + members[i][j] * d,
+                        sizeof (float) * d);
+            }
+            Clustering clus2 (d, ki, cp2);
+            clus2.seed = seed + 1 + i;
+            IndexFlat index2 (d, metric);
+            clus2.train (ni, xi.data(), index2);
+
+            if (balance_factor > 0 && ki > 1) {
+                size_t capacity = std::max (size_t(1), size_t(
+                        ceil (balance_factor * double(ni) / ki)));
+                balance_clusters (d, ni, ki, xi.data(), metric, capacity,
+                                  balance_niter, spherical,
+                                  clus2.centroids.data());
+            }
+            memcpy (centroids.data() + c_ofs[i] * d,
+                    clus2.centroids.data(), sizeof (float) * ki * d);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock (exceptions_mutex);
+            exceptions.push_back (std::make_pair (
+                  int(i), std::current_exception()));
+        }
+    }
+
+    handleExceptions (exceptions);
+
+    if (int_centroids) {
+        for (size_t i = 0; i < centroids.size(); i++)
+            centroids[i] = roundf (centroids[i]);
+    }
+
+    if (verbose) {
+        printf ("  Second level done in %.2f s\n",
+                (getmillisecs() - t0) / 1000.);
+    }
+
+    if (index.ntotal != 0) {
+        index.reset();
+    }
+    if (!index.is_trained) {
+        index.train (k, centroids.data());
+    }
+    index.add (k, centroids.data());
+}
+
+
+void HierarchicalClustering::train_distributed (idx_t n, const float *x,
+                                                Index & index,
+                                                ClusteringComm & comm)
+{
+    FAISS_THROW_IF_NOT_FMT (index.d == d,
+            "Index dimension %d not the same as data dimension %d",
+            int(index.d), int(d));
+    FAISS_THROW_IF_NOT_MSG (balance_factor <= 0,
+            "balance_factor not supported for distributed clustering");
+    double t0 = getmillisecs();
+    MetricType metric = index.metric_type;
+    bool print = verbose && comm.rank == 0;
+
+    size_t nc = nc1 > 0 ? nc1 : size_t(sqrt (double(k)) + 0.5);
+    nc = std::max (std::min (nc, k), size_t(1));
+
+    if (print) {
+        printf ("Distributed two-level clustering in %zdD to %zd clusters, "
+                "%zd coarse clusters, %d workers\n",
+                d, k, nc, comm.nworker);
+    }
+
+    // coarse level
+    Clustering clus1 (d, nc, *this);
+    clus1.verbose = print;
+    IndexFlat index1 (d, metric);
+    clus1.train_distributed (n, x, index1, comm);
+
+    std::vector<idx_t> assign1 (n);
+    {
+        std::vector<float> dis1 (n);
+        index1.search (n, x, 1, dis1.data(), assign1.data());
+    }
+
+    // vectors of each coarse cluster on this worker
+    std::vector<std::vector<idx_t> > members (nc);
+    for (idx_t i = 0; i < n; i++) {
+        members[assign1[i]].push_back (i);
+    }
+
+    // size of each coarse cluster on each worker
+    size_t nw = comm.nworker;
+    std::vector<double> wsizes (nc * nw);
+    for (size_t i = 0; i < nc; i++) {
+        wsizes[i * nw + comm.rank] = members[i].size();
+    }
+    comm.allreduce_sum (wsizes.size(), wsizes.data());
+
+    std::vector<size_t> sizes (nc);
+    for (size_t i = 0; i < nc; i++) {
+        for (size_t r = 0; r < nw; r++) {
+            sizes[i] += size_t(wsizes[i * nw + r]);
+        }
+    }
+    allocate_centroids (k, sizes, sub_k);
+
+    // offset of the first sub-centroid of each coarse cluster
+    std::vector<size_t> c_ofs (nc + 1);
+    for (size_t i = 0; i < nc; i++) {
+        c_ofs[i + 1] = c_ofs[i] + sub_k[i];
+    }
+
+    if (print) {
+        printf ("  Coarse level done in %.2f s, "
+                "largest coarse cluster: %zd points\n",
+                (getmillisecs() - t0) / 1000.,
+                *std::max_element (sizes.begin(), sizes.end()));
+    }
+
+    // the initial centroids of coarse cluster i are drawn from the
+    // workers proportionally to their nb of vectors in i
+    centroids.assign (k * d, 0);
+    for (size_t i = 0; i < nc; i++) {
+        if (sub_k[i] == 0) {
+            continue;
+        }
+        std::vector<size_t> wsizes_i (nw), kw;
+        for (size_t r = 0; r < nw; r++) {
+            wsizes_i[r] = size_t(wsizes[i * nw + r]);
+        }
+        allocate_centroids (sub_k[i], wsizes_i, kw);
+        size_t ofs = c_ofs[i];
+        for (int r = 0; r < comm.rank; r++) {
+            ofs += kw[r];
+        }
+        std::vector<int> perm (members[i].size());
+        rand_perm (perm.data(), perm.size(), seed + 1 + i);
+        for (size_t j = 0; j < kw[comm.rank]; j++) {
+            memcpy (centroids.data() + (ofs + j) * d,
+                    x + members[i][perm[j]] * d, sizeof (float) * d);
+        }
+    }
+    comm.allreduce_sum (centroids.size(), centroids.data());
+    if (spherical) {
+        fvec_renorm_L2 (d, k, centroids.data());
+    }
+
+    // second level: the k-means of all the coarse clusters run together,
+    // with one allreduce per iteration
+    std::vector<float> hassign (k);
+    std::vector<std::pair<int, std::exception_ptr> > exceptions;
+    std::mutex exceptions_mutex;
+
+    for (int iter = 0; iter < niter; iter++) {
+        std::fill (hassign.begin(), hassign.end(), 0);
+
+#pragma omp parallel for schedule(dynamic)
+        for (size_t i = 0; i < nc; i++) {
+            size_t ki = sub_k[i], ni = members[i].size();
+            float *cent_i = centroids.data() + c_ofs[i] * d;
+            if (ki == 0 || ni == 0) {
+                continue;
+            }
+            try {
+                std::vector<float> xi (ni * d);
+                for (size_t j = 0; j < ni; j++) {
+                    memcpy (xi.data() + j * d, x + members[i][j] * d,
+                            sizeof (float) * d);
+                }
+                IndexFlat index2 (d, metric);
+                index2.add (ki, cent_i);
+                std::vector<float> dis (ni);
+                std::vector<idx_t> assign (ni);
+                index2.search (ni, xi.data(), 1, dis.data(), assign.data());
+                compute_centroids (d, ki, ni, 0,
+                                   (const uint8_t*)xi.data(), nullptr,
+                                   assign.data(), nullptr,
+                                   hassign.data() + c_ofs[i], cent_i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock (exceptions_mutex);
+                exceptions.push_back (std::make_pair (
+                      int(i), std::current_exception()));
+            }
+        }
+        handleExceptions (exceptions);
+
+        allreduce_centroids (comm, d, k, 0, hassign.data(), centroids.data());
+
+        int nsplit = 0;
+        for (size_t i = 0; i < nc; i++) {
+            if (sub_k[i] > 0) {
+                nsplit += split_clusters (
+                      d, sub_k[i], sizes[i], 0,
+                      hassign.data() + c_ofs[i],
+                      centroids.data() + c_ofs[i] * d);
+            }
+        }
+        if (spherical) {
+            fvec_renorm_L2 (d, k, centroids.data());
+        }
+        if (print) {
+            printf ("  Second level iteration %d (%.2f s): nsplit=%d   \r",
+                    iter, (getmillisecs() - t0) / 1000., nsplit);
+            fflush (stdout);
+        }
+        InterruptCallback::check ();
+    }
+
+    if (int_centroids) {
+        for (size_t i = 0; i < centroids.size(); i++)
+            centroids[i] = roundf (centroids[i]);
+    }
+
+    if (print) {
+        printf ("\n  Second level done in %.2f s\n",
+                (getmillisecs() - t0) / 1000.);
+    }
+
+    if (index.ntotal != 0) {
+        index.reset();
+    }
+    if (!index.is_trained) {
+        index.train (k, centroids.data());
+    }
+    index.add (k, centroids.data());
+}
+
+
 float kmeans_clustering (size_t d, size_t n, size_t k,
                          const float *x,
                          float *centroids)
@@ -15,6 +15,8 @@
 
 namespace faiss {
 
+struct IOReader;
+
 
 /** Class for the clustering parameters. Can be passed to the
  * constructor of the Clustering object.
@@ -36,17 +38,123 @@ struct ClusteringParameters {
 
     size_t decode_block_size;  ///< how many vectors at a time to decode
 
+    /// nb of training vectors per mini-batch (train_minibatch only)
+    size_t batch_size;
+
+    /** approximate assignment for large k: if > 0, the training vectors
+     * are assigned with an IndexHNSWFlat of this M, rebuilt over the
+     * centroids at each iteration, instead of the index passed to train
+     * (that gets the centroids at the end only) */
+    int assign_hnsw_M;
+
+    /// efSearch of the approximate assignment (trades recall for speed)
+    int assign_hnsw_efSearch;
+
+    /** L2 only: do not search the training vectors that provably keep
+     * their centroid. Each vector keeps a lower bound on the distance to
+     * its second nearest centroid, decreased by the largest centroid
+     * displacement at each iteration (as in Hamerly's k-means); the
+     * vectors that are closer than that to their current centroid are
+     * not searched. */
+    bool skip_stable_points;
+
+    /** initialize the centroids with k-means|| (Bahmani et al., "Scalable
+     * k-means++", VLDB'12) instead of random training points (train and
+     * train_encoded only). In each of init_rounds rounds, every training
+     * point is sampled with a probability proportional to its squared
+     * distance to the candidates, init_oversampling * k points in
+     * expectation. The candidates, weighted by the nb of points they
+     * are nearest to, are then reduced to k centroids with k-means++. */
+    bool init_kmeans_parallel;
+    int init_rounds;           ///< nb of sampling rounds of k-means||
+    float init_oversampling;   ///< expected nb of samples per round / k
+
     /// sets reasonable defaults
     ClusteringParameters ();
 };
 
 
+/** Supplies the training vectors of the mini-batch k-means
+ * (Clustering::train_minibatch) by batches, so that the training set
+ * does not need to be in RAM. */
+struct ClusteringDataSource {
+    /** copy up to n vectors to x (size n * d)
+     *
+     * @return nb of vectors copied, 0 if there are no more vectors
+     */
+    virtual size_t next_batch (size_t n, float *x) = 0;
+
+    virtual ~ClusteringDataSource () {}
+};
+
+
+/** Random samples from an in-RAM training set: the vectors are visited
+ * in random order, npass times. */
+struct ClusteringDataSourceArray: ClusteringDataSource {
+    size_t d, n;
+    const float *x;
+    int npass;              ///< nb of passes over the training set
+    int64_t seed;
+
+    int pass;               ///< current pass
+    size_t ofs;             ///< offset in the current pass
+    std::vector<int> perm;  ///< order of the vectors in the current pass
+
+    ClusteringDataSourceArray (size_t d, size_t n, const float *x,
+                               int npass = 1, int64_t seed = 1234);
+
+    size_t next_batch (size_t nb, float *x_out) override;
+};
+
+
+/** Raw float32 vectors read sequentially from an IOReader (eg. a
+ * FileIOReader on a file of n * d floats). The data is read in one pass,
+ * so it should be in random order. */
+struct ClusteringDataSourceReader: ClusteringDataSource {
+    IOReader *reader;
+    size_t d;
+
+    ClusteringDataSourceReader (IOReader *reader, size_t d);
+
+    size_t next_batch (size_t n, float *x) override;
+};
+
+
+/** Collective operations between the processes (workers) of a
+ * distributed k-means, see Clustering::train_distributed. All the
+ * workers call the same operations in the same order. An MPI transport
+ * is eg. a subclass whose allreduce_sum calls
+ *
+ *   MPI_Allreduce (MPI_IN_PLACE, x, n, MPI_FLOAT, MPI_SUM, comm);
+ *
+ * For the k-means to be deterministic, all the workers must get the
+ * same result bits (this is the case for MPI and NCCL).
+ */
+struct ClusteringComm {
+    int rank;      ///< rank of this worker, 0 <= rank < nworker
+    int nworker;   ///< nb of workers
+
+    ClusteringComm (int rank, int nworker): rank (rank), nworker (nworker)
+    {}
+
+    /// x[i] = sum over the workers of x[i], on all the workers
+    virtual void allreduce_sum (size_t n, float *x) = 0;
+    virtual void allreduce_sum (size_t n, double *x) = 0;
+
+    /// copy the nbytes of x of worker 0 to the other workers
+    virtual void broadcast (size_t nbytes, void *x) = 0;
+
+    virtual ~ClusteringComm () {}
+};
+
+
 struct ClusteringIterationStats {
     float obj;               ///< objective values (sum of distances reported by index)
     double time;             ///< seconds for iteration
     double time_search;      ///< seconds for just search
     double imbalance_factor; ///< imbalance factor of iteration
     int nsplit;              ///< number of cluster splits
+    size_t nsearch;          ///< nb of training vectors that were searched
 };
 
 
@@ -100,6 +208,66 @@ struct Clustering: ClusteringParameters {
                         const Index * codec, Index & index,
                         const float *weights = nullptr);
 
+    /** distributed k-means: each worker calls it with its part of the
+     * training set, and all get the same centroids.
+     *
+     * Each iteration assigns the local vectors and computes the local
+     * centroid sums (compute_centroids), that are summed over the
+     * workers with comm.allreduce_sum. The initial centroids are drawn
+     * from the workers proportionally to the size of their part, the
+     * subsampling to k * max_points_per_centroid vectors is done
+     * proportionally as well. The input centroids, if any, must be the
+     * same on all workers. The stats are global except
+     * imbalance_factor and nsearch, that are local. init_kmeans_parallel
+     * is not supported.
+     *
+     * @param nx   nb of local training vectors, may be 0
+     */
+    void train_distributed (idx_t nx, const float * x, Index & index,
+                            ClusteringComm & comm,
+                            const float *weights = nullptr);
+
+    /// train_encoded or train_distributed if comm is not NULL
+    void train_encoded_distributed (idx_t nx, const uint8_t *x_in,
+                                    const Index * codec, Index & index,
+                                    ClusteringComm *comm,
+                                    const float *weights = nullptr);
+
+    /** mini-batch k-means (Sculley, "Web-scale k-means clustering",
+     * WWW'10) on vectors supplied by a data source.
+     *
+     * Each iteration assigns a batch of batch_size vectors and moves
+     * their centroids towards them, with a per-centroid learning rate
+     * 1 / (nb of vectors assigned to the centroid so far), so that each
+     * centroid is the running mean of its vectors. The centroids that
+     * are not provided as input are initialized with the first
+     * vectors of the source, and the centroids that have never been
+     * assigned a vector are re-seeded with random vectors of the batch
+     * (reported as nsplit). The iterations stop when the source is
+     * exhausted. The memory usage is batch_size * d + k * d floats.
+     *
+     * niter, nredo, max_points_per_centroid and the weights are not
+     * used.
+     */
+    void train_minibatch (ClusteringDataSource & source, Index & index);
+
+    /// mini-batch k-means on an in-RAM training set, with niter passes
+    void train_minibatch (idx_t n, const float *x, Index & index);
+
+    /** distributed mini-batch k-means: each worker reads batches of
+     * batch_size vectors from its own source. At each iteration, the
+     * per-centroid sums and counts of the batches of all workers are
+     * summed with comm.allreduce_sum, and each centroid moves to the
+     * running mean of its vectors (the same update as train_minibatch,
+     * applied to the whole batch at once). The centroids that are not
+     * provided as input are initialized with the first vectors of the
+     * source of worker 0. The iterations stop when all sources are
+     * exhausted.
+     */
+    void train_minibatch_distributed (ClusteringDataSource & source,
+                                      Index & index,
+                                      ClusteringComm & comm);
+
     /// Post-process the centroids after each centroid update.
     /// includes optional L2 normalization and nearest integer rounding
     void post_process_centroids ();
@@ -108,6 +276,62 @@ struct Clustering: ClusteringParameters {
 };
 
 
+/** Two-level k-means, for large k.
+ *
+ * The training set is first clustered into nc1 coarse clusters (sqrt(k)
+ * by default). Then each coarse cluster is clustered independently,
+ * into a number of centroids proportional to its size. The coarse
+ * clusters are processed in parallel, and the cost of an iteration is
+ * O(n_i * k_i * d) for coarse cluster i instead of O(n * k * d) for the
+ * flat k-means. The output is a flat table of k centroids, eg. for
+ * IndexIVF::quantizer.
+ *
+ * The ClusteringParameters apply to both levels.
+ */
+struct HierarchicalClustering: ClusteringParameters {
+    typedef Index::idx_t idx_t;
+    size_t d;              ///< dimension of the vectors
+    size_t k;              ///< nb of centroids
+
+    size_t nc1;            ///< nb of coarse clusters (0 = sqrt(k))
+
+    /** if > 0, the nb of vectors per cluster is bounded by
+     * balance_factor * (mean cluster size) in each coarse cluster. The
+     * constraint is enforced (approximately) by balance_niter iterations
+     * of capacity-constrained assignment after the k-means. */
+    float balance_factor;
+    int balance_niter;
+
+    /// final centroids (k * d)
+    std::vector<float> centroids;
+
+    /// nb of centroids allocated to each coarse cluster (size nc1)
+    std::vector<size_t> sub_k;
+
+    HierarchicalClustering (int d, int k);
+    HierarchicalClustering (int d, int k, const ClusteringParameters &cp);
+
+    /** run the two-level training
+     *
+     * @param x      training vectors, size n * d
+     * @param index  the centroids are added to it on output. Its metric
+     *               is used for the assignments
+     */
+    void train (idx_t n, const float *x, Index & index);
+
+    /** distributed two-level k-means, each worker calls it with its
+     * part of the training set. The coarse level is trained with
+     * Clustering::train_distributed. The second level runs the k-means
+     * of all the coarse clusters together, with one allreduce of the
+     * k centroid sums per iteration. balance_factor is not supported.
+     */
+    void train_distributed (idx_t n, const float *x, Index & index,
+                            ClusteringComm & comm);
+
+    virtual ~HierarchicalClustering() {}
+};
+
+
 /** simplified interface
  *
  * @param d dimension of the data
@@ -121,6 +345,25 @@ float kmeans_clustering (size_t d, size_t n, size_t k,
                          const float *x,
                          float *centroids);
 
+/** Handle empty clusters by splitting larger ones, after a centroid
+ * update.
+ *
+ * It works by slightly changing the centroids to make 2 clusters from
+ * a single one.
+ *
+ * @param n          nb of training vectors
+ * @param k_frozen   do not update the k_frozen first centroids
+ * @param hassign    weight of the vectors assigned to each non-frozen
+ *                   centroid (size k - k_frozen), updated for the split
+ *                   clusters
+ * @param centroids  centroid vectors, size k * d
+ * @return           nb of spliting operations (larger is worse)
+ */
+int split_clusters (size_t d, size_t k, size_t n,
+                    size_t k_frozen,
+                    float * hassign,
+                    float * centroids);
+
 
 
 }
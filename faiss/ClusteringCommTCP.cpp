@@ -0,0 +1,300 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/ClusteringCommTCP.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <chrono>
+#include <thread>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/utils.h>
+
+namespace faiss {
+
+namespace {
+
+const uint32_t comm_magic = 0x434b5846;   // "FXKC"
+
+enum CommOp {
+    OP_HELLO = 0,
+    OP_ALLREDUCE_FLOAT = 1,
+    OP_ALLREDUCE_DOUBLE = 2,
+    OP_BROADCAST = 3,
+};
+
+struct MessageHeader {
+    uint32_t magic;
+    uint32_t op;
+    uint64_t size;   // nb of bytes that follow, or the rank for OP_HELLO
+};
+
+bool write_all (int fd, const void *buf, size_t n)
+{
+    const char *p = (const char*)buf;
+    while (n > 0) {
+        ssize_t nw = send (fd, p, n, MSG_NOSIGNAL);
+        if (nw < 0 && errno == EINTR) {
+            continue;
+        }
+        if (nw <= 0) {
+            return false;
+        }
+        p += nw;
+        n -= nw;
+    }
+    return true;
+}
+
+bool read_all (int fd, void *buf, size_t n)
+{
+    char *p = (char*)buf;
+    while (n > 0) {
+        ssize_t nr = recv (fd, p, n, 0);
+        if (nr < 0 && errno == EINTR) {
+            continue;
+        }
+        if (nr <= 0) {
+            return false;
+        }
+        p += nr;
+        n -= nr;
+    }
+    return true;
+}
+
+void send_message (int fd, uint32_t op, uint64_t size, const void *data)
+{
+    MessageHeader h = {comm_magic, op, size};
+    bool ok = write_all (fd, &h, sizeof(h)) &&
+        (op == OP_HELLO || write_all (fd, data, size));
+    FAISS_THROW_IF_NOT_FMT (ok, "ClusteringCommTCP: send failed: %s",
+                            strerror(errno));
+}
+
+/// read a message whose op and size must match the expected ones
+void recv_message (int fd, uint32_t op, uint64_t size, void *data)
+{
+    MessageHeader h;
+    FAISS_THROW_IF_NOT_MSG (read_all (fd, &h, sizeof(h)) &&
+                            h.magic == comm_magic,
+                            "ClusteringCommTCP: connection lost");
+    FAISS_THROW_IF_NOT_FMT (h.op == op && h.size == size,
+            "ClusteringCommTCP: mismatched collective operations "
+            "(op %d size %zd, expected op %d size %zd)",
+            int(h.op), size_t(h.size), int(op), size_t(size));
+    FAISS_THROW_IF_NOT_MSG (read_all (fd, data, size),
+                            "ClusteringCommTCP: connection lost");
+}
+
+void set_nodelay (int fd)
+{
+    int one = 1;
+    setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+/// @return the socket, -1 if no address accepted the connection
+int try_connect (const std::string & host, int port)
+{
+    addrinfo hints, *res = nullptr;
+    memset (&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    std::string port_str = std::to_string (port);
+    int err = getaddrinfo (host.c_str(), port_str.c_str(), &hints, &res);
+    FAISS_THROW_IF_NOT_FMT (err == 0, "could not resolve %s: %s",
+                            host.c_str(), gai_strerror (err));
+    int fd = -1;
+    for (addrinfo *ai = res; ai; ai = ai->ai_next) {
+        fd = socket (ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (::connect (fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close (fd);
+        fd = -1;
+    }
+    freeaddrinfo (res);
+    return fd;
+}
+
+} // anonymous namespace
+
+
+ClusteringCommTCP::ClusteringCommTCP (int rank, int nworker,
+                                      const char *host, int port):
+    ClusteringComm (rank, nworker), host (host), port (port),
+    connect_timeout_ms (60000), listen_fd (-1)
+{
+    if (rank != 0 || nworker == 1) {
+        return;
+    }
+    int fd = socket (AF_INET6, SOCK_STREAM, 0);
+    FAISS_THROW_IF_NOT_FMT (fd >= 0, "socket: %s", strerror(errno));
+    int one = 1;
+    setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    int zero = 0; // accept IPv4 connections as well
+    setsockopt (fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+
+    sockaddr_in6 addr;
+    memset (&addr, 0, sizeof(addr));
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr = in6addr_any;
+    addr.sin6_port = htons (port);
+    if (bind (fd, (sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen (fd, nworker) != 0) {
+        int err = errno;
+        close (fd);
+        FAISS_THROW_FMT ("could not listen on port %d: %s",
+                         port, strerror(err));
+    }
+    socklen_t len = sizeof(addr);
+    getsockname (fd, (sockaddr*)&addr, &len);
+    this->port = ntohs (addr.sin6_port);
+    listen_fd = fd;
+}
+
+void ClusteringCommTCP::connect ()
+{
+    FAISS_THROW_IF_NOT_MSG (fds.empty(), "already connected");
+    if (nworker == 1) {
+        return;
+    }
+    double t0 = getmillisecs ();
+
+    if (rank == 0) {
+        fds.resize (nworker - 1, -1);
+        for (int i = 1; i < nworker; i++) {
+            pollfd pfd;
+            pfd.fd = listen_fd;
+            pfd.events = POLLIN;
+            int remaining = connect_timeout_ms - int(getmillisecs () - t0);
+            int ret = remaining > 0 ? poll (&pfd, 1, remaining) : 0;
+            if (ret < 0 && errno == EINTR) {
+                i--;
+                continue;
+            }
+            FAISS_THROW_IF_NOT_FMT (ret > 0,
+                  "ClusteringCommTCP: only %d of %d workers connected",
+                  i - 1, nworker - 1);
+            int fd = accept (listen_fd, nullptr, nullptr);
+            FAISS_THROW_IF_NOT_FMT (fd >= 0, "accept: %s", strerror(errno));
+            set_nodelay (fd);
+            MessageHeader h;
+            bool ok = read_all (fd, &h, sizeof(h)) &&
+                h.magic == comm_magic && h.op == OP_HELLO &&
+                h.size > 0 && h.size < uint64_t(nworker) &&
+                fds[h.size - 1] < 0;
+            if (!ok) {
+                close (fd);
+                FAISS_THROW_MSG ("ClusteringCommTCP: invalid worker "
+                                 "connection");
+            }
+            fds[h.size - 1] = fd;
+        }
+        close (listen_fd);
+        listen_fd = -1;
+        return;
+    }
+
+    // worker 0 may not listen yet
+    int fd;
+    while ((fd = try_connect (host, port)) < 0) {
+        FAISS_THROW_IF_NOT_FMT (
+              getmillisecs () - t0 < connect_timeout_ms,
+              "ClusteringCommTCP: could not connect to %s:%d",
+              host.c_str(), port);
+        std::this_thread::sleep_for (std::chrono::milliseconds (100));
+    }
+    set_nodelay (fd);
+    fds.push_back (fd);
+    send_message (fd, OP_HELLO, rank, nullptr);
+}
+
+template <typename T>
+void ClusteringCommTCP::allreduce_sum_T (size_t n, T *x)
+{
+    if (nworker == 1) {
+        return;
+    }
+    FAISS_THROW_IF_NOT_MSG (!fds.empty(), "connect() was not called");
+    uint32_t op = sizeof(T) == sizeof(float) ?
+        OP_ALLREDUCE_FLOAT : OP_ALLREDUCE_DOUBLE;
+    size_t size = n * sizeof(T);
+
+    if (rank != 0) {
+        send_message (fds[0], op, size, x);
+        recv_message (fds[0], op, size, x);
+        return;
+    }
+
+    // sum in rank order, the result does not depend on the timing
+    std::vector<T> buf (n);
+    for (int fd : fds) {
+        recv_message (fd, op, size, buf.data());
+        for (size_t i = 0; i < n; i++) {
+            x[i] += buf[i];
+        }
+    }
+    for (int fd : fds) {
+        send_message (fd, op, size, x);
+    }
+}
+
+void ClusteringCommTCP::allreduce_sum (size_t n, float *x)
+{
+    allreduce_sum_T (n, x);
+}
+
+void ClusteringCommTCP::allreduce_sum (size_t n, double *x)
+{
+    allreduce_sum_T (n, x);
+}
+
+void ClusteringCommTCP::broadcast (size_t nbytes, void *x)
+{
+    if (nworker == 1) {
+        return;
+    }
+    FAISS_THROW_IF_NOT_MSG (!fds.empty(), "connect() was not called");
+    if (rank != 0) {
+        recv_message (fds[0], OP_BROADCAST, nbytes, x);
+        return;
+    }
+    for (int fd : fds) {
+        send_message (fd, OP_BROADCAST, nbytes, x);
+    }
+}
+
+ClusteringCommTCP::~ClusteringCommTCP ()
+{
+    for (int fd : fds) {
+        if (fd >= 0) {
+            close (fd);
+        }
+    }
+    if (listen_fd >= 0) {
+        close (listen_fd);
+    }
+}
+
+} // namespace faiss
@@ -0,0 +1,67 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#ifndef FAISS_CLUSTERING_COMM_TCP_H
+#define FAISS_CLUSTERING_COMM_TCP_H
+
+#include <string>
+#include <vector>
+
+#include <faiss/Clustering.h>
+
+namespace faiss {
+
+/** ClusteringComm over TCP connections between worker 0 and each of the
+ * other workers (star topology).
+ *
+ * For an allreduce, the workers send their array to worker 0, that sums
+ * them in rank order and sends the sum back, so all workers get the
+ * same bits. The traffic of worker 0 is 2 * (nworker - 1) times the
+ * array size, which is fine for a few tens of workers; use an MPI or
+ * NCCL subclass of ClusteringComm beyond that.
+ *
+ * The protocol is binary, in host byte order: all the machines must
+ * have the same endianness.
+ */
+struct ClusteringCommTCP: ClusteringComm {
+    std::string host;     ///< host of worker 0
+    int port;             ///< port of worker 0
+
+    /// how long connect() retries to reach worker 0, in ms
+    int connect_timeout_ms;
+
+    /** For worker 0, listen on port (0 = a free port, stored in port
+     * on output). The other workers connect to host:port in connect().
+     */
+    ClusteringCommTCP (int rank, int nworker,
+                       const char *host, int port);
+
+    /** establish the connections: worker 0 waits for the nworker - 1
+     * others, the others connect to worker 0 (retrying until it
+     * listens) */
+    void connect ();
+
+    void allreduce_sum (size_t n, float *x) override;
+    void allreduce_sum (size_t n, double *x) override;
+    void broadcast (size_t nbytes, void *x) override;
+
+    ~ClusteringCommTCP () override;
+
+    // private
+    int listen_fd;
+    /// worker 0: socket of worker r at r - 1. Others: the socket to 0
+    std::vector<int> fds;
+
+    template <typename T>
+    void allreduce_sum_T (size_t n, T *x);
+};
+
+} // namespace faiss
+
+#endif
@@ -0,0 +1,246 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/CompactIdsInvertedLists.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cinttypes>
+#include <cstring>
+
+#include <faiss/impl/FaissAssert.h>
+
+
+namespace faiss {
+
+
+CompactIdsInvertedLists::CompactIdsInvertedLists (
+        size_t nlist, size_t code_size, IdStorage id_storage, idx_t id_base):
+    InvertedLists (nlist, code_size),
+    id_storage (id_storage), id_base (id_base)
+{
+    FAISS_THROW_IF_NOT_MSG (code_size != InvertedLists::INVALID_CODE_SIZE,
+                            "block codes are not supported");
+    codes.resize (nlist);
+    if (id_storage == IDS_32BIT) {
+        ids32.resize (nlist);
+    } else {
+        id_runs.resize (nlist);
+    }
+}
+
+CompactIdsInvertedLists::CompactIdsInvertedLists (
+        const InvertedLists & il, IdStorage id_storage, idx_t id_base):
+    CompactIdsInvertedLists (il.nlist, il.code_size, id_storage, id_base)
+{
+    for (size_t l = 0; l < nlist; l++) {
+        size_t n = il.list_size (l);
+        if (n > 0) {
+            add_entries (l, n, ScopedIds (&il, l).get (),
+                         ScopedCodes (&il, l).get ());
+        }
+    }
+}
+
+size_t CompactIdsInvertedLists::list_size (size_t list_no) const
+{
+    assert (list_no < nlist);
+    return codes[list_no].size () / code_size;
+}
+
+const uint8_t * CompactIdsInvertedLists::get_codes (size_t list_no) const
+{
+    assert (list_no < nlist);
+    return codes[list_no].data ();
+}
+
+const InvertedLists::idx_t * CompactIdsInvertedLists::get_ids (
+        size_t list_no) const
+{
+    size_t n = list_size (list_no);
+    idx_t *ids = new idx_t [n];
+    decode_ids (list_no, ids);
+    return ids;
+}
+
+void CompactIdsInvertedLists::release_ids (
+        size_t, const idx_t *ids) const
+{
+    delete [] ids;
+}
+
+InvertedLists::idx_t CompactIdsInvertedLists::get_single_id (
+        size_t list_no, size_t offset) const
+{
+    assert (offset < list_size (list_no));
+    if (id_storage == IDS_32BIT) {
+        uint32_t v = ids32[list_no][offset];
+        return v == UINT32_MAX ? -1 : id_base + v;
+    }
+    const std::vector<IdRun> & runs = id_runs[list_no];
+    // last run that starts at or before offset
+    auto it = std::upper_bound (
+          runs.begin (), runs.end (), offset,
+          [] (size_t o, const IdRun & r) { return o < r.offset; });
+    assert (it != runs.begin ());
+    --it;
+    return it->id + idx_t (offset - it->offset);
+}
+
+bool CompactIdsInvertedLists::lazy_ids () const
+{
+    return true;
+}
+
+void CompactIdsInvertedLists::decode_ids (size_t list_no, idx_t *out) const
+{
+    size_t n = list_size (list_no);
+    if (id_storage == IDS_32BIT) {
+        const uint32_t *v = ids32[list_no].data ();
+        for (size_t i = 0; i < n; i++) {
+            out[i] = v[i] == UINT32_MAX ? -1 : id_base + v[i];
+        }
+        return;
+    }
+    const std::vector<IdRun> & runs = id_runs[list_no];
+    for (size_t r = 0; r < runs.size (); r++) {
+        size_t end = r + 1 < runs.size () ? runs[r + 1].offset : n;
+        for (size_t i = runs[r].offset; i < end; i++) {
+            out[i] = runs[r].id + idx_t (i - runs[r].offset);
+        }
+    }
+}
+
+uint32_t CompactIdsInvertedLists::encode_id32 (idx_t id) const
+{
+    if (id == -1) {
+        return UINT32_MAX;
+    }
+    FAISS_THROW_IF_NOT_FMT (
+          id >= id_base && id - id_base < idx_t (UINT32_MAX),
+          "id %" PRId64 " cannot be stored as 32 bits from id_base %" PRId64,
+          id, id_base);
+    return uint32_t (id - id_base);
+}
+
+void CompactIdsInvertedLists::encode_ids (
+        size_t list_no, size_t n, const idx_t *ids)
+{
+    if (id_storage == IDS_32BIT) {
+        std::vector<uint32_t> & v = ids32[list_no];
+        v.resize (n);
+        for (size_t i = 0; i < n; i++) {
+            v[i] = encode_id32 (ids[i]);
+        }
+        return;
+    }
+    std::vector<IdRun> & runs = id_runs[list_no];
+    runs.clear ();
+    for (size_t i = 0; i < n; i++) {
+        if (runs.empty () ||
+            runs.back ().id + idx_t (i - runs.back ().offset) != ids[i]) {
+            runs.push_back (IdRun {i, ids[i]});
+        }
+    }
+}
+
+size_t CompactIdsInvertedLists::add_entries (
+           size_t list_no, size_t n_entry,
+           const idx_t* ids_in, const uint8_t *code)
+{
+    if (n_entry == 0) return 0;
+    assert (list_no < nlist);
+    size_t o = list_size (list_no);
+    // encode the ids first, so that an invalid id leaves the list unchanged
+    if (id_storage == IDS_32BIT) {
+        std::vector<uint32_t> v (n_entry);
+        for (size_t i = 0; i < n_entry; i++) {
+            v[i] = encode_id32 (ids_in[i]);
+        }
+        ids32[list_no].insert (ids32[list_no].end (), v.begin (), v.end ());
+    } else {
+        std::vector<IdRun> & runs = id_runs[list_no];
+        for (size_t i = 0; i < n_entry; i++) {
+            if (runs.empty () ||
+                runs.back ().id + idx_t (o + i - runs.back ().offset) !=
+                    ids_in[i]) {
+                runs.push_back (IdRun {o + i, ids_in[i]});
+            }
+        }
+    }
+    codes[list_no].resize ((o + n_entry) * code_size);
+    memcpy (&codes[list_no][o * code_size], code, code_size * n_entry);
+    return o;
+}
+
+void CompactIdsInvertedLists::update_entries (
+      size_t list_no, size_t offset, size_t n_entry,
+      const idx_t *ids_in, const uint8_t *codes_in)
+{
+    size_t n = list_size (list_no);
+    assert (n_entry + offset <= n);
+    if (id_storage == IDS_32BIT) {
+        for (size_t i = 0; i < n_entry; i++) {
+            ids32[list_no][offset + i] = encode_id32 (ids_in[i]);
+        }
+    } else {
+        std::vector<idx_t> ids (n);
+        decode_ids (list_no, ids.data ());
+        std::copy (ids_in, ids_in + n_entry, ids.begin () + offset);
+        encode_ids (list_no, n, ids.data ());
+    }
+    memcpy (&codes[list_no][offset * code_size], codes_in,
+            code_size * n_entry);
+}
+
+void CompactIdsInvertedLists::resize (size_t list_no, size_t new_size)
+{
+    size_t n = list_size (list_no);
+    if (id_storage == IDS_32BIT) {
+        ids32[list_no].resize (new_size, UINT32_MAX);
+    } else if (new_size < n) {
+        std::vector<IdRun> & runs = id_runs[list_no];
+        while (!runs.empty () && runs.back ().offset >= new_size) {
+            runs.pop_back ();
+        }
+    } else {
+        std::vector<idx_t> ids (new_size, -1);
+        decode_ids (list_no, ids.data ());
+        encode_ids (list_no, new_size, ids.data ());
+    }
+    codes[list_no].resize (new_size * code_size);
+}
+
+size_t CompactIdsInvertedLists::ids_bytes () const
+{
+    size_t nbytes = 0;
+    for (size_t l = 0; l < nlist; l++) {
+        if (id_storage == IDS_32BIT) {
+            nbytes += ids32[l].size () * sizeof (uint32_t);
+        } else {
+            nbytes += id_runs[l].size () * sizeof (IdRun);
+        }
+    }
+    return nbytes;
+}
+
+MemoryUsage CompactIdsInvertedLists::memory_usage () const
+{
+    MemoryUsage mu = MemoryUsage::object ("CompactIdsInvertedLists");
+    mu.add ("codes", codes);
+    if (id_storage == IDS_32BIT) {
+        mu.add ("ids", ids32);
+    } else {
+        mu.add ("ids", id_runs);
+    }
+    return mu;
+}
+
+
+} // namespace faiss
@@ -0,0 +1,106 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#ifndef FAISS_COMPACT_IDS_INVERTED_LISTS_H
+#define FAISS_COMPACT_IDS_INVERTED_LISTS_H
+
+#include <stdint.h>
+
+#include <vector>
+
+#include <faiss/InvertedLists.h>
+
+
+namespace faiss {
+
+/** In-memory inverted lists that store the ids in less than 64 bits per
+ * entry, for indexes where the ids take a large fraction of the memory
+ * (eg. 8 or 16-byte PQ codes).
+ *
+ * - IDS_32BIT: the ids are stored as 32-bit offsets from id_base, so
+ *   they must be in [id_base, id_base + 2^32 - 1), or -1 (tombstones).
+ * - IDS_IMPLICIT: the ids of a list are stored as runs of consecutive
+ *   ids. It takes no memory per entry when the ids of each list are
+ *   consecutive, eg. when the database is sorted by inverted list and the
+ *   ids are the positions in that order. Arbitrary ids are supported, but
+ *   they take 16 bytes per run.
+ *
+ * get_ids decodes the ids of a list to a temporary array (released by
+ * release_ids), so the ids are available through ScopedIds as usual.
+ * lazy_ids() is true, so that IndexIVF::search decodes only the ids of
+ * the results.
+ */
+struct CompactIdsInvertedLists: InvertedLists {
+
+    enum IdStorage {
+        IDS_32BIT,
+        IDS_IMPLICIT,
+    };
+
+    IdStorage id_storage;
+
+    /// IDS_32BIT: smallest id that can be stored
+    idx_t id_base;
+
+    std::vector<std::vector<uint8_t> > codes;
+
+    /// IDS_32BIT: id - id_base, UINT32_MAX for -1
+    std::vector<std::vector<uint32_t> > ids32;
+
+    /// IDS_IMPLICIT: entries offset, offset + 1, ... of the list, up to
+    /// the next run, have ids id, id + 1, ...
+    struct IdRun {
+        size_t offset;
+        idx_t id;
+    };
+    std::vector<std::vector<IdRun> > id_runs;
+
+    CompactIdsInvertedLists (size_t nlist, size_t code_size,
+                             IdStorage id_storage, idx_t id_base = 0);
+
+    /// copy the contents of il
+    CompactIdsInvertedLists (const InvertedLists & il,
+                             IdStorage id_storage, idx_t id_base = 0);
+
+    size_t list_size (size_t list_no) const override;
+    const uint8_t * get_codes (size_t list_no) const override;
+    const idx_t * get_ids (size_t list_no) const override;
+    void release_ids (size_t list_no, const idx_t *ids) const override;
+    idx_t get_single_id (size_t list_no, size_t offset) const override;
+    bool lazy_ids () const override;
+
+    size_t add_entries (
+           size_t list_no, size_t n_entry,
+           const idx_t* ids, const uint8_t *code) override;
+
+    void update_entries (size_t list_no, size_t offset, size_t n_entry,
+                         const idx_t *ids, const uint8_t *code) override;
+
+    /// the new entries have id -1
+    void resize (size_t list_no, size_t new_size) override;
+
+    /// nb of bytes used by the ids
+    size_t ids_bytes () const;
+
+    MemoryUsage memory_usage () const override;
+
+  private:
+    /// decode the ids of a list to out (size list_size)
+    void decode_ids (size_t list_no, idx_t *out) const;
+
+    /// replace the ids of a list, that has n entries
+    void encode_ids (size_t list_no, size_t n, const idx_t *ids);
+
+    uint32_t encode_id32 (idx_t id) const;
+};
+
+
+} // namespace faiss
+
+#endif
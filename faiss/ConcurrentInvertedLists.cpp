@@ -0,0 +1,186 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/ConcurrentInvertedLists.h>
+
+#include <cassert>
+#include <cstring>
+
+#include <faiss/impl/FaissAssert.h>
+
+
+namespace faiss {
+
+
+/*****************************************
+ * ConcurrentInvertedLists implementation
+ ******************************************/
+
+ConcurrentInvertedLists::List::List ():
+    size (0), codes (nullptr), ids (nullptr), capacity (0),
+    retired_capacity (0)
+{}
+
+ConcurrentInvertedLists::ConcurrentInvertedLists (
+        size_t nlist, size_t code_size):
+    InvertedLists (nlist, code_size),
+    lists (new List [nlist]),
+    min_capacity (16)
+{
+    FAISS_THROW_IF_NOT_MSG (code_size != InvertedLists::INVALID_CODE_SIZE,
+                            "block codes are not supported");
+}
+
+size_t ConcurrentInvertedLists::list_size (size_t list_no) const
+{
+    assert (list_no < nlist);
+    return lists[list_no].size.load (std::memory_order_acquire);
+}
+
+const uint8_t * ConcurrentInvertedLists::get_codes (size_t list_no) const
+{
+    assert (list_no < nlist);
+    return lists[list_no].codes.load (std::memory_order_acquire);
+}
+
+const InvertedLists::idx_t * ConcurrentInvertedLists::get_ids (
+        size_t list_no) const
+{
+    assert (list_no < nlist);
+    return lists[list_no].ids.load (std::memory_order_acquire);
+}
+
+void ConcurrentInvertedLists::reserve (List & l, size_t n)
+{
+    if (n <= l.capacity) {
+        return;
+    }
+    size_t new_capacity = std::max (min_capacity, l.capacity * 2);
+    if (new_capacity < n) {
+        new_capacity = n;
+    }
+    size_t size = l.size.load (std::memory_order_relaxed);
+    uint8_t *old_codes = l.codes.load (std::memory_order_relaxed);
+    idx_t *old_ids = l.ids.load (std::memory_order_relaxed);
+
+    uint8_t *new_codes = new uint8_t [new_capacity * code_size];
+    idx_t *new_ids = new idx_t [new_capacity];
+    if (size > 0) {
+        memcpy (new_codes, old_codes, size * code_size);
+        memcpy (new_ids, old_ids, size * sizeof (idx_t));
+    }
+
+    // readers that see the new buffers see at least size valid entries
+    l.codes.store (new_codes, std::memory_order_release);
+    l.ids.store (new_ids, std::memory_order_release);
+
+    if (old_codes) {
+        l.retired_codes.push_back (old_codes);
+        l.retired_ids.push_back (old_ids);
+        l.retired_capacity += l.capacity;
+    }
+    l.capacity = new_capacity;
+}
+
+size_t ConcurrentInvertedLists::add_entries (
+           size_t list_no, size_t n_entry,
+           const idx_t* ids_in, const uint8_t *code)
+{
+    if (n_entry == 0) return 0;
+    assert (list_no < nlist);
+    List & l = lists[list_no];
+    size_t o = l.size.load (std::memory_order_relaxed);
+    reserve (l, o + n_entry);
+    memcpy (l.codes.load (std::memory_order_relaxed) + o * code_size,
+            code, n_entry * code_size);
+    memcpy (l.ids.load (std::memory_order_relaxed) + o,
+            ids_in, n_entry * sizeof (idx_t));
+    // publish the new entries
+    l.size.store (o + n_entry, std::memory_order_release);
+    return o;
+}
+
+void ConcurrentInvertedLists::update_entries (
+      size_t list_no, size_t offset, size_t n_entry,
+      const idx_t *ids_in, const uint8_t *codes_in)
+{
+    assert (list_no < nlist);
+    List & l = lists[list_no];
+    FAISS_THROW_IF_NOT (offset + n_entry <= l.size.load ());
+    memcpy (l.codes.load () + offset * code_size,
+            codes_in, code_size * n_entry);
+    memcpy (l.ids.load () + offset, ids_in, n_entry * sizeof (idx_t));
+}
+
+void ConcurrentInvertedLists::resize (size_t list_no, size_t new_size)
+{
+    assert (list_no < nlist);
+    List & l = lists[list_no];
+    size_t size = l.size.load (std::memory_order_relaxed);
+    if (new_size > size) {
+        reserve (l, new_size);
+        memset (l.codes.load (std::memory_order_relaxed) + size * code_size,
+                0, (new_size - size) * code_size);
+        memset (l.ids.load (std::memory_order_relaxed) + size,
+                0, (new_size - size) * sizeof (idx_t));
+    }
+    l.size.store (new_size, std::memory_order_release);
+}
+
+void ConcurrentInvertedLists::reclaim_memory ()
+{
+    for (size_t i = 0; i < nlist; i++) {
+        List & l = lists[i];
+        for (uint8_t *p: l.retired_codes) {
+            delete [] p;
+        }
+        for (idx_t *p: l.retired_ids) {
+            delete [] p;
+        }
+        l.retired_codes.clear ();
+        l.retired_ids.clear ();
+        l.retired_capacity = 0;
+    }
+}
+
+size_t ConcurrentInvertedLists::retired_bytes () const
+{
+    size_t nbytes = 0;
+    for (size_t i = 0; i < nlist; i++) {
+        nbytes += lists[i].retired_capacity * (code_size + sizeof (idx_t));
+    }
+    return nbytes;
+}
+
+MemoryUsage ConcurrentInvertedLists::memory_usage () const
+{
+    MemoryUsage mu = MemoryUsage::object ("ConcurrentInvertedLists");
+    size_t ntotal = 0, capacity = 0;
+    for (size_t i = 0; i < nlist; i++) {
+        ntotal += lists[i].size.load ();
+        capacity += lists[i].capacity;
+    }
+    mu.add ("lists", nlist * sizeof (List), nlist * sizeof (List));
+    mu.add ("codes", ntotal * code_size, capacity * code_size);
+    mu.add ("ids", ntotal * sizeof (idx_t), capacity * sizeof (idx_t));
+    mu.add ("retired", 0, retired_bytes ());
+    return mu;
+}
+
+ConcurrentInvertedLists::~ConcurrentInvertedLists ()
+{
+    reclaim_memory ();
+    for (size_t i = 0; i < nlist; i++) {
+        delete [] lists[i].codes.load ();
+        delete [] lists[i].ids.load ();
+    }
+}
+
+
+} // namespace faiss
@@ -0,0 +1,108 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#ifndef FAISS_CONCURRENT_INVERTED_LISTS_H
+#define FAISS_CONCURRENT_INVERTED_LISTS_H
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <faiss/InvertedLists.h>
+
+
+namespace faiss {
+
+/** Inverted lists that support appending entries while other threads
+ * read them, without locks.
+ *
+ * Each list is a pair of code and id buffers that are never modified
+ * below the published list size. When a buffer is full, a buffer twice as
+ * large is allocated, the entries are copied and the new buffer is
+ * published. The old buffer is retired but not freed, because readers may
+ * still use it: the retired buffers take at most as much memory as the
+ * current ones, and they are freed by reclaim_memory() or the destructor.
+ *
+ * The size of a list is published (release semantics) after its entries
+ * are written, and the buffers are published before the size. So a reader
+ * that gets list_size() = n and then calls get_codes() / get_ids() always
+ * sees n valid entries.
+ *
+ * Consistency guarantees for an IndexIVF that uses these lists, with one
+ * thread calling add_with_ids and any number of threads calling search:
+ *  - a search sees all vectors added by add_with_ids calls that returned
+ *    before the search started;
+ *  - the vectors of a concurrent add_with_ids call may be only partially
+ *    visible (some inverted lists are updated before others);
+ *  - results are never corrupted.
+ * The index must not use a direct map, and ntotal is only meaningful
+ * when no add is running. update_entries, resize to a smaller size,
+ * reset and reclaim_memory must not run concurrently with readers.
+ *
+ * Several writer threads can add to different lists concurrently, as for
+ * the other InvertedLists.
+ */
+struct ConcurrentInvertedLists: InvertedLists {
+
+    struct List {
+        std::atomic<size_t> size;      ///< published nb of entries
+        std::atomic<uint8_t*> codes;   ///< size capacity * code_size
+        std::atomic<idx_t*> ids;       ///< size capacity
+        size_t capacity;               ///< accessed by the writer only
+
+        /// buffers that were replaced by larger ones
+        std::vector<uint8_t*> retired_codes;
+        std::vector<idx_t*> retired_ids;
+        size_t retired_capacity;       ///< total capacity of the retired
+
+        List ();
+    };
+
+    std::unique_ptr<List[]> lists;
+
+    /// initial capacity of the lists (in entries)
+    size_t min_capacity;
+
+    ConcurrentInvertedLists (size_t nlist, size_t code_size);
+
+    size_t list_size (size_t list_no) const override;
+    const uint8_t * get_codes (size_t list_no) const override;
+    const idx_t * get_ids (size_t list_no) const override;
+
+    size_t add_entries (
+           size_t list_no, size_t n_entry,
+           const idx_t* ids, const uint8_t *code) override;
+
+    /// not atomic with respect to readers
+    void update_entries (size_t list_no, size_t offset, size_t n_entry,
+                         const idx_t *ids, const uint8_t *code) override;
+
+    /// grows with zeroed entries. Shrinking is not safe for readers
+    void resize (size_t list_no, size_t new_size) override;
+
+    /// free the retired buffers. Must not run concurrently with readers
+    void reclaim_memory ();
+
+    /// nb of bytes of the retired buffers
+    size_t retired_bytes () const;
+
+    /// capacity vs size of the current buffers, and the retired buffers
+    MemoryUsage memory_usage () const override;
+
+    ~ConcurrentInvertedLists () override;
+
+  private:
+    /// make sure the list can hold n entries (writer only)
+    void reserve (List & l, size_t n);
+};
+
+
+} // namespace faiss
+
+#endif
@@ -11,19 +11,187 @@
 
 #include <cstdio>
 #include <cassert>
+#include <algorithm>
 
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/impl/AuxIndexStructures.h>
 
 namespace faiss {
 
+/********************* CompactIdMap implementation */
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+/// the delta table is merged when larger than this...
+const size_t compact_min_delta_size = 4096;
+/// ... and than this fraction of the sorted arrays
+const size_t compact_delta_ratio = 32;
+
+bool cmp_first (const std::pair<idx_t, idx_t> & a,
+                const std::pair<idx_t, idx_t> & b)
+{
+    return a.first < b.first;
+}
+
+} // anonymous namespace
+
+
+CompactIdMap::CompactIdMap (): n_removed (0)
+{}
+
+void CompactIdMap::build (size_t n, const idx_t *keys, const idx_t *vals)
+{
+    clear ();
+    std::vector<std::pair<idx_t, idx_t> > entries (n);
+    for (size_t i = 0; i < n; i++) {
+        entries[i] = std::make_pair (keys[i], vals[i]);
+    }
+    std::stable_sort (entries.begin(), entries.end(), cmp_first);
+    ids.reserve (n);
+    values.reserve (n);
+    for (size_t i = 0; i < n; i++) {
+        if (i + 1 < n && entries[i + 1].first == entries[i].first) {
+            continue;
+        }
+        ids.push_back (entries[i].first);
+        values.push_back (entries[i].second);
+    }
+}
+
+CompactIdMap::idx_t CompactIdMap::get (idx_t id) const
+{
+    auto it = std::lower_bound (ids.begin(), ids.end(), id);
+    if (it != ids.end() && *it == id) {
+        return values [it - ids.begin()];
+    }
+    if (!delta.empty()) {
+        auto res = delta.find (id);
+        if (res != delta.end()) {
+            return res->second;
+        }
+    }
+    return -1;
+}
+
+void CompactIdMap::set (idx_t id, idx_t value)
+{
+    FAISS_THROW_IF_NOT (value >= 0);
+    auto it = std::lower_bound (ids.begin(), ids.end(), id);
+    if (it != ids.end() && *it == id) {
+        idx_t & v = values [it - ids.begin()];
+        if (v < 0) {
+            n_removed--;
+        }
+        v = value;
+        return;
+    }
+    delta [id] = value;
+    if (delta.size() > compact_min_delta_size &&
+        delta.size() * compact_delta_ratio > ids.size()) {
+        merge ();
+    }
+}
+
+bool CompactIdMap::erase (idx_t id)
+{
+    auto it = std::lower_bound (ids.begin(), ids.end(), id);
+    if (it != ids.end() && *it == id) {
+        idx_t & v = values [it - ids.begin()];
+        if (v < 0) {
+            return false;
+        }
+        v = -1;
+        n_removed++;
+        return true;
+    }
+    return delta.erase (id) > 0;
+}
+
+void CompactIdMap::merge ()
+{
+    if (delta.empty() && n_removed == 0) {
+        return;
+    }
+    std::vector<std::pair<idx_t, idx_t> > added (delta.begin(), delta.end());
+    std::sort (added.begin(), added.end(), cmp_first);
+    delta.clear ();
+
+    size_t n = ids.size() - n_removed + added.size();
+    std::vector<idx_t> new_ids (n), new_values (n);
+    size_t i = 0, j = 0, k = 0;
+    while (i < ids.size() || j < added.size()) {
+        if (j == added.size() ||
+            (i < ids.size() && ids[i] < added[j].first)) {
+            if (values[i] >= 0) {
+                new_ids[k] = ids[i];
+                new_values[k] = values[i];
+                k++;
+            }
+            i++;
+        } else {
+            new_ids[k] = added[j].first;
+            new_values[k] = added[j].second;
+            k++;
+            j++;
+        }
+    }
+    assert (k == n);
+    ids.swap (new_ids);
+    values.swap (new_values);
+    n_removed = 0;
+}
+
+size_t CompactIdMap::size () const
+{
+    return ids.size() - n_removed + delta.size();
+}
+
+void CompactIdMap::clear ()
+{
+    ids.clear ();
+    values.clear ();
+    delta.clear ();
+    n_removed = 0;
+}
+
+void CompactIdMap::get_entries (
+        std::vector<std::pair<idx_t, idx_t> > & entries) const
+{
+    entries.clear ();
+    entries.reserve (size ());
+    for (size_t i = 0; i < ids.size(); i++) {
+        if (values[i] >= 0) {
+            entries.push_back (std::make_pair (ids[i], values[i]));
+        }
+    }
+    size_t n0 = entries.size();
+    entries.insert (entries.end(), delta.begin(), delta.end());
+    std::sort (entries.begin() + n0, entries.end(), cmp_first);
+    std::inplace_merge (entries.begin(), entries.begin() + n0, entries.end(),
+                        cmp_first);
+}
+
+MemoryUsage CompactIdMap::memory_usage () const
+{
+    MemoryUsage mu = MemoryUsage::object ("CompactIdMap");
+    mu.add ("ids", ids);
+    mu.add ("values", values);
+    mu.add_hash_table ("delta", delta);
+    return mu;
+}
+
+
+/********************* DirectMap implementation */
+
 DirectMap::DirectMap(): type(NoMap)
 {}
 
 void DirectMap::set_type (Type new_type, const InvertedLists *invlists, size_t ntotal) {
 
     FAISS_THROW_IF_NOT (new_type == NoMap || new_type == Array ||
-                        new_type == Hashtable);
+                        new_type == Hashtable || new_type == Compact);
 
     if (new_type == type) {
         // nothing to do
@@ -32,6 +200,7 @@ void DirectMap::set_type (Type new_type, const InvertedLists *invlists, size_t n
 
     array.clear ();
     hashtable.clear ();
+    compact.clear ();
     type = new_type;
 
     if (new_type == NoMap) {
@@ -42,6 +211,9 @@ void DirectMap::set_type (Type new_type, const InvertedLists *invlists, size_t n
         hashtable.reserve (ntotal);
     }
 
+    // for Compact
+    std::vector<idx_t> all_ids, all_lo;
+
     for (size_t key = 0; key < invlists->nlist; key++) {
         size_t list_size = invlists->list_size (key);
         InvertedLists::ScopedIds idlist (invlists, key);
@@ -57,14 +229,24 @@ void DirectMap::set_type (Type new_type, const InvertedLists *invlists, size_t n
             for (long ofs = 0; ofs < list_size; ofs++) {
                 hashtable [idlist [ofs]] = lo_build(key, ofs);
             }
+        } else if (new_type == Compact) {
+            for (long ofs = 0; ofs < list_size; ofs++) {
+                all_ids.push_back (idlist [ofs]);
+                all_lo.push_back (lo_build(key, ofs));
+            }
         }
     }
+
+    if (new_type == Compact) {
+        compact.build (all_ids.size(), all_ids.data(), all_lo.data());
+    }
 }
 
 void DirectMap::clear()
 {
     array.clear ();
     hashtable.clear ();
+    compact.clear ();
 }
 
 
@@ -81,11 +263,42 @@ DirectMap::idx_t DirectMap::get (idx_t key) const
         auto res = hashtable.find (key);
         FAISS_THROW_IF_NOT_MSG (res != hashtable.end(), "key not found");
         return res->second;
+    } else if (type == Compact) {
+        idx_t lo = compact.get (key);
+        FAISS_THROW_IF_NOT_MSG (lo >= 0, "key not found");
+        return lo;
     } else {
         FAISS_THROW_MSG ("direct map not initialized");
     }
 }
 
+DirectMap::idx_t DirectMap::find (idx_t key) const
+{
+    if (type == Array) {
+        return key >= 0 && key < array.size() ? array[key] : -1;
+    } else if (type == Hashtable) {
+        auto res = hashtable.find (key);
+        return res == hashtable.end() ? -1 : res->second;
+    } else if (type == Compact) {
+        return compact.get (key);
+    } else {
+        FAISS_THROW_MSG ("direct map not initialized");
+    }
+}
+
+MemoryUsage DirectMap::memory_usage () const
+{
+    MemoryUsage mu = MemoryUsage::object ("DirectMap");
+    if (type == Array) {
+        mu.add ("array", array);
+    } else if (type == Hashtable) {
+        mu.add_hash_table ("hashtable", hashtable);
+    } else if (type == Compact) {
+        mu.add ("compact", compact.memory_usage ());
+    }
+    return mu;
+}
+
 
 
 void DirectMap::add_single_id (idx_t id, idx_t list_no, size_t offset)
@@ -103,6 +316,10 @@ void DirectMap::add_single_id (idx_t id, idx_t list_no, size_t offset)
         if (list_no >= 0) {
             hashtable[id] = lo_build (list_no, offset);
         }
+    } else if (type == Compact) {
+        if (list_no >= 0) {
+            compact.set (id, lo_build (list_no, offset));
+        }
     }
 
 }
@@ -123,8 +340,10 @@ DirectMapAdd::DirectMapAdd (DirectMap &direct_map, size_t n, const idx_t *xids):
         FAISS_THROW_IF_NOT (xids == nullptr);
         ntotal = direct_map.array.size();
         direct_map.array.resize (ntotal + n, -1);
-    } else if (type == DirectMap::Hashtable) {
+    } else if (type == DirectMap::Hashtable ||
+               type == DirectMap::Compact) {
         // can't parallel update hashtable so use temp array
+        ntotal = 0;
         all_ofs.resize (n, -1);
     }
 }
@@ -134,7 +353,8 @@ void DirectMapAdd::add (size_t i, idx_t list_no, size_t ofs)
 {
     if (type == DirectMap::Array) {
         direct_map.array [ntotal + i] = lo_build (list_no, ofs);
-    } else if (type == DirectMap::Hashtable) {
+    } else if (type == DirectMap::Hashtable ||
+               type == DirectMap::Compact) {
         all_ofs [i] = lo_build (list_no, ofs);
     }
 }
@@ -146,6 +366,13 @@ DirectMapAdd::~DirectMapAdd ()
             idx_t id = xids ? xids[i] : ntotal + i;
             direct_map.hashtable [id] = all_ofs [i];
         }
+    } else if (type == DirectMap::Compact) {
+        for (int i = 0; i < n; i++) {
+            if (all_ofs [i] >= 0) {
+                idx_t id = xids ? xids[i] : ntotal + i;
+                direct_map.compact.set (id, all_ofs [i]);
+            }
+        }
     }
 }
 
@@ -167,13 +394,18 @@ size_t DirectMap::remove_ids(const IDSelector& sel, InvertedLists *invlists)
 #pragma omp parallel for
         for (idx_t i = 0; i < nlist; i++) {
             idx_t l0 = invlists->list_size (i), l = l0, j = 0;
-            ScopedIds idsi (invlists, i);
+            // get_ids may return a copy that does not see the updates
+            std::vector<idx_t> idsi (l0);
+            {
+                ScopedIds sids (invlists, i);
+                std::copy (sids.get (), sids.get () + l0, idsi.begin ());
+            }
             while (j < l) {
                 if (sel.is_member (idsi[j])) {
                     l--;
+                    idsi[j] = idsi[l];
                     invlists->update_entry (
-                        i, j,
-                        invlists->get_single_id (i, l),
+                        i, j, idsi[l],
                         ScopedCodes (invlists, i, l).get()
                     );
                 } else {
@@ -190,7 +422,7 @@ size_t DirectMap::remove_ids(const IDSelector& sel, InvertedLists *invlists)
                 invlists->resize(i, invlists->list_size(i) - toremove[i]);
             }
         }
-    } else if (type == Hashtable) {
+    } else if (type == Hashtable || type == Compact) {
         const IDSelectorArray *sela =
             dynamic_cast<const IDSelectorArray*>(&sel);
         FAISS_THROW_IF_NOT_MSG (
@@ -200,12 +432,12 @@ size_t DirectMap::remove_ids(const IDSelector& sel, InvertedLists *invlists)
 
         for (idx_t i = 0; i < sela->n; i++) {
             idx_t id = sela->ids[i];
-            auto res = hashtable.find (id);
-            if (res != hashtable.end()) {
-                size_t list_no = lo_listno (res->second);
-                size_t offset = lo_offset (res->second);
+            idx_t lo = find (id);
+            if (lo >= 0) {
+                size_t list_no = lo_listno (lo);
+                size_t offset = lo_offset (lo);
                 idx_t last = invlists->list_size (list_no) - 1;
-                hashtable.erase (res);
+                erase_id (id);
                 if (offset < last) {
                     idx_t last_id = invlists->get_single_id (list_no, last);
                     invlists->update_entry (
@@ -214,7 +446,7 @@ size_t DirectMap::remove_ids(const IDSelector& sel, InvertedLists *invlists)
                         ScopedCodes (invlists, list_no, last).get()
                     );
                     // update hash entry for last element
-                    hashtable [last_id] = list_no << 32 | offset;
+                    set_id (last_id, lo_build (list_no, offset));
                 }
                 invlists->resize(list_no, last);
                 nremove++;
@@ -232,22 +464,22 @@ void DirectMap::update_codes (InvertedLists *invlists,
                               const idx_t *assign,
                               const uint8_t *codes)
 {
-    FAISS_THROW_IF_NOT (type == Array);
+    FAISS_THROW_IF_NOT (type == Array || type == Hashtable ||
+                        type == Compact);
 
     size_t code_size = invlists->code_size;
 
     for (size_t i = 0; i < n; i++) {
         idx_t id = ids[i];
-        FAISS_THROW_IF_NOT_MSG (0 <= id && id < array.size(),
-                                "id to update out of range");
+        idx_t dm = find (id);
+        FAISS_THROW_IF_NOT_MSG (dm >= 0, "id to update not found");
         { // remove old one
-            idx_t dm = array [id];
             int64_t ofs = lo_offset (dm);
             int64_t il = lo_listno (dm);
             size_t l = invlists->list_size (il);
             if (ofs != l - 1) { // move l - 1 to ofs
                 int64_t id2 = invlists->get_single_id (il, l - 1);
-                array[id2] = lo_build (il, ofs);
+                set_id (id2, lo_build (il, ofs));
                 invlists->update_entry (il, ofs, id2,
                                         invlists->get_single_code (il, l - 1));
             }
@@ -256,12 +488,35 @@ void DirectMap::update_codes (InvertedLists *invlists,
         { // insert new one
             int64_t il = assign[i];
             size_t l = invlists->list_size (il);
-            idx_t dm = lo_build (il, l);
-            array [id] = dm;
+            set_id (id, lo_build (il, l));
             invlists->add_entry (il, id, codes + i * code_size);
         }
     }
 }
 
+void DirectMap::set_id (idx_t id, idx_t lo)
+{
+    if (type == Array) {
+        array [id] = lo;
+    } else if (type == Hashtable) {
+        hashtable [id] = lo;
+    } else if (type == Compact) {
+        compact.set (id, lo);
+    }
+}
+
+void DirectMap::erase_id (idx_t id)
+{
+    if (type == Array) {
+        if (id >= 0 && id < array.size()) {
+            array [id] = -1;
+        }
+    } else if (type == Hashtable) {
+        hashtable.erase (id);
+    } else if (type == Compact) {
+        compact.erase (id);
+    }
+}
+
 
 }
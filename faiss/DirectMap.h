@@ -31,6 +31,52 @@ inline uint64_t lo_offset (uint64_t lo) {
     return lo & 0xffffffff;
 }
 
+/** Compact map from ids to values, for large numbers of arbitrary ids.
+ *
+ * Most entries are stored in two sorted arrays (16 bytes per entry,
+ * instead of ~5x more for a std::unordered_map), and the recent
+ * additions in a small hash table that is merged into the arrays when
+ * it grows too large. Removed entries are marked with -1 until the next
+ * merge. Values must be >= 0.
+ */
+struct CompactIdMap {
+    typedef Index::idx_t idx_t;
+
+    std::vector<idx_t> ids;     ///< sorted ids
+    std::vector<idx_t> values;  ///< values of the ids, -1 if removed
+    size_t n_removed;           ///< nb of -1 entries in values
+
+    /// entries added since the last merge, disjoint from ids
+    std::unordered_map<idx_t, idx_t> delta;
+
+    CompactIdMap ();
+
+    /// replace the content with n entries (last one wins for duplicates)
+    void build (size_t n, const idx_t *keys, const idx_t *vals);
+
+    /// returns -1 if the id is not in the map
+    idx_t get (idx_t id) const;
+
+    void set (idx_t id, idx_t value);
+
+    /// returns whether the id was in the map
+    bool erase (idx_t id);
+
+    /// move the delta entries to the sorted arrays and drop removed ones
+    void merge ();
+
+    /// nb of entries
+    size_t size () const;
+
+    void clear ();
+
+    /// all entries, sorted by id
+    void get_entries (std::vector<std::pair<idx_t, idx_t> > & entries) const;
+
+    MemoryUsage memory_usage () const;
+};
+
+
 /**
  * Direct map: a way to map back from ids to inverted lists
  */
@@ -40,13 +86,15 @@ struct DirectMap {
     enum Type {
        NoMap = 0,     // default
        Array = 1,     // sequential ids (only for add, no add_with_ids)
-       Hashtable = 2  // arbitrary ids
+       Hashtable = 2, // arbitrary ids
+       Compact = 3    // arbitrary ids, stored in a CompactIdMap
     };
     Type type;
 
     /// map for direct access to the elements. Map ids to LO-encoded entries.
     std::vector <idx_t> array;
     std::unordered_map <idx_t, idx_t> hashtable;
+    CompactIdMap compact;
 
     DirectMap();
 
@@ -56,9 +104,14 @@ struct DirectMap {
     /// get an entry
     idx_t get (idx_t id) const;
 
+    /// same as get for Hashtable and Compact, returns -1 if not found
+    idx_t find (idx_t id) const;
+
     /// for quick checks
     bool no () const {return type == NoMap; }
 
+    MemoryUsage memory_usage () const;
+
     /**
      * update the direct_map
      */
@@ -85,6 +138,9 @@ struct DirectMap {
                        const idx_t *list_nos,
                        const uint8_t *codes);
 
+    /// set / remove a single entry of the map (no effect on NoMap)
+    void set_id (idx_t id, idx_t lo);
+    void erase_id (idx_t id);
 
 
 };
@@ -0,0 +1,329 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/EntropyCodedInvertedLists.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <typeinfo>
+
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/io.h>
+#include <faiss/impl/io_macros.h>
+
+
+namespace faiss {
+
+
+namespace {
+
+/* byte-wise rANS with a 32-bit state, the state is kept in
+ * [rans_l, rans_l << 8) */
+const uint32_t rans_l = 1u << 23;
+const int scale_bits = EntropyCodedInvertedLists::scale_bits;
+
+/// quantize the counts of a byte position to frequencies that sum to
+/// 1 << scale_bits, with a frequency >= 1 for the bytes that occur
+void normalize_freqs (const size_t *counts, uint16_t *freqs)
+{
+    size_t total = 0;
+    for (int i = 0; i < 256; i++) {
+        total += counts[i];
+    }
+    if (total == 0) {
+        for (int i = 0; i < 256; i++) {
+            freqs[i] = (1 << scale_bits) / 256;
+        }
+        return;
+    }
+    int64_t sum = 0;
+    for (int i = 0; i < 256; i++) {
+        if (counts[i] == 0) {
+            freqs[i] = 0;
+        } else {
+            freqs[i] = std::max ((size_t)1,
+                                 (counts[i] << scale_bits) / total);
+        }
+        sum += freqs[i];
+    }
+    // fix the rounding on the most frequent bytes, where it costs least
+    while (sum != (1 << scale_bits)) {
+        int imax = -1;
+        for (int i = 0; i < 256; i++) {
+            if ((sum > (1 << scale_bits) ? freqs[i] > 1 : freqs[i] > 0) &&
+                (imax < 0 || freqs[i] > freqs[imax])) {
+                imax = i;
+            }
+        }
+        FAISS_ASSERT (imax >= 0);
+        int64_t delta = (1 << scale_bits) - sum;
+        if (delta > 0) {
+            freqs[imax] += delta;
+            sum += delta;
+        } else {
+            int64_t dec = std::min (-delta, (int64_t)freqs[imax] - 1);
+            freqs[imax] -= dec;
+            sum -= dec;
+        }
+    }
+}
+
+} // namespace
+
+
+EntropyCodedInvertedLists::EntropyCodedInvertedLists ():
+    ReadOnlyInvertedLists (0, 0)
+{}
+
+EntropyCodedInvertedLists::EntropyCodedInvertedLists (
+        const InvertedLists & il):
+    ReadOnlyInvertedLists (il.nlist, il.code_size)
+{
+    FAISS_THROW_IF_NOT (il.code_size != InvertedLists::INVALID_CODE_SIZE);
+
+    list_offsets.resize (nlist + 1);
+    list_offsets[0] = 0;
+    for (size_t i = 0; i < nlist; i++) {
+        list_offsets[i + 1] = list_offsets[i] + il.list_size (i);
+    }
+
+    // statistics of each byte position
+    std::vector<size_t> counts (code_size * 256);
+    ids.resize (list_offsets[nlist]);
+    for (size_t i = 0; i < nlist; i++) {
+        size_t n = il.list_size (i);
+        if (n == 0) continue;
+        ScopedIds lids (&il, i);
+        memcpy (ids.data() + list_offsets[i], lids.get(), n * sizeof(idx_t));
+        ScopedCodes lcodes (&il, i);
+        const uint8_t *c = lcodes.get();
+        for (size_t j = 0; j < n; j++) {
+            for (size_t m = 0; m < code_size; m++) {
+                counts[m * 256 + *c++]++;
+            }
+        }
+    }
+
+    freqs.resize (code_size * 256);
+    for (size_t m = 0; m < code_size; m++) {
+        normalize_freqs (counts.data() + m * 256, freqs.data() + m * 256);
+    }
+    compute_decoding_tables ();
+
+    // the symbols are coded in reverse order, and the bytes of the
+    // stream are reversed at the end, so that decoding runs forward
+    data_offsets.resize (nlist + 1);
+    data_offsets[0] = 0;
+    std::vector<uint8_t> out;
+    for (size_t i = 0; i < nlist; i++) {
+        size_t n = il.list_size (i);
+        if (n > 0) {
+            ScopedCodes lcodes (&il, i);
+            const uint8_t *c = lcodes.get();
+            out.clear ();
+            uint32_t x = rans_l;
+            for (size_t k = n * code_size; k-- > 0; ) {
+                size_t m = k % code_size;
+                uint32_t freq = freqs[m * 256 + c[k]];
+                uint32_t start = cum_freqs[m * 257 + c[k]];
+                uint32_t x_max = ((rans_l >> scale_bits) << 8) * freq;
+                while (x >= x_max) {
+                    out.push_back (x & 0xff);
+                    x >>= 8;
+                }
+                x = ((x / freq) << scale_bits) + (x % freq) + start;
+            }
+            for (int b = 3; b >= 0; b--) {
+                out.push_back ((x >> (8 * b)) & 0xff);
+            }
+            data.insert (data.end(), out.rbegin(), out.rend());
+        }
+        data_offsets[i + 1] = data.size();
+    }
+}
+
+void EntropyCodedInvertedLists::compute_decoding_tables ()
+{
+    FAISS_THROW_IF_NOT (freqs.size() == code_size * 256);
+    cum_freqs.resize (code_size * 257);
+    slot_to_byte.resize (code_size << scale_bits);
+    for (size_t m = 0; m < code_size; m++) {
+        uint32_t *cum = cum_freqs.data() + m * 257;
+        uint8_t *s2b = slot_to_byte.data() + (m << scale_bits);
+        cum[0] = 0;
+        for (int i = 0; i < 256; i++) {
+            uint32_t f = freqs[m * 256 + i];
+            cum[i + 1] = cum[i] + f;
+            FAISS_THROW_IF_NOT_MSG (cum[i + 1] <= (1u << scale_bits),
+                                    "invalid frequency table");
+            memset (s2b + cum[i], i, f);
+        }
+        FAISS_THROW_IF_NOT_MSG (cum[256] == (1u << scale_bits),
+                                "invalid frequency table");
+    }
+}
+
+size_t EntropyCodedInvertedLists::list_size (size_t list_no) const
+{
+    assert (list_no < nlist);
+    return list_offsets[list_no + 1] - list_offsets[list_no];
+}
+
+void EntropyCodedInvertedLists::decode_codes (
+        size_t list_no, size_t n, uint8_t *out) const
+{
+    FAISS_THROW_IF_NOT (n <= list_size (list_no));
+    if (n == 0) {
+        return;
+    }
+    const uint8_t *ptr = data.data() + data_offsets[list_no];
+    const uint8_t *end = data.data() + data_offsets[list_no + 1];
+    FAISS_THROW_IF_NOT (end - ptr >= 4);
+    uint32_t x = ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) |
+        ((uint32_t)ptr[3] << 24);
+    ptr += 4;
+    const uint32_t mask = (1u << scale_bits) - 1;
+
+    for (size_t j = 0; j < n; j++) {
+        const uint16_t *fr = freqs.data();
+        const uint32_t *cum = cum_freqs.data();
+        const uint8_t *s2b = slot_to_byte.data();
+        for (size_t m = 0; m < code_size; m++) {
+            uint32_t slot = x & mask;
+            uint8_t b = s2b[slot];
+            x = fr[b] * (x >> scale_bits) + slot - cum[b];
+            while (x < rans_l && ptr < end) {
+                x = (x << 8) | *ptr++;
+            }
+            *out++ = b;
+            fr += 256;
+            cum += 257;
+            s2b += 1 << scale_bits;
+        }
+    }
+}
+
+const uint8_t * EntropyCodedInvertedLists::get_codes (size_t list_no) const
+{
+    size_t n = list_size (list_no);
+    uint8_t *codes = new uint8_t [n * code_size];
+    decode_codes (list_no, n, codes);
+    return codes;
+}
+
+void EntropyCodedInvertedLists::release_codes (
+        size_t, const uint8_t *codes) const
+{
+    delete [] codes;
+}
+
+const uint8_t * EntropyCodedInvertedLists::get_single_code (
+        size_t list_no, size_t offset) const
+{
+    assert (offset < list_size (list_no));
+    std::vector<uint8_t> buf ((offset + 1) * code_size);
+    decode_codes (list_no, offset + 1, buf.data());
+    uint8_t *code = new uint8_t [code_size];
+    memcpy (code, buf.data() + offset * code_size, code_size);
+    return code;
+}
+
+const InvertedLists::idx_t * EntropyCodedInvertedLists::get_ids (
+        size_t list_no) const
+{
+    assert (list_no < nlist);
+    return ids.data() + list_offsets[list_no];
+}
+
+InvertedLists::idx_t EntropyCodedInvertedLists::get_single_id (
+        size_t list_no, size_t offset) const
+{
+    assert (offset < list_size (list_no));
+    return ids[list_offsets[list_no] + offset];
+}
+
+size_t EntropyCodedInvertedLists::coded_size () const
+{
+    return data.size();
+}
+
+MemoryUsage EntropyCodedInvertedLists::memory_usage () const
+{
+    MemoryUsage mu = MemoryUsage::object ("EntropyCodedInvertedLists");
+    mu.add ("data", data);
+    mu.add ("data_offsets", data_offsets);
+    mu.add ("ids", ids);
+    mu.add ("list_offsets", list_offsets);
+    MemoryUsage & tables = mu.add (MemoryUsage ("tables"));
+    tables.add ("freqs", freqs);
+    tables.add ("cum_freqs", cum_freqs);
+    tables.add ("slot_to_byte", slot_to_byte);
+    return mu;
+}
+
+
+/*******************************************************
+ * I/O support via callbacks
+ *******************************************************/
+
+#ifndef _MSC_VER
+
+EntropyCodedInvertedListsIOHook::EntropyCodedInvertedListsIOHook():
+    InvertedListsIOHook("ilec", typeid(EntropyCodedInvertedLists).name())
+{}
+
+void EntropyCodedInvertedListsIOHook::write(
+        const InvertedLists *ils_in, IOWriter *f) const
+{
+    uint32_t h = fourcc ("ilec");
+    WRITE1 (h);
+    const EntropyCodedInvertedLists *il =
+        dynamic_cast<const EntropyCodedInvertedLists*> (ils_in);
+    WRITE1 (il->nlist);
+    WRITE1 (il->code_size);
+    WRITEVECTOR (il->freqs);
+    WRITEVECTOR (il->list_offsets);
+    WRITEVECTOR (il->ids);
+    WRITEVECTOR (il->data_offsets);
+    WRITEVECTOR (il->data);
+}
+
+InvertedLists * EntropyCodedInvertedListsIOHook::read(
+        IOReader *f, int /* io_flags */) const
+{
+    EntropyCodedInvertedLists *il = new EntropyCodedInvertedLists();
+    std::unique_ptr<EntropyCodedInvertedLists> del (il);
+    READ1 (il->nlist);
+    READ1 (il->code_size);
+    READVECTOR (il->freqs);
+    READVECTOR (il->list_offsets);
+    READVECTOR (il->ids);
+    READVECTOR (il->data_offsets);
+    READVECTOR (il->data);
+    FAISS_THROW_IF_NOT (il->list_offsets.size() == il->nlist + 1 &&
+                        il->data_offsets.size() == il->nlist + 1 &&
+                        il->ids.size() == il->list_offsets[il->nlist] &&
+                        il->data.size() == il->data_offsets[il->nlist]);
+    il->compute_decoding_tables ();
+    return del.release();
+}
+
+InvertedLists * EntropyCodedInvertedListsIOHook::read_ArrayInvertedLists(
+        IOReader *, int, size_t, size_t, const std::vector<size_t> &) const
+{
+    FAISS_THROW_MSG ("cannot read ArrayInvertedLists as "
+                     "EntropyCodedInvertedLists");
+}
+
+#endif // !_MSC_VER
+
+
+} // namespace faiss
@@ -0,0 +1,111 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#ifndef FAISS_ENTROPY_CODED_INVERTED_LISTS_H
+#define FAISS_ENTROPY_CODED_INVERTED_LISTS_H
+
+#include <stdint.h>
+
+#include <vector>
+
+#include <faiss/InvertedLists.h>
+#include <faiss/index_io.h>
+
+
+namespace faiss {
+
+/** Read-only inverted lists whose codes are entropy coded, for indexes
+ * that are rarely searched (cold storage).
+ *
+ * The centroids of a PQ or the levels of a scalar quantizer are not used
+ * uniformly, so the codes take less space with an entropy coder. Each
+ * byte position of the codes has its own frequency table, shared by all
+ * lists: for 8-bit PQ codes this is one table per subquantizer, for SQ8
+ * one table per dimension. The bytes of a list are coded with rANS
+ * (range asymmetric numeral systems) in a single stream per list.
+ *
+ * get_codes decodes the whole list to a buffer that is freed by
+ * release_codes, so the decoding cost is paid only for the lists that
+ * are accessed. The ids are stored uncompressed.
+ */
+struct EntropyCodedInvertedLists: ReadOnlyInvertedLists {
+
+    /// the frequencies of a table sum to 1 << scale_bits
+    static const int scale_bits = 12;
+
+    /// frequency of each byte value, size code_size * 256
+    std::vector<uint16_t> freqs;
+
+    /// list i has entries list_offsets[i] to list_offsets[i + 1]
+    std::vector<size_t> list_offsets;
+    std::vector<idx_t> ids;
+
+    /// the coded codes of list i are data[data_offsets[i] :
+    /// data_offsets[i + 1]]
+    std::vector<size_t> data_offsets;
+    std::vector<uint8_t> data;
+
+    /// copies the ids and encodes the codes of il, that must have a
+    /// fixed code size
+    explicit EntropyCodedInvertedLists (const InvertedLists & il);
+
+    size_t list_size (size_t list_no) const override;
+
+    /// the codes are decoded to a buffer that is freed by release_codes
+    const uint8_t * get_codes (size_t list_no) const override;
+    void release_codes (size_t list_no, const uint8_t *codes) const override;
+
+    /// decodes the list up to the requested code
+    const uint8_t * get_single_code (
+                size_t list_no, size_t offset) const override;
+
+    const idx_t * get_ids (size_t list_no) const override;
+    idx_t get_single_id (size_t list_no, size_t offset) const override;
+
+    /// size of the coded codes of all lists (bytes)
+    size_t coded_size () const;
+
+    MemoryUsage memory_usage () const override;
+
+    /// decodes the first n codes of a list to out (size n * code_size)
+    void decode_codes (size_t list_no, size_t n, uint8_t *out) const;
+
+    /// to be called after freqs changes (eg. when the lists are read)
+    void compute_decoding_tables ();
+
+    // empty constructor for the I/O functions
+    EntropyCodedInvertedLists ();
+
+  private:
+    /// cumulative frequencies, size code_size * 257
+    std::vector<uint32_t> cum_freqs;
+    /// byte value of each slot, size code_size << scale_bits
+    std::vector<uint8_t> slot_to_byte;
+};
+
+
+#ifndef _MSC_VER
+
+struct EntropyCodedInvertedListsIOHook: InvertedListsIOHook {
+    EntropyCodedInvertedListsIOHook();
+    void write(const InvertedLists *ils, IOWriter *f) const override;
+    InvertedLists * read(IOReader *f, int io_flags) const override;
+    /// not supported, the codes are coded from the whole lists
+    InvertedLists * read_ArrayInvertedLists(
+            IOReader *f, int io_flags,
+            size_t nlist, size_t code_size,
+            const std::vector<size_t> &sizes) const override;
+};
+
+#endif // !_MSC_VER
+
+
+} // namespace faiss
+
+#endif
@@ -0,0 +1,192 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/IVFAddPipeline.h>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <typeinfo>
+#include <vector>
+
+#include <faiss/IndexIVFFlat.h>
+#include <faiss/IndexIVFPQ.h>
+#include <faiss/IndexIVFSpectralHash.h>
+#include <faiss/IndexScalarQuantizer.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/utils.h>
+
+
+namespace faiss {
+
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+/* append the n encoded vectors to their lists, grouped per list. The
+ * entries of a list keep their order in the batch. */
+void append_by_list (IndexIVF & index, idx_t n, const idx_t *list_nos,
+                     const uint8_t *codes, const idx_t *xids)
+{
+    size_t nlist = index.nlist, code_size = index.code_size;
+    idx_t id0 = index.ntotal;
+
+    // counting sort of the entries by list
+    std::vector<size_t> lims (nlist + 1);
+    for (idx_t i = 0; i < n; i++) {
+        if (list_nos[i] >= 0) {
+            lims[list_nos[i] + 1]++;
+        }
+    }
+    std::vector<idx_t> lists;
+    for (size_t l = 0; l < nlist; l++) {
+        if (lims[l + 1] > 0) {
+            lists.push_back (l);
+        }
+        lims[l + 1] += lims[l];
+    }
+    std::vector<idx_t> perm (lims[nlist]);
+    {
+        std::vector<size_t> pos (lims.begin(), lims.end() - 1);
+        for (idx_t i = 0; i < n; i++) {
+            if (list_nos[i] >= 0) {
+                perm[pos[list_nos[i]]++] = i;
+            }
+        }
+    }
+
+    DirectMapAdd dm_adder (index.direct_map, n, xids);
+    for (idx_t i = 0; i < n; i++) {
+        if (list_nos[i] < 0) {
+            dm_adder.add (i, -1, 0);
+        }
+    }
+
+#pragma omp parallel if (lists.size() > 1)
+    {
+        std::vector<idx_t> ids;
+        std::vector<uint8_t> list_codes;
+
+#pragma omp for schedule(dynamic)
+        for (size_t j = 0; j < lists.size(); j++) {
+            idx_t list_no = lists[j];
+            const idx_t *pl = perm.data() + lims[list_no];
+            size_t nl = lims[list_no + 1] - lims[list_no];
+            ids.resize (nl);
+            list_codes.resize (nl * code_size);
+            for (size_t k = 0; k < nl; k++) {
+                ids[k] = xids ? xids[pl[k]] : id0 + pl[k];
+                memcpy (list_codes.data() + k * code_size,
+                        codes + pl[k] * code_size, code_size);
+            }
+            size_t ofs = index.invlists->add_entries (
+                    list_no, nl, ids.data(), list_codes.data());
+            for (size_t k = 0; k < nl; k++) {
+                dm_adder.add (pl[k], list_no, ofs + k);
+            }
+        }
+    }
+}
+
+} // anonymous namespace
+
+
+IVFAddPipeline::IVFAddPipeline (IndexIVF *index, const Index *quantizer,
+                                idx_t batch_size):
+    index (index), quantizer (quantizer ? quantizer : index->quantizer),
+    batch_size (batch_size), verbose (false)
+{
+    FAISS_THROW_IF_NOT (batch_size > 0);
+    FAISS_THROW_IF_NOT (this->quantizer->d == index->d);
+    const std::type_info & type = typeid (*index);
+    FAISS_THROW_IF_NOT_MSG (
+          type == typeid (IndexIVFFlat) ||
+          type == typeid (IndexIVFScalarQuantizer) ||
+          type == typeid (IndexIVFPQ) ||
+          type == typeid (IndexIVFSpectralHash),
+          "IVFAddPipeline not supported for this index type");
+}
+
+
+void IVFAddPipeline::add (idx_t n, const float *x, const idx_t *xids)
+{
+    FAISS_THROW_IF_NOT (index->is_trained);
+    FAISS_THROW_IF_NOT_MSG (index->max_list_size == 0,
+                            "IVFAddPipeline does not support max_list_size");
+    index->direct_map.check_can_add (xids);
+    size_t d = index->d;
+
+    // double buffering of the assignment results
+    std::vector<idx_t> idx[2];
+    double t_assign = 0, t_encode = 0, t_append = 0;
+
+    auto assign_stage = [&] (idx_t i0, int slot) {
+        idx_t i1 = std::min (n, i0 + batch_size);
+        idx[slot].resize (i1 - i0);
+        quantizer->assign (i1 - i0, x + i0 * d, idx[slot].data ());
+    };
+
+    double t0 = getmillisecs ();
+    if (n > 0) {
+        assign_stage (0, 0);
+    }
+    t_assign += getmillisecs () - t0;
+
+    std::vector<uint8_t> codes;
+    int slot = 0;
+    for (idx_t i0 = 0; i0 < n; i0 += batch_size) {
+        idx_t i1 = std::min (n, i0 + batch_size);
+        std::future<void> next;
+        if (i1 < n) {
+            next = std::async (std::launch::async,
+                               assign_stage, i1, 1 - slot);
+        }
+        try {
+            t0 = getmillisecs ();
+            codes.resize ((i1 - i0) * index->code_size);
+            index->encode_vectors (i1 - i0, x + i0 * d, idx[slot].data(),
+                                   codes.data());
+            double t1 = getmillisecs ();
+            append_by_list (*index, i1 - i0, idx[slot].data(), codes.data(),
+                            xids ? xids + i0 : nullptr);
+            index->ntotal += i1 - i0;
+            double t2 = getmillisecs ();
+            t_encode += t1 - t0;
+            t_append += t2 - t1;
+        } catch (...) {
+            // the assignment stage uses the buffers of this frame
+            if (next.valid ()) {
+                next.wait ();
+            }
+            throw;
+        }
+        t0 = getmillisecs ();
+        if (next.valid ()) {
+            next.get ();
+        }
+        // time the assignment was not hidden by the other stages
+        t_assign += getmillisecs () - t0;
+        slot = 1 - slot;
+
+        if (verbose) {
+            printf ("  IVFAddPipeline: %" PRId64 " / %" PRId64
+                    " added, assign %.3f ms encode %.3f ms append %.3f ms\r",
+                    i1, n, t_assign, t_encode, t_append);
+            fflush (stdout);
+        }
+    }
+    if (verbose) {
+        printf ("\n");
+    }
+}
+
+
+} // namespace faiss
@@ -0,0 +1,65 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#ifndef FAISS_IVF_ADD_PIPELINE_H
+#define FAISS_IVF_ADD_PIPELINE_H
+
+#include <faiss/IndexIVF.h>
+
+
+namespace faiss {
+
+/** Bulk addition front-end for an IndexIVF that overlaps the coarse
+ * assignment of a batch of vectors with the encoding and the list
+ * append of the previous batch.
+ *
+ * The vectors are cut in batches of batch_size. The assignment of
+ * batch i + 1 runs in a separate thread while batch i is encoded (with
+ * encode_vectors) and appended. The append groups the entries of a
+ * batch per list and appends each list with a single add_entries call,
+ * the lists being distributed dynamically over the threads, so that a
+ * few large lists do not idle the other threads.
+ *
+ * As for IVFSearchPipeline, the quantizer can be a GPU replica of
+ * index->quantizer (eg. a GpuIndexFlat built with index_cpu_to_gpu),
+ * so that the assignment does not compete with the encoding for the
+ * CPU cores.
+ *
+ * The resulting inverted lists are the same as with index->add_with_ids.
+ * Supported: IndexIVFFlat, IndexIVFScalarQuantizer, IndexIVFPQ and
+ * IndexIVFSpectralHash, without max_list_size (the assignment would
+ * depend on the appends of the previous batches).
+ */
+struct IVFAddPipeline {
+    typedef Index::idx_t idx_t;
+
+    IndexIVF *index;
+
+    /** coarse quantizer (not owned), must return the same list numbers
+     * as index->quantizer. It is called from another thread. */
+    const Index *quantizer;
+
+    /// nb of vectors per stage of the pipeline
+    idx_t batch_size;
+
+    bool verbose;
+
+    explicit IVFAddPipeline (IndexIVF *index,
+                             const Index *quantizer = nullptr,
+                             idx_t batch_size = 65536);
+
+    /// same semantics as index->add_with_ids (sequential ids if xids
+    /// is null)
+    void add (idx_t n, const float *x, const idx_t *xids = nullptr);
+};
+
+
+} // namespace faiss
+
+#endif
@@ -0,0 +1,159 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/IVFSearchBatcher.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <memory>
+
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/utils.h>
+
+
+namespace faiss {
+
+
+struct IVFSearchBatcher::Request {
+    idx_t n;
+    const float *x;
+    idx_t k;
+    float *distances;
+    idx_t *labels;
+
+    bool done;
+    std::exception_ptr error;
+};
+
+
+IVFSearchBatcher::IVFSearchBatcher (const IndexIVF *index,
+                                    double window_ms,
+                                    size_t max_batch_size):
+    index (index), quantizer (index->quantizer), params (nullptr),
+    window_ms (window_ms), max_batch_size (max_batch_size),
+    nbatch (0), nquery (0), n_pending (0), collecting (false)
+{
+    FAISS_THROW_IF_NOT (max_batch_size > 0);
+}
+
+
+void IVFSearchBatcher::search (idx_t n, const float *x, idx_t k,
+                               float *distances, idx_t *labels)
+{
+    FAISS_THROW_IF_NOT (k > 0);
+    if (n == 0) {
+        return;
+    }
+    Request req = {n, x, k, distances, labels, false, nullptr};
+
+    std::unique_lock<std::mutex> lock (mutex);
+    pending.push_back (&req);
+    n_pending += n;
+
+    if (collecting) {
+        // the collector wakes up if the batch is full
+        cv.notify_all ();
+        cv.wait (lock, [&req] { return req.done; });
+    } else {
+        // this caller collects and processes the batch
+        collecting = true;
+        auto deadline = std::chrono::steady_clock::now () +
+            std::chrono::microseconds (int64_t (window_ms * 1000));
+        cv.wait_until (lock, deadline,
+                       [this] { return n_pending >= max_batch_size; });
+
+        std::vector<Request*> batch;
+        batch.swap (pending);
+        n_pending = 0;
+        collecting = false;
+        lock.unlock ();
+
+        process_batch (batch);
+
+        lock.lock ();
+        nbatch++;
+        for (Request *r: batch) {
+            nquery += r->n;
+            r->done = true;
+        }
+        cv.notify_all ();
+    }
+
+    if (req.error) {
+        std::rethrow_exception (req.error);
+    }
+}
+
+
+void IVFSearchBatcher::process_batch (std::vector<Request*> & batch) const
+{
+    idx_t n = 0, kmax = 0;
+    for (const Request *r: batch) {
+        n += r->n;
+        kmax = std::max (kmax, r->k);
+    }
+    size_t d = index->d;
+
+    try {
+        // gather the queries
+        std::vector<float> x;
+        const float *xb;
+        if (batch.size () == 1) {
+            xb = batch[0]->x;
+        } else {
+            x.resize (n * d);
+            idx_t i0 = 0;
+            for (const Request *r: batch) {
+                memcpy (x.data () + i0 * d, r->x, sizeof (float) * r->n * d);
+                i0 += r->n;
+            }
+            xb = x.data ();
+        }
+
+        size_t nprobe = params ? params->nprobe : index->nprobe;
+        std::unique_ptr<idx_t[]> idx (new idx_t[n * nprobe]);
+        std::unique_ptr<float[]> coarse_dis (new float[n * nprobe]);
+
+        double t0 = getmillisecs ();
+        quantizer->search (n, xb, nprobe, coarse_dis.get (), idx.get (),
+                           params ? params->quantizer_params : nullptr);
+        indexIVF_stats.quantization_time += getmillisecs () - t0;
+
+        t0 = getmillisecs ();
+        index->invlists->prefetch_lists (idx.get (), n * nprobe);
+
+        // the results of kmax are sorted, so their k first elements are
+        // the k-nn result
+        std::vector<float> D (n * kmax);
+        std::vector<idx_t> I (n * kmax);
+        index->search_preassigned (n, xb, kmax, idx.get (), coarse_dis.get (),
+                                   D.data (), I.data (), false, params);
+        indexIVF_stats.search_time += getmillisecs () - t0;
+
+        idx_t i0 = 0;
+        for (Request *r: batch) {
+            for (idx_t i = 0; i < r->n; i++) {
+                memcpy (r->distances + i * r->k, D.data () + (i0 + i) * kmax,
+                        sizeof (float) * r->k);
+                memcpy (r->labels + i * r->k, I.data () + (i0 + i) * kmax,
+                        sizeof (idx_t) * r->k);
+            }
+            i0 += r->n;
+        }
+    } catch (...) {
+        for (Request *r: batch) {
+            r->error = std::current_exception ();
+        }
+    }
+
+}
+
+} // namespace faiss
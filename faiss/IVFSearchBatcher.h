@@ -0,0 +1,88 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#ifndef FAISS_IVF_SEARCH_BATCHER_H
+#define FAISS_IVF_SEARCH_BATCHER_H
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include <faiss/IndexIVF.h>
+
+
+namespace faiss {
+
+/** Search front-end for an IndexIVF that merges the queries of
+ * concurrent callers into one batch.
+ *
+ * When queries arrive one by one from many threads, each IndexIVF::search
+ * call does a coarse quantization for a single query, which is far from
+ * BLAS efficiency with a large flat quantizer. With the batcher, the first
+ * caller waits for at most window_ms, collects the queries of the callers
+ * that arrive in the meantime, and runs one coarse quantizer search and
+ * one search_preassigned call for all of them (the lists are scanned in
+ * parallel over the queries). The other callers block until their
+ * results are ready. A caller that arrives while a batch is processed
+ * starts collecting the next batch.
+ *
+ * The coarse quantizer can be replaced, eg. by a replica on another
+ * device or by an approximate index on the centroids, that must return
+ * the same list numbers as index->quantizer.
+ */
+struct IVFSearchBatcher {
+    typedef Index::idx_t idx_t;
+
+    const IndexIVF *index;
+
+    /// coarse quantizer used for the batches (not owned)
+    const Index *quantizer;
+
+    /// search parameters applied to all queries (not owned, may be null)
+    const IVFSearchParameters *params;
+
+    /// max time the first query of a batch waits for others (ms)
+    double window_ms;
+
+    /// a batch is processed immediately when it has this many queries
+    size_t max_batch_size;
+
+    explicit IVFSearchBatcher (const IndexIVF *index,
+                               double window_ms = 1.0,
+                               size_t max_batch_size = 256);
+
+    /** same semantics as Index::search, can be called from several
+     * threads concurrently */
+    void search (idx_t n, const float *x, idx_t k,
+                 float *distances, idx_t *labels);
+
+    /// statistics, protected by the mutex
+    size_t nbatch;   ///< nb of batches processed
+    size_t nquery;   ///< nb of queries searched
+
+  private:
+    struct Request;
+
+    void process_batch (std::vector<Request*> & batch) const;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    /// requests of the batch being collected
+    std::vector<Request*> pending;
+    size_t n_pending;  ///< nb of queries in pending
+
+    /// whether a caller is collecting the pending batch
+    bool collecting;
+};
+
+
+} // namespace faiss
+
+#endif
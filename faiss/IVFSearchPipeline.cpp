@@ -0,0 +1,92 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/IVFSearchPipeline.h>
+
+#include <algorithm>
+#include <future>
+#include <vector>
+
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/utils.h>
+
+
+namespace faiss {
+
+
+IVFSearchPipeline::IVFSearchPipeline (const IndexIVF *index,
+                                      const Index *quantizer,
+                                      idx_t batch_size):
+    index (index), quantizer (quantizer ? quantizer : index->quantizer),
+    params (nullptr), batch_size (batch_size)
+{
+    FAISS_THROW_IF_NOT (batch_size > 0);
+    FAISS_THROW_IF_NOT (this->quantizer->d == index->d);
+}
+
+
+void IVFSearchPipeline::search (idx_t n, const float *x, idx_t k,
+                                float *distances, idx_t *labels) const
+{
+    FAISS_THROW_IF_NOT (k > 0);
+    size_t d = index->d;
+    size_t nprobe = params ? params->nprobe : index->nprobe;
+
+    // double buffering of the coarse quantization results
+    std::vector<idx_t> idx[2];
+    std::vector<float> coarse_dis[2];
+
+    auto coarse_stage = [&] (idx_t i0, int slot) {
+        idx_t i1 = std::min (n, i0 + batch_size);
+        idx[slot].resize ((i1 - i0) * nprobe);
+        coarse_dis[slot].resize ((i1 - i0) * nprobe);
+        quantizer->search (i1 - i0, x + i0 * d, nprobe,
+                           coarse_dis[slot].data (), idx[slot].data (),
+                           params ? params->quantizer_params : nullptr);
+        index->invlists->prefetch_lists (idx[slot].data (),
+                                         (i1 - i0) * nprobe);
+    };
+
+    double t0 = getmillisecs ();
+    if (n > 0) {
+        coarse_stage (0, 0);
+    }
+    indexIVF_stats.quantization_time += getmillisecs () - t0;
+
+    t0 = getmillisecs ();
+    int slot = 0;
+    for (idx_t i0 = 0; i0 < n; i0 += batch_size) {
+        idx_t i1 = std::min (n, i0 + batch_size);
+        std::future<void> next;
+        if (i1 < n) {
+            next = std::async (std::launch::async,
+                               coarse_stage, i1, 1 - slot);
+        }
+        try {
+            index->search_preassigned (
+                  i1 - i0, x + i0 * d, k,
+                  idx[slot].data (), coarse_dis[slot].data (),
+                  distances + i0 * k, labels + i0 * k, false, params);
+        } catch (...) {
+            // the coarse stage uses the buffers of this frame
+            if (next.valid ()) {
+                next.wait ();
+            }
+            throw;
+        }
+        if (next.valid ()) {
+            next.get ();
+        }
+        slot = 1 - slot;
+    }
+    indexIVF_stats.search_time += getmillisecs () - t0;
+}
+
+
+} // namespace faiss
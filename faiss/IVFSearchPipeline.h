@@ -0,0 +1,63 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#ifndef FAISS_IVF_SEARCH_PIPELINE_H
+#define FAISS_IVF_SEARCH_PIPELINE_H
+
+#include <faiss/IndexIVF.h>
+
+
+namespace faiss {
+
+/** Search front-end for an IndexIVF that overlaps the coarse
+ * quantization of a batch of queries with the list scan of the previous
+ * batch.
+ *
+ * This is intended for a hybrid CPU-GPU setup, where the inverted lists
+ * are too large for the GPU but the coarse quantizer is expensive (large
+ * nlist): the quantizer is a GPU replica of index->quantizer (eg. a
+ * GpuIndexFlat built with index_cpu_to_gpu), while the lists are scanned
+ * by the CPU with search_preassigned. The queries are cut in batches of
+ * batch_size. The coarse quantization of batch i + 1 runs in a separate
+ * thread, and the list numbers are prefetched (see
+ * InvertedLists::prefetch_lists), while batch i is scanned.
+ *
+ * With a CPU quantizer, the two stages compete for the same cores, so
+ * this is useful only if the scan is limited by I/O (on-disk lists).
+ */
+struct IVFSearchPipeline {
+    typedef Index::idx_t idx_t;
+
+    const IndexIVF *index;
+
+    /** coarse quantizer (not owned), must return the same list numbers
+     * as index->quantizer. It is called from another thread, so it must
+     * not be used concurrently elsewhere if its search is not thread
+     * safe (GPU indexes serialize their calls). */
+    const Index *quantizer;
+
+    /// search parameters applied to all queries (not owned, may be null)
+    const IVFSearchParameters *params;
+
+    /// nb of queries per stage of the pipeline
+    idx_t batch_size;
+
+    explicit IVFSearchPipeline (const IndexIVF *index,
+                                const Index *quantizer = nullptr,
+                                idx_t batch_size = 1024);
+
+    /// same semantics as Index::search
+    void search (idx_t n, const float *x, idx_t k,
+                 float *distances, idx_t *labels) const;
+};
+
+
+} // namespace faiss
+
+#endif
@@ -9,9 +9,12 @@
 
 #include <faiss/IVFlib.h>
 
+#include <algorithm>
 #include <memory>
+#include <unordered_map>
 
 #include <faiss/IndexPreTransform.h>
+#include <faiss/OnDiskInvertedLists.h>
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/MetaIndexes.h>
 #include <faiss/utils/utils.h>
@@ -108,6 +111,248 @@ void merge_into(faiss::Index *index0, faiss::Index *index1, bool shift_ids) {
     index1->ntotal = ivf1->ntotal;
 }
 
+namespace {
+
+/// the lazily removed entries (id -1) are not handled by the copies
+void check_no_tombstones (const IndexIVF *ivf)
+{
+    FAISS_THROW_IF_NOT_MSG (ivf->ntombstones == 0,
+                            "call purge_tombstones before merging or "
+                            "splitting");
+}
+
+/// move list list_no of src to the (empty) list list_no of dst
+void move_list (InvertedLists *src, InvertedLists *dst, size_t list_no)
+{
+    size_t n = src->list_size (list_no);
+    if (n == 0) {
+        return;
+    }
+    ArrayInvertedLists *asrc = dynamic_cast<ArrayInvertedLists*> (src);
+    ArrayInvertedLists *adst = dynamic_cast<ArrayInvertedLists*> (dst);
+    if (asrc && adst && adst->list_size (list_no) == 0) {
+        std::swap (asrc->codes[list_no], adst->codes[list_no]);
+        std::swap (asrc->ids[list_no], adst->ids[list_no]);
+        return;
+    }
+    dst->add_entries (list_no, n,
+                      InvertedLists::ScopedIds (src, list_no).get(),
+                      InvertedLists::ScopedCodes (src, list_no).get());
+    src->resize (list_no, 0);
+}
+
+std::vector<IndexIVF *> extract_shards (Index *index, int n_shard,
+                                        Index **shards, bool empty)
+{
+    std::vector<IndexIVF *> ivfs (n_shard);
+    for (int i = 0; i < n_shard; i++) {
+        check_compatible_for_merge (index, shards[i]);
+        ivfs[i] = extract_index_ivf (shards[i]);
+        FAISS_THROW_IF_NOT_MSG (!empty || ivfs[i]->ntotal == 0,
+                                "shards should be empty");
+        check_no_tombstones (ivfs[i]);
+    }
+    return ivfs;
+}
+
+/// set ntotal of the index and of its wrappers from the inverted lists
+void update_ntotal (Index *index)
+{
+    IndexIVF *ivf = extract_index_ivf (index);
+    ivf->ntotal = ivf->invlists->compute_ntotal ();
+    index->ntotal = ivf->ntotal;
+}
+
+} // anonymous namespace
+
+
+void merge_shards_into(Index *index0, int n_shard, Index **shards,
+                       bool shift_ids)
+{
+    IndexIVF *ivf0 = extract_index_ivf (index0);
+    check_no_tombstones (ivf0);
+    std::vector<IndexIVF *> ivfs = extract_shards (
+            index0, n_shard, shards, false);
+
+    std::vector<idx_t> add_ids (n_shard);
+    idx_t ntotal = ivf0->ntotal;
+    for (int i = 0; i < n_shard; i++) {
+        add_ids[i] = shift_ids ? ntotal : 0;
+        ntotal += ivfs[i]->ntotal;
+    }
+
+    InvertedLists *il0 = ivf0->invlists;
+
+#pragma omp parallel for schedule(dynamic)
+    for (idx_t j = 0; j < ivf0->nlist; j++) {
+        size_t n0 = il0->list_size (j);
+        size_t new_size = n0;
+        int n_nonempty = 0;
+        for (int i = 0; i < n_shard; i++) {
+            size_t n = ivfs[i]->invlists->list_size (j);
+            new_size += n;
+            n_nonempty += n > 0;
+        }
+        if (new_size == n0) {
+            continue;
+        }
+        if (n0 == 0 && n_nonempty == 1 && !shift_ids) {
+            for (int i = 0; i < n_shard; i++) {
+                move_list (ivfs[i]->invlists, il0, j);
+            }
+            continue;
+        }
+
+        il0->resize (j, new_size);
+        size_t ofs = n0;
+        std::vector<idx_t> new_ids;
+        for (int i = 0; i < n_shard; i++) {
+            InvertedLists *il = ivfs[i]->invlists;
+            size_t n = il->list_size (j);
+            if (n == 0) {
+                continue;
+            }
+            InvertedLists::ScopedIds ids (il, j);
+            const idx_t *ids_in = ids.get();
+            if (add_ids[i] != 0) {
+                new_ids.resize (n);
+                for (size_t k = 0; k < n; k++) {
+                    new_ids[k] = ids_in[k] + add_ids[i];
+                }
+                ids_in = new_ids.data();
+            }
+            il0->update_entries (j, ofs, n, ids_in,
+                                 InvertedLists::ScopedCodes (il, j).get());
+            ofs += n;
+        }
+        for (int i = 0; i < n_shard; i++) {
+            ivfs[i]->invlists->resize (j, 0);
+        }
+    }
+
+    ivf0->ntotal = ntotal;
+    index0->ntotal = ntotal;
+    for (int i = 0; i < n_shard; i++) {
+        ivfs[i]->ntotal = 0;
+        shards[i]->ntotal = 0;
+    }
+}
+
+
+void split_by_list_range(Index *index, int n_shard, Index **shards)
+{
+    IndexIVF *ivf = extract_index_ivf (index);
+    check_no_tombstones (ivf);
+    std::vector<IndexIVF *> ivfs = extract_shards (
+            index, n_shard, shards, true);
+    size_t nlist = ivf->nlist;
+
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < n_shard; i++) {
+        size_t l0 = i * nlist / n_shard, l1 = (i + 1) * nlist / n_shard;
+        for (size_t j = l0; j < l1; j++) {
+            move_list (ivf->invlists, ivfs[i]->invlists, j);
+        }
+    }
+
+    for (int i = 0; i < n_shard; i++) {
+        update_ntotal (shards[i]);
+    }
+    update_ntotal (index);
+}
+
+
+void split_by_id_range(Index *index, int n_shard, Index **shards,
+                       const idx_t *id_bounds)
+{
+    IndexIVF *ivf = extract_index_ivf (index);
+    check_no_tombstones (ivf);
+    std::vector<IndexIVF *> ivfs = extract_shards (
+            index, n_shard, shards, true);
+
+    std::vector<idx_t> bounds (n_shard + 1);
+    for (int i = 0; i <= n_shard; i++) {
+        bounds[i] = id_bounds ? id_bounds[i] : i * ivf->ntotal / n_shard;
+        FAISS_THROW_IF_NOT_MSG (i == 0 || bounds[i] >= bounds[i - 1],
+                                "id_bounds should be increasing");
+    }
+
+    InvertedLists *il = ivf->invlists;
+    size_t code_size = il->code_size;
+
+#pragma omp parallel for schedule(dynamic)
+    for (idx_t j = 0; j < ivf->nlist; j++) {
+        size_t n = il->list_size (j);
+        if (n == 0) {
+            continue;
+        }
+        // shard of each entry, n_shard = stays in index
+        std::vector<int> shard_no (n);
+        std::vector<size_t> counts (n_shard + 1);
+        {
+            InvertedLists::ScopedIds ids (il, j);
+            for (size_t k = 0; k < n; k++) {
+                idx_t id = ids[k];
+                int s = n_shard;
+                if (id >= bounds[0] && id < bounds[n_shard]) {
+                    s = std::upper_bound (bounds.begin(), bounds.end(), id)
+                        - bounds.begin() - 1;
+                }
+                shard_no[k] = s;
+                counts[s]++;
+            }
+        }
+
+        bool moved = false;
+        for (int s = 0; s < n_shard; s++) {
+            if (counts[s] == n) {
+                move_list (il, ivfs[s]->invlists, j);
+                moved = true;
+            }
+        }
+        if (moved || counts[n_shard] == n) {
+            continue;
+        }
+
+        std::vector<idx_t> new_ids;
+        std::vector<uint8_t> new_codes;
+        {
+            InvertedLists::ScopedIds ids (il, j);
+            InvertedLists::ScopedCodes codes (il, j);
+            for (int s = 0; s <= n_shard; s++) {
+                if (counts[s] == 0) {
+                    continue;
+                }
+                new_ids.resize (0);
+                new_codes.resize (0);
+                for (size_t k = 0; k < n; k++) {
+                    if (shard_no[k] == s) {
+                        new_ids.push_back (ids[k]);
+                        new_codes.insert (
+                            new_codes.end(), codes.get() + k * code_size,
+                            codes.get() + (k + 1) * code_size);
+                    }
+                }
+                if (s < n_shard) {
+                    ivfs[s]->invlists->add_entries (
+                          j, counts[s], new_ids.data(), new_codes.data());
+                }
+            }
+        }
+        // new_ids / new_codes contain the entries that stay
+        il->resize (j, counts[n_shard]);
+        if (counts[n_shard] > 0) {
+            il->update_entries (j, 0, counts[n_shard],
+                                new_ids.data(), new_codes.data());
+        }
+    }
+
+    for (int i = 0; i < n_shard; i++) {
+        update_ntotal (shards[i]);
+    }
+    update_ntotal (index);
+}
+
 
 
 void search_centroid(faiss::Index *index,
@@ -429,6 +674,88 @@ void range_search_with_parameters (const Index *index,
 
 
 
+void co_probe_list_order (size_t nlist, idx_t n, size_t nprobe,
+                          const idx_t *probes, idx_t *list_order)
+{
+    // co-probe counts of each pair of lists
+    std::vector<std::unordered_map<idx_t, size_t> > co (nlist);
+    std::vector<size_t> freq (nlist);
+    for (idx_t q = 0; q < n; q++) {
+        const idx_t *pq = probes + q * nprobe;
+        for (size_t i = 0; i < nprobe; i++) {
+            idx_t a = pq[i];
+            if (a < 0) continue;
+            FAISS_THROW_IF_NOT (a < nlist);
+            freq[a]++;
+            for (size_t j = 0; j < nprobe; j++) {
+                idx_t b = pq[j];
+                if (b >= 0 && b != a) {
+                    co[a][b]++;
+                }
+            }
+        }
+    }
+
+    // fallback order, most probed first
+    std::vector<idx_t> by_freq (nlist);
+    for (size_t i = 0; i < nlist; i++) {
+        by_freq[i] = i;
+    }
+    std::stable_sort (by_freq.begin(), by_freq.end(),
+        [&freq](idx_t a, idx_t b) { return freq[a] > freq[b]; });
+
+    // how far back in the placed lists to look for co-probed lists
+    const size_t window = 8;
+    std::vector<bool> placed (nlist);
+    size_t next_by_freq = 0;
+    for (size_t k = 0; k < nlist; k++) {
+        idx_t next = -1;
+        for (size_t w = 1; w <= window && w <= k && next < 0; w++) {
+            size_t best = 0;
+            for (const auto & bc: co[list_order[k - w]]) {
+                if (placed[bc.first]) continue;
+                if (bc.second > best ||
+                    (bc.second == best && bc.first < next)) {
+                    next = bc.first;
+                    best = bc.second;
+                }
+            }
+        }
+        if (next < 0) {
+            while (placed[by_freq[next_by_freq]]) {
+                next_by_freq++;
+            }
+            next = by_freq[next_by_freq];
+        }
+        placed[next] = true;
+        list_order[k] = next;
+    }
+}
+
+
+void centroid_graph_list_order (const Index *index, size_t nprobe,
+                                idx_t *list_order)
+{
+    const IndexIVF *index_ivf = extract_index_ivf (index);
+    size_t nlist = index_ivf->nlist;
+    nprobe = std::min (nprobe, nlist);
+    std::vector<float> centroids (nlist * index_ivf->d);
+    index_ivf->quantizer->reconstruct_n (0, nlist, centroids.data());
+    std::vector<idx_t> probes (nlist * nprobe);
+    index_ivf->quantizer->assign (nlist, centroids.data(), probes.data(),
+                                  nprobe);
+    co_probe_list_order (nlist, nlist, nprobe, probes.data(), list_order);
+}
+
+
+size_t relayout_ondisk_invlists (Index *index, const idx_t *list_order)
+{
+    IndexIVF *index_ivf = extract_index_ivf (index);
+    OnDiskInvertedLists *ails =
+        dynamic_cast<OnDiskInvertedLists*> (index_ivf->invlists);
+    FAISS_THROW_IF_NOT_MSG (ails, "the inverted lists are not on disk");
+    return ails->compact (list_order);
+}
 
 
 } } // namespace faiss::ivflib
@@ -48,6 +48,42 @@ void merge_into(Index *index0, Index *index1, bool shift_ids);
 
 typedef Index::idx_t idx_t;
 
+/** Merge n_shard indexes into index0 in a single pass, in parallel
+ *  over the inverted lists. Each list of index0 is resized once to its
+ *  final size before the entries of the shards are copied in, so the
+ *  destination can be any InvertedLists that supports resize and
+ *  update_entries (ArrayInvertedLists, OnDiskInvertedLists). When a
+ *  destination list is empty and a single ArrayInvertedLists shard
+ *  contributes to it, the codes are moved without copy. On output the
+ *  shards are empty. index0 and the shards should not have lazily
+ *  removed entries (see IndexIVF::purge_tombstones).
+ *
+ * @param shift_ids: translate the ids of each shard by the ntotal of
+ *                   index0 and the previous shards (as merge_into)
+ */
+void merge_shards_into(Index *index0, int n_shard, Index **shards,
+                       bool shift_ids);
+
+/** Move the inverted lists of index to n_shard shards: shard i gets
+ *  lists [i * nlist / n_shard, (i + 1) * nlist / n_shard). The shards
+ *  must be empty indexes that are compatible with index (eg. clones of
+ *  the trained index). The lists are moved without copy between
+ *  ArrayInvertedLists. On output index is empty. index should not have
+ *  lazily removed entries (see IndexIVF::purge_tombstones).
+ */
+void split_by_list_range(Index *index, int n_shard, Index **shards);
+
+/** Move the vectors of index to n_shard shards: shard i gets the
+ *  vectors whose id is in [id_bounds[i], id_bounds[i + 1]). By default,
+ *  id_bounds splits [0, ntotal) uniformly. The vectors with ids outside
+ *  [id_bounds[0], id_bounds[n_shard]) remain in index. The shards must
+ *  be empty and compatible with index, as for split_by_list_range.
+ *
+ * @param id_bounds  increasing ids, size n_shard + 1 (or nullptr)
+ */
+void split_by_id_range(Index *index, int n_shard, Index **shards,
+                       const idx_t *id_bounds = nullptr);
+
 /* Returns the cluster the embeddings belong to.
  *
  * @param index      Index, which should be an IVF index
@@ -83,6 +119,9 @@ void search_and_return_centroids(Index *index,
 
 /** A set of IndexIVFs concatenated together in a FIFO fashion.
  * at each "step", the oldest index slice is removed and a new index is added.
+ *
+ * See IndexSegmentedIVF for an index that supports arbitrary additions and
+ * removals.
  */
 struct SlidingIndexWindow {
     /// common index that contains the sliding window
@@ -148,6 +187,38 @@ void range_search_with_parameters (
         double *ms_per_stage = nullptr);
 
 
+/** order the inverted lists so that the lists that are probed by the
+ * same queries are adjacent, for relayout_ondisk_invlists.
+ *
+ * Starting from the most probed list, the list that was most often
+ * probed together with the last placed one is placed next. When it has
+ * no unplaced co-probed list, the lists placed just before it are
+ * tried, then the most probed unplaced list.
+ *
+ * @param probes      probe log: the lists probed by n queries, size
+ *                    n * nprobe (-1s are ignored), eg. from
+ *                    quantizer->assign (n, x, probes, nprobe)
+ * @param list_order  output permutation of the list numbers, size nlist
+ */
+void co_probe_list_order (size_t nlist, idx_t n, size_t nprobe,
+                          const idx_t *probes, idx_t *list_order);
+
+/** same as co_probe_list_order, without a probe log: the co-probed lists
+ * are estimated from the neighbor graph of the coarse centroids (each
+ * centroid is used as a query that probes nprobe lists). The index is
+ * an IndexIVF, possibly embedded in an IndexPreTransform. */
+void centroid_graph_list_order (const Index *index, size_t nprobe,
+                                idx_t *list_order);
+
+/** rewrite the OnDiskInvertedLists file of an IVF index with the lists
+ * in the order list_order (see OnDiskInvertedLists::compact), so that
+ * the lists of a query are more often contiguous and their reads can
+ * be merged (OnDiskInvertedLists::prefetch_merge_gap).
+ *
+ * @return  new size of the file (bytes)
+ */
+size_t relayout_ondisk_invlists (Index *index, const idx_t *list_order);
+
 
 } } // namespace faiss::ivflib
 
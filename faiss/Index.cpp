@@ -12,12 +12,25 @@
 #include <faiss/impl/AuxIndexStructures.h>
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/utils/distances.h>
+#include <faiss/utils/utils.h>
+#include <faiss/utils/vector_view.h>
 
+#include <algorithm>
 #include <cstring>
 
 
 namespace faiss {
 
+void SearchParameters::set_time_budget (double budget_ms)
+{
+  deadline_ms = getmillisecs () + budget_ms;
+}
+
+bool SearchParameters::deadline_passed () const
+{
+  return deadline_ms > 0 && getmillisecs () > deadline_ms;
+}
+
 Index::~Index ()
 {
 }
@@ -34,6 +47,32 @@ void Index::range_search (idx_t , const float *, float,
   FAISS_THROW_MSG ("range search not implemented");
 }
 
+// nb of vectors converted at a time by the default add_view / search_view
+static const size_t view_block_size = 16384;
+
+void Index::add_view (const VectorArrayView & x)
+{
+  FAISS_THROW_IF_NOT (x.d == d);
+  std::vector<float> buf;
+  for (size_t i0 = 0; i0 < x.n; i0 += view_block_size) {
+    size_t i1 = std::min (x.n, i0 + view_block_size);
+    add (i1 - i0, x.get_float (i0, i1, buf));
+  }
+}
+
+void Index::search_view (const VectorArrayView & x, idx_t k,
+                         float *distances, idx_t *labels,
+                         const SearchParameters *params) const
+{
+  FAISS_THROW_IF_NOT (x.d == d);
+  std::vector<float> buf;
+  for (size_t i0 = 0; i0 < x.n; i0 += view_block_size) {
+    size_t i1 = std::min (x.n, i0 + view_block_size);
+    search (i1 - i0, x.get_float (i0, i1, buf), k,
+            distances + i0 * k, labels + i0 * k, params);
+  }
+}
+
 void Index::assign (idx_t n, const float * x, idx_t * labels, idx_t k) const
 {
   std::vector<float> distances(n * k);
@@ -65,6 +104,14 @@ void Index::reconstruct_n (idx_t i0, idx_t ni, float *recons) const {
 }
 
 
+void Index::reconstruct_batch (idx_t n, const idx_t *keys,
+                               float *recons) const {
+  for (idx_t i = 0; i < n; i++) {
+    reconstruct (keys[i], recons + i * d);
+  }
+}
+
+
 void Index::search_and_reconstruct (idx_t n, const float *x, idx_t k,
                                     float *distances, idx_t *labels,
                                     float *recons) const {
@@ -166,5 +213,11 @@ DistanceComputer * Index::get_distance_computer() const {
     }
 }
 
+MemoryUsage Index::memory_usage () const
+{
+    return MemoryUsage::object (
+          demangle_cpp_symbol (typeid (*this).name()));
+}
+
 
 }
@@ -11,6 +11,8 @@
 #define FAISS_INDEX_H
 
 #include <faiss/MetricType.h>
+#include <faiss/impl/MemoryUsage.h>
+#include <cstdint>
 #include <cstdio>
 #include <typeinfo>
 #include <string>
@@ -43,11 +45,58 @@ namespace faiss {
 struct IDSelector;
 struct RangeSearchResult;
 struct DistanceComputer;
+/// see utils/vector_view.h
+struct VectorArrayView;
+
+/** Parent class for the optional search parameters.
+ *
+ * Sub-classes with additional search parameters should inherit this
+ * class. The parameters override the corresponding fields of the index
+ * for one search call only, so that a shared index can serve queries
+ * with different settings. Ownership of the object fields is always to
+ * the caller.
+ */
+struct SearchParameters {
+    /// if non-null, only these ids are considered during search (not
+    /// owned). Only supported by the indexes that check it explicitly.
+    const IDSelector *sel;
+
+    /** if > 0, deadline of the search, in the time base of
+     * getmillisecs() (see set_time_budget). When it is passed, the
+     * indexes that support it return the best results found so far
+     * instead of the complete ones: IndexIVF stops probing lists
+     * (parallel_mode 0), IndexHNSW stops expanding candidates at level 0
+     * and IndexShards returns the results of the shards that did not
+     * fail. Unlike InterruptCallback, this never throws. Other indexes
+     * ignore it. */
+    double deadline_ms;
+
+    /** if non-null, size n (not owned): set to 1 for the queries whose
+     * search was cut by the deadline. The entries of the other queries
+     * are not modified, so the caller should initialize it to 0. */
+    uint8_t *truncated;
+
+    SearchParameters (): sel (nullptr), deadline_ms (0), truncated (nullptr) {}
+    virtual ~SearchParameters () {}
+
+    /// set the deadline to budget_ms milliseconds from now
+    void set_time_budget (double budget_ms);
+
+    /// true if a deadline is set and it is passed
+    bool deadline_passed () const;
+};
 
 /** Abstract structure for an index, supports adding vectors and searching them.
  *
  * All vectors provided at add or search time are 32-bit float arrays,
  * although the internal representation may vary.
+ *
+ * Thread safety: the const methods (search, range_search, reconstruct,
+ * ...) can be called concurrently from several threads, unless the
+ * documentation of the index states otherwise. The non-const methods
+ * (train, add, remove_ids, reset, ...) must not run concurrently with
+ * any other call on the same index. The Python wrapper releases the GIL
+ * in all of them.
  */
 struct Index {
     using idx_t = int64_t;  ///< all indices are this type
@@ -110,9 +159,28 @@ struct Index {
      * @param x           input vectors to search, size n * d
      * @param labels      output labels of the NNs, size n*k
      * @param distances   output pairwise distances, size n*k
+     * @param params      optional search parameters, their type depends
+     *                    on the index. Indexes that do not support them
+     *                    throw when they are provided
      */
     virtual void search (idx_t n, const float *x, idx_t k,
-                         float *distances, idx_t *labels) const = 0;
+                         float *distances, idx_t *labels,
+                         const SearchParameters *params = nullptr) const = 0;
+
+    /** Add the vectors of a view (any element type and stride, see
+     * utils/vector_view.h), with sequential ids as add.
+     *
+     * The default implementation converts them to float by blocks and
+     * calls add, so the whole array is never copied.
+     */
+    virtual void add_view (const VectorArrayView & x);
+
+    /** Same as search, for the query vectors of a view. The default
+     * implementation converts them to float by blocks and calls search.
+     */
+    virtual void search_view (const VectorArrayView & x, idx_t k,
+                              float *distances, idx_t *labels,
+                              const SearchParameters *params = nullptr) const;
 
     /** query n vectors of dimension d to the index.
      *
@@ -158,6 +226,17 @@ struct Index {
      */
     virtual void reconstruct_n (idx_t i0, idx_t ni, float *recons) const;
 
+    /** Reconstruct the vectors of arbitrary ids, eg. the candidates of a
+     * re-ranking stage
+     *
+     * The default implementation calls reconstruct for each key, the
+     * indexes that store codes decode them directly, in parallel.
+     * @param keys        ids of the vectors to reconstruct (size n)
+     * @param recons      reconstucted vectors (size n * d)
+     */
+    virtual void reconstruct_batch (idx_t n, const idx_t *keys,
+                                    float *recons) const;
+
     /** Similar to search, but also reconstructs the stored vectors (or an
      * approximation in the case of lossy coding) for the search results.
      *
@@ -233,6 +312,12 @@ struct Index {
     virtual void sa_decode (idx_t n, const uint8_t *bytes,
                                     float *x) const;
 
+    /** Memory used by the index, broken down over its components
+     * (codes, ids, quantizers, graph links, etc.), recursively for the
+     * sub-indexes. The default returns an empty node with the class
+     * name, for indexes that do not implement it.
+     */
+    virtual MemoryUsage memory_usage () const;
 
 };
 
@@ -28,11 +28,10 @@
 #include <faiss/impl/AuxIndexStructures.h>
 #include <faiss/IndexFlat.h>
 #include <faiss/utils/distances.h>
+#include <faiss/utils/Heap.h>
 
 
 /*
-#include <faiss/utils/Heap.h>
-
 #include <faiss/Clustering.h>
 
 #include <faiss/utils/hamming.h>
@@ -99,6 +98,7 @@ void Index2Layer::train(idx_t n, const float* x)
     std::vector<idx_t> assign(n); // assignement to coarse centroids
     q1.quantizer->assign (n, x, assign.data());
     std::vector<float> residuals(n * d);
+#pragma omp parallel for if (n > 1000)
     for (idx_t i = 0; i < n; i++) {
         q1.quantizer->compute_residual (
            x + i * d, residuals.data() + i * d, assign[i]);
@@ -111,6 +111,7 @@ void Index2Layer::train(idx_t n, const float* x)
     pq.train (n, residuals.data());
 
     is_trained = true;
+    precompute_table ();
 }
 
 void Index2Layer::add(idx_t n, const float* x)
@@ -161,13 +162,246 @@ void Index2Layer::add(idx_t n, const float* x)
 
 }
 
+namespace {
+
+typedef Index::idx_t idx_t;
+
+enum TermsType {
+    IP,           ///< <x, y_C> + <x, y_R>
+    L2_tab,       ///< L2 with precomputed ||y_R||^2 + 2 <y_C, y_R>
+    L2_otf,       ///< same, computed on the fly from the centroids
+};
+
+/** scan all the codes for one query, see IndexIVFPQ.cpp for the
+ * decomposition of the L2 distance
+ *
+ * @param order       the codes grouped by list number (size ntotal), so
+ *                    that the per-list data stays in cache
+ * @param coarse_dis  distance of x to all the centroids (size nlist)
+ * @param sim_table   <x, y_R> table (IP) or -2 * <x, y_R> (L2),
+ *                    size M * ksub
+ */
+template <class C, class PQDecoder, TermsType terms>
+void scan_codes_2layer (const Index2Layer &index,
+                        const idx_t *order,
+                        const float *coarse_dis,
+                        const float *sim_table,
+                        const float *centroids,
+                        const float *r_norms,
+                        idx_t k, float *D, idx_t *I)
+{
+    const ProductQuantizer &pq = index.pq;
+    size_t M = pq.M, ksub = pq.ksub;
+    const uint8_t *codes = index.codes.data();
+
+    heap_heapify<C> (k, D, I);
+
+    for (idx_t j = 0; j < index.ntotal; j++) {
+        idx_t i = order[j];
+        const uint8_t *code = codes + i * index.code_size;
+        idx_t key = index.q1.decode_listno (code);
+        PQDecoder decoder (code + index.code_size_1, pq.nbits);
+        float dis = coarse_dis[key];
+        const float *tab = terms == L2_tab ?
+            index.precomputed_table.data() + key * M * ksub : nullptr;
+        const float *centroid = centroids + key * index.d;
+        for (size_t m = 0; m < M; m++) {
+            uint64_t c = decoder.decode();
+            dis += sim_table[m * ksub + c];
+            if (terms == L2_tab) {
+                dis += tab[m * ksub + c];
+            } else if (terms == L2_otf) {
+                dis += r_norms[m * ksub + c] + 2 * fvec_inner_product (
+                     centroid + m * pq.dsub, pq.get_centroids (m, c),
+                     pq.dsub);
+            }
+        }
+        if (C::cmp (D[0], dis)) {
+            heap_pop<C> (k, D, I);
+            heap_push<C> (k, D, I, dis, i);
+        }
+    }
+
+    heap_reorder<C> (k, D, I);
+}
+
+template <class C, class PQDecoder>
+void scan_codes_2layer (TermsType terms, const Index2Layer &index,
+                        const idx_t *order,
+                        const float *coarse_dis,
+                        const float *sim_table,
+                        const float *centroids,
+                        const float *r_norms,
+                        idx_t k, float *D, idx_t *I)
+{
+#define DISPATCH(t) \
+    case t: \
+        scan_codes_2layer<C, PQDecoder, t> ( \
+             index, order, coarse_dis, sim_table, centroids, r_norms, k, D, I); \
+        break;
+    switch (terms) {
+        DISPATCH(IP)
+        DISPATCH(L2_tab)
+        DISPATCH(L2_otf)
+    }
+#undef DISPATCH
+}
+
+template <class C>
+void scan_codes_2layer (TermsType terms, const Index2Layer &index,
+                        const idx_t *order,
+                        const float *coarse_dis,
+                        const float *sim_table,
+                        const float *centroids,
+                        const float *r_norms,
+                        idx_t k, float *D, idx_t *I)
+{
+    switch (index.pq.nbits) {
+    case 8:
+        scan_codes_2layer<C, PQDecoder8> (
+            terms, index, order, coarse_dis, sim_table, centroids, r_norms,
+            k, D, I);
+        break;
+    case 16:
+        scan_codes_2layer<C, PQDecoder16> (
+            terms, index, order, coarse_dis, sim_table, centroids, r_norms,
+            k, D, I);
+        break;
+    default:
+        scan_codes_2layer<C, PQDecoderGeneric> (
+            terms, index, order, coarse_dis, sim_table, centroids, r_norms,
+            k, D, I);
+        break;
+    }
+}
+
+/// squared norms of the PQ centroids, size M * ksub
+std::vector<float> pq_centroid_norms (const ProductQuantizer &pq)
+{
+    std::vector<float> r_norms (pq.M * pq.ksub);
+    for (size_t m = 0; m < pq.M; m++) {
+        for (size_t j = 0; j < pq.ksub; j++) {
+            r_norms [m * pq.ksub + j] =
+                fvec_norm_L2sqr (pq.get_centroids (m, j), pq.dsub);
+        }
+    }
+    return r_norms;
+}
+
+} // anonymous namespace
+
+
+void Index2Layer::precompute_table ()
+{
+    precomputed_table.clear ();
+    size_t nlist = q1.nlist;
+    size_t table_size = pq.M * pq.ksub * nlist * sizeof(float);
+    if (metric_type != METRIC_L2 || !is_trained ||
+        table_size > IndexIVFPQ::precomputed_table_max_bytes) {
+        return;
+    }
+
+    std::vector<float> r_norms = pq_centroid_norms (pq);
+    precomputed_table.resize (nlist * pq.M * pq.ksub);
+
+#pragma omp parallel
+    {
+        std::vector<float> centroid (d);
+#pragma omp for
+        for (idx_t i = 0; i < nlist; i++) {
+            q1.quantizer->reconstruct (i, centroid.data());
+            float *tab = &precomputed_table[i * pq.M * pq.ksub];
+            pq.compute_inner_prod_table (centroid.data(), tab);
+            fvec_madd (pq.M * pq.ksub, r_norms.data(), 2.0, tab, tab);
+        }
+    }
+}
+
+
 void Index2Layer::search(
-    idx_t /*n*/,
-    const float* /*x*/,
-    idx_t /*k*/,
-    float* /*distances*/,
-    idx_t* /*labels*/) const {
-  FAISS_THROW_MSG("not implemented");
+    idx_t n,
+    const float* x,
+    idx_t k,
+    float* distances,
+    idx_t* labels,
+    const SearchParameters* params) const
+{
+    FAISS_THROW_IF_NOT_MSG (!params,
+            "search params not supported for this index");
+    FAISS_THROW_IF_NOT (is_trained);
+    FAISS_THROW_IF_NOT (k > 0);
+    FAISS_THROW_IF_NOT (metric_type == METRIC_L2 ||
+                        metric_type == METRIC_INNER_PRODUCT);
+    size_t nlist = q1.nlist;
+
+    // the coarse centroids, read directly from flat quantizers
+    std::vector<float> centroids_buf;
+    const float *centroids;
+    const IndexFlat *flat = dynamic_cast<const IndexFlat*> (q1.quantizer);
+    if (flat) {
+        centroids = flat->xb.data();
+    } else {
+        centroids_buf.resize (nlist * d);
+        q1.quantizer->reconstruct_n (0, nlist, centroids_buf.data());
+        centroids = centroids_buf.data();
+    }
+
+    TermsType terms =
+        metric_type == METRIC_INNER_PRODUCT ? IP :
+        !precomputed_table.empty() ? L2_tab : L2_otf;
+    std::vector<float> r_norms;
+    if (terms == L2_otf) {
+        r_norms = pq_centroid_norms (pq);
+    }
+
+    // counting sort of the codes by list number
+    std::vector<idx_t> order (ntotal);
+    {
+        std::vector<idx_t> list_nos (ntotal);
+        std::vector<size_t> ofs (nlist + 1);
+        for (idx_t i = 0; i < ntotal; i++) {
+            list_nos[i] = q1.decode_listno (codes.data() + i * code_size);
+            ofs[list_nos[i] + 1]++;
+        }
+        for (size_t l = 0; l < nlist; l++) {
+            ofs[l + 1] += ofs[l];
+        }
+        for (idx_t i = 0; i < ntotal; i++) {
+            order[ofs[list_nos[i]]++] = i;
+        }
+    }
+
+#pragma omp parallel if (n > 1)
+    {
+        std::vector<float> coarse_dis (nlist);
+        std::vector<float> sim_table (pq.M * pq.ksub);
+
+#pragma omp for
+        for (idx_t i = 0; i < n; i++) {
+            const float *xi = x + i * d;
+            pq.compute_inner_prod_table (xi, sim_table.data());
+            if (terms == IP) {
+                fvec_inner_products_ny (coarse_dis.data(), xi, centroids,
+                                        d, nlist);
+            } else {
+                fvec_L2sqr_ny (coarse_dis.data(), xi, centroids, d, nlist);
+                for (size_t j = 0; j < sim_table.size(); j++) {
+                    sim_table[j] *= -2;
+                }
+            }
+            float *D = distances + i * k;
+            idx_t *I = labels + i * k;
+            if (terms == IP) {
+                scan_codes_2layer<CMin<float, idx_t> > (
+                    terms, *this, order.data(), coarse_dis.data(), sim_table.data(),
+                    centroids, r_norms.data(), k, D, I);
+            } else {
+                scan_codes_2layer<CMax<float, idx_t> > (
+                    terms, *this, order.data(), coarse_dis.data(), sim_table.data(),
+                    centroids, r_norms.data(), k, D, I);
+            }
+        }
+    }
 }
 
 
@@ -196,15 +430,45 @@ void Index2Layer::transfer_to_IVFPQ (IndexIVFPQ & other) const
     FAISS_THROW_IF_NOT (other.nlist == q1.nlist);
     FAISS_THROW_IF_NOT (other.code_size == code_size_2);
     FAISS_THROW_IF_NOT (other.ntotal == 0);
+    FAISS_THROW_IF_NOT (other.by_residual);
+
+    if (!other.is_trained) {
+        // the PQ is shared, the coarse quantizer should be the same
+        FAISS_THROW_IF_NOT (other.quantizer->ntotal == q1.nlist);
+        other.pq = pq;
+        other.is_trained = true;
+        other.precompute_table ();
+    }
 
-    const uint8_t *rp = codes.data();
-
+    // bucket the codes per list to add them in a single call per list
+    std::vector<size_t> lims (q1.nlist + 1);
+    std::vector<idx_t> list_nos (ntotal);
     for (idx_t i = 0; i < ntotal; i++) {
-        idx_t key = 0;
-        memcpy (&key, rp, code_size_1);
-        rp += code_size_1;
-        other.invlists->add_entry (key, i, rp);
-        rp += code_size_2;
+        list_nos[i] = q1.decode_listno (codes.data() + i * code_size);
+        lims[list_nos[i] + 1]++;
+    }
+    for (size_t l = 0; l < q1.nlist; l++) {
+        lims[l + 1] += lims[l];
+    }
+    std::vector<idx_t> ids (ntotal);
+    std::vector<uint8_t> list_codes (ntotal * code_size_2);
+    {
+        std::vector<size_t> ofs (lims.begin(), lims.end() - 1);
+        for (idx_t i = 0; i < ntotal; i++) {
+            size_t o = ofs[list_nos[i]]++;
+            ids[o] = i;
+            memcpy (&list_codes[o * code_size_2],
+                    codes.data() + i * code_size + code_size_1,
+                    code_size_2);
+        }
+    }
+
+    for (size_t l = 0; l < q1.nlist; l++) {
+        if (lims[l + 1] > lims[l]) {
+            other.invlists->add_entries (
+                 l, lims[l + 1] - lims[l], ids.data() + lims[l],
+                 list_codes.data() + lims[l] * code_size_2);
+        }
     }
 
     other.ntotal = ntotal;
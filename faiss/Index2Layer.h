@@ -22,7 +22,9 @@ struct IndexIVFPQ;
 /** Same as an IndexIVFPQ without the inverted lists: codes are stored sequentially
  *
  * The class is mainly inteded to store encoded vectors that can be
- * accessed randomly, the search function is not implemented.
+ * accessed randomly. The search is exhaustive: it combines the
+ * distances to the first-level centroids with PQ look-up tables, as
+ * IndexIVFPQ does for its residuals.
  */
 struct Index2Layer: Index {
     /// first level quantizer
@@ -43,6 +45,12 @@ struct Index2Layer: Index {
     /// code_size_1 + code_size_2
     size_t code_size;
 
+    /** ||y_R||^2 + 2 <y_C, y_R> terms of the L2 distances, size
+     * nlist * pq.M * pq.ksub (same as IndexIVFPQ::precomputed_table).
+     * Empty if larger than IndexIVFPQ::precomputed_table_max_bytes, the
+     * terms are then computed on the fly */
+    std::vector<float> precomputed_table;
+
     Index2Layer (Index * quantizer, size_t nlist,
                  int M, int nbit = 8,
                  MetricType metric = METRIC_L2);
@@ -54,13 +62,13 @@ struct Index2Layer: Index {
 
     void add(idx_t n, const float* x) override;
 
-    /// not implemented
     void search(
         idx_t n,
         const float* x,
         idx_t k,
         float* distances,
-        idx_t* labels) const override;
+        idx_t* labels,
+        const SearchParameters *params = nullptr) const override;
 
     void reconstruct_n(idx_t i0, idx_t ni, float* recons) const override;
 
@@ -70,7 +78,12 @@ struct Index2Layer: Index {
 
     DistanceComputer * get_distance_computer() const override;
 
-    /// transfer the flat codes to an IVFPQ index
+    /// build the precomputed table (called by train)
+    void precompute_table();
+
+    /** transfer the flat codes to an IVFPQ index without re-encoding
+     * them. If other is not trained, its PQ is copied from this index:
+     * its coarse quantizer should have the same centroids as q1 */
     void transfer_to_IVFPQ(IndexIVFPQ & other) const;
 
 
@@ -0,0 +1,635 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/IndexAdditiveQuantizer.h>
+
+#include <cinttypes>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+
+#include <faiss/utils/distances.h>
+#include <faiss/utils/Heap.h>
+#include <faiss/utils/utils.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/AuxIndexStructures.h>
+
+
+namespace faiss {
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+/// whether the distances are computed from look-up tables
+bool use_LUT (const AdditiveQuantizer & aq)
+{
+    return aq.search_type != AdditiveQuantizer::ST_decompress;
+}
+
+/// codes scanned at a time with look-up tables
+const size_t scan_bs = 256;
+
+} // anonymous namespace
+
+
+/*******************************************************************
+ * IndexAdditiveQuantizer implementation
+ ********************************************************************/
+
+IndexAdditiveQuantizer::IndexAdditiveQuantizer (idx_t d,
+                                                AdditiveQuantizer *aq,
+                                                MetricType metric):
+    Index (d, metric), aq (aq)
+{
+    FAISS_THROW_IF_NOT_MSG (metric == METRIC_L2 ||
+                            metric == METRIC_INNER_PRODUCT,
+                            "metric type not supported");
+    is_trained = false;
+}
+
+void IndexAdditiveQuantizer::train (idx_t n, const float* x)
+{
+    aq->train (n, x);
+    is_trained = true;
+}
+
+void IndexAdditiveQuantizer::add (idx_t n, const float* x)
+{
+    FAISS_THROW_IF_NOT (is_trained);
+    codes.resize ((ntotal + n) * aq->code_size);
+    aq->compute_codes (x, codes.data() + ntotal * aq->code_size, n);
+    ntotal += n;
+}
+
+void IndexAdditiveQuantizer::reset ()
+{
+    codes.clear ();
+    ntotal = 0;
+}
+
+
+namespace {
+
+template<class C>
+void search_with_LUT (const IndexAdditiveQuantizer & index,
+                      idx_t n, const float *x, idx_t k,
+                      float *distances, idx_t *labels)
+{
+    const AdditiveQuantizer & aq = *index.aq;
+    bool is_IP = index.metric_type == METRIC_INNER_PRODUCT;
+    size_t MK = aq.M * aq.K;
+    size_t ntotal = index.ntotal;
+
+    // the LUTs are computed for blocks of queries
+    const idx_t qbs = 256;
+    std::vector<float> LUT (std::min (n, qbs) * MK);
+
+    for (idx_t i0 = 0; i0 < n; i0 += qbs) {
+        idx_t i1 = std::min (n, i0 + qbs);
+        aq.compute_LUT (i1 - i0, x + i0 * index.d, LUT.data());
+
+#pragma omp parallel if (i1 - i0 > 1)
+        {
+            std::vector<float> tables (aq.scan_tables_size ());
+            float dis[scan_bs];
+
+#pragma omp for
+            for (idx_t i = i0; i < i1; i++) {
+                aq.compute_scan_tables (LUT.data() + (i - i0) * MK, is_IP,
+                                        tables.data());
+                float dis0 = is_IP ? 0 :
+                    fvec_norm_L2sqr (x + i * index.d, index.d);
+
+                float *simi = distances + i * k;
+                idx_t *idxi = labels + i * k;
+                heap_heapify<C> (k, simi, idxi);
+
+                for (size_t j0 = 0; j0 < ntotal; j0 += scan_bs) {
+                    size_t j1 = std::min (ntotal, j0 + scan_bs);
+                    aq.scan_codes (tables.data(), is_IP,
+                                   index.codes.data() + j0 * aq.code_size,
+                                   j1 - j0, dis);
+                    for (size_t j = j0; j < j1; j++) {
+                        float d = dis0 + dis[j - j0];
+                        if (C::cmp (simi[0], d)) {
+                            heap_pop<C> (k, simi, idxi);
+                            heap_push<C> (k, simi, idxi, d, j);
+                        }
+                    }
+                }
+                heap_reorder<C> (k, simi, idxi);
+            }
+        }
+    }
+}
+
+/// decode blocks of database vectors and search them exhaustively
+template<class C>
+void search_decompress (const IndexAdditiveQuantizer & index,
+                        idx_t n, const float *x, idx_t k,
+                        float *distances, idx_t *labels)
+{
+    size_t d = index.d;
+    size_t bs = 16384;
+    std::vector<float> block (std::min (bs, size_t(index.ntotal)) * d);
+    std::vector<float> block_dis (n * k);
+    std::vector<idx_t> block_ids (n * k);
+
+    for (idx_t i = 0; i < n; i++) {
+        heap_heapify<C> (k, distances + i * k, labels + i * k);
+    }
+
+    for (size_t j0 = 0; j0 < index.ntotal; j0 += bs) {
+        size_t j1 = std::min (j0 + bs, size_t(index.ntotal));
+        index.aq->decode (index.codes.data() + j0 * index.aq->code_size,
+                          block.data(), j1 - j0);
+
+        if (index.metric_type == METRIC_L2) {
+            float_maxheap_array_t res = {
+                size_t(n), size_t(k), block_ids.data(), block_dis.data()};
+            knn_L2sqr (x, block.data(), d, n, j1 - j0, &res);
+        } else {
+            float_minheap_array_t res = {
+                size_t(n), size_t(k), block_ids.data(), block_dis.data()};
+            knn_inner_product (x, block.data(), d, n, j1 - j0, &res);
+        }
+
+#pragma omp parallel for
+        for (idx_t i = 0; i < n; i++) {
+            idx_t *idsi = block_ids.data() + i * k;
+            for (idx_t l = 0; l < k; l++) {
+                if (idsi[l] >= 0) {
+                    idsi[l] += j0;
+                }
+            }
+            heap_addn<C> (k, distances + i * k, labels + i * k,
+                          block_dis.data() + i * k, idsi, k);
+        }
+    }
+
+    for (idx_t i = 0; i < n; i++) {
+        heap_reorder<C> (k, distances + i * k, labels + i * k);
+    }
+}
+
+template<class C>
+void search_AQ (const IndexAdditiveQuantizer & index,
+                idx_t n, const float *x, idx_t k,
+                float *distances, idx_t *labels)
+{
+    if (use_LUT (*index.aq)) {
+        search_with_LUT<C> (index, n, x, k, distances, labels);
+    } else {
+        search_decompress<C> (index, n, x, k, distances, labels);
+    }
+}
+
+} // anonymous namespace
+
+
+void IndexAdditiveQuantizer::search (idx_t n, const float *x, idx_t k,
+                                     float *distances, idx_t *labels,
+                                     const SearchParameters *params) const
+{
+    FAISS_THROW_IF_NOT_MSG (!params,
+            "search params not supported for this index");
+    FAISS_THROW_IF_NOT (k > 0);
+    FAISS_THROW_IF_NOT (is_trained);
+
+    if (metric_type == METRIC_L2) {
+        search_AQ<CMax<float, idx_t>> (*this, n, x, k, distances, labels);
+    } else {
+        search_AQ<CMin<float, idx_t>> (*this, n, x, k, distances, labels);
+    }
+}
+
+
+void IndexAdditiveQuantizer::reconstruct_n (idx_t i0, idx_t ni,
+                                            float* recons) const
+{
+    FAISS_THROW_IF_NOT (ni == 0 || (i0 >= 0 && i0 + ni <= ntotal));
+    aq->decode (codes.data() + i0 * aq->code_size, recons, ni);
+}
+
+void IndexAdditiveQuantizer::reconstruct (idx_t key, float* recons) const
+{
+    aq->decode (codes.data() + key * aq->code_size, recons, 1);
+}
+
+
+namespace {
+
+struct AQDistanceComputer: DistanceComputer {
+    const IndexAdditiveQuantizer & index;
+    const AdditiveQuantizer & aq;
+    const float *q;
+    std::vector<float> tmp1, tmp2;
+
+    explicit AQDistanceComputer (const IndexAdditiveQuantizer & index):
+        index (index), aq (*index.aq), q (nullptr),
+        tmp1 (index.d), tmp2 (index.d)
+    {}
+
+    float distance (const float *x, const float *y) {
+        return index.metric_type == METRIC_L2 ?
+            fvec_L2sqr (x, y, index.d) :
+            fvec_inner_product (x, y, index.d);
+    }
+
+    float operator () (idx_t i) override {
+        aq.decode (index.codes.data() + i * aq.code_size, tmp1.data(), 1);
+        return distance (q, tmp1.data());
+    }
+
+    float symmetric_dis (idx_t i, idx_t j) override {
+        aq.decode (index.codes.data() + i * aq.code_size, tmp1.data(), 1);
+        aq.decode (index.codes.data() + j * aq.code_size, tmp2.data(), 1);
+        return distance (tmp1.data(), tmp2.data());
+    }
+
+    void set_query (const float *x) override {
+        q = x;
+    }
+};
+
+} // anonymous namespace
+
+
+DistanceComputer *IndexAdditiveQuantizer::get_distance_computer () const
+{
+    return new AQDistanceComputer (*this);
+}
+
+
+/* The standalone codec interface */
+size_t IndexAdditiveQuantizer::sa_code_size () const
+{
+    return aq->code_size;
+}
+
+void IndexAdditiveQuantizer::sa_encode (idx_t n, const float *x,
+                                        uint8_t *bytes) const
+{
+    aq->compute_codes (x, bytes, n);
+}
+
+void IndexAdditiveQuantizer::sa_decode (idx_t n, const uint8_t *bytes,
+                                        float *x) const
+{
+    aq->decode (bytes, x, n);
+}
+
+
+/*******************************************************************
+ * IndexResidual / IndexLocalSearchQuantizer
+ ********************************************************************/
+
+IndexResidual::IndexResidual (int d, size_t M, size_t nbits,
+                              MetricType metric,
+                              AdditiveQuantizer::Search_type_t search_type):
+    IndexAdditiveQuantizer (d, &rq, metric),
+    rq (d, M, nbits, search_type)
+{}
+
+IndexResidual::IndexResidual ():
+    IndexAdditiveQuantizer (0, &rq)
+{}
+
+IndexLocalSearchQuantizer::IndexLocalSearchQuantizer (
+        int d, size_t M, size_t nbits,
+        MetricType metric,
+        AdditiveQuantizer::Search_type_t search_type):
+    IndexAdditiveQuantizer (d, &lsq, metric),
+    lsq (d, M, nbits, search_type)
+{}
+
+IndexLocalSearchQuantizer::IndexLocalSearchQuantizer ():
+    IndexAdditiveQuantizer (0, &lsq)
+{}
+
+
+/*******************************************************************
+ * IndexIVFAdditiveQuantizer implementation
+ ********************************************************************/
+
+IndexIVFAdditiveQuantizer::IndexIVFAdditiveQuantizer (
+        AdditiveQuantizer *aq, Index *quantizer, size_t d, size_t nlist,
+        MetricType metric):
+    IndexIVF (quantizer, d, nlist, 0, metric),
+    aq (aq), by_residual (true)
+{
+    FAISS_THROW_IF_NOT_MSG (metric == METRIC_L2 ||
+                            metric == METRIC_INNER_PRODUCT,
+                            "metric type not supported");
+}
+
+IndexIVFAdditiveQuantizer::IndexIVFAdditiveQuantizer (AdditiveQuantizer *aq):
+    aq (aq), by_residual (true)
+{}
+
+void IndexIVFAdditiveQuantizer::train_residual (idx_t n, const float *x)
+{
+    const float *x_in = x;
+    // samples of the training set, as for the IVFPQ
+    size_t max_train_points = 1024 * ((size_t)1 << aq->nbits);
+    x = fvecs_maybe_subsample (d, (size_t*)&n, max_train_points,
+                               x, verbose, 1234);
+    ScopeDeleter<float> del_x (x_in == x ? nullptr : x);
+
+    if (!by_residual) {
+        aq->train (n, x);
+        return;
+    }
+
+    std::vector<idx_t> assign (n);
+    quantizer->assign (n, x, assign.data());
+    std::vector<float> residuals (n * d);
+    std::vector<float> centroids (n * d);
+    quantizer->compute_residual_n (n, x, residuals.data(), assign.data());
+    for (idx_t i = 0; i < n; i++) {
+        quantizer->reconstruct (assign[i], centroids.data() + i * d);
+    }
+
+    if (verbose) {
+        printf ("training additive quantizer on %" PRId64
+                " residuals\n", n);
+    }
+    aq->train (n, residuals.data());
+
+    if (aq->norm_bits > 0) {
+        // the norms are those of the full reconstructions
+        std::vector<uint8_t> codes (n * aq->code_size);
+        aq->compute_codes (residuals.data(), codes.data(), n);
+        std::vector<float> x_recons (n * d);
+        aq->decode (codes.data(), x_recons.data(), n);
+        fvec_madd (n * d, x_recons.data(), 1.0, centroids.data(),
+                   x_recons.data());
+        std::vector<float> norms (n);
+        fvec_norms_L2sqr (norms.data(), x_recons.data(), d, n);
+        aq->train_norm (n, norms.data());
+    }
+}
+
+void IndexIVFAdditiveQuantizer::encode_vectors (idx_t n, const float* x,
+                                                const idx_t *list_nos,
+                                                uint8_t * codes,
+                                                bool include_listnos) const
+{
+    size_t coarse_size = include_listnos ? coarse_code_size () : 0;
+
+    std::vector<float> residuals, centroids;
+    if (by_residual) {
+        residuals.resize (n * d);
+        centroids.resize (n * d);
+#pragma omp parallel for if (n > 1000)
+        for (idx_t i = 0; i < n; i++) {
+            if (list_nos[i] < 0) {
+                memcpy (residuals.data() + i * d, x + i * d,
+                        sizeof (float) * d);
+                memset (centroids.data() + i * d, 0, sizeof (float) * d);
+            } else {
+                quantizer->reconstruct (list_nos[i],
+                                        centroids.data() + i * d);
+                fvec_madd (d, x + i * d, -1.0, centroids.data() + i * d,
+                           residuals.data() + i * d);
+            }
+        }
+        x = residuals.data();
+    }
+
+    std::vector<uint8_t> aq_codes (n * code_size);
+    aq->compute_codes (x, aq_codes.data(), n,
+                       by_residual ? centroids.data() : nullptr);
+
+    for (idx_t i = 0; i < n; i++) {
+        uint8_t *code = codes + i * (code_size + coarse_size);
+        if (list_nos[i] < 0) {
+            memset (code, 0, code_size + coarse_size);
+            continue;
+        }
+        if (coarse_size) {
+            encode_listno (list_nos[i], code);
+        }
+        memcpy (code + coarse_size, aq_codes.data() + i * code_size,
+                code_size);
+    }
+}
+
+void IndexIVFAdditiveQuantizer::sa_decode (idx_t n, const uint8_t *codes,
+                                           float *x) const
+{
+    size_t coarse_size = coarse_code_size ();
+
+#pragma omp parallel if (n > 1000)
+    {
+        std::vector<float> centroid (d);
+
+#pragma omp for
+        for (idx_t i = 0; i < n; i++) {
+            const uint8_t *code = codes + i * (code_size + coarse_size);
+            int64_t list_no = decode_listno (code);
+            float *xi = x + i * d;
+            aq->decode (code + coarse_size, xi, 1);
+            if (by_residual) {
+                quantizer->reconstruct (list_no, centroid.data());
+                fvec_madd (d, xi, 1.0, centroid.data(), xi);
+            }
+        }
+    }
+}
+
+void IndexIVFAdditiveQuantizer::reconstruct_from_offset (
+        int64_t list_no, int64_t offset, float* recons) const
+{
+    const uint8_t* code = invlists->get_single_code (list_no, offset);
+    aq->decode (code, recons, 1);
+    if (by_residual) {
+        std::vector<float> centroid (d);
+        quantizer->reconstruct (list_no, centroid.data());
+        fvec_madd (d, recons, 1.0, centroid.data(), recons);
+    }
+}
+
+
+namespace {
+
+template<class C>
+struct AQInvertedListScanner: InvertedListScanner {
+    const IndexIVFAdditiveQuantizer & ivf;
+    const AdditiveQuantizer & aq;
+    bool store_pairs;
+    bool is_IP;
+    bool with_LUT;
+
+    const float *q;
+    float q_norm;
+    std::vector<float> LUT, tables;
+
+    idx_t list_no;
+    std::vector<float> centroid;
+    float dis0;
+
+    mutable std::vector<float> tmp;
+
+    AQInvertedListScanner (const IndexIVFAdditiveQuantizer & ivf,
+                           bool store_pairs):
+        ivf (ivf), aq (*ivf.aq), store_pairs (store_pairs),
+        is_IP (ivf.metric_type == METRIC_INNER_PRODUCT),
+        with_LUT (use_LUT (aq)),
+        q (nullptr), q_norm (0),
+        list_no (-1), centroid (ivf.d), dis0 (0), tmp (ivf.d)
+    {
+        if (with_LUT) {
+            LUT.resize (aq.M * aq.K);
+            tables.resize (aq.scan_tables_size ());
+        }
+    }
+
+    void set_query (const float *query) override {
+        q = query;
+        if (with_LUT) {
+            aq.compute_LUT (1, q, LUT.data());
+            aq.compute_scan_tables (LUT.data(), is_IP, tables.data());
+        }
+        q_norm = fvec_norm_L2sqr (q, ivf.d);
+    }
+
+    void set_list (idx_t list_no, float /* coarse_dis */) override {
+        this->list_no = list_no;
+        if (ivf.by_residual) {
+            ivf.quantizer->reconstruct (list_no, centroid.data());
+        }
+        float qc = ivf.by_residual ?
+            fvec_inner_product (q, centroid.data(), ivf.d) : 0;
+        dis0 = is_IP ? qc : q_norm - 2 * qc;
+    }
+
+    float distance_to_code (const uint8_t *code) const override {
+        if (with_LUT) {
+            float dis;
+            aq.scan_codes (tables.data(), is_IP, code, 1, &dis);
+            return dis0 + dis;
+        }
+        aq.decode (code, tmp.data(), 1);
+        if (ivf.by_residual) {
+            fvec_madd (ivf.d, tmp.data(), 1.0, centroid.data(), tmp.data());
+        }
+        return is_IP ? fvec_inner_product (q, tmp.data(), ivf.d) :
+                       fvec_L2sqr (q, tmp.data(), ivf.d);
+    }
+
+    /// calls consumer (j, dis) for the codes that pass the selector
+    template<class Consumer>
+    void scan_list (size_t list_size, const uint8_t *codes,
+                    const idx_t *ids, Consumer & consumer) const
+    {
+        if (sel || !with_LUT) {
+            for (size_t j = 0; j < list_size; j++) {
+                if (sel && !sel->is_member (ids[j])) continue;
+                consumer (j, distance_to_code (codes + j * aq.code_size));
+            }
+            return;
+        }
+        float dis[scan_bs];
+        for (size_t j0 = 0; j0 < list_size; j0 += scan_bs) {
+            size_t j1 = std::min (list_size, j0 + scan_bs);
+            aq.scan_codes (tables.data(), is_IP,
+                           codes + j0 * aq.code_size, j1 - j0, dis);
+            for (size_t j = j0; j < j1; j++) {
+                consumer (j, dis0 + dis[j - j0]);
+            }
+        }
+    }
+
+    size_t scan_codes (size_t list_size,
+                       const uint8_t *codes,
+                       const idx_t *ids,
+                       float *simi, idx_t *idxi,
+                       size_t k) const override
+    {
+        size_t nup = 0;
+        auto consumer = [&] (size_t j, float dis) {
+            if (C::cmp (simi[0], dis)) {
+                heap_pop<C> (k, simi, idxi);
+                int64_t id = store_pairs ? lo_build (list_no, j) : ids[j];
+                heap_push<C> (k, simi, idxi, dis, id);
+                nup++;
+            }
+        };
+        scan_list (list_size, codes, ids, consumer);
+        return nup;
+    }
+
+    void scan_codes_range (size_t list_size,
+                           const uint8_t *codes,
+                           const idx_t *ids,
+                           float radius,
+                           RangeQueryResult & res) const override
+    {
+        auto consumer = [&] (size_t j, float dis) {
+            if (C::cmp (radius, dis)) {
+                int64_t id = store_pairs ? lo_build (list_no, j) : ids[j];
+                res.add (dis, id);
+            }
+        };
+        scan_list (list_size, codes, ids, consumer);
+    }
+};
+
+} // anonymous namespace
+
+
+InvertedListScanner* IndexIVFAdditiveQuantizer::get_InvertedListScanner
+    (bool store_pairs) const
+{
+    if (metric_type == METRIC_INNER_PRODUCT) {
+        return new AQInvertedListScanner<CMin<float, idx_t>> (
+              *this, store_pairs);
+    } else {
+        return new AQInvertedListScanner<CMax<float, idx_t>> (
+              *this, store_pairs);
+    }
+}
+
+
+/*******************************************************************
+ * IndexIVFResidual / IndexIVFLocalSearchQuantizer
+ ********************************************************************/
+
+IndexIVFResidual::IndexIVFResidual (
+        Index *quantizer, size_t d, size_t nlist,
+        size_t M, size_t nbits, MetricType metric,
+        AdditiveQuantizer::Search_type_t search_type):
+    IndexIVFAdditiveQuantizer (&rq, quantizer, d, nlist, metric),
+    rq (d, M, nbits, search_type)
+{
+    code_size = invlists->code_size = rq.code_size;
+}
+
+IndexIVFResidual::IndexIVFResidual ():
+    IndexIVFAdditiveQuantizer (&rq)
+{}
+
+IndexIVFLocalSearchQuantizer::IndexIVFLocalSearchQuantizer (
+        Index *quantizer, size_t d, size_t nlist,
+        size_t M, size_t nbits, MetricType metric,
+        AdditiveQuantizer::Search_type_t search_type):
+    IndexIVFAdditiveQuantizer (&lsq, quantizer, d, nlist, metric),
+    lsq (d, M, nbits, search_type)
+{
+    code_size = invlists->code_size = lsq.code_size;
+}
+
+IndexIVFLocalSearchQuantizer::IndexIVFLocalSearchQuantizer ():
+    IndexIVFAdditiveQuantizer (&lsq)
+{}
+
+
+} // namespace faiss
@@ -0,0 +1,187 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#ifndef FAISS_INDEX_ADDITIVE_QUANTIZER_H
+#define FAISS_INDEX_ADDITIVE_QUANTIZER_H
+
+#include <stdint.h>
+
+#include <vector>
+
+#include <faiss/IndexIVF.h>
+#include <faiss/impl/AdditiveQuantizer.h>
+#include <faiss/impl/LocalSearchQuantizer.h>
+#include <faiss/impl/ResidualQuantizer.h>
+
+
+namespace faiss {
+
+/** Flat index whose vectors are encoded with an additive quantizer.
+ *
+ * The search computes the look-up tables of the queries with one
+ * matrix multiplication and scans the codes with them (see
+ * AdditiveQuantizer::scan_codes). For L2, the codes must store a norm
+ * (ST_norm_float or ST_norm_qint8), otherwise (ST_decompress) the
+ * database vectors are decoded by blocks.
+ */
+struct IndexAdditiveQuantizer: Index {
+
+    /// the quantizer, owned by the subclasses
+    AdditiveQuantizer *aq;
+
+    /// codes, size ntotal * aq->code_size
+    std::vector<uint8_t> codes;
+
+    explicit IndexAdditiveQuantizer (idx_t d = 0,
+                                     AdditiveQuantizer *aq = nullptr,
+                                     MetricType metric = METRIC_L2);
+
+    void train(idx_t n, const float* x) override;
+
+    void add(idx_t n, const float* x) override;
+
+    void search(
+        idx_t n,
+        const float* x,
+        idx_t k,
+        float* distances,
+        idx_t* labels,
+        const SearchParameters *params = nullptr) const override;
+
+    void reset() override;
+
+    void reconstruct_n(idx_t i0, idx_t ni, float* recons) const override;
+
+    void reconstruct(idx_t key, float* recons) const override;
+
+    DistanceComputer *get_distance_computer () const override;
+
+    /* standalone codec interface */
+    size_t sa_code_size () const override;
+
+    void sa_encode (idx_t n, const float *x,
+                          uint8_t *bytes) const override;
+
+    void sa_decode (idx_t n, const uint8_t *bytes,
+                            float *x) const override;
+};
+
+
+/// flat index with a residual quantizer
+struct IndexResidual: IndexAdditiveQuantizer {
+
+    ResidualQuantizer rq;
+
+    /** Constructor.
+     *
+     * @param d      dimensionality of the input vectors
+     * @param M      number of codebooks
+     * @param nbits  number of bits per codebook index
+     */
+    IndexResidual (int d, size_t M, size_t nbits,
+                   MetricType metric = METRIC_L2,
+                   AdditiveQuantizer::Search_type_t search_type =
+                        AdditiveQuantizer::ST_norm_float);
+
+    IndexResidual ();
+};
+
+
+/// flat index with a local search quantizer
+struct IndexLocalSearchQuantizer: IndexAdditiveQuantizer {
+
+    LocalSearchQuantizer lsq;
+
+    IndexLocalSearchQuantizer (int d, size_t M, size_t nbits,
+                               MetricType metric = METRIC_L2,
+                               AdditiveQuantizer::Search_type_t search_type =
+                                    AdditiveQuantizer::ST_norm_float);
+
+    IndexLocalSearchQuantizer ();
+};
+
+
+/** IVF index whose residuals are encoded with an additive quantizer.
+ *
+ * The look-up tables of a query are computed once for all the lists.
+ * For L2, the norm that is stored in the codes is the one of the full
+ * reconstruction (centroid + residual), so that
+ *
+ *    ||q - c - r||^2 = ||q||^2 - 2 <q, c> - 2 <q, r> + ||c + r||^2
+ *
+ * where only <q, c> depends on the list.
+ */
+struct IndexIVFAdditiveQuantizer: IndexIVF {
+
+    /// the quantizer, owned by the subclasses
+    AdditiveQuantizer *aq;
+
+    /// encode the residuals w.r.t. the centroids
+    bool by_residual;
+
+    IndexIVFAdditiveQuantizer (AdditiveQuantizer *aq, Index *quantizer,
+                               size_t d, size_t nlist,
+                               MetricType metric = METRIC_L2);
+
+    explicit IndexIVFAdditiveQuantizer (AdditiveQuantizer *aq = nullptr);
+
+    void train_residual(idx_t n, const float* x) override;
+
+    void encode_vectors(idx_t n, const float* x,
+                        const idx_t *list_nos,
+                        uint8_t * codes,
+                        bool include_listnos=false) const override;
+
+    InvertedListScanner *get_InvertedListScanner (bool store_pairs)
+        const override;
+
+    void reconstruct_from_offset (int64_t list_no, int64_t offset,
+                                  float* recons) const override;
+
+    /* standalone codec interface */
+    void sa_decode (idx_t n, const uint8_t *bytes,
+                            float *x) const override;
+};
+
+
+/// IVF index with a residual quantizer
+struct IndexIVFResidual: IndexIVFAdditiveQuantizer {
+
+    ResidualQuantizer rq;
+
+    IndexIVFResidual (Index *quantizer, size_t d, size_t nlist,
+                      size_t M, size_t nbits,
+                      MetricType metric = METRIC_L2,
+                      AdditiveQuantizer::Search_type_t search_type =
+                           AdditiveQuantizer::ST_norm_float);
+
+    IndexIVFResidual ();
+};
+
+
+/// IVF index with a local search quantizer
+struct IndexIVFLocalSearchQuantizer: IndexIVFAdditiveQuantizer {
+
+    LocalSearchQuantizer lsq;
+
+    IndexIVFLocalSearchQuantizer (
+          Index *quantizer, size_t d, size_t nlist,
+          size_t M, size_t nbits,
+          MetricType metric = METRIC_L2,
+          AdditiveQuantizer::Search_type_t search_type =
+               AdditiveQuantizer::ST_norm_float);
+
+    IndexIVFLocalSearchQuantizer ();
+};
+
+
+}
+
+
+#endif
@@ -73,5 +73,9 @@ void IndexBinary::display() const {
   printf("Index: %s  -> %" PRId64 " elements\n", typeid (*this).name(), ntotal);
 }
 
+MemoryUsage IndexBinary::memory_usage() const {
+  return MemoryUsage::object(demangle_cpp_symbol(typeid (*this).name()));
+}
+
 
 }  // namespace faiss
@@ -93,9 +93,11 @@ struct IndexBinary {
    * @param x           input vectors to search, size n * d / 8
    * @param labels      output labels of the NNs, size n*k
    * @param distances   output pairwise distances, size n*k
+   * @param params      optional search parameters (see Index::search)
    */
   virtual void search(idx_t n, const uint8_t *x, idx_t k,
-                      int32_t *distances, idx_t *labels) const = 0;
+                      int32_t *distances, idx_t *labels,
+                      const SearchParameters *params = nullptr) const = 0;
 
   /** Query n vectors of dimension d to the index.
    *
@@ -159,6 +161,9 @@ struct IndexBinary {
 
   /** Display the actual class name and some more info. */
   void display() const;
+
+  /// memory used by the index, see Index::memory_usage
+  virtual MemoryUsage memory_usage() const;
 };
 
 
@@ -32,7 +32,10 @@ void IndexBinaryFlat::reset() {
 }
 
 void IndexBinaryFlat::search(idx_t n, const uint8_t *x, idx_t k,
-                             int32_t *distances, idx_t *labels) const {
+                             int32_t *distances, idx_t *labels,
+                             const SearchParameters *params) const {
+  FAISS_THROW_IF_NOT_MSG(!params,
+                         "search params not supported for this index");
   const idx_t block_size = query_batch_size;
   for (idx_t s = 0; s < n; s += block_size) {
     idx_t nn = block_size;
@@ -49,8 +52,8 @@ void IndexBinaryFlat::search(idx_t n, const uint8_t *x, idx_t k,
       hammings_knn_hc(&res, x + s * code_size, xb.data(), ntotal, code_size,
                       /* ordered = */ true);
     } else {
-      hammings_knn_mc(x + s * code_size, xb.data(), nn, ntotal, k, code_size,
-                      distances + s * k, labels + s * k);
+      hammings_knn_hist(x + s * code_size, xb.data(), nn, ntotal, k,
+                        code_size, distances + s * k, labels + s * k);
     }
   }
 }
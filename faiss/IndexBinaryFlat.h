@@ -23,7 +23,8 @@ struct IndexBinaryFlat : IndexBinary {
   std::vector<uint8_t> xb;
 
   /** Select between using a heap or counting to select the k smallest values
-   * when scanning inverted lists.
+   * when scanning inverted lists. Counting (see HammingKSelector) is
+   * faster for large k.
    */
   bool use_heap = true;
 
@@ -36,7 +37,8 @@ struct IndexBinaryFlat : IndexBinary {
   void reset() override;
 
   void search(idx_t n, const uint8_t *x, idx_t k,
-              int32_t *distances, idx_t *labels) const override;
+              int32_t *distances, idx_t *labels,
+              const SearchParameters *params = nullptr) const override;
 
   void range_search(idx_t n, const uint8_t *x, int radius,
                    RangeSearchResult *result) const override;
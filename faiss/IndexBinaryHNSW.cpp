@@ -10,6 +10,7 @@
 #include <faiss/IndexBinaryHNSW.h>
 
 
+#include <algorithm>
 #include <memory>
 #include <cstdlib>
 #include <cassert>
@@ -195,11 +196,25 @@ void IndexBinaryHNSW::train(idx_t n, const uint8_t *x)
 }
 
 void IndexBinaryHNSW::search(idx_t n, const uint8_t *x, idx_t k,
-                             int32_t *distances, idx_t *labels) const
+                             int32_t *distances, idx_t *labels,
+                             const SearchParameters *params_in) const
 {
+  const SearchParametersHNSW *params = nullptr;
+  if (params_in) {
+    params = dynamic_cast<const SearchParametersHNSW *>(params_in);
+    FAISS_THROW_IF_NOT_MSG(params,
+                           "IndexBinaryHNSW params have incorrect type");
+  }
+
+  int efSearch = params ? params->efSearch : hnsw.efSearch;
+  // HNSW::search uses max(efSearch, k), eg. the nprobe of a coarse quantizer
+  size_t nvisit_hint = (size_t)std::max(efSearch, int(k)) *
+    hnsw.nb_neighbors(0);
+
 #pragma omp parallel
   {
-    VisitedTable vt(ntotal);
+    ScratchVisitedTable svt(ntotal, nvisit_hint);
+    VisitedTable& vt = *svt;
     std::unique_ptr<DistanceComputer> dis(get_distance_computer());
 
 #pragma omp for
@@ -210,13 +225,13 @@ void IndexBinaryHNSW::search(idx_t n, const uint8_t *x, idx_t k,
       dis->set_query((float *)(x + i * code_size));
 
       maxheap_heapify(k, simi, idxi);
-      hnsw.search(*dis, k, idxi, simi, vt);
+      hnsw.search(*dis, k, idxi, simi, vt, params);
       maxheap_reorder(k, simi, idxi);
     }
   }
 
 #pragma omp parallel for
-  for (int i = 0; i < n * k; ++i) {
+  for (idx_t i = 0; i < n * k; ++i) {
     distances[i] = std::round(((float *)distances)[i]);
   }
 }
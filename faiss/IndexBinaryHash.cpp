@@ -9,8 +9,10 @@
 
 #include <faiss/IndexBinaryHash.h>
 
+#include <algorithm>
 #include <cinttypes>
 #include <cstdio>
+#include <cstring>
 #include <memory>
 
 #include <faiss/utils/hamming.h>
@@ -31,15 +33,217 @@ static inline int __builtin_ctzll(uint64_t x) {
 
 namespace faiss {
 
-void IndexBinaryHash::InvertedList::add (
-        idx_t id, size_t code_size, const uint8_t *code)
+/*******************************************************
+ * BinaryHashTable implementation
+ ******************************************************/
+
+const uint64_t BinaryHashTable::empty_key;
+
+namespace {
+
+inline size_t hash_slot (uint64_t key, int log2_capacity)
+{
+    // Fibonacci hashing, the high bits are the best mixed
+    return (key * 0x9E3779B97F4A7C15ULL) >> (64 - log2_capacity);
+}
+
+/// returns the slot of key, inserts it if it is not in the table
+size_t insert_key (std::vector<uint64_t> &keys, int log2_capacity,
+                   uint64_t key, bool &is_new)
+{
+    size_t cap_mask = keys.size() - 1;
+    size_t s = hash_slot (key, log2_capacity);
+    while (keys[s] != BinaryHashTable::empty_key) {
+        if (keys[s] == key) {
+            is_new = false;
+            return s;
+        }
+        s = (s + 1) & cap_mask;
+    }
+    keys[s] = key;
+    is_new = true;
+    return s;
+}
+
+void rehash_keys (std::vector<uint64_t> &keys, int new_log2_capacity)
+{
+    std::vector<uint64_t> new_keys (
+            (size_t)1 << new_log2_capacity, BinaryHashTable::empty_key);
+    bool is_new;
+    for (uint64_t key: keys) {
+        if (key != BinaryHashTable::empty_key) {
+            insert_key (new_keys, new_log2_capacity, key, is_new);
+        }
+    }
+    keys.swap (new_keys);
+}
+
+} // anonymous namespace
+
+
+BinaryHashTable::BinaryHashTable (size_t code_size):
+    code_size (code_size), log2_capacity (0), nkeys (0)
+{}
+
+int64_t BinaryHashTable::find (uint64_t key) const
+{
+    if (nkeys == 0) {
+        return -1;
+    }
+    size_t cap_mask = keys.size() - 1;
+    size_t s = hash_slot (key, log2_capacity);
+    while (keys[s] != empty_key) {
+        if (keys[s] == key) {
+            return s;
+        }
+        s = (s + 1) & cap_mask;
+    }
+    return -1;
+}
+
+void BinaryHashTable::find_batch (
+        size_t n, const uint64_t *qkeys, int64_t *slots) const
 {
-    ids.push_back(id);
-    vecs.insert(vecs.end(), code, code + code_size);
+    if (nkeys == 0) {
+        for (size_t i = 0; i < n; i++) {
+            slots[i] = -1;
+        }
+        return;
+    }
+    // initial slots, in a separate loop so that it can be vectorized
+    int shift = 64 - log2_capacity;
+    for (size_t i = 0; i < n; i++) {
+        slots[i] = (qkeys[i] * 0x9E3779B97F4A7C15ULL) >> shift;
+    }
+    size_t cap_mask = keys.size() - 1;
+    for (size_t i = 0; i < n; i++) {
+        size_t s = slots[i];
+        uint64_t key = qkeys[i];
+        while (keys[s] != key && keys[s] != empty_key) {
+            s = (s + 1) & cap_mask;
+        }
+        slots[i] = keys[s] == key ? (int64_t)s : -1;
+    }
 }
 
+void BinaryHashTable::add (size_t n, const uint64_t *entry_keys,
+                           const idx_t *entry_ids, const uint8_t *entry_codes)
+{
+    if (n == 0) {
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        FAISS_THROW_IF_NOT_MSG (entry_keys[i] != empty_key,
+                                "invalid hash value");
+    }
+
+    // state of the table before the add
+    std::vector<uint64_t> old_keys = keys;
+    std::vector<size_t> old_lims;
+    old_lims.swap (lims);
+    size_t old_cap = old_keys.size();
+
+    // insert the keys, the load factor is kept below 1/2
+    for (size_t i = 0; i < n; i++) {
+        if ((nkeys + 1) * 2 > keys.size()) {
+            log2_capacity = std::max (log2_capacity + 1, 4);
+            rehash_keys (keys, log2_capacity);
+        }
+        bool is_new;
+        insert_key (keys, log2_capacity, entry_keys[i], is_new);
+        if (is_new) {
+            nkeys++;
+        }
+    }
+    size_t cap = keys.size();
+
+    // new slots of the new entries and of the old buckets
+    std::vector<int64_t> entry_slots (n);
+#pragma omp parallel for if (n > 1000)
+    for (int64_t i0 = 0; i0 < (int64_t)n; i0 += 1024) {
+        size_t i1 = std::min ((size_t)i0 + 1024, n);
+        find_batch (i1 - i0, entry_keys + i0, entry_slots.data() + i0);
+    }
+
+    std::vector<int64_t> old_slots (old_cap, -1);
+#pragma omp parallel for if (old_cap > 1000)
+    for (int64_t s = 0; s < (int64_t)old_cap; s++) {
+        if (old_keys[s] != empty_key) {
+            old_slots[s] = find (old_keys[s]);
+        }
+    }
+
+    // bucket limits
+    lims.assign (cap + 1, 0);
+    for (size_t s = 0; s < old_cap; s++) {
+        if (old_slots[s] >= 0) {
+            lims[old_slots[s] + 1] = old_lims[s + 1] - old_lims[s];
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        lims[entry_slots[i] + 1]++;
+    }
+    for (size_t s = 0; s < cap; s++) {
+        lims[s + 1] += lims[s];
+    }
+
+    size_t nentries = lims[cap];
+    std::vector<idx_t> new_ids (nentries);
+    std::vector<uint8_t> new_codes (nentries * code_size);
+
+    // move the old buckets to the head of their new bucket
+#pragma omp parallel for if (old_cap > 1000)
+    for (int64_t s = 0; s < (int64_t)old_cap; s++) {
+        int64_t ns = old_slots[s];
+        if (ns < 0) {
+            continue;
+        }
+        size_t j0 = old_lims[s], nv = old_lims[s + 1] - j0;
+        memcpy (new_ids.data() + lims[ns], ids.data() + j0,
+                nv * sizeof (idx_t));
+        memcpy (new_codes.data() + lims[ns] * code_size,
+                codes.data() + j0 * code_size, nv * code_size);
+    }
+
+    // the new entries fill the buckets from the end, in reverse order
+    std::vector<size_t> dest (n);
+    {
+        std::vector<size_t> end (lims.begin() + 1, lims.end());
+        for (size_t i = n; i-- > 0; ) {
+            dest[i] = --end[entry_slots[i]];
+        }
+    }
+
+#pragma omp parallel for if (n > 1000)
+    for (int64_t i = 0; i < (int64_t)n; i++) {
+        new_ids[dest[i]] = entry_ids[i];
+        if (code_size > 0) {
+            memcpy (new_codes.data() + dest[i] * code_size,
+                    entry_codes + i * code_size, code_size);
+        }
+    }
+
+    ids.swap (new_ids);
+    codes.swap (new_codes);
+}
+
+void BinaryHashTable::clear ()
+{
+    keys.clear();
+    lims.clear();
+    ids.clear();
+    codes.clear();
+    nkeys = 0;
+    log2_capacity = 0;
+}
+
+
+/*******************************************************
+ * IndexBinaryHash implementation
+ ******************************************************/
+
 IndexBinaryHash::IndexBinaryHash(int d, int b):
-    IndexBinary(d), b(b), nflip(0)
+    IndexBinary(d), invlists(code_size), b(b), nflip(0)
 {
     is_trained = true;
 }
@@ -64,14 +268,16 @@ void IndexBinaryHash::add(idx_t n, const uint8_t *x)
 void IndexBinaryHash::add_with_ids(idx_t n, const uint8_t *x, const idx_t *xids)
 {
     uint64_t mask = ((uint64_t)1 << b) - 1;
-    // simplistic add function. Cannot really be parallelized.
+    std::vector<uint64_t> hashes (n);
+    std::vector<idx_t> ids (n);
 
+#pragma omp parallel for if (n > 1000)
     for (idx_t i = 0; i < n; i++) {
-        idx_t id = xids ? xids[i] : ntotal + i;
-        const uint8_t * xi = x + i * code_size;
-        idx_t hash = *((uint64_t*)xi) & mask;
-        invlists[hash].add(id, code_size, xi);
+        ids[i] = xids ? xids[i] : ntotal + i;
+        hashes[i] = *((uint64_t*)(x + i * code_size)) & mask;
     }
+    invlists.code_size = code_size;
+    invlists.add (n, hashes.data(), ids.data(), x);
     ntotal += n;
 }
 
@@ -122,6 +328,17 @@ struct FlipEnumerator {
 
 using idx_t = Index::idx_t;
 
+/// all the bit masks of nbit bits with at most maxflip 1s
+std::vector<uint64_t> flip_masks (int nbit, int maxflip)
+{
+    std::vector<uint64_t> flips;
+    FlipEnumerator fe (nbit, maxflip);
+    do {
+        flips.push_back (fe.x);
+    } while (fe.next());
+    return flips;
+}
+
 
 struct RangeSearchResults {
     int radius;
@@ -152,9 +369,19 @@ struct KnnSearchResults {
 
 };
 
+struct KSelectorSearchResults {
+    HammingKSelector & sel;
+
+    inline void add (float dis, idx_t id) {
+        sel.add (dis, id);
+    }
+
+};
+
 template<class HammingComputer, class SearchResults>
 void
 search_single_query_template(const IndexBinaryHash & index, const uint8_t *q,
+                    const std::vector<uint64_t> & flips,
                     SearchResults &res,
                     size_t &n0, size_t &nlist, size_t &ndis)
 {
@@ -162,43 +389,48 @@ search_single_query_template(const IndexBinaryHash & index, const uint8_t *q,
     uint64_t mask = ((uint64_t)1 << index.b) - 1;
     uint64_t qhash = *((uint64_t*)q) & mask;
     HammingComputer hc (q, code_size);
-    FlipEnumerator fe(index.b, index.nflip);
+    const BinaryHashTable & table = index.invlists;
 
-    // loop over neighbors that are at most at nflip bits
-    do {
-        uint64_t hash = qhash ^ fe.x;
-        auto it = index.invlists.find (hash);
+    // probe all neighbors that are at most at nflip bits in one batch
+    size_t nf = flips.size();
+    std::vector<uint64_t> hashes (nf);
+    for (size_t j = 0; j < nf; j++) {
+        hashes[j] = qhash ^ flips[j];
+    }
+    std::vector<int64_t> slots (nf);
+    table.find_batch (nf, hashes.data(), slots.data());
 
-        if (it == index.invlists.end()) {
+    for (size_t j = 0; j < nf; j++) {
+        if (slots[j] < 0) {
             continue;
         }
 
-        const IndexBinaryHash::InvertedList &il = it->second;
-
-        size_t nv = il.ids.size();
+        size_t nv = table.bucket_size (slots[j]);
 
         if (nv == 0) {
             n0++;
         } else {
-            const uint8_t *codes = il.vecs.data();
+            const uint8_t *codes = table.bucket_codes (slots[j]);
+            const idx_t *ids = table.bucket_ids (slots[j]);
             for (size_t i = 0; i < nv; i++) {
                 int dis = hc.hamming (codes);
-                res.add(dis, il.ids[i]);
+                res.add(dis, ids[i]);
                 codes += code_size;
             }
             ndis += nv;
             nlist++;
         }
-    } while(fe.next());
+    }
 }
 
 template<class SearchResults>
 void
 search_single_query(const IndexBinaryHash & index, const uint8_t *q,
+                    const std::vector<uint64_t> & flips,
                     SearchResults &res,
                     size_t &n0, size_t &nlist, size_t &ndis)
 {
-#define HC(name) search_single_query_template<name>(index, q, res, n0, nlist, ndis);
+#define HC(name) search_single_query_template<name>(index, q, flips, res, n0, nlist, ndis);
     switch(index.code_size) {
     case 4: HC(HammingComputer4); break;
     case 8: HC(HammingComputer8); break;
@@ -215,7 +447,6 @@ search_single_query(const IndexBinaryHash & index, const uint8_t *q,
 #undef HC
 }
 
-
 } // anonymous namespace
 
 
@@ -225,6 +456,7 @@ void IndexBinaryHash::range_search(idx_t n, const uint8_t *x, int radius,
 {
 
     size_t nlist = 0, ndis = 0, n0 = 0;
+    std::vector<uint64_t> flips = flip_masks (b, nflip);
 
 #pragma omp parallel if(n > 100) reduction(+: ndis, n0, nlist)
     {
@@ -236,7 +468,7 @@ void IndexBinaryHash::range_search(idx_t n, const uint8_t *x, int radius,
             RangeSearchResults res = {radius, qres};
             const uint8_t *q = x + i * code_size;
 
-            search_single_query (*this, q, res, n0, nlist, ndis);
+            search_single_query (*this, q, flips, res, n0, nlist, ndis);
 
         }
         pres.finalize ();
@@ -248,23 +480,42 @@ void IndexBinaryHash::range_search(idx_t n, const uint8_t *x, int radius,
 }
 
 void IndexBinaryHash::search(idx_t n, const uint8_t *x, idx_t k,
-                             int32_t *distances, idx_t *labels) const
+                             int32_t *distances, idx_t *labels,
+                             const SearchParameters *params) const
 {
+    FAISS_THROW_IF_NOT_MSG (!params,
+            "search params not supported for this index");
 
     using HeapForL2 = CMax<int32_t, idx_t>;
     size_t nlist = 0, ndis = 0, n0 = 0;
+    std::vector<uint64_t> flips = flip_masks (b, nflip);
 
+    if (!use_heap) {
+#pragma omp parallel if(n > 100) reduction(+: nlist, ndis, n0)
+        {
+            HammingKSelector sel (d, k);
+#pragma omp for
+            for (idx_t i = 0; i < n; i++) {
+                sel.reset ();
+                KSelectorSearchResults res = {sel};
+                search_single_query (*this, x + i * code_size, flips,
+                                     res, n0, nlist, ndis);
+                sel.get_results (distances + k * i, labels + k * i);
+            }
+        }
+    } else {
 #pragma omp parallel for if(n > 100) reduction(+: nlist, ndis, n0)
-    for (idx_t i = 0; i < n; i++) {
-        int32_t * simi = distances + k * i;
-        idx_t * idxi = labels + k * i;
-
-        heap_heapify<HeapForL2> (k, simi, idxi);
-        KnnSearchResults res = {k, simi, idxi};
-        const uint8_t *q = x + i * code_size;
+        for (idx_t i = 0; i < n; i++) {
+            int32_t * simi = distances + k * i;
+            idx_t * idxi = labels + k * i;
 
-        search_single_query (*this, q, res, n0, nlist, ndis);
+            heap_heapify<HeapForL2> (k, simi, idxi);
+            KnnSearchResults res = {k, simi, idxi};
+            const uint8_t *q = x + i * code_size;
 
+            search_single_query (*this, q, flips, res, n0, nlist, ndis);
+            heap_reorder<HeapForL2> (k, simi, idxi);
+        }
     }
     indexBinaryHash_stats.nq += n;
     indexBinaryHash_stats.n0 += n0;
@@ -274,17 +525,20 @@ void IndexBinaryHash::search(idx_t n, const uint8_t *x, idx_t k,
 
 size_t IndexBinaryHash::hashtable_size() const
 {
-    return invlists.size();
+    return invlists.nkeys;
 }
 
 
 void IndexBinaryHash::display() const
 {
-    for (auto it = invlists.begin(); it != invlists.end(); ++it) {
-        printf("%" PRId64 ": [", it->first);
-        const std::vector<idx_t> & v = it->second.ids;
-        for (auto x: v) {
-            printf("%" PRId64 " ", x);
+    for (size_t s = 0; s < invlists.capacity(); s++) {
+        if (invlists.keys[s] == BinaryHashTable::empty_key) {
+            continue;
+        }
+        printf("%" PRId64 ": [", invlists.keys[s]);
+        const idx_t *ids = invlists.bucket_ids (s);
+        for (size_t j = 0; j < invlists.bucket_size (s); j++) {
+            printf("%" PRId64 " ", ids[j]);
         }
         printf("]\n");
 
@@ -329,7 +583,7 @@ void IndexBinaryMultiHash::reset()
 {
     storage->reset();
     ntotal = 0;
-    for(auto map: maps) {
+    for(auto & map: maps) {
         map.clear();
     }
 }
@@ -339,16 +593,22 @@ void IndexBinaryMultiHash::add(idx_t n, const uint8_t *x)
     storage->add(n, x);
     // populate maps
     uint64_t mask = ((uint64_t)1 << b) - 1;
+    std::vector<uint64_t> hashes (n);
+    std::vector<idx_t> ids (n);
+    for (idx_t i = 0; i < n; i++) {
+        ids[i] = i + ntotal;
+    }
 
-    for(idx_t i = 0; i < n; i++) {
-        const uint8_t *xi = x + i * code_size;
-        int ho = 0;
-        for(int h = 0; h < nhash; h++) {
+    int ho = 0;
+    for(int h = 0; h < nhash; h++) {
+#pragma omp parallel for if (n > 1000)
+        for(idx_t i = 0; i < n; i++) {
+            const uint8_t *xi = x + i * code_size;
             uint64_t hash = *(uint64_t*)(xi + (ho >> 3)) >> (ho & 7);
-            hash &= mask;
-            maps[h][hash].push_back(i + ntotal);
-            ho += b;
+            hashes[i] = hash & mask;
         }
+        maps[h].add (n, hashes.data(), ids.data(), nullptr);
+        ho += b;
     }
     ntotal += n;
 }
@@ -361,7 +621,7 @@ static
 void verify_shortlist(
         const IndexBinaryFlat & index,
         const uint8_t * q,
-        const std::unordered_set<Index::idx_t> & shortlist,
+        const std::vector<Index::idx_t> & shortlist,
         SearchResults &res)
 {
     size_t code_size = index.code_size;
@@ -379,13 +639,17 @@ void verify_shortlist(
 template<class SearchResults>
 void
 search_1_query_multihash(const IndexBinaryMultiHash & index, const uint8_t *xi,
+                         const std::vector<uint64_t> & flips,
                          SearchResults &res,
                          size_t &n0, size_t &nlist, size_t &ndis)
 {
 
-    std::unordered_set<idx_t> shortlist;
+    std::vector<idx_t> shortlist;
     int b = index.b;
     uint64_t mask = ((uint64_t)1 << b) - 1;
+    size_t nf = flips.size();
+    std::vector<uint64_t> hashes (nf);
+    std::vector<int64_t> slots (nf);
 
     int ho = 0;
     for(int h = 0; h < index.nhash; h++) {
@@ -393,25 +657,28 @@ search_1_query_multihash(const IndexBinaryMultiHash & index, const uint8_t *xi,
         qhash &= mask;
         const IndexBinaryMultiHash::Map & map = index.maps[h];
 
-        FlipEnumerator fe(index.b, index.nflip);
-        // loop over neighbors that are at most at nflip bits
-        do {
-            uint64_t hash = qhash ^ fe.x;
-            auto it = map.find (hash);
-
-            if (it != map.end()) {
-                const std::vector<idx_t> & v = it->second;
-                for (auto i: v) {
-                    shortlist.insert(i);
-                }
+        // probe all neighbors that are at most at nflip bits in one batch
+        for (size_t j = 0; j < nf; j++) {
+            hashes[j] = qhash ^ flips[j];
+        }
+        map.find_batch (nf, hashes.data(), slots.data());
+
+        for (size_t j = 0; j < nf; j++) {
+            if (slots[j] >= 0) {
+                const idx_t *ids = map.bucket_ids (slots[j]);
+                shortlist.insert (shortlist.end(),
+                                  ids, ids + map.bucket_size (slots[j]));
                 nlist++;
             } else {
                 n0++;
             }
-        } while(fe.next());
+        }
 
         ho += b;
     }
+    std::sort (shortlist.begin(), shortlist.end());
+    shortlist.erase (std::unique (shortlist.begin(), shortlist.end()),
+                     shortlist.end());
     ndis += shortlist.size();
 
     // verify shortlist
@@ -440,6 +707,7 @@ void IndexBinaryMultiHash::range_search(idx_t n, const uint8_t *x, int radius,
 {
 
     size_t nlist = 0, ndis = 0, n0 = 0;
+    std::vector<uint64_t> flips = flip_masks (b, nflip);
 
 #pragma omp parallel if(n > 100) reduction(+: ndis, n0, nlist)
     {
@@ -451,7 +719,7 @@ void IndexBinaryMultiHash::range_search(idx_t n, const uint8_t *x, int radius,
             RangeSearchResults res = {radius, qres};
             const uint8_t *q = x + i * code_size;
 
-            search_1_query_multihash (*this, q, res, n0, nlist, ndis);
+            search_1_query_multihash (*this, q, flips, res, n0, nlist, ndis);
 
         }
         pres.finalize ();
@@ -463,23 +731,42 @@ void IndexBinaryMultiHash::range_search(idx_t n, const uint8_t *x, int radius,
 }
 
 void IndexBinaryMultiHash::search(idx_t n, const uint8_t *x, idx_t k,
-                             int32_t *distances, idx_t *labels) const
+                             int32_t *distances, idx_t *labels,
+                             const SearchParameters *params) const
 {
+    FAISS_THROW_IF_NOT_MSG (!params,
+            "search params not supported for this index");
 
     using HeapForL2 = CMax<int32_t, idx_t>;
     size_t nlist = 0, ndis = 0, n0 = 0;
+    std::vector<uint64_t> flips = flip_masks (b, nflip);
 
+    if (!use_heap) {
+#pragma omp parallel if(n > 100) reduction(+: nlist, ndis, n0)
+        {
+            HammingKSelector sel (d, k);
+#pragma omp for
+            for (idx_t i = 0; i < n; i++) {
+                sel.reset ();
+                KSelectorSearchResults res = {sel};
+                search_1_query_multihash (*this, x + i * code_size, flips,
+                                          res, n0, nlist, ndis);
+                sel.get_results (distances + k * i, labels + k * i);
+            }
+        }
+    } else {
 #pragma omp parallel for if(n > 100) reduction(+: nlist, ndis, n0)
-    for (idx_t i = 0; i < n; i++) {
-        int32_t * simi = distances + k * i;
-        idx_t * idxi = labels + k * i;
+        for (idx_t i = 0; i < n; i++) {
+            int32_t * simi = distances + k * i;
+            idx_t * idxi = labels + k * i;
 
-        heap_heapify<HeapForL2> (k, simi, idxi);
-        KnnSearchResults res = {k, simi, idxi};
-        const uint8_t *q = x + i * code_size;
-
-        search_1_query_multihash (*this, q, res, n0, nlist, ndis);
+            heap_heapify<HeapForL2> (k, simi, idxi);
+            KnnSearchResults res = {k, simi, idxi};
+            const uint8_t *q = x + i * code_size;
 
+            search_1_query_multihash (*this, q, flips, res, n0, nlist, ndis);
+            heap_reorder<HeapForL2> (k, simi, idxi);
+        }
     }
     indexBinaryHash_stats.nq += n;
     indexBinaryHash_stats.n0 += n0;
@@ -490,8 +777,8 @@ void IndexBinaryMultiHash::search(idx_t n, const uint8_t *x, idx_t k,
 size_t IndexBinaryMultiHash::hashtable_size() const
 {
     size_t tot = 0;
-    for (auto map: maps) {
-        tot += map.size();
+    for (const auto & map: maps) {
+        tot += map.nkeys;
     }
 
     return tot;
@@ -12,8 +12,8 @@
 
 
 
+#include <stdint.h>
 #include <vector>
-#include <unordered_map>
 
 #include <faiss/IndexBinary.h>
 #include <faiss/IndexBinaryFlat.h>
@@ -26,21 +26,79 @@ namespace faiss {
 struct RangeSearchResult;
 
 
-/** just uses the b first bits as a hash value */
-struct IndexBinaryHash : IndexBinary {
+/** Open-addressing hash table that maps hash values to buckets of
+ * (id, code) entries.
+ *
+ * The keys are stored in a flat table with linear probing. The entries
+ * of all buckets sit contiguously in two arenas (ids and codes), ordered
+ * by slot, so that a bucket is a range of the arenas.
+ */
+struct BinaryHashTable {
+    typedef Index::idx_t idx_t;
+
+    /// marks a free slot in the key table
+    static const uint64_t empty_key = ~(uint64_t)0;
+
+    size_t code_size;     ///< size of the codes, 0 if only ids are stored
+    int log2_capacity;    ///< the key table has 2^log2_capacity slots
+    size_t nkeys;         ///< nb of non-empty slots
+
+    std::vector<uint64_t> keys;  ///< key of each slot, or empty_key
+    /// bucket of slot s is entries lims[s] .. lims[s + 1] (size capacity + 1)
+    std::vector<size_t> lims;
+    std::vector<idx_t> ids;      ///< entry ids, size nb of entries
+    std::vector<uint8_t> codes;  ///< entry codes, size nb of entries * code_size
+
+    explicit BinaryHashTable (size_t code_size = 0);
+
+    size_t capacity () const {
+        return keys.size();
+    }
+
+    /// slot of the key or -1 if it is not in the table
+    int64_t find (uint64_t key) const;
+
+    /// find for n keys at once (the initial slots are computed in batch)
+    void find_batch (size_t n, const uint64_t *qkeys, int64_t *slots) const;
 
-    struct InvertedList {
-        std::vector<idx_t> ids;
-        std::vector<uint8_t> vecs;
+    size_t bucket_size (int64_t slot) const {
+        return lims[slot + 1] - lims[slot];
+    }
 
-        void add (idx_t id, size_t code_size, const uint8_t *code);
-    };
+    const idx_t *bucket_ids (int64_t slot) const {
+        return ids.data() + lims[slot];
+    }
 
-    using InvertedListMap = std::unordered_map<idx_t, InvertedList>;
-    InvertedListMap invlists;
+    const uint8_t *bucket_codes (int64_t slot) const {
+        return codes.data() + lims[slot] * code_size;
+    }
+
+    /** add n entries. The arenas are rebuilt in parallel, the new entries
+     * are appended to their bucket in order.
+     *
+     * @param entry_keys   hash values, size n
+     * @param entry_ids    ids, size n
+     * @param entry_codes  codes, size n * code_size (unused if code_size = 0)
+     */
+    void add (size_t n, const uint64_t *entry_keys,
+              const idx_t *entry_ids, const uint8_t *entry_codes);
+
+    void clear ();
+};
+
+
+/** just uses the b first bits as a hash value */
+struct IndexBinaryHash : IndexBinary {
+
+    /// maps the hash values to the ids and codes that hash to them
+    BinaryHashTable invlists;
 
     int b, nflip;
 
+    /** Select between using a heap or counting to select the k smallest
+     * values (see HammingKSelector) */
+    bool use_heap = true;
+
     IndexBinaryHash(int d, int b);
 
     IndexBinaryHash();
@@ -55,7 +113,8 @@ struct IndexBinaryHash : IndexBinary {
                       RangeSearchResult *result) const override;
 
     void search(idx_t n, const uint8_t *x, idx_t k,
-                int32_t *distances, idx_t *labels) const override;
+                int32_t *distances, idx_t *labels,
+                const SearchParameters *params = nullptr) const override;
 
     void display() const;
     size_t hashtable_size() const;
@@ -82,8 +141,8 @@ struct IndexBinaryMultiHash: IndexBinary {
     IndexBinaryFlat *storage;
     bool own_fields;
 
-    // maps hash values to the ids that hash to them
-    using Map = std::unordered_map<idx_t, std::vector<idx_t> >;
+    // maps hash values to the ids that hash to them (no codes stored)
+    using Map = BinaryHashTable;
 
     // the different hashes, size nhash
     std::vector<Map> maps;
@@ -92,6 +151,10 @@ struct IndexBinaryMultiHash: IndexBinary {
     int b; ///< nb bits per hash map
     int nflip; ///< nb bit flips to use at search time
 
+    /** Select between using a heap or counting to select the k smallest
+     * values (see HammingKSelector) */
+    bool use_heap = true;
+
     IndexBinaryMultiHash(int d, int nhash, int b);
 
     IndexBinaryMultiHash();
@@ -106,7 +169,8 @@ struct IndexBinaryMultiHash: IndexBinary {
                       RangeSearchResult *result) const override;
 
      void search(idx_t n, const uint8_t *x, idx_t k,
-                int32_t *distances, idx_t *labels) const override;
+                int32_t *distances, idx_t *labels,
+                const SearchParameters *params = nullptr) const override;
 
     size_t hashtable_size() const;
 
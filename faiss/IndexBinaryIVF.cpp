@@ -11,6 +11,7 @@
 
 #include <cinttypes>
 #include <cstdio>
+#include <cstring>
 #include <omp.h>
 
 #include <memory>
@@ -119,19 +120,29 @@ void IndexBinaryIVF::set_direct_map_type (DirectMap::Type type)
 
 
 void IndexBinaryIVF::search(idx_t n, const uint8_t *x, idx_t k,
-                            int32_t *distances, idx_t *labels) const {
+                            int32_t *distances, idx_t *labels,
+                            const SearchParameters *params_in) const {
+  const IVFSearchParameters *params = nullptr;
+  if (params_in) {
+    params = dynamic_cast<const IVFSearchParameters *>(params_in);
+    FAISS_THROW_IF_NOT_MSG(params,
+                           "IndexBinaryIVF params have incorrect type");
+  }
+  size_t nprobe = params ? params->nprobe : this->nprobe;
+
   std::unique_ptr<idx_t[]> idx(new idx_t[n * nprobe]);
   std::unique_ptr<int32_t[]> coarse_dis(new int32_t[n * nprobe]);
 
   double t0 = getmillisecs();
-  quantizer->search(n, x, nprobe, coarse_dis.get(), idx.get());
+  quantizer->search(n, x, nprobe, coarse_dis.get(), idx.get(),
+                    params ? params->quantizer_params : nullptr);
   indexIVF_stats.quantization_time += getmillisecs() - t0;
 
   t0 = getmillisecs();
   invlists->prefetch_lists(idx.get(), n * nprobe);
 
   search_preassigned(n, x, k, idx.get(), coarse_dis.get(),
-                     distances, labels, false);
+                     distances, labels, false, params);
   indexIVF_stats.search_time += getmillisecs() - t0;
 }
 
@@ -351,6 +362,86 @@ struct IVFBinaryScannerL2: BinaryInvertedListScanner {
 };
 
 
+/* computes the distances by blocks of codes with the SIMD kernels of
+ * hammings_1_to_n */
+struct IVFBinaryScannerBlocks: BinaryInvertedListScanner {
+
+    std::vector<uint8_t> query;
+    size_t code_size;
+    bool store_pairs;
+
+    static const size_t bs = 256;
+
+    IVFBinaryScannerBlocks (size_t code_size, bool store_pairs):
+        query (code_size), code_size (code_size), store_pairs(store_pairs)
+    {}
+
+    void set_query (const uint8_t *query_vector) override {
+        memcpy (query.data(), query_vector, code_size);
+    }
+
+    idx_t list_no;
+    void set_list (idx_t list_no, uint8_t /* coarse_dis */) override {
+        this->list_no = list_no;
+    }
+
+    uint32_t distance_to_code (const uint8_t *code) const override {
+        hamdis_t dis;
+        hammings_1_to_n (query.data(), code, 1, code_size, &dis);
+        return dis;
+    }
+
+    size_t scan_codes (size_t n,
+                       const uint8_t *codes,
+                       const idx_t *ids,
+                       int32_t *simi, idx_t *idxi,
+                       size_t k) const override
+    {
+        using C = CMax<int32_t, idx_t>;
+
+        size_t nup = 0;
+        hamdis_t dis[bs];
+        for (size_t j0 = 0; j0 < n; j0 += bs) {
+            size_t nj = std::min (n - j0, bs);
+            hammings_1_to_n (query.data(), codes + j0 * code_size, nj,
+                             code_size, dis);
+            for (size_t j = 0; j < nj; j++) {
+                if (dis[j] < simi[0]) {
+                    heap_pop<C> (k, simi, idxi);
+                    idx_t id = store_pairs ? lo_build(list_no, j0 + j) :
+                        ids[j0 + j];
+                    heap_push<C> (k, simi, idxi, dis[j], id);
+                    nup++;
+                }
+            }
+        }
+        return nup;
+    }
+
+    void scan_codes_range (size_t n,
+                           const uint8_t *codes,
+                           const idx_t *ids,
+                           int radius,
+                           RangeQueryResult &result) const override
+    {
+        hamdis_t dis[bs];
+        for (size_t j0 = 0; j0 < n; j0 += bs) {
+            size_t nj = std::min (n - j0, bs);
+            hammings_1_to_n (query.data(), codes + j0 * code_size, nj,
+                             code_size, dis);
+            for (size_t j = 0; j < nj; j++) {
+                if (dis[j] < radius) {
+                    int64_t id = store_pairs ? lo_build (list_no, j0 + j) :
+                        ids[j0 + j];
+                    result.add (dis[j], id);
+                }
+            }
+        }
+    }
+
+};
+
+
 void search_knn_hamming_heap(const IndexBinaryIVF& ivf,
                              size_t n,
                              const uint8_t *x,
@@ -371,71 +462,146 @@ void search_knn_hamming_heap(const IndexBinaryIVF& ivf,
     using HeapForIP = CMin<int32_t, idx_t>;
     using HeapForL2 = CMax<int32_t, idx_t>;
 
-#pragma omp parallel if(n > 1) reduction(+: nlistv, ndis, nheap)
+    // small batches: the lists probed by a query are scanned in parallel
+    int pmode = ivf.parallel_mode;
+    if (pmode == 0 && n < (size_t)omp_get_max_threads() && nprobe > 1 &&
+        max_codes == 0) {
+        pmode = 1;
+    }
+    FAISS_THROW_IF_NOT_FMT (pmode == 0 || pmode == 1,
+                            "parallel_mode %d not supported", pmode);
+
+    auto init_result = [&](int32_t *simi, idx_t *idxi) {
+        if (metric_type == METRIC_INNER_PRODUCT) {
+            heap_heapify<HeapForIP> (k, simi, idxi);
+        } else {
+            heap_heapify<HeapForL2> (k, simi, idxi);
+        }
+    };
+
+    auto reorder_result = [&](int32_t *simi, idx_t *idxi) {
+        if (metric_type == METRIC_INNER_PRODUCT) {
+            heap_reorder<HeapForIP> (k, simi, idxi);
+        } else {
+            heap_reorder<HeapForL2> (k, simi, idxi);
+        }
+    };
+
+    // returns the size of the list
+    auto scan_one_list = [&](BinaryInvertedListScanner *scanner,
+                             idx_t key, int32_t coarse_dis_i,
+                             int32_t *simi, idx_t *idxi,
+                             size_t & nheap_i) -> size_t {
+        if (key < 0) {
+            // not enough centroids for multiprobe
+            return 0;
+        }
+        FAISS_THROW_IF_NOT_FMT
+            (key < (idx_t) ivf.nlist,
+             "Invalid key=%" PRId64 " nlist=%zd\n",
+             key, ivf.nlist);
+
+        scanner->set_list (key, coarse_dis_i);
+
+        size_t list_size = ivf.invlists->list_size(key);
+        InvertedLists::ScopedCodes scodes (ivf.invlists, key);
+        std::unique_ptr<InvertedLists::ScopedIds> sids;
+        const Index::idx_t * ids = nullptr;
+
+        if (!store_pairs) {
+            sids.reset (new InvertedLists::ScopedIds (ivf.invlists, key));
+            ids = sids->get();
+        }
+
+        nheap_i += scanner->scan_codes (
+                list_size, scodes.get(),
+                ids, simi, idxi, k
+        );
+        return list_size;
+    };
+
+    bool do_parallel = pmode == 0 ? n > 1 : nprobe > 1;
+
+#pragma omp parallel if(do_parallel) reduction(+: nlistv, ndis, nheap)
     {
         std::unique_ptr<BinaryInvertedListScanner> scanner
             (ivf.get_InvertedListScanner (store_pairs));
 
-#pragma omp for
-        for (idx_t i = 0; i < n; i++) {
-            const uint8_t *xi = x + i * ivf.code_size;
-            scanner->set_query(xi);
+        if (pmode == 0) {
 
-            const idx_t * keysi = keys + i * nprobe;
-            int32_t * simi = distances + k * i;
-            idx_t * idxi = labels + k * i;
+#pragma omp for
+            for (idx_t i = 0; i < n; i++) {
+                const uint8_t *xi = x + i * ivf.code_size;
+                scanner->set_query(xi);
 
-            if (metric_type == METRIC_INNER_PRODUCT) {
-                heap_heapify<HeapForIP> (k, simi, idxi);
-            } else {
-                heap_heapify<HeapForL2> (k, simi, idxi);
-            }
+                const idx_t * keysi = keys + i * nprobe;
+                int32_t * simi = distances + k * i;
+                idx_t * idxi = labels + k * i;
 
-            size_t nscan = 0;
+                init_result (simi, idxi);
 
-            for (size_t ik = 0; ik < nprobe; ik++) {
-                idx_t key = keysi[ik];  /* select the list  */
-                if (key < 0) {
-                    // not enough centroids for multiprobe
-                    continue;
-                }
-                FAISS_THROW_IF_NOT_FMT
-                    (key < (idx_t) ivf.nlist,
-                     "Invalid key=%" PRId64 " at ik=%zd nlist=%zd\n",
-                     key, ik, ivf.nlist);
+                size_t nscan = 0;
 
-                scanner->set_list (key, coarse_dis[i * nprobe + ik]);
+                for (size_t ik = 0; ik < nprobe; ik++) {
+                    if (keysi[ik] >= 0) {
+                        nlistv++;
+                    }
+                    nscan += scan_one_list (
+                          scanner.get(), keysi[ik],
+                          coarse_dis[i * nprobe + ik], simi, idxi, nheap);
 
-                nlistv++;
-
-                size_t list_size = ivf.invlists->list_size(key);
-                InvertedLists::ScopedCodes scodes (ivf.invlists, key);
-                std::unique_ptr<InvertedLists::ScopedIds> sids;
-                const Index::idx_t * ids = nullptr;
-
-                if (!store_pairs) {
-                    sids.reset (new InvertedLists::ScopedIds (ivf.invlists, key));
-                    ids = sids->get();
+                    if (max_codes && nscan >= max_codes)
+                        break;
                 }
 
-                nheap += scanner->scan_codes (
-                        list_size, scodes.get(),
-                        ids, simi, idxi, k
-                );
+                ndis += nscan;
+                reorder_result (simi, idxi);
 
-                nscan += list_size;
-                if (max_codes && nscan >= max_codes)
-                    break;
-            }
+            } // parallel for
+        } else {
+            std::vector<int32_t> local_dis (k);
+            std::vector<idx_t> local_idx (k);
+
+            for (idx_t i = 0; i < n; i++) {
+                scanner->set_query (x + i * ivf.code_size);
+                init_result (local_dis.data(), local_idx.data());
+
+#pragma omp for schedule(dynamic)
+                for (int64_t ik = 0; ik < nprobe; ik++) {
+                    idx_t key = keys[i * nprobe + ik];
+                    if (key >= 0) {
+                        nlistv++;
+                    }
+                    // max_codes is not applied
+                    ndis += scan_one_list (
+                          scanner.get(), key, coarse_dis[i * nprobe + ik],
+                          local_dis.data(), local_idx.data(), nheap);
+                }
 
-            ndis += nscan;
-            if (metric_type == METRIC_INNER_PRODUCT) {
-                heap_reorder<HeapForIP> (k, simi, idxi);
-            } else {
-                heap_reorder<HeapForL2> (k, simi, idxi);
+                // merge the thread-local results
+                int32_t * simi = distances + k * i;
+                idx_t * idxi = labels + k * i;
+#pragma omp single
+                init_result (simi, idxi);
+
+#pragma omp barrier
+#pragma omp critical
+                {
+                    if (metric_type == METRIC_INNER_PRODUCT) {
+                        heap_addn<HeapForIP> (k, simi, idxi,
+                                              local_dis.data(),
+                                              local_idx.data(), k);
+                    } else {
+                        heap_addn<HeapForL2> (k, simi, idxi,
+                                              local_dis.data(),
+                                              local_idx.data(), k);
+                    }
+                }
+#pragma omp barrier
+#pragma omp single
+                reorder_result (simi, idxi);
             }
-
-        } // parallel for
+        }
     } // parallel
 
     indexIVF_stats.nq += n;
@@ -454,79 +620,58 @@ void search_knn_hamming_count(const IndexBinaryIVF& ivf,
                               int32_t *distances,
                               idx_t *labels,
                               const IVFSearchParameters *params) {
-  const int nBuckets = ivf.d + 1;
-  std::vector<int> all_counters(nx * nBuckets, 0);
-  std::unique_ptr<idx_t[]> all_ids_per_dis(new idx_t[nx * nBuckets * k]);
-
   long nprobe = params ? params->nprobe : ivf.nprobe;
   long max_codes = params ? params->max_codes : ivf.max_codes;
 
-  std::vector<HCounterState<HammingComputer>> cs;
-  for (size_t i = 0; i < nx; ++i) {
-    cs.push_back(HCounterState<HammingComputer>(
-                   all_counters.data() + i * nBuckets,
-                   all_ids_per_dis.get() + i * nBuckets * k,
-                   x + i * ivf.code_size,
-                   ivf.d,
-                   k
-                 ));
-  }
-
   size_t nlistv = 0, ndis = 0;
 
-#pragma omp parallel for reduction(+: nlistv, ndis)
-  for (int64_t i = 0; i < nx; i++) {
-    const idx_t * keysi = keys + i * nprobe;
-    HCounterState<HammingComputer>& csi = cs[i];
+#pragma omp parallel reduction(+: nlistv, ndis)
+  {
+    HammingKSelector sel (ivf.d, k);
 
-    size_t nscan = 0;
+#pragma omp for
+    for (int64_t i = 0; i < nx; i++) {
+      const idx_t * keysi = keys + i * nprobe;
+      HammingComputer hc (x + i * ivf.code_size, ivf.code_size);
+      sel.reset ();
+
+      size_t nscan = 0;
+
+      for (size_t ik = 0; ik < nprobe; ik++) {
+        idx_t key = keysi[ik];  /* select the list  */
+        if (key < 0) {
+          // not enough centroids for multiprobe
+          continue;
+        }
+        FAISS_THROW_IF_NOT_FMT (
+          key < (idx_t) ivf.nlist,
+          "Invalid key=%" PRId64 " at ik=%zd nlist=%zd\n",
+          key, ik, ivf.nlist);
+
+        nlistv++;
+        size_t list_size = ivf.invlists->list_size(key);
+        InvertedLists::ScopedCodes scodes (ivf.invlists, key);
+        const uint8_t *list_vecs = scodes.get();
+        const Index::idx_t *ids = store_pairs
+          ? nullptr
+          : ivf.invlists->get_ids(key);
+
+        for (size_t j = 0; j < list_size; j++) {
+          const uint8_t * yj = list_vecs + ivf.code_size * j;
+
+          idx_t id = store_pairs ? (key << 32 | j) : ids[j];
+          sel.add (hc.hamming (yj), id);
+        }
+        if (ids)
+            ivf.invlists->release_ids (key, ids);
 
-    for (size_t ik = 0; ik < nprobe; ik++) {
-      idx_t key = keysi[ik];  /* select the list  */
-      if (key < 0) {
-        // not enough centroids for multiprobe
-        continue;
-      }
-      FAISS_THROW_IF_NOT_FMT (
-        key < (idx_t) ivf.nlist,
-        "Invalid key=%" PRId64 " at ik=%zd nlist=%zd\n",
-        key, ik, ivf.nlist);
-
-      nlistv++;
-      size_t list_size = ivf.invlists->list_size(key);
-      InvertedLists::ScopedCodes scodes (ivf.invlists, key);
-      const uint8_t *list_vecs = scodes.get();
-      const Index::idx_t *ids = store_pairs
-        ? nullptr
-        : ivf.invlists->get_ids(key);
-
-      for (size_t j = 0; j < list_size; j++) {
-        const uint8_t * yj = list_vecs + ivf.code_size * j;
-
-        idx_t id = store_pairs ? (key << 32 | j) : ids[j];
-        csi.update_counter(yj, id);
+        nscan += list_size;
+        if (max_codes && nscan >= max_codes)
+          break;
       }
-      if (ids)
-          ivf.invlists->release_ids (key, ids);
+      ndis += nscan;
 
-      nscan += list_size;
-      if (max_codes && nscan >= max_codes)
-        break;
-    }
-    ndis += nscan;
-
-    int nres = 0;
-    for (int b = 0; b < nBuckets && nres < k; b++) {
-      for (int l = 0; l < csi.counters[b] && nres < k; l++) {
-        labels[i * k + nres] = csi.ids_per_dis[b * k + l];
-        distances[i * k + nres] = b;
-        nres++;
-      }
-    }
-    while (nres < k) {
-      labels[i * k + nres] = -1;
-      distances[i * k + nres] = std::numeric_limits<int32_t>::max();
-      ++nres;
+      sel.get_results (distances + i * k, labels + i * k);
     }
   }
 
@@ -581,6 +726,9 @@ void search_knn_hamming_count_1 (
 BinaryInvertedListScanner *IndexBinaryIVF::get_InvertedListScanner
       (bool store_pairs) const
 {
+    if (hammings_1_to_n_is_simd (code_size)) {
+        return new IVFBinaryScannerBlocks (code_size, store_pairs);
+    }
 
 #define HC(name) return new IVFBinaryScannerL2<name> (code_size, store_pairs)
     switch (code_size) {
@@ -41,14 +41,28 @@ struct IndexBinaryIVF : IndexBinary {
     size_t max_codes;         ///< max nb of codes to visit to do a query
 
     /** Select between using a heap or counting to select the k smallest values
-     * when scanning inverted lists.
+     * when scanning inverted lists. Counting (see HammingKSelector) is
+     * faster for large k.
      */
     bool use_heap = true;
 
+    /** Parallel mode of the search with heaps (use_heap):
+     *
+     * 0 (default): parallelize over queries. Batches with fewer queries
+     *    than threads are searched as in mode 1, unless max_codes is set
+     * 1: parallelize over the inverted lists probed by each query.
+     *    max_codes is not applied
+     */
+    int parallel_mode = 0;
+
     /// map for direct access to the elements. Enables reconstruct().
     DirectMap direct_map;
 
-    IndexBinary *quantizer;   ///< quantizer that maps vectors to inverted lists
+    /** quantizer that maps vectors to inverted lists. For large nlist,
+     * an IndexBinaryHNSW avoids the exhaustive coarse search: its graph
+     * is built on the centroids at the end of train, and it is searched
+     * with an efSearch of at least nprobe */
+    IndexBinary *quantizer;
     size_t nlist;             ///< number of possible key values
 
     bool own_fields;          ///< whether object owns the quantizer
@@ -110,7 +124,8 @@ struct IndexBinaryIVF : IndexBinary {
 
     /** assign the vectors, then call search_preassign */
     void search(idx_t n, const uint8_t *x, idx_t k,
-                int32_t *distances, idx_t *labels) const override;
+                int32_t *distances, idx_t *labels,
+                const SearchParameters *params = nullptr) const override;
 
     void range_search(idx_t n, const uint8_t *x, int radius,
                       RangeSearchResult *result) const override;
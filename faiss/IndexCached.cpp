@@ -0,0 +1,341 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/IndexCached.h>
+
+#include <cstring>
+#include <functional>
+#include <list>
+#include <string>
+#include <typeinfo>
+#include <unordered_map>
+
+#include <faiss/IndexIVF.h>
+#include <faiss/IndexIVFPQ.h>
+#include <faiss/IndexPQ.h>
+#include <faiss/IndexRefine.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/HNSW.h>
+#include <faiss/impl/NSG.h>
+
+
+namespace faiss {
+
+
+/*****************************************************
+ * IndexCachedStats
+ *****************************************************/
+
+void IndexCachedStats::reset ()
+{
+    nq = nhit = nmiss = nbypass = nevict = 0;
+}
+
+double IndexCachedStats::hit_rate () const
+{
+    return nq == 0 ? 0 : nhit / double(nq);
+}
+
+
+/*****************************************************
+ * LRU segments
+ *****************************************************/
+
+struct IndexCached::Segment {
+    struct Entry {
+        std::string key;
+        std::vector<float> distances;
+        std::vector<idx_t> labels;
+    };
+
+    std::mutex mutex;
+    /// most recently used first
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> map;
+
+    /// copy the results of key to D, I if they are cached
+    bool lookup (const std::string & key, idx_t k, float *D, idx_t *I)
+    {
+        std::lock_guard<std::mutex> lock (mutex);
+        auto it = map.find (key);
+        if (it == map.end()) {
+            return false;
+        }
+        entries.splice (entries.begin(), entries, it->second);
+        const Entry & e = *it->second;
+        memcpy (D, e.distances.data(), sizeof(float) * k);
+        memcpy (I, e.labels.data(), sizeof(idx_t) * k);
+        return true;
+    }
+
+    /// @return nb of evicted entries
+    size_t insert (const std::string & key, idx_t k,
+                   const float *D, const idx_t *I, size_t max_size)
+    {
+        std::lock_guard<std::mutex> lock (mutex);
+        auto it = map.find (key);
+        if (it != map.end()) {
+            // cached by a concurrent search meanwhile
+            entries.splice (entries.begin(), entries, it->second);
+            return 0;
+        }
+        entries.push_front (Entry{key, std::vector<float> (D, D + k),
+                                  std::vector<idx_t> (I, I + k)});
+        map[key] = entries.begin();
+        size_t nevict = 0;
+        while (entries.size() > max_size) {
+            map.erase (entries.back().key);
+            entries.pop_back ();
+            nevict++;
+        }
+        return nevict;
+    }
+
+    void clear ()
+    {
+        std::lock_guard<std::mutex> lock (mutex);
+        entries.clear ();
+        map.clear ();
+    }
+};
+
+
+namespace {
+
+template <class T>
+void append_value (std::string & key, const T & v)
+{
+    key.append ((const char*)&v, sizeof(v));
+}
+
+/** append the fields of params that change the search results to key.
+ * Returns false if the results should not be cached: with a selector
+ * or a deadline, or with a type of parameters that is not known here
+ * (its fields could not be part of the key). */
+bool append_params_key (const SearchParameters *params, std::string & key)
+{
+    if (!params) {
+        key.push_back (0);
+        return true;
+    }
+    if (params->sel || params->deadline_ms > 0 || params->truncated) {
+        return false;
+    }
+    const std::type_info & type = typeid (*params);
+    if (type == typeid (SearchParameters)) {
+        key.push_back (1);
+        return true;
+    }
+    if (type == typeid (IVFSearchParameters) ||
+        type == typeid (IVFPQSearchParameters)) {
+        auto p = static_cast<const IVFSearchParameters*> (params);
+        key.push_back (2);
+        append_value (key, p->nprobe);
+        append_value (key, p->max_codes);
+        append_value (key, p->early_stop_ratio);
+        append_value (key, p->early_stop_stable);
+        if (type == typeid (IVFPQSearchParameters)) {
+            auto pq = static_cast<const IVFPQSearchParameters*> (params);
+            key.push_back (3);
+            append_value (key, pq->scan_table_threshold);
+            append_value (key, pq->polysemous_ht);
+        }
+        return append_params_key (p->quantizer_params, key);
+    }
+    if (type == typeid (SearchParametersHNSW)) {
+        auto p = static_cast<const SearchParametersHNSW*> (params);
+        key.push_back (4);
+        append_value (key, p->efSearch);
+        append_value (key, p->check_relative_distance);
+        return true;
+    }
+    if (type == typeid (SearchParametersNSG)) {
+        auto p = static_cast<const SearchParametersNSG*> (params);
+        key.push_back (5);
+        append_value (key, p->search_L);
+        return true;
+    }
+    if (type == typeid (SearchParametersPQ)) {
+        auto p = static_cast<const SearchParametersPQ*> (params);
+        key.push_back (6);
+        append_value (key, p->search_type);
+        append_value (key, p->polysemous_ht);
+        return true;
+    }
+    if (type == typeid (IndexRefineSearchParameters)) {
+        auto p = static_cast<const IndexRefineSearchParameters*> (params);
+        key.push_back (7);
+        append_value (key, p->k_factor);
+        return append_params_key (p->base_index_params, key);
+    }
+    return false;
+}
+
+} // anonymous namespace
+
+
+/*****************************************************
+ * IndexCached
+ *****************************************************/
+
+IndexCached::IndexCached (Index *index, size_t max_entries):
+    Index (index->d, index->metric_type),
+    index (index), own_fields (false), max_entries (max_entries)
+{
+    is_trained = index->is_trained;
+    ntotal = index->ntotal;
+    for (int i = 0; i < nsegment; i++) {
+        segments.push_back (new Segment ());
+    }
+}
+
+IndexCached::IndexCached ():
+    index (nullptr), own_fields (false), max_entries (0)
+{
+    for (int i = 0; i < nsegment; i++) {
+        segments.push_back (new Segment ());
+    }
+}
+
+IndexCached::~IndexCached ()
+{
+    for (Segment *s: segments) {
+        delete s;
+    }
+    if (own_fields) {
+        delete index;
+    }
+}
+
+void IndexCached::train (idx_t n, const float *x)
+{
+    invalidate ();
+    index->train (n, x);
+    is_trained = index->is_trained;
+}
+
+void IndexCached::add (idx_t n, const float *x)
+{
+    invalidate ();
+    index->add (n, x);
+    ntotal = index->ntotal;
+}
+
+void IndexCached::add_with_ids (idx_t n, const float *x, const idx_t *xids)
+{
+    invalidate ();
+    index->add_with_ids (n, x, xids);
+    ntotal = index->ntotal;
+}
+
+void IndexCached::reset ()
+{
+    invalidate ();
+    index->reset ();
+    ntotal = index->ntotal;
+}
+
+size_t IndexCached::remove_ids (const IDSelector & sel)
+{
+    invalidate ();
+    size_t nremove = index->remove_ids (sel);
+    ntotal = index->ntotal;
+    return nremove;
+}
+
+void IndexCached::search (
+              idx_t n, const float *x, idx_t k,
+              float *distances, idx_t *labels,
+              const SearchParameters *params) const
+{
+    FAISS_THROW_IF_NOT (k > 0);
+
+    std::string prefix;
+    append_value (prefix, k);
+    if (max_entries == 0 || !append_params_key (params, prefix)) {
+        index->search (n, x, k, distances, labels, params);
+        std::lock_guard<std::mutex> lock (stats_mutex);
+        stats.nq += n;
+        stats.nbypass += n;
+        return;
+    }
+
+    std::vector<std::string> keys (n);
+    std::vector<size_t> segment_nos (n);
+    std::vector<idx_t> misses;
+    for (idx_t i = 0; i < n; i++) {
+        std::string & key = keys[i];
+        key.reserve (prefix.size() + sizeof(float) * d);
+        key = prefix;
+        key.append ((const char*)(x + i * d), sizeof(float) * d);
+        segment_nos[i] = std::hash<std::string>() (key) % nsegment;
+        if (!segments[segment_nos[i]]->lookup (
+                  key, k, distances + i * k, labels + i * k)) {
+            misses.push_back (i);
+        }
+    }
+
+    size_t nmiss = misses.size(), nevict = 0;
+    if (nmiss > 0) {
+        // search the missed queries in one batch
+        std::vector<float> xm (nmiss * d), Dm (nmiss * k);
+        std::vector<idx_t> Im (nmiss * k);
+        for (size_t j = 0; j < nmiss; j++) {
+            memcpy (xm.data() + j * d, x + misses[j] * d, sizeof(float) * d);
+        }
+        index->search (nmiss, xm.data(), k, Dm.data(), Im.data(), params);
+
+        size_t max_size = (max_entries + nsegment - 1) / nsegment;
+        for (size_t j = 0; j < nmiss; j++) {
+            idx_t i = misses[j];
+            memcpy (distances + i * k, Dm.data() + j * k, sizeof(float) * k);
+            memcpy (labels + i * k, Im.data() + j * k, sizeof(idx_t) * k);
+            nevict += segments[segment_nos[i]]->insert (
+                  keys[i], k, Dm.data() + j * k, Im.data() + j * k,
+                  max_size);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock (stats_mutex);
+    stats.nq += n;
+    stats.nhit += n - nmiss;
+    stats.nmiss += nmiss;
+    stats.nevict += nevict;
+}
+
+void IndexCached::range_search (idx_t n, const float *x, float radius,
+                                RangeSearchResult *result) const
+{
+    index->range_search (n, x, radius, result);
+}
+
+void IndexCached::reconstruct (idx_t key, float *recons) const
+{
+    index->reconstruct (key, recons);
+}
+
+void IndexCached::invalidate ()
+{
+    for (Segment *s: segments) {
+        s->clear ();
+    }
+}
+
+size_t IndexCached::cache_size () const
+{
+    size_t n = 0;
+    for (Segment *s: segments) {
+        std::lock_guard<std::mutex> lock (s->mutex);
+        n += s->entries.size();
+    }
+    return n;
+}
+
+
+} // namespace faiss
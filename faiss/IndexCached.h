@@ -0,0 +1,116 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+#include <faiss/Index.h>
+
+
+namespace faiss {
+
+
+/// statistics of an IndexCached, in number of queries
+struct IndexCachedStats {
+    size_t nq;       ///< nb of queries searched
+    size_t nhit;     ///< served from the cache
+    size_t nmiss;    ///< searched in the index, then cached
+    size_t nbypass;  ///< searched in the index, with uncachable parameters
+    size_t nevict;   ///< nb of results evicted from the cache
+
+    IndexCachedStats () {reset (); }
+    void reset ();
+
+    /// fraction of the queries that were served from the cache
+    double hit_rate () const;
+};
+
+
+/** Wrapper that caches the search results of an index, for query
+ * streams where the same queries are repeated verbatim (popular
+ * items, retries).
+ *
+ * The cache key is made of the bytes of the query vector, k and the
+ * fields of the search parameters that change the results. The
+ * results of a query that is found in the cache are copied from it,
+ * the other queries are searched in the index as one batch and their
+ * results are cached. The cache holds at most max_entries results and
+ * evicts the least recently used ones. It is split in independently
+ * locked segments, so that the search can be called concurrently from
+ * several threads.
+ *
+ * Searches with an IDSelector, a deadline or parameters of a type that
+ * is not known to the cache are not cached. The cache is cleared by
+ * all the calls that modify the index through the wrapper (train, add,
+ * remove_ids, reset). If the wrapped index is modified directly, or
+ * its search-time fields (eg. nprobe, efSearch) are changed, invalidate
+ * must be called.
+ *
+ * The wrapped index can be an IndexShards or an IndexReplicas, and an
+ * IndexCached can be a shard or a replica.
+ */
+struct IndexCached: Index {
+
+    /// the index whose results are cached
+    Index *index;
+
+    /// should the index be deallocated?
+    bool own_fields;
+
+    /// max nb of cached results (0 = no caching)
+    size_t max_entries;
+
+    /// statistics of the searches, protected by stats_mutex
+    mutable IndexCachedStats stats;
+    mutable std::mutex stats_mutex;
+
+    explicit IndexCached (Index *index, size_t max_entries = 10000);
+
+    IndexCached ();
+
+    ~IndexCached () override;
+
+    void train (idx_t n, const float *x) override;
+
+    void add (idx_t n, const float *x) override;
+
+    void add_with_ids (idx_t n, const float *x, const idx_t *xids) override;
+
+    void reset () override;
+
+    size_t remove_ids (const IDSelector & sel) override;
+
+    void search (idx_t n, const float *x, idx_t k,
+                 float *distances, idx_t *labels,
+                 const SearchParameters *params = nullptr) const override;
+
+    /// not cached
+    void range_search (idx_t n, const float *x, float radius,
+                       RangeSearchResult *result) const override;
+
+    void reconstruct (idx_t key, float *recons) const override;
+
+    /// remove all the cached results
+    void invalidate ();
+
+    /// nb of cached results
+    size_t cache_size () const;
+
+    /// nb of independently locked segments of the cache
+    static const int nsegment = 16;
+
+  private:
+    struct Segment;
+    std::vector<Segment*> segments;
+};
+
+
+} // namespace faiss
@@ -0,0 +1,476 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/IndexDiskGraph.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <faiss/IndexHNSW.h>
+#include <faiss/IndexNSG.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/Heap.h>
+#include <faiss/utils/distances.h>
+#include <faiss/utils/utils.h>
+
+
+namespace faiss {
+
+DiskGraphStats diskgraph_stats;
+
+void DiskGraphStats::reset ()
+{
+    nq = nhops = nread = nbytes = ndis = 0;
+}
+
+void DiskGraphStats::add (const DiskGraphStats & other)
+{
+    nq += other.nq;
+    nhops += other.nhops;
+    nread += other.nread;
+    nbytes += other.nbytes;
+    ndis += other.ndis;
+}
+
+
+namespace {
+
+/// first bytes of the header block
+struct DiskGraphHeader {
+    char magic[8];
+    int64_t d;
+    int64_t R;
+    int64_t ntotal;
+    int64_t record_size;
+};
+
+const char disk_graph_magic[8] = {'F', 'A', 'I', 'S', 'S', 'D', 'G', '1'};
+
+} // namespace
+
+
+const size_t IndexDiskGraph::block_size;
+
+IndexDiskGraph::IndexDiskGraph (int d, int pq_M, int R, MetricType metric):
+    Index (d, metric), R (R),
+    pq (d, pq_M, 8),
+    entry_point (-1),
+    search_L (64), beam_width (4),
+    record_size (sizeof(float) * d + sizeof(storage_idx_t) * R),
+    fd (-1)
+{
+    FAISS_THROW_IF_NOT_MSG (metric == METRIC_L2 ||
+                            metric == METRIC_INNER_PRODUCT,
+                            "only L2 and inner product are supported");
+    is_trained = false;
+}
+
+IndexDiskGraph::~IndexDiskGraph ()
+{
+    if (fd >= 0) {
+        close (fd);
+    }
+}
+
+void IndexDiskGraph::train (idx_t n, const float *x)
+{
+    pq.train (n, x);
+    is_trained = true;
+}
+
+void IndexDiskGraph::add (idx_t, const float *)
+{
+    FAISS_THROW_MSG ("IndexDiskGraph: use build or build_from");
+}
+
+void IndexDiskGraph::reset ()
+{
+    if (fd >= 0) {
+        close (fd);
+        fd = -1;
+    }
+    codes.clear ();
+    node_to_label.clear ();
+    entry_point = -1;
+    ntotal = 0;
+}
+
+size_t IndexDiskGraph::node_offset (storage_idx_t node,
+                                    size_t *read_size) const
+{
+    if (record_size <= block_size) {
+        size_t per_block = block_size / record_size;
+        *read_size = block_size;
+        return (1 + node / per_block) * block_size +
+            (node % per_block) * record_size;
+    }
+    size_t nblock = (record_size + block_size - 1) / block_size;
+    *read_size = nblock * block_size;
+    return (1 + node * nblock) * block_size;
+}
+
+const uint8_t *IndexDiskGraph::read_node (storage_idx_t node,
+                                          uint8_t *buf) const
+{
+    size_t read_size;
+    size_t offset = node_offset (node, &read_size);
+    size_t block_offset = offset - offset % block_size;
+    // the last block of the file may be incomplete
+    size_t nread = 0;
+    while (nread < read_size) {
+        ssize_t ret = pread (fd, buf + nread, read_size - nread,
+                             block_offset + nread);
+        FAISS_THROW_IF_NOT_FMT (ret >= 0, "read error on %s: %s",
+                                filename.c_str(), strerror(errno));
+        if (ret == 0) {
+            break;
+        }
+        nread += ret;
+    }
+    FAISS_THROW_IF_NOT_FMT (nread >= offset - block_offset + record_size,
+                            "%s truncated (node %d)", filename.c_str(), node);
+    return buf + (offset - block_offset);
+}
+
+void IndexDiskGraph::build (idx_t n, const float *x, const char *fname)
+{
+    FAISS_THROW_IF_NOT (R >= 2);
+    IndexHNSWFlat hnsw_index (d, R / 2, metric_type);
+    hnsw_index.verbose = verbose;
+    hnsw_index.add (n, x);
+    // nodes expanded together are often in the same blocks
+    hnsw_index.reorder_nodes ();
+    build_from (&hnsw_index, fname);
+}
+
+void IndexDiskGraph::build_from (const Index *graph_index, const char *fname)
+{
+    FAISS_THROW_IF_NOT_MSG (is_trained, "the PQ must be trained");
+    FAISS_THROW_IF_NOT (graph_index->d == d);
+    FAISS_THROW_IF_NOT_MSG (graph_index->ntotal < (1L << 31),
+                            "node ids are 32-bit");
+
+    const IndexHNSW *hnsw_index = dynamic_cast<const IndexHNSW*>(graph_index);
+    const IndexNSG *nsg_index = dynamic_cast<const IndexNSG*>(graph_index);
+    const Index *storage = nullptr;
+    if (hnsw_index) {
+        FAISS_THROW_IF_NOT_MSG (hnsw_index->hnsw.ndeleted == 0,
+                                "repair the deleted nodes first");
+        storage = hnsw_index->storage;
+    } else if (nsg_index) {
+        FAISS_THROW_IF_NOT_MSG (nsg_index->nsg.is_built,
+                                "the NSG graph is not built");
+        storage = nsg_index->storage;
+    } else {
+        FAISS_THROW_MSG ("graph_index must be an IndexHNSW or an IndexNSG");
+    }
+    FAISS_THROW_IF_NOT (storage);
+
+    reset ();
+    idx_t nt = graph_index->ntotal;
+
+    FILE *f = fopen (fname, "w");
+    FAISS_THROW_IF_NOT_FMT (f, "could not open %s for writing: %s",
+                            fname, strerror(errno));
+    std::unique_ptr<FILE, int(*)(FILE*)> del (f, fclose);
+
+    std::vector<uint8_t> block (block_size);
+    DiskGraphHeader header;
+    memcpy (header.magic, disk_graph_magic, sizeof(header.magic));
+    header.d = d;
+    header.R = R;
+    header.ntotal = nt;
+    header.record_size = record_size;
+    memcpy (block.data(), &header, sizeof(header));
+    FAISS_THROW_IF_NOT (fwrite (block.data(), 1, block_size, f) == block_size);
+
+    codes.resize (nt * pq.code_size);
+
+    // the records are written by chunks of whole blocks
+    size_t read_size;
+    node_offset (0, &read_size);
+    size_t per_read = record_size <= block_size ?
+        block_size / record_size : 1;
+    size_t chunk = per_read * std::max(size_t(1), (size_t(1) << 20) / read_size);
+    std::vector<float> xchunk (chunk * d);
+    std::vector<uint8_t> out (chunk / per_read * read_size);
+
+    for (idx_t i0 = 0; i0 < nt; i0 += chunk) {
+        idx_t i1 = std::min (i0 + (idx_t)chunk, nt);
+        storage->reconstruct_n (i0, i1 - i0, xchunk.data());
+        pq.compute_codes (xchunk.data(), codes.data() + i0 * pq.code_size,
+                          i1 - i0);
+
+        memset (out.data(), 0, out.size());
+        size_t end = 0;
+        for (idx_t i = i0; i < i1; i++) {
+            // i0 starts a block
+            size_t rs;
+            size_t offset = node_offset (i, &rs) - node_offset (i0, &rs);
+            uint8_t *rec = out.data() + offset;
+            memcpy (rec, xchunk.data() + (i - i0) * d, sizeof(float) * d);
+            storage_idx_t *nbr = (storage_idx_t*)(rec + sizeof(float) * d);
+            for (int j = 0; j < R; j++) {
+                nbr[j] = -1;
+            }
+            if (hnsw_index) {
+                const HNSW & hnsw = hnsw_index->hnsw;
+                storage_idx_t links_buf[256];
+                size_t nneigh;
+                const storage_idx_t *neigh =
+                    hnsw.neighbor_list (i, 0, links_buf, &nneigh);
+                for (size_t j = 0, l = 0; j < nneigh && l < R; j++) {
+                    if (neigh[j] < 0) break;
+                    nbr[l++] = neigh[j];
+                }
+            } else {
+                const NSG & nsg = nsg_index->nsg;
+                for (int j = 0, l = 0; j < nsg.R && l < R; j++) {
+                    storage_idx_t v = nsg.final_graph[(size_t)i * nsg.R + j];
+                    if (v < 0) break;
+                    nbr[l++] = v;
+                }
+            }
+            end = std::max (end, offset + record_size);
+        }
+        // whole blocks, except at the end of the file
+        if (i1 < nt) {
+            end = (end + block_size - 1) / block_size * block_size;
+        }
+        FAISS_THROW_IF_NOT_FMT (fwrite (out.data(), 1, end, f) == end,
+                                "write error on %s: %s",
+                                fname, strerror(errno));
+    }
+    FAISS_THROW_IF_NOT_FMT (fflush (f) == 0, "write error on %s: %s",
+                            fname, strerror(errno));
+
+    if (hnsw_index) {
+        entry_point = hnsw_index->hnsw.entry_point;
+        node_to_label.assign (hnsw_index->node_to_label.begin(),
+                              hnsw_index->node_to_label.end());
+    } else {
+        entry_point = nsg_index->nsg.enterpoint;
+    }
+    ntotal = nt;
+    open (fname);
+}
+
+void IndexDiskGraph::open (const char *fname)
+{
+    if (fd >= 0) {
+        close (fd);
+        fd = -1;
+    }
+    filename = fname;
+    int f = ::open (fname, O_RDONLY);
+    FAISS_THROW_IF_NOT_FMT (f >= 0, "could not open %s: %s",
+                            fname, strerror(errno));
+    DiskGraphHeader header;
+    if (pread (f, &header, sizeof(header), 0) != sizeof(header) ||
+        memcmp (header.magic, disk_graph_magic, sizeof(header.magic))) {
+        ::close (f);
+        FAISS_THROW_FMT ("%s is not a disk graph file", fname);
+    }
+    if (header.d != d || header.R != R ||
+        header.record_size != record_size ||
+        (ntotal > 0 && header.ntotal != ntotal)) {
+        ::close (f);
+        FAISS_THROW_FMT ("%s does not match the index "
+                         "(d=%ld R=%ld ntotal=%ld)", fname, header.d,
+                         header.R, header.ntotal);
+    }
+    // the accesses are random
+    posix_fadvise (f, 0, 0, POSIX_FADV_RANDOM);
+    fd = f;
+}
+
+void IndexDiskGraph::reconstruct (idx_t key, float *recons) const
+{
+    FAISS_THROW_IF_NOT (key >= 0 && key < ntotal);
+    FAISS_THROW_IF_NOT_MSG (fd >= 0, "no file open");
+    storage_idx_t node = key;
+    if (!node_to_label.empty()) {
+        node = std::find (node_to_label.begin(), node_to_label.end(), key) -
+            node_to_label.begin();
+    }
+    size_t read_size;
+    node_offset (node, &read_size);
+    std::vector<uint8_t> buf (read_size);
+    const uint8_t *rec = read_node (node, buf.data());
+    memcpy (recons, rec, sizeof(float) * d);
+}
+
+
+namespace {
+
+struct Candidate {
+    float dis;
+    IndexDiskGraph::storage_idx_t id;
+    bool expanded;
+    bool operator < (const Candidate & other) const {
+        return dis < other.dis;
+    }
+};
+
+} // namespace
+
+
+void IndexDiskGraph::search (idx_t n, const float *x, idx_t k,
+                             float *distances, idx_t *labels,
+                             const SearchParameters *params) const
+{
+    FAISS_THROW_IF_NOT_MSG (fd >= 0 || ntotal == 0, "no file open");
+    FAISS_THROW_IF_NOT (pq.nbits == 8);
+    FAISS_THROW_IF_NOT (beam_width > 0);
+    const IDSelector *sel = params ? params->sel : nullptr;
+    bool is_ip = metric_type == METRIC_INNER_PRODUCT;
+    int L = std::max (search_L, int(k));
+
+    size_t read_size;
+    node_offset (0, &read_size);
+
+    DiskGraphStats stats;
+
+#pragma omp parallel if (n > 1)
+    {
+        std::vector<float> dis_table (pq.M * pq.ksub);
+        ScratchVisitedTable svt (ntotal, (size_t)L * R);
+        VisitedTable & vt = *svt;
+        std::vector<Candidate> cands;
+        std::vector<uint8_t> bufs (beam_width * read_size);
+        std::vector<storage_idx_t> beam;
+        DiskGraphStats lstats;
+
+        auto pq_dis = [&](storage_idx_t i) {
+            const uint8_t *code = codes.data() + (size_t)i * pq.code_size;
+            const float *dt = dis_table.data();
+            float accu = 0;
+            for (size_t m = 0; m < pq.M; m++) {
+                accu += dt[code[m]];
+                dt += pq.ksub;
+            }
+            return accu;
+        };
+
+#pragma omp for schedule(dynamic)
+        for (idx_t q = 0; q < n; q++) {
+            const float *xq = x + q * d;
+            float *simi = distances + q * k;
+            idx_t *idxi = labels + q * k;
+            // results are in a max-heap with negated inner products
+            maxheap_heapify (k, simi, idxi);
+            if (entry_point < 0) {
+                continue;
+            }
+
+            if (is_ip) {
+                pq.compute_inner_prod_table (xq, dis_table.data());
+                for (float & v : dis_table) {
+                    v = -v;
+                }
+            } else {
+                pq.compute_distance_table (xq, dis_table.data());
+            }
+
+            cands.clear ();
+            cands.push_back (Candidate{pq_dis (entry_point),
+                                       entry_point, false});
+            vt.set (entry_point);
+            lstats.ndis++;
+
+            for (;;) {
+                // the best candidates that are not expanded yet
+                beam.clear ();
+                for (Candidate & c : cands) {
+                    if (!c.expanded) {
+                        c.expanded = true;
+                        beam.push_back (c.id);
+                        if (beam.size() == (size_t)beam_width) break;
+                    }
+                }
+                if (beam.empty ()) {
+                    break;
+                }
+                lstats.nhops++;
+
+                // the reads are handed to the kernel together
+                for (storage_idx_t v : beam) {
+                    size_t rs;
+                    size_t offset = node_offset (v, &rs);
+                    posix_fadvise (fd, offset - offset % block_size, rs,
+                                   POSIX_FADV_WILLNEED);
+                }
+
+                for (size_t b = 0; b < beam.size(); b++) {
+                    storage_idx_t v = beam[b];
+                    const uint8_t *rec = read_node (
+                          v, bufs.data() + b * read_size);
+                    lstats.nread++;
+                    lstats.nbytes += read_size;
+
+                    // exact distance for the results
+                    const float *xv = (const float*)rec;
+                    float dv = is_ip ? -fvec_inner_product (xq, xv, d) :
+                        fvec_L2sqr (xq, xv, d);
+                    idx_t label = node_to_label.empty () ? v :
+                        node_to_label[v];
+                    if ((!sel || sel->is_member (label)) && dv < simi[0]) {
+                        maxheap_pop (k, simi, idxi);
+                        maxheap_push (k, simi, idxi, dv, label);
+                    }
+
+                    // PQ distances to route
+                    const storage_idx_t *nbr =
+                        (const storage_idx_t*)(rec + sizeof(float) * d);
+                    for (int j = 0; j < R; j++) {
+                        storage_idx_t v1 = nbr[j];
+                        if (v1 < 0) break;
+                        if (vt.get (v1)) continue;
+                        vt.set (v1);
+                        float d1 = pq_dis (v1);
+                        lstats.ndis++;
+                        if (cands.size() < (size_t)L) {
+                            Candidate c {d1, v1, false};
+                            cands.insert (std::upper_bound (cands.begin(),
+                                          cands.end(), c), c);
+                        } else if (d1 < cands.back().dis) {
+                            Candidate c {d1, v1, false};
+                            cands.pop_back ();
+                            cands.insert (std::upper_bound (cands.begin(),
+                                          cands.end(), c), c);
+                        }
+                    }
+                }
+            }
+            vt.advance ();
+
+            maxheap_reorder (k, simi, idxi);
+            if (is_ip) {
+                for (idx_t j = 0; j < k; j++) {
+                    simi[j] = -simi[j];
+                }
+            }
+        }
+
+#pragma omp critical
+        stats.add (lstats);
+    }
+    stats.nq = n;
+    diskgraph_stats.add (stats);
+}
+
+
+} // namespace faiss
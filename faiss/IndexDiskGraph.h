@@ -0,0 +1,140 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <faiss/Index.h>
+#include <faiss/impl/ProductQuantizer.h>
+#include <faiss/impl/platform_macros.h>
+
+
+namespace faiss {
+
+
+/** Graph index whose vectors and links are stored on disk (SSD).
+ *
+ * Only PQ codes of the vectors stay in memory, they are used to navigate
+ * the graph. The file contains, for each node, the full vector followed
+ * by its R neighbors (-1 padded):
+ *
+ *   float vector[d]; int32 neighbors[R];
+ *
+ * The records are packed in 4096-byte blocks that do not straddle block
+ * boundaries (a record larger than a block occupies a whole number of
+ * blocks). Block 0 is a header.
+ *
+ * The search is a beam search on the PQ distances: at each hop, the
+ * beam_width best candidates not expanded yet are read from disk
+ * together (their blocks are handed to the kernel readahead before they
+ * are read). The full vectors of the expanded nodes give the exact
+ * distances of the results, the neighbors are scored with the PQ codes.
+ *
+ * The graph is built in memory by an IndexHNSW or IndexNSG (eg. on a
+ * larger machine, or on a sample with the same ids), and converted with
+ * build_from. Node ids are 32-bit.
+ */
+struct IndexDiskGraph: Index {
+    typedef int32_t storage_idx_t;
+
+    /// nb of neighbors per node in the file
+    int R;
+
+    /// in-memory codes of the vectors, nbits must be 8
+    ProductQuantizer pq;
+    std::vector<uint8_t> codes;
+
+    /// if not empty, label of each node (if the source graph was
+    /// reordered)
+    std::vector<storage_idx_t> node_to_label;
+
+    storage_idx_t entry_point;
+
+    /// size of the candidate list, at least k
+    int search_L;
+
+    /// nb of nodes read from disk at each hop
+    int beam_width;
+
+    /// file with the vectors and the links
+    std::string filename;
+
+    /// file layout
+    static const size_t block_size = 4096;
+    size_t record_size;
+
+    explicit IndexDiskGraph (int d = 0, int pq_M = 8, int R = 64,
+                             MetricType metric = METRIC_L2);
+
+    ~IndexDiskGraph() override;
+
+    IndexDiskGraph (const IndexDiskGraph &) = delete;
+    IndexDiskGraph & operator = (const IndexDiskGraph &) = delete;
+
+    /// trains the PQ
+    void train (idx_t n, const float *x) override;
+
+    /// not supported, see build and build_from
+    void add (idx_t n, const float *x) override;
+
+    /** builds an IndexHNSWFlat with 2 * M = R on the vectors and
+     * writes it to fname with build_from */
+    void build (idx_t n, const float *x, const char *fname);
+
+    /** writes the graph of level 0 of an IndexHNSW or the graph of an
+     * IndexNSG to fname, with the vectors reconstructed from its
+     * storage, and encodes the vectors with the PQ (that must be
+     * trained). The index then searches fname. */
+    void build_from (const Index *graph_index, const char *fname);
+
+    /// opens an existing file written by build_from
+    void open (const char *fname);
+
+    void search (idx_t n, const float *x, idx_t k,
+                 float *distances, idx_t *labels,
+                 const SearchParameters *params = nullptr) const override;
+
+    /// reads the vector from disk (the node of the label is searched
+    /// linearly if the nodes were reordered)
+    void reconstruct (idx_t key, float *recons) const override;
+
+    /// closes the file (which is not removed)
+    void reset () override;
+
+    /// offset in the file of the block(s) of a node, size of the read
+    size_t node_offset (storage_idx_t node, size_t *read_size) const;
+
+    /// reads the record of a node, buf is of size read_size
+    /// (see node_offset). Returns a pointer to the record in buf
+    const uint8_t *read_node (storage_idx_t node, uint8_t *buf) const;
+
+private:
+    int fd;
+};
+
+
+struct DiskGraphStats {
+    size_t nq;        ///< nb of queries
+    size_t nhops;     ///< nb of beam steps
+    size_t nread;     ///< nb of node records read from disk
+    size_t nbytes;    ///< nb of bytes read from disk
+    size_t ndis;      ///< nb of PQ distances
+
+    DiskGraphStats () {reset (); }
+    void reset ();
+    void add (const DiskGraphStats & other);
+};
+
+// global var that collects them all
+FAISS_API extern DiskGraphStats diskgraph_stats;
+
+
+} // namespace faiss
@@ -14,6 +14,9 @@
 #include <faiss/utils/extra_distances.h>
 #include <faiss/utils/utils.h>
 #include <faiss/utils/Heap.h>
+#include <faiss/utils/prefetch.h>
+#include <faiss/utils/vector_view.h>
+#include <faiss/utils/parallel.h>
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/impl/AuxIndexStructures.h>
 
@@ -21,7 +24,7 @@
 namespace faiss {
 
 IndexFlat::IndexFlat (idx_t d, MetricType metric):
-            Index(d, metric)
+            Index(d, metric), early_abort_block (0)
 {
 }
 
@@ -40,14 +43,43 @@ void IndexFlat::reset() {
 
 
 void IndexFlat::search (idx_t n, const float *x, idx_t k,
-                               float *distances, idx_t *labels) const
+                               float *distances, idx_t *labels,
+                               const SearchParameters *params) const
 {
+    FAISS_THROW_IF_NOT_MSG (!params,
+            "search params not supported for this index");
+    if (use_parallel_executor (n)) {
+        // the executor parallelizes over the queries
+        parallel_for (n, [&] (size_t i0, size_t i1) {
+            search (i1 - i0, x + i0 * d, k, distances + i0 * k,
+                    labels + i0 * k, params);
+        });
+        return;
+    }
     // we see the distances and labels as heaps
 
     if (metric_type == METRIC_INNER_PRODUCT) {
         float_minheap_array_t res = {
             size_t(n), size_t(k), labels, distances};
         knn_inner_product (x, xb.data(), d, n, ntotal, &res);
+    } else if (metric_type == METRIC_L2 && early_abort_block > 0) {
+#pragma omp parallel for if (n > 1)
+        for (idx_t i = 0; i < n; i++) {
+            const float *xi = x + i * d;
+            float *simi = distances + i * k;
+            idx_t *idxi = labels + i * k;
+            maxheap_heapify (k, simi, idxi);
+            const float *y = xb.data();
+            for (idx_t j = 0; j < ntotal; j++, y += d) {
+                float dis = fvec_L2sqr_early_abort (
+                      xi, y, d, simi[0], early_abort_block);
+                if (dis < simi[0]) {
+                    maxheap_pop (k, simi, idxi);
+                    maxheap_push (k, simi, idxi, dis, j);
+                }
+            }
+            maxheap_reorder (k, simi, idxi);
+        }
     } else if (metric_type == METRIC_L2) {
         float_maxheap_array_t res = {
             size_t(n), size_t(k), labels, distances};
@@ -61,6 +93,36 @@ void IndexFlat::search (idx_t n, const float *x, idx_t k,
     }
 }
 
+void IndexFlat::add_view (const VectorArrayView & x)
+{
+    FAISS_THROW_IF_NOT (x.d == d);
+    xb.resize ((ntotal + x.n) * d);
+    x.to_float (0, x.n, xb.data() + ntotal * d);
+    ntotal += x.n;
+}
+
+void IndexFlat::search_view (const VectorArrayView & x, idx_t k,
+                             float *distances, idx_t *labels,
+                             const SearchParameters *params) const
+{
+    FAISS_THROW_IF_NOT_MSG (!params,
+            "search params not supported for this index");
+    FAISS_THROW_IF_NOT (x.d == d);
+    VectorArrayView y (xb.data(), ntotal, d);
+
+    if (metric_type == METRIC_INNER_PRODUCT) {
+        float_minheap_array_t res = {
+            x.n, size_t(k), labels, distances};
+        knn_inner_product (x, y, &res);
+    } else if (metric_type == METRIC_L2) {
+        float_maxheap_array_t res = {
+            x.n, size_t(k), labels, distances};
+        knn_L2sqr (x, y, &res);
+    } else {
+        Index::search_view (x, k, distances, labels, params);
+    }
+}
+
 void IndexFlat::range_search (idx_t n, const float *x, float radius,
                               RangeSearchResult *result) const
 {
@@ -153,6 +215,10 @@ struct FlatL2Dis : DistanceComputer {
     void set_query(const float *x) override {
         q = x;
     }
+
+    void prefetch(idx_t i) override {
+        prefetch_L1(b + i * d, d * sizeof(float));
+    }
 };
 
 struct FlatIPDis : DistanceComputer {
@@ -181,6 +247,10 @@ struct FlatIPDis : DistanceComputer {
     void set_query(const float *x) override {
         q = x;
     }
+
+    void prefetch(idx_t i) override {
+        prefetch_L1(b + i * d, d * sizeof(float));
+    }
 };
 
 
@@ -206,6 +276,18 @@ void IndexFlat::reconstruct (idx_t key, float * recons) const
     memcpy (recons, &(xb[key * d]), sizeof(*recons) * d);
 }
 
+void IndexFlat::reconstruct_batch (idx_t n, const idx_t *keys,
+                                   float *recons) const
+{
+    for (idx_t i = 0; i < n; i++) {
+        FAISS_THROW_IF_NOT (keys[i] >= 0 && keys[i] < ntotal);
+    }
+#pragma omp parallel for if (n > 1000)
+    for (idx_t i = 0; i < n; i++) {
+        memcpy (recons + i * d, &(xb[keys[i] * d]), sizeof(*recons) * d);
+    }
+}
+
 
 /* The standalone codec interface */
 size_t IndexFlat::sa_code_size () const
@@ -223,6 +305,13 @@ void IndexFlat::sa_decode (idx_t n, const uint8_t *bytes, float *x) const
     memcpy (x, bytes, sizeof(float) * d * n);
 }
 
+MemoryUsage IndexFlat::memory_usage () const
+{
+    MemoryUsage mu = Index::memory_usage ();
+    mu.add ("xb", xb);
+    return mu;
+}
+
 
 
 
@@ -299,7 +388,8 @@ static void reorder_2_heaps (
 
 void IndexRefineFlat::search (
               idx_t n, const float *x, idx_t k,
-              float *distances, idx_t *labels) const
+              float *distances, idx_t *labels,
+              const SearchParameters *params) const
 {
     FAISS_THROW_IF_NOT (is_trained);
     idx_t k_base = idx_t (k * k_factor);
@@ -316,7 +406,8 @@ void IndexRefineFlat::search (
         del2.set (base_distances);
     }
 
-    base_index->search (n, x, k_base, base_distances, base_labels);
+    // the search parameters are those of the base index
+    base_index->search (n, x, k_base, base_distances, base_labels, params);
 
     for (int i = 0; i < n * k_base; i++)
         assert (base_labels[i] >= -1 &&
@@ -345,6 +436,23 @@ void IndexRefineFlat::search (
 }
 
 
+size_t IndexRefineFlat::sa_code_size () const
+{
+    return refine_index.sa_code_size ();
+}
+
+void IndexRefineFlat::sa_encode (idx_t n, const float *x,
+                                 uint8_t *bytes) const
+{
+    refine_index.sa_encode (n, x, bytes);
+}
+
+void IndexRefineFlat::sa_decode (idx_t n, const uint8_t *bytes,
+                                 float *x) const
+{
+    refine_index.sa_decode (n, bytes, x);
+}
+
 
 IndexRefineFlat::~IndexRefineFlat ()
 {
@@ -392,8 +500,11 @@ void IndexFlat1D::search (
             const float *x,
             idx_t k,
             float *distances,
-            idx_t *labels) const
+            idx_t *labels,
+            const SearchParameters *params) const
 {
+    FAISS_THROW_IF_NOT_MSG (!params,
+            "search params not supported for this index");
     FAISS_THROW_IF_NOT_MSG (perm.size() == ntotal,
                     "Call update_permutation before search");
 
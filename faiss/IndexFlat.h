@@ -13,6 +13,7 @@
 #include <vector>
 
 #include <faiss/Index.h>
+#include <faiss/impl/maybe_owned_vector.h>
 
 
 namespace faiss {
@@ -20,8 +21,16 @@ namespace faiss {
 /** Index that stores the full vectors and performs exhaustive search */
 struct IndexFlat: Index {
 
-    /// database vectors, size ntotal * d
-    std::vector<float> xb;
+    /// database vectors, size ntotal * d (may be memory-mapped)
+    MaybeOwnedVector<float> xb;
+
+    /** if > 0, the L2 search computes the distances by blocks of this
+     * many dimensions and abandons a vector as soon as its partial
+     * distance exceeds the current k-th distance (see
+     * fvec_L2sqr_early_abort). This replaces the BLAS path, so it is
+     * useful for small batches of queries on data whose first
+     * dimensions have the largest variance. */
+    size_t early_abort_block;
 
     explicit IndexFlat (idx_t d, MetricType metric = METRIC_L2);
 
@@ -34,7 +43,17 @@ struct IndexFlat: Index {
         const float* x,
         idx_t k,
         float* distances,
-        idx_t* labels) const override;
+        idx_t* labels,
+        const SearchParameters *params = nullptr) const override;
+
+    /// the vectors are converted directly into xb
+    void add_view (const VectorArrayView & x) override;
+
+    /// for L2 and IP, the queries are converted inside the knn functions
+    void search_view (const VectorArrayView & x, idx_t k,
+                      float *distances, idx_t *labels,
+                      const SearchParameters *params = nullptr
+                      ) const override;
 
     void range_search(
         idx_t n,
@@ -44,6 +63,9 @@ struct IndexFlat: Index {
 
     void reconstruct(idx_t key, float* recons) const override;
 
+    void reconstruct_batch (idx_t n, const idx_t *keys,
+                            float *recons) const override;
+
     /** compute distance with a subset of vectors
      *
      * @param x       query vectors, size n * d
@@ -64,7 +86,7 @@ struct IndexFlat: Index {
      * different from the usual ones: the new ids are shifted */
     size_t remove_ids(const IDSelector& sel) override;
 
-    IndexFlat () {}
+    IndexFlat (): early_abort_block (0) {}
 
     DistanceComputer * get_distance_computer() const override;
 
@@ -77,6 +99,8 @@ struct IndexFlat: Index {
     void sa_decode (idx_t n, const uint8_t *bytes,
                             float *x) const override;
 
+    MemoryUsage memory_usage () const override;
+
 };
 
 
@@ -125,7 +149,17 @@ struct IndexRefineFlat: Index {
         const float* x,
         idx_t k,
         float* distances,
-        idx_t* labels) const override;
+        idx_t* labels,
+        const SearchParameters *params = nullptr) const override;
+
+    /// the standalone codec is the one of refine_index (flat vectors)
+    size_t sa_code_size () const override;
+
+    void sa_encode (idx_t n, const float *x,
+                    uint8_t *bytes) const override;
+
+    void sa_decode (idx_t n, const uint8_t *bytes,
+                    float *x) const override;
 
     ~IndexRefineFlat() override;
 };
@@ -153,7 +187,8 @@ struct IndexFlat1D:IndexFlatL2 {
         const float* x,
         idx_t k,
         float* distances,
-        idx_t* labels) const override;
+        idx_t* labels,
+        const SearchParameters *params = nullptr) const override;
 };
 
 
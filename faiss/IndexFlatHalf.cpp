@@ -0,0 +1,323 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/IndexFlatHalf.h>
+
+#include <cstring>
+#include <memory>
+
+#include <faiss/utils/distances.h>
+#include <faiss/utils/fp16.h>
+#include <faiss/utils/Heap.h>
+#include <faiss/utils/prefetch.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/AuxIndexStructures.h>
+
+
+namespace faiss {
+
+typedef Index::idx_t idx_t;
+
+IndexFlatHalf::IndexFlatHalf (idx_t d, HalfType half_type,
+                              MetricType metric):
+    Index (d, metric), half_type (half_type), search_bs (16384)
+{
+    FAISS_THROW_IF_NOT_MSG (metric == METRIC_L2 ||
+                            metric == METRIC_INNER_PRODUCT,
+                            "metric type not supported");
+}
+
+IndexFlatHalf::IndexFlatHalf ():
+    half_type (HALF_FP16), search_bs (16384)
+{}
+
+
+namespace {
+
+void encode_half (IndexFlatHalf::HalfType half_type,
+                  uint16_t *out, const float *x, size_t n)
+{
+    if (half_type == IndexFlatHalf::HALF_FP16) {
+        fp32_to_fp16 (out, x, n);
+    } else {
+        fp32_to_bf16 (out, x, n);
+    }
+}
+
+void decode_half (IndexFlatHalf::HalfType half_type,
+                  float *out, const uint16_t *x, size_t n)
+{
+    if (half_type == IndexFlatHalf::HALF_FP16) {
+        fp16_to_fp32 (out, x, n);
+    } else {
+        bf16_to_fp32 (out, x, n);
+    }
+}
+
+typedef float (*half_distance_t) (const float *, const uint16_t *, size_t);
+
+half_distance_t get_half_distance (IndexFlatHalf::HalfType half_type,
+                                   MetricType metric)
+{
+    if (half_type == IndexFlatHalf::HALF_FP16) {
+        return metric == METRIC_L2 ? fvec_L2sqr_fp16 :
+                                     fvec_inner_product_fp16;
+    } else {
+        return metric == METRIC_L2 ? fvec_L2sqr_bf16 :
+                                     fvec_inner_product_bf16;
+    }
+}
+
+} // anonymous namespace
+
+
+void IndexFlatHalf::add (idx_t n, const float *x)
+{
+    codes.resize ((ntotal + n) * d);
+    encode_half (half_type, codes.data() + ntotal * d, x, n * d);
+    ntotal += n;
+}
+
+
+void IndexFlatHalf::reset ()
+{
+    codes.clear ();
+    ntotal = 0;
+}
+
+
+namespace {
+
+template<class C>
+void search_direct_template (
+        const IndexFlatHalf & index, idx_t n, const float *x, idx_t k,
+        float *distances, idx_t *labels)
+{
+    half_distance_t dis_fn = get_half_distance (
+          index.half_type, index.metric_type);
+    size_t d = index.d;
+
+#pragma omp parallel for if (n > 1)
+    for (idx_t i = 0; i < n; i++) {
+        const float *xi = x + i * d;
+        float *simi = distances + i * k;
+        idx_t *idxi = labels + i * k;
+        heap_heapify<C> (k, simi, idxi);
+        const uint16_t *yj = index.codes.data();
+        for (idx_t j = 0; j < index.ntotal; j++) {
+            float dis = dis_fn (xi, yj, d);
+            if (C::cmp (simi[0], dis)) {
+                heap_pop<C> (k, simi, idxi);
+                heap_push<C> (k, simi, idxi, dis, j);
+            }
+            yj += d;
+        }
+        heap_reorder<C> (k, simi, idxi);
+    }
+}
+
+template<class C>
+void search_blocked_template (
+        const IndexFlatHalf & index, idx_t n, const float *x, idx_t k,
+        float *distances, idx_t *labels)
+{
+    size_t d = index.d;
+    size_t bs = index.search_bs;
+    std::vector<float> block (std::min (bs, size_t(index.ntotal)) * d);
+    std::vector<float> block_dis (n * k);
+    std::vector<idx_t> block_ids (n * k);
+
+    for (idx_t i = 0; i < n; i++) {
+        heap_heapify<C> (k, distances + i * k, labels + i * k);
+    }
+
+    for (size_t j0 = 0; j0 < index.ntotal; j0 += bs) {
+        size_t j1 = std::min (j0 + bs, size_t(index.ntotal));
+
+        // convert the block by chunks of 256 vectors
+#pragma omp parallel for
+        for (size_t j = j0; j < j1; j += 256) {
+            size_t je = std::min (j + 256, j1);
+            decode_half (index.half_type, block.data() + (j - j0) * d,
+                         index.codes.data() + j * d, (je - j) * d);
+        }
+
+        if (index.metric_type == METRIC_L2) {
+            float_maxheap_array_t res = {
+                size_t(n), size_t(k), block_ids.data(), block_dis.data()};
+            knn_L2sqr (x, block.data(), d, n, j1 - j0, &res);
+        } else {
+            float_minheap_array_t res = {
+                size_t(n), size_t(k), block_ids.data(), block_dis.data()};
+            knn_inner_product (x, block.data(), d, n, j1 - j0, &res);
+        }
+
+#pragma omp parallel for
+        for (idx_t i = 0; i < n; i++) {
+            idx_t *idsi = block_ids.data() + i * k;
+            for (idx_t l = 0; l < k; l++) {
+                if (idsi[l] >= 0) {
+                    idsi[l] += j0;
+                }
+            }
+            heap_addn<C> (k, distances + i * k, labels + i * k,
+                          block_dis.data() + i * k, idsi, k);
+        }
+    }
+
+    for (idx_t i = 0; i < n; i++) {
+        heap_reorder<C> (k, distances + i * k, labels + i * k);
+    }
+}
+
+} // anonymous namespace
+
+
+void IndexFlatHalf::search_direct (idx_t n, const float *x, idx_t k,
+                                   float *distances, idx_t *labels) const
+{
+    if (metric_type == METRIC_L2) {
+        search_direct_template<CMax<float, idx_t>> (
+              *this, n, x, k, distances, labels);
+    } else {
+        search_direct_template<CMin<float, idx_t>> (
+              *this, n, x, k, distances, labels);
+    }
+}
+
+void IndexFlatHalf::search_blocked (idx_t n, const float *x, idx_t k,
+                                    float *distances, idx_t *labels) const
+{
+    if (metric_type == METRIC_L2) {
+        search_blocked_template<CMax<float, idx_t>> (
+              *this, n, x, k, distances, labels);
+    } else {
+        search_blocked_template<CMin<float, idx_t>> (
+              *this, n, x, k, distances, labels);
+    }
+}
+
+
+void IndexFlatHalf::search (idx_t n, const float *x, idx_t k,
+                            float *distances, idx_t *labels,
+                            const SearchParameters *params) const
+{
+    FAISS_THROW_IF_NOT_MSG (!params,
+            "search params not supported for this index");
+    FAISS_THROW_IF_NOT (k > 0);
+
+    // the conversion of the database is amortized over the queries
+    if (n < distance_compute_blas_threshold) {
+        search_direct (n, x, k, distances, labels);
+    } else {
+        search_blocked (n, x, k, distances, labels);
+    }
+}
+
+
+void IndexFlatHalf::reconstruct (idx_t key, float *recons) const
+{
+    decode_half (half_type, recons, codes.data() + key * d, d);
+}
+
+void IndexFlatHalf::reconstruct_n (idx_t i0, idx_t ni, float *recons) const
+{
+    FAISS_THROW_IF_NOT (ni == 0 || (i0 >= 0 && i0 + ni <= ntotal));
+    decode_half (half_type, recons, codes.data() + i0 * d, ni * d);
+}
+
+
+size_t IndexFlatHalf::remove_ids (const IDSelector & sel)
+{
+    idx_t j = 0;
+    for (idx_t i = 0; i < ntotal; i++) {
+        if (sel.is_member (i)) {
+            // should be removed
+        } else {
+            if (i > j) {
+                memmove (&codes[d * j], &codes[d * i], sizeof(codes[0]) * d);
+            }
+            j++;
+        }
+    }
+    size_t nremove = ntotal - j;
+    if (nremove > 0) {
+        ntotal = j;
+        codes.resize (ntotal * d);
+    }
+    return nremove;
+}
+
+
+namespace {
+
+struct FlatHalfDis : DistanceComputer {
+    size_t d;
+    IndexFlatHalf::HalfType half_type;
+    half_distance_t dis_fn;
+    const float *q;
+    const uint16_t *b;
+    std::vector<float> tmp;
+    size_t ndis;
+
+    float operator () (idx_t i) override {
+        ndis++;
+        return dis_fn (q, b + i * d, d);
+    }
+
+    float symmetric_dis (idx_t i, idx_t j) override {
+        decode_half (half_type, tmp.data(), b + i * d, d);
+        return dis_fn (tmp.data(), b + j * d, d);
+    }
+
+    explicit FlatHalfDis (const IndexFlatHalf & storage):
+        d (storage.d),
+        half_type (storage.half_type),
+        dis_fn (get_half_distance (storage.half_type, storage.metric_type)),
+        q (nullptr),
+        b (storage.codes.data()),
+        tmp (storage.d),
+        ndis (0) {}
+
+    void set_query (const float *x) override {
+        q = x;
+    }
+
+    void prefetch (idx_t i) override {
+        prefetch_L1 (b + i * d, d * sizeof(uint16_t));
+    }
+};
+
+} // anonymous namespace
+
+
+DistanceComputer * IndexFlatHalf::get_distance_computer () const
+{
+    return new FlatHalfDis (*this);
+}
+
+
+/* The standalone codec interface */
+size_t IndexFlatHalf::sa_code_size () const
+{
+    return sizeof(uint16_t) * d;
+}
+
+void IndexFlatHalf::sa_encode (idx_t n, const float *x, uint8_t *bytes) const
+{
+    encode_half (half_type, (uint16_t*)bytes, x, n * d);
+}
+
+void IndexFlatHalf::sa_decode (idx_t n, const uint8_t *bytes, float *x) const
+{
+    decode_half (half_type, x, (const uint16_t*)bytes, n * d);
+}
+
+
+} // namespace faiss
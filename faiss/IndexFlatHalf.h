@@ -0,0 +1,105 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#ifndef INDEX_FLAT_HALF_H
+#define INDEX_FLAT_HALF_H
+
+#include <vector>
+
+#include <faiss/Index.h>
+
+
+namespace faiss {
+
+/** Index that stores the full vectors in a 16-bit floating point format
+ * (fp16 or bf16) and performs exhaustive search.
+ *
+ * It uses half the memory of IndexFlat, at the cost of the precision of
+ * the stored vectors. The queries are not converted. For a few queries,
+ * the distances are computed directly on the 16-bit vectors. For larger
+ * batches, blocks of database vectors are converted to float32 and the
+ * distances are computed with BLAS as in IndexFlat.
+ *
+ * Only the L2 and inner product metrics are supported.
+ */
+struct IndexFlatHalf: Index {
+
+    enum HalfType {
+        HALF_FP16 = 0,    ///< IEEE half precision
+        HALF_BF16 = 1,    ///< bfloat16, 8 bits exponent
+    };
+
+    HalfType half_type;
+
+    /// database vectors, size ntotal * d
+    std::vector<uint16_t> codes;
+
+    /// nb of database vectors converted at a time in the batched search
+    size_t search_bs;
+
+    IndexFlatHalf (idx_t d, HalfType half_type,
+                   MetricType metric = METRIC_L2);
+
+    void add(idx_t n, const float* x) override;
+
+    void reset() override;
+
+    void search(
+        idx_t n,
+        const float* x,
+        idx_t k,
+        float* distances,
+        idx_t* labels,
+        const SearchParameters *params = nullptr) const override;
+
+    void reconstruct(idx_t key, float* recons) const override;
+
+    void reconstruct_n(idx_t i0, idx_t ni, float* recons) const override;
+
+    size_t remove_ids(const IDSelector& sel) override;
+
+    DistanceComputer * get_distance_computer() const override;
+
+    /* The standalone codec interface */
+    size_t sa_code_size () const override;
+
+    void sa_encode (idx_t n, const float *x,
+                          uint8_t *bytes) const override;
+
+    void sa_decode (idx_t n, const uint8_t *bytes,
+                            float *x) const override;
+
+    IndexFlatHalf ();
+
+    // private
+    void search_direct (idx_t n, const float* x, idx_t k,
+                        float* distances, idx_t* labels) const;
+
+    void search_blocked (idx_t n, const float* x, idx_t k,
+                         float* distances, idx_t* labels) const;
+};
+
+
+struct IndexFlatFP16: IndexFlatHalf {
+    explicit IndexFlatFP16 (idx_t d, MetricType metric = METRIC_L2):
+        IndexFlatHalf (d, HALF_FP16, metric) {}
+    IndexFlatFP16 () {half_type = HALF_FP16; }
+};
+
+
+struct IndexFlatBF16: IndexFlatHalf {
+    explicit IndexFlatBF16 (idx_t d, MetricType metric = METRIC_L2):
+        IndexFlatHalf (d, HALF_BF16, metric) {}
+    IndexFlatBF16 () {half_type = HALF_BF16; }
+};
+
+
+}
+
+#endif
@@ -16,6 +16,9 @@
 #include <cstdio>
 #include <cinttypes>
 #include <cmath>
+#include <algorithm>
+#include <memory>
+#include <numeric>
 #include <omp.h>
 
 #include <unordered_set>
@@ -31,7 +34,10 @@
 #include <faiss/utils/distances.h>
 #include <faiss/utils/random.h>
 #include <faiss/utils/Heap.h>
+#include <faiss/utils/instrumentation.h>
+#include <faiss/utils/parallel.h>
 #include <faiss/impl/FaissAssert.h>
+#include <faiss/Clustering.h>
 #include <faiss/IndexFlat.h>
 #include <faiss/IndexIVFPQ.h>
 #include <faiss/Index2Layer.h>
@@ -47,6 +53,10 @@ int sgemm_ (const char *transa, const char *transb, FINTEGER *m, FINTEGER *
             FINTEGER *lda, const float *b, FINTEGER *
             ldb, float *beta, float *c, FINTEGER *ldc);
 
+int dposv_ (const char *uplo, FINTEGER *n, FINTEGER *nrhs,
+            double *a, FINTEGER *lda, double *b, FINTEGER *ldb,
+            FINTEGER *info);
+
 }
 
 namespace faiss {
@@ -91,6 +101,10 @@ struct NegativeDistanceComputer: DistanceComputer {
         return -basedis->symmetric_dis(i, j);
     }
 
+    void prefetch (idx_t i) override {
+        basedis->prefetch(i);
+    }
+
     virtual ~NegativeDistanceComputer ()
     {
         delete basedis;
@@ -109,6 +123,102 @@ DistanceComputer *storage_distance_computer(const Index *storage)
 
 
 
+/* add the points pt_ids[0:n] that all have level pt_level + 1, by batches
+ * of at most hnsw.add_batch_size points. The links of a batch are found on
+ * the graph built so far, so the batch size is also bounded by the number
+ * nin of points already in the graph. */
+void hnsw_add_batches(IndexHNSW &index_hnsw, int pt_level,
+                      const storage_idx_t *pt_ids, size_t n,
+                      const float *x, size_t n0, size_t nin, bool verbose)
+{
+    using LinkUpdate = HNSW::LinkUpdate;
+    HNSW & hnsw = index_hnsw.hnsw;
+    size_t d = index_hnsw.d;
+    size_t ntotal = hnsw.levels.size();
+
+    size_t i0 = 0;
+    if (hnsw.entry_point == -1) {
+        // first point of the graph
+        hnsw.entry_point = pt_ids[0];
+        hnsw.max_level = pt_level;
+        i0 = 1;
+        nin = 1;
+    }
+    std::vector<std::vector<LinkUpdate> > thread_updates (
+            omp_get_max_threads());
+    std::vector<LinkUpdate> updates;
+
+    while (i0 < n) {
+        size_t i1 = std::min (n,
+              i0 + std::min ((size_t)hnsw.add_batch_size, nin));
+
+        // phase 1: find the links, the graph is read-only
+#pragma omp parallel if(i1 > i0 + 100)
+        {
+            VisitedTable vt (ntotal);
+            DistanceComputer *dis =
+                storage_distance_computer (index_hnsw.storage);
+            ScopeDeleter1<DistanceComputer> del(dis);
+            std::vector<LinkUpdate> & tu = thread_updates[omp_get_thread_num()];
+            tu.clear ();
+
+#pragma omp for schedule(dynamic)
+            for (size_t i = i0; i < i1; i++) {
+                storage_idx_t pt_id = pt_ids[i];
+                dis->set_query (x + (pt_id - n0) * d);
+                hnsw.search_link_updates (*dis, pt_level, pt_id, vt, tu);
+            }
+        }
+
+        // phase 2: group the updates per node and apply them
+        updates.clear ();
+        for (const std::vector<LinkUpdate> & tu: thread_updates) {
+            updates.insert (updates.end(), tu.begin(), tu.end());
+        }
+        std::sort (updates.begin(), updates.end());
+
+        std::vector<size_t> lims (1, 0);
+        for (size_t j = 1; j <= updates.size(); j++) {
+            if (j == updates.size() || updates[j].src != updates[j - 1].src) {
+                lims.push_back (j);
+            }
+        }
+        size_t ngroup = lims.size() - 1;
+
+#pragma omp parallel if(ngroup > 100)
+        {
+            DistanceComputer *dis =
+                storage_distance_computer (index_hnsw.storage);
+            ScopeDeleter1<DistanceComputer> del(dis);
+
+#pragma omp for schedule(dynamic, 16)
+            for (size_t g = 0; g < ngroup; g++) {
+                hnsw.apply_link_updates (*dis, updates.data() + lims[g],
+                                         lims[g + 1] - lims[g]);
+            }
+        }
+
+        if (pt_level > hnsw.max_level) {
+            hnsw.max_level = pt_level;
+            hnsw.entry_point = pt_ids[i0];
+        }
+
+        if (verbose) {
+            printf("  %zd / %zd, %zd link updates\r", i1, n, updates.size());
+            fflush(stdout);
+        }
+        if (InterruptCallback::is_interrupted ()) {
+            FAISS_THROW_MSG ("computation interrupted");
+        }
+        nin += i1 - i0;
+        i0 = i1;
+    }
+    if (verbose) {
+        printf("\n");
+    }
+}
+
+
 void hnsw_add_vertices(IndexHNSW &index_hnsw,
                        size_t n0,
                        size_t n, const float *x,
@@ -187,6 +297,13 @@ void hnsw_add_vertices(IndexHNSW &index_hnsw,
             for (int j = i0; j < i1; j++)
                 std::swap(order[j], order[j + rng2.rand_int(i1 - j)]);
 
+            if (hnsw.add_batch_size > 0) {
+                hnsw_add_batches (index_hnsw, pt_level, order.data() + i0,
+                                  i1 - i0, x, n0, n0 + n - i1, verbose);
+                i1 = i0;
+                continue;
+            }
+
             bool interrupt = false;
 
 #pragma omp parallel if(i1 > i0 + 100)
@@ -243,6 +360,269 @@ void hnsw_add_vertices(IndexHNSW &index_hnsw,
 }
 
 
+/// state of one query of a batched search
+struct BatchedQuery {
+    const float *x;
+    idx_t *I;
+    float *D;
+    int nres;
+    storage_idx_t nearest;
+    float d_nearest;
+    int nstep;
+    bool active;
+    MinimaxHeap candidates;
+    std::vector<storage_idx_t> new_ids;
+
+    BatchedQuery(): candidates(0) {}
+};
+
+
+/** Search of a group of queries of a flat storage that traverse the
+ * graph together. At each step, the union of the vectors to visit is
+ * copied to a contiguous buffer and compared with all the active
+ * queries, so that each vector is loaded once per step.
+ *
+ * The results are in heaps of size k (heapified by the caller) and the
+ * inner products are negated, as for HNSW::search. */
+HNSWStats hnsw_search_batch (const IndexHNSW & index, const IndexFlat & flat,
+                             size_t nq, const float *x, idx_t k,
+                             float *distances, idx_t *labels,
+                             std::vector<VisitedTable*> & vts,
+                             std::vector<BatchedQuery> & queries,
+                             const SearchParametersHNSW *params,
+                             uint8_t *truncated)
+{
+    const HNSW & hnsw = index.hnsw;
+    HNSWStats stats;
+    if (hnsw.entry_point < 0) {
+        return stats;
+    }
+    size_t d = index.d;
+    bool is_ip = index.metric_type == METRIC_INNER_PRODUCT;
+    const float *xb = flat.xb.data();
+
+    int efSearch = params ? params->efSearch : hnsw.efSearch;
+    int ef = std::max(efSearch, int(k));
+    bool do_dis_check = params ?
+        params->check_relative_distance : hnsw.check_relative_distance;
+    const IDSelector *sel = params ? params->sel : nullptr;
+    double deadline_ms = params ? params->deadline_ms : 0;
+
+    // the deleted nodes are traversed but not returned
+    auto is_selected = [&](storage_idx_t v) {
+        return !hnsw.is_deleted(v) && (!sel || sel->is_member(v));
+    };
+
+    // ids of the vectors of the current step, buffer of their
+    // vectors and the distances of the active queries to them
+    std::vector<storage_idx_t> step_ids;
+    std::vector<float> step_x, step_dis;
+    std::vector<size_t> act;
+
+    auto score_step = [&]() {
+        size_t nu = step_ids.size();
+        step_x.resize(nu * d);
+        for (size_t j = 0; j < nu; j++) {
+            memcpy(step_x.data() + j * d, xb + size_t(step_ids[j]) * d,
+                   sizeof(float) * d);
+        }
+        step_dis.resize(act.size() * nu);
+        for (size_t a = 0; a < act.size(); a++) {
+            float *dis_a = step_dis.data() + a * nu;
+            const float *xq = queries[act[a]].x;
+            if (is_ip) {
+                fvec_inner_products_ny_batch_4 (dis_a, xq, step_x.data(),
+                                                d, nu);
+                for (size_t j = 0; j < nu; j++) {
+                    dis_a[j] = -dis_a[j];
+                }
+            } else {
+                fvec_L2sqr_ny_batch_4 (dis_a, xq, step_x.data(), d, nu);
+            }
+        }
+        stats.ndis += act.size() * nu;
+    };
+
+    auto sort_step_ids = [&]() {
+        std::sort(step_ids.begin(), step_ids.end());
+        step_ids.erase(std::unique(step_ids.begin(), step_ids.end()),
+                       step_ids.end());
+    };
+
+    for (size_t q = 0; q < nq; q++) {
+        BatchedQuery & bq = queries[q];
+        bq.x = x + q * d;
+        bq.I = labels + q * k;
+        bq.D = distances + q * k;
+        bq.nres = 0;
+        bq.nstep = 0;
+        bq.nearest = hnsw.entry_point;
+        act.push_back(q);
+    }
+
+    storage_idx_t links_buf[256];
+    step_ids.assign(1, hnsw.entry_point);
+    score_step();
+    for (size_t q = 0; q < nq; q++) {
+        queries[q].d_nearest = step_dis[q];
+    }
+
+    // greedy descent of the upper levels: a query moves to the nearest
+    // of the neighbors of the current nodes of all the queries
+    for (int level = hnsw.max_level; level >= 1; level--) {
+        act.resize(nq);
+        for (size_t q = 0; q < nq; q++) {
+            act[q] = q;
+        }
+        while (!act.empty()) {
+            step_ids.clear();
+            for (size_t q : act) {
+                size_t nneigh;
+                const storage_idx_t *neigh = hnsw.neighbor_list(
+                        queries[q].nearest, level, links_buf, &nneigh);
+                for (size_t j = 0; j < nneigh; j++) {
+                    storage_idx_t v = neigh[j];
+                    if (v < 0) break;
+                    step_ids.push_back(v);
+                }
+            }
+            sort_step_ids();
+            score_step();
+
+            size_t nu = step_ids.size(), nact = 0;
+            for (size_t a = 0; a < act.size(); a++) {
+                BatchedQuery & bq = queries[act[a]];
+                const float *dis_a = step_dis.data() + a * nu;
+                storage_idx_t prev_nearest = bq.nearest;
+                for (size_t j = 0; j < nu; j++) {
+                    if (dis_a[j] < bq.d_nearest) {
+                        bq.nearest = step_ids[j];
+                        bq.d_nearest = dis_a[j];
+                    }
+                }
+                if (bq.nearest != prev_nearest) {
+                    act[nact++] = act[a];
+                }
+            }
+            act.resize(nact);
+        }
+    }
+
+    // beam search of level 0
+    auto add_to_results = [&](BatchedQuery & bq, storage_idx_t v, float dv) {
+        if (is_selected(v)) {
+            if (bq.nres < k) {
+                faiss::maxheap_push(++bq.nres, bq.D, bq.I, dv, v);
+            } else if (dv < bq.D[0]) {
+                faiss::maxheap_pop(bq.nres--, bq.D, bq.I);
+                faiss::maxheap_push(++bq.nres, bq.D, bq.I, dv, v);
+            }
+        }
+        bq.candidates.push(v, dv);
+    };
+
+    for (size_t q = 0; q < nq; q++) {
+        BatchedQuery & bq = queries[q];
+        bq.candidates.reset(ef);
+        bq.active = true;
+        add_to_results(bq, bq.nearest, bq.d_nearest);
+        vts[q]->set(bq.nearest);
+    }
+
+    size_t ndis0 = stats.ndis;
+    for (int step = 1; ; step++) {
+        // each active query expands its best candidate
+        act.clear();
+        step_ids.clear();
+        for (size_t q = 0; q < nq; q++) {
+            BatchedQuery & bq = queries[q];
+            if (!bq.active) {
+                continue;
+            }
+            if (bq.candidates.size() == 0) {
+                stats.n2++;
+                bq.active = false;
+                continue;
+            }
+            float d0 = 0;
+            storage_idx_t v0 = bq.candidates.pop_min(&d0);
+            if (do_dis_check && bq.candidates.count_below(d0) >= ef) {
+                bq.active = false;
+                continue;
+            }
+            VisitedTable & vt = *vts[q];
+            bq.new_ids.clear();
+            size_t nneigh;
+            const storage_idx_t *neigh =
+                hnsw.neighbor_list(v0, 0, links_buf, &nneigh);
+            for (size_t j = 0; j < nneigh; j++) {
+                storage_idx_t v1 = neigh[j];
+                if (v1 < 0) break;
+                if (vt.get(v1)) {
+                    continue;
+                }
+                vt.set(v1);
+                bq.new_ids.push_back(v1);
+                step_ids.push_back(v1);
+            }
+            bq.nstep++;
+            act.push_back(q);
+        }
+        if (act.empty()) {
+            break;
+        }
+
+        sort_step_ids();
+        score_step();
+
+        size_t nu = step_ids.size();
+        for (size_t a = 0; a < act.size(); a++) {
+            BatchedQuery & bq = queries[act[a]];
+            VisitedTable & vt = *vts[act[a]];
+            const float *dis_a = step_dis.data() + a * nu;
+            for (storage_idx_t v1 : bq.new_ids) {
+                size_t j = std::lower_bound(step_ids.begin(), step_ids.end(),
+                                            v1) - step_ids.begin();
+                add_to_results(bq, v1, dis_a[j]);
+            }
+            // the vectors visited by the other queries are taken if they
+            // improve the results
+            for (size_t j = 0; j < nu; j++) {
+                storage_idx_t v1 = step_ids[j];
+                if ((bq.nres < k || dis_a[j] < bq.D[0]) &&
+                    !vt.get(v1) && is_selected(v1)) {
+                    vt.set(v1);
+                    add_to_results(bq, v1, dis_a[j]);
+                }
+            }
+            if (!do_dis_check && bq.nstep > ef) {
+                bq.active = false;
+            }
+        }
+
+        if (deadline_ms > 0 && step % 16 == 0 &&
+            getmillisecs() > deadline_ms) {
+            for (size_t q = 0; q < nq; q++) {
+                if (queries[q].active && queries[q].candidates.size() > 0) {
+                    stats.ntruncated++;
+                    if (truncated) {
+                        truncated[q] = 1;
+                    }
+                }
+            }
+            break;
+        }
+    }
+
+    for (size_t q = 0; q < nq; q++) {
+        vts[q]->advance();
+    }
+    stats.n1 += nq;
+    stats.n3 += stats.ndis - ndis0;
+    return stats;
+}
+
+
 }  // namespace
 
 
@@ -257,7 +637,9 @@ IndexHNSW::IndexHNSW(int d, int M, MetricType metric):
     hnsw(M),
     own_fields(false),
     storage(nullptr),
-    reconstruct_from_neighbors(nullptr)
+    reconstruct_from_neighbors(nullptr),
+    range_search_max_results(0),
+    search_batch_size(0)
 {}
 
 IndexHNSW::IndexHNSW(Index *storage, int M):
@@ -265,7 +647,9 @@ IndexHNSW::IndexHNSW(Index *storage, int M):
     hnsw(M),
     own_fields(false),
     storage(storage),
-    reconstruct_from_neighbors(nullptr)
+    reconstruct_from_neighbors(nullptr),
+    range_search_max_results(0),
+    search_batch_size(0)
 {}
 
 IndexHNSW::~IndexHNSW() {
@@ -284,39 +668,124 @@ void IndexHNSW::train(idx_t n, const float* x)
 }
 
 void IndexHNSW::search (idx_t n, const float *x, idx_t k,
-                        float *distances, idx_t *labels) const
+                        float *distances, idx_t *labels,
+                        const SearchParameters *params_in) const
 
 {
     FAISS_THROW_IF_NOT_MSG(storage,
        "Please use IndexHSNWFlat (or variants) instead of IndexHNSW directly");
-    size_t n1 = 0, n2 = 0, n3 = 0, ndis = 0, nreorder = 0;
+    const SearchParametersHNSW *params = nullptr;
+    if (params_in) {
+        params = dynamic_cast<const SearchParametersHNSW *>(params_in);
+        FAISS_THROW_IF_NOT_MSG (params,
+                                "IndexHNSW params have incorrect type");
+    }
+    if (use_parallel_executor (n)) {
+        // the executor parallelizes over the queries
+        parallel_for (n, [&] (size_t i0, size_t i1) {
+            search (i1 - i0, x + i0 * d, k, distances + i0 * k,
+                    labels + i0 * k, params_in);
+        });
+        return;
+    }
+    int efSearch = params ? params->efSearch : hnsw.efSearch;
+    size_t n1 = 0, n2 = 0, n3 = 0, ndis = 0, nreorder = 0, ntruncated = 0;
 
     idx_t check_period = InterruptCallback::get_period_hint (
-          hnsw.max_level * d * hnsw.efSearch);
+          hnsw.max_level * d * efSearch);
+
+    size_t nvisit_hint = (size_t)std::max (efSearch, int(k)) *
+        hnsw.nb_neighbors(0);
+
+    const IndexFlat *flat = dynamic_cast<const IndexFlat *>(storage);
+    idx_t batch_size = 0;
+    if (search_batch_size > 1 && flat && hnsw.upper_beam == 1 &&
+        hnsw.search_bounded_queue && !reconstruct_from_neighbors &&
+        (metric_type == METRIC_L2 || metric_type == METRIC_INNER_PRODUCT)) {
+        batch_size = search_batch_size;
+    }
 
     for (idx_t i0 = 0; i0 < n; i0 += check_period) {
         idx_t i1 = std::min(i0 + check_period, n);
 
+        if (batch_size > 0) {
+#pragma omp parallel
+            {
+                std::vector<std::unique_ptr<ScratchVisitedTable> > svts;
+                std::vector<VisitedTable*> vts;
+                for (idx_t b = 0; b < batch_size; b++) {
+                    svts.emplace_back(
+                          new ScratchVisitedTable (ntotal, nvisit_hint));
+                    vts.push_back(&**svts.back());
+                }
+                std::vector<BatchedQuery> queries(batch_size);
+
+#pragma omp for schedule(dynamic) reduction (+ : n1, n2, n3, ndis, ntruncated)
+                for (idx_t j0 = i0; j0 < i1; j0 += batch_size) {
+                    idx_t j1 = std::min(j0 + batch_size, i1);
+                    idx_t * idxi = labels + j0 * k;
+                    float * simi = distances + j0 * k;
+
+                    for (idx_t j = j0; j < j1; j++) {
+                        maxheap_heapify (k, simi + (j - j0) * k,
+                                         idxi + (j - j0) * k);
+                    }
+                    HNSWStats stats = hnsw_search_batch (
+                          *this, *flat, j1 - j0, x + j0 * d, k, simi, idxi,
+                          vts, queries, params,
+                          params && params->truncated ?
+                              params->truncated + j0 : nullptr);
+                    n1 += stats.n1;
+                    n2 += stats.n2;
+                    n3 += stats.n3;
+                    ndis += stats.ndis;
+                    ntruncated += stats.ntruncated;
+
+                    for (idx_t j = 0; j < (j1 - j0) * k; j += k) {
+                        maxheap_reorder (k, simi + j, idxi + j);
+                    }
+                    if (!node_to_label.empty()) {
+                        for (idx_t j = 0; j < (j1 - j0) * k; j++) {
+                            if (idxi[j] >= 0) {
+                                idxi[j] = node_to_label[idxi[j]];
+                            }
+                        }
+                    }
+                }
+            }
+            InterruptCallback::check ();
+            continue;
+        }
+
 #pragma omp parallel
         {
-            VisitedTable vt (ntotal);
+            // the visited tables are kept by the threads across calls,
+            // they are expensive to allocate for large graphs (eg. coarse
+            // quantizers with millions of centroids). For large graphs,
+            // this is a sparse table
+            ScratchVisitedTable svt (ntotal, nvisit_hint);
+            VisitedTable & vt = *svt;
 
             DistanceComputer *dis = storage_distance_computer(storage);
             ScopeDeleter1<DistanceComputer> del(dis);
 
-#pragma omp for reduction (+ : n1, n2, n3, ndis, nreorder)
+#pragma omp for reduction (+ : n1, n2, n3, ndis, nreorder, ntruncated)
             for(idx_t i = i0; i < i1; i++) {
                 idx_t * idxi = labels + i * k;
                 float * simi = distances + i * k;
                 dis->set_query(x + i * d);
 
                 maxheap_heapify (k, simi, idxi);
-                HNSWStats stats = hnsw.search(*dis, k, idxi, simi, vt);
+                HNSWStats stats = hnsw.search(*dis, k, idxi, simi, vt, params);
                 n1 += stats.n1;
                 n2 += stats.n2;
                 n3 += stats.n3;
                 ndis += stats.ndis;
                 nreorder += stats.nreorder;
+                ntruncated += stats.ntruncated;
+                if (stats.ntruncated > 0 && params && params->truncated) {
+                    params->truncated[i] = 1;
+                }
                 maxheap_reorder (k, simi, idxi);
 
                 if (reconstruct_from_neighbors &&
@@ -332,6 +801,13 @@ void IndexHNSW::search (idx_t n, const float *x, idx_t k,
                     maxheap_reorder (k_reorder, simi, idxi);
                 }
 
+                if (!node_to_label.empty()) {
+                    for (idx_t j = 0; j < k; j++) {
+                        if (idxi[j] >= 0) {
+                            idxi[j] = node_to_label[idxi[j]];
+                        }
+                    }
+                }
             }
 
         }
@@ -345,7 +821,64 @@ void IndexHNSW::search (idx_t n, const float *x, idx_t k,
         }
     }
 
-    hnsw_stats.combine({n1, n2, n3, ndis, nreorder});
+    hnsw_stats.combine({n1, n2, n3, ndis, nreorder, ntruncated});
+
+    if (instrumentation_enabled) {
+        instrumentation_count (COUNTER_NQ, n);
+        instrumentation_count (COUNTER_NDIS, ndis);
+    }
+}
+
+
+void IndexHNSW::range_search (idx_t n, const float *x, float radius,
+                              RangeSearchResult *result) const
+{
+    FAISS_THROW_IF_NOT_MSG(storage,
+       "Please use IndexHSNWFlat (or variants) instead of IndexHNSW directly");
+    int efSearch = hnsw.efSearch;
+    bool is_ip = metric_type == METRIC_INNER_PRODUCT;
+    // the distance computer negates inner products
+    float threshold = is_ip ? -radius : radius;
+    size_t n1 = 0, n2 = 0, n3 = 0, ndis = 0;
+
+    idx_t check_period = InterruptCallback::get_period_hint (
+          hnsw.max_level * d * efSearch);
+
+    for (idx_t i0 = 0; i0 < n; i0 += check_period) {
+        idx_t i1 = std::min(i0 + check_period, n);
+
+#pragma omp parallel
+        {
+            RangeSearchPartialResult pres (result);
+            // the nb of visited nodes is not bounded by efSearch
+            ScratchVisitedTable svt (ntotal);
+            VisitedTable & vt = *svt;
+
+            DistanceComputer *dis = storage_distance_computer(storage);
+            ScopeDeleter1<DistanceComputer> del(dis);
+
+#pragma omp for reduction (+ : n1, n2, n3, ndis)
+            for(idx_t i = i0; i < i1; i++) {
+                dis->set_query(x + i * d);
+                RangeQueryTopResults res (threshold, range_search_max_results);
+                HNSWStats stats = hnsw.range_search(*dis, res, vt);
+                n1 += stats.n1;
+                n2 += stats.n2;
+                n3 += stats.n3;
+                ndis += stats.ndis;
+                if (!node_to_label.empty()) {
+                    for (auto & r : res.results) {
+                        r.second = node_to_label[r.second];
+                    }
+                }
+                res.flush (pres.new_result (i), is_ip);
+            }
+            pres.finalize ();
+        }
+        InterruptCallback::check ();
+    }
+
+    hnsw_stats.combine({n1, n2, n3, ndis, 0});
 }
 
 
@@ -358,6 +891,14 @@ void IndexHNSW::add(idx_t n, const float *x)
     storage->add(n, x);
     ntotal = storage->ntotal;
 
+    // the new nodes have the next labels
+    if (!node_to_label.empty()) {
+        for (idx_t i = n0; i < ntotal; i++) {
+            node_to_label.push_back (i);
+            label_to_node.push_back (i);
+        }
+    }
+
     hnsw_add_vertices (*this, n0, n, x, verbose,
                        hnsw.levels.size() == ntotal);
 }
@@ -367,11 +908,409 @@ void IndexHNSW::reset()
     hnsw.reset();
     storage->reset();
     ntotal = 0;
+    node_to_label.clear();
+    label_to_node.clear();
 }
 
 void IndexHNSW::reconstruct (idx_t key, float* recons) const
 {
-    storage->reconstruct(key, recons);
+    storage->reconstruct(label_to_node.empty() ? key : label_to_node[key],
+                         recons);
+}
+
+void IndexHNSW::reconstruct_batch (idx_t n, const idx_t *keys,
+                                   float *recons) const
+{
+    if (label_to_node.empty()) {
+        storage->reconstruct_batch (n, keys, recons);
+        return;
+    }
+    std::vector<idx_t> nodes (n);
+    for (idx_t i = 0; i < n; i++) {
+        FAISS_THROW_IF_NOT (keys[i] >= 0 &&
+                            keys[i] < (idx_t)label_to_node.size());
+        nodes[i] = label_to_node[keys[i]];
+    }
+    storage->reconstruct_batch (n, nodes.data(), recons);
+}
+
+size_t IndexHNSW::sa_code_size () const
+{
+    return storage->sa_code_size ();
+}
+
+void IndexHNSW::sa_encode (idx_t n, const float *x, uint8_t *bytes) const
+{
+    storage->sa_encode (n, x, bytes);
+}
+
+void IndexHNSW::sa_decode (idx_t n, const uint8_t *bytes, float *x) const
+{
+    storage->sa_decode (n, bytes, x);
+}
+
+MemoryUsage IndexHNSW::memory_usage () const
+{
+    MemoryUsage mu = Index::memory_usage ();
+    mu.add ("hnsw", hnsw.memory_usage ());
+    if (storage) {
+        mu.add ("storage", storage->memory_usage ());
+    }
+    mu.add ("node_to_label", node_to_label);
+    mu.add ("label_to_node", label_to_node);
+    if (reconstruct_from_neighbors) {
+        MemoryUsage & rfn = mu.add (MemoryUsage::object (
+              "ReconstructFromNeighbors"));
+        rfn.name = "reconstruct_from_neighbors";
+        rfn.add ("codebook", reconstruct_from_neighbors->codebook);
+        rfn.add ("codes", reconstruct_from_neighbors->codes);
+    }
+    return mu;
+}
+
+size_t IndexHNSW::remove_ids (const IDSelector & sel)
+{
+    FAISS_THROW_IF_NOT_MSG (!dynamic_cast<const IndexIVF*>(storage),
+                            "remove_ids not supported for IVF storage");
+    size_t nremove = 0;
+    for (idx_t i = 0; i < ntotal; i++) {
+        if (sel.is_member (node_label (i)) && hnsw.mark_deleted (i)) {
+            nremove++;
+        }
+    }
+    return nremove;
+}
+
+size_t IndexHNSW::repair_deleted ()
+{
+    if (hnsw.ndeleted == 0) {
+        return 0;
+    }
+    // nb of the live nodes of each level that have deleted neighbors
+    size_t nrepaired = 0;
+
+#pragma omp parallel reduction(+: nrepaired)
+    {
+        VisitedTable vt (ntotal);
+        DistanceComputer *dis = storage_distance_computer (storage);
+        ScopeDeleter1<DistanceComputer> del(dis);
+
+#pragma omp for schedule(dynamic, 1024)
+        for (idx_t i = 0; i < ntotal; i++) {
+            if (hnsw.is_deleted (i)) {
+                continue;
+            }
+            for (int level = 0; level < hnsw.levels[i]; level++) {
+                if (hnsw.repair_neighbors (*dis, i, level, vt)) {
+                    nrepaired++;
+                }
+            }
+        }
+    }
+
+    size_t ndetached = hnsw.detach_deleted ();
+    if (verbose) {
+        printf ("IndexHNSW::repair_deleted: repaired %zd lists, "
+                "detached %zd nodes\n", nrepaired, ndetached);
+    }
+    return ndetached;
+}
+
+namespace {
+
+/// overwrite vector i of the storage with x
+void update_storage_vector (Index *storage, idx_t i, const float *x)
+{
+    if (IndexFlat *flat = dynamic_cast<IndexFlat*> (storage)) {
+        FAISS_THROW_IF_NOT (flat->xb.is_owned);
+        memcpy (flat->xb.data() + i * flat->d, x, sizeof(float) * flat->d);
+    } else if (IndexPQ *ipq = dynamic_cast<IndexPQ*> (storage)) {
+        FAISS_THROW_IF_NOT (ipq->codes.is_owned);
+        uint8_t *code = ipq->codes.data() + i * ipq->pq.code_size;
+        memset (code, 0, ipq->pq.code_size);
+        ipq->pq.compute_code (x, code);
+    } else if (IndexScalarQuantizer *isq =
+               dynamic_cast<IndexScalarQuantizer*> (storage)) {
+        FAISS_THROW_IF_NOT (isq->codes.is_owned);
+        isq->sq.compute_codes (
+             x, isq->codes.data() + i * isq->code_size, 1);
+    } else {
+        FAISS_THROW_MSG ("slot reuse not supported for this storage");
+    }
+}
+
+/// append the vectors of other to storage
+void append_storage (Index *storage, const Index *other)
+{
+    size_t n0 = storage->ntotal, n1 = other->ntotal;
+    const IndexFlat *oflat = dynamic_cast<const IndexFlat*> (other);
+    const IndexPQ *opq = dynamic_cast<const IndexPQ*> (other);
+    const IndexScalarQuantizer *osq =
+        dynamic_cast<const IndexScalarQuantizer*> (other);
+    IndexFlat *flat = dynamic_cast<IndexFlat*> (storage);
+    IndexPQ *ipq = dynamic_cast<IndexPQ*> (storage);
+    IndexScalarQuantizer *isq = dynamic_cast<IndexScalarQuantizer*> (storage);
+
+    if (flat && oflat) {
+        flat->xb.resize ((n0 + n1) * flat->d);
+        memcpy (flat->xb.data() + n0 * flat->d, oflat->xb.data(),
+                sizeof(float) * n1 * flat->d);
+    } else if (ipq && opq && ipq->pq.centroids == opq->pq.centroids) {
+        size_t cs = ipq->pq.code_size;
+        ipq->codes.resize ((n0 + n1) * cs);
+        memcpy (ipq->codes.data() + n0 * cs, opq->codes.data(), n1 * cs);
+    } else if (isq && osq && isq->sq.qtype == osq->sq.qtype &&
+               isq->sq.trained == osq->sq.trained) {
+        size_t cs = isq->code_size;
+        isq->codes.resize ((n0 + n1) * cs);
+        memcpy (isq->codes.data() + n0 * cs, osq->codes.data(), n1 * cs);
+    } else {
+        // re-encode the reconstructed vectors
+        std::vector<float> x (n1 * other->d);
+        other->reconstruct_n (0, n1, x.data());
+        storage->add (n1, x.data());
+        return;
+    }
+    storage->ntotal = n0 + n1;
+}
+
+/// new vector i is old vector perm[i]
+template <class T>
+MaybeOwnedVector<T> permute_vectors (const MaybeOwnedVector<T> & x,
+                                     size_t n, size_t vsize, const idx_t *perm)
+{
+    MaybeOwnedVector<T> y (n * vsize);
+#pragma omp parallel for if(n > 10000)
+    for (idx_t i = 0; i < n; i++) {
+        memcpy (y.data() + i * vsize, x.data() + perm[i] * vsize,
+                sizeof(T) * vsize);
+    }
+    return y;
+}
+
+}  // namespace
+
+void IndexHNSW::permute_entries (const idx_t *perm)
+{
+    FAISS_THROW_IF_NOT_MSG (!reconstruct_from_neighbors,
+            "permute_entries not supported with reconstruct_from_neighbors");
+    if (IndexFlat *flat = dynamic_cast<IndexFlat*> (storage)) {
+        flat->xb = permute_vectors (flat->xb, ntotal, d, perm);
+    } else if (IndexPQ *ipq = dynamic_cast<IndexPQ*> (storage)) {
+        ipq->codes = permute_vectors (ipq->codes, ntotal,
+                                      ipq->pq.code_size, perm);
+    } else if (IndexScalarQuantizer *isq =
+               dynamic_cast<IndexScalarQuantizer*> (storage)) {
+        isq->codes = permute_vectors (isq->codes, ntotal,
+                                      isq->code_size, perm);
+    } else {
+        FAISS_THROW_MSG ("permute_entries not supported for this storage");
+    }
+    hnsw.permute_entries (perm);
+
+    std::vector<storage_idx_t> new_labels (ntotal);
+    for (idx_t i = 0; i < ntotal; i++) {
+        new_labels[i] = node_label (perm[i]);
+    }
+    node_to_label.swap (new_labels);
+    label_to_node.resize (ntotal);
+    for (idx_t i = 0; i < ntotal; i++) {
+        label_to_node[node_to_label[i]] = i;
+    }
+}
+
+void IndexHNSW::reorder_nodes (HNSW::ReorderType type)
+{
+    std::vector<idx_t> perm (ntotal);
+    hnsw.locality_order (type, perm.data());
+    permute_entries (perm.data());
+}
+
+void IndexHNSW::merge_from (IndexHNSW &other)
+{
+    using LinkUpdate = HNSW::LinkUpdate;
+    FAISS_THROW_IF_NOT (other.d == d && other.metric_type == metric_type);
+    FAISS_THROW_IF_NOT_MSG (
+            !reconstruct_from_neighbors && !other.reconstruct_from_neighbors,
+            "merge_from not supported with reconstruct_from_neighbors");
+    FAISS_THROW_IF_NOT_MSG (hnsw.ndeleted == 0 && other.hnsw.ndeleted == 0 &&
+                            hnsw.deleted.empty() && other.hnsw.deleted.empty(),
+                            "cannot merge indexes with deleted vectors");
+    FAISS_THROW_IF_NOT (storage->ntotal == ntotal &&
+                        other.storage->ntotal == other.ntotal);
+    if (other.ntotal == 0) {
+        return;
+    }
+
+    storage_idx_t n0 = ntotal, n1 = other.ntotal;
+    storage_idx_t entry0 = hnsw.entry_point;
+    storage_idx_t entry1 = other.hnsw.entry_point + n0;
+
+    // appending the graph checks that the levels are compatible
+    hnsw.append_graph (other.hnsw);
+    append_storage (storage, other.storage);
+
+    if (!node_to_label.empty() || !other.node_to_label.empty()) {
+        std::vector<storage_idx_t> new_labels (n0 + n1);
+        for (storage_idx_t i = 0; i < n0 + n1; i++) {
+            new_labels[i] = i < n0 ? node_label (i) :
+                n0 + other.node_label (i - n0);
+        }
+        node_to_label.swap (new_labels);
+        label_to_node.resize (n0 + n1);
+        for (storage_idx_t i = 0; i < n0 + n1; i++) {
+            label_to_node[node_to_label[i]] = i;
+        }
+    }
+    ntotal = n0 + n1;
+
+    // connect the two graphs, by batches to bound the memory used by
+    // the updates. The nodes of a batch are searched in the graph they
+    // do not belong to, that may already be linked to the previous
+    // batches.
+    if (entry0 >= 0) {
+        size_t bs = std::max (hnsw.add_batch_size, 16384);
+        std::vector<std::vector<LinkUpdate> > thread_updates (
+                omp_get_max_threads());
+        std::vector<LinkUpdate> updates;
+
+        for (size_t i0 = 0; i0 < ntotal; i0 += bs) {
+            size_t i1 = std::min ((size_t)ntotal, i0 + bs);
+
+#pragma omp parallel
+            {
+                VisitedTable vt (ntotal);
+                DistanceComputer *dis = storage_distance_computer (storage);
+                ScopeDeleter1<DistanceComputer> del(dis);
+                std::vector<float> x (d);
+                std::vector<LinkUpdate> & tu =
+                    thread_updates[omp_get_thread_num()];
+                tu.clear ();
+
+#pragma omp for schedule(dynamic, 64)
+                for (idx_t i = i0; i < i1; i++) {
+                    storage->reconstruct (i, x.data());
+                    dis->set_query (x.data());
+                    hnsw.search_link_updates (
+                          *dis, hnsw.levels[i] - 1, i, vt, tu,
+                          i < n0 ? entry1 : entry0);
+                }
+            }
+
+            updates.clear ();
+            for (const std::vector<LinkUpdate> & tu: thread_updates) {
+                updates.insert (updates.end(), tu.begin(), tu.end());
+            }
+            std::sort (updates.begin(), updates.end());
+
+            std::vector<size_t> lims (1, 0);
+            for (size_t j = 1; j <= updates.size(); j++) {
+                if (j == updates.size() ||
+                    updates[j].src != updates[j - 1].src) {
+                    lims.push_back (j);
+                }
+            }
+            size_t ngroup = lims.size() - 1;
+
+#pragma omp parallel if(ngroup > 100)
+            {
+                DistanceComputer *dis = storage_distance_computer (storage);
+                ScopeDeleter1<DistanceComputer> del(dis);
+
+#pragma omp for schedule(dynamic, 16)
+                for (size_t g = 0; g < ngroup; g++) {
+                    hnsw.reprune_link_updates (
+                          *dis, updates.data() + lims[g],
+                          lims[g + 1] - lims[g]);
+                }
+            }
+
+            if (verbose) {
+                printf("  merge: %zd / %" PRId64 ", %zd link updates\r",
+                       i1, ntotal, updates.size());
+                fflush(stdout);
+            }
+            if (InterruptCallback::is_interrupted ()) {
+                FAISS_THROW_MSG ("computation interrupted");
+            }
+        }
+        if (verbose) {
+            printf("\n");
+        }
+    }
+
+    other.reset ();
+}
+
+void IndexHNSW::add_in_free_slots (idx_t n, const float *x, idx_t *labels)
+{
+    FAISS_THROW_IF_NOT(is_trained);
+    size_t nreuse = std::min ((size_t)n, hnsw.free_slots.size());
+
+    // take the slots in order and sort them by decreasing level, as
+    // in hnsw_add_vertices
+    std::vector<storage_idx_t> slots (hnsw.free_slots.begin(),
+                                      hnsw.free_slots.begin() + nreuse);
+    hnsw.free_slots.erase (hnsw.free_slots.begin(),
+                           hnsw.free_slots.begin() + nreuse);
+    for (size_t i = 0; i < nreuse; i++) {
+        storage_idx_t s = slots[i];
+        update_storage_vector (storage, s, x + i * d);
+        hnsw.deleted[s] = 0;
+        hnsw.ndeleted--;
+        labels[i] = node_label (s);
+    }
+
+    if (nreuse > 0) {
+        std::vector<size_t> order (nreuse);
+        for (size_t i = 0; i < nreuse; i++) {
+            order[i] = i;
+        }
+        std::stable_sort (order.begin(), order.end(),
+            [&] (size_t a, size_t b) {
+                return hnsw.levels[slots[a]] > hnsw.levels[slots[b]];
+            });
+
+        std::vector<omp_lock_t> locks (ntotal);
+        for (idx_t i = 0; i < ntotal; i++) {
+            omp_init_lock (&locks[i]);
+        }
+
+        size_t i0 = 0;
+        while (i0 < nreuse) {
+            int pt_level = hnsw.levels[slots[order[i0]]] - 1;
+            size_t i1 = i0;
+            while (i1 < nreuse &&
+                   hnsw.levels[slots[order[i1]]] - 1 == pt_level) {
+                i1++;
+            }
+
+#pragma omp parallel if(i1 > i0 + 100)
+            {
+                VisitedTable vt (ntotal);
+                DistanceComputer *dis = storage_distance_computer (storage);
+                ScopeDeleter1<DistanceComputer> del(dis);
+
+#pragma omp for schedule(dynamic)
+                for (size_t i = i0; i < i1; i++) {
+                    dis->set_query (x + order[i] * d);
+                    hnsw.add_with_locks (*dis, pt_level, slots[order[i]],
+                                         locks, vt);
+                }
+            }
+            i0 = i1;
+        }
+
+        for (idx_t i = 0; i < ntotal; i++) {
+            omp_destroy_lock (&locks[i]);
+        }
+    }
+
+    idx_t n0 = ntotal;
+    add (n - nreuse, x + nreuse * d);
+    for (idx_t i = nreuse; i < n; i++) {
+        labels[i] = n0 + i - nreuse;
+    }
 }
 
 void IndexHNSW::shrink_level_0_neighbors(int new_size)
@@ -427,7 +1366,8 @@ void IndexHNSW::search_level_0(
         DistanceComputer *qdis = storage_distance_computer(storage);
         ScopeDeleter1<DistanceComputer> del(qdis);
 
-        VisitedTable vt (ntotal);
+        ScratchVisitedTable svt (ntotal);
+        VisitedTable & vt = *svt;
 
 #pragma omp for reduction (+ : n1, n2, n3, ndis, nreorder)
         for(idx_t i = 0; i < n; i++) {
@@ -500,6 +1440,205 @@ void IndexHNSW::search_level_0(
     hnsw_stats.combine({n1, n2, n3, ndis, nreorder});
 }
 
+namespace {
+
+/* build the graph of an index whose storage is populated and whose
+ * graph is empty from a kNN graph of the vectors */
+void hnsw_build_from_knn_graph(IndexHNSW &index_hnsw,
+                               int k, const float *D, const idx_t *I)
+{
+    HNSW & hnsw = index_hnsw.hnsw;
+    idx_t n = index_hnsw.ntotal;
+    bool verbose = index_hnsw.verbose;
+    double t0 = getmillisecs();
+    if (n == 0) {
+        return;
+    }
+    hnsw.prepare_level_tab(n);
+    // the distance computers return negated inner products
+    float sign = index_hnsw.metric_type == METRIC_INNER_PRODUCT ? -1 : 1;
+
+    // reverse links, at most k per node
+    std::vector<size_t> lims(n + 1, 0);
+    for (idx_t i = 0; i < n * k; i++) {
+        if (I[i] >= 0 && I[i] != i / k) {
+            lims[I[i] + 1]++;
+        }
+    }
+    for (idx_t i = 0; i < n; i++) {
+        lims[i + 1] += lims[i];
+    }
+    std::vector<NodeDistFarther> rev (lims[n], NodeDistFarther(0, -1));
+    {
+        std::vector<size_t> ofs (lims.begin(), lims.end() - 1);
+        for (idx_t i = 0; i < n * k; i++) {
+            if (I[i] >= 0 && I[i] != i / k) {
+                rev[ofs[I[i]]++] = NodeDistFarther(sign * D[i], i / k);
+            }
+        }
+    }
+
+    // level 0: prune the kNN and reverse kNN links
+    int max_size = hnsw.nb_neighbors(0);
+#pragma omp parallel
+    {
+        DistanceComputer *dis = storage_distance_computer(index_hnsw.storage);
+        ScopeDeleter1<DistanceComputer> del(dis);
+        std::vector<NodeDistFarther> cands, shrunk_list;
+
+#pragma omp for schedule(dynamic, 1024)
+        for (idx_t i = 0; i < n; i++) {
+            cands.clear();
+            for (int j = 0; j < k; j++) {
+                idx_t v = I[i * k + j];
+                if (v >= 0 && v != i) {
+                    cands.emplace_back(sign * D[i * k + j], v);
+                }
+            }
+            // the nearest reverse links (hubs may have many)
+            NodeDistFarther *r0 = rev.data() + lims[i];
+            NodeDistFarther *r1 = rev.data() + lims[i + 1];
+            if (r1 - r0 > k) {
+                std::nth_element(r0, r0 + k, r1,
+                    [](const NodeDistFarther & a, const NodeDistFarther & b) {
+                        return a.d < b.d;
+                    });
+                r1 = r0 + k;
+            }
+            cands.insert(cands.end(), r0, r1);
+
+            std::sort(cands.begin(), cands.end(),
+                [](const NodeDistFarther & a, const NodeDistFarther & b) {
+                    return a.id < b.id;
+                });
+            std::priority_queue<NodeDistFarther> initial_list;
+            for (size_t j = 0; j < cands.size(); j++) {
+                if (j == 0 || cands[j].id != cands[j - 1].id) {
+                    initial_list.push(cands[j]);
+                }
+            }
+
+            shrunk_list.clear();
+            if (initial_list.size() <= max_size) {
+                while (!initial_list.empty()) {
+                    shrunk_list.push_back(initial_list.top());
+                    initial_list.pop();
+                }
+            } else {
+                HNSW::shrink_neighbor_list(*dis, initial_list,
+                                           shrunk_list, max_size);
+            }
+
+            size_t begin, end;
+            hnsw.neighbor_range(i, 0, &begin, &end);
+            for (size_t j = begin; j < end; j++) {
+                hnsw.neighbors[j] = j - begin < shrunk_list.size() ?
+                    shrunk_list[j - begin].id : -1;
+            }
+        }
+    }
+    if (verbose) {
+        printf("  level 0 built in %.3f s\n", (getmillisecs() - t0) / 1000);
+    }
+
+    // upper levels: insert the nodes of level > 0 by decreasing level,
+    // without touching level 0
+    std::vector<storage_idx_t> order;
+    for (idx_t i = 0; i < n; i++) {
+        if (hnsw.levels[i] > 1) {
+            order.push_back(i);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(),
+        [&](storage_idx_t a, storage_idx_t b) {
+            return hnsw.levels[a] > hnsw.levels[b];
+        });
+    hnsw.entry_point = order.empty() ? 0 : order[0];
+    hnsw.max_level = hnsw.levels[hnsw.entry_point] - 1;
+
+    std::vector<omp_lock_t> locks(n);
+    for (idx_t i = 0; i < n; i++) {
+        omp_init_lock(&locks[i]);
+    }
+
+    size_t i0 = order.empty() ? 0 : 1;
+    while (i0 < order.size()) {
+        int pt_level = hnsw.levels[order[i0]] - 1;
+        size_t i1 = i0;
+        while (i1 < order.size() && hnsw.levels[order[i1]] - 1 == pt_level) {
+            i1++;
+        }
+
+#pragma omp parallel if(i1 > i0 + 100)
+        {
+            VisitedTable vt (n);
+            DistanceComputer *dis =
+                storage_distance_computer (index_hnsw.storage);
+            ScopeDeleter1<DistanceComputer> del(dis);
+            std::vector<float> vec (index_hnsw.d);
+
+#pragma omp for schedule(dynamic)
+            for (size_t i = i0; i < i1; i++) {
+                storage_idx_t pt_id = order[i];
+                index_hnsw.storage->reconstruct (pt_id, vec.data());
+                dis->set_query (vec.data());
+                hnsw.add_with_locks (*dis, pt_level, pt_id, locks, vt, 1);
+            }
+        }
+        i0 = i1;
+    }
+
+    for (idx_t i = 0; i < n; i++) {
+        omp_destroy_lock(&locks[i]);
+    }
+    if (verbose) {
+        printf("  %zd upper level nodes added, total %.3f s\n",
+               order.size(), (getmillisecs() - t0) / 1000);
+    }
+}
+
+}  // namespace
+
+void IndexHNSW::add_with_knn_graph (idx_t n, const float *x, int k,
+                                    const float *D, const idx_t *I)
+{
+    FAISS_THROW_IF_NOT_MSG(storage,
+       "Please use IndexHSNWFlat (or variants) instead of IndexHNSW directly");
+    FAISS_THROW_IF_NOT(is_trained);
+    FAISS_THROW_IF_NOT_MSG(ntotal == 0,
+       "the graph can be built from a kNN graph only for an empty index");
+    storage->add(n, x);
+    ntotal = storage->ntotal;
+    hnsw_build_from_knn_graph (*this, k, D, I);
+}
+
+void IndexHNSW::add_with_nndescent (idx_t n, const float *x,
+                                    const NNDescent *nnd_in)
+{
+    FAISS_THROW_IF_NOT_MSG(storage,
+       "Please use IndexHSNWFlat (or variants) instead of IndexHNSW directly");
+    FAISS_THROW_IF_NOT(is_trained);
+    FAISS_THROW_IF_NOT_MSG(ntotal == 0,
+       "the graph can be built from a kNN graph only for an empty index");
+    storage->add(n, x);
+    ntotal = storage->ntotal;
+
+    NNDescent nnd (hnsw.nb_neighbors(0));
+    if (nnd_in) {
+        nnd = *nnd_in;
+    }
+    nnd.verbose = nnd.verbose || verbose;
+    std::vector<idx_t> I (n * nnd.K);
+    std::vector<float> D (n * nnd.K);
+    double t0 = getmillisecs();
+    nnd.build (storage, I.data(), D.data());
+    if (verbose) {
+        printf("IndexHNSW::add_with_nndescent: kNN graph in %.3f s\n",
+               (getmillisecs() - t0) / 1000);
+    }
+    hnsw_build_from_knn_graph (*this, nnd.K, D.data(), I.data());
+}
+
 void IndexHNSW::init_level_0_from_knngraph(
        int k, const float *D, const idx_t *I)
 {
@@ -662,6 +1801,59 @@ void IndexHNSW::link_singletons()
  * ReconstructFromNeighbors implementation
  **************************************************************/
 
+namespace {
+
+/// accumulate the normal equations G beta = r of the regression of the
+/// components [d0, d1) of x on the rows of the m1 * d neighbor table
+void add_normal_equations(size_t m1, size_t d, size_t d0, size_t d1,
+                          const float *tab, const float *x,
+                          double *G, double *r)
+{
+    for (size_t a = 0; a < m1; a++) {
+        const float *ta = tab + a * d;
+        double ra = 0;
+        for (size_t l = d0; l < d1; l++) {
+            ra += ta[l] * x[l];
+        }
+        r[a] += ra;
+        for (size_t b = 0; b <= a; b++) {
+            const float *tb = tab + b * d;
+            double g = 0;
+            for (size_t l = d0; l < d1; l++) {
+                g += ta[l] * tb[l];
+            }
+            G[a * m1 + b] += g;
+            if (b != a) {
+                G[b * m1 + a] += g;
+            }
+        }
+    }
+}
+
+/// solve the normal equations with a small ridge, since the neighbor
+/// table has more rows than dimensions in general
+void solve_normal_equations(size_t m1, std::vector<double> G,
+                            std::vector<double> r, float *beta)
+{
+    double trace = 0;
+    for (size_t a = 0; a < m1; a++) {
+        trace += G[a * m1 + a];
+    }
+    double lambda = 1e-3 * trace / m1 + 1e-10;
+    for (size_t a = 0; a < m1; a++) {
+        G[a * m1 + a] += lambda;
+    }
+    FINTEGER mi = m1, one = 1, info;
+    dposv_ ("Upper", &mi, &one, G.data(), &mi, r.data(), &mi, &info);
+    FAISS_THROW_IF_NOT_FMT (info == 0, "dposv failed with info=%d",
+                            int(info));
+    for (size_t a = 0; a < m1; a++) {
+        beta[a] = r[a];
+    }
+}
+
+} // namespace
+
 
 ReconstructFromNeighbors::ReconstructFromNeighbors(
              const IndexHNSW & index, size_t k, size_t nsq):
@@ -681,8 +1873,9 @@ void ReconstructFromNeighbors::reconstruct(storage_idx_t i, float *x, float *tmp
 
 
     const HNSW & hnsw = index.hnsw;
-    size_t begin, end;
-    hnsw.neighbor_range(i, 0, &begin, &end);
+    storage_idx_t links_buf[256];
+    size_t nneigh;
+    const storage_idx_t *neigh = hnsw.neighbor_list(i, 0, links_buf, &nneigh);
 
     if (k == 1 || nsq == 1) {
         const float * beta;
@@ -699,11 +1892,11 @@ void ReconstructFromNeighbors::reconstruct(storage_idx_t i, float *x, float *tmp
         for (int l = 0; l < d; l++)
             x[l] = w0 * tmp[l];
 
-        for (size_t j = begin; j < end; j++) {
+        for (size_t j = 0; j < M; j++) {
 
-            storage_idx_t ji = hnsw.neighbors[j];
+            storage_idx_t ji = j < nneigh ? neigh[j] : -1;
             if (ji < 0) ji = i;
-            float w = beta[j - begin + 1];
+            float w = beta[j + 1];
             index.storage->reconstruct(ji, tmp);
             for (int l = 0; l < d; l++)
                 x[l] += w * tmp[l];
@@ -727,16 +1920,16 @@ void ReconstructFromNeighbors::reconstruct(storage_idx_t i, float *x, float *tmp
         for (int l = dsub; l < d; l++)
             x[l] = w0 * tmp[l];
 
-        for (size_t j = begin; j < end; j++) {
-            storage_idx_t ji = hnsw.neighbors[j];
+        for (size_t j = 0; j < M; j++) {
+            storage_idx_t ji = j < nneigh ? neigh[j] : -1;
             if (ji < 0) ji = i;
             index.storage->reconstruct(ji, tmp);
             float w;
-            w = beta0[j - begin + 1];
+            w = beta0[j + 1];
             for (int l = 0; l < dsub; l++)
                 x[l] += w * tmp[l];
 
-            w = beta1[j - begin + 1];
+            w = beta1[j + 1];
             for (int l = dsub; l < d; l++)
                 x[l] += w * tmp[l];
         }
@@ -764,8 +1957,8 @@ void ReconstructFromNeighbors::reconstruct(storage_idx_t i, float *x, float *tmp
             }
         }
 
-        for (size_t j = begin; j < end; j++) {
-            storage_idx_t ji = hnsw.neighbors[j];
+        for (size_t j = 0; j < M; j++) {
+            storage_idx_t ji = j < nneigh ? neigh[j] : -1;
             if (ji < 0) ji = i;
 
             index.storage->reconstruct(ji, tmp);
@@ -814,16 +2007,17 @@ size_t ReconstructFromNeighbors::compute_distances(
 void ReconstructFromNeighbors::get_neighbor_table(storage_idx_t i, float *tmp1) const
 {
     const HNSW & hnsw = index.hnsw;
-    size_t begin, end;
-    hnsw.neighbor_range(i, 0, &begin, &end);
+    storage_idx_t links_buf[256];
+    size_t nneigh;
+    const storage_idx_t *neigh = hnsw.neighbor_list(i, 0, links_buf, &nneigh);
     size_t d = index.d;
 
     index.storage->reconstruct(i, tmp1);
 
-    for (size_t j = begin; j < end; j++) {
-        storage_idx_t ji = hnsw.neighbors[j];
+    for (size_t j = 0; j < M; j++) {
+        storage_idx_t ji = j < nneigh ? neigh[j] : -1;
         if (ji < 0) ji = i;
-        index.storage->reconstruct(ji, tmp1 + (j - begin + 1) * d);
+        index.storage->reconstruct(ji, tmp1 + (j + 1) * d);
     }
 
 }
@@ -870,6 +2064,98 @@ void ReconstructFromNeighbors::estimate_code(
 
 }
 
+void ReconstructFromNeighbors::train(size_t n, const float *x, int niter)
+{
+    FAISS_THROW_IF_NOT (n <= index.ntotal);
+    size_t m1 = M + 1;
+    // with k == 1, a single set of weights is used for all dimensions
+    size_t nsub = k == 1 ? 1 : nsq;
+    size_t ds = d / nsub;
+    codebook.resize (nsub * k * m1);
+    codes.clear ();
+    ntotal = 0;
+
+    // least-squares weights of the vectors ids in subspace s
+    auto fit_weights = [&] (size_t s, const std::vector<idx_t> & ids,
+                            float *beta) {
+        std::vector<double> G (m1 * m1), r (m1);
+#pragma omp parallel
+        {
+            std::vector<double> Gt (m1 * m1), rt (m1);
+            std::vector<float> tab (m1 * d);
+#pragma omp for
+            for (idx_t j = 0; j < ids.size(); j++) {
+                get_neighbor_table (ids[j], tab.data());
+                add_normal_equations (m1, d, s * ds, (s + 1) * ds,
+                                      tab.data(), x + ids[j] * d,
+                                      Gt.data(), rt.data());
+            }
+#pragma omp critical
+            {
+                for (size_t a = 0; a < m1 * m1; a++) {
+                    G[a] += Gt[a];
+                }
+                for (size_t a = 0; a < m1; a++) {
+                    r[a] += rt[a];
+                }
+            }
+        }
+        solve_normal_equations (m1, G, r, beta);
+    };
+
+    if (k == 1) {
+        std::vector<idx_t> all (n);
+        std::iota (all.begin(), all.end(), 0);
+        fit_weights (0, all, codebook.data());
+        return;
+    }
+
+    // initialization: k-means on the weights of the individual vectors
+    std::vector<float> betas (nsub * n * m1);
+#pragma omp parallel
+    {
+        std::vector<float> tab (m1 * d);
+#pragma omp for
+        for (idx_t i = 0; i < n; i++) {
+            get_neighbor_table (i, tab.data());
+            for (size_t s = 0; s < nsub; s++) {
+                std::vector<double> G (m1 * m1), r (m1);
+                add_normal_equations (m1, d, s * ds, (s + 1) * ds,
+                                      tab.data(), x + i * d,
+                                      G.data(), r.data());
+                solve_normal_equations (m1, G, r,
+                                        betas.data() + (s * n + i) * m1);
+            }
+        }
+    }
+    for (size_t s = 0; s < nsub; s++) {
+        kmeans_clustering (m1, n, k, betas.data() + s * n * m1,
+                           codebook.data() + s * k * m1);
+    }
+
+    // EM: assign the codes, then refit the weights of each cluster. The
+    // weights of empty clusters are kept
+    std::vector<uint8_t> assign (n * nsub);
+    for (int iter = 0; iter < niter; iter++) {
+#pragma omp parallel for
+        for (idx_t i = 0; i < n; i++) {
+            estimate_code (x + i * d, i, assign.data() + i * nsub);
+        }
+        for (size_t s = 0; s < nsub; s++) {
+            std::vector<std::vector<idx_t> > members (k);
+            for (size_t i = 0; i < n; i++) {
+                members[assign[i * nsub + s]].push_back (i);
+            }
+            for (size_t c = 0; c < k; c++) {
+                if (!members[c].empty()) {
+                    fit_weights (s, members[c],
+                                 codebook.data() + (s * k + c) * m1);
+                }
+            }
+        }
+    }
+}
+
 void ReconstructFromNeighbors::add_codes(size_t n, const float *x)
 {
     if (k == 1) { // nothing to encode
@@ -935,7 +2221,8 @@ IndexHNSWSQ::IndexHNSWSQ(int d, ScalarQuantizer::QuantizerType qtype, int M,
                          MetricType metric):
     IndexHNSW (new IndexScalarQuantizer (d, qtype, metric), M)
 {
-    is_trained = false;
+    // fp16 and direct encodings do not need training
+    is_trained = storage->is_trained;
     own_fields = true;
 }
 
@@ -980,16 +2267,18 @@ int search_from_candidates_2(const HNSW & hnsw,
     }
 
     int nstep = 0;
+    storage_idx_t links_buf[256];
 
     while (candidates.size() > 0) {
         float d0 = 0;
         int v0 = candidates.pop_min(&d0);
 
-        size_t begin, end;
-        hnsw.neighbor_range(v0, level, &begin, &end);
+        size_t nneigh;
+        const storage_idx_t *neigh =
+            hnsw.neighbor_list(v0, level, links_buf, &nneigh);
 
-        for (size_t j = begin; j < end; j++) {
-            int v1 = hnsw.neighbors[j];
+        for (size_t j = 0; j < nneigh; j++) {
+            int v1 = neigh[j];
             if (v1 < 0) break;
             if (vt.visited[v1] == vt.visno + 1) {
                 // nothing to do
@@ -1028,12 +2317,15 @@ int search_from_candidates_2(const HNSW & hnsw,
 }  // namespace
 
 void IndexHNSW2Level::search (idx_t n, const float *x, idx_t k,
-                              float *distances, idx_t *labels) const
+                              float *distances, idx_t *labels,
+                              const SearchParameters *params) const
 {
     if (dynamic_cast<const Index2Layer*>(storage)) {
-        IndexHNSW::search (n, x, k, distances, labels);
+        IndexHNSW::search (n, x, k, distances, labels, params);
 
     } else { // "mixed" search
+        FAISS_THROW_IF_NOT_MSG (!params,
+                "search params not supported for this index");
         size_t n1 = 0, n2 = 0, n3 = 0, ndis = 0, nreorder = 0;
 
         const IndexIVFPQ *index_ivfpq =
@@ -1053,7 +2345,8 @@ void IndexHNSW2Level::search (idx_t n, const float *x, idx_t k,
 
 #pragma omp parallel
         {
-            VisitedTable vt (ntotal);
+            ScratchVisitedTable svt (ntotal);
+            VisitedTable & vt = *svt;
             DistanceComputer *dis = storage_distance_computer(storage);
             ScopeDeleter1<DistanceComputer> del(dis);
 
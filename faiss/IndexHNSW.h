@@ -12,6 +12,7 @@
 #include <vector>
 
 #include <faiss/impl/HNSW.h>
+#include <faiss/impl/NNDescent.h>
 #include <faiss/IndexFlat.h>
 #include <faiss/IndexPQ.h>
 #include <faiss/IndexScalarQuantizer.h>
@@ -42,6 +43,16 @@ struct ReconstructFromNeighbors {
     explicit ReconstructFromNeighbors(const IndexHNSW& index,
                                       size_t k=256, size_t nsq=1);
 
+    /** learn the codebook from the vectors of the first n nodes of the
+     * index (x in node order), as in benchs/link_and_code: the
+     * least-squares weights of the neighbor table of each vector are
+     * clustered with k-means, then refined with niter iterations that
+     * alternate the assignment of the codes and the least-squares
+     * weights of each cluster. The codes are cleared. The links must not
+     * change afterwards (eg. compress them before training, since the
+     * weights depend on the order of the neighbors). */
+    void train(size_t n, const float *x, int niter = 5);
+
     /// codes must be added in the correct order and the IndexHNSW
     /// must be populated and sorted
     void add_codes(size_t n, const float *x);
@@ -79,6 +90,11 @@ struct IndexHNSW : Index {
 
     ReconstructFromNeighbors *reconstruct_from_neighbors;
 
+    /** if not empty, the nodes of the graph were renumbered by
+     * permute_entries and node_to_label gives the label of each node
+     * (label_to_node is the inverse). The labels do not change. */
+    std::vector<storage_idx_t> node_to_label, label_to_node;
+
     explicit IndexHNSW (int d = 0, int M = 32, MetricType metric = METRIC_L2);
     explicit IndexHNSW (Index *storage, int M = 32);
 
@@ -91,12 +107,97 @@ struct IndexHNSW : Index {
 
     /// entry point for search
     void search (idx_t n, const float *x, idx_t k,
-                 float *distances, idx_t *labels) const override;
+                 float *distances, idx_t *labels,
+                 const SearchParameters *params = nullptr) const override;
+
+    /** range search: the beam of size efSearch is extended as long as
+     * the visited neighbors are within the radius */
+    void range_search (idx_t n, const float *x, float radius,
+                       RangeSearchResult *result) const override;
+
+    /// max nb of range search results per query (0 = unlimited). When
+    /// the cap is reached, the search keeps only the nearest results
+    /// and stops expanding beyond them
+    size_t range_search_max_results;
+
+    /** if > 1 and the storage is flat, the search processes the
+     * queries by groups of this size that traverse the graph together:
+     * at each step, the vectors of the neighbors expanded by the queries
+     * of the group are loaded once and compared with all of them. A
+     * vector found by another query of the group enters the beam of a
+     * query if it improves its current results, so the results may
+     * differ slightly from those of the per-query search. The default
+     * search is used with upper_beam > 1, an unbounded queue or
+     * reconstruct_from_neighbors. */
+    int search_batch_size;
 
     void reconstruct(idx_t key, float* recons) const override;
 
+    void reconstruct_batch (idx_t n, const idx_t *keys,
+                            float *recons) const override;
+
+    /* The standalone codec interface is the one of the storage (the
+     * graph is not part of the codes) */
+    size_t sa_code_size () const override;
+
+    void sa_encode (idx_t n, const float *x,
+                    uint8_t *bytes) const override;
+
+    void sa_decode (idx_t n, const uint8_t *bytes,
+                    float *x) const override;
+
+    /// graph, storage and label maps
+    MemoryUsage memory_usage () const override;
+
     void reset () override;
 
+    /** soft deletion: the selected vectors are marked as deleted in
+     * the graph. They are not returned by the searches anymore but
+     * still route them until repair_deleted is called. The ids of the
+     * other vectors do not change, so ntotal does not change either.
+     *
+     * @return nb of vectors that were marked */
+    size_t remove_ids (const IDSelector & sel) override;
+
+    /** reconnect the neighbors of the deleted vectors without them and
+     * detach the deleted vectors from the graph. Their slots can then
+     * be reused with add_in_free_slots.
+     *
+     * @return nb of vectors detached */
+    size_t repair_deleted ();
+
+    /** add vectors by overwriting the slots of the detached vectors
+     * first (they keep the level of the vector they replace), the
+     * remaining vectors are appended. Requires a flat, PQ or SQ
+     * storage that owns its data.
+     *
+     * @param labels  output ids of the added vectors, size n
+     */
+    void add_in_free_slots (idx_t n, const float *x, idx_t *labels);
+
+    /** renumber the nodes of the graph and the vectors of the storage
+     * (flat, PQ or SQ): new node i is old node perm[i]. The labels
+     * returned by the searches do not change. */
+    void permute_entries (const idx_t *perm);
+
+    /// renumber the nodes so that the nodes visited together by the
+    /// search are close in memory, to be called once the index is built
+    void reorder_nodes (HNSW::ReorderType type = HNSW::REORDER_BFS);
+
+    /** move the vectors and the graph of other to the end of this
+     * index (their ids are shifted by ntotal), other is emptied. The
+     * two graphs are connected by searching each node in the graph of
+     * the other index and pruning its current and new neighbors
+     * together with shrink_neighbor_list, which is much cheaper than
+     * adding the vectors again. The indexes must have the same
+     * parameters and no deleted vectors. */
+    void merge_from (IndexHNSW &other);
+
+    /// label of a node of the graph
+    idx_t node_label (storage_idx_t node) const {
+        return node_to_label.empty() ? node : node_to_label[node];
+    }
+
     void shrink_level_0_neighbors(int size);
 
     /** Perform search only on level 0, given the starting points for
@@ -110,6 +211,27 @@ struct IndexHNSW : Index {
                         float *distances, idx_t *labels, int nprobe = 1,
                         int search_type = 1) const;
 
+    /** build the graph of an empty index from a kNN graph of the
+     * vectors instead of inserting them one by one. Level 0 is derived
+     * from the kNN and reverse kNN links with the shrink_neighbor_list
+     * heuristic, the upper levels are built by inserting the nodes of
+     * level > 0 (a 1/M sample).
+     *
+     * @param D, I  kNN graph of x, size n * k, as returned by a search
+     *              (eg. brute-force on GPU with bfKnn), -1 padded
+     */
+    void add_with_knn_graph (idx_t n, const float *x, int k,
+                             const float *D, const idx_t *I);
+
+    /** same as add_with_knn_graph, the kNN graph is computed in
+     * parallel with NN-descent
+     *
+     * @param nnd  NN-descent parameters, by default the nb of neighbors
+     *             is the size of the level 0 lists
+     */
+    void add_with_nndescent (idx_t n, const float *x,
+                             const NNDescent *nnd = nullptr);
+
     /// alternative graph building
     void init_level_0_from_knngraph(
                         int k, const float *D, const idx_t *I);
@@ -162,7 +284,8 @@ struct IndexHNSW2Level : IndexHNSW {
 
     /// entry point for search
     void search (idx_t n, const float *x, idx_t k,
-                 float *distances, idx_t *labels) const override;
+                 float *distances, idx_t *labels,
+                 const SearchParameters *params = nullptr) const override;
 
 };
 
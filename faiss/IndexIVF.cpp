@@ -19,11 +19,17 @@
 #include <memory>
 
 #include <faiss/utils/utils.h>
+#include <faiss/utils/distances.h>
 #include <faiss/utils/hamming.h>
+#include <faiss/utils/instrumentation.h>
+#include <faiss/utils/parallel.h>
+#include <faiss/utils/scratch.h>
 
 #include <faiss/impl/FaissAssert.h>
+#include <faiss/Clustering.h>
 #include <faiss/IndexFlat.h>
 #include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/ResultHandler.h>
 
 namespace faiss {
 
@@ -160,7 +166,16 @@ IndexIVF::IndexIVF (Index * quantizer, size_t d,
     code_size (code_size),
     nprobe (1),
     max_codes (0),
-    parallel_mode (0)
+    early_stop_ratio (0),
+    early_stop_stable (0),
+    parallel_mode (0),
+    reservoir_min_k (0),
+    prefetch_distance (1),
+    prefetch_bytes (256),
+    max_list_size (0),
+    spill_nprobe (4),
+    lazy_remove (false),
+    ntombstones (0)
 {
     FAISS_THROW_IF_NOT (d == quantizer->d);
     is_trained = quantizer->is_trained && (quantizer->ntotal == nlist);
@@ -174,7 +189,11 @@ IndexIVF::IndexIVF (Index * quantizer, size_t d,
 IndexIVF::IndexIVF ():
     invlists (nullptr), own_invlists (false),
     code_size (0),
-    nprobe (1), max_codes (0), parallel_mode (0)
+    nprobe (1), max_codes (0),
+    early_stop_ratio (0), early_stop_stable (0), parallel_mode (0),
+    reservoir_min_k (0), prefetch_distance (1), prefetch_bytes (256),
+    max_list_size (0), spill_nprobe (4),
+    lazy_remove (false), ntombstones (0)
 {}
 
 void IndexIVF::add (idx_t n, const float * x)
@@ -203,7 +222,7 @@ void IndexIVF::add_with_ids (idx_t n, const float * x, const idx_t *xids)
     direct_map.check_can_add (xids);
 
     std::unique_ptr<idx_t []> idx(new idx_t[n]);
-    quantizer->assign (n, x, idx.get());
+    assign_for_add (n, x, idx.get());
     size_t nadd = 0, nminus1 = 0;
 
     for (size_t i = 0; i < n; i++) {
@@ -247,6 +266,46 @@ void IndexIVF::add_with_ids (idx_t n, const float * x, const idx_t *xids)
     ntotal += n;
 }
 
+void IndexIVF::assign_for_add (idx_t n, const float *x,
+                               idx_t *list_nos) const
+{
+    if (max_list_size == 0 || n == 0) {
+        quantizer->assign (n, x, list_nos);
+        return;
+    }
+    size_t np = std::max (std::min (spill_nprobe, nlist), size_t(1));
+    std::unique_ptr<idx_t []> keys (new idx_t[n * np]);
+    std::unique_ptr<float []> dis (new float[n * np]);
+    quantizer->search (n, x, np, dis.get(), keys.get());
+
+    // list sizes including the vectors assigned so far
+    std::vector<size_t> sizes (nlist);
+    for (size_t l = 0; l < nlist; l++) {
+        sizes[l] = invlists->list_size (l);
+    }
+
+    size_t nspill = 0;
+    for (idx_t i = 0; i < n; i++) {
+        const idx_t *ki = keys.get() + i * np;
+        idx_t list_no = ki[0];
+        for (size_t j = 0; j < np; j++) {
+            if (ki[j] >= 0 && sizes[ki[j]] < max_list_size) {
+                list_no = ki[j];
+                nspill += j > 0;
+                break;
+            }
+        }
+        if (list_no >= 0) {
+            sizes[list_no]++;
+        }
+        list_nos[i] = list_no;
+    }
+    if (verbose) {
+        printf ("    %zd / %" PRId64 " vectors spilled to other lists\n",
+                nspill, n);
+    }
+}
+
 void IndexIVF::make_direct_map (bool b)
 {
     if (b) {
@@ -264,25 +323,181 @@ void IndexIVF::set_direct_map_type (DirectMap::Type type)
 }
 
 
+void IVFNormBounds::clear ()
+{
+    block_size = 0;
+    list_max.clear ();
+    block_max.clear ();
+    ncovered.clear ();
+}
+
+
+void IndexIVF::compute_norm_bounds (size_t block_size)
+{
+    FAISS_THROW_IF_NOT (block_size > 0);
+    IVFNormBounds & nb = norm_bounds;
+
+    if (nb.block_size != block_size) {
+        nb.clear ();
+        nb.block_size = block_size;
+        nb.list_max.resize (nlist, 0);
+        nb.block_max.resize (nlist);
+        nb.ncovered.resize (nlist, 0);
+    }
+
+    // fail early if the entries cannot be reconstructed
+    for (size_t list_no = 0; list_no < nlist; list_no++) {
+        if (invlists->list_size (list_no) > 0) {
+            std::vector<float> recons (d);
+            reconstruct_from_offset (list_no, 0, recons.data());
+            break;
+        }
+    }
+
+#pragma omp parallel
+    {
+        std::vector<float> recons (d);
+
+#pragma omp for schedule(dynamic)
+        for (idx_t list_no = 0; list_no < (idx_t) nlist; list_no++) {
+            size_t list_size = invlists->list_size (list_no);
+            std::vector<float> & blocks = nb.block_max [list_no];
+            FAISS_ASSERT (nb.ncovered [list_no] <= list_size);
+
+            // the last block may be partial: restart from its beginning
+            size_t j0 = nb.ncovered [list_no] / block_size;
+            blocks.resize (j0);
+            for (size_t j = j0 * block_size; j < list_size; j++) {
+                reconstruct_from_offset (list_no, j, recons.data());
+                float norm = sqrtf (fvec_norm_L2sqr (recons.data(), d));
+                if (j % block_size == 0) {
+                    blocks.push_back (norm);
+                } else if (norm > blocks.back()) {
+                    blocks.back() = norm;
+                }
+            }
+
+            float lmax = 0;
+            for (float bm : blocks) {
+                lmax = std::max (lmax, bm);
+            }
+            nb.list_max [list_no] = lmax;
+            nb.ncovered [list_no] = list_size;
+        }
+    }
+}
+
+
 void IndexIVF::search (idx_t n, const float *x, idx_t k,
-                         float *distances, idx_t *labels) const
+                         float *distances, idx_t *labels,
+                         const SearchParameters *params_in) const
 {
-    std::unique_ptr<idx_t[]> idx(new idx_t[n * nprobe]);
-    std::unique_ptr<float[]> coarse_dis(new float[n * nprobe]);
+    const IVFSearchParameters *params = nullptr;
+    if (params_in) {
+        params = dynamic_cast<const IVFSearchParameters *>(params_in);
+        FAISS_THROW_IF_NOT_MSG (params, "IndexIVF params have incorrect type");
+    }
+    if (use_parallel_executor (n)) {
+        // the executor parallelizes over the queries
+        parallel_for (n, [&] (size_t i0, size_t i1) {
+            search (i1 - i0, x + i0 * d, k, distances + i0 * k,
+                    labels + i0 * k, params_in);
+        });
+        return;
+    }
+    size_t nprobe = params ? params->nprobe : this->nprobe;
+
+    // reused across calls, the coarse quantizer fills them entirely
+    ScratchBuffer idx_buf, coarse_dis_buf;
+    idx_t *idx = idx_buf.get<idx_t> (n * nprobe);
+    float *coarse_dis = coarse_dis_buf.get<float> (n * nprobe);
 
     double t0 = getmillisecs();
-    quantizer->search (n, x, nprobe, coarse_dis.get(), idx.get());
+    {
+        InstrumentationTimer timer (STAGE_COARSE_QUANTIZE);
+        quantizer->search (n, x, nprobe, coarse_dis, idx,
+                           params ? params->quantizer_params : nullptr);
+    }
     indexIVF_stats.quantization_time += getmillisecs() - t0;
 
     t0 = getmillisecs();
-    invlists->prefetch_lists (idx.get(), n * nprobe);
+    {
+        InstrumentationTimer timer (STAGE_IO);
+        invlists->prefetch_lists (idx, n * nprobe);
+    }
 
-    search_preassigned (n, x, k, idx.get(), coarse_dis.get(),
-                        distances, labels, false);
+    {
+        InstrumentationTimer timer (STAGE_LIST_SCAN);
+        search_preassigned (n, x, k, idx, coarse_dis,
+                            distances, labels, false, params);
+    }
     indexIVF_stats.search_time += getmillisecs() - t0;
 }
 
 
+namespace {
+
+/// skips the entries marked as deleted, then applies sel if any
+struct IDSelectorNotDeleted: IDSelector {
+    const IDSelector *sel;
+
+    explicit IDSelectorNotDeleted (const IDSelector *sel): sel (sel) {}
+
+    bool is_member (idx_t id) const override {
+        return id != -1 && (!sel || sel->is_member (id));
+    }
+};
+
+/* Scan an inverted list and store the results in a reservoir rather
+ * than a heap. The distances are computed by blocks of bs codes. Each
+ * block is compared to the reservoir threshold with a branchless loop
+ * that compacts the indices of the surviving candidates, so only these
+ * go through ReservoirTopN::add. The reservoir is partitioned back to k
+ * elements only when it is full. */
+template<class C>
+size_t scan_list_reservoir (const InvertedListScanner *scanner,
+                            size_t list_size, const uint8_t *codes,
+                            size_t code_size, const Index::idx_t *ids,
+                            bool store_pairs, Index::idx_t list_no,
+                            ReservoirTopN<C> & res)
+{
+    constexpr size_t bs = 32;
+    float dis[bs];
+    int sel[bs];
+    size_t nup = 0;
+    const IDSelector *idsel = scanner->sel;
+
+    for (size_t j0 = 0; j0 < list_size; j0 += bs) {
+        size_t nj = std::min (bs, list_size - j0);
+        for (size_t j = 0; j < nj; j++) {
+            if (idsel && !idsel->is_member (ids[j0 + j])) {
+                // never passes the threshold test
+                dis[j] = C::neutral ();
+                continue;
+            }
+            dis[j] = scanner->distance_to_code (codes + (j0 + j) * code_size);
+        }
+
+        float thresh = res.threshold;
+        size_t nsel = 0;
+        for (size_t j = 0; j < nj; j++) {
+            sel[nsel] = j;
+            nsel += C::cmp (thresh, dis[j]) ? 1 : 0;
+        }
+
+        for (size_t l = 0; l < nsel; l++) {
+            size_t j = j0 + sel[l];
+            res.add (dis[sel[l]],
+                     store_pairs ? lo_build (list_no, j) : ids[j]);
+        }
+        nup += nsel;
+    }
+    return nup;
+}
+
+} // anonymous namespace
+
+
 void IndexIVF::search_preassigned (idx_t n, const float *x, idx_t k,
                                    const idx_t *keys,
                                    const float *coarse_dis ,
@@ -292,8 +507,24 @@ void IndexIVF::search_preassigned (idx_t n, const float *x, idx_t k,
 {
     long nprobe = params ? params->nprobe : this->nprobe;
     long max_codes = params ? params->max_codes : this->max_codes;
+    float early_stop_ratio = params ?
+        params->early_stop_ratio : this->early_stop_ratio;
+    size_t early_stop_stable = params ?
+        params->early_stop_stable : this->early_stop_stable;
+    const IDSelector *sel = params ? params->sel : nullptr;
+    IDSelectorNotDeleted sel_not_deleted (sel);
+    if (ntombstones > 0) {
+        sel = &sel_not_deleted;
+    }
 
-    size_t nlistv = 0, ndis = 0, nheap = 0;
+    if (metric_type != METRIC_L2) {
+        early_stop_ratio = 0;
+    }
+
+    size_t nlistv = 0, ndis = 0, nheap = 0, nearly_stop = 0;
+    size_t ntruncated = 0, nnorm_pruned = 0;
+    double deadline_ms = params ? params->deadline_ms : 0;
+    uint8_t *truncated = params ? params->truncated : nullptr;
 
     using HeapForIP = CMin<float, idx_t>;
     using HeapForL2 = CMax<float, idx_t>;
@@ -305,17 +536,95 @@ void IndexIVF::search_preassigned (idx_t n, const float *x, idx_t k,
     int pmode = this->parallel_mode & ~PARALLEL_MODE_NO_HEAP_INIT;
     bool do_heap_init = !(this->parallel_mode & PARALLEL_MODE_NO_HEAP_INIT);
 
+    if (!store_pairs && do_heap_init && invlists->lazy_ids ()) {
+        // collect (list_no, offset) pairs and decode only the result ids
+        IndexIVF::search_preassigned (n, x, k, keys, coarse_dis,
+                                      distances, labels, true, params);
+#pragma omp parallel for if (n * k > 10000)
+        for (idx_t i = 0; i < n * k; i++) {
+            idx_t lo = labels[i];
+            if (lo >= 0) {
+                labels[i] = invlists->get_single_id (lo_listno (lo),
+                                                     lo_offset (lo));
+            }
+        }
+        return;
+    }
+
     // don't start parallel section if single query
     bool do_parallel = omp_get_max_threads() >= 2 && (
             pmode == 0 ? n > 1 :
             pmode == 1 ? nprobe > 1 :
             nprobe * n > 1);
 
+    // for the list-major mode: the (query, probe) pairs of each list, in
+    // CSR format, and per-thread result heaps for all the queries
+    std::vector<size_t> list_lims;
+    std::vector<idx_t> list_probes;
+    int nt_lists = do_parallel ? omp_get_max_threads() : 1;
+    std::vector<float> th_dis;
+    std::vector<idx_t> th_ids;
+    if (pmode == 3) {
+        list_lims.resize (nlist + 1);
+        for (idx_t ij = 0; ij < n * nprobe; ij++) {
+            if (keys[ij] >= 0) {
+                FAISS_THROW_IF_NOT_FMT (keys[ij] < (idx_t) nlist,
+                                        "Invalid key=%" PRId64 " nlist=%zd\n",
+                                        keys[ij], nlist);
+                list_lims[keys[ij] + 1]++;
+            }
+        }
+        for (size_t l = 0; l < nlist; l++) {
+            list_lims[l + 1] += list_lims[l];
+        }
+        list_probes.resize (list_lims[nlist]);
+        std::vector<size_t> ofs (list_lims.begin(), list_lims.end() - 1);
+        for (idx_t ij = 0; ij < n * nprobe; ij++) {
+            if (keys[ij] >= 0) {
+                list_probes[ofs[keys[ij]]++] = ij;
+            }
+        }
+        th_dis.resize (nt_lists * n * k);
+        th_ids.resize (nt_lists * n * k);
+        for (size_t i = 0; i < nt_lists * n; i++) {
+            if (metric_type == METRIC_INNER_PRODUCT) {
+                heap_heapify<HeapForIP> (k, th_dis.data() + i * k,
+                                         th_ids.data() + i * k);
+            } else {
+                heap_heapify<HeapForL2> (k, th_dis.data() + i * k,
+                                         th_ids.data() + i * k);
+            }
+        }
+    }
+
+    // the reservoir replaces the result heaps of the queries
+    bool use_reservoir = reservoir_min_k > 0 && k >= reservoir_min_k &&
+        pmode == 0 && do_heap_init;
+    size_t reservoir_capacity = (2 * k + 15) & ~15;
+
+    // pruning with the norm bounds. With store_pairs, the scanners number
+    // the entries from the start of the codes they get, so the lists
+    // cannot be split in blocks
+    bool use_norm_bounds = metric_type == METRIC_INNER_PRODUCT &&
+        !norm_bounds.empty() && pmode == 0 && !use_reservoir;
+    bool use_norm_blocks = use_norm_bounds && !store_pairs;
 
-#pragma omp parallel if(do_parallel) reduction(+: nlistv, ndis, nheap)
+#pragma omp parallel if(do_parallel) \
+    reduction(+: nlistv, ndis, nheap, nearly_stop, ntruncated, nnorm_pruned)
     {
         InvertedListScanner *scanner = get_InvertedListScanner(store_pairs);
         ScopeDeleter1<InvertedListScanner> del(scanner);
+        scanner->sel = sel;
+
+        std::vector<float> reservoir_dis;
+        std::vector<idx_t> reservoir_ids;
+        ReservoirTopN<HeapForIP> res_ip;
+        ReservoirTopN<HeapForL2> res_l2;
+        float query_norm = 0;
+        if (use_reservoir) {
+            reservoir_dis.resize (reservoir_capacity);
+            reservoir_ids.resize (reservoir_capacity);
+        }
 
         /*****************************************************
          * Depending on parallel_mode, there are two possible ways
@@ -347,6 +656,34 @@ void IndexIVF::search_preassigned (idx_t n, const float *x, idx_t k,
             }
         };
 
+        auto init_reservoir = [&]() {
+            if (metric_type == METRIC_INNER_PRODUCT) {
+                res_ip = ReservoirTopN<HeapForIP> (
+                    k, reservoir_capacity,
+                    reservoir_dis.data(), reservoir_ids.data());
+            } else {
+                res_l2 = ReservoirTopN<HeapForL2> (
+                    k, reservoir_capacity,
+                    reservoir_dis.data(), reservoir_ids.data());
+            }
+        };
+
+        auto reservoir_to_result = [&] (float *simi, idx_t *idxi) {
+            if (metric_type == METRIC_INNER_PRODUCT) {
+                res_ip.to_result (simi, idxi);
+            } else {
+                res_l2.to_result (simi, idxi);
+            }
+        };
+
+        // current k-th result distance (L2), +inf while it is not full
+        auto kth_distance = [&] (const float *simi) {
+            if (!use_reservoir) {
+                return simi[0];
+            }
+            return res_l2.threshold;
+        };
+
         auto reorder_result = [&] (float *simi, idx_t *idxi) {
             if (!do_heap_init) return;
             if (metric_type == METRIC_INNER_PRODUCT) {
@@ -356,6 +693,39 @@ void IndexIVF::search_preassigned (idx_t n, const float *x, idx_t k,
             }
         };
 
+        // whether entries of norm <= max_norm cannot enter the current
+        // results. The margin covers the rounding of the scanners
+        auto norm_prunable = [&] (float max_norm, const float *simi) {
+            return query_norm * max_norm * 1.00001f < simi[0];
+        };
+
+        // scan of the list by blocks, skipping those that are prunable
+        auto scan_blocks = [&] (idx_t key, size_t list_size,
+                                const uint8_t *codes, const idx_t *ids,
+                                float *simi, idx_t *idxi) {
+            size_t bs = norm_bounds.block_size;
+            size_t ncovered = norm_bounds.ncovered [key];
+            const float *block_max = norm_bounds.block_max [key].data();
+            size_t nscan = 0;
+
+            for (size_t j0 = 0; j0 < list_size; ) {
+                // the entries that are not covered are scanned at once
+                size_t j1 = j0 < ncovered ?
+                    std::min (j0 + bs, ncovered) : list_size;
+                if (j0 < ncovered && norm_prunable (block_max [j0 / bs],
+                                                    simi)) {
+                    nnorm_pruned += j1 - j0;
+                } else {
+                    nheap += scanner->scan_codes (
+                          j1 - j0, codes + j0 * code_size,
+                          ids ? ids + j0 : nullptr, simi, idxi, k);
+                    nscan += j1 - j0;
+                }
+                j0 = j1;
+            }
+            return nscan;
+        };
+
         // single list scan using the current scanner (with query
         // set porperly) and storing results in simi and idxi
         auto scan_one_list = [&] (idx_t key, float coarse_dis_i,
@@ -376,6 +746,13 @@ void IndexIVF::search_preassigned (idx_t n, const float *x, idx_t k,
                 return (size_t)0;
             }
 
+            if (use_norm_bounds &&
+                norm_bounds.ncovered [key] == list_size &&
+                norm_prunable (norm_bounds.list_max [key], simi)) {
+                nnorm_pruned += list_size;
+                return (size_t)0;
+            }
+
             scanner->set_list (key, coarse_dis_i);
 
             nlistv++;
@@ -386,13 +763,26 @@ void IndexIVF::search_preassigned (idx_t n, const float *x, idx_t k,
                 std::unique_ptr<InvertedLists::ScopedIds> sids;
                 const Index::idx_t * ids = nullptr;
 
-                if (!store_pairs)  {
+                if (!store_pairs || scanner->sel)  {
                     sids.reset (new InvertedLists::ScopedIds (invlists, key));
                     ids = sids->get();
                 }
 
-                nheap += scanner->scan_codes (list_size, scodes.get(),
-                                              ids, simi, idxi, k);
+                if (use_norm_blocks) {
+                    return scan_blocks (key, list_size, scodes.get(), ids,
+                                        simi, idxi);
+                } else if (!use_reservoir) {
+                    nheap += scanner->scan_codes (list_size, scodes.get(),
+                                                  ids, simi, idxi, k);
+                } else if (metric_type == METRIC_INNER_PRODUCT) {
+                    nheap += scan_list_reservoir (
+                          scanner, list_size, scodes.get(), code_size,
+                          ids, store_pairs, key, res_ip);
+                } else {
+                    nheap += scan_list_reservoir (
+                          scanner, list_size, scodes.get(), code_size,
+                          ids, store_pairs, key, res_l2);
+                }
 
             } catch(const std::exception & e) {
                 std::lock_guard<std::mutex> lock(exception_mutex);
@@ -405,6 +795,13 @@ void IndexIVF::search_preassigned (idx_t n, const float *x, idx_t k,
             return list_size;
         };
 
+        auto prefetch_probe = [&] (idx_t key) {
+            if (key >= 0 && key < (idx_t) nlist) {
+                invlists->prefetch_list_head (key, prefetch_bytes);
+                scanner->prefetch_list (key);
+            }
+        };
+
         /****************************************************
          * Actual loops, depending on parallel_mode
          ****************************************************/
@@ -420,29 +817,81 @@ void IndexIVF::search_preassigned (idx_t n, const float *x, idx_t k,
 
                 // loop over queries
                 scanner->set_query (x + i * d);
+                scanner->set_query_lists (nprobe, keys + i * nprobe);
+                if (use_norm_bounds) {
+                    query_norm = sqrtf (fvec_norm_L2sqr (x + i * d, d));
+                }
                 float * simi = distances + i * k;
                 idx_t * idxi = labels + i * k;
 
-                init_result (simi, idxi);
+                if (use_reservoir) {
+                    init_reservoir ();
+                } else {
+                    init_result (simi, idxi);
+                }
 
                 long nscan = 0;
+                size_t nstable = 0;
+                const idx_t *keysi = keys + i * nprobe;
+
+                for (size_t ik = 0; ik < prefetch_distance && ik < nprobe;
+                     ik++) {
+                    prefetch_probe (keysi[ik]);
+                }
 
                 // loop over probes
                 for (size_t ik = 0; ik < nprobe; ik++) {
 
-                    nscan += scan_one_list (
+                    // at least one list is scanned to have some results
+                    if (deadline_ms > 0 && ik > 0 &&
+                        getmillisecs () > deadline_ms) {
+                        if (truncated) {
+                            truncated[i] = 1;
+                        }
+                        ntruncated++;
+                        break;
+                    }
+
+                    if (prefetch_distance > 0 &&
+                        ik + prefetch_distance < nprobe) {
+                        prefetch_probe (keysi[ik + prefetch_distance]);
+                    }
+
+                    if (early_stop_ratio > 0 && ik > 0 &&
+                        coarse_dis[i * nprobe + ik] >
+                            early_stop_ratio * kth_distance (simi)) {
+                        nearly_stop++;
+                        break;
+                    }
+
+                    size_t nheap0 = nheap;
+                    size_t list_size = scan_one_list (
                          keys [i * nprobe + ik],
                          coarse_dis[i * nprobe + ik],
                          simi, idxi
                     );
+                    nscan += list_size;
 
                     if (max_codes && nscan >= max_codes) {
                         break;
                     }
+
+                    if (early_stop_stable && list_size > 0) {
+                        nstable = nheap == nheap0 ? nstable + 1 : 0;
+                        if (nstable >= early_stop_stable &&
+                            ik + 1 < nprobe) {
+                            nearly_stop++;
+                            break;
+                        }
+                    }
                 }
 
                 ndis += nscan;
-                reorder_result (simi, idxi);
+                if (use_reservoir) {
+                    reservoir_to_result (simi, idxi);
+                } else {
+                    reorder_result (simi, idxi);
+                }
 
                 if (InterruptCallback::is_interrupted ()) {
                     interrupt = true;
@@ -512,6 +961,44 @@ void IndexIVF::search_preassigned (idx_t n, const float *x, idx_t k,
             for (int64_t i = 0; i < n; i++) {
                 reorder_result (distances + i * k, labels + i * k);
             }
+        } else if (pmode == 3) {
+            // each list is scanned once for all the queries that probe
+            // it, the results go to the heaps of the thread
+            int rank = omp_get_thread_num ();
+            float *local_dis = th_dis.data() + rank * n * k;
+            idx_t *local_idx = th_ids.data() + rank * n * k;
+
+#pragma omp for schedule(dynamic)
+            for (idx_t l = 0; l < nlist; l++) {
+                if (interrupt) {
+                    continue;
+                }
+                for (size_t jj = list_lims[l]; jj < list_lims[l + 1]; jj++) {
+                    idx_t ij = list_probes[jj];
+                    idx_t i = ij / nprobe;
+                    scanner->set_query (x + i * d);
+                    ndis += scan_one_list (
+                            l, coarse_dis[ij],
+                            local_dis + i * k, local_idx + i * k);
+                }
+                if (InterruptCallback::is_interrupted ()) {
+                    interrupt = true;
+                }
+            }
+
+            // merge the per-thread results (implicit barrier above)
+#pragma omp for
+            for (idx_t i = 0; i < n; i++) {
+                float * simi = distances + i * k;
+                idx_t * idxi = labels + i * k;
+                init_result (simi, idxi);
+                for (int r = 0; r < nt_lists; r++) {
+                    add_local_results (th_dis.data() + (r * n + i) * k,
+                                       th_ids.data() + (r * n + i) * k,
+                                       simi, idxi);
+                }
+                reorder_result (simi, idxi);
+            }
         } else {
             FAISS_THROW_FMT ("parallel_mode %d not supported\n",
                              pmode);
@@ -531,6 +1018,16 @@ void IndexIVF::search_preassigned (idx_t n, const float *x, idx_t k,
     indexIVF_stats.nlist += nlistv;
     indexIVF_stats.ndis += ndis;
     indexIVF_stats.nheap_updates += nheap;
+    indexIVF_stats.nearly_stop += nearly_stop;
+    indexIVF_stats.ntruncated += ntruncated;
+    indexIVF_stats.nnorm_pruned += nnorm_pruned;
+
+    if (instrumentation_enabled) {
+        instrumentation_count (COUNTER_NQ, n);
+        instrumentation_count (COUNTER_NLIST, nlistv);
+        instrumentation_count (COUNTER_NDIS, ndis);
+        instrumentation_count (COUNTER_BYTES_SCANNED, ndis * code_size);
+    }
 
 }
 
@@ -540,18 +1037,18 @@ void IndexIVF::search_preassigned (idx_t n, const float *x, idx_t k,
 void IndexIVF::range_search (idx_t nx, const float *x, float radius,
                              RangeSearchResult *result) const
 {
-    std::unique_ptr<idx_t[]> keys (new idx_t[nx * nprobe]);
-    std::unique_ptr<float []> coarse_dis (new float[nx * nprobe]);
+    ScratchBuffer keys_buf, coarse_dis_buf;
+    idx_t *keys = keys_buf.get<idx_t> (nx * nprobe);
+    float *coarse_dis = coarse_dis_buf.get<float> (nx * nprobe);
 
     double t0 = getmillisecs();
-    quantizer->search (nx, x, nprobe, coarse_dis.get (), keys.get ());
+    quantizer->search (nx, x, nprobe, coarse_dis, keys);
     indexIVF_stats.quantization_time += getmillisecs() - t0;
 
     t0 = getmillisecs();
-    invlists->prefetch_lists (keys.get(), nx * nprobe);
+    invlists->prefetch_lists (keys, nx * nprobe);
 
-    range_search_preassigned (nx, x, radius, keys.get (), coarse_dis.get (),
-                              result);
+    range_search_preassigned (nx, x, radius, keys, coarse_dis, result);
 
     indexIVF_stats.search_time += getmillisecs() - t0;
 }
@@ -565,6 +1062,15 @@ void IndexIVF::range_search_preassigned (
 {
     long nprobe = params ? params->nprobe : this->nprobe;
     long max_codes = params ? params->max_codes : this->max_codes;
+    const IDSelector *sel = params ? params->sel : nullptr;
+    IDSelectorNotDeleted sel_not_deleted (sel);
+    if (ntombstones > 0) {
+        sel = &sel_not_deleted;
+    }
+
+    // the list-major mode 3 is for kNN search, range search falls back
+    // to parallelizing over the queries
+    int pmode = parallel_mode == 3 ? 0 : parallel_mode;
 
     size_t nlistv = 0, ndis = 0;
 
@@ -580,6 +1086,7 @@ void IndexIVF::range_search_preassigned (
         std::unique_ptr<InvertedListScanner> scanner
             (get_InvertedListScanner(store_pairs));
         FAISS_THROW_IF_NOT (scanner.get ());
+        scanner->sel = sel;
         all_pres[omp_get_thread_num()] = &pres;
 
         // prepare the list scanning function
@@ -616,21 +1123,29 @@ void IndexIVF::range_search_preassigned (
 
         };
 
-        if (parallel_mode == 0) {
+        if (pmode == 0) {
 
 #pragma omp for
             for (idx_t i = 0; i < nx; i++) {
                 scanner->set_query (x + i * d);
 
                 RangeQueryResult & qres = pres.new_result (i);
+                const idx_t *keysi = keys + i * nprobe;
 
                 for (size_t ik = 0; ik < nprobe; ik++) {
+                    size_t ik2 = ik + prefetch_distance;
+                    if (prefetch_distance > 0 && ik2 < nprobe &&
+                        keysi[ik2] >= 0 && keysi[ik2] < (idx_t) nlist) {
+                        invlists->prefetch_list_head (
+                              keysi[ik2], prefetch_bytes);
+                        scanner->prefetch_list (keysi[ik2]);
+                    }
                     scan_list_func (i, ik, qres);
                 }
 
             }
 
-        } else if (parallel_mode == 1) {
+        } else if (pmode == 1) {
 
             for (size_t i = 0; i < nx; i++) {
                 scanner->set_query (x + i * d);
@@ -642,7 +1157,7 @@ void IndexIVF::range_search_preassigned (
                     scan_list_func (i, ik, qres);
                 }
             }
-        } else if (parallel_mode == 2) {
+        } else if (pmode == 2) {
             std::vector<RangeQueryResult *> all_qres (nx);
             RangeQueryResult *qres = nullptr;
 
@@ -658,9 +1173,9 @@ void IndexIVF::range_search_preassigned (
                 scan_list_func (i, ik, *qres);
             }
         } else {
-            FAISS_THROW_FMT ("parallel_mode %d not supported\n", parallel_mode);
+            FAISS_THROW_FMT ("parallel_mode %d not supported\n", pmode);
         }
-        if (parallel_mode == 0) {
+        if (pmode == 0) {
             pres.finalize ();
         } else {
 #pragma omp barrier
@@ -720,6 +1235,96 @@ void IndexIVF::reconstruct_n (idx_t i0, idx_t ni, float* recons) const
 }
 
 
+void IndexIVF::reconstruct_batch (idx_t n, const idx_t *keys,
+                                  float* recons) const
+{
+    // (list_no, rank in keys), sorted by list
+    std::vector<std::pair<idx_t, idx_t> > entries (n);
+    std::vector<int64_t> offsets (n);
+    for (idx_t i = 0; i < n; i++) {
+        idx_t lo = direct_map.get (keys[i]);
+        entries[i] = std::make_pair (lo_listno(lo), i);
+        offsets[i] = lo_offset(lo);
+    }
+    std::sort (entries.begin(), entries.end());
+
+    std::vector<size_t> group_begins;
+    for (idx_t i = 0; i < n; i++) {
+        if (i == 0 || entries[i].first != entries[i - 1].first) {
+            group_begins.push_back (i);
+        }
+    }
+    size_t ngroup = group_begins.size();
+    group_begins.push_back (n);
+
+    bool interrupt = false;
+    std::mutex exception_mutex;
+    std::string exception_string;
+
+#pragma omp parallel if (n > 1000)
+    {
+        std::vector<int64_t> group_offsets;
+        std::vector<float> buf;
+
+#pragma omp for schedule(dynamic)
+        for (size_t g = 0; g < ngroup; g++) {
+            if (interrupt) {
+                continue;
+            }
+            size_t j0 = group_begins[g], j1 = group_begins[g + 1];
+            group_offsets.resize (j1 - j0);
+            for (size_t j = j0; j < j1; j++) {
+                group_offsets[j - j0] = offsets[entries[j].second];
+            }
+            buf.resize ((j1 - j0) * d);
+            try {
+                reconstruct_from_offsets (
+                      entries[j0].first, j1 - j0, group_offsets.data(),
+                      buf.data());
+            } catch (const std::exception & e) {
+                std::lock_guard<std::mutex> lock (exception_mutex);
+                exception_string =
+                    demangle_cpp_symbol (typeid(e).name()) + "  " + e.what();
+                interrupt = true;
+                continue;
+            }
+            for (size_t j = j0; j < j1; j++) {
+                memcpy (recons + entries[j].second * d,
+                        buf.data() + (j - j0) * d, sizeof(float) * d);
+            }
+        }
+    }
+
+    if (interrupt) {
+        FAISS_THROW_FMT ("reconstruct_batch failed with: %s",
+                         exception_string.c_str());
+    }
+}
+
+
+MemoryUsage IndexIVF::memory_usage () const
+{
+    MemoryUsage mu = Index::memory_usage ();
+    if (quantizer) {
+        mu.add ("quantizer", quantizer->memory_usage ());
+    }
+    if (invlists) {
+        mu.add ("invlists", invlists->memory_usage ());
+    }
+    if (!direct_map.no ()) {
+        mu.add ("direct_map", direct_map.memory_usage ());
+    }
+    if (!norm_bounds.empty ()) {
+        MemoryUsage & nb = mu.add (MemoryUsage ("norm_bounds"));
+        nb.add ("list_max", norm_bounds.list_max);
+        nb.add ("block_max", norm_bounds.block_max);
+        nb.add ("ncovered", norm_bounds.ncovered);
+    }
+    mu.add ("list_ntombstones", list_ntombstones);
+    return mu;
+}
+
+
 /* standalone codec interface */
 size_t IndexIVF::sa_code_size () const
 {
@@ -782,38 +1387,372 @@ void IndexIVF::reconstruct_from_offset(
   FAISS_THROW_MSG ("reconstruct_from_offset not implemented");
 }
 
+void IndexIVF::reconstruct_from_offsets (
+        int64_t list_no, size_t n, const int64_t *offsets,
+        float* recons) const
+{
+    for (size_t j = 0; j < n; j++) {
+        reconstruct_from_offset (list_no, offsets[j], recons + j * d);
+    }
+}
+
 void IndexIVF::reset ()
 {
     direct_map.clear ();
     invlists->reset ();
     ntotal = 0;
+    ntombstones = 0;
+    list_ntombstones.clear ();
+    norm_bounds.clear ();
+}
+
+
+namespace {
+
+/// mark the entries of sel as deleted, returns the nb of marked entries
+size_t mark_deleted (IndexIVF & ivf, const IDSelector & sel)
+{
+    using idx_t = Index::idx_t;
+    InvertedLists *invlists = ivf.invlists;
+    DirectMap & direct_map = ivf.direct_map;
+    size_t nlist = ivf.nlist;
+
+    if (ivf.ntombstones == 0) {
+        ivf.list_ntombstones.assign (nlist, 0);
+    }
+    std::vector<size_t> & list_ntombstones = ivf.list_ntombstones;
+    bool known = list_ntombstones.size() == nlist;
+    size_t nremove = 0;
+
+    auto mark_entry = [&] (idx_t list_no, idx_t offset) {
+        invlists->update_entry (list_no, offset, -1,
+                                ScopedCodes (invlists, list_no, offset).get());
+    };
+
+    const IDSelectorArray *sela = dynamic_cast<const IDSelectorArray*>(&sel);
+    const IDSelectorBatch *selb = dynamic_cast<const IDSelectorBatch*>(&sel);
+
+    if (!direct_map.no() && (sela || selb)) {
+        // locate the entries with the direct map
+        auto mark_id = [&] (idx_t id) {
+            idx_t lo = direct_map.find (id);
+            if (lo < 0) {
+                return;
+            }
+            mark_entry (lo_listno (lo), lo_offset (lo));
+            direct_map.erase_id (id);
+            if (known) {
+                list_ntombstones [lo_listno (lo)]++;
+            }
+            nremove++;
+        };
+        if (sela) {
+            for (size_t i = 0; i < sela->n; i++) {
+                mark_id (sela->ids[i]);
+            }
+        } else {
+            for (idx_t id : selb->set) {
+                mark_id (id);
+            }
+        }
+        return nremove;
+    }
+
+    // scan the ids of all the lists. Only the entries to remove are
+    // written to
+    std::vector<std::vector<idx_t> > removed_ids (nlist);
+#pragma omp parallel for reduction(+: nremove)
+    for (idx_t list_no = 0; list_no < nlist; list_no++) {
+        size_t list_size = invlists->list_size (list_no);
+        if (list_size == 0) {
+            continue;
+        }
+        ScopedIds ids (invlists, list_no);
+        size_t nr = 0;
+        for (size_t j = 0; j < list_size; j++) {
+            idx_t id = ids[j];
+            if (id != -1 && sel.is_member (id)) {
+                mark_entry (list_no, j);
+                if (!direct_map.no()) {
+                    removed_ids[list_no].push_back (id);
+                }
+                nr++;
+            }
+        }
+        if (known) {
+            list_ntombstones [list_no] += nr;
+        }
+        nremove += nr;
+    }
+    for (size_t list_no = 0; list_no < nlist; list_no++) {
+        for (idx_t id : removed_ids[list_no]) {
+            direct_map.erase_id (id);
+        }
+    }
+    return nremove;
 }
 
+} // anonymous namespace
+
 
 size_t IndexIVF::remove_ids (const IDSelector & sel)
 {
-    size_t nremove = direct_map.remove_ids (sel, invlists);
+    size_t nremove;
+    if (lazy_remove) {
+        nremove = mark_deleted (*this, sel);
+        ntombstones += nremove;
+    } else {
+        nremove = direct_map.remove_ids (sel, invlists);
+        norm_bounds.clear ();
+    }
     ntotal -= nremove;
     return nremove;
 }
 
 
-void IndexIVF::update_vectors (int n, const idx_t *new_ids, const float *x)
+size_t IndexIVF::purge_tombstones (float min_ratio)
 {
+    if (ntombstones == 0) {
+        return 0;
+    }
+    // if the per-list counts are unknown they are computed on the way
+    bool known = list_ntombstones.size() == nlist;
+    std::vector<size_t> counts (nlist);
+    size_t nremove = 0;
 
-    if (direct_map.type == DirectMap::Hashtable) {
-        // just remove then add
-        IDSelectorArray sel(n, new_ids);
-        size_t nremove = remove_ids (sel);
-        FAISS_THROW_IF_NOT_MSG (nremove == n,
-                                "did not find all entries to remove");
-        add_with_ids (n, x, new_ids);
-        return;
+    for (size_t list_no = 0; list_no < nlist; list_no++) {
+        size_t list_size = invlists->list_size (list_no);
+        if (list_size == 0 || (known && list_ntombstones[list_no] == 0)) {
+            continue;
+        }
+        if (known && list_ntombstones[list_no] < min_ratio * list_size) {
+            counts[list_no] = list_ntombstones[list_no];
+            continue;
+        }
+        std::vector<idx_t> ids (list_size);
+        {
+            ScopedIds sids (invlists, list_no);
+            std::copy (sids.get(), sids.get() + list_size, ids.begin());
+        }
+        size_t nt = std::count (ids.begin(), ids.end(), (idx_t)-1);
+        counts[list_no] = nt;
+        if (nt == 0 || nt < min_ratio * list_size) {
+            continue;
+        }
+
+        // fill the holes with the last live entries
+        size_t j = 0, l = list_size;
+        for (;;) {
+            while (j < l && ids[j] != -1) {
+                j++;
+            }
+            while (l > j && ids[l - 1] == -1) {
+                l--;
+            }
+            if (j + 1 >= l) {
+                break;
+            }
+            l--;
+            invlists->update_entry (list_no, j, ids[l],
+                                    ScopedCodes (invlists, list_no, l).get());
+            direct_map.set_id (ids[l], lo_build (list_no, j));
+            ids[j] = ids[l];
+            j++;
+        }
+        FAISS_THROW_IF_NOT (list_size - l == nt);
+        invlists->resize (list_no, l);
+        counts[list_no] = 0;
+        nremove += nt;
+    }
+
+    list_ntombstones.swap (counts);
+    norm_bounds.clear ();
+    ntombstones = 0;
+    for (size_t nt : list_ntombstones) {
+        ntombstones += nt;
+    }
+    return nremove;
+}
+
+
+bool IndexIVF::codes_depend_on_list () const
+{
+    // conservative default: the moved entries are re-encoded
+    return true;
+}
+
+Index::idx_t IndexIVF::split_list (idx_t list_no, int niter)
+{
+    FAISS_THROW_IF_NOT (list_no >= 0 && list_no < nlist);
+    ArrayInvertedLists *ails = dynamic_cast<ArrayInvertedLists*> (invlists);
+    FAISS_THROW_IF_NOT_MSG (ails, "split_list requires ArrayInvertedLists");
+    IndexFlat *qflat = dynamic_cast<IndexFlat*> (quantizer);
+    FAISS_THROW_IF_NOT_MSG (qflat && !dynamic_cast<IndexFlat1D*> (quantizer),
+                            "split_list requires a flat quantizer");
+    FAISS_THROW_IF_NOT (quantizer->ntotal == nlist);
+
+    // live entries of the list
+    size_t list_size = invlists->list_size (list_no);
+    std::vector<idx_t> ids;
+    std::vector<int64_t> offsets;
+    {
+        ScopedIds sids (invlists, list_no);
+        for (size_t j = 0; j < list_size; j++) {
+            if (sids[j] != -1) {
+                ids.push_back (sids[j]);
+                offsets.push_back (j);
+            }
+        }
+    }
+    size_t n = ids.size();
+    if (n < 2) {
+        return -1;
+    }
+    std::vector<float> x (n * d);
+    reconstruct_from_offsets (list_no, n, offsets.data(), x.data());
+
+    // 2-means on the entries of the list
+    std::vector<float> c_old (d), c_keep (d), c_new (d);
+    quantizer->reconstruct (list_no, c_old.data());
+    {
+        Clustering clus (d, 2);
+        clus.niter = niter;
+        clus.verbose = false;
+        IndexFlat assign_index (d, quantizer->metric_type);
+        clus.train (n, x.data(), assign_index);
+        const float *c0 = clus.centroids.data();
+        const float *c1 = c0 + d;
+        if (fvec_L2sqr (c1, c_old.data(), d) <
+            fvec_L2sqr (c0, c_old.data(), d)) {
+            std::swap (c0, c1);
+        }
+        std::copy (c0, c0 + d, c_keep.begin());
+        std::copy (c1, c1 + d, c_new.begin());
     }
 
-    FAISS_THROW_IF_NOT (direct_map.type == DirectMap::Array);
-    // here it is more tricky because we don't want to introduce holes
-    // in continuous range of ids
+    bool ip = quantizer->metric_type == METRIC_INNER_PRODUCT;
+    std::vector<bool> moved (n);
+    size_t nmoved = 0;
+    for (size_t i = 0; i < n; i++) {
+        const float *xi = x.data() + i * d;
+        moved[i] = ip ?
+            fvec_inner_product (xi, c_new.data(), d) >
+                fvec_inner_product (xi, c_keep.data(), d) :
+            fvec_L2sqr (xi, c_new.data(), d) <
+                fvec_L2sqr (xi, c_keep.data(), d);
+        if (moved[i]) {
+            nmoved++;
+        }
+    }
+    if (nmoved == 0) {
+        return -1;
+    }
+
+    std::vector<uint8_t> codes (n * code_size);
+    {
+        ScopedCodes scodes (invlists, list_no);
+        for (size_t i = 0; i < n; i++) {
+            memcpy (codes.data() + i * code_size,
+                    scodes.get() + offsets[i] * code_size, code_size);
+        }
+    }
+
+    // the closest 2-means centroid replaces the one of the list
+    qflat->xb.make_owned ();
+    memcpy (qflat->xb.data() + list_no * d, c_keep.data(),
+            sizeof (float) * d);
+    quantizer->add (1, c_new.data());
+    FAISS_THROW_IF_NOT (quantizer->ntotal == nlist + 1);
+    idx_t new_list = ails->add_list ();
+    nlist++;
+    FAISS_THROW_IF_NOT (new_list == nlist - 1);
+
+    std::vector<idx_t> keep_ids, move_ids;
+    std::vector<uint8_t> keep_codes, move_codes;
+    std::vector<float> keep_x, move_x;
+    for (size_t i = 0; i < n; i++) {
+        const uint8_t *code = codes.data() + i * code_size;
+        const float *xi = x.data() + i * d;
+        if (moved[i]) {
+            move_ids.push_back (ids[i]);
+            move_codes.insert (move_codes.end(), code, code + code_size);
+            move_x.insert (move_x.end(), xi, xi + d);
+        } else {
+            keep_ids.push_back (ids[i]);
+            keep_codes.insert (keep_codes.end(), code, code + code_size);
+            keep_x.insert (keep_x.end(), xi, xi + d);
+        }
+    }
+    if (codes_depend_on_list ()) {
+        // both centroids changed: re-encode the two lists
+        std::vector<idx_t> list_nos (keep_ids.size(), list_no);
+        encode_vectors (keep_ids.size(), keep_x.data(), list_nos.data(),
+                        keep_codes.data());
+        list_nos.assign (nmoved, new_list);
+        encode_vectors (nmoved, move_x.data(), list_nos.data(),
+                        move_codes.data());
+    }
+
+    invlists->resize (list_no, 0);
+    invlists->add_entries (list_no, keep_ids.size(),
+                           keep_ids.data(), keep_codes.data());
+    invlists->add_entries (new_list, nmoved,
+                           move_ids.data(), move_codes.data());
+
+    for (size_t j = 0; j < keep_ids.size(); j++) {
+        direct_map.set_id (keep_ids[j], lo_build (list_no, j));
+    }
+    for (size_t j = 0; j < nmoved; j++) {
+        direct_map.set_id (move_ids[j], lo_build (new_list, j));
+    }
+
+    // the deleted entries of the list were dropped
+    ntombstones -= list_size - n;
+    if (list_ntombstones.size() == nlist - 1) {
+        list_ntombstones[list_no] = 0;
+        list_ntombstones.push_back (0);
+    } else {
+        list_ntombstones.clear ();
+    }
+    norm_bounds.clear ();
+
+    return new_list;
+}
+
+size_t IndexIVF::split_large_lists (double max_ratio, int niter)
+{
+    size_t nsplit = 0;
+    for (size_t nlist0 = nlist; nsplit < nlist0; nsplit++) {
+        size_t lmax = 0, smax = 0, tot = 0;
+        for (size_t l = 0; l < nlist; l++) {
+            size_t sz = invlists->list_size (l);
+            tot += sz;
+            if (sz > smax) {
+                smax = sz;
+                lmax = l;
+            }
+        }
+        if (smax <= max_ratio * tot / nlist) {
+            break;
+        }
+        if (verbose) {
+            printf ("IndexIVF::split_large_lists: splitting list %zd "
+                    "of size %zd\n", lmax, smax);
+        }
+        if (split_list (lmax, niter) < 0) {
+            break;
+        }
+    }
+    return nsplit;
+}
+
+
+void IndexIVF::update_vectors (int n, const idx_t *new_ids, const float *x)
+{
+    FAISS_THROW_IF_NOT_MSG (!direct_map.no(),
+                            "update_vectors requires a direct map");
+    // the entries are moved in place, so that there are no holes in
+    // a continuous range of ids for the Array direct map
 
     FAISS_THROW_IF_NOT (is_trained);
     std::vector<idx_t> assign (n);
@@ -823,6 +1762,7 @@ void IndexIVF::update_vectors (int n, const idx_t *new_ids, const float *x)
     encode_vectors (n, x, assign.data(), flat_codes.data());
 
     direct_map.update_codes (invlists, n, new_ids, assign.data(), flat_codes.data());
+    norm_bounds.clear ();
 
 }
 
@@ -867,11 +1807,14 @@ void IndexIVF::check_compatible_for_merge (const IndexIVF &other) const
 void IndexIVF::merge_from (IndexIVF &other, idx_t add_id)
 {
     check_compatible_for_merge (other);
+    FAISS_THROW_IF_NOT_MSG (ntombstones == 0 && other.ntombstones == 0,
+                            "call purge_tombstones before merging");
 
     invlists->merge_from (other.invlists, add_id);
 
     ntotal += other.ntotal;
     other.ntotal = 0;
+    other.norm_bounds.clear ();
 }
 
 
@@ -882,11 +1825,26 @@ void IndexIVF::replace_invlists (InvertedLists *il, bool own)
     }
     // FAISS_THROW_IF_NOT (ntotal == 0);
     if (il) {
-        FAISS_THROW_IF_NOT (il->nlist == nlist &&
-                            il->code_size == code_size);
+        FAISS_THROW_IF_NOT (il->nlist == nlist);
+        FAISS_THROW_IF_NOT (
+              il->code_size == code_size ||
+              il->code_size == InvertedLists::INVALID_CODE_SIZE);
     }
     invlists = il;
     own_invlists = own;
+    norm_bounds.clear ();
+}
+
+
+void IndexIVF::compact ()
+{
+    FAISS_THROW_IF_NOT (is_trained && invlists);
+    InvertedLists *il = new CompactedInvertedLists (*invlists);
+    // the entries keep their order
+    IVFNormBounds bounds;
+    std::swap (bounds, norm_bounds);
+    replace_invlists (il, true);
+    std::swap (bounds, norm_bounds);
 }
 
 
@@ -897,6 +1855,8 @@ void IndexIVF::copy_subset_to (IndexIVF & other, int subset_type,
     FAISS_THROW_IF_NOT (nlist == other.nlist);
     FAISS_THROW_IF_NOT (code_size == other.code_size);
     FAISS_THROW_IF_NOT (other.direct_map.no());
+    FAISS_THROW_IF_NOT_MSG (ntombstones == 0,
+                            "call purge_tombstones before copying");
     FAISS_THROW_IF_NOT_FMT (
           subset_type == 0 || subset_type == 1 || subset_type == 2,
           "subset type %d not implemented", subset_type);
@@ -66,10 +66,17 @@ struct Level1Quantizer {
 
 
 
-struct IVFSearchParameters {
+/** Search parameters for the IVF indexes, they override the
+ * corresponding fields of IndexIVF for one search call */
+struct IVFSearchParameters: SearchParameters {
     size_t nprobe;            ///< number of probes at query time
     size_t max_codes;         ///< max nb of codes to visit to do a query
-    IVFSearchParameters(): nprobe(1), max_codes(0) {}
+    float early_stop_ratio;   ///< see IndexIVF::early_stop_ratio
+    size_t early_stop_stable; ///< see IndexIVF::early_stop_stable
+    /// parameters for the coarse quantizer search (not owned)
+    SearchParameters *quantizer_params;
+    IVFSearchParameters(): nprobe(1), max_codes(0), early_stop_ratio(0),
+                           early_stop_stable(0), quantizer_params(nullptr) {}
     virtual ~IVFSearchParameters () {}
 };
 
@@ -77,6 +84,39 @@ struct IVFSearchParameters {
 
 struct InvertedListScanner;
 
+
+/** Upper bounds on the norms of the vectors stored in the inverted lists,
+ * used to prune the inner product search: by Cauchy-Schwarz, an entry of
+ * norm at most M has an inner product at most |q| * M with query q, so a
+ * list or a block of a list whose bound does not beat the current k-th
+ * result is skipped.
+ *
+ * The norms are those of the reconstructed vectors (centroid included),
+ * whose inner product with the query is what the scanners of the IVF
+ * indexes compute. The bounds cover the first ncovered[l] entries of list
+ * l; entries appended later are scanned without pruning until the bounds
+ * are updated. */
+struct IVFNormBounds {
+    /// nb of entries per block, 0 if there are no bounds
+    size_t block_size;
+
+    /// max norm over the covered entries of each list
+    std::vector<float> list_max;
+
+    /// max norm of each block of block_size entries of each list
+    std::vector<std::vector<float> > block_max;
+
+    /// nb of entries of each list covered by the bounds
+    std::vector<size_t> ncovered;
+
+    IVFNormBounds (): block_size (0) {}
+
+    bool empty () const { return block_size == 0; }
+
+    void clear ();
+};
+
+
 /** Index based on a inverted file (IVF)
  *
  * In the inverted file, the quantizer (an Index instance) provides a
@@ -107,11 +147,38 @@ struct IndexIVF: Index, Level1Quantizer {
     size_t nprobe;            ///< number of probes at query time
     size_t max_codes;         ///< max nb of codes to visit to do a query
 
+    /** Adaptive nprobe: the probes of a query are visited by increasing
+     * coarse distance, and probing stops before nprobe lists when
+     *
+     * - early_stop_ratio > 0 (L2 only): the coarse distance of the next
+     *   list exceeds early_stop_ratio times the current k-th result
+     *   distance. Both are squared L2 distances, so 1 stops as soon as
+     *   the centroid is farther than the k-th result; larger values are
+     *   more conservative.
+     * - early_stop_stable > 0: the last early_stop_stable non-empty
+     *   lists did not update the results.
+     *
+     * Only used for parallel_mode 0. The nb of queries that stopped
+     * early is in indexIVF_stats.nearly_stop.
+     *
+     * With a deadline (SearchParameters::deadline_ms), probing also stops
+     * after the first list once the deadline is passed, see
+     * indexIVF_stats.ntruncated.
+     */
+    float early_stop_ratio;
+    size_t early_stop_stable;
+
     /** Parallel mode determines how queries are parallelized with OpenMP
      *
      * 0 (default): parallelize over queries
      * 1: parallelize over inverted lists
      * 2: parallelize over both
+     * 3: list-major, parallelize over inverted lists: each list is
+     *    scanned once for all the queries that probe it, while it is
+     *    in cache. The results are collected in per-thread heaps for
+     *    all queries (nb of threads * n * k entries), merged at the end.
+     *    max_codes is not applied. For IndexIVFFlat the queries of a
+     *    list are scored with a GEMM. Range search uses mode 0 instead.
      *
      * PARALLEL_MODE_NO_HEAP_INIT: binary or with the previous to
      * prevent the heap to be initialized and finalized
@@ -119,10 +186,60 @@ struct IndexIVF: Index, Level1Quantizer {
     int parallel_mode;
     const int PARALLEL_MODE_NO_HEAP_INIT = 1024;
 
+    /** if > 0, searches with k >= reservoir_min_k collect the results of
+     * each query in a reservoir that is partitioned with partition_fuzzy
+     * when full, instead of a heap. This is faster for large k. It
+     * relies on InvertedListScanner::distance_to_code, so scanner-specific
+     * filtering (eg. polysemous) is not applied. Only used for
+     * parallel_mode 0.
+     */
+    size_t reservoir_min_k;
+
+    /** software prefetching in the scan of a query (parallel_mode 0):
+     * while list ik is scanned, the head of list ik + prefetch_distance
+     * (prefetch_bytes of codes and the first ids, see
+     * InvertedLists::prefetch_list_head) and its look-up table (see
+     * InvertedListScanner::prefetch_list) are prefetched, so that the
+     * scan of short lists does not start with cache misses. 0 disables.
+     */
+    size_t prefetch_distance;
+    size_t prefetch_bytes;
+
+    /** if > 0, soft cap on the inverted list sizes, applied when adding
+     * vectors: a vector whose nearest list has max_list_size entries or
+     * more spills to the nearest of its spill_nprobe nearest lists that
+     * is below the cap. If they are all full, it goes to the nearest
+     * list anyway. This bounds the scan cost of the largest lists, but a
+     * spilled vector is found only if its list is probed. */
+    size_t max_list_size;
+    size_t spill_nprobe;
+
     /** optional map that maps back ids to invlist entries. This
      *  enables reconstruct() */
     DirectMap direct_map;
 
+    /** if true, remove_ids only marks the removed entries as deleted
+     * (tombstones), by setting their id to -1 in the inverted lists. With
+     * a direct map and an IDSelectorArray or IDSelectorBatch, each id is
+     * located in O(1). The deleted entries are skipped at search time,
+     * and physically removed by purge_tombstones. */
+    bool lazy_remove;
+
+    /// nb of deleted entries still in the inverted lists
+    size_t ntombstones;
+
+    /// same, per inverted list (empty if unknown, eg. after reading)
+    std::vector<size_t> list_ntombstones;
+
+    /** norm bounds for the pruning of inner product searches, empty
+     * unless compute_norm_bounds is called. Only used for parallel_mode 0
+     * without reservoir (and not by IndexIVFFlat::batch_queries). The
+     * pruning is exact, except for scanners with approximate distances
+     * (eg. IndexIVFPQ::quantized_lut). Not serialized. They remain valid when vectors
+     * are added, and are cleared by the other modifications of the
+     * inverted lists (except lazy removals). */
+    IVFNormBounds norm_bounds;
+
     /** The Inverted file takes a quantizer (an Index) on input,
      * which implements the function mapping a vector to a list
      * identifier. The pointer is borrowed: the quantizer should not
@@ -143,6 +260,14 @@ struct IndexIVF: Index, Level1Quantizer {
     /// default implementation that calls encode_vectors
     void add_with_ids(idx_t n, const float* x, const idx_t* xids) override;
 
+    /** assign the vectors to add to inverted lists, with the quantizer
+     * and the max_list_size policy. Used by all add_with_ids
+     * implementations.
+     *
+     * @param list_nos  output inverted list ids, size n
+     */
+    void assign_for_add (idx_t n, const float *x, idx_t *list_nos) const;
+
     /** Encodes a set of vectors as they would appear in the inverted lists
      *
      * @param list_nos   inverted list ids as returned by the
@@ -189,7 +314,8 @@ struct IndexIVF: Index, Level1Quantizer {
 
     /** assign the vectors, then call search_preassign */
     void search (idx_t n, const float *x, idx_t k,
-                 float *distances, idx_t *labels) const override;
+                 float *distances, idx_t *labels,
+                 const SearchParameters *params = nullptr) const override;
 
     void range_search (idx_t n, const float* x, float radius,
                        RangeSearchResult* result) const override;
@@ -204,7 +330,7 @@ struct IndexIVF: Index, Level1Quantizer {
     virtual InvertedListScanner *get_InvertedListScanner (
         bool store_pairs=false) const;
 
-    /** reconstruct a vector. Works only if maintain_direct_map is set to 1 or 2 */
+    /** reconstruct a vector. Works only if the direct map is maintained */
     void reconstruct (idx_t key, float* recons) const override;
 
     /** Update a subset of vectors.
@@ -228,6 +354,15 @@ struct IndexIVF: Index, Level1Quantizer {
      */
     void reconstruct_n(idx_t i0, idx_t ni, float* recons) const override;
 
+    /** Reconstruct the vectors of arbitrary ids. Works only if the direct
+     * map is maintained.
+     *
+     * The entries are grouped by inverted list, and the lists are
+     * decoded in parallel with reconstruct_from_offsets.
+     */
+    void reconstruct_batch (idx_t n, const idx_t *keys,
+                            float *recons) const override;
+
     /** Similar to search, but also reconstructs the stored vectors (or an
      * approximation in the case of lossy coding) for the search results.
      *
@@ -251,11 +386,56 @@ struct IndexIVF: Index, Level1Quantizer {
     virtual void reconstruct_from_offset (int64_t list_no, int64_t offset,
                                           float* recons) const;
 
+    /** Reconstruct n entries of a list, given their offsets in the list
+     * (size n), to recons (size n * d). The default implementation
+     * calls reconstruct_from_offset for each entry, subclasses
+     * override it to access the list and its centroid only once.
+     */
+    virtual void reconstruct_from_offsets (int64_t list_no, size_t n,
+                                           const int64_t *offsets,
+                                           float* recons) const;
+
 
     /// Dataset manipulation functions
 
     size_t remove_ids(const IDSelector& sel) override;
 
+    /** remove the deleted entries from the inverted lists where they
+     * are at least a fraction min_ratio of the list size. Only these
+     * lists are rewritten.
+     *
+     * @return nb of entries removed */
+    size_t purge_tombstones (float min_ratio = 0);
+
+    /** split an inverted list in two, without retraining the other
+     * lists: the entries of the list are clustered with a 2-means of
+     * niter iterations. The 2-means centroid that is the closest to the
+     * current one replaces it in the quantizer, the other one is added
+     * as a new list (number nlist - 1 on output), and the entries are
+     * assigned to the closest of the two.
+     *
+     * The entries keep their codes, unless codes_depend_on_list, in
+     * which case the entries of the two lists are re-encoded from their
+     * reconstruction. Requires ArrayInvertedLists,
+     * reconstruct_from_offset and an IndexFlat quantizer. The deleted
+     * entries of the list are dropped.
+     *
+     * With lossy codes, the reconstructions of a list can be too close to
+     * be separated, then no entry moves.
+     *
+     * @return the new list number, -1 if no entry would move */
+    virtual idx_t split_list (idx_t list_no, int niter = 10);
+
+    /** split the largest list while it has more than max_ratio times the
+     * average list size (at most nlist times, and until a split fails)
+     *
+     * @return nb of lists added */
+    size_t split_large_lists (double max_ratio, int niter = 10);
+
+    /// whether the codes are relative to the centroid of their list (eg.
+    /// residual encoding), so that a code cannot move to another list
+    virtual bool codes_depend_on_list () const;
+
     /** check that the two indexes are compatible (ie, they are
      * trained in the same way and have the same
      * parameters). Otherwise throw. */
@@ -290,16 +470,30 @@ struct IndexIVF: Index, Level1Quantizer {
 
     void set_direct_map_type (DirectMap::Type type);
 
+    /** compute the norm bounds of the entries that are not covered yet
+     * (all of them with a new block_size). Requires
+     * reconstruct_from_offset. Small blocks prune more, at the cost of
+     * more scan_codes calls. */
+    void compute_norm_bounds (size_t block_size = 64);
+
 
     /// replace the inverted lists, old one is deallocated if own_invlists
     void replace_invlists (InvertedLists *il, bool own=false);
 
+    /** replace the inverted lists with a CompactedInvertedLists that
+     * stores all codes and ids in two contiguous arenas. The index is then
+     * read-only: adding or removing vectors throws. */
+    void compact ();
+
     /* The standalone codec interface (except sa_decode that is specific) */
     size_t sa_code_size () const override;
 
     void sa_encode (idx_t n, const float *x,
                           uint8_t *bytes) const override;
 
+    /// quantizer, inverted lists, direct map and norm bounds
+    MemoryUsage memory_usage () const override;
+
     IndexIVF ();
 };
 
@@ -313,12 +507,29 @@ struct InvertedListScanner {
 
     using idx_t = Index::idx_t;
 
+    /// if set, the ids that are not members are skipped before their
+    /// distance is computed (not owned). The scan functions then need
+    /// the ids, even with store_pairs.
+    const IDSelector *sel;
+
+    InvertedListScanner (): sel (nullptr) {}
+
     /// from now on we handle this query.
     virtual void set_query (const float *query_vector) = 0;
 
+    /** optional, called after set_query with the lists that will be
+     * scanned for the query (some may be -1), so that the per-list
+     * preprocessing can be done in batch */
+    virtual void set_query_lists (size_t /* nlist */,
+                                  const idx_t * /* list_nos */) {}
+
     /// following codes come from this inverted list
     virtual void set_list (idx_t list_no, float coarse_dis) = 0;
 
+    /// optional, software prefetch of the per-list data (eg. look-up
+    /// tables) that set_list will use for list_no
+    virtual void prefetch_list (idx_t /* list_no */) const {}
+
     /// compute a single query-to-code distance
     virtual float distance_to_code (const uint8_t *code) const = 0;
 
@@ -359,6 +570,9 @@ struct IndexIVFStats {
     size_t nlist;    // nb of inverted lists scanned
     size_t ndis;     // nb of distancs computed
     size_t nheap_updates; // nb of times the heap was updated
+    size_t nearly_stop;   // nb of queries that stopped before nprobe lists
+    size_t ntruncated;    // nb of queries cut by their deadline
+    size_t nnorm_pruned;  // nb of codes skipped thanks to the norm bounds
     double quantization_time; // time spent quantizing vectors (in ms)
     double search_time;       // time spent searching lists (in ms)
 
@@ -9,17 +9,42 @@
 
 #include <faiss/IndexIVFFlat.h>
 
+#include <algorithm>
 #include <cinttypes>
+#include <cmath>
 #include <cstdio>
+#include <cstring>
+#include <memory>
+
+#include <omp.h>
 
 #include <faiss/IndexFlat.h>
 
 #include <faiss/utils/distances.h>
+#include <faiss/utils/extra_distances-inl.h>
 #include <faiss/utils/utils.h>
+#include <faiss/utils/Heap.h>
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/impl/AuxIndexStructures.h>
 
 
+#ifndef FINTEGER
+#define FINTEGER long
+#endif
+
+
+extern "C" {
+
+/* declare BLAS functions, see http://www.netlib.org/clapack/cblas/ */
+
+int sgemm_ (const char *transa, const char *transb, FINTEGER *m, FINTEGER *
+            n, FINTEGER *k, const float *alpha, const float *a,
+            FINTEGER *lda, const float *b, FINTEGER *
+            ldb, float *beta, float *c, FINTEGER *ldc);
+
+}
+
+
 namespace faiss {
 
 
@@ -29,7 +54,8 @@ namespace faiss {
 
 IndexIVFFlat::IndexIVFFlat (Index * quantizer,
                             size_t d, size_t nlist, MetricType metric):
-    IndexIVF (quantizer, d, nlist, sizeof(float) * d, metric)
+    IndexIVF (quantizer, d, nlist, sizeof(float) * d, metric),
+    batch_queries (false), early_abort_block (0)
 {
     code_size = sizeof(float) * d;
 }
@@ -55,7 +81,7 @@ void IndexIVFFlat::add_core (idx_t n, const float * x, const int64_t *xids,
     } else {
         int64_t * idx0 = new int64_t [n];
         del.set (idx0);
-        quantizer->assign (n, x, idx0);
+        assign_for_add (n, x, idx0);
         idx = idx0;
     }
     int64_t n_add = 0;
@@ -91,7 +117,8 @@ void IndexIVFFlat::encode_vectors(idx_t n, const float* x,
         memcpy (codes, x, code_size * n);
     } else {
         size_t coarse_size = coarse_code_size ();
-        for (size_t i = 0; i < n; i++) {
+#pragma omp parallel for if (n > 1000)
+        for (int64_t i = 0; i < n; i++) {
             int64_t list_no = list_nos [i];
             uint8_t *code = codes + i * (code_size + coarse_size);
             const float *xi = x + i * d;
@@ -110,13 +137,19 @@ void IndexIVFFlat::sa_decode (idx_t n, const uint8_t *bytes,
                                       float *x) const
 {
     size_t coarse_size = coarse_code_size ();
-    for (size_t i = 0; i < n; i++) {
+#pragma omp parallel for if (n > 1000)
+    for (idx_t i = 0; i < n; i++) {
         const uint8_t *code = bytes + i * (code_size + coarse_size);
         float *xi = x + i * d;
         memcpy (xi, code + coarse_size, code_size);
     }
 }
 
+bool IndexIVFFlat::codes_depend_on_list () const
+{
+    return false;
+}
+
 
 namespace {
 
@@ -125,9 +158,11 @@ template<MetricType metric, class C>
 struct IVFFlatScanner: InvertedListScanner {
     size_t d;
     bool store_pairs;
+    size_t early_abort_block;
 
-    IVFFlatScanner(size_t d, bool store_pairs):
-        d(d), store_pairs(store_pairs) {}
+    IVFFlatScanner(size_t d, bool store_pairs, size_t early_abort_block = 0):
+        d(d), store_pairs(store_pairs),
+        early_abort_block(early_abort_block) {}
 
     const float *xi;
     void set_query (const float *query) override {
@@ -146,6 +181,137 @@ struct IVFFlatScanner: InvertedListScanner {
         return dis;
     }
 
+    /// calls consumer (j, dis) for each vector of the list that passes
+    /// the selector, the distances are computed 4 vectors at a time.
+    /// With early abort, the L2 distances are computed one vector at a
+    /// time and the ones above *threshold are only lower bounds.
+    template<class Consumer>
+    void scan_list (size_t list_size, const uint8_t *codes,
+                    const idx_t *ids, Consumer & consumer,
+                    const float *threshold) const
+    {
+        const float *list_vecs = (const float*)codes;
+        if (metric == METRIC_L2 && early_abort_block > 0) {
+            for (size_t j = 0; j < list_size; j++) {
+                if (sel && !sel->is_member (ids[j])) continue;
+                consumer (j, fvec_L2sqr_early_abort (
+                                 xi, list_vecs + j * d, d, *threshold,
+                                 early_abort_block));
+            }
+            return;
+        }
+        if (!sel) {
+            // contiguous vectors: blocks of the kernels specialized for
+            // the common dimensions
+            const size_t bs = 64;
+            float dis[bs];
+            for (size_t j0 = 0; j0 < list_size; j0 += bs) {
+                size_t nj = std::min (bs, list_size - j0);
+                if (metric == METRIC_INNER_PRODUCT) {
+                    fvec_inner_products_ny_batch_4 (
+                          dis, xi, list_vecs + j0 * d, d, nj);
+                } else {
+                    fvec_L2sqr_ny_batch_4 (
+                          dis, xi, list_vecs + j0 * d, d, nj);
+                }
+                for (size_t j = 0; j < nj; j++) {
+                    consumer (j0 + j, dis[j]);
+                }
+            }
+            return;
+        }
+        size_t jbuf[4];
+        int nbuf = 0;
+        for (size_t j = 0; j < list_size; j++) {
+            if (sel && !sel->is_member (ids[j])) continue;
+            jbuf[nbuf++] = j;
+            if (nbuf < 4) continue;
+            float dis[4];
+            if (metric == METRIC_INNER_PRODUCT) {
+                fvec_inner_product_batch_4 (
+                     xi, list_vecs + d * jbuf[0], list_vecs + d * jbuf[1],
+                     list_vecs + d * jbuf[2], list_vecs + d * jbuf[3], d,
+                     dis[0], dis[1], dis[2], dis[3]);
+            } else {
+                fvec_L2sqr_batch_4 (
+                     xi, list_vecs + d * jbuf[0], list_vecs + d * jbuf[1],
+                     list_vecs + d * jbuf[2], list_vecs + d * jbuf[3], d,
+                     dis[0], dis[1], dis[2], dis[3]);
+            }
+            for (int b = 0; b < 4; b++) {
+                consumer (jbuf[b], dis[b]);
+            }
+            nbuf = 0;
+        }
+        for (int b = 0; b < nbuf; b++) {
+            const float *yj = list_vecs + d * jbuf[b];
+            consumer (jbuf[b], distance_to_code ((const uint8_t*)yj));
+        }
+    }
+
+    size_t scan_codes (size_t list_size,
+                       const uint8_t *codes,
+                       const idx_t *ids,
+                       float *simi, idx_t *idxi,
+                       size_t k) const override
+    {
+        size_t nup = 0;
+        auto consumer = [&] (size_t j, float dis) {
+            if (C::cmp (simi[0], dis)) {
+                heap_pop<C> (k, simi, idxi);
+                int64_t id = store_pairs ? lo_build (list_no, j) : ids[j];
+                heap_push<C> (k, simi, idxi, dis, id);
+                nup++;
+            }
+        };
+        scan_list (list_size, codes, ids, consumer, simi);
+        return nup;
+    }
+
+    void scan_codes_range (size_t list_size,
+                           const uint8_t *codes,
+                           const idx_t *ids,
+                           float radius,
+                           RangeQueryResult & res) const override
+    {
+        auto consumer = [&] (size_t j, float dis) {
+            if (C::cmp (radius, dis)) {
+                int64_t id = store_pairs ? lo_build (list_no, j) : ids[j];
+                res.add (dis, id);
+            }
+        };
+        scan_list (list_size, codes, ids, consumer, &radius);
+    }
+
+
+};
+
+
+/* scanner for the metrics of extra_distances.h, with the same distance
+ * functors as the brute-force search. Smaller is closer. */
+template<class VD>
+struct IVFFlatExtraScanner: InvertedListScanner {
+    using C = CMax<float, int64_t>;
+    VD vd;
+    bool store_pairs;
+
+    IVFFlatExtraScanner(const VD & vd, bool store_pairs):
+        vd(vd), store_pairs(store_pairs) {}
+
+    const float *xi;
+    void set_query (const float *query) override {
+        this->xi = query;
+    }
+
+    idx_t list_no;
+    void set_list (idx_t list_no, float /* coarse_dis */) override {
+        this->list_no = list_no;
+    }
+
+    float distance_to_code (const uint8_t *code) const override {
+        return vd (xi, (const float*)code);
+    }
+
     size_t scan_codes (size_t list_size,
                        const uint8_t *codes,
                        const idx_t *ids,
@@ -155,9 +321,8 @@ struct IVFFlatScanner: InvertedListScanner {
         const float *list_vecs = (const float*)codes;
         size_t nup = 0;
         for (size_t j = 0; j < list_size; j++) {
-            const float * yj = list_vecs + d * j;
-            float dis = metric == METRIC_INNER_PRODUCT ?
-                fvec_inner_product (xi, yj, d) : fvec_L2sqr (xi, yj, d);
+            if (sel && !sel->is_member (ids[j])) continue;
+            float dis = vd (xi, list_vecs + j * vd.d);
             if (C::cmp (simi[0], dis)) {
                 heap_pop<C> (k, simi, idxi);
                 int64_t id = store_pairs ? lo_build (list_no, j) : ids[j];
@@ -176,23 +341,205 @@ struct IVFFlatScanner: InvertedListScanner {
     {
         const float *list_vecs = (const float*)codes;
         for (size_t j = 0; j < list_size; j++) {
-            const float * yj = list_vecs + d * j;
-            float dis = metric == METRIC_INNER_PRODUCT ?
-                fvec_inner_product (xi, yj, d) : fvec_L2sqr (xi, yj, d);
+            if (sel && !sel->is_member (ids[j])) continue;
+            float dis = vd (xi, list_vecs + j * vd.d);
             if (C::cmp (radius, dis)) {
                 int64_t id = store_pairs ? lo_build (list_no, j) : ids[j];
                 res.add (dis, id);
             }
         }
     }
+};
 
 
-};
+typedef Index::idx_t idx_t;
+
+/* Scores the m queries xq that probe a list against its vectors, by
+ * blocks of list vectors, with a GEMM. The results are added to the
+ * heaps of the queries (heap_dis / heap_ids, indexed by the query
+ * numbers qnos). */
+template<class C>
+void search_list_batched (
+        size_t d, size_t m, const float *xq, const float *xq_norms,
+        const idx_t *qnos,
+        size_t list_size, const float *list_vecs, const idx_t *ids,
+        size_t k, float *heap_dis, idx_t *heap_ids,
+        bool is_L2, std::vector<float> & ip_block)
+{
+    const size_t bs = 1024;
+    ip_block.resize (m * bs);
+    float y_norms[bs];
+
+    for (size_t j0 = 0; j0 < list_size; j0 += bs) {
+        size_t j1 = std::min (j0 + bs, list_size);
+        const float *y = list_vecs + j0 * d;
+        {
+            float one = 1, zero = 0;
+            FINTEGER nyi = j1 - j0, nxi = m, di = d;
+            sgemm_ ("Transpose", "Not transpose", &nyi, &nxi, &di, &one,
+                    y, &di, xq, &di, &zero, ip_block.data(), &nyi);
+        }
+        if (is_L2) {
+            for (size_t j = j0; j < j1; j++) {
+                y_norms[j - j0] = fvec_norm_L2sqr (list_vecs + j * d, d);
+            }
+        }
+        for (size_t i = 0; i < m; i++) {
+            const float *ip_line = ip_block.data() + i * (j1 - j0);
+            float *simi = heap_dis + qnos[i] * k;
+            idx_t *idxi = heap_ids + qnos[i] * k;
+            for (size_t j = j0; j < j1; j++) {
+                float dis = ip_line[j - j0];
+                if (is_L2) {
+                    dis = xq_norms[i] + y_norms[j - j0] - 2 * dis;
+                    // negative values can occur for identical vectors
+                    if (dis < 0) dis = 0;
+                }
+                if (C::cmp (simi[0], dis)) {
+                    heap_pop<C> (k, simi, idxi);
+                    heap_push<C> (k, simi, idxi, dis, ids[j]);
+                }
+            }
+        }
+    }
+}
+
+template<class C>
+void search_preassigned_batched (
+        const IndexIVFFlat & ivf, idx_t n, const float *x, idx_t k,
+        const idx_t *keys, size_t nprobe,
+        float *distances, idx_t *labels)
+{
+    size_t d = ivf.d;
+    size_t nlist = ivf.nlist;
+    bool is_L2 = ivf.metric_type == METRIC_L2;
+
+    // queries that probe each list, in CSR format
+    std::vector<size_t> lims (nlist + 1);
+    for (idx_t i = 0; i < n * nprobe; i++) {
+        if (keys[i] >= 0) {
+            lims[keys[i] + 1]++;
+        }
+    }
+    for (size_t l = 0; l < nlist; l++) {
+        lims[l + 1] += lims[l];
+    }
+    std::vector<idx_t> list_queries (lims[nlist]);
+    {
+        std::vector<size_t> ofs (lims.begin(), lims.end() - 1);
+        for (idx_t i = 0; i < n; i++) {
+            for (size_t p = 0; p < nprobe; p++) {
+                idx_t key = keys[i * nprobe + p];
+                if (key >= 0) {
+                    list_queries[ofs[key]++] = i;
+                }
+            }
+        }
+    }
+
+    std::vector<float> x_norms;
+    if (is_L2) {
+        x_norms.resize (n);
+        fvec_norms_L2sqr (x_norms.data(), x, d, n);
+    }
+
+    int nt = std::min (omp_get_max_threads(), int(nlist));
+    std::vector<float> th_dis (nt * n * k);
+    std::vector<idx_t> th_ids (nt * n * k);
+    size_t nlistv = 0, ndis = 0;
+
+#pragma omp parallel num_threads(nt) reduction(+: nlistv, ndis)
+    {
+        int rank = omp_get_thread_num ();
+        float *heap_dis = th_dis.data() + rank * n * k;
+        idx_t *heap_ids = th_ids.data() + rank * n * k;
+        for (idx_t i = 0; i < n; i++) {
+            heap_heapify<C> (k, heap_dis + i * k, heap_ids + i * k);
+        }
+        std::vector<float> xq, xq_norms, ip_block;
+
+#pragma omp for schedule(dynamic)
+        for (idx_t l = 0; l < nlist; l++) {
+            size_t m = lims[l + 1] - lims[l];
+            size_t list_size = ivf.invlists->list_size (l);
+            if (m == 0 || list_size == 0) continue;
+            const idx_t *qnos = list_queries.data() + lims[l];
+
+            InvertedLists::ScopedCodes scodes (ivf.invlists, l);
+            InvertedLists::ScopedIds sids (ivf.invlists, l);
+
+            // gather the queries
+            xq.resize (m * d);
+            xq_norms.resize (m);
+            for (size_t i = 0; i < m; i++) {
+                memcpy (xq.data() + i * d, x + qnos[i] * d,
+                        sizeof(float) * d);
+                if (is_L2) {
+                    xq_norms[i] = x_norms[qnos[i]];
+                }
+            }
+            search_list_batched<C> (
+                  d, m, xq.data(), xq_norms.data(), qnos,
+                  list_size, (const float*)scodes.get(), sids.get(),
+                  k, heap_dis, heap_ids, is_L2, ip_block);
+            nlistv += m;
+            ndis += m * list_size;
+        }
+    }
 
+    // merge the per-thread results
+#pragma omp parallel for if (n > 1)
+    for (idx_t i = 0; i < n; i++) {
+        float *simi = distances + i * k;
+        idx_t *idxi = labels + i * k;
+        heap_heapify<C> (k, simi, idxi,
+                         th_dis.data() + i * k, th_ids.data() + i * k, k);
+        for (int rank = 1; rank < nt; rank++) {
+            size_t ofs = (rank * n + i) * k;
+            heap_addn<C> (k, simi, idxi,
+                          th_dis.data() + ofs, th_ids.data() + ofs, k);
+        }
+        heap_reorder<C> (k, simi, idxi);
+    }
+
+    indexIVF_stats.nq += n;
+    indexIVF_stats.nlist += nlistv;
+    indexIVF_stats.ndis += ndis;
+}
 
 } // anonymous namespace
 
 
+void IndexIVFFlat::search_preassigned (
+        idx_t n, const float *x, idx_t k,
+        const idx_t *keys, const float *coarse_dis,
+        float *distances, idx_t *labels,
+        bool store_pairs,
+        const IVFSearchParameters *params) const
+{
+    size_t nprobe = params ? params->nprobe : this->nprobe;
+    bool use_batched = (batch_queries || parallel_mode == 3) &&
+        n > 1 && !store_pairs &&
+        !(params && params->sel) && ntombstones == 0 &&
+        (params ? params->max_codes : max_codes) == 0 &&
+        (params ? params->early_stop_ratio : early_stop_ratio) == 0 &&
+        !(parallel_mode & PARALLEL_MODE_NO_HEAP_INIT) &&
+        !invlists->lazy_ids () &&
+        (metric_type == METRIC_L2 || metric_type == METRIC_INNER_PRODUCT);
+
+    if (!use_batched) {
+        IndexIVF::search_preassigned (n, x, k, keys, coarse_dis,
+                                      distances, labels, store_pairs,
+                                      params);
+    } else if (metric_type == METRIC_L2) {
+        search_preassigned_batched<CMax<float, idx_t>> (
+              *this, n, x, k, keys, nprobe, distances, labels);
+    } else {
+        search_preassigned_batched<CMin<float, idx_t>> (
+              *this, n, x, k, keys, nprobe, distances, labels);
+    }
+}
+
 
 InvertedListScanner* IndexIVFFlat::get_InvertedListScanner
      (bool store_pairs) const
@@ -202,8 +549,28 @@ InvertedListScanner* IndexIVFFlat::get_InvertedListScanner
             METRIC_INNER_PRODUCT, CMin<float, int64_t> > (d, store_pairs);
     } else if (metric_type == METRIC_L2) {
         return new IVFFlatScanner<
-            METRIC_L2, CMax<float, int64_t> >(d, store_pairs);
-    } else {
+            METRIC_L2, CMax<float, int64_t> >(
+                  d, store_pairs, early_abort_block);
+    }
+
+    switch (metric_type) {
+#define HANDLE_VAR(kw)                                                  \
+    case METRIC_ ## kw: {                                               \
+        VectorDistance ## kw vd = {(size_t)d};                          \
+        return new IVFFlatExtraScanner<VectorDistance ## kw> (          \
+              vd, store_pairs);                                         \
+    }
+        HANDLE_VAR(L1);
+        HANDLE_VAR(Linf);
+        HANDLE_VAR(Canberra);
+        HANDLE_VAR(BrayCurtis);
+        HANDLE_VAR(JensenShannon);
+#undef HANDLE_VAR
+    case METRIC_Lp: {
+        VectorDistanceLp vd = {(size_t)d, metric_arg};
+        return new IVFFlatExtraScanner<VectorDistanceLp> (vd, store_pairs);
+    }
+    default:
         FAISS_THROW_MSG("metric type not supported");
     }
     return nullptr;
@@ -218,6 +585,17 @@ void IndexIVFFlat::reconstruct_from_offset (int64_t list_no, int64_t offset,
     memcpy (recons, invlists->get_single_code (list_no, offset), code_size);
 }
 
+void IndexIVFFlat::reconstruct_from_offsets (
+        int64_t list_no, size_t n, const int64_t *offsets,
+        float* recons) const
+{
+    InvertedLists::ScopedCodes codes (invlists, list_no);
+    for (size_t j = 0; j < n; j++) {
+        memcpy (recons + j * d, codes.get() + offsets[j] * code_size,
+                code_size);
+    }
+}
+
 /*****************************************
  * IndexIVFFlatDedup implementation
  ******************************************/
@@ -266,7 +644,7 @@ void IndexIVFFlatDedup::add_with_ids(
            "IVFFlatDedup not implemented with direct_map");
     int64_t * idx = new int64_t [na];
     ScopeDeleter<int64_t> del (idx);
-    quantizer->assign (na, x, idx);
+    assign_for_add (na, x, idx);
 
     int64_t n_add = 0, n_dup = 0;
     // TODO make a omp loop with this
@@ -321,6 +699,8 @@ void IndexIVFFlatDedup::search_preassigned (
 {
     FAISS_THROW_IF_NOT_MSG (
            !store_pairs, "store_pairs not supported in IVFDedup");
+    FAISS_THROW_IF_NOT_MSG (
+           !(params && params->sel), "IDSelector not supported in IVFDedup");
 
     IndexIVFFlat::search_preassigned (n, x, k, assign, centroid_dis,
                                       distances, labels, false,
@@ -368,6 +748,7 @@ void IndexIVFFlatDedup::search_preassigned (
 
 size_t IndexIVFFlatDedup::remove_ids(const IDSelector& sel)
 {
+    norm_bounds.clear ();
     std::unordered_map<idx_t, idx_t> replace;
     std::vector<std::pair<idx_t, idx_t> > toadd;
     for (auto it = instances.begin(); it != instances.end(); ) {
@@ -464,5 +845,303 @@ void IndexIVFFlatDedup::reconstruct_from_offset (
 
 
 
+/*****************************************
+ * IndexIVFFlatSorted implementation
+ ******************************************/
+
+IndexIVFFlatSorted::IndexIVFFlatSorted (
+            Index * quantizer, size_t d, size_t nlist_):
+    IndexIVFFlat (quantizer, d, nlist_, METRIC_L2),
+    centroid_dis (nlist_)
+{}
+
+
+void IndexIVFFlatSorted::add_core (
+           idx_t n, const float * x, const int64_t *xids,
+           const int64_t *precomputed_idx)
+{
+    FAISS_THROW_IF_NOT_MSG (direct_map.no(),
+           "IndexIVFFlatSorted not implemented with direct_map");
+    std::vector<size_t> offsets (nlist);
+    for (size_t list_no = 0; list_no < nlist; list_no++) {
+        offsets[list_no] = invlists->list_size (list_no);
+    }
+    IndexIVFFlat::add_core (n, x, xids, precomputed_idx);
+    sort_lists (offsets.data());
+}
+
+
+void IndexIVFFlatSorted::sort_lists (const size_t *offsets)
+{
+    FAISS_THROW_IF_NOT_MSG (direct_map.no(),
+           "IndexIVFFlatSorted not implemented with direct_map");
+    centroid_dis.resize (nlist);
+
+    // fail early if the centroids cannot be reconstructed
+    std::vector<float> centroid0 (d);
+    if (nlist > 0) {
+        quantizer->reconstruct (0, centroid0.data());
+    }
+
+#pragma omp parallel
+    {
+        std::vector<float> centroid (d);
+
+#pragma omp for schedule(dynamic)
+        for (idx_t list_no = 0; list_no < (idx_t) nlist; list_no++) {
+            size_t list_size = invlists->list_size (list_no);
+            std::vector<float> & cdis = centroid_dis[list_no];
+            size_t ofs = offsets ? offsets[list_no] : 0;
+            if (cdis.size() != ofs || ofs > list_size) {
+                // stale distances
+                ofs = 0;
+            }
+            cdis.resize (list_size);
+            if (ofs == list_size) {
+                continue;
+            }
+
+            quantizer->reconstruct (list_no, centroid.data());
+            std::vector<uint8_t> codes;
+            std::vector<idx_t> ids;
+            {
+                InvertedLists::ScopedCodes scodes (invlists, list_no);
+                const float *vecs = (const float*)scodes.get();
+                for (size_t j = ofs; j < list_size; j++) {
+                    cdis[j] = sqrtf (fvec_L2sqr (
+                           vecs + j * d, centroid.data(), d));
+                }
+                if (std::is_sorted (cdis.begin(), cdis.end())) {
+                    continue;
+                }
+                InvertedLists::ScopedIds sids (invlists, list_no);
+                codes.assign (scodes.get(), scodes.get() + list_size * code_size);
+                ids.assign (sids.get(), sids.get() + list_size);
+            }
+
+            std::vector<size_t> perm (list_size);
+            for (size_t j = 0; j < list_size; j++) {
+                perm[j] = j;
+            }
+            std::stable_sort (perm.begin(), perm.end(),
+                              [&cdis] (size_t a, size_t b) {
+                                  return cdis[a] < cdis[b];
+                              });
+
+            std::vector<uint8_t> codes2 (list_size * code_size);
+            std::vector<idx_t> ids2 (list_size);
+            std::vector<float> cdis2 (list_size);
+            for (size_t j = 0; j < list_size; j++) {
+                memcpy (codes2.data() + j * code_size,
+                        codes.data() + perm[j] * code_size, code_size);
+                ids2[j] = ids[perm[j]];
+                cdis2[j] = cdis[perm[j]];
+            }
+            invlists->update_entries (list_no, 0, list_size,
+                                      ids2.data(), codes2.data());
+            cdis.swap (cdis2);
+        }
+    }
+}
+
+
+void IndexIVFFlatSorted::search_preassigned (
+           idx_t n, const float *x, idx_t k,
+           const idx_t *assign,
+           const float * /* coarse_dis */,
+           float *distances, idx_t *labels,
+           bool store_pairs,
+           const IVFSearchParameters *params) const
+{
+    long nprobe = params ? params->nprobe : this->nprobe;
+    const IDSelector *sel = params ? params->sel : nullptr;
+
+    FAISS_THROW_IF_NOT_MSG (ntombstones == 0,
+           "lazy_remove not supported by IndexIVFFlatSorted");
+    FAISS_THROW_IF_NOT (centroid_dis.size() == nlist);
+    for (size_t list_no = 0; list_no < nlist; list_no++) {
+        FAISS_THROW_IF_NOT_MSG (
+               centroid_dis[list_no].size() ==
+                   invlists->list_size (list_no),
+               "inverted lists modified, call sort_lists");
+    }
+    for (idx_t ij = 0; ij < n * nprobe; ij++) {
+        FAISS_THROW_IF_NOT_FMT (assign[ij] < (idx_t) nlist,
+                                "Invalid key=%" PRId64 " nlist=%zd\n",
+                                assign[ij], nlist);
+    }
+
+    size_t nlistv = 0, ndis = 0;
+
+#pragma omp parallel if (n > 1) reduction(+: nlistv, ndis)
+    {
+        std::vector<float> centroid (d);
+
+#pragma omp for
+        for (idx_t i = 0; i < n; i++) {
+            const float *xi = x + i * d;
+            float *simi = distances + i * k;
+            idx_t *idxi = labels + i * k;
+            maxheap_heapify (k, simi, idxi);
+
+            for (long ik = 0; ik < nprobe; ik++) {
+                idx_t key = assign[i * nprobe + ik];
+                if (key < 0) {
+                    continue;
+                }
+                size_t list_size = invlists->list_size (key);
+                if (list_size == 0) {
+                    continue;
+                }
+                nlistv++;
+
+                // the coarse distances may be approximate, recompute
+                quantizer->reconstruct (key, centroid.data());
+                float dqc = sqrtf (fvec_L2sqr (xi, centroid.data(), d));
+
+                InvertedLists::ScopedCodes scodes (invlists, key);
+                const float *vecs = (const float*)scodes.get();
+                std::unique_ptr<InvertedLists::ScopedIds> sids;
+                const idx_t *ids = nullptr;
+                if (!store_pairs || sel) {
+                    sids.reset (new InvertedLists::ScopedIds (invlists, key));
+                    ids = sids->get();
+                }
+                const float *cdis = centroid_dis[key].data();
+
+                // lower bound of the squared distance to entry j, with a
+                // margin for the rounding errors
+                auto bound = [&] (size_t j) {
+                    float b = std::fabs (dqc - cdis[j]) -
+                        1e-5f * (dqc + cdis[j]);
+                    return b > 0 ? b * b : 0;
+                };
+
+                // the entries [lo, hi) are done, they are extended by the
+                // side with the smallest bound
+                size_t hi = std::lower_bound (cdis, cdis + list_size, dqc)
+                    - cdis;
+                size_t lo = hi;
+                for (;;) {
+                    bool do_lo = lo > 0 && bound (lo - 1) < simi[0];
+                    bool do_hi = hi < list_size && bound (hi) < simi[0];
+                    size_t j;
+                    if (do_lo && (!do_hi ||
+                                  dqc - cdis[lo - 1] < cdis[hi] - dqc)) {
+                        j = --lo;
+                    } else if (do_hi) {
+                        j = hi++;
+                    } else {
+                        break;
+                    }
+
+                    if (sel && !sel->is_member (ids[j])) {
+                        continue;
+                    }
+                    float dis = fvec_L2sqr (xi, vecs + j * d, d);
+                    ndis++;
+                    if (dis < simi[0]) {
+                        maxheap_pop (k, simi, idxi);
+                        idx_t id = store_pairs ? lo_build (key, j) : ids[j];
+                        maxheap_push (k, simi, idxi, dis, id);
+                    }
+                }
+            }
+            maxheap_reorder (k, simi, idxi);
+        }
+    }
+
+    indexIVF_stats.nq += n;
+    indexIVF_stats.nlist += nlistv;
+    indexIVF_stats.ndis += ndis;
+}
+
+
+size_t IndexIVFFlatSorted::remove_ids (const IDSelector& sel)
+{
+    FAISS_THROW_IF_NOT_MSG (!lazy_remove,
+           "lazy_remove not supported by IndexIVFFlatSorted");
+    size_t nremove = 0;
+
+#pragma omp parallel for reduction(+: nremove)
+    for (idx_t list_no = 0; list_no < (idx_t) nlist; list_no++) {
+        size_t list_size = invlists->list_size (list_no);
+        std::vector<float> & cdis = centroid_dis[list_no];
+        size_t l = 0;
+        {
+            InvertedLists::ScopedCodes scodes (invlists, list_no);
+            InvertedLists::ScopedIds sids (invlists, list_no);
+            for (size_t j = 0; j < list_size; j++) {
+                idx_t id = sids[j];
+                if (sel.is_member (id)) {
+                    continue;
+                }
+                if (l < j) {
+                    invlists->update_entry (list_no, l, id,
+                                            scodes.get() + j * code_size);
+                    if (j < cdis.size()) {
+                        cdis[l] = cdis[j];
+                    }
+                }
+                l++;
+            }
+        }
+        if (l < list_size) {
+            invlists->resize (list_no, l);
+            cdis.resize (std::min (l, cdis.size()));
+            nremove += list_size - l;
+        }
+    }
+    ntotal -= nremove;
+    return nremove;
+}
+
+
+void IndexIVFFlatSorted::merge_from (IndexIVF &other, idx_t add_id)
+{
+    IndexIVFFlatSorted *other_sorted =
+        dynamic_cast<IndexIVFFlatSorted*> (&other);
+    FAISS_THROW_IF_NOT (other_sorted);
+    std::vector<size_t> offsets (nlist);
+    for (size_t list_no = 0; list_no < nlist; list_no++) {
+        offsets[list_no] = invlists->list_size (list_no);
+    }
+    IndexIVF::merge_from (other, add_id);
+    for (auto & cdis : other_sorted->centroid_dis) {
+        cdis.clear ();
+    }
+    sort_lists (offsets.data());
+}
+
+
+void IndexIVFFlatSorted::reset ()
+{
+    IndexIVF::reset ();
+    centroid_dis.clear ();
+    centroid_dis.resize (nlist);
+}
+
+
+void IndexIVFFlatSorted::update_vectors (int , const idx_t *, const float *)
+{
+    FAISS_THROW_MSG ("not implemented");
+}
+
+Index::idx_t IndexIVFFlatSorted::split_list (idx_t list_no, int niter)
+{
+    idx_t new_list = IndexIVFFlat::split_list (list_no, niter);
+    if (new_list >= 0) {
+        // only the two lists are re-sorted
+        std::vector<size_t> offsets (nlist);
+        for (size_t l = 0; l < centroid_dis.size(); l++) {
+            offsets[l] = centroid_dis[l].size();
+        }
+        offsets[list_no] = 0;
+        sort_lists (offsets.data());
+    }
+    return new_list;
+}
+
+
 
 } // namespace faiss
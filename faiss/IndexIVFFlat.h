@@ -24,6 +24,21 @@ namespace faiss {
  */
 struct IndexIVFFlat: IndexIVF {
 
+    /** if set, the search processes the inverted lists one after the
+     * other and scores all the queries that probe a list together with
+     * a GEMM. This is faster when many queries of a batch probe the
+     * same lists. The default search is used for store_pairs, an ID
+     * selector, max_codes or early_stop_ratio. parallel_mode 3 enables
+     * it as well. */
+    bool batch_queries;
+
+    /** if > 0, the L2 distances of the scanner are computed by blocks
+     * of this many dimensions, and a vector is abandoned as soon as its
+     * partial distance exceeds the current k-th distance (or the
+     * radius). Useful when the first dimensions have the largest
+     * variance, eg. after a PCA. Not used by batch_queries. */
+    size_t early_abort_block;
+
     IndexIVFFlat (
             Index * quantizer, size_t d, size_t nlist_,
             MetricType = METRIC_L2);
@@ -41,6 +56,14 @@ struct IndexIVFFlat: IndexIVF {
                         bool include_listnos=false) const override;
 
 
+    void search_preassigned (idx_t n, const float *x, idx_t k,
+                             const idx_t *assign,
+                             const float *centroid_dis,
+                             float *distances, idx_t *labels,
+                             bool store_pairs,
+                             const IVFSearchParameters *params=nullptr
+                             ) const override;
+
     InvertedListScanner *get_InvertedListScanner (bool store_pairs)
         const override;
 
@@ -48,10 +71,17 @@ struct IndexIVFFlat: IndexIVF {
     void reconstruct_from_offset (int64_t list_no, int64_t offset,
                                   float* recons) const override;
 
+    void reconstruct_from_offsets (int64_t list_no, size_t n,
+                                   const int64_t *offsets,
+                                   float* recons) const override;
+
     void sa_decode (idx_t n, const uint8_t *bytes,
                             float *x) const override;
 
-    IndexIVFFlat () {}
+    /// the vectors are stored as is
+    bool codes_depend_on_list () const override;
+
+    IndexIVFFlat (): batch_queries (false), early_abort_block (0) {}
 };
 
 
@@ -102,6 +132,64 @@ struct IndexIVFFlatDedup: IndexIVFFlat {
 };
 
 
+/** IndexIVFFlat (L2 only) whose inverted lists are sorted by the
+ * distance of the vectors to their list centroid, which is stored.
+ *
+ * By the triangle inequality, |d(q, c) - d(x, c)| <= d(q, x) for a
+ * vector x of the list of centroid c. The search of a list starts from
+ * the vectors with d(x, c) closest to d(q, c) and extends to both sides,
+ * until this lower bound exceeds the current k-th result distance on
+ * both sides. The results are the same as with IndexIVFFlat, but with
+ * fewer distance computations when the lists are large compared to the
+ * radius of the results (high nprobe or small k).
+ *
+ * The lists are sorted by add and merge_from. lazy_remove, the direct
+ * map and update_vectors are not supported. After the inverted lists
+ * are modified by other means (replace_invlists, copy_subset_to into
+ * this index...), sort_lists must be called before searching.
+ */
+struct IndexIVFFlatSorted: IndexIVFFlat {
+
+    /// distances (not squared) of the entries of each list to its
+    /// centroid, in increasing order
+    std::vector<std::vector<float> > centroid_dis;
+
+    IndexIVFFlatSorted (Index * quantizer, size_t d, size_t nlist_);
+
+    void add_core (idx_t n, const float * x, const int64_t *xids,
+                   const int64_t *precomputed_idx) override;
+
+    /** recompute the distances to the centroids for the entries
+     * [offsets[l], list_size) of each list l (all of them if offsets is
+     * NULL) and sort the lists that are not sorted anymore */
+    void sort_lists (const size_t *offsets = nullptr);
+
+    /** uses only nprobe and the ID selector of the params */
+    void search_preassigned (idx_t n, const float *x, idx_t k,
+                             const idx_t *assign,
+                             const float *coarse_dis,
+                             float *distances, idx_t *labels,
+                             bool store_pairs,
+                             const IVFSearchParameters *params=nullptr
+                             ) const override;
+
+    /// removes the entries in place, keeping the order
+    size_t remove_ids (const IDSelector& sel) override;
+
+    void merge_from (IndexIVF &other, idx_t add_id) override;
+
+    void reset () override;
+
+    /// not implemented
+    void update_vectors (int nv, const idx_t *idx, const float *v) override;
+
+    /// also sorts the two lists
+    idx_t split_list (idx_t list_no, int niter = 10) override;
+
+    IndexIVFFlatSorted () {}
+};
+
+
 
 } // namespace faiss
 
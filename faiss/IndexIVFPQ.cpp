@@ -16,10 +16,15 @@
 #include <stdint.h>
 
 #include <algorithm>
+#include <memory>
 
 #include <faiss/utils/Heap.h>
 #include <faiss/utils/utils.h>
 #include <faiss/utils/distances.h>
+#include <faiss/utils/fp16.h>
+#include <faiss/utils/instrumentation.h>
+#include <faiss/utils/prefetch.h>
+#include <faiss/utils/scratch.h>
 
 #include <faiss/Clustering.h>
 #include <faiss/IndexFlat.h>
@@ -27,6 +32,7 @@
 #include <faiss/utils/hamming.h>
 
 #include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/pq_code_distance.h>
 
 #include <faiss/impl/AuxIndexStructures.h>
 
@@ -48,6 +54,9 @@ IndexIVFPQ::IndexIVFPQ (Index * quantizer, size_t d, size_t nlist,
     by_residual = true;
     use_precomputed_table = 0;
     scan_table_threshold = 0;
+    batched_list_tables = false;
+    quantized_lut = false;
+    rerank_factor = 0;
 
     polysemous_training = nullptr;
     do_polysemous_training = false;
@@ -194,8 +203,8 @@ static float * compute_residuals (
 {
     size_t d = quantizer->d;
     float *residuals = new float [n * d];
-    // TODO: parallelize?
-    for (size_t i = 0; i < n; i++) {
+#pragma omp parallel for if (n > 1000)
+    for (int64_t i = 0; i < n; i++) {
         if (list_nos[i] < 0)
             memset (residuals + i * d, 0, sizeof(*residuals) * d);
         else
@@ -291,7 +300,7 @@ void IndexIVFPQ::add_core_o (idx_t n, const float * x, const idx_t *xids,
     } else {
         idx_t * idx0 = new idx_t [n];
         del_idx.set (idx0);
-        quantizer->assign (n, x, idx0);
+        assign_for_add (n, x, idx0);
         idx = idx0;
     }
 
@@ -368,6 +377,21 @@ void IndexIVFPQ::reconstruct_from_offset (int64_t list_no, int64_t offset,
     }
 }
 
+bool IndexIVFPQ::codes_depend_on_list () const
+{
+    return by_residual;
+}
+
+Index::idx_t IndexIVFPQ::split_list (idx_t list_no, int niter)
+{
+    idx_t new_list = IndexIVF::split_list (list_no, niter);
+    if (new_list >= 0 && (!precomputed_table.empty() ||
+                          !precomputed_table_fp16.empty())) {
+        precompute_table ();
+    }
+    return new_list;
+}
+
 
 
 /// 2G by default, accommodates tables up to PQ32 w/ 65536 centroids
@@ -460,6 +484,22 @@ void IndexIVFPQ::precompute_table ()
             pq.compute_inner_prod_table (centroid.data(), tab);
             fvec_madd (pq.M * pq.ksub, r_norms.data(), 2.0, tab, tab);
         }
+    } else if (use_precomputed_table == 3) {
+
+        precomputed_table.clear ();
+        precomputed_table_fp16.resize (nlist * pq.M * pq.ksub);
+        std::vector<float> centroid (d);
+        std::vector<float> tab (pq.M * pq.ksub);
+
+        for (size_t i = 0; i < nlist; i++) {
+            quantizer->reconstruct (i, centroid.data());
+
+            pq.compute_inner_prod_table (centroid.data(), tab.data());
+            fvec_madd (pq.M * pq.ksub, r_norms.data(), 2.0,
+                       tab.data(), tab.data());
+            fp32_to_fp16 (&precomputed_table_fp16[i * pq.M * pq.ksub],
+                          tab.data(), pq.M * pq.ksub);
+        }
     } else if (use_precomputed_table == 2) {
         const MultiIndexQuantizer *miq =
            dynamic_cast<const MultiIndexQuantizer *> (quantizer);
@@ -492,6 +532,15 @@ void IndexIVFPQ::precompute_table ()
 
 }
 
+MemoryUsage IndexIVFPQ::memory_usage () const
+{
+    MemoryUsage mu = IndexIVF::memory_usage ();
+    mu.add ("pq", pq.memory_usage ());
+    mu.add ("precomputed_table", precomputed_table);
+    mu.add ("precomputed_table_fp16", precomputed_table_fp16);
+    return mu;
+}
+
 namespace {
 
 using idx_t = Index::idx_t;
@@ -525,13 +574,15 @@ struct QueryTables {
     bool by_residual;
     int use_precomputed_table;
     int polysemous_ht;
+    bool batched_list_tables;
 
     // pre-allocated data buffers
     float * sim_table, * sim_table_2;
     float * residual_vec, *decoded_vec;
 
-    // single data buffer
-    std::vector<float> mem;
+    // single data buffer, taken from the per-thread pool because a
+    // QueryTables is built for each search call and thread
+    ScratchBuffer mem;
 
     // for table pointers
     std::vector<const float *> sim_table_ptrs;
@@ -545,8 +596,7 @@ struct QueryTables {
         by_residual (ivfpq.by_residual),
         use_precomputed_table (ivfpq.use_precomputed_table)
     {
-        mem.resize (pq.ksub * pq.M * 2 + d * 2);
-        sim_table = mem.data ();
+        sim_table = mem.get<float> (pq.ksub * pq.M * 2 + d * 2);
         sim_table_2 = sim_table + pq.ksub * pq.M;
         residual_vec = sim_table_2 + pq.ksub * pq.M;
         decoded_vec = residual_vec + d;
@@ -562,6 +612,20 @@ struct QueryTables {
         }
         init_list_cycles = 0;
         sim_table_ptrs.resize (pq.M);
+
+        batched_list_tables = ivfpq.batched_list_tables && by_residual &&
+            metric_type == METRIC_L2 &&
+            ivfpq.quantizer->metric_type == METRIC_L2 &&
+            (use_precomputed_table == 0 || use_precomputed_table == -1);
+        if (batched_list_tables) {
+            r_norms.resize (pq.M * pq.ksub);
+            for (size_t m = 0; m < pq.M; m++) {
+                for (size_t j = 0; j < pq.ksub; j++) {
+                    r_norms [m * pq.ksub + j] =
+                        fvec_norm_L2sqr (pq.get_centroids (m, j), pq.dsub);
+                }
+            }
+        }
     }
 
     /*****************************************************
@@ -590,9 +654,59 @@ struct QueryTables {
     void init_query_L2 () {
         if (!by_residual) {
             pq.compute_distance_table (qi, sim_table);
-        } else if (use_precomputed_table) {
+        } else if (use_precomputed_table || batched_list_tables) {
             pq.compute_inner_prod_table (qi, sim_table_2);
         }
+        batch_keys.clear ();
+    }
+
+    /*****************************************************
+     * Batched computation of the list terms
+     *****************************************************/
+
+    // squared norms of the PQ centroids
+    std::vector<float> r_norms;
+
+    // lists of the current query and their term 2 tables
+    std::vector<idx_t> batch_keys;
+    std::vector<float> batch_tables;
+    std::vector<float> batch_centroids;
+
+    /// compute the term 2 tables of the lists that the current query
+    /// will scan, as for use_precomputed_table = 1
+    void init_query_lists (size_t nlist, const idx_t *list_nos) {
+        if (!batched_list_tables) {
+            return;
+        }
+        batch_keys.clear ();
+        batch_centroids.resize (nlist * d);
+        for (size_t i = 0; i < nlist; i++) {
+            if (list_nos[i] < 0) {
+                continue;
+            }
+            ivfpq.quantizer->reconstruct (
+                  list_nos[i], batch_centroids.data() + batch_keys.size() * d);
+            batch_keys.push_back (list_nos[i]);
+        }
+        size_t tab_size = pq.M * pq.ksub;
+        batch_tables.resize (batch_keys.size() * tab_size);
+        pq.compute_inner_prod_tables (batch_keys.size(),
+                                      batch_centroids.data(),
+                                      batch_tables.data());
+        for (size_t i = 0; i < batch_keys.size(); i++) {
+            float *tab = batch_tables.data() + i * tab_size;
+            fvec_madd (tab_size, r_norms.data(), 2.0, tab, tab);
+        }
+    }
+
+    /// the term 2 table of the list, nullptr if it is not in the batch
+    const float *get_batch_table (idx_t list_no) const {
+        for (size_t i = 0; i < batch_keys.size(); i++) {
+            if (batch_keys[i] == list_no) {
+                return batch_tables.data() + i * pq.M * pq.ksub;
+            }
+        }
+        return nullptr;
     }
 
     /*****************************************************
@@ -665,7 +779,21 @@ struct QueryTables {
     {
         float dis0 = 0;
 
-        if (use_precomputed_table == 0 || use_precomputed_table == -1) {
+        const float *batch_table = batched_list_tables ?
+            get_batch_table (key) : nullptr;
+
+        if (batch_table) {
+            dis0 = coarse_dis;
+
+            fvec_madd (pq.M * pq.ksub, batch_table,
+                       -2.0, sim_table_2, sim_table);
+
+            if (polysemous_ht != 0) {
+                ivfpq.quantizer->compute_residual (qi, residual_vec, key);
+                pq.compute_code (residual_vec, q_code.data());
+            }
+
+        } else if (use_precomputed_table == 0 || use_precomputed_table == -1) {
             ivfpq.quantizer->compute_residual (qi, residual_vec, key);
             pq.compute_distance_table (residual_vec, sim_table);
 
@@ -673,13 +801,20 @@ struct QueryTables {
                 pq.compute_code (residual_vec, q_code.data());
             }
 
-        } else if (use_precomputed_table == 1) {
+        } else if (use_precomputed_table == 1 || use_precomputed_table == 3) {
             dis0 = coarse_dis;
 
-            fvec_madd (pq.M * pq.ksub,
-                       &ivfpq.precomputed_table [key * pq.ksub * pq.M],
-                       -2.0, sim_table_2,
-                       sim_table);
+            const float *tab;
+            if (use_precomputed_table == 1) {
+                tab = &ivfpq.precomputed_table [key * pq.ksub * pq.M];
+            } else {
+                fp16_to_fp32 (sim_table,
+                              &ivfpq.precomputed_table_fp16 [
+                                    key * pq.ksub * pq.M],
+                              pq.ksub * pq.M);
+                tab = sim_table;
+            }
+            fvec_madd (pq.M * pq.ksub, tab, -2.0, sim_table_2, sim_table);
 
 
             if (polysemous_ht != 0) {
@@ -794,6 +929,11 @@ struct KnnSearchResults {
     idx_t key;
     const idx_t *ids;
 
+    // ids that are not in sel are skipped. sel_ids is set even with
+    // store_pairs
+    const IDSelector *sel;
+    const idx_t *sel_ids;
+
     // heap params
     size_t k;
     float * heap_sim;
@@ -810,6 +950,10 @@ struct KnnSearchResults {
         }
     }
 
+    inline bool skip_entry (idx_t j) const {
+        return sel && !sel->is_member (sel_ids[j]);
+    }
+
 };
 
 template<class C>
@@ -817,6 +961,11 @@ struct RangeSearchResults {
     idx_t key;
     const idx_t *ids;
 
+    // ids that are not in sel are skipped. sel_ids is set even with
+    // store_pairs
+    const IDSelector *sel;
+    const idx_t *sel_ids;
+
     // wrapped result structure
     float radius;
     RangeQueryResult & rres;
@@ -827,6 +976,10 @@ struct RangeSearchResults {
             rres.add (dis, id);
         }
     }
+
+    inline bool skip_entry (idx_t j) const {
+        return sel && !sel->is_member (sel_ids[j]);
+    }
 };
 
 
@@ -843,8 +996,11 @@ struct IVFPQScannerT: QueryTables {
     const IDType * list_ids;
     size_t list_size;
 
+    /// scan 8-bit codes with tables quantized to 16 bits
+    bool quantized_lut;
+
     IVFPQScannerT (const IndexIVFPQ & ivfpq, const IVFSearchParameters *params):
-        QueryTables (ivfpq, params)
+        QueryTables (ivfpq, params), quantized_lut (false)
     {
         assert(METRIC_TYPE == metric_type);
     }
@@ -867,23 +1023,122 @@ struct IVFPQScannerT: QueryTables {
      * Scaning the codes: simple PQ scan.
      *****************************************************/
 
+    // tables of the pairs of 4-bit sub-quantizers of the current list
+    mutable std::vector<float> pair_tables;
+
+    /// distances computed by blocks with pq_code_distances_8bit, for
+    /// codes where each byte indexes a table of 256 entries
+    template<class SearchResultType>
+    void scan_list_blocked (size_t ncode, const uint8_t *codes,
+                            const float *tab, SearchResultType & res) const
+    {
+        const size_t bs = 256;
+        float dis[bs];
+        for (size_t j0 = 0; j0 < ncode; j0 += bs) {
+            size_t j1 = std::min (j0 + bs, ncode);
+            pq_code_distances_8bit (pq.code_size, tab,
+                                    codes + j0 * pq.code_size, j1 - j0, dis);
+            for (size_t j = j0; j < j1; j++) {
+                res.add (j, dis0 + dis[j - j0]);
+            }
+        }
+    }
+
+    // table entries of one 4-bit code, combined by pairs
+    mutable std::vector<float> pair_entries;
+
+    /// distance of one code with the precomputed tables. The sum has the
+    /// same rounding as scan_list_blocked, so that a code gets the same
+    /// distance from all the scan paths and from distance_to_code.
+    float distance_with_table (const uint8_t *code) const
+    {
+        if (pq.nbits == 8) {
+            float dis;
+            pq_code_distances_8bit (pq.code_size, sim_table, code, 1, &dis);
+            return dis0 + dis;
+        }
+        if (pq.nbits == 4) {
+            // the entries of the pair tables, without building them
+            pair_entries.resize (pq.code_size);
+            for (size_t i = 0; i < pq.code_size; i++) {
+                const float *t0 = sim_table + 2 * i * 16;
+                float e = t0[code[i] & 15];
+                if (2 * i + 1 < pq.M) {
+                    e += t0[16 + (code[i] >> 4)];
+                }
+                pair_entries[i] = e;
+            }
+            return dis0 + pq_sum_entries_8bit (pq.code_size,
+                                               pair_entries.data());
+        }
+        PQDecoder decoder(code, pq.nbits);
+        const float *tab = sim_table;
+        float accu = 0;
+        for (size_t m = 0; m < pq.M; m++) {
+            accu += tab[decoder.decode()];
+            tab += pq.ksub;
+        }
+        return dis0 + accu;
+    }
+
+    // tables of the current list quantized to 16 bits
+    mutable std::vector<uint16_t> lut_u16;
+
+    /// distances with the tables quantized by pq_quantize_tables_u16, for
+    /// 8-bit codes: the sums are integer, and the tables take half of the
+    /// cache of the float ones
+    template<class SearchResultType>
+    void scan_list_quantized (size_t ncode, const uint8_t *codes,
+                              SearchResultType & res) const
+    {
+        lut_u16.resize (pq.M * 256 + 1);
+        float scale, bias;
+        pq_quantize_tables_u16 (pq.M, sim_table, lut_u16.data(),
+                                &scale, &bias);
+
+        const size_t bs = 256;
+        uint32_t idis[bs];
+        for (size_t j0 = 0; j0 < ncode; j0 += bs) {
+            size_t j1 = std::min (j0 + bs, ncode);
+            pq_code_distances_8bit_u16 (pq.M, lut_u16.data(),
+                                        codes + j0 * pq.code_size,
+                                        j1 - j0, idis);
+            for (size_t j = j0; j < j1; j++) {
+                res.add (j, dis0 + bias + scale * idis[j - j0]);
+            }
+        }
+    }
+
     /// version of the scan where we use precomputed tables
     template<class SearchResultType>
     void scan_list_with_table (size_t ncode, const uint8_t *codes,
                                SearchResultType & res) const
     {
-        for (size_t j = 0; j < ncode; j++) {
-            PQDecoder decoder(codes, pq.nbits);
-            codes += pq.code_size;
-            float dis = dis0;
-            const float *tab = sim_table;
-
-            for (size_t m = 0; m < pq.M; m++) {
-                dis += tab[decoder.decode()];
-                tab += pq.ksub;
+        if (!res.sel) {
+            if (pq.nbits == 8 && quantized_lut) {
+                scan_list_quantized (ncode, codes, res);
+                return;
             }
+            if (pq.nbits == 8 && pq_code_distances_8bit_is_simd (pq.M)) {
+                scan_list_blocked (ncode, codes, sim_table, res);
+                return;
+            }
+            // the pair tables are worth building for long lists only
+            if (pq.nbits == 4 && ncode > 256) {
+                pair_tables.resize (pq.code_size * 256);
+                pq_pair_tables_4bit (pq.M, sim_table, pair_tables.data());
+                scan_list_blocked (ncode, codes, pair_tables.data(), res);
+                return;
+            }
+        }
 
-            res.add(j, dis);
+        for (size_t j = 0; j < ncode; j++) {
+            if (res.skip_entry (j)) {
+                codes += pq.code_size;
+                continue;
+            }
+            res.add(j, distance_with_table (codes));
+            codes += pq.code_size;
         }
     }
 
@@ -895,6 +1150,10 @@ struct IVFPQScannerT: QueryTables {
                                  SearchResultType & res) const
     {
         for (size_t j = 0; j < ncode; j++) {
+            if (res.skip_entry (j)) {
+                codes += pq.code_size;
+                continue;
+            }
             PQDecoder decoder(codes, pq.nbits);
             codes += pq.code_size;
 
@@ -932,6 +1191,10 @@ struct IVFPQScannerT: QueryTables {
         }
 
         for (size_t j = 0; j < ncode; j++) {
+            if (res.skip_entry (j)) {
+                codes += pq.code_size;
+                continue;
+            }
 
             pq.decode (codes, decoded_vec);
             codes += pq.code_size;
@@ -950,36 +1213,49 @@ struct IVFPQScannerT: QueryTables {
      * Scanning codes with polysemous filtering
      *****************************************************/
 
+    /* The codes are scanned by blocks. First the Hamming distances of
+     * the block to the query code are computed, in a loop without
+     * branches, and the indices of the codes within the threshold are
+     * compacted without branches either. Then the PQ distances are
+     * computed for these survivors only. */
     template <class HammingComputer, class SearchResultType>
     void scan_list_polysemous_hc (
              size_t ncode, const uint8_t *codes,
              SearchResultType & res) const
     {
-        int ht = ivfpq.polysemous_ht;
-        size_t n_hamming_pass = 0, nup = 0;
+        constexpr size_t bs = 256;
+        int ht = polysemous_ht;
+        size_t n_hamming_pass = 0;
 
         int code_size = pq.code_size;
 
         HammingComputer hc (q_code.data(), code_size);
 
-        for (size_t j = 0; j < ncode; j++) {
-            const uint8_t *b_code = codes;
-            int hd = hc.hamming (b_code);
-            if (hd < ht) {
-                n_hamming_pass ++;
-                PQDecoder decoder(codes, pq.nbits);
+        int hds[bs];
+        uint16_t survivors[bs];
 
-                float dis = dis0;
-                const float *tab = sim_table;
+        for (size_t j0 = 0; j0 < ncode; j0 += bs) {
+            size_t nb = std::min (bs, ncode - j0);
+            const uint8_t *block = codes + j0 * code_size;
 
-                for (size_t m = 0; m < pq.M; m++) {
-                    dis += tab[decoder.decode()];
-                    tab += pq.ksub;
-                }
+            for (size_t j = 0; j < nb; j++) {
+                hds[j] = hc.hamming (block + j * code_size);
+            }
 
-                res.add (j, dis);
+            size_t nsurvivor = 0;
+            for (size_t j = 0; j < nb; j++) {
+                survivors[nsurvivor] = j;
+                nsurvivor += hds[j] < ht;
+            }
+
+            for (size_t i = 0; i < nsurvivor; i++) {
+                size_t j = j0 + survivors[i];
+                if (res.skip_entry (j)) {
+                    continue;
+                }
+                n_hamming_pass ++;
+                res.add (j, distance_with_table (codes + j * code_size));
             }
-            codes += code_size;
         }
 #pragma omp critical
         {
@@ -1037,31 +1313,51 @@ struct IVFPQScanner:
     int precompute_mode;
 
     IVFPQScanner(const IndexIVFPQ & ivfpq, bool store_pairs,
-                 int precompute_mode):
+                 int precompute_mode, bool quantized_lut):
         IVFPQScannerT<Index::idx_t, METRIC_TYPE, PQDecoder>(ivfpq, nullptr),
         store_pairs(store_pairs), precompute_mode(precompute_mode)
     {
+        this->quantized_lut = quantized_lut;
     }
 
     void set_query (const float *query) override {
+        InstrumentationTimer timer (STAGE_LUT);
         this->init_query (query);
     }
 
+    void set_query_lists (size_t nlist, const idx_t *list_nos) override {
+        // nothing to compute (nor to time) without batched tables
+        if (!this->batched_list_tables) {
+            return;
+        }
+        InstrumentationTimer timer (STAGE_LUT);
+        this->init_query_lists (nlist, list_nos);
+    }
+
     void set_list (idx_t list_no, float coarse_dis) override {
+        InstrumentationTimer timer (STAGE_LUT);
         this->init_list (list_no, coarse_dis, precompute_mode);
     }
 
+    void prefetch_list (idx_t list_no) const override {
+        // the per-list term of the precomputed tables
+        if (!this->by_residual || METRIC_TYPE != METRIC_L2 ||
+            this->batched_list_tables) {
+            return;
+        }
+        size_t n = this->pq.M * this->pq.ksub;
+        if (this->use_precomputed_table == 1) {
+            prefetch_L2 (&this->ivfpq.precomputed_table[list_no * n],
+                         n * sizeof(float));
+        } else if (this->use_precomputed_table == 3) {
+            prefetch_L2 (&this->ivfpq.precomputed_table_fp16[list_no * n],
+                         n * sizeof(uint16_t));
+        }
+    }
+
     float distance_to_code (const uint8_t *code) const override {
         assert(precompute_mode == 2);
-        float dis = this->dis0;
-        const float *tab = this->sim_table;
-        PQDecoder decoder(code, this->pq.nbits);
-
-        for (size_t m = 0; m < this->pq.M; m++) {
-            dis += tab[decoder.decode()];
-            tab += this->pq.ksub;
-        }
-        return dis;
+        return this->distance_with_table (code);
     }
 
     size_t scan_codes (size_t ncode,
@@ -1073,6 +1369,8 @@ struct IVFPQScanner:
         KnnSearchResults<C> res = {
             /* key */      this->key,
             /* ids */      this->store_pairs ? nullptr : ids,
+            /* sel */      this->sel,
+            /* sel_ids */  ids,
             /* k */        k,
             /* heap_sim */ heap_sim,
             /* heap_ids */ heap_ids,
@@ -1103,6 +1401,8 @@ struct IVFPQScanner:
         RangeSearchResults<C> res = {
             /* key */      this->key,
             /* ids */      this->store_pairs ? nullptr : ids,
+            /* sel */      this->sel,
+            /* sel_ids */  ids,
             /* radius */   radius,
             /* rres */     rres
         };
@@ -1125,37 +1425,144 @@ struct IVFPQScanner:
 
 template<class PQDecoder>
 InvertedListScanner *get_InvertedListScanner1 (const IndexIVFPQ &index,
-                                               bool store_pairs)
+                                               bool store_pairs,
+                                               bool quantized_lut)
 {
 
    if (index.metric_type == METRIC_INNER_PRODUCT) {
         return new IVFPQScanner
             <METRIC_INNER_PRODUCT, CMin<float, idx_t>, PQDecoder>
-            (index, store_pairs, 2);
+            (index, store_pairs, 2, quantized_lut);
     } else if (index.metric_type == METRIC_L2) {
         return new IVFPQScanner
             <METRIC_L2, CMax<float, idx_t>, PQDecoder>
-            (index, store_pairs, 2);
+            (index, store_pairs, 2, quantized_lut);
     }
     return nullptr;
 }
 
+InvertedListScanner *get_InvertedListScanner2 (const IndexIVFPQ &index,
+                                               bool store_pairs,
+                                               bool quantized_lut)
+{
+    if (index.pq.nbits == 8) {
+        return get_InvertedListScanner1<PQDecoder8> (
+              index, store_pairs, quantized_lut);
+    } else if (index.pq.nbits == 16) {
+        return get_InvertedListScanner1<PQDecoder16> (
+              index, store_pairs, false);
+    } else {
+        return get_InvertedListScanner1<PQDecoderGeneric> (
+              index, store_pairs, false);
+    }
+}
+
 
 } // anonymous namespace
 
 InvertedListScanner *
 IndexIVFPQ::get_InvertedListScanner (bool store_pairs) const
 {
+    return get_InvertedListScanner2 (*this, store_pairs, quantized_lut);
+}
 
-    if (pq.nbits == 8) {
-        return get_InvertedListScanner1<PQDecoder8> (*this, store_pairs);
-    } else if (pq.nbits == 16) {
-        return get_InvertedListScanner1<PQDecoder16> (*this, store_pairs);
-    } else {
-        return get_InvertedListScanner1<PQDecoderGeneric> (*this, store_pairs);
+
+void IndexIVFPQ::search_preassigned (
+        idx_t n, const float *x, idx_t k,
+        const idx_t *assign,
+        const float *centroid_dis,
+        float *distances, idx_t *labels,
+        bool store_pairs,
+        const IVFSearchParameters *params) const
+{
+    if (!quantized_lut || pq.nbits != 8 || rerank_factor <= 1) {
+        IndexIVF::search_preassigned (n, x, k, assign, centroid_dis,
+                                      distances, labels, store_pairs,
+                                      params);
+        return;
     }
-    return nullptr;
 
+    // collect the candidates with the quantized tables, as
+    // (list_no, offset) pairs
+    idx_t k2 = k * rerank_factor;
+    std::vector<float> dis2 (n * k2);
+    std::vector<idx_t> labels2 (n * k2);
+    IndexIVF::search_preassigned (n, x, k2, assign, centroid_dis,
+                                  dis2.data(), labels2.data(), true, params);
+
+    long nprobe = params ? params->nprobe : this->nprobe;
+
+#pragma omp parallel if (n > 1)
+    {
+        std::unique_ptr<InvertedListScanner> scanner (
+             get_InvertedListScanner2 (*this, true, false));
+        std::vector<idx_t> lo_sorted (k2);
+
+#pragma omp for
+        for (idx_t i = 0; i < n; i++) {
+            float *simi = distances + i * k;
+            idx_t *idxi = labels + i * k;
+            if (metric_type == METRIC_INNER_PRODUCT) {
+                minheap_heapify (k, simi, idxi);
+            } else {
+                maxheap_heapify (k, simi, idxi);
+            }
+            scanner->set_query (x + i * d);
+
+            // by list, so that the tables of each list are computed once
+            size_t ncand = 0;
+            for (idx_t j = 0; j < k2; j++) {
+                idx_t lo = labels2[i * k2 + j];
+                if (lo < 0) {
+                    break;
+                }
+                lo_sorted[ncand++] = lo;
+            }
+            std::sort (lo_sorted.begin(), lo_sorted.begin() + ncand);
+
+            idx_t cur_list = -1;
+            for (size_t j = 0; j < ncand; j++) {
+                idx_t lo = lo_sorted[j];
+                idx_t list_no = lo_listno (lo);
+                idx_t offset = lo_offset (lo);
+
+                if (list_no != cur_list) {
+                    float coarse_dis = 0;
+                    for (long l = 0; l < nprobe; l++) {
+                        if (assign[i * nprobe + l] == list_no) {
+                            coarse_dis = centroid_dis[i * nprobe + l];
+                            break;
+                        }
+                    }
+                    scanner->set_list (list_no, coarse_dis);
+                    cur_list = list_no;
+                }
+                float dis = scanner->distance_to_code (
+                     InvertedLists::ScopedCodes (invlists, list_no, offset)
+                     .get ());
+                idx_t id = store_pairs ? lo :
+                    invlists->get_single_id (list_no, offset);
+
+                if (metric_type == METRIC_INNER_PRODUCT) {
+                    if (dis > simi[0]) {
+                        minheap_pop (k, simi, idxi);
+                        minheap_push (k, simi, idxi, dis, id);
+                    }
+                } else {
+                    if (dis < simi[0]) {
+                        maxheap_pop (k, simi, idxi);
+                        maxheap_push (k, simi, idxi, dis, id);
+                    }
+                }
+            }
+
+            if (metric_type == METRIC_INNER_PRODUCT) {
+                minheap_reorder (k, simi, idxi);
+            } else {
+                maxheap_reorder (k, simi, idxi);
+            }
+        }
+    }
 }
 
 
@@ -1173,6 +1580,9 @@ IndexIVFPQ::IndexIVFPQ ()
     // initialize some runtime values
     use_precomputed_table = 0;
     scan_table_threshold = 0;
+    batched_list_tables = false;
+    quantized_lut = false;
+    rerank_factor = 0;
     do_polysemous_training = false;
     polysemous_ht = 0;
     polysemous_training = nullptr;
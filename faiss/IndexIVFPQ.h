@@ -50,6 +50,8 @@ struct FAISS_API IndexIVFPQ: IndexIVF {
      *     < precomputed_tables_max_bytes)
      * =1: tables that work for all quantizers (size 256 * nlist * M)
      * =2: specific version for MultiIndexQuantizer (much more compact)
+     * =3: same as 1, stored in fp16 (half the memory), never selected
+     *     by the heuristic
      */
     int use_precomputed_table;
     static size_t precomputed_table_max_bytes;
@@ -58,6 +60,28 @@ struct FAISS_API IndexIVFPQ: IndexIVF {
     /// size nlist * pq.M * pq.ksub
     std::vector <float> precomputed_table;
 
+    /// if use_precomputed_table == 3, size nlist * pq.M * pq.ksub
+    std::vector <uint16_t> precomputed_table_fp16;
+
+    /** without precomputed table (by_residual, L2), compute the
+     * centroid terms of the tables of the nprobe lists of a query at
+     * once, with ProductQuantizer::compute_inner_prod_tables, instead
+     * of a residual distance table per list. Assumes that the coarse
+     * distances are exact L2 distances. */
+    bool batched_list_tables;
+
+    /** search-time option for 8-bit PQ: quantize the look-up tables of
+     * each (query, list) pair to 16 bits with a shared scale, and sum
+     * them with integer arithmetic. The tables take half of the cache
+     * and the sums are exact, but the distances are approximate. Not
+     * used with an IDSelector or polysemous filtering. */
+    bool quantized_lut;
+
+    /** with quantized_lut, collect k * rerank_factor results with the
+     * quantized tables, then re-rank them with the float tables
+     * (disabled when <= 1) */
+    int rerank_factor;
+
     IndexIVFPQ (
             Index * quantizer, size_t d, size_t nlist,
             size_t M, size_t nbits_per_idx, MetricType metric = METRIC_L2);
@@ -90,6 +114,11 @@ struct FAISS_API IndexIVFPQ: IndexIVF {
     void reconstruct_from_offset (int64_t list_no, int64_t offset,
                                   float* recons) const override;
 
+    bool codes_depend_on_list () const override;
+
+    /// also updates the precomputed tables
+    idx_t split_list (idx_t list_no, int niter = 10) override;
+
     /** Find exact duplicates in the dataset.
      *
      * the duplicates are returned in pre-allocated arrays (see the
@@ -123,12 +152,24 @@ struct FAISS_API IndexIVFPQ: IndexIVF {
     void decode_multiple (size_t n, const idx_t *keys,
                           const uint8_t * xcodes, float * x) const;
 
+    /// re-ranks the results if quantized_lut and rerank_factor are set
+    void search_preassigned (idx_t n, const float *x, idx_t k,
+                             const idx_t *assign,
+                             const float *centroid_dis,
+                             float *distances, idx_t *labels,
+                             bool store_pairs,
+                             const IVFSearchParameters *params=nullptr
+                             ) const override;
+
     InvertedListScanner *get_InvertedListScanner (bool store_pairs)
         const override;
 
     /// build precomputed table
     void precompute_table ();
 
+    /// IndexIVF components, product quantizer and precomputed tables
+    MemoryUsage memory_usage () const override;
+
     IndexIVFPQ ();
 
 };
@@ -0,0 +1,442 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/IndexIVFPQFastScan.h>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <memory>
+
+#include <omp.h>
+
+#include <faiss/BlockInvertedLists.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/pq4_fast_scan.h>
+#include <faiss/impl/simd_result_handlers.h>
+#include <faiss/utils/Heap.h>
+#include <faiss/utils/quantize_lut.h>
+#include <faiss/utils/utils.h>
+
+
+namespace faiss {
+
+
+/*********************************************************
+ * IndexIVFPQFastScan implementation
+ ********************************************************/
+
+
+IndexIVFPQFastScan::IndexIVFPQFastScan (
+        Index * quantizer, size_t d, size_t nlist,
+        size_t M, size_t nbits_per_idx,
+        MetricType metric):
+    IndexIVF (quantizer, d, nlist, 0, metric),
+    pq (d, M, nbits_per_idx)
+{
+    FAISS_THROW_IF_NOT_MSG (nbits_per_idx == 4, "only 4-bit PQ is supported");
+    FAISS_THROW_IF_NOT (metric == METRIC_L2 ||
+                        metric == METRIC_INNER_PRODUCT);
+    by_residual = true;
+    is_trained = false;
+    init_fast_scan ();
+}
+
+IndexIVFPQFastScan::IndexIVFPQFastScan ():
+    by_residual (true), M2 (0)
+{}
+
+
+IndexIVFPQFastScan::IndexIVFPQFastScan (const IndexIVFPQ & orig):
+    IndexIVF (orig.quantizer, orig.d, orig.nlist, 0, orig.metric_type),
+    pq (orig.pq)
+{
+    FAISS_THROW_IF_NOT_MSG (pq.nbits == 4, "only 4-bit PQ is supported");
+    FAISS_THROW_IF_NOT (!orig.by_residual ||
+                        orig.metric_type == METRIC_L2 ||
+                        orig.metric_type == METRIC_INNER_PRODUCT);
+    by_residual = orig.by_residual;
+    is_trained = orig.is_trained;
+    ntotal = orig.ntotal;
+    nprobe = orig.nprobe;
+    max_codes = orig.max_codes;
+    init_fast_scan ();
+
+    BlockInvertedLists *bil = dynamic_cast<BlockInvertedLists*> (invlists);
+    const InvertedLists *oil = orig.invlists;
+
+    for (size_t list_no = 0; list_no < nlist; list_no++) {
+        size_t n = oil->list_size (list_no);
+        if (n == 0) {
+            continue;
+        }
+        bil->resize (list_no, n);
+        memcpy (bil->ids[list_no].data(),
+                InvertedLists::ScopedIds (oil, list_no).get(),
+                n * sizeof (idx_t));
+        pq4_pack_codes_range (
+                InvertedLists::ScopedCodes (oil, list_no).get(),
+                pq.M, 0, n, M2, bil->codes[list_no].data());
+    }
+    // the offsets in the lists are unchanged
+    direct_map = orig.direct_map;
+}
+
+
+void IndexIVFPQFastScan::init_fast_scan ()
+{
+    code_size = pq.code_size;
+    M2 = (pq.M + 1) / 2 * 2;
+    FAISS_THROW_IF_NOT_MSG (M2 <= 256,
+            "the 16-bit accumulators support at most 256 sub-quantizers");
+    replace_invlists (
+            new BlockInvertedLists (nlist, pq4_bbs, pq4_block_size (M2)),
+            true);
+}
+
+
+/*********************************************************
+ * Training and encoding
+ ********************************************************/
+
+void IndexIVFPQFastScan::train_residual (idx_t n, const float *x_in)
+{
+    const float * x = fvecs_maybe_subsample (
+         d, (size_t*)&n, pq.cp.max_points_per_centroid * pq.ksub,
+         x_in, verbose, pq.cp.seed);
+
+    std::unique_ptr<float []> del_x;
+    if (x != x_in) {
+        del_x.reset ((float*)x);
+    }
+
+    const float *trainset;
+    std::unique_ptr<float []> residuals;
+
+    if (by_residual) {
+        if (verbose) printf ("computing residuals\n");
+        std::vector<idx_t> assign (n);
+        quantizer->assign (n, x, assign.data());
+        residuals.reset (new float [n * d]);
+        quantizer->compute_residual_n (n, x, residuals.get(), assign.data());
+        trainset = residuals.get();
+    } else {
+        trainset = x;
+    }
+
+    if (verbose) {
+        printf ("training %zdx%zd product quantizer on %" PRId64 " vectors in %dD\n",
+                pq.M, pq.ksub, n, d);
+    }
+    pq.verbose = verbose;
+    pq.train (n, trainset);
+}
+
+
+void IndexIVFPQFastScan::encode_vectors (
+        idx_t n, const float* x,
+        const idx_t *list_nos, uint8_t * codes,
+        bool include_listnos) const
+{
+    if (by_residual) {
+        std::unique_ptr<float []> residuals (new float [n * d]);
+        for (idx_t i = 0; i < n; i++) {
+            if (list_nos[i] < 0) {
+                memset (residuals.get() + i * d, 0, sizeof(float) * d);
+            } else {
+                quantizer->compute_residual (
+                     x + i * d, residuals.get() + i * d, list_nos[i]);
+            }
+        }
+        pq.compute_codes (residuals.get(), codes, n);
+    } else {
+        pq.compute_codes (x, codes, n);
+    }
+
+    if (include_listnos) {
+        size_t coarse_size = coarse_code_size();
+        for (idx_t i = n - 1; i >= 0; i--) {
+            uint8_t * code = codes + i * (coarse_size + code_size);
+            memmove (code + coarse_size,
+                     codes + i * code_size, code_size);
+            encode_listno (list_nos[i], code);
+        }
+    }
+}
+
+
+void IndexIVFPQFastScan::add_with_ids (
+        idx_t n, const float * x, const idx_t *xids)
+{
+    // do some blocking to avoid excessive allocs
+    idx_t bs = 65536;
+    if (n > bs) {
+        for (idx_t i0 = 0; i0 < n; i0 += bs) {
+            idx_t i1 = std::min (n, i0 + bs);
+            if (verbose) {
+                printf("   IndexIVFPQFastScan::add_with_ids %" PRId64 ":%" PRId64 "\n",
+                       i0, i1);
+            }
+            add_with_ids (i1 - i0, x + i0 * d,
+                          xids ? xids + i0 : nullptr);
+        }
+        return;
+    }
+
+    FAISS_THROW_IF_NOT (is_trained);
+    direct_map.check_can_add (xids);
+
+    BlockInvertedLists *bil = dynamic_cast<BlockInvertedLists*> (invlists);
+    FAISS_THROW_IF_NOT_MSG (bil, "fast-scan requires BlockInvertedLists");
+
+    std::unique_ptr<idx_t []> idx (new idx_t[n]);
+    assign_for_add (n, x, idx.get());
+
+    std::unique_ptr<uint8_t []> flat_codes (new uint8_t [n * code_size]);
+    encode_vectors (n, x, idx.get(), flat_codes.get());
+
+    DirectMapAdd dm_adder (direct_map, n, xids);
+    size_t nadd = 0;
+
+#pragma omp parallel reduction(+: nadd)
+    {
+        int nt = omp_get_num_threads();
+        int rank = omp_get_thread_num();
+
+        // each thread takes care of a subset of lists. The entries are
+        // appended one by one because the last block of a list may be
+        // partially filled
+        for (size_t i = 0; i < n; i++) {
+            idx_t list_no = idx [i];
+            if (list_no >= 0 && list_no % nt == rank) {
+                idx_t id = xids ? xids[i] : ntotal + i;
+                size_t ofs = bil->list_size (list_no);
+                bil->resize (list_no, ofs + 1);
+                bil->ids[list_no][ofs] = id;
+                pq4_pack_codes_range (
+                        flat_codes.get() + i * code_size, pq.M,
+                        ofs, ofs + 1, M2, bil->codes[list_no].data());
+                dm_adder.add (i, list_no, ofs);
+                nadd++;
+            } else if (rank == 0 && list_no == -1) {
+                dm_adder.add (i, -1, 0);
+            }
+        }
+    }
+
+    if (verbose) {
+        printf("    added %zd / %" PRId64 " vectors\n", nadd, n);
+    }
+
+    ntotal += n;
+}
+
+
+/*********************************************************
+ * Search
+ ********************************************************/
+
+
+void IndexIVFPQFastScan::search_preassigned (
+        idx_t n, const float *x, idx_t k,
+        const idx_t *keys, const float *coarse_dis,
+        float *distances, idx_t *labels,
+        bool store_pairs,
+        const IVFSearchParameters *params) const
+{
+    FAISS_THROW_IF_NOT (k > 0);
+    FAISS_THROW_IF_NOT_MSG (!(params && params->sel),
+            "IDSelector not supported for fast-scan indexes");
+    FAISS_THROW_IF_NOT_MSG (ntombstones == 0,
+            "call purge_tombstones before searching a fast-scan index");
+    using C = DequantizingHeapHandler::C;
+
+    size_t nprobe = params ? params->nprobe : this->nprobe;
+    size_t max_codes = params ? params->max_codes : this->max_codes;
+
+    for (idx_t i = 0; i < n * (idx_t)nprobe; i++) {
+        FAISS_THROW_IF_NOT_FMT (keys[i] < (idx_t) nlist,
+                                "Invalid key=%" PRId64 " nlist=%zd\n",
+                                keys[i], nlist);
+    }
+
+    // with residuals and L2, each list has its own table. Otherwise the
+    // table is shared and the coarse term goes to the bias
+    bool table_per_list = by_residual && metric_type == METRIC_L2;
+    size_t ntab = table_per_list ? nprobe : 1;
+    size_t dim12 = pq.ksub * pq.M;
+    size_t lut_size = pq.ksub * M2;
+
+    size_t nlistv = 0, ndis = 0, nheap = 0;
+
+#pragma omp parallel if (n > 1) reduction(+: nlistv, ndis, nheap)
+    {
+        std::vector<float> dis_tables (ntab * dim12);
+        std::vector<uint8_t> LUT (ntab * lut_size);
+        std::vector<float> biases (ntab);
+        std::vector<float> residual (d);
+
+        DequantizingHeapHandler handler (1, k);
+
+#pragma omp for
+        for (idx_t i = 0; i < n; i++) {
+            const float *xi = x + i * d;
+            const idx_t *keysi = keys + i * nprobe;
+
+            if (table_per_list) {
+                for (size_t j = 0; j < nprobe; j++) {
+                    float *tab = dis_tables.data() + j * dim12;
+                    if (keysi[j] < 0) {
+                        memset (tab, 0, sizeof(float) * dim12);
+                        continue;
+                    }
+                    quantizer->compute_residual (xi, residual.data(), keysi[j]);
+                    pq.compute_distance_table (residual.data(), tab);
+                }
+            } else if (metric_type == METRIC_L2) {
+                pq.compute_distance_table (xi, dis_tables.data());
+            } else {
+                // search for the largest inner products = smallest negated
+                pq.compute_inner_prod_table (xi, dis_tables.data());
+                for (size_t j = 0; j < dim12; j++) {
+                    dis_tables[j] = -dis_tables[j];
+                }
+            }
+
+            float a;
+            quantize_lut::quantize_LUT_and_bias (
+                    ntab, pq.M, pq.ksub, dis_tables.data(), nullptr,
+                    M2, LUT.data(), &a, biases.data());
+
+            float *heap_dis = distances + i * k;
+            idx_t *heap_ids = labels + i * k;
+            heap_heapify<C> (k, heap_dis, heap_ids);
+            handler.set_heap (0, heap_dis, heap_ids);
+
+            size_t nscan = 0;
+
+            for (size_t j = 0; j < nprobe; j++) {
+                idx_t key = keysi[j];
+                if (key < 0) {
+                    // not enough centroids for multiprobe
+                    continue;
+                }
+                size_t list_size = invlists->list_size (key);
+                if (list_size == 0) {
+                    continue;
+                }
+
+                float bias = biases[table_per_list ? j : 0];
+                if (by_residual && metric_type == METRIC_INNER_PRODUCT) {
+                    bias -= coarse_dis[i * nprobe + j];
+                }
+                handler.set_normalizers (0, a, bias);
+                if (!handler.can_improve (0)) {
+                    // no code of this list can enter the result list
+                    continue;
+                }
+
+                InvertedLists::ScopedCodes codes (invlists, key);
+                std::unique_ptr<InvertedLists::ScopedIds> ids;
+                if (store_pairs) {
+                    handler.ids = nullptr;
+                    handler.id_offset = lo_build (key, 0);
+                } else {
+                    ids.reset (new InvertedLists::ScopedIds (invlists, key));
+                    handler.ids = ids->get();
+                    handler.id_offset = 0;
+                }
+                handler.ntotal = list_size;
+
+                // for 1 query, the packed LUT is the same as the input LUT
+                size_t nblock = (list_size + pq4_bbs - 1) / pq4_bbs;
+                pq4_accumulate_loop (
+                        1, nblock, M2, codes.get(),
+                        LUT.data() + (table_per_list ? j : 0) * lut_size,
+                        handler);
+
+                nlistv++;
+                nscan += list_size;
+                if (max_codes && nscan >= max_codes) {
+                    break;
+                }
+            }
+
+            ndis += nscan;
+
+            heap_reorder<C> (k, heap_dis, heap_ids);
+            if (metric_type == METRIC_INNER_PRODUCT) {
+                for (idx_t j = 0; j < k; j++) {
+                    heap_dis[j] = -heap_dis[j];
+                }
+            }
+        }
+        nheap += handler.nup;
+    }
+
+    indexIVF_stats.nq += n;
+    indexIVF_stats.nlist += nlistv;
+    indexIVF_stats.ndis += ndis;
+    indexIVF_stats.nheap_updates += nheap;
+}
+
+
+/*********************************************************
+ * Decoding
+ ********************************************************/
+
+
+void IndexIVFPQFastScan::reconstruct_from_offset (
+        int64_t list_no, int64_t offset, float* recons) const
+{
+    std::vector<uint8_t> code (code_size);
+    pq4_get_code (InvertedLists::ScopedCodes (invlists, list_no).get(),
+                  pq.M, M2, offset, code.data());
+    pq.decode (code.data(), recons);
+
+    if (by_residual) {
+        std::vector<float> centroid (d);
+        quantizer->reconstruct (list_no, centroid.data());
+        for (int i = 0; i < d; ++i) {
+            recons[i] += centroid[i];
+        }
+    }
+}
+
+
+void IndexIVFPQFastScan::sa_decode (idx_t n, const uint8_t *codes,
+                                    float *x) const
+{
+    size_t coarse_size = coarse_code_size ();
+
+#pragma omp parallel
+    {
+        std::vector<float> residual (d);
+
+#pragma omp for
+        for (idx_t i = 0; i < n; i++) {
+            const uint8_t *code = codes + i * (code_size + coarse_size);
+            int64_t list_no = decode_listno (code);
+            float *xi = x + i * d;
+            pq.decode (code + coarse_size, xi);
+            if (by_residual) {
+                quantizer->reconstruct (list_no, residual.data());
+                for (size_t j = 0; j < d; j++) {
+                    xi[j] += residual[j];
+                }
+            }
+        }
+    }
+}
+
+
+} // namespace faiss
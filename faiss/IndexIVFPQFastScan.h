@@ -0,0 +1,85 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#ifndef FAISS_INDEX_IVFPQ_FAST_SCAN_H
+#define FAISS_INDEX_IVFPQ_FAST_SCAN_H
+
+#include <vector>
+
+#include <faiss/IndexIVF.h>
+#include <faiss/IndexIVFPQ.h>
+#include <faiss/impl/ProductQuantizer.h>
+
+
+namespace faiss {
+
+/** Fast scan version of IVFPQ. Works for 4-bit PQ for now.
+ *
+ * The inverted lists are BlockInvertedLists: each list stores its codes in
+ * blocks of 32 vectors in the layout of pq4_fast_scan.h. For each query, the
+ * distance tables of all visited lists are quantized to 8 bits with a common
+ * scale, so that the 16-bit distances of the different lists are comparable
+ * up to a per-list bias.
+ *
+ * As for IndexPQFastScan, the returned distances are computed from the
+ * quantized tables.
+ */
+struct IndexIVFPQFastScan: IndexIVF {
+
+    bool by_residual;              ///< Encode residual or plain vector?
+    ProductQuantizer pq;           ///< produces the codes
+
+    /// pq.M rounded up to a multiple of 2
+    size_t M2;
+
+    IndexIVFPQFastScan (
+            Index * quantizer, size_t d, size_t nlist,
+            size_t M, size_t nbits_per_idx = 4,
+            MetricType metric = METRIC_L2);
+
+    IndexIVFPQFastScan ();
+
+    /// build from an existing IndexIVFPQ (the inverted lists are repacked)
+    explicit IndexIVFPQFastScan (const IndexIVFPQ & orig);
+
+    /// initialize M2 and the block inverted lists after pq is set
+    void init_fast_scan ();
+
+    /// trains the product quantizer
+    void train_residual(idx_t n, const float* x) override;
+
+    /// same as the regular IVFPQ encoder. The codes are not reorganized by
+    /// blocks at this point
+    void encode_vectors(idx_t n, const float* x,
+                        const idx_t *list_nos,
+                        uint8_t * codes,
+                        bool include_listno = false) const override;
+
+    void add_with_ids(idx_t n, const float* x, const idx_t* xids) override;
+
+    void search_preassigned (idx_t n, const float *x, idx_t k,
+                             const idx_t *assign,
+                             const float *centroid_dis,
+                             float *distances, idx_t *labels,
+                             bool store_pairs,
+                             const IVFSearchParameters *params=nullptr
+                             ) const override;
+
+    void reconstruct_from_offset (int64_t list_no, int64_t offset,
+                                  float* recons) const override;
+
+    void sa_decode (idx_t n, const uint8_t *bytes,
+                    float *x) const override;
+
+};
+
+
+} // namespace faiss
+
+#endif
@@ -16,10 +16,15 @@
 
 #include <faiss/utils/hamming.h>
 #include <faiss/utils/utils.h>
+#include <faiss/utils/cpu_dispatch.h>
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/impl/AuxIndexStructures.h>
 #include <faiss/VectorTransform.h>
 
+#ifdef FAISS_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
 namespace faiss {
 
 
@@ -141,9 +146,9 @@ void IndexIVFSpectralHash::train_residual (idx_t n, const float *x)
 
 namespace {
 
-void binarize_with_freq(size_t nbit, float freq,
-                        const float *x, const float *c,
-                        uint8_t *codes)
+void binarize_with_freq_ref(size_t nbit, float freq,
+                            const float *x, const float *c,
+                            uint8_t *codes)
 {
     memset (codes, 0, (nbit + 7) / 8);
     for (size_t i = 0; i < nbit; i++) {
@@ -154,6 +159,46 @@ void binarize_with_freq(size_t nbit, float freq,
     }
 }
 
+#ifdef FAISS_X86_DISPATCH
+
+/// same, 8 bits at a time: the parity bit of floor((x - c) * freq) is
+/// moved to the sign bit and collected with movemask
+FAISS_AVX2_TARGET
+void binarize_with_freq_avx2(size_t nbit, float freq,
+                             const float *x, const float *c,
+                             uint8_t *codes)
+{
+    __m256 vfreq = _mm256_set1_ps (freq);
+    size_t i = 0;
+    for (; i + 8 <= nbit; i += 8) {
+        __m256 xf = _mm256_mul_ps (
+                _mm256_sub_ps (_mm256_loadu_ps (x + i),
+                               _mm256_loadu_ps (c + i)), vfreq);
+        __m256i xi = _mm256_cvttps_epi32 (_mm256_floor_ps (xf));
+        __m256i bits = _mm256_slli_epi32 (xi, 31);
+        codes[i >> 3] = _mm256_movemask_ps (_mm256_castsi256_ps (bits));
+    }
+    if (i < nbit) {
+        binarize_with_freq_ref (nbit - i, freq, x + i, c + i,
+                                codes + (i >> 3));
+    }
+}
+
+#endif
+
+void binarize_with_freq(size_t nbit, float freq,
+                        const float *x, const float *c,
+                        uint8_t *codes)
+{
+#ifdef FAISS_X86_DISPATCH
+    if (use_avx2 ()) {
+        binarize_with_freq_avx2 (nbit, freq, x, c, codes);
+        return;
+    }
+#endif
+    binarize_with_freq_ref (nbit, freq, x, c, codes);
+}
+
 
 };
 
@@ -265,7 +310,10 @@ struct IVFScanner: InvertedListScanner {
     {
         size_t nup = 0;
         for (size_t j = 0; j < list_size; j++) {
-
+            if (sel && !sel->is_member (ids[j])) {
+                codes += code_size;
+                continue;
+            }
             float dis = hc.hamming (codes);
 
             if (dis < simi [0]) {
@@ -286,6 +334,10 @@ struct IVFScanner: InvertedListScanner {
                            RangeQueryResult & res) const override
     {
         for (size_t j = 0; j < list_size; j++) {
+            if (sel && !sel->is_member (ids[j])) {
+                codes += code_size;
+                continue;
+            }
             float dis = hc.hamming (codes);
             if (dis < radius) {
                 int64_t id = store_pairs ? lo_build (list_no, j) : ids[j];
@@ -130,16 +130,17 @@ void IndexLSH::search (
         const float *x,
         idx_t k,
         float *distances,
-        idx_t *labels) const
+        idx_t *labels,
+        const SearchParameters *params) const
 {
+    FAISS_THROW_IF_NOT_MSG (!params,
+            "search params not supported for this index");
     FAISS_THROW_IF_NOT (is_trained);
-    const float *xt = apply_preprocess (n, x);
-    ScopeDeleter<float> del (xt == x ? nullptr : xt);
 
     uint8_t * qcodes = new uint8_t [n * bytes_per_vec];
     ScopeDeleter<uint8_t> del2 (qcodes);
 
-    fvecs2bitvecs (xt, qcodes, nbits, n);
+    sa_encode (n, x, qcodes);
 
     int * idistances = new int [n * k];
     ScopeDeleter<int> del3 (idistances);
@@ -185,9 +186,22 @@ void IndexLSH::sa_encode (idx_t n, const float *x,
                                 uint8_t *bytes) const
 {
     FAISS_THROW_IF_NOT (is_trained);
-    const float *xt = apply_preprocess (n, x);
-    ScopeDeleter<float> del (xt == x ? nullptr : xt);
-    fvecs2bitvecs (xt, bytes, nbits, n);
+    // same as apply_preprocess + fvecs2bitvecs, the selection of the
+    // components and the thresholds are applied by the binarization
+    const float *th = train_thresholds ? thresholds.data() : nullptr;
+    if (!rotate_data) {
+        fvecs2bitvecs_threshold (x, d, th, bytes, nbits, n);
+        return;
+    }
+    // rotate by blocks to bound the temporary storage
+    idx_t bs = 65536;
+    std::vector<float> xt (std::min (n, bs) * nbits);
+    for (idx_t i0 = 0; i0 < n; i0 += bs) {
+        idx_t i1 = std::min (i0 + bs, n);
+        rrot.apply_noalloc (i1 - i0, x + i0 * d, xt.data());
+        fvecs2bitvecs_threshold (xt.data(), nbits, th,
+                                 bytes + i0 * bytes_per_vec, nbits, i1 - i0);
+    }
 }
 
 void IndexLSH::sa_decode (idx_t n, const uint8_t *bytes,
@@ -9,9 +9,14 @@
 
 
 #include <faiss/IndexLattice.h>
+
+#include <algorithm>
+#include <cstring>
+
 #include <faiss/utils/hamming.h>    // for the bitstring routines
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/utils/distances.h>
+#include <faiss/utils/Heap.h>
 
 namespace faiss {
 
@@ -34,9 +39,28 @@ IndexLattice::IndexLattice (idx_t d, int nsq, int scale_nbit, int r2):
 
     code_size = (total_nbit + 7) / 8;
 
+    bs = 16384;
+    set_codebook (1 << 18);
+
     is_trained = false;
 }
 
+void IndexLattice::set_codebook (size_t max_size)
+{
+    codebook.clear();
+    codebook.shrink_to_fit();
+    uint64_t nv = zn_sphere_codec.nv;
+    if (nv > max_size / dsq) {
+        return;
+    }
+    std::vector<uint64_t> all_codes (nv);
+    for (uint64_t i = 0; i < nv; i++) {
+        all_codes[i] = i;
+    }
+    codebook.resize (nv * dsq);
+    zn_sphere_codec.decode_multi (nv, all_codes.data(), codebook.data());
+}
+
 void IndexLattice::train(idx_t n, const float* x)
 {
     // compute ranges per sub-block
@@ -70,6 +94,18 @@ size_t IndexLattice::sa_code_size () const
     return code_size;
 }
 
+namespace {
+
+/// decoded norm of a sub-vector, divided by the norm of the lattice
+/// points
+float decode_norm (uint64_t scale, float vmin, float vmax, float sc, float r)
+{
+    float norm = (scale + 0.5) * (vmax - vmin) / sc + vmin;
+    norm /= r;
+    return norm;
+}
+
+} // anonymous namespace
 
 
 void IndexLattice::sa_encode (idx_t n, const float *x, uint8_t *codes) const
@@ -78,20 +114,30 @@ void IndexLattice::sa_encode (idx_t n, const float *x, uint8_t *codes) const
     const float * mins = trained.data();
     const float * maxs = mins + nsq;
     int64_t sc = int64_t(1) << scale_nbit;
+    std::vector<uint64_t> lattice_codes (std::min (n, (idx_t)bs) * nsq);
 
-#pragma omp parallel for
-    for (idx_t i = 0; i < n; i++) {
-        BitstringWriter wr(codes + i * code_size, code_size);
-        const float *xi = x + i * d;
-        for (int j = 0; j < nsq; j++) {
-            float nj =
-                (sqrtf(fvec_norm_L2sqr(xi, dsq)) - mins[j])
-                * sc / (maxs[j] - mins[j]);
-            if (nj < 0) nj = 0;
-            if (nj >= sc) nj = sc - 1;
-            wr.write((int64_t)nj, scale_nbit);
-            wr.write(zn_sphere_codec.encode(xi), lattice_nbit);
-            xi += dsq;
+    for (idx_t i0 = 0; i0 < n; i0 += bs) {
+        idx_t i1 = std::min (i0 + (idx_t)bs, n);
+        // the sub-vectors of consecutive vectors are contiguous, so
+        // they are encoded in a single batch
+        zn_sphere_codec.encode_multi (
+             (i1 - i0) * nsq, x + i0 * d, lattice_codes.data());
+
+#pragma omp parallel for if (i1 - i0 > 1000)
+        for (idx_t i = i0; i < i1; i++) {
+            BitstringWriter wr(codes + i * code_size, code_size);
+            const float *xi = x + i * d;
+            const uint64_t *lc = lattice_codes.data() + (i - i0) * nsq;
+            for (int j = 0; j < nsq; j++) {
+                float nj =
+                    (sqrtf(fvec_norm_L2sqr(xi, dsq)) - mins[j])
+                    * sc / (maxs[j] - mins[j]);
+                if (nj < 0) nj = 0;
+                if (nj >= sc) nj = sc - 1;
+                wr.write((int64_t)nj, scale_nbit);
+                wr.write(lc[j], lattice_nbit);
+                xi += dsq;
+            }
         }
     }
 }
@@ -102,41 +148,273 @@ void IndexLattice::sa_decode (idx_t n, const uint8_t *codes, float *x) const
     const float * maxs = mins + nsq;
     float sc = int64_t(1) << scale_nbit;
     float r = sqrtf(zn_sphere_codec.r2);
+    idx_t bs1 = std::min (n, (idx_t)bs);
+    std::vector<uint64_t> lattice_codes (bs1 * nsq);
+    std::vector<float> norms (bs1 * nsq);
 
-#pragma omp parallel for
-    for (idx_t i = 0; i < n; i++) {
-        BitstringReader rd(codes + i * code_size, code_size);
-        float *xi = x + i * d;
-        for (int j = 0; j < nsq; j++) {
-            float norm =
-                (rd.read (scale_nbit) + 0.5) *
-                (maxs[j] - mins[j]) / sc + mins[j];
-            norm /= r;
-            zn_sphere_codec.decode (rd.read (lattice_nbit), xi);
+    for (idx_t i0 = 0; i0 < n; i0 += bs) {
+        idx_t i1 = std::min (i0 + (idx_t)bs, n);
+
+#pragma omp parallel for if (i1 - i0 > 1000)
+        for (idx_t i = i0; i < i1; i++) {
+            BitstringReader rd(codes + i * code_size, code_size);
+            uint64_t *lc = lattice_codes.data() + (i - i0) * nsq;
+            float *ni = norms.data() + (i - i0) * nsq;
+            for (int j = 0; j < nsq; j++) {
+                ni[j] = decode_norm (rd.read (scale_nbit),
+                                     mins[j], maxs[j], sc, r);
+                lc[j] = rd.read (lattice_nbit);
+            }
+        }
+
+        float *xb = x + i0 * d;
+        if (codebook.empty()) {
+            zn_sphere_codec.decode_multi (
+                 (i1 - i0) * nsq, lattice_codes.data(), xb);
+        }
+
+#pragma omp parallel for if (i1 - i0 > 1000)
+        for (idx_t i = 0; i < (i1 - i0) * nsq; i++) {
+            float *xi = xb + i * dsq;
+            const float *ci = codebook.empty() ? xi :
+                codebook.data() + lattice_codes[i] * dsq;
             for (int l = 0; l < dsq; l++) {
-                xi[l] *= norm;
+                xi[l] = ci[l] * norms[i];
             }
-            xi += dsq;
         }
     }
 }
 
-void IndexLattice::add(idx_t , const float* )
+void IndexLattice::add(idx_t n, const float* x)
+{
+    FAISS_THROW_IF_NOT (is_trained);
+    codes.resize ((n + ntotal) * code_size);
+    sa_encode (n, x, &codes[ntotal * code_size]);
+    ntotal += n;
+}
+
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+/// scan the codes of a lattice index for one query
+template <class C>
+struct LatticeScanner {
+    const IndexLattice &index;
+    size_t nsq, dsq, sc;
+    uint64_t nv;
+    bool use_lut;
+
+    /// decoded norms and squared norms of the sub-vectors, per scale
+    std::vector<float> norms, norms2;
+
+    /// query-to-lattice point dot products, size nsq * nv
+    std::vector<float> lut;
+
+    /// the fields of the codes can be read with a single 64-bit load
+    bool fast_unpack;
+    int field_nbit;
+    uint64_t scale_mask, lattice_mask;
+
+    // per-block buffers
+    std::vector<uint8_t> block_codes;
+    std::vector<uint32_t> scales;
+    std::vector<uint64_t> lattice_codes;
+    std::vector<float> ips, decoded;
+
+    static const size_t block_size = 256;
+
+    LatticeScanner (const IndexLattice &index, bool use_lut):
+        index (index), nsq (index.nsq), dsq (index.dsq),
+        sc (size_t(1) << index.scale_nbit),
+        nv (index.zn_sphere_codec.nv), use_lut (use_lut),
+        scales (block_size * nsq), lattice_codes (block_size * nsq),
+        ips (block_size * nsq)
+    {
+        field_nbit = index.scale_nbit + index.lattice_nbit;
+        fast_unpack = field_nbit <= 56;
+        scale_mask = (uint64_t(1) << index.scale_nbit) - 1;
+        lattice_mask = fast_unpack ?
+            (uint64_t(1) << index.lattice_nbit) - 1 : 0;
+        if (fast_unpack) {
+            block_codes.resize (block_size * index.code_size + 8);
+        }
+        const float * mins = index.trained.data();
+        const float * maxs = mins + nsq;
+        float r2 = index.zn_sphere_codec.r2;
+        norms.resize (nsq * sc);
+        norms2.resize (nsq * sc);
+        for (size_t j = 0; j < nsq; j++) {
+            for (size_t s = 0; s < sc; s++) {
+                float nr = decode_norm (s, mins[j], maxs[j], sc, sqrtf(r2));
+                norms[j * sc + s] = nr;
+                norms2[j * sc + s] = nr * nr * r2;
+            }
+        }
+        if (use_lut) {
+            lut.resize (nsq * nv);
+        } else if (index.codebook.empty()) {
+            decoded.resize (block_size * nsq * dsq);
+        }
+    }
+
+    void scan (const float *q, idx_t k, float *D, idx_t *I)
+    {
+        const idx_t ntotal = index.ntotal;
+        const uint8_t *codes = index.codes.data();
+        size_t code_size = index.code_size;
+        const float *codebook =
+            index.codebook.empty() ? nullptr : index.codebook.data();
+        bool is_l2 = index.metric_type == METRIC_L2;
+        float qnorm2 = is_l2 ? fvec_norm_L2sqr (q, index.d) : 0;
+
+        if (use_lut) {
+            for (size_t j = 0; j < nsq; j++) {
+                fvec_inner_products_ny (lut.data() + j * nv, q + j * dsq,
+                                        codebook, dsq, nv);
+            }
+        }
+
+        heap_heapify<C> (k, D, I);
+
+        for (idx_t i0 = 0; i0 < ntotal; i0 += block_size) {
+            size_t ni = std::min (ntotal - i0, (idx_t)block_size);
+
+            if (fast_unpack) {
+                // padded copy so that 8 bytes can be read from any field
+                memcpy (block_codes.data(), codes + i0 * code_size,
+                        ni * code_size);
+                for (size_t i = 0; i < ni; i++) {
+                    const uint8_t *code = block_codes.data() + i * code_size;
+                    for (size_t j = 0; j < nsq; j++) {
+                        size_t bit = j * field_nbit;
+                        uint64_t w;
+                        memcpy (&w, code + (bit >> 3), sizeof(w));
+                        w >>= bit & 7;
+                        scales[i * nsq + j] = w & scale_mask;
+                        lattice_codes[i * nsq + j] =
+                            (w >> index.scale_nbit) & lattice_mask;
+                    }
+                }
+            } else {
+                for (size_t i = 0; i < ni; i++) {
+                    BitstringReader rd (codes + (i0 + i) * code_size,
+                                        code_size);
+                    for (size_t j = 0; j < nsq; j++) {
+                        scales[i * nsq + j] = rd.read (index.scale_nbit);
+                        lattice_codes[i * nsq + j] =
+                            rd.read (index.lattice_nbit);
+                    }
+                }
+            }
+
+            // dot products between the query sub-vectors and the
+            // lattice points
+            if (use_lut) {
+                for (size_t i = 0; i < ni; i++) {
+                    for (size_t j = 0; j < nsq; j++) {
+                        ips[i * nsq + j] =
+                            lut[j * nv + lattice_codes[i * nsq + j]];
+                    }
+                }
+            } else {
+                if (!codebook) {
+                    index.zn_sphere_codec.decode_multi (
+                         ni * nsq, lattice_codes.data(), decoded.data());
+                }
+                for (size_t i = 0; i < ni; i++) {
+                    for (size_t j = 0; j < nsq; j++) {
+                        size_t ij = i * nsq + j;
+                        const float *c = codebook ?
+                            codebook + lattice_codes[ij] * dsq :
+                            decoded.data() + ij * dsq;
+                        ips[ij] = fvec_inner_product (q + j * dsq, c, dsq);
+                    }
+                }
+            }
+
+            for (size_t i = 0; i < ni; i++) {
+                float dis = qnorm2;
+                for (size_t j = 0; j < nsq; j++) {
+                    size_t s = j * sc + scales[i * nsq + j];
+                    if (is_l2) {
+                        dis += norms2[s] - 2 * norms[s] * ips[i * nsq + j];
+                    } else {
+                        dis += norms[s] * ips[i * nsq + j];
+                    }
+                }
+                if (C::cmp (D[0], dis)) {
+                    heap_pop<C> (k, D, I);
+                    heap_push<C> (k, D, I, dis, i0 + i);
+                }
+            }
+        }
+
+        heap_reorder<C> (k, D, I);
+    }
+
+};
+
+template <class C>
+void search_lattice (const IndexLattice &index, idx_t n, const float *x,
+                     idx_t k, float *distances, idx_t *labels)
 {
-    FAISS_THROW_MSG("not implemented");
+    // the look-up tables are worthwhile when the codes reference more
+    // points than there are in the lattice sphere
+    bool use_lut = !index.codebook.empty() &&
+        index.ntotal > index.zn_sphere_codec.nv;
+
+#pragma omp parallel if (n > 1)
+    {
+        LatticeScanner<C> scanner (index, use_lut);
+#pragma omp for
+        for (idx_t i = 0; i < n; i++) {
+            scanner.scan (x + i * index.d, k,
+                          distances + i * k, labels + i * k);
+        }
+    }
 }
 
+} // anonymous namespace
+
 
-void  IndexLattice::search(idx_t , const float* , idx_t ,
-                           float* , idx_t* ) const
+void  IndexLattice::search(idx_t n, const float* x, idx_t k,
+                           float* distances, idx_t* labels,
+                           const SearchParameters * params) const
 {
-    FAISS_THROW_MSG("not implemented");
+    FAISS_THROW_IF_NOT_MSG (!params,
+            "search params not supported for this index");
+    FAISS_THROW_IF_NOT (is_trained);
+    FAISS_THROW_IF_NOT (k > 0);
+
+    if (metric_type == METRIC_L2) {
+        search_lattice<CMax<float, idx_t> > (
+             *this, n, x, k, distances, labels);
+    } else if (metric_type == METRIC_INNER_PRODUCT) {
+        search_lattice<CMin<float, idx_t> > (
+             *this, n, x, k, distances, labels);
+    } else {
+        FAISS_THROW_MSG ("metric type not supported");
+    }
 }
 
 
 void IndexLattice::reset()
 {
-    FAISS_THROW_MSG("not implemented");
+    codes.clear();
+    ntotal = 0;
+}
+
+void IndexLattice::reconstruct_n(idx_t i0, idx_t ni, float* recons) const
+{
+    FAISS_THROW_IF_NOT (ni == 0 || (i0 >= 0 && i0 + ni <= ntotal));
+    sa_decode (ni, codes.data() + i0 * code_size, recons);
+}
+
+void IndexLattice::reconstruct(idx_t key, float* recons) const
+{
+    reconstruct_n (key, 1, recons);
 }
 
 
@@ -23,6 +23,16 @@ namespace faiss {
 
 
 /** Index that encodes a vector with a series of Zn lattice quantizers
+ *
+ * Each sub-vector is encoded as a quantized norm and a point of the
+ * lattice sphere. The search computes the distances from the codes
+ * without decoding the vectors: with |x_j| the decoded norm of the
+ * sub-vector and u_j its lattice point scaled to the unit sphere,
+ *
+ *    ||q_j - x_j||^2 = ||q_j||^2 - 2 |x_j| <q_j, u_j> + |x_j|^2
+ *
+ * where the dot products <q_j, u> are read from per-query look-up
+ * tables when the lattice sphere is small enough to be enumerated.
  */
 struct IndexLattice: Index {
 
@@ -42,8 +52,23 @@ struct IndexLattice: Index {
     /// mins and maxes of the vector norms, per subquantizer
     std::vector<float> trained;
 
+    /// encoded dataset, size ntotal * code_size
+    std::vector<uint8_t> codes;
+
+    /** all the points of the lattice sphere (size nv * dsq), used to
+     * decode without the combinatorial codec and to build the search
+     * look-up tables. Empty if the sphere is too large */
+    std::vector<float> codebook;
+
+    /// nb of vectors processed at a time by the encoder and decoder
+    size_t bs;
+
     IndexLattice (idx_t d, int nsq, int scale_nbit, int r2);
 
+    /** enumerate the lattice sphere in the codebook if it has at most
+     * max_size floats (the default is sized to fit in the L2 cache) */
+    void set_codebook (size_t max_size);
+
     void train(idx_t n, const float* x) override;
 
     /* The standalone codec interface */
@@ -55,12 +80,18 @@ struct IndexLattice: Index {
     void sa_decode (idx_t n, const uint8_t *bytes,
                             float *x) const override;
 
-    /// not implemented
     void add(idx_t n, const float* x) override;
+
     void search(idx_t n, const float* x, idx_t k,
-                float* distances, idx_t* labels) const override;
+                float* distances, idx_t* labels,
+                const SearchParameters *params = nullptr) const override;
+
     void reset() override;
 
+    void reconstruct_n(idx_t i0, idx_t ni, float* recons) const override;
+
+    void reconstruct(idx_t key, float* recons) const override;
+
 };
 
 } // namespace faiss
@@ -0,0 +1,329 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/IndexMultiVector.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <typeinfo>
+#include <unordered_map>
+
+#include <faiss/IndexIVF.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/Heap.h>
+#include <faiss/utils/distances.h>
+#include <faiss/utils/utils.h>
+
+
+namespace faiss {
+
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+/// aggregates the similarities of the candidate documents of one query,
+/// one query vector at a time
+struct DocAccumulator {
+    IndexMultiVector::Aggregation aggregation;
+
+    /// doc -> max similarity for the current query vector
+    std::unordered_map<idx_t, float> token_max;
+
+    /// doc -> aggregated score. For AGG_SUM_MAX, the sum of the
+    /// differences to the imputed similarity of each query vector.
+    std::unordered_map<idx_t, float> acc;
+
+    /// sum and max of the imputed similarities of the query vectors
+    float sum_imputed;
+    float max_imputed;
+
+    explicit DocAccumulator (IndexMultiVector::Aggregation aggregation):
+        aggregation (aggregation), sum_imputed (0),
+        max_imputed (-std::numeric_limits<float>::infinity())
+    {}
+
+    void add (idx_t doc, float sim)
+    {
+        auto res = token_max.emplace (doc, sim);
+        if (!res.second && sim > res.first->second) {
+            res.first->second = sim;
+        }
+    }
+
+    /// to be called after all the results of a query vector are added
+    void end_token ()
+    {
+        if (token_max.empty()) {
+            return;
+        }
+        float imputed = std::numeric_limits<float>::infinity();
+        for (const auto & p: token_max) {
+            imputed = std::min (imputed, p.second);
+        }
+        sum_imputed += imputed;
+        max_imputed = std::max (max_imputed, imputed);
+        for (const auto & p: token_max) {
+            if (aggregation == IndexMultiVector::AGG_SUM_MAX) {
+                acc[p.first] += p.second - imputed;
+            } else {
+                auto res = acc.emplace (p.first, p.second);
+                if (!res.second && p.second > res.first->second) {
+                    res.first->second = p.second;
+                }
+            }
+        }
+        token_max.clear ();
+    }
+
+    /// estimated score, also an upper bound of the exact score when the
+    /// search of each query vector returns its nearest vectors
+    float upper_bound (float a) const
+    {
+        return aggregation == IndexMultiVector::AGG_SUM_MAX ?
+            a + sum_imputed : std::max (a, max_imputed);
+    }
+
+    /// estimated score, as returned without rerank
+    float score (float a) const
+    {
+        return aggregation == IndexMultiVector::AGG_SUM_MAX ?
+            a + sum_imputed : a;
+    }
+};
+
+} // anonymous namespace
+
+
+IndexMultiVector::IndexMultiVector (Index *index, Aggregation aggregation):
+    index (index), own_fields (false), doc_offsets (1, 0),
+    aggregation (aggregation), k_token (100), rerank (false)
+{
+    FAISS_THROW_IF_NOT_MSG (index->ntotal == 0, "index must be empty");
+    FAISS_THROW_IF_NOT (index->metric_type == METRIC_INNER_PRODUCT ||
+                        index->metric_type == METRIC_L2);
+}
+
+IndexMultiVector::IndexMultiVector ():
+    index (nullptr), own_fields (false), doc_offsets (1, 0),
+    aggregation (AGG_SUM_MAX), k_token (100), rerank (false)
+{}
+
+IndexMultiVector::~IndexMultiVector ()
+{
+    if (own_fields) {
+        delete index;
+    }
+}
+
+IndexMultiVector::idx_t IndexMultiVector::doc_of (idx_t vector_no) const
+{
+    return std::upper_bound (doc_offsets.begin(), doc_offsets.end(),
+                             vector_no) - doc_offsets.begin() - 1;
+}
+
+void IndexMultiVector::add (idx_t n, const idx_t *doc_sizes, const float *x)
+{
+    FAISS_THROW_IF_NOT (index->ntotal == doc_offsets.back());
+    idx_t nvec = 0;
+    for (idx_t i = 0; i < n; i++) {
+        FAISS_THROW_IF_NOT (doc_sizes[i] >= 0);
+        nvec += doc_sizes[i];
+    }
+    index->add (nvec, x);
+    for (idx_t i = 0; i < n; i++) {
+        doc_offsets.push_back (doc_offsets.back() + doc_sizes[i]);
+    }
+}
+
+void IndexMultiVector::reset ()
+{
+    index->reset ();
+    doc_offsets.assign (1, 0);
+}
+
+float IndexMultiVector::score_document (
+        idx_t doc, idx_t nqv, const float *xq) const
+{
+    size_t d = index->d;
+    idx_t i0 = doc_offsets[doc], ni = doc_offsets[doc + 1] - i0;
+    std::vector<idx_t> keys (ni);
+    for (idx_t j = 0; j < ni; j++) {
+        keys[j] = i0 + j;
+    }
+    std::vector<float> xd (ni * d);
+    index->reconstruct_batch (ni, keys.data(), xd.data());
+
+    bool is_ip = index->metric_type == METRIC_INNER_PRODUCT;
+    float total = 0;
+    float best = -std::numeric_limits<float>::infinity();
+    for (idx_t t = 0; t < nqv; t++) {
+        float tmax = -std::numeric_limits<float>::infinity();
+        for (idx_t j = 0; j < ni; j++) {
+            const float *y = xd.data() + j * d;
+            float sim = is_ip ? fvec_inner_product (xq + t * d, y, d) :
+                -fvec_L2sqr (xq + t * d, y, d);
+            tmax = std::max (tmax, sim);
+        }
+        total += tmax;
+        best = std::max (best, tmax);
+    }
+    return aggregation == AGG_SUM_MAX ? total : best;
+}
+
+void IndexMultiVector::search (
+        idx_t nq, const idx_t *query_sizes, const float *x,
+        idx_t k, float *scores, idx_t *labels) const
+{
+    FAISS_THROW_IF_NOT (k > 0);
+    size_t d = index->d;
+    bool is_ip = index->metric_type == METRIC_INNER_PRODUCT;
+
+    std::vector<idx_t> query_offsets (nq + 1);
+    query_offsets[0] = 0;
+    for (idx_t i = 0; i < nq; i++) {
+        FAISS_THROW_IF_NOT (query_sizes[i] >= 0);
+        query_offsets[i + 1] = query_offsets[i] + query_sizes[i];
+    }
+    idx_t ntok = query_offsets[nq];
+
+    // the results of the query vectors: probed lists for an IVF,
+    // k_token nearest vectors otherwise
+    const IndexIVF *ivf = dynamic_cast<const IndexIVF*> (index);
+    FAISS_THROW_IF_NOT_MSG (!(rerank && ivf && ivf->direct_map.no()),
+                            "rerank needs a direct map in the IndexIVF");
+    idx_t kt = ivf ? ivf->nprobe : k_token;
+    FAISS_THROW_IF_NOT (kt > 0);
+    std::vector<float> D (ntok * kt);
+    std::vector<idx_t> I (ntok * kt);
+    if (ivf) {
+        ivf->quantizer->search (ntok, x, kt, D.data(), I.data());
+    } else {
+        index->search (ntok, x, kt, D.data(), I.data());
+    }
+
+    bool interrupt = false;
+    std::mutex exception_mutex;
+    std::string exception_string;
+
+#pragma omp parallel
+    {
+        std::unique_ptr<InvertedListScanner> scanner;
+        if (ivf) {
+            scanner.reset (ivf->get_InvertedListScanner (false));
+        }
+
+#pragma omp for schedule(dynamic)
+        for (idx_t q = 0; q < nq; q++) {
+            if (interrupt) {
+                continue;
+            }
+            float *simi = scores + q * k;
+            idx_t *idxi = labels + q * k;
+            minheap_heapify (k, simi, idxi);
+
+            DocAccumulator accu (aggregation);
+            for (idx_t t = query_offsets[q]; t < query_offsets[q + 1]; t++) {
+                const float *Dt = D.data() + t * kt;
+                const idx_t *It = I.data() + t * kt;
+                if (!ivf) {
+                    for (idx_t j = 0; j < kt; j++) {
+                        if (It[j] >= 0) {
+                            accu.add (doc_of (It[j]), is_ip ? Dt[j] : -Dt[j]);
+                        }
+                    }
+                    accu.end_token ();
+                    continue;
+                }
+                // score all the vectors of the probed lists
+                scanner->set_query (x + t * d);
+                for (idx_t p = 0; p < kt; p++) {
+                    idx_t list_no = It[p];
+                    if (list_no < 0) {
+                        continue;
+                    }
+                    size_t list_size = ivf->invlists->list_size (list_no);
+                    if (list_size == 0) {
+                        continue;
+                    }
+                    scanner->set_list (list_no, Dt[p]);
+                    InvertedLists::ScopedCodes codes (ivf->invlists, list_no);
+                    InvertedLists::ScopedIds ids (ivf->invlists, list_no);
+                    for (size_t j = 0; j < list_size; j++) {
+                        if (ids[j] < 0) { // removed entry
+                            continue;
+                        }
+                        float dis = scanner->distance_to_code (
+                              codes.get() + j * ivf->code_size);
+                        accu.add (doc_of (ids[j]), is_ip ? dis : -dis);
+                    }
+                }
+                accu.end_token ();
+            }
+
+            if (!rerank) {
+                for (const auto & p: accu.acc) {
+                    float s = accu.score (p.second);
+                    if (s > simi[0]) {
+                        minheap_pop (k, simi, idxi);
+                        minheap_push (k, simi, idxi, s, p.first);
+                    }
+                }
+                minheap_reorder (k, simi, idxi);
+                continue;
+            }
+
+            // exact scores by decreasing upper bound, until no
+            // remaining candidate can enter the top-k
+            std::vector<std::pair<float, idx_t> > cands;
+            cands.reserve (accu.acc.size());
+            for (const auto & p: accu.acc) {
+                cands.emplace_back (accu.upper_bound (p.second), p.first);
+            }
+            std::sort (cands.begin(), cands.end(),
+                       [] (const std::pair<float, idx_t> & a,
+                           const std::pair<float, idx_t> & b) {
+                           return a.first > b.first ||
+                               (a.first == b.first && a.second < b.second);
+                       });
+            try {
+                for (const auto & c: cands) {
+                    if (idxi[0] >= 0 && c.first <= simi[0]) {
+                        break;
+                    }
+                    float s = score_document (
+                          c.second, query_sizes[q], x + query_offsets[q] * d);
+                    if (s > simi[0]) {
+                        minheap_pop (k, simi, idxi);
+                        minheap_push (k, simi, idxi, s, c.second);
+                    }
+                }
+            } catch (const std::exception & e) {
+                std::lock_guard<std::mutex> lock (exception_mutex);
+                exception_string =
+                    demangle_cpp_symbol (typeid(e).name()) + "  " + e.what();
+                interrupt = true;
+                continue;
+            }
+            minheap_reorder (k, simi, idxi);
+        }
+    }
+
+    if (interrupt) {
+        FAISS_THROW_FMT ("multi-vector search failed with: %s",
+                         exception_string.c_str());
+    }
+}
+
+
+} // namespace faiss
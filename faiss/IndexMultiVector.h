@@ -0,0 +1,113 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <vector>
+
+#include <faiss/Index.h>
+
+
+namespace faiss {
+
+
+/** Index of documents that are represented by several vectors (eg. the
+ * token embeddings of a late-interaction model), searched with queries
+ * that are themselves sets of vectors.
+ *
+ * The vectors of all documents are stored in a single index, in the
+ * order of the documents: document i has the vectors doc_offsets[i] to
+ * doc_offsets[i + 1] - 1. The score of a document for a query is an
+ * aggregate of the similarities between their vectors (the inner
+ * product, or minus the squared L2 distance):
+ *
+ * - AGG_SUM_MAX: sum over the query vectors of the max similarity to the
+ *   vectors of the document (MaxSim)
+ * - AGG_MAX: max similarity over all pairs of vectors
+ *
+ * Only the document vectors found by the search of each query vector are
+ * used. For AGG_SUM_MAX, a query vector for which no vector of the
+ * document was found contributes the lowest similarity among the
+ * documents found for it (imputation, an upper bound of the true
+ * contribution if the search returns the nearest vectors).
+ *
+ * If the index is an IndexIVF, the per-document maxima are aggregated
+ * while the probed lists are scanned: all the vectors of the lists are
+ * scored, without the large per-vector top-k of a search. For other
+ * indexes, each query vector is searched with k_token results.
+ *
+ * With rerank, the candidate documents are rescored exactly from their
+ * reconstructed vectors, by decreasing upper bound, until no remaining
+ * candidate can enter the top-k.
+ */
+struct IndexMultiVector {
+    typedef Index::idx_t idx_t;
+
+    enum Aggregation {
+        AGG_SUM_MAX,
+        AGG_MAX,
+    };
+
+    /// stores the vectors of the documents, in order (not owned by
+    /// default). Must be empty at construction.
+    Index *index;
+
+    /// should the index be deallocated?
+    bool own_fields;
+
+    /// size ndoc + 1
+    std::vector<idx_t> doc_offsets;
+
+    Aggregation aggregation;
+
+    /// nb of results per query vector, for indexes that are not IVF
+    idx_t k_token;
+
+    /// rescore the candidates exactly (requires reconstruct_batch)
+    bool rerank;
+
+    explicit IndexMultiVector (Index *index,
+                               Aggregation aggregation = AGG_SUM_MAX);
+
+    IndexMultiVector ();
+
+    ~IndexMultiVector ();
+
+    idx_t ndoc () const {return doc_offsets.size() - 1; }
+
+    /// document that contains a vector (binary search in doc_offsets)
+    idx_t doc_of (idx_t vector_no) const;
+
+    /** add documents
+     *
+     * @param doc_sizes   nb of vectors of each document (size ndoc)
+     * @param x           vectors of the documents, one after the other
+     *                    (size sum(doc_sizes) * d)
+     */
+    void add (idx_t ndoc, const idx_t *doc_sizes, const float *x);
+
+    /** search documents
+     *
+     * @param query_sizes nb of vectors of each query (size nq)
+     * @param x           vectors of the queries (size sum(query_sizes) * d)
+     * @param scores      aggregated scores, higher is better (size nq * k)
+     * @param labels      document numbers, -1 if there are less than k
+     *                    candidates (size nq * k)
+     */
+    void search (idx_t nq, const idx_t *query_sizes, const float *x,
+                 idx_t k, float *scores, idx_t *labels) const;
+
+    /// exact score of a document for a query of nqv vectors
+    float score_document (idx_t doc, idx_t nqv, const float *xq) const;
+
+    void reset ();
+};
+
+
+} // namespace faiss
@@ -0,0 +1,189 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/IndexNSG.h>
+
+#include <algorithm>
+
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/HNSW.h>
+
+
+namespace faiss {
+
+
+/**************************************************************
+ * IndexNSG implementation
+ **************************************************************/
+
+IndexNSG::IndexNSG(int d, int R, MetricType metric):
+    Index(d, metric),
+    nsg(R),
+    own_fields(false),
+    storage(nullptr)
+{
+    FAISS_THROW_IF_NOT_MSG(metric == METRIC_L2,
+                           "NSG supports only the L2 metric");
+}
+
+IndexNSG::IndexNSG(Index *storage, int R):
+    Index(storage->d, storage->metric_type),
+    nsg(R),
+    own_fields(false),
+    storage(storage)
+{
+    FAISS_THROW_IF_NOT_MSG(metric_type == METRIC_L2,
+                           "NSG supports only the L2 metric");
+}
+
+IndexNSG::~IndexNSG() {
+    if (own_fields) {
+        delete storage;
+    }
+}
+
+void IndexNSG::train(idx_t n, const float* x)
+{
+    FAISS_THROW_IF_NOT_MSG(storage,
+       "Please use IndexNSGFlat (or variants) instead of IndexNSG directly");
+    // nsg structure does not require training
+    storage->train (n, x);
+    is_trained = true;
+}
+
+void IndexNSG::add(idx_t n, const float *x)
+{
+    FAISS_THROW_IF_NOT_MSG(storage,
+       "Please use IndexNSGFlat (or variants) instead of IndexNSG directly");
+    FAISS_THROW_IF_NOT(is_trained);
+    FAISS_THROW_IF_NOT_MSG(ntotal == 0,
+       "NSG does not support incremental adds, add all vectors at once");
+    storage->add(n, x);
+    ntotal = storage->ntotal;
+    nsg.build(storage, ntotal, x, verbose);
+}
+
+void IndexNSG::search (idx_t n, const float *x, idx_t k,
+                       float *distances, idx_t *labels,
+                       const SearchParameters *params_in) const
+{
+    FAISS_THROW_IF_NOT_MSG(storage,
+       "Please use IndexNSGFlat (or variants) instead of IndexNSG directly");
+    FAISS_THROW_IF_NOT(k > 0);
+    const SearchParametersNSG *params = nullptr;
+    if (params_in) {
+        params = dynamic_cast<const SearchParametersNSG *>(params_in);
+        FAISS_THROW_IF_NOT_MSG (params,
+                                "IndexNSG params have incorrect type");
+    }
+    if (ntotal == 0) {
+        for (idx_t i = 0; i < n * k; i++) {
+            labels[i] = -1;
+            distances[i] = HUGE_VALF;
+        }
+        return;
+    }
+    int L = std::max(params ? params->search_L : nsg.search_L, (int)k);
+
+    idx_t check_period = InterruptCallback::get_period_hint (
+          (size_t)d * L * nsg.R);
+
+    for (idx_t i0 = 0; i0 < n; i0 += check_period) {
+        idx_t i1 = std::min(i0 + check_period, n);
+
+#pragma omp parallel
+        {
+            ScratchVisitedTable svt (ntotal, (size_t)L * nsg.R);
+            VisitedTable & vt = *svt;
+
+            DistanceComputer *dis = storage->get_distance_computer();
+            ScopeDeleter1<DistanceComputer> del(dis);
+
+#pragma omp for
+            for(idx_t i = i0; i < i1; i++) {
+                dis->set_query(x + i * d);
+                nsg.search(*dis, k, labels + i * k, distances + i * k,
+                           vt, params);
+            }
+        }
+        InterruptCallback::check ();
+    }
+}
+
+void IndexNSG::reset()
+{
+    nsg.reset();
+    storage->reset();
+    ntotal = 0;
+}
+
+void IndexNSG::reconstruct (idx_t key, float* recons) const
+{
+    storage->reconstruct(key, recons);
+}
+
+
+/**************************************************************
+ * IndexNSGFlat implementation
+ **************************************************************/
+
+
+IndexNSGFlat::IndexNSGFlat()
+{
+    is_trained = true;
+}
+
+IndexNSGFlat::IndexNSGFlat(int d, int R, MetricType metric):
+    IndexNSG(new IndexFlat(d, metric), R)
+{
+    own_fields = true;
+    is_trained = true;
+}
+
+
+/**************************************************************
+ * IndexNSGPQ implementation
+ **************************************************************/
+
+
+IndexNSGPQ::IndexNSGPQ() {}
+
+IndexNSGPQ::IndexNSGPQ(int d, int pq_m, int R):
+    IndexNSG(new IndexPQ(d, pq_m, 8), R)
+{
+    own_fields = true;
+    is_trained = false;
+}
+
+void IndexNSGPQ::train(idx_t n, const float* x)
+{
+    IndexNSG::train (n, x);
+    // the pruning uses symmetric distances
+    (dynamic_cast<IndexPQ*> (storage))->pq.compute_sdc_table();
+}
+
+
+/**************************************************************
+ * IndexNSGSQ implementation
+ **************************************************************/
+
+
+IndexNSGSQ::IndexNSGSQ(int d, ScalarQuantizer::QuantizerType qtype, int R,
+                       MetricType metric):
+    IndexNSG (new IndexScalarQuantizer (d, qtype, metric), R)
+{
+    is_trained = false;
+    own_fields = true;
+}
+
+IndexNSGSQ::IndexNSGSQ() {}
+
+
+}  // namespace faiss
@@ -0,0 +1,89 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <vector>
+
+#include <faiss/impl/NSG.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexPQ.h>
+#include <faiss/IndexScalarQuantizer.h>
+
+
+namespace faiss {
+
+
+/** The NSG index is a normal random-access index with a single-layer
+ * graph of fixed out-degree built on top. Compared to IndexHNSW, it
+ * stores R ints per vector instead of about 2 * M plus the upper levels.
+ *
+ * The graph is built when the vectors are added, so all vectors must be
+ * added in a single call to add(). Only the L2 metric is supported.
+ */
+struct IndexNSG : Index {
+
+    typedef NSG::storage_idx_t storage_idx_t;
+
+    /// the link structure
+    NSG nsg;
+
+    /// the sequential storage
+    bool own_fields;
+    Index *storage;
+
+    explicit IndexNSG (int d = 0, int R = 32, MetricType metric = METRIC_L2);
+    explicit IndexNSG (Index *storage, int R = 32);
+
+    ~IndexNSG() override;
+
+    /// adds the vectors to the storage and builds the graph
+    void add(idx_t n, const float *x) override;
+
+    /// Trains the storage if needed
+    void train(idx_t n, const float* x) override;
+
+    void search (idx_t n, const float *x, idx_t k,
+                 float *distances, idx_t *labels,
+                 const SearchParameters *params = nullptr) const override;
+
+    void reconstruct(idx_t key, float* recons) const override;
+
+    void reset () override;
+};
+
+
+/** Flat index topped with with a NSG structure to access elements
+ *  more efficiently.
+ */
+struct IndexNSGFlat : IndexNSG {
+    IndexNSGFlat();
+    IndexNSGFlat(int d, int R, MetricType metric = METRIC_L2);
+};
+
+/** PQ index topped with with a NSG structure to access elements
+ *  more efficiently.
+ */
+struct IndexNSGPQ : IndexNSG {
+    IndexNSGPQ();
+    IndexNSGPQ(int d, int pq_m, int R);
+    void train(idx_t n, const float* x) override;
+};
+
+/** SQ index topped with with a NSG structure to access elements
+ *  more efficiently.
+ */
+struct IndexNSGSQ : IndexNSG {
+    IndexNSGSQ();
+    IndexNSGSQ(int d, ScalarQuantizer::QuantizerType qtype, int R,
+               MetricType metric = METRIC_L2);
+};
+
+
+}  // namespace faiss
@@ -17,9 +17,15 @@
 
 #include <algorithm>
 
+#include <omp.h>
+
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/pq_code_distance.h>
+#include <faiss/utils/distances.h>
 #include <faiss/utils/hamming.h>
+#include <faiss/utils/prefetch.h>
+#include <faiss/utils/parallel.h>
 
 namespace faiss {
 
@@ -36,6 +42,7 @@ IndexPQ::IndexPQ (int d, size_t M, size_t nbits, MetricType metric):
     polysemous_ht = nbits * M + 1;
     search_type = ST_PQ;
     encode_signs = false;
+    range_search_max_results = 0;
 }
 
 IndexPQ::IndexPQ ()
@@ -46,6 +53,7 @@ IndexPQ::IndexPQ ()
     polysemous_ht = pq.nbits * pq.M + 1;
     search_type = ST_PQ;
     encode_signs = false;
+    range_search_max_results = 0;
 }
 
 
@@ -126,6 +134,18 @@ void IndexPQ::reconstruct (idx_t key, float * recons) const
     pq.decode (&codes[key * pq.code_size], recons);
 }
 
+void IndexPQ::reconstruct_batch (idx_t n, const idx_t *keys,
+                                 float *recons) const
+{
+    for (idx_t i = 0; i < n; i++) {
+        FAISS_THROW_IF_NOT (keys[i] >= 0 && keys[i] < ntotal);
+    }
+#pragma omp parallel for if (n > 1000)
+    for (idx_t i = 0; i < n; i++) {
+        pq.decode (&codes[keys[i] * pq.code_size], recons + i * d);
+    }
+}
+
 
 namespace {
 
@@ -153,6 +173,11 @@ struct PQDis: DistanceComputer {
         return accu;
     }
 
+    void prefetch(idx_t i) override
+    {
+        prefetch_L1(codes + i * code_size, code_size);
+    }
+
     float symmetric_dis(idx_t i, idx_t j) override
     {
         const float * sdci = sdc;
@@ -194,6 +219,86 @@ DistanceComputer * IndexPQ::get_distance_computer() const {
     return new PQDis(*this);
 }
 
+MemoryUsage IndexPQ::memory_usage () const
+{
+    MemoryUsage mu = Index::memory_usage ();
+    mu.add ("pq", pq.memory_usage ());
+    mu.add ("codes", codes);
+    return mu;
+}
+
+
+/*****************************************
+ * IndexPQ range search
+ ******************************************/
+
+namespace {
+
+template <class PQDecoder>
+void pq_range_scan (const ProductQuantizer & pq, const float *dis_table,
+                    const uint8_t *codes, size_t ncode, bool is_ip,
+                    RangeQueryTopResults & res)
+{
+    for (size_t j = 0; j < ncode; j++) {
+        PQDecoder decoder (codes + j * pq.code_size, pq.nbits);
+        const float *dt = dis_table;
+        float accu = 0;
+        for (size_t m = 0; m < pq.M; m++) {
+            accu += dt[decoder.decode()];
+            dt += pq.ksub;
+        }
+        res.add (is_ip ? -accu : accu, j);
+    }
+}
+
+} // anonymous namespace
+
+
+void IndexPQ::range_search (idx_t n, const float *x, float radius,
+                            RangeSearchResult *result) const
+{
+    FAISS_THROW_IF_NOT (is_trained);
+    FAISS_THROW_IF_NOT_MSG (search_type == ST_PQ,
+                            "range search supports only ST_PQ");
+    bool is_ip = metric_type == METRIC_INNER_PRODUCT;
+    FAISS_THROW_IF_NOT (is_ip || metric_type == METRIC_L2);
+
+    // internally, smaller is better
+    float threshold = is_ip ? -radius : radius;
+
+#pragma omp parallel
+    {
+        RangeSearchPartialResult pres (result);
+        std::vector<float> dis_table (pq.M * pq.ksub);
+
+#pragma omp for
+        for (idx_t i = 0; i < n; i++) {
+            if (is_ip) {
+                pq.compute_inner_prod_table (x + i * d, dis_table.data());
+            } else {
+                pq.compute_distance_table (x + i * d, dis_table.data());
+            }
+            RangeQueryTopResults res (threshold, range_search_max_results);
+
+            if (pq.nbits == 8) {
+                pq_range_scan<PQDecoder8> (pq, dis_table.data(),
+                                           codes.data(), ntotal, is_ip, res);
+            } else if (pq.nbits == 16) {
+                pq_range_scan<PQDecoder16> (pq, dis_table.data(),
+                                            codes.data(), ntotal, is_ip, res);
+            } else {
+                pq_range_scan<PQDecoderGeneric> (pq, dis_table.data(),
+                                                 codes.data(), ntotal,
+                                                 is_ip, res);
+            }
+            res.flush (pres.new_result (i), is_ip);
+        }
+        pres.finalize ();
+    }
+    indexPQ_stats.nq += n;
+    indexPQ_stats.ncode += n * ntotal;
+}
+
 
 /*****************************************
  * IndexPQ polysemous search routines
@@ -204,9 +309,26 @@ DistanceComputer * IndexPQ::get_distance_computer() const {
 
 
 void IndexPQ::search (idx_t n, const float *x, idx_t k,
-                           float *distances, idx_t *labels) const
+                           float *distances, idx_t *labels,
+                           const SearchParameters *params_in) const
 {
     FAISS_THROW_IF_NOT (is_trained);
+    const SearchParametersPQ *params = nullptr;
+    if (params_in) {
+        params = dynamic_cast<const SearchParametersPQ *>(params_in);
+        FAISS_THROW_IF_NOT_MSG (params, "IndexPQ params have incorrect type");
+    }
+    if (use_parallel_executor (n)) {
+        // the executor parallelizes over the queries
+        parallel_for (n, [&] (size_t i0, size_t i1) {
+            search (i1 - i0, x + i0 * d, k, distances + i0 * k,
+                    labels + i0 * k, params_in);
+        });
+        return;
+    }
+    Search_type_t search_type =
+        params ? params->search_type : this->search_type;
+
     if (search_type == ST_PQ) {  // Simple PQ search
 
         if (metric_type == METRIC_L2) {
@@ -226,7 +348,7 @@ void IndexPQ::search (idx_t n, const float *x, idx_t k,
 
         FAISS_THROW_IF_NOT (metric_type == METRIC_L2);
 
-        search_core_polysemous (n, x, k, distances, labels);
+        search_core_polysemous (n, x, k, distances, labels, params);
 
     } else { // code-to-code distances
 
@@ -296,53 +418,140 @@ void IndexPQStats::reset()
 IndexPQStats indexPQ_stats;
 
 
+/* scan the codes [j0, j1) by blocks: the Hamming distances of a block
+ * are computed first, in a loop without branches, then the PQ distances
+ * of the codes that pass the threshold are computed together. */
 template <class HammingComputer>
 static size_t polysemous_inner_loop (
         const IndexPQ & index,
         const float *dis_table_qi, const uint8_t *q_code,
-        size_t k, float *heap_dis, int64_t *heap_ids)
+        size_t j0, size_t j1,
+        size_t k, float *heap_dis, int64_t *heap_ids, int ht)
 {
-
-    int M = index.pq.M;
-    int code_size = index.pq.code_size;
-    int ksub = index.pq.ksub;
-    size_t ntotal = index.ntotal;
-    int ht = index.polysemous_ht;
-
-    const uint8_t *b_code = index.codes.data();
+    size_t code_size = index.pq.code_size;
+    const uint8_t *b_code = index.codes.data() + j0 * code_size;
 
     size_t n_pass_i = 0;
 
     HammingComputer hc (q_code, code_size);
 
-    for (int64_t bi = 0; bi < ntotal; bi++) {
-        int hd = hc.hamming (b_code);
+    const size_t bs = 64;
+    int hd[bs];
+    size_t pass[bs];
+    float dis[bs];
+    std::vector<uint8_t> pass_codes (bs * code_size);
 
-        if (hd < ht) {
-            n_pass_i ++;
+    for (size_t b0 = j0; b0 < j1; b0 += bs) {
+        size_t nb = std::min (bs, j1 - b0);
 
-            float dis = 0;
-            const float * dis_table = dis_table_qi;
-            for (int m = 0; m < M; m++) {
-                dis += dis_table [b_code[m]];
-                dis_table += ksub;
-            }
+        for (size_t j = 0; j < nb; j++) {
+            hd[j] = hc.hamming (b_code + j * code_size);
+        }
 
-            if (dis < heap_dis[0]) {
-                maxheap_pop (k, heap_dis, heap_ids);
-                maxheap_push (k, heap_dis, heap_ids, dis, bi);
+        size_t npass = 0;
+        for (size_t j = 0; j < nb; j++) {
+            pass[npass] = j;
+            npass += hd[j] < ht;
+        }
+
+        if (npass > 0) {
+            for (size_t p = 0; p < npass; p++) {
+                memcpy (pass_codes.data() + p * code_size,
+                        b_code + pass[p] * code_size, code_size);
+            }
+            pq_code_distances_8bit (code_size, dis_table_qi,
+                                    pass_codes.data(), npass, dis);
+
+            for (size_t p = 0; p < npass; p++) {
+                if (dis[p] < heap_dis[0]) {
+                    maxheap_pop (k, heap_dis, heap_ids);
+                    maxheap_push (k, heap_dis, heap_ids, dis[p],
+                                  b0 + pass[p]);
+                }
             }
+            n_pass_i += npass;
         }
-        b_code += code_size;
+        b_code += nb * code_size;
     }
     return n_pass_i;
 }
 
+/* search all the queries. For fewer queries than threads, each thread
+ * scans a slice of the codes for all the queries, collecting the results
+ * in its own heaps, then the heaps are merged into the result. */
+template <class HammingComputer>
+static size_t polysemous_search (
+        const IndexPQ & index, IndexPQ::idx_t n,
+        const float *dis_tables, const uint8_t *q_codes,
+        size_t k, float *distances, IndexPQ::idx_t *labels, int ht)
+{
+    size_t ntotal = index.ntotal;
+    size_t code_size = index.pq.code_size;
+    size_t table_size = index.pq.M * index.pq.ksub;
+    size_t n_pass = 0;
+
+    int nt = omp_get_max_threads ();
+    if (!(nt > 1 && n < nt && !omp_in_parallel () &&
+          ntotal >= distance_compute_split_database_min_ny &&
+          ntotal >= 2 * k)) {
+#pragma omp parallel for reduction (+: n_pass)
+        for (IndexPQ::idx_t qi = 0; qi < n; qi++) {
+            int64_t * heap_ids = labels + qi * k;
+            float *heap_dis = distances + qi * k;
+            maxheap_heapify (k, heap_dis, heap_ids);
+            n_pass += polysemous_inner_loop<HammingComputer> (
+                  index, dis_tables + qi * table_size,
+                  q_codes + qi * code_size, 0, ntotal,
+                  k, heap_dis, heap_ids, ht);
+            maxheap_reorder (k, heap_dis, heap_ids);
+        }
+        return n_pass;
+    }
+
+    nt = std::min (size_t(nt), ntotal / k);
+    std::vector<float> th_dis (nt * n * k);
+    std::vector<int64_t> th_ids (nt * n * k);
+
+#pragma omp parallel num_threads(nt) reduction (+: n_pass)
+    {
+        int rank = omp_get_thread_num ();
+        size_t j0 = ntotal * rank / nt;
+        size_t j1 = ntotal * (rank + 1) / nt;
+
+        for (IndexPQ::idx_t qi = 0; qi < n; qi++) {
+            float * dis = th_dis.data() + (rank * n + qi) * k;
+            int64_t * ids = th_ids.data() + (rank * n + qi) * k;
+            maxheap_heapify (k, dis, ids);
+            n_pass += polysemous_inner_loop<HammingComputer> (
+                  index, dis_tables + qi * table_size,
+                  q_codes + qi * code_size, j0, j1,
+                  k, dis, ids, ht);
+        }
+    }
+
+    for (IndexPQ::idx_t qi = 0; qi < n; qi++) {
+        int64_t * heap_ids = labels + qi * k;
+        float *heap_dis = distances + qi * k;
+        maxheap_heapify (k, heap_dis, heap_ids);
+        for (int rank = 0; rank < nt; rank++) {
+            size_t ofs = (rank * n + qi) * k;
+            maxheap_addn (k, heap_dis, heap_ids,
+                          th_dis.data() + ofs, th_ids.data() + ofs, k);
+        }
+        maxheap_reorder (k, heap_dis, heap_ids);
+    }
+    return n_pass;
+}
+
 
 void IndexPQ::search_core_polysemous (idx_t n, const float *x, idx_t k,
-                                          float *distances, idx_t *labels) const
+                                      float *distances, idx_t *labels,
+                                      const SearchParametersPQ *params) const
 {
     FAISS_THROW_IF_NOT (pq.nbits == 8);
+    int ht = params ? params->polysemous_ht : polysemous_ht;
+    Search_type_t search_type =
+        params ? params->search_type : this->search_type;
 
     // PQ distance tables
     float * dis_tables = new float [n * pq.ksub * pq.M];
@@ -366,81 +575,47 @@ void IndexPQ::search_core_polysemous (idx_t n, const float *x, idx_t k,
 
     size_t n_pass = 0;
 
-#pragma omp parallel for reduction (+: n_pass)
-    for (idx_t qi = 0; qi < n; qi++) {
-        const uint8_t * q_code = q_codes + qi * pq.code_size;
-
-        const float * dis_table_qi = dis_tables + qi * pq.M * pq.ksub;
-
-        int64_t * heap_ids = labels + qi * k;
-        float *heap_dis = distances + qi * k;
-        maxheap_heapify (k, heap_dis, heap_ids);
-
-        if (search_type == ST_polysemous) {
-
-            switch (pq.code_size) {
-            case 4:
-                n_pass += polysemous_inner_loop<HammingComputer4>
-                    (*this, dis_table_qi, q_code, k, heap_dis, heap_ids);
-                break;
-            case 8:
-                n_pass += polysemous_inner_loop<HammingComputer8>
-                    (*this, dis_table_qi, q_code, k, heap_dis, heap_ids);
-                break;
-            case 16:
-                n_pass += polysemous_inner_loop<HammingComputer16>
-                    (*this, dis_table_qi, q_code, k, heap_dis, heap_ids);
-                break;
-            case 32:
-                n_pass += polysemous_inner_loop<HammingComputer32>
-                    (*this, dis_table_qi, q_code, k, heap_dis, heap_ids);
-                break;
-            case 20:
-                n_pass += polysemous_inner_loop<HammingComputer20>
-                    (*this, dis_table_qi, q_code, k, heap_dis, heap_ids);
-                break;
-            default:
-                if (pq.code_size % 8 == 0) {
-                    n_pass += polysemous_inner_loop<HammingComputerM8>
-                        (*this, dis_table_qi, q_code, k, heap_dis, heap_ids);
-                } else if (pq.code_size % 4 == 0) {
-                    n_pass += polysemous_inner_loop<HammingComputerM4>
-                        (*this, dis_table_qi, q_code, k, heap_dis, heap_ids);
-                } else {
-                    FAISS_THROW_FMT(
-                         "code size %zd not supported for polysemous",
-                         pq.code_size);
-                }
-                break;
+#define DISPATCH(HammingComputer)                                       \
+    n_pass = polysemous_search<HammingComputer>                         \
+        (*this, n, dis_tables, q_codes, k, distances, labels, ht)
+
+    if (search_type == ST_polysemous) {
+
+        switch (pq.code_size) {
+        case 4: DISPATCH (HammingComputer4); break;
+        case 8: DISPATCH (HammingComputer8); break;
+        case 16: DISPATCH (HammingComputer16); break;
+        case 32: DISPATCH (HammingComputer32); break;
+        case 20: DISPATCH (HammingComputer20); break;
+        default:
+            if (pq.code_size % 8 == 0) {
+                DISPATCH (HammingComputerM8);
+            } else if (pq.code_size % 4 == 0) {
+                DISPATCH (HammingComputerM4);
+            } else {
+                FAISS_THROW_FMT(
+                     "code size %zd not supported for polysemous",
+                     pq.code_size);
             }
-        } else {
-            switch (pq.code_size) {
-            case 8:
-                n_pass += polysemous_inner_loop<GenHammingComputer8>
-                    (*this, dis_table_qi, q_code, k, heap_dis, heap_ids);
-                break;
-            case 16:
-                n_pass += polysemous_inner_loop<GenHammingComputer16>
-                    (*this, dis_table_qi, q_code, k, heap_dis, heap_ids);
-                break;
-            case 32:
-                n_pass += polysemous_inner_loop<GenHammingComputer32>
-                    (*this, dis_table_qi, q_code, k, heap_dis, heap_ids);
-                break;
-            default:
-                if (pq.code_size % 8 == 0) {
-                    n_pass += polysemous_inner_loop<GenHammingComputerM8>
-                        (*this, dis_table_qi, q_code, k, heap_dis, heap_ids);
-                } else {
-                    FAISS_THROW_FMT(
-                         "code size %zd not supported for polysemous",
-                         pq.code_size);
-                }
-                break;
+            break;
+        }
+    } else {
+        switch (pq.code_size) {
+        case 8: DISPATCH (GenHammingComputer8); break;
+        case 16: DISPATCH (GenHammingComputer16); break;
+        case 32: DISPATCH (GenHammingComputer32); break;
+        default:
+            if (pq.code_size % 8 == 0) {
+                DISPATCH (GenHammingComputerM8);
+            } else {
+                FAISS_THROW_FMT(
+                     "code size %zd not supported for polysemous",
+                     pq.code_size);
             }
+            break;
         }
-        maxheap_reorder (k, heap_dis, heap_ids);
     }
+#undef DISPATCH
 
     indexPQ_stats.nq += n;
     indexPQ_stats.ncode += n * ntotal;
@@ -589,6 +764,11 @@ struct PreSortedArray {
         return x[n] - x[n - 1];
     }
 
+    // get n-smallest value
+    T get_val (int n) {
+        return x[n];
+    }
+
     // remap orders counted from smallest to indices in array
     int get_ord (int n) {
         return n;
@@ -637,6 +817,11 @@ struct SortedArray {
         return x[perm[n]] - x[perm[n - 1]];
     }
 
+    // get n-smallest value
+    T get_val (int n) {
+        return x[perm[n]];
+    }
+
     // remap orders counted from smallest to indices in array
     int get_ord (int n) {
         return perm[n];
@@ -710,9 +895,17 @@ struct SemiSortedArray {
 
     /// grow the sorted part of the array to size next_k
     void grow (int next_k) {
-        if (next_k < N) {
+        if (next_k < N && (next_k - k) * 16 < N - k) {
+            // few elements to select: most are rejected by the heap top
             partial_sort<HC> (next_k - k, N - k, x, &perm[k]);
             k = next_k;
+        } else if (next_k < N) {
+            // selection in O(N) then sort of the selected elements
+            ArgSort<T> cmp = {x };
+            std::nth_element (perm.begin() + k, perm.begin() + next_k,
+                              perm.end(), cmp);
+            std::sort (perm.begin() + k, perm.begin() + next_k, cmp);
+            k = next_k;
         } else { // full sort of remainder of array
             ArgSort<T> cmp = {x };
             std::sort (perm.begin() + k, perm.end(), cmp);
@@ -735,6 +928,12 @@ struct SemiSortedArray {
         return x[perm[n]] - x[perm[n - 1]];
     }
 
+    // get n-smallest value, n should be in the sorted part
+    T get_val (int n) {
+        assert (n < k);
+        return x[perm[n]];
+    }
+
     // remap orders counted from smallest to indices in array
     int get_ord (int n) {
         assert (n < k);
@@ -863,23 +1062,20 @@ struct MinSumK {
             T sum = sums[k] = bh_val[0];
             int64_t ti = terms[k] = bh_ids[0];
 
-            if (use_seen) {
-                mark_seen (ti);
-                heap_pop<HC> (heap_size--, bh_val, bh_ids);
-            } else {
-                do {
-                    heap_pop<HC> (heap_size--, bh_val, bh_ids);
-                }  while (heap_size > 0 && bh_ids[0] == ti);
-            }
+            mark_seen (ti);
+            heap_pop<HC> (heap_size--, bh_val, bh_ids);
 
-            // enqueue followers
+            // enqueue followers: ti is incremented only on the terms up
+            // to its first non-zero one, so that each combination has a
+            // single predecessor and is enqueued at most once
             int64_t ii = ti;
             for (int m = 0; m < M; m++) {
                 int64_t n = ii & ((1L << nbit) - 1);
                 ii >>= nbit;
-                if (n + 1 >= N) continue;
-
-                enqueue_follower (ti, m, n, sum);
+                if (n + 1 < N) {
+                    enqueue_follower (ti, m, n, sum);
+                }
+                if (n > 0) break;
             }
         }
 
@@ -908,8 +1104,14 @@ struct MinSumK {
 
 
     void enqueue_follower (int64_t ti, int m, int n, T sum) {
+        // get_diff grows the sorted part of the array if needed
         T next_sum = sum + ssx[m].get_diff(n + 1);
         int64_t next_ti = ti + weight(m);
+        if (M == 2) {
+            // recompute the sum to avoid accumulating rounding errors
+            int64_t n0 = next_ti & ((1L << nbit) - 1);
+            next_sum = ssx[0].get_val (n0) + ssx[1].get_val (next_ti >> nbit);
+        }
         heap_push<HC> (++heap_size, bh_val, bh_ids, next_sum, next_ti);
     }
 
@@ -946,7 +1148,10 @@ void MultiIndexQuantizer::train(idx_t n, const float *x)
 
 
 void MultiIndexQuantizer::search (idx_t n, const float *x, idx_t k,
-                                  float *distances, idx_t *labels) const {
+                                  float *distances, idx_t *labels,
+                                  const SearchParameters *params) const {
+    FAISS_THROW_IF_NOT_MSG (!params,
+            "search params not supported for this index");
     if (n == 0) return;
 
     // the allocation just below can be severe...
@@ -1099,8 +1304,11 @@ void MultiIndexQuantizer2::train(idx_t n, const float* x)
 
 void MultiIndexQuantizer2::search(
         idx_t n, const float* x, idx_t K,
-        float* distances, idx_t* labels) const
+        float* distances, idx_t* labels,
+        const SearchParameters *params) const
 {
+    FAISS_THROW_IF_NOT_MSG (!params,
+            "search params not supported for this index");
 
     if (n == 0) return;
 
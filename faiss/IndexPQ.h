@@ -16,6 +16,7 @@
 
 #include <faiss/Index.h>
 #include <faiss/impl/ProductQuantizer.h>
+#include <faiss/impl/maybe_owned_vector.h>
 #include <faiss/impl/PolysemousTraining.h>
 #include <faiss/impl/platform_macros.h>
 
@@ -25,13 +26,15 @@ namespace faiss {
 
 /** Index based on a product quantizer. Stored vectors are
  * approximated by PQ codes. */
+struct SearchParametersPQ;
+
 struct IndexPQ: Index {
 
     /// The product quantizer used to encode the vectors
     ProductQuantizer pq;
 
     /// Codes. Size ntotal * pq.code_size
-    std::vector<uint8_t> codes;
+    MaybeOwnedVector<uint8_t> codes;
 
     /** Constructor.
      *
@@ -55,7 +58,16 @@ struct IndexPQ: Index {
         const float* x,
         idx_t k,
         float* distances,
-        idx_t* labels) const override;
+        idx_t* labels,
+        const SearchParameters *params = nullptr) const override;
+
+    /// range search with the asymmetric PQ distances (ST_PQ only)
+    void range_search (idx_t n, const float *x, float radius,
+                       RangeSearchResult *result) const override;
+
+    /// max nb of range search results per query (0 = unlimited). When
+    /// the cap is reached, the nearest results are kept
+    size_t range_search_max_results;
 
     void reset() override;
 
@@ -63,6 +75,9 @@ struct IndexPQ: Index {
 
     void reconstruct(idx_t key, float* recons) const override;
 
+    void reconstruct_batch (idx_t n, const idx_t *keys,
+                            float *recons) const override;
+
     size_t remove_ids(const IDSelector& sel) override;
 
     /* The standalone codec interface */
@@ -77,6 +92,8 @@ struct IndexPQ: Index {
 
     DistanceComputer * get_distance_computer() const override;
 
+    MemoryUsage memory_usage () const override;
+
     /******************************************************
      * Polysemous codes implementation
      ******************************************************/
@@ -104,9 +121,12 @@ struct IndexPQ: Index {
     /// Hamming threshold used for polysemy
     int polysemous_ht;
 
-    // actual polysemous search
+    /// actual polysemous search. The params override search_type and
+    /// polysemous_ht if provided
     void search_core_polysemous (idx_t n, const float *x, idx_t k,
-                               float *distances, idx_t *labels) const;
+                                 float *distances, idx_t *labels,
+                                 const SearchParametersPQ *params = nullptr
+                                 ) const;
 
     /// prepare query for a polysemous search, but instead of
     /// computing the result, just get the histogram of Hamming
@@ -128,6 +148,17 @@ struct IndexPQ: Index {
 };
 
 
+/// search parameters for IndexPQ, they override the index fields for one
+/// search call
+struct SearchParametersPQ: SearchParameters {
+    IndexPQ::Search_type_t search_type;  ///< type of search
+    int polysemous_ht;                   ///< Hamming threshold for polysemy
+
+    SearchParametersPQ(): search_type(IndexPQ::ST_PQ), polysemous_ht(0) {}
+    ~SearchParametersPQ() {}
+};
+
+
 /// statistics are robust to internal threading, but not if
 /// IndexPQ::search is called by multiple threads
 struct IndexPQStats {
@@ -157,7 +188,8 @@ struct MultiIndexQuantizer: Index  {
 
     void search(
         idx_t n, const float* x, idx_t k,
-        float* distances, idx_t* labels) const override;
+        float* distances, idx_t* labels,
+        const SearchParameters *params = nullptr) const override;
 
     /// add and reset will crash at runtime
     void add(idx_t n, const float* x) override;
@@ -190,7 +222,8 @@ struct MultiIndexQuantizer2: MultiIndexQuantizer {
 
     void search(
         idx_t n, const float* x, idx_t k,
-        float* distances, idx_t* labels) const override;
+        float* distances, idx_t* labels,
+        const SearchParameters *params = nullptr) const override;
 
 };
 
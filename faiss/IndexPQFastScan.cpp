@@ -0,0 +1,210 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/IndexPQFastScan.h>
+
+#include <algorithm>
+#include <memory>
+
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/pq4_fast_scan.h>
+#include <faiss/impl/simd_result_handlers.h>
+#include <faiss/utils/quantize_lut.h>
+#include <faiss/utils/Heap.h>
+
+
+namespace faiss {
+
+
+/*********************************************************
+ * IndexPQFastScan implementation
+ ********************************************************/
+
+
+IndexPQFastScan::IndexPQFastScan (int d, size_t M, size_t nbits,
+                                  MetricType metric):
+    Index(d, metric), pq(d, M, nbits)
+{
+    FAISS_THROW_IF_NOT_MSG (nbits == 4, "only 4-bit PQ is supported");
+    FAISS_THROW_IF_NOT (metric == METRIC_L2 ||
+                        metric == METRIC_INNER_PRODUCT);
+    is_trained = false;
+    init_fast_scan ();
+}
+
+IndexPQFastScan::IndexPQFastScan (): M2(0)
+{}
+
+IndexPQFastScan::IndexPQFastScan (const IndexPQ & orig):
+    Index(orig.d, orig.metric_type), pq(orig.pq)
+{
+    FAISS_THROW_IF_NOT_MSG (pq.nbits == 4, "only 4-bit PQ is supported");
+    FAISS_THROW_IF_NOT (metric_type == METRIC_L2 ||
+                        metric_type == METRIC_INNER_PRODUCT);
+    is_trained = orig.is_trained;
+    init_fast_scan ();
+    ntotal = orig.ntotal;
+    size_t nblock = (ntotal + pq4_bbs - 1) / pq4_bbs;
+    codes.resize (nblock * pq4_block_size (M2));
+    pq4_pack_codes_range (orig.codes.data(), pq.M, 0, ntotal, M2,
+                          codes.data());
+}
+
+void IndexPQFastScan::init_fast_scan ()
+{
+    M2 = (pq.M + 1) / 2 * 2;
+    FAISS_THROW_IF_NOT_MSG (M2 <= 256,
+            "the 16-bit accumulators support at most 256 sub-quantizers");
+}
+
+
+void IndexPQFastScan::train (idx_t n, const float *x)
+{
+    if (is_trained) {
+        return;
+    }
+    pq.train (n, x);
+    is_trained = true;
+}
+
+
+void IndexPQFastScan::add (idx_t n, const float *x)
+{
+    FAISS_THROW_IF_NOT (is_trained);
+    std::unique_ptr<uint8_t[]> tmp_codes (new uint8_t[n * pq.code_size]);
+    pq.compute_codes (x, tmp_codes.get(), n);
+
+    size_t nblock = (ntotal + n + pq4_bbs - 1) / pq4_bbs;
+    codes.resize (nblock * pq4_block_size (M2), 0);
+    pq4_pack_codes_range (tmp_codes.get(), pq.M, ntotal, ntotal + n,
+                          M2, codes.data());
+    ntotal += n;
+}
+
+
+void IndexPQFastScan::reset ()
+{
+    codes.clear();
+    ntotal = 0;
+}
+
+
+void IndexPQFastScan::reconstruct (idx_t key, float * recons) const
+{
+    FAISS_THROW_IF_NOT (key >= 0 && key < ntotal);
+    std::vector<uint8_t> code (pq.code_size);
+    pq4_get_code (codes.data(), pq.M, M2, key, code.data());
+    pq.decode (code.data(), recons);
+}
+
+
+size_t IndexPQFastScan::sa_code_size () const
+{
+    return pq.code_size;
+}
+
+void IndexPQFastScan::sa_encode (idx_t n, const float *x,
+                                 uint8_t *bytes) const
+{
+    pq.compute_codes (x, bytes, n);
+}
+
+void IndexPQFastScan::sa_decode (idx_t n, const uint8_t *bytes,
+                                 float *x) const
+{
+    pq.decode (bytes, x, n);
+}
+
+
+void IndexPQFastScan::compute_quantized_LUT (
+        idx_t n, const float *x,
+        uint8_t *LUT, float *normalizers) const
+{
+    size_t dim12 = pq.ksub * pq.M;
+    std::unique_ptr<float[]> dis_tables (new float [n * dim12]);
+
+    if (metric_type == METRIC_L2) {
+        pq.compute_distance_tables (n, x, dis_tables.get());
+    } else {
+        // search for the largest inner products = the smallest negated ones
+        pq.compute_inner_prod_tables (n, x, dis_tables.get());
+        for (size_t i = 0; i < n * dim12; i++) {
+            dis_tables[i] = -dis_tables[i];
+        }
+    }
+
+#pragma omp parallel for if (n > 100)
+    for (idx_t i = 0; i < n; i++) {
+        quantize_lut::quantize_LUT_and_bias (
+               1, pq.M, pq.ksub,
+               dis_tables.get() + i * dim12, nullptr,
+               M2, LUT + i * M2 * pq.ksub,
+               normalizers + 2 * i, normalizers + 2 * i + 1);
+    }
+}
+
+
+void IndexPQFastScan::search (
+        idx_t n, const float *x, idx_t k,
+        float *distances, idx_t *labels,
+        const SearchParameters *params) const
+{
+    FAISS_THROW_IF_NOT_MSG (!params,
+            "search params not supported for this index");
+    FAISS_THROW_IF_NOT (k > 0);
+    using C = DequantizingHeapHandler::C;
+
+    size_t lut_size = M2 * pq.ksub;
+    std::unique_ptr<uint8_t[]> LUT (new uint8_t [n * lut_size]);
+    std::unique_ptr<float[]> normalizers (new float [n * 2]);
+
+    compute_quantized_LUT (n, x, LUT.get(), normalizers.get());
+
+    size_t nblock = (ntotal + pq4_bbs - 1) / pq4_bbs;
+    idx_t ngroup = (n + pq4_max_nq - 1) / pq4_max_nq;
+
+    // each kernel call handles a group of queries, so that the codes are
+    // loaded once for all of them
+#pragma omp parallel for if (ngroup > 1)
+    for (idx_t g = 0; g < ngroup; g++) {
+        idx_t q0 = g * pq4_max_nq;
+        int nq = std::min (n - q0, (idx_t)pq4_max_nq);
+
+        std::vector<uint8_t> LUT_packed (nq * lut_size);
+        pq4_pack_LUT (nq, M2, LUT.get() + q0 * lut_size, LUT_packed.data());
+
+        DequantizingHeapHandler handler (nq, k);
+        handler.ntotal = ntotal;
+
+        for (int q = 0; q < nq; q++) {
+            float *heap_dis = distances + (q0 + q) * k;
+            idx_t *heap_ids = labels + (q0 + q) * k;
+            heap_heapify<C> (k, heap_dis, heap_ids);
+            handler.set_heap (q, heap_dis, heap_ids);
+            const float *norm = normalizers.get() + 2 * (q0 + q);
+            handler.set_normalizers (q, norm[0], norm[1]);
+        }
+
+        pq4_accumulate_loop (nq, nblock, M2, codes.data(), LUT_packed.data(),
+                             handler);
+
+        for (int q = 0; q < nq; q++) {
+            float *heap_dis = distances + (q0 + q) * k;
+            heap_reorder<C> (k, heap_dis, labels + (q0 + q) * k);
+            if (metric_type == METRIC_INNER_PRODUCT) {
+                for (idx_t j = 0; j < k; j++) {
+                    heap_dis[j] = -heap_dis[j];
+                }
+            }
+        }
+    }
+}
+
+
+} // namespace faiss
@@ -0,0 +1,100 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#ifndef FAISS_INDEX_PQ_FAST_SCAN_H
+#define FAISS_INDEX_PQ_FAST_SCAN_H
+
+#include <vector>
+
+#include <faiss/Index.h>
+#include <faiss/IndexPQ.h>
+#include <faiss/impl/ProductQuantizer.h>
+
+
+namespace faiss {
+
+
+/** Fast scan version of IndexPQ. Works for 4-bit PQ for now.
+ *
+ * The codes are not stored sequentially but grouped in blocks of 32
+ * vectors (see pq4_fast_scan.h). This makes it possible to compute the
+ * distances of one query to 32 database vectors with SIMD shuffles of
+ * the look-up tables, that are quantized to 8 bits and stay in registers.
+ *
+ * The returned distances are computed from the quantized look-up tables, so
+ * they are approximations of the IndexPQ distances.
+ */
+struct IndexPQFastScan: Index {
+
+    /// The product quantizer used to encode the vectors
+    ProductQuantizer pq;
+
+    /// pq.M rounded up to a multiple of 2
+    size_t M2;
+
+    /// packed codes, size ceil(ntotal / 32) * 32 * M2 / 2
+    std::vector<uint8_t> codes;
+
+    /** Constructor.
+     *
+     * @param d      dimensionality of the input vectors
+     * @param M      number of subquantizers
+     * @param nbits  number of bit per subvector index (only 4 is supported)
+     */
+    IndexPQFastScan (int d, size_t M, size_t nbits = 4,
+                     MetricType metric = METRIC_L2);
+
+    IndexPQFastScan ();
+
+    /// build from an existing IndexPQ (the codes are repacked)
+    explicit IndexPQFastScan (const IndexPQ & orig);
+
+    void train(idx_t n, const float* x) override;
+
+    void add(idx_t n, const float* x) override;
+
+    void reset() override;
+
+    void search(
+        idx_t n,
+        const float* x,
+        idx_t k,
+        float* distances,
+        idx_t* labels,
+        const SearchParameters *params = nullptr) const override;
+
+    void reconstruct(idx_t key, float* recons) const override;
+
+    /* The standalone codec interface */
+    size_t sa_code_size () const override;
+
+    void sa_encode (idx_t n, const float *x,
+                    uint8_t *bytes) const override;
+
+    void sa_decode (idx_t n, const uint8_t *bytes,
+                    float *x) const override;
+
+    /** compute the uint8 look-up tables of a set of queries
+     *
+     * @param LUT          output tables, size n * M2 * 16
+     * @param normalizers  output (scale, bias) per query, size n * 2
+     */
+    void compute_quantized_LUT (idx_t n, const float *x,
+                                uint8_t *LUT, float *normalizers) const;
+
+    /// initialize M2 and the packed storage after pq is set
+    void init_fast_scan ();
+
+};
+
+
+} // namespace faiss
+
+
+#endif
@@ -12,18 +12,92 @@
 #include <cstdio>
 #include <cmath>
 #include <cstring>
+#include <algorithm>
 #include <memory>
 
 #include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/scratch.h>
+
+extern "C" {
+
+// this is to keep the clang syntax checker happy
+#ifndef FINTEGER
+#define FINTEGER int
+#endif
+
+/* declare BLAS functions, see http://www.netlib.org/clapack/cblas/ */
+
+int sgemm_ (const char *transa, const char *transb, FINTEGER *m, FINTEGER *
+            n, FINTEGER *k, const float *alpha, const float *a,
+            FINTEGER *lda, const float *b, FINTEGER *
+            ldb, float *beta, float *c, FINTEGER *ldc);
+
+}
 
 namespace faiss {
 
+namespace {
+
+/// returns x if the chain is empty, otherwise the transformed vectors,
+/// stored in buf
+const float *apply_chain_scratch (const IndexPreTransform & ipt,
+                                  Index::idx_t n, const float *x,
+                                  ScratchBuffer & buf)
+{
+    if (ipt.chain.empty()) {
+        return x;
+    }
+    float *xt = buf.get<float> (n * ipt.index->d);
+    ipt.apply_chain_noalloc (n, x, xt);
+    return xt;
+}
+
+/// transform equivalent to a1 followed by a2: y = A2 (A1 x + b1) + b2
+LinearTransform compose_linear (const LinearTransform & a1,
+                                const LinearTransform & a2)
+{
+    FAISS_THROW_IF_NOT (a1.d_out == a2.d_in);
+    int d0 = a1.d_in, d1 = a1.d_out, d2 = a2.d_out;
+    LinearTransform lt (d0, d2, a1.have_bias || a2.have_bias);
+    lt.A.resize ((size_t)d2 * d0);
+    {
+        float one = 1, zero = 0;
+        FINTEGER mi = d0, ni = d2, ki = d1;
+        sgemm_ ("Not transposed", "Not transposed", &mi, &ni, &ki,
+                &one, a1.A.data(), &mi, a2.A.data(), &ki,
+                &zero, lt.A.data(), &mi);
+    }
+    if (lt.have_bias) {
+        lt.b.resize (d2);
+        for (int i = 0; i < d2; i++) {
+            double accu = a2.have_bias ? a2.b[i] : 0;
+            if (a1.have_bias) {
+                const float *row = a2.A.data() + (size_t)i * d1;
+                for (int j = 0; j < d1; j++) {
+                    accu += row[j] * (double)a1.b[j];
+                }
+            }
+            lt.b[i] = accu;
+        }
+    }
+    lt.is_trained = true;
+    return lt;
+}
+
+const LinearTransform *as_trained_linear (const VectorTransform *vt)
+{
+    const LinearTransform *lt = dynamic_cast<const LinearTransform *> (vt);
+    return lt && lt->is_trained ? lt : nullptr;
+}
+
+} // anonymous namespace
+
 /*********************************************
  * IndexPreTransform
  *********************************************/
 
 IndexPreTransform::IndexPreTransform ():
-    index(nullptr), own_fields (false)
+    index(nullptr), own_fields (false), fuse_linear (true)
 {
 }
 
@@ -31,7 +105,7 @@ IndexPreTransform::IndexPreTransform ():
 IndexPreTransform::IndexPreTransform (
         Index * index):
     Index (index->d, index->metric_type),
-    index (index), own_fields (false)
+    index (index), own_fields (false), fuse_linear (true)
 {
     is_trained = index->is_trained;
     ntotal = index->ntotal;
@@ -42,7 +116,7 @@ IndexPreTransform::IndexPreTransform (
         VectorTransform * ltrans,
         Index * index):
     Index (index->d, index->metric_type),
-    index (index), own_fields (false)
+    index (index), own_fields (false), fuse_linear (true)
 {
     is_trained = index->is_trained;
     ntotal = index->ntotal;
@@ -55,6 +129,47 @@ void IndexPreTransform::prepend_transform (VectorTransform *ltrans)
     is_trained = is_trained && ltrans->is_trained;
     chain.insert (chain.begin(), ltrans);
     d = ltrans->d_in;
+    fuse_chain ();
+}
+
+void IndexPreTransform::fuse_chain ()
+{
+    fused_plan.clear ();
+    fused_lt.clear ();
+    fused_from.clear ();
+    if (!fuse_linear) {
+        return;
+    }
+    bool any_fused = false;
+    for (int i = 0; i < chain.size(); i++) {
+        const LinearTransform *lt = as_trained_linear (chain[i]);
+        if (lt && !fused_plan.empty()) {
+            int prev = fused_plan.back();
+            const LinearTransform *plt = prev >= 0 ?
+                as_trained_linear (chain[prev]) : &fused_lt[-1 - prev];
+            // compose only if the product is cheaper to apply
+            if (plt && (size_t)plt->d_in * lt->d_out <=
+                    (size_t)plt->d_in * plt->d_out +
+                    (size_t)lt->d_in * lt->d_out) {
+                LinearTransform composed = compose_linear (*plt, *lt);
+                if (prev >= 0) {
+                    fused_lt.push_back (composed);
+                    fused_plan.back() = -(int)fused_lt.size();
+                } else {
+                    fused_lt[-1 - prev] = composed;
+                }
+                any_fused = true;
+                continue;
+            }
+        }
+        fused_plan.push_back (i);
+    }
+    if (!any_fused) {
+        fused_plan.clear ();
+        fused_lt.clear ();
+        return;
+    }
+    fused_from = chain;
 }
 
 
@@ -125,22 +240,57 @@ void IndexPreTransform::train (idx_t n, const float *x)
     }
 
     is_trained = true;
+    fuse_chain ();
 }
 
 
 const float *IndexPreTransform::apply_chain (idx_t n, const float *x) const
 {
-    const float *prev_x = x;
-    ScopeDeleter<float> del;
-
-    for (int i = 0; i < chain.size(); i++) {
-        float * xt = chain[i]->apply (n, prev_x);
-        ScopeDeleter<float> del2 (xt);
-        del2.swap (del);
-        prev_x = xt;
+    if (chain.empty()) {
+        return x;
     }
+    float *xt = new float [n * index->d];
+    ScopeDeleter<float> del (xt);
+    apply_chain_noalloc (n, x, xt);
     del.release ();
-    return prev_x;
+    return xt;
+}
+
+void IndexPreTransform::apply_chain_noalloc (
+        idx_t n, const float *x, float *xt) const
+{
+    bool fused = !fused_plan.empty() && fused_from == chain;
+    int nstep = fused ? fused_plan.size() : chain.size();
+    auto step = [&] (int i) -> const VectorTransform * {
+        if (!fused) {
+            return chain[i];
+        }
+        int j = fused_plan[i];
+        return j >= 0 ? chain[j] : &fused_lt[-1 - j];
+    };
+
+    if (nstep == 0) {
+        memcpy (xt, x, sizeof(*x) * n * d);
+        return;
+    }
+
+    // intermediate results alternate between 2 buffers
+    size_t dmax = 0;
+    for (int i = 0; i + 1 < nstep; i++) {
+        dmax = std::max (dmax, (size_t)step(i)->d_out);
+    }
+    ScratchBuffer buf0, buf1;
+    float *bufs[2] = {
+        nstep > 1 ? buf0.get<float> (n * dmax) : nullptr,
+        nstep > 2 ? buf1.get<float> (n * dmax) : nullptr
+    };
+
+    const float *prev_x = x;
+    for (int i = 0; i < nstep; i++) {
+        float *out = i == nstep - 1 ? xt : bufs[i % 2];
+        step(i)->apply_noalloc (n, prev_x, out);
+        prev_x = out;
+    }
 }
 
 void IndexPreTransform::reverse_chain (idx_t n, const float* xt, float* x) const
@@ -160,8 +310,8 @@ void IndexPreTransform::reverse_chain (idx_t n, const float* xt, float* x) const
 void IndexPreTransform::add (idx_t n, const float *x)
 {
     FAISS_THROW_IF_NOT (is_trained);
-    const float *xt = apply_chain (n, x);
-    ScopeDeleter<float> del(xt == x ? nullptr : xt);
+    ScratchBuffer buf;
+    const float *xt = apply_chain_scratch (*this, n, x, buf);
     index->add (n, xt);
     ntotal = index->ntotal;
 }
@@ -170,8 +320,8 @@ void IndexPreTransform::add_with_ids (idx_t n, const float * x,
                                       const idx_t *xids)
 {
     FAISS_THROW_IF_NOT (is_trained);
-    const float *xt = apply_chain (n, x);
-    ScopeDeleter<float> del(xt == x ? nullptr : xt);
+    ScratchBuffer buf;
+    const float *xt = apply_chain_scratch (*this, n, x, buf);
     index->add_with_ids (n, xt, xids);
     ntotal = index->ntotal;
 }
@@ -180,20 +330,21 @@ void IndexPreTransform::add_with_ids (idx_t n, const float * x,
 
 
 void IndexPreTransform::search (idx_t n, const float *x, idx_t k,
-                               float *distances, idx_t *labels) const
+                               float *distances, idx_t *labels,
+                               const SearchParameters *params) const
 {
     FAISS_THROW_IF_NOT (is_trained);
-    const float *xt = apply_chain (n, x);
-    ScopeDeleter<float> del(xt == x ? nullptr : xt);
-    index->search (n, xt, k, distances, labels);
+    ScratchBuffer buf;
+    const float *xt = apply_chain_scratch (*this, n, x, buf);
+    index->search (n, xt, k, distances, labels, params);
 }
 
 void IndexPreTransform::range_search (idx_t n, const float* x, float radius,
                                       RangeSearchResult* result) const
 {
     FAISS_THROW_IF_NOT (is_trained);
-    const float *xt = apply_chain (n, x);
-    ScopeDeleter<float> del(xt == x ? nullptr : xt);
+    ScratchBuffer buf;
+    const float *xt = apply_chain_scratch (*this, n, x, buf);
     index->range_search (n, xt, radius, result);
 }
 
@@ -235,14 +386,27 @@ void IndexPreTransform::reconstruct_n (idx_t i0, idx_t ni, float *recons) const
 }
 
 
+void IndexPreTransform::reconstruct_batch (idx_t n, const idx_t *keys,
+                                           float *recons) const
+{
+    float *x = chain.empty() ? recons : new float [n * index->d];
+    ScopeDeleter<float> del (recons == x ? nullptr : x);
+    // Initial reconstruction
+    index->reconstruct_batch (n, keys, x);
+
+    // Revert transformations from last to first
+    reverse_chain (n, x, recons);
+}
+
+
 void IndexPreTransform::search_and_reconstruct (
       idx_t n, const float *x, idx_t k,
       float *distances, idx_t *labels, float* recons) const
 {
     FAISS_THROW_IF_NOT (is_trained);
 
-    const float* xt = apply_chain (n, x);
-    ScopeDeleter<float> del ((xt == x) ? nullptr : xt);
+    ScratchBuffer buf;
+    const float *xt = apply_chain_scratch (*this, n, x, buf);
 
     float* recons_temp = chain.empty() ? recons : new float [n * k * index->d];
     ScopeDeleter<float> del2 ((recons_temp == recons) ? nullptr : recons_temp);
@@ -263,9 +427,8 @@ void IndexPreTransform::sa_encode (idx_t n, const float *x,
     if (chain.empty()) {
         index->sa_encode (n, x, bytes);
     } else {
-        const float *xt = apply_chain (n, x);
-        ScopeDeleter<float> del(xt == x ? nullptr : xt);
-        index->sa_encode (n, xt, bytes);
+        ScratchBuffer buf;
+        index->sa_encode (n, apply_chain_scratch (*this, n, x, buf), bytes);
     }
 }
 
@@ -282,6 +445,22 @@ void IndexPreTransform::sa_decode (idx_t n, const uint8_t *bytes,
     }
 }
 
+MemoryUsage IndexPreTransform::memory_usage () const
+{
+    MemoryUsage mu = Index::memory_usage ();
+    for (size_t i = 0; i < chain.size(); i++) {
+        mu.add ("chain." + std::to_string (i), chain[i]->memory_usage ());
+    }
+    for (size_t i = 0; i < fused_lt.size(); i++) {
+        mu.add ("fused_lt." + std::to_string (i),
+                fused_lt[i].memory_usage ());
+    }
+    if (index) {
+        mu.add ("index", index->memory_usage ());
+    }
+    return mu;
+}
+
 
 
 } // namespace faiss
@@ -25,6 +25,18 @@ struct IndexPreTransform: Index {
 
     bool own_fields;          ///! whether pointers are deleted in destructor
 
+    /// compose consecutive trained LinearTransforms of the chain into a
+    /// single matrix when this reduces the nb of flops (default true)
+    bool fuse_linear;
+
+    /** Steps applied by apply_chain_noalloc when the chain is fused:
+     * i >= 0 refers to chain[i], i < 0 to fused_lt[-1 - i]. The plan is
+     * used only while chain == fused_from, ie. it is ignored if the
+     * chain is modified without calling fuse_chain again. */
+    std::vector<int> fused_plan;
+    std::vector<LinearTransform> fused_lt;  ///! composed transforms
+    std::vector<VectorTransform *> fused_from; ///! chain at fusion time
+
     explicit IndexPreTransform (Index *index);
 
     IndexPreTransform ();
@@ -34,6 +46,10 @@ struct IndexPreTransform: Index {
 
     void prepend_transform (VectorTransform * ltrans);
 
+    /// (re-)compute the fused plan. Called after training, prepending a
+    /// transform, cloning and reading the index.
+    void fuse_chain ();
+
     void train(idx_t n, const float* x) override;
 
     void add(idx_t n, const float* x) override;
@@ -51,7 +67,8 @@ struct IndexPreTransform: Index {
         const float* x,
         idx_t k,
         float* distances,
-        idx_t* labels) const override;
+        idx_t* labels,
+        const SearchParameters *params = nullptr) const override;
 
 
     /* range search, no attempt is done to change the radius */
@@ -64,6 +81,9 @@ struct IndexPreTransform: Index {
     void reconstruct_n (idx_t i0, idx_t ni, float *recons)
         const override;
 
+    void reconstruct_batch (idx_t n, const idx_t *keys, float *recons)
+        const override;
+
     void search_and_reconstruct (idx_t n, const float *x, idx_t k,
                                  float *distances, idx_t *labels,
                                  float *recons) const override;
@@ -72,6 +92,11 @@ struct IndexPreTransform: Index {
     /// equal to x, otherwise it should be deallocated.
     const float * apply_chain (idx_t n, const float *x) const;
 
+    /** same as apply_chain, but the output is pre-allocated (size
+     * n * index->d). The intermediate results are stored in per-thread
+     * scratch buffers that are reused across calls. */
+    void apply_chain_noalloc (idx_t n, const float *x, float *xt) const;
+
     /// Reverse the transforms in the chain. May not be implemented for
     /// all transforms in the chain or may return approximate results.
     void reverse_chain (idx_t n, const float* xt, float* x) const;
@@ -84,6 +109,9 @@ struct IndexPreTransform: Index {
     void sa_decode (idx_t n, const uint8_t *bytes,
                             float *x) const override;
 
+    /// transforms of the chain (chain.i), fused transforms and sub-index
+    MemoryUsage memory_usage () const override;
+
     ~IndexPreTransform() override;
 };
 
@@ -0,0 +1,431 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/IndexRefine.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexHNSW.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/Heap.h>
+#include <faiss/utils/distances.h>
+#include <faiss/utils/instrumentation.h>
+
+
+namespace faiss {
+
+
+IndexRefine::IndexRefine (Index *base_index, Index *refine_index):
+    Index (base_index->d, base_index->metric_type),
+    base_index (base_index), refine_index (refine_index),
+    own_fields (false), own_refine_index (false),
+    k_factor (1), rerank_hnsw_candidates (true), adaptive_refine (false)
+{
+    FAISS_THROW_IF_NOT (base_index->d == refine_index->d);
+    FAISS_THROW_IF_NOT_MSG (
+          base_index->metric_type == refine_index->metric_type,
+          "base and refine index should have the same metric");
+    FAISS_THROW_IF_NOT_MSG (
+          base_index->ntotal == 0 && refine_index->ntotal == 0,
+          "base_index and refine_index should be empty in the beginning");
+    is_trained = base_index->is_trained && refine_index->is_trained;
+}
+
+IndexRefine::IndexRefine ():
+    base_index (nullptr), refine_index (nullptr),
+    own_fields (false), own_refine_index (false),
+    k_factor (1), rerank_hnsw_candidates (true), adaptive_refine (false)
+{}
+
+
+void IndexRefine::train (idx_t n, const float *x)
+{
+    base_index->train (n, x);
+    refine_index->train (n, x);
+    is_trained = true;
+}
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+/// |x - x'| where x' is the reconstruction of x by the standalone codec
+/// of index
+void compute_reconstruction_errors (const Index & index, idx_t n,
+                                    const float *x, float *errors)
+{
+    size_t d = index.d;
+    size_t code_size = index.sa_code_size ();
+    const idx_t bs = 16384;
+    std::vector<uint8_t> codes (std::min (n, bs) * code_size);
+    std::vector<float> xr (std::min (n, bs) * d);
+
+    for (idx_t i0 = 0; i0 < n; i0 += bs) {
+        idx_t i1 = std::min (n, i0 + bs);
+        index.sa_encode (i1 - i0, x + i0 * d, codes.data());
+        index.sa_decode (i1 - i0, codes.data(), xr.data());
+#pragma omp parallel for if (i1 - i0 > 1000)
+        for (idx_t i = i0; i < i1; i++) {
+            errors[i] = sqrtf (fvec_L2sqr (x + i * d,
+                                           xr.data() + (i - i0) * d, d));
+        }
+    }
+}
+
+} // anonymous namespace
+
+void IndexRefine::add (idx_t n, const float *x)
+{
+    FAISS_THROW_IF_NOT (is_trained);
+    if (adaptive_refine) {
+        FAISS_THROW_IF_NOT_MSG (base_errors.size() == ntotal,
+                                "adaptive_refine set after adding vectors");
+        std::vector<float> errors (n);
+        compute_reconstruction_errors (*base_index, n, x, errors.data());
+        base_errors.insert (base_errors.end(), errors.begin(), errors.end());
+    }
+    base_index->add (n, x);
+    refine_index->add (n, x);
+    ntotal = refine_index->ntotal;
+}
+
+void IndexRefine::reset ()
+{
+    base_index->reset ();
+    refine_index->reset ();
+    base_errors.clear ();
+    ntotal = 0;
+}
+
+namespace {
+
+template<class C>
+void reorder_2_heaps (
+      idx_t n,
+      idx_t k, idx_t *labels, float *distances,
+      idx_t k_base, const idx_t *base_labels, const float *base_distances)
+{
+#pragma omp parallel for
+    for (idx_t i = 0; i < n; i++) {
+        idx_t *idxo = labels + i * k;
+        float *diso = distances + i * k;
+        const idx_t *idxi = base_labels + i * k_base;
+        const float *disi = base_distances + i * k_base;
+
+        heap_heapify<C> (k, diso, idxo, disi, idxi, k);
+        if (k_base != k) { // add remaining elements
+            heap_addn<C> (k, diso, idxo, disi + k, idxi + k, k_base - k);
+        }
+        heap_reorder<C> (k, diso, idxo);
+    }
+}
+
+/// refine distances of the k_base candidates of each query (-1s ignored)
+void compute_refine_distances (const Index & refine_index,
+                               idx_t n, const float *x, idx_t k_base,
+                               const idx_t *base_labels, float *distances)
+{
+    size_t d = refine_index.d;
+    const IndexFlat *rf = dynamic_cast<const IndexFlat*> (&refine_index);
+
+    if (rf && (rf->metric_type == METRIC_L2 ||
+               rf->metric_type == METRIC_INNER_PRODUCT)) {
+        rf->compute_distance_subset (n, x, k_base, distances, base_labels);
+    } else if (refine_index.metric_type == METRIC_L2) {
+#pragma omp parallel
+        {
+            std::unique_ptr<DistanceComputer> dc (
+                  refine_index.get_distance_computer ());
+#pragma omp for
+            for (idx_t i = 0; i < n; i++) {
+                dc->set_query (x + i * d);
+                const idx_t *li = base_labels + i * k_base;
+                float *di = distances + i * k_base;
+                for (idx_t j = 0; j < k_base; j++) {
+                    if (li[j] >= 0) {
+                        di[j] = (*dc) (li[j]);
+                    }
+                }
+            }
+        }
+    } else if (refine_index.metric_type == METRIC_INNER_PRODUCT) {
+        // gather the reconstructed candidates of a query, then compute
+        // all its distances at once
+#pragma omp parallel
+        {
+            std::vector<float> xr (k_base * d), dis (k_base);
+            std::vector<idx_t> valid (k_base);
+#pragma omp for
+            for (idx_t i = 0; i < n; i++) {
+                const idx_t *li = base_labels + i * k_base;
+                float *di = distances + i * k_base;
+                size_t nv = 0;
+                for (idx_t j = 0; j < k_base; j++) {
+                    if (li[j] >= 0) {
+                        refine_index.reconstruct (li[j], xr.data() + nv * d);
+                        valid[nv++] = j;
+                    }
+                }
+                fvec_inner_products_ny (dis.data(), x + i * d, xr.data(),
+                                        d, nv);
+                for (size_t j = 0; j < nv; j++) {
+                    di[valid[j]] = dis[j];
+                }
+            }
+        }
+    } else {
+        FAISS_THROW_MSG ("Metric type not supported");
+    }
+}
+
+/// refine distances of the candidates of one query at a time
+struct RefineDistance {
+    const Index & index;
+    std::unique_ptr<DistanceComputer> dc;
+    std::vector<float> xr;
+    const float *q;
+
+    explicit RefineDistance (const Index & index):
+        index (index), q (nullptr)
+    {
+        if (index.metric_type == METRIC_L2 ||
+            dynamic_cast<const IndexFlat*> (&index)) {
+            dc.reset (index.get_distance_computer ());
+        } else {
+            // no inner product DistanceComputer in general
+            xr.resize (index.d);
+        }
+    }
+
+    void set_query (const float *x)
+    {
+        q = x;
+        if (dc) {
+            dc->set_query (x);
+        }
+    }
+
+    float operator () (idx_t id)
+    {
+        if (dc) {
+            return (*dc) (id);
+        }
+        index.reconstruct (id, xr.data());
+        return fvec_inner_product (q, xr.data(), index.d);
+    }
+};
+
+/** re-rank the k_base candidates of each query by order of their bound,
+ * and stop when the next bound cannot beat the k-th refined distance. C
+ * is the comparator of the result heap (CMax for L2). Returns the nb of
+ * refined distances. */
+template<class C>
+size_t refine_adaptive (const Index & refine_index, const float *base_errors,
+                        idx_t n, const float *x, idx_t k,
+                        float *distances, idx_t *labels,
+                        idx_t k_base, const idx_t *base_labels,
+                        const float *base_distances)
+{
+    size_t d = refine_index.d;
+    size_t nrefine = 0;
+
+#pragma omp parallel reduction(+: nrefine)
+    {
+        RefineDistance rd (refine_index);
+        // (bound, label) of the candidates
+        std::vector<std::pair<float, idx_t> > bounds (k_base);
+
+#pragma omp for
+        for (idx_t i = 0; i < n; i++) {
+            const float *xi = x + i * d;
+            const idx_t *li = base_labels + i * k_base;
+            const float *di = base_distances + i * k_base;
+            float qnorm = C::is_max ? 0 : sqrtf (fvec_norm_L2sqr (xi, d));
+
+            size_t nb = 0;
+            for (idx_t j = 0; j < k_base; j++) {
+                if (li[j] < 0) {
+                    continue;
+                }
+                float e = base_errors[li[j]];
+                float bound;
+                if (C::is_max) {
+                    float r = sqrtf (std::max (di[j], 0.0f)) - e;
+                    bound = r > 0 ? r * r : 0;
+                } else {
+                    bound = di[j] + qnorm * e;
+                }
+                bounds[nb++] = std::make_pair (bound, li[j]);
+            }
+            // most promising candidates first
+            std::sort (bounds.begin(), bounds.begin() + nb,
+                       [] (const std::pair<float, idx_t> & a,
+                           const std::pair<float, idx_t> & b) {
+                           return C::cmp (b.first, a.first);
+                       });
+
+            float *simi = distances + i * k;
+            idx_t *idxi = labels + i * k;
+            heap_heapify<C> (k, simi, idxi);
+            rd.set_query (xi);
+
+            for (size_t j = 0; j < nb; j++) {
+                // the heap top is the neutral value until k are refined
+                if (!C::cmp (simi[0], bounds[j].first)) {
+                    break;
+                }
+                float dis = rd (bounds[j].second);
+                nrefine++;
+                if (C::cmp (simi[0], dis)) {
+                    heap_pop<C> (k, simi, idxi);
+                    heap_push<C> (k, simi, idxi, dis, bounds[j].second);
+                }
+            }
+            heap_reorder<C> (k, simi, idxi);
+        }
+    }
+    return nrefine;
+}
+
+} // anonymous namespace
+
+
+void IndexRefine::search (
+              idx_t n, const float *x, idx_t k,
+              float *distances, idx_t *labels,
+              const SearchParameters *params) const
+{
+    FAISS_THROW_IF_NOT (is_trained);
+
+    float kf = k_factor;
+    const SearchParameters *base_params = params;
+    if (auto rparams =
+            dynamic_cast<const IndexRefineSearchParameters*> (params)) {
+        if (rparams->k_factor > 0) {
+            kf = rparams->k_factor;
+        }
+        base_params = rparams->base_index_params;
+    }
+
+    idx_t k_base = idx_t (k * kf);
+    FAISS_THROW_IF_NOT (k_base >= k);
+
+    const IndexHNSW *hnsw = dynamic_cast<const IndexHNSW*> (base_index);
+    if (rerank_hnsw_candidates && hnsw) {
+        auto hparams = dynamic_cast<const SearchParametersHNSW*> (base_params);
+        int ef = hparams ? hparams->efSearch : hnsw->hnsw.efSearch;
+        k_base = std::max (k_base, std::min (idx_t (ef), hnsw->ntotal));
+    }
+
+    bool adaptive = adaptive_refine && base_errors.size() == ntotal &&
+        (metric_type == METRIC_L2 || metric_type == METRIC_INNER_PRODUCT);
+
+    std::unique_ptr<idx_t []> del1;
+    std::unique_ptr<float []> del2;
+    idx_t *base_labels = labels;
+    float *base_distances = distances;
+    // the adaptive re-ranking does not work in place
+    if (k != k_base || adaptive) {
+        base_labels = new idx_t [n * k_base];
+        del1.reset (base_labels);
+        base_distances = new float [n * k_base];
+        del2.reset (base_distances);
+    }
+
+    base_index->search (n, x, k_base, base_distances, base_labels,
+                        base_params);
+
+    for (idx_t i = 0; i < n * k_base; i++)
+        assert (base_labels[i] >= -1 &&
+                base_labels[i] < ntotal);
+
+    size_t ncandidates = 0;
+    for (idx_t i = 0; i < n * k_base; i++) {
+        ncandidates += base_labels[i] >= 0 ? 1 : 0;
+    }
+    indexRefine_stats.nq += n;
+    indexRefine_stats.ncandidates += ncandidates;
+
+    InstrumentationTimer timer (STAGE_REFINE);
+    if (adaptive) {
+        size_t nrefine;
+        if (metric_type == METRIC_L2) {
+            nrefine = refine_adaptive<CMax<float, idx_t> > (
+                *refine_index, base_errors.data(), n, x, k,
+                distances, labels, k_base, base_labels, base_distances);
+        } else {
+            nrefine = refine_adaptive<CMin<float, idx_t> > (
+                *refine_index, base_errors.data(), n, x, k,
+                distances, labels, k_base, base_labels, base_distances);
+        }
+        indexRefine_stats.nrefine += nrefine;
+        return;
+    }
+
+    compute_refine_distances (*refine_index, n, x, k_base,
+                              base_labels, base_distances);
+    indexRefine_stats.nrefine += ncandidates;
+
+    // sort and store result
+    if (metric_type == METRIC_L2) {
+        typedef CMax <float, idx_t> C;
+        reorder_2_heaps<C> (
+            n, k, labels, distances,
+            k_base, base_labels, base_distances);
+    } else {
+        typedef CMin <float, idx_t> C;
+        reorder_2_heaps<C> (
+            n, k, labels, distances,
+            k_base, base_labels, base_distances);
+    }
+}
+
+void IndexRefine::reconstruct (idx_t key, float *recons) const
+{
+    refine_index->reconstruct (key, recons);
+}
+
+size_t IndexRefine::sa_code_size () const
+{
+    return refine_index->sa_code_size ();
+}
+
+void IndexRefine::sa_encode (idx_t n, const float *x, uint8_t *bytes) const
+{
+    refine_index->sa_encode (n, x, bytes);
+}
+
+void IndexRefine::sa_decode (idx_t n, const uint8_t *bytes, float *x) const
+{
+    refine_index->sa_decode (n, bytes, x);
+}
+
+IndexRefine::~IndexRefine ()
+{
+    if (own_fields) delete base_index;
+    if (own_refine_index) delete refine_index;
+}
+
+
+void IndexRefineStats::reset ()
+{
+    memset ((void*)this, 0, sizeof (*this));
+}
+
+IndexRefineStats indexRefine_stats;
+
+
+} // namespace faiss
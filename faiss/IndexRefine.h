@@ -0,0 +1,140 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <vector>
+
+#include <faiss/Index.h>
+#include <faiss/impl/platform_macros.h>
+
+
+namespace faiss {
+
+
+/// search parameters of IndexRefine, override the fields of the index
+struct IndexRefineSearchParameters: SearchParameters {
+    float k_factor;                      ///< 0 = use IndexRefine::k_factor
+    SearchParameters *base_index_params; ///< passed to the base index
+
+    IndexRefineSearchParameters (): k_factor (0), base_index_params (nullptr)
+    {}
+};
+
+
+/** Index that queries a base_index (a fast one) and re-ranks the
+ * k_factor * k results with the distances of a refine_index, that stores
+ * a more accurate version of the same vectors (eg. IndexFlat, or an
+ * IndexScalarQuantizer or IndexPQ with more bytes per vector than the
+ * base index).
+ *
+ * The refine distances are computed in one batch for all the
+ * candidates: with fvec_L2sqr_by_idx / fvec_inner_products_by_idx if the
+ * refine index is an IndexFlat, otherwise with the DistanceComputer of
+ * the refine index for L2, or by reconstructing the candidates for the
+ * inner product.
+ *
+ * With an HNSW base index on compressed storage (eg. "HNSW32_PQ16,
+ * Refine(SQfp16)" in the index_factory), the graph is traversed with the
+ * compressed distances and the efSearch candidates are re-ranked.
+ */
+struct IndexRefine: Index {
+
+    /// faster index to pre-select the vectors that should be filtered
+    Index *base_index;
+
+    /// refinement index
+    Index *refine_index;
+
+    bool own_fields;         ///< should the base index be deallocated?
+    bool own_refine_index;   ///< same with the refine index
+
+    /// factor between k requested in search and the k requested from
+    /// the base_index (should be >= 1)
+    float k_factor;
+
+    /** if the base index is an IndexHNSW (eg. with PQ or SQ storage), the
+     * k requested from it is at least efSearch: all the candidates of
+     * the graph traversal are re-ranked, at no additional traversal cost */
+    bool rerank_hnsw_candidates;
+
+    /** adaptive refinement (L2 and inner product): the candidates of a
+     * query are re-ranked by order of their bound on the refined
+     * distance, and the re-ranking stops when the bound of the next
+     * candidate cannot beat the current k-th refined distance. The bound
+     * of a candidate x follows from its base distance and the error
+     * e = |x - x'| of its reconstruction x' by the base index: the L2
+     * distance to the query q is at least |q - x'| - e (triangle
+     * inequality), the inner product is at most <q, x'> + |q| e
+     * (Cauchy-Schwarz).
+     *
+     * The results are those of the full re-ranking of the k_base
+     * candidates if the base index returns the distances to its
+     * reconstructed vectors (eg. IndexPQ, IndexScalarQuantizer,
+     * IndexIVFPQ, IndexIVFScalarQuantizer and IndexHNSW on such a
+     * storage, but not the fast-scan indexes), and the refine index is
+     * exact. The errors are computed at add time with the standalone
+     * codec of the base index, so the flag should be set before adding.
+     * Without the errors, all the candidates are re-ranked. */
+    bool adaptive_refine;
+
+    /// |x - x'| for each vector, filled in by add if adaptive_refine
+    std::vector<float> base_errors;
+
+    /// the indexes should be empty and have the same dimension and metric
+    IndexRefine (Index *base_index, Index *refine_index);
+
+    IndexRefine ();
+
+    void train(idx_t n, const float* x) override;
+
+    void add(idx_t n, const float* x) override;
+
+    void reset() override;
+
+    void search(
+        idx_t n,
+        const float* x,
+        idx_t k,
+        float* distances,
+        idx_t* labels,
+        const SearchParameters *params = nullptr) const override;
+
+    /// reconstructs from the refine index
+    void reconstruct(idx_t key, float* recons) const override;
+
+    /* The standalone codec interface is the one of the refine index,
+     * that stores the more accurate version of the vectors */
+    size_t sa_code_size () const override;
+
+    void sa_encode (idx_t n, const float *x,
+                    uint8_t *bytes) const override;
+
+    void sa_decode (idx_t n, const uint8_t *bytes,
+                    float *x) const override;
+
+    ~IndexRefine() override;
+};
+
+
+/// statistics of the re-ranking of IndexRefine
+struct IndexRefineStats {
+    size_t nq;           ///< nb of queries
+    size_t ncandidates;  ///< nb of candidates returned by the base index
+    size_t nrefine;      ///< nb of refined distances computed
+
+    IndexRefineStats () {reset (); }
+    void reset ();
+};
+
+/// global var that collects them all
+FAISS_API extern IndexRefineStats indexRefine_stats;
+
+
+} // namespace faiss
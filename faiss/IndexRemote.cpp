@@ -0,0 +1,590 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/IndexRemote.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/utils.h>
+
+namespace faiss {
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+const uint32_t request_magic = 0x51525846;   // "FXRQ"
+const uint32_t response_magic = 0x53525846;  // "FXRS"
+
+enum RemoteOp {
+    OP_INFO = 0,
+    OP_TRAIN = 1,
+    OP_ADD = 2,
+    OP_ADD_WITH_IDS = 3,
+    OP_RESET = 4,
+    OP_SEARCH = 5,
+};
+
+struct RequestHeader {
+    uint32_t magic;
+    uint32_t op;
+    int64_t req_id;
+    int64_t n;
+    int64_t k;
+    uint64_t payload_size;
+};
+
+struct ResponseHeader {
+    uint32_t magic;
+    int32_t status;   // 0 = ok, otherwise the payload is an error message
+    int64_t req_id;
+    uint64_t payload_size;
+};
+
+struct IndexInfo {
+    int64_t d;
+    int64_t ntotal;
+    int64_t metric_type;
+    int64_t is_trained;
+};
+
+bool write_all (int fd, const void *buf, size_t n)
+{
+    const char *p = (const char*)buf;
+    while (n > 0) {
+        ssize_t nw = send (fd, p, n, MSG_NOSIGNAL);
+        if (nw < 0 && errno == EINTR) {
+            continue;
+        }
+        if (nw <= 0) {
+            return false;
+        }
+        p += nw;
+        n -= nw;
+    }
+    return true;
+}
+
+bool read_all (int fd, void *buf, size_t n)
+{
+    char *p = (char*)buf;
+    while (n > 0) {
+        ssize_t nr = recv (fd, p, n, 0);
+        if (nr < 0 && errno == EINTR) {
+            continue;
+        }
+        if (nr <= 0) {
+            return false;
+        }
+        p += nr;
+        n -= nr;
+    }
+    return true;
+}
+
+void set_nodelay (int fd)
+{
+    int one = 1;
+    setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+} // anonymous namespace
+
+
+/**********************************************************
+ * IndexServer
+ **********************************************************/
+
+struct IndexServer::Impl {
+    IndexServer *server;
+    int listen_fd = -1;
+    bool stopping = false;
+
+    std::thread accept_thread;
+
+    std::mutex mutex; // protects conn_fds and threads
+    std::vector<int> conn_fds;
+    std::vector<std::thread> threads;
+
+    /// searches take it in read mode, the other ops in write mode
+    pthread_rwlock_t index_lock;
+
+    explicit Impl (IndexServer *server): server (server) {
+        pthread_rwlock_init (&index_lock, nullptr);
+    }
+
+    ~Impl () {
+        pthread_rwlock_destroy (&index_lock);
+    }
+
+    void accept_loop () {
+        for (;;) {
+            int fd = accept (listen_fd, nullptr, nullptr);
+            if (fd < 0 && errno == EINTR) {
+                continue;
+            }
+            if (fd < 0) {
+                break; // listening socket closed by stop()
+            }
+            set_nodelay (fd);
+            std::lock_guard<std::mutex> lock (mutex);
+            if (stopping) {
+                close (fd);
+                break;
+            }
+            conn_fds.push_back (fd);
+            threads.emplace_back (&Impl::serve_connection, this, fd);
+        }
+    }
+
+    void serve_connection (int fd) {
+        std::vector<uint8_t> payload, response;
+        for (;;) {
+            RequestHeader req;
+            if (!read_all (fd, &req, sizeof(req)) ||
+                req.magic != request_magic) {
+                break;
+            }
+            payload.resize (req.payload_size);
+            if (!read_all (fd, payload.data(), payload.size())) {
+                break;
+            }
+            ResponseHeader resp;
+            resp.magic = response_magic;
+            resp.req_id = req.req_id;
+            resp.status = 0;
+            try {
+                handle_request (req, payload, response);
+            } catch (const std::exception & e) {
+                resp.status = 1;
+                const char *msg = e.what();
+                response.assign (msg, msg + strlen (msg));
+            }
+            resp.payload_size = response.size();
+            if (!write_all (fd, &resp, sizeof(resp)) ||
+                !write_all (fd, response.data(), response.size())) {
+                break;
+            }
+        }
+    }
+
+    void handle_request (const RequestHeader & req,
+                         const std::vector<uint8_t> & payload,
+                         std::vector<uint8_t> & response) {
+        Index *index = server->index;
+        size_t x_size = req.n * index->d * sizeof(float);
+        const float *x = (const float*)payload.data();
+
+        if (req.op == OP_SEARCH) {
+            FAISS_THROW_IF_NOT_MSG (payload.size() == x_size && req.k >= 0,
+                                    "invalid search request");
+            size_t nk = req.n * req.k;
+            response.resize (nk * (sizeof(float) + sizeof(idx_t)));
+            pthread_rwlock_rdlock (&index_lock);
+            try {
+                index->search (req.n, x, req.k, (float*)response.data(),
+                               (idx_t*)(response.data() + nk * sizeof(float)));
+            } catch (...) {
+                pthread_rwlock_unlock (&index_lock);
+                throw;
+            }
+            pthread_rwlock_unlock (&index_lock);
+            return;
+        }
+
+        pthread_rwlock_wrlock (&index_lock);
+        try {
+            switch (req.op) {
+              case OP_INFO:
+                break;
+              case OP_TRAIN:
+                FAISS_THROW_IF_NOT (payload.size() == x_size);
+                index->train (req.n, x);
+                break;
+              case OP_ADD:
+                FAISS_THROW_IF_NOT (payload.size() == x_size);
+                index->add (req.n, x);
+                break;
+              case OP_ADD_WITH_IDS:
+                FAISS_THROW_IF_NOT (
+                      payload.size() == x_size + req.n * sizeof(idx_t));
+                index->add_with_ids (req.n, x,
+                      (const idx_t*)(payload.data() + x_size));
+                break;
+              case OP_RESET:
+                index->reset ();
+                break;
+              default:
+                FAISS_THROW_FMT ("unknown request %d", int(req.op));
+            }
+        } catch (...) {
+            pthread_rwlock_unlock (&index_lock);
+            throw;
+        }
+        IndexInfo info;
+        info.d = index->d;
+        info.ntotal = index->ntotal;
+        info.metric_type = index->metric_type;
+        info.is_trained = index->is_trained;
+        pthread_rwlock_unlock (&index_lock);
+        response.resize (sizeof(info));
+        memcpy (response.data(), &info, sizeof(info));
+    }
+
+};
+
+
+IndexServer::IndexServer (Index *index, int port):
+    index (index), port (port), impl (nullptr)
+{}
+
+void IndexServer::start ()
+{
+    FAISS_THROW_IF_NOT_MSG (!impl, "server already started");
+    int fd = socket (AF_INET6, SOCK_STREAM, 0);
+    FAISS_THROW_IF_NOT_FMT (fd >= 0, "socket: %s", strerror(errno));
+    int one = 1;
+    setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    int zero = 0; // accept IPv4 connections as well
+    setsockopt (fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+
+    sockaddr_in6 addr;
+    memset (&addr, 0, sizeof(addr));
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr = in6addr_any;
+    addr.sin6_port = htons (port);
+    if (bind (fd, (sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen (fd, 64) != 0) {
+        int err = errno;
+        close (fd);
+        FAISS_THROW_FMT ("could not listen on port %d: %s",
+                         port, strerror(err));
+    }
+    socklen_t len = sizeof(addr);
+    getsockname (fd, (sockaddr*)&addr, &len);
+    port = ntohs (addr.sin6_port);
+
+    impl = new Impl (this);
+    impl->listen_fd = fd;
+    impl->accept_thread = std::thread (&Impl::accept_loop, impl);
+}
+
+void IndexServer::stop ()
+{
+    if (!impl) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock (impl->mutex);
+        impl->stopping = true;
+        // unblocks accept and the reads of the connection threads
+        shutdown (impl->listen_fd, SHUT_RDWR);
+        for (int fd : impl->conn_fds) {
+            shutdown (fd, SHUT_RDWR);
+        }
+    }
+    impl->accept_thread.join ();
+    for (std::thread & t : impl->threads) {
+        t.join ();
+    }
+    for (int fd : impl->conn_fds) {
+        close (fd);
+    }
+    close (impl->listen_fd);
+    delete impl;
+    impl = nullptr;
+}
+
+IndexServer::~IndexServer ()
+{
+    stop ();
+}
+
+
+/**********************************************************
+ * IndexRemote
+ **********************************************************/
+
+struct IndexRemote::Connection {
+    int fd = -1;
+
+    std::mutex send_mutex;
+    idx_t next_req_id = 0;
+
+    // all fields below are protected by recv_mutex
+    std::mutex recv_mutex;
+
+    struct Response {
+        int status;
+        std::vector<uint8_t> payload;
+    };
+    /// responses that were received but not waited for yet
+    std::map<idx_t, Response> received;
+    /// requests that timed out, their response is dropped
+    std::set<idx_t> abandoned;
+    /// n and k of the search requests in flight
+    std::map<idx_t, std::pair<idx_t, idx_t> > search_sizes;
+
+    std::string name;
+
+    idx_t send_request (int op, idx_t n, idx_t k,
+                        const void *payload1, size_t size1,
+                        const void *payload2, size_t size2) {
+        std::lock_guard<std::mutex> lock (send_mutex);
+        RequestHeader req;
+        req.magic = request_magic;
+        req.op = op;
+        req.req_id = next_req_id++;
+        req.n = n;
+        req.k = k;
+        req.payload_size = size1 + size2;
+        bool ok = write_all (fd, &req, sizeof(req)) &&
+            write_all (fd, payload1, size1) &&
+            write_all (fd, payload2, size2);
+        FAISS_THROW_IF_NOT_FMT (ok, "could not send request to %s: %s",
+                                name.c_str(), strerror(errno));
+        return req.req_id;
+    }
+
+    /// @return false on timeout
+    bool wait_response (idx_t req_id, int timeout_ms, Response & out) {
+        double t0 = getmillisecs ();
+        std::lock_guard<std::mutex> lock (recv_mutex);
+        for (;;) {
+            auto it = received.find (req_id);
+            if (it != received.end()) {
+                out = std::move (it->second);
+                received.erase (it);
+                return true;
+            }
+            int remaining = -1;
+            if (timeout_ms > 0) {
+                remaining = timeout_ms - int(getmillisecs () - t0);
+                if (remaining <= 0) {
+                    abandoned.insert (req_id);
+                    return false;
+                }
+            }
+            pollfd pfd;
+            pfd.fd = fd;
+            pfd.events = POLLIN;
+            int ret = poll (&pfd, 1, remaining);
+            if (ret < 0 && errno == EINTR) {
+                continue;
+            }
+            FAISS_THROW_IF_NOT_FMT (ret >= 0, "poll: %s", strerror(errno));
+            if (ret == 0) {
+                continue;
+            }
+
+            ResponseHeader resp;
+            Response r;
+            bool ok = read_all (fd, &resp, sizeof(resp)) &&
+                resp.magic == response_magic;
+            if (ok) {
+                r.status = resp.status;
+                r.payload.resize (resp.payload_size);
+                ok = read_all (fd, r.payload.data(), r.payload.size());
+            }
+            FAISS_THROW_IF_NOT_FMT (ok, "connection to %s lost",
+                                    name.c_str());
+            if (abandoned.erase (resp.req_id)) {
+                search_sizes.erase (resp.req_id);
+                continue;
+            }
+            received[resp.req_id] = std::move (r);
+        }
+    }
+
+    ~Connection () {
+        if (fd >= 0) {
+            close (fd);
+        }
+    }
+};
+
+
+IndexRemote::IndexRemote (const char *host, int port, int timeout_ms):
+    host (host), port (port), timeout_ms (timeout_ms), n_timeout (0),
+    conn (new Connection ())
+{
+    conn->name = std::string (host) + ":" + std::to_string (port);
+
+    addrinfo hints, *res = nullptr;
+    memset (&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    std::string port_str = std::to_string (port);
+    int err = getaddrinfo (host, port_str.c_str(), &hints, &res);
+    if (err != 0) {
+        delete conn;
+        FAISS_THROW_FMT ("could not resolve %s: %s",
+                         host, gai_strerror (err));
+    }
+    int fd = -1;
+    for (addrinfo *ai = res; ai; ai = ai->ai_next) {
+        fd = socket (ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect (fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close (fd);
+        fd = -1;
+    }
+    freeaddrinfo (res);
+    if (fd < 0) {
+        std::string name = conn->name;
+        delete conn;
+        FAISS_THROW_FMT ("could not connect to %s", name.c_str());
+    }
+    set_nodelay (fd);
+    conn->fd = fd;
+
+    sync_info ();
+}
+
+IndexRemote::~IndexRemote ()
+{
+    delete conn;
+}
+
+void IndexRemote::call (int op, idx_t n,
+                        const void *payload1, size_t size1,
+                        const void *payload2, size_t size2)
+{
+    idx_t req_id = conn->send_request (op, n, 0, payload1, size1,
+                                       payload2, size2);
+    Connection::Response r;
+    conn->wait_response (req_id, 0, r);
+    if (r.status != 0) {
+        std::string msg (r.payload.begin(), r.payload.end());
+        FAISS_THROW_FMT ("error on %s: %s", conn->name.c_str(), msg.c_str());
+    }
+    FAISS_THROW_IF_NOT (r.payload.size() == sizeof(IndexInfo));
+    IndexInfo info;
+    memcpy (&info, r.payload.data(), sizeof(info));
+    d = info.d;
+    ntotal = info.ntotal;
+    metric_type = (MetricType)info.metric_type;
+    is_trained = info.is_trained;
+}
+
+void IndexRemote::sync_info ()
+{
+    call (OP_INFO, 0, nullptr, 0, nullptr, 0);
+}
+
+void IndexRemote::train (idx_t n, const float *x)
+{
+    call (OP_TRAIN, n, x, n * d * sizeof(float), nullptr, 0);
+}
+
+void IndexRemote::add (idx_t n, const float *x)
+{
+    call (OP_ADD, n, x, n * d * sizeof(float), nullptr, 0);
+}
+
+void IndexRemote::add_with_ids (idx_t n, const float *x, const idx_t *xids)
+{
+    call (OP_ADD_WITH_IDS, n, x, n * d * sizeof(float),
+          xids, n * sizeof(idx_t));
+}
+
+void IndexRemote::reset ()
+{
+    call (OP_RESET, 0, nullptr, 0, nullptr, 0);
+}
+
+idx_t IndexRemote::search_async (idx_t n, const float *x, idx_t k) const
+{
+    idx_t req_id = conn->send_request (
+            OP_SEARCH, n, k, x, n * d * sizeof(float), nullptr, 0);
+    std::lock_guard<std::mutex> lock (conn->recv_mutex);
+    conn->search_sizes[req_id] = std::make_pair (n, k);
+    return req_id;
+}
+
+bool IndexRemote::wait_result (idx_t req_id, float *distances,
+                               idx_t *labels) const
+{
+    idx_t n, k;
+    {
+        std::lock_guard<std::mutex> lock (conn->recv_mutex);
+        auto it = conn->search_sizes.find (req_id);
+        FAISS_THROW_IF_NOT_MSG (it != conn->search_sizes.end(),
+                                "unknown request");
+        n = it->second.first;
+        k = it->second.second;
+    }
+
+    Connection::Response r;
+    if (!conn->wait_response (req_id, timeout_ms, r)) {
+        float neutral = metric_type == METRIC_INNER_PRODUCT ?
+            -std::numeric_limits<float>::infinity() :
+            std::numeric_limits<float>::infinity();
+        for (idx_t i = 0; i < n * k; i++) {
+            distances[i] = neutral;
+            labels[i] = -1;
+        }
+        n_timeout++;
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock (conn->recv_mutex);
+        conn->search_sizes.erase (req_id);
+    }
+    if (r.status != 0) {
+        std::string msg (r.payload.begin(), r.payload.end());
+        FAISS_THROW_FMT ("error on %s: %s", conn->name.c_str(), msg.c_str());
+    }
+    size_t nk = n * k;
+    FAISS_THROW_IF_NOT (r.payload.size() ==
+                        nk * (sizeof(float) + sizeof(idx_t)));
+    memcpy (distances, r.payload.data(), nk * sizeof(float));
+    memcpy (labels, r.payload.data() + nk * sizeof(float),
+            nk * sizeof(idx_t));
+    return true;
+}
+
+void IndexRemote::search (idx_t n, const float *x, idx_t k,
+                          float *distances, idx_t *labels,
+                          const SearchParameters *params) const
+{
+    FAISS_THROW_IF_NOT_MSG (!params,
+                            "search params not supported by IndexRemote");
+    if (n == 0) {
+        return;
+    }
+    idx_t req_id = search_async (n, x, k);
+    wait_result (req_id, distances, labels);
+}
+
+
+} // namespace faiss
@@ -0,0 +1,109 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#ifndef FAISS_INDEX_REMOTE_H
+#define FAISS_INDEX_REMOTE_H
+
+#include <string>
+
+#include <faiss/Index.h>
+
+namespace faiss {
+
+/** Serves an index over TCP for IndexRemote clients.
+ *
+ * Each connection is handled by its own thread, requests on a
+ * connection are processed in order. Searches from several connections
+ * run concurrently, train / add / reset are exclusive.
+ *
+ * The protocol is binary, in host byte order. A request is a header
+ * (magic, op, request id, n, k, payload size) followed by the vectors
+ * (and ids), the response is a header (magic, status, request id,
+ * payload size) followed by the distances and labels for a search, the
+ * index parameters (d, ntotal, metric, is_trained) for the other
+ * operations, or an error message.
+ */
+struct IndexServer {
+    Index *index;
+
+    /// port to listen on, if 0 a free port is chosen by start()
+    int port;
+
+    explicit IndexServer (Index *index, int port = 0);
+
+    /// start listening and serving in background threads
+    void start ();
+
+    /// close the connections and wait for the threads
+    void stop ();
+
+    ~IndexServer ();
+
+    // private
+    struct Impl;
+    Impl *impl;
+};
+
+
+/** Index that forwards the calls to an IndexServer.
+ *
+ * Several search requests can be in flight on the connection
+ * (search_async + wait_result). With a timeout, a search that does not
+ * complete in time returns empty results (labels -1), so that in an
+ * IndexShards the results of the other shards are returned.
+ *
+ * reconstruct and the search parameters are not supported.
+ */
+struct IndexRemote: Index {
+    std::string host;
+    int port;
+
+    /// timeout for search results in ms (0 = wait forever)
+    int timeout_ms;
+
+    /// nb of searches that timed out (statistics, approximate when
+    /// searches run concurrently)
+    mutable size_t n_timeout;
+
+    IndexRemote (const char *host, int port, int timeout_ms = 0);
+
+    void train (idx_t n, const float *x) override;
+    void add (idx_t n, const float *x) override;
+    void add_with_ids (idx_t n, const float *x, const idx_t *xids) override;
+    void reset () override;
+
+    void search (idx_t n, const float *x, idx_t k,
+                 float *distances, idx_t *labels,
+                 const SearchParameters *params = nullptr) const override;
+
+    /// send a search request and return its id without waiting
+    idx_t search_async (idx_t n, const float *x, idx_t k) const;
+
+    /** wait for the results of a search_async request (size n * k).
+     * @return false on timeout, then the results are empty */
+    bool wait_result (idx_t req_id, float *distances, idx_t *labels) const;
+
+    /// update d, ntotal, is_trained from the server
+    void sync_info ();
+
+    ~IndexRemote () override;
+
+    // private
+    struct Connection;
+    Connection *conn;
+
+    /// synchronous call that returns the index parameters
+    void call (int op, idx_t n, const void *payload1, size_t size1,
+               const void *payload2, size_t size2);
+};
+
+
+} // namespace faiss
+
+#endif
@@ -5,31 +5,47 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <algorithm>
 #include <cinttypes>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <omp.h>
 
 #include <faiss/IndexReplicas.h>
+#include <faiss/IndexBinaryIVF.h>
+#include <faiss/IndexIVF.h>
 #include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/utils.h>
 
 namespace faiss {
 
 template <typename IndexT>
 IndexReplicasTemplate<IndexT>::IndexReplicasTemplate(bool threaded)
-    : ThreadedIndex<IndexT>(threaded) {
+    : ThreadedIndex<IndexT>(threaded),
+      dynamic_dispatch(false),
+      dispatch_chunk_size(256) {
 }
 
 template <typename IndexT>
 IndexReplicasTemplate<IndexT>::IndexReplicasTemplate(idx_t d, bool threaded)
-    : ThreadedIndex<IndexT>(d, threaded) {
+    : ThreadedIndex<IndexT>(d, threaded),
+      dynamic_dispatch(false),
+      dispatch_chunk_size(256) {
 }
 
 template <typename IndexT>
 IndexReplicasTemplate<IndexT>::IndexReplicasTemplate(int d, bool threaded)
-    : ThreadedIndex<IndexT>(d, threaded) {
+    : ThreadedIndex<IndexT>(d, threaded),
+      dynamic_dispatch(false),
+      dispatch_chunk_size(256) {
 }
 
 template <typename IndexT>
 void
 IndexReplicasTemplate<IndexT>::onAfterAddIndex(IndexT* index) {
+  resetReplicaStats_();
+
   // Make sure that the parameters are the same for all prior indices, unless
   // we're the first index to be added
   if (this->count() > 0 && this->at(0) != index) {
@@ -56,9 +72,39 @@ IndexReplicasTemplate<IndexT>::onAfterAddIndex(IndexT* index) {
 template <typename IndexT>
 void
 IndexReplicasTemplate<IndexT>::onAfterRemoveIndex(IndexT* index) {
+  resetReplicaStats_();
   syncWithSubIndexes();
 }
 
+template <typename IndexT>
+void
+IndexReplicasTemplate<IndexT>::bindToNumaNodes() {
+  FAISS_THROW_IF_NOT_MSG(this->isThreaded_,
+                         "IndexReplicas: NUMA binding requires threaded mode");
+
+  int nnode = get_numa_node_count();
+  if (nnode <= 1) {
+    return;
+  }
+
+  this->runOnIndex([nnode](int i, IndexT* index) {
+      if (!bind_thread_to_numa_node(i % nnode)) {
+        return;
+      }
+
+      // the copy is done by the bound thread, so it lands on its node
+      InvertedLists* invlists = nullptr;
+      if (auto ivf = dynamic_cast<IndexIVF*>(index)) {
+        invlists = ivf->invlists;
+      } else if (auto bivf = dynamic_cast<IndexBinaryIVF*>(index)) {
+        invlists = bivf->invlists;
+      }
+      if (auto ails = dynamic_cast<ArrayInvertedLists*>(invlists)) {
+        ails->first_touch_lists(false);
+      }
+    });
+}
+
 template <typename IndexT>
 void
 IndexReplicasTemplate<IndexT>::train(idx_t n, const component_t* x) {
@@ -114,13 +160,19 @@ IndexReplicasTemplate<IndexT>::search(idx_t n,
                                       const component_t* x,
                                       idx_t k,
                                       distance_t* distances,
-                                      idx_t* labels) const {
+                                      idx_t* labels,
+                                      const SearchParameters *params) const {
   FAISS_THROW_IF_NOT_MSG(this->count() > 0, "no replicas in index");
 
   if (n == 0) {
     return;
   }
 
+  if (dynamic_dispatch && this->isThreaded_ && this->count() > 1) {
+    searchDynamic_(n, x, k, distances, labels, params);
+    return;
+  }
+
   auto dim = this->d;
   size_t componentsPerVec =
     sizeof(component_t) == 1 ? (dim + 7) / 8 : dim;
@@ -133,7 +185,7 @@ IndexReplicasTemplate<IndexT>::search(idx_t n,
 
   auto fn =
     [queriesPerIndex, componentsPerVec,
-     n, x, k, distances, labels](int i, const IndexT* index) {
+     n, x, k, distances, labels, params](int i, const IndexT* index) {
       faiss::Index::idx_t base = (faiss::Index::idx_t) i * queriesPerIndex;
 
       if (base < n) {
@@ -148,7 +200,8 @@ IndexReplicasTemplate<IndexT>::search(idx_t n,
                       x + base * componentsPerVec,
                       k,
                       distances + base * k,
-                      labels + base * k);
+                      labels + base * k,
+                      params);
 
         if (index->verbose) {
           printf("end search replica %d\n", i);
@@ -159,6 +212,189 @@ IndexReplicasTemplate<IndexT>::search(idx_t n,
   this->runOnIndex(fn);
 }
 
+namespace {
+
+/// State of a dynamically dispatched search. It is shared with the
+/// worker threads, since a replica may only get to its task after the
+/// search has returned; it then finds no chunk left and does nothing.
+struct DispatchState {
+  std::mutex mutex;
+  std::condition_variable allDone;
+
+  Index::idx_t numChunks = 0;
+  Index::idx_t nextChunk = 0;
+  Index::idx_t numDone = 0;
+
+  /// first exception thrown by a chunk
+  std::exception_ptr error;
+};
+
+} // namespace
+
+template <typename IndexT>
+void
+IndexReplicasTemplate<IndexT>::searchDynamic_(
+    idx_t n,
+    const component_t* x,
+    idx_t k,
+    distance_t* distances,
+    idx_t* labels,
+    const SearchParameters *params) const {
+  size_t componentsPerVec =
+    sizeof(component_t) == 1 ? (this->d + 7) / 8 : this->d;
+  idx_t chunkSize = std::max(dispatch_chunk_size, (idx_t) 1);
+  int nt = this->getOmpThreadsPerIndex_();
+
+  auto searchChunk =
+    [this, componentsPerVec, x, k, distances, labels, params](
+        int i, const IndexT* index, idx_t i0, idx_t i1) {
+      double t0 = getmillisecs();
+
+      try {
+        index->search(i1 - i0,
+                      x + i0 * componentsPerVec,
+                      k,
+                      distances + i0 * k,
+                      labels + i0 * k,
+                      params);
+      } catch (...) {
+        releaseReplica_(i, i1 - i0, 0);
+        throw;
+      }
+
+      releaseReplica_(i, i1 - i0, getmillisecs() - t0);
+    };
+
+  if (n <= chunkSize) {
+    // A single chunk goes to the least loaded replica
+    int i = acquireReplica_(n);
+    const IndexT* index = this->indices_[i].first;
+
+    auto fut = this->indices_[i].second->add(
+      [searchChunk, i, index, n, nt]() {
+        ScopedOmpThreads ompThreads(nt);
+        searchChunk(i, index, 0, n);
+      });
+
+    // Rethrows the exception of the search, if any
+    FAISS_THROW_IF_NOT_MSG(fut.get(), "IndexReplicas: replica was removed");
+    return;
+  }
+
+  // All replicas take chunks from the same queue until it is empty
+  auto state = std::make_shared<DispatchState>();
+  state->numChunks = (n + chunkSize - 1) / chunkSize;
+
+  for (int i = 0; i < this->count(); ++i) {
+    const IndexT* index = this->indices_[i].first;
+
+    this->indices_[i].second->add(
+      [this, state, searchChunk, i, index, n, chunkSize, nt]() {
+        ScopedOmpThreads ompThreads(nt);
+
+        while (true) {
+          idx_t chunk;
+          {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (state->nextChunk == state->numChunks) {
+              return;
+            }
+            chunk = state->nextChunk++;
+          }
+
+          idx_t i0 = chunk * chunkSize;
+          idx_t i1 = std::min(n, i0 + chunkSize);
+          std::exception_ptr error;
+
+          {
+            std::lock_guard<std::mutex> lock(statsMutex_);
+            replicaStats_[i].queued += i1 - i0;
+          }
+
+          try {
+            searchChunk(i, index, i0, i1);
+          } catch (...) {
+            error = std::current_exception();
+          }
+
+          std::lock_guard<std::mutex> lock(state->mutex);
+          if (error && !state->error) {
+            state->error = error;
+          }
+          if (++state->numDone == state->numChunks) {
+            state->allDone.notify_all();
+          }
+        }
+      });
+  }
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->allDone.wait(lock, [&state]() {
+      return state->numDone == state->numChunks;
+    });
+
+  if (state->error) {
+    std::rethrow_exception(state->error);
+  }
+}
+
+template <typename IndexT>
+int
+IndexReplicasTemplate<IndexT>::acquireReplica_(idx_t n) const {
+  std::lock_guard<std::mutex> lock(statsMutex_);
+
+  // Replicas that have not been measured yet are tried first
+  int best = 0;
+  double bestCost = 0;
+
+  for (int i = 0; i < replicaStats_.size(); ++i) {
+    auto& stats = replicaStats_[i];
+    double cost = (stats.queued + n) * stats.msPerQuery;
+
+    if (i == 0 || cost < bestCost ||
+        (cost == bestCost && stats.queued < replicaStats_[best].queued)) {
+      best = i;
+      bestCost = cost;
+    }
+  }
+
+  replicaStats_[best].queued += n;
+  return best;
+}
+
+template <typename IndexT>
+void
+IndexReplicasTemplate<IndexT>::releaseReplica_(int i,
+                                               idx_t n,
+                                               double ms) const {
+  std::lock_guard<std::mutex> lock(statsMutex_);
+
+  auto& stats = replicaStats_[i];
+  stats.queued -= n;
+
+  if (ms > 0) {
+    // Exponential moving average over the recent searches
+    double msPerQuery = ms / n;
+    stats.msPerQuery = stats.msPerQuery == 0 ?
+      msPerQuery : 0.8 * stats.msPerQuery + 0.2 * msPerQuery;
+  }
+}
+
+template <typename IndexT>
+void
+IndexReplicasTemplate<IndexT>::resetReplicaStats_() {
+  std::lock_guard<std::mutex> lock(statsMutex_);
+  replicaStats_.assign(this->count(), ReplicaStats());
+}
+
+template <typename IndexT>
+double
+IndexReplicasTemplate<IndexT>::getReplicaLatency(int i) const {
+  std::lock_guard<std::mutex> lock(statsMutex_);
+  FAISS_THROW_IF_NOT(i >= 0 && i < replicaStats_.size());
+  return replicaStats_[i].msPerQuery;
+}
+
 // FIXME: assumes that nothing is currently running on the sub-indexes, which is
 // true with the normal API, but should use the runOnIndex API instead
 template <typename IndexT>
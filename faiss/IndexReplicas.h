@@ -10,6 +10,8 @@
 #include <faiss/Index.h>
 #include <faiss/IndexBinary.h>
 #include <faiss/impl/ThreadedIndex.h>
+#include <mutex>
+#include <vector>
 
 namespace faiss {
 
@@ -55,12 +57,14 @@ class IndexReplicasTemplate : public ThreadedIndex<IndexT> {
 
   /// faiss::Index API
   /// Query is partitioned into a slice for each sub-index
-  /// split by ceil(n / #indices) for our sub-indices
+  /// split by ceil(n / #indices) for our sub-indices, or dispatched
+  /// dynamically if dynamic_dispatch is set
   void search(idx_t n,
               const component_t* x,
               idx_t k,
               distance_t* distances,
-              idx_t* labels) const override;
+              idx_t* labels,
+              const SearchParameters *params = nullptr) const override;
 
   /// reconstructs from the first index
   void reconstruct(idx_t, component_t *v) const override;
@@ -68,12 +72,69 @@ class IndexReplicasTemplate : public ThreadedIndex<IndexT> {
   /// Synchronize the top-level index (IndexShards) with data in the sub-indices
   void syncWithSubIndexes();
 
+  /// Average search time per query of replica i (ms), smoothed over the
+  /// recent searches; 0 if it has not searched yet in dynamic dispatch
+  double getReplicaLatency(int i) const;
+
+  /// Bind the worker thread of replica i to NUMA node i % nnode, and move
+  /// the inverted lists of IVF replicas to the memory of that node.
+  /// Requires threaded mode; a no-op on single-node machines.
+  void bindToNumaNodes();
+
+ public:
+  /// In threaded mode, replace the static split of search by a dynamic
+  /// dispatch, for replicas of unequal speed (heterogeneous GPUs, or
+  /// replicas busy with other work). The queries are cut in chunks of
+  /// dispatch_chunk_size that the replicas take from a shared queue as
+  /// they become idle, so that the search does not wait for the slowest
+  /// replica. A search of at most dispatch_chunk_size queries goes to the
+  /// least loaded replica, estimated from the queries queued on each
+  /// replica and its latency. In this mode, search may be called
+  /// concurrently from several threads.
+  bool dynamic_dispatch;
+
+  /// nb of queries per chunk of the dynamic dispatch
+  idx_t dispatch_chunk_size;
+
  protected:
+  /// Search with dynamic dispatch
+  void searchDynamic_(idx_t n,
+                      const component_t* x,
+                      idx_t k,
+                      distance_t* distances,
+                      idx_t* labels,
+                      const SearchParameters *params) const;
+
+  /// Returns the least loaded replica for a search of n queries, and
+  /// counts them as queued on it
+  int acquireReplica_(idx_t n) const;
+
+  /// Records a search of n queries by replica i, that took ms milliseconds
+  void releaseReplica_(int i, idx_t n, double ms) const;
+
+  /// Resets the load and latency of all replicas
+  void resetReplicaStats_();
+
   /// Called just after an index is added
   void onAfterAddIndex(IndexT* index) override;
 
   /// Called just after an index is removed
   void onAfterRemoveIndex(IndexT* index) override;
+
+  /// Load and latency of a replica, for dynamic dispatch
+  struct ReplicaStats {
+    /// nb of queries queued or being searched
+    idx_t queued = 0;
+
+    /// smoothed search time per query (ms), 0 if unknown
+    double msPerQuery = 0;
+  };
+
+  /// Protects replicaStats_
+  mutable std::mutex statsMutex_;
+
+  /// Per-replica statistics, in the order of the replicas
+  mutable std::vector<ReplicaStats> replicaStats_;
 };
 
 using IndexReplicas = IndexReplicasTemplate<Index>;
@@ -11,10 +11,13 @@
 
 #include <cstdio>
 #include <algorithm>
+#include <memory>
 
 #include <omp.h>
 
 #include <faiss/utils/utils.h>
+#include <faiss/utils/Heap.h>
+#include <faiss/utils/parallel.h>
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/impl/AuxIndexStructures.h>
 #include <faiss/impl/ScalarQuantizer.h>
@@ -35,7 +38,8 @@ IndexScalarQuantizer::IndexScalarQuantizer
 {
     is_trained =
         qtype == ScalarQuantizer::QT_fp16 ||
-        qtype == ScalarQuantizer::QT_8bit_direct;
+        qtype == ScalarQuantizer::QT_8bit_direct ||
+        qtype == ScalarQuantizer::QT_8bit_direct_signed;
     code_size = sq.code_size;
 }
 
@@ -64,11 +68,22 @@ void IndexScalarQuantizer::search(
         const float* x,
         idx_t k,
         float* distances,
-        idx_t* labels) const
+        idx_t* labels,
+        const SearchParameters *params) const
 {
+    FAISS_THROW_IF_NOT_MSG (!params,
+            "search params not supported for this index");
     FAISS_THROW_IF_NOT (is_trained);
     FAISS_THROW_IF_NOT (metric_type == METRIC_L2 ||
                         metric_type == METRIC_INNER_PRODUCT);
+    if (use_parallel_executor (n)) {
+        // the executor parallelizes over the queries
+        parallel_for (n, [&] (size_t i0, size_t i1) {
+            search (i1 - i0, x + i0 * d, k, distances + i0 * k,
+                    labels + i0 * k, params);
+        });
+        return;
+    }
 
 #pragma omp parallel
     {
@@ -132,6 +147,24 @@ void IndexScalarQuantizer::reconstruct(idx_t key, float* recons) const
     reconstruct_n(key, 1, recons);
 }
 
+void IndexScalarQuantizer::reconstruct_batch (
+             idx_t n, const idx_t *keys, float *recons) const
+{
+    for (idx_t i = 0; i < n; i++) {
+        FAISS_THROW_IF_NOT (keys[i] >= 0 && keys[i] < ntotal);
+    }
+#pragma omp parallel if (n > 1000)
+    {
+        std::unique_ptr<ScalarQuantizer::Quantizer> squant (
+              sq.select_quantizer ());
+#pragma omp for
+        for (idx_t i = 0; i < n; i++) {
+            squant->decode_vector (&codes[keys[i] * code_size],
+                                   recons + i * d);
+        }
+    }
+}
+
 /* Codec interface */
 size_t IndexScalarQuantizer::sa_code_size () const
 {
@@ -152,6 +185,14 @@ void IndexScalarQuantizer::sa_decode (idx_t n, const uint8_t *bytes,
     sq.decode(bytes, x, n);
 }
 
+MemoryUsage IndexScalarQuantizer::memory_usage () const
+{
+    MemoryUsage mu = Index::memory_usage ();
+    mu.add ("sq", sq.memory_usage ());
+    mu.add ("codes", codes);
+    return mu;
+}
+
 
 
 /*******************************************************************
@@ -164,7 +205,9 @@ IndexIVFScalarQuantizer::IndexIVFScalarQuantizer (
             MetricType metric, bool encode_residual)
     : IndexIVF(quantizer, d, nlist, 0, metric),
       sq(d, qtype),
-      by_residual(encode_residual)
+      by_residual(encode_residual),
+      quantized_query(false),
+      rerank_factor(0)
 {
     code_size = sq.code_size;
     // was not known at construction time
@@ -174,7 +217,9 @@ IndexIVFScalarQuantizer::IndexIVFScalarQuantizer (
 
 IndexIVFScalarQuantizer::IndexIVFScalarQuantizer ():
     IndexIVF(),
-    by_residual(true)
+    by_residual(true),
+    quantized_query(false),
+    rerank_factor(0)
 {
 }
 
@@ -242,6 +287,18 @@ void IndexIVFScalarQuantizer::sa_decode (idx_t n, const uint8_t *codes,
     }
 }
 
+bool IndexIVFScalarQuantizer::codes_depend_on_list () const
+{
+    return by_residual;
+}
+
+MemoryUsage IndexIVFScalarQuantizer::memory_usage () const
+{
+    MemoryUsage mu = IndexIVF::memory_usage ();
+    mu.add ("sq", sq.memory_usage ());
+    return mu;
+}
+
 
 
 void IndexIVFScalarQuantizer::add_with_ids
@@ -249,7 +306,7 @@ void IndexIVFScalarQuantizer::add_with_ids
 {
     FAISS_THROW_IF_NOT (is_trained);
     std::unique_ptr<int64_t []> idx (new int64_t [n]);
-    quantizer->assign (n, x, idx.get());
+    assign_for_add (n, x, idx.get());
     size_t nadd = 0;
     std::unique_ptr<ScalarQuantizer::Quantizer> squant(sq.select_quantizer ());
 
@@ -300,7 +357,94 @@ InvertedListScanner* IndexIVFScalarQuantizer::get_InvertedListScanner
     (bool store_pairs) const
 {
     return sq.select_InvertedListScanner (metric_type, quantizer, store_pairs,
-                                          by_residual);
+                                          by_residual, quantized_query);
+}
+
+
+void IndexIVFScalarQuantizer::search_preassigned (
+        idx_t n, const float *x, idx_t k,
+        const idx_t *assign,
+        const float *centroid_dis,
+        float *distances, idx_t *labels,
+        bool store_pairs,
+        const IVFSearchParameters *params) const
+{
+    if (!quantized_query || rerank_factor <= 1) {
+        IndexIVF::search_preassigned (n, x, k, assign, centroid_dis,
+                                      distances, labels, store_pairs,
+                                      params);
+        return;
+    }
+
+    // collect the candidates with the integer distances, as
+    // (list_no, offset) pairs
+    idx_t k2 = k * rerank_factor;
+    std::vector<float> dis2 (n * k2);
+    std::vector<idx_t> labels2 (n * k2);
+    IndexIVF::search_preassigned (n, x, k2, assign, centroid_dis,
+                                  dis2.data(), labels2.data(), true, params);
+
+    long nprobe = params ? params->nprobe : this->nprobe;
+
+#pragma omp parallel if (n > 1)
+    {
+        std::unique_ptr<InvertedListScanner> scanner (
+             sq.select_InvertedListScanner (metric_type, quantizer, true,
+                                            by_residual, false));
+
+#pragma omp for
+        for (idx_t i = 0; i < n; i++) {
+            float *simi = distances + i * k;
+            idx_t *idxi = labels + i * k;
+            if (metric_type == METRIC_INNER_PRODUCT) {
+                minheap_heapify (k, simi, idxi);
+            } else {
+                maxheap_heapify (k, simi, idxi);
+            }
+            scanner->set_query (x + i * d);
+
+            for (idx_t j = 0; j < k2; j++) {
+                idx_t lo = labels2[i * k2 + j];
+                if (lo < 0) {
+                    break;
+                }
+                idx_t list_no = lo_listno (lo);
+                idx_t offset = lo_offset (lo);
+
+                float coarse_dis = 0;
+                for (long l = 0; l < nprobe; l++) {
+                    if (assign[i * nprobe + l] == list_no) {
+                        coarse_dis = centroid_dis[i * nprobe + l];
+                        break;
+                    }
+                }
+                scanner->set_list (list_no, coarse_dis);
+                float dis = scanner->distance_to_code (
+                     InvertedLists::ScopedCodes (invlists, list_no, offset)
+                     .get ());
+                idx_t id = store_pairs ? lo :
+                    invlists->get_single_id (list_no, offset);
+
+                if (metric_type == METRIC_INNER_PRODUCT) {
+                    if (dis > simi[0]) {
+                        minheap_pop (k, simi, idxi);
+                        minheap_push (k, simi, idxi, dis, id);
+                    }
+                } else {
+                    if (dis < simi[0]) {
+                        maxheap_pop (k, simi, idxi);
+                        maxheap_push (k, simi, idxi, dis, id);
+                    }
+                }
+            }
+
+            if (metric_type == METRIC_INNER_PRODUCT) {
+                minheap_reorder (k, simi, idxi);
+            } else {
+                maxheap_reorder (k, simi, idxi);
+            }
+        }
+    }
 }
 
 
@@ -308,13 +452,29 @@ void IndexIVFScalarQuantizer::reconstruct_from_offset (int64_t list_no,
                                                        int64_t offset,
                                                        float* recons) const
 {
-    std::vector<float> centroid(d);
-    quantizer->reconstruct (list_no, centroid.data());
+    reconstruct_from_offsets (list_no, 1, &offset, recons);
+}
 
-    const uint8_t* code = invlists->get_single_code (list_no, offset);
-    sq.decode (code, recons, 1);
-    for (int i = 0; i < d; ++i) {
-        recons[i] += centroid[i];
+void IndexIVFScalarQuantizer::reconstruct_from_offsets (
+        int64_t list_no, size_t n, const int64_t *offsets,
+        float* recons) const
+{
+    std::vector<float> centroid(d);
+    if (by_residual) {
+        quantizer->reconstruct (list_no, centroid.data());
+    }
+    std::unique_ptr<ScalarQuantizer::Quantizer> squant (
+          sq.select_quantizer ());
+
+    InvertedLists::ScopedCodes codes (invlists, list_no);
+    for (size_t j = 0; j < n; j++) {
+        float *xj = recons + j * d;
+        squant->decode_vector (codes.get() + offsets[j] * code_size, xj);
+        if (by_residual) {
+            for (int i = 0; i < d; ++i) {
+                xj[i] += centroid[i];
+            }
+        }
     }
 }
 
@@ -15,6 +15,7 @@
 
 #include <faiss/IndexIVF.h>
 #include <faiss/impl/ScalarQuantizer.h>
+#include <faiss/impl/maybe_owned_vector.h>
 
 
 namespace faiss {
@@ -33,7 +34,7 @@ struct IndexScalarQuantizer: Index {
     ScalarQuantizer sq;
 
     /// Codes. Size ntotal * pq.code_size
-    std::vector<uint8_t> codes;
+    MaybeOwnedVector<uint8_t> codes;
 
     size_t code_size;
 
@@ -58,7 +59,8 @@ struct IndexScalarQuantizer: Index {
         const float* x,
         idx_t k,
         float* distances,
-        idx_t* labels) const override;
+        idx_t* labels,
+        const SearchParameters *params = nullptr) const override;
 
     void reset() override;
 
@@ -66,6 +68,9 @@ struct IndexScalarQuantizer: Index {
 
     void reconstruct(idx_t key, float* recons) const override;
 
+    void reconstruct_batch (idx_t n, const idx_t *keys,
+                            float *recons) const override;
+
     DistanceComputer *get_distance_computer () const override;
 
     /* standalone codec interface */
@@ -77,6 +82,7 @@ struct IndexScalarQuantizer: Index {
     void sa_decode (idx_t n, const uint8_t *bytes,
                             float *x) const override;
 
+    MemoryUsage memory_usage () const override;
 
 };
 
@@ -91,6 +97,17 @@ struct IndexIVFScalarQuantizer: IndexIVF {
     ScalarQuantizer sq;
     bool by_residual;
 
+    /** search-time option: quantize the query to 8 bits and compute the
+     * distances to the codes with integer arithmetic. Supported for
+     * QT_8bit_uniform, and for QT_8bit with METRIC_INNER_PRODUCT, ignored
+     * otherwise. It is faster but the distances are approximate. */
+    bool quantized_query;
+
+    /** with quantized_query, collect k * rerank_factor results with the
+     * integer distances, then re-rank them with the float distances
+     * (disabled when <= 1) */
+    int rerank_factor;
+
     IndexIVFScalarQuantizer(Index *quantizer, size_t d, size_t nlist,
                             ScalarQuantizer::QuantizerType qtype,
                             MetricType metric = METRIC_L2,
@@ -107,6 +124,15 @@ struct IndexIVFScalarQuantizer: IndexIVF {
 
     void add_with_ids(idx_t n, const float* x, const idx_t* xids) override;
 
+    /// re-ranks the results if quantized_query and rerank_factor are set
+    void search_preassigned (idx_t n, const float *x, idx_t k,
+                             const idx_t *assign,
+                             const float *centroid_dis,
+                             float *distances, idx_t *labels,
+                             bool store_pairs,
+                             const IVFSearchParameters *params=nullptr
+                             ) const override;
+
     InvertedListScanner *get_InvertedListScanner (bool store_pairs)
         const override;
 
@@ -114,10 +140,19 @@ struct IndexIVFScalarQuantizer: IndexIVF {
     void reconstruct_from_offset (int64_t list_no, int64_t offset,
                                   float* recons) const override;
 
+    /// reconstructs the centroid once and decodes the codes in place
+    void reconstruct_from_offsets (int64_t list_no, size_t n,
+                                   const int64_t *offsets,
+                                   float* recons) const override;
+
     /* standalone codec interface */
     void sa_decode (idx_t n, const uint8_t *bytes,
                             float *x) const override;
 
+    bool codes_depend_on_list () const override;
+
+    MemoryUsage memory_usage () const override;
+
 };
 
 
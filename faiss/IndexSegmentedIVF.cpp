@@ -0,0 +1,588 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/IndexSegmentedIVF.h>
+
+#include <algorithm>
+#include <string>
+#include <typeinfo>
+
+#include <faiss/ConcurrentInvertedLists.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/Heap.h>
+#include <faiss/utils/scratch.h>
+
+
+namespace faiss {
+
+namespace {
+
+typedef IndexSegmentedIVF::Segment Segment;
+typedef IndexSegmentedIVF::IdSet IdSet;
+
+/// skips the tombstones of a segment, then applies sel if any
+struct IDSelectorNotRemoved: IDSelector {
+    const IdSet *tombstones;
+    const IDSelector *sel;
+
+    IDSelectorNotRemoved (const IdSet *tombstones, const IDSelector *sel):
+        tombstones (tombstones), sel (sel) {}
+
+    bool is_member (idx_t id) const override {
+        return tombstones->count (id) == 0 && (!sel || sel->is_member (id));
+    }
+};
+
+bool is_removed (const Segment & seg, Index::idx_t id)
+{
+    return seg.tombstones && seg.tombstones->count (id) > 0;
+}
+
+/// copy the entries of the segments, without the tombstones
+void merge_segments (const std::vector<Segment> & segs,
+                     ArrayInvertedLists & out)
+{
+    for (size_t l = 0; l < out.nlist; l++) {
+        for (const Segment & seg: segs) {
+            const InvertedLists *il = seg.invlists.get ();
+            size_t list_size = il->list_size (l);
+            if (list_size == 0) {
+                continue;
+            }
+            InvertedLists::ScopedCodes codes (il, l);
+            InvertedLists::ScopedIds ids (il, l);
+            for (size_t j = 0; j < list_size; j++) {
+                if (!is_removed (seg, ids[j])) {
+                    out.add_entry (l, ids[j],
+                                   codes.get () + j * out.code_size);
+                }
+            }
+        }
+    }
+}
+
+/// index of the segment that uses il, -1 if none
+int find_segment (const std::vector<Segment> & segs, const InvertedLists *il)
+{
+    for (size_t i = 0; i < segs.size (); i++) {
+        if (segs[i].invlists.get () == il) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+} // anonymous namespace
+
+
+IndexSegmentedIVF::IndexSegmentedIVF (IndexIVF *ivf, size_t seal_size,
+                                      size_t merge_factor,
+                                      bool background_merge):
+    Index (ivf->d, ivf->metric_type), ivf (ivf), own_fields (false),
+    seal_size (seal_size), merge_factor (merge_factor),
+    background_merge (background_merge), next_id (0),
+    merge_pending (false), merging (false), stopping (false)
+{
+    FAISS_THROW_IF_NOT (seal_size > 0);
+    FAISS_THROW_IF_NOT (merge_factor >= 2);
+    is_trained = ivf->is_trained;
+    write_segment = new_write_segment ();
+    if (background_merge) {
+        merge_thread = std::thread (&IndexSegmentedIVF::merge_loop, this);
+    }
+}
+
+
+IndexSegmentedIVF::~IndexSegmentedIVF ()
+{
+    stop_merges ();
+    if (own_fields) {
+        delete ivf;
+    }
+}
+
+
+void IndexSegmentedIVF::stop_merges ()
+{
+    if (!merge_thread.joinable ()) {
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> lock (mutex);
+        stopping = true;
+    }
+    cv_merge.notify_all ();
+    merge_thread.join ();
+}
+
+
+IndexSegmentedIVF::Segment IndexSegmentedIVF::new_write_segment () const
+{
+    Segment seg;
+    seg.invlists.reset (
+          new ConcurrentInvertedLists (ivf->nlist, ivf->code_size));
+    seg.size = 0;
+    return seg;
+}
+
+
+std::vector<Segment> IndexSegmentedIVF::snapshot () const
+{
+    std::unique_lock<std::mutex> lock (mutex);
+    std::vector<Segment> segs (sealed);
+    segs.push_back (write_segment);
+    return segs;
+}
+
+
+void IndexSegmentedIVF::train (idx_t n, const float *x)
+{
+    ivf->train (n, x);
+    is_trained = true;
+}
+
+
+void IndexSegmentedIVF::add (idx_t n, const float *x)
+{
+    std::vector<idx_t> ids (n);
+    for (idx_t i = 0; i < n; i++) {
+        ids[i] = next_id + i;
+    }
+    add_with_ids (n, x, ids.data ());
+}
+
+
+void IndexSegmentedIVF::add_with_ids (idx_t n, const float *x,
+                                      const idx_t *xids)
+{
+    if (!xids) {
+        add (n, x);
+        return;
+    }
+    FAISS_THROW_IF_NOT (is_trained);
+
+    const IdSet *tombstones = write_segment.tombstones.get ();
+    if (tombstones) {
+        // the tombstones would hide the new entries with the same ids
+        for (idx_t i = 0; i < n; i++) {
+            if (tombstones->count (xids[i])) {
+                seal ();
+                break;
+            }
+        }
+    }
+
+    size_t code_size = ivf->code_size;
+    idx_t i0 = 0;
+    while (i0 < n) {
+        idx_t i1 = i0 + std::min (idx_t (seal_size - write_segment.size),
+                                  n - i0);
+        idx_t ni = i1 - i0;
+
+        ScratchBuffer list_nos_buf, codes_buf;
+        idx_t *list_nos = list_nos_buf.get<idx_t> (ni);
+        uint8_t *codes = codes_buf.get<uint8_t> (ni * code_size);
+        ivf->quantizer->assign (ni, x + i0 * d, list_nos);
+        ivf->encode_vectors (ni, x + i0 * d, list_nos, codes);
+
+        // the only writer of the write segment
+        InvertedLists *il = write_segment.invlists.get ();
+        size_t nadd = 0;
+        for (idx_t i = 0; i < ni; i++) {
+            if (list_nos[i] >= 0) {
+                il->add_entry (list_nos[i], xids[i0 + i],
+                               codes + i * code_size);
+                nadd++;
+            }
+            next_id = std::max (next_id, xids[i0 + i] + 1);
+        }
+        {
+            std::unique_lock<std::mutex> lock (mutex);
+            write_segment.size += nadd;
+        }
+        ntotal += nadd;
+        if (write_segment.size >= seal_size) {
+            seal ();
+        }
+        i0 = i1;
+    }
+}
+
+
+InvertedLists *IndexSegmentedIVF::make_sealed_lists (
+        const InvertedLists & il) const
+{
+    return new CompactedInvertedLists (il);
+}
+
+
+void IndexSegmentedIVF::seal ()
+{
+    Segment ws = write_segment;
+    if (ws.size == 0) {
+        return;
+    }
+    Segment seg;
+    {
+        ArrayInvertedLists merged (ivf->nlist, ivf->code_size);
+        merge_segments ({ws}, merged);
+        seg.size = merged.compute_ntotal ();
+        seg.invlists.reset (make_sealed_lists (merged));
+    }
+    Segment new_ws = new_write_segment ();
+    {
+        // atomically for the searches
+        std::unique_lock<std::mutex> lock (mutex);
+        if (seg.size > 0) {
+            sealed.push_back (seg);
+        }
+        write_segment = new_ws;
+    }
+
+    if (background_merge) {
+        {
+            std::unique_lock<std::mutex> lock (mutex);
+            merge_pending = true;
+        }
+        cv_merge.notify_one ();
+    } else {
+        while (merge_step (false)) {
+        }
+    }
+}
+
+
+bool IndexSegmentedIVF::merge_step (bool all)
+{
+    std::vector<Segment> inputs;
+    {
+        std::unique_lock<std::mutex> lock (mutex);
+        if (all) {
+            if (sealed.size () > 1 ||
+                (sealed.size () == 1 && sealed[0].tombstones)) {
+                inputs = sealed;
+            }
+        } else {
+            // segments by tier
+            std::vector<std::vector<size_t> > tiers;
+            for (size_t i = 0; i < sealed.size (); i++) {
+                size_t tier = 0;
+                for (size_t s = seal_size * merge_factor; sealed[i].size >= s;
+                     s *= merge_factor) {
+                    tier++;
+                }
+                if (tier >= tiers.size ()) {
+                    tiers.resize (tier + 1);
+                }
+                tiers[tier].push_back (i);
+            }
+            for (const std::vector<size_t> & tier: tiers) {
+                if (tier.size () >= merge_factor) {
+                    // the oldest segments of the tier
+                    for (size_t j = 0; j < merge_factor; j++) {
+                        inputs.push_back (sealed[tier[j]]);
+                    }
+                    break;
+                }
+            }
+        }
+    }
+    if (inputs.empty ()) {
+        return false;
+    }
+
+    Segment seg;
+    {
+        ArrayInvertedLists merged (ivf->nlist, ivf->code_size);
+        merge_segments (inputs, merged);
+        seg.size = merged.compute_ntotal ();
+        seg.invlists.reset (make_sealed_lists (merged));
+    }
+
+    std::unique_lock<std::mutex> update_lock (update_mutex);
+    std::unique_lock<std::mutex> lock (mutex);
+
+    // the tombstones that were added to the inputs during the merge
+    IdSet *tombstones = nullptr;
+    size_t pos = sealed.size ();
+    for (const Segment & in: inputs) {
+        int i = find_segment (sealed, in.invlists.get ());
+        FAISS_ASSERT (i >= 0);
+        const Segment & cur = sealed[i];
+        if (cur.tombstones && cur.tombstones != in.tombstones) {
+            if (!tombstones) {
+                tombstones = new IdSet ();
+                seg.tombstones.reset (tombstones);
+            }
+            for (idx_t id: *cur.tombstones) {
+                if (!in.tombstones || !in.tombstones->count (id)) {
+                    tombstones->insert (id);
+                }
+            }
+        }
+        pos = std::min (pos, size_t (i));
+        sealed.erase (sealed.begin () + i);
+    }
+    if (seg.size > 0) {
+        sealed.insert (sealed.begin () + pos, seg);
+    }
+    return true;
+}
+
+
+void IndexSegmentedIVF::merge_loop ()
+{
+    std::unique_lock<std::mutex> lock (mutex);
+    for (;;) {
+        cv_merge.wait (lock, [this] { return stopping || merge_pending; });
+        if (stopping) {
+            return;
+        }
+        merge_pending = false;
+        merging = true;
+        lock.unlock ();
+
+        std::exception_ptr error;
+        try {
+            while (merge_step (false)) {
+            }
+        } catch (...) {
+            error = std::current_exception ();
+        }
+
+        lock.lock ();
+        if (error) {
+            merge_error = error;
+        }
+        merging = false;
+        cv_idle.notify_all ();
+    }
+}
+
+
+void IndexSegmentedIVF::wait_for_merges ()
+{
+    std::unique_lock<std::mutex> lock (mutex);
+    cv_idle.wait (lock, [this] { return !merge_pending && !merging; });
+    if (merge_error) {
+        std::exception_ptr error = merge_error;
+        merge_error = nullptr;
+        std::rethrow_exception (error);
+    }
+}
+
+
+void IndexSegmentedIVF::merge_all ()
+{
+    seal ();
+    wait_for_merges ();
+    merge_step (true);
+}
+
+
+size_t IndexSegmentedIVF::remove_ids (const IDSelector & sel)
+{
+    std::unique_lock<std::mutex> update_lock (update_mutex);
+    std::vector<Segment> segs = snapshot ();
+
+    size_t nremove = 0;
+    std::vector<std::shared_ptr<const IdSet> > new_tombstones (segs.size ());
+    for (size_t s = 0; s < segs.size (); s++) {
+        const Segment & seg = segs[s];
+        IdSet *tombstones = nullptr;
+        const InvertedLists *il = seg.invlists.get ();
+        for (size_t l = 0; l < il->nlist; l++) {
+            size_t list_size = il->list_size (l);
+            if (list_size == 0) {
+                continue;
+            }
+            InvertedLists::ScopedIds ids (il, l);
+            for (size_t j = 0; j < list_size; j++) {
+                idx_t id = ids[j];
+                if (is_removed (seg, id) || !sel.is_member (id)) {
+                    continue;
+                }
+                if (!tombstones) {
+                    tombstones = seg.tombstones ?
+                        new IdSet (*seg.tombstones) : new IdSet ();
+                    new_tombstones[s].reset (tombstones);
+                }
+                // is_removed uses the previous tombstones, so the
+                // entries with the same id are all counted
+                tombstones->insert (id);
+                nremove++;
+            }
+        }
+    }
+    std::unique_lock<std::mutex> lock (mutex);
+    for (size_t s = 0; s < segs.size (); s++) {
+        if (!new_tombstones[s]) {
+            continue;
+        }
+        const InvertedLists *il = segs[s].invlists.get ();
+        if (il == write_segment.invlists.get ()) {
+            write_segment.tombstones = new_tombstones[s];
+        } else {
+            // the merges do not replace segments while update_mutex is held
+            int i = find_segment (sealed, il);
+            FAISS_ASSERT (i >= 0);
+            sealed[i].tombstones = new_tombstones[s];
+        }
+    }
+    ntotal -= nremove;
+    return nremove;
+}
+
+
+void IndexSegmentedIVF::reset ()
+{
+    if (background_merge) {
+        wait_for_merges ();
+    }
+    Segment new_ws = new_write_segment ();
+    {
+        std::unique_lock<std::mutex> lock (mutex);
+        sealed.clear ();
+        write_segment = new_ws;
+    }
+    ntotal = 0;
+    next_id = 0;
+}
+
+
+std::vector<size_t> IndexSegmentedIVF::sealed_segment_sizes () const
+{
+    std::unique_lock<std::mutex> lock (mutex);
+    std::vector<size_t> sizes;
+    for (const Segment & seg: sealed) {
+        sizes.push_back (seg.size);
+    }
+    return sizes;
+}
+
+
+size_t IndexSegmentedIVF::ntombstones () const
+{
+    std::vector<Segment> segs = snapshot ();
+    size_t n = 0;
+    for (const Segment & seg: segs) {
+        if (seg.tombstones) {
+            n += seg.tombstones->size ();
+        }
+    }
+    return n;
+}
+
+
+void IndexSegmentedIVF::search (idx_t n, const float *x, idx_t k,
+                                float *distances, idx_t *labels,
+                                const SearchParameters *params_in) const
+{
+    FAISS_THROW_IF_NOT (k > 0);
+    const IVFSearchParameters *params = nullptr;
+    if (params_in) {
+        params = dynamic_cast<const IVFSearchParameters *> (params_in);
+        FAISS_THROW_IF_NOT_MSG (params,
+                "IndexSegmentedIVF params have incorrect type");
+    }
+    size_t nprobe = params ? params->nprobe : ivf->nprobe;
+    nprobe = std::min (nprobe, ivf->nlist);
+    const IDSelector *sel = params ? params->sel : nullptr;
+
+    ScratchBuffer keys_buf, coarse_dis_buf;
+    idx_t *keys = keys_buf.get<idx_t> (n * nprobe);
+    float *coarse_dis = coarse_dis_buf.get<float> (n * nprobe);
+    ivf->quantizer->search (n, x, nprobe, coarse_dis, keys,
+                            params ? params->quantizer_params : nullptr);
+
+    std::vector<Segment> segs = snapshot ();
+
+    // selector of each segment
+    std::vector<IDSelectorNotRemoved> not_removed;
+    not_removed.reserve (segs.size ());
+    std::vector<const IDSelector *> sels (segs.size (), sel);
+    for (size_t s = 0; s < segs.size (); s++) {
+        if (segs[s].tombstones) {
+            not_removed.emplace_back (segs[s].tombstones.get (), sel);
+            sels[s] = &not_removed.back ();
+        }
+    }
+
+    bool is_ip = metric_type == METRIC_INNER_PRODUCT;
+    using HeapForIP = CMin<float, idx_t>;
+    using HeapForL2 = CMax<float, idx_t>;
+
+    bool interrupt = false;
+    std::mutex exception_mutex;
+    std::string exception_string;
+
+#pragma omp parallel if (n > 1)
+    {
+        std::unique_ptr<InvertedListScanner> scanner (
+              ivf->get_InvertedListScanner (false));
+
+#pragma omp for
+        for (idx_t i = 0; i < n; i++) {
+            if (interrupt) {
+                continue;
+            }
+            float *simi = distances + i * k;
+            idx_t *idxi = labels + i * k;
+            if (is_ip) {
+                heap_heapify<HeapForIP> (k, simi, idxi);
+            } else {
+                heap_heapify<HeapForL2> (k, simi, idxi);
+            }
+            try {
+                scanner->set_query (x + i * d);
+                scanner->set_query_lists (nprobe, keys + i * nprobe);
+                for (size_t ik = 0; ik < nprobe; ik++) {
+                    idx_t key = keys[i * nprobe + ik];
+                    if (key < 0) {
+                        continue;
+                    }
+                    // the list tables are shared by the segments
+                    scanner->set_list (key, coarse_dis[i * nprobe + ik]);
+                    for (size_t s = 0; s < segs.size (); s++) {
+                        const InvertedLists *il = segs[s].invlists.get ();
+                        size_t list_size = il->list_size (key);
+                        if (list_size == 0) {
+                            continue;
+                        }
+                        InvertedLists::ScopedCodes codes (il, key);
+                        InvertedLists::ScopedIds ids (il, key);
+                        scanner->sel = sels[s];
+                        scanner->scan_codes (list_size, codes.get (),
+                                             ids.get (), simi, idxi, k);
+                    }
+                }
+            } catch (const std::exception & e) {
+                std::lock_guard<std::mutex> lock (exception_mutex);
+                exception_string =
+                    demangle_cpp_symbol (typeid (e).name ()) + "  " +
+                    e.what ();
+                interrupt = true;
+            }
+            if (is_ip) {
+                heap_reorder<HeapForIP> (k, simi, idxi);
+            } else {
+                heap_reorder<HeapForL2> (k, simi, idxi);
+            }
+        }
+    }
+
+    if (interrupt) {
+        FAISS_THROW_FMT ("search interrupted with: %s",
+                         exception_string.c_str ());
+    }
+}
+
+
+} // namespace faiss
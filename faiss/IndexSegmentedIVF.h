@@ -0,0 +1,161 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#ifndef FAISS_INDEX_SEGMENTED_IVF_H
+#define FAISS_INDEX_SEGMENTED_IVF_H
+
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <faiss/IndexIVF.h>
+
+
+namespace faiss {
+
+/** Mutable IVF index made of segments, for a steady ingestion without
+ * periodic rebuilds (as in a log-structured merge tree).
+ *
+ * The segments are inverted lists that share the coarse quantizer and
+ * the encoding of an IndexIVF, trained beforehand (its own inverted
+ * lists are not used):
+ *
+ * - the vectors are added to the write segment, a
+ *   ConcurrentInvertedLists. When it contains seal_size entries, it is
+ *   sealed: converted to immutable inverted lists (make_sealed_lists,
+ *   CompactedInvertedLists by default).
+ * - the sealed segments are grouped in tiers by size, tier t holding the
+ *   segments of seal_size * merge_factor^t to seal_size *
+ *   merge_factor^(t + 1) vectors. When a tier contains merge_factor
+ *   segments, they are merged into one. The merges run in a background
+ *   thread, or in add if background_merge is false.
+ * - remove_ids records the removed entries as tombstones in the
+ *   segments. They are skipped at search time and dropped by the merges.
+ *
+ * A search scans each probed list in all the segments in turn, with the
+ * same scanner and result heap, as if the segments were stacked
+ * horizontally (see HStackInvertedLists) but without copying them.
+ *
+ * Thread safety: searches can run concurrently with the merges and with
+ * one thread that calls add, add_with_ids, remove_ids or seal. A search
+ * sees the vectors of the add calls that returned before it started.
+ * The ids are not required to be unique.
+ */
+struct IndexSegmentedIVF: Index {
+
+    /// quantizer and encoding of the segments
+    IndexIVF *ivf;
+    bool own_fields;   ///< whether ivf should be deleted
+
+    /// nb of entries of the write segment when it is sealed
+    size_t seal_size;
+
+    /// nb of segments of a tier that are merged together (>= 2)
+    size_t merge_factor;
+
+    /// run the merges in a background thread
+    const bool background_merge;
+
+    /// id of the next vector added with add()
+    idx_t next_id;
+
+    /** @param ivf    trained (or trained later with train), its
+     *                nprobe is the default nprobe of the searches
+     */
+    explicit IndexSegmentedIVF (IndexIVF *ivf, size_t seal_size = 65536,
+                                size_t merge_factor = 4,
+                                bool background_merge = true);
+
+    ~IndexSegmentedIVF () override;
+
+    void train (idx_t n, const float *x) override;
+
+    void add (idx_t n, const float *x) override;
+
+    void add_with_ids (idx_t n, const float *x, const idx_t *xids) override;
+
+    /// supports IVFSearchParameters (nprobe and sel)
+    void search (idx_t n, const float *x, idx_t k,
+                 float *distances, idx_t *labels,
+                 const SearchParameters *params = nullptr) const override;
+
+    /// records tombstones, the space is recovered by the merges
+    size_t remove_ids (const IDSelector & sel) override;
+
+    void reset () override;
+
+    /// seal the write segment now (if it is not empty)
+    void seal ();
+
+    /// block until no merge is needed. Rethrows the exception of a
+    /// failed background merge.
+    void wait_for_merges ();
+
+    /// merge all the segments into one, removing all the tombstones
+    void merge_all ();
+
+    /// nb of entries (including the tombstones) of the sealed segments,
+    /// from oldest to newest
+    std::vector<size_t> sealed_segment_sizes () const;
+
+    /// nb of tombstones in all the segments
+    size_t ntombstones () const;
+
+    /** build the immutable inverted lists of a segment from lists without
+     * tombstones. Can be overloaded to store the segments on disk, for
+     * example. The default is a CompactedInvertedLists. */
+    virtual InvertedLists *make_sealed_lists (const InvertedLists & il) const;
+
+    /// the entries removed from a segment (immutable, replaced on change)
+    typedef std::unordered_set<idx_t> IdSet;
+
+    struct Segment {
+        std::shared_ptr<InvertedLists> invlists;
+        size_t size;   ///< nb of entries, including the tombstones
+        std::shared_ptr<const IdSet> tombstones;  ///< may be null
+    };
+
+  private:
+    /// the segments to search, with the write segment last
+    std::vector<Segment> snapshot () const;
+
+    Segment new_write_segment () const;
+
+    /// merge the segments of the first tier that has enough of them.
+    /// Returns false if no merge is needed.
+    bool merge_step (bool all);
+
+    void merge_loop ();
+
+    void stop_merges ();
+
+    /// held by remove_ids and while a merge replaces its input segments
+    std::mutex update_mutex;
+
+    mutable std::mutex mutex;      ///< protects the following fields
+    std::vector<Segment> sealed;
+    Segment write_segment;
+    bool merge_pending;            ///< the merge thread should run
+    bool merging;                  ///< the merge thread is running
+    bool stopping;
+    std::exception_ptr merge_error;
+
+    std::condition_variable cv_merge;  ///< a merge may be needed
+    std::condition_variable cv_idle;   ///< a merge completed
+    std::thread merge_thread;
+};
+
+
+} // namespace faiss
+
+#endif
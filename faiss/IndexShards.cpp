@@ -9,12 +9,16 @@
 
 #include <faiss/IndexShards.h>
 
+#include <algorithm>
 #include <cinttypes>
 #include <cstdio>
+#include <cstring>
+#include <exception>
 #include <functional>
 
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/utils/Heap.h>
+#include <faiss/utils/instrumentation.h>
 #include <faiss/utils/WorkerThread.h>
 
 namespace faiss {
@@ -37,6 +41,15 @@ void translate_labels (long n, idx_t *labels, long translation)
 
 
 /** merge result tables from several shards.
+ *
+ * The result list of each shard is sorted, so the lists of a query are
+ * merged with a tournament (loser) tree, with log2(nshard) comparisons
+ * per output, ties going to the lowest shard. Before that, a bound is set
+ * on the k-th merged result: it is at least as good as the k-th result
+ * of any shard that returned k results. The results worse than this
+ * bound are cut, which removes whole shards when their best result is
+ * already worse.
+ *
  * @param all_distances  size nshard * n * k
  * @param all_labels     idem
  * @param translartions  label translations to apply, size nshard
@@ -56,48 +69,98 @@ merge_tables(long n, long k, long nshard,
   using distance_t = typename IndexClass::distance_t;
 
   long stride = n * k;
-#pragma omp parallel
+
+  // nb of leaves of the tree, a power of 2
+  int nleaf = 1;
+  while (nleaf < nshard) {
+    nleaf *= 2;
+  }
+
+#pragma omp parallel if (n > 1)
   {
-    std::vector<int> buf (2 * nshard);
-    int * pointer = buf.data();
-    int * shard_ids = pointer + nshard;
-    std::vector<distance_t> buf2 (nshard);
-    distance_t * heap_vals = buf2.data();
+    // per shard: current position and end of the useful results
+    std::vector<long> pointer (nleaf), end (nleaf);
+    // the loser of each match, and the players of the initial round
+    std::vector<int> losers (nleaf), winners (2 * nleaf);
+
 #pragma omp for
     for (long i = 0; i < n; i++) {
-      // the heap maps values to the shard where they are
-      // produced.
       const distance_t *D_in = all_distances.data() + i * k;
       const idx_t *I_in = all_labels.data() + i * k;
-      int heap_size = 0;
 
+      // bound on the k-th merged result
+      bool have_bound = false;
+      distance_t bound = C::neutral();
       for (long s = 0; s < nshard; s++) {
+        if (I_in[stride * s + k - 1] >= 0 &&
+            (!have_bound || C::cmp(D_in[stride * s + k - 1], bound))) {
+          bound = D_in[stride * s + k - 1];
+          have_bound = true;
+        }
+      }
+
+      for (long s = 0; s < nleaf; s++) {
         pointer[s] = 0;
-        if (I_in[stride * s] >= 0) {
-          heap_push<C> (++heap_size, heap_vals, shard_ids,
-                        D_in[stride * s], s);
+        long e = 0;
+        if (s < nshard) {
+          const distance_t *Ds = D_in + stride * s;
+          const idx_t *Is = I_in + stride * s;
+          while (e < k && Is[e] >= 0 &&
+                 !(have_bound && C::cmp(bound, Ds[e]))) {
+            e++;
+          }
         }
+        end[s] = e;
       }
 
+      // does shard a beat shard b with their current results?
+      auto beats = [&](int a, int b) {
+        if (pointer[a] == end[a]) {
+          return false;
+        }
+        if (pointer[b] == end[b]) {
+          return true;
+        }
+        distance_t da = D_in[stride * a + pointer[a]];
+        distance_t db = D_in[stride * b + pointer[b]];
+        return C::cmp(da, db) || (da == db && a < b);
+      };
+
+      for (int s = 0; s < nleaf; s++) {
+        winners[nleaf + s] = s;
+      }
+      for (int node = nleaf - 1; node >= 1; node--) {
+        int a = winners[2 * node], b = winners[2 * node + 1];
+        if (beats(b, a)) {
+          std::swap(a, b);
+        }
+        winners[node] = a;
+        losers[node] = b;
+      }
+      int winner = winners[1];
+
       distance_t *D = distances + i * k;
       idx_t *I = labels + i * k;
 
-      for (int j = 0; j < k; j++) {
-        if (heap_size == 0) {
-          I[j] = -1;
-          D[j] = C::neutral();
-        } else {
-          // pop best element
-          int s = shard_ids[0];
-          int & p = pointer[s];
-          D[j] = heap_vals[0];
-          I[j] = I_in[stride * s + p] + translations[s];
-
-          heap_pop<C> (heap_size--, heap_vals, shard_ids);
-          p++;
-          if (p < k && I_in[stride * s + p] >= 0) {
-            heap_push<C> (++heap_size, heap_vals, shard_ids,
-                          D_in[stride * s + p], s);
+      for (long j = 0; j < k; j++) {
+        long & p = pointer[winner];
+        if (p == end[winner]) {
+          // all the lists are exhausted
+          for (; j < k; j++) {
+            I[j] = -1;
+            D[j] = C::neutral();
+          }
+          break;
+        }
+
+        D[j] = D_in[stride * winner + p];
+        I[j] = I_in[stride * winner + p] + translations[winner];
+        p++;
+
+        // replay the matches of the winner up to the root
+        for (int node = (nleaf + winner) / 2; node >= 1; node /= 2) {
+          if (beats(losers[node], winner)) {
+            std::swap(losers[node], winner);
           }
         }
       }
@@ -289,21 +352,54 @@ IndexShardsTemplate<IndexT>::search(idx_t n,
                                     const component_t *x,
                                     idx_t k,
                                     distance_t *distances,
-                                    idx_t *labels) const {
+                                    idx_t *labels,
+                                    const SearchParameters *params) const {
+  auto search_shard =
+    [n, k, x, params](int, const IndexT *index,
+                      distance_t *shard_distances, idx_t *shard_labels) {
+      index->search (n, x, k, shard_distances, shard_labels, params);
+    };
+
+  search_and_merge(n, k, distances, labels, params, search_shard);
+}
+
+template <typename IndexT>
+void
+IndexShardsTemplate<IndexT>::search_and_merge(
+      idx_t n,
+      idx_t k,
+      distance_t *distances,
+      idx_t *labels,
+      const SearchParameters *params,
+      const ShardSearchFunction& search_shard) const {
   long nshard = this->count();
 
   std::vector<distance_t> all_distances(nshard * k * n);
   std::vector<idx_t> all_labels(nshard * k * n);
 
+  // with a deadline, the shards that fail are left out of the results
+  // instead of failing the whole search
+  bool best_effort = params && params->deadline_ms > 0;
+  std::vector<std::exception_ptr> shard_errors(nshard);
+
   auto fn =
-    [n, k, x, &all_distances, &all_labels](int no, const IndexT *index) {
+    [n, k, best_effort, &search_shard, &all_distances, &all_labels,
+     &shard_errors](int no, const IndexT *index) {
       if (index->verbose) {
         printf ("begin query shard %d on %" PRId64 " points\n", no, n);
       }
 
-      index->search (n, x, k,
-                     all_distances.data() + no * k * n,
-                     all_labels.data() + no * k * n);
+      try {
+        search_shard (no, index,
+                      all_distances.data() + no * k * n,
+                      all_labels.data() + no * k * n);
+      } catch (...) {
+        if (!best_effort) {
+          throw;
+        }
+        shard_errors[no] = std::current_exception();
+        std::fill_n (all_labels.data() + no * k * n, k * n, idx_t(-1));
+      }
 
       if (index->verbose) {
         printf ("end query shard %d\n", no);
@@ -312,6 +408,20 @@ IndexShardsTemplate<IndexT>::search(idx_t n,
 
   this->runOnIndex(fn);
 
+  if (best_effort) {
+    long nfailed = 0;
+    for (long s = 0; s < nshard; s++) {
+      nfailed += shard_errors[s] ? 1 : 0;
+    }
+    if (nfailed == nshard && nshard > 0) {
+      // nothing to return
+      std::rethrow_exception (shard_errors[0]);
+    }
+    if (nfailed > 0 && params->truncated) {
+      memset (params->truncated, 1, n);
+    }
+  }
+
   std::vector<long> translations(nshard, 0);
 
   // Because we just called runOnIndex above, it is safe to access the sub-index
@@ -324,6 +434,7 @@ IndexShardsTemplate<IndexT>::search(idx_t n,
     }
   }
 
+  InstrumentationTimer timer(STAGE_MERGE);
   if (this->metric_type == METRIC_L2) {
     merge_tables<IndexT, CMin<distance_t, int>>(
       n, k, nshard, distances, labels,
@@ -74,8 +74,13 @@ struct IndexShardsTemplate : public ThreadedIndex<IndexT> {
    */
   void add_with_ids(idx_t n, const component_t* x, const idx_t* xids) override;
 
+  /** The params are passed to all shards. If params->deadline_ms is
+   * set, the shards that throw are left out of the results, and all
+   * queries are then flagged as truncated. The search throws only if all
+   * shards fail. */
   void search(idx_t n, const component_t* x, idx_t k,
-              distance_t* distances, idx_t* labels) const override;
+              distance_t* distances, idx_t* labels,
+              const SearchParameters *params = nullptr) const override;
 
   void train(idx_t n, const component_t* x) override;
 
@@ -85,6 +90,18 @@ struct IndexShardsTemplate : public ThreadedIndex<IndexT> {
   void syncWithSubIndexes();
 
  protected:
+  /// searches one shard: (shard no, shard, distances, labels), the
+  /// result tables have size n * k
+  using ShardSearchFunction = std::function<
+    void(int, const IndexT*, distance_t*, idx_t*)>;
+
+  /// runs search_shard on all shards and merges their results, with the
+  /// deadline handling and id translation of search()
+  void search_and_merge(idx_t n, idx_t k,
+                        distance_t* distances, idx_t* labels,
+                        const SearchParameters* params,
+                        const ShardSearchFunction& search_shard) const;
+
   /// Called just after an index is added
   void onAfterAddIndex(IndexT* index) override;
 
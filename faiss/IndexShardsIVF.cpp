@@ -0,0 +1,158 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/IndexShardsIVF.h>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/instrumentation.h>
+#include <faiss/utils/utils.h>
+
+namespace faiss {
+
+
+IndexShardsIVF::IndexShardsIVF (Index *quantizer, size_t nlist,
+                                bool threaded, bool successive_ids):
+    IndexShards (quantizer->d, threaded, successive_ids),
+    Level1Quantizer (quantizer, nlist)
+{
+    is_trained = quantizer->is_trained && quantizer->ntotal == nlist;
+}
+
+void IndexShardsIVF::addIndex (Index *index)
+{
+    auto *ivf = dynamic_cast<IndexIVF*> (index);
+    FAISS_THROW_IF_NOT_MSG (ivf, "IndexShardsIVF: shards must be IndexIVFs");
+    FAISS_THROW_IF_NOT_FMT (ivf->nlist == nlist,
+                            "IndexShardsIVF: shard has %zd lists instead of %zd",
+                            ivf->nlist, nlist);
+    FAISS_THROW_IF_NOT (ivf->quantizer->d == quantizer->d);
+
+    if (ivf->quantizer != quantizer && ivf->quantizer->ntotal > 0) {
+        FAISS_THROW_IF_NOT (ivf->quantizer->ntotal == nlist);
+        std::vector<float> centroids (nlist * quantizer->d);
+        ivf->quantizer->reconstruct_n (0, nlist, centroids.data());
+        if (quantizer->ntotal == 0) {
+            // take the centroids of the first trained shard
+            FAISS_THROW_IF_NOT_MSG (quantizer->is_trained,
+                                    "IndexShardsIVF: quantizer not trained");
+            quantizer->add (nlist, centroids.data());
+        } else {
+            FAISS_THROW_IF_NOT (quantizer->ntotal == nlist);
+            std::vector<float> ref (nlist * quantizer->d);
+            quantizer->reconstruct_n (0, nlist, ref.data());
+            FAISS_THROW_IF_NOT_MSG (
+                  memcmp (centroids.data(), ref.data(),
+                          sizeof(float) * ref.size()) == 0,
+                  "IndexShardsIVF: the shard has different centroids");
+        }
+    }
+
+    IndexShards::addIndex (index);
+}
+
+void IndexShardsIVF::copy_centroids_to (IndexIVF *index) const
+{
+    if (index->quantizer == quantizer || index->quantizer->ntotal > 0) {
+        return;
+    }
+    std::vector<float> centroids (nlist * quantizer->d);
+    quantizer->reconstruct_n (0, nlist, centroids.data());
+    index->quantizer->add (nlist, centroids.data());
+}
+
+void IndexShardsIVF::train (idx_t n, const float *x)
+{
+    if (verbose) {
+        printf ("Training IndexShardsIVF quantizer on %" PRId64 " vectors\n",
+                n);
+    }
+    train_q1 (n, x, verbose, metric_type);
+
+    auto fn = [this, n, x] (int no, Index *index) {
+        auto *ivf = dynamic_cast<IndexIVF*> (index);
+        copy_centroids_to (ivf);
+        if (index->verbose) {
+            printf ("begin train shard %d on %" PRId64 " points\n", no, n);
+        }
+        // the coarse quantizer is complete, this trains the encoder only
+        index->train (n, x);
+    };
+    runOnIndex (fn);
+
+    syncWithSubIndexes ();
+    is_trained = is_trained || count() == 0;
+}
+
+void IndexShardsIVF::search (idx_t n, const float *x, idx_t k,
+                             float *distances, idx_t *labels,
+                             const SearchParameters *params_in) const
+{
+    if (count() == 0) {
+        IndexShards::search (n, x, k, distances, labels, params_in);
+        return;
+    }
+    const IVFSearchParameters *params = nullptr;
+    if (params_in) {
+        params = dynamic_cast<const IVFSearchParameters *>(params_in);
+        FAISS_THROW_IF_NOT_MSG (params,
+                                "IndexShardsIVF params have incorrect type");
+    }
+
+    size_t nprobe;
+    if (params) {
+        nprobe = params->nprobe;
+    } else {
+        // the shards index the assignment table with their own nprobe
+        nprobe = dynamic_cast<const IndexIVF*> (at(0))->nprobe;
+        for (int i = 1; i < count(); i++) {
+            FAISS_THROW_IF_NOT_MSG (
+                  dynamic_cast<const IndexIVF*> (at(i))->nprobe == nprobe,
+                  "IndexShardsIVF: the shards have different nprobe");
+        }
+    }
+
+    std::vector<idx_t> idx (n * nprobe);
+    std::vector<float> coarse_dis (n * nprobe);
+
+    double t0 = getmillisecs();
+    {
+        InstrumentationTimer timer (STAGE_COARSE_QUANTIZE);
+        quantizer->search (n, x, nprobe, coarse_dis.data(), idx.data(),
+                           params ? params->quantizer_params : nullptr);
+    }
+    indexIVF_stats.quantization_time += getmillisecs() - t0;
+
+    auto search_shard =
+        [n, x, k, params, nprobe, &idx, &coarse_dis] (
+            int, const Index *index,
+            float *shard_distances, idx_t *shard_labels) {
+        auto *ivf = dynamic_cast<const IndexIVF*> (index);
+        ivf->invlists->prefetch_lists (idx.data(), n * nprobe);
+        ivf->search_preassigned (n, x, k, idx.data(), coarse_dis.data(),
+                                 shard_distances, shard_labels,
+                                 false, params);
+    };
+
+    search_and_merge (n, k, distances, labels, params_in, search_shard);
+}
+
+MemoryUsage IndexShardsIVF::memory_usage () const
+{
+    MemoryUsage mu = IndexShards::memory_usage ();
+    mu.add ("quantizer", quantizer->memory_usage ());
+    return mu;
+}
+
+
+} // namespace faiss
@@ -0,0 +1,63 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <faiss/IndexIVF.h>
+#include <faiss/IndexShards.h>
+
+namespace faiss {
+
+/** IndexShards for IndexIVF shards that have the same coarse centroids
+ * (eg. the shards of a large IVF index, trained once and filled
+ * separately). The coarse quantization of the queries is done once with
+ * the quantizer of the IndexShardsIVF, and the assignment is passed to
+ * search_preassigned of all the shards, instead of being recomputed by
+ * each of them.
+ *
+ * The shards must be IndexIVFs with nlist lists. Their quantizer can be
+ * the quantizer of the IndexShardsIVF, or a separate index with the same
+ * centroids. When a shard is added, its centroids are checked against
+ * those of the quantizer. If the quantizer is empty, it is filled with
+ * the centroids of the shard, so that shards read from disk can be
+ * combined with an empty IndexFlat as quantizer.
+ *
+ * All the shards must have the same nprobe (unless it is given in the
+ * IVFSearchParameters).
+ */
+struct IndexShardsIVF: IndexShards, Level1Quantizer {
+
+    /// the quantizer is not owned by default (see Level1Quantizer)
+    IndexShardsIVF (Index *quantizer, size_t nlist,
+                    bool threaded = false, bool successive_ids = true);
+
+    /// checks that the shard is an IndexIVF with the same centroids
+    void addIndex (Index *index) override;
+
+    /** trains the quantizer, copies the centroids to the shards that have
+     * an empty quantizer of their own, then trains the shards (that only
+     * train their encoders). */
+    void train (idx_t n, const float *x) override;
+
+    /// searches the quantizer once, then calls search_preassigned on the
+    /// shards
+    void search (idx_t n, const float *x, idx_t k,
+                 float *distances, idx_t *labels,
+                 const SearchParameters *params = nullptr) const override;
+
+    /// adds the quantizer to the breakdown of IndexShards
+    MemoryUsage memory_usage () const override;
+
+  private:
+    /// copies the centroids of the quantizer to an empty shard quantizer
+    void copy_centroids_to (IndexIVF *index) const;
+};
+
+
+} // namespace faiss
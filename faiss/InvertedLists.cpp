@@ -9,8 +9,16 @@
 
 #include <faiss/InvertedLists.h>
 
+#include <cassert>
 #include <cstdio>
+#include <cstring>
 
+#include <algorithm>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+
+#include <faiss/utils/prefetch.h>
 #include <faiss/utils/utils.h>
 #include <faiss/impl/FaissAssert.h>
 
@@ -47,6 +55,14 @@ void InvertedLists::release_ids (size_t, const idx_t *) const
 void InvertedLists::prefetch_lists (const idx_t *, int) const
 {}
 
+void InvertedLists::prefetch_list_head (size_t, size_t) const
+{}
+
+bool InvertedLists::lazy_ids () const
+{
+    return false;
+}
+
 const uint8_t * InvertedLists::get_single_code (
                    size_t list_no, size_t offset) const
 {
@@ -121,6 +137,15 @@ void InvertedLists::print_stats () const {
     }
 }
 
+MemoryUsage InvertedLists::memory_usage () const {
+    MemoryUsage mu = MemoryUsage::object (
+          demangle_cpp_symbol (typeid (*this).name()));
+    size_t ntotal = compute_ntotal ();
+    mu.add ("codes", ntotal * code_size, ntotal * code_size);
+    mu.add ("ids", ntotal * sizeof(idx_t), ntotal * sizeof(idx_t));
+    return mu;
+}
+
 size_t InvertedLists::compute_ntotal () const {
     size_t tot = 0;
     for (size_t i = 0; i < nlist; i++) {
@@ -167,6 +192,16 @@ const uint8_t * ArrayInvertedLists::get_codes (size_t list_no) const
 }
 
 
+void ArrayInvertedLists::prefetch_list_head (
+        size_t list_no, size_t nbytes) const
+{
+    const std::vector<uint8_t> & c = codes[list_no];
+    prefetch_L2 (c.data(), std::min (nbytes, c.size()));
+    if (!ids[list_no].empty()) {
+        prefetch_L2 (ids[list_no].data());
+    }
+}
+
 const InvertedLists::idx_t * ArrayInvertedLists::get_ids (size_t list_no) const
 {
     assert (list_no < nlist);
@@ -179,6 +214,13 @@ void ArrayInvertedLists::resize (size_t list_no, size_t new_size)
     codes[list_no].resize (new_size * code_size);
 }
 
+size_t ArrayInvertedLists::add_list ()
+{
+    ids.emplace_back ();
+    codes.emplace_back ();
+    return nlist++;
+}
+
 void ArrayInvertedLists::update_entries (
       size_t list_no, size_t offset, size_t n_entry,
       const idx_t *ids_in, const uint8_t *codes_in)
@@ -189,6 +231,25 @@ void ArrayInvertedLists::update_entries (
     memcpy (&codes[list_no][offset * code_size], codes_in, code_size * n_entry);
 }
 
+void ArrayInvertedLists::first_touch_lists (bool parallel)
+{
+#pragma omp parallel for schedule(static) if(parallel)
+    for (idx_t list_no = 0; list_no < nlist; list_no++) {
+        // the copy constructor allocates a new buffer and touches it
+        std::vector<idx_t> new_ids (ids[list_no]);
+        std::vector<uint8_t> new_codes (codes[list_no]);
+        ids[list_no].swap (new_ids);
+        codes[list_no].swap (new_codes);
+    }
+}
+
+MemoryUsage ArrayInvertedLists::memory_usage () const
+{
+    MemoryUsage mu = MemoryUsage::object ("ArrayInvertedLists");
+    mu.add ("codes", codes);
+    mu.add ("ids", ids);
+    return mu;
+}
 
 ArrayInvertedLists::~ArrayInvertedLists ()
 {}
@@ -218,6 +279,106 @@ void ReadOnlyInvertedLists::resize (size_t , size_t )
 
 
 
+/*****************************************
+ * CompactedInvertedLists implementation
+ ******************************************/
+
+namespace {
+
+const size_t arena_alignment = 64;
+
+size_t round_up_to_alignment (size_t n)
+{
+    return (n + arena_alignment - 1) / arena_alignment * arena_alignment;
+}
+
+} // anonymous namespace
+
+
+CompactedInvertedLists::CompactedInvertedLists (const InvertedLists & il):
+    ReadOnlyInvertedLists (il.nlist, il.code_size),
+    codes (nullptr), ids (nullptr)
+{
+    FAISS_THROW_IF_NOT_MSG (code_size != InvertedLists::INVALID_CODE_SIZE,
+                            "cannot compact lists without a code size");
+    offsets.resize (nlist + 1);
+    offsets[0] = 0;
+    for (size_t i = 0; i < nlist; i++) {
+        offsets[i + 1] = offsets[i] + il.list_size (i);
+    }
+    size_t ntotal = offsets[nlist];
+
+    // the ids arena starts at an aligned offset after the codes arena,
+    // the extra bytes at the beginning are to align the buffer itself
+    size_t codes_bytes = round_up_to_alignment (ntotal * code_size);
+    buffer.resize (arena_alignment + codes_bytes + ntotal * sizeof (idx_t));
+    uint8_t *base = buffer.data();
+    size_t misalign = (uintptr_t)base % arena_alignment;
+    if (misalign) {
+        base += arena_alignment - misalign;
+    }
+    codes = base;
+    ids = (idx_t*)(base + codes_bytes);
+
+#pragma omp parallel for if (nlist > 100)
+    for (idx_t i = 0; i < nlist; i++) {
+        size_t n = offsets[i + 1] - offsets[i];
+        if (n == 0) {
+            continue;
+        }
+        memcpy (codes + offsets[i] * code_size,
+                ScopedCodes (&il, i).get(), n * code_size);
+        memcpy (ids + offsets[i],
+                ScopedIds (&il, i).get(), n * sizeof (idx_t));
+    }
+}
+
+size_t CompactedInvertedLists::list_size (size_t list_no) const
+{
+    assert (list_no < nlist);
+    return offsets[list_no + 1] - offsets[list_no];
+}
+
+const uint8_t * CompactedInvertedLists::get_codes (size_t list_no) const
+{
+    assert (list_no < nlist);
+    return codes + offsets[list_no] * code_size;
+}
+
+const InvertedLists::idx_t * CompactedInvertedLists::get_ids (
+        size_t list_no) const
+{
+    assert (list_no < nlist);
+    return ids + offsets[list_no];
+}
+
+InvertedLists::idx_t CompactedInvertedLists::get_single_id (
+        size_t list_no, size_t offset) const
+{
+    assert (offset < list_size (list_no));
+    return ids[offsets[list_no] + offset];
+}
+
+const uint8_t * CompactedInvertedLists::get_single_code (
+        size_t list_no, size_t offset) const
+{
+    assert (offset < list_size (list_no));
+    return codes + (offsets[list_no] + offset) * code_size;
+}
+
+MemoryUsage CompactedInvertedLists::memory_usage () const
+{
+    MemoryUsage mu = MemoryUsage::object ("CompactedInvertedLists");
+    mu.add ("offsets", offsets);
+    // the alignment padding of the arenas is counted with the ids
+    size_t ncodes = offsets[nlist] * code_size;
+    mu.add ("codes", ncodes, ncodes);
+    mu.add ("ids", offsets[nlist] * sizeof(idx_t),
+            buffer.capacity() - ncodes);
+    return mu;
+}
+
+
 /*****************************************
  * HStackInvertedLists implementation
  ******************************************/
@@ -688,5 +849,316 @@ void StopWordsInvertedLists::prefetch_lists (
 }
 
 
+/*****************************************
+ * CachedInvertedLists implementation
+ ******************************************/
+
+struct CachedInvertedLists::Cache {
+
+    struct Entry {
+        std::vector<uint8_t> codes;
+        std::vector<idx_t> ids;
+        size_t nref = 0;      // nb of get_codes / get_ids not released
+        bool pinned = false;
+        uint64_t key = 0;     // key in the evictable set
+
+        size_t nbytes () const {
+            return codes.size() + ids.size() * sizeof(idx_t);
+        }
+    };
+
+    const CachedInvertedLists & owner;
+    std::mutex mutex;
+    std::unordered_map<size_t, Entry> entries;
+
+    /// entries that are neither pinned nor in use, by eviction order
+    std::set<std::pair<uint64_t, size_t> > evictable;
+
+    std::vector<uint64_t> nuse;  // nb of accesses per list (LFU)
+    uint64_t clock = 0;          // access counter (LRU)
+    size_t nbytes = 0;
+    size_t nhit = 0, nmiss = 0, nevict = 0;
+
+    explicit Cache (const CachedInvertedLists & owner):
+        owner (owner), nuse (owner.nlist)
+    {}
+
+    // all the functions below are called with the mutex held
+
+    Entry * acquire (size_t list_no) {
+        auto it = entries.find (list_no);
+        if (it == entries.end()) {
+            return nullptr;
+        }
+        Entry & e = it->second;
+        if (e.nref == 0 && !e.pinned) {
+            evictable.erase (std::make_pair (e.key, list_no));
+        }
+        e.nref++;
+        return &e;
+    }
+
+    void make_evictable (size_t list_no, Entry & e) {
+        e.key = owner.policy == EVICT_LRU ? ++clock : nuse[list_no];
+        evictable.insert (std::make_pair (e.key, list_no));
+    }
+
+    void release (size_t list_no, Entry & e) {
+        assert (e.nref > 0);
+        e.nref--;
+        if (e.nref == 0 && !e.pinned) {
+            make_evictable (list_no, e);
+        }
+    }
+
+    void evict (size_t max_bytes) {
+        while (nbytes > max_bytes && !evictable.empty()) {
+            size_t list_no = evictable.begin()->second;
+            evictable.erase (evictable.begin());
+            auto it = entries.find (list_no);
+            nbytes -= it->second.nbytes();
+            entries.erase (it);
+            nevict++;
+        }
+    }
+
+    /// find the list in the cache, or load it if it fits in max_bytes
+    /// (or if force). Called without the mutex.
+    Entry * get (size_t list_no, bool count, bool force) {
+        {
+            std::lock_guard<std::mutex> lock (mutex);
+            if (count) {
+                nuse[list_no]++;
+            }
+            Entry *e = acquire (list_no);
+            if (count) {
+                (e ? nhit : nmiss)++;
+            }
+            if (e) {
+                return e;
+            }
+        }
+        const InvertedLists *il = owner.il;
+        size_t n = il->list_size (list_no);
+        if (n == 0 || (!force &&
+                n * (owner.code_size + sizeof(idx_t)) > owner.max_bytes)) {
+            return nullptr;
+        }
+
+        // read the list without holding the mutex
+        Entry ne;
+        {
+            ScopedCodes codes (il, list_no);
+            ne.codes.assign (codes.get(), codes.get() + n * owner.code_size);
+            ScopedIds ids (il, list_no);
+            ne.ids.assign (ids.get(), ids.get() + n);
+        }
+
+        std::lock_guard<std::mutex> lock (mutex);
+        Entry *e = acquire (list_no);
+        if (e) {
+            // loaded by another thread in the meantime
+            return e;
+        }
+        nbytes += ne.nbytes();
+        e = &entries[list_no];
+        *e = std::move (ne);
+        e->nref = 1;
+        evict (owner.max_bytes);
+        return e;
+    }
+
+};
+
+
+CachedInvertedLists::CachedInvertedLists (
+        const InvertedLists *il, size_t max_bytes,
+        EvictionPolicy policy):
+    ReadOnlyInvertedLists (il->nlist, il->code_size),
+    il (il), max_bytes (max_bytes), policy (policy)
+{
+    FAISS_THROW_IF_NOT (il->code_size != InvertedLists::INVALID_CODE_SIZE);
+    cache = new Cache (*this);
+}
+
+CachedInvertedLists::~CachedInvertedLists ()
+{
+    delete cache;
+}
+
+void CachedInvertedLists::pin_list (size_t list_no)
+{
+    FAISS_THROW_IF_NOT (list_no < nlist);
+    Cache::Entry *e = cache->get (list_no, false, true);
+    if (!e) {
+        return; // empty list
+    }
+    std::lock_guard<std::mutex> lock (cache->mutex);
+    e->pinned = true;
+    cache->release (list_no, *e);
+    cache->evict (max_bytes);
+}
+
+void CachedInvertedLists::unpin_list (size_t list_no)
+{
+    std::lock_guard<std::mutex> lock (cache->mutex);
+    auto it = cache->entries.find (list_no);
+    if (it == cache->entries.end() || !it->second.pinned) {
+        return;
+    }
+    it->second.pinned = false;
+    if (it->second.nref == 0) {
+        cache->make_evictable (list_no, it->second);
+    }
+    cache->evict (max_bytes);
+}
+
+void CachedInvertedLists::clear ()
+{
+    std::lock_guard<std::mutex> lock (cache->mutex);
+    cache->evict (0);
+}
+
+size_t CachedInvertedLists::list_size (size_t list_no) const
+{
+    return il->list_size (list_no);
+}
+
+const uint8_t * CachedInvertedLists::get_codes (size_t list_no) const
+{
+    Cache::Entry *e = cache->get (list_no, true, false);
+    return e ? e->codes.data() : il->get_codes (list_no);
+}
+
+const idx_t * CachedInvertedLists::get_ids (size_t list_no) const
+{
+    Cache::Entry *e = cache->get (list_no, false, false);
+    return e ? e->ids.data() : il->get_ids (list_no);
+}
+
+void CachedInvertedLists::release_codes (
+      size_t list_no, const uint8_t *codes) const
+{
+    {
+        std::lock_guard<std::mutex> lock (cache->mutex);
+        auto it = cache->entries.find (list_no);
+        if (it != cache->entries.end()) {
+            Cache::Entry & e = it->second;
+            // get_single_code returns a pointer inside the list
+            if (codes >= e.codes.data() &&
+                codes < e.codes.data() + e.codes.size()) {
+                cache->release (list_no, e);
+                return;
+            }
+        }
+    }
+    il->release_codes (list_no, codes);
+}
+
+void CachedInvertedLists::release_ids (
+      size_t list_no, const idx_t *ids) const
+{
+    {
+        std::lock_guard<std::mutex> lock (cache->mutex);
+        auto it = cache->entries.find (list_no);
+        if (it != cache->entries.end() && ids == it->second.ids.data()) {
+            cache->release (list_no, it->second);
+            return;
+        }
+    }
+    il->release_ids (list_no, ids);
+}
+
+idx_t CachedInvertedLists::get_single_id (
+      size_t list_no, size_t offset) const
+{
+    {
+        std::lock_guard<std::mutex> lock (cache->mutex);
+        auto it = cache->entries.find (list_no);
+        if (it != cache->entries.end()) {
+            assert (offset < it->second.ids.size());
+            return it->second.ids[offset];
+        }
+    }
+    return il->get_single_id (list_no, offset);
+}
+
+const uint8_t * CachedInvertedLists::get_single_code (
+      size_t list_no, size_t offset) const
+{
+    {
+        std::lock_guard<std::mutex> lock (cache->mutex);
+        Cache::Entry *e = cache->acquire (list_no);
+        if (e) {
+            return e->codes.data() + offset * code_size;
+        }
+    }
+    return il->get_single_code (list_no, offset);
+}
+
+void CachedInvertedLists::prefetch_lists (
+      const idx_t *list_nos, int nlist) const
+{
+    // only the lists that are not cached need to be prefetched in il
+    std::vector<idx_t> missing;
+    {
+        std::lock_guard<std::mutex> lock (cache->mutex);
+        for (int i = 0; i < nlist; i++) {
+            if (list_nos[i] >= 0 && !cache->entries.count (list_nos[i])) {
+                missing.push_back (list_nos[i]);
+            }
+        }
+    }
+    il->prefetch_lists (missing.data(), missing.size());
+}
+
+bool CachedInvertedLists::lazy_ids () const
+{
+    return il->lazy_ids ();
+}
+
+size_t CachedInvertedLists::cached_bytes () const
+{
+    std::lock_guard<std::mutex> lock (cache->mutex);
+    return cache->nbytes;
+}
+
+size_t CachedInvertedLists::cached_lists () const
+{
+    std::lock_guard<std::mutex> lock (cache->mutex);
+    return cache->entries.size();
+}
+
+size_t CachedInvertedLists::nhit () const
+{
+    std::lock_guard<std::mutex> lock (cache->mutex);
+    return cache->nhit;
+}
+
+size_t CachedInvertedLists::nmiss () const
+{
+    std::lock_guard<std::mutex> lock (cache->mutex);
+    return cache->nmiss;
+}
+
+size_t CachedInvertedLists::nevict () const
+{
+    std::lock_guard<std::mutex> lock (cache->mutex);
+    return cache->nevict;
+}
+
+double CachedInvertedLists::hit_rate () const
+{
+    std::lock_guard<std::mutex> lock (cache->mutex);
+    size_t n = cache->nhit + cache->nmiss;
+    return n == 0 ? 0 : cache->nhit / double(n);
+}
+
+void CachedInvertedLists::reset_stats ()
+{
+    std::lock_guard<std::mutex> lock (cache->mutex);
+    cache->nhit = cache->nmiss = cache->nevict = 0;
+}
+
 
 } // namespace faiss
@@ -34,6 +34,10 @@ struct InvertedLists {
     size_t nlist;             ///< number of possible key values
     size_t code_size;         ///< code size per vector in bytes
 
+    /// used for BlockInvertedLists, where the codes are packed into blocks
+    /// and there is no code size per vector
+    static const size_t INVALID_CODE_SIZE = static_cast<size_t>(-1);
+
     InvertedLists (size_t nlist, size_t code_size);
 
     /*************************
@@ -74,6 +78,17 @@ struct InvertedLists {
     /// a list can be -1 hence the signed long
     virtual void prefetch_lists (const idx_t *list_nos, int nlist) const;
 
+    /** software prefetch of the first nbytes of codes of a list, and of
+     * the first ids, that are scanned shortly (default does nothing).
+     * This is for in-memory lists, called by the IVF search a few lists
+     * ahead of the scan. */
+    virtual void prefetch_list_head (size_t list_no, size_t nbytes) const;
+
+    /// if true, get_ids is expensive (eg. the ids are compressed), so
+    /// IndexIVF scans the lists with store_pairs and then uses
+    /// get_single_id for the results only (default false)
+    virtual bool lazy_ids () const;
+
     /*************************
      * writing functions     */
 
@@ -109,6 +124,11 @@ struct InvertedLists {
     /// display some stats about the inverted lists
     void print_stats () const;
 
+    /** memory used by the inverted lists. The default is an estimate
+     * from the list sizes (codes and ids, no allocation overhead), for
+     * the types that do not implement it. */
+    virtual MemoryUsage memory_usage () const;
+
     /// sum up list sizes
     size_t compute_ntotal () const;
 
@@ -189,6 +209,8 @@ struct ArrayInvertedLists: InvertedLists {
     const uint8_t * get_codes (size_t list_no) const override;
     const idx_t * get_ids (size_t list_no) const override;
 
+    void prefetch_list_head (size_t list_no, size_t nbytes) const override;
+
     size_t add_entries (
            size_t list_no, size_t n_entry,
            const idx_t* ids, const uint8_t *code) override;
@@ -198,6 +220,21 @@ struct ArrayInvertedLists: InvertedLists {
 
     void resize (size_t list_no, size_t new_size) override;
 
+    /// append an empty list, returns its number
+    size_t add_list ();
+
+    /** copy the lists to new buffers, so that their memory is allocated
+     * on the NUMA node of the thread that does the copy (first touch).
+     *
+     * With parallel = true, the lists are distributed statically over
+     * the OpenMP threads, so with bound threads (OMP_PROC_BIND=spread)
+     * the lists are partitioned across the nodes. With parallel = false,
+     * all lists move to the node of the calling thread, see
+     * bind_thread_to_numa_node. */
+    void first_touch_lists (bool parallel = true);
+
+    MemoryUsage memory_usage () const override;
+
     virtual ~ArrayInvertedLists ();
 };
 
@@ -226,6 +263,45 @@ struct ReadOnlyInvertedLists: InvertedLists {
 };
 
 
+/** Frozen inverted lists where the codes and the ids of all lists are
+ * stored in two contiguous arenas, each aligned on 64 bytes. List i
+ * occupies entries offsets[i] to offsets[i + 1] of the arenas.
+ *
+ * Compared to ArrayInvertedLists, this avoids two heap allocations per
+ * list and keeps consecutive lists next to each other in memory. It is
+ * built from any inverted lists with a fixed code size, see
+ * IndexIVF::compact(). It is stored in the same format as
+ * ArrayInvertedLists.
+ */
+struct CompactedInvertedLists: ReadOnlyInvertedLists {
+    /// size nlist + 1, in number of entries
+    std::vector<size_t> offsets;
+
+    /// memory of both arenas
+    std::vector<uint8_t> buffer;
+
+    uint8_t *codes;   ///< size offsets[nlist] * code_size
+    idx_t *ids;       ///< size offsets[nlist]
+
+    /// copy the contents of il
+    explicit CompactedInvertedLists (const InvertedLists & il);
+
+    CompactedInvertedLists (const CompactedInvertedLists &) = delete;
+    CompactedInvertedLists & operator = (
+          const CompactedInvertedLists &) = delete;
+
+    size_t list_size(size_t list_no) const override;
+    const uint8_t * get_codes (size_t list_no) const override;
+    const idx_t * get_ids (size_t list_no) const override;
+
+    idx_t get_single_id (size_t list_no, size_t offset) const override;
+    const uint8_t * get_single_code (
+          size_t list_no, size_t offset) const override;
+
+    MemoryUsage memory_usage () const override;
+};
+
+
 /// Horizontal stack of inverted lists
 struct HStackInvertedLists: ReadOnlyInvertedLists {
 
@@ -356,6 +432,86 @@ struct StopWordsInvertedLists: ReadOnlyInvertedLists {
 };
 
 
+/** Cache of whole inverted lists in RAM in front of another inverted
+ * lists object (typically an OnDiskInvertedLists), with a budget of
+ * max_bytes for the codes + ids of the cached lists.
+ *
+ * A list is copied to the cache when it is accessed. When the budget
+ * is exceeded, the least recently used (EVICT_LRU) or least frequently
+ * used (EVICT_LFU) lists are evicted. Pinned lists are loaded
+ * immediately, count in the budget and are never evicted.
+ *
+ * Lists in use (returned by get_codes / get_ids and not released) are
+ * not evicted, so the budget can be exceeded temporarily. Lists that
+ * are larger than the budget are accessed directly in il.
+ */
+struct CachedInvertedLists: ReadOnlyInvertedLists {
+
+    enum EvictionPolicy {
+        EVICT_LRU,    ///< evict the least recently used list
+        EVICT_LFU,    ///< evict the list with the fewest accesses
+    };
+
+    const InvertedLists *il;
+    size_t max_bytes;
+    EvictionPolicy policy;
+
+    CachedInvertedLists (const InvertedLists *il, size_t max_bytes,
+                         EvictionPolicy policy = EVICT_LRU);
+
+    /// load a list in the cache and never evict it
+    void pin_list (size_t list_no);
+
+    /// make a pinned list evictable again
+    void unpin_list (size_t list_no);
+
+    /// drop all lists that are not pinned or in use
+    void clear ();
+
+    size_t list_size(size_t list_no) const override;
+    const uint8_t * get_codes (size_t list_no) const override;
+    const idx_t * get_ids (size_t list_no) const override;
+
+    void release_codes (size_t list_no, const uint8_t *codes) const override;
+    void release_ids (size_t list_no, const idx_t *ids) const override;
+
+    idx_t get_single_id (size_t list_no, size_t offset) const override;
+
+    const uint8_t * get_single_code (
+           size_t list_no, size_t offset) const override;
+
+    void prefetch_lists (const idx_t *list_nos, int nlist) const override;
+
+    bool lazy_ids () const override;
+
+    /*************************
+     * statistics            */
+
+    /// nb of bytes in the cache
+    size_t cached_bytes () const;
+
+    /// nb of lists in the cache
+    size_t cached_lists () const;
+
+    /// number of get_codes calls served from the cache / from il, and
+    /// number of evicted lists
+    size_t nhit () const;
+    size_t nmiss () const;
+    size_t nevict () const;
+
+    /// nhit / (nhit + nmiss)
+    double hit_rate () const;
+
+    void reset_stats ();
+
+    ~CachedInvertedLists () override;
+
+    // private
+    struct Cache;
+    Cache *cache;
+};
+
+
 } // namespace faiss
 
 
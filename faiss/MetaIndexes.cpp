@@ -84,9 +84,10 @@ void IndexIDMapTemplate<IndexT>::add_with_ids
 template <typename IndexT>
 void IndexIDMapTemplate<IndexT>::search
     (idx_t n, const typename IndexT::component_t *x, idx_t k,
-     typename IndexT::distance_t *distances, typename IndexT::idx_t *labels) const
+     typename IndexT::distance_t *distances, typename IndexT::idx_t *labels,
+     const SearchParameters *params) const
 {
-    index->search (n, x, k, distances, labels);
+    index->search (n, x, k, distances, labels, params);
     idx_t *li = labels;
 #pragma omp parallel for
     for (idx_t i = 0; i < n * k; i++) {
@@ -100,6 +101,8 @@ void IndexIDMapTemplate<IndexT>::range_search
     (typename IndexT::idx_t n, const typename IndexT::component_t *x,
      typename IndexT::distance_t radius, RangeSearchResult *result) const
 {
+  FAISS_THROW_IF_NOT_MSG (!result->callback,
+                          "streaming range search not supported");
   index->range_search(n, x, radius, result);
 #pragma omp parallel for
   for (idx_t i = 0; i < result->lims[result->nq]; i++) {
@@ -146,6 +149,15 @@ size_t IndexIDMapTemplate<IndexT>::remove_ids (const IDSelector & sel)
     return nremove;
 }
 
+template <typename IndexT>
+MemoryUsage IndexIDMapTemplate<IndexT>::memory_usage () const
+{
+    MemoryUsage mu = IndexT::memory_usage ();
+    mu.add ("index", index->memory_usage ());
+    mu.add ("id_map", id_map);
+    return mu;
+}
+
 template <typename IndexT>
 IndexIDMapTemplate<IndexT>::~IndexIDMapTemplate ()
 {
@@ -160,7 +172,7 @@ IndexIDMapTemplate<IndexT>::~IndexIDMapTemplate ()
 
 template <typename IndexT>
 IndexIDMap2Template<IndexT>::IndexIDMap2Template (IndexT *index):
-    IndexIDMapTemplate<IndexT> (index)
+    IndexIDMapTemplate<IndexT> (index), use_compact_rev_map (false)
 {}
 
 template <typename IndexT>
@@ -171,7 +183,11 @@ void IndexIDMap2Template<IndexT>::add_with_ids
     size_t prev_ntotal = this->ntotal;
     IndexIDMapTemplate<IndexT>::add_with_ids (n, x, xids);
     for (size_t i = prev_ntotal; i < this->ntotal; i++) {
-        rev_map [this->id_map [i]] = i;
+        if (use_compact_rev_map) {
+            compact_rev_map.set (this->id_map [i], i);
+        } else {
+            rev_map [this->id_map [i]] = i;
+        }
     }
 }
 
@@ -179,11 +195,29 @@ template <typename IndexT>
 void IndexIDMap2Template<IndexT>::construct_rev_map ()
 {
     rev_map.clear ();
+    compact_rev_map.clear ();
+    if (use_compact_rev_map) {
+        std::vector<idx_t> pos (this->ntotal);
+        for (size_t i = 0; i < this->ntotal; i++) {
+            pos[i] = i;
+        }
+        compact_rev_map.build (this->ntotal, this->id_map.data(), pos.data());
+        return;
+    }
     for (size_t i = 0; i < this->ntotal; i++) {
         rev_map [this->id_map [i]] = i;
     }
 }
 
+template <typename IndexT>
+void IndexIDMap2Template<IndexT>::set_compact_rev_map (bool compact)
+{
+    if (compact != use_compact_rev_map) {
+        use_compact_rev_map = compact;
+        construct_rev_map ();
+    }
+}
+
 
 template <typename IndexT>
 size_t IndexIDMap2Template<IndexT>::remove_ids(const IDSelector& sel)
@@ -198,6 +232,14 @@ template <typename IndexT>
 void IndexIDMap2Template<IndexT>::reconstruct
     (idx_t key, typename IndexT::component_t * recons) const
 {
+    if (use_compact_rev_map) {
+        idx_t i = compact_rev_map.get (key);
+        if (i < 0) {
+            FAISS_THROW_FMT ("key %" PRId64 " not found", key);
+        }
+        this->index->reconstruct (i, recons);
+        return;
+    }
     try {
         this->index->reconstruct (rev_map.at (key), recons);
     } catch (const std::out_of_range& e) {
@@ -205,6 +247,18 @@ void IndexIDMap2Template<IndexT>::reconstruct
     }
 }
 
+template <typename IndexT>
+MemoryUsage IndexIDMap2Template<IndexT>::memory_usage () const
+{
+    MemoryUsage mu = IndexIDMapTemplate<IndexT>::memory_usage ();
+    if (use_compact_rev_map) {
+        mu.add ("rev_map", compact_rev_map.memory_usage ());
+    } else {
+        mu.add_hash_table ("rev_map", rev_map);
+    }
+    return mu;
+}
+
 
 // explicit template instantiations
 
@@ -257,8 +311,11 @@ void IndexSplitVectors::add(idx_t /*n*/, const float* /*x*/) {
 
 void IndexSplitVectors::search (
            idx_t n, const float *x, idx_t k,
-           float *distances, idx_t *labels) const
+           float *distances, idx_t *labels,
+           const SearchParameters *params) const
 {
+    FAISS_THROW_IF_NOT_MSG (!params,
+            "search params not supported for this index");
     FAISS_THROW_IF_NOT_MSG (k == 1,
                       "search implemented only for k=1");
     FAISS_THROW_IF_NOT_MSG (sum_d == d,
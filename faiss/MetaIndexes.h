@@ -13,6 +13,7 @@
 #include <vector>
 #include <unordered_map>
 #include <faiss/Index.h>
+#include <faiss/DirectMap.h>
 #include <faiss/IndexShards.h>
 #include <faiss/IndexReplicas.h>
 
@@ -40,7 +41,8 @@ struct IndexIDMapTemplate : IndexT {
     void search(
         idx_t n, const component_t* x, idx_t k,
         distance_t* distances,
-        idx_t* labels) const override;
+        idx_t* labels,
+        const SearchParameters *params = nullptr) const override;
 
     void train(idx_t n, const component_t* x) override;
 
@@ -52,6 +54,8 @@ struct IndexIDMapTemplate : IndexT {
     void range_search (idx_t n, const component_t *x, distance_t radius,
                        RangeSearchResult *result) const override;
 
+    MemoryUsage memory_usage () const override;
+
     ~IndexIDMapTemplate () override;
     IndexIDMapTemplate () {own_fields=false; index=nullptr; }
 };
@@ -70,19 +74,29 @@ struct IndexIDMap2Template : IndexIDMapTemplate<IndexT> {
 
     std::unordered_map<idx_t, idx_t> rev_map;
 
+    /// if set, the reverse map is stored in compact_rev_map instead of
+    /// rev_map, which uses much less memory for large numbers of ids
+    bool use_compact_rev_map;
+    CompactIdMap compact_rev_map;
+
     explicit IndexIDMap2Template (IndexT *index);
 
     /// make the rev_map from scratch
     void construct_rev_map ();
 
+    /// switch between the two reverse map representations
+    void set_compact_rev_map (bool compact);
+
     void add_with_ids(idx_t n, const component_t* x, const idx_t* xids) override;
 
     size_t remove_ids(const IDSelector& sel) override;
 
     void reconstruct (idx_t key, component_t * recons) const override;
 
+    MemoryUsage memory_usage () const override;
+
     ~IndexIDMap2Template() override {}
-    IndexIDMap2Template () {}
+    IndexIDMap2Template (): use_compact_rev_map (false) {}
 };
 
 using IndexIDMap2 = IndexIDMap2Template<Index>;
@@ -110,7 +124,8 @@ struct IndexSplitVectors: Index {
         const float* x,
         idx_t k,
         float* distances,
-        idx_t* labels) const override;
+        idx_t* labels,
+        const SearchParameters *params = nullptr) const override;
 
     void train(idx_t n, const float* x) override;
 
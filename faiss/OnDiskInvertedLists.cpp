@@ -11,6 +11,9 @@
 
 #include <pthread.h>
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <unordered_set>
 
 #include <sys/mman.h>
@@ -20,6 +23,7 @@
 
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/utils/utils.h>
+#include <faiss/utils/hamming.h>
 
 #include <faiss/impl/io.h>
 #include <faiss/impl/io_macros.h>
@@ -40,22 +44,35 @@ struct LockLevels {
      *    a single thread can hold lock2, if it holds lock1(n) for some n
      *    a single thread can hold lock3, if it holds lock1(n) for some n
      *       AND lock2 AND no other thread holds lock1(m) for m != n
+     *
+     * The lock1s are striped: lock1(n) is a mutex shared by the lists
+     * n mod nstripe, so that writers to different lists do not contend
+     * on a global mutex. The nb of lock1 holders is an atomic counter
+     * that lock3 waits on; mutex1 is taken by lock1 only while a lock3
+     * is in use.
      */
+    static const int nstripe = 1024;
+    pthread_mutex_t stripes[nstripe];
+
     pthread_mutex_t mutex1;
     pthread_cond_t level1_cv;
     pthread_cond_t level2_cv;
     pthread_cond_t level3_cv;
 
-    std::unordered_set<int> level1_holders; // which level1 locks are held
+    std::atomic<int> n_level1; // nb of lock1 holders
     int n_level2; // nb threads that wait on level2
-    bool level3_in_use; // a threads waits on level3
+    std::atomic<bool> level3_in_use; // a threads waits on level3
     bool level2_in_use;
 
     LockLevels() {
+        for (int i = 0; i < nstripe; i++) {
+            pthread_mutex_init(&stripes[i], nullptr);
+        }
         pthread_mutex_init(&mutex1, nullptr);
         pthread_cond_init(&level1_cv, nullptr);
         pthread_cond_init(&level2_cv, nullptr);
         pthread_cond_init(&level3_cv, nullptr);
+        n_level1 = 0;
         n_level2 = 0;
         level2_in_use = false;
         level3_in_use = false;
@@ -66,27 +83,46 @@ struct LockLevels {
         pthread_cond_destroy(&level2_cv);
         pthread_cond_destroy(&level3_cv);
         pthread_mutex_destroy(&mutex1);
+        for (int i = 0; i < nstripe; i++) {
+            pthread_mutex_destroy(&stripes[i]);
+        }
     }
 
-    void lock_1(int no) {
+    pthread_mutex_t *stripe(int no) {
+        return &stripes[(unsigned)no % nstripe];
+    }
+
+    void signal_level3() {
         pthread_mutex_lock(&mutex1);
-        while (level3_in_use || level1_holders.count(no) > 0) {
-            pthread_cond_wait(&level1_cv, &mutex1);
-        }
-        level1_holders.insert(no);
+        pthread_cond_signal(&level3_cv);
         pthread_mutex_unlock(&mutex1);
     }
 
+    void lock_1(int no) {
+        pthread_mutex_lock(stripe(no));
+        for (;;) {
+            // lock_3 sets level3_in_use before reading n_level1, so
+            // either it sees this holder or we see it
+            n_level1++;
+            if (!level3_in_use) {
+                break;
+            }
+            n_level1--;
+            pthread_mutex_lock(&mutex1);
+            pthread_cond_signal(&level3_cv);
+            while (level3_in_use) {
+                pthread_cond_wait(&level1_cv, &mutex1);
+            }
+            pthread_mutex_unlock(&mutex1);
+        }
+    }
+
     void unlock_1(int no) {
-        pthread_mutex_lock(&mutex1);
-        assert(level1_holders.count(no) == 1);
-        level1_holders.erase(no);
+        n_level1--;
         if (level3_in_use) { // a writer is waiting
-            pthread_cond_signal(&level3_cv);
-        } else {
-            pthread_cond_broadcast(&level1_cv);
+            signal_level3();
         }
-        pthread_mutex_unlock(&mutex1);
+        pthread_mutex_unlock(stripe(no));
     }
 
     void lock_2() {
@@ -115,7 +151,7 @@ struct LockLevels {
         level3_in_use = true;
         // wait until there are no level1 holders anymore except the
         // ones that are waiting on level2 (we are holding lock2)
-        while (level1_holders.size() > n_level2) {
+        while (n_level1 > n_level2) {
             pthread_cond_wait(&level3_cv, &mutex1);
         }
         // don't release the lock!
@@ -130,11 +166,8 @@ struct LockLevels {
 
     void print () {
         pthread_mutex_lock(&mutex1);
-        printf("State: level3_in_use=%d n_level2=%d level1_holders: [", level3_in_use, n_level2);
-        for (int k : level1_holders) {
-            printf("%d ", k);
-        }
-        printf("]\n");
+        printf("State: level3_in_use=%d n_level2=%d n_level1=%d\n",
+               (int)level3_in_use, n_level2, (int)n_level1);
         pthread_mutex_unlock(&mutex1);
     }
 
@@ -261,9 +294,99 @@ struct OnDiskInvertedLists::OngoingPrefetch {
 int OnDiskInvertedLists::OngoingPrefetch::global_cs = 0;
 
 
+/**********************************************
+ * Kernel readahead
+ **********************************************/
+
+namespace {
+
+struct ByteRange {
+    size_t begin, end;
+    bool operator < (const ByteRange & other) const {
+        return begin < other.begin;
+    }
+};
+
+/* page-aligned ranges of the codes and ids of the lists, in the order
+ * of list_nos and up to max_bytes */
+std::vector<ByteRange> collect_list_ranges (
+        const OnDiskInvertedLists & od, LockLevels & locks,
+        const Index::idx_t *list_nos, int n, size_t max_bytes)
+{
+    size_t page_size = sysconf (_SC_PAGESIZE);
+    auto add_range = [&] (std::vector<ByteRange> & ranges,
+                          size_t begin, size_t size) {
+        size_t end = std::min (begin + size, od.totsize);
+        begin = begin / page_size * page_size;
+        ranges.push_back (ByteRange {begin, end});
+        return end - begin;
+    };
+
+    std::vector<ByteRange> ranges;
+    std::unordered_set<Index::idx_t> seen;
+    size_t nbytes = 0;
+    for (int i = 0; i < n; i++) {
+        Index::idx_t list_no = list_nos[i];
+        if (list_no < 0 || !seen.insert (list_no).second) {
+            continue;
+        }
+        locks.lock_1 (list_no);
+        const OnDiskOneList & l = od.lists[list_no];
+        if (l.size > 0) {
+            // codes, then ids at the end of the allocated slot
+            nbytes += add_range (ranges, l.offset, l.size * od.code_size);
+            nbytes += add_range (
+                  ranges, l.offset + l.capacity * od.code_size,
+                  l.size * sizeof (Index::idx_t));
+        }
+        locks.unlock_1 (list_no);
+        if (max_bytes > 0 && nbytes >= max_bytes) {
+            break;
+        }
+    }
+    return ranges;
+}
+
+} // anonymous namespace
+
+
 void OnDiskInvertedLists::prefetch_lists (const idx_t *list_nos, int n) const
 {
-    pf->prefetch_lists (list_nos, n);
+    if (prefetch_mode == PREFETCH_THREADS) {
+        pf->prefetch_lists (list_nos, n);
+        return;
+    }
+    if (ptr == nullptr) {
+        return;
+    }
+
+    std::vector<ByteRange> ranges = collect_list_ranges (
+            *this, *locks, list_nos, n, prefetch_max_bytes);
+
+    // sort by offset and merge the ranges that are close, so that the
+    // kernel gets few large sequential requests
+    std::sort (ranges.begin(), ranges.end());
+    size_t nmerged = 0;
+    for (const ByteRange & r: ranges) {
+        if (nmerged > 0 &&
+            r.begin <= ranges[nmerged - 1].end + prefetch_merge_gap) {
+            ranges[nmerged - 1].end =
+                std::max (ranges[nmerged - 1].end, r.end);
+        } else {
+            ranges[nmerged++] = r;
+        }
+    }
+    ranges.resize (nmerged);
+
+    // madvise does not wait for the I/O to complete
+    size_t nbytes = 0;
+    for (const ByteRange & r: ranges) {
+        int err = madvise (ptr + r.begin, r.end - r.begin, MADV_WILLNEED);
+        if (err == 0) {
+            nbytes += r.end - r.begin;
+        }
+    }
+    prefetch_nbytes.fetch_add (nbytes, std::memory_order_relaxed);
 }
 
 
@@ -281,7 +404,9 @@ void OnDiskInvertedLists::do_mmap ()
     FAISS_THROW_IF_NOT_FMT (f, "could not open %s in mode %s: %s",
                             filename.c_str(), rw_flags, strerror(errno));
 
-    uint8_t * ptro = (uint8_t*)mmap (nullptr, totsize,
+    // the pages beyond totsize are not accessed before the file grows
+    size_t size = read_only ? totsize : std::max (totsize, reserve_size);
+    uint8_t * ptro = (uint8_t*)mmap (nullptr, size,
                           prot, MAP_SHARED, fileno (f), 0);
 
     FAISS_THROW_IF_NOT_FMT (ptro != MAP_FAILED,
@@ -289,18 +414,26 @@ void OnDiskInvertedLists::do_mmap ()
                             filename.c_str(),
                             strerror(errno));
     ptr = ptro;
+    map_size = size;
     fclose (f);
 
 }
 
+bool OnDiskInvertedLists::needs_remap (size_t new_size) const
+{
+    return ptr == nullptr || new_size > map_size;
+}
+
 void OnDiskInvertedLists::update_totsize (size_t new_size)
 {
+    bool remap = needs_remap (new_size);
 
     // unmap file
-    if (ptr != nullptr) {
-        int err = munmap (ptr, totsize);
+    if (remap && ptr != nullptr) {
+        int err = munmap (ptr, map_size);
         FAISS_THROW_IF_NOT_FMT (err == 0, "munmap error: %s",
                                 strerror(errno));
+        ptr = nullptr;
     }
     if (totsize == 0) {
         // must create file before truncating it
@@ -331,7 +464,9 @@ void OnDiskInvertedLists::update_totsize (size_t new_size)
     FAISS_THROW_IF_NOT_FMT (err == 0, "truncate %s to %ld: %s",
                             filename.c_str(), totsize,
                             strerror(errno));
-    do_mmap ();
+    if (remap) {
+        do_mmap ();
+    }
 }
 
 
@@ -367,9 +502,18 @@ OnDiskInvertedLists::OnDiskInvertedLists (
     totsize (0),
     ptr (nullptr),
     read_only (false),
+    reserve_size (0),
+    max_grow_size ((size_t)1 << 30),
     locks (new LockLevels ()),
     pf (new OngoingPrefetch (this)),
-    prefetch_nthread (32)
+    prefetch_nthread (32),
+    prefetch_mode (PREFETCH_THREADS),
+    prefetch_max_bytes (0),
+    prefetch_merge_gap (64 * 1024),
+    prefetch_nbytes (0),
+    retired_ptr (nullptr),
+    retired_size (0),
+    map_size (0)
 {
     lists.resize (nlist);
 
@@ -387,12 +531,15 @@ OnDiskInvertedLists::~OnDiskInvertedLists ()
 
     // unmap all lists
     if (ptr != nullptr) {
-        int err = munmap (ptr, totsize);
+        int err = munmap (ptr, map_size);
         if (err != 0) {
             fprintf(stderr, "mumap error: %s",
                     strerror(errno));
         }
     }
+    if (retired_ptr != nullptr) {
+        munmap (retired_ptr, retired_size);
+    }
     delete locks;
 }
 
@@ -514,13 +661,22 @@ size_t OnDiskInvertedLists::allocate_slot (size_t capacity) {
     }
 
     if (it == slots.end()) {
-        // not enough capacity
-        size_t new_size = totsize == 0 ? 32 : totsize * 2;
-        while (new_size - totsize < capacity)
-            new_size *= 2;
-        locks->lock_3 ();
+        // not enough capacity: grow by the size of the file, up to
+        // max_grow_size at a time
+        size_t grow = std::max (totsize, (size_t)32);
+        if (max_grow_size > 0) {
+            grow = std::min (grow, max_grow_size);
+        }
+        size_t new_size = totsize + std::max (grow, capacity);
+        // other threads access the mapping only if it is moved
+        bool remap = needs_remap (new_size);
+        if (remap) {
+            locks->lock_3 ();
+        }
         update_totsize(new_size);
-        locks->unlock_3 ();
+        if (remap) {
+            locks->unlock_3 ();
+        }
         it = slots.begin();
         while (it != slots.end() && it->capacity < capacity) {
             it++;
@@ -679,6 +835,146 @@ void OnDiskInvertedLists::crop_invlists(size_t l0, size_t l1)
 }
 
 
+size_t OnDiskInvertedLists::free_bytes () const
+{
+    size_t tot = 0;
+    for (const Slot & slot : slots) {
+        tot += slot.capacity;
+    }
+    return tot;
+}
+
+MemoryUsage OnDiskInvertedLists::memory_usage () const
+{
+    MemoryUsage mu = MemoryUsage::object ("OnDiskInvertedLists");
+    mu.add ("lists", lists);
+    // std::list nodes have a next and a prev pointer
+    mu.add ("slots", slots.size() * sizeof (Slot),
+            slots.size() * (sizeof (Slot) + 2 * sizeof (void*)));
+    size_t ntotal = compute_ntotal ();
+    MemoryUsage & data = mu.add (MemoryUsage (
+          "data", ntotal * (code_size + sizeof (idx_t)), 0));
+    data.mapped = map_size;
+    if (retired_ptr) {
+        mu.add (MemoryUsage ("retired")).mapped = retired_size;
+    }
+    return mu;
+}
+
+
+size_t OnDiskInvertedLists::compact (const idx_t *list_order)
+{
+    FAISS_THROW_IF_NOT (!read_only);
+
+    std::vector<idx_t> order (nlist);
+    if (list_order) {
+        std::vector<bool> seen (nlist);
+        for (size_t k = 0; k < nlist; k++) {
+            idx_t j = list_order[k];
+            FAISS_THROW_IF_NOT_MSG (j >= 0 && j < nlist && !seen[j],
+                                    "list_order is not a permutation");
+            seen[j] = true;
+            order[k] = j;
+        }
+    } else {
+        for (size_t k = 0; k < nlist; k++) {
+            order[k] = k;
+        }
+    }
+
+    // block the writers: they all hold a lock1, so take one on a
+    // non-existing list number and then lock2 + lock3 (as allocate_slot)
+    locks->lock_1 (-1);
+    locks->lock_2 ();
+    locks->lock_3 ();
+
+    std::string tmpname = filename + ".compact";
+    std::vector<List> new_lists (nlist);
+    size_t new_totsize = 0;
+    uint8_t *new_ptr = nullptr;
+    size_t new_map_size = 0;
+    std::string err_msg;
+
+    for (size_t k = 0; k < nlist; k++) {
+        size_t j = order[k];
+        if (lists[j].size == 0) {
+            continue;
+        }
+        List & l = new_lists[j];
+        l.size = l.capacity = lists[j].size;
+        l.offset = new_totsize;
+        new_totsize += l.size * (sizeof(idx_t) + code_size);
+    }
+
+    FILE *f = fopen (tmpname.c_str(), "w+");
+    if (!f) {
+        err_msg = "could not open " + tmpname + ": " + strerror(errno);
+    } else if (ftruncate (fileno (f), new_totsize) != 0) {
+        err_msg = "could not resize " + tmpname + ": " + strerror(errno);
+    } else if (new_totsize > 0) {
+        new_map_size = std::max (new_totsize, reserve_size);
+        new_ptr = (uint8_t*)mmap (nullptr, new_map_size,
+                                  PROT_WRITE | PROT_READ, MAP_SHARED,
+                                  fileno (f), 0);
+        if (new_ptr == MAP_FAILED) {
+            new_ptr = nullptr;
+            err_msg = "could not mmap " + tmpname + ": " + strerror(errno);
+        }
+    }
+    if (f) {
+        fclose (f);
+    }
+
+    if (err_msg.empty()) {
+#pragma omp parallel for schedule(dynamic)
+        for (size_t j = 0; j < nlist; j++) {
+            const List & l = new_lists[j];
+            if (l.size == 0) {
+                continue;
+            }
+            memcpy (new_ptr + l.offset, get_codes (j), l.size * code_size);
+            memcpy (new_ptr + l.offset + l.capacity * code_size,
+                    get_ids (j), l.size * sizeof(idx_t));
+        }
+        if (rename (tmpname.c_str(), filename.c_str()) != 0) {
+            err_msg = "could not rename " + tmpname + " to " +
+                filename + ": " + strerror(errno);
+        }
+    }
+
+    if (!err_msg.empty()) {
+        if (new_ptr) {
+            munmap (new_ptr, new_map_size);
+        }
+        unlink (tmpname.c_str());
+        locks->unlock_3 ();
+        locks->unlock_2 ();
+        locks->unlock_1 (-1);
+        FAISS_THROW_MSG (err_msg);
+    }
+
+    // the old file was replaced, but its mapping stays valid for the
+    // searches that are running
+    if (retired_ptr != nullptr) {
+        munmap (retired_ptr, retired_size);
+    }
+    retired_ptr = ptr;
+    retired_size = map_size;
+
+    lists.swap (new_lists);
+    ptr = new_ptr;
+    map_size = new_map_size;
+    totsize = new_totsize;
+    slots.clear ();
+
+    locks->unlock_3 ();
+    locks->unlock_2 ();
+    locks->unlock_1 (-1);
+
+    return new_totsize;
+}
+
+
 void OnDiskInvertedLists::set_all_lists_sizes(const size_t *sizes)
 {
     size_t ofs = 0;
@@ -690,6 +986,558 @@ void OnDiskInvertedLists::set_all_lists_sizes(const size_t *sizes)
 
 }
 
+/*******************************************************
+ * OnDiskCompressedInvertedLists
+ *******************************************************/
+
+OnDiskCompressedInvertedLists::List::List ():
+    size (0), offset (0), nbits (0)
+{}
+
+OnDiskCompressedInvertedLists::OnDiskCompressedInvertedLists (
+        size_t nlist, size_t code_size, const char *filename):
+    ReadOnlyInvertedLists (nlist, code_size),
+    filename (filename),
+    totsize (0),
+    ptr (nullptr)
+{
+    lists.resize (nlist);
+}
+
+OnDiskCompressedInvertedLists::OnDiskCompressedInvertedLists ():
+    OnDiskCompressedInvertedLists (0, 0, "")
+{}
+
+OnDiskCompressedInvertedLists::~OnDiskCompressedInvertedLists ()
+{
+    if (ptr != nullptr) {
+        int err = munmap (ptr, totsize);
+        if (err != 0) {
+            fprintf(stderr, "mumap error: %s",
+                    strerror(errno));
+        }
+    }
+}
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+size_t nblock_of (size_t size)
+{
+    size_t bs = OnDiskCompressedInvertedLists::id_block_size;
+    return (size + bs - 1) / bs;
+}
+
+/* the decoder reads 8 bytes at a time, hence the padding.
+ * Differences on more than 56 bits are stored as full 64-bit words */
+size_t packed_size (size_t size, size_t nbits)
+{
+    return (size * nbits + 7) / 8 + 8;
+}
+
+size_t list_bytes (const OnDiskCompressedInvertedLists::List & l,
+                   size_t code_size)
+{
+    size_t nbytes = nblock_of (l.size) * sizeof (idx_t) +
+        l.size * code_size + packed_size (l.size, l.nbits);
+    return (nbytes + 7) & ~size_t(7);
+}
+
+/* gather the entries of list j from all the invlists, sorted by id.
+ * perm refers to the entries in the order of the concatenated lists */
+void gather_sorted_ids (const InvertedLists **ils, int n_il, size_t j,
+                        std::vector<idx_t> & ids,
+                        std::vector<size_t> & perm)
+{
+    ids.clear ();
+    for (int i = 0; i < n_il; i++) {
+        size_t n = ils[i]->list_size (j);
+        InvertedLists::ScopedIds sids (ils[i], j);
+        ids.insert (ids.end(), sids.get(), sids.get() + n);
+    }
+    perm.resize (ids.size ());
+    for (size_t i = 0; i < perm.size(); i++) {
+        perm[i] = i;
+    }
+    std::sort (perm.begin(), perm.end(), [&ids] (size_t a, size_t b) {
+        return ids[a] < ids[b];
+    });
+}
+
+size_t nbits_for_ids (const std::vector<idx_t> & ids,
+                      const std::vector<size_t> & perm)
+{
+    size_t bs = OnDiskCompressedInvertedLists::id_block_size;
+    uint64_t maxdiff = 0;
+    for (size_t b = 0; b < perm.size(); b += bs) {
+        size_t e = std::min (b + bs, perm.size()) - 1;
+        maxdiff = std::max (maxdiff, uint64_t (ids[perm[e]] - ids[perm[b]]));
+    }
+    size_t nbits = 0;
+    while (nbits < 64 && (maxdiff >> nbits) != 0) {
+        nbits++;
+    }
+    return nbits > 56 ? 64 : nbits;
+}
+
+} // anonymous namespace
+
+
+size_t OnDiskCompressedInvertedLists::merge_from (
+          const InvertedLists **ils, int n_il, bool verbose)
+{
+    for (int i = 0; i < n_il; i++) {
+        const InvertedLists *il = ils[i];
+        FAISS_THROW_IF_NOT (il->nlist == nlist && il->code_size == code_size);
+    }
+
+    if (ptr != nullptr) {
+        do_munmap ();
+    }
+
+    double t0 = getmillisecs();
+
+    // first pass to get the sizes of the lists
+#pragma omp parallel
+    {
+        std::vector<idx_t> ids;
+        std::vector<size_t> perm;
+#pragma omp for
+        for (size_t j = 0; j < nlist; j++) {
+            gather_sorted_ids (ils, n_il, j, ids, perm);
+            lists[j].size = ids.size ();
+            lists[j].nbits = nbits_for_ids (ids, perm);
+        }
+    }
+
+    size_t ntotal = 0;
+    totsize = 0;
+    for (size_t j = 0; j < nlist; j++) {
+        lists[j].offset = totsize;
+        totsize += list_bytes (lists[j], code_size);
+        ntotal += lists[j].size;
+    }
+
+    FILE *f = fopen (filename.c_str(), "w");
+    FAISS_THROW_IF_NOT_FMT (f, "could not open %s in mode w: %s",
+                            filename.c_str(), strerror(errno));
+    int fd = fileno (f);
+    int err = ftruncate (fd, totsize);
+    FAISS_THROW_IF_NOT_FMT (err == 0, "could not resize %s: %s",
+                            filename.c_str(), strerror(errno));
+
+    // second pass to encode and write the lists
+    size_t nerr = 0;
+#pragma omp parallel reduction(+: nerr)
+    {
+        std::vector<idx_t> ids;
+        std::vector<size_t> perm, dest;
+        std::vector<uint8_t> buf;
+#pragma omp for
+        for (size_t j = 0; j < nlist; j++) {
+            const List & l = lists[j];
+            if (l.size == 0) {
+                continue;
+            }
+            gather_sorted_ids (ils, n_il, j, ids, perm);
+
+            buf.assign (list_bytes (l, code_size), 0);
+            idx_t *first_ids = (idx_t*)buf.data();
+            uint8_t *list_codes = buf.data() + nblock_of (l.size) *
+                sizeof (idx_t);
+            uint8_t *packed = list_codes + l.size * code_size;
+
+            BitstringWriter wr (packed, packed_size (l.size, l.nbits));
+            for (size_t e = 0; e < l.size; e++) {
+                idx_t id = ids[perm[e]];
+                if (e % id_block_size == 0) {
+                    first_ids[e / id_block_size] = id;
+                }
+                wr.write (id - first_ids[e / id_block_size], l.nbits);
+            }
+
+            // copy the codes in the order of the ids
+            dest.resize (l.size);
+            for (size_t e = 0; e < l.size; e++) {
+                dest[perm[e]] = e;
+            }
+            size_t e0 = 0;
+            for (int i = 0; i < n_il; i++) {
+                InvertedLists::ScopedCodes scodes (ils[i], j);
+                size_t n = ils[i]->list_size (j);
+                for (size_t e = 0; e < n; e++) {
+                    memcpy (list_codes + dest[e0 + e] * code_size,
+                            scodes.get() + e * code_size, code_size);
+                }
+                e0 += n;
+            }
+            ssize_t nw = pwrite (fd, buf.data(), buf.size(), l.offset);
+            if (nw != (ssize_t)buf.size()) {
+                nerr++;
+            }
+        }
+    }
+    fclose (f);
+    FAISS_THROW_IF_NOT_FMT (nerr == 0, "write error on %s",
+                            filename.c_str());
+
+    if (verbose) {
+        printf ("wrote %zd lists, %zd entries to %s in %.3f s\n",
+                nlist, ntotal, filename.c_str(),
+                (getmillisecs() - t0) / 1000.0);
+    }
+
+    do_mmap ();
+    return ntotal;
+}
+
+size_t OnDiskCompressedInvertedLists::merge_from_1 (
+          const InvertedLists *il, bool verbose)
+{
+    return merge_from (&il, 1, verbose);
+}
+
+void OnDiskCompressedInvertedLists::do_mmap ()
+{
+    if (totsize == 0) {
+        return;
+    }
+    FILE *f = fopen (filename.c_str(), "r");
+    FAISS_THROW_IF_NOT_FMT (f, "could not open %s in mode r: %s",
+                            filename.c_str(), strerror(errno));
+
+    uint8_t * ptro = (uint8_t*)mmap (nullptr, totsize,
+                          PROT_READ, MAP_SHARED, fileno (f), 0);
+    fclose (f);
+
+    FAISS_THROW_IF_NOT_FMT (ptro != MAP_FAILED,
+                            "could not mmap %s: %s",
+                            filename.c_str(),
+                            strerror(errno));
+    ptr = ptro;
+}
+
+void OnDiskCompressedInvertedLists::do_munmap ()
+{
+    int err = munmap (ptr, totsize);
+    FAISS_THROW_IF_NOT_FMT (err == 0, "munmap error: %s",
+                            strerror(errno));
+    ptr = nullptr;
+}
+
+size_t OnDiskCompressedInvertedLists::list_size (size_t list_no) const
+{
+    return lists[list_no].size;
+}
+
+const idx_t * OnDiskCompressedInvertedLists::block_first_ids (
+          size_t list_no) const
+{
+    return (const idx_t*)(ptr + lists[list_no].offset);
+}
+
+const uint8_t * OnDiskCompressedInvertedLists::get_codes (
+          size_t list_no) const
+{
+    if (lists[list_no].size == 0) {
+        return nullptr;
+    }
+    return ptr + lists[list_no].offset +
+        nblock_of (lists[list_no].size) * sizeof (idx_t);
+}
+
+const uint8_t * OnDiskCompressedInvertedLists::packed_ids (
+          size_t list_no) const
+{
+    return get_codes (list_no) + lists[list_no].size * code_size;
+}
+
+size_t OnDiskCompressedInvertedLists::ids_size (size_t list_no) const
+{
+    const List & l = lists[list_no];
+    return nblock_of (l.size) * sizeof (idx_t) + (l.size * l.nbits + 7) / 8;
+}
+
+MemoryUsage OnDiskCompressedInvertedLists::memory_usage () const
+{
+    MemoryUsage mu = MemoryUsage::object ("OnDiskCompressedInvertedLists");
+    mu.add ("lists", lists);
+    MemoryUsage & data = mu.add (MemoryUsage ("data", totsize, 0));
+    data.mapped = ptr ? totsize : 0;
+    return mu;
+}
+
+idx_t OnDiskCompressedInvertedLists::get_single_id (
+          size_t list_no, size_t offset) const
+{
+    const List & l = lists[list_no];
+    assert (offset < l.size);
+    idx_t first = block_first_ids (list_no)[offset / id_block_size];
+    const uint8_t *packed = packed_ids (list_no);
+    uint64_t diff;
+    if (l.nbits == 64) {
+        memcpy (&diff, packed + offset * 8, 8);
+    } else {
+        size_t i = offset * l.nbits;
+        memcpy (&diff, packed + (i >> 3), 8);
+        diff = (diff >> (i & 7)) & ((uint64_t(1) << l.nbits) - 1);
+    }
+    return first + diff;
+}
+
+const idx_t * OnDiskCompressedInvertedLists::get_ids (size_t list_no) const
+{
+    size_t n = lists[list_no].size;
+    idx_t *ids = new idx_t [n];
+    for (size_t i = 0; i < n; i++) {
+        ids[i] = get_single_id (list_no, i);
+    }
+    return ids;
+}
+
+void OnDiskCompressedInvertedLists::release_ids (
+          size_t, const idx_t *ids) const
+{
+    delete [] ids;
+}
+
+bool OnDiskCompressedInvertedLists::lazy_ids () const
+{
+    return true;
+}
+
+void OnDiskCompressedInvertedLists::prefetch_lists (
+         const idx_t *list_nos, int n) const
+{
+    if (ptr == nullptr) {
+        return;
+    }
+    size_t page_size = sysconf (_SC_PAGESIZE);
+    for (int i = 0; i < n; i++) {
+        idx_t list_no = list_nos[i];
+        if (list_no < 0 || lists[list_no].size == 0) {
+            continue;
+        }
+        size_t begin = lists[list_no].offset / page_size * page_size;
+        size_t end = lists[list_no].offset +
+            list_bytes (lists[list_no], code_size);
+        madvise (ptr + begin, std::min (end, totsize) - begin,
+                 MADV_WILLNEED);
+    }
+}
+
+
+/*******************************************************
+ * OnDiskInvertedListsBuilder
+ *******************************************************/
+
+OnDiskInvertedListsBuilder::OnDiskInvertedListsBuilder (
+        IndexIVF *index, const char *filename):
+    index (index), filename (filename), tmp_prefix (filename),
+    batch_size (65536), max_buffer_size ((size_t)1 << 30),
+    verbose (false), ntotal (0)
+{
+    FAISS_THROW_IF_NOT (index->is_trained);
+    FAISS_THROW_IF_NOT_MSG (index->ntotal == 0,
+                            "the index must be empty");
+    FAISS_THROW_IF_NOT_MSG (index->direct_map.type == DirectMap::NoMap,
+                            "direct map not supported");
+    FAISS_THROW_IF_NOT_MSG (index->max_list_size == 0,
+                            "max_list_size not supported");
+    sizes.resize (index->nlist);
+}
+
+void OnDiskInvertedListsBuilder::add (
+        idx_t n, const float *x, const idx_t *xids)
+{
+    size_t code_size = index->code_size;
+    size_t entry_size = 2 * sizeof (idx_t) + code_size;
+    std::vector<idx_t> list_nos;
+    std::vector<uint8_t> codes;
+
+    for (idx_t i0 = 0; i0 < n; i0 += batch_size) {
+        idx_t i1 = std::min (n, i0 + (idx_t)batch_size);
+        const float *xi = x + i0 * index->d;
+        list_nos.resize (i1 - i0);
+        codes.resize ((i1 - i0) * code_size);
+        index->quantizer->assign (i1 - i0, xi, list_nos.data());
+        index->encode_vectors (i1 - i0, xi, list_nos.data(), codes.data());
+
+        for (idx_t i = i0; i < i1; i++) {
+            idx_t list_no = list_nos[i - i0];
+            if (list_no < 0) {
+                continue;
+            }
+            buf_list_nos.push_back (list_no);
+            buf_ids.push_back (xids ? xids[i] : ntotal + i);
+            const uint8_t *code = codes.data() + (i - i0) * code_size;
+            buf_codes.insert (buf_codes.end(), code, code + code_size);
+        }
+        if (buf_list_nos.size() * entry_size >= max_buffer_size) {
+            flush_run ();
+        }
+    }
+    ntotal += n;
+}
+
+void OnDiskInvertedListsBuilder::add_from_reader (IOReader *f, idx_t n)
+{
+    std::vector<float> x;
+    for (idx_t i0 = 0; i0 < n; i0 += batch_size) {
+        idx_t i1 = std::min (n, i0 + (idx_t)batch_size);
+        x.resize ((i1 - i0) * index->d);
+        READANDCHECK (x.data(), x.size());
+        add (i1 - i0, x.data());
+    }
+}
+
+void OnDiskInvertedListsBuilder::flush_run ()
+{
+    size_t nb = buf_list_nos.size();
+    if (nb == 0) {
+        return;
+    }
+    size_t nlist = index->nlist, code_size = index->code_size;
+
+    // stable counting sort of the entries by list id
+    std::vector<size_t> run_sizes (nlist + 1);
+    for (size_t i = 0; i < nb; i++) {
+        run_sizes[buf_list_nos[i] + 1]++;
+    }
+    for (size_t j = 0; j < nlist; j++) {
+        sizes[j] += run_sizes[j + 1];
+        run_sizes[j + 1] += run_sizes[j];
+    }
+    std::vector<size_t> perm (nb);
+    for (size_t i = 0; i < nb; i++) {
+        perm[run_sizes[buf_list_nos[i]]++] = i;
+    }
+    // now run_sizes[j] is the end of list j in perm
+
+    std::string fname = tmp_prefix + ".run" +
+        std::to_string (run_files.size());
+    {
+        FileIOWriter writer (fname.c_str());
+        IOWriter *f = &writer;
+        uint64_t nnz = 0;
+        for (size_t j = 0; j < nlist; j++) {
+            size_t begin = j == 0 ? 0 : run_sizes[j - 1];
+            nnz += run_sizes[j] > begin;
+        }
+        WRITE1 (nnz);
+
+        std::vector<idx_t> ids;
+        std::vector<uint8_t> codes;
+        for (size_t j = 0; j < nlist; j++) {
+            size_t begin = j == 0 ? 0 : run_sizes[j - 1];
+            uint64_t n = run_sizes[j] - begin;
+            if (n == 0) {
+                continue;
+            }
+            ids.resize (n);
+            codes.resize (n * code_size);
+            for (size_t e = 0; e < n; e++) {
+                size_t i = perm[begin + e];
+                ids[e] = buf_ids[i];
+                memcpy (codes.data() + e * code_size,
+                        buf_codes.data() + i * code_size, code_size);
+            }
+            uint64_t list_no = j;
+            WRITE1 (list_no);
+            WRITE1 (n);
+            WRITEANDCHECK (ids.data(), n);
+            WRITEANDCHECK (codes.data(), n * code_size);
+        }
+    }
+    run_files.push_back (fname);
+
+    if (verbose) {
+        printf ("wrote run %s with %zd entries\n", fname.c_str(), nb);
+    }
+
+    buf_list_nos.clear();
+    buf_ids.clear();
+    buf_codes.clear();
+}
+
+OnDiskInvertedLists * OnDiskInvertedListsBuilder::finish ()
+{
+    flush_run ();
+    size_t nlist = index->nlist, code_size = index->code_size;
+    double t0 = getmillisecs();
+
+    std::unique_ptr<OnDiskInvertedLists> il (
+          new OnDiskInvertedLists (nlist, code_size, filename.c_str()));
+
+    // compact layout, as in merge_from
+    size_t cums = 0;
+    for (size_t j = 0; j < nlist; j++) {
+        il->lists[j].size = 0;
+        il->lists[j].capacity = sizes[j];
+        il->lists[j].offset = cums;
+        cums += sizes[j] * (sizeof(idx_t) + code_size);
+    }
+    if (cums > 0) {
+        il->update_totsize (cums);
+    }
+    il->slots.clear ();
+
+    std::vector<uint8_t> codes;
+    std::vector<idx_t> ids;
+    for (size_t r = 0; r < run_files.size(); r++) {
+        {
+            FileIOReader reader (run_files[r].c_str());
+            IOReader *f = &reader;
+            uint64_t nnz;
+            READ1 (nnz);
+            for (uint64_t k = 0; k < nnz; k++) {
+                uint64_t list_no, n;
+                READ1 (list_no);
+                READ1 (n);
+                FAISS_THROW_IF_NOT (list_no < nlist &&
+                    il->lists[list_no].size + n <= sizes[list_no]);
+                ids.resize (n);
+                codes.resize (n * code_size);
+                READANDCHECK (ids.data(), n);
+                READANDCHECK (codes.data(), n * code_size);
+                OnDiskOneList & l = il->lists[list_no];
+                l.size += n;
+                il->update_entries (list_no, l.size - n, n,
+                                    ids.data(), codes.data());
+            }
+        }
+        unlink (run_files[r].c_str());
+        if (verbose) {
+            printf ("merged run %zd / %zd in %.3f s\r",
+                    r + 1, run_files.size(),
+                    (getmillisecs() - t0) / 1000.0);
+            fflush (stdout);
+        }
+    }
+    if (verbose) {
+        printf ("\n");
+    }
+    run_files.clear ();
+
+    for (size_t j = 0; j < nlist; j++) {
+        FAISS_THROW_IF_NOT (il->lists[j].size == sizes[j]);
+    }
+
+    OnDiskInvertedLists *il_ptr = il.release();
+    index->replace_invlists (il_ptr, true);
+    index->ntotal = ntotal;
+    return il_ptr;
+}
+
+OnDiskInvertedListsBuilder::~OnDiskInvertedListsBuilder ()
+{
+    for (const std::string & fname : run_files) {
+        unlink (fname.c_str());
+    }
+}
+
+
 /*******************************************************
  * I/O support via callbacks
  *******************************************************/
@@ -724,6 +1572,36 @@ void OnDiskInvertedListsIOHook::write(const InvertedLists *ils, IOWriter *f) con
     WRITE1(od->totsize);
 }
 
+namespace {
+
+/// the data file is in the same directory as the index file
+std::string ondisk_filename_same_dir (IOReader *f,
+                                      const std::string & orig_filename)
+{
+    FileIOReader *reader = dynamic_cast<FileIOReader*>(f);
+    FAISS_THROW_IF_NOT_MSG (
+            reader, "IO_FLAG_ONDISK_SAME_DIR only supported "
+            "when reading from file");
+    std::string indexname = reader->name;
+    std::string dirname = "./";
+    size_t slash = indexname.find_last_of('/');
+    if (slash != std::string::npos) {
+        dirname = indexname.substr(0, slash + 1);
+    }
+    std::string filename = orig_filename;
+    slash = filename.find_last_of('/');
+    if (slash != std::string::npos) {
+        filename = filename.substr(slash + 1);
+    }
+    filename = dirname + filename;
+    printf("IO_FLAG_ONDISK_SAME_DIR: "
+           "updating ondisk filename from %s to %s\n",
+           orig_filename.c_str(), filename.c_str());
+    return filename;
+}
+
+} // anonymous namespace
+
 InvertedLists * OnDiskInvertedListsIOHook::read(IOReader *f, int io_flags) const
 {
     OnDiskInvertedLists *od = new OnDiskInvertedLists();
@@ -743,26 +1621,7 @@ InvertedLists * OnDiskInvertedListsIOHook::read(IOReader *f, int io_flags) const
         od->filename.assign(x.begin(), x.end());
 
         if (io_flags & IO_FLAG_ONDISK_SAME_DIR) {
-            FileIOReader *reader = dynamic_cast<FileIOReader*>(f);
-            FAISS_THROW_IF_NOT_MSG (
-                    reader, "IO_FLAG_ONDISK_SAME_DIR only supported "
-                    "when reading from file");
-            std::string indexname = reader->name;
-            std::string dirname = "./";
-            size_t slash = indexname.find_last_of('/');
-            if (slash != std::string::npos) {
-                dirname = indexname.substr(0, slash + 1);
-            }
-            std::string filename = od->filename;
-            slash = filename.find_last_of('/');
-            if (slash != std::string::npos) {
-                filename = filename.substr(slash + 1);
-            }
-            filename = dirname + filename;
-            printf("IO_FLAG_ONDISK_SAME_DIR: "
-                   "updating ondisk filename from %s to %s\n",
-                   od->filename.c_str(), filename.c_str());
-            od->filename = filename;
+            od->filename = ondisk_filename_same_dir (f, od->filename);
         }
 
     }
@@ -795,7 +1654,7 @@ InvertedLists * OnDiskInvertedListsIOHook::read_ArrayInvertedLists(
         int ret = fstat (fileno(fdesc), &buf);
         FAISS_THROW_IF_NOT_FMT (ret == 0,
                                 "fstat failed: %s", strerror(errno));
-        ails->totsize = buf.st_size;
+        ails->totsize = ails->map_size = buf.st_size;
         ails->ptr = (uint8_t*)mmap (nullptr, ails->totsize,
                                     PROT_READ, MAP_SHARED,
                                     fileno(fdesc), 0);
@@ -820,7 +1679,56 @@ InvertedLists * OnDiskInvertedListsIOHook::read_ArrayInvertedLists(
 }
 
 
+OnDiskCompressedInvertedListsIOHook::OnDiskCompressedInvertedListsIOHook():
+    InvertedListsIOHook("ilcd", typeid(OnDiskCompressedInvertedLists).name())
+{}
 
+void OnDiskCompressedInvertedListsIOHook::write(
+        const InvertedLists *ils, IOWriter *f) const
+{
+    uint32_t h = fourcc ("ilcd");
+    WRITE1 (h);
+    WRITE1 (ils->nlist);
+    WRITE1 (ils->code_size);
+    const OnDiskCompressedInvertedLists *od =
+        dynamic_cast<const OnDiskCompressedInvertedLists*> (ils);
+    // this is a POD object
+    WRITEVECTOR (od->lists);
+    {
+        std::vector<char> x(od->filename.begin(), od->filename.end());
+        WRITEVECTOR(x);
+    }
+    WRITE1(od->totsize);
+}
+
+InvertedLists * OnDiskCompressedInvertedListsIOHook::read(
+        IOReader *f, int io_flags) const
+{
+    OnDiskCompressedInvertedLists *od = new OnDiskCompressedInvertedLists();
+    READ1 (od->nlist);
+    READ1 (od->code_size);
+    READVECTOR (od->lists);
+    {
+        std::vector<char> x;
+        READVECTOR(x);
+        od->filename.assign(x.begin(), x.end());
+        if (io_flags & IO_FLAG_ONDISK_SAME_DIR) {
+            od->filename = ondisk_filename_same_dir (f, od->filename);
+        }
+    }
+    READ1(od->totsize);
+    if (!(io_flags & IO_FLAG_SKIP_IVF_DATA)) {
+        od->do_mmap();
+    }
+    return od;
+}
+
+InvertedLists * OnDiskCompressedInvertedListsIOHook::read_ArrayInvertedLists(
+        IOReader *, int, size_t, size_t, const std::vector<size_t> &) const
+{
+    FAISS_THROW_MSG ("cannot read ArrayInvertedLists as "
+                     "OnDiskCompressedInvertedLists");
+}
 
 
 } // namespace faiss
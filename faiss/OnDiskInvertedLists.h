@@ -10,6 +10,7 @@
 #ifndef FAISS_ON_DISK_INVERTED_LISTS_H
 #define FAISS_ON_DISK_INVERTED_LISTS_H
 
+#include <atomic>
 #include <vector>
 #include <list>
 #include <typeinfo>
@@ -57,8 +58,12 @@ struct OnDiskOneList {
  * OnDisk with merge_from.
  *
  * When it is known that a set of lists will be accessed, it is useful
- * to call prefetch_lists, that launches a set of threads to read the
- * lists in parallel.
+ * to call prefetch_lists. By default, it launches a set of threads to
+ * read the lists in parallel. With prefetch_mode = PREFETCH_READAHEAD,
+ * it instead hands the page-aligned and coalesced byte ranges of all
+ * the lists to the kernel readahead (madvise MADV_WILLNEED) and returns
+ * immediately, so that the I/O overlaps with the scanning of the lists
+ * that are already in memory.
  */
 struct OnDiskInvertedLists: InvertedLists {
     using List = OnDiskOneList;
@@ -81,6 +86,18 @@ struct OnDiskInvertedLists: InvertedLists {
     uint8_t *ptr; // mmap base pointer
     bool read_only;  /// are inverted lists mapped read-only
 
+    /** address space reserved for the mapping of the file (bytes). As
+     * long as the file fits in it, growing the file only extends it,
+     * without remapping it: the concurrent add_entries and searches are
+     * not blocked and ptr does not change. Set it to the expected final
+     * size of the file before adding, it is applied at the next
+     * (re)mapping. 0 = map exactly totsize bytes. */
+    size_t reserve_size;
+
+    /// when it is full, the file grows by its size, but by no more
+    /// than max_grow_size bytes at a time (0 = no limit)
+    size_t max_grow_size;
+
     OnDiskInvertedLists (size_t nlist, size_t code_size,
                          const char *filename);
 
@@ -107,8 +124,29 @@ struct OnDiskInvertedLists: InvertedLists {
     /// restrict the inverted lists to l0:l1 without touching the mmapped region
     void crop_invlists(size_t l0, size_t l1);
 
+    /** Rewrite the lists contiguously, in the order given by list_order
+     * (size nlist, a permutation of the list numbers, eg. sorted by
+     * size or by access frequency; default 0..nlist-1). The lists are
+     * copied to a new file that replaces filename, so the free slots
+     * are dropped and the file shrinks to the size of the data.
+     *
+     * Writers are blocked during the compaction, but searches can run
+     * concurrently from other threads: they read the old mapping until
+     * the list table and mapping are swapped at the end. The old
+     * mapping remains valid until the next compaction.
+     *
+     * @return  new size of the file (bytes)
+     */
+    size_t compact (const idx_t *list_order = nullptr);
+
+    /// total size of the free slots (bytes), to decide when to compact
+    size_t free_bytes () const;
+
     void prefetch_lists (const idx_t *list_nos, int nlist) const override;
 
+    /// the lists are counted as mapped, with the whole mapping
+    MemoryUsage memory_usage () const override;
+
     virtual ~OnDiskInvertedLists ();
 
     // private
@@ -120,7 +158,35 @@ struct OnDiskInvertedLists: InvertedLists {
     OngoingPrefetch *pf;
     int prefetch_nthread;
 
+    enum PrefetchMode {
+        PREFETCH_THREADS,    ///< prefetch_nthread threads read the lists
+        PREFETCH_READAHEAD,  ///< asynchronous kernel readahead
+    };
+    PrefetchMode prefetch_mode;
+
+    /// readahead: max number of bytes requested by one prefetch_lists
+    /// call, the lists that come first are requested first (0 = no limit)
+    size_t prefetch_max_bytes;
+
+    /// readahead: ranges that are closer than this number of bytes are
+    /// merged into a single request
+    size_t prefetch_merge_gap;
+
+    /// readahead: number of bytes requested so far (statistics, updated
+    /// by concurrent searches)
+    mutable std::atomic<size_t> prefetch_nbytes;
+
+    /// mapping replaced by the last compaction, unmapped at the next
+    /// one (or at destruction)
+    uint8_t *retired_ptr;
+    size_t retired_size;
+
+    /// size of the mapping at ptr (>= totsize)
+    size_t map_size;
+
     void do_mmap ();
+    /// whether growing the file to new_size moves the mapping
+    bool needs_remap (size_t new_size) const;
     void update_totsize (size_t new_totsize);
     void resize_locked (size_t list_no, size_t new_size);
     size_t allocate_slot (size_t capacity);
@@ -133,6 +199,143 @@ struct OnDiskInvertedLists: InvertedLists {
     OnDiskInvertedLists ();
 };
 
+/** Read-only on-disk inverted lists with compressed ids.
+ *
+ * The entries of each list are sorted by id. The ids are stored by
+ * blocks of id_block_size: each block stores its first id as an idx_t
+ * and the differences of the other ids to the first one on nbits bits,
+ * where nbits is the same for all the blocks of a list. Thus, decoding a
+ * single id takes constant time.
+ *
+ * Each list is a range of the mmapped file that contains:
+ *
+ * - idx_t block_first_ids[nblock]
+ * - uint8_t codes[size * code_size]
+ * - followed by the packed differences, size * nbits bits
+ *
+ * lazy_ids() is true, so the IVF search decodes only the ids of the
+ * results.
+ */
+struct OnDiskCompressedInvertedLists: ReadOnlyInvertedLists {
+
+    static const size_t id_block_size = 64;
+
+    struct List {
+        size_t size;     // size of inverted list (entries)
+        size_t offset;   // offset in file (bytes)
+        size_t nbits;    // nb of bits per id difference
+        List ();
+    };
+
+    // size nlist
+    std::vector<List> lists;
+
+    std::string filename;
+    size_t totsize;
+    uint8_t *ptr; // mmap base pointer
+
+    /// the file is written by merge_from
+    OnDiskCompressedInvertedLists (size_t nlist, size_t code_size,
+                                   const char *filename);
+
+    /// write all the entries of the inverted lists to the file, sorted
+    /// by id (any previous content is replaced)
+    size_t merge_from (const InvertedLists **ils, int n_il,
+                       bool verbose=false);
+
+    /// same as merge_from for a single invlist
+    size_t merge_from_1 (const InvertedLists *il, bool verbose=false);
+
+    size_t list_size (size_t list_no) const override;
+    const uint8_t * get_codes (size_t list_no) const override;
+
+    /// the ids are decoded to a buffer that is freed by release_ids
+    const idx_t * get_ids (size_t list_no) const override;
+    void release_ids (size_t list_no, const idx_t *ids) const override;
+
+    idx_t get_single_id (size_t list_no, size_t offset) const override;
+
+    void prefetch_lists (const idx_t *list_nos, int nlist) const override;
+
+    bool lazy_ids () const override;
+
+    /// size of the compressed ids of a list (bytes)
+    size_t ids_size (size_t list_no) const;
+
+    MemoryUsage memory_usage () const override;
+
+    ~OnDiskCompressedInvertedLists () override;
+
+    // private
+
+    void do_mmap ();
+    void do_munmap ();
+    const idx_t * block_first_ids (size_t list_no) const;
+    const uint8_t * packed_ids (size_t list_no) const;
+
+    // empty constructor for the I/O functions
+    OnDiskCompressedInvertedLists ();
+};
+
+
+/** Builds the inverted lists of a trained IndexIVF directly in an
+ * OnDiskInvertedLists file, with a bounded amount of memory.
+ *
+ * The vectors are assigned and encoded by batches of batch_size. The
+ * resulting entries are buffered, and when the buffer exceeds
+ * max_buffer_size bytes it is sorted by list id and written to a
+ * temporary run file. finish() lays out the final file from the total
+ * list sizes and copies the runs into it, reading each run
+ * sequentially. The entries of a list are in the order they were
+ * added, as with IndexIVF::add_with_ids.
+ *
+ * The index must be empty, without direct map or max_list_size. Index
+ * types that store additional data at add time (IndexIVFPQR) are not
+ * supported.
+ */
+struct OnDiskInvertedListsBuilder {
+    typedef Index::idx_t idx_t;
+
+    IndexIVF *index;
+
+    std::string filename;    ///< output file of the inverted lists
+    std::string tmp_prefix;  ///< prefix of the run files (default filename)
+
+    size_t batch_size;       ///< nb of vectors assigned + encoded at a time
+    size_t max_buffer_size;  ///< size of the buffered entries (bytes)
+    bool verbose;
+
+    idx_t ntotal;            ///< nb of vectors added so far
+
+    /// size nlist, sizes of the lists over all runs
+    std::vector<size_t> sizes;
+
+    /// buffered entries (not written to a run yet)
+    std::vector<idx_t> buf_list_nos, buf_ids;
+    std::vector<uint8_t> buf_codes;
+
+    /// run files that are not merged yet
+    std::vector<std::string> run_files;
+
+    OnDiskInvertedListsBuilder (IndexIVF *index, const char *filename);
+
+    /// add vectors with ids xids (if NULL, sequential ids)
+    void add (idx_t n, const float *x, const idx_t *xids = nullptr);
+
+    /// read n vectors (float32, size n * d) from f and add them
+    void add_from_reader (IOReader *f, idx_t n);
+
+    /// sort the buffered entries by list id and write them to a run file
+    void flush_run ();
+
+    /** write the inverted lists file and install it in the index (the
+     * index owns it). The builder cannot be used afterwards. */
+    OnDiskInvertedLists * finish ();
+
+    ~OnDiskInvertedListsBuilder ();
+};
+
+
 struct OnDiskInvertedListsIOHook: InvertedListsIOHook {
     OnDiskInvertedListsIOHook();
     void write(const InvertedLists *ils, IOWriter *f) const override;
@@ -143,6 +346,16 @@ struct OnDiskInvertedListsIOHook: InvertedListsIOHook {
             const std::vector<size_t> &sizes) const override;
 };
 
+struct OnDiskCompressedInvertedListsIOHook: InvertedListsIOHook {
+    OnDiskCompressedInvertedListsIOHook();
+    void write(const InvertedLists *ils, IOWriter *f) const override;
+    InvertedLists * read(IOReader *f, int io_flags) const override;
+    InvertedLists * read_ArrayInvertedLists(
+            IOReader *f, int io_flags,
+            size_t nlist, size_t code_size,
+            const std::vector<size_t> &sizes) const override;
+};
+
 
 
 } // namespace faiss
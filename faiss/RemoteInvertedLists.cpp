@@ -0,0 +1,272 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/RemoteInvertedLists.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <typeinfo>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/RangeIOReader.h>
+#include <faiss/impl/io.h>
+
+namespace faiss {
+
+
+/// which lists are in the cache
+struct RemoteInvertedLists::State {
+    enum ListState: uint8_t { MISSING, FETCHING, CACHED };
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<ListState> lists;
+    size_t nfetch_lists = 0;
+    size_t nfetch_bytes = 0;
+};
+
+RemoteInvertedLists::RemoteInvertedLists (
+        RangeSource *source, size_t nlist, size_t code_size,
+        size_t data_offset, const std::vector<size_t> & sizes,
+        const char *cache_filename):
+    ReadOnlyInvertedLists (nlist, code_size),
+    source (source), own_source (false), sizes (sizes),
+    data_offset (data_offset), cache_filename (cache_filename),
+    prefetch_nthread (32), ptr (nullptr), map_size (0), cache_fd (-1),
+    state (nullptr)
+{
+    FAISS_THROW_IF_NOT (sizes.size() == nlist);
+    offsets.resize (nlist);
+    size_t o = 0;
+    for (size_t i = 0; i < nlist; i++) {
+        offsets[i] = o;
+        o += sizes[i] * (code_size + sizeof(idx_t));
+    }
+    totsize = o;
+
+    // the mapping is written by fetch_list
+    map_size = std::max (totsize, size_t(1));
+    if (this->cache_filename.empty()) {
+        ptr = (uint8_t*)mmap (nullptr, map_size, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    } else {
+        cache_fd = open (cache_filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        FAISS_THROW_IF_NOT_FMT (cache_fd >= 0, "could not open %s: %s",
+                                cache_filename, strerror(errno));
+        // sparse file, only the fetched lists use disk space
+        if (ftruncate (cache_fd, map_size) != 0) {
+            int err = errno;
+            close (cache_fd);
+            FAISS_THROW_FMT ("could not resize %s: %s",
+                             cache_filename, strerror(err));
+        }
+        ptr = (uint8_t*)mmap (nullptr, map_size, PROT_READ | PROT_WRITE,
+                              MAP_SHARED, cache_fd, 0);
+    }
+    if (ptr == MAP_FAILED) {
+        int err = errno;
+        if (cache_fd >= 0) {
+            close (cache_fd);
+        }
+        FAISS_THROW_FMT ("could not mmap the inverted lists cache: %s",
+                         strerror(err));
+    }
+
+    state = new State ();
+    state->lists.resize (nlist, State::MISSING);
+}
+
+void RemoteInvertedLists::fetch_list (size_t list_no) const
+{
+    {
+        std::unique_lock<std::mutex> lock (state->mutex);
+        // another thread may be fetching the list
+        state->cv.wait (lock, [&] () {
+            return state->lists[list_no] != State::FETCHING;
+        });
+        if (state->lists[list_no] == State::CACHED) {
+            return;
+        }
+        state->lists[list_no] = State::FETCHING;
+    }
+
+    size_t nbytes = sizes[list_no] * (code_size + sizeof(idx_t));
+    std::exception_ptr error;
+    try {
+        source->read_range (data_offset + offsets[list_no], nbytes,
+                            ptr + offsets[list_no]);
+    } catch (...) {
+        error = std::current_exception();
+    }
+
+    std::lock_guard<std::mutex> lock (state->mutex);
+    if (error) {
+        state->lists[list_no] = State::MISSING;
+    } else {
+        state->lists[list_no] = State::CACHED;
+        state->nfetch_lists++;
+        state->nfetch_bytes += nbytes;
+    }
+    state->cv.notify_all ();
+    if (error) {
+        std::rethrow_exception (error);
+    }
+}
+
+size_t RemoteInvertedLists::list_size (size_t list_no) const
+{
+    assert (list_no < nlist);
+    return sizes[list_no];
+}
+
+const uint8_t * RemoteInvertedLists::get_codes (size_t list_no) const
+{
+    assert (list_no < nlist);
+    if (sizes[list_no] == 0) {
+        return nullptr;
+    }
+    fetch_list (list_no);
+    return ptr + offsets[list_no];
+}
+
+const InvertedLists::idx_t * RemoteInvertedLists::get_ids (
+        size_t list_no) const
+{
+    assert (list_no < nlist);
+    if (sizes[list_no] == 0) {
+        return nullptr;
+    }
+    fetch_list (list_no);
+    return (const idx_t*)(ptr + offsets[list_no] +
+                          sizes[list_no] * code_size);
+}
+
+bool RemoteInvertedLists::is_cached (size_t list_no) const
+{
+    std::lock_guard<std::mutex> lock (state->mutex);
+    return state->lists[list_no] == State::CACHED;
+}
+
+void RemoteInvertedLists::prefetch_lists (
+        const idx_t *list_nos, int n) const
+{
+    std::vector<size_t> missing;
+    {
+        std::lock_guard<std::mutex> lock (state->mutex);
+        for (int i = 0; i < n; i++) {
+            idx_t list_no = list_nos[i];
+            if (list_no >= 0 && sizes[list_no] > 0 &&
+                state->lists[list_no] == State::MISSING) {
+                missing.push_back (list_no);
+            }
+        }
+    }
+    if (missing.empty()) {
+        return;
+    }
+
+    // errors are reported when the list is accessed
+    std::atomic<size_t> next (0);
+    auto fetch_missing = [&] () {
+        size_t i;
+        while ((i = next++) < missing.size()) {
+            try {
+                fetch_list (missing[i]);
+            } catch (const std::exception &) {
+            }
+        }
+    };
+    int nt = std::min (size_t(prefetch_nthread), missing.size());
+    std::vector<std::thread> threads;
+    for (int t = 1; t < nt; t++) {
+        threads.emplace_back (fetch_missing);
+    }
+    fetch_missing ();
+    for (auto & t : threads) {
+        t.join ();
+    }
+}
+
+size_t RemoteInvertedLists::nfetch_lists () const
+{
+    std::lock_guard<std::mutex> lock (state->mutex);
+    return state->nfetch_lists;
+}
+
+size_t RemoteInvertedLists::nfetch_bytes () const
+{
+    std::lock_guard<std::mutex> lock (state->mutex);
+    return state->nfetch_bytes;
+}
+
+RemoteInvertedLists::~RemoteInvertedLists ()
+{
+    munmap (ptr, map_size);
+    if (cache_fd >= 0) {
+        close (cache_fd);
+    }
+    delete state;
+    if (own_source) {
+        delete source;
+    }
+}
+
+
+/*******************************************************
+ * I/O support via callbacks
+ *******************************************************/
+
+RemoteInvertedListsIOHook::RemoteInvertedListsIOHook():
+    InvertedListsIOHook("ilrm", typeid(RemoteInvertedLists).name())
+{}
+
+void RemoteInvertedListsIOHook::write(
+        const InvertedLists *, IOWriter *) const
+{
+    // write_InvertedLists stores them as ArrayInvertedLists
+    FAISS_THROW_MSG ("RemoteInvertedLists are written as "
+                     "ArrayInvertedLists");
+}
+
+InvertedLists * RemoteInvertedListsIOHook::read(IOReader *, int) const
+{
+    FAISS_THROW_MSG ("RemoteInvertedLists are stored as "
+                     "ArrayInvertedLists");
+}
+
+InvertedLists * RemoteInvertedListsIOHook::read_ArrayInvertedLists(
+        IOReader *f, int /* io_flags */,
+        size_t nlist, size_t code_size,
+        const std::vector<size_t> &sizes) const
+{
+    RangeIOReader *reader = dynamic_cast<RangeIOReader*> (f);
+    FAISS_THROW_IF_NOT_MSG (reader, "IO_FLAG_REMOTE_INVLISTS needs a "
+                            "RangeIOReader");
+    RemoteInvertedLists *ils = new RemoteInvertedLists (
+          reader->source, nlist, code_size, reader->offset, sizes,
+          reader->invlists_cache_filename.c_str());
+    // resume reading after the lists
+    reader->skip (ils->totsize);
+    return ils;
+}
+
+
+} // namespace faiss
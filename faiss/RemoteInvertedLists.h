@@ -0,0 +1,113 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <faiss/InvertedLists.h>
+#include <faiss/index_io.h>
+
+namespace faiss {
+
+struct RangeSource;
+
+/** read_index flag: with a RangeIOReader, the ArrayInvertedLists of an
+ * IVF index are not read but replaced with a RemoteInvertedLists that
+ * fetches them from the reader's source when they are accessed. */
+const int IO_FLAG_REMOTE_INVLISTS = IO_FLAG_SKIP_IVF_DATA | 0x6d720000;
+
+
+/** Read-only inverted lists stored in a RangeSource (eg. an index file
+ * in object storage) in the ArrayInvertedLists format, that are fetched
+ * the first time they are accessed.
+ *
+ * The fetched lists are kept in a local cache file (eg. on SSD) that is
+ * memory-mapped, with the same layout as in the source, or in anonymous
+ * memory if there is no cache file. The cache is filled lazily and
+ * never evicted, so that an index loaded this way can serve queries
+ * immediately, with the first accesses to each list going to the
+ * network. The cache file is scratch space, it is truncated when the
+ * object is constructed.
+ *
+ * prefetch_lists fetches the missing lists in parallel, it is called by
+ * the IVF search with the lists that are going to be scanned.
+ */
+struct RemoteInvertedLists: ReadOnlyInvertedLists {
+    RangeSource *source;     ///< must outlive the object
+    bool own_source;
+
+    /// offset of the codes of each list from data_offset, size nlist
+    std::vector<size_t> offsets;
+    std::vector<size_t> sizes;
+
+    size_t data_offset;      ///< offset of the first list in the source
+    size_t totsize;          ///< size of all the lists, in bytes
+    std::string cache_filename;
+
+    /// nb of threads of prefetch_lists, the fetches are network bound
+    int prefetch_nthread;
+
+    /**
+     * @param data_offset  offset of the list data in the source
+     * @param sizes        size of each list, the lists are stored in order
+     *                     (codes, then ids)
+     */
+    RemoteInvertedLists (RangeSource *source,
+                         size_t nlist, size_t code_size,
+                         size_t data_offset,
+                         const std::vector<size_t> & sizes,
+                         const char *cache_filename = "");
+
+    size_t list_size (size_t list_no) const override;
+    const uint8_t * get_codes (size_t list_no) const override;
+    const idx_t * get_ids (size_t list_no) const override;
+
+    void prefetch_lists (const idx_t *list_nos, int nlist) const override;
+
+    /// whether the list is in the cache
+    bool is_cached (size_t list_no) const;
+
+    /// nb of lists and of bytes fetched from the source
+    size_t nfetch_lists () const;
+    size_t nfetch_bytes () const;
+
+    ~RemoteInvertedLists () override;
+
+    // private
+    uint8_t *ptr;            ///< mapping of the cache
+    size_t map_size;
+    int cache_fd;
+
+    struct State;
+    State *state;
+
+    /// fetch the list if it is not in the cache
+    void fetch_list (size_t list_no) const;
+};
+
+
+#ifndef _MSC_VER
+
+/// reads ArrayInvertedLists as RemoteInvertedLists with
+/// IO_FLAG_REMOTE_INVLISTS, from a RangeIOReader
+struct RemoteInvertedListsIOHook: InvertedListsIOHook {
+    RemoteInvertedListsIOHook();
+    void write(const InvertedLists *ils, IOWriter *f) const override;
+    InvertedLists * read(IOReader *f, int io_flags) const override;
+    InvertedLists * read_ArrayInvertedLists(
+            IOReader *f, int io_flags,
+            size_t nlist, size_t code_size,
+            const std::vector<size_t> &sizes) const override;
+};
+
+#endif // !_MSC_VER
+
+} // namespace faiss
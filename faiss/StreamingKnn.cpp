@@ -0,0 +1,510 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/StreamingKnn.h>
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/RangeIOReader.h>
+#include <faiss/utils/Heap.h>
+#include <faiss/utils/distances.h>
+#include <faiss/utils/utils.h>
+
+namespace faiss {
+
+
+/***********************************************************************
+ * ArrayVectorSource
+ ***********************************************************************/
+
+ArrayVectorSource::ArrayVectorSource (const VectorArrayView & x):
+    VectorSource (x.n, x.d), x (x)
+{}
+
+VectorArrayView ArrayVectorSource::read (
+        size_t i0, size_t i1, std::vector<uint8_t> &) const
+{
+    FAISS_THROW_IF_NOT (i0 <= i1 && i1 <= n);
+    return VectorArrayView (x.type, x.get (i0), i1 - i0, x.d, x.stride);
+}
+
+
+/***********************************************************************
+ * FileVectorSource
+ ***********************************************************************/
+
+namespace {
+
+bool ends_with (const std::string & s, const char *suffix)
+{
+    size_t l = strlen (suffix);
+    return s.size() >= l && s.compare (s.size() - l, l, suffix) == 0;
+}
+
+/// value of a key of the header dictionary of a .npy file
+std::string npy_header_field (const std::string & header, const char *key)
+{
+    size_t pos = header.find (std::string ("'") + key + "'");
+    FAISS_THROW_IF_NOT_FMT (pos != std::string::npos,
+                            "no %s in npy header", key);
+    pos = header.find (':', pos);
+    FAISS_THROW_IF_NOT (pos != std::string::npos);
+    pos = header.find_first_not_of (' ', pos + 1);
+    FAISS_THROW_IF_NOT (pos != std::string::npos);
+    size_t end;
+    if (header[pos] == '\'') {
+        end = header.find ('\'', pos + 1) + 1;
+    } else if (header[pos] == '(') {
+        end = header.find (')', pos) + 1;
+    } else {
+        end = header.find_first_of (",}", pos);
+    }
+    FAISS_THROW_IF_NOT (end != std::string::npos && end > pos);
+    return header.substr (pos, end - pos);
+}
+
+/// header of a .npy file (version 1.0) for a 2D array
+std::string npy_header (const char *descr, size_t n, size_t k)
+{
+    char dict[256];
+    snprintf (dict, sizeof(dict),
+              "{'descr': '%s', 'fortran_order': False, 'shape': (%zd, %zd), }",
+              descr, n, k);
+    std::string h = dict;
+    // the header size is a multiple of 64 and ends with a newline
+    size_t total = 10 + h.size() + 1;
+    h.append ((64 - total % 64) % 64, ' ');
+    h += '\n';
+    std::string out ("\x93NUMPY", 6);
+    out += char(1);
+    out += char(0);
+    out += char(h.size() & 0xff);
+    out += char(h.size() >> 8);
+    return out + h;
+}
+
+} // namespace
+
+FileVectorSource::FileVectorSource (const char *fname):
+    fname (fname), source (new FileRangeSource (fname)), own_source (true)
+{
+    try {
+        read_header ();
+    } catch (...) {
+        delete source;
+        throw;
+    }
+}
+
+FileVectorSource::FileVectorSource (RangeSource *source, const char *fname):
+    fname (fname), source (source), own_source (false)
+{
+    read_header ();
+}
+
+void FileVectorSource::read_header ()
+{
+    const char *fname = this->fname.c_str();
+    size_t size = source->size ();
+    if (ends_with (this->fname, ".fvecs") ||
+        ends_with (this->fname, ".bvecs")) {
+        bool is_f = ends_with (this->fname, ".fvecs");
+        type = is_f ? VET_float32 : VET_uint8;
+        FAISS_THROW_IF_NOT_FMT (size >= 4, "%s is empty", fname);
+        int32_t di;
+        source->read_range (0, sizeof(di), &di);
+        FAISS_THROW_IF_NOT_FMT (di > 0 && di < 1000000,
+                                "unreasonable dimension %d in %s",
+                                int(di), fname);
+        d = di;
+        header_size = 0;
+        vector_offset = 4;
+        record_size = 4 + d * (is_f ? 4 : 1);
+        FAISS_THROW_IF_NOT_FMT (size % record_size == 0,
+                                "%s: size %zd is not a multiple of the "
+                                "record size %zd", fname, size, record_size);
+        n = size / record_size;
+    } else if (ends_with (this->fname, ".npy")) {
+        uint8_t pre[12];
+        FAISS_THROW_IF_NOT_FMT (size >= 12, "%s is too short", fname);
+        source->read_range (0, 12, pre);
+        FAISS_THROW_IF_NOT_FMT (memcmp (pre, "\x93NUMPY", 6) == 0,
+                                "%s is not a npy file", fname);
+        size_t hlen;
+        if (pre[6] == 1) {
+            hlen = pre[8] | (pre[9] << 8);
+            header_size = 10 + hlen;
+        } else {
+            hlen = pre[8] | (pre[9] << 8) | (pre[10] << 16) |
+                (size_t(pre[11]) << 24);
+            header_size = 12 + hlen;
+        }
+        FAISS_THROW_IF_NOT_FMT (header_size <= size, "%s is too short",
+                                fname);
+        std::string header (hlen, ' ');
+        source->read_range (header_size - hlen, hlen, &header[0]);
+
+        std::string descr = npy_header_field (header, "descr");
+        size_t es;
+        if (descr == "'<f4'") {
+            type = VET_float32;
+            es = 4;
+        } else if (descr == "'<f2'") {
+            type = VET_float16;
+            es = 2;
+        } else if (descr == "'|u1'") {
+            type = VET_uint8;
+            es = 1;
+        } else if (descr == "'|i1'") {
+            type = VET_int8;
+            es = 1;
+        } else {
+            FAISS_THROW_FMT ("%s: unsupported npy type %s",
+                             fname, descr.c_str());
+        }
+        FAISS_THROW_IF_NOT_FMT (
+              npy_header_field (header, "fortran_order") == "False",
+              "%s: Fortran order not supported", fname);
+        std::string shape = npy_header_field (header, "shape");
+        unsigned long long sn, sd;
+        char closing;
+        FAISS_THROW_IF_NOT_FMT (
+              sscanf (shape.c_str(), "(%llu, %llu%c", &sn, &sd,
+                      &closing) == 3 && closing == ')',
+              "%s: expected a 2D array, got shape %s",
+              fname, shape.c_str());
+        n = sn;
+        d = sd;
+        vector_offset = 0;
+        record_size = d * es;
+        FAISS_THROW_IF_NOT_FMT (header_size + n * record_size <= size,
+                                "%s is truncated", fname);
+    } else {
+        FAISS_THROW_FMT ("%s: unknown file extension (supported: .fvecs, "
+                         ".bvecs, .npy)", fname);
+    }
+}
+
+VectorArrayView FileVectorSource::read (
+        size_t i0, size_t i1, std::vector<uint8_t> & buf) const
+{
+    FAISS_THROW_IF_NOT (i0 <= i1 && i1 <= n);
+    buf.resize (std::max ((i1 - i0) * record_size, size_t(1)));
+    if (i1 > i0) {
+        source->read_range (header_size + i0 * record_size,
+                            (i1 - i0) * record_size, buf.data());
+    }
+    VectorArrayView x (type, buf.data() + vector_offset, i1 - i0, d);
+    x.stride = record_size / x.element_size ();
+    return x;
+}
+
+FileVectorSource::~FileVectorSource ()
+{
+    if (own_source) {
+        delete source;
+    }
+}
+
+
+/***********************************************************************
+ * StreamingKnn
+ ***********************************************************************/
+
+namespace {
+
+typedef StreamingKnn::idx_t idx_t;
+
+/// merge the sorted result lists 1 into the sorted result lists 0,
+/// the missing results have id -1
+void merge_results (size_t k, float *D0, idx_t *I0,
+                    const float *D1, const idx_t *I1,
+                    idx_t translation, bool keep_min,
+                    float *tmpD, idx_t *tmpI)
+{
+    size_t r0 = 0, r1 = 0;
+    for (size_t j = 0; j < k; j++) {
+        bool has0 = r0 < k && I0[r0] >= 0;
+        bool has1 = r1 < k && I1[r1] >= 0;
+        if (has0 && (!has1 || (keep_min ? D0[r0] <= D1[r1] :
+                                          D0[r0] >= D1[r1]))) {
+            tmpD[j] = D0[r0];
+            tmpI[j] = I0[r0];
+            r0++;
+        } else if (has1) {
+            tmpD[j] = D1[r1];
+            tmpI[j] = I1[r1] + translation;
+            r1++;
+        } else {
+            tmpD[j] = keep_min ? HUGE_VAL : -HUGE_VAL;
+            tmpI[j] = -1;
+        }
+    }
+    memcpy (D0, tmpD, sizeof(*D0) * k);
+    memcpy (I0, tmpI, sizeof(*I0) * k);
+}
+
+void pwrite_all (int fd, const void *data, size_t nbytes, size_t offset,
+                 const char *fname)
+{
+    const uint8_t *p = (const uint8_t*)data;
+    while (nbytes > 0) {
+        ssize_t ret = pwrite (fd, p, nbytes, offset);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        FAISS_THROW_IF_NOT_FMT (ret > 0, "write error in %s: %s",
+                                fname, strerror(errno));
+        p += ret;
+        offset += ret;
+        nbytes -= ret;
+    }
+}
+
+/// result file with a npy header, closed at destruction
+struct ResultFile {
+    std::string fname;
+    std::string header;
+    size_t row_size;
+    int fd;
+
+    /// open or create the file
+    ResultFile (const char *fname, const std::string & header,
+                size_t row_size):
+        fname (fname), header (header), row_size (row_size)
+    {
+        fd = open (fname, O_RDWR | O_CREAT, 0644);
+        FAISS_THROW_IF_NOT_FMT (fd >= 0, "could not open %s: %s",
+                                fname, strerror(errno));
+    }
+
+    /// nb of complete rows already in the file. If there are none, the
+    /// header is (re-)written
+    size_t init () {
+        struct stat st;
+        FAISS_THROW_IF_NOT_FMT (fstat (fd, &st) == 0, "fstat failed: %s",
+                                strerror(errno));
+        size_t size = st.st_size;
+        if (size >= header.size()) {
+            std::string h (header.size(), ' ');
+            FAISS_THROW_IF_NOT_FMT (
+                  pread (fd, &h[0], h.size(), 0) == ssize_t(h.size()),
+                  "could not read %s", fname.c_str());
+            FAISS_THROW_IF_NOT_FMT (h == header,
+                                    "%s exists with another npy header, "
+                                    "it is not a checkpoint of this "
+                                    "computation", fname.c_str());
+            return (size - header.size()) / row_size;
+        }
+        pwrite_all (fd, header.data(), header.size(), 0, fname.c_str());
+        return 0;
+    }
+
+    void write_rows (size_t i0, size_t n, const void *data) {
+        pwrite_all (fd, data, n * row_size, header.size() + i0 * row_size,
+                    fname.c_str());
+    }
+
+    void sync () {
+        FAISS_THROW_IF_NOT_FMT (fsync (fd) == 0, "fsync %s failed: %s",
+                                fname.c_str(), strerror(errno));
+    }
+
+    ~ResultFile () {
+        close (fd);
+    }
+};
+
+} // namespace
+
+StreamingKnn::StreamingKnn (size_t k, MetricType metric_type):
+    k (k), metric_type (metric_type),
+    query_block_size (65536), db_block_size (1 << 20),
+    exclude_self (false), index (nullptr), verbose (false)
+{}
+
+void StreamingKnn::search_block (
+        const VectorArrayView & xq, size_t q0, const VectorSource & xb,
+        float *D, idx_t *I) const
+{
+    FAISS_THROW_IF_NOT_MSG (metric_type == METRIC_L2 ||
+                            metric_type == METRIC_INNER_PRODUCT,
+                            "only L2 and inner product are supported");
+    FAISS_THROW_IF_NOT (xq.d == xb.d && k > 0 && db_block_size > 0);
+    FAISS_THROW_IF_NOT (!index || (index->d == xq.d &&
+                                   index->metric_type == metric_type));
+    size_t nq = xq.n;
+    bool keep_min = metric_type == METRIC_L2;
+    // one more result per query, that may be the query itself
+    size_t k2 = exclude_self ? k + 1 : k;
+
+    std::vector<float> Dr (nq * k2, keep_min ? HUGE_VAL : -HUGE_VAL);
+    std::vector<idx_t> Ir (nq * k2, -1);
+    std::vector<float> Db (nq * k2);
+    std::vector<idx_t> Ib (nq * k2);
+
+    // the next database block is read by a thread while the current one
+    // is searched
+    size_t nblock = (xb.n + db_block_size - 1) / db_block_size;
+    std::vector<uint8_t> bufs[2];
+    std::unique_ptr<VectorArrayView> next;
+    std::exception_ptr read_error;
+    std::thread reader;
+    auto start_read = [&] (size_t b) {
+        reader = std::thread ([&, b] () {
+            try {
+                size_t i0 = b * db_block_size;
+                size_t i1 = std::min (i0 + db_block_size, xb.n);
+                next.reset (new VectorArrayView (
+                      xb.read (i0, i1, bufs[b % 2])));
+            } catch (...) {
+                read_error = std::current_exception ();
+            }
+        });
+    };
+
+    if (nblock > 0) {
+        start_read (0);
+    }
+    for (size_t b = 0; b < nblock; b++) {
+        reader.join ();
+        if (read_error) {
+            std::rethrow_exception (read_error);
+        }
+        std::unique_ptr<VectorArrayView> cur (std::move (next));
+        if (b + 1 < nblock) {
+            start_read (b + 1);
+        }
+
+        try {
+            if (index) {
+                index->reset ();
+                index->add_view (*cur);
+                index->search_view (xq, k2, Db.data(), Ib.data());
+            } else if (keep_min) {
+                float_maxheap_array_t res = {nq, k2, Ib.data(), Db.data()};
+                knn_L2sqr (xq, *cur, &res);
+            } else {
+                float_minheap_array_t res = {nq, k2, Ib.data(), Db.data()};
+                knn_inner_product (xq, *cur, &res);
+            }
+
+            idx_t b0 = b * db_block_size;
+#pragma omp parallel if (nq > 1000)
+            {
+                std::vector<float> tmpD (k2);
+                std::vector<idx_t> tmpI (k2);
+#pragma omp for
+                for (idx_t q = 0; q < nq; q++) {
+                    merge_results (k2, Dr.data() + q * k2, Ir.data() + q * k2,
+                                   Db.data() + q * k2, Ib.data() + q * k2,
+                                   b0, keep_min, tmpD.data(), tmpI.data());
+                }
+            }
+        } catch (...) {
+            if (reader.joinable ()) {
+                reader.join ();
+            }
+            throw;
+        }
+    }
+    if (index) {
+        index->reset ();
+    }
+
+    for (size_t q = 0; q < nq; q++) {
+        const float *Dq = Dr.data() + q * k2;
+        const idx_t *Iq = Ir.data() + q * k2;
+        // the query itself, or the last result if it was not found
+        size_t skip = k2;
+        if (exclude_self) {
+            skip = k;
+            for (size_t j = 0; j < k2; j++) {
+                if (Iq[j] == idx_t(q0 + q)) {
+                    skip = j;
+                    break;
+                }
+            }
+        }
+        for (size_t j = 0, o = 0; j < k2; j++) {
+            if (j != skip) {
+                D[q * k + o] = Dq[j];
+                I[q * k + o] = Iq[j];
+                o++;
+            }
+        }
+    }
+}
+
+void StreamingKnn::search (
+        const VectorSource & xq, const VectorSource & xb,
+        float *D, idx_t *I) const
+{
+    FAISS_THROW_IF_NOT (query_block_size > 0);
+    std::vector<uint8_t> buf;
+    double t0 = getmillisecs ();
+    for (size_t q0 = 0; q0 < xq.n; q0 += query_block_size) {
+        size_t q1 = std::min (q0 + query_block_size, xq.n);
+        if (verbose) {
+            printf ("StreamingKnn: queries %zd:%zd / %zd (%.3f s)\n",
+                    q0, q1, xq.n, (getmillisecs () - t0) / 1000);
+        }
+        search_block (xq.read (q0, q1, buf), q0, xb, D + q0 * k, I + q0 * k);
+    }
+}
+
+void StreamingKnn::search_to_files (
+        const VectorSource & xq, const VectorSource & xb,
+        const char *D_fname, const char *I_fname) const
+{
+    FAISS_THROW_IF_NOT (query_block_size > 0);
+    ResultFile fD (D_fname, npy_header ("<f4", xq.n, k), k * sizeof(float));
+    ResultFile fI (I_fname, npy_header ("<i8", xq.n, k), k * sizeof(idx_t));
+    size_t ndone = std::min (fD.init (), fI.init ());
+    if (verbose && ndone > 0) {
+        printf ("StreamingKnn: resuming after %zd queries\n", ndone);
+    }
+
+    std::vector<uint8_t> buf;
+    std::vector<float> D;
+    std::vector<idx_t> I;
+    double t0 = getmillisecs ();
+    for (size_t q0 = ndone; q0 < xq.n; q0 += query_block_size) {
+        size_t q1 = std::min (q0 + query_block_size, xq.n);
+        if (verbose) {
+            printf ("StreamingKnn: queries %zd:%zd / %zd (%.3f s)\n",
+                    q0, q1, xq.n, (getmillisecs () - t0) / 1000);
+        }
+        D.resize ((q1 - q0) * k);
+        I.resize ((q1 - q0) * k);
+        search_block (xq.read (q0, q1, buf), q0, xb, D.data(), I.data());
+        fD.write_rows (q0, q1 - q0, D.data());
+        fI.write_rows (q0, q1 - q0, I.data());
+        // the rows are complete in both files before the next block
+        fD.sync ();
+        fI.sync ();
+    }
+}
+
+
+} // namespace faiss
@@ -0,0 +1,152 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <faiss/Index.h>
+#include <faiss/utils/vector_view.h>
+
+namespace faiss {
+
+struct RangeSource;
+
+/** A set of vectors that is read by blocks, so that it does not have to
+ * fit in RAM. */
+struct VectorSource {
+    size_t n;   ///< nb of vectors
+    size_t d;   ///< dimension
+
+    explicit VectorSource (size_t n = 0, size_t d = 0): n (n), d (d) {}
+
+    /** vectors i0 .. i1 - 1. The returned view may point to buf, it is
+     * valid until buf is reused. Can be called from several threads with
+     * different bufs. */
+    virtual VectorArrayView read (size_t i0, size_t i1,
+                                  std::vector<uint8_t> & buf) const = 0;
+
+    virtual ~VectorSource () {}
+};
+
+
+/// vectors that are already in memory
+struct ArrayVectorSource: VectorSource {
+    VectorArrayView x;
+
+    explicit ArrayVectorSource (const VectorArrayView & x);
+
+    VectorArrayView read (size_t i0, size_t i1,
+                          std::vector<uint8_t> & buf) const override;
+};
+
+
+/** Vectors in a file, in the format given by its extension:
+ *
+ * - .fvecs: float32 vectors, each preceded by its dimension (int32)
+ * - .bvecs: same with uint8 vectors
+ * - .npy: 2D array in C order of float32 ('<f4'), float16 ('<f2'),
+ *   uint8 ('|u1') or int8 ('|i1')
+ *
+ * The vectors are read from a RangeSource as they are requested, which
+ * is a local file by default but can also be eg. a HTTPRangeSource.
+ */
+struct FileVectorSource: VectorSource {
+    std::string fname;
+    VectorElementType type;
+    size_t header_size;    ///< offset of the first vector in the file
+    size_t record_size;    ///< nb of bytes between 2 vectors
+    size_t vector_offset;  ///< offset of the components in a record
+    RangeSource *source;
+    bool own_source;
+
+    /// read a local file
+    explicit FileVectorSource (const char *fname);
+
+    /// fname is used only to get the format
+    FileVectorSource (RangeSource *source, const char *fname);
+
+    FileVectorSource (const FileVectorSource &) = delete;
+    FileVectorSource & operator = (const FileVectorSource &) = delete;
+
+    VectorArrayView read (size_t i0, size_t i1,
+                          std::vector<uint8_t> & buf) const override;
+
+    ~FileVectorSource () override;
+
+  private:
+    /// sets the format, n and d from the file header
+    void read_header ();
+};
+
+
+/** Exact k-nearest neighbor search of queries in a database that are
+ * both read by blocks from VectorSources, with bounded memory: at most
+ * query_block_size queries and 2 blocks of db_block_size database
+ * vectors are in RAM at a time (the next database block is read while
+ * the current one is searched). This computes the ground truth of
+ * benchmarks or the kNN graph of a dataset (eg. for
+ * IndexHNSW::add_with_knn_graph) for datasets larger than RAM.
+ *
+ * The distances are computed with knn_L2sqr / knn_inner_product
+ * (multi-threaded, with a reservoir for large k) or, if index is set,
+ * by the index filled with each database block. This is typically a
+ * GpuIndexFlat, or an IndexShards of GpuIndexFlat to use several GPUs.
+ */
+struct StreamingKnn {
+    typedef Index::idx_t idx_t;
+
+    size_t k;
+    MetricType metric_type;
+
+    size_t query_block_size;   ///< default 65536
+    size_t db_block_size;      ///< default 1M
+
+    /** the queries are the database vectors (kNN graph): query i is not
+     * returned as a neighbor of itself */
+    bool exclude_self;
+
+    /** if not null, the searches of a block of queries in a block of
+     * database vectors are done by resetting this index, adding the
+     * database vectors to it and searching it. The index must be an
+     * exhaustive index with the same metric. */
+    Index *index;
+
+    bool verbose;
+
+    explicit StreamingKnn (size_t k, MetricType metric_type = METRIC_L2);
+
+    /// results in memory, size (xq.n, k), sorted by increasing distance
+    /// (decreasing similarity for the inner product)
+    void search (const VectorSource & xq, const VectorSource & xb,
+                 float *D, idx_t *I) const;
+
+    /** results written to .npy files with arrays of size (xq.n, k) of
+     * float32 (D) and int64 (I). The files are written after each block
+     * of queries and are the checkpoint of the computation: if they
+     * already contain results for the same shape, the queries whose
+     * results are complete are skipped. An interrupted computation is
+     * thus resumed by calling the function again. */
+    void search_to_files (const VectorSource & xq, const VectorSource & xb,
+                          const char *D_fname, const char *I_fname) const;
+
+    /** search a block of queries in all the database
+     *
+     * @param q0  index of the first query, for exclude_self
+     */
+    void search_block (const VectorArrayView & xq, size_t q0,
+                       const VectorSource & xb,
+                       float *D, idx_t *I) const;
+};
+
+
+} // namespace faiss
@@ -13,9 +13,11 @@
 #include <cstdio>
 #include <cmath>
 #include <cstring>
+#include <algorithm>
 #include <memory>
 
 #include <faiss/utils/distances.h>
+#include <faiss/utils/hadamard.h>
 #include <faiss/utils/random.h>
 #include <faiss/utils/utils.h>
 #include <faiss/impl/FaissAssert.h>
@@ -78,6 +80,62 @@ int dgesvd_(
 
 }
 
+/*********************************************
+ * TrainingGemm
+ *********************************************/
+
+void TrainingGemm::sgemm (const char *transa, const char *transb,
+                          int m, int n, int k,
+                          float alpha, const float *a, int lda,
+                          const float *b, int ldb,
+                          float beta, float *c, int ldc) const
+{
+    FINTEGER mi = m, ni = n, ki = k, ldai = lda, ldbi = ldb, ldci = ldc;
+    sgemm_ (transa, transb, &mi, &ni, &ki,
+            &alpha, a, &ldai, b, &ldbi, &beta, c, &ldci);
+}
+
+void TrainingGemm::dgemm (const char *transa, const char *transb,
+                          int m, int n, int k,
+                          double alpha, const double *a, int lda,
+                          const double *b, int ldb,
+                          double beta, double *c, int ldc) const
+{
+    FINTEGER mi = m, ni = n, ki = k, ldai = lda, ldbi = ldb, ldci = ldc;
+    dgemm_ (transa, transb, &mi, &ni, &ki,
+            &alpha, a, &ldai, b, &ldbi, &beta, c, &ldci);
+}
+
+namespace {
+
+/// the TrainingGemm to use for a transform
+const TrainingGemm & get_train_gemm (const TrainingGemm *train_gemm)
+{
+    static const TrainingGemm blas_gemm;
+    return train_gemm ? *train_gemm : blas_gemm;
+}
+
+/** c = alpha * a * a^T + beta * c (trans = "N") or
+ *  c = alpha * a^T * a + beta * c (trans = "T"), c of size n * n.
+ * With BLAS only the upper triangle of c is computed (ssyrk), with an
+ * external TrainingGemm the whole matrix is. */
+void train_syrk (const TrainingGemm *train_gemm, const char *trans,
+                 int n, int k, float alpha, const float *a, int lda,
+                 float beta, float *c, int ldc)
+{
+    bool notrans = trans[0] == 'N' || trans[0] == 'n';
+    if (train_gemm) {
+        train_gemm->sgemm (notrans ? "N" : "T", notrans ? "T" : "N",
+                           n, n, k, alpha, a, lda, a, lda, beta, c, ldc);
+    } else {
+        FINTEGER ni = n, ki = k, ldai = lda, ldci = ldc;
+        ssyrk_ ("Up", notrans ? "N" : "T", &ni, &ki, &alpha,
+                (float*)a, &ldai, &beta, c, &ldci);
+    }
+}
+
+} // namespace
+
 /*********************************************
  * VectorTransform
  *********************************************/
@@ -104,6 +162,12 @@ void VectorTransform::reverse_transform (
     FAISS_THROW_MSG ("reverse transform not implemented");
 }
 
+MemoryUsage VectorTransform::memory_usage () const
+{
+    return MemoryUsage::object (
+          demangle_cpp_symbol (typeid (*this).name()));
+}
+
 
 
 
@@ -115,7 +179,7 @@ void VectorTransform::reverse_transform (
 LinearTransform::LinearTransform (int d_in, int d_out,
                                   bool have_bias):
     VectorTransform (d_in, d_out), have_bias (have_bias),
-    is_orthonormal (false), verbose (false)
+    is_orthonormal (false), train_gemm (nullptr), verbose (false)
 {
     is_trained = false; // will be trained when A and b are initialized
 }
@@ -240,6 +304,14 @@ void LinearTransform::print_if_verbose (
     printf("]\n");
 }
 
+MemoryUsage LinearTransform::memory_usage () const
+{
+    MemoryUsage mu = VectorTransform::memory_usage ();
+    mu.add ("A", A);
+    mu.add ("b", b);
+    return mu;
+}
+
 /*********************************************
  * RandomRotationMatrix
  *********************************************/
@@ -278,6 +350,145 @@ void RandomRotationMatrix::train (Index::idx_t /*n*/, const float * /*x*/)
 }
 
 
+/*********************************************
+ * HadamardRotation
+ *********************************************/
+
+namespace {
+
+/// largest power of 2 <= d
+size_t hadamard_size (size_t d)
+{
+    size_t p = 1;
+    while (p * 2 <= d) {
+        p *= 2;
+    }
+    return p;
+}
+
+} // anonymous namespace
+
+HadamardRotation::HadamardRotation (int d_in, int d_out, int nrounds):
+    VectorTransform (d_in, d_out), nrounds (nrounds)
+{
+    is_trained = false;
+}
+
+HadamardRotation::HadamardRotation ():
+    HadamardRotation (0, 0)
+{}
+
+void HadamardRotation::init (int seed)
+{
+    size_t d = std::max (d_in, d_out);
+    FAISS_THROW_IF_NOT (d > 0 && nrounds > 0);
+    RandomGenerator rng (seed);
+    signs.resize (nrounds * d);
+    for (size_t i = 0; i < signs.size(); i++) {
+        signs[i] = rng.rand_int (2) ? 1 : -1;
+    }
+    is_trained = true;
+}
+
+void HadamardRotation::train (Index::idx_t /*n*/, const float * /*x*/)
+{
+    // initialize with some arbitrary seed
+    init (12345);
+}
+
+void HadamardRotation::apply_noalloc (idx_t n, const float * x,
+                                      float *xt) const
+{
+    FAISS_THROW_IF_NOT_MSG (is_trained, "Transformation not trained yet");
+    size_t d = std::max (d_in, d_out);
+    size_t p = hadamard_size (d);
+    float scale = 1 / sqrt (p);
+
+#pragma omp parallel if (n > 100)
+    {
+        std::vector<float> buf (d);
+
+#pragma omp for
+        for (idx_t i = 0; i < n; i++) {
+            float *y = buf.data();
+            memcpy (y, x + i * d_in, sizeof (float) * d_in);
+            memset (y + d_in, 0, sizeof (float) * (d - d_in));
+            for (int r = 0; r < nrounds; r++) {
+                const float *s = signs.data() + r * d;
+                for (size_t j = 0; j < p; j++) {
+                    y[j] *= s[j] * scale;
+                }
+                for (size_t j = p; j < d; j++) {
+                    y[j] *= s[j];
+                }
+                fwht_inplace (y, p);
+                if (p < d) {
+                    for (size_t j = d - p; j < d; j++) {
+                        y[j] *= scale;
+                    }
+                    fwht_inplace (y + d - p, p);
+                }
+            }
+            memcpy (xt + i * d_out, y, sizeof (float) * d_out);
+        }
+    }
+}
+
+void HadamardRotation::reverse_transform (idx_t n, const float * xt,
+                                          float *x) const
+{
+    FAISS_THROW_IF_NOT_MSG (is_trained, "Transformation not trained yet");
+    size_t d = std::max (d_in, d_out);
+    size_t p = hadamard_size (d);
+    float scale = 1 / sqrt (p);
+
+#pragma omp parallel if (n > 100)
+    {
+        std::vector<float> buf (d);
+
+#pragma omp for
+        for (idx_t i = 0; i < n; i++) {
+            float *y = buf.data();
+            memcpy (y, xt + i * d_out, sizeof (float) * d_out);
+            memset (y + d_out, 0, sizeof (float) * (d - d_out));
+            // the normalized Hadamard transforms are their own inverse
+            for (int r = nrounds - 1; r >= 0; r--) {
+                if (p < d) {
+                    fwht_inplace (y + d - p, p);
+                    for (size_t j = d - p; j < d; j++) {
+                        y[j] *= scale;
+                    }
+                }
+                fwht_inplace (y, p);
+                const float *s = signs.data() + r * d;
+                for (size_t j = 0; j < p; j++) {
+                    y[j] *= s[j] * scale;
+                }
+                for (size_t j = p; j < d; j++) {
+                    y[j] *= s[j];
+                }
+            }
+            memcpy (x + i * d_in, y, sizeof (float) * d_in);
+        }
+    }
+}
+
+void HadamardRotation::make_matrix (float *A) const
+{
+    // column j of A is the transform of the j-th canonical vector
+    std::vector<float> eye (d_in * d_in), cols (d_in * d_out);
+    for (int j = 0; j < d_in; j++) {
+        eye[j * d_in + j] = 1;
+    }
+    apply_noalloc (d_in, eye.data(), cols.data());
+    for (int i = 0; i < d_out; i++) {
+        for (int j = 0; j < d_in; j++) {
+            A[i * d_in + j] = cols[j * d_out + i];
+        }
+    }
+}
+
+
 /*********************************************
  * PCAMatrix
  *********************************************/
@@ -290,6 +501,9 @@ PCAMatrix::PCAMatrix (int d_in, int d_out,
     is_trained = false;
     max_points_per_d = 1000;
     balanced_bins = 0;
+    stream_chunk_size = 0;
+    randomized_niter = 0;
+    cov_n = 0;
 }
 
 
@@ -351,11 +565,124 @@ void eig(size_t d_in, double *cov, double *eigenvalues, int verbose)
 
 }
 
+/// orthonormalize the l vectors of size d in Q (Gram-Schmidt, applied
+/// twice for numerical stability)
+void orthonormalize (size_t d, size_t l, double *Q)
+{
+    for (size_t i = 0; i < l; i++) {
+        double *qi = Q + i * d;
+        for (int pass = 0; pass < 2; pass++) {
+            for (size_t j = 0; j < i; j++) {
+                const double *qj = Q + j * d;
+                double dot = 0;
+                for (size_t k = 0; k < d; k++) dot += qi[k] * qj[k];
+                for (size_t k = 0; k < d; k++) qi[k] -= dot * qj[k];
+            }
+        }
+        double norm = 0;
+        for (size_t k = 0; k < d; k++) norm += qi[k] * qi[k];
+        norm = sqrt (norm);
+        if (norm > 0) {
+            for (size_t k = 0; k < d; k++) qi[k] /= norm;
+        }
+    }
+}
+
+/** Leading k eigenvectors of the symmetric d-by-d matrix cov with a
+ * randomized subspace iteration (Halko et al., "Finding structure with
+ * randomness", 2011). Costs O(d^2 k) per iteration instead of O(d^3).
+ *
+ * Outputs k eigenvalues in decreasing order and the eigenvectors, size
+ * k * d. */
+void eig_randomized (size_t d, const double *cov, size_t k, int niter,
+                     double *eigenvalues, double *eigenvectors, int verbose)
+{
+    // oversampling of the subspace
+    size_t l = std::min (d, k + 10);
+    FINTEGER di = d, li = l;
+    double one = 1, zero = 0;
+
+    std::vector<double> Q (l * d), Y (l * d);
+    {
+        std::vector<float> omega (l * d);
+        float_randn (omega.data(), l * d, 1234);
+        for (size_t i = 0; i < l * d; i++) Y[i] = omega[i];
+    }
+    for (int it = 0; it <= niter; it++) {
+        if (it > 0) {
+            // Y = cov * Q
+            dgemm_ ("N", "N", &di, &li, &di, &one, cov, &di,
+                    Q.data(), &di, &zero, Y.data(), &di);
+        }
+        orthonormalize (d, l, Y.data());
+        std::swap (Q, Y);
+    }
+
+    // project cov on the subspace: B = Q^T * cov * Q
+    std::vector<double> B (l * l);
+    dgemm_ ("N", "N", &di, &li, &di, &one, cov, &di,
+            Q.data(), &di, &zero, Y.data(), &di);
+    dgemm_ ("T", "N", &li, &li, &di, &one, Q.data(), &di,
+            Y.data(), &di, &zero, B.data(), &li);
+
+    std::vector<double> evals (l);
+    eig (l, B.data(), evals.data(), verbose);
+
+    // eigenvectors in the original space: Q * V
+    dgemm_ ("N", "N", &di, &li, &li, &one, Q.data(), &di,
+            B.data(), &li, &zero, Y.data(), &di);
+    memcpy (eigenvectors, Y.data(), sizeof (double) * k * d);
+    memcpy (eigenvalues, evals.data(), sizeof (double) * k);
+}
+
+/** PCA from the covariance matrix cov (d * d, of which only the upper
+ * triangle in column-major order is used). If k > 0, only the k leading
+ * components are computed with the randomized solver. */
+void pca_from_covariance (size_t d, std::vector<double> & cov,
+                          size_t k, int niter, int verbose,
+                          std::vector<float> & PCAMat,
+                          std::vector<float> & eigenvalues)
+{
+    eigenvalues.clear ();
+    eigenvalues.resize (d);
+    if (k > 0 && k < d) {
+        // symmetrize
+        for (size_t j = 0; j < d; j++) {
+            for (size_t i = 0; i < j; i++) {
+                cov[i * d + j] = cov[j * d + i];
+            }
+        }
+        std::vector<double> evals (k), evecs (k * d);
+        eig_randomized (d, cov.data(), k, niter, evals.data(),
+                        evecs.data(), verbose);
+        PCAMat.resize (k * d);
+        for (size_t i = 0; i < k * d; i++) PCAMat[i] = evecs[i];
+        for (size_t i = 0; i < k; i++) eigenvalues[i] = evals[i];
+    } else {
+        std::vector<double> evals (d);
+        eig (d, cov.data(), evals.data(), verbose);
+        PCAMat.resize (d * d);
+        for (size_t i = 0; i < d * d; i++) PCAMat[i] = cov[i];
+        for (size_t i = 0; i < d; i++) eigenvalues[i] = evals[i];
+    }
+}
+
 
 }
 
 void PCAMatrix::train (Index::idx_t n, const float *x)
 {
+    if (stream_chunk_size > 0) {
+        // all the training vectors are used, one chunk at a time
+        cov_n = 0;
+        for (idx_t i0 = 0; i0 < n; i0 += stream_chunk_size) {
+            idx_t i1 = std::min (n, idx_t (i0 + stream_chunk_size));
+            accumulate_covariance (i1 - i0, x + i0 * d_in);
+        }
+        train_from_covariance ();
+        return;
+    }
+
     const float * x_in = x;
 
     x = fvecs_maybe_subsample (d_in, (size_t*)&n,
@@ -391,13 +718,8 @@ void PCAMatrix::train (Index::idx_t n, const float *x)
                     *ci++ = - n * mean[i] * mean[j];
             }
         }
-        {
-            FINTEGER di = d_in, ni = n;
-            float one = 1.0;
-            ssyrk_ ("Up", "Non transposed",
-                    &di, &ni, &one, (float*)x, &di, &one, cov, &di);
-
-        }
+        train_syrk (train_gemm, "Non transposed",
+                    d_in, n, 1.0, x, d_in, 1.0, cov, d_in);
         if(verbose && d_in <= 10) {
             float *ci = cov;
             printf("cov=\n");
@@ -411,15 +733,10 @@ void PCAMatrix::train (Index::idx_t n, const float *x)
         std::vector<double> covd (d_in * d_in);
         for (size_t i = 0; i < d_in * d_in; i++) covd [i] = cov [i];
 
-        std::vector<double> eigenvaluesd (d_in);
-
-        eig (d_in, covd.data (), eigenvaluesd.data (), verbose);
-
-        for (size_t i = 0; i < d_in * d_in; i++) PCAMat [i] = covd [i];
-        eigenvalues.resize (d_in);
-
-        for (size_t i = 0; i < d_in; i++)
-            eigenvalues [i] = eigenvaluesd [i];
+        pca_from_covariance (d_in, covd,
+                             randomized_niter > 0 ? d_out : 0,
+                             randomized_niter, verbose,
+                             PCAMat, eigenvalues);
 
 
     } else {
@@ -432,12 +749,8 @@ void PCAMatrix::train (Index::idx_t n, const float *x)
 
         // compute Gram matrix
         std::vector<float> gram (n * n);
-        {
-            FINTEGER di = d_in, ni = n;
-            float one = 1.0, zero = 0.0;
-            ssyrk_ ("Up", "Transposed",
-                    &ni, &di, &one, xc.data(), &di, &zero, gram.data(), &ni);
-        }
+        train_syrk (train_gemm, "Transposed",
+                    n, d_in, 1.0, xc.data(), d_in, 0.0, gram.data(), n);
 
         if(verbose && d_in <= 10) {
             float *ci = gram.data();
@@ -469,15 +782,11 @@ void PCAMatrix::train (Index::idx_t n, const float *x)
         for (size_t i = 0; i < n; i++)
             eigenvalues [i] = eigenvaluesd [i];
 
-        { // compute PCAMat = x' * v
-            FINTEGER di = d_in, ni = n;
-            float one = 1.0;
-
-            sgemm_ ("Non", "Non Trans",
-                    &di, &ni, &ni,
-                    &one, xc.data(), &di, gram.data(), &ni,
-                    &one, PCAMat.data(), &di);
-        }
+        // compute PCAMat = x' * v
+        get_train_gemm (train_gemm).sgemm (
+                "Non", "Non Trans", d_in, n, n,
+                1.0, xc.data(), d_in, gram.data(), n,
+                1.0, PCAMat.data(), d_in);
 
         if(verbose && d_in <= 10) {
             float *ci = PCAMat.data();
@@ -496,6 +805,106 @@ void PCAMatrix::train (Index::idx_t n, const float *x)
     is_trained = true;
 }
 
+void PCAMatrix::accumulate_covariance (idx_t n, const float *x)
+{
+    if (n == 0) {
+        return;
+    }
+    if (cov_n == 0) {
+        // the statistics are computed relative to the mean of the first
+        // batch, to avoid cancellations in single precision
+        cov_shift.assign (d_in, 0);
+        if (have_bias) {
+            std::vector<double> sum (d_in);
+            for (idx_t i = 0; i < n; i++) {
+                for (int j = 0; j < d_in; j++) {
+                    sum[j] += x[i * d_in + j];
+                }
+            }
+            for (int j = 0; j < d_in; j++) {
+                cov_shift[j] = sum[j] / n;
+            }
+        }
+        cov_sum.assign (d_in, 0);
+        cov_accu.assign (d_in * d_in, 0);
+    }
+
+    size_t bs = std::min (size_t (n), size_t (16384));
+    std::vector<float> xc (bs * d_in), chunk_cov (d_in * d_in);
+
+    for (idx_t i0 = 0; i0 < n; i0 += bs) {
+        idx_t i1 = std::min (n, idx_t (i0 + bs));
+        idx_t ni = i1 - i0;
+
+#pragma omp parallel for if (ni > 1000)
+        for (idx_t i = 0; i < ni; i++) {
+            for (int j = 0; j < d_in; j++) {
+                xc[i * d_in + j] = x[(i0 + i) * d_in + j] - cov_shift[j];
+            }
+        }
+        for (idx_t i = 0; i < ni; i++) {
+            for (int j = 0; j < d_in; j++) {
+                cov_sum[j] += xc[i * d_in + j];
+            }
+        }
+        train_syrk (train_gemm, "Non transposed",
+                    d_in, ni, 1.0, xc.data(), d_in, 0.0,
+                    chunk_cov.data(), d_in);
+        // accumulate the upper triangle in double precision
+#pragma omp parallel for
+        for (int j = 0; j < d_in; j++) {
+            for (int i = 0; i <= j; i++) {
+                cov_accu[j * d_in + i] += chunk_cov[j * d_in + i];
+            }
+        }
+    }
+    cov_n += n;
+}
+
+void PCAMatrix::train_from_covariance ()
+{
+    FAISS_THROW_IF_NOT_MSG (cov_n > 0, "no accumulated covariance");
+
+    // mean of the shifted vectors
+    std::vector<double> m (d_in);
+    mean.clear(); mean.resize(d_in, 0.0);
+    if (have_bias) {
+        for (int j = 0; j < d_in; j++) {
+            m[j] = cov_sum[j] / cov_n;
+            mean[j] = cov_shift[j] + m[j];
+        }
+    }
+
+    // same scaling as train(): sum of the outer products of the centered
+    // vectors
+    std::vector<double> cov (cov_accu);
+    for (int j = 0; j < d_in; j++) {
+        for (int i = 0; i <= j; i++) {
+            cov[j * d_in + i] -= cov_n * m[i] * m[j];
+        }
+    }
+
+    if (verbose) {
+        printf ("PCAMatrix::train_from_covariance: %zd vectors, "
+                "%s eigendecomposition\n", cov_n,
+                randomized_niter > 0 && d_out < d_in ?
+                "randomized" : "full");
+    }
+
+    pca_from_covariance (d_in, cov,
+                         randomized_niter > 0 ? d_out : 0,
+                         randomized_niter, verbose,
+                         PCAMat, eigenvalues);
+
+    cov_n = 0;
+    cov_shift.clear ();
+    cov_sum.clear ();
+    cov_accu.clear ();
+
+    prepare_Ab();
+    is_trained = true;
+}
+
 void PCAMatrix::copy_from (const PCAMatrix & other)
 {
     FAISS_THROW_IF_NOT (other.is_trained);
@@ -506,6 +915,18 @@ void PCAMatrix::copy_from (const PCAMatrix & other)
     is_trained = true;
 }
 
+MemoryUsage PCAMatrix::memory_usage () const
+{
+    MemoryUsage mu = LinearTransform::memory_usage ();
+    mu.add ("mean", mean);
+    mu.add ("eigenvalues", eigenvalues);
+    mu.add ("PCAMat", PCAMat);
+    mu.add ("cov_shift", cov_shift);
+    mu.add ("cov_sum", cov_sum);
+    mu.add ("cov_accu", cov_accu);
+    return mu;
+}
+
 void PCAMatrix::prepare_Ab ()
 {
     FAISS_THROW_IF_NOT_FMT (
@@ -614,7 +1035,8 @@ void PCAMatrix::prepare_Ab ()
 ITQMatrix::ITQMatrix (int d):
     LinearTransform(d, d, false),
     max_iter (50),
-    seed (123)
+    seed (123),
+    hadamard_init (false)
 {
 }
 
@@ -628,6 +1050,14 @@ void ITQMatrix::train (Index::idx_t n, const float* xf)
     if (init_rotation.size() == d * d) {
         memcpy (rotation.data(), init_rotation.data(),
                 d * d * sizeof(rotation[0]));
+    } else if (hadamard_init) {
+        HadamardRotation hrot (d, d);
+        hrot.init (seed);
+        std::vector<float> A0 (d * d);
+        hrot.make_matrix (A0.data());
+        for (size_t i = 0; i < d * d; i++) {
+            rotation[i] = A0[i];
+        }
     } else {
         RandomRotationMatrix rrot (d, d);
         rrot.init (seed);
@@ -647,26 +1077,21 @@ void ITQMatrix::train (Index::idx_t n, const float* xf)
 
     for (int i = 0; i < max_iter; i++) {
         print_if_verbose ("rotation", rotation, d, d);
-        { // rotated_data = np.dot(training_data, rotation)
-            FINTEGER di = d, ni = n;
-            double one = 1, zero = 0;
-            dgemm_ ("N", "N", &di, &ni, &di,
-                    &one, rotation.data(), &di, x.data(), &di,
-                    &zero, rotated_x.data(), &di);
-        }
+        // rotated_data = np.dot(training_data, rotation)
+        get_train_gemm (train_gemm).dgemm (
+                "N", "N", d, n, d,
+                1, rotation.data(), d, x.data(), d,
+                0, rotated_x.data(), d);
         print_if_verbose ("rotated_x", rotated_x, n, d);
         // binarize
         for (size_t j = 0; j < n * d; j++) {
             rotated_x[j] = rotated_x[j] < 0 ? -1 : 1;
         }
         // covariance matrix
-        { // rotated_data = np.dot(training_data, rotation)
-            FINTEGER di = d, ni = n;
-            double one = 1, zero = 0;
-            dgemm_ ("N", "T", &di, &di, &ni,
-                    &one, rotated_x.data(), &di, x.data(), &di,
-                    &zero, cov_mat.data(), &di);
-        }
+        get_train_gemm (train_gemm).dgemm (
+                "N", "T", d, d, n,
+                1, rotated_x.data(), d, x.data(), d,
+                0, cov_mat.data(), d);
         print_if_verbose ("cov_mat", cov_mat, d, d);
         // SVD
         {
@@ -768,6 +1193,7 @@ void ITQTransform::train (idx_t n, const float *x)
     std::unique_ptr<float []> x_pca_del;
     if (do_pca) {
         pca.have_bias = false;  // for consistency with reference implem
+        pca.train_gemm = itq.train_gemm;
         pca.train (n, x_norm.get());
         x_pca = pca.apply (n, x_norm.get());
         x_pca_del.reset(x_pca);
@@ -825,7 +1251,8 @@ OPQMatrix::OPQMatrix (int d, int M, int d2):
     niter (50),
     niter_pq (4), niter_pq_0 (40),
     verbose(false),
-    pq(nullptr)
+    pq(nullptr),
+    hadamard_init(false)
 {
     is_trained = false;
     // OPQ is quite expensive to train, so set this right.
@@ -898,8 +1325,14 @@ void OPQMatrix::train (Index::idx_t n, const float *x)
         if (verbose)
             printf("  OPQMatrix::train: making random %zd*%zd rotation\n",
                    d, d);
-        float_randn (rotation, d * d, 1234);
-        matrix_qr (d, d, rotation);
+        if (hadamard_init) {
+            HadamardRotation hrot (d, d);
+            hrot.init (1234);
+            hrot.make_matrix (rotation);
+        } else {
+            float_randn (rotation, d * d, 1234);
+            matrix_qr (d, d, rotation);
+        }
         // we use only the d * d2 upper part of the matrix
         A.resize (d * d2);
     } else {
@@ -919,15 +1352,11 @@ void OPQMatrix::train (Index::idx_t n, const float *x)
     double t0 = getmillisecs();
     for (int iter = 0; iter < niter; iter++) {
 
-        { // torch.mm(xtrain, rotation:t())
-            FINTEGER di = d, d2i = d2, ni = n;
-            float zero = 0, one = 1;
-            sgemm_ ("Transposed", "Not transposed",
-                    &d2i, &ni, &di,
-                    &one, rotation, &di,
-                    xtrain.data(), &di,
-                    &zero, xproj.data(), &d2i);
-        }
+        // torch.mm(xtrain, rotation:t())
+        get_train_gemm (train_gemm).sgemm (
+                "Transposed", "Not transposed", d2, n, d,
+                1, rotation, d, xtrain.data(), d,
+                0, xproj.data(), d2);
 
         pq_regular.cp.max_points_per_centroid = 1000;
         pq_regular.cp.niter = iter == 0 ? niter_pq_0 : niter_pq;
@@ -955,18 +1384,17 @@ void OPQMatrix::train (Index::idx_t n, const float *x)
         {
             float *u = tmp.data(), *vt = &tmp [d * d];
             float *sing_val = &tmp [2 * d * d];
-            FINTEGER di = d, d2i = d2, ni = n;
+            FINTEGER di = d, d2i = d2;
             float one = 1, zero = 0;
 
             if (verbose) {
                 printf("    X * recons\n");
             }
             // torch.mm(xtrain:t(), pq_recons)
-            sgemm_ ("Not", "Transposed",
-                    &d2i, &di, &ni,
-                    &one, pq_recons.data(), &d2i,
-                    xtrain.data(), &di,
-                    &zero, xxr.data(), &d2i);
+            get_train_gemm (train_gemm).sgemm (
+                    "Not", "Transposed", d2, d, n,
+                    1, pq_recons.data(), d2, xtrain.data(), d,
+                    0, xxr.data(), d2);
 
 
             FINTEGER lwork = -1, info = -1;
@@ -64,12 +64,37 @@ struct VectorTransform {
     virtual void reverse_transform (idx_t n, const float * xt,
                                     float *x) const;
 
+    /// memory used by the parameters, see Index::memory_usage
+    virtual MemoryUsage memory_usage () const;
+
     virtual ~VectorTransform () {}
 
 };
 
 
 
+/** The matrix products done by the training of the linear transforms
+ * whose size depends on the number of training vectors. They can be run
+ * elsewhere, e.g. on a GPU (see gpu/GpuVectorTransform.h). The arguments
+ * are those of BLAS sgemm / dgemm (column-major); the default
+ * implementation calls BLAS. */
+struct TrainingGemm {
+    virtual void sgemm (const char *transa, const char *transb,
+                        int m, int n, int k,
+                        float alpha, const float *a, int lda,
+                        const float *b, int ldb,
+                        float beta, float *c, int ldc) const;
+
+    virtual void dgemm (const char *transa, const char *transb,
+                        int m, int n, int k,
+                        double alpha, const double *a, int lda,
+                        const double *b, int ldb,
+                        double beta, double *c, int ldc) const;
+
+    virtual ~TrainingGemm () {}
+};
+
+
 /** Generic linear transformation, with bias term applied on output
  * y = A * x + b
  */
@@ -105,10 +130,16 @@ struct LinearTransform: VectorTransform {
     /// compute A^T * A to set the is_orthonormal flag
     void set_is_orthonormal ();
 
+    /// if non-NULL, used by train() for the products over the training
+    /// vectors instead of BLAS (not owned, not serialized)
+    const TrainingGemm *train_gemm;
+
     bool verbose;
     void print_if_verbose (const char*name, const std::vector<double> &mat,
                            int n, int d) const;
 
+    MemoryUsage memory_usage () const override;
+
     ~LinearTransform() override {}
 };
 
@@ -131,6 +162,44 @@ struct RandomRotationMatrix: LinearTransform {
 };
 
 
+/** Structured random rotation: nrounds of random sign flips followed by
+ * a fast Walsh-Hadamard transform, in O(d log d) instead of O(d^2) for a
+ * RandomRotationMatrix.
+ *
+ * The vectors are zero-padded to d = max(d_in, d_out). When d is not a
+ * power of 2, each round applies the Hadamard transform of the largest
+ * power of 2 p <= d on the first p components, then on the last p
+ * components, so that the transform is still orthonormal.
+ */
+struct HadamardRotation: VectorTransform {
+
+    int nrounds;    ///< nb of (sign flip, Hadamard) rounds
+
+    /// random signs (+1 or -1), size nrounds * max(d_in, d_out)
+    std::vector<float> signs;
+
+    /// both d_in > d_out and d_out < d_in are supported
+    HadamardRotation (int d_in, int d_out, int nrounds = 3);
+
+    /// must be called before the transform is used
+    void init (int seed);
+
+    /// intializes with an arbitrary seed
+    void train (idx_t n, const float* x) override;
+
+    void apply_noalloc (idx_t n, const float* x, float* xt) const override;
+
+    /// exact if d_out >= d_in
+    void reverse_transform (idx_t n, const float* xt,
+                            float* x) const override;
+
+    /// dense equivalent of the transform, size d_out * d_in
+    void make_matrix (float *A) const;
+
+    HadamardRotation ();
+};
+
+
 /** Applies a principal component analysis on a set of vectors,
  *  with optionally whitening and random rotation. */
 struct PCAMatrix: LinearTransform {
@@ -161,6 +230,22 @@ struct PCAMatrix: LinearTransform {
     /// PCA matrix, size d_in * d_in
     std::vector<float> PCAMat;
 
+    /** if > 0, train() does not subsample the training set but
+     * accumulates the covariance over all the vectors, by chunks of this
+     * size (see accumulate_covariance) */
+    size_t stream_chunk_size;
+
+    /** if > 0, compute only the d_out leading eigenvectors of the
+     * covariance with a randomized subspace iteration with this many
+     * power iterations, instead of a full eigendecomposition */
+    int randomized_niter;
+
+    /// statistics accumulated by accumulate_covariance, relative to
+    /// cov_shift (sizes d_in, d_in and d_in * d_in)
+    size_t cov_n;
+    std::vector<float> cov_shift;
+    std::vector<double> cov_sum, cov_accu;
+
     // the final matrix is computed after random rotation and/or whitening
     explicit PCAMatrix (int d_in = 0, int d_out = 0,
                         float eigen_power = 0, bool random_rotation = false);
@@ -169,9 +254,20 @@ struct PCAMatrix: LinearTransform {
     /// will be completed with 0s
     void train(idx_t n, const float* x) override;
 
+    /** streaming training: accumulate the covariance of a batch of
+     * training vectors. Can be called several times, then the PCA is
+     * computed with train_from_covariance */
+    void accumulate_covariance (idx_t n, const float *x);
+
+    /// compute the PCA from the accumulated covariance and clear it
+    void train_from_covariance ();
+
     /// copy pre-trained PCA matrix
     void copy_from (const PCAMatrix & other);
 
+    /// includes the covariance accumulated for streaming training
+    MemoryUsage memory_usage () const override;
+
     /// called after mean, PCAMat and eigenvalues are computed
     void prepare_Ab();
 
@@ -195,6 +291,10 @@ struct ITQMatrix: LinearTransform {
     // force initialization of the rotation (for debugging)
     std::vector<double> init_rotation;
 
+    /// initialize with a HadamardRotation instead of a dense random
+    /// rotation (if init_rotation is not set)
+    bool hadamard_init;
+
     explicit ITQMatrix (int d = 0);
 
     void train (idx_t n, const float* x) override;
@@ -250,6 +350,10 @@ struct OPQMatrix: LinearTransform {
     /// should be constructed with (d_out, M, _)
     ProductQuantizer * pq;
 
+    /// initialize with a HadamardRotation instead of a dense random
+    /// rotation (if A is not set)
+    bool hadamard_init;
+
     /// if d2 != -1, output vectors of this dimension
     explicit OPQMatrix (int d = 0, int M = 1, int d2 = -1);
 
@@ -19,17 +19,21 @@
 #include <faiss/IndexPreTransform.h>
 #include <faiss/IndexLSH.h>
 #include <faiss/IndexPQ.h>
+#include <faiss/IndexPQFastScan.h>
 #include <faiss/IndexIVF.h>
 #include <faiss/IndexIVFPQ.h>
 #include <faiss/IndexIVFPQR.h>
+#include <faiss/IndexIVFPQFastScan.h>
 #include <faiss/Index2Layer.h>
 #include <faiss/IndexIVFFlat.h>
 #include <faiss/IndexIVFSpectralHash.h>
 #include <faiss/MetaIndexes.h>
 #include <faiss/IndexScalarQuantizer.h>
 #include <faiss/IndexHNSW.h>
+#include <faiss/IndexNSG.h>
 #include <faiss/IndexLattice.h>
 #include <faiss/Index2Layer.h>
+#include <faiss/BlockInvertedLists.h>
 
 namespace faiss {
 
@@ -60,6 +64,7 @@ VectorTransform *Cloner::clone_VectorTransform (const VectorTransform *vt)
     TRYCLONE (PCAMatrix, vt)
     TRYCLONE (ITQMatrix, vt)
     TRYCLONE (RandomRotationMatrix, vt)
+    TRYCLONE (HadamardRotation, vt)
     TRYCLONE (LinearTransform, vt)
     {
       FAISS_THROW_MSG("clone not supported for this type of VectorTransform");
@@ -69,8 +74,10 @@ VectorTransform *Cloner::clone_VectorTransform (const VectorTransform *vt)
 
 IndexIVF * Cloner::clone_IndexIVF (const IndexIVF *ivf)
 {
+    TRYCLONE (IndexIVFPQFastScan, ivf)
     TRYCLONE (IndexIVFPQR, ivf)
     TRYCLONE (IndexIVFPQ, ivf)
+    TRYCLONE (IndexIVFFlatSorted, ivf)
     TRYCLONE (IndexIVFFlat, ivf)
     TRYCLONE (IndexIVFScalarQuantizer, ivf)
     {
@@ -82,6 +89,7 @@ IndexIVF * Cloner::clone_IndexIVF (const IndexIVF *ivf)
 Index *Cloner::clone_Index (const Index *index)
 {
     TRYCLONE (IndexPQ, index)
+    TRYCLONE (IndexPQFastScan, index)
     TRYCLONE (IndexLSH, index)
     TRYCLONE (IndexFlatL2, index)
     TRYCLONE (IndexFlatIP, index)
@@ -97,6 +105,10 @@ Index *Cloner::clone_Index (const Index *index)
                    (ivf->invlists)) {
             res->invlists = new ArrayInvertedLists(*ails);
             res->own_invlists = true;
+        } else if (auto *bils = dynamic_cast<const BlockInvertedLists*>
+                   (ivf->invlists)) {
+            res->invlists = new BlockInvertedLists(*bils);
+            res->own_invlists = true;
         } else {
             FAISS_THROW_MSG( "clone not supported for this type of inverted lists");
         }
@@ -117,6 +129,8 @@ Index *Cloner::clone_Index (const Index *index)
         for (int i = 0; i < ipt->chain.size(); i++)
             res->chain.push_back (clone_VectorTransform (ipt->chain[i]));
         res->own_fields = true;
+        res->fuse_linear = ipt->fuse_linear;
+        res->fuse_chain ();
         return res;
     } else if (const IndexIDMap *idmap =
                dynamic_cast<const IndexIDMap*> (index)) {
@@ -130,6 +144,19 @@ Index *Cloner::clone_Index (const Index *index)
         res->own_fields = true;
         res->storage = clone_Index (ihnsw->storage);
         return res;
+    } else if (const IndexNSG *insg =
+               dynamic_cast<const IndexNSG*> (index)) {
+        IndexNSG *res =
+            dynamic_cast<const IndexNSGFlat*> (index) ?
+                (IndexNSG*)new IndexNSGFlat (*(const IndexNSGFlat*)insg) :
+            dynamic_cast<const IndexNSGPQ*> (index) ?
+                (IndexNSG*)new IndexNSGPQ (*(const IndexNSGPQ*)insg) :
+            dynamic_cast<const IndexNSGSQ*> (index) ?
+                (IndexNSG*)new IndexNSGSQ (*(const IndexNSGSQ*)insg) :
+            new IndexNSG (*insg);
+        res->own_fields = true;
+        res->storage = clone_Index (insg->storage);
+        return res;
     } else if (const Index2Layer *i2l =
                dynamic_cast<const Index2Layer*> (index)) {
         Index2Layer *res = new Index2Layer (*i2l);
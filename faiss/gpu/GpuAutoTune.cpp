@@ -16,6 +16,7 @@
 #include <faiss/gpu/GpuIndexIVFFlat.h>
 #include <faiss/gpu/GpuIndexIVFPQ.h>
 #include <faiss/gpu/GpuIndexIVFScalarQuantizer.h>
+#include <faiss/gpu/GpuIndexPreTransform.h>
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/gpu/utils/DeviceUtils.h>
 
@@ -36,6 +37,9 @@ void GpuParameterSpace::initialize (const Index * index)
     if (DC (IndexPreTransform)) {
         index = ix->index;
     }
+    if (DC (GpuIndexPreTransform)) {
+        index = ix->getIndex();
+    }
     if (DC (IndexReplicas)) {
         if (ix->count() == 0) return;
         index = ix->at(0);
@@ -72,6 +76,10 @@ void GpuParameterSpace::set_index_parameter (
             set_index_parameter (ix->at(i), name, val);
         return;
     }
+    if (DC (GpuIndexPreTransform)) {
+        set_index_parameter (ix->getIndex(), name, val);
+        return;
+    }
     if (name == "nprobe") {
         if (DC (GpuIndexIVF)) {
             ix->setNumProbes (int (val));
@@ -7,27 +7,82 @@
 
 
 #include <faiss/gpu/GpuCloner.h>
+#include <exception>
+#include <thread>
 #include <typeinfo>
 
 #include <faiss/gpu/GpuIndex.h>
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/index_io.h>
+#include <faiss/IndexBinaryFlat.h>
+#include <faiss/IndexBinaryIVF.h>
 #include <faiss/IndexFlat.h>
 #include <faiss/IndexIVF.h>
 #include <faiss/IndexIVFFlat.h>
 #include <faiss/IndexScalarQuantizer.h>
 #include <faiss/IndexIVFPQ.h>
+#include <faiss/IndexIVFPQFastScan.h>
 #include <faiss/IndexReplicas.h>
 #include <faiss/IndexPreTransform.h>
 #include <faiss/MetaIndexes.h>
+#include <faiss/gpu/GpuIndexBinaryFlat.h>
+#include <faiss/gpu/GpuIndexBinaryIVF.h>
 #include <faiss/gpu/GpuIndexFlat.h>
 #include <faiss/gpu/GpuIndexIVFFlat.h>
+#include <faiss/gpu/GpuIndexIVFListShards.h>
 #include <faiss/gpu/GpuIndexIVFPQ.h>
 #include <faiss/gpu/GpuIndexIVFScalarQuantizer.h>
+#include <faiss/gpu/GpuIndexPreTransform.h>
 #include <faiss/gpu/utils/DeviceUtils.h>
 
 namespace faiss { namespace gpu {
 
+namespace {
+
+/// Returns the n indexes built by clone(i), one host thread per index if
+/// parallel. If any of the clones fails, the others are deleted and the
+/// first exception is rethrown
+template <class F>
+std::vector<Index*> clone_per_device (long n, bool parallel, F clone)
+{
+    std::vector<Index*> res(n, nullptr);
+    std::vector<std::exception_ptr> errors(n);
+
+    auto run = [&](long i) {
+        try {
+            res[i] = clone(i);
+        } catch (...) {
+            errors[i] = std::current_exception();
+        }
+    };
+
+    if (parallel && n > 1) {
+        std::vector<std::thread> threads;
+        for (long i = 0; i < n; i++) {
+            threads.emplace_back(run, i);
+        }
+        for (auto & t: threads) {
+            t.join();
+        }
+    } else {
+        for (long i = 0; i < n; i++) {
+            run(i);
+        }
+    }
+
+    for (long i = 0; i < n; i++) {
+        if (errors[i]) {
+            for (auto index: res) {
+                delete index;
+            }
+            std::rethrow_exception(errors[i]);
+        }
+    }
+    return res;
+}
+
+} // namespace
+
 
 /**********************************************************
  * Cloning to CPU
@@ -74,6 +129,11 @@ Index *ToCPUCloner::clone_Index(const Index *index)
         ifl->copyTo(res);
         return res;
     } else if(auto ipq = dynamic_cast<const GpuIndexIVFPQ *>(index)) {
+        if (ipq->getFastScanLayout()) {
+            IndexIVFPQFastScan *res = new IndexIVFPQFastScan();
+            ipq->copyTo(res);
+            return res;
+        }
         IndexIVFPQ *res = new IndexIVFPQ();
         ipq->copyTo(res);
         return res;
@@ -92,6 +152,26 @@ Index *ToCPUCloner::clone_Index(const Index *index)
             delete res_i;
         }
         return res;
+    } else if(auto ils =
+              dynamic_cast<const GpuIndexIVFListShards *>(index)) {
+        // the shards hold disjoint lists with their own ids
+        int nshard = ils->count();
+        FAISS_ASSERT(nshard > 0);
+        Index *res = clone_Index(ils->at(0));
+        for(int i = 1; i < nshard; i++) {
+            Index *res_i = clone_Index(ils->at(i));
+            merge_index(res, res_i, false);
+            delete res_i;
+        }
+        dynamic_cast<IndexIVF *>(res)->nprobe = ils->nprobe;
+        return res;
+    } else if(auto ipt = dynamic_cast<const GpuIndexPreTransform *>(index)) {
+        IndexPreTransform *res = new IndexPreTransform();
+        ipt->copyTo(res);
+        res->index = clone_Index(ipt->getIndex());
+        res->own_fields = true;
+        res->fuse_chain();
+        return res;
     } else if(auto ipr = dynamic_cast<const IndexReplicas *>(index)) {
         // just clone one of the replicas
         FAISS_ASSERT(ipr->count() > 0);
@@ -190,6 +270,61 @@ Index *ToGpuCloner::clone_Index(const Index *index)
             res->reserveMemory(reserveVecs);
         }
 
+        return res;
+    } else if(auto ipq =
+              dynamic_cast<const faiss::IndexIVFPQFastScan *>(index)) {
+        if(verbose)
+            printf("  IndexIVFPQFastScan size %ld -> GpuIndexIVFPQ "
+                   "indicesOptions=%d useFloat16=%d reserveVecs=%ld\n",
+                   ipq->ntotal, indicesOptions, useFloat16, reserveVecs);
+        GpuIndexIVFPQConfig config;
+        config.device = device;
+        config.indicesOptions = indicesOptions;
+        config.flatConfig.useFloat16 = useFloat16CoarseQuantizer;
+        config.flatConfig.storeTransposed = storeTransposed;
+        config.useFloat16LookupTables = useFloat16;
+
+        GpuIndexIVFPQ *res = new GpuIndexIVFPQ(provider, ipq, config);
+
+        if(reserveVecs > 0 && ipq->ntotal == 0) {
+            res->reserveMemory(reserveVecs);
+        }
+
+        return res;
+    } else if(auto ipt =
+              dynamic_cast<const faiss::IndexPreTransform *>(index)) {
+        if (!usePreTransform || !GpuIndexPreTransform::isSupported(ipt)) {
+            // the chain is applied on the CPU
+            return Cloner::clone_Index(index);
+        }
+        Index *sub = clone_Index(ipt->index);
+
+        if (auto gsub = dynamic_cast<GpuIndex *>(sub)) {
+            if(verbose)
+                printf("  IndexPreTransform with %zd transforms -> "
+                       "GpuIndexPreTransform\n", ipt->chain.size());
+            GpuIndexConfig config;
+            config.device = device;
+
+            GpuIndexPreTransform *res;
+            try {
+                res = new GpuIndexPreTransform(provider, ipt, gsub, config);
+            } catch (...) {
+                delete sub;
+                throw;
+            }
+            res->ownIndex = true;
+            return res;
+        }
+
+        // the sub-index stays on the CPU, so does the chain
+        IndexPreTransform *res = new IndexPreTransform(sub);
+        res->own_fields = true;
+        for (int i = ipt->chain.size() - 1; i >= 0; i--) {
+            res->prepend_transform(clone_VectorTransform(ipt->chain[i]));
+        }
+        res->fuse_linear = ipt->fuse_linear;
+        res->fuse_chain();
         return res;
     } else {
         return Cloner::clone_Index(index);
@@ -251,6 +386,22 @@ void ToGpuClonerMultiple::copy_ivf_shard (
             printf("IndexShards shard %ld select modulo %ld = %ld\n",
                    i, n, i);
         index_ivf->copy_subset_to(*idx2, 1, n, i);
+    } else if (shard_type == 3) {
+        if(verbose)
+            printf("IndexShards shard %ld inverted lists\n", i);
+        std::vector<int> owners = GpuIndexIVFListShards::balanceLists(
+            index_ivf->invlists, n);
+        const InvertedLists *ils = index_ivf->invlists;
+
+        for (size_t l = 0; l < ils->nlist; l++) {
+            size_t ls = ils->list_size(l);
+            if (owners[l] != i || ls == 0) continue;
+
+            InvertedLists::ScopedIds ids(ils, l);
+            InvertedLists::ScopedCodes codes(ils, l);
+            idx2->invlists->add_entries(l, ls, ids.get(), codes.get());
+            idx2->ntotal += ls;
+        }
     } else {
         FAISS_THROW_FMT ("shard_type %d not implemented", shard_type);
     }
@@ -275,9 +426,8 @@ Index * ToGpuClonerMultiple::clone_Index_to_shards (const Index *index)
         "IndexIVFFlat, IndexIVFScalarQuantizer, "
         "IndexFlat and IndexIVFPQ");
 
-    std::vector<faiss::Index*> shards(n);
-
-    for(long i = 0; i < n; i++) {
+    // the shards are built on their GPUs concurrently
+    auto clone_shard = [&](long i) -> faiss::Index* {
         // make a shallow copy
         if(reserveVecs)
             sub_cloners[i].reserveVecs =
@@ -294,7 +444,7 @@ Index * ToGpuClonerMultiple::clone_Index_to_shards (const Index *index)
             idx2.use_precomputed_table = 0;
             idx2.is_trained = index->is_trained;
             copy_ivf_shard (index_ivfpq, &idx2, n, i);
-            shards[i] = sub_cloners[i].clone_Index(&idx2);
+            return sub_cloners[i].clone_Index(&idx2);
         } else if (index_ivfflat) {
             faiss::IndexIVFFlat idx2(
                        index_ivfflat->quantizer, index->d,
@@ -302,7 +452,7 @@ Index * ToGpuClonerMultiple::clone_Index_to_shards (const Index *index)
             idx2.nprobe = index_ivfflat->nprobe;
             idx2.is_trained = index->is_trained;
             copy_ivf_shard (index_ivfflat, &idx2, n, i);
-            shards[i] = sub_cloners[i].clone_Index(&idx2);
+            return sub_cloners[i].clone_Index(&idx2);
         } else if (index_ivfsq) {
             faiss::IndexIVFScalarQuantizer idx2(
                        index_ivfsq->quantizer, index->d, index_ivfsq->nlist,
@@ -314,18 +464,42 @@ Index * ToGpuClonerMultiple::clone_Index_to_shards (const Index *index)
             idx2.is_trained = index->is_trained;
             idx2.sq = index_ivfsq->sq;
             copy_ivf_shard (index_ivfsq, &idx2, n, i);
-            shards[i] = sub_cloners[i].clone_Index(&idx2);
+            return sub_cloners[i].clone_Index(&idx2);
         } else if (index_flat) {
             faiss::IndexFlat idx2 (
                                    index->d, index->metric_type);
-            shards[i] = sub_cloners[i].clone_Index(&idx2);
+            faiss::Index *shard = sub_cloners[i].clone_Index(&idx2);
             if (index->ntotal > 0) {
                 long i0 = index->ntotal * i / n;
                 long i1 = index->ntotal * (i + 1) / n;
-                shards[i]->add (i1 - i0,
-                                index_flat->xb.data() + i0 * index->d);
+                shard->add (i1 - i0,
+                            index_flat->xb.data() + i0 * index->d);
             }
+            return shard;
         }
+        return nullptr;
+    };
+
+    std::vector<faiss::Index*> shards =
+        clone_per_device (n, parallelClone, clone_shard);
+
+    if (shard_type == 3 && !index_flat) {
+        // a single coarse quantizer, on the first GPU, routes the queries
+        const IndexIVF *index_ivf = dynamic_cast<const IndexIVF *>(index);
+        GpuIndexIVFListShards *res = new GpuIndexIVFListShards(
+            sub_cloners[0].clone_Index(index_ivf->quantizer),
+            index_ivf->nlist);
+        res->ownQuantizer = true;
+        res->nprobe = index_ivf->nprobe;
+        res->listToShard = GpuIndexIVFListShards::balanceLists(
+            index_ivf->invlists, n);
+
+        for (int i = 0; i < n; i++) {
+            res->addShard(dynamic_cast<GpuIndexIVF *>(shards[i]));
+        }
+        res->own_fields = true;
+        FAISS_ASSERT(index->ntotal == res->ntotal);
+        return res;
     }
 
     bool successive_ids = index_flat != nullptr;
@@ -353,8 +527,11 @@ Index *ToGpuClonerMultiple::clone_Index(const Index *index)
        dynamic_cast<const faiss::IndexIVFPQ *>(index)) {
         if(!shard) {
             IndexReplicas * res = new IndexReplicas();
-            for(auto & sub_cloner: sub_cloners) {
-                res->addIndex(sub_cloner.clone_Index(index));
+            auto replicas = clone_per_device (
+                n, parallelClone,
+                [&](long i) { return sub_cloners[i].clone_Index(index); });
+            for(auto replica: replicas) {
+                res->addIndex(replica);
             }
             res->own_fields = true;
             return res;
@@ -404,4 +581,56 @@ faiss::Index * index_cpu_to_gpu_multiple(
     return cl.clone_Index(index);
 }
 
+
+
+/**********************************************************
+ * Cloning binary indexes
+ **********************************************************/
+
+faiss::IndexBinary * index_binary_gpu_to_cpu(
+       const faiss::IndexBinary *gpu_index)
+{
+    if(auto ii = dynamic_cast<const GpuIndexBinaryFlat *>(gpu_index)) {
+        IndexBinaryFlat *res = new IndexBinaryFlat();
+        ii->copyTo(res);
+        return res;
+    } else if(auto ii = dynamic_cast<const GpuIndexBinaryIVF *>(gpu_index)) {
+        IndexBinaryIVF *res = new IndexBinaryIVF();
+        ii->copyTo(res);
+        return res;
+    } else {
+        FAISS_THROW_MSG("cannot clone this type of binary index");
+    }
+}
+
+faiss::IndexBinary * index_binary_cpu_to_gpu(
+       GpuResourcesProvider* provider, int device,
+       const faiss::IndexBinary *index,
+       const GpuClonerOptions *options)
+{
+    GpuClonerOptions defaults;
+    const GpuClonerOptions & opts = options ? *options : defaults;
+
+    if(auto ii = dynamic_cast<const IndexBinaryFlat *>(index)) {
+        GpuIndexBinaryFlatConfig config;
+        config.device = device;
+        return new GpuIndexBinaryFlat(provider, ii, config);
+    } else if(auto ii = dynamic_cast<const IndexBinaryIVF *>(index)) {
+        GpuIndexBinaryIVFConfig config;
+        config.device = device;
+        config.indicesOptions = opts.indicesOptions;
+
+        GpuIndexBinaryIVF *res =
+            new GpuIndexBinaryIVF(provider, ii->d, ii->nlist, config);
+        if(opts.reserveVecs > 0 && ii->ntotal == 0) {
+            res->reserveMemory(opts.reserveVecs);
+        }
+
+        res->copyFrom(ii);
+        return res;
+    } else {
+        FAISS_THROW_MSG("cannot clone this type of binary index");
+    }
+}
+
 } } // namespace
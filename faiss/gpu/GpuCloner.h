@@ -10,6 +10,7 @@
 #include <vector>
 
 #include <faiss/Index.h>
+#include <faiss/IndexBinary.h>
 #include <faiss/clone_index.h>
 #include <faiss/gpu/GpuClonerOptions.h>
 #include <faiss/gpu/GpuIndex.h>
@@ -76,6 +77,15 @@ faiss::Index * index_cpu_to_gpu_multiple(
        const faiss::Index *index,
        const GpuMultipleClonerOptions *options = nullptr);
 
+/// converts a GpuIndexBinaryFlat or GpuIndexBinaryIVF to a CPU index
+faiss::IndexBinary * index_binary_gpu_to_cpu(
+       const faiss::IndexBinary *gpu_index);
+
+/// converts an IndexBinaryFlat or IndexBinaryIVF to a GPU index
+faiss::IndexBinary * index_binary_cpu_to_gpu(
+       GpuResourcesProvider* provider, int device,
+       const faiss::IndexBinary *index,
+       const GpuClonerOptions *options = nullptr);
 
 
 } } // namespace
@@ -16,12 +16,14 @@ GpuClonerOptions::GpuClonerOptions()
       usePrecomputed(false),
       reserveVecs(0),
       storeTransposed(false),
-      verbose(false) {
+      verbose(false),
+      usePreTransform(true) {
 }
 
 GpuMultipleClonerOptions::GpuMultipleClonerOptions()
     : shard(false),
-      shard_type(1)
+      shard_type(1),
+      parallelClone(true)
 {
 }
 
@@ -37,6 +37,11 @@ struct GpuClonerOptions {
 
   /// Set verbose options on the index
   bool verbose;
+
+  /// Clone an IndexPreTransform whose chain is made of LinearTransforms to
+  /// a GpuIndexPreTransform, that applies the chain on the GPU? Otherwise,
+  /// the chain is applied on the CPU in front of the GPU sub-index
+  bool usePreTransform;
 };
 
 struct GpuMultipleClonerOptions : public GpuClonerOptions {
@@ -46,8 +51,14 @@ struct GpuMultipleClonerOptions : public GpuClonerOptions {
   /// across GPUs
   bool shard;
 
-  /// IndexIVF::copy_subset_to subset type
+  /// IndexIVF::copy_subset_to subset type, or 3 to partition the inverted
+  /// lists of IVF indices across GPUs, with a single coarse quantizer
+  /// (GpuIndexIVFListShards)
   int shard_type;
+
+  /// Whether the sub-indexes are built on their GPUs concurrently, one
+  /// host thread per GPU
+  bool parallelClone;
 };
 
 } } // namespace
@@ -0,0 +1,461 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#include <faiss/gpu/GpuClustering.h>
+#include <faiss/gpu/GpuResources.h>
+#include <faiss/gpu/impl/Distance.cuh>
+#include <faiss/gpu/impl/L2Norm.cuh>
+#include <faiss/gpu/utils/CopyUtils.cuh>
+#include <faiss/gpu/utils/DeviceTensor.cuh>
+#include <faiss/gpu/utils/DeviceUtils.h>
+#include <faiss/gpu/utils/HostTensor.cuh>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/WorkerThread.h>
+#include <faiss/utils/random.h>
+#include <faiss/utils/utils.h>
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+namespace faiss { namespace gpu {
+
+namespace {
+
+// Adds each (weighted) training vector to the sum of the centroid it is
+// assigned to; one block per vector
+__global__ void
+kmeansAccumulate(Tensor<float, 2, true> vecs,
+                 float* weights,
+                 Tensor<int, 2, true> assign,
+                 Tensor<float, 2, true> sums) {
+  int vec = blockIdx.x;
+  int centroid = assign[vec][0];
+
+  if (centroid < 0) {
+    return;
+  }
+
+  float w = weights ? weights[vec] : 1.0f;
+
+  for (int d = threadIdx.x; d < vecs.getSize(1); d += blockDim.x) {
+    atomicAdd(sums[centroid][d].data(), w * vecs[vec][d]);
+  }
+}
+
+/// The part of the training set handled by one device
+struct KmeansShard {
+  std::shared_ptr<GpuResources> res;
+  int device;
+
+  /// Training vectors [start, start + num) belong to this device
+  Index::idx_t start;
+  Index::idx_t num;
+
+  /// Resident training vectors and weights, by chunk; empty if the training
+  /// vectors are streamed
+  std::vector<DeviceTensor<float, 2, true>> vecs;
+  std::vector<DeviceTensor<float, 1, true>> weights;
+
+  /// Current centroids (k x d) and their norms (L2 only)
+  DeviceTensor<float, 2, true> centroids;
+  DeviceTensor<float, 1, true> centroidNorms;
+
+  /// Sum of the training vectors assigned to each centroid (k x d)
+  DeviceTensor<float, 2, true> sums;
+
+  /// `sums` on the CPU
+  std::vector<float> hostSums;
+};
+
+} // namespace
+
+GpuClustering::GpuClustering(int d, int k,
+                             std::vector<GpuResourcesProvider*> providers,
+                             std::vector<int> devices)
+    : GpuClustering(d, k, ClusteringParameters(), providers, devices) {
+}
+
+GpuClustering::GpuClustering(int d, int k,
+                             const ClusteringParameters& cp,
+                             std::vector<GpuResourcesProvider*> providers,
+                             std::vector<int> devices)
+    : Clustering(d, k, cp),
+      maxResidentBytes(0),
+      chunkSize(65536),
+      providers_(providers),
+      devices_(devices) {
+  FAISS_THROW_IF_NOT_MSG(!providers_.empty(), "no GPU provided");
+  FAISS_THROW_IF_NOT_MSG(providers_.size() == devices_.size(),
+                         "need one resources provider per device");
+}
+
+void
+GpuClustering::train(idx_t n, const float* x, faiss::Index& index,
+                     const float* weights) {
+  FAISS_THROW_IF_NOT_FMT(n >= k,
+                         "Number of training points (%" PRId64 ") should be "
+                         "at least as large as number of clusters (%zd)",
+                         n, k);
+  FAISS_THROW_IF_NOT_FMT(index.d == d,
+                         "Index dimension %d not the same as data "
+                         "dimension %d", int(index.d), int(d));
+  FAISS_THROW_IF_NOT_MSG(index.metric_type == METRIC_L2 ||
+                         index.metric_type == METRIC_INNER_PRODUCT,
+                         "GpuClustering only supports L2 and inner product");
+  FAISS_THROW_IF_NOT_FMT(chunkSize > 0, "invalid chunkSize %d", chunkSize);
+
+  double t0 = getmillisecs();
+
+  for (size_t i = 0; i < n * d; i++) {
+    FAISS_THROW_IF_NOT_MSG(std::isfinite(x[i]),
+                           "input contains NaN's or Inf's");
+  }
+
+  // Subsample as Clustering does, to get the same training set
+  std::vector<float> xSub;
+  std::vector<float> weightsSub;
+
+  if (n > k * max_points_per_centroid) {
+    if (verbose) {
+      printf("Sampling a subset of %zd / %" PRId64 " for training\n",
+             k * max_points_per_centroid, n);
+    }
+
+    std::vector<int> perm(n);
+    rand_perm(perm.data(), n, seed);
+    n = k * max_points_per_centroid;
+
+    xSub.resize(n * d);
+    for (idx_t i = 0; i < n; i++) {
+      memcpy(xSub.data() + i * d, x + perm[i] * d, sizeof(float) * d);
+    }
+    x = xSub.data();
+
+    if (weights) {
+      weightsSub.resize(n);
+      for (idx_t i = 0; i < n; i++) {
+        weightsSub[i] = weights[perm[i]];
+      }
+      weights = weightsSub.data();
+    }
+  } else if (n < k * min_points_per_centroid) {
+    fprintf(stderr,
+            "WARNING clustering %" PRId64 " points to %zd centroids: "
+            "please provide at least %" PRId64 " training points\n",
+            n, k, idx_t(k) * min_points_per_centroid);
+  }
+
+  if (n == k) {
+    // Corner case, just copy the training set to the clusters
+    centroids.assign(x, x + n * d);
+
+    ClusteringIterationStats stats = { 0.0, 0.0, 0.0, 1.0, 0 };
+    iteration_stats.push_back(stats);
+
+    index.reset();
+    index.add(k, centroids.data());
+    return;
+  }
+
+  FAISS_THROW_IF_NOT_MSG(centroids.size() % d == 0,
+                         "size of provided input centroids not a multiple "
+                         "of dimension");
+  size_t nInputCentroids = centroids.size() / d;
+  size_t kFrozen = frozen_centroids ? nInputCentroids : 0;
+
+  bool isL2 = index.metric_type == METRIC_L2;
+  int numDevices = devices_.size();
+
+  //
+  // Split the training set across the devices, and copy the resident parts
+  //
+
+  std::vector<std::unique_ptr<KmeansShard>> shards;
+  std::vector<std::unique_ptr<WorkerThread>> workers;
+
+  for (int i = 0; i < numDevices; ++i) {
+    std::unique_ptr<KmeansShard> shard(new KmeansShard);
+    shard->res = providers_[i]->getResources();
+    shard->device = devices_[i];
+    shard->start = n * i / numDevices;
+    shard->num = n * (i + 1) / numDevices - shard->start;
+
+    DeviceScope scope(shard->device);
+    auto res = shard->res.get();
+    auto stream = res->getDefaultStreamCurrentDevice();
+
+    size_t maxBytes = maxResidentBytes;
+    if (maxBytes == 0) {
+      size_t devFree = 0;
+      size_t devTotal = 0;
+      CUDA_VERIFY(cudaMemGetInfo(&devFree, &devTotal));
+      maxBytes = devFree / 2;
+    }
+
+    bool resident = shard->num * d * sizeof(float) <= maxBytes;
+
+    if (verbose) {
+      printf("  device %d: %" PRId64 " training vectors, %s\n",
+             shard->device, shard->num, resident ? "resident" : "streamed");
+    }
+
+    for (idx_t c = 0; resident && c < shard->num; c += chunkSize) {
+      int rows = std::min((idx_t) chunkSize, shard->num - c);
+      idx_t row = shard->start + c;
+
+      shard->vecs.emplace_back(DeviceTensor<float, 2, true>(
+        res, makeDevAlloc(AllocType::Other, stream), {rows, (int) d}));
+      shard->vecs.back().copyFrom(
+        Tensor<float, 2, true>(const_cast<float*>(x) + row * d,
+                               {rows, (int) d}), stream);
+
+      if (weights) {
+        shard->weights.emplace_back(DeviceTensor<float, 1, true>(
+          res, makeDevAlloc(AllocType::Other, stream), {rows}));
+        shard->weights.back().copyFrom(
+          Tensor<float, 1, true>(const_cast<float*>(weights) + row, {rows}),
+          stream);
+      }
+    }
+
+    shard->centroids = DeviceTensor<float, 2, true>(
+      res, makeDevAlloc(AllocType::Other, stream), {(int) k, (int) d});
+    shard->centroidNorms = DeviceTensor<float, 1, true>(
+      res, makeDevAlloc(AllocType::Other, stream), {(int) k});
+    shard->sums = DeviceTensor<float, 2, true>(
+      res, makeDevAlloc(AllocType::Other, stream), {(int) k, (int) d});
+    shard->hostSums.resize(k * d);
+
+    shards.emplace_back(std::move(shard));
+    workers.emplace_back(new WorkerThread);
+  }
+
+  // One iteration of the devices: assign the training vectors of each to
+  // the current centroids, and sum them per centroid
+  std::vector<int> assign(n);
+  std::vector<float> dis(n);
+
+  auto runShard = [&](KmeansShard& shard) {
+    DeviceScope scope(shard.device);
+    auto res = shard.res.get();
+    auto stream = res->getDefaultStreamCurrentDevice();
+
+    shard.centroids.copyFrom(
+      Tensor<float, 2, true>(centroids.data(), {(int) k, (int) d}), stream);
+    if (isL2) {
+      runL2Norm(shard.centroids, true, shard.centroidNorms, true, stream);
+    }
+    shard.sums.zero(stream);
+
+    for (idx_t c = 0, chunk = 0; c < shard.num; c += chunkSize, ++chunk) {
+      int rows = std::min((idx_t) chunkSize, shard.num - c);
+      idx_t row = shard.start + c;
+
+      DeviceTensor<float, 2, true> streamedVecs;
+      DeviceTensor<float, 1, true> streamedWeights;
+      Tensor<float, 2, true> vecs;
+      float* chunkWeights = nullptr;
+
+      if (!shard.vecs.empty()) {
+        vecs = shard.vecs[chunk];
+        chunkWeights = weights ? shard.weights[chunk].data() : nullptr;
+      } else {
+        streamedVecs = toDeviceTemporary<float, 2>(
+          res, shard.device, const_cast<float*>(x) + row * d, stream,
+          {rows, (int) d});
+        vecs = streamedVecs;
+
+        if (weights) {
+          streamedWeights = toDeviceTemporary<float, 1>(
+            res, shard.device, const_cast<float*>(weights) + row, stream,
+            {rows});
+          chunkWeights = streamedWeights.data();
+        }
+      }
+
+      DeviceTensor<float, 2, true> chunkDis(
+        res, makeTempAlloc(AllocType::Other, stream), {rows, 1});
+      DeviceTensor<int, 2, true> chunkAssign(
+        res, makeTempAlloc(AllocType::Other, stream), {rows, 1});
+
+      bfKnnOnDevice(res,
+                    shard.device,
+                    stream,
+                    shard.centroids,
+                    true,
+                    isL2 ? &shard.centroidNorms : nullptr,
+                    vecs,
+                    true,
+                    1,
+                    index.metric_type,
+                    0,
+                    chunkDis,
+                    chunkAssign,
+                    false);
+
+      auto block = dim3(std::min((int) d, getMaxThreadsCurrentDevice()));
+      kmeansAccumulate<<<rows, block, 0, stream>>>(
+        vecs, chunkWeights, chunkAssign, shard.sums);
+      CUDA_TEST_ERROR();
+
+      fromDevice(chunkDis, dis.data() + row, stream);
+      fromDevice(chunkAssign, assign.data() + row, stream);
+    }
+
+    fromDevice(shard.sums, shard.hostSums.data(), stream);
+    CUDA_VERIFY(cudaStreamSynchronize(stream));
+  };
+
+  if (verbose) {
+    printf("Clustering %" PRId64 " points in %zdD to %zd clusters on %d "
+           "GPUs, redo %d times, %d iterations\n",
+           n, d, k, numDevices, nredo, niter);
+    printf("  Preprocessing in %.2f s\n", (getmillisecs() - t0) / 1000.);
+  }
+
+  // remember best iteration for redo
+  float bestObj = isL2 ? HUGE_VALF : -HUGE_VALF;
+  std::vector<ClusteringIterationStats> bestIterationStats;
+  std::vector<float> bestCentroids;
+
+  double tSearchTot = 0;
+  t0 = getmillisecs();
+
+  for (int redo = 0; redo < nredo; redo++) {
+    if (verbose && nredo > 1) {
+      printf("Outer iteration %d / %d\n", redo, nredo);
+    }
+
+    // initialize (remaining) centroids with random points from the dataset,
+    // as Clustering does
+    centroids.resize(d * k);
+    std::vector<int> perm(n);
+    rand_perm(perm.data(), n, seed + 1 + redo * 15486557L);
+
+    for (size_t i = nInputCentroids; i < k; i++) {
+      memcpy(&centroids[i * d], x + perm[i] * d, sizeof(float) * d);
+    }
+
+    post_process_centroids();
+
+    float obj = 0;
+    for (int iter = 0; iter < niter; iter++) {
+      double t0s = getmillisecs();
+
+      std::vector<std::future<bool>> futures;
+      for (int i = 0; i < numDevices; ++i) {
+        auto shard = shards[i].get();
+        futures.emplace_back(workers[i]->add([&runShard, shard]() {
+              runShard(*shard);
+            }));
+      }
+
+      std::vector<std::pair<int, std::exception_ptr>> exceptions;
+      for (int i = 0; i < numDevices; ++i) {
+        try {
+          futures[i].get();
+        } catch (...) {
+          exceptions.emplace_back(std::make_pair(i, std::current_exception()));
+        }
+      }
+      handleExceptions(exceptions);
+
+      InterruptCallback::check();
+      tSearchTot += getmillisecs() - t0s;
+
+      // accumulate objective and assignment histogram; as for
+      // split_clusters, hassign skips the frozen centroids
+      obj = 0;
+      std::vector<float> hassign(k);
+      std::vector<int> hist(k);
+
+      for (idx_t i = 0; i < n; i++) {
+        obj += dis[i];
+        hist[assign[i]]++;
+
+        if (assign[i] >= (int) kFrozen) {
+          hassign[assign[i] - kFrozen] += weights ? weights[i] : 1.0f;
+        }
+      }
+
+      // reduce the sums of the devices into the centroids
+      for (idx_t c = kFrozen; c < k; c++) {
+        float* cent = centroids.data() + c * d;
+        memset(cent, 0, sizeof(float) * d);
+
+        if (hassign[c - kFrozen] == 0) {
+          continue;
+        }
+
+        for (int i = 0; i < numDevices; ++i) {
+          const float* s = shards[i]->hostSums.data() + c * d;
+          for (size_t j = 0; j < d; j++) {
+            cent[j] += s[j];
+          }
+        }
+
+        float norm = 1 / hassign[c - kFrozen];
+        for (size_t j = 0; j < d; j++) {
+          cent[j] *= norm;
+        }
+      }
+
+      int nsplit = split_clusters(d, k, n, kFrozen,
+                                  hassign.data(), centroids.data());
+
+      // collect statistics
+      ClusteringIterationStats stats =
+        { obj, (getmillisecs() - t0) / 1000.0,
+          tSearchTot / 1000,
+          imbalance_factor(k, hist.data()),
+          nsplit };
+      iteration_stats.push_back(stats);
+
+      if (verbose) {
+        printf("  Iteration %d (%.2f s, search %.2f s): "
+               "objective=%g imbalance=%.3f nsplit=%d       \r",
+               iter, stats.time, stats.time_search, stats.obj,
+               stats.imbalance_factor, nsplit);
+        fflush(stdout);
+      }
+
+      post_process_centroids();
+      InterruptCallback::check();
+    }
+
+    if (verbose) printf("\n");
+    if (nredo > 1) {
+      if ((isL2 && obj < bestObj) || (!isL2 && obj > bestObj)) {
+        if (verbose) {
+          printf("Objective improved: keep new clusters\n");
+        }
+        bestCentroids = centroids;
+        bestIterationStats = iteration_stats;
+        bestObj = obj;
+      }
+    }
+  }
+
+  if (nredo > 1) {
+    centroids = bestCentroids;
+    iteration_stats = bestIterationStats;
+  }
+
+  // add the centroids to the index for output
+  index.reset();
+  if (!index.is_trained) {
+    index.train(k, centroids.data());
+  }
+  index.add(k, centroids.data());
+}
+
+} } // namespace
@@ -0,0 +1,66 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#pragma once
+
+#include <faiss/Clustering.h>
+#include <vector>
+
+namespace faiss { namespace gpu {
+
+class GpuResourcesProvider;
+
+/// K-means clustering that keeps the training set and the centroid updates
+/// on one or more GPUs.
+///
+/// Clustering::train with a GPU index for the assignment copies the whole
+/// training set to the GPU at every iteration, and computes the centroids on
+/// the CPU. Here, the training set is split across the devices once. Each
+/// device assigns its vectors to the nearest centroid and sums them per
+/// centroid; only these sums (k x d per device) and the assignments come
+/// back to the CPU, where the sums of all devices are reduced into the new
+/// centroids, which are then broadcast to the devices for the next
+/// iteration.
+///
+/// The part of the training set of a device stays resident in its memory if
+/// it is at most `maxResidentBytes`; otherwise it is streamed to the device
+/// by chunks of `chunkSize` vectors at every iteration.
+///
+/// The index passed to train() gives the metric (L2 or inner product) and
+/// receives the centroids on output, as for Clustering; it is not used for
+/// the assignment, and update_index is ignored.
+struct GpuClustering : public Clustering {
+  /// Runs on the given devices, using the resources of the corresponding
+  /// provider for each
+  GpuClustering(int d, int k,
+                std::vector<GpuResourcesProvider*> providers,
+                std::vector<int> devices);
+
+  GpuClustering(int d, int k,
+                const ClusteringParameters& cp,
+                std::vector<GpuResourcesProvider*> providers,
+                std::vector<int> devices);
+
+  void train(idx_t n, const float* x, faiss::Index& index,
+             const float* x_weights = nullptr) override;
+
+  /// Maximum size in bytes of the training vectors kept resident on each
+  /// device; larger training sets are streamed at every iteration. 0 (the
+  /// default) uses half of the free memory of the device
+  size_t maxResidentBytes;
+
+  /// Number of training vectors assigned per call, and per copy to the
+  /// device when streaming
+  int chunkSize;
+
+ private:
+  std::vector<GpuResourcesProvider*> providers_;
+  std::vector<int> devices_;
+};
+
+} } // namespace
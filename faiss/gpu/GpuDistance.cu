@@ -10,10 +10,20 @@
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/gpu/GpuResources.h>
 #include <faiss/gpu/impl/Distance.cuh>
+#include <faiss/gpu/utils/BlockSelectKernel.cuh>
 #include <faiss/gpu/utils/ConversionOperators.cuh>
 #include <faiss/gpu/utils/CopyUtils.cuh>
+#include <faiss/gpu/utils/DeviceDefs.cuh>
 #include <faiss/gpu/utils/DeviceUtils.h>
 #include <faiss/gpu/utils/DeviceTensor.cuh>
+#include <faiss/gpu/utils/Limits.cuh>
+#include <faiss/utils/Heap.h>
+#include <faiss/utils/WorkerThread.h>
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <future>
+#include <memory>
 
 namespace faiss { namespace gpu {
 
@@ -176,6 +186,388 @@ bfKnn(GpuResourcesProvider* res, const GpuDistanceParams& args) {
   }
 }
 
+namespace {
+
+// Fills the running results of the streaming search
+__global__ void
+bfKnnStreamingInit(Tensor<float, 2, true> dis,
+                   Tensor<int, 2, true> ids,
+                   float val) {
+  int q = blockIdx.x;
+  for (int j = threadIdx.x; j < dis.getSize(1); j += blockDim.x) {
+    dis[q][j] = val;
+    ids[q][j] = -1;
+  }
+}
+
+// Concatenates the running results of each query (k columns) with the
+// results of a tile, whose ids are shifted by the first row of the tile;
+// one block per query
+__global__ void
+bfKnnStreamingConcat(Tensor<float, 2, true> bestDis,
+                     Tensor<int, 2, true> bestIds,
+                     Tensor<float, 2, true> tileDis,
+                     Tensor<int, 2, true> tileIds,
+                     int offset,
+                     Tensor<float, 2, true> catDis,
+                     Tensor<int, 2, true> catIds) {
+  int q = blockIdx.x;
+  int k = bestDis.getSize(1);
+
+  for (int j = threadIdx.x; j < catDis.getSize(1); j += blockDim.x) {
+    if (j < k) {
+      catDis[q][j] = bestDis[q][j];
+      catIds[q][j] = bestIds[q][j];
+    } else {
+      int id = tileIds[q][j - k];
+      catDis[q][j] = tileDis[q][j - k];
+      catIds[q][j] = id < 0 ? -1 : id + offset;
+    }
+  }
+}
+
+// Whether p is host memory registered with CUDA (cudaHostAlloc)
+bool isPinnedHostMemory(const void* p) {
+  cudaPointerAttributes att;
+  cudaError_t err = cudaPointerGetAttributes(&att, p);
+
+  if (err != cudaSuccess) {
+    // pageable memory before CUDA 11: reset the error status
+    cudaGetLastError();
+    return false;
+  }
+
+#if CUDART_VERSION < 10000
+  return att.memoryType == cudaMemoryTypeHost;
+#else
+  return att.type == cudaMemoryTypeHost;
+#endif
+}
+
+// Pinned host buffer, freed once the copies of `stream` are done
+struct PinnedStaging {
+  PinnedStaging(size_t bytes, cudaStream_t stream)
+      : buf(nullptr), stream(stream) {
+    CUDA_VERIFY(cudaHostAlloc(&buf, bytes, cudaHostAllocDefault));
+  }
+
+  ~PinnedStaging() {
+    cudaStreamSynchronize(stream);
+    cudaFreeHost(buf);
+  }
+
+  void* buf;
+  cudaStream_t stream;
+};
+
+// Searches the database rows [start, start + num) on one device, by tiles
+// of tileRows; the results (global row numbers) are written to the host
+// arrays outDis / outIds of size numQueries x k
+template <typename T>
+void bfKnnStreamingDevice(GpuResources* res,
+                          int device,
+                          const GpuDistanceParams& args,
+                          int start,
+                          int num,
+                          int tileRows,
+                          float* outDis,
+                          int* outIds) {
+  DeviceScope scope(device);
+  auto stream = res->getDefaultStream(device);
+  auto copyStream = res->getAsyncCopyStream(device);
+
+  int nq = args.numQueries;
+  int k = args.k;
+  int dims = args.dims;
+  bool dir = args.metric == faiss::MetricType::METRIC_INNER_PRODUCT;
+
+  auto queries = toDeviceNonTemporary<T, 2>(
+    res, device, const_cast<T*>(reinterpret_cast<const T*>(args.queries)),
+    stream, {nq, dims});
+
+  // Running results
+  DeviceTensor<float, 2, true> bestDis(
+    res, makeDevAlloc(AllocType::Other, stream), {nq, k});
+  DeviceTensor<int, 2, true> bestIds(
+    res, makeDevAlloc(AllocType::Other, stream), {nq, k});
+
+  int block = std::min(2 * k, getMaxThreadsCurrentDevice());
+  bfKnnStreamingInit<<<nq, block, 0, stream>>>(
+    bestDis, bestIds,
+    dir ? Limits<float>::getMin() : Limits<float>::getMax());
+  CUDA_TEST_ERROR();
+
+  // Double-buffered tiles of the database
+  tileRows = std::min(tileRows, num);
+  size_t tileBytes = (size_t) tileRows * dims * sizeof(T);
+  const T* vectors = reinterpret_cast<const T*>(args.vectors);
+
+  std::vector<DeviceTensor<T, 2, true>> tiles;
+  std::vector<std::unique_ptr<PinnedStaging>> staging;
+  for (int b = 0; b < 2; ++b) {
+    tiles.emplace_back(DeviceTensor<T, 2, true>(
+      res, makeDevAlloc(AllocType::Other, stream), {tileRows, dims}));
+  }
+  if (!isPinnedHostMemory(vectors)) {
+    for (int b = 0; b < 2; ++b) {
+      staging.emplace_back(new PinnedStaging(tileBytes, copyStream));
+    }
+  }
+
+  // tile copied to buffer b / search of buffer b done
+  std::unique_ptr<CudaEvent> copied[2];
+  std::unique_ptr<CudaEvent> consumed[2];
+
+  int numTiles = (num + tileRows - 1) / tileRows;
+
+  auto tileRange = [&](int t, int& row0, int& rows) {
+    row0 = start + t * tileRows;
+    rows = std::min(tileRows, start + num - row0);
+  };
+
+  auto issueCopy = [&](int t) {
+    int b = t % 2;
+    int row0, rows;
+    tileRange(t, row0, rows);
+
+    // the device buffer is reused once the search of tile t - 2 is done
+    if (consumed[b]) {
+      consumed[b]->streamWaitOnEvent(copyStream);
+    }
+
+    const T* src = vectors + (size_t) row0 * dims;
+    size_t bytes = (size_t) rows * dims * sizeof(T);
+
+    if (!staging.empty()) {
+      // the staging buffer is reused once the copy of tile t - 2 is done
+      if (copied[b]) {
+        copied[b]->cpuWaitOnEvent();
+      }
+      memcpy(staging[b]->buf, src, bytes);
+      src = reinterpret_cast<const T*>(staging[b]->buf);
+    }
+
+    CUDA_VERIFY(cudaMemcpyAsync(tiles[b].data(), src, bytes,
+                                cudaMemcpyHostToDevice, copyStream));
+    copied[b].reset(new CudaEvent(copyStream));
+  };
+
+  issueCopy(0);
+
+  for (int t = 0; t < numTiles; ++t) {
+    // the copy of the next tile overlaps with the search of this one
+    if (t + 1 < numTiles) {
+      issueCopy(t + 1);
+    }
+
+    int b = t % 2;
+    int row0, rows;
+    tileRange(t, row0, rows);
+    copied[b]->streamWaitOnEvent(stream);
+
+    Tensor<T, 2, true> tile(tiles[b].data(), {rows, dims});
+    int kTile = std::min(k, rows);
+
+    DeviceTensor<float, 1, true> tileNorms;
+    if (args.vectorNorms) {
+      tileNorms = toDeviceTemporary<float, 1>(
+        res, device, const_cast<float*>(args.vectorNorms) + row0, stream,
+        {rows});
+    }
+
+    DeviceTensor<float, 2, true> tileDis(
+      res, makeTempAlloc(AllocType::Other, stream), {nq, kTile});
+    DeviceTensor<int, 2, true> tileIds(
+      res, makeTempAlloc(AllocType::Other, stream), {nq, kTile});
+
+    bfKnnOnDevice<T>(res,
+                     device,
+                     stream,
+                     tile,
+                     true,
+                     args.vectorNorms ? &tileNorms : nullptr,
+                     queries,
+                     true,
+                     kTile,
+                     args.metric,
+                     args.metricArg,
+                     tileDis,
+                     tileIds,
+                     false);
+
+    // k-way merge with the running results
+    DeviceTensor<float, 2, true> catDis(
+      res, makeTempAlloc(AllocType::Other, stream), {nq, k + kTile});
+    DeviceTensor<int, 2, true> catIds(
+      res, makeTempAlloc(AllocType::Other, stream), {nq, k + kTile});
+
+    bfKnnStreamingConcat<<<nq, block, 0, stream>>>(
+      bestDis, bestIds, tileDis, tileIds, row0, catDis, catIds);
+    CUDA_TEST_ERROR();
+
+    runBlockSelectPair(catDis, catIds, bestDis, bestIds, dir, k, stream);
+
+    consumed[b].reset(new CudaEvent(stream));
+  }
+
+  fromDevice<float, 2>(bestDis, outDis, stream);
+  fromDevice<int, 2>(bestIds, outIds, stream);
+  CUDA_VERIFY(cudaStreamSynchronize(stream));
+}
+
+// Merges the results of the devices into the output heaps
+template <typename C>
+void bfKnnStreamingMerge(int nq,
+                         int k,
+                         const std::vector<std::vector<float>>& dis,
+                         const std::vector<std::vector<int>>& ids,
+                         float* outDis,
+                         Index::idx_t* outIds) {
+#pragma omp parallel for if (nq > 100)
+  for (int q = 0; q < nq; ++q) {
+    float* heapDis = outDis + (size_t) q * k;
+    Index::idx_t* heapIds = outIds + (size_t) q * k;
+    heap_heapify<C>(k, heapDis, heapIds);
+
+    for (size_t s = 0; s < dis.size(); ++s) {
+      for (int j = 0; j < k; ++j) {
+        float v = dis[s][(size_t) q * k + j];
+        int id = ids[s][(size_t) q * k + j];
+
+        if (id >= 0 && C::cmp(heapDis[0], v)) {
+          heap_pop<C>(k, heapDis, heapIds);
+          heap_push<C>(k, heapDis, heapIds, v, id);
+        }
+      }
+    }
+
+    heap_reorder<C>(k, heapDis, heapIds);
+  }
+}
+
+template <typename T>
+void bfKnnStreamingConvert(const std::vector<GpuResourcesProvider*>& providers,
+                           const std::vector<int>& devices,
+                           const GpuDistanceParams& args,
+                           int tileSize) {
+  int numDevices = devices.size();
+  int nq = args.numQueries;
+  int k = args.k;
+
+  int tileRows = tileSize > 0 ? tileSize :
+    std::max(k, (int) ((64 << 20) / ((size_t) args.dims * sizeof(T))));
+
+  std::vector<std::vector<float>> dis(numDevices);
+  std::vector<std::vector<int>> ids(numDevices);
+  std::vector<std::unique_ptr<WorkerThread>> workers;
+  std::vector<std::future<bool>> futures;
+
+  for (int i = 0; i < numDevices; ++i) {
+    int start = (int64_t) args.numVectors * i / numDevices;
+    int num = (int64_t) args.numVectors * (i + 1) / numDevices - start;
+
+    dis[i].resize((size_t) nq * k);
+    ids[i].resize((size_t) nq * k, -1);
+
+    if (num == 0) {
+      continue;
+    }
+
+    auto provider = providers[i];
+    int device = devices[i];
+    float* outDis = dis[i].data();
+    int* outIds = ids[i].data();
+
+    workers.emplace_back(new WorkerThread);
+    futures.emplace_back(workers.back()->add(
+      [provider, device, &args, start, num, tileRows, outDis, outIds]() {
+        // Don't let the resources go out of scope
+        auto res = provider->getResources();
+        bfKnnStreamingDevice<T>(res.get(), device, args, start, num,
+                                tileRows, outDis, outIds);
+      }));
+  }
+
+  std::vector<std::pair<int, std::exception_ptr>> exceptions;
+  for (int i = 0; i < futures.size(); ++i) {
+    try {
+      futures[i].get();
+    } catch (...) {
+      exceptions.emplace_back(std::make_pair(i, std::current_exception()));
+    }
+  }
+  handleExceptions(exceptions);
+
+  std::vector<Index::idx_t> outIds64;
+  Index::idx_t* outIds = (Index::idx_t*) args.outIndices;
+  if (args.outIndicesType == IndicesDataType::I32) {
+    outIds64.resize((size_t) nq * k);
+    outIds = outIds64.data();
+  }
+
+  if (args.metric == faiss::MetricType::METRIC_INNER_PRODUCT) {
+    bfKnnStreamingMerge<CMin<float, Index::idx_t>>(
+      nq, k, dis, ids, args.outDistances, outIds);
+  } else {
+    bfKnnStreamingMerge<CMax<float, Index::idx_t>>(
+      nq, k, dis, ids, args.outDistances, outIds);
+  }
+
+  if (args.outIndicesType == IndicesDataType::I32) {
+    int* out = (int*) args.outIndices;
+    for (size_t i = 0; i < outIds64.size(); ++i) {
+      out[i] = (int) outIds64[i];
+    }
+  }
+}
+
+} // namespace
+
+void
+bfKnnStreaming(const std::vector<GpuResourcesProvider*>& resources,
+               const std::vector<int>& devices,
+               const GpuDistanceParams& args,
+               int tileSize) {
+  FAISS_THROW_IF_NOT_MSG(!resources.empty() &&
+                         resources.size() == devices.size(),
+                         "bfKnnStreaming: need one resources object per "
+                         "device");
+  FAISS_THROW_IF_NOT_MSG(args.k > 0 && args.k <= GPU_MAX_SELECTION_K,
+                         "bfKnnStreaming: k must be > 0 and <= "
+                         "GPU_MAX_SELECTION_K");
+  FAISS_THROW_IF_NOT_MSG(args.dims > 0,
+                         "bfKnnStreaming: dims must be > 0");
+  FAISS_THROW_IF_NOT_MSG(args.numVectors > 0,
+                         "bfKnnStreaming: numVectors must be > 0");
+  FAISS_THROW_IF_NOT_MSG(args.numQueries > 0,
+                         "bfKnnStreaming: numQueries must be > 0");
+  FAISS_THROW_IF_NOT_MSG(args.vectors && args.queries &&
+                         args.outDistances && args.outIndices,
+                         "bfKnnStreaming: vectors, queries and outputs must "
+                         "be provided (passed null)");
+  FAISS_THROW_IF_NOT_MSG(args.vectorsRowMajor && args.queriesRowMajor,
+                         "bfKnnStreaming: vectors and queries must be "
+                         "row major");
+  FAISS_THROW_IF_NOT_MSG(
+    getDeviceForAddress(args.vectors) == -1 &&
+    getDeviceForAddress(args.outDistances) == -1 &&
+    getDeviceForAddress(args.outIndices) == -1 &&
+    (!args.vectorNorms || getDeviceForAddress(args.vectorNorms) == -1),
+    "bfKnnStreaming: vectors, vectorNorms and outputs must be on the host");
+  FAISS_THROW_IF_NOT_MSG(
+    args.vectorType == args.queryType,
+    "limitation: both vectorType and queryType must currently "
+    "be the same (F32 or F16");
+
+  if (args.vectorType == DistanceDataType::F32) {
+    bfKnnStreamingConvert<float>(resources, devices, args, tileSize);
+  } else if (args.vectorType == DistanceDataType::F16) {
+    bfKnnStreamingConvert<half>(resources, devices, args, tileSize);
+  } else {
+    FAISS_THROW_MSG("unknown vectorType");
+  }
+}
+
 // legacy version
 void
 bruteForceKnn(GpuResourcesProvider* res,
@@ -9,6 +9,7 @@
 #pragma once
 
 #include <faiss/Index.h>
+#include <vector>
 
 namespace faiss { namespace gpu {
 
@@ -126,6 +127,27 @@ struct GpuDistanceParams {
 /// nearest neighbors with respect to the given metric
 void bfKnn(GpuResourcesProvider* resources, const GpuDistanceParams& args);
 
+/// Brute-force k-nearest neighbor search in a database that does not fit
+/// in GPU memory. `args.vectors` (row major) is on the host, eg. in pinned
+/// memory or in a memory-mapped file, and is streamed to the GPU(s) by tiles
+/// of `tileSize` vectors (0 = tiles of about 64 MB). The copy of the next
+/// tile (on the async copy stream, through pinned staging buffers if
+/// `vectors` is not pinned) overlaps with the search of the current one, and
+/// the results of each tile are merged on the device into running top-k
+/// results.
+///
+/// With several devices, the database is split in contiguous ranges, one per
+/// device (resources[i] for devices[i]), searched in parallel, and the
+/// results of the devices are merged on the CPU.
+///
+/// The queries (row major) can be on the host or on any device, they are
+/// copied to each device. The outputs and the optional vectorNorms are on
+/// the host. Requires k <= GPU_MAX_SELECTION_K.
+void bfKnnStreaming(const std::vector<GpuResourcesProvider*>& resources,
+                    const std::vector<int>& devices,
+                    const GpuDistanceParams& args,
+                    int tileSize = 0);
+
 /// Deprecated legacy implementation
 void bruteForceKnn(GpuResourcesProvider* resources,
                    faiss::MetricType metric,
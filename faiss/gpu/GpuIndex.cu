@@ -7,11 +7,14 @@
 
 
 #include <faiss/gpu/GpuIndex.h>
+#include <faiss/impl/AuxIndexStructures.h>
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/gpu/GpuResources.h>
 #include <faiss/gpu/utils/CopyUtils.cuh>
 #include <faiss/gpu/utils/DeviceUtils.h>
 #include <faiss/gpu/utils/StaticUtils.h>
+#include <faiss/gpu/utils/Timer.h>
+#include <faiss/utils/instrumentation.h>
 #include <limits>
 #include <memory>
 
@@ -43,7 +46,8 @@ GpuIndex::GpuIndex(std::shared_ptr<GpuResources> resources,
     Index(dims, metric),
     resources_(resources),
     config_(config),
-    minPagedSize_(kMinPageSize) {
+    minPagedSize_(kMinPageSize),
+    maxRangeResults_(0) {
   FAISS_THROW_IF_NOT_FMT(config_.device < getNumDevices(),
                      "Invalid GPU device %d", config_.device);
 
@@ -95,6 +99,20 @@ GpuIndex::getMinPagingSize() const {
   return minPagedSize_;
 }
 
+void
+GpuIndex::setMaxRangeResults(int maxResults) {
+  FAISS_THROW_IF_NOT_FMT(maxResults >= 0 && maxResults <= getMaxSearchK_(),
+                         "GPU index only supports max range results <= %d "
+                         "(requested %d)",
+                         getMaxSearchK_(), maxResults);
+  maxRangeResults_ = maxResults;
+}
+
+int
+GpuIndex::getMaxRangeResults() const {
+  return maxRangeResults_;
+}
+
 void
 GpuIndex::add(Index::idx_t n, const float* x) {
   // Pass to add_with_ids
@@ -207,9 +225,9 @@ GpuIndex::assign(Index::idx_t n,
                          std::numeric_limits<int>::max());
 
   // Maximum k-selection supported is based on the CUDA SDK
-  FAISS_THROW_IF_NOT_FMT(k <= (Index::idx_t) getMaxKSelection(),
+  FAISS_THROW_IF_NOT_FMT(k <= (Index::idx_t) getMaxSearchK_(),
                          "GPU index only supports k <= %d (requested %d)",
-                         getMaxKSelection(),
+                         getMaxSearchK_(),
                          (int) k); // select limitation
 
   DeviceScope scope(config_.device);
@@ -226,12 +244,20 @@ GpuIndex::assign(Index::idx_t n,
   search(n, x, k, distances.data(), labels);
 }
 
+int
+GpuIndex::getMaxSearchK_() const {
+  return getMaxKSelection();
+}
+
 void
 GpuIndex::search(Index::idx_t n,
                  const float* x,
                  Index::idx_t k,
                  float* distances,
-                 Index::idx_t* labels) const {
+                 Index::idx_t* labels,
+                 const SearchParameters *params) const {
+  FAISS_THROW_IF_NOT_MSG(!params,
+                         "search params not supported for this index");
   FAISS_THROW_IF_NOT_MSG(this->is_trained, "Index not trained");
 
   // For now, only support <= max int results
@@ -240,9 +266,9 @@ GpuIndex::search(Index::idx_t n,
                          std::numeric_limits<int>::max());
 
   // Maximum k-selection supported is based on the CUDA SDK
-  FAISS_THROW_IF_NOT_FMT(k <= (Index::idx_t) getMaxKSelection(),
+  FAISS_THROW_IF_NOT_FMT(k <= (Index::idx_t) getMaxSearchK_(),
                          "GPU index only supports k <= %d (requested %d)",
-                         getMaxKSelection(),
+                         getMaxSearchK_(),
                          (int) k); // select limitation
 
   if (n == 0 || k == 0) {
@@ -250,9 +276,26 @@ GpuIndex::search(Index::idx_t n,
     return;
   }
 
+  if (instrumentation_enabled) {
+    instrumentation_count(COUNTER_NQ, n);
+  }
+
   DeviceScope scope(config_.device);
   auto stream = resources_->getDefaultStream(config_.device);
 
+  // If the queries and the outputs are all on the CPU, pipeline the copies
+  // with the search
+  if (getDeviceForAddress(x) == -1 &&
+      getDeviceForAddress(distances) == -1 &&
+      getDeviceForAddress(labels) == -1) {
+    int tileSize = getPipelineTileSize_((int) k);
+
+    if (tileSize > 0 && n > tileSize) {
+      searchFromCpuPipelined_(n, x, k, distances, labels, tileSize);
+      return;
+    }
+  }
+
   // We guarantee that the searchImpl_ will be called with device-resident
   // pointers.
 
@@ -298,10 +341,51 @@ GpuIndex::search(Index::idx_t n,
   }
 
   // Copy back if necessary
+  GpuStageTimer copyTimer(STAGE_COPY, stream);
   fromDevice<float, 2>(outDistances, distances, stream);
   fromDevice<Index::idx_t, 2>(outLabels, labels, stream);
 }
 
+void
+GpuIndex::range_search(Index::idx_t n,
+                       const float* x,
+                       float radius,
+                       RangeSearchResult* result) const {
+  FAISS_THROW_IF_NOT_MSG(this->is_trained, "Index not trained");
+
+  // For now, only support <= max int results
+  FAISS_THROW_IF_NOT_FMT(n <= (Index::idx_t) std::numeric_limits<int>::max(),
+                         "GPU index only supports up to %d indices",
+                         std::numeric_limits<int>::max());
+
+  if (n == 0) {
+    result->lims[0] = 0;
+    return;
+  }
+
+  DeviceScope scope(config_.device);
+  auto stream = resources_->getDefaultStream(config_.device);
+
+  // The results are compacted on the device and copied to `result` once
+  // their number is known, so only the queries need to be on the GPU
+  auto vecs = toDeviceTemporary<float, 2>(resources_.get(),
+                                          config_.device,
+                                          const_cast<float*>(x),
+                                          stream,
+                                          {(int) n, (int) this->d});
+
+  rangeSearchImpl_((int) n, vecs.data(), radius, maxRangeResults_, result);
+}
+
+void
+GpuIndex::rangeSearchImpl_(int n,
+                           const float* x,
+                           float radius,
+                           int maxResults,
+                           RangeSearchResult* result) const {
+  FAISS_THROW_MSG("range search not implemented for this type of index");
+}
+
 void
 GpuIndex::searchNonPaged_(int n,
                           const float* x,
@@ -312,11 +396,13 @@ GpuIndex::searchNonPaged_(int n,
 
   // Make sure arguments are on the device we desire; use temporary
   // memory allocations to move it if necessary
+  GpuStageTimer copyTimer(STAGE_COPY, stream);
   auto vecs = toDeviceTemporary<float, 2>(resources_.get(),
                                           config_.device,
                                           const_cast<float*>(x),
                                           stream,
                                           {n, (int) this->d});
+  copyTimer.stop();
 
   searchImpl_(n, vecs.data(), k, outDistancesData, outIndicesData);
 }
@@ -344,6 +430,10 @@ GpuIndex::searchFromCpuPaged_(int n,
     for (int cur = 0; cur < n; cur += batchSize) {
       int num = std::min(batchSize, n - cur);
 
+      if (instrumentation_enabled) {
+        instrumentation_count(COUNTER_GPU_PAGES, 1);
+      }
+
       auto outDistancesSlice = outDistances.narrowOutermost(cur, num);
       auto outIndicesSlice = outIndices.narrowOutermost(cur, num);
 
@@ -485,6 +575,10 @@ GpuIndex::searchFromCpuPaged_(int n,
              x + (size_t) cur1 * this->d,
              (size_t) numToCopy * this->d * sizeof(float));
 
+      if (instrumentation_enabled) {
+        instrumentation_count(COUNTER_GPU_PAGES, 1);
+      }
+
       // We pick up from here
       cur2 = cur1;
       cur1 += numToCopy;
@@ -493,6 +587,178 @@ GpuIndex::searchFromCpuPaged_(int n,
   }
 }
 
+int
+GpuIndex::getPipelineTileSize_(int k) const {
+  auto pinnedAlloc = resources_->getPinnedMemory();
+  if (!pinnedAlloc.first) {
+    return 0;
+  }
+
+  // Each of the two pinned buffers holds the queries and the results of a
+  // tile
+  size_t bytesPerQuery =
+    sizeof(float) * this->d + (sizeof(float) + sizeof(Index::idx_t)) * k;
+  size_t bytesPerBuffer = utils::roundDown(pinnedAlloc.second / 2,
+                                           (size_t) 16);
+  size_t tileSize = bytesPerBuffer / bytesPerQuery;
+
+  // Bound by the maximum number of queries per searchImpl_ call
+  return (int) std::min(tileSize, kSearchVecSize);
+}
+
+void
+GpuIndex::searchFromCpuPipelined_(int n,
+                                  const float* x,
+                                  int k,
+                                  float* distances,
+                                  Index::idx_t* labels,
+                                  int tileSize) const {
+  //
+  // Per tile, on two alternating sets of buffers:
+  //
+  // 1 CPU copy of the queries -> pinned
+  // 2 pinned copy -> GPU (copy stream)
+  // 3 GPU search (default stream)
+  // 4 GPU copy of the results -> pinned (copy stream)
+  // 5 pinned copy -> CPU results
+  //
+  // Iteration t issues 1-3 for tile t, 4 for tile t - 1 and 5 for tile
+  // t - 2, so that the copies of tiles t + 1 and t - 1 both run while tile t
+  // is searched. Only events order the streams and the CPU.
+  //
+  auto defaultStream = resources_->getDefaultStream(config_.device);
+  auto copyStream = resources_->getAsyncCopyStream(config_.device);
+
+  int numTiles = utils::divUp(n, tileSize);
+
+  // Pinned memory layout per buffer: labels, distances, queries
+  auto pinnedAlloc = resources_->getPinnedMemory();
+  size_t bytesPerBuffer = utils::roundDown(pinnedAlloc.second / 2,
+                                           (size_t) 16);
+
+  Index::idx_t* pinnedLabels[2];
+  float* pinnedDistances[2];
+  float* pinnedQueries[2];
+
+  for (int b = 0; b < 2; ++b) {
+    char* p = (char*) pinnedAlloc.first + b * bytesPerBuffer;
+    pinnedLabels[b] = (Index::idx_t*) p;
+    pinnedDistances[b] = (float*) (pinnedLabels[b] + (size_t) tileSize * k);
+    pinnedQueries[b] = pinnedDistances[b] + (size_t) tileSize * k;
+  }
+
+  std::unique_ptr<DeviceTensor<float, 2, true>> gpuQueries[2];
+  std::unique_ptr<DeviceTensor<float, 2, true>> gpuDistances[2];
+  std::unique_ptr<DeviceTensor<Index::idx_t, 2, true>> gpuLabels[2];
+
+  for (int b = 0; b < 2; ++b) {
+    gpuQueries[b].reset(new DeviceTensor<float, 2, true>(
+      resources_.get(), makeTempAlloc(AllocType::Other, defaultStream),
+      {tileSize, (int) this->d}));
+    gpuDistances[b].reset(new DeviceTensor<float, 2, true>(
+      resources_.get(), makeTempAlloc(AllocType::Other, defaultStream),
+      {tileSize, k}));
+    gpuLabels[b].reset(new DeviceTensor<Index::idx_t, 2, true>(
+      resources_.get(), makeTempAlloc(AllocType::Other, defaultStream),
+      {tileSize, k}));
+  }
+
+  // Completion of steps 2, 3 and 4 of the last tile using each buffer
+  std::unique_ptr<CudaEvent> eventQueriesCopied[2];
+  std::unique_ptr<CudaEvent> eventSearchDone[2];
+  std::unique_ptr<CudaEvent> eventResultsCopied[2];
+
+  auto tileStart = [tileSize](int t) { return t * tileSize; };
+  auto tileNum = [tileSize, n](int t) {
+    return std::min(tileSize, n - t * tileSize);
+  };
+
+  for (int t = 0; t < numTiles + 2; ++t) {
+    if (t < numTiles) {
+      int b = t % 2;
+      int num = tileNum(t);
+
+      // 1: the pinned queries of tile t - 2 must have reached the GPU
+      if (eventQueriesCopied[b]) {
+        eventQueriesCopied[b]->cpuWaitOnEvent();
+      }
+
+      memcpy(pinnedQueries[b],
+             x + (size_t) tileStart(t) * this->d,
+             (size_t) num * this->d * sizeof(float));
+
+      if (instrumentation_enabled) {
+        instrumentation_count(COUNTER_GPU_PAGES, 1);
+      }
+
+      // 2: the GPU queries of tile t - 2 must have been searched
+      if (eventSearchDone[b]) {
+        eventSearchDone[b]->streamWaitOnEvent(copyStream);
+      }
+
+      CUDA_VERIFY(cudaMemcpyAsync(gpuQueries[b]->data(),
+                                  pinnedQueries[b],
+                                  (size_t) num * this->d * sizeof(float),
+                                  cudaMemcpyHostToDevice,
+                                  copyStream));
+      eventQueriesCopied[b].reset(new CudaEvent(copyStream));
+
+      // 3: the GPU results of tile t - 2 must have been copied out
+      eventQueriesCopied[b]->streamWaitOnEvent(defaultStream);
+      if (eventResultsCopied[b]) {
+        eventResultsCopied[b]->streamWaitOnEvent(defaultStream);
+      }
+
+      searchImpl_(num,
+                  gpuQueries[b]->data(),
+                  k,
+                  gpuDistances[b]->data(),
+                  gpuLabels[b]->data());
+      eventSearchDone[b].reset(new CudaEvent(defaultStream));
+    }
+
+    if (t >= 1 && t - 1 < numTiles) {
+      // 4: results of tile t - 1 to pinned memory; that buffer was drained
+      // to the CPU results at the previous iteration
+      int b = (t - 1) % 2;
+      int num = tileNum(t - 1);
+
+      eventSearchDone[b]->streamWaitOnEvent(copyStream);
+
+      CUDA_VERIFY(cudaMemcpyAsync(pinnedDistances[b],
+                                  gpuDistances[b]->data(),
+                                  (size_t) num * k * sizeof(float),
+                                  cudaMemcpyDeviceToHost,
+                                  copyStream));
+      CUDA_VERIFY(cudaMemcpyAsync(pinnedLabels[b],
+                                  gpuLabels[b]->data(),
+                                  (size_t) num * k * sizeof(Index::idx_t),
+                                  cudaMemcpyDeviceToHost,
+                                  copyStream));
+      eventResultsCopied[b].reset(new CudaEvent(copyStream));
+    }
+
+    if (t >= 2) {
+      // 5: results of tile t - 2 to the CPU outputs
+      int b = (t - 2) % 2;
+      int num = tileNum(t - 2);
+
+      eventResultsCopied[b]->cpuWaitOnEvent();
+
+      memcpy(distances + (size_t) tileStart(t - 2) * k,
+             pinnedDistances[b],
+             (size_t) num * k * sizeof(float));
+      memcpy(labels + (size_t) tileStart(t - 2) * k,
+             pinnedLabels[b],
+             (size_t) num * k * sizeof(Index::idx_t));
+    }
+  }
+
+  // The temporary GPU buffers are released in the default stream; make sure
+  // that the copy stream is done with them
+  eventResultsCopied[(numTiles - 1) % 2]->streamWaitOnEvent(defaultStream);
+}
+
 void
 GpuIndex::compute_residual(const float* x,
                            float* residual,
@@ -50,6 +50,14 @@ class GpuIndex : public faiss::Index {
   /// Returns the current minimum data size for paged searches
   size_t getMinPagingSize() const;
 
+  /// Set the maximum number of results per query returned by range_search;
+  /// a query with more results within the radius returns only its
+  /// `maxResults` nearest ones. 0 (the default) means no limit
+  void setMaxRangeResults(int maxResults);
+
+  /// Returns the maximum number of results per query of range_search
+  int getMaxRangeResults() const;
+
   /// `x` can be resident on the CPU or any GPU; copies are performed
   /// as needed
   /// Handles paged adds if the add set is too large; calls addInternal_
@@ -75,7 +83,15 @@ class GpuIndex : public faiss::Index {
               const float* x,
               Index::idx_t k,
               float* distances,
-              Index::idx_t* labels) const override;
+              Index::idx_t* labels,
+              const SearchParameters *params = nullptr) const override;
+
+  /// `x` can be resident on the CPU or any GPU; `result` is on the CPU.
+  /// Calls rangeSearchImpl_
+  void range_search(Index::idx_t n,
+                    const float* x,
+                    float radius,
+                    RangeSearchResult* result) const override;
 
   /// Overridden to force GPU indices to provide their own GPU-friendly
   /// implementation
@@ -115,6 +131,19 @@ class GpuIndex : public faiss::Index {
                            float* distances,
                            Index::idx_t* labels) const = 0;
 
+  /// Overridden to perform the range search; the queries are resident on
+  /// our device, the result is on the CPU. By default, range search is not
+  /// supported
+  virtual void rangeSearchImpl_(int n,
+                                const float* x,
+                                float radius,
+                                int maxResults,
+                                RangeSearchResult* result) const;
+
+  /// Largest k supported by searchImpl_; by default, the WarpSelect /
+  /// BlockSelect limit
+  virtual int getMaxSearchK_() const;
+
 private:
   /// Handles paged adds if the add set is too large, passes to
   /// addImpl_ to actually perform the add for the current page
@@ -142,6 +171,20 @@ private:
                            float* outDistancesData,
                            Index::idx_t* outIndicesData) const;
 
+  /// Number of queries per tile of searchFromCpuPipelined_, or 0 if there
+  /// is not enough pinned memory for the pipeline
+  int getPipelineTileSize_(int k) const;
+
+  /// Search of CPU-resident queries into CPU-resident outputs, by tiles:
+  /// the copy of tile i + 1 to the GPU and the copy of the results of tile
+  /// i - 1 to the CPU overlap with the search of tile i
+  void searchFromCpuPipelined_(int n,
+                               const float* x,
+                               int k,
+                               float* distances,
+                               Index::idx_t* labels,
+                               int tileSize) const;
+
  protected:
   /// Manages streams, cuBLAS handles and scratch memory for devices
   std::shared_ptr<GpuResources> resources_;
@@ -151,6 +194,9 @@ private:
 
   /// Size above which we page copies from the CPU to GPU
   size_t minPagedSize_;
+
+  /// Maximum number of results per query of range_search (0 = no limit)
+  int maxRangeResults_;
 };
 
 } } // namespace
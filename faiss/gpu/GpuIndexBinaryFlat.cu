@@ -56,6 +56,26 @@ GpuIndexBinaryFlat::GpuIndexBinaryFlat(GpuResourcesProvider* provider,
                                   this->d, binaryFlatConfig_.memorySpace));
 }
 
+GpuIndexBinaryFlat::GpuIndexBinaryFlat(std::shared_ptr<GpuResources> resources,
+                                       int dims,
+                                       GpuIndexBinaryFlatConfig config)
+    : IndexBinary(dims),
+      resources_(resources),
+      binaryFlatConfig_(std::move(config)) {
+  FAISS_THROW_IF_NOT_FMT(this->d % 8 == 0,
+                         "vector dimension (number of bits) "
+                         "must be divisible by 8 (passed %d)",
+                         this->d);
+
+  // Flat index doesn't need training
+  this->is_trained = true;
+
+  // Construct index
+  DeviceScope scope(binaryFlatConfig_.device);
+  data_.reset(new BinaryFlatIndex(resources_.get(),
+                                  this->d, binaryFlatConfig_.memorySpace));
+}
+
 GpuIndexBinaryFlat::~GpuIndexBinaryFlat() {
 }
 
@@ -151,7 +171,10 @@ GpuIndexBinaryFlat::search(faiss::IndexBinary::idx_t n,
                            const uint8_t* x,
                            faiss::IndexBinary::idx_t k,
                            int32_t* distances,
-                           faiss::IndexBinary::idx_t* labels) const {
+                           faiss::IndexBinary::idx_t* labels,
+                           const SearchParameters *params) const {
+  FAISS_THROW_IF_NOT_MSG(!params,
+                         "search params not supported for this index");
   if (n == 0) {
     return;
   }
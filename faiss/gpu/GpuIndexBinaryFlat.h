@@ -36,6 +36,11 @@ class GpuIndexBinaryFlat : public IndexBinary {
                      GpuIndexBinaryFlatConfig config =
                      GpuIndexBinaryFlatConfig());
 
+  GpuIndexBinaryFlat(std::shared_ptr<GpuResources> resources,
+                     int dims,
+                     GpuIndexBinaryFlatConfig config =
+                     GpuIndexBinaryFlatConfig());
+
   ~GpuIndexBinaryFlat() override;
 
   /// Returns the device that this index is resident on
@@ -62,11 +67,15 @@ class GpuIndexBinaryFlat : public IndexBinary {
               const uint8_t* x,
               faiss::IndexBinary::idx_t k,
               int32_t* distances,
-              faiss::IndexBinary::idx_t* labels) const override;
+              faiss::IndexBinary::idx_t* labels,
+              const SearchParameters *params = nullptr) const override;
 
   void reconstruct(faiss::IndexBinary::idx_t key,
                    uint8_t* recons) const override;
 
+  /// For internal access
+  inline BinaryFlatIndex* getGpuData() { return data_.get(); }
+
  protected:
   /// Called from search when the input data is on the CPU;
   /// potentially allows for pinned memory usage
@@ -0,0 +1,409 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <faiss/gpu/GpuIndexBinaryIVF.h>
+
+#include <faiss/IndexBinaryFlat.h>
+#include <faiss/gpu/GpuResources.h>
+#include <faiss/gpu/impl/BinaryFlatIndex.cuh>
+#include <faiss/gpu/impl/IVFBinary.cuh>
+#include <faiss/gpu/utils/CopyUtils.cuh>
+#include <faiss/gpu/utils/DeviceUtils.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/invlists/InvertedLists.h>
+
+#include <limits>
+#include <numeric>
+
+namespace faiss { namespace gpu {
+
+GpuIndexBinaryIVF::GpuIndexBinaryIVF(GpuResourcesProvider* provider,
+                                     const faiss::IndexBinaryIVF* index,
+                                     GpuIndexBinaryIVFConfig config)
+    : IndexBinary(index->d),
+      nlist(index->nlist),
+      nprobe(1),
+      quantizer(nullptr),
+      resources_(provider->getResources()),
+      binaryIVFConfig_(std::move(config)),
+      reserveMemoryVecs_(0) {
+  FAISS_THROW_IF_NOT_FMT(this->d % 8 == 0,
+                         "vector dimension (number of bits) "
+                         "must be divisible by 8 (passed %d)",
+                         this->d);
+
+  copyFrom(index);
+}
+
+GpuIndexBinaryIVF::GpuIndexBinaryIVF(GpuResourcesProvider* provider,
+                                     int dims,
+                                     int nlist,
+                                     GpuIndexBinaryIVFConfig config)
+    : IndexBinary(dims),
+      nlist(nlist),
+      nprobe(1),
+      quantizer(nullptr),
+      resources_(provider->getResources()),
+      binaryIVFConfig_(std::move(config)),
+      reserveMemoryVecs_(0) {
+  FAISS_THROW_IF_NOT_FMT(this->d % 8 == 0,
+                         "vector dimension (number of bits) "
+                         "must be divisible by 8 (passed %d)",
+                         this->d);
+  FAISS_THROW_IF_NOT_MSG(nlist > 0, "nlist must be > 0");
+
+  // Same defaults as the CPU IndexBinaryIVF
+  cp.niter = 10;
+
+  // We haven't trained ourselves, so don't construct the IVFBinary
+  // index yet
+  this->is_trained = false;
+
+  GpuIndexBinaryFlatConfig flatConfig = binaryIVFConfig_.flatConfig;
+  flatConfig.device = binaryIVFConfig_.device;
+  quantizer = new GpuIndexBinaryFlat(resources_, this->d, flatConfig);
+}
+
+GpuIndexBinaryIVF::~GpuIndexBinaryIVF() {
+  index_.reset();
+  delete quantizer;
+}
+
+int
+GpuIndexBinaryIVF::getDevice() const {
+  return binaryIVFConfig_.device;
+}
+
+std::shared_ptr<GpuResources>
+GpuIndexBinaryIVF::getResources() {
+  return resources_;
+}
+
+void
+GpuIndexBinaryIVF::initIndex_() {
+  index_.reset(new IVFBinary(resources_.get(),
+                             quantizer->getGpuData(),
+                             this->d,
+                             binaryIVFConfig_.indicesOptions,
+                             binaryIVFConfig_.memorySpace));
+
+  if (reserveMemoryVecs_) {
+    index_->reserveMemory(reserveMemoryVecs_);
+  }
+}
+
+void
+GpuIndexBinaryIVF::copyFrom(const faiss::IndexBinaryIVF* index) {
+  DeviceScope scope(binaryIVFConfig_.device);
+
+  this->d = index->d;
+  this->code_size = index->code_size;
+  this->verbose = index->verbose;
+
+  FAISS_THROW_IF_NOT_FMT(index->nlist > 0 &&
+                         index->nlist <=
+                         (Index::idx_t) std::numeric_limits<int>::max(),
+                         "GPU index only supports %zu inverted lists",
+                         (size_t) std::numeric_limits<int>::max());
+  nlist = index->nlist;
+
+  FAISS_THROW_IF_NOT_FMT(index->nprobe > 0 &&
+                         index->nprobe <= getMaxKSelection(),
+                         "GPU index only supports nprobe <= %zu; passed %zu",
+                         (size_t) getMaxKSelection(),
+                         index->nprobe);
+  nprobe = index->nprobe;
+  cp = index->cp;
+
+  // GPU code has 32 bit indices
+  FAISS_THROW_IF_NOT_FMT(index->ntotal <=
+                         (Index::idx_t) std::numeric_limits<int>::max(),
+                         "GPU index only supports up to %zu indices; "
+                         "attempting to copy CPU index with %zu parameters",
+                         (size_t) std::numeric_limits<int>::max(),
+                         (size_t) index->ntotal);
+  this->ntotal = index->ntotal;
+
+  // Clear out our old data
+  index_.reset();
+  delete quantizer;
+  quantizer = nullptr;
+
+  GpuIndexBinaryFlatConfig flatConfig = binaryIVFConfig_.flatConfig;
+  flatConfig.device = binaryIVFConfig_.device;
+  quantizer = new GpuIndexBinaryFlat(resources_, this->d, flatConfig);
+
+  // The other index might not be trained
+  if (!index->is_trained) {
+    this->is_trained = false;
+    return;
+  }
+
+  // Otherwise, we can populate ourselves from the other index
+  this->is_trained = true;
+
+  auto q = dynamic_cast<const faiss::IndexBinaryFlat*>(index->quantizer);
+  FAISS_THROW_IF_NOT_MSG(q, "Only IndexBinaryFlat is supported as the "
+                         "coarse quantizer");
+  FAISS_ASSERT(q->ntotal == nlist);
+  quantizer->copyFrom(q);
+
+  initIndex_();
+
+  // Copy all of the IVF data
+  index_->copyInvertedListsFrom(index->invlists);
+}
+
+void
+GpuIndexBinaryIVF::copyTo(faiss::IndexBinaryIVF* index) const {
+  DeviceScope scope(binaryIVFConfig_.device);
+
+  // We must have the indices in order to copy to ourselves
+  FAISS_THROW_IF_NOT_MSG(binaryIVFConfig_.indicesOptions != INDICES_IVF,
+                         "Cannot copy to CPU as GPU index doesn't retain "
+                         "indices (INDICES_IVF)");
+
+  index->d = this->d;
+  index->code_size = this->code_size;
+  index->ntotal = this->ntotal;
+  index->is_trained = this->is_trained;
+  index->verbose = this->verbose;
+  index->nlist = nlist;
+  index->nprobe = nprobe;
+  index->cp = cp;
+
+  if (index->own_fields) {
+    delete index->quantizer;
+  }
+
+  auto q = new faiss::IndexBinaryFlat(this->d);
+  quantizer->copyTo(q);
+  index->quantizer = q;
+  index->own_fields = true;
+
+  auto ivf = new ArrayInvertedLists(nlist, index->code_size);
+  index->replace_invlists(ivf, true);
+
+  if (index_) {
+    // Copy IVF lists
+    index_->copyInvertedListsTo(ivf);
+  }
+}
+
+void
+GpuIndexBinaryIVF::reserveMemory(size_t numVecs) {
+  reserveMemoryVecs_ = numVecs;
+  if (index_) {
+    DeviceScope scope(binaryIVFConfig_.device);
+    index_->reserveMemory(numVecs);
+  }
+}
+
+size_t
+GpuIndexBinaryIVF::reclaimMemory() {
+  if (index_) {
+    DeviceScope scope(binaryIVFConfig_.device);
+    return index_->reclaimMemory();
+  }
+
+  return 0;
+}
+
+int
+GpuIndexBinaryIVF::getNumLists() const {
+  return nlist;
+}
+
+void
+GpuIndexBinaryIVF::setNumProbes(int nprobe) {
+  FAISS_THROW_IF_NOT_FMT(nprobe > 0 && nprobe <= getMaxKSelection(),
+                         "GPU index only supports nprobe <= %d; passed %d",
+                         getMaxKSelection(),
+                         nprobe);
+  this->nprobe = nprobe;
+}
+
+int
+GpuIndexBinaryIVF::getNumProbes() const {
+  return nprobe;
+}
+
+GpuIndexBinaryFlat*
+GpuIndexBinaryIVF::getQuantizer() {
+  return quantizer;
+}
+
+int
+GpuIndexBinaryIVF::getListLength(int listId) const {
+  FAISS_ASSERT(index_);
+  DeviceScope scope(binaryIVFConfig_.device);
+
+  return index_->getListLength(listId);
+}
+
+std::vector<uint8_t>
+GpuIndexBinaryIVF::getListVectorData(int listId) const {
+  FAISS_ASSERT(index_);
+  DeviceScope scope(binaryIVFConfig_.device);
+
+  return index_->getListVectorData(listId);
+}
+
+std::vector<Index::idx_t>
+GpuIndexBinaryIVF::getListIndices(int listId) const {
+  FAISS_ASSERT(index_);
+  DeviceScope scope(binaryIVFConfig_.device);
+
+  return index_->getListIndices(listId);
+}
+
+void
+GpuIndexBinaryIVF::train(faiss::IndexBinary::idx_t n, const uint8_t* x) {
+  DeviceScope scope(binaryIVFConfig_.device);
+
+  if (this->is_trained) {
+    FAISS_ASSERT(quantizer->is_trained);
+    FAISS_ASSERT(quantizer->ntotal == nlist);
+    FAISS_ASSERT(index_);
+    return;
+  }
+
+  // The binary k-means runs on the CPU through the float clustering; the
+  // GPU flat quantizer receives the binarized centroids
+  faiss::IndexBinaryIVF cpuIndex(quantizer, this->d, nlist);
+  cpuIndex.cp = cp;
+  cpuIndex.verbose = this->verbose;
+  cpuIndex.train(n, x);
+
+  FAISS_ASSERT(quantizer->ntotal == nlist);
+
+  initIndex_();
+
+  this->is_trained = true;
+}
+
+void
+GpuIndexBinaryIVF::add(faiss::IndexBinary::idx_t n,
+                       const uint8_t* x) {
+  // Generate sequential ids starting at the current ntotal
+  std::vector<Index::idx_t> ids(n);
+  std::iota(ids.begin(), ids.end(), this->ntotal);
+
+  add_with_ids(n, x, ids.data());
+}
+
+void
+GpuIndexBinaryIVF::add_with_ids(faiss::IndexBinary::idx_t n,
+                                const uint8_t* x,
+                                const faiss::IndexBinary::idx_t* xids) {
+  FAISS_THROW_IF_NOT_MSG(this->is_trained, "Index not trained");
+
+  if (n == 0) {
+    return;
+  }
+
+  // Due to GPU indexing in int32, we can't store more than this
+  // number of vectors on a GPU
+  FAISS_THROW_IF_NOT_FMT(this->ntotal + n <=
+                         (Index::idx_t) std::numeric_limits<int>::max(),
+                         "GPU index only supports up to %zu indices",
+                         (size_t) std::numeric_limits<int>::max());
+
+  DeviceScope scope(binaryIVFConfig_.device);
+  auto stream = resources_->getDefaultStream(binaryIVFConfig_.device);
+
+  auto vecs = toDeviceTemporary<uint8_t, 2>(resources_.get(),
+                                            binaryIVFConfig_.device,
+                                            const_cast<uint8_t*>(x),
+                                            stream,
+                                            {(int) n, (int) (this->d / 8)});
+
+  auto indices =
+    toDeviceTemporary<Index::idx_t, 1>(resources_.get(),
+                                       binaryIVFConfig_.device,
+                                       const_cast<Index::idx_t*>(xids),
+                                       stream,
+                                       {(int) n});
+
+  FAISS_ASSERT(index_);
+  index_->addVectors(vecs, indices);
+
+  // keep the ntotal based on the total number of vectors that we attempted
+  // to add
+  this->ntotal += n;
+}
+
+void
+GpuIndexBinaryIVF::reset() {
+  if (index_) {
+    DeviceScope scope(binaryIVFConfig_.device);
+
+    index_->reset();
+    this->ntotal = 0;
+  } else {
+    FAISS_ASSERT(this->ntotal == 0);
+  }
+}
+
+void
+GpuIndexBinaryIVF::search(faiss::IndexBinary::idx_t n,
+                          const uint8_t* x,
+                          faiss::IndexBinary::idx_t k,
+                          int32_t* distances,
+                          faiss::IndexBinary::idx_t* labels,
+                          const SearchParameters *params) const {
+  FAISS_THROW_IF_NOT_MSG(!params,
+                         "search params not supported for this index");
+  FAISS_THROW_IF_NOT_MSG(this->is_trained, "Index not trained");
+
+  if (n == 0) {
+    return;
+  }
+
+  // For now, only support <= max int results
+  FAISS_THROW_IF_NOT_FMT(n <= (Index::idx_t) std::numeric_limits<int>::max(),
+                         "GPU index only supports up to %zu indices",
+                         (size_t) std::numeric_limits<int>::max());
+  FAISS_THROW_IF_NOT_FMT(k <= (Index::idx_t) getMaxKSelection(),
+                         "GPU only supports k <= %d (requested %d)",
+                         getMaxKSelection(),
+                         (int) k); // select limitation
+  FAISS_THROW_IF_NOT_FMT(nprobe <= getMaxKSelection(),
+                         "GPU index only supports nprobe <= %d; passed %d",
+                         getMaxKSelection(),
+                         nprobe);
+
+  DeviceScope scope(binaryIVFConfig_.device);
+  auto stream = resources_->getDefaultStream(binaryIVFConfig_.device);
+
+  auto queries = toDeviceTemporary<uint8_t, 2>(resources_.get(),
+                                               binaryIVFConfig_.device,
+                                               const_cast<uint8_t*>(x),
+                                               stream,
+                                               {(int) n, (int) (this->d / 8)});
+
+  auto outDistances = toDeviceTemporary<int32_t, 2>(resources_.get(),
+                                                    binaryIVFConfig_.device,
+                                                    distances,
+                                                    stream,
+                                                    {(int) n, (int) k});
+
+  auto outIndices =
+    toDeviceTemporary<Index::idx_t, 2>(resources_.get(),
+                                       binaryIVFConfig_.device,
+                                       labels,
+                                       stream,
+                                       {(int) n, (int) k});
+
+  index_->query(queries, nprobe, k, outDistances, outIndices);
+
+  // Copy back if necessary
+  fromDevice<int32_t, 2>(outDistances, distances, stream);
+  fromDevice<Index::idx_t, 2>(outIndices, labels, stream);
+}
+
+} } // namespace gpu
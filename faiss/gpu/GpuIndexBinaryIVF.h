@@ -0,0 +1,151 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <faiss/Clustering.h>
+#include <faiss/IndexBinaryIVF.h>
+#include <faiss/gpu/GpuIndexBinaryFlat.h>
+#include <faiss/gpu/GpuIndicesOptions.h>
+#include <faiss/gpu/GpuResources.h>
+#include <memory>
+#include <vector>
+
+namespace faiss { namespace gpu {
+
+class IVFBinary;
+
+struct GpuIndexBinaryIVFConfig : public GpuIndexConfig {
+  inline GpuIndexBinaryIVFConfig()
+      : indicesOptions(INDICES_64_BIT) {
+  }
+
+  /// Index storage options for the GPU
+  IndicesOptions indicesOptions;
+
+  /// Configuration for the coarse quantizer object
+  GpuIndexBinaryFlatConfig flatConfig;
+};
+
+/// A GPU version of IndexBinaryIVF: a binary flat coarse quantizer and
+/// inverted lists of codes scanned by Hamming distance
+class GpuIndexBinaryIVF : public IndexBinary {
+ public:
+  /// Construct from a pre-existing faiss::IndexBinaryIVF instance, copying
+  /// data over to the given GPU, if the input index is trained.
+  GpuIndexBinaryIVF(GpuResourcesProvider* provider,
+                    const faiss::IndexBinaryIVF* index,
+                    GpuIndexBinaryIVFConfig config =
+                    GpuIndexBinaryIVFConfig());
+
+  /// Constructs a new instance with an empty flat quantizer; the user
+  /// provides the number of lists desired.
+  GpuIndexBinaryIVF(GpuResourcesProvider* provider,
+                    int dims,
+                    int nlist,
+                    GpuIndexBinaryIVFConfig config =
+                    GpuIndexBinaryIVFConfig());
+
+  ~GpuIndexBinaryIVF() override;
+
+  /// Returns the device that this index is resident on
+  int getDevice() const;
+
+  /// Returns a reference to our GpuResources object that manages memory, stream
+  /// and handle resources on the GPU
+  std::shared_ptr<GpuResources> getResources();
+
+  /// Initialize ourselves from the given CPU index; will overwrite
+  /// all data in ourselves
+  void copyFrom(const faiss::IndexBinaryIVF* index);
+
+  /// Copy ourselves to the given CPU index; will overwrite all data
+  /// in the index instance
+  void copyTo(faiss::IndexBinaryIVF* index) const;
+
+  /// Reserve GPU memory in our inverted lists for this number of vectors
+  void reserveMemory(size_t numVecs);
+
+  /// After adding vectors, one can call this to reclaim device memory
+  /// to exactly the amount needed. Returns space reclaimed in bytes
+  size_t reclaimMemory();
+
+  /// Returns the number of inverted lists we're managing
+  int getNumLists() const;
+
+  /// Sets the number of list probes per query
+  void setNumProbes(int nprobe);
+
+  /// Returns our current number of list probes per query
+  int getNumProbes() const;
+
+  /// Return the quantizer we're using
+  GpuIndexBinaryFlat* getQuantizer();
+
+  /// Returns the number of vectors present in a particular inverted list
+  int getListLength(int listId) const;
+
+  /// Return the encoded vector data contained in a particular inverted list,
+  /// for debugging purposes
+  std::vector<uint8_t> getListVectorData(int listId) const;
+
+  /// Return the vector indices contained in a particular inverted list, for
+  /// debugging purposes.
+  std::vector<Index::idx_t> getListIndices(int listId) const;
+
+  /// Trains the coarse quantizer with the CPU-side binary k-means
+  void train(faiss::IndexBinary::idx_t n, const uint8_t* x) override;
+
+  void add(faiss::IndexBinary::idx_t n,
+           const uint8_t* x) override;
+
+  void add_with_ids(faiss::IndexBinary::idx_t n,
+                    const uint8_t* x,
+                    const faiss::IndexBinary::idx_t* xids) override;
+
+  /// Clears out all inverted lists, but retains the coarse centroid information
+  void reset() override;
+
+  void search(faiss::IndexBinary::idx_t n,
+              const uint8_t* x,
+              faiss::IndexBinary::idx_t k,
+              int32_t* distances,
+              faiss::IndexBinary::idx_t* labels,
+              const SearchParameters *params = nullptr) const override;
+
+ private:
+  /// (Re)construct the GPU inverted lists on top of the quantizer
+  void initIndex_();
+
+ public:
+  /// Exposing this like the CPU version for manipulation
+  ClusteringParameters cp;
+
+  /// Exposing this like the CPU version for query
+  int nlist;
+
+  /// Exposing this like the CPU version for manipulation
+  int nprobe;
+
+  /// Exposing this like the CPU version for query
+  GpuIndexBinaryFlat* quantizer;
+
+ protected:
+  /// Manages streans, cuBLAS handles and scratch memory for devices
+  std::shared_ptr<GpuResources> resources_;
+
+  /// Configuration options
+  const GpuIndexBinaryIVFConfig binaryIVFConfig_;
+
+  /// Desired inverted list memory reservation
+  size_t reserveMemoryVecs_;
+
+  /// Instance that we own; contains the inverted list
+  std::unique_ptr<IVFBinary> index_;
+};
+
+} } // namespace gpu
@@ -8,12 +8,14 @@
 
 #include <faiss/gpu/GpuIndexFlat.h>
 #include <faiss/IndexFlat.h>
+#include <faiss/impl/AuxIndexStructures.h>
 #include <faiss/gpu/GpuResources.h>
 #include <faiss/gpu/impl/FlatIndex.cuh>
 #include <faiss/gpu/utils/ConversionOperators.cuh>
 #include <faiss/gpu/utils/CopyUtils.cuh>
 #include <faiss/gpu/utils/DeviceUtils.h>
 #include <faiss/gpu/utils/Float16.cuh>
+#include <faiss/gpu/utils/HostTensor.cuh>
 #include <faiss/gpu/utils/StaticUtils.h>
 #include <limits>
 
@@ -157,6 +159,35 @@ GpuIndexFlat::reset() {
   this->ntotal = 0;
 }
 
+size_t
+GpuIndexFlat::remove_ids(const IDSelector& sel) {
+  DeviceScope scope(config_.device);
+  auto stream = resources_->getDefaultStream(config_.device);
+
+  std::vector<int> keepIds;
+  keepIds.reserve(this->ntotal);
+
+  for (int i = 0; i < this->ntotal; ++i) {
+    if (!sel.is_member(i)) {
+      keepIds.push_back(i);
+    }
+  }
+
+  size_t numRemoved = this->ntotal - keepIds.size();
+  if (numRemoved == 0) {
+    return 0;
+  }
+
+  HostTensor<int, 1, true> hostKeepIds(keepIds.data(), {(int) keepIds.size()});
+  DeviceTensor<int, 1, true> deviceKeepIds(
+    resources_.get(), makeTempAlloc(AllocType::Other, stream), hostKeepIds);
+
+  data_->compact(deviceKeepIds, stream);
+  this->ntotal = keepIds.size();
+
+  return numRemoved;
+}
+
 void
 GpuIndexFlat::train(Index::idx_t n, const float* x) {
   // nothing to do
@@ -218,6 +249,15 @@ GpuIndexFlat::addImpl_(int n,
   this->ntotal += n;
 }
 
+int
+GpuIndexFlat::getMaxSearchK_() const {
+  // Other metrics use the general distance kernel, which is limited to
+  // BlockSelect
+  return (metric_type == faiss::METRIC_L2 ||
+          metric_type == faiss::METRIC_INNER_PRODUCT) ?
+    getMaxLargeKSelection() : getMaxKSelection();
+}
+
 void
 GpuIndexFlat::searchImpl_(int n,
                           const float* x,
@@ -246,6 +286,23 @@ GpuIndexFlat::searchImpl_(int n,
                                              outLabels);
 }
 
+void
+GpuIndexFlat::rangeSearchImpl_(int n,
+                               const float* x,
+                               float radius,
+                               int maxResults,
+                               RangeSearchResult* result) const {
+  FAISS_THROW_IF_NOT_MSG(metric_type == faiss::METRIC_L2 ||
+                         metric_type == faiss::METRIC_INNER_PRODUCT,
+                         "GPU range search only supports L2 and "
+                         "inner product metrics");
+
+  // Input data is already resident on the GPU
+  Tensor<float, 2, true> queries(const_cast<float*>(x), {n, (int) this->d});
+
+  data_->rangeQuery(queries, radius, maxResults, metric_type, result);
+}
+
 void
 GpuIndexFlat::reconstruct(Index::idx_t key, float* out) const {
   DeviceScope scope(config_.device);
@@ -283,6 +340,58 @@ GpuIndexFlat::reconstruct_n(Index::idx_t i0,
   }
 }
 
+void
+GpuIndexFlat::reconstruct_batch(Index::idx_t n,
+                                const Index::idx_t* keys,
+                                float* out) const {
+  FAISS_THROW_IF_NOT_FMT(n <=
+                         (Index::idx_t) std::numeric_limits<int>::max(),
+                         "GPU index only supports up to %zu indices",
+                         (size_t) std::numeric_limits<int>::max());
+  for (Index::idx_t i = 0; i < n; ++i) {
+    FAISS_THROW_IF_NOT_MSG(keys[i] >= 0 && keys[i] < this->ntotal,
+                           "index out of bounds");
+  }
+  if (n == 0) {
+    return;
+  }
+
+  DeviceScope scope(config_.device);
+  auto stream = resources_->getDefaultStream(config_.device);
+
+  auto idsDevice =
+    toDeviceTemporary<Index::idx_t, 1>(
+      resources_.get(), config_.device,
+      const_cast<Index::idx_t*>(keys),
+      stream,
+      {(int) n});
+
+  // Convert idx_t to int
+  auto keysInt =
+    convertTensorTemporary<Index::idx_t, int, 1>(
+      resources_.get(), stream, idsDevice);
+
+  auto outDevice =
+    toDeviceTemporary<float, 2>(resources_.get(),
+                                config_.device, out, stream,
+                                {(int) n, (int) this->d});
+
+  // gathers (and converts from float16 if needed) on the device
+  FAISS_ASSERT(data_);
+  data_->reconstruct(keysInt, outDevice);
+
+  fromDevice<float, 2>(outDevice, out, stream);
+}
+
+MemoryUsage
+GpuIndexFlat::memory_usage() const {
+  MemoryUsage mu = GpuIndex::memory_usage();
+  if (data_) {
+    mu.add("storage", data_->getMemoryUsage());
+  }
+  return mu;
+}
+
 void
 GpuIndexFlat::compute_residual(const float* x,
                                float* residual,
@@ -29,7 +29,9 @@ struct GpuIndexFlatConfig : public GpuIndexConfig {
         storeTransposed(false) {
   }
 
-  /// Whether or not data is stored as float16
+  /// Whether or not data is stored as float16. Queries are then converted
+  /// to float16 as well, and distances are computed by f16 GEMMs on tensor
+  /// cores (where available) with f32 accumulation
   bool useFloat16;
 
   /// Whether or not data is stored (transparently) in a transposed
@@ -83,6 +85,10 @@ class GpuIndexFlat : public GpuIndex {
   /// Clears all vectors from this index
   void reset() override;
 
+  /// Removes the vectors selected by `sel`; the remaining vectors are
+  /// renumbered sequentially in order, as for IndexFlat
+  size_t remove_ids(const IDSelector& sel) override;
+
   /// This index is not trained, so this does nothing
   void train(Index::idx_t n, const float* x) override;
 
@@ -98,6 +104,12 @@ class GpuIndexFlat : public GpuIndex {
                      Index::idx_t num,
                      float* out) const override;
 
+  /// Reconstruction of arbitrary ids; the vectors are gathered on the
+  /// device, then copied to out in one transfer
+  void reconstruct_batch(Index::idx_t n,
+                         const Index::idx_t* keys,
+                         float* out) const override;
+
   /// Compute residual
   void compute_residual(const float* x,
                         float* residual,
@@ -109,6 +121,9 @@ class GpuIndexFlat : public GpuIndex {
                           float* residuals,
                           const Index::idx_t* keys) const override;
 
+  /// The vectors are reported as device memory
+  MemoryUsage memory_usage() const override;
+
   /// For internal access
   inline FlatIndex* getGpuData() { return data_.get(); }
 
@@ -128,6 +143,16 @@ class GpuIndexFlat : public GpuIndex {
                    float* distances,
                    Index::idx_t* labels) const override;
 
+  /// Called from GpuIndex for range_search
+  void rangeSearchImpl_(int n,
+                        const float* x,
+                        float radius,
+                        int maxResults,
+                        RangeSearchResult* result) const override;
+
+  /// Supports k up to getMaxLargeKSelection() for L2 and inner product
+  int getMaxSearchK_() const override;
+
  protected:
   /// Our configuration options
   const GpuIndexFlatConfig flatConfig_;
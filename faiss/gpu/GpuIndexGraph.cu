@@ -0,0 +1,219 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#include <faiss/gpu/GpuIndexGraph.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexHNSW.h>
+#include <faiss/IndexNSG.h>
+#include <faiss/gpu/GpuResources.h>
+#include <faiss/gpu/impl/GraphIndex.cuh>
+#include <faiss/gpu/utils/DeviceUtils.h>
+#include <faiss/impl/FaissAssert.h>
+
+#include <limits>
+#include <vector>
+
+namespace faiss { namespace gpu {
+
+GpuIndexGraph::GpuIndexGraph(GpuResourcesProvider* provider,
+                             const faiss::IndexHNSW* index,
+                             GpuIndexGraphConfig config) :
+    GpuIndex(provider->getResources(),
+             index->d,
+             index->metric_type,
+             index->metric_arg,
+             config),
+    searchWidth(index->hnsw.efSearch),
+    numSeeds(32),
+    maxIterations(0),
+    graphConfig_(config) {
+  copyFrom(index);
+}
+
+GpuIndexGraph::GpuIndexGraph(GpuResourcesProvider* provider,
+                             const faiss::IndexNSG* index,
+                             GpuIndexGraphConfig config) :
+    GpuIndex(provider->getResources(),
+             index->d,
+             index->metric_type,
+             index->metric_arg,
+             config),
+    searchWidth(index->nsg.search_L),
+    numSeeds(32),
+    maxIterations(0),
+    graphConfig_(config) {
+  copyFrom(index);
+}
+
+GpuIndexGraph::~GpuIndexGraph() {
+}
+
+namespace {
+
+const IndexFlat* getFlatStorage(const faiss::Index* storage) {
+  auto flat = dynamic_cast<const IndexFlat*>(storage);
+  FAISS_THROW_IF_NOT_MSG(flat, "GpuIndexGraph only supports graph indexes "
+                         "with an IndexFlat storage");
+  return flat;
+}
+
+void checkGraphIndex(const faiss::Index* index) {
+  FAISS_THROW_IF_NOT_MSG(index->metric_type == faiss::METRIC_L2 ||
+                         index->metric_type == faiss::METRIC_INNER_PRODUCT,
+                         "GpuIndexGraph only supports L2 and inner product");
+
+  // GPU code has 32 bit indices
+  FAISS_THROW_IF_NOT_FMT(index->ntotal <=
+                         (Index::idx_t) std::numeric_limits<int>::max(),
+                         "GPU index only supports up to %zu indices; "
+                         "attempting to copy CPU index with %zu parameters",
+                         (size_t) std::numeric_limits<int>::max(),
+                         (size_t) index->ntotal);
+}
+
+} // namespace
+
+void
+GpuIndexGraph::copyFrom(const faiss::IndexHNSW* index) {
+  DeviceScope scope(config_.device);
+
+  checkGraphIndex(index);
+  GpuIndex::copyFrom(index);
+
+  const IndexFlat* flat = getFlatStorage(index->storage);
+  const HNSW& hnsw = index->hnsw;
+
+  data_.reset();
+  data_.reset(new GraphIndex(resources_.get(),
+                             this->d,
+                             this->metric_type,
+                             config_.memorySpace));
+
+  // The index could be empty
+  if (index->ntotal == 0) {
+    return;
+  }
+
+  // Only the base level is used: every node is present there, and the wide
+  // beam replaces the descent through the upper levels
+  int degree = hnsw.nb_neighbors(0);
+  std::vector<int> graph((size_t) index->ntotal * degree, -1);
+
+  // the links may be compressed
+  std::vector<HNSW::storage_idx_t> buf(degree);
+  for (Index::idx_t i = 0; i < index->ntotal; ++i) {
+    size_t n;
+    const HNSW::storage_idx_t* neigh =
+        hnsw.neighbor_list(i, 0, buf.data(), &n);
+
+    for (size_t j = 0; j < n; ++j) {
+      graph[(size_t) i * degree + j] = neigh[j];
+    }
+  }
+
+  copyGraph_(flat->xb.data(), graph.data(), degree, hnsw.entry_point);
+}
+
+void
+GpuIndexGraph::copyFrom(const faiss::IndexNSG* index) {
+  DeviceScope scope(config_.device);
+
+  checkGraphIndex(index);
+  FAISS_THROW_IF_NOT_MSG(index->ntotal == 0 || index->nsg.is_built,
+                         "the NSG graph is not built");
+  GpuIndex::copyFrom(index);
+
+  const IndexFlat* flat = getFlatStorage(index->storage);
+  const NSG& nsg = index->nsg;
+
+  data_.reset();
+  data_.reset(new GraphIndex(resources_.get(),
+                             this->d,
+                             this->metric_type,
+                             config_.memorySpace));
+
+  if (index->ntotal == 0) {
+    return;
+  }
+
+  // The NSG graph is already stored with a fixed degree, padded with -1
+  copyGraph_(flat->xb.data(), nsg.final_graph.data(), nsg.R, nsg.enterpoint);
+}
+
+void
+GpuIndexGraph::copyGraph_(const float* vecs,
+                          const int* graph,
+                          int degree,
+                          int entryPoint) {
+  data_->copyFrom(vecs,
+                  graph,
+                  (int) this->ntotal,
+                  degree,
+                  entryPoint,
+                  resources_->getDefaultStream(config_.device));
+}
+
+int
+GpuIndexGraph::getDegree() const {
+  return data_ && data_->getSize() > 0 ? data_->getDegree() : 0;
+}
+
+void
+GpuIndexGraph::reset() {
+  DeviceScope scope(config_.device);
+
+  if (data_) {
+    data_->reset();
+  }
+  this->ntotal = 0;
+}
+
+bool
+GpuIndexGraph::addImplRequiresIDs_() const {
+  return false;
+}
+
+void
+GpuIndexGraph::addImpl_(int n,
+                        const float* x,
+                        const Index::idx_t* ids) {
+  FAISS_THROW_MSG("GpuIndexGraph does not support adding vectors; "
+                  "build the graph on the CPU and copy it");
+}
+
+void
+GpuIndexGraph::searchImpl_(int n,
+                           const float* x,
+                           int k,
+                           float* distances,
+                           Index::idx_t* labels) const {
+  // Device is already set in GpuIndex::search
+  FAISS_ASSERT(data_);
+  FAISS_ASSERT(n > 0);
+
+  FAISS_THROW_IF_NOT_FMT(k <= kGraphMaxSearchWidth,
+                         "GpuIndexGraph only supports k <= %d (requested %d)",
+                         kGraphMaxSearchWidth, k);
+  FAISS_THROW_IF_NOT_FMT(searchWidth > 0 && searchWidth <= kGraphMaxSearchWidth,
+                         "GpuIndexGraph only supports searchWidth <= %d "
+                         "(requested %d)",
+                         kGraphMaxSearchWidth, searchWidth);
+
+  // Data is already resident on the GPU
+  Tensor<float, 2, true> queries(const_cast<float*>(x), {n, (int) this->d});
+  Tensor<float, 2, true> outDistances(distances, {n, k});
+  Tensor<Index::idx_t, 2, true> outLabels(labels, {n, k});
+
+  FAISS_THROW_IF_NOT_MSG(data_->getSize() > 0,
+                         "GpuIndexGraph: cannot search an empty index");
+
+  data_->query(queries, k, searchWidth, numSeeds, maxIterations,
+               outDistances, outLabels);
+}
+
+} } // namespace
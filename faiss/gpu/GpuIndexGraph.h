@@ -0,0 +1,103 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#pragma once
+
+#include <faiss/gpu/GpuIndex.h>
+#include <memory>
+
+namespace faiss {
+
+struct IndexHNSW;
+struct IndexNSG;
+
+}
+
+namespace faiss { namespace gpu {
+
+class GraphIndex;
+
+struct GpuIndexGraphConfig : public GpuIndexConfig {
+};
+
+/// A GPU-resident proximity graph over float vectors, copied from the base
+/// level of a CPU IndexHNSWFlat or from an IndexNSGFlat. Each query is
+/// handled by one warp doing a beam search over the graph, so it is suited to
+/// both small and large query batches. The graph is built on the CPU; the GPU
+/// index is search-only.
+class GpuIndexGraph : public GpuIndex {
+ public:
+  /// Construct from the level 0 of a pre-existing faiss::IndexHNSW with a
+  /// flat storage, copying data over to the given GPU
+  GpuIndexGraph(GpuResourcesProvider* provider,
+                const faiss::IndexHNSW* index,
+                GpuIndexGraphConfig config = GpuIndexGraphConfig());
+
+  /// Construct from the graph of a pre-existing faiss::IndexNSG with a flat
+  /// storage, copying data over to the given GPU
+  GpuIndexGraph(GpuResourcesProvider* provider,
+                const faiss::IndexNSG* index,
+                GpuIndexGraphConfig config = GpuIndexGraphConfig());
+
+  ~GpuIndexGraph() override;
+
+  /// Initialize ourselves from the given CPU index; will overwrite
+  /// all data in ourselves
+  void copyFrom(const faiss::IndexHNSW* index);
+
+  void copyFrom(const faiss::IndexNSG* index);
+
+  /// Maximum number of out-edges per node
+  int getDegree() const;
+
+  /// Clears all vectors and the graph from this index
+  void reset() override;
+
+ protected:
+  /// Called from GpuIndex for add/add_with_ids; not supported
+  void addImpl_(int n,
+                const float* x,
+                const Index::idx_t* ids) override;
+
+  bool addImplRequiresIDs_() const override;
+
+  /// Called from GpuIndex for search
+  void searchImpl_(int n,
+                   const float* x,
+                   int k,
+                   float* distances,
+                   Index::idx_t* labels) const override;
+
+  /// Replaces the GPU data with the given vectors and fixed-degree graph
+  void copyGraph_(const float* vecs,
+                  const int* graph,
+                  int degree,
+                  int entryPoint);
+
+ public:
+  /// Number of candidates kept per query (the beam width; the CPU
+  /// efSearch / search_L). Raised to k if smaller, at most 512.
+  int searchWidth;
+
+  /// Number of nodes the beam is seeded with: the entry point, then
+  /// pseudo-random nodes
+  int numSeeds;
+
+  /// Maximum number of node expansions per query, 0 for no limit (the
+  /// search stops when all beam entries have been expanded)
+  int maxIterations;
+
+ protected:
+  /// Our configuration options
+  const GpuIndexGraphConfig graphConfig_;
+
+  /// Holds our GPU data containing the vectors and the graph
+  std::unique_ptr<GraphIndex> data_;
+};
+
+} } // namespace
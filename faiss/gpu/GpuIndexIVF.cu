@@ -10,9 +10,13 @@
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/IndexFlat.h>
 #include <faiss/IndexIVF.h>
+#include <faiss/impl/AuxIndexStructures.h>
 #include <faiss/gpu/GpuIndexFlat.h>
+#include <faiss/gpu/utils/CopyUtils.cuh>
 #include <faiss/gpu/utils/DeviceUtils.h>
 #include <faiss/gpu/utils/Float16.cuh>
+#include <limits>
+#include <vector>
 
 namespace faiss { namespace gpu {
 
@@ -76,6 +80,15 @@ GpuIndexIVF::getQuantizer() {
   return quantizer;
 }
 
+MemoryUsage
+GpuIndexIVF::memory_usage() const {
+  MemoryUsage mu = GpuIndex::memory_usage();
+  if (quantizer) {
+    mu.add("quantizer", quantizer->memory_usage());
+  }
+  return mu;
+}
+
 void
 GpuIndexIVF::copyFrom(const faiss::IndexIVF* index) {
   DeviceScope scope(config_.device);
@@ -202,6 +215,108 @@ GpuIndexIVF::getNumProbes() const {
   return nprobe;
 }
 
+void
+GpuIndexIVF::update_vectors(int n, const Index::idx_t* ids, const float* x) {
+  FAISS_THROW_IF_NOT(is_trained);
+
+  if (n == 0) {
+    return;
+  }
+
+  IDSelectorBatch sel(n, ids);
+  remove_ids(sel);
+  add_with_ids(n, x, ids);
+}
+
+void
+GpuIndexIVF::searchPreassigned(Index::idx_t n,
+                               const float* x,
+                               Index::idx_t k,
+                               int nprobe,
+                               const Index::idx_t* assign,
+                               const float* centroidDis,
+                               float* distances,
+                               Index::idx_t* labels) const {
+  FAISS_THROW_IF_NOT_MSG(this->is_trained, "Index not trained");
+  FAISS_THROW_IF_NOT_MSG(assign && centroidDis,
+                         "searchPreassigned: coarse assignment required");
+
+  // For now, only support <= max int results
+  FAISS_THROW_IF_NOT_FMT(n <= (Index::idx_t) std::numeric_limits<int>::max(),
+                         "GPU index only supports up to %d indices",
+                         std::numeric_limits<int>::max());
+
+  FAISS_THROW_IF_NOT_FMT(k <= (Index::idx_t) getMaxSearchK_(),
+                         "GPU index only supports k <= %d (requested %d)",
+                         getMaxSearchK_(),
+                         (int) k); // select limitation
+
+  FAISS_THROW_IF_NOT_FMT(nprobe > 0 && nprobe <= getMaxKSelection(),
+                         "GPU index only supports nprobe <= %d; passed %d",
+                         getMaxKSelection(),
+                         nprobe);
+
+  if (n == 0 || k == 0) {
+    // nothing to search
+    return;
+  }
+
+  DeviceScope scope(config_.device);
+  auto stream = resources_->getDefaultStream(config_.device);
+
+  // The GPU kernels use int list ids
+  std::vector<int> assign32((size_t) n * nprobe);
+
+  for (size_t i = 0; i < assign32.size(); ++i) {
+    FAISS_THROW_IF_NOT_FMT(assign[i] >= -1 && assign[i] < nlist,
+                           "searchPreassigned: invalid list id %ld",
+                           assign[i]);
+    assign32[i] = (int) assign[i];
+  }
+
+  auto devAssign =
+    toDeviceTemporary<int, 2>(resources_.get(), config_.device,
+                              assign32.data(), stream,
+                              {(int) n, nprobe});
+  auto devCentroidDis =
+    toDeviceTemporary<float, 2>(resources_.get(), config_.device,
+                                const_cast<float*>(centroidDis), stream,
+                                {(int) n, nprobe});
+  auto vecs =
+    toDeviceTemporary<float, 2>(resources_.get(), config_.device,
+                                const_cast<float*>(x), stream,
+                                {(int) n, (int) this->d});
+
+  auto outDistances =
+    toDeviceTemporary<float, 2>(resources_.get(), config_.device,
+                                distances, stream,
+                                {(int) n, (int) k});
+  auto outLabels =
+    toDeviceTemporary<Index::idx_t, 2>(resources_.get(), config_.device,
+                                       labels, stream,
+                                       {(int) n, (int) k});
+
+  searchPreassignedImpl_((int) n, vecs.data(), (int) k, nprobe,
+                         devAssign.data(), devCentroidDis.data(),
+                         outDistances.data(), outLabels.data());
+
+  // Copy back if necessary
+  fromDevice<float, 2>(outDistances, distances, stream);
+  fromDevice<Index::idx_t, 2>(outLabels, labels, stream);
+}
+
+void
+GpuIndexIVF::searchPreassignedImpl_(int n,
+                                    const float* x,
+                                    int k,
+                                    int nprobe,
+                                    const int* assign,
+                                    const float* centroidDis,
+                                    float* distances,
+                                    Index::idx_t* labels) const {
+  FAISS_THROW_MSG("searchPreassigned not implemented for this type of index");
+}
+
 bool
 GpuIndexIVF::addImplRequiresIDs_() const {
   // All IVF indices have storage for IDs
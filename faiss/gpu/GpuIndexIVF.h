@@ -21,12 +21,20 @@ class GpuIndexFlat;
 
 struct GpuIndexIVFConfig : public GpuIndexConfig {
   inline GpuIndexIVFConfig()
-      : indicesOptions(INDICES_64_BIT) {
+      : indicesOptions(INDICES_64_BIT),
+        unifiedHotListBytes(0) {
   }
 
   /// Index storage options for the GPU
   IndicesOptions indicesOptions;
 
+  /// With memorySpace = MemorySpace::Unified, the inverted lists may be
+  /// larger than the GPU memory. The lists probed by each query batch are
+  /// prefetched to the GPU, and the most frequently probed lists, up to this
+  /// many bytes, are advised to stay resident on the GPU while the others
+  /// prefer host memory. 0 disables the residency advice.
+  size_t unifiedHotListBytes;
+
   /// Configuration for the coarse quantizer object
   GpuIndexFlatConfig flatConfig;
 };
@@ -71,16 +79,50 @@ class GpuIndexIVF : public GpuIndex {
   /// Return the quantizer we're using
   GpuIndexFlat* getQuantizer();
 
+  /// Adds the coarse quantizer; the subclasses add their inverted lists
+  MemoryUsage memory_usage() const override;
+
   /// Sets the number of list probes per query
   void setNumProbes(int nprobe);
 
   /// Returns our current number of list probes per query
   int getNumProbes() const;
 
+  /// Replaces the vectors with the given ids by `x`, or adds them if they
+  /// are not present: the ids are removed (see remove_ids), then added
+  /// again, to the inverted lists of their new coarse assignment
+  void update_vectors(int n, const Index::idx_t* ids, const float* x);
+
+  /// Searches given the `nprobe` coarse centroids of each query, as
+  /// IndexIVF::search_preassigned: `assign` and `centroidDis` (n x nprobe,
+  /// on the host) are the labels and distances returned by a search of the
+  /// coarse quantizer. Entries of `assign` may be -1, in which case the
+  /// probe is skipped. `x`, `distances` and `labels` may be on the host or
+  /// on our device
+  void searchPreassigned(Index::idx_t n,
+                         const float* x,
+                         Index::idx_t k,
+                         int nprobe,
+                         const Index::idx_t* assign,
+                         const float* centroidDis,
+                         float* distances,
+                         Index::idx_t* labels) const;
+
  protected:
   bool addImplRequiresIDs_() const override;
   void trainQuantizer_(Index::idx_t n, const float* x);
 
+  /// Overridden to perform searchPreassigned; all data, including `assign`
+  /// (n x nprobe) and `centroidDis`, is resident on our device
+  virtual void searchPreassignedImpl_(int n,
+                                      const float* x,
+                                      int k,
+                                      int nprobe,
+                                      const int* assign,
+                                      const float* centroidDis,
+                                      float* distances,
+                                      Index::idx_t* labels) const;
+
  public:
   /// Exposing this like the CPU version for manipulation
   ClusteringParameters cp;
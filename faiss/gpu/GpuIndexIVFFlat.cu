@@ -87,8 +87,10 @@ GpuIndexIVFFlat::copyFrom(const faiss::IndexIVFFlat* index) {
                            index->metric_arg,
                            false, // no residual
                            nullptr, // no scalar quantizer
+                           ivfFlatConfig_.interleavedLayout,
                            ivfFlatConfig_.indicesOptions,
                            config_.memorySpace));
+  index_->setHotListBytes(ivfConfig_.unifiedHotListBytes);
 
   // Copy all of the IVF data
   index_->copyInvertedListsFrom(index->invlists);
@@ -138,6 +140,21 @@ GpuIndexIVFFlat::reset() {
   }
 }
 
+size_t
+GpuIndexIVFFlat::remove_ids(const IDSelector& sel) {
+  if (!index_) {
+    FAISS_ASSERT(this->ntotal == 0);
+    return 0;
+  }
+
+  DeviceScope scope(config_.device);
+
+  size_t numRemoved = index_->removeIds(sel);
+  this->ntotal -= numRemoved;
+
+  return numRemoved;
+}
+
 void
 GpuIndexIVFFlat::train(Index::idx_t n, const float* x) {
   // For now, only support <= max int results
@@ -172,8 +189,10 @@ GpuIndexIVFFlat::train(Index::idx_t n, const float* x) {
                            this->metric_arg,
                            false, // no residual
                            nullptr, // no scalar quantizer
+                           ivfFlatConfig_.interleavedLayout,
                            ivfFlatConfig_.indicesOptions,
                            config_.memorySpace));
+  index_->setHotListBytes(ivfConfig_.unifiedHotListBytes);
 
   if (reserveMemoryVecs_) {
     index_->reserveMemory(reserveMemoryVecs_);
@@ -206,6 +225,15 @@ GpuIndexIVFFlat::getListIndices(int listId) const {
   return index_->getListIndices(listId);
 }
 
+MemoryUsage
+GpuIndexIVFFlat::memory_usage() const {
+  MemoryUsage mu = GpuIndexIVF::memory_usage();
+  if (index_) {
+    mu.add("invlists", index_->getMemoryUsage());
+  }
+  return mu;
+}
+
 void
 GpuIndexIVFFlat::addImpl_(int n,
                           const float* x,
@@ -226,6 +254,34 @@ GpuIndexIVFFlat::addImpl_(int n,
   ntotal += n;
 }
 
+void
+GpuIndexIVFFlat::searchPreassignedImpl_(int n,
+                                        const float* x,
+                                        int k,
+                                        int nprobe,
+                                        const int* assign,
+                                        const float* centroidDis,
+                                        float* distances,
+                                        Index::idx_t* labels) const {
+  // Device is already set in GpuIndexIVF::searchPreassigned
+  FAISS_ASSERT(index_);
+  FAISS_ASSERT(n > 0);
+
+  // Data is already resident on the GPU
+  Tensor<float, 2, true> queries(const_cast<float*>(x), {n, (int) this->d});
+  Tensor<int, 2, true> coarseIndices(const_cast<int*>(assign), {n, nprobe});
+  Tensor<float, 2, true> outDistances(distances, {n, k});
+  Tensor<Index::idx_t, 2, true> outLabels(labels, {n, k});
+
+  index_->queryPreassigned(queries, coarseIndices,
+                           k, outDistances, outLabels);
+}
+
+int
+GpuIndexIVFFlat::getMaxSearchK_() const {
+  return getMaxLargeKSelection();
+}
+
 void
 GpuIndexIVFFlat::searchImpl_(int n,
                              const float* x,
@@ -244,5 +300,21 @@ GpuIndexIVFFlat::searchImpl_(int n,
   index_->query(queries, nprobe, k, outDistances, outLabels);
 }
 
+void
+GpuIndexIVFFlat::rangeSearchImpl_(int n,
+                                 const float* x,
+                                 float radius,
+                                 int maxResults,
+                                 RangeSearchResult* result) const {
+  // Device is already set in GpuIndex::range_search
+  FAISS_ASSERT(index_);
+  FAISS_ASSERT(n > 0);
+
+  // Data is already resident on the GPU
+  Tensor<float, 2, true> queries(const_cast<float*>(x), {n, (int) this->d});
+
+  index_->rangeQuery(queries, nprobe, radius, maxResults, result);
+}
+
 
 } } // namespace
@@ -19,6 +19,15 @@ class IVFFlat;
 class GpuIndexFlat;
 
 struct GpuIndexIVFFlatConfig : public GpuIndexIVFConfig {
+  inline GpuIndexIVFFlatConfig()
+      : interleavedLayout(false) {
+  }
+
+  /// Store the inverted lists by groups of 32 vectors, dimension-major within
+  /// a group, so that each lane of a warp scans one vector with coalesced
+  /// loads. Mostly useful for small dimensions. The lists are converted from
+  /// and to the CPU layout when copied
+  bool interleavedLayout;
 };
 
 /// Wrapper around the GPU implementation that looks like
@@ -59,6 +68,10 @@ class GpuIndexIVFFlat : public GpuIndexIVF {
   /// Clears out all inverted lists, but retains the coarse centroid information
   void reset() override;
 
+  /// Removes the vectors selected by `sel` from the inverted lists, in
+  /// place on the device; returns the number removed
+  size_t remove_ids(const IDSelector& sel) override;
+
   /// Trains the coarse quantizer based on the given vector data
   void train(Index::idx_t n, const float* x) override;
 
@@ -74,6 +87,9 @@ class GpuIndexIVFFlat : public GpuIndexIVF {
   /// debugging purposes.
   std::vector<Index::idx_t> getListIndices(int listId) const override;
 
+  /// Adds the inverted lists on the device
+  MemoryUsage memory_usage() const override;
+
  protected:
   /// Called from GpuIndex for add/add_with_ids
   void addImpl_(int n,
@@ -87,6 +103,26 @@ class GpuIndexIVFFlat : public GpuIndexIVF {
                    float* distances,
                    Index::idx_t* labels) const override;
 
+  /// Called from GpuIndex for range_search
+  void rangeSearchImpl_(int n,
+                        const float* x,
+                        float radius,
+                        int maxResults,
+                        RangeSearchResult* result) const override;
+
+  /// Supports k up to getMaxLargeKSelection()
+  int getMaxSearchK_() const override;
+
+  /// Called from GpuIndexIVF for searchPreassigned
+  void searchPreassignedImpl_(int n,
+                              const float* x,
+                              int k,
+                              int nprobe,
+                              const int* assign,
+                              const float* centroidDis,
+                              float* distances,
+                              Index::idx_t* labels) const override;
+
  protected:
   /// Our configuration options
   const GpuIndexIVFFlatConfig ivfFlatConfig_;
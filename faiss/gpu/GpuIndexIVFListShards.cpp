@@ -0,0 +1,356 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#include <faiss/gpu/GpuIndexIVFListShards.h>
+#include <faiss/InvertedLists.h>
+#include <faiss/gpu/GpuIndexIVF.h>
+#include <faiss/impl/FaissAssert.h>
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <utility>
+
+namespace faiss { namespace gpu {
+
+GpuIndexIVFListShards::GpuIndexIVFListShards(faiss::Index* quantizerIn,
+                                             int nlistIn,
+                                             bool threaded)
+    : ThreadedIndex<Index>(quantizerIn->d, threaded),
+      quantizer(quantizerIn),
+      ownQuantizer(false),
+      nlist(nlistIn),
+      nprobe(1),
+      listToShard(nlistIn, 0) {
+  FAISS_THROW_IF_NOT_FMT(quantizer->ntotal == nlist,
+                         "quantizer has %ld centroids, expected %d lists",
+                         quantizer->ntotal, nlist);
+
+  this->metric_type = quantizer->metric_type;
+  this->is_trained = quantizer->is_trained;
+}
+
+GpuIndexIVFListShards::~GpuIndexIVFListShards() {
+  if (ownQuantizer) {
+    delete quantizer;
+  }
+}
+
+void
+GpuIndexIVFListShards::addShard(GpuIndexIVF* shard) {
+  addIndex(shard);
+}
+
+std::vector<int>
+GpuIndexIVFListShards::balanceLists(const InvertedLists* invlists,
+                                    int numShards) {
+  FAISS_THROW_IF_NOT(numShards > 0);
+
+  std::vector<size_t> order(invlists->nlist);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [invlists](size_t a, size_t b) {
+                     return invlists->list_size(a) > invlists->list_size(b);
+                   });
+
+  // (vectors, lists) per shard; the list count breaks ties so that empty
+  // lists are spread out as well
+  std::vector<std::pair<size_t, size_t>> load(numShards);
+  std::vector<int> owners(invlists->nlist, 0);
+
+  for (auto list : order) {
+    int shard =
+      std::min_element(load.begin(), load.end()) - load.begin();
+
+    owners[list] = shard;
+    load[shard].first += invlists->list_size(list);
+    load[shard].second++;
+  }
+
+  return owners;
+}
+
+void
+GpuIndexIVFListShards::setNumProbes(int nprobeIn) {
+  FAISS_THROW_IF_NOT_FMT(nprobeIn > 0, "invalid nprobe %d", nprobeIn);
+  nprobe = nprobeIn;
+}
+
+int
+GpuIndexIVFListShards::getNumProbes() const {
+  return nprobe;
+}
+
+void
+GpuIndexIVFListShards::train(idx_t n, const float* x) {
+  FAISS_THROW_IF_NOT_MSG(this->is_trained,
+                         "GpuIndexIVFListShards must be created from "
+                         "trained IVF indices");
+}
+
+void
+GpuIndexIVFListShards::add(idx_t n, const float* x) {
+  std::vector<idx_t> ids(n);
+  std::iota(ids.begin(), ids.end(), this->ntotal);
+
+  add_with_ids(n, x, ids.data());
+}
+
+void
+GpuIndexIVFListShards::add_with_ids(idx_t n,
+                                    const float* x,
+                                    const idx_t* xids) {
+  FAISS_THROW_IF_NOT_MSG(this->is_trained, "Index not trained");
+  FAISS_THROW_IF_NOT_MSG(this->count() > 0, "no shards");
+
+  if (n == 0) {
+    return;
+  }
+
+  std::vector<idx_t> assign(n);
+  quantizer->assign(n, x, assign.data());
+
+  // Vectors that could not be assigned (e.g., containing NaNs) are dropped,
+  // as IndexIVF does
+  std::vector<std::vector<idx_t>> shardVecs(this->count());
+
+  for (idx_t i = 0; i < n; ++i) {
+    if (assign[i] >= 0) {
+      shardVecs[listToShard[assign[i]]].push_back(i);
+    }
+  }
+
+  // The shard quantizers hold the same centroids as ours, so each shard
+  // assigns its vectors to the lists we chose
+  auto fn =
+    [this, x, xids, &shardVecs](int shard, Index* index) {
+      auto& vecs = shardVecs[shard];
+      if (vecs.empty()) {
+        return;
+      }
+
+      std::vector<float> shardX(vecs.size() * this->d);
+      std::vector<idx_t> shardIds(vecs.size());
+
+      for (size_t i = 0; i < vecs.size(); ++i) {
+        memcpy(shardX.data() + i * this->d,
+               x + vecs[i] * this->d,
+               this->d * sizeof(float));
+        shardIds[i] = xids[vecs[i]];
+      }
+
+      index->add_with_ids(vecs.size(), shardX.data(), shardIds.data());
+    };
+
+  this->runOnIndex(fn);
+  syncWithSubIndexes_();
+}
+
+namespace {
+
+/// The work of one shard for a search
+struct ShardQueries {
+  /// Queries probing at least one list of the shard
+  std::vector<Index::idx_t> queries;
+
+  /// Largest number of the shard's lists probed by one query
+  int nprobe = 0;
+
+  /// (queries x nprobe) probed lists of the shard, padded with -1
+  std::vector<Index::idx_t> assign;
+  std::vector<float> centroidDis;
+
+  /// (queries x k) results
+  std::vector<float> distances;
+  std::vector<Index::idx_t> labels;
+};
+
+} // namespace
+
+void
+GpuIndexIVFListShards::search(idx_t n,
+                              const float* x,
+                              idx_t k,
+                              float* distances,
+                              idx_t* labels,
+                              const SearchParameters* params) const {
+  FAISS_THROW_IF_NOT_MSG(!params,
+                         "search params not supported for this index");
+  FAISS_THROW_IF_NOT_MSG(this->count() > 0, "no shards");
+
+  if (n == 0 || k == 0) {
+    return;
+  }
+
+  int numShards = this->count();
+  int np = std::min(nprobe, nlist);
+
+  // The coarse quantizer runs once for all shards
+  std::vector<float> coarseDis(n * np);
+  std::vector<idx_t> coarseIds(n * np);
+  quantizer->search(n, x, np, coarseDis.data(), coarseIds.data());
+
+  // Route each query to the shards owning its probed lists; shardRow is the
+  // row of each query in the work of each shard, or -1
+  std::vector<ShardQueries> work(numShards);
+  std::vector<idx_t> shardRow((size_t) n * numShards, -1);
+  std::vector<int> probesPerShard(numShards);
+
+  for (idx_t q = 0; q < n; ++q) {
+    std::fill(probesPerShard.begin(), probesPerShard.end(), 0);
+
+    for (int p = 0; p < np; ++p) {
+      idx_t list = coarseIds[q * np + p];
+
+      if (list >= 0) {
+        probesPerShard[listToShard[list]]++;
+      }
+    }
+
+    for (int s = 0; s < numShards; ++s) {
+      if (probesPerShard[s] > 0) {
+        auto& w = work[s];
+
+        shardRow[q * numShards + s] = w.queries.size();
+        w.queries.push_back(q);
+        w.nprobe = std::max(w.nprobe, probesPerShard[s]);
+      }
+    }
+  }
+
+  for (auto& w : work) {
+    w.assign.assign(w.queries.size() * w.nprobe, -1);
+    w.centroidDis.assign(w.queries.size() * w.nprobe, 0);
+  }
+
+  for (idx_t q = 0; q < n; ++q) {
+    std::fill(probesPerShard.begin(), probesPerShard.end(), 0);
+
+    for (int p = 0; p < np; ++p) {
+      idx_t list = coarseIds[q * np + p];
+
+      if (list >= 0) {
+        int s = listToShard[list];
+        auto& w = work[s];
+        size_t pos = shardRow[q * numShards + s] * w.nprobe +
+          probesPerShard[s]++;
+
+        w.assign[pos] = list;
+        w.centroidDis[pos] = coarseDis[q * np + p];
+      }
+    }
+  }
+
+  auto fn =
+    [this, x, k, &work](int shard, const Index* index) {
+      auto& w = work[shard];
+      if (w.queries.empty()) {
+        return;
+      }
+
+      auto ivf = dynamic_cast<const GpuIndexIVF*>(index);
+      FAISS_ASSERT(ivf);
+
+      std::vector<float> shardX(w.queries.size() * this->d);
+
+      for (size_t i = 0; i < w.queries.size(); ++i) {
+        memcpy(shardX.data() + i * this->d,
+               x + w.queries[i] * this->d,
+               this->d * sizeof(float));
+      }
+
+      w.distances.resize(w.queries.size() * k);
+      w.labels.resize(w.queries.size() * k);
+
+      ivf->searchPreassigned(w.queries.size(), shardX.data(), k, w.nprobe,
+                             w.assign.data(), w.centroidDis.data(),
+                             w.distances.data(), w.labels.data());
+    };
+
+  this->runOnIndex(fn);
+
+  // k-way merge of the results of the shards each query was routed to
+  bool largestFirst = this->metric_type == METRIC_INNER_PRODUCT;
+  float initDistance = largestFirst ?
+    -std::numeric_limits<float>::max() : std::numeric_limits<float>::max();
+
+#pragma omp parallel for if (n > 100)
+  for (idx_t q = 0; q < n; ++q) {
+    std::vector<std::pair<float, idx_t>> candidates;
+
+    for (int s = 0; s < numShards; ++s) {
+      idx_t row = shardRow[q * numShards + s];
+      if (row < 0) {
+        continue;
+      }
+
+      auto& w = work[s];
+
+      for (idx_t j = 0; j < k; ++j) {
+        idx_t label = w.labels[row * k + j];
+
+        if (label >= 0) {
+          candidates.emplace_back(w.distances[row * k + j], label);
+        }
+      }
+    }
+
+    size_t numOut = std::min((size_t) k, candidates.size());
+
+    if (largestFirst) {
+      std::partial_sort(candidates.begin(), candidates.begin() + numOut,
+                        candidates.end(),
+                        std::greater<std::pair<float, idx_t>>());
+    } else {
+      std::partial_sort(candidates.begin(), candidates.begin() + numOut,
+                        candidates.end());
+    }
+
+    for (idx_t j = 0; j < k; ++j) {
+      bool valid = j < numOut;
+      distances[q * k + j] = valid ? candidates[j].first : initDistance;
+      labels[q * k + j] = valid ? candidates[j].second : -1;
+    }
+  }
+}
+
+void
+GpuIndexIVFListShards::reset() {
+  this->runOnIndex([](int, Index* index){ index->reset(); });
+  this->ntotal = 0;
+}
+
+void
+GpuIndexIVFListShards::onAfterAddIndex(Index* index) {
+  auto ivf = dynamic_cast<GpuIndexIVF*>(index);
+
+  FAISS_THROW_IF_NOT_MSG(ivf, "shards must be GPU IVF indices");
+  FAISS_THROW_IF_NOT_FMT(ivf->getNumLists() == nlist,
+                         "shard has %d lists, expected %d",
+                         ivf->getNumLists(), nlist);
+  FAISS_THROW_IF_NOT(ivf->metric_type == this->metric_type);
+
+  syncWithSubIndexes_();
+}
+
+void
+GpuIndexIVFListShards::onAfterRemoveIndex(Index* index) {
+  syncWithSubIndexes_();
+}
+
+void
+GpuIndexIVFListShards::syncWithSubIndexes_() {
+  this->ntotal = 0;
+
+  for (int i = 0; i < this->count(); ++i) {
+    this->ntotal += this->at(i)->ntotal;
+  }
+}
+
+} } // namespace
@@ -0,0 +1,101 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#pragma once
+
+#include <faiss/Index.h>
+#include <faiss/impl/ThreadedIndex.h>
+#include <vector>
+
+namespace faiss { struct InvertedLists; }
+
+namespace faiss { namespace gpu {
+
+class GpuIndexIVF;
+
+/// Multi-GPU IVF index that partitions the inverted lists, rather than the
+/// vectors, across GPUs. Each shard (a GpuIndexIVF, typically one per GPU)
+/// holds a replica of the coarse centroids but only the lists it owns.
+///
+/// On search, the coarse quantizer runs once for the whole batch. Each query
+/// is then only routed to the shards owning some of its probed lists, with
+/// only those lists to scan, so that each GPU scans about nprobe / nshard
+/// lists per query instead of all nprobe lists like IndexShards does. The
+/// per-shard results are merged on the CPU.
+class GpuIndexIVFListShards : public ThreadedIndex<Index> {
+ public:
+  /// `quantizer` is the coarse quantizer used for search and add, holding
+  /// the same centroids as the shards (e.g., a GpuIndexFlat on the first
+  /// GPU)
+  GpuIndexIVFListShards(faiss::Index* quantizer,
+                        int nlist,
+                        bool threaded = true);
+
+  ~GpuIndexIVFListShards() override;
+
+  /// Adds a shard; the lists it owns are those l with listToShard[l] equal
+  /// to its rank among the shards
+  void addShard(GpuIndexIVF* shard);
+
+  /// Assigns the lists to `numShards` shards, balancing the number of
+  /// vectors per shard: lists are placed largest first on the shard that
+  /// holds the fewest vectors so far
+  static std::vector<int> balanceLists(const InvertedLists* invlists,
+                                       int numShards);
+
+  /// Sets the number of list probes per query
+  void setNumProbes(int nprobe);
+
+  /// Returns our current number of list probes per query
+  int getNumProbes() const;
+
+  /// The shards and the quantizer are trained when they are created from
+  /// an IndexIVF
+  void train(idx_t n, const float* x) override;
+
+  /// Adds vectors with sequential ids
+  void add(idx_t n, const float* x) override;
+
+  /// Assigns each vector with the coarse quantizer, and adds it to the
+  /// shard owning its list
+  void add_with_ids(idx_t n, const float* x, const idx_t* xids) override;
+
+  void search(idx_t n, const float* x, idx_t k,
+              float* distances, idx_t* labels,
+              const SearchParameters* params = nullptr) const override;
+
+  void reset() override;
+
+ public:
+  /// Coarse quantizer
+  faiss::Index* quantizer;
+
+  /// Whether or not we delete the quantizer
+  bool ownQuantizer;
+
+  /// Number of inverted lists
+  int nlist;
+
+  /// Number of list probes per query
+  int nprobe;
+
+  /// Owning shard of each inverted list
+  std::vector<int> listToShard;
+
+ protected:
+  /// Checks that the new shard is a GpuIndexIVF matching our lists
+  void onAfterAddIndex(Index* index) override;
+
+  /// Recomputes ntotal
+  void onAfterRemoveIndex(Index* index) override;
+
+ private:
+  void syncWithSubIndexes_();
+};
+
+} } // namespace
@@ -9,17 +9,56 @@
 #include <faiss/gpu/GpuIndexIVFPQ.h>
 #include <faiss/IndexFlat.h>
 #include <faiss/IndexIVFPQ.h>
+#include <faiss/IndexIVFPQFastScan.h>
 #include <faiss/impl/ProductQuantizer.h>
 #include <faiss/gpu/GpuIndexFlat.h>
 #include <faiss/gpu/GpuResources.h>
 #include <faiss/gpu/impl/IVFPQ.cuh>
 #include <faiss/gpu/utils/CopyUtils.cuh>
+#include <faiss/gpu/utils/DeviceTensor.cuh>
 #include <faiss/gpu/utils/DeviceUtils.h>
+#include <faiss/gpu/utils/StackDeviceMemory.h>
 
 #include <limits>
 
 namespace faiss { namespace gpu {
 
+/// A search captured into a CUDA graph, with the buffers that the graph
+/// references
+struct GpuIndexIVFPQ::SearchGraph {
+  SearchGraph(GpuResources* res,
+              int device,
+              int n,
+              int d,
+              int k,
+              size_t tempMemorySize,
+              cudaStream_t stream)
+      : tempMemory(res, device, tempMemorySize),
+        queries(res, makeDevAlloc(AllocType::Other, stream), {n, d}),
+        distances(res, makeDevAlloc(AllocType::Other, stream), {n, k}),
+        labels(res, makeDevAlloc(AllocType::Other, stream), {n, k}),
+        exec(nullptr) {
+  }
+
+  ~SearchGraph() {
+    if (exec) {
+      CUDA_VERIFY(cudaGraphExecDestroy(exec));
+    }
+  }
+
+  /// Temporary memory of the search, reserved for the graph
+  StackDeviceMemory tempMemory;
+
+  /// Search inputs and outputs; the search arguments are copied in and
+  /// out of these around each replay
+  DeviceTensor<float, 2, true> queries;
+  DeviceTensor<float, 2, true> distances;
+  DeviceTensor<Index::idx_t, 2, true> labels;
+
+  /// Instantiated graph, or nullptr if the search could not be captured
+  cudaGraphExec_t exec;
+};
+
 GpuIndexIVFPQ::GpuIndexIVFPQ(GpuResourcesProvider* provider,
                              const faiss::IndexIVFPQ* index,
                              GpuIndexIVFPQConfig config) :
@@ -31,6 +70,25 @@ GpuIndexIVFPQ::GpuIndexIVFPQ(GpuResourcesProvider* provider,
                 config),
     ivfpqConfig_(config),
     usePrecomputedTables_(config.usePrecomputedTables),
+    fastScanLayout_(false),
+    subQuantizers_(0),
+    bitsPerCode_(0),
+    reserveMemoryVecs_(0) {
+  copyFrom(index);
+}
+
+GpuIndexIVFPQ::GpuIndexIVFPQ(GpuResourcesProvider* provider,
+                             const faiss::IndexIVFPQFastScan* index,
+                             GpuIndexIVFPQConfig config) :
+    GpuIndexIVF(provider,
+                index->d,
+                index->metric_type,
+                index->metric_arg,
+                index->nlist,
+                config),
+    ivfpqConfig_(config),
+    usePrecomputedTables_(false),
+    fastScanLayout_(true),
     subQuantizers_(0),
     bitsPerCode_(0),
     reserveMemoryVecs_(0) {
@@ -52,6 +110,7 @@ GpuIndexIVFPQ::GpuIndexIVFPQ(GpuResourcesProvider* provider,
                 config),
     ivfpqConfig_(config),
     usePrecomputedTables_(config.usePrecomputedTables),
+    fastScanLayout_(config.fastScanLayout),
     subQuantizers_(subQuantizers),
     bitsPerCode_(bitsPerCode),
     reserveMemoryVecs_(0) {
@@ -62,27 +121,54 @@ GpuIndexIVFPQ::GpuIndexIVFPQ(GpuResourcesProvider* provider,
 }
 
 GpuIndexIVFPQ::~GpuIndexIVFPQ() {
+  DeviceScope scope(config_.device);
+  clearSearchGraphs_();
 }
 
 void
 GpuIndexIVFPQ::copyFrom(const faiss::IndexIVFPQ* index) {
   DeviceScope scope(config_.device);
 
-  GpuIndexIVF::copyFrom(index);
+  // We only support this
+  FAISS_THROW_IF_NOT_MSG(index->by_residual,
+                         "GPU: only by_residual = true is supported");
+  FAISS_THROW_IF_NOT_MSG(index->polysemous_ht == 0,
+                         "GPU: polysemous codes not supported");
 
-  // Clear out our old data
-  index_.reset();
+  fastScanLayout_ = ivfpqConfig_.fastScanLayout;
+  FAISS_THROW_IF_NOT_MSG(!fastScanLayout_,
+                         "GPU: the fast-scan layout can only be copied "
+                         "from an IndexIVFPQFastScan");
 
-  subQuantizers_ = index->pq.M;
-  bitsPerCode_ = index->pq.nbits;
+  copyFromPQ_(index, index->pq);
+}
+
+void
+GpuIndexIVFPQ::copyFrom(const faiss::IndexIVFPQFastScan* index) {
+  DeviceScope scope(config_.device);
 
   // We only support this
-  FAISS_THROW_IF_NOT_MSG(index->pq.nbits == 8,
-                         "GPU: only pq.nbits == 8 is supported");
   FAISS_THROW_IF_NOT_MSG(index->by_residual,
                          "GPU: only by_residual = true is supported");
-  FAISS_THROW_IF_NOT_MSG(index->polysemous_ht == 0,
-                         "GPU: polysemous codes not supported");
+
+  // The lists are copied as is
+  fastScanLayout_ = true;
+  usePrecomputedTables_ = false;
+
+  copyFromPQ_(index, index->pq);
+}
+
+void
+GpuIndexIVFPQ::copyFromPQ_(const faiss::IndexIVF* index,
+                           const faiss::ProductQuantizer& pq) {
+  GpuIndexIVF::copyFrom(index);
+
+  // Clear out our old data
+  clearSearchGraphs_();
+  index_.reset();
+
+  subQuantizers_ = pq.M;
+  bitsPerCode_ = pq.nbits;
 
   verifySettings_();
 
@@ -95,7 +181,7 @@ GpuIndexIVFPQ::copyFrom(const faiss::IndexIVFPQ* index) {
 
   // Copy our lists as well
   // The product quantizer must have data in it
-  FAISS_ASSERT(index->pq.centroids.size() > 0);
+  FAISS_ASSERT(pq.centroids.size() > 0);
   index_.reset(new IVFPQ(resources_.get(),
                          index->metric_type,
                          index->metric_arg,
@@ -105,10 +191,13 @@ GpuIndexIVFPQ::copyFrom(const faiss::IndexIVFPQ* index) {
                          ivfpqConfig_.useFloat16LookupTables,
                          ivfpqConfig_.useMMCodeDistance,
                          ivfpqConfig_.alternativeLayout,
-                         (float*) index->pq.centroids.data(),
+                         fastScanLayout_,
+                         (float*) pq.centroids.data(),
                          ivfpqConfig_.indicesOptions,
                          config_.memorySpace));
+  index_->setHotListBytes(ivfConfig_.unifiedHotListBytes);
   // Doesn't make sense to reserve memory here
+  index_->setPrecomputedTableMaxBytes(ivfpqConfig_.precomputedTableMaxBytes);
   index_->setPrecomputedCodes(usePrecomputedTables_);
 
   // Copy all of the IVF data
@@ -123,6 +212,9 @@ GpuIndexIVFPQ::copyTo(faiss::IndexIVFPQ* index) const {
   FAISS_THROW_IF_NOT_MSG(ivfpqConfig_.indicesOptions != INDICES_IVF,
                      "Cannot copy to CPU as GPU index doesn't retain "
                      "indices (INDICES_IVF)");
+  FAISS_THROW_IF_NOT_MSG(!fastScanLayout_,
+                     "GPU index in the fast-scan layout can only be copied "
+                     "to an IndexIVFPQFastScan");
 
   GpuIndexIVF::copyTo(index);
 
@@ -131,8 +223,8 @@ GpuIndexIVFPQ::copyTo(faiss::IndexIVFPQ* index) const {
   //
   index->by_residual = true;
   index->use_precomputed_table = 0;
-  index->code_size = subQuantizers_;
   index->pq = faiss::ProductQuantizer(this->d, subQuantizers_, bitsPerCode_);
+  index->code_size = index->pq.code_size;
 
   index->do_polysemous_training = false;
   index->polysemous_training = nullptr;
@@ -163,11 +255,54 @@ GpuIndexIVFPQ::copyTo(faiss::IndexIVFPQ* index) const {
   }
 }
 
+void
+GpuIndexIVFPQ::copyTo(faiss::IndexIVFPQFastScan* index) const {
+  DeviceScope scope(config_.device);
+
+  // We must have the indices in order to copy to ourselves
+  FAISS_THROW_IF_NOT_MSG(ivfpqConfig_.indicesOptions != INDICES_IVF,
+                     "Cannot copy to CPU as GPU index doesn't retain "
+                     "indices (INDICES_IVF)");
+  FAISS_THROW_IF_NOT_MSG(fastScanLayout_,
+                     "GPU index must be in the fast-scan layout to be "
+                     "copied to an IndexIVFPQFastScan");
+
+  GpuIndexIVF::copyTo(index);
+
+  //
+  // IndexIVFPQFastScan information
+  //
+  index->by_residual = true;
+  index->pq = faiss::ProductQuantizer(this->d, subQuantizers_, bitsPerCode_);
+
+  // Sets up empty block inverted lists for nlist
+  index->init_fast_scan();
+
+  if (index_) {
+    // Copy IVF lists; the blocks are copied as is
+    index_->copyInvertedListsTo(index->invlists);
+
+    // Copy PQ centroids
+    auto devPQCentroids = index_->getPQCentroids();
+    index->pq.centroids.resize(devPQCentroids.numElements());
+
+    fromDevice<float, 3>(devPQCentroids,
+                         index->pq.centroids.data(),
+                         resources_->getDefaultStream(config_.device));
+  }
+}
+
+bool
+GpuIndexIVFPQ::getFastScanLayout() const {
+  return fastScanLayout_;
+}
+
 void
 GpuIndexIVFPQ::reserveMemory(size_t numVecs) {
   reserveMemoryVecs_ = numVecs;
   if (index_) {
     DeviceScope scope(config_.device);
+    clearSearchGraphs_();
     index_->reserveMemory(numVecs);
   }
 }
@@ -177,6 +312,7 @@ GpuIndexIVFPQ::setPrecomputedCodes(bool enable) {
   usePrecomputedTables_ = enable;
   if (index_) {
     DeviceScope scope(config_.device);
+    clearSearchGraphs_();
     index_->setPrecomputedCodes(enable);
   }
 
@@ -207,6 +343,7 @@ size_t
 GpuIndexIVFPQ::reclaimMemory() {
   if (index_) {
     DeviceScope scope(config_.device);
+    clearSearchGraphs_();
     return index_->reclaimMemory();
   }
 
@@ -218,6 +355,7 @@ GpuIndexIVFPQ::reset() {
   if (index_) {
     DeviceScope scope(config_.device);
 
+    clearSearchGraphs_();
     index_->reset();
     this->ntotal = 0;
   } else {
@@ -225,6 +363,23 @@ GpuIndexIVFPQ::reset() {
   }
 }
 
+size_t
+GpuIndexIVFPQ::remove_ids(const IDSelector& sel) {
+  if (!index_) {
+    FAISS_ASSERT(this->ntotal == 0);
+    return 0;
+  }
+
+  DeviceScope scope(config_.device);
+
+  clearSearchGraphs_();
+
+  size_t numRemoved = index_->removeIds(sel);
+  this->ntotal -= numRemoved;
+
+  return numRemoved;
+}
+
 void
 GpuIndexIVFPQ::trainResidualQuantizer_(Index::idx_t n, const float* x) {
   // Code largely copied from faiss::IndexIVFPQ
@@ -264,13 +419,16 @@ GpuIndexIVFPQ::trainResidualQuantizer_(Index::idx_t n, const float* x) {
                          ivfpqConfig_.useFloat16LookupTables,
                          ivfpqConfig_.useMMCodeDistance,
                          ivfpqConfig_.alternativeLayout,
+                         fastScanLayout_,
                          pq.centroids.data(),
                          ivfpqConfig_.indicesOptions,
                          config_.memorySpace));
+  index_->setHotListBytes(ivfConfig_.unifiedHotListBytes);
   if (reserveMemoryVecs_) {
     index_->reserveMemory(reserveMemoryVecs_);
   }
 
+  index_->setPrecomputedTableMaxBytes(ivfpqConfig_.precomputedTableMaxBytes);
   index_->setPrecomputedCodes(usePrecomputedTables_);
 }
 
@@ -319,6 +477,9 @@ GpuIndexIVFPQ::addImpl_(int n,
   Tensor<float, 2, true> data(const_cast<float*>(x), {n, (int) this->d});
   Tensor<Index::idx_t, 1, true> labels(const_cast<Index::idx_t*>(xids), {n});
 
+  // The list lengths and storage the graphs were captured with change
+  clearSearchGraphs_();
+
   // Not all vectors may be able to be added (some may contain NaNs etc)
   index_->addVectors(data, labels);
 
@@ -327,6 +488,36 @@ GpuIndexIVFPQ::addImpl_(int n,
   ntotal += n;
 }
 
+void
+GpuIndexIVFPQ::searchPreassignedImpl_(int n,
+                                      const float* x,
+                                      int k,
+                                      int nprobe,
+                                      const int* assign,
+                                      const float* centroidDis,
+                                      float* distances,
+                                      Index::idx_t* labels) const {
+  // Device is already set in GpuIndexIVF::searchPreassigned
+  FAISS_ASSERT(index_);
+  FAISS_ASSERT(n > 0);
+
+  // Data is already resident on the GPU
+  Tensor<float, 2, true> queries(const_cast<float*>(x), {n, (int) this->d});
+  Tensor<int, 2, true> coarseIndices(const_cast<int*>(assign), {n, nprobe});
+  Tensor<float, 2, true> coarseDistances(const_cast<float*>(centroidDis),
+                                         {n, nprobe});
+  Tensor<float, 2, true> outDistances(distances, {n, k});
+  Tensor<Index::idx_t, 2, true> outLabels(labels, {n, k});
+
+  index_->queryPreassigned(queries, coarseDistances, coarseIndices,
+                           k, outDistances, outLabels);
+}
+
+int
+GpuIndexIVFPQ::getMaxSearchK_() const {
+  return getMaxLargeKSelection();
+}
+
 void
 GpuIndexIVFPQ::searchImpl_(int n,
                            const float* x,
@@ -342,9 +533,120 @@ GpuIndexIVFPQ::searchImpl_(int n,
   Tensor<float, 2, true> outDistances(distances, {n, k});
   Tensor<Index::idx_t, 2, true> outLabels(const_cast<Index::idx_t*>(labels), {n, k});
 
+  if (ivfpqConfig_.useSearchGraphs &&
+      searchWithGraph_(n, x, k, distances, labels)) {
+    return;
+  }
+
   index_->query(queries, nprobe, k, outDistances, outLabels);
 }
 
+bool
+GpuIndexIVFPQ::searchWithGraph_(int n,
+                                const float* x,
+                                int k,
+                                float* distances,
+                                Index::idx_t* labels) const {
+  // These copy data through the CPU during the search, which cannot be
+  // captured
+  if (ivfpqConfig_.indicesOptions == INDICES_CPU ||
+      config_.memorySpace == MemorySpace::Unified ||
+      index_->getPrecomputedCodesOnTheFly()) {
+    return false;
+  }
+
+  auto stream = resources_->getDefaultStream(config_.device);
+  auto key = std::make_tuple(n, k, nprobe);
+  auto it = searchGraphs_.find(key);
+
+  if (it == searchGraphs_.end()) {
+    std::unique_ptr<SearchGraph> graph(
+      new SearchGraph(resources_.get(),
+                      config_.device,
+                      n,
+                      this->d,
+                      k,
+                      ivfpqConfig_.searchGraphTempMemory,
+                      stream));
+
+    // Temporary memory used within the capture must still be valid, and
+    // not in use by anyone else, when the graph is replayed
+    if (resources_->setTemporaryMemoryOverride(config_.device,
+                                               &graph->tempMemory)) {
+      cudaGraph_t captured = nullptr;
+      bool ok = cudaStreamBeginCapture(
+        stream, cudaStreamCaptureModeThreadLocal) == cudaSuccess;
+
+      if (ok) {
+        try {
+          index_->query(graph->queries, nprobe, k,
+                        graph->distances, graph->labels);
+        } catch (const std::exception&) {
+          // e.g., the reserved temporary memory is too small
+          ok = false;
+        }
+
+        ok = (cudaStreamEndCapture(stream, &captured) == cudaSuccess) && ok;
+      }
+
+      resources_->setTemporaryMemoryOverride(config_.device, nullptr);
+
+      if (ok) {
+        ok = cudaGraphInstantiate(
+          &graph->exec, captured, nullptr, nullptr, 0) == cudaSuccess;
+      }
+
+      if (captured) {
+        CUDA_VERIFY(cudaGraphDestroy(captured));
+      }
+
+      if (!ok) {
+        graph->exec = nullptr;
+
+        // Forget the capture error; this shape is searched directly
+        cudaGetLastError();
+      }
+    }
+
+    it = searchGraphs_.emplace(key, std::move(graph)).first;
+  }
+
+  auto& graph = *it->second;
+  if (!graph.exec) {
+    return false;
+  }
+
+  CUDA_VERIFY(cudaMemcpyAsync(graph.queries.data(),
+                              x,
+                              graph.queries.getSizeInBytes(),
+                              cudaMemcpyDeviceToDevice,
+                              stream));
+  CUDA_VERIFY(cudaGraphLaunch(graph.exec, stream));
+  CUDA_VERIFY(cudaMemcpyAsync(distances,
+                              graph.distances.data(),
+                              graph.distances.getSizeInBytes(),
+                              cudaMemcpyDeviceToDevice,
+                              stream));
+  CUDA_VERIFY(cudaMemcpyAsync(labels,
+                              graph.labels.data(),
+                              graph.labels.getSizeInBytes(),
+                              cudaMemcpyDeviceToDevice,
+                              stream));
+
+  return true;
+}
+
+void
+GpuIndexIVFPQ::clearSearchGraphs_() {
+  if (searchGraphs_.empty()) {
+    return;
+  }
+
+  // A graph may still be running with its buffers
+  resources_->syncDefaultStream(config_.device);
+  searchGraphs_.clear();
+}
+
 int
 GpuIndexIVFPQ::getListLength(int listId) const {
   FAISS_ASSERT(index_);
@@ -369,6 +671,15 @@ GpuIndexIVFPQ::getListIndices(int listId) const {
   return index_->getListIndices(listId);
 }
 
+MemoryUsage
+GpuIndexIVFPQ::memory_usage() const {
+  MemoryUsage mu = GpuIndexIVF::memory_usage();
+  if (index_) {
+    mu.add("invlists", index_->getMemoryUsage());
+  }
+  return mu;
+}
+
 void
 GpuIndexIVFPQ::verifySettings_() const {
   // Our implementation has these restrictions:
@@ -376,9 +687,10 @@ GpuIndexIVFPQ::verifySettings_() const {
   // Must have some number of lists
   FAISS_THROW_IF_NOT_MSG(nlist > 0, "nlist must be >0");
 
-  // up to a single byte per code
-  FAISS_THROW_IF_NOT_FMT(bitsPerCode_ <= 8,
-                     "Bits per code must be <= 8 (passed %d)", bitsPerCode_);
+  // up to two bytes per code
+  FAISS_THROW_IF_NOT_FMT(IVFPQ::isSupportedBitsPerCode(bitsPerCode_),
+                     "Bits per code must be between 1 and 16 (passed %d)",
+                     bitsPerCode_);
 
   // Sub-quantizers must evenly divide dimensions available
   FAISS_THROW_IF_NOT_FMT(this->d % subQuantizers_ == 0,
@@ -386,33 +698,20 @@ GpuIndexIVFPQ::verifySettings_() const {
                      "even divisor of the number of dimensions (%d)",
                      subQuantizers_, this->d);
 
-  // The number of bytes per encoded vector must be one we support
-  FAISS_THROW_IF_NOT_FMT(IVFPQ::isSupportedPQCodeLength(subQuantizers_),
-                     "Number of bytes per encoded vector / sub-quantizers (%d) "
-                     "is not supported",
-                     subQuantizers_);
-
-  // We must have enough shared memory on the current device to store
-  // our lookup distances
-  int lookupTableSize = sizeof(float);
-  if (ivfpqConfig_.useFloat16LookupTables) {
-    lookupTableSize = sizeof(half);
+  if (fastScanLayout_) {
+    FAISS_THROW_IF_NOT_FMT(bitsPerCode_ == 4,
+                       "The fast-scan layout requires 4 bits per code "
+                       "(passed %d)", bitsPerCode_);
+    FAISS_THROW_IF_NOT_MSG(!ivfpqConfig_.alternativeLayout,
+                       "The fast-scan layout excludes alternativeLayout");
+    FAISS_THROW_IF_NOT_MSG(!usePrecomputedTables_,
+                       "Precomputed tables are not supported with the "
+                       "fast-scan layout");
   }
 
-  // 64 bytes per code is only supported with usage of float16, at 2^8
-  // codes per subquantizer
-  size_t requiredSmemSize =
-    lookupTableSize * subQuantizers_ * utils::pow2(bitsPerCode_);
-  size_t smemPerBlock = getMaxSharedMemPerBlock(config_.device);
-
-  FAISS_THROW_IF_NOT_FMT(requiredSmemSize
-                     <= getMaxSharedMemPerBlock(config_.device),
-                     "Device %d has %zu bytes of shared memory, while "
-                     "%d bits per code and %d sub-quantizers requires %zu "
-                     "bytes. Consider useFloat16LookupTables and/or "
-                     "reduce parameters",
-                     config_.device, smemPerBlock, bitsPerCode_, subQuantizers_,
-                     requiredSmemSize);
+  // Any number of sub-quantizers is supported; the list scanning kernels
+  // read the lookup tables from global memory if they don't fit into shared
+  // memory
 }
 
 } } // namespace
@@ -9,10 +9,16 @@
 #pragma once
 
 #include <faiss/gpu/GpuIndexIVF.h>
+#include <map>
 #include <memory>
+#include <tuple>
 #include <vector>
 
-namespace faiss { struct IndexIVFPQ; }
+namespace faiss {
+struct IndexIVFPQ;
+struct IndexIVFPQFastScan;
+struct ProductQuantizer;
+}
 
 namespace faiss { namespace gpu {
 
@@ -23,23 +29,42 @@ struct GpuIndexIVFPQConfig : public GpuIndexIVFConfig {
   inline GpuIndexIVFPQConfig()
       : useFloat16LookupTables(false),
         usePrecomputedTables(false),
+        precomputedTableMaxBytes((size_t) 1 << 31),
         alternativeLayout(false),
-        useMMCodeDistance(false) {
+        fastScanLayout(false),
+        useMMCodeDistance(false),
+        useSearchGraphs(false),
+        searchGraphTempMemory((size_t) 128 * 1024 * 1024) {
   }
 
   /// Whether or not float16 residual distance tables are used in the
-  /// list scanning kernels. When subQuantizers * 2^bitsPerCode >
-  /// 16384, this is required.
+  /// list scanning kernels. The tables of subQuantizers * 2^bitsPerCode
+  /// entries are read from shared memory if they fit, and from global
+  /// memory (more slowly) otherwise.
   bool useFloat16LookupTables;
 
   /// Whether or not we enable the precomputed table option for
   /// search, which can substantially increase the memory requirement.
   bool usePrecomputedTables;
 
+  /// With usePrecomputedTables, the precomputed table has nlist *
+  /// subQuantizers * 2^bitsPerCode entries (in float16 with
+  /// useFloat16LookupTables). If it is larger than this, it is not stored:
+  /// each search computes the entries of the lists probed by its queries,
+  /// by tiles of queries whose entries take at most about this size. This
+  /// copies the probed list ids to the CPU, so search graphs are not used
+  size_t precomputedTableMaxBytes;
+
   /// Use the alternative memory layout for the IVF lists
   /// WARNING: this is a feature under development, do not use!
   bool alternativeLayout;
 
+  /// Store the IVF lists in the 4-bit fast-scan block layout of the CPU
+  /// IndexIVFPQFastScan, so that lists move between the CPU and the GPU
+  /// without re-encoding. Requires 4 bits per code and no precomputed tables.
+  /// Set automatically when constructing from an IndexIVFPQFastScan
+  bool fastScanLayout;
+
   /// Use GEMM-backed computation of PQ code distances for the no precomputed
   /// table version of IVFPQ.
   /// This is for debugging purposes, it should not substantially affect the
@@ -49,6 +74,20 @@ struct GpuIndexIVFPQConfig : public GpuIndexIVFConfig {
   /// of dimensions per sub-quantizer that is not natively specialized (an odd
   /// number like 7 or so).
   bool useMMCodeDistance;
+
+  /// Capture the kernels of a search into a CUDA graph the first time a
+  /// (number of queries, k, nprobe) shape is seen, and replay the graph for
+  /// later searches of the same shape, to cut CPU launch overhead and
+  /// jitter. Each shape keeps its own query, result and temporary buffers
+  /// on the GPU. Graphs are dropped whenever the index content or search
+  /// settings change. Not used with INDICES_CPU, MemorySpace::Unified or
+  /// precomputed tables computed at search time, which need the CPU in the
+  /// middle of a search.
+  bool useSearchGraphs;
+
+  /// With useSearchGraphs, the temporary memory reserved for each captured
+  /// shape; shapes whose search needs more are searched without a graph
+  size_t searchGraphTempMemory;
 };
 
 /// IVFPQ index for the GPU
@@ -60,6 +99,12 @@ class GpuIndexIVFPQ : public GpuIndexIVF {
                 const faiss::IndexIVFPQ* index,
                 GpuIndexIVFPQConfig config = GpuIndexIVFPQConfig());
 
+  /// Construct from a pre-existing faiss::IndexIVFPQFastScan instance; the
+  /// GPU lists keep the fast-scan block layout
+  GpuIndexIVFPQ(GpuResourcesProvider* provider,
+                const faiss::IndexIVFPQFastScan* index,
+                GpuIndexIVFPQConfig config = GpuIndexIVFPQConfig());
+
   /// Construct an empty index
   GpuIndexIVFPQ(GpuResourcesProvider* provider,
                 int dims,
@@ -78,10 +123,21 @@ class GpuIndexIVFPQ : public GpuIndexIVF {
   /// all data in ourselves
   void copyFrom(const faiss::IndexIVFPQ* index);
 
+  /// Initialize ourselves from the given CPU fast-scan index, in the
+  /// fast-scan layout; will overwrite all data in ourselves
+  void copyFrom(const faiss::IndexIVFPQFastScan* index);
+
   /// Copy ourselves to the given CPU index; will overwrite all data
-  /// in the index instance
+  /// in the index instance. Not available with the fast-scan layout
   void copyTo(faiss::IndexIVFPQ* index) const;
 
+  /// Copy ourselves to the given CPU fast-scan index; requires the
+  /// fast-scan layout
+  void copyTo(faiss::IndexIVFPQFastScan* index) const;
+
+  /// Are the IVF lists in the 4-bit fast-scan layout?
+  bool getFastScanLayout() const;
+
   /// Reserve GPU memory in our inverted lists for this number of vectors
   void reserveMemory(size_t numVecs);
 
@@ -108,6 +164,10 @@ class GpuIndexIVFPQ : public GpuIndexIVF {
   /// product centroid information
   void reset() override;
 
+  /// Removes the vectors selected by `sel` from the inverted lists, in
+  /// place on the device; returns the number removed
+  size_t remove_ids(const IDSelector& sel) override;
+
   /// Trains the coarse and product quantizer based on the given vector data
   void train(Index::idx_t n, const float* x) override;
 
@@ -123,6 +183,9 @@ class GpuIndexIVFPQ : public GpuIndexIVF {
   /// debugging purposes.
   std::vector<Index::idx_t> getListIndices(int listId) const override;
 
+  /// Adds the inverted lists on the device
+  MemoryUsage memory_usage() const override;
+
  protected:
   /// Called from GpuIndex for add/add_with_ids
   void addImpl_(int n,
@@ -136,12 +199,45 @@ class GpuIndexIVFPQ : public GpuIndexIVF {
                    float* distances,
                    Index::idx_t* labels) const override;
 
+  /// Supports k up to getMaxLargeKSelection()
+  int getMaxSearchK_() const override;
+
+  /// Called from GpuIndexIVF for searchPreassigned
+  void searchPreassignedImpl_(int n,
+                              const float* x,
+                              int k,
+                              int nprobe,
+                              const int* assign,
+                              const float* centroidDis,
+                              float* distances,
+                              Index::idx_t* labels) const override;
+
   /// Throws errors if configuration settings are improper
   void verifySettings_() const;
 
   /// Trains the PQ quantizer based on the given vector data
   void trainResidualQuantizer_(Index::idx_t n, const float* x);
 
+  /// Shared part of the copyFrom variants; creates index_ if the CPU index
+  /// is trained
+  void copyFromPQ_(const faiss::IndexIVF* index,
+                   const faiss::ProductQuantizer& pq);
+
+  /// With useSearchGraphs, replays (capturing it first if needed) the
+  /// search graph for this shape. Returns false if the search must be run
+  /// directly instead
+  bool searchWithGraph_(int n,
+                        const float* x,
+                        int k,
+                        float* distances,
+                        Index::idx_t* labels) const;
+
+  /// Drops all captured search graphs; called whenever anything they
+  /// depend upon changes
+  void clearSearchGraphs_();
+
+  struct SearchGraph;
+
  protected:
   /// Our configuration options that we were initialized with
   const GpuIndexIVFPQConfig ivfpqConfig_;
@@ -149,6 +245,10 @@ class GpuIndexIVFPQ : public GpuIndexIVF {
   /// Runtime override: whether or not we use precomputed tables
   bool usePrecomputedTables_;
 
+  /// Whether the lists are in the fast-scan layout; from the config, or
+  /// from the type of the index we were copied from
+  bool fastScanLayout_;
+
   /// Number of sub-quantizers per encoded vector
   int subQuantizers_;
 
@@ -161,6 +261,10 @@ class GpuIndexIVFPQ : public GpuIndexIVF {
   /// The product quantizer instance that we own; contains the
   /// inverted lists
   std::unique_ptr<IVFPQ> index_;
+
+  /// Captured search graphs, per (number of queries, k, nprobe)
+  mutable std::map<std::tuple<int, int, int>,
+                   std::unique_ptr<SearchGraph>> searchGraphs_;
 };
 
 } } // namespace
@@ -100,8 +100,10 @@ GpuIndexIVFScalarQuantizer::copyFrom(
                            index->metric_arg,
                            by_residual,
                            &sq,
+                           ivfSQConfig_.interleavedLayout,
                            ivfSQConfig_.indicesOptions,
                            config_.memorySpace));
+  index_->setHotListBytes(ivfConfig_.unifiedHotListBytes);
 
   // Copy all of the IVF data
   index_->copyInvertedListsFrom(index->invlists);
@@ -155,6 +157,21 @@ GpuIndexIVFScalarQuantizer::reset() {
   }
 }
 
+size_t
+GpuIndexIVFScalarQuantizer::remove_ids(const IDSelector& sel) {
+  if (!index_) {
+    FAISS_ASSERT(this->ntotal == 0);
+    return 0;
+  }
+
+  DeviceScope scope(config_.device);
+
+  size_t numRemoved = index_->removeIds(sel);
+  this->ntotal -= numRemoved;
+
+  return numRemoved;
+}
+
 int
 GpuIndexIVFScalarQuantizer::getListLength(int listId) const {
   FAISS_ASSERT(index_);
@@ -179,6 +196,15 @@ GpuIndexIVFScalarQuantizer::getListIndices(int listId) const {
   return index_->getListIndices(listId);
 }
 
+MemoryUsage
+GpuIndexIVFScalarQuantizer::memory_usage() const {
+  MemoryUsage mu = GpuIndexIVF::memory_usage();
+  if (index_) {
+    mu.add("invlists", index_->getMemoryUsage());
+  }
+  return mu;
+}
+
 void
 GpuIndexIVFScalarQuantizer::trainResiduals_(Index::idx_t n, const float* x) {
   // The input is already guaranteed to be on the CPU
@@ -220,8 +246,10 @@ GpuIndexIVFScalarQuantizer::train(Index::idx_t n, const float* x) {
                            this->metric_arg,
                            by_residual,
                            &sq,
+                           ivfSQConfig_.interleavedLayout,
                            ivfSQConfig_.indicesOptions,
                            config_.memorySpace));
+  index_->setHotListBytes(ivfConfig_.unifiedHotListBytes);
 
   if (reserveMemoryVecs_) {
     index_->reserveMemory(reserveMemoryVecs_);
@@ -250,6 +278,34 @@ GpuIndexIVFScalarQuantizer::addImpl_(int n,
   ntotal += n;
 }
 
+void
+GpuIndexIVFScalarQuantizer::searchPreassignedImpl_(int n,
+                                                   const float* x,
+                                                   int k,
+                                                   int nprobe,
+                                                   const int* assign,
+                                                   const float* centroidDis,
+                                                   float* distances,
+                                                   Index::idx_t* labels) const {
+  // Device is already set in GpuIndexIVF::searchPreassigned
+  FAISS_ASSERT(index_);
+  FAISS_ASSERT(n > 0);
+
+  // Data is already resident on the GPU
+  Tensor<float, 2, true> queries(const_cast<float*>(x), {n, (int) this->d});
+  Tensor<int, 2, true> coarseIndices(const_cast<int*>(assign), {n, nprobe});
+  Tensor<float, 2, true> outDistances(distances, {n, k});
+  Tensor<Index::idx_t, 2, true> outLabels(labels, {n, k});
+
+  index_->queryPreassigned(queries, coarseIndices,
+                           k, outDistances, outLabels);
+}
+
+int
+GpuIndexIVFScalarQuantizer::getMaxSearchK_() const {
+  return getMaxLargeKSelection();
+}
+
 void
 GpuIndexIVFScalarQuantizer::searchImpl_(int n,
                                         const float* x,
@@ -268,4 +324,20 @@ GpuIndexIVFScalarQuantizer::searchImpl_(int n,
   index_->query(queries, nprobe, k, outDistances, outLabels);
 }
 
+void
+GpuIndexIVFScalarQuantizer::rangeSearchImpl_(int n,
+                                            const float* x,
+                                            float radius,
+                                            int maxResults,
+                                            RangeSearchResult* result) const {
+  // Device is already set in GpuIndex::range_search
+  FAISS_ASSERT(index_);
+  FAISS_ASSERT(n > 0);
+
+  // Data is already resident on the GPU
+  Tensor<float, 2, true> queries(const_cast<float*>(x), {n, (int) this->d});
+
+  index_->rangeQuery(queries, nprobe, radius, maxResults, result);
+}
+
 } } // namespace
@@ -18,6 +18,15 @@ class IVFFlat;
 class GpuIndexFlat;
 
 struct GpuIndexIVFScalarQuantizerConfig : public GpuIndexIVFConfig {
+  inline GpuIndexIVFScalarQuantizerConfig()
+      : interleavedLayout(false) {
+  }
+
+  /// Store the inverted lists by groups of 32 vectors, dimension-major within
+  /// a group, so that each lane of a warp scans one vector with coalesced
+  /// loads. Mostly useful for small dimensions. The lists are converted from
+  /// and to the CPU layout when copied
+  bool interleavedLayout;
 };
 
 /// Wrapper around the GPU implementation that looks like
@@ -65,6 +74,10 @@ class GpuIndexIVFScalarQuantizer : public GpuIndexIVF {
   /// information
   void reset() override;
 
+  /// Removes the vectors selected by `sel` from the inverted lists, in
+  /// place on the device; returns the number removed
+  size_t remove_ids(const IDSelector& sel) override;
+
   /// Trains the coarse and scalar quantizer based on the given vector data
   void train(Index::idx_t n, const float* x) override;
 
@@ -80,6 +93,9 @@ class GpuIndexIVFScalarQuantizer : public GpuIndexIVF {
   /// debugging purposes.
   std::vector<Index::idx_t> getListIndices(int listId) const override;
 
+  /// Adds the inverted lists on the device
+  MemoryUsage memory_usage() const override;
+
  protected:
   /// Called from GpuIndex for add/add_with_ids
   void addImpl_(int n,
@@ -93,6 +109,26 @@ class GpuIndexIVFScalarQuantizer : public GpuIndexIVF {
                    float* distances,
                    Index::idx_t* labels) const override;
 
+  /// Called from GpuIndex for range_search
+  void rangeSearchImpl_(int n,
+                        const float* x,
+                        float radius,
+                        int maxResults,
+                        RangeSearchResult* result) const override;
+
+  /// Supports k up to getMaxLargeKSelection()
+  int getMaxSearchK_() const override;
+
+  /// Called from GpuIndexIVF for searchPreassigned
+  void searchPreassignedImpl_(int n,
+                              const float* x,
+                              int k,
+                              int nprobe,
+                              const int* assign,
+                              const float* centroidDis,
+                              float* distances,
+                              Index::idx_t* labels) const override;
+
   /// Called from train to handle SQ residual training
   void trainResiduals_(Index::idx_t n, const float* x);
 
@@ -0,0 +1,288 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#include <faiss/gpu/GpuIndexPreTransform.h>
+#include <faiss/IndexPreTransform.h>
+#include <faiss/VectorTransform.h>
+#include <faiss/clone_index.h>
+#include <faiss/gpu/GpuResources.h>
+#include <faiss/gpu/impl/BroadcastSum.cuh>
+#include <faiss/gpu/utils/DeviceTensor.cuh>
+#include <faiss/gpu/utils/DeviceUtils.h>
+#include <faiss/gpu/utils/MatrixMult.cuh>
+#include <faiss/impl/FaissAssert.h>
+
+#include <algorithm>
+#include <memory>
+
+namespace faiss { namespace gpu {
+
+/// A LinearTransform resident on the device
+struct DeviceLinearTransform {
+  DeviceLinearTransform(GpuResources* res,
+                        const faiss::LinearTransform& lt,
+                        cudaStream_t stream)
+      : dIn(lt.d_in),
+        dOut(lt.d_out),
+        haveBias(lt.have_bias),
+        A(res, makeDevAlloc(AllocType::Other, stream), {dOut, dIn}) {
+    FAISS_THROW_IF_NOT_MSG(lt.A.size() == (size_t) dOut * dIn,
+                           "Transformation matrix not initialized");
+    A.copyFrom(Tensor<float, 2, true>(const_cast<float*>(lt.A.data()),
+                                      {dOut, dIn}),
+               stream);
+    if (haveBias) {
+      FAISS_THROW_IF_NOT_MSG(lt.b.size() == (size_t) dOut,
+                             "Bias not initialized");
+      b = DeviceTensor<float, 1, true>(
+        res, makeDevAlloc(AllocType::Other, stream), {dOut});
+      b.copyFrom(Tensor<float, 1, true>(const_cast<float*>(lt.b.data()),
+                                        {dOut}),
+                 stream);
+    }
+  }
+
+  /// xt = x * A^T + b
+  void apply(GpuResources* res,
+             Tensor<float, 2, true>& x,
+             Tensor<float, 2, true>& xt,
+             cudaStream_t stream) {
+    runMatrixMult(xt, false,
+                  x, false,
+                  A, true,
+                  1.0f, 0.0f,
+                  res->getBlasHandleCurrentDevice(),
+                  stream);
+    if (haveBias) {
+      runSumAlongColumns(b, xt, stream);
+    }
+  }
+
+  int dIn;
+  int dOut;
+  bool haveBias;
+
+  /// size dOut x dIn
+  DeviceTensor<float, 2, true> A;
+
+  /// size dOut, empty without bias
+  DeviceTensor<float, 1, true> b;
+};
+
+namespace {
+
+/// The transforms applied by the CPU index, with the fused plan if it
+/// is up to date (see IndexPreTransform::apply_chain_noalloc)
+std::vector<const faiss::VectorTransform*>
+getSteps(const faiss::IndexPreTransform* index) {
+  std::vector<const faiss::VectorTransform*> steps;
+  bool fused = !index->fused_plan.empty() &&
+    index->fused_from == index->chain;
+
+  if (fused) {
+    for (int j : index->fused_plan) {
+      steps.push_back(j >= 0 ? index->chain[j] : &index->fused_lt[-1 - j]);
+    }
+  } else {
+    steps.assign(index->chain.begin(), index->chain.end());
+  }
+  return steps;
+}
+
+/// Applies the steps to the n device-resident vectors of x, alternating
+/// between buf0 and buf1 (of n x max(dOut) elements); returns a view of
+/// the transformed vectors (x itself if there is no step)
+Tensor<float, 2, true>
+applySteps(GpuResources* res,
+           const std::vector<std::unique_ptr<DeviceLinearTransform>>& steps,
+           int n,
+           const float* x,
+           int d,
+           DeviceTensor<float, 2, true>& buf0,
+           DeviceTensor<float, 2, true>& buf1,
+           cudaStream_t stream) {
+  Tensor<float, 2, true> cur(const_cast<float*>(x), {n, d});
+
+  for (int i = 0; i < steps.size(); i++) {
+    auto& step = steps[i];
+    FAISS_ASSERT(step->dIn == cur.getSize(1));
+
+    auto& buf = i % 2 == 0 ? buf0 : buf1;
+    Tensor<float, 2, true> next(buf.data(), {n, step->dOut});
+    step->apply(res, cur, next, stream);
+    cur = next;
+  }
+
+  return cur;
+}
+
+} // namespace
+
+GpuIndexPreTransform::GpuIndexPreTransform(
+  GpuResourcesProvider* provider,
+  const faiss::IndexPreTransform* index,
+  GpuIndex* subIndex,
+  GpuIndexConfig config) :
+    GpuIndex(provider->getResources(),
+             index->d,
+             index->metric_type,
+             index->metric_arg,
+             config),
+    ownIndex(false),
+    index_(subIndex),
+    maxDimOut_(1) {
+  FAISS_THROW_IF_NOT_MSG(isSupported(index),
+                         "GpuIndexPreTransform: the chain must be made of "
+                         "trained LinearTransforms");
+  FAISS_THROW_IF_NOT_FMT(subIndex->getDevice() == config_.device,
+                         "GpuIndexPreTransform: sub-index on device %d "
+                         "instead of %d",
+                         subIndex->getDevice(), config_.device);
+  FAISS_THROW_IF_NOT_FMT(subIndex->d == index->index->d,
+                         "GpuIndexPreTransform: sub-index of dimension %d "
+                         "instead of %d",
+                         (int) subIndex->d, (int) index->index->d);
+
+  faiss::Cloner cloner;
+  for (auto vt : index->chain) {
+    chain_.emplace_back(cloner.clone_VectorTransform(vt));
+  }
+
+  DeviceScope scope(config_.device);
+  auto stream = resources_->getDefaultStream(config_.device);
+
+  for (auto vt : getSteps(index)) {
+    auto lt = dynamic_cast<const faiss::LinearTransform*>(vt);
+    FAISS_ASSERT(lt);
+    steps_.emplace_back(
+      new DeviceLinearTransform(resources_.get(), *lt, stream));
+    maxDimOut_ = std::max(maxDimOut_, lt->d_out);
+  }
+
+  this->ntotal = subIndex->ntotal;
+  this->is_trained = subIndex->is_trained;
+}
+
+GpuIndexPreTransform::~GpuIndexPreTransform() {
+  if (ownIndex) {
+    delete index_;
+  }
+}
+
+bool
+GpuIndexPreTransform::isSupported(const faiss::IndexPreTransform* index) {
+  for (auto vt : index->chain) {
+    if (!vt->is_trained ||
+        !dynamic_cast<const faiss::LinearTransform*>(vt)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void
+GpuIndexPreTransform::copyTo(faiss::IndexPreTransform* index) const {
+  GpuIndex::copyTo(index);
+
+  if (index->own_fields) {
+    for (auto vt : index->chain) {
+      delete vt;
+    }
+  }
+  index->chain.clear();
+
+  faiss::Cloner cloner;
+  for (auto& vt : chain_) {
+    index->chain.push_back(cloner.clone_VectorTransform(vt.get()));
+  }
+}
+
+GpuIndex*
+GpuIndexPreTransform::getIndex() const {
+  return index_;
+}
+
+void
+GpuIndexPreTransform::train(Index::idx_t n, const float* x) {
+  if (!index_->is_trained) {
+    const float* xt = x;
+    std::unique_ptr<const float[]> del;
+
+    for (auto& vt : chain_) {
+      // the previous intermediate result is freed once it is applied
+      xt = vt->apply(n, xt);
+      del.reset(xt);
+    }
+
+    index_->train(n, xt);
+  }
+
+  this->is_trained = index_->is_trained;
+}
+
+void
+GpuIndexPreTransform::reset() {
+  index_->reset();
+  this->ntotal = 0;
+}
+
+bool
+GpuIndexPreTransform::addImplRequiresIDs_() const {
+  // the sub-index assigns the ids if there are none
+  return false;
+}
+
+void
+GpuIndexPreTransform::addImpl_(int n,
+                               const float* x,
+                               const Index::idx_t* ids) {
+  auto stream = resources_->getDefaultStream(config_.device);
+
+  // the temporary memory is a stack, the buffers are freed in reverse order
+  DeviceTensor<float, 2, true> buf0(
+    resources_.get(), makeTempAlloc(AllocType::Other, stream),
+    {n, maxDimOut_});
+  DeviceTensor<float, 2, true> buf1(
+    resources_.get(), makeTempAlloc(AllocType::Other, stream),
+    {n, maxDimOut_});
+
+  auto xt = applySteps(resources_.get(), steps_, n, x, (int) this->d,
+                       buf0, buf1, stream);
+
+  if (ids) {
+    index_->add_with_ids(n, xt.data(), ids);
+  } else {
+    index_->add(n, xt.data());
+  }
+  this->ntotal = index_->ntotal;
+}
+
+void
+GpuIndexPreTransform::searchImpl_(int n,
+                                  const float* x,
+                                  int k,
+                                  float* distances,
+                                  Index::idx_t* labels) const {
+  auto stream = resources_->getDefaultStream(config_.device);
+
+  // the temporary memory is a stack, the buffers are freed in reverse order
+  DeviceTensor<float, 2, true> buf0(
+    resources_.get(), makeTempAlloc(AllocType::Other, stream),
+    {n, maxDimOut_});
+  DeviceTensor<float, 2, true> buf1(
+    resources_.get(), makeTempAlloc(AllocType::Other, stream),
+    {n, maxDimOut_});
+
+  auto xt = applySteps(resources_.get(), steps_, n, x, (int) this->d,
+                       buf0, buf1, stream);
+
+  // all the data is on our device, the sub-index does not copy it
+  index_->search(n, xt.data(), k, distances, labels);
+}
+
+} } // namespace
@@ -0,0 +1,94 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#pragma once
+
+#include <faiss/gpu/GpuIndex.h>
+#include <memory>
+#include <vector>
+
+namespace faiss {
+
+struct IndexPreTransform;
+struct VectorTransform;
+
+}
+
+namespace faiss { namespace gpu {
+
+struct DeviceLinearTransform;
+
+/// GPU equivalent of a faiss::IndexPreTransform whose chain is made of
+/// trained LinearTransforms (PCAMatrix, OPQMatrix, RandomRotationMatrix,
+/// ITQMatrix) in front of a GpuIndex. The matrices and biases are resident
+/// on the device, and the vectors are transformed there with cuBLAS before
+/// they are passed to the sub-index, so that a search does not go through
+/// the CPU between the transform and the sub-index. When the CPU index fused
+/// consecutive transforms (IndexPreTransform::fuse_linear), the fused
+/// matrices are used.
+class GpuIndexPreTransform : public GpuIndex {
+ public:
+  /// Copies the chain of `index` to the device of `subIndex`, which is
+  /// typically a GPU clone of index->index. The sub-index is owned if
+  /// ownIndex is set
+  GpuIndexPreTransform(GpuResourcesProvider* provider,
+                       const faiss::IndexPreTransform* index,
+                       GpuIndex* subIndex,
+                       GpuIndexConfig config = GpuIndexConfig());
+
+  ~GpuIndexPreTransform() override;
+
+  /// Whether the chain of `index` can be applied on the GPU: all its
+  /// transforms are trained LinearTransforms
+  static bool isSupported(const faiss::IndexPreTransform* index);
+
+  /// Copies the chain to the given CPU index; its sub-index is not set
+  void copyTo(faiss::IndexPreTransform* index) const;
+
+  /// Returns the sub-index
+  GpuIndex* getIndex() const;
+
+  /// Trains the sub-index on the transformed vectors (on the CPU, the
+  /// chain is already trained); `x` is on the CPU
+  void train(Index::idx_t n, const float* x) override;
+
+  /// Removes all vectors from the sub-index
+  void reset() override;
+
+  /// Whether the sub-index is deleted with this index
+  bool ownIndex;
+
+ protected:
+  bool addImplRequiresIDs_() const override;
+
+  /// Called from GpuIndex for add/add_with_ids
+  void addImpl_(int n,
+                const float* x,
+                const Index::idx_t* ids) override;
+
+  /// Called from GpuIndex for search
+  void searchImpl_(int n,
+                   const float* x,
+                   int k,
+                   float* distances,
+                   Index::idx_t* labels) const override;
+
+ private:
+  /// Host copy of the chain, for copyTo and train
+  std::vector<std::unique_ptr<faiss::VectorTransform>> chain_;
+
+  /// The steps applied on the device (fused or not)
+  std::vector<std::unique_ptr<DeviceLinearTransform>> steps_;
+
+  GpuIndex* index_;
+
+  /// Largest output dimension of the steps, for the temporary buffers
+  int maxDimOut_;
+};
+
+} } // namespace
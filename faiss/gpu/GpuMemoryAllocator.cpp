@@ -0,0 +1,266 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#include <faiss/gpu/GpuMemoryAllocator.h>
+#include <faiss/gpu/utils/DeviceUtils.h>
+#include <faiss/gpu/utils/StaticUtils.h>
+#include <faiss/impl/FaissAssert.h>
+#include <iterator>
+
+namespace faiss { namespace gpu {
+
+namespace {
+
+// Smallest block handed out by the caching allocator
+constexpr size_t kMinBlockSize = 512;
+
+void* cudaAlloc(const AllocRequest& req) {
+  void* p = nullptr;
+  cudaError_t err;
+
+  if (req.space == MemorySpace::Unified) {
+    err = cudaMallocManaged(&p, req.size);
+  } else {
+    FAISS_ASSERT_FMT(req.space == MemorySpace::Device,
+                     "unknown MemorySpace %d", (int) req.space);
+    err = cudaMalloc(&p, req.size);
+  }
+
+  FAISS_THROW_IF_NOT_FMT(err == cudaSuccess,
+                         "Failed to allocate %zu bytes on device %d "
+                         "(error %d %s)",
+                         req.size, req.device,
+                         (int) err, cudaGetErrorString(err));
+  return p;
+}
+
+void cudaDealloc(void* p) {
+  auto err = cudaFree(p);
+  FAISS_ASSERT_FMT(err == cudaSuccess,
+                   "Failed to cudaFree pointer %p (error %d %s)",
+                   p, (int) err, cudaGetErrorString(err));
+}
+
+}
+
+//
+// GpuMemoryAllocator
+//
+
+GpuMemoryAllocator::~GpuMemoryAllocator() {
+}
+
+void
+GpuMemoryAllocator::releaseCachedMemory(int device) {
+}
+
+std::map<AllocType, GpuMemoryAllocatorStats>
+GpuMemoryAllocator::getStats(int device) const {
+  return std::map<AllocType, GpuMemoryAllocatorStats>();
+}
+
+std::pair<int, size_t>
+GpuMemoryAllocator::getCachedMemory(int device) const {
+  return std::make_pair(0, (size_t) 0);
+}
+
+//
+// CudaMemoryAllocator
+//
+
+CudaMemoryAllocator::~CudaMemoryAllocator() {
+}
+
+void*
+CudaMemoryAllocator::allocMemory(const AllocRequest& req) {
+  return cudaAlloc(req);
+}
+
+void
+CudaMemoryAllocator::deallocMemory(const AllocRequest& req, void* p) {
+  cudaDealloc(p);
+}
+
+//
+// CachingGpuMemoryAllocator
+//
+
+CachingGpuMemoryAllocator::CachingGpuMemoryAllocator(size_t maxCachedBytes)
+    : maxCachedBytes_(maxCachedBytes) {
+}
+
+CachingGpuMemoryAllocator::~CachingGpuMemoryAllocator() {
+  for (auto& entry : caches_) {
+    DeviceScope scope(entry.first);
+    trimCache_(entry.second, 0);
+  }
+}
+
+size_t
+CachingGpuMemoryAllocator::binSize(size_t size) {
+  if (size <= kMinBlockSize) {
+    return kMinBlockSize;
+  }
+
+  // Round up to a quarter of the largest power of 2 <= size
+  size_t pow2 = kMinBlockSize;
+  while (pow2 <= size / 2) {
+    pow2 *= 2;
+  }
+
+  return utils::roundUp(size, pow2 / 4);
+}
+
+void
+CachingGpuMemoryAllocator::setMaxCachedBytes(size_t size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  maxCachedBytes_ = size;
+
+  for (auto& entry : caches_) {
+    DeviceScope scope(entry.first);
+    trimCache_(entry.second, maxCachedBytes_);
+  }
+}
+
+void
+CachingGpuMemoryAllocator::trimCache_(DeviceCache& cache, size_t target) {
+  // Free the largest blocks first
+  while (cache.cachedBytes > target && !cache.freeBlocks.empty()) {
+    auto it = std::prev(cache.freeBlocks.end());
+
+    cudaDealloc(it->second.ptr);
+    cache.cachedBytes -= it->first;
+    cache.numCached--;
+    cache.freeBlocks.erase(it);
+  }
+}
+
+void*
+CachingGpuMemoryAllocator::allocMemory(const AllocRequest& req) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& cache = caches_[req.device];
+  auto& stats = cache.stats[req.type];
+
+  if (req.space != MemorySpace::Device) {
+    stats.numMisses++;
+    stats.bytesMissed += req.size;
+    return cudaAlloc(req);
+  }
+
+  size_t size = binSize(req.size);
+
+  // Reuse a block of the same bin that was freed on the same stream, so that
+  // all work on the previous use is ordered before the new use
+  auto range = cache.freeBlocks.equal_range(size);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (it->second.stream == req.stream) {
+      void* p = it->second.ptr;
+      cache.freeBlocks.erase(it);
+      cache.cachedBytes -= size;
+      cache.numCached--;
+
+      cache.blockSizes[p] = size;
+      stats.numHits++;
+      stats.bytesHit += req.size;
+      stats.bytesRequested += req.size;
+      stats.bytesAllocated += size;
+      return p;
+    }
+  }
+
+  AllocRequest blockReq = req;
+  blockReq.size = size;
+
+  void* p = nullptr;
+  try {
+    p = cudaAlloc(blockReq);
+  } catch (const FaissException&) {
+    // Give the cached memory back to CUDA and retry
+    trimCache_(cache, 0);
+    p = cudaAlloc(blockReq);
+  }
+
+  cache.blockSizes[p] = size;
+  stats.numMisses++;
+  stats.bytesMissed += req.size;
+  stats.bytesRequested += req.size;
+  stats.bytesAllocated += size;
+  return p;
+}
+
+void
+CachingGpuMemoryAllocator::deallocMemory(const AllocRequest& req, void* p) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (req.space != MemorySpace::Device) {
+    cudaDealloc(p);
+    return;
+  }
+
+  auto& cache = caches_[req.device];
+  auto it = cache.blockSizes.find(p);
+  FAISS_ASSERT(it != cache.blockSizes.end());
+
+  size_t size = it->second;
+  cache.blockSizes.erase(it);
+
+  auto& stats = cache.stats[req.type];
+  stats.bytesRequested -= req.size;
+  stats.bytesAllocated -= size;
+
+  if (size > maxCachedBytes_) {
+    cudaDealloc(p);
+    return;
+  }
+
+  trimCache_(cache, maxCachedBytes_ - size);
+
+  FreeBlock block;
+  block.ptr = p;
+  block.stream = req.stream;
+  cache.freeBlocks.insert(std::make_pair(size, block));
+  cache.cachedBytes += size;
+  cache.numCached++;
+}
+
+void
+CachingGpuMemoryAllocator::releaseCachedMemory(int device) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto it = caches_.find(device);
+  if (it != caches_.end()) {
+    DeviceScope scope(device);
+    trimCache_(it->second, 0);
+  }
+}
+
+std::map<AllocType, GpuMemoryAllocatorStats>
+CachingGpuMemoryAllocator::getStats(int device) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto it = caches_.find(device);
+  if (it == caches_.end()) {
+    return std::map<AllocType, GpuMemoryAllocatorStats>();
+  }
+
+  return it->second.stats;
+}
+
+std::pair<int, size_t>
+CachingGpuMemoryAllocator::getCachedMemory(int device) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto it = caches_.find(device);
+  if (it == caches_.end()) {
+    return std::make_pair(0, (size_t) 0);
+  }
+
+  return std::make_pair(it->second.numCached, it->second.cachedBytes);
+}
+
+} } // namespace
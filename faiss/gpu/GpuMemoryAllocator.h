@@ -0,0 +1,149 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#pragma once
+
+#include <faiss/gpu/GpuResources.h>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+namespace faiss { namespace gpu {
+
+/// Allocation statistics of a GpuMemoryAllocator for one allocation type
+struct GpuMemoryAllocatorStats {
+  inline GpuMemoryAllocatorStats()
+      : numHits(0),
+        numMisses(0),
+        bytesHit(0),
+        bytesMissed(0),
+        bytesRequested(0),
+        bytesAllocated(0) {
+  }
+
+  /// Number of allocations served from cached memory
+  size_t numHits;
+
+  /// Number of allocations that required a new allocation from CUDA
+  size_t numMisses;
+
+  /// Total bytes requested by the allocations counted in numHits and
+  /// numMisses
+  size_t bytesHit;
+  size_t bytesMissed;
+
+  /// Bytes currently requested by outstanding allocations
+  size_t bytesRequested;
+
+  /// Bytes of the blocks backing outstanding allocations; the excess over
+  /// bytesRequested is lost to binning (internal fragmentation)
+  size_t bytesAllocated;
+};
+
+/// Interface for the non-temporary (MemorySpace::Device and Unified)
+/// allocations made by StandardGpuResources. Implementations can pool
+/// memory or forward to an external allocator. Calls are made with the
+/// request's device set as the current device.
+class GpuMemoryAllocator {
+ public:
+  virtual ~GpuMemoryAllocator();
+
+  /// Returns an allocation of at least req.size bytes usable on req.stream;
+  /// throws on failure
+  virtual void* allocMemory(const AllocRequest& req) = 0;
+
+  /// Returns an allocation made by allocMemory with the same request
+  virtual void deallocMemory(const AllocRequest& req, void* p) = 0;
+
+  /// Frees cached memory held for the given device, if any
+  virtual void releaseCachedMemory(int device);
+
+  /// Per allocation type statistics for the given device; empty if the
+  /// allocator does not track them
+  virtual std::map<AllocType, GpuMemoryAllocatorStats>
+  getStats(int device) const;
+
+  /// Number of blocks and bytes held in cache for the given device
+  virtual std::pair<int, size_t> getCachedMemory(int device) const;
+};
+
+/// Allocates every request directly with cudaMalloc / cudaMallocManaged
+class CudaMemoryAllocator : public GpuMemoryAllocator {
+ public:
+  ~CudaMemoryAllocator() override;
+
+  void* allocMemory(const AllocRequest& req) override;
+
+  void deallocMemory(const AllocRequest& req, void* p) override;
+};
+
+/// Caching allocator for device memory: freed blocks are kept in free lists
+/// binned by size and reused for later requests of the same bin on the same
+/// stream, avoiding the device-wide synchronization of cudaMalloc / cudaFree.
+/// Sizes are rounded up to one of four bins per power of 2, so at most 25% of
+/// a block is wasted. Unified memory is not cached.
+class CachingGpuMemoryAllocator : public GpuMemoryAllocator {
+ public:
+  /// maxCachedBytes bounds the memory held in free lists, per device
+  explicit CachingGpuMemoryAllocator(
+    size_t maxCachedBytes = std::numeric_limits<size_t>::max());
+
+  ~CachingGpuMemoryAllocator() override;
+
+  /// Bounds the memory held in free lists per device; trims the current
+  /// free lists if needed
+  void setMaxCachedBytes(size_t size);
+
+  void* allocMemory(const AllocRequest& req) override;
+
+  void deallocMemory(const AllocRequest& req, void* p) override;
+
+  void releaseCachedMemory(int device) override;
+
+  std::map<AllocType, GpuMemoryAllocatorStats>
+  getStats(int device) const override;
+
+  std::pair<int, size_t> getCachedMemory(int device) const override;
+
+  /// Size of the block used for a request of `size` bytes
+  static size_t binSize(size_t size);
+
+ private:
+  struct FreeBlock {
+    void* ptr;
+    cudaStream_t stream;
+  };
+
+  struct DeviceCache {
+    DeviceCache() : cachedBytes(0), numCached(0) {}
+
+    /// block size -> blocks available
+    std::multimap<size_t, FreeBlock> freeBlocks;
+
+    /// outstanding blocks -> their size
+    std::unordered_map<void*, size_t> blockSizes;
+
+    std::map<AllocType, GpuMemoryAllocatorStats> stats;
+
+    size_t cachedBytes;
+    int numCached;
+  };
+
+  /// Frees cached blocks of the device until at most `target` bytes remain
+  void trimCache_(DeviceCache& cache, size_t target);
+
+  mutable std::mutex mutex_;
+
+  size_t maxCachedBytes_;
+
+  std::unordered_map<int, DeviceCache> caches_;
+};
+
+} } // namespace
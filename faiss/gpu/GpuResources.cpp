@@ -149,6 +149,11 @@ GpuMemoryReservation::~GpuMemoryReservation() {
 GpuResources::~GpuResources() {
 }
 
+bool
+GpuResources::setTemporaryMemoryOverride(int device, StackDeviceMemory* mem) {
+  return false;
+}
+
 cublasHandle_t
 GpuResources::getBlasHandleCurrentDevice() {
   return getBlasHandle(getCurrentDevice());
@@ -18,6 +18,7 @@
 namespace faiss { namespace gpu {
 
 class GpuResources;
+class StackDeviceMemory;
 
 enum AllocType {
   /// Unknown allocation type or miscellaneous (not currently categorized)
@@ -225,6 +226,13 @@ class GpuResources {
   /// Returns the stream on which we perform async CPU <-> GPU copies
   virtual cudaStream_t getAsyncCopyStream(int device) = 0;
 
+  /// Until called again with nullptr, serves the MemorySpace::Temporary
+  /// requests for the given device out of `mem` rather than the usual
+  /// temporary memory. This gives work captured into a CUDA graph temporary
+  /// buffers that stay reserved for its replays. Returns false if the
+  /// implementation does not support this (the default)
+  virtual bool setTemporaryMemoryOverride(int device, StackDeviceMemory* mem);
+
   ///
   /// Functions provided by default
   ///
@@ -0,0 +1,365 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#include <faiss/gpu/GpuTenantPool.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVF.h>
+#include <faiss/gpu/GpuCloner.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/FaissException.h>
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <map>
+#include <utility>
+
+namespace faiss { namespace gpu {
+
+GpuTenantPool::GpuTenantPool(int device,
+                             size_t residentBytes,
+                             int numWorkers,
+                             size_t tempMemPerWorker,
+                             const GpuClonerOptions& options)
+    : device_(device),
+      residentBytesBudget_(residentBytes),
+      options_(options),
+      residentBytes_(0),
+      clock_(0),
+      numLoads_(0),
+      numEvictions_(0) {
+  FAISS_THROW_IF_NOT_FMT(numWorkers > 0,
+                         "invalid number of workers %d", numWorkers);
+
+  // Each worker has its own streams and temporary memory; the shared
+  // temporary memory and pinned buffer are not used in this mode
+  res_.noTempMemory();
+  res_.setPinnedMemory(0);
+  res_.setPerThreadContexts(true, tempMemPerWorker);
+
+  for (int i = 0; i < numWorkers; ++i) {
+    workers_.emplace_back(std::unique_ptr<WorkerThread>(new WorkerThread));
+  }
+}
+
+GpuTenantPool::~GpuTenantPool() {
+  // Flush the workers before the GPU copies are destroyed
+  workers_.clear();
+}
+
+size_t
+GpuTenantPool::estimateGpuBytes(const faiss::Index* index) {
+  if (auto ivf = dynamic_cast<const faiss::IndexIVF*>(index)) {
+    size_t bytes = estimateGpuBytes(ivf->quantizer);
+
+    for (size_t l = 0; l < ivf->nlist; ++l) {
+      bytes += ivf->invlists->list_size(l) *
+        (ivf->code_size + sizeof(Index::idx_t));
+    }
+
+    return bytes;
+  }
+
+  // Flat storage of the vectors, and an approximation for the others
+  return (size_t) index->ntotal * index->d * sizeof(float);
+}
+
+void
+GpuTenantPool::addTenant(Index::idx_t tenant, const faiss::Index* index) {
+  FAISS_THROW_IF_NOT(index);
+  size_t bytes = estimateGpuBytes(index);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  FAISS_THROW_IF_NOT_FMT(tenants_.count(tenant) == 0,
+                         "tenant %ld already exists", tenant);
+
+  Tenant& t = tenants_[tenant];
+  t.cpuIndex = index;
+  t.bytes = bytes;
+  t.numUsers = 0;
+  t.loading = false;
+  t.lastUse = 0;
+}
+
+void
+GpuTenantPool::removeTenant(Index::idx_t tenant) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto it = tenants_.find(tenant);
+  FAISS_THROW_IF_NOT_FMT(it != tenants_.end(), "unknown tenant %ld", tenant);
+  FAISS_THROW_IF_NOT_FMT(it->second.numUsers == 0,
+                         "tenant %ld is in use", tenant);
+
+  if (it->second.gpuIndex) {
+    residentBytes_ -= it->second.bytes;
+  }
+
+  tenants_.erase(it);
+}
+
+void
+GpuTenantPool::evict(Index::idx_t tenant) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto it = tenants_.find(tenant);
+  FAISS_THROW_IF_NOT_FMT(it != tenants_.end(), "unknown tenant %ld", tenant);
+  FAISS_THROW_IF_NOT_FMT(it->second.numUsers == 0,
+                         "tenant %ld is in use", tenant);
+
+  if (it->second.gpuIndex) {
+    it->second.gpuIndex.reset();
+    residentBytes_ -= it->second.bytes;
+    ++numEvictions_;
+  }
+}
+
+bool
+GpuTenantPool::isResident(Index::idx_t tenant) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto it = tenants_.find(tenant);
+  return it != tenants_.end() && it->second.gpuIndex;
+}
+
+size_t
+GpuTenantPool::getResidentBytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return residentBytes_;
+}
+
+size_t
+GpuTenantPool::getNumLoads() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return numLoads_;
+}
+
+size_t
+GpuTenantPool::getNumEvictions() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return numEvictions_;
+}
+
+void
+GpuTenantPool::makeRoom_(size_t bytes) {
+  while (residentBytes_ + bytes > residentBytesBudget_) {
+    Tenant* lru = nullptr;
+
+    for (auto& entry : tenants_) {
+      auto& t = entry.second;
+
+      if (t.gpuIndex && t.numUsers == 0 &&
+          (!lru || t.lastUse < lru->lastUse)) {
+        lru = &t;
+      }
+    }
+
+    if (!lru) {
+      // Everything resident is in use
+      return;
+    }
+
+    lru->gpuIndex.reset();
+    residentBytes_ -= lru->bytes;
+    ++numEvictions_;
+  }
+}
+
+faiss::Index*
+GpuTenantPool::acquire_(Index::idx_t tenant) {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  auto it = tenants_.find(tenant);
+  FAISS_THROW_IF_NOT_FMT(it != tenants_.end(), "unknown tenant %ld", tenant);
+
+  // References to the elements of an unordered_map are stable, and the
+  // tenant cannot be removed while it is in use
+  Tenant& t = it->second;
+  ++t.numUsers;
+
+  while (!t.gpuIndex) {
+    if (t.loading) {
+      loaded_.wait(lock);
+      continue;
+    }
+
+    // We upload it. The space is accounted for right away, so that
+    // concurrent uploads of other tenants do not overshoot the budget
+    t.loading = true;
+    makeRoom_(t.bytes);
+    residentBytes_ += t.bytes;
+
+    lock.unlock();
+
+    std::unique_ptr<faiss::Index> gpuIndex;
+    std::exception_ptr error;
+
+    try {
+      gpuIndex.reset(
+        index_cpu_to_gpu(&res_, device_, t.cpuIndex, &options_));
+
+      // The upload ran on the streams of this worker; the other workers
+      // may search the copy right away
+      res_.getResources()->syncDefaultStream(device_);
+    } catch (...) {
+      error = std::current_exception();
+    }
+
+    lock.lock();
+    t.loading = false;
+    loaded_.notify_all();
+
+    if (error) {
+      residentBytes_ -= t.bytes;
+      --t.numUsers;
+      std::rethrow_exception(error);
+    }
+
+    t.gpuIndex = std::move(gpuIndex);
+    ++numLoads_;
+  }
+
+  t.lastUse = ++clock_;
+  return t.gpuIndex.get();
+}
+
+void
+GpuTenantPool::release_(Index::idx_t tenant) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto it = tenants_.find(tenant);
+  FAISS_ASSERT(it != tenants_.end());
+  FAISS_ASSERT(it->second.numUsers > 0);
+  --it->second.numUsers;
+}
+
+void
+GpuTenantPool::runSearch_(const TenantSearch& s) {
+  auto index = acquire_(s.tenant);
+
+  try {
+    index->search(s.n, s.x, s.k, s.distances, s.labels);
+  } catch (...) {
+    release_(s.tenant);
+    throw;
+  }
+
+  release_(s.tenant);
+}
+
+void
+GpuTenantPool::search(Index::idx_t tenant,
+                      Index::idx_t n,
+                      const float* x,
+                      Index::idx_t k,
+                      float* distances,
+                      Index::idx_t* labels) {
+  TenantSearch s;
+  s.tenant = tenant;
+  s.n = n;
+  s.x = x;
+  s.k = k;
+  s.distances = distances;
+  s.labels = labels;
+
+  // Runs on a worker, so that the number of thread contexts (and
+  // temporary memory stacks) stays bounded
+  searchBatch(std::vector<TenantSearch>(1, s));
+}
+
+void
+GpuTenantPool::searchBatch(const std::vector<TenantSearch>& searches) {
+  // Group the searches by tenant and k; a group of several searches is run
+  // as one search over the concatenated queries, then split back
+  std::map<std::pair<Index::idx_t, Index::idx_t>, std::vector<int>> groups;
+  for (int i = 0; i < searches.size(); ++i) {
+    if (searches[i].n > 0) {
+      groups[std::make_pair(searches[i].tenant, searches[i].k)].push_back(i);
+    }
+  }
+
+  std::vector<std::vector<int>> work;
+  for (auto& g : groups) {
+    work.emplace_back(std::move(g.second));
+  }
+
+  auto runGroup = [this, &searches](const std::vector<int>& group) {
+    if (group.size() == 1) {
+      runSearch_(searches[group[0]]);
+      return;
+    }
+
+    const auto& first = searches[group[0]];
+    Index::idx_t k = first.k;
+
+    size_t d = 0;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = tenants_.find(first.tenant);
+      FAISS_THROW_IF_NOT_FMT(it != tenants_.end(),
+                             "unknown tenant %ld", first.tenant);
+      d = it->second.cpuIndex->d;
+    }
+
+    Index::idx_t n = 0;
+    for (int i : group) {
+      n += searches[i].n;
+    }
+
+    std::vector<float> x(n * d);
+    std::vector<float> distances(n * k);
+    std::vector<Index::idx_t> labels(n * k);
+
+    Index::idx_t offset = 0;
+    for (int i : group) {
+      std::memcpy(x.data() + offset * d, searches[i].x,
+                  searches[i].n * d * sizeof(float));
+      offset += searches[i].n;
+    }
+
+    TenantSearch merged = first;
+    merged.n = n;
+    merged.x = x.data();
+    merged.distances = distances.data();
+    merged.labels = labels.data();
+    runSearch_(merged);
+
+    offset = 0;
+    for (int i : group) {
+      const auto& s = searches[i];
+      std::memcpy(s.distances, distances.data() + offset * k,
+                  s.n * k * sizeof(float));
+      std::memcpy(s.labels, labels.data() + offset * k,
+                  s.n * k * sizeof(Index::idx_t));
+      offset += s.n;
+    }
+  };
+
+  // The workers take the groups in turn
+  std::atomic<size_t> next(0);
+  std::vector<std::future<bool>> futures;
+
+  for (auto& worker : workers_) {
+    futures.emplace_back(worker->add([&]() {
+      for (size_t i = next++; i < work.size(); i = next++) {
+        runGroup(work[i]);
+      }
+    }));
+  }
+
+  std::vector<std::pair<int, std::exception_ptr>> exceptions;
+  for (int i = 0; i < futures.size(); ++i) {
+    try {
+      futures[i].get();
+    } catch (...) {
+      exceptions.emplace_back(std::make_pair(i, std::current_exception()));
+    }
+  }
+
+  handleExceptions(exceptions);
+}
+
+} } // namespace
@@ -0,0 +1,159 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#pragma once
+
+#include <faiss/Index.h>
+#include <faiss/gpu/GpuClonerOptions.h>
+#include <faiss/gpu/StandardGpuResources.h>
+#include <faiss/utils/WorkerThread.h>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace faiss { namespace gpu {
+
+/// One search in GpuTenantPool::searchBatch
+struct TenantSearch {
+  /// Tenant whose index is searched
+  Index::idx_t tenant;
+
+  /// Queries (n x d, on the host)
+  Index::idx_t n;
+  const float* x;
+
+  /// Results (n x k, on the host)
+  Index::idx_t k;
+  float* distances;
+  Index::idx_t* labels;
+};
+
+/// Hosts many small indexes ("tenants") on one GPU.
+///
+/// All tenants share a single StandardGpuResources with per-thread contexts
+/// (see StandardGpuResources::setPerThreadContexts). Searches run on a fixed
+/// set of worker threads, each with its own streams and temporary memory,
+/// so that the searches of different tenants overlap on the device and the
+/// temporary memory is bounded by numWorkers * tempMemPerWorker, whatever
+/// the number of tenants.
+///
+/// The tenants are given as CPU indexes, that remain the reference copy.
+/// A tenant is cloned to the GPU when it is first searched; when the
+/// estimated size of the resident tenants exceeds the budget, the least
+/// recently searched tenants that are not in use are evicted from the
+/// GPU. The budget is soft: a tenant is still loaded if all the others are
+/// in use.
+class GpuTenantPool {
+ public:
+  GpuTenantPool(int device,
+                /// Budget for the GPU copies of the tenants, in bytes
+                size_t residentBytes,
+                int numWorkers = 4,
+                size_t tempMemPerWorker = (size_t) 64 * 1024 * 1024,
+                const GpuClonerOptions& options = GpuClonerOptions());
+
+  ~GpuTenantPool();
+
+  /// Registers a tenant. We do not own the index, that must outlive the
+  /// tenant and must not be modified while it is resident (evict it first)
+  void addTenant(Index::idx_t tenant, const faiss::Index* index);
+
+  /// Unregisters a tenant, that must not be in use
+  void removeTenant(Index::idx_t tenant);
+
+  /// Searches one tenant
+  void search(Index::idx_t tenant,
+              Index::idx_t n,
+              const float* x,
+              Index::idx_t k,
+              float* distances,
+              Index::idx_t* labels);
+
+  /// Runs a set of searches over any tenants, concurrently on the workers.
+  /// The searches of the same tenant with the same k are merged into a
+  /// single search of all their queries
+  void searchBatch(const std::vector<TenantSearch>& searches);
+
+  /// Drops the GPU copy of a tenant, that must not be in use
+  void evict(Index::idx_t tenant);
+
+  /// Whether a tenant is currently on the GPU
+  bool isResident(Index::idx_t tenant) const;
+
+  /// Estimated size of the tenants currently on the GPU
+  size_t getResidentBytes() const;
+
+  /// Number of uploads / evictions of tenants since construction
+  size_t getNumLoads() const;
+  size_t getNumEvictions() const;
+
+  /// Estimated GPU memory used by a clone of this index
+  static size_t estimateGpuBytes(const faiss::Index* index);
+
+ private:
+  struct Tenant {
+    /// Reference copy
+    const faiss::Index* cpuIndex;
+
+    /// GPU copy, if resident
+    std::unique_ptr<faiss::Index> gpuIndex;
+
+    /// Estimated size of the GPU copy
+    size_t bytes;
+
+    /// Number of searches in flight
+    int numUsers;
+
+    /// Whether a thread is uploading the GPU copy
+    bool loading;
+
+    /// Logical time of the last search, for LRU eviction
+    size_t lastUse;
+  };
+
+  /// Returns the GPU copy of a tenant, uploading it if needed. The tenant
+  /// cannot be evicted until release_ is called
+  faiss::Index* acquire_(Index::idx_t tenant);
+
+  void release_(Index::idx_t tenant);
+
+  /// Evicts the least recently used idle tenants until `bytes` more fit in
+  /// the budget, or no more tenant can be evicted. Called with mutex_ held
+  void makeRoom_(size_t bytes);
+
+  /// Runs one search on the calling (worker) thread
+  void runSearch_(const TenantSearch& s);
+
+ private:
+  const int device_;
+  const size_t residentBytesBudget_;
+  const GpuClonerOptions options_;
+
+  /// Shared by all the tenants
+  StandardGpuResources res_;
+
+  /// Workers on which the searches run
+  std::vector<std::unique_ptr<WorkerThread>> workers_;
+
+  /// Protects all the state below
+  mutable std::mutex mutex_;
+
+  /// Signaled when a tenant upload finishes
+  std::condition_variable loaded_;
+
+  std::unordered_map<Index::idx_t, Tenant> tenants_;
+
+  size_t residentBytes_;
+  size_t clock_;
+  size_t numLoads_;
+  size_t numEvictions_;
+};
+
+} } // namespace
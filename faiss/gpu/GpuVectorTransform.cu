@@ -0,0 +1,200 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#include <faiss/gpu/GpuVectorTransform.h>
+#include <faiss/gpu/GpuIndexFlat.h>
+#include <faiss/gpu/GpuResources.h>
+#include <faiss/gpu/utils/DeviceTensor.cuh>
+#include <faiss/gpu/utils/DeviceUtils.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/ProductQuantizer.h>
+#include <algorithm>
+#include <climits>
+
+namespace faiss { namespace gpu {
+
+namespace {
+
+bool isTrans(const char* trans) {
+  return trans[0] == 'T' || trans[0] == 't';
+}
+
+/// Number of elements of a column-major matrix of `cols` columns
+size_t matrixSize(int ld, int cols) {
+  size_t size = (size_t) ld * cols;
+  FAISS_THROW_IF_NOT_FMT(size <= INT_MAX,
+                         "matrix of %zd elements too large for the GPU gemm",
+                         size);
+  return size;
+}
+
+cublasStatus_t
+rawGemm(cublasHandle_t handle,
+        cublasOperation_t transa, cublasOperation_t transb,
+        int m, int n, int k,
+        const float* alpha, const float* a, int lda,
+        const float* b, int ldb,
+        const float* beta, float* c, int ldc) {
+  return cublasSgemm(handle, transa, transb, m, n, k,
+                     alpha, a, lda, b, ldb, beta, c, ldc);
+}
+
+cublasStatus_t
+rawGemm(cublasHandle_t handle,
+        cublasOperation_t transa, cublasOperation_t transb,
+        int m, int n, int k,
+        const double* alpha, const double* a, int lda,
+        const double* b, int ldb,
+        const double* beta, double* c, int ldc) {
+  return cublasDgemm(handle, transa, transb, m, n, k,
+                     alpha, a, lda, b, ldb, beta, c, ldc);
+}
+
+template <typename T>
+void
+gpuGemm(GpuResources* res, int device,
+        const char* transa, const char* transb,
+        int m, int n, int k,
+        T alpha, const T* a, int lda,
+        const T* b, int ldb,
+        T beta, T* c, int ldc) {
+  if (m == 0 || n == 0) {
+    return;
+  }
+
+  DeviceScope scope(device);
+  auto stream = res->getDefaultStreamCurrentDevice();
+  auto handle = res->getBlasHandleCurrentDevice();
+
+  bool ta = isTrans(transa);
+  bool tb = isTrans(transb);
+
+  int sizeA = matrixSize(lda, ta ? m : k);
+  int sizeB = matrixSize(ldb, tb ? k : n);
+  int sizeC = matrixSize(ldc, n);
+
+  // a and b may alias (a * a^T), but are not large enough to bother
+  DeviceTensor<T, 1, true> devA(
+    res, makeTempAlloc(AllocType::Other, stream), {std::max(sizeA, 1)});
+  DeviceTensor<T, 1, true> devB(
+    res, makeTempAlloc(AllocType::Other, stream), {std::max(sizeB, 1)});
+  DeviceTensor<T, 1, true> devC(
+    res, makeTempAlloc(AllocType::Other, stream), {sizeC});
+
+  if (sizeA > 0) {
+    devA.copyFrom(Tensor<T, 1, true>(const_cast<T*>(a), {sizeA}), stream);
+  }
+  if (sizeB > 0) {
+    devB.copyFrom(Tensor<T, 1, true>(const_cast<T*>(b), {sizeB}), stream);
+  }
+
+  if (beta != 0) {
+    devC.copyFrom(Tensor<T, 1, true>(c, {sizeC}), stream);
+  } else {
+    devC.zero(stream);
+  }
+
+  cublasSetStream(handle, stream);
+
+  auto err = rawGemm(handle,
+                     ta ? CUBLAS_OP_T : CUBLAS_OP_N,
+                     tb ? CUBLAS_OP_T : CUBLAS_OP_N,
+                     m, n, k,
+                     &alpha, devA.data(), lda,
+                     devB.data(), ldb,
+                     &beta, devC.data(), ldc);
+  FAISS_ASSERT_FMT(err == CUBLAS_STATUS_SUCCESS,
+                   "cublas failed (%d): (%d, %d) x (%d, %d)",
+                   (int) err, m, k, k, n);
+
+  devC.copyTo(Tensor<T, 1, true>(c, {sizeC}), stream);
+  CUDA_VERIFY(cudaStreamSynchronize(stream));
+}
+
+} // namespace
+
+GpuTrainingGemm::GpuTrainingGemm(GpuResourcesProvider* provider, int device)
+    : res_(provider->getResources()),
+      device_(device) {
+  res_->initializeForDevice(device_);
+}
+
+void
+GpuTrainingGemm::sgemm(const char* transa, const char* transb,
+                       int m, int n, int k,
+                       float alpha, const float* a, int lda,
+                       const float* b, int ldb,
+                       float beta, float* c, int ldc) const {
+  gpuGemm<float>(res_.get(), device_, transa, transb, m, n, k,
+                 alpha, a, lda, b, ldb, beta, c, ldc);
+}
+
+void
+GpuTrainingGemm::dgemm(const char* transa, const char* transb,
+                       int m, int n, int k,
+                       double alpha, const double* a, int lda,
+                       const double* b, int ldb,
+                       double beta, double* c, int ldc) const {
+  gpuGemm<double>(res_.get(), device_, transa, transb, m, n, k,
+                  alpha, a, lda, b, ldb, beta, c, ldc);
+}
+
+void
+trainVectorTransform(GpuResourcesProvider* provider,
+                     int device,
+                     faiss::VectorTransform* vt,
+                     Index::idx_t n,
+                     const float* x) {
+  faiss::LinearTransform* lt = dynamic_cast<faiss::LinearTransform*>(vt);
+  if (auto itqt = dynamic_cast<faiss::ITQTransform*>(vt)) {
+    lt = &itqt->itq;
+  }
+
+  if (!lt) {
+    vt->train(n, x);
+    return;
+  }
+
+  GpuTrainingGemm gemm(provider, device);
+
+  // For OPQ, a PQ whose subquantizers are trained and searched on the GPU
+  auto opq = dynamic_cast<faiss::OPQMatrix*>(vt);
+  std::unique_ptr<faiss::ProductQuantizer> pq;
+  std::unique_ptr<GpuIndexFlatL2> assignIndex;
+
+  if (opq && !opq->pq) {
+    GpuIndexFlatConfig config;
+    config.device = device;
+
+    pq.reset(new faiss::ProductQuantizer(opq->d_out, opq->M, 8));
+    assignIndex.reset(new GpuIndexFlatL2(provider, pq->dsub, config));
+    pq->assign_index = assignIndex.get();
+    opq->pq = pq.get();
+  }
+
+  const faiss::TrainingGemm* prevGemm = lt->train_gemm;
+  lt->train_gemm = &gemm;
+
+  auto restore = [&]() {
+    lt->train_gemm = prevGemm;
+    if (pq) {
+      opq->pq = nullptr;
+    }
+  };
+
+  try {
+    vt->train(n, x);
+  } catch (...) {
+    restore();
+    throw;
+  }
+
+  restore();
+}
+
+} } // namespace
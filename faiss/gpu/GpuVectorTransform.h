@@ -0,0 +1,56 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#pragma once
+
+#include <faiss/VectorTransform.h>
+#include <memory>
+
+namespace faiss { namespace gpu {
+
+class GpuResources;
+class GpuResourcesProvider;
+
+/// Runs the matrix products of LinearTransform::train with cuBLAS on one
+/// device. The operands are copied to temporary device memory for each
+/// product and the result is copied back, so this pays off for the
+/// products over the training set (n x d by d x d', with n large), which
+/// are the only ones routed here.
+class GpuTrainingGemm : public faiss::TrainingGemm {
+ public:
+  GpuTrainingGemm(GpuResourcesProvider* provider, int device);
+
+  void sgemm(const char* transa, const char* transb,
+             int m, int n, int k,
+             float alpha, const float* a, int lda,
+             const float* b, int ldb,
+             float beta, float* c, int ldc) const override;
+
+  void dgemm(const char* transa, const char* transb,
+             int m, int n, int k,
+             double alpha, const double* a, int lda,
+             const double* b, int ldb,
+             double beta, double* c, int ldc) const override;
+
+ private:
+  std::shared_ptr<GpuResources> res_;
+  int device_;
+};
+
+/// Trains a PCAMatrix, ITQMatrix, ITQTransform or OPQMatrix with the large
+/// matrix products on the given GPU. For OPQMatrix without a user-provided
+/// pq, the k-means and the encoding of the inner product quantizer also run
+/// on the GPU. The SVDs and eigendecompositions (d x d) stay on the CPU.
+/// Other transforms are trained on the CPU.
+void trainVectorTransform(GpuResourcesProvider* provider,
+                          int device,
+                          faiss::VectorTransform* vt,
+                          Index::idx_t n,
+                          const float* x);
+
+} } // namespace
@@ -59,6 +59,35 @@ std::string allocsToString(const std::unordered_map<void*, AllocRequest>& map) {
   return ss.str();
 }
 
+cublasHandle_t createBlasHandle(bool tensorCoreMath) {
+  cublasHandle_t blasHandle = 0;
+  auto blasStatus = cublasCreate(&blasHandle);
+  FAISS_ASSERT(blasStatus == CUBLAS_STATUS_SUCCESS);
+
+  // For CUDA 10 on V100, enabling tensor core usage would enable automatic
+  // rounding down of inputs to f16 (though accumulate in f32) which results in
+  // unacceptable loss of precision in general.
+  // For CUDA 11 / A100, only enable tensor core support if it doesn't result in
+  // a loss of precision, unless the user asked for tensor core math (TF32
+  // inputs for the f32 GEMMs).
+  // The f16 GEMMs use tensor cores in all cases (see rawGemm).
+#if CUDA_VERSION >= 11000
+  int mathMode = CUBLAS_MATH_DISALLOW_REDUCED_PRECISION_REDUCTION;
+  if (tensorCoreMath) {
+    mathMode |= CUBLAS_TF32_TENSOR_OP_MATH;
+  }
+  blasStatus = cublasSetMathMode(blasHandle, (cublasMath_t) mathMode);
+  FAISS_ASSERT(blasStatus == CUBLAS_STATUS_SUCCESS);
+#else
+  if (tensorCoreMath) {
+    blasStatus = cublasSetMathMode(blasHandle, CUBLAS_TENSOR_OP_MATH);
+    FAISS_ASSERT(blasStatus == CUBLAS_STATUS_SUCCESS);
+  }
+#endif
+
+  return blasHandle;
+}
+
 }
 
 //
@@ -66,6 +95,9 @@ std::string allocsToString(const std::unordered_map<void*, AllocRequest>& map) {
 //
 
 StandardGpuResourcesImpl::StandardGpuResourcesImpl() :
+    perThreadContexts_(false),
+    tempMemPerThread_(0),
+    tensorCoreMath_(false),
     pinnedMemAlloc_(nullptr),
     pinnedMemAllocSize_(0),
     // let the adjustment function determine the memory size for us by passing
@@ -73,7 +105,8 @@ StandardGpuResourcesImpl::StandardGpuResourcesImpl() :
     tempMemSize_(getDefaultTempMemForGPU(-1,
                                          std::numeric_limits<size_t>::max())),
     pinnedMemSize_(kDefaultPinnedMemoryAllocation),
-    allocLogging_(false) {
+    allocLogging_(false),
+    allocator_(new CudaMemoryAllocator) {
 }
 
 StandardGpuResourcesImpl::~StandardGpuResourcesImpl() {
@@ -81,6 +114,10 @@ StandardGpuResourcesImpl::~StandardGpuResourcesImpl() {
   // that up before we finish fully de-initializing ourselves
   tempMemory_.clear();
 
+  for (auto& entry : threadContexts_) {
+    entry.second->tempMemory.reset();
+  }
+
   // Make sure all allocations have been freed
   bool allocError = false;
 
@@ -126,6 +163,20 @@ StandardGpuResourcesImpl::~StandardGpuResourcesImpl() {
     FAISS_ASSERT(blasStatus == CUBLAS_STATUS_SUCCESS);
   }
 
+  for (auto& entry : threadContexts_) {
+    DeviceScope scope(entry.first.second);
+    auto& ctx = *entry.second;
+
+    CUDA_VERIFY(cudaStreamDestroy(ctx.defaultStream));
+    for (auto stream : ctx.alternateStreams) {
+      CUDA_VERIFY(cudaStreamDestroy(stream));
+    }
+    CUDA_VERIFY(cudaStreamDestroy(ctx.asyncCopyStream));
+
+    auto blasStatus = cublasDestroy(ctx.blasHandle);
+    FAISS_ASSERT(blasStatus == CUBLAS_STATUS_SUCCESS);
+  }
+
   if (pinnedMemAlloc_) {
     auto err = cudaFreeHost(pinnedMemAlloc_);
     FAISS_ASSERT_FMT(err == cudaSuccess,
@@ -171,6 +222,8 @@ StandardGpuResourcesImpl::noTempMemory() {
 
 void
 StandardGpuResourcesImpl::setTempMemory(size_t size) {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
+
   if (tempMemSize_ != size) {
     // adjust based on general limits
     tempMemSize_ = getDefaultTempMemForGPU(-1, size);
@@ -206,11 +259,13 @@ StandardGpuResourcesImpl::setPinnedMemory(size_t size) {
 
 void
 StandardGpuResourcesImpl::setDefaultStream(int device, cudaStream_t stream) {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
   userDefaultStreams_[device] = stream;
 }
 
 void
 StandardGpuResourcesImpl::revertDefaultStream(int device) {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
   userDefaultStreams_.erase(device);
 }
 
@@ -226,6 +281,93 @@ StandardGpuResourcesImpl::setLogMemoryAllocations(bool enable) {
   allocLogging_ = enable;
 }
 
+void
+StandardGpuResourcesImpl::setMemoryAllocator(
+  std::shared_ptr<GpuMemoryAllocator> allocator) {
+  FAISS_THROW_IF_NOT_MSG(allocator, "null allocator");
+  // Allocations are returned to the allocator that made them
+  FAISS_THROW_IF_NOT_MSG(defaultStreams_.empty(),
+                         "setMemoryAllocator must be called before the "
+                         "resources are used on any device");
+  allocator_ = allocator;
+}
+
+std::shared_ptr<GpuMemoryAllocator>
+StandardGpuResourcesImpl::getMemoryAllocator() {
+  return allocator_;
+}
+
+void
+StandardGpuResourcesImpl::setPerThreadContexts(bool enable,
+                                               size_t tempMemPerThread) {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
+  FAISS_THROW_IF_NOT_MSG(defaultStreams_.empty(),
+                         "setPerThreadContexts must be called before the "
+                         "resources are used on any device");
+  perThreadContexts_ = enable;
+  tempMemPerThread_ = tempMemPerThread;
+}
+
+void
+StandardGpuResourcesImpl::setTensorCoreMath(bool enable) {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
+  FAISS_THROW_IF_NOT_MSG(defaultStreams_.empty(),
+                         "setTensorCoreMath must be called before the "
+                         "resources are used on any device");
+  tensorCoreMath_ = enable;
+}
+
+StandardGpuResourcesImpl::ThreadContext*
+StandardGpuResourcesImpl::getThreadContext_(int device) {
+  if (!perThreadContexts_) {
+    return nullptr;
+  }
+
+  auto key = std::make_pair(std::this_thread::get_id(), device);
+  auto it = threadContexts_.find(key);
+  if (it != threadContexts_.end()) {
+    return it->second.get();
+  }
+
+  initializeForDevice(device);
+  DeviceScope scope(device);
+
+  std::unique_ptr<ThreadContext> ctx(new ThreadContext);
+
+  CUDA_VERIFY(cudaStreamCreateWithFlags(&ctx->defaultStream,
+                                        cudaStreamNonBlocking));
+  CUDA_VERIFY(cudaStreamCreateWithFlags(&ctx->asyncCopyStream,
+                                        cudaStreamNonBlocking));
+  for (int j = 0; j < kNumStreams; ++j) {
+    cudaStream_t stream = 0;
+    CUDA_VERIFY(cudaStreamCreateWithFlags(&stream,
+                                          cudaStreamNonBlocking));
+    ctx->alternateStreams.push_back(stream);
+  }
+
+  ctx->blasHandle = createBlasHandle(tensorCoreMath_);
+
+  ctx->tempMemory.reset(
+    new StackDeviceMemory(this,
+                          device,
+                          getDefaultTempMemForGPU(device, tempMemPerThread_)));
+
+  auto p = ctx.get();
+  threadContexts_.emplace(key, std::move(ctx));
+  return p;
+}
+
+const StandardGpuResourcesImpl::ThreadContext*
+StandardGpuResourcesImpl::findThreadContext_(int device) const {
+  if (!perThreadContexts_) {
+    return nullptr;
+  }
+
+  auto it = threadContexts_.find(
+    std::make_pair(std::this_thread::get_id(), device));
+  return it != threadContexts_.end() ? it->second.get() : nullptr;
+}
+
 bool
 StandardGpuResourcesImpl::isInitialized(int device) const {
   // Use default streams as a marker for whether or not a certain
@@ -235,6 +377,8 @@ StandardGpuResourcesImpl::isInitialized(int device) const {
 
 void
 StandardGpuResourcesImpl::initializeForDevice(int device) {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
+
   if (isInitialized(device)) {
     return;
   }
@@ -291,20 +435,7 @@ StandardGpuResourcesImpl::initializeForDevice(int device) {
   alternateStreams_[device] = std::move(deviceStreams);
 
   // Create cuBLAS handle
-  cublasHandle_t blasHandle = 0;
-  auto blasStatus = cublasCreate(&blasHandle);
-  FAISS_ASSERT(blasStatus == CUBLAS_STATUS_SUCCESS);
-  blasHandles_[device] = blasHandle;
-
-  // For CUDA 10 on V100, enabling tensor core usage would enable automatic
-  // rounding down of inputs to f16 (though accumulate in f32) which results in
-  // unacceptable loss of precision in general.
-  // For CUDA 11 / A100, only enable tensor core support if it doesn't result in
-  // a loss of precision.
-#if CUDA_VERSION >= 11000
-  cublasSetMathMode(blasHandle,
-                    CUBLAS_MATH_DISALLOW_REDUCED_PRECISION_REDUCTION);
-#endif
+  blasHandles_[device] = createBlasHandle(tensorCoreMath_);
 
   FAISS_ASSERT(allocs_.count(device) == 0);
   allocs_[device] = std::unordered_map<void*, AllocRequest>();
@@ -321,12 +452,20 @@ StandardGpuResourcesImpl::initializeForDevice(int device) {
 
 cublasHandle_t
 StandardGpuResourcesImpl::getBlasHandle(int device) {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
   initializeForDevice(device);
+
+  auto ctx = getThreadContext_(device);
+  if (ctx) {
+    return ctx->blasHandle;
+  }
+
   return blasHandles_[device];
 }
 
 cudaStream_t
 StandardGpuResourcesImpl::getDefaultStream(int device) {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
   initializeForDevice(device);
 
   auto it = userDefaultStreams_.find(device);
@@ -335,29 +474,54 @@ StandardGpuResourcesImpl::getDefaultStream(int device) {
     return it->second;
   }
 
+  auto ctx = getThreadContext_(device);
+  if (ctx) {
+    return ctx->defaultStream;
+  }
+
   // Otherwise, our base default stream
   return defaultStreams_[device];
 }
 
 std::vector<cudaStream_t>
 StandardGpuResourcesImpl::getAlternateStreams(int device) {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
   initializeForDevice(device);
+
+  auto ctx = getThreadContext_(device);
+  if (ctx) {
+    return ctx->alternateStreams;
+  }
+
   return alternateStreams_[device];
 }
 
 std::pair<void*, size_t>
 StandardGpuResourcesImpl::getPinnedMemory() {
+  if (perThreadContexts_) {
+    // a single buffer cannot be shared by concurrent calls
+    return std::make_pair(nullptr, (size_t) 0);
+  }
+
   return std::make_pair(pinnedMemAlloc_, pinnedMemAllocSize_);
 }
 
 cudaStream_t
 StandardGpuResourcesImpl::getAsyncCopyStream(int device) {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
   initializeForDevice(device);
+
+  auto ctx = getThreadContext_(device);
+  if (ctx) {
+    return ctx->asyncCopyStream;
+  }
+
   return asyncCopyStreams_[device];
 }
 
 void*
 StandardGpuResourcesImpl::allocMemory(const AllocRequest& req) {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
   initializeForDevice(req.device);
 
   // We don't allocate a placeholder for zero-sized allocations
@@ -376,10 +540,28 @@ StandardGpuResourcesImpl::allocMemory(const AllocRequest& req) {
     std::cout << "StandardGpuResources: alloc " << adjReq.toString() << "\n";
   }
 
-  if (adjReq.space == MemorySpace::Temporary) {
+  auto overrideIt = tempMemoryOverride_.find(adjReq.device);
+
+  if (adjReq.space == MemorySpace::Temporary &&
+      overrideIt != tempMemoryOverride_.end()) {
+    // Memory reserved for a captured CUDA graph must not fall back to a
+    // separate allocation, as that would not outlive the capture
+    auto tempMem = overrideIt->second;
+
+    FAISS_THROW_IF_NOT_FMT(
+      adjReq.size <= tempMem->getSizeAvailable(),
+      "temporary memory override exhausted: requested %zu bytes, "
+      "%zu available", adjReq.size, tempMem->getSizeAvailable());
+
+    p = tempMem->allocMemory(adjReq.stream, adjReq.size);
+    overrideAllocs_[adjReq.device][p] = tempMem;
+
+  } else if (adjReq.space == MemorySpace::Temporary) {
     // If we don't have enough space in our temporary memory manager, we need
     // to allocate this request separately
-    auto& tempMem = tempMemory_[adjReq.device];
+    auto ctx = getThreadContext_(adjReq.device);
+    StackDeviceMemory* tempMem = ctx ?
+      ctx->tempMemory.get() : tempMemory_[adjReq.device].get();
 
     if (adjReq.size > tempMem->getSizeAvailable()) {
       // We need to allocate this ourselves
@@ -391,37 +573,24 @@ StandardGpuResourcesImpl::allocMemory(const AllocRequest& req) {
     }
 
     // Otherwise, we can handle this locally
-    p = tempMemory_[adjReq.device]->allocMemory(adjReq.stream, adjReq.size);
-
-  } else if (adjReq.space == MemorySpace::Device) {
-    auto err = cudaMalloc(&p, adjReq.size);
-
-    // Throw if we fail to allocate
-    if (err != cudaSuccess) {
-      auto& map = allocs_[req.device];
-
-      std::stringstream ss;
-      ss << "Failed to cudaMalloc " << adjReq.size << " bytes "
-         << "on device " << adjReq.device << " (error "
-         << (int) err << " " << cudaGetErrorString(err)
-         << "\nOutstanding allocations:\n" << allocsToString(map);
-      auto str = ss.str();
-
-      FAISS_THROW_IF_NOT_FMT(err == cudaSuccess, "%s", str.c_str());
+    p = tempMem->allocMemory(adjReq.stream, adjReq.size);
+    if (ctx) {
+      overrideAllocs_[adjReq.device][p] = tempMem;
     }
-  } else if (adjReq.space == MemorySpace::Unified) {
-    auto err = cudaMallocManaged(&p, adjReq.size);
 
-    if (err != cudaSuccess) {
+  } else if (adjReq.space == MemorySpace::Device ||
+             adjReq.space == MemorySpace::Unified) {
+    try {
+      p = allocator_->allocMemory(adjReq);
+    } catch (const FaissException& e) {
       auto& map = allocs_[req.device];
 
       std::stringstream ss;
-      ss << "Failed to cudaMallocManaged " << adjReq.size << " bytes "
-         << "(error " << (int) err << " " << cudaGetErrorString(err)
+      ss << e.what()
          << "\nOutstanding allocations:\n" << allocsToString(map);
       auto str = ss.str();
 
-      FAISS_THROW_IF_NOT_FMT(err == cudaSuccess, "%s", str.c_str());
+      FAISS_THROW_FMT("%s", str.c_str());
     }
   } else {
     FAISS_ASSERT_FMT(false, "unknown MemorySpace %d", (int) adjReq.space);
@@ -434,6 +603,7 @@ StandardGpuResourcesImpl::allocMemory(const AllocRequest& req) {
 
 void
 StandardGpuResourcesImpl::deallocMemory(int device, void* p) {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
   FAISS_ASSERT(isInitialized(device));
 
   if (!p) {
@@ -450,15 +620,19 @@ StandardGpuResourcesImpl::deallocMemory(int device, void* p) {
     std::cout << "StandardGpuResources: dealloc " << req.toString() << "\n";
   }
 
-  if (req.space == MemorySpace::Temporary) {
+  auto& overrides = overrideAllocs_[device];
+  auto overrideIt = overrides.find(p);
+
+  if (overrideIt != overrides.end()) {
+    overrideIt->second->deallocMemory(device, req.stream, req.size, p);
+    overrides.erase(overrideIt);
+
+  } else if (req.space == MemorySpace::Temporary) {
     tempMemory_[device]->deallocMemory(device, req.stream, req.size, p);
 
   } else if (req.space == MemorySpace::Device ||
              req.space == MemorySpace::Unified) {
-    auto err = cudaFree(p);
-    FAISS_ASSERT_FMT(err == cudaSuccess,
-                     "Failed to cudaFree pointer %p (error %d %s)",
-                     p, (int) err, cudaGetErrorString(err));
+    allocator_->deallocMemory(req, p);
 
   } else {
     FAISS_ASSERT_FMT(false, "unknown MemorySpace %d", (int) req.space);
@@ -469,16 +643,45 @@ StandardGpuResourcesImpl::deallocMemory(int device, void* p) {
 
 size_t
 StandardGpuResourcesImpl::getTempMemoryAvailable(int device) const {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
   FAISS_ASSERT(isInitialized(device));
 
+  auto overrideIt = tempMemoryOverride_.find(device);
+  if (overrideIt != tempMemoryOverride_.end()) {
+    return overrideIt->second->getSizeAvailable();
+  }
+
+  if (perThreadContexts_) {
+    auto ctx = findThreadContext_(device);
+    return ctx ? ctx->tempMemory->getSizeAvailable() :
+      getDefaultTempMemForGPU(device, tempMemPerThread_);
+  }
+
   auto it = tempMemory_.find(device);
   FAISS_ASSERT(it != tempMemory_.end());
 
   return it->second->getSizeAvailable();
 }
 
+bool
+StandardGpuResourcesImpl::setTemporaryMemoryOverride(int device,
+                                                     StackDeviceMemory* mem) {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
+  initializeForDevice(device);
+
+  if (mem) {
+    FAISS_ASSERT(mem->getDevice() == device);
+    tempMemoryOverride_[device] = mem;
+  } else {
+    tempMemoryOverride_.erase(device);
+  }
+
+  return true;
+}
+
 std::map<int, std::map<std::string, std::pair<int, size_t>>>
 StandardGpuResourcesImpl::getMemoryInfo() const {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
   using AT = std::map<std::string, std::pair<int, size_t>>;
 
   std::map<int, AT> out;
@@ -492,6 +695,25 @@ StandardGpuResourcesImpl::getMemoryInfo() const {
       v.second += a.second.size;
     }
 
+    for (auto& st : allocator_->getStats(entry.first)) {
+      auto type = allocTypeToString(st.first);
+      auto& a = st.second;
+
+      outDevice[type + " pool hits"] =
+        std::make_pair((int) a.numHits, a.bytesHit);
+      outDevice[type + " pool misses"] =
+        std::make_pair((int) a.numMisses, a.bytesMissed);
+      auto cur = outDevice.find(type);
+      outDevice[type + " binning overhead"] =
+        std::make_pair(cur != outDevice.end() ? cur->second.first : 0,
+                       a.bytesAllocated - a.bytesRequested);
+    }
+
+    auto cached = allocator_->getCachedMemory(entry.first);
+    if (cached.first > 0) {
+      outDevice["Pool cached"] = cached;
+    }
+
     out[entry.first] = std::move(outDevice);
   }
 
@@ -569,4 +791,21 @@ StandardGpuResources::setLogMemoryAllocations(bool enable) {
   res_->setLogMemoryAllocations(enable);
 }
 
+void
+StandardGpuResources::setMemoryAllocator(
+  std::shared_ptr<GpuMemoryAllocator> allocator) {
+  res_->setMemoryAllocator(allocator);
+}
+
+void
+StandardGpuResources::setPerThreadContexts(bool enable,
+                                           size_t tempMemPerThread) {
+  res_->setPerThreadContexts(enable, tempMemPerThread);
+}
+
+void
+StandardGpuResources::setTensorCoreMath(bool enable) {
+  res_->setTensorCoreMath(enable);
+}
+
 } } // namespace
@@ -8,12 +8,17 @@
 
 #pragma once
 
+#include <faiss/gpu/GpuMemoryAllocator.h>
 #include <faiss/gpu/GpuResources.h>
 #include <faiss/gpu/utils/StackDeviceMemory.h>
 #include <faiss/gpu/utils/DeviceUtils.h>
 #include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace faiss { namespace gpu {
@@ -66,6 +71,39 @@ class StandardGpuResourcesImpl : public GpuResources {
   /// standard output
   void setLogMemoryAllocations(bool enable);
 
+  /// Use the given allocator for all non-temporary device and unified memory
+  /// allocations (including the temporary memory region itself). Must be
+  /// called before the resources are used on any device. The default
+  /// allocator calls cudaMalloc / cudaFree for each allocation.
+  void setMemoryAllocator(std::shared_ptr<GpuMemoryAllocator> allocator);
+
+  /// Returns the allocator in use
+  std::shared_ptr<GpuMemoryAllocator> getMemoryAllocator();
+
+  /// If enabled, each host thread that calls into Faiss gets, per device,
+  /// its own default stream, alternate streams, async copy stream, cuBLAS
+  /// handle and temporary memory stack of tempMemPerThread bytes, so that
+  /// concurrent searches from several threads on the same index run
+  /// concurrently on the device instead of serializing on one stream and
+  /// one temporary memory stack. The contexts are created at the first
+  /// call of a thread and kept until the resources are destroyed.
+  /// Work from different threads is not ordered: an index must not be
+  /// modified while it is searched, and the thread that modified it
+  /// should call syncDefaultStreamCurrentDevice() before other threads
+  /// use it. The shared pinned memory buffer is not used in this mode
+  /// (large host-resident batches are paged without copy overlap), and a
+  /// stream set with setDefaultStream still applies to all threads. Must
+  /// be called before the resources are used on any device.
+  void setPerThreadContexts(bool enable, size_t tempMemPerThread);
+
+  /// If enabled, the f32 GEMMs of the distance computations may run on
+  /// tensor cores with reduced precision inputs: TF32 (10-bit mantissa) on
+  /// CUDA 11 and later, f16 before. Off by default, as it changes the
+  /// distances. The f16 GEMMs (e.g., GpuIndexFlat with useFloat16) run on
+  /// tensor cores either way. Must be called before the resources are used
+  /// on any device.
+  void setTensorCoreMath(bool enable);
+
  public:
   /// Internal system calls
 
@@ -84,7 +122,17 @@ class StandardGpuResourcesImpl : public GpuResources {
 
   size_t getTempMemoryAvailable(int device) const override;
 
-  /// Export a description of memory used for Python
+  /// Redirect temporary memory requests to `mem`, or back to our own
+  /// temporary memory with nullptr
+  bool setTemporaryMemoryOverride(int device, StackDeviceMemory* mem) override;
+
+  /// Export a description of memory used for Python: per device, the
+  /// (count, bytes) of the outstanding allocations of each type. With an
+  /// allocator that keeps statistics, also reports per type the
+  /// "<type> pool hits" and "<type> pool misses" (count, bytes requested
+  /// since creation), the "<type> binning overhead"
+  /// (outstanding allocations, bytes allocated beyond the request) and the
+  /// "Pool cached" (free blocks, bytes) held by the allocator
   std::map<int, std::map<std::string, std::pair<int, size_t>>>
   getMemoryInfo() const;
 
@@ -100,7 +148,29 @@ class StandardGpuResourcesImpl : public GpuResources {
   /// memory size
   static size_t getDefaultTempMemForGPU(int device, size_t requested);
 
+  /// Streams, cuBLAS handle and temporary memory of one host thread on one
+  /// device, see setPerThreadContexts
+  struct ThreadContext {
+    cudaStream_t defaultStream;
+    std::vector<cudaStream_t> alternateStreams;
+    cudaStream_t asyncCopyStream;
+    cublasHandle_t blasHandle;
+    std::unique_ptr<StackDeviceMemory> tempMemory;
+  };
+
+  /// Returns the context of the calling thread for the device, created if
+  /// needed, or nullptr if per-thread contexts are disabled
+  ThreadContext* getThreadContext_(int device);
+
+  /// Same, but returns nullptr if the context does not exist yet
+  const ThreadContext* findThreadContext_(int device) const;
+
  private:
+  /// Protects all the state below, as several host threads may use the
+  /// resources concurrently. It is recursive as the temporary memory
+  /// stacks allocate their memory through us
+  mutable std::recursive_mutex mutex_;
+
   /// Set of currently outstanding memory allocations per device
   /// device -> (alloc request, allocated ptr)
   std::unordered_map<int, std::unordered_map<void*, AllocRequest>> allocs_;
@@ -108,6 +178,29 @@ class StandardGpuResourcesImpl : public GpuResources {
   /// Temporary memory provider, per each device
   std::unordered_map<int, std::unique_ptr<StackDeviceMemory>> tempMemory_;
 
+  /// Temporary memory provider that currently replaces tempMemory_, per
+  /// device, if any
+  std::unordered_map<int, StackDeviceMemory*> tempMemoryOverride_;
+
+  /// Outstanding temporary allocations made out of an override provider or
+  /// a per-thread provider
+  /// device -> (allocated ptr, provider)
+  std::unordered_map<int, std::unordered_map<void*, StackDeviceMemory*>>
+  overrideAllocs_;
+
+  /// Whether each calling thread gets its own ThreadContext
+  bool perThreadContexts_;
+
+  /// Temporary memory size for each ThreadContext
+  size_t tempMemPerThread_;
+
+  /// Whether the cuBLAS handles allow tensor core math for f32 GEMMs
+  bool tensorCoreMath_;
+
+  /// (thread, device) -> context
+  std::map<std::pair<std::thread::id, int>, std::unique_ptr<ThreadContext>>
+  threadContexts_;
+
   /// Our default stream that work is ordered on, one per each device
   std::unordered_map<int, cudaStream_t> defaultStreams_;
 
@@ -137,6 +230,9 @@ class StandardGpuResourcesImpl : public GpuResources {
 
   /// Whether or not we log every GPU memory allocation and deallocation
   bool allocLogging_;
+
+  /// Provider of the non-temporary memory allocations
+  std::shared_ptr<GpuMemoryAllocator> allocator_;
 };
 
 /// Default implementation of GpuResources that allocates a cuBLAS
@@ -197,6 +293,18 @@ class StandardGpuResources : public GpuResourcesProvider {
   /// standard output
   void setLogMemoryAllocations(bool enable);
 
+  /// Use the given allocator for all non-temporary device and unified memory
+  /// allocations. Must be called before the resources are used.
+  void setMemoryAllocator(std::shared_ptr<GpuMemoryAllocator> allocator);
+
+  /// Give each calling host thread its own streams, cuBLAS handle and
+  /// temporary memory, see StandardGpuResourcesImpl::setPerThreadContexts
+  void setPerThreadContexts(bool enable, size_t tempMemPerThread);
+
+  /// Run the f32 GEMMs on tensor cores with reduced precision inputs, see
+  /// StandardGpuResourcesImpl::setTensorCoreMath
+  void setTensorCoreMath(bool enable);
+
  private:
   std::shared_ptr<StandardGpuResourcesImpl> res_;
 };
@@ -8,6 +8,7 @@
 
 #include <faiss/gpu/impl/Distance.cuh>
 #include <faiss/gpu/impl/BroadcastSum.cuh>
+#include <faiss/gpu/impl/FusedDistanceSelect.cuh>
 #include <faiss/gpu/impl/L2Norm.cuh>
 #include <faiss/gpu/impl/L2Select.cuh>
 #include <faiss/impl/FaissAssert.h>
@@ -19,6 +20,7 @@
 #include <faiss/gpu/utils/Limits.cuh>
 #include <faiss/gpu/utils/MatrixMult.cuh>
 #include <faiss/gpu/utils/BlockSelectKernel.cuh>
+#include <faiss/gpu/utils/LargeSelect.cuh>
 
 #include <memory>
 #include <algorithm>
@@ -96,6 +98,16 @@ void runDistance(bool computeL2,
     runL2Norm(queries, queriesRowMajor, queryNorms, true, defaultStream);
   }
 
+  // For small k and dimension, compute the distances and k-select them in a
+  // single kernel rather than writing out distance tiles
+  if (runFusedDistanceSelect(res, computeL2,
+                             centroids, centroidsRowMajor, centroidNorms,
+                             queries, queriesRowMajor, queryNorms,
+                             k, outDistances, outIndices, ignoreOutDistances,
+                             defaultStream)) {
+    return;
+  }
+
   // By default, aim to use up to 512 MB of memory for the processing, with both
   // number of queries and number of centroids being at least 512.
   int tileRows = 0;
@@ -112,7 +124,19 @@ void runDistance(bool computeL2,
 
   // We can have any number of vectors to query against, even less than k, in
   // which case we'll return -1 for the index
-  FAISS_ASSERT(k <= GPU_MAX_SELECTION_K); // select limitation
+  FAISS_ASSERT(k <= GPU_MAX_LARGE_SELECTION_K); // select limitation
+
+  // Beyond the WarpSelect / BlockSelect limit, we use the radix-based
+  // selection; neither it nor the merge is fused with the ||c||^2 addition
+  bool largeK = k > GPU_MAX_SELECTION_K;
+
+  if (largeK) {
+    // The intermediate results of all column tiles are kept at once, doubled
+    // for the two streams; bound them to the same budget as the tiles
+    size_t perRow = (size_t) 2 * numColTiles * k * (sizeof(float) + sizeof(int));
+    size_t budget = (size_t) 2 * tileRows * tileCols * sizeof(float);
+    tileRows = std::max(1, std::min(tileRows, (int) (budget / perRow)));
+  }
 
   // Temporary output memory space we'll use
   DeviceTensor<float, 2, true> distanceBuf1(
@@ -201,7 +225,34 @@ void runDistance(bool computeL2,
                     res->getBlasHandleCurrentDevice(),
                     streams[curStream]);
 
-      if (computeL2) {
+      if (largeK) {
+        auto outDistanceSelView =
+          tileCols == numCentroids ? outDistanceView : outDistanceBufColView;
+        auto outIndexSelView =
+          tileCols == numCentroids ? outIndexView : outIndexBufColView;
+
+        if (computeL2) {
+          // ||c||^2 - 2qc
+          auto centroidNormsView =
+            centroidNorms->narrow(0, j, curCentroidSize);
+          runSumAlongColumns(centroidNormsView, distanceBufView,
+                             streams[curStream]);
+        }
+
+        runLargeSelect(distanceBufView,
+                       outDistanceSelView,
+                       outIndexSelView,
+                       !computeL2, k, res, streams[curStream]);
+
+        if (computeL2 && !ignoreOutDistances) {
+          // top-k ||c||^2 - 2qc + ||q||^2 in the form (query id, k)
+          runSumAlongRows(queryNormNiew,
+                          outDistanceSelView,
+                          true, // L2 distances should not go below zero due
+                                // to roundoff error
+                          streams[curStream]);
+        }
+      } else if (computeL2) {
         // For L2 distance, we use this fused kernel that performs both
         // adding ||c||^2 to -2qc and k-selection, so we only need two
         // passes (one write by the gemm, one read here) over the huge
@@ -273,11 +324,20 @@ void runDistance(bool computeL2,
       // tileCols to the index
       runIncrementIndex(outIndexBufRowView, k, tileCols, streams[curStream]);
 
-      runBlockSelectPair(outDistanceBufRowView,
-                         outIndexBufRowView,
-                         outDistanceView,
-                         outIndexView,
-                         computeL2 ? false : true, k, streams[curStream]);
+      if (largeK) {
+        runLargeSelectPair(outDistanceBufRowView,
+                           outIndexBufRowView,
+                           outDistanceView,
+                           outIndexView,
+                           computeL2 ? false : true, k,
+                           res, streams[curStream]);
+      } else {
+        runBlockSelectPair(outDistanceBufRowView,
+                           outIndexBufRowView,
+                           outDistanceView,
+                           outIndexView,
+                           computeL2 ? false : true, k, streams[curStream]);
+      }
     }
 
     curStream = (curStream + 1) % 2;
@@ -9,6 +9,7 @@
 #include <faiss/gpu/impl/FlatIndex.cuh>
 #include <faiss/gpu/impl/Distance.cuh>
 #include <faiss/gpu/impl/L2Norm.cuh>
+#include <faiss/gpu/impl/RangeSearch.cuh>
 #include <faiss/gpu/impl/VectorResidual.cuh>
 #include <faiss/gpu/utils/ConversionOperators.cuh>
 #include <faiss/gpu/utils/CopyUtils.cuh>
@@ -183,6 +184,65 @@ FlatIndex::query(Tensor<half, 2, true>& input,
                 !exactDistance);
 }
 
+void
+FlatIndex::rangeQuery(Tensor<float, 2, true>& input,
+                      float radius,
+                      int maxResults,
+                      faiss::MetricType metric,
+                      RangeSearchResult* result) {
+  auto stream = resources_->getDefaultStreamCurrentDevice();
+  bool computeL2 = metric == faiss::MetricType::METRIC_L2;
+
+  // This is caught at a higher level
+  FAISS_ASSERT(computeL2 ||
+               metric == faiss::MetricType::METRIC_INNER_PRODUCT);
+
+  DeviceTensor<half, 2, true> inputHalf;
+  if (useFloat16_) {
+    // We need to convert the input to float16 for comparison to ourselves
+    inputHalf =
+      convertTensorTemporary<float, half, 2>(resources_, stream, input);
+  }
+
+  auto scan = [&](RangeScanOutput& out) {
+    if (useFloat16_) {
+      runFlatRangeScan(resources_,
+                       storeTransposed_ ? vectorsHalfTransposed_ : vectorsHalf_,
+                       !storeTransposed_, // is vectors row major?
+                       &norms_,
+                       inputHalf,
+                       computeL2,
+                       radius,
+                       out);
+    } else {
+      runFlatRangeScan(resources_,
+                       storeTransposed_ ? vectorsTransposed_ : vectors_,
+                       !storeTransposed_, // is vectors row major?
+                       &norms_,
+                       input,
+                       computeL2,
+                       radius,
+                       out);
+    }
+  };
+
+  auto knn = [&](Tensor<float, 2, true>& queries,
+                 int k,
+                 Tensor<float, 2, true>& outDistances,
+                 Tensor<Index::idx_t, 2, true>& outIndices) {
+    // We only support int indices
+    DeviceTensor<int, 2, true> outIntIndices(
+      resources_, makeTempAlloc(AllocType::Other, stream),
+      {queries.getSize(0), k});
+
+    query(queries, k, metric, 0, outDistances, outIntIndices, true);
+
+    convertTensor<int, Index::idx_t, 2>(stream, outIntIndices, outIndices);
+  };
+
+  runRangeSearch(resources_, input, maxResults, scan, knn, nullptr, result);
+}
+
 void
 FlatIndex::computeResidual(Tensor<float, 2, true>& vecs,
                            Tensor<int, 1, true>& listIds,
@@ -304,6 +364,26 @@ FlatIndex::add(const float* data, int numVecs, cudaStream_t stream) {
   }
 }
 
+void
+FlatIndex::compact(Tensor<int, 1, true>& keepIds, cudaStream_t stream) {
+  int numKeep = keepIds.getSize(0);
+
+  if (numKeep == 0) {
+    reset();
+    return;
+  }
+
+  // Gather the kept vectors, then rebuild the storage (and the transposed
+  // data and norms) from them. The float16 -> float32 -> float16 round trip
+  // is exact
+  DeviceTensor<float, 2, true> keptVecs(
+    resources_, makeTempAlloc(AllocType::Other, stream), {numKeep, dim_});
+  reconstruct(keepIds, keptVecs);
+
+  reset();
+  add(keptVecs.data(), numKeep, stream);
+}
+
 void
 FlatIndex::reset() {
   rawData_.clear();
@@ -315,4 +395,21 @@ FlatIndex::reset() {
   num_ = 0;
 }
 
+MemoryUsage
+FlatIndex::getMemoryUsage() const {
+  MemoryUsage mu = MemoryUsage::object("gpu::FlatIndex");
+
+  // vectors_ and vectorsHalf_ are views on rawData_
+  mu.add_device("vectors", rawData_.size(), rawData_.capacity());
+
+  if (storeTransposed_) {
+    size_t bytes = useFloat16_ ? vectorsHalfTransposed_.getSizeInBytes() :
+        vectorsTransposed_.getSizeInBytes();
+    mu.add_device("vectors_transposed", bytes, bytes);
+  }
+
+  mu.add_device("norms", norms_.getSizeInBytes(), norms_.getSizeInBytes());
+  return mu;
+}
+
 } }
@@ -9,6 +9,7 @@
 #pragma once
 
 #include <faiss/MetricType.h>
+#include <faiss/impl/MemoryUsage.h>
 #include <faiss/gpu/utils/DeviceTensor.cuh>
 #include <faiss/gpu/utils/DeviceVector.cuh>
 #include <faiss/gpu/GpuResources.h>
@@ -74,6 +75,14 @@ class FlatIndex {
              Tensor<int, 2, true>& outIndices,
              bool exactDistance);
 
+  /// Range search of `vecs` into `result` (on the host); see runRangeSearch
+  /// for maxResults
+  void rangeQuery(Tensor<float, 2, true>& vecs,
+                  float radius,
+                  int maxResults,
+                  faiss::MetricType metric,
+                  RangeSearchResult* result);
+
   /// Compute residual for set of vectors
   void computeResidual(Tensor<float, 2, true>& vecs,
                        Tensor<int, 1, true>& listIds,
@@ -90,9 +99,16 @@ class FlatIndex {
   /// or the device
   void add(const float* data, int numVecs, cudaStream_t stream);
 
+  /// Keep only the vectors keepIds (on the device), in this order; the
+  /// storage is reallocated to the exact size
+  void compact(Tensor<int, 1, true>& keepIds, cudaStream_t stream);
+
   /// Free all storage
   void reset();
 
+  /// Device memory of the vectors and of their norms
+  MemoryUsage getMemoryUsage() const;
+
  private:
   /// Collection of GPU resources that we use
   GpuResources* resources_;
@@ -0,0 +1,252 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#include <faiss/gpu/impl/FusedDistanceSelect.cuh>
+#include <faiss/gpu/GpuResources.h>
+#include <faiss/gpu/impl/BroadcastSum.cuh>
+#include <faiss/gpu/utils/BlockSelectKernel.cuh>
+#include <faiss/gpu/utils/DeviceTensor.cuh>
+#include <faiss/gpu/utils/DeviceUtils.h>
+#include <faiss/gpu/utils/Limits.cuh>
+#include <faiss/gpu/utils/Select.cuh>
+#include <faiss/gpu/utils/StaticUtils.h>
+#include <algorithm>
+
+namespace faiss { namespace gpu {
+
+// One warp per query
+constexpr int kFusedDistanceThreads = 256;
+constexpr int kFusedDistanceQueriesPerBlock =
+  kFusedDistanceThreads / kWarpSize;
+
+// Smallest number of vectors handled by a block, when splitting the vectors
+// across blocks to fill the device for small query batches
+constexpr int kFusedDistanceMinChunk = 1024;
+
+// Each block handles kFusedDistanceQueriesPerBlock queries against the chunk
+// blockIdx.x of `chunkSize` vectors. Vectors are staged in shared memory a
+// warp's width at a time, with each lane computing the distance of its
+// warp's query to one of them, so that every tile is shared by all queries
+// of the block. Writes the k-selected results of the chunk at column
+// blockIdx.x * k of the output
+template <bool L2, int NumWarpQ, int NumThreadQ>
+__global__ void __launch_bounds__(kFusedDistanceThreads)
+fusedDistanceSelect(Tensor<float, 2, true> centroids,
+                    Tensor<float, 1, true> centroidNorms,
+                    Tensor<float, 2, true> queries,
+                    int chunkSize,
+                    int k,
+                    Tensor<float, 2, true> outDistances,
+                    Tensor<int, 2, true> outIndices) {
+  // L2: smallest ||c||^2 - 2qc; IP: largest qc
+  constexpr bool kDir = !L2;
+  constexpr float kInit = L2 ? kFloatMax : kFloatMin;
+
+  __shared__ float smemQueries[kFusedDistanceQueriesPerBlock]
+                              [kFusedDistanceMaxDim];
+  // Padded to avoid bank conflicts, as each lane reads its own row
+  __shared__ float smemVecs[kWarpSize][kFusedDistanceMaxDim + 1];
+
+  int dim = queries.getSize(1);
+  int numVecs = centroids.getSize(0);
+
+  int warpId = threadIdx.x / kWarpSize;
+  int laneId = getLaneId();
+  int query = blockIdx.y * kFusedDistanceQueriesPerBlock + warpId;
+  bool queryValid = query < queries.getSize(0);
+
+  int chunkStart = blockIdx.x * chunkSize;
+  int chunkEnd = min(chunkStart + chunkSize, numVecs);
+
+  for (int d = laneId; d < dim; d += kWarpSize) {
+    smemQueries[warpId][d] = queryValid ? queries[query][d] : 0.0f;
+  }
+
+  WarpSelect<float, int, kDir, Comparator<float>,
+             NumWarpQ, NumThreadQ, kFusedDistanceThreads>
+    heap(kInit, -1, k);
+
+  for (int tile = chunkStart; tile < chunkEnd; tile += kWarpSize) {
+    int tileSize = min(kWarpSize, chunkEnd - tile);
+
+    // Wait for all warps to be done with the previous tile
+    __syncthreads();
+
+    for (int i = threadIdx.x; i < tileSize * dim; i += blockDim.x) {
+      int v = i / dim;
+      int d = i - v * dim;
+
+      smemVecs[v][d] = centroids[tile + v][d];
+    }
+
+    __syncthreads();
+
+    float dot = 0.0f;
+
+    for (int d = 0; d < dim; ++d) {
+      dot = fmaf(smemQueries[warpId][d], smemVecs[laneId][d], dot);
+    }
+
+    // Whole warps must participate in the selection; lanes past the end of
+    // the tile add a value that is never selected
+    int vec = tile + laneId;
+    bool valid = laneId < tileSize;
+
+    float dist = kInit;
+    if (valid) {
+      dist = L2 ? centroidNorms[vec] - 2.0f * dot : dot;
+    }
+
+    heap.add(dist, valid ? vec : -1);
+  }
+
+  heap.reduce();
+
+  if (queryValid) {
+    heap.writeOut(outDistances[query][blockIdx.x * k].data(),
+                  outIndices[query][blockIdx.x * k].data(), k);
+  }
+}
+
+bool runFusedDistanceSelect(GpuResources* res,
+                            bool computeL2,
+                            Tensor<float, 2, true>& centroids,
+                            bool centroidsRowMajor,
+                            Tensor<float, 1, true>* centroidNorms,
+                            Tensor<float, 2, true>& queries,
+                            bool queriesRowMajor,
+                            Tensor<float, 1, true>& queryNorms,
+                            int k,
+                            Tensor<float, 2, true>& outDistances,
+                            Tensor<int, 2, true>& outIndices,
+                            bool ignoreOutDistances,
+                            cudaStream_t stream) {
+  if (!centroidsRowMajor || !queriesRowMajor ||
+      k > kFusedDistanceMaxK ||
+      queries.getSize(1) > kFusedDistanceMaxDim) {
+    return false;
+  }
+
+  FAISS_ASSERT(!computeL2 || centroidNorms);
+
+  int numQueries = queries.getSize(0);
+  int numVecs = centroids.getSize(0);
+
+  // Maximum number of queries per launch, given the grid y limit
+  constexpr int kMaxQueriesPerLaunch = 65535 * kFusedDistanceQueriesPerBlock;
+
+  // For small query batches, split the vectors across blocks to fill the
+  // device; the per-chunk results are merged with a second k-selection
+  int numQueryBlocks = utils::divUp(std::min(numQueries, kMaxQueriesPerLaunch),
+                                    kFusedDistanceQueriesPerBlock);
+  int targetBlocks =
+    8 * getDeviceProperties(getCurrentDevice()).multiProcessorCount;
+
+  int numChunks = std::max(1, std::min(
+                    utils::divUp(targetBlocks, numQueryBlocks),
+                    utils::divUp(numVecs, kFusedDistanceMinChunk)));
+  int chunkSize = utils::roundUp(utils::divUp(numVecs, numChunks), kWarpSize);
+  numChunks = utils::divUp(numVecs, chunkSize);
+
+  DeviceTensor<float, 2, true> chunkDistances;
+  DeviceTensor<int, 2, true> chunkIndices;
+
+  if (numChunks > 1) {
+    chunkDistances = DeviceTensor<float, 2, true>(
+      res, makeTempAlloc(AllocType::Other, stream),
+      {numQueries, numChunks * k});
+    chunkIndices = DeviceTensor<int, 2, true>(
+      res, makeTempAlloc(AllocType::Other, stream),
+      {numQueries, numChunks * k});
+  }
+
+  Tensor<float, 1, true> norms =
+    computeL2 ? *centroidNorms : Tensor<float, 1, true>();
+
+  for (int i = 0; i < numQueries; i += kMaxQueriesPerLaunch) {
+    int curQueries = std::min(kMaxQueriesPerLaunch, numQueries - i);
+
+    auto queryView = queries.narrow(0, i, curQueries);
+    auto outDistanceView = numChunks > 1 ?
+      chunkDistances.narrow(0, i, curQueries) :
+      outDistances.narrow(0, i, curQueries);
+    auto outIndexView = numChunks > 1 ?
+      chunkIndices.narrow(0, i, curQueries) :
+      outIndices.narrow(0, i, curQueries);
+
+    auto grid = dim3(numChunks,
+                     utils::divUp(curQueries, kFusedDistanceQueriesPerBlock));
+    auto block = dim3(kFusedDistanceThreads);
+
+#define RUN_FUSED(L2, NUM_WARP_Q, NUM_THREAD_Q)                         \
+    do {                                                                \
+      fusedDistanceSelect<L2, NUM_WARP_Q, NUM_THREAD_Q>                 \
+        <<<grid, block, 0, stream>>>(centroids, norms, queryView,       \
+                                     chunkSize, k,                      \
+                                     outDistanceView, outIndexView);    \
+    } while (0)
+
+#define RUN_FUSED_K(L2)                         \
+    do {                                        \
+      if (k == 1) {                             \
+        RUN_FUSED(L2, 1, 1);                    \
+      } else if (k <= 32) {                     \
+        RUN_FUSED(L2, 32, 2);                   \
+      } else {                                  \
+        RUN_FUSED(L2, 64, 3);                   \
+      }                                         \
+    } while (0)
+
+    if (computeL2) {
+      RUN_FUSED_K(true);
+    } else {
+      RUN_FUSED_K(false);
+    }
+
+#undef RUN_FUSED_K
+#undef RUN_FUSED
+
+    CUDA_TEST_ERROR();
+  }
+
+  if (numChunks > 1) {
+    // The chunk results hold global vector indices already
+    runBlockSelectPair(chunkDistances, chunkIndices,
+                       outDistances, outIndices,
+                       !computeL2, k, stream);
+  }
+
+  if (computeL2 && !ignoreOutDistances) {
+    // top-k ||c||^2 - 2qc + ||q||^2 in the form (query id, k)
+    runSumAlongRows(queryNorms,
+                    outDistances,
+                    true, // L2 distances should not go below zero due
+                          // to roundoff error
+                    stream);
+  }
+
+  return true;
+}
+
+bool runFusedDistanceSelect(GpuResources* res,
+                            bool computeL2,
+                            Tensor<half, 2, true>& centroids,
+                            bool centroidsRowMajor,
+                            Tensor<float, 1, true>* centroidNorms,
+                            Tensor<half, 2, true>& queries,
+                            bool queriesRowMajor,
+                            Tensor<float, 1, true>& queryNorms,
+                            int k,
+                            Tensor<float, 2, true>& outDistances,
+                            Tensor<int, 2, true>& outIndices,
+                            bool ignoreOutDistances,
+                            cudaStream_t stream) {
+  return false;
+}
+
+} } // namespace
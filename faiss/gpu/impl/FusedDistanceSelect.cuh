@@ -0,0 +1,61 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#pragma once
+
+#include <faiss/gpu/utils/Float16.cuh>
+#include <faiss/gpu/utils/Tensor.cuh>
+
+namespace faiss { namespace gpu {
+
+class GpuResources;
+
+/// Largest k handled by the fused distance + k-selection kernel
+constexpr int kFusedDistanceMaxK = 64;
+
+/// Largest dimension handled by the fused distance + k-selection kernel;
+/// beyond this, the GEMM dominates and is better left to cuBLAS
+constexpr int kFusedDistanceMaxDim = 128;
+
+/// Brute-force L2 or IP k-nearest neighbors that computes the distances of
+/// a block of queries to a tile of vectors in shared memory and feeds them
+/// straight into WarpSelect, instead of writing each tile of the distance
+/// matrix to global memory for a separate k-selection pass. Used by
+/// runDistance for small k and dimension with row-major float data; returns
+/// false without doing anything otherwise.
+/// `queryNorms` is only used for L2, if distances are output
+bool runFusedDistanceSelect(GpuResources* res,
+                            bool computeL2,
+                            Tensor<float, 2, true>& centroids,
+                            bool centroidsRowMajor,
+                            Tensor<float, 1, true>* centroidNorms,
+                            Tensor<float, 2, true>& queries,
+                            bool queriesRowMajor,
+                            Tensor<float, 1, true>& queryNorms,
+                            int k,
+                            Tensor<float, 2, true>& outDistances,
+                            Tensor<int, 2, true>& outIndices,
+                            bool ignoreOutDistances,
+                            cudaStream_t stream);
+
+/// Float16 data always uses the GEMM-based path
+bool runFusedDistanceSelect(GpuResources* res,
+                            bool computeL2,
+                            Tensor<half, 2, true>& centroids,
+                            bool centroidsRowMajor,
+                            Tensor<float, 1, true>* centroidNorms,
+                            Tensor<half, 2, true>& queries,
+                            bool queriesRowMajor,
+                            Tensor<float, 1, true>& queryNorms,
+                            int k,
+                            Tensor<float, 2, true>& outDistances,
+                            Tensor<int, 2, true>& outIndices,
+                            bool ignoreOutDistances,
+                            cudaStream_t stream);
+
+} } // namespace
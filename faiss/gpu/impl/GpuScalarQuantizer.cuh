@@ -9,6 +9,7 @@
 
 #include <faiss/IndexScalarQuantizer.h>
 #include <faiss/gpu/utils/ConversionOperators.cuh>
+#include <faiss/gpu/utils/DeviceDefs.cuh>
 #include <faiss/gpu/utils/DeviceTensor.cuh>
 #include <faiss/gpu/utils/HostTensor.cuh>
 
@@ -22,6 +23,7 @@ inline bool isSQSupported(ScalarQuantizer::QuantizerType qtype) {
     case ScalarQuantizer::QuantizerType::QT_4bit:
     case ScalarQuantizer::QuantizerType::QT_4bit_uniform:
     case ScalarQuantizer::QuantizerType::QT_fp16:
+    case ScalarQuantizer::QuantizerType::QT_6bit:
       return true;
     default:
       return false;
@@ -608,4 +610,213 @@ struct Codec<ScalarQuantizer::QuantizerType::QT_4bit, 1> {
   float* smemVdiff;
 };
 
+/////
+//
+// 6 bit encodings
+//
+/////
+
+// Uniform quantization per each dimension; 4 dimensions are packed in 3 bytes,
+// in the same layout as the CPU ScalarQuantizer
+template <>
+struct Codec<ScalarQuantizer::QuantizerType::QT_6bit, 1> {
+  /// How many dimensions per iteration we are handling for encoding or decoding
+  static constexpr int kDimPerIter = 4;
+
+  Codec(int vecBytes, float* min, float* diff)
+      : bytesPerVec(vecBytes), vmin(min), vdiff(diff),
+        smemVmin(nullptr),
+        smemVdiff(nullptr) {
+  }
+
+  size_t getSmemSize(int dim) {
+    return sizeof(float) * dim * 2;
+  }
+
+  inline __device__ void setSmem(float* smem, int dim) {
+    smemVmin = smem;
+    smemVdiff = smem + dim;
+
+    for (int i = threadIdx.x; i < dim; i += blockDim.x) {
+      smemVmin[i] = vmin[i];
+      smemVdiff[i] = vdiff[i];
+    }
+  }
+
+  inline __device__ float decodeHelper(uint8_t v, int realDim) const {
+    float x = (((float) v) + 0.5f) / 63.0f;
+    return smemVmin[realDim] + x * smemVdiff[realDim];
+  }
+
+  inline __device__ void decode(void* data, int vec, int d,
+                                float* out) const {
+    uint8_t* p = &((uint8_t*) data)[vec * bytesPerVec + d * 3];
+    uint32_t pv = (uint32_t) p[0] |
+      ((uint32_t) p[1] << 8) |
+      ((uint32_t) p[2] << 16);
+    int realDim = d * kDimPerIter;
+
+#pragma unroll
+    for (int i = 0; i < kDimPerIter; ++i) {
+      out[i] = decodeHelper((pv >> (i * 6)) & 0x3fU, realDim + i);
+    }
+  }
+
+  inline __device__ float decodePartial(void* data, int vec, int d,
+                                        int subD) const {
+    // Only the bytes holding the remaining dimensions exist
+    uint8_t* p = &((uint8_t*) data)[vec * bytesPerVec + d * 3];
+    int realDim = d * kDimPerIter + subD;
+    uint8_t bits;
+
+    switch (subD) {
+      case 0:
+        bits = p[0] & 0x3f;
+        break;
+      case 1:
+        bits = (p[0] >> 6) | ((p[1] & 0xf) << 2);
+        break;
+      default:
+        bits = (p[1] >> 4) | ((p[2] & 0x3) << 4);
+        break;
+    }
+
+    return decodeHelper(bits, realDim);
+  }
+
+  inline __device__ uint32_t encodeHelper(float v, int realDim) const {
+    float x = (v - vmin[realDim]) / vdiff[realDim];
+    x = fminf(1.0f, fmaxf(0.0f, x));
+    return (uint32_t) (x * 63.0f);
+  }
+
+  inline __device__ void encode(void* data, int vec, int d,
+                                float v[kDimPerIter]) const {
+    encodePartial(data, vec, d, kDimPerIter, v);
+  }
+
+  inline __device__ void encodePartial(void* data, int vec, int d,
+                                       int remaining,
+                                       float v[kDimPerIter]) const {
+    uint8_t* p = &((uint8_t*) data)[vec * bytesPerVec + d * 3];
+    int realDim = d * kDimPerIter;
+
+    uint32_t out = 0;
+    for (int i = 0; i < remaining; ++i) {
+      out |= encodeHelper(v[i], realDim + i) << (i * 6);
+    }
+
+    // Each group of remaining dimensions covers ceil(6 * remaining / 8) bytes
+    int numBytes = remaining < kDimPerIter ? remaining : 3;
+    for (int i = 0; i < numBytes; ++i) {
+      p[i] = (uint8_t) (out >> (i * 8));
+    }
+  }
+
+  int bytesPerVec;
+
+  // gmem pointers
+  const float* vmin;
+  const float* vdiff;
+
+  // smem pointers
+  float* smemVmin;
+  float* smemVdiff;
+};
+
+/////
+//
+// Interleaved list layout
+//
+/////
+
+/// Number of bytes read by one decode() call of the codec used for the
+/// given quantizer (nullptr: float vectors). In the interleaved list layout,
+/// these units of the kWarpSize vectors of a group are stored contiguously
+inline int getCodecUnitBytes(const ScalarQuantizer* sq) {
+  if (!sq) {
+    return sizeof(float);
+  }
+
+  switch (sq->qtype) {
+    case ScalarQuantizer::QuantizerType::QT_fp16:
+      return sizeof(half);
+    case ScalarQuantizer::QuantizerType::QT_6bit:
+      // 4 dimensions per unit
+      return 3;
+    default:
+      // 1 dimension per byte, or 2 for the 4 bit codecs
+      return 1;
+  }
+}
+
+/// Adapts a codec to the interleaved list layout. The vectors of a list are
+/// stored by groups of kWarpSize; within a group, unit d (the data read by
+/// codec.decode(.., d, ..)) of all vectors is contiguous, so that the lanes
+/// of a warp that each handle one vector load consecutive addresses. The
+/// last group is padded.
+///
+/// The wrapped codec is given a stride of one unit between vectors, and a
+/// base pointer shifted so that its own offset of unit d lands on vector
+/// `lane` of unit d in the group:
+/// group + d * (kWarpSize - 1) * unitBytes + lane * unitBytes + d * unitBytes
+template <typename CodecT>
+struct InterleavedCodec {
+  static constexpr int kDimPerIter = CodecT::kDimPerIter;
+
+  /// codeSize is the size of a vector in the row-major layout
+  InterleavedCodec(const CodecT& c, int unitBytes, int codeSize)
+      : codec(c),
+        unitBytes(unitBytes),
+        groupBytes(kWarpSize * unitBytes *
+                   ((codeSize + unitBytes - 1) / unitBytes)) {
+    codec.bytesPerVec = unitBytes;
+  }
+
+  size_t getSmemSize(int dim) { return codec.getSmemSize(dim); }
+
+  inline __device__ void setSmem(float* smem, int dim) {
+    codec.setSmem(smem, dim);
+  }
+
+  inline __device__ void* unitBase(void* data, int vec, int d) const {
+    return (uint8_t*) data +
+      (size_t) (vec / kWarpSize) * groupBytes +
+      (size_t) d * (kWarpSize - 1) * unitBytes;
+  }
+
+  inline __device__ void decode(void* data, int vec, int d,
+                                float* out) const {
+    codec.decode(unitBase(data, vec, d), vec % kWarpSize, d, out);
+  }
+
+  inline __device__ float decodePartial(void* data, int vec, int d,
+                                        int subD) const {
+    return codec.decodePartial(
+      unitBase(data, vec, d), vec % kWarpSize, d, subD);
+  }
+
+  inline __device__ void encode(void* data, int vec, int d,
+                                float v[kDimPerIter]) const {
+    codec.encode(unitBase(data, vec, d), vec % kWarpSize, d, v);
+  }
+
+  inline __device__ void encodePartial(void* data, int vec, int d,
+                                       int remaining,
+                                       float v[kDimPerIter]) const {
+    codec.encodePartial(
+      unitBase(data, vec, d), vec % kWarpSize, d, remaining, v);
+  }
+
+  CodecT codec;
+  int unitBytes;
+  int groupBytes;
+};
+
+template <typename CodecT>
+inline InterleavedCodec<CodecT>
+makeInterleavedCodec(const CodecT& codec, int unitBytes, int codeSize) {
+  return InterleavedCodec<CodecT>(codec, unitBytes, codeSize);
+}
+
 } } // namespace
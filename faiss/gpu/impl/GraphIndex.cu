@@ -0,0 +1,380 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#include <faiss/gpu/impl/GraphIndex.cuh>
+#include <faiss/gpu/GpuResources.h>
+#include <faiss/gpu/utils/DeviceDefs.cuh>
+#include <faiss/gpu/utils/DeviceUtils.h>
+#include <faiss/gpu/utils/Limits.cuh>
+#include <faiss/gpu/utils/PtxUtils.cuh>
+#include <faiss/gpu/utils/Reductions.cuh>
+#include <faiss/gpu/utils/StaticUtils.h>
+#include <faiss/impl/FaissAssert.h>
+
+namespace faiss { namespace gpu {
+
+/// Number of queries (one per warp) handled by each block
+constexpr int kGraphSearchWarps = 4;
+
+/// Marks a beam entry whose neighbors have already been expanded
+constexpr int kGraphExplored = (int) 0x80000000;
+
+namespace {
+
+inline __device__ unsigned int hashNode(unsigned int id) {
+  return id * 2654435761u;
+}
+
+/// Squared L2 distance, or negated inner product, between the query and a
+/// database vector, computed by the whole warp; all lanes get the result
+template <bool IsL2>
+inline __device__ float warpDistance(const float* query,
+                                     const float* vec,
+                                     int dim,
+                                     int laneId) {
+  float acc = 0;
+
+  for (int i = laneId; i < dim; i += kWarpSize) {
+    float q = query[i];
+    float v = vec[i];
+
+    if (IsL2) {
+      float diff = q - v;
+      acc += diff * diff;
+    } else {
+      acc += q * v;
+    }
+  }
+
+  acc = warpReduceAllSum(acc);
+  return IsL2 ? acc : -acc;
+}
+
+/// Inserts (dist, id) in the sorted beam of `width` entries if it is better
+/// than the worst entry and not already present. Called by the whole warp.
+inline __device__ void warpBeamInsert(float* beamDist,
+                                      int* beamId,
+                                      int width,
+                                      float dist,
+                                      int id,
+                                      int laneId) {
+  if (!(dist < beamDist[width - 1])) {
+    return;
+  }
+
+  // Position of the new entry (after equal distances), and whether the node
+  // is already in the beam
+  int pos = 0;
+  bool dup = false;
+
+  for (int i = laneId; i < width; i += kWarpSize) {
+    pos += (beamDist[i] <= dist);
+    dup |= ((beamId[i] & ~kGraphExplored) == id && beamId[i] != -1);
+  }
+
+  if (__any_sync(0xffffffff, dup)) {
+    return;
+  }
+
+  pos = warpReduceAllSum(pos);
+
+  // Shift [pos, width - 1) up by one, from the top chunk down so that each
+  // chunk is read before the next lower one overwrites its first entry
+  for (int s = pos + ((width - 2 - pos) / kWarpSize) * kWarpSize;
+       s >= pos; s -= kWarpSize) {
+    int i = s + laneId;
+    bool active = (i < width - 1);
+
+    float d;
+    int v;
+
+    if (active) {
+      d = beamDist[i];
+      v = beamId[i];
+    }
+
+    __syncwarp();
+
+    if (active) {
+      beamDist[i + 1] = d;
+      beamId[i + 1] = v;
+    }
+
+    __syncwarp();
+  }
+
+  if (laneId == 0) {
+    beamDist[pos] = dist;
+    beamId[pos] = id;
+  }
+
+  __syncwarp();
+}
+
+/// Returns true if the node was not recorded as visited, and records it.
+/// The table is lossy: a node evicted by a colliding one may be visited again,
+/// which only costs a distance computation since the beam is deduplicated.
+inline __device__ bool checkVisited(int* visited, int hashMask, int id) {
+  int slot = hashNode(id) & hashMask;
+
+  if (visited[slot] == id) {
+    return false;
+  }
+
+  visited[slot] = id;
+  return true;
+}
+
+template <bool IsL2>
+__global__ void
+graphSearch(Tensor<float, 2, true> queries,
+            Tensor<float, 2, true> vecs,
+            Tensor<int, 2, true> graph,
+            int entryPoint,
+            int width,
+            int hashSize,
+            int numSeeds,
+            int maxIterations,
+            Tensor<float, 2, true> outDistances,
+            Tensor<Index::idx_t, 2, true> outIndices) {
+  extern __shared__ char smemByte[];
+
+  int warpId = threadIdx.x / kWarpSize;
+  int laneId = getLaneId();
+  int queryId = blockIdx.x * kGraphSearchWarps + warpId;
+
+  // The block never synchronizes, so whole warps may leave early
+  if (queryId >= queries.getSize(0)) {
+    return;
+  }
+
+  char* warpSmem = smemByte +
+    (size_t) warpId * (width * (sizeof(float) + sizeof(int)) +
+                       hashSize * sizeof(int));
+  float* beamDist = (float*) warpSmem;
+  int* beamId = (int*) (beamDist + width);
+  int* visited = beamId + width;
+
+  int numVecs = vecs.getSize(0);
+  int dim = vecs.getSize(1);
+  int degree = graph.getSize(1);
+  int hashMask = hashSize - 1;
+  const float* query = queries[queryId].data();
+
+  for (int i = laneId; i < width; i += kWarpSize) {
+    beamDist[i] = Limits<float>::getMax();
+    // empty entries are also marked as explored
+    beamId[i] = -1;
+  }
+
+  for (int i = laneId; i < hashSize; i += kWarpSize) {
+    visited[i] = -1;
+  }
+
+  __syncwarp();
+
+  // Seed the beam with the entry point and pseudo-random nodes
+  for (int s = 0; s < numSeeds; ++s) {
+    int id = s == 0 ? entryPoint :
+      (int) (hashNode(queryId * numSeeds + s) % (unsigned int) numVecs);
+
+    bool isNew = false;
+    if (laneId == 0) {
+      isNew = checkVisited(visited, hashMask, id);
+    }
+    isNew = __shfl_sync(0xffffffff, isNew, 0);
+    __syncwarp();
+
+    if (isNew) {
+      float dist = warpDistance<IsL2>(query, vecs[id].data(), dim, laneId);
+      warpBeamInsert(beamDist, beamId, width, dist, id, laneId);
+    }
+  }
+
+  for (int iter = 0; maxIterations <= 0 || iter < maxIterations; ++iter) {
+    // Find the best entry that has not been expanded yet
+    int best = -1;
+
+    for (int s = 0; s < width; s += kWarpSize) {
+      int i = s + laneId;
+      bool cand = (i < width) && (beamId[i] >= 0);
+      unsigned int mask = __ballot_sync(0xffffffff, cand);
+
+      if (mask) {
+        best = s + __ffs(mask) - 1;
+        break;
+      }
+    }
+
+    if (best < 0) {
+      break;
+    }
+
+    int node = beamId[best];
+    __syncwarp();
+
+    if (laneId == 0) {
+      beamId[best] = node | kGraphExplored;
+    }
+
+    __syncwarp();
+
+    // Evaluate the unvisited neighbors, a warp-sized chunk at a time
+    for (int s = 0; s < degree; s += kWarpSize) {
+      int j = s + laneId;
+      int neighbor = (j < degree) ? graph[node][j] : -1;
+
+      bool isNew = (neighbor >= 0) &&
+        checkVisited(visited, hashMask, neighbor);
+      unsigned int mask = __ballot_sync(0xffffffff, isNew);
+      __syncwarp();
+
+      while (mask) {
+        int src = __ffs(mask) - 1;
+        mask &= mask - 1;
+
+        int id = __shfl_sync(0xffffffff, neighbor, src);
+        float dist = warpDistance<IsL2>(query, vecs[id].data(), dim, laneId);
+        warpBeamInsert(beamDist, beamId, width, dist, id, laneId);
+      }
+    }
+  }
+
+  // The beam is sorted; write out its k first entries
+  int k = outDistances.getSize(1);
+
+  for (int i = laneId; i < k; i += kWarpSize) {
+    int id = beamId[i];
+    float dist = beamDist[i];
+
+    if (id == -1) {
+      outDistances[queryId][i] =
+        IsL2 ? Limits<float>::getMax() : -Limits<float>::getMax();
+      outIndices[queryId][i] = -1;
+    } else {
+      outDistances[queryId][i] = IsL2 ? dist : -dist;
+      outIndices[queryId][i] = (Index::idx_t) (id & ~kGraphExplored);
+    }
+  }
+}
+
+} // namespace
+
+GraphIndex::GraphIndex(GpuResources* res,
+                       int dim,
+                       faiss::MetricType metric,
+                       MemorySpace space) :
+    resources_(res),
+    dim_(dim),
+    metric_(metric),
+    space_(space),
+    entryPoint_(0) {
+  FAISS_ASSERT(metric == faiss::METRIC_L2 ||
+               metric == faiss::METRIC_INNER_PRODUCT);
+}
+
+int
+GraphIndex::getSize() const {
+  return vectors_.getSize(0);
+}
+
+int
+GraphIndex::getDim() const {
+  return dim_;
+}
+
+int
+GraphIndex::getDegree() const {
+  return graph_.getSize(1);
+}
+
+void
+GraphIndex::copyFrom(const float* vecs,
+                     const int* graph,
+                     int numVecs,
+                     int degree,
+                     int entryPoint,
+                     cudaStream_t stream) {
+  FAISS_ASSERT(numVecs > 0 && degree > 0);
+  FAISS_ASSERT(entryPoint >= 0 && entryPoint < numVecs);
+
+  // free the old storage first
+  reset();
+
+  Tensor<float, 2, true> hostVecs(const_cast<float*>(vecs), {numVecs, dim_});
+  vectors_ = DeviceTensor<float, 2, true>(
+    resources_,
+    makeSpaceAlloc(AllocType::FlatData, space_, stream),
+    {numVecs, dim_});
+  vectors_.copyFrom(hostVecs, stream);
+
+  Tensor<int, 2, true> hostGraph(const_cast<int*>(graph), {numVecs, degree});
+  graph_ = DeviceTensor<int, 2, true>(
+    resources_,
+    makeSpaceAlloc(AllocType::FlatData, space_, stream),
+    {numVecs, degree});
+  graph_.copyFrom(hostGraph, stream);
+
+  entryPoint_ = entryPoint;
+}
+
+void
+GraphIndex::query(Tensor<float, 2, true>& queries,
+                  int k,
+                  int searchWidth,
+                  int numSeeds,
+                  int maxIterations,
+                  Tensor<float, 2, true>& outDistances,
+                  Tensor<Index::idx_t, 2, true>& outIndices) {
+  FAISS_ASSERT(getSize() > 0);
+  FAISS_ASSERT(queries.getSize(1) == dim_);
+  FAISS_ASSERT(outDistances.getSize(0) == queries.getSize(0));
+  FAISS_ASSERT(outIndices.getSize(0) == queries.getSize(0));
+  FAISS_ASSERT(outDistances.getSize(1) == k);
+  FAISS_ASSERT(outIndices.getSize(1) == k);
+
+  // The beam holds at least k entries, rounded to full warps
+  int width = utils::roundUp(std::max(searchWidth, k), kWarpSize);
+  FAISS_ASSERT(width <= kGraphMaxSearchWidth);
+
+  // Keep the visited table at most half full in the common case
+  int hashSize = utils::nextHighestPowerOf2(width) * 2;
+
+  numSeeds = std::max(1, std::min(numSeeds, getSize()));
+
+  size_t smemPerWarp =
+    width * (sizeof(float) + sizeof(int)) + hashSize * sizeof(int);
+  size_t smem = smemPerWarp * kGraphSearchWarps;
+  FAISS_ASSERT(smem <= getMaxSharedMemPerBlockCurrentDevice());
+
+  auto stream = resources_->getDefaultStreamCurrentDevice();
+
+  auto grid = dim3(utils::divUp(queries.getSize(0), kGraphSearchWarps));
+  auto block = dim3(kWarpSize * kGraphSearchWarps);
+
+  if (metric_ == faiss::METRIC_L2) {
+    graphSearch<true><<<grid, block, smem, stream>>>(
+      queries, vectors_, graph_, entryPoint_, width, hashSize,
+      numSeeds, maxIterations, outDistances, outIndices);
+  } else {
+    graphSearch<false><<<grid, block, smem, stream>>>(
+      queries, vectors_, graph_, entryPoint_, width, hashSize,
+      numSeeds, maxIterations, outDistances, outIndices);
+  }
+
+  CUDA_TEST_ERROR();
+}
+
+void
+GraphIndex::reset() {
+  vectors_ = DeviceTensor<float, 2, true>();
+  graph_ = DeviceTensor<int, 2, true>();
+  entryPoint_ = 0;
+}
+
+} } // namespace
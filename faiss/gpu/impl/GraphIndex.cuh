@@ -0,0 +1,85 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#pragma once
+
+#include <faiss/Index.h>
+#include <faiss/gpu/utils/DeviceTensor.cuh>
+
+namespace faiss { namespace gpu {
+
+class GpuResources;
+
+/// Largest beam (number of candidates kept per query) supported by the
+/// graph search kernel
+constexpr int kGraphMaxSearchWidth = 512;
+
+/// Holder of GPU resources for a fixed-degree proximity graph over float
+/// vectors, searched by a warp-per-query beam search
+class GraphIndex {
+ public:
+  GraphIndex(GpuResources* res,
+             int dim,
+             faiss::MetricType metric,
+             MemorySpace space);
+
+  /// Returns the number of vectors we contain
+  int getSize() const;
+
+  int getDim() const;
+
+  /// Maximum number of out-edges per node
+  int getDegree() const;
+
+  /// Replaces our contents with the given host vectors and graph
+  /// (numVecs x degree neighbor ids, -1 for missing edges)
+  void copyFrom(const float* vecs,
+                const int* graph,
+                int numVecs,
+                int degree,
+                int entryPoint,
+                cudaStream_t stream);
+
+  /// Finds the approximate k nearest neighbors of `queries`, keeping
+  /// `searchWidth` candidates per query and stopping after
+  /// `maxIterations` node expansions (0: until the beam converges)
+  void query(Tensor<float, 2, true>& queries,
+             int k,
+             int searchWidth,
+             int numSeeds,
+             int maxIterations,
+             Tensor<float, 2, true>& outDistances,
+             Tensor<Index::idx_t, 2, true>& outIndices);
+
+  /// Free all storage
+  void reset();
+
+ private:
+  /// Collection of GPU resources that we use
+  GpuResources* resources_;
+
+  /// Dimensionality of our vectors
+  const int dim_;
+
+  /// Metric used to compare vectors
+  const faiss::MetricType metric_;
+
+  /// Memory space for our allocations
+  const MemorySpace space_;
+
+  /// Where every search starts
+  int entryPoint_;
+
+  /// The database vectors, numVecs x dim
+  DeviceTensor<float, 2, true> vectors_;
+
+  /// The out-edges of each vector, numVecs x degree
+  DeviceTensor<int, 2, true> graph_;
+};
+
+} } // namespace
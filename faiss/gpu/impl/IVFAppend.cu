@@ -8,13 +8,159 @@
 
 #include <faiss/gpu/impl/IVFAppend.cuh>
 #include <faiss/impl/FaissAssert.h>
+#include <faiss/gpu/GpuResources.h>
+#include <faiss/gpu/utils/ConversionOperators.cuh>
 #include <faiss/gpu/utils/Float16.cuh>
+#include <faiss/gpu/utils/DeviceTensor.cuh>
+#include <faiss/gpu/utils/DeviceDefs.cuh>
 #include <faiss/gpu/utils/DeviceUtils.h>
+#include <faiss/gpu/utils/Limits.cuh>
 #include <faiss/gpu/utils/Tensor.cuh>
 #include <faiss/gpu/utils/StaticUtils.h>
+#include <faiss/gpu/utils/WarpShuffles.cuh>
+#include <cub/cub.cuh>
 
 namespace faiss { namespace gpu {
 
+//
+// IVF list offset calculation
+//
+
+__global__ void
+ivfListHistogram(Tensor<int, 1, true> listIds,
+                 Tensor<int, 1, true> vecIds,
+                 Tensor<int, 1, true> listAddCounts) {
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+
+  if (i < listIds.getSize(0)) {
+    vecIds[i] = i;
+
+    int listId = listIds[i];
+
+    // Add vector could be invalid (contains NaNs etc)
+    if (listId >= 0) {
+      atomicAdd(listAddCounts[listId].data(), 1);
+    }
+  }
+}
+
+__global__ void
+ivfListOffsets(Tensor<int, 1, true> sortedListIds,
+               Tensor<int, 1, true> sortedVecIds,
+               Tensor<int, 1, true> listAddCounts,
+               Tensor<int, 1, true> listAddEnd,
+               int* listLengths,
+               Tensor<int, 1, true> listOffset) {
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+
+  if (i >= sortedListIds.getSize(0)) {
+    return;
+  }
+
+  int listId = sortedListIds[i];
+  int vec = sortedVecIds[i];
+
+  if (listId < 0) {
+    listOffset[vec] = -1;
+    return;
+  }
+
+  // The invalid vectors sort first, so the vectors of listId end at this
+  // position in sorted order
+  int numLists = listAddEnd.getSize(0);
+  int end = sortedListIds.getSize(0) -
+    (listAddEnd[numLists - 1] - listAddEnd[listId]);
+
+  listOffset[vec] = listLengths[listId] + listAddCounts[listId] - (end - i);
+}
+
+void
+runCalcListOffsets(GpuResources* res,
+                   Tensor<int, 1, true>& listIds,
+                   thrust::device_vector<int>& listLengths,
+                   Tensor<int, 1, true>& listOffset,
+                   Tensor<int, 1, true>& listAddCounts,
+                   cudaStream_t stream) {
+  FAISS_ASSERT(listIds.getSize(0) == listOffset.getSize(0));
+  FAISS_ASSERT(listAddCounts.getSize(0) == listLengths.size());
+
+  int num = listIds.getSize(0);
+  int numLists = listAddCounts.getSize(0);
+
+  CUDA_VERIFY(cudaMemsetAsync(listAddCounts.data(), 0,
+                              listAddCounts.getSizeInBytes(), stream));
+
+  if (num == 0) {
+    return;
+  }
+
+  int numThreads = std::min(num, getMaxThreadsCurrentDevice());
+  int numBlocks = utils::divUp(num, numThreads);
+
+  DeviceTensor<int, 1, true> vecIds(
+    res, makeTempAlloc(AllocType::Other, stream), {num});
+
+  ivfListHistogram<<<numBlocks, numThreads, 0, stream>>>(
+    listIds, vecIds, listAddCounts);
+
+  // A stable sort of the vectors by list keeps the vectors of a list in
+  // their order in the batch, as they would be appended one at a time
+  DeviceTensor<int, 1, true> sortedListIds(
+    res, makeTempAlloc(AllocType::Other, stream), {num});
+  DeviceTensor<int, 1, true> sortedVecIds(
+    res, makeTempAlloc(AllocType::Other, stream), {num});
+  DeviceTensor<int, 1, true> listAddEnd(
+    res, makeTempAlloc(AllocType::Other, stream), {numLists});
+
+  size_t sortTempBytes = 0;
+  CUDA_VERIFY(cub::DeviceRadixSort::SortPairs(nullptr,
+                                              sortTempBytes,
+                                              listIds.data(),
+                                              sortedListIds.data(),
+                                              vecIds.data(),
+                                              sortedVecIds.data(),
+                                              num,
+                                              0,
+                                              sizeof(int) * 8,
+                                              stream));
+
+  size_t scanTempBytes = 0;
+  CUDA_VERIFY(cub::DeviceScan::InclusiveSum(nullptr,
+                                            scanTempBytes,
+                                            listAddCounts.data(),
+                                            listAddEnd.data(),
+                                            numLists,
+                                            stream));
+
+  DeviceTensor<char, 1, true> cubTemp(
+    res, makeTempAlloc(AllocType::Other, stream),
+    {(int) std::max(sortTempBytes, scanTempBytes)});
+
+  CUDA_VERIFY(cub::DeviceRadixSort::SortPairs(cubTemp.data(),
+                                              sortTempBytes,
+                                              listIds.data(),
+                                              sortedListIds.data(),
+                                              vecIds.data(),
+                                              sortedVecIds.data(),
+                                              num,
+                                              0,
+                                              sizeof(int) * 8,
+                                              stream));
+
+  CUDA_VERIFY(cub::DeviceScan::InclusiveSum(cubTemp.data(),
+                                            scanTempBytes,
+                                            listAddCounts.data(),
+                                            listAddEnd.data(),
+                                            numLists,
+                                            stream));
+
+  ivfListOffsets<<<numBlocks, numThreads, 0, stream>>>(
+    sortedListIds, sortedVecIds, listAddCounts, listAddEnd,
+    listLengths.data().get(), listOffset);
+
+  CUDA_TEST_ERROR();
+}
+
 //
 // IVF list length update
 //
@@ -65,6 +211,7 @@ runUpdateListPointers(Tensor<int, 1, true>& listIds,
 // IVF PQ append
 //
 
+template <typename CodeT>
 __global__ void
 ivfpqInvertedListAppend(Tensor<int, 1, true> listIds,
                         Tensor<int, 1, true> listOffset,
@@ -107,20 +254,20 @@ ivfpqInvertedListAppend(Tensor<int, 1, true> listIds,
     int blockStart = (vectorNumInList / 32) * fullBlockSize;
     int start = blockStart + (vectorNumInList % 32);
 
-    uint8_t* codeStart = ((uint8_t*) listCodes[listId]) + start;
+    CodeT* codeStart = ((CodeT*) listCodes[listId]) + start;
 
     for (int i = 0; i < encodings.getSize(1); ++i) {
-      codeStart[i * 32] = (uint8_t) encoding[i];
+      codeStart[i * 32] = (CodeT) encoding[i];
     }
   } else {
     // Layout with dimensions innermost
-    uint8_t* codeStart =
-      ((uint8_t*) listCodes[listId]) +
+    CodeT* codeStart =
+      ((CodeT*) listCodes[listId]) +
       vectorNumInList * encodings.getSize(1);
 
     // FIXME: slow
     for (int i = 0; i < encodings.getSize(1); ++i) {
-      codeStart[i] = (uint8_t) encoding[i];
+      codeStart[i] = (CodeT) encoding[i];
     }
   }
 }
@@ -131,6 +278,7 @@ runIVFPQInvertedListAppend(Tensor<int, 1, true>& listIds,
                            Tensor<int, 2, true>& encodings,
                            Tensor<Index::idx_t, 1, true>& indices,
                            bool layoutBy32,
+                           int bytesPerCode,
                            thrust::device_vector<void*>& listCodes,
                            thrust::device_vector<void*>& listIndices,
                            IndicesOptions indicesOptions,
@@ -146,15 +294,374 @@ runIVFPQInvertedListAppend(Tensor<int, 1, true>& listIds,
                indicesOptions == INDICES_32_BIT ||
                indicesOptions == INDICES_64_BIT);
 
-  ivfpqInvertedListAppend<<<grid, block, 0, stream>>>(
+  FAISS_ASSERT(bytesPerCode == 1 || bytesPerCode == 2);
+
+  if (bytesPerCode == 1) {
+    ivfpqInvertedListAppend<uint8_t><<<grid, block, 0, stream>>>(
+      listIds, listOffset, encodings, indices,
+      indicesOptions, layoutBy32,
+      listCodes.data().get(),
+      listIndices.data().get());
+  } else {
+    ivfpqInvertedListAppend<uint16_t><<<grid, block, 0, stream>>>(
+      listIds, listOffset, encodings, indices,
+      indicesOptions, layoutBy32,
+      listCodes.data().get(),
+      listIndices.data().get());
+  }
+
+  CUDA_TEST_ERROR();
+}
+
+//
+// IVFPQ fast-scan append
+//
+
+// Writes the 4-bit code of sub-quantizer sq of vector vectorNumInList of a
+// list in the fast-scan block layout
+__device__ inline void
+writeFastScanCode(void* listCodes,
+                  int vectorNumInList,
+                  int numSubQuantizersPadded,
+                  int sq,
+                  unsigned int code) {
+  // See pq4_fast_scan.h: for each pair of sub-quantizers, a block of 32
+  // vectors has 32 bytes; vector v of the block is at byte 2 (v % 8) +
+  // (v % 16) / 8 of each 16-byte half, in the high nibble if v >= 16
+  int blockSize = numSubQuantizersPadded * 16;
+  int v = vectorNumInList % 32;
+  int byteInHalf = 2 * (v % 8) + (v % 16) / 8;
+  int shift = v >= 16 ? 4 : 0;
+
+  uint8_t* blockStart =
+    ((uint8_t*) listCodes) + (vectorNumInList / 32) * blockSize;
+
+  // Another thread may be writing the other nibble of the byte, so the
+  // nibble is updated with atomics on its (aligned) word
+  int byteOffset = (sq / 2) * 32 + (sq % 2) * 16 + byteInHalf;
+  auto word = (unsigned int*) (blockStart + (byteOffset & ~3));
+  int bitShift = (byteOffset & 3) * 8 + shift;
+
+  atomicAnd(word, ~(0xfU << bitShift));
+  atomicOr(word, (code & 0xfU) << bitShift);
+}
+
+__global__ void
+ivfpqFastScanInvertedListAppend(Tensor<int, 1, true> listIds,
+                                Tensor<int, 1, true> listOffset,
+                                Tensor<int, 2, true> encodings,
+                                Tensor<Index::idx_t, 1, true> indices,
+                                int numSubQuantizersPadded,
+                                IndicesOptions opt,
+                                void** listCodes,
+                                void** listIndices) {
+  int encodingToAdd = blockIdx.x * blockDim.x + threadIdx.x;
+
+  if (encodingToAdd >= listIds.getSize(0)) {
+    return;
+  }
+
+  int listId = listIds[encodingToAdd];
+  int vectorNumInList = listOffset[encodingToAdd];
+
+  // Add vector could be invalid (contains NaNs etc)
+  if (listId == -1 || vectorNumInList == -1) {
+    return;
+  }
+
+  auto encoding = encodings[encodingToAdd];
+  auto index = indices[encodingToAdd];
+
+  if (opt == INDICES_32_BIT) {
+    // FIXME: there could be overflow here, but where should we check this?
+    ((int*) listIndices[listId])[vectorNumInList] = (int) index;
+  } else if (opt == INDICES_64_BIT) {
+    ((Index::idx_t*) listIndices[listId])[vectorNumInList] = index;
+  } else {
+    // INDICES_CPU or INDICES_IVF; no indices are being stored
+  }
+
+  for (int sq = 0; sq < numSubQuantizersPadded; ++sq) {
+    unsigned int code = sq < encodings.getSize(1) ? encoding[sq] : 0;
+
+    writeFastScanCode(listCodes[listId], vectorNumInList,
+                      numSubQuantizersPadded, sq, code);
+  }
+}
+
+void
+runIVFPQFastScanInvertedListAppend(Tensor<int, 1, true>& listIds,
+                                   Tensor<int, 1, true>& listOffset,
+                                   Tensor<int, 2, true>& encodings,
+                                   Tensor<Index::idx_t, 1, true>& indices,
+                                   int numSubQuantizersPadded,
+                                   thrust::device_vector<void*>& listCodes,
+                                   thrust::device_vector<void*>& listIndices,
+                                   IndicesOptions indicesOptions,
+                                   cudaStream_t stream) {
+  int numThreads = std::min(listIds.getSize(0), getMaxThreadsCurrentDevice());
+  int numBlocks = utils::divUp(listIds.getSize(0), numThreads);
+
+  dim3 grid(numBlocks);
+  dim3 block(numThreads);
+
+  FAISS_ASSERT(indicesOptions == INDICES_CPU ||
+               indicesOptions == INDICES_IVF ||
+               indicesOptions == INDICES_32_BIT ||
+               indicesOptions == INDICES_64_BIT);
+  FAISS_ASSERT(numSubQuantizersPadded % 2 == 0);
+
+  ivfpqFastScanInvertedListAppend<<<grid, block, 0, stream>>>(
     listIds, listOffset, encodings, indices,
-    indicesOptions, layoutBy32,
+    numSubQuantizersPadded, indicesOptions,
     listCodes.data().get(),
     listIndices.data().get());
 
   CUDA_TEST_ERROR();
 }
 
+//
+// IVFPQ fused residual, encoding and append
+//
+
+// Vectors encoded by a block, for one sub-quantizer
+constexpr int kEncodeAppendTile = 32;
+
+// Stride of the codes in the shared memory codebook; odd to avoid bank
+// conflicts between the lanes, that each handle a different code
+__host__ __device__ inline int
+encodeAppendCodeStride(int dimPerSubQuantizer) {
+  return dimPerSubQuantizer | 1;
+}
+
+// Block (x, y) encodes sub-quantizer y of the tile x of kEncodeAppendTile
+// vectors: the codebook of the sub-quantizer and the residual slices of
+// the tile are staged in shared memory, then each warp finds the nearest
+// code for one vector at a time (a lane per code) and writes it to the
+// list. numSubQuantizersPadded is > 0 for the fast-scan layout.
+template <typename CentroidT, typename CodeT>
+__global__ void
+ivfpqEncodeAppend(Tensor<float, 2, true> vecs,
+                  Tensor<CentroidT, 2, true> coarseCentroids,
+                  Tensor<float, 3, true> pqCentroids,
+                  Tensor<int, 1, true> listIds,
+                  Tensor<int, 1, true> listOffset,
+                  Tensor<Index::idx_t, 1, true> indices,
+                  IndicesOptions opt,
+                  bool layoutBy32,
+                  int numSubQuantizersPadded,
+                  void** listCodes,
+                  void** listIndices) {
+  extern __shared__ float smem[];
+
+  int sq = blockIdx.y;
+  int numSubQuantizers = pqCentroids.getSize(0);
+  int numCodes = pqCentroids.getSize(1);
+  int dimPerSubQ = pqCentroids.getSize(2);
+  int stride = encodeAppendCodeStride(dimPerSubQ);
+
+  float* smemCodes = smem;
+  float* smemResiduals = smem + numCodes * stride;
+
+  int vec0 = blockIdx.x * kEncodeAppendTile;
+  int numTile = min(kEncodeAppendTile, vecs.getSize(0) - vec0);
+  int dim0 = sq * dimPerSubQ;
+
+  for (int i = threadIdx.x; i < numCodes * dimPerSubQ; i += blockDim.x) {
+    int c = i / dimPerSubQ;
+    int j = i % dimPerSubQ;
+    smemCodes[c * stride + j] = pqCentroids[sq][c][j];
+  }
+
+  for (int i = threadIdx.x; i < numTile * dimPerSubQ; i += blockDim.x) {
+    int vec = vec0 + i / dimPerSubQ;
+    int j = dim0 + i % dimPerSubQ;
+    int listId = listIds[vec];
+
+    smemResiduals[i] = listId == -1 ? 0.0f :
+      vecs[vec][j] - ConvertTo<float>::to(coarseCentroids[listId][j]);
+  }
+
+  __syncthreads();
+
+  int warpId = threadIdx.x / kWarpSize;
+  int laneId = threadIdx.x % kWarpSize;
+  int numWarps = blockDim.x / kWarpSize;
+
+  for (int t = warpId; t < numTile; t += numWarps) {
+    int vec = vec0 + t;
+    int listId = listIds[vec];
+    int vectorNumInList = listOffset[vec];
+
+    // Add vector could be invalid (contains NaNs etc)
+    if (listId == -1 || vectorNumInList == -1) {
+      continue;
+    }
+
+    const float* residual = smemResiduals + t * dimPerSubQ;
+    float bestDist = Limits<float>::getMax();
+    int bestCode = numCodes;
+
+    for (int c = laneId; c < numCodes; c += kWarpSize) {
+      const float* code = smemCodes + c * stride;
+      float dist = 0;
+
+      for (int j = 0; j < dimPerSubQ; ++j) {
+        float diff = residual[j] - code[j];
+        dist += diff * diff;
+      }
+
+      if (dist < bestDist) {
+        bestDist = dist;
+        bestCode = c;
+      }
+    }
+
+    // Warp argmin, the smallest code wins ties
+    for (int mask = kWarpSize / 2; mask > 0; mask /= 2) {
+      float otherDist = shfl_xor(bestDist, mask);
+      int otherCode = shfl_xor(bestCode, mask);
+
+      if (otherDist < bestDist ||
+          (otherDist == bestDist && otherCode < bestCode)) {
+        bestDist = otherDist;
+        bestCode = otherCode;
+      }
+    }
+
+    if (laneId != 0) {
+      continue;
+    }
+
+    if (sq == 0) {
+      auto index = indices[vec];
+
+      if (opt == INDICES_32_BIT) {
+        ((int*) listIndices[listId])[vectorNumInList] = (int) index;
+      } else if (opt == INDICES_64_BIT) {
+        ((Index::idx_t*) listIndices[listId])[vectorNumInList] = index;
+      }
+    }
+
+    if (numSubQuantizersPadded > 0) {
+      writeFastScanCode(listCodes[listId], vectorNumInList,
+                        numSubQuantizersPadded, sq, bestCode);
+
+      // The padding sub-quantizers have code 0
+      if (sq == numSubQuantizers - 1) {
+        for (int p = numSubQuantizers; p < numSubQuantizersPadded; ++p) {
+          writeFastScanCode(listCodes[listId], vectorNumInList,
+                            numSubQuantizersPadded, p, 0);
+        }
+      }
+    } else if (layoutBy32) {
+      int blockStart = (vectorNumInList / 32) * 32 * numSubQuantizers;
+      ((CodeT*) listCodes[listId])[
+        blockStart + sq * 32 + vectorNumInList % 32] = (CodeT) bestCode;
+    } else {
+      ((CodeT*) listCodes[listId])[
+        vectorNumInList * numSubQuantizers + sq] = (CodeT) bestCode;
+    }
+  }
+}
+
+size_t
+getIVFPQEncodeAppendSharedMem(int numSubQuantizerCodes,
+                              int dimPerSubQuantizer) {
+  return ((size_t) numSubQuantizerCodes *
+          encodeAppendCodeStride(dimPerSubQuantizer) +
+          (size_t) kEncodeAppendTile * dimPerSubQuantizer) * sizeof(float);
+}
+
+template <typename CentroidT>
+void
+runIVFPQEncodeAppendT(Tensor<float, 2, true>& vecs,
+                      Tensor<CentroidT, 2, true>& coarseCentroids,
+                      Tensor<float, 3, true>& pqCentroids,
+                      Tensor<int, 1, true>& listIds,
+                      Tensor<int, 1, true>& listOffset,
+                      Tensor<Index::idx_t, 1, true>& indices,
+                      bool layoutBy32,
+                      int numSubQuantizersPadded,
+                      int bytesPerCode,
+                      thrust::device_vector<void*>& listCodes,
+                      thrust::device_vector<void*>& listIndices,
+                      IndicesOptions indicesOptions,
+                      cudaStream_t stream) {
+  FAISS_ASSERT(indicesOptions == INDICES_CPU ||
+               indicesOptions == INDICES_IVF ||
+               indicesOptions == INDICES_32_BIT ||
+               indicesOptions == INDICES_64_BIT);
+  FAISS_ASSERT(bytesPerCode == 1 || bytesPerCode == 2);
+  FAISS_ASSERT(numSubQuantizersPadded % 2 == 0);
+  FAISS_ASSERT(vecs.getSize(1) ==
+               pqCentroids.getSize(0) * pqCentroids.getSize(2));
+
+  size_t smem = getIVFPQEncodeAppendSharedMem(pqCentroids.getSize(1),
+                                              pqCentroids.getSize(2));
+  FAISS_ASSERT(smem <= getMaxSharedMemPerBlockCurrentDevice());
+
+  dim3 grid(utils::divUp(vecs.getSize(0), kEncodeAppendTile),
+            pqCentroids.getSize(0));
+  dim3 block(kWarpSize * 4);
+
+  if (bytesPerCode == 1) {
+    ivfpqEncodeAppend<CentroidT, uint8_t><<<grid, block, smem, stream>>>(
+      vecs, coarseCentroids, pqCentroids, listIds, listOffset, indices,
+      indicesOptions, layoutBy32, numSubQuantizersPadded,
+      listCodes.data().get(),
+      listIndices.data().get());
+  } else {
+    ivfpqEncodeAppend<CentroidT, uint16_t><<<grid, block, smem, stream>>>(
+      vecs, coarseCentroids, pqCentroids, listIds, listOffset, indices,
+      indicesOptions, layoutBy32, numSubQuantizersPadded,
+      listCodes.data().get(),
+      listIndices.data().get());
+  }
+
+  CUDA_TEST_ERROR();
+}
+
+void
+runIVFPQEncodeAppend(Tensor<float, 2, true>& vecs,
+                     Tensor<float, 2, true>& coarseCentroids,
+                     Tensor<float, 3, true>& pqCentroids,
+                     Tensor<int, 1, true>& listIds,
+                     Tensor<int, 1, true>& listOffset,
+                     Tensor<Index::idx_t, 1, true>& indices,
+                     bool layoutBy32,
+                     int numSubQuantizersPadded,
+                     int bytesPerCode,
+                     thrust::device_vector<void*>& listCodes,
+                     thrust::device_vector<void*>& listIndices,
+                     IndicesOptions indicesOptions,
+                     cudaStream_t stream) {
+  runIVFPQEncodeAppendT<float>(
+    vecs, coarseCentroids, pqCentroids, listIds, listOffset, indices,
+    layoutBy32, numSubQuantizersPadded, bytesPerCode,
+    listCodes, listIndices, indicesOptions, stream);
+}
+
+void
+runIVFPQEncodeAppend(Tensor<float, 2, true>& vecs,
+                     Tensor<half, 2, true>& coarseCentroids,
+                     Tensor<float, 3, true>& pqCentroids,
+                     Tensor<int, 1, true>& listIds,
+                     Tensor<int, 1, true>& listOffset,
+                     Tensor<Index::idx_t, 1, true>& indices,
+                     bool layoutBy32,
+                     int numSubQuantizersPadded,
+                     int bytesPerCode,
+                     thrust::device_vector<void*>& listCodes,
+                     thrust::device_vector<void*>& listIndices,
+                     IndicesOptions indicesOptions,
+                     cudaStream_t stream) {
+  runIVFPQEncodeAppendT<half>(
+    vecs, coarseCentroids, pqCentroids, listIds, listOffset, indices,
+    layoutBy32, numSubQuantizersPadded, bytesPerCode,
+    listCodes, listIndices, indicesOptions, stream);
+}
+
 //
 // IVF flat append
 //
@@ -257,6 +764,7 @@ runIVFFlatInvertedListAppend(Tensor<int, 1, true>& listIds,
                              thrust::device_vector<void*>& listData,
                              thrust::device_vector<void*>& listIndices,
                              IndicesOptions indicesOptions,
+                             bool interleavedLayout,
                              cudaStream_t stream) {
   int dim = vecs.getSize(1);
   int maxThreads = getMaxThreadsCurrentDevice();
@@ -273,11 +781,14 @@ runIVFFlatInvertedListAppend(Tensor<int, 1, true>& listIds,
       listIndices.data().get());
   }
 
+  // Size of an encoded vector in the row-major layout
+  int codeSize = scalarQ ? scalarQ->code_size : dim * sizeof(float);
+
   // Each block will handle appending a single vector
-#define RUN_APPEND                                                      \
+#define LAUNCH_APPEND(CODEC)                                            \
   do {                                                                  \
     dim3 grid(vecs.getSize(0));                                         \
-    dim3 block(std::min(dim / codec.kDimPerIter, maxThreads));          \
+    dim3 block(std::min(dim / CODEC.kDimPerIter, maxThreads));          \
                                                                         \
     ivfFlatInvertedListAppend                                           \
       <<<grid, block, 0, stream>>>(                                     \
@@ -285,7 +796,18 @@ runIVFFlatInvertedListAppend(Tensor<int, 1, true>& listIds,
         listOffset,                                                     \
         useResidual ? residuals : vecs,                                 \
         listData.data().get(),                                          \
-        codec);                                                         \
+        CODEC);                                                         \
+  } while (0)
+
+#define RUN_APPEND                                                      \
+  do {                                                                  \
+    if (interleavedLayout) {                                            \
+      auto icodec = makeInterleavedCodec(                               \
+        codec, getCodecUnitBytes(scalarQ), codeSize);                   \
+      LAUNCH_APPEND(icodec);                                            \
+    } else {                                                            \
+      LAUNCH_APPEND(codec);                                             \
+    }                                                                   \
   } while (0)
 
   if (!scalarQ) {
@@ -362,6 +884,15 @@ runIVFFlatInvertedListAppend(Tensor<int, 1, true>& listIds,
         RUN_APPEND;
       }
       break;
+      case ScalarQuantizer::QuantizerType::QT_6bit:
+      {
+        Codec<ScalarQuantizer::QuantizerType::QT_6bit, 1>
+          codec(scalarQ->code_size,
+                scalarQ->gpuTrained.data(),
+                scalarQ->gpuTrained.data() + dim);
+        RUN_APPEND;
+      }
+      break;
       default:
         // unimplemented, should be handled at a higher level
         FAISS_ASSERT(false);
@@ -371,6 +902,151 @@ runIVFFlatInvertedListAppend(Tensor<int, 1, true>& listIds,
   CUDA_TEST_ERROR();
 
 #undef RUN_APPEND
+#undef LAUNCH_APPEND
+}
+
+//
+// IVF binary append
+//
+
+__global__ void
+ivfBinaryInvertedListAppend(Tensor<int, 1, true> listIds,
+                            Tensor<int, 1, true> listOffset,
+                            Tensor<unsigned char, 2, true> vecs,
+                            void** listData) {
+  int vec = blockIdx.x;
+
+  int listId = listIds[vec];
+  int offset = listOffset[vec];
+
+  // Add vector could be invalid (no list assigned)
+  if (listId == -1 || offset == -1) {
+    return;
+  }
+
+  int codeSize = vecs.getSize(1);
+  unsigned char* codeStart =
+    ((unsigned char*) listData[listId]) + (size_t) offset * codeSize;
+
+  for (int i = threadIdx.x; i < codeSize; i += blockDim.x) {
+    codeStart[i] = vecs[vec][i];
+  }
+}
+
+void
+runIVFBinaryInvertedListAppend(Tensor<int, 1, true>& listIds,
+                               Tensor<int, 1, true>& listOffset,
+                               Tensor<unsigned char, 2, true>& vecs,
+                               Tensor<Index::idx_t, 1, true>& indices,
+                               thrust::device_vector<void*>& listData,
+                               thrust::device_vector<void*>& listIndices,
+                               IndicesOptions indicesOptions,
+                               cudaStream_t stream) {
+  int maxThreads = getMaxThreadsCurrentDevice();
+
+  // The indices are appended in the same way as for IVF flat
+  if (indicesOptions != INDICES_CPU && indicesOptions != INDICES_IVF) {
+    int blocks = utils::divUp(vecs.getSize(0), maxThreads);
+
+    ivfFlatIndicesAppend<<<blocks, maxThreads, 0, stream>>>(
+      listIds,
+      listOffset,
+      indices,
+      indicesOptions,
+      listIndices.data().get());
+  }
+
+  // Each block will handle appending a single code
+  dim3 grid(vecs.getSize(0));
+  dim3 block(std::min(vecs.getSize(1), maxThreads));
+
+  ivfBinaryInvertedListAppend<<<grid, block, 0, stream>>>(
+    listIds,
+    listOffset,
+    vecs,
+    listData.data().get());
+
+  CUDA_TEST_ERROR();
+}
+
+//
+// IVF list entry moves, for removals
+//
+
+__global__ void
+ivfMoveListEntries(Tensor<int, 1, true> moveListIds,
+                   Tensor<int, 1, true> moveFrom,
+                   Tensor<int, 1, true> moveTo,
+                   IVFListCodeLayout layout,
+                   void** listCodes,
+                   void** listIndices,
+                   IndicesOptions opt) {
+  int move = blockIdx.x;
+
+  int listId = moveListIds[move];
+  int from = moveFrom[move];
+  int to = moveTo[move];
+
+  uint8_t* codes = (uint8_t*) listCodes[listId];
+
+  size_t unitStride = (size_t) layout.groupSize * layout.unitBytes;
+  size_t groupBytes = unitStride * layout.numUnits;
+
+  size_t fromStart = (size_t) (from / layout.groupSize) * groupBytes +
+    (size_t) (from % layout.groupSize) * layout.unitBytes;
+  size_t toStart = (size_t) (to / layout.groupSize) * groupBytes +
+    (size_t) (to % layout.groupSize) * layout.unitBytes;
+
+  int codeBytes = layout.numUnits * layout.unitBytes;
+
+  for (int i = threadIdx.x; i < codeBytes; i += blockDim.x) {
+    size_t unitOffset = (size_t) (i / layout.unitBytes) * unitStride +
+      i % layout.unitBytes;
+
+    codes[toStart + unitOffset] = codes[fromStart + unitOffset];
+  }
+
+  if (threadIdx.x == 0) {
+    if (opt == INDICES_32_BIT) {
+      int* indices = (int*) listIndices[listId];
+      indices[to] = indices[from];
+    } else if (opt == INDICES_64_BIT) {
+      Index::idx_t* indices = (Index::idx_t*) listIndices[listId];
+      indices[to] = indices[from];
+    }
+  }
+}
+
+void
+runIVFMoveListEntries(Tensor<int, 1, true>& moveListIds,
+                      Tensor<int, 1, true>& moveFrom,
+                      Tensor<int, 1, true>& moveTo,
+                      IVFListCodeLayout layout,
+                      thrust::device_vector<void*>& listCodes,
+                      thrust::device_vector<void*>& listIndices,
+                      IndicesOptions indicesOptions,
+                      cudaStream_t stream) {
+  int numMoves = moveListIds.getSize(0);
+
+  if (numMoves == 0) {
+    return;
+  }
+
+  // Each block moves a single entry
+  dim3 grid(numMoves);
+  dim3 block(std::min(layout.numUnits * layout.unitBytes,
+                      getMaxThreadsCurrentDevice()));
+
+  ivfMoveListEntries<<<grid, block, 0, stream>>>(
+    moveListIds,
+    moveFrom,
+    moveTo,
+    layout,
+    listCodes.data().get(),
+    listIndices.data().get(),
+    indicesOptions);
+
+  CUDA_TEST_ERROR();
 }
 
 } } // namespace
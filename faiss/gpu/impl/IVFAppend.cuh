@@ -15,6 +15,20 @@
 
 namespace faiss { namespace gpu {
 
+class GpuResources;
+
+/// For a batch of vectors to add with their list assignment (-1 for vectors
+/// that cannot be added), computes on the device the number of vectors added
+/// to each list (listAddCounts, one entry per list) and the offset of each
+/// vector in its list (listOffset, -1 if not added). Vectors are appended
+/// after the current listLengths, in their order in the batch
+void runCalcListOffsets(GpuResources* res,
+                        Tensor<int, 1, true>& listIds,
+                        thrust::device_vector<int>& listLengths,
+                        Tensor<int, 1, true>& listOffset,
+                        Tensor<int, 1, true>& listAddCounts,
+                        cudaStream_t stream);
+
 /// Update device-side list pointers in a batch
 void runUpdateListPointers(Tensor<int, 1, true>& listIds,
                            Tensor<int, 1, true>& newListLength,
@@ -27,17 +41,72 @@ void runUpdateListPointers(Tensor<int, 1, true>& listIds,
 
 /// Actually append the new codes / vector indices to the individual lists
 
-/// IVFPQ
+/// IVFPQ; each sub-quantizer code is stored in bytesPerCode (1 or 2) bytes
 void runIVFPQInvertedListAppend(Tensor<int, 1, true>& listIds,
                                 Tensor<int, 1, true>& listOffset,
                                 Tensor<int, 2, true>& encodings,
                                 Tensor<Index::idx_t, 1, true>& indices,
                                 bool layoutBy32,
+                                int bytesPerCode,
                                 thrust::device_vector<void*>& listCodes,
                                 thrust::device_vector<void*>& listIndices,
                                 IndicesOptions indicesOptions,
                                 cudaStream_t stream);
 
+/// IVFPQ with 4-bit codes in the fast-scan block layout; the encodings are
+/// numSubQuantizers wide and are padded with 0 codes to numSubQuantizersPadded
+void runIVFPQFastScanInvertedListAppend(
+  Tensor<int, 1, true>& listIds,
+  Tensor<int, 1, true>& listOffset,
+  Tensor<int, 2, true>& encodings,
+  Tensor<Index::idx_t, 1, true>& indices,
+  int numSubQuantizersPadded,
+  thrust::device_vector<void*>& listCodes,
+  thrust::device_vector<void*>& listIndices,
+  IndicesOptions indicesOptions,
+  cudaStream_t stream);
+
+/// Shared memory needed by runIVFPQEncodeAppend for a codebook of
+/// numSubQuantizerCodes codes of dimPerSubQuantizer
+size_t getIVFPQEncodeAppendSharedMem(int numSubQuantizerCodes,
+                                     int dimPerSubQuantizer);
+
+/// IVFPQ; computes the residuals of vecs with respect to the coarse
+/// centroids of their lists, encodes them with the PQ codebooks
+/// pqCentroids (numSubQuantizers x numSubQuantizerCodes x
+/// dimPerSubQuantizer) and appends the codes and indices to the lists, in
+/// one kernel without materializing the residuals or the encodings. The
+/// codebook of a sub-quantizer must fit in shared memory (see
+/// getIVFPQEncodeAppendSharedMem). numSubQuantizersPadded is > 0 for the
+/// fast-scan layout (see runIVFPQFastScanInvertedListAppend)
+void runIVFPQEncodeAppend(Tensor<float, 2, true>& vecs,
+                          Tensor<float, 2, true>& coarseCentroids,
+                          Tensor<float, 3, true>& pqCentroids,
+                          Tensor<int, 1, true>& listIds,
+                          Tensor<int, 1, true>& listOffset,
+                          Tensor<Index::idx_t, 1, true>& indices,
+                          bool layoutBy32,
+                          int numSubQuantizersPadded,
+                          int bytesPerCode,
+                          thrust::device_vector<void*>& listCodes,
+                          thrust::device_vector<void*>& listIndices,
+                          IndicesOptions indicesOptions,
+                          cudaStream_t stream);
+
+void runIVFPQEncodeAppend(Tensor<float, 2, true>& vecs,
+                          Tensor<half, 2, true>& coarseCentroids,
+                          Tensor<float, 3, true>& pqCentroids,
+                          Tensor<int, 1, true>& listIds,
+                          Tensor<int, 1, true>& listOffset,
+                          Tensor<Index::idx_t, 1, true>& indices,
+                          bool layoutBy32,
+                          int numSubQuantizersPadded,
+                          int bytesPerCode,
+                          thrust::device_vector<void*>& listCodes,
+                          thrust::device_vector<void*>& listIndices,
+                          IndicesOptions indicesOptions,
+                          cudaStream_t stream);
+
 /// IVF flat storage
 void runIVFFlatInvertedListAppend(Tensor<int, 1, true>& listIds,
                                   Tensor<int, 1, true>& listOffset,
@@ -49,6 +118,42 @@ void runIVFFlatInvertedListAppend(Tensor<int, 1, true>& listIds,
                                   thrust::device_vector<void*>& listData,
                                   thrust::device_vector<void*>& listIndices,
                                   IndicesOptions indicesOptions,
+                                  /// codes stored in the interleaved layout
+                                  /// (see InterleavedCodec)
+                                  bool interleavedLayout,
                                   cudaStream_t stream);
 
+/// IVF binary storage (codes appended as-is)
+void runIVFBinaryInvertedListAppend(Tensor<int, 1, true>& listIds,
+                                    Tensor<int, 1, true>& listOffset,
+                                    Tensor<unsigned char, 2, true>& vecs,
+                                    Tensor<Index::idx_t, 1, true>& indices,
+                                    thrust::device_vector<void*>& listData,
+                                    thrust::device_vector<void*>& listIndices,
+                                    IndicesOptions indicesOptions,
+                                    cudaStream_t stream);
+
+/// Layout of the encoded vectors in the IVF lists, for moving list entries.
+/// The vectors are stored by groups of groupSize (1 for a row-major
+/// layout); within a group, unit u of vector v is at
+/// (u * groupSize + v) * unitBytes, and each vector is made of numUnits
+/// units
+struct IVFListCodeLayout {
+  int groupSize;
+  int unitBytes;
+  int numUnits;
+};
+
+/// Moves the list entries (code and index) at offset moveFrom[i] of list
+/// moveListIds[i] to offset moveTo[i] of the same list. Within a list, the
+/// sources and destinations must be disjoint
+void runIVFMoveListEntries(Tensor<int, 1, true>& moveListIds,
+                           Tensor<int, 1, true>& moveFrom,
+                           Tensor<int, 1, true>& moveTo,
+                           IVFListCodeLayout layout,
+                           thrust::device_vector<void*>& listCodes,
+                           thrust::device_vector<void*>& listIndices,
+                           IndicesOptions indicesOptions,
+                           cudaStream_t stream);
+
 } } // namespace
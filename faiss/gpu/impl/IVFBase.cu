@@ -8,6 +8,8 @@
 
 #include <faiss/gpu/impl/IVFBase.cuh>
 #include <faiss/InvertedLists.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/FaissException.h>
 #include <faiss/gpu/GpuResources.h>
 #include <faiss/gpu/impl/FlatIndex.cuh>
 #include <faiss/gpu/impl/IVFAppend.cuh>
@@ -15,12 +17,132 @@
 #include <faiss/gpu/utils/DeviceDefs.cuh>
 #include <faiss/gpu/utils/DeviceUtils.h>
 #include <faiss/gpu/utils/HostTensor.cuh>
+#include <faiss/gpu/utils/StaticUtils.h>
+#include <faiss/gpu/utils/Timer.h>
+#include <faiss/utils/instrumentation.h>
+#include <algorithm>
+#include <cstring>
 #include <limits>
+#include <memory>
+#include <numeric>
+#include <typeinfo>
 #include <thrust/host_vector.h>
-#include <unordered_map>
 
 namespace faiss { namespace gpu {
 
+/// Number of query batches between two updates of the hot lists
+constexpr int kHotListUpdateInterval = 16;
+
+/// Size of each pinned host buffer through which the inverted lists are
+/// copied in bulk to and from the device
+constexpr size_t kListCopyStagingBytes = (size_t) 64 * 1024 * 1024;
+
+namespace {
+
+/// Pinned host buffers, one per copy stream, through which batches of lists
+/// are copied. While the copies of a batch are in flight on one stream, the
+/// next batch is packed in the buffer of another stream
+class ListCopyStaging {
+ public:
+  ListCopyStaging(const std::vector<cudaStream_t>& streams, size_t bytes)
+      : streams_(streams),
+        buffers_(streams.size(), nullptr),
+        events_(streams.size()) {
+    for (auto& buf : buffers_) {
+      CUDA_VERIFY(cudaHostAlloc((void**) &buf, bytes, cudaHostAllocDefault));
+    }
+  }
+
+  ~ListCopyStaging() {
+    for (size_t i = 0; i < buffers_.size(); ++i) {
+      acquire(i);
+      CUDA_VERIFY(cudaFreeHost(buffers_[i]));
+    }
+  }
+
+  size_t numStreams() const {
+    return streams_.size();
+  }
+
+  cudaStream_t stream(int i) const {
+    return streams_[i];
+  }
+
+  /// Returns buffer i, once the copies previously enqueued through it are
+  /// complete
+  uint8_t* acquire(int i) {
+    if (events_[i]) {
+      events_[i]->cpuWaitOnEvent();
+      events_[i].reset();
+    }
+
+    return buffers_[i];
+  }
+
+  /// Marks the end of the copies enqueued through buffer i
+  void release(int i) {
+    events_[i].reset(new CudaEvent(streams_[i]));
+  }
+
+ private:
+  std::vector<cudaStream_t> streams_;
+  std::vector<uint8_t*> buffers_;
+  std::vector<std::unique_ptr<CudaEvent>> events_;
+};
+
+/// Bytes in which a list item of this size is staged, aligned so that all
+/// items in a buffer are aligned
+size_t stagingSize(size_t bytes) {
+  return utils::roundUp(bytes, (size_t) 16);
+}
+
+/// Splits [0, sizes.size()) into consecutive batches whose total size fits
+/// in maxBytes (each item must fit)
+std::vector<std::pair<size_t, size_t>>
+makeCopyBatches(const std::vector<size_t>& sizes, size_t maxBytes) {
+  std::vector<std::pair<size_t, size_t>> batches;
+
+  size_t begin = 0;
+  while (begin < sizes.size()) {
+    size_t end = begin;
+    size_t total = 0;
+
+    while (end < sizes.size() && total + sizes[end] <= maxBytes) {
+      total += sizes[end];
+      ++end;
+    }
+
+    FAISS_ASSERT(end > begin);
+    batches.push_back(std::make_pair(begin, end));
+    begin = end;
+  }
+
+  return batches;
+}
+
+bool supportsManagedPrefetch(MemorySpace space) {
+  if (space != MemorySpace::Unified) {
+    return false;
+  }
+
+  int concurrent = 0;
+  CUDA_VERIFY(cudaDeviceGetAttribute(&concurrent,
+                                     cudaDevAttrConcurrentManagedAccess,
+                                     getCurrentDevice()));
+  return concurrent != 0;
+}
+
+void adviseLocation(const DeviceVector<uint8_t>& v, int device) {
+  if (v.size() == 0) {
+    return;
+  }
+
+  CUDA_VERIFY(cudaMemAdvise(v.data(), v.size(),
+                            cudaMemAdviseSetPreferredLocation, device));
+}
+
+}
+
 IVFBase::DeviceIVFList::DeviceIVFList(GpuResources* res, const AllocInfo& info)
     : data(res, info),
       numVecs(0) {
@@ -40,7 +162,32 @@ IVFBase::IVFBase(GpuResources* resources,
     numLists_(quantizer->getSize()),
     indicesOptions_(indicesOptions),
     space_(space),
-    maxListLength_(0) {
+    maxListLength_(0),
+    prefetchLists_(supportsManagedPrefetch(space)),
+    hotListBytes_(0),
+    numPrefetchCalls_(0) {
+  reset();
+}
+
+IVFBase::IVFBase(GpuResources* resources,
+                 faiss::MetricType metric,
+                 float metricArg,
+                 int dim,
+                 int numLists,
+                 IndicesOptions indicesOptions,
+                 MemorySpace space) :
+    resources_(resources),
+    metric_(metric),
+    metricArg_(metricArg),
+    quantizer_(nullptr),
+    dim_(dim),
+    numLists_(numLists),
+    indicesOptions_(indicesOptions),
+    space_(space),
+    maxListLength_(0),
+    prefetchLists_(supportsManagedPrefetch(space)),
+    hotListBytes_(0),
+    numPrefetchCalls_(0) {
   reset();
 }
 
@@ -106,6 +253,9 @@ IVFBase::reset() {
   deviceListIndexPointers_.resize(numLists_, nullptr);
   deviceListLengths_.resize(numLists_, 0);
   maxListLength_ = 0;
+
+  listAccessCount_.assign(numLists_, 0);
+  listIsHot_.assign(numLists_, 0);
 }
 
 int
@@ -113,12 +263,171 @@ IVFBase::getDim() const {
   return dim_;
 }
 
+size_t
+IVFBase::removeIds(const IDSelector& sel) {
+  FAISS_THROW_IF_NOT_MSG(indicesOptions_ != INDICES_IVF,
+                         "remove_ids not supported with INDICES_IVF");
+
+  auto stream = resources_->getDefaultStreamCurrentDevice();
+  auto layout = getListCodeLayout_();
+
+  // Moves of all lists, performed at once
+  std::vector<int> moveListIds;
+  std::vector<int> moveFrom;
+  std::vector<int> moveTo;
+
+  // Lists with removed entries and their new length
+  std::vector<int> changedLists;
+  std::vector<int> newListLengths;
+
+  size_t numRemoved = 0;
+
+  for (int listId = 0; listId < numLists_; ++listId) {
+    int numVecs = deviceListData_[listId]->numVecs;
+
+    if (numVecs == 0) {
+      continue;
+    }
+
+    auto ids = getListIndices(listId);
+    FAISS_ASSERT(ids.size() == numVecs);
+
+    std::vector<char> removed(numVecs);
+    int numListRemoved = 0;
+
+    for (int i = 0; i < numVecs; ++i) {
+      removed[i] = sel.is_member(ids[i]);
+      numListRemoved += removed[i];
+    }
+
+    if (numListRemoved == 0) {
+      continue;
+    }
+
+    int newLength = numVecs - numListRemoved;
+
+    // The kept entries past the new end fill the holes before it, in order
+    int hole = 0;
+    for (int i = newLength; i < numVecs; ++i) {
+      if (removed[i]) {
+        continue;
+      }
+
+      while (!removed[hole]) {
+        ++hole;
+      }
+
+      moveListIds.push_back(listId);
+      moveFrom.push_back(i);
+      moveTo.push_back(hole);
+
+      if (indicesOptions_ == INDICES_CPU) {
+        listOffsetToUserIndex_[listId][hole] = ids[i];
+      }
+
+      ++hole;
+    }
+
+    if (indicesOptions_ == INDICES_CPU) {
+      listOffsetToUserIndex_[listId].resize(newLength);
+    }
+
+    changedLists.push_back(listId);
+    newListLengths.push_back(newLength);
+    numRemoved += numListRemoved;
+  }
+
+  if (numRemoved == 0) {
+    return 0;
+  }
+
+  if (!moveListIds.empty()) {
+    int numMoves = (int) moveListIds.size();
+
+    HostTensor<int, 1, true> hostMoveListIds(moveListIds.data(), {numMoves});
+    HostTensor<int, 1, true> hostMoveFrom(moveFrom.data(), {numMoves});
+    HostTensor<int, 1, true> hostMoveTo(moveTo.data(), {numMoves});
+
+    DeviceTensor<int, 1, true> deviceMoveListIds(
+      resources_, makeTempAlloc(AllocType::Other, stream), hostMoveListIds);
+    DeviceTensor<int, 1, true> deviceMoveFrom(
+      resources_, makeTempAlloc(AllocType::Other, stream), hostMoveFrom);
+    DeviceTensor<int, 1, true> deviceMoveTo(
+      resources_, makeTempAlloc(AllocType::Other, stream), hostMoveTo);
+
+    runIVFMoveListEntries(deviceMoveListIds,
+                          deviceMoveFrom,
+                          deviceMoveTo,
+                          layout,
+                          deviceListDataPointers_,
+                          deviceListIndexPointers_,
+                          indicesOptions_,
+                          stream);
+  }
+
+  // Shrinking does not reallocate, so the list pointers are unchanged
+  for (int i = 0; i < changedLists.size(); ++i) {
+    int listId = changedLists[i];
+    int newLength = newListLengths[i];
+
+    auto& data = deviceListData_[listId];
+    auto& indices = deviceListIndices_[listId];
+
+    data->data.resize(getGpuVectorsEncodingSize_(newLength), stream);
+    data->numVecs = newLength;
+
+    if (indicesOptions_ == INDICES_32_BIT) {
+      indices->data.resize((size_t) newLength * sizeof(int), stream);
+    } else if (indicesOptions_ == INDICES_64_BIT) {
+      indices->data.resize((size_t) newLength * sizeof(Index::idx_t), stream);
+    }
+    indices->numVecs = newLength;
+  }
+
+  updateDeviceListInfo_(changedLists, stream);
+
+  return numRemoved;
+}
+
 size_t
 IVFBase::reclaimMemory() {
   // Reclaim all unused memory exactly
   return reclaimMemory_(true);
 }
 
+MemoryUsage
+IVFBase::getMemoryUsage() const {
+  MemoryUsage mu = MemoryUsage::object(
+    demangle_cpp_symbol(typeid(*this).name()));
+
+  size_t codeSize = 0;
+  size_t codeCapacity = 0;
+  for (auto& list : deviceListData_) {
+    codeSize += list->data.size();
+    codeCapacity += list->data.capacity();
+  }
+  mu.add_device("codes", codeSize, codeCapacity);
+
+  size_t idSize = 0;
+  size_t idCapacity = 0;
+  for (auto& list : deviceListIndices_) {
+    idSize += list->data.size();
+    idCapacity += list->data.capacity();
+  }
+  mu.add_device("ids", idSize, idCapacity);
+
+  size_t listInfo =
+    (deviceListDataPointers_.size() + deviceListIndexPointers_.size()) *
+    sizeof(void*) + deviceListLengths_.size() * sizeof(int);
+  mu.add_device("list_info", listInfo, listInfo);
+
+  if (!listOffsetToUserIndex_.empty()) {
+    mu.add("ids_cpu", listOffsetToUserIndex_);
+  }
+
+  return mu;
+}
+
 size_t
 IVFBase::reclaimMemory_(bool exact) {
   auto stream = resources_->getDefaultStreamCurrentDevice();
@@ -173,6 +482,9 @@ IVFBase::updateDeviceListInfo_(const std::vector<int>& listIds,
     auto& data = deviceListData_[listId];
     auto& indices = deviceListIndices_[listId];
 
+    // a reallocated list has lost its location advice
+    listIsHot_[listId] = 0;
+
     hostListsToUpdate[i] = listId;
     hostNewListLength[i] = data->numVecs;
     hostNewDataPointers[i] = data->data.data();
@@ -287,6 +599,19 @@ IVFBase::getListVectorData(int listId) const {
 void
 IVFBase::copyInvertedListsFrom(const InvertedLists* ivf) {
   size_t nlist = ivf ? ivf->nlist : 0;
+  FAISS_ASSERT(nlist <= deviceListData_.size());
+
+  auto stream = resources_->getDefaultStreamCurrentDevice();
+
+  size_t indexSize =
+    indicesOptions_ == INDICES_32_BIT ? sizeof(int) :
+    indicesOptions_ == INDICES_64_BIT ? sizeof(Index::idx_t) : 0;
+
+  // Allocate all lists at their exact final size first, so that the data
+  // can then be copied in a few large batches rather than list by list
+  std::vector<size_t> stagingBytes(nlist, 0);
+  size_t maxStagingBytes = 0;
+
   for (size_t i = 0; i < nlist; ++i) {
     size_t listSize = ivf->list_size(i);
 
@@ -298,17 +623,233 @@ IVFBase::copyInvertedListsFrom(const InvertedLists* ivf) {
                            (size_t) std::numeric_limits<int>::max(),
                            listSize);
 
-    addEncodedVectorsToList_(i, ivf->get_codes(i), ivf->get_ids(i), listSize);
+    // This list must currently be empty
+    auto& listCodes = deviceListData_[i];
+    FAISS_ASSERT(listCodes->data.size() == 0);
+    FAISS_ASSERT(listCodes->numVecs == 0);
+
+    if (listSize == 0) {
+      continue;
+    }
+
+    auto gpuListSizeInBytes = getGpuVectorsEncodingSize_(listSize);
+
+    // We only have int32 length representations on the GPU per each
+    // list; the length is in sizeof(char)
+    FAISS_ASSERT(gpuListSizeInBytes <=
+                 (size_t) std::numeric_limits<int>::max());
+
+    listCodes->data.resize(gpuListSizeInBytes, stream, true);
+    listCodes->numVecs = listSize;
+
+    if (indexSize > 0) {
+      auto& listIndices = deviceListIndices_[i];
+      FAISS_ASSERT(listIndices->data.size() == 0);
+
+      listIndices->data.resize(listSize * indexSize, stream, true);
+      listIndices->numVecs = listSize;
+    } else if (indicesOptions_ == INDICES_CPU) {
+      InvertedLists::ScopedIds ids(ivf, i);
+      listOffsetToUserIndex_[i].assign(ids.get(), ids.get() + listSize);
+    }
+
+    stagingBytes[i] = stagingSize(gpuListSizeInBytes) +
+      stagingSize(listSize * indexSize);
+    maxStagingBytes = std::max(maxStagingBytes, stagingBytes[i]);
+
+    // We update this as well, since the multi-pass algorithm uses it
+    maxListLength_ = std::max(maxListLength_, (int) listSize);
+  }
+
+  if (maxStagingBytes > 0) {
+    // The copies run on the alternate streams, once the lists are allocated
+    auto copyStreams = resources_->getAlternateStreamsCurrentDevice();
+    streamWait(copyStreams, {stream});
+
+    size_t bufferBytes = std::max(kListCopyStagingBytes, maxStagingBytes);
+    ListCopyStaging staging(copyStreams, bufferBytes);
+
+    auto batches = makeCopyBatches(stagingBytes, bufferBytes);
+
+    for (size_t b = 0; b < batches.size(); ++b) {
+      int s = b % staging.numStreams();
+      uint8_t* buf = staging.acquire(s);
+
+      // Pack the batch in the host buffer, translating the codes to our
+      // preferred GPU layout; the previous batch is being copied meanwhile
+      size_t offset = 0;
+      for (size_t i = batches[b].first; i < batches[b].second; ++i) {
+        size_t listSize = ivf->list_size(i);
+        if (listSize == 0) {
+          continue;
+        }
+
+        auto& listCodes = deviceListData_[i];
+        size_t gpuBytes = listCodes->data.size();
+
+        {
+          InvertedLists::ScopedCodes codes(ivf, i);
+
+          std::vector<uint8_t> codesV(getCpuVectorsEncodingSize_(listSize));
+          std::memcpy(codesV.data(), codes.get(), codesV.size());
+          auto translatedCodes =
+            translateCodesToGpu_(std::move(codesV), listSize);
+
+          std::memcpy(buf + offset, translatedCodes.data(), gpuBytes);
+        }
+
+        CUDA_VERIFY(cudaMemcpyAsync(listCodes->data.data(), buf + offset,
+                                    gpuBytes, cudaMemcpyHostToDevice,
+                                    staging.stream(s)));
+        offset += stagingSize(gpuBytes);
+
+        if (indexSize > 0) {
+          InvertedLists::ScopedIds ids(ivf, i);
+
+          if (indicesOptions_ == INDICES_32_BIT) {
+            int* ids32 = (int*) (buf + offset);
+            for (size_t j = 0; j < listSize; ++j) {
+              auto ind = ids[j];
+              FAISS_ASSERT(ind <=
+                           (Index::idx_t) std::numeric_limits<int>::max());
+              ids32[j] = (int) ind;
+            }
+          } else {
+            std::memcpy(buf + offset, ids.get(), listSize * indexSize);
+          }
+
+          CUDA_VERIFY(cudaMemcpyAsync(deviceListIndices_[i]->data.data(),
+                                      buf + offset,
+                                      listSize * indexSize,
+                                      cudaMemcpyHostToDevice,
+                                      staging.stream(s)));
+          offset += stagingSize(listSize * indexSize);
+        }
+      }
+
+      staging.release(s);
+    }
+
+    streamWait({stream}, copyStreams);
   }
+
+  // Update the device-side list pointers and lengths in a single batch,
+  // rather than with a separate copy per list
+  updateDeviceListInfo_(stream);
 }
 
 void
 IVFBase::copyInvertedListsTo(InvertedLists* ivf) {
+  auto stream = resources_->getDefaultStreamCurrentDevice();
+
+  size_t indexSize =
+    indicesOptions_ == INDICES_32_BIT ? sizeof(int) :
+    indicesOptions_ == INDICES_64_BIT ? sizeof(Index::idx_t) : 0;
+
+  // INDICES_IVF is not handled, as in getListIndices
+  FAISS_ASSERT(indexSize > 0 || indicesOptions_ == INDICES_CPU);
+
+  std::vector<size_t> stagingBytes(numLists_, 0);
+  size_t maxStagingBytes = 0;
+
   for (int i = 0; i < numLists_; ++i) {
-    auto listIndices = getListIndices(i);
-    auto listData = getListVectorData(i);
+    size_t numVecs = deviceListData_[i]->numVecs;
+
+    if (numVecs > 0) {
+      stagingBytes[i] = stagingSize(deviceListData_[i]->data.size()) +
+        stagingSize(numVecs * indexSize);
+      maxStagingBytes = std::max(maxStagingBytes, stagingBytes[i]);
+    }
+  }
+
+  if (maxStagingBytes == 0) {
+    return;
+  }
+
+  auto copyStreams = resources_->getAlternateStreamsCurrentDevice();
+  streamWait(copyStreams, {stream});
+
+  size_t bufferBytes = std::max(kListCopyStagingBytes, maxStagingBytes);
+  ListCopyStaging staging(copyStreams, bufferBytes);
+
+  auto batches = makeCopyBatches(stagingBytes, bufferBytes);
+
+  // Enqueues the copies of batch b to its host buffer
+  auto enqueueBatch = [&](size_t b) {
+    int s = b % staging.numStreams();
+    uint8_t* buf = staging.acquire(s);
+
+    size_t offset = 0;
+    for (size_t i = batches[b].first; i < batches[b].second; ++i) {
+      auto& listCodes = deviceListData_[i];
+      if (listCodes->numVecs == 0) {
+        continue;
+      }
+
+      CUDA_VERIFY(cudaMemcpyAsync(buf + offset, listCodes->data.data(),
+                                  listCodes->data.size(),
+                                  cudaMemcpyDeviceToHost,
+                                  staging.stream(s)));
+      offset += stagingSize(listCodes->data.size());
+
+      if (indexSize > 0) {
+        CUDA_VERIFY(cudaMemcpyAsync(buf + offset,
+                                    deviceListIndices_[i]->data.data(),
+                                    listCodes->numVecs * indexSize,
+                                    cudaMemcpyDeviceToHost,
+                                    staging.stream(s)));
+        offset += stagingSize(listCodes->numVecs * indexSize);
+      }
+    }
+
+    staging.release(s);
+  };
+
+  if (!batches.empty()) {
+    enqueueBatch(0);
+  }
+
+  for (size_t b = 0; b < batches.size(); ++b) {
+    // The next batch is copied while this one is unpacked
+    if (b + 1 < batches.size()) {
+      enqueueBatch(b + 1);
+    }
+
+    const uint8_t* buf = staging.acquire(b % staging.numStreams());
+
+    size_t offset = 0;
+    for (size_t i = batches[b].first; i < batches[b].second; ++i) {
+      auto& listCodes = deviceListData_[i];
+      size_t numVecs = listCodes->numVecs;
+      if (numVecs == 0) {
+        continue;
+      }
+
+      std::vector<uint8_t> gpuCodes(buf + offset,
+                                    buf + offset + listCodes->data.size());
+      offset += stagingSize(listCodes->data.size());
+
+      // The GPU layout may be different than the CPU layout (e.g., vectors
+      // rather than dimensions interleaved), translate back if necessary
+      auto codes = translateCodesFromGpu_(std::move(gpuCodes), numVecs);
+
+      std::vector<Index::idx_t> ids(numVecs);
+      if (indicesOptions_ == INDICES_32_BIT) {
+        const int* ids32 = (const int*) (buf + offset);
+        for (size_t j = 0; j < numVecs; ++j) {
+          ids[j] = (Index::idx_t) ids32[j];
+        }
+      } else if (indicesOptions_ == INDICES_64_BIT) {
+        std::memcpy(ids.data(), buf + offset, numVecs * indexSize);
+      } else {
+        auto& userIds = listOffsetToUserIndex_[i];
+        FAISS_ASSERT(userIds.size() == numVecs);
+        ids = userIds;
+      }
+      offset += stagingSize(numVecs * indexSize);
 
-    ivf->add_entries(i, listIndices.size(), listIndices.data(), listData.data());
+      ivf->add_entries(i, numVecs, ids.data(), codes.data());
+    }
   }
 }
 
@@ -354,17 +895,8 @@ IVFBase::addEncodedVectorsToList_(int listId,
   // Handle the indices as well
   addIndicesFromCpu_(listId, indices, numVecs);
 
-  deviceListDataPointers_[listId] = listCodes->data.data();
-  deviceListLengths_[listId] = numVecs;
-
   // We update this as well, since the multi-pass algorithm uses it
   maxListLength_ = std::max(maxListLength_, (int) numVecs);
-
-  // device_vector add is potentially happening on a different stream
-  // than our default stream
-  if (resources_->getDefaultStreamCurrentDevice() != 0) {
-    streamWait({stream}, {0});
-  }
 }
 
 void
@@ -409,8 +941,6 @@ IVFBase::addIndicesFromCpu_(int listId,
     // indices are not stored
     FAISS_ASSERT(indicesOptions_ == INDICES_IVF);
   }
-
-  deviceListIndexPointers_[listId] = listIndices->data.data();
 }
 
 
@@ -422,9 +952,6 @@ IVFBase::addVectors(Tensor<float, 2, true>& vecs,
 
   auto stream = resources_->getDefaultStreamCurrentDevice();
 
-  // Number of valid vectors that we actually add; we return this
-  int numAdded = 0;
-
   // Determine which IVF lists we need to append to
 
   // We don't actually need this
@@ -435,49 +962,107 @@ IVFBase::addVectors(Tensor<float, 2, true>& vecs,
     resources_, makeTempAlloc(AllocType::Other, stream), {vecs.getSize(0), 1});
   auto listIds = listIds2d.view<1>({vecs.getSize(0)});
 
-  quantizer_->query(vecs, 1, metric_, metricArg_,
-                    listDistance, listIds2d, false);
+  {
+    GpuStageTimer timer(STAGE_COARSE_QUANTIZE, stream);
+    quantizer_->query(vecs, 1, metric_, metricArg_,
+                      listDistance, listIds2d, false);
+  }
+
+  // vector id -> offset in list
+  // (we already have vector id -> list id in listIds)
+  DeviceTensor<int, 1, true> listOffset(
+    resources_, makeTempAlloc(AllocType::Other, stream), {vecs.getSize(0)});
+
+  // Number of valid vectors that we actually add; we return this
+  int numAdded = prepareListAppend_(listIds, indices, listOffset, stream);
+
+  // If we didn't add anything (all invalid vectors that didn't map to IVF
+  // clusters), no need to continue
+  if (numAdded == 0) {
+    return 0;
+  }
 
-  // Copy the lists that we wish to append to back to the CPU
-  // FIXME: really this can be into pinned memory and a true async
-  // copy on a different stream; we can start the copy early, but it's
-  // tiny
-  HostTensor<int, 1, true> listIdsHost(listIds, stream);
+  // Actually encode and append the vectors
+  {
+    GpuStageTimer timer(STAGE_ENCODE, stream);
+    appendVectors_(vecs, indices, listIds, listOffset, stream);
+  }
 
-  // Now we add the encoded vectors to the individual lists
-  // First, make sure that there is space available for adding the new
-  // encoded vectors and indices
+  // We added this number
+  return numAdded;
+}
 
-  // list id -> # being added
-  std::unordered_map<int, int> assignCounts;
 
-  // vector id -> offset in list
-  // (we already have vector id -> list id in listIds)
-  HostTensor<int, 1, true> listOffsetHost({listIdsHost.getSize(0)});
+int
+IVFBase::prepareListAppend_(Tensor<int, 1, true>& listIds,
+                            Tensor<Index::idx_t, 1, true>& indices,
+                            Tensor<int, 1, true>& listOffset,
+                            cudaStream_t stream) {
+  FAISS_ASSERT(listOffset.getSize(0) == listIds.getSize(0));
+
+  // The histogram of the list assignment and the offset of each vector in
+  // its list are computed on the device; only the histogram comes back
+  DeviceTensor<int, 1, true> listAddCounts(
+    resources_, makeTempAlloc(AllocType::Other, stream), {numLists_});
+
+  runCalcListOffsets(resources_,
+                     listIds,
+                     deviceListLengths_,
+                     listOffset,
+                     listAddCounts,
+                     stream);
+
+  HostTensor<int, 1, true> listAddCountsHost(listAddCounts, stream);
 
-  for (int i = 0; i < listIdsHost.getSize(0); ++i) {
-    int listId = listIdsHost[i];
+  // Number of valid vectors that we actually add; we return this
+  int numAdded = 0;
 
-    // Add vector could be invalid (contains NaNs etc)
-    if (listId < 0) {
-      listOffsetHost[i] = -1;
+  // We need to resize the data structures for the inverted lists on
+  // the GPUs, which means that they might need reallocation, which
+  // means that their base address may change. Figure out the new base
+  // addresses, and update those in a batch on the device
+  std::vector<int> listsToUpdate;
+
+  for (int listId = 0; listId < numLists_; ++listId) {
+    int numToAdd = listAddCountsHost[listId];
+    if (numToAdd == 0) {
       continue;
     }
 
-    FAISS_ASSERT(listId < numLists_);
-    ++numAdded;
+    numAdded += numToAdd;
+    listsToUpdate.push_back(listId);
+
+    // Resize the list that we are appending to
+    auto& codes = deviceListData_[listId];
+    int newNumVecs = codes->numVecs + numToAdd;
 
-    int offset = deviceListData_[listId]->numVecs;
+    codes->data.resize(getGpuVectorsEncodingSize_(newNumVecs), stream);
+    codes->numVecs = newNumVecs;
+
+    auto& listIndices = deviceListIndices_[listId];
+    if ((indicesOptions_ == INDICES_32_BIT) ||
+        (indicesOptions_ == INDICES_64_BIT)) {
+      size_t indexSize =
+        (indicesOptions_ == INDICES_32_BIT) ? sizeof(int) : sizeof(Index::idx_t);
+
+      listIndices->data.resize(
+        listIndices->data.size() + numToAdd * indexSize, stream);
+      listIndices->numVecs = newNumVecs;
+
+    } else if (indicesOptions_ == INDICES_CPU) {
+      // indices are stored on the CPU side
+      FAISS_ASSERT(listId < listOffsetToUserIndex_.size());
 
-    auto it = assignCounts.find(listId);
-    if (it != assignCounts.end()) {
-      offset += it->second;
-      it->second++;
+      auto& userIndices = listOffsetToUserIndex_[listId];
+      userIndices.resize(newNumVecs);
     } else {
-      assignCounts[listId] = 1;
+      // indices are not stored on the GPU or CPU side
+      FAISS_ASSERT(indicesOptions_ == INDICES_IVF);
     }
 
-    listOffsetHost[i] = offset;
+    // This is used by the multi-pass query to decide how much scratch
+    // space to allocate for intermediate results
+    maxListLength_ = std::max(maxListLength_, newNumVecs);
   }
 
   // If we didn't add anything (all invalid vectors that didn't map to IVF
@@ -486,63 +1071,16 @@ IVFBase::addVectors(Tensor<float, 2, true>& vecs,
     return 0;
   }
 
-  // We need to resize the data structures for the inverted lists on
-  // the GPUs, which means that they might need reallocation, which
-  // means that their base address may change. Figure out the new base
-  // addresses, and update those in a batch on the device
-  {
-    // Resize all of the lists that we are appending to
-    for (auto& counts : assignCounts) {
-      auto& codes = deviceListData_[counts.first];
-      codes->data.resize(
-        getGpuVectorsEncodingSize_(codes->numVecs + counts.second), stream);
-
-      int newNumVecs = codes->numVecs + counts.second;
-      codes->numVecs = newNumVecs;
-
-      auto& indices = deviceListIndices_[counts.first];
-      if ((indicesOptions_ == INDICES_32_BIT) ||
-          (indicesOptions_ == INDICES_64_BIT)) {
-        size_t indexSize =
-          (indicesOptions_ == INDICES_32_BIT) ? sizeof(int) : sizeof(Index::idx_t);
-
-        indices->data.resize(
-          indices->data.size() + counts.second * indexSize, stream);
-        indices->numVecs = newNumVecs;
-
-      } else if (indicesOptions_ == INDICES_CPU) {
-        // indices are stored on the CPU side
-        FAISS_ASSERT(counts.first < listOffsetToUserIndex_.size());
-
-        auto& userIndices = listOffsetToUserIndex_[counts.first];
-        userIndices.resize(newNumVecs);
-      } else {
-        // indices are not stored on the GPU or CPU side
-        FAISS_ASSERT(indicesOptions_ == INDICES_IVF);
-      }
-
-      // This is used by the multi-pass query to decide how much scratch
-      // space to allocate for intermediate results
-      maxListLength_ = std::max(maxListLength_, newNumVecs);
-    }
-
-    // Update all pointers and sizes on the device for lists that we
-    // appended to
-    {
-      std::vector<int> listIdsV(assignCounts.size());
-      int i = 0;
-      for (auto& counts : assignCounts) {
-        listIdsV[i++] = counts.first;
-      }
-
-      updateDeviceListInfo_(listIdsV, stream);
-    }
-  }
+  // Update all pointers and sizes on the device for lists that we
+  // appended to
+  updateDeviceListInfo_(listsToUpdate, stream);
 
   // If we're maintaining the indices on the CPU side, update our
   // map. We already resized our map above.
   if (indicesOptions_ == INDICES_CPU) {
     // We need to maintain the indices on the CPU side
+    HostTensor<int, 1, true> listIdsHost(listIds, stream);
+    HostTensor<int, 1, true> listOffsetHost(listOffset, stream);
     HostTensor<Index::idx_t, 1, true> hostIndices(indices, stream);
 
     for (int i = 0; i < hostIndices.getSize(0); ++i) {
@@ -563,16 +1101,100 @@ IVFBase::addVectors(Tensor<float, 2, true>& vecs,
     }
   }
 
-  // Copy the offsets to the GPU
-  DeviceTensor<int, 1, true> listOffset(
-    resources_, makeTempAlloc(AllocType::Other, stream), listOffsetHost);
+  return numAdded;
+}
 
-  // Actually encode and append the vectors
-  appendVectors_(vecs, indices, listIds, listOffset, stream);
+void
+IVFBase::setHotListBytes(size_t bytes) {
+  hotListBytes_ = bytes;
 
-  // We added this number
-  return numAdded;
+  if (prefetchLists_) {
+    updateHotLists_();
+  }
 }
 
+void
+IVFBase::prefetchProbedLists_(Tensor<int, 2, true>& listIds,
+                              cudaStream_t stream) {
+  if (!prefetchLists_) {
+    return;
+  }
+
+  HostTensor<int, 2, true> hostListIds(listIds, stream);
+
+  std::vector<char> probed(numLists_, 0);
+  for (size_t i = 0; i < hostListIds.numElements(); ++i) {
+    int listId = hostListIds.data()[i];
+
+    // -1 is used for queries with fewer lists than nprobe
+    if (listId >= 0 && !probed[listId]) {
+      probed[listId] = 1;
+      listAccessCount_[listId]++;
+    }
+  }
+
+  int device = getCurrentDevice();
+
+  for (int i = 0; i < numLists_; ++i) {
+    if (!probed[i]) {
+      continue;
+    }
+
+    for (auto list : {deviceListData_[i].get(), deviceListIndices_[i].get()}) {
+      if (list->data.size() > 0) {
+        CUDA_VERIFY(cudaMemPrefetchAsync(list->data.data(),
+                                         list->data.size(),
+                                         device,
+                                         stream));
+      }
+    }
+  }
+
+  if (hotListBytes_ > 0 &&
+      ++numPrefetchCalls_ % kHotListUpdateInterval == 0) {
+    updateHotLists_();
+  }
+}
+
+void
+IVFBase::updateHotLists_() {
+  if (!prefetchLists_) {
+    return;
+  }
+
+  std::vector<int> order(numLists_);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [this](int a, int b) {
+      return listAccessCount_[a] > listAccessCount_[b];
+    });
+
+  int device = getCurrentDevice();
+  size_t hotBytes = 0;
+
+  for (int listId : order) {
+    auto& data = deviceListData_[listId]->data;
+    auto& indices = deviceListIndices_[listId]->data;
+    size_t bytes = data.size() + indices.size();
+
+    bool hot = hotListBytes_ > 0 && listAccessCount_[listId] > 0 &&
+      hotBytes + bytes <= hotListBytes_;
+    if (hot) {
+      hotBytes += bytes;
+    }
+
+    if (hot && !listIsHot_[listId]) {
+      adviseLocation(data, device);
+      adviseLocation(indices, device);
+    } else if (!hot && listIsHot_[listId]) {
+      adviseLocation(data, cudaCpuDeviceId);
+      adviseLocation(indices, cudaCpuDeviceId);
+    }
+
+    listIsHot_[listId] = hot;
+
+    // decay the counts so that the hot set follows the recent queries
+    listAccessCount_[listId] /= 2;
+  }
+}
 
 } } // namespace
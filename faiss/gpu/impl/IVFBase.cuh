@@ -11,18 +11,21 @@
 #include <faiss/Index.h>
 #include <faiss/MetricType.h>
 #include <faiss/gpu/GpuIndicesOptions.h>
+#include <faiss/impl/MemoryUsage.h>
 #include <faiss/gpu/utils/DeviceVector.cuh>
 #include <faiss/gpu/utils/DeviceTensor.cuh>
+#include <faiss/gpu/utils/HostTensor.cuh>
 #include <memory>
 #include <thrust/device_vector.h>
 #include <vector>
 
-namespace faiss { struct InvertedLists; }
+namespace faiss { struct InvertedLists; struct IDSelector; }
 
 namespace faiss { namespace gpu {
 
 class GpuResources;
 struct FlatIndex;
+struct IVFListCodeLayout;
 
 /// Base inverted list functionality for IVFFlat and IVFPQ
 class IVFBase {
@@ -35,6 +38,16 @@ class IVFBase {
           IndicesOptions indicesOptions,
           MemorySpace space);
 
+  /// Construct without a float coarse quantizer; the subclass does the
+  /// list assignment itself (e.g., with a binary quantizer)
+  IVFBase(GpuResources* resources,
+          faiss::MetricType metric,
+          float metricArg,
+          int dim,
+          int numLists,
+          IndicesOptions indicesOptions,
+          MemorySpace space);
+
   virtual ~IVFBase();
 
   /// Reserve GPU memory in our inverted lists for this number of vectors
@@ -51,6 +64,11 @@ class IVFBase {
   /// to exactly the amount needed. Returns space reclaimed in bytes
   size_t reclaimMemory();
 
+  /// Memory of the inverted lists: the codes and user indices on the
+  /// device (size is the part in use) and the per-list info, plus the
+  /// user indices on the host with INDICES_CPU
+  virtual MemoryUsage getMemoryUsage() const;
+
   /// Returns the number of inverted lists
   size_t getNumLists() const;
 
@@ -64,10 +82,13 @@ class IVFBase {
   /// Return the encoded vectors of a particular list back to the CPU
   std::vector<uint8_t> getListVectorData(int listId) const;
 
-  /// Copy all inverted lists from a CPU representation to ourselves
+  /// Copy all inverted lists from a CPU representation to ourselves.
+  /// The lists are allocated at their exact size, then copied in large
+  /// batches through pinned host buffers, on the alternate streams
   void copyInvertedListsFrom(const InvertedLists* ivf);
 
-  /// Copy all inverted lists from ourselves to a CPU representation
+  /// Copy all inverted lists from ourselves to a CPU representation, in
+  /// large batches through pinned host buffers
   void copyInvertedListsTo(InvertedLists* ivf);
 
   /// Classify and encode/add vectors to our IVF lists.
@@ -77,9 +98,24 @@ class IVFBase {
   int addVectors(Tensor<float, 2, true>& vecs,
                  Tensor<Index::idx_t, 1, true>& indices);
 
+  /// Removes the entries whose user index is selected by `sel`. In each
+  /// list, the last entries are moved on the device into the holes left by
+  /// the removed entries, as for the CPU IndexIVF, so the lists stay dense
+  /// and no memory is reallocated (see reclaimMemory). Only the user
+  /// indices are copied to the host to evaluate `sel`.
+  /// Returns the number of entries removed
+  size_t removeIds(const IDSelector& sel);
+
+  /// With MemorySpace::Unified storage, the most frequently probed lists,
+  /// up to this many bytes, are advised to stay on the GPU and the other
+  /// lists on the host. 0 disables the advice; the lists probed by a query
+  /// are still prefetched to the GPU before they are scanned
+  void setHotListBytes(size_t bytes);
+
  protected:
   /// Adds a set of codes and indices to a list, with the representation coming
-  /// from the CPU equivalent
+  /// from the CPU equivalent. The device-side list pointers and lengths are
+  /// not updated; call updateDeviceListInfo_ once the lists are added
   void addEncodedVectorsToList_(int listId,
                                 // resident on the host
                                 const void* codes,
@@ -102,6 +138,10 @@ class IVFBase {
   virtual std::vector<uint8_t> translateCodesFromGpu_(std::vector<uint8_t> codes,
                                                       size_t numVecs) const = 0;
 
+  /// Layout of the encoded vectors in our lists, to move entries on the
+  /// device in removeIds
+  virtual IVFListCodeLayout getListCodeLayout_() const = 0;
+
   /// Append vectors to our on-device lists
   virtual void appendVectors_(Tensor<float, 2, true>& vecs,
                               Tensor<Index::idx_t, 1, true>& indices,
@@ -126,6 +166,25 @@ class IVFBase {
                           const Index::idx_t* indices,
                           size_t numVecs);
 
+  /// With MemorySpace::Unified storage, prefetches the lists probed by a
+  /// query batch (listIds, on the device) to the GPU and counts their
+  /// accesses
+  void prefetchProbedLists_(Tensor<int, 2, true>& listIds,
+                            cudaStream_t stream);
+
+  /// Advises the preferred location of each list from its access count
+  void updateHotLists_();
+
+  /// Given the list assignment of vectors to add (-1 for vectors that
+  /// cannot be added), computes on the device the offset of each vector in
+  /// its list (-1 if not added) and grows the lists being appended to. Only
+  /// the number of vectors added per list is copied back to the host.
+  /// Returns the number of vectors that will be added
+  int prepareListAppend_(Tensor<int, 1, true>& listIds,
+                         Tensor<Index::idx_t, 1, true>& indices,
+                         Tensor<int, 1, true>& listOffset,
+                         cudaStream_t stream);
+
  protected:
   /// Collection of GPU resources that we use
   GpuResources* resources_;
@@ -136,7 +195,7 @@ class IVFBase {
   /// Metric arg
   float metricArg_;
 
-  /// Quantizer object
+  /// Quantizer object (nullptr if the subclass has its own quantizer)
   FlatIndex* quantizer_;
 
   /// Expected dimensionality of the vectors
@@ -184,6 +243,21 @@ class IVFBase {
   std::vector<std::unique_ptr<DeviceIVFList>> deviceListData_;
   std::vector<std::unique_ptr<DeviceIVFList>> deviceListIndices_;
 
+  /// Whether our lists are in managed memory that can be prefetched
+  bool prefetchLists_;
+
+  /// Memory budget for the lists advised to stay on the GPU
+  size_t hotListBytes_;
+
+  /// Number of query batches that probed each list (decayed over time)
+  std::vector<size_t> listAccessCount_;
+
+  /// Whether each list is currently advised to stay on the GPU
+  std::vector<char> listIsHot_;
+
+  /// Number of calls to prefetchProbedLists_
+  int numPrefetchCalls_;
+
   /// If we are storing indices on the CPU (indicesOptions_ is
   /// INDICES_CPU), then this maintains a CPU-side map of what
   /// (inverted list id, offset) maps to which user index
@@ -0,0 +1,195 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#include <faiss/gpu/impl/IVFBinary.cuh>
+#include <faiss/gpu/GpuResources.h>
+#include <faiss/gpu/impl/BinaryFlatIndex.cuh>
+#include <faiss/gpu/impl/IVFAppend.cuh>
+#include <faiss/gpu/impl/IVFBinaryScan.cuh>
+#include <faiss/gpu/impl/RemapIndices.h>
+#include <faiss/gpu/utils/ConversionOperators.cuh>
+#include <faiss/gpu/utils/DeviceDefs.cuh>
+#include <faiss/gpu/utils/DeviceUtils.h>
+#include <faiss/gpu/utils/HostTensor.cuh>
+
+namespace faiss { namespace gpu {
+
+IVFBinary::IVFBinary(GpuResources* res,
+                     BinaryFlatIndex* quantizer,
+                     int dim,
+                     IndicesOptions indicesOptions,
+                     MemorySpace space) :
+    // the metric is unused, the distance is always Hamming
+    IVFBase(res,
+            faiss::METRIC_L2,
+            0,
+            dim,
+            quantizer->getSize(),
+            indicesOptions,
+            space),
+    binaryQuantizer_(quantizer) {
+  FAISS_ASSERT(dim % 8 == 0);
+}
+
+IVFBinary::~IVFBinary() {
+}
+
+size_t
+IVFBinary::getGpuVectorsEncodingSize_(int numVecs) const {
+  return (size_t) numVecs * (getDim() / 8);
+}
+
+size_t
+IVFBinary::getCpuVectorsEncodingSize_(int numVecs) const {
+  return (size_t) numVecs * (getDim() / 8);
+}
+
+std::vector<uint8_t>
+IVFBinary::translateCodesToGpu_(std::vector<uint8_t> codes,
+                                size_t numVecs) const {
+  // nothing to do
+  return codes;
+}
+
+std::vector<uint8_t>
+IVFBinary::translateCodesFromGpu_(std::vector<uint8_t> codes,
+                                  size_t numVecs) const {
+  // nothing to do
+  return codes;
+}
+
+IVFListCodeLayout
+IVFBinary::getListCodeLayout_() const {
+  return IVFListCodeLayout{1, getDim() / 8, 1};
+}
+
+void
+IVFBinary::appendVectors_(Tensor<float, 2, true>& vecs,
+                          Tensor<Index::idx_t, 1, true>& indices,
+                          Tensor<int, 1, true>& listIds,
+                          Tensor<int, 1, true>& listOffset,
+                          cudaStream_t stream) {
+  // IVFBase::addVectors is hidden by our binary version
+  FAISS_ASSERT(false);
+}
+
+int
+IVFBinary::addVectors(Tensor<unsigned char, 2, true>& vecs,
+                      Tensor<Index::idx_t, 1, true>& indices) {
+  FAISS_ASSERT(vecs.getSize(0) == indices.getSize(0));
+  FAISS_ASSERT(vecs.getSize(1) == dim_ / 8);
+
+  auto stream = resources_->getDefaultStreamCurrentDevice();
+
+  // Determine which IVF lists we need to append to
+
+  // We don't actually need this
+  DeviceTensor<int, 2, true> listDistance(
+    resources_, makeTempAlloc(AllocType::Other, stream), {vecs.getSize(0), 1});
+  // We use this
+  DeviceTensor<int, 2, true> listIds2d(
+    resources_, makeTempAlloc(AllocType::Other, stream), {vecs.getSize(0), 1});
+  auto listIds = listIds2d.view<1>({vecs.getSize(0)});
+
+  binaryQuantizer_->query(vecs, 1, listDistance, listIds2d);
+
+  // vector id -> offset in list
+  DeviceTensor<int, 1, true> listOffset(
+    resources_, makeTempAlloc(AllocType::Other, stream), {vecs.getSize(0)});
+
+  int numAdded = prepareListAppend_(listIds, indices, listOffset, stream);
+
+  if (numAdded == 0) {
+    return 0;
+  }
+
+  // The codes are stored as-is
+  runIVFBinaryInvertedListAppend(listIds,
+                                 listOffset,
+                                 vecs,
+                                 indices,
+                                 deviceListDataPointers_,
+                                 deviceListIndexPointers_,
+                                 indicesOptions_,
+                                 stream);
+
+  return numAdded;
+}
+
+void
+IVFBinary::query(Tensor<unsigned char, 2, true>& queries,
+                 int nprobe,
+                 int k,
+                 Tensor<int, 2, true>& outDistances,
+                 Tensor<Index::idx_t, 2, true>& outIndices) {
+  auto stream = resources_->getDefaultStreamCurrentDevice();
+
+  // These are caught at a higher level
+  FAISS_ASSERT(nprobe <= GPU_MAX_SELECTION_K);
+  FAISS_ASSERT(k <= GPU_MAX_SELECTION_K);
+  nprobe = std::min(nprobe, binaryQuantizer_->getSize());
+
+  FAISS_ASSERT(queries.getSize(1) == dim_ / 8);
+
+  FAISS_ASSERT(outDistances.getSize(0) == queries.getSize(0));
+  FAISS_ASSERT(outIndices.getSize(0) == queries.getSize(0));
+
+  // Reserve space for the quantized information
+  DeviceTensor<int, 2, true> coarseDistances(
+    resources_, makeTempAlloc(AllocType::Other, stream),
+    {queries.getSize(0), nprobe});
+  DeviceTensor<int, 2, true> coarseIndices(
+    resources_, makeTempAlloc(AllocType::Other, stream),
+    {queries.getSize(0), nprobe});
+
+  // Find the `nprobe` closest lists
+  binaryQuantizer_->query(queries, nprobe, coarseDistances, coarseIndices);
+
+  // Bring the probed lists to the GPU if they are in managed memory
+  prefetchProbedLists_(coarseIndices, stream);
+
+  // The list scan selects on float distances, which are exact for
+  // Hamming distances
+  DeviceTensor<float, 2, true> outFloatDistances(
+    resources_, makeTempAlloc(AllocType::Other, stream),
+    {queries.getSize(0), k});
+
+  runIVFBinaryScan(queries,
+                   coarseIndices,
+                   deviceListDataPointers_,
+                   deviceListIndexPointers_,
+                   indicesOptions_,
+                   deviceListLengths_,
+                   maxListLength_,
+                   k,
+                   outFloatDistances,
+                   outIndices,
+                   resources_);
+
+  // Missing results have the max float distance, which saturates to the
+  // max int distance like on the CPU
+  convertTensor<float, int, 2>(stream, outFloatDistances, outDistances);
+
+  // If the GPU isn't storing indices (they are on the CPU side), we
+  // need to perform the re-mapping here
+  if (indicesOptions_ == INDICES_CPU) {
+    HostTensor<Index::idx_t, 2, true> hostOutIndices(outIndices, stream);
+
+    ivfOffsetToUserIndex(hostOutIndices.data(),
+                         numLists_,
+                         hostOutIndices.getSize(0),
+                         hostOutIndices.getSize(1),
+                         listOffsetToUserIndex_);
+
+    // Copy back to GPU, since the input to this function is on the
+    // GPU
+    outIndices.copyFrom(hostOutIndices, stream);
+  }
+}
+
+} } // namespace
@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#pragma once
+
+#include <faiss/gpu/impl/IVFBase.cuh>
+
+namespace faiss { namespace gpu {
+
+class BinaryFlatIndex;
+
+/// Inverted lists of binary codes, searched by Hamming distance
+class IVFBinary : public IVFBase {
+ public:
+  /// Construct from a binary quantizer; dim is in bits
+  IVFBinary(GpuResources* resources,
+            /// We do not own this reference
+            BinaryFlatIndex* quantizer,
+            int dim,
+            IndicesOptions indicesOptions,
+            MemorySpace space);
+
+  ~IVFBinary() override;
+
+  /// Classify and append codes to our IVF lists.
+  /// The input data must be on our current device.
+  /// Returns the number of vectors successfully added.
+  int addVectors(Tensor<unsigned char, 2, true>& vecs,
+                 Tensor<Index::idx_t, 1, true>& indices);
+
+  /// Find the approximate k nearest neigbors in Hamming distance for
+  /// `queries` against our database
+  void query(Tensor<unsigned char, 2, true>& queries,
+             int nprobe,
+             int k,
+             Tensor<int, 2, true>& outDistances,
+             Tensor<Index::idx_t, 2, true>& outIndices);
+
+ protected:
+  /// Returns the number of bytes in which an IVF list containing numVecs
+  /// vectors is encoded on the device
+  size_t getGpuVectorsEncodingSize_(int numVecs) const override;
+  size_t getCpuVectorsEncodingSize_(int numVecs) const override;
+
+  /// Translate to our preferred GPU encoding
+  std::vector<uint8_t> translateCodesToGpu_(std::vector<uint8_t> codes,
+                                            size_t numVecs) const override;
+
+  /// Translate from our preferred GPU encoding
+  std::vector<uint8_t> translateCodesFromGpu_(std::vector<uint8_t> codes,
+                                              size_t numVecs) const override;
+
+  /// Layout of the encoded vectors in our lists
+  IVFListCodeLayout getListCodeLayout_() const override;
+
+  /// Float vectors cannot be added; codes are appended in addVectors
+  void appendVectors_(Tensor<float, 2, true>& vecs,
+                      Tensor<Index::idx_t, 1, true>& indices,
+                      Tensor<int, 1, true>& listIds,
+                      Tensor<int, 1, true>& listOffset,
+                      cudaStream_t stream) override;
+
+ protected:
+  /// Binary coarse quantizer
+  BinaryFlatIndex* binaryQuantizer_;
+};
+
+} } // namespace
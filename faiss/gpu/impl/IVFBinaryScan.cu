@@ -0,0 +1,322 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#include <faiss/gpu/impl/IVFBinaryScan.cuh>
+#include <faiss/gpu/impl/IVFUtils.cuh>
+#include <faiss/gpu/GpuResources.h>
+#include <faiss/gpu/utils/DeviceDefs.cuh>
+#include <faiss/gpu/utils/DeviceUtils.h>
+#include <faiss/gpu/utils/DeviceTensor.cuh>
+#include <faiss/gpu/utils/StaticUtils.h>
+#include <limits>
+
+namespace faiss { namespace gpu {
+
+// Number of warps we create per block of IVFBinaryScan
+constexpr int kIVFBinaryScanWarps = 4;
+
+// Each block handles a single (query, list) pair; each thread computes the
+// Hamming distance of the query to separate codes in the list. The codes are
+// read as words of type BinaryType, for which the code size must be a
+// multiple of sizeof(BinaryType)
+template <typename BinaryType>
+__global__ void
+ivfBinaryScan(Tensor<unsigned char, 2, true> queries,
+              Tensor<int, 2, true> listIds,
+              void** allListData,
+              int* listLengths,
+              Tensor<int, 2, true> prefixSumOffsets,
+              Tensor<float, 1, true> distance) {
+  extern __shared__ unsigned int smemWords[];
+  BinaryType* queryWords = (BinaryType*) smemWords;
+
+  auto queryId = blockIdx.y;
+  auto probeId = blockIdx.x;
+
+  // This is where we start writing out data
+  // We ensure that before the array (at offset -1), there is a 0 value
+  int outBase = *(prefixSumOffsets[queryId][probeId].data() - 1);
+
+  auto listId = listIds[queryId][probeId];
+  // Safety guard in case no list ID was generated
+  if (listId == -1) {
+    return;
+  }
+
+  int numWords = queries.getSize(1) / sizeof(BinaryType);
+
+  // Stage the query in shared memory, since all threads use it
+  auto query = (const BinaryType*) queries[queryId].data();
+  for (int i = threadIdx.x; i < numWords; i += blockDim.x) {
+    queryWords[i] = query[i];
+  }
+
+  __syncthreads();
+
+  auto codes = (const BinaryType*) allListData[listId];
+  auto numVecs = listLengths[listId];
+  auto distanceOut = distance[outBase].data();
+
+  for (int vec = threadIdx.x; vec < numVecs; vec += blockDim.x) {
+    const BinaryType* code = codes + (size_t) vec * numWords;
+    int dist = 0;
+
+    for (int i = 0; i < numWords; ++i) {
+      dist += __popc((unsigned int) (code[i] ^ queryWords[i]));
+    }
+
+    distanceOut[vec] = (float) dist;
+  }
+}
+
+void
+runIVFBinaryScanTile(GpuResources* res,
+                     Tensor<unsigned char, 2, true>& queries,
+                     Tensor<int, 2, true>& listIds,
+                     thrust::device_vector<void*>& listData,
+                     thrust::device_vector<void*>& listIndices,
+                     IndicesOptions indicesOptions,
+                     thrust::device_vector<int>& listLengths,
+                     Tensor<char, 1, true>& thrustMem,
+                     Tensor<int, 2, true>& prefixSumOffsets,
+                     Tensor<float, 1, true>& allDistances,
+                     Tensor<float, 3, true>& heapDistances,
+                     Tensor<int, 3, true>& heapIndices,
+                     int k,
+                     Tensor<float, 2, true>& outDistances,
+                     Tensor<Index::idx_t, 2, true>& outIndices,
+                     cudaStream_t stream) {
+  int codeSize = queries.getSize(1);
+
+  // Calculate offset lengths, so we know where to write out
+  // intermediate results
+  runCalcListOffsets(
+    res, listIds, listLengths, prefixSumOffsets, thrustMem, stream);
+
+  auto grid = dim3(listIds.getSize(1), listIds.getSize(0));
+  auto block = dim3(kWarpSize * kIVFBinaryScanWarps);
+
+  // Shared memory holds the query, rounded up to whole 32 bit words
+  size_t smem = utils::roundUp(codeSize, (int) sizeof(unsigned int));
+
+  if (codeSize % sizeof(unsigned int) == 0) {
+    ivfBinaryScan<unsigned int><<<grid, block, smem, stream>>>(
+      queries,
+      listIds,
+      listData.data().get(),
+      listLengths.data().get(),
+      prefixSumOffsets,
+      allDistances);
+  } else {
+    ivfBinaryScan<unsigned char><<<grid, block, smem, stream>>>(
+      queries,
+      listIds,
+      listData.data().get(),
+      listLengths.data().get(),
+      prefixSumOffsets,
+      allDistances);
+  }
+
+  CUDA_TEST_ERROR();
+
+  // k-select the output in chunks, to increase parallelism
+  runPass1SelectLists(prefixSumOffsets,
+                      allDistances,
+                      listIds.getSize(1),
+                      k,
+                      false, // smallest distances
+                      heapDistances,
+                      heapIndices,
+                      stream);
+
+  // k-select final output
+  auto flatHeapDistances = heapDistances.downcastInner<2>();
+  auto flatHeapIndices = heapIndices.downcastInner<2>();
+
+  runPass2SelectLists(flatHeapDistances,
+                      flatHeapIndices,
+                      listIndices,
+                      indicesOptions,
+                      prefixSumOffsets,
+                      listIds,
+                      k,
+                      false, // smallest distances
+                      outDistances,
+                      outIndices,
+                      stream);
+}
+
+void
+runIVFBinaryScan(Tensor<unsigned char, 2, true>& queries,
+                 Tensor<int, 2, true>& listIds,
+                 thrust::device_vector<void*>& listData,
+                 thrust::device_vector<void*>& listIndices,
+                 IndicesOptions indicesOptions,
+                 thrust::device_vector<int>& listLengths,
+                 int maxListLength,
+                 int k,
+                 // output
+                 Tensor<float, 2, true>& outDistances,
+                 // output
+                 Tensor<Index::idx_t, 2, true>& outIndices,
+                 GpuResources* res) {
+  constexpr int kMinQueryTileSize = 8;
+  constexpr int kMaxQueryTileSize = 128;
+  constexpr int kThrustMemSize = 16384;
+
+  int nprobe = listIds.getSize(1);
+
+  auto stream = res->getDefaultStreamCurrentDevice();
+
+  // Make a reservation for Thrust to do its dirty work (global memory
+  // cross-block reduction space); hopefully this is large enough.
+  DeviceTensor<char, 1, true> thrustMem1(
+    res, makeTempAlloc(AllocType::Other, stream), {kThrustMemSize});
+  DeviceTensor<char, 1, true> thrustMem2(
+    res, makeTempAlloc(AllocType::Other, stream), {kThrustMemSize});
+  DeviceTensor<char, 1, true>* thrustMem[2] =
+    {&thrustMem1, &thrustMem2};
+
+  // How much temporary storage is available?
+  // If possible, we'd like to fit within the space available.
+  size_t sizeAvailable = res->getTempMemoryAvailableCurrentDevice();
+
+  // We run two passes of heap selection
+  // This is the size of the first-level heap passes
+  constexpr int kNProbeSplit = 8;
+  int pass2Chunks = std::min(nprobe, kNProbeSplit);
+
+  size_t sizeForFirstSelectPass =
+    pass2Chunks * k * (sizeof(float) + sizeof(int));
+
+  // How much temporary storage we need per each query
+  size_t sizePerQuery =
+    2 * // # streams
+    ((nprobe * sizeof(int) + sizeof(int)) + // prefixSumOffsets
+     nprobe * maxListLength * sizeof(float) + // allDistances
+     sizeForFirstSelectPass);
+
+  int queryTileSize = (int) (sizeAvailable / sizePerQuery);
+
+  if (queryTileSize < kMinQueryTileSize) {
+    queryTileSize = kMinQueryTileSize;
+  } else if (queryTileSize > kMaxQueryTileSize) {
+    queryTileSize = kMaxQueryTileSize;
+  }
+
+  // FIXME: we should adjust queryTileSize to deal with this, since
+  // indexing is in int32
+  FAISS_ASSERT(queryTileSize * nprobe * maxListLength <
+         std::numeric_limits<int>::max());
+
+  // Temporary memory buffers
+  // Make sure there is space prior to the start which will be 0, and
+  // will handle the boundary condition without branches
+  DeviceTensor<int, 1, true> prefixSumOffsetSpace1(
+    res, makeTempAlloc(AllocType::Other, stream), {queryTileSize * nprobe + 1});
+  DeviceTensor<int, 1, true> prefixSumOffsetSpace2(
+    res, makeTempAlloc(AllocType::Other, stream), {queryTileSize * nprobe + 1});
+
+  DeviceTensor<int, 2, true> prefixSumOffsets1(
+    prefixSumOffsetSpace1[1].data(),
+    {queryTileSize, nprobe});
+  DeviceTensor<int, 2, true> prefixSumOffsets2(
+    prefixSumOffsetSpace2[1].data(),
+    {queryTileSize, nprobe});
+  DeviceTensor<int, 2, true>* prefixSumOffsets[2] =
+    {&prefixSumOffsets1, &prefixSumOffsets2};
+
+  // Make sure the element before prefixSumOffsets is 0, since we
+  // depend upon simple, boundary-less indexing to get proper results
+  CUDA_VERIFY(cudaMemsetAsync(prefixSumOffsetSpace1.data(),
+                              0,
+                              sizeof(int),
+                              stream));
+  CUDA_VERIFY(cudaMemsetAsync(prefixSumOffsetSpace2.data(),
+                              0,
+                              sizeof(int),
+                              stream));
+
+  DeviceTensor<float, 1, true> allDistances1(
+    res, makeTempAlloc(AllocType::Other, stream),
+    {queryTileSize * nprobe * maxListLength});
+  DeviceTensor<float, 1, true> allDistances2(
+    res, makeTempAlloc(AllocType::Other, stream),
+    {queryTileSize * nprobe * maxListLength});
+  DeviceTensor<float, 1, true>* allDistances[2] =
+    {&allDistances1, &allDistances2};
+
+  DeviceTensor<float, 3, true> heapDistances1(
+    res, makeTempAlloc(AllocType::Other, stream),
+    {queryTileSize, pass2Chunks, k});
+  DeviceTensor<float, 3, true> heapDistances2(
+    res, makeTempAlloc(AllocType::Other, stream),
+    {queryTileSize, pass2Chunks, k});
+  DeviceTensor<float, 3, true>* heapDistances[2] =
+    {&heapDistances1, &heapDistances2};
+
+  DeviceTensor<int, 3, true> heapIndices1(
+    res, makeTempAlloc(AllocType::Other, stream),
+    {queryTileSize, pass2Chunks, k});
+  DeviceTensor<int, 3, true> heapIndices2(
+    res, makeTempAlloc(AllocType::Other, stream),
+    {queryTileSize, pass2Chunks, k});
+  DeviceTensor<int, 3, true>* heapIndices[2] =
+    {&heapIndices1, &heapIndices2};
+
+  auto streams = res->getAlternateStreamsCurrentDevice();
+  streamWait(streams, {stream});
+
+  int curStream = 0;
+
+  for (int query = 0; query < queries.getSize(0); query += queryTileSize) {
+    int numQueriesInTile =
+      std::min(queryTileSize, queries.getSize(0) - query);
+
+    auto prefixSumOffsetsView =
+      prefixSumOffsets[curStream]->narrowOutermost(0, numQueriesInTile);
+
+    auto listIdsView =
+      listIds.narrowOutermost(query, numQueriesInTile);
+    auto queryView =
+      queries.narrowOutermost(query, numQueriesInTile);
+
+    auto heapDistancesView =
+      heapDistances[curStream]->narrowOutermost(0, numQueriesInTile);
+    auto heapIndicesView =
+      heapIndices[curStream]->narrowOutermost(0, numQueriesInTile);
+
+    auto outDistanceView =
+      outDistances.narrowOutermost(query, numQueriesInTile);
+    auto outIndicesView =
+      outIndices.narrowOutermost(query, numQueriesInTile);
+
+    runIVFBinaryScanTile(res,
+                         queryView,
+                         listIdsView,
+                         listData,
+                         listIndices,
+                         indicesOptions,
+                         listLengths,
+                         *thrustMem[curStream],
+                         prefixSumOffsetsView,
+                         *allDistances[curStream],
+                         heapDistancesView,
+                         heapIndicesView,
+                         k,
+                         outDistanceView,
+                         outIndicesView,
+                         streams[curStream]);
+
+    curStream = (curStream + 1) % 2;
+  }
+
+  streamWait({stream}, streams);
+}
+
+} } // namespace
@@ -0,0 +1,38 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#pragma once
+
+#include <faiss/Index.h>
+#include <faiss/gpu/GpuIndicesOptions.h>
+#include <faiss/gpu/utils/Tensor.cuh>
+#include <thrust/device_vector.h>
+
+namespace faiss { namespace gpu {
+
+class GpuResources;
+
+/// Scans the inverted lists of binary codes for the given (query, list)
+/// pairs, returning the k codes of lowest Hamming distance. The
+/// distances are returned as float, since they go through the same
+/// k-selection as IVFFlat
+void runIVFBinaryScan(Tensor<unsigned char, 2, true>& queries,
+                      Tensor<int, 2, true>& listIds,
+                      thrust::device_vector<void*>& listData,
+                      thrust::device_vector<void*>& listIndices,
+                      IndicesOptions indicesOptions,
+                      thrust::device_vector<int>& listLengths,
+                      int maxListLength,
+                      int k,
+                      // output
+                      Tensor<float, 2, true>& outDistances,
+                      // output
+                      Tensor<Index::idx_t, 2, true>& outIndices,
+                      GpuResources* res);
+
+} } // namespace
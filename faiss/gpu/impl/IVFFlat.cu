@@ -11,6 +11,7 @@
 #include <faiss/gpu/impl/FlatIndex.cuh>
 #include <faiss/gpu/impl/IVFAppend.cuh>
 #include <faiss/gpu/impl/IVFFlatScan.cuh>
+#include <faiss/gpu/impl/RangeSearch.cuh>
 #include <faiss/gpu/impl/RemapIndices.h>
 #include <faiss/gpu/utils/ConversionOperators.cuh>
 #include <faiss/gpu/utils/CopyUtils.cuh>
@@ -18,7 +19,12 @@
 #include <faiss/gpu/utils/DeviceUtils.h>
 #include <faiss/gpu/utils/Float16.cuh>
 #include <faiss/gpu/utils/HostTensor.cuh>
+#include <faiss/gpu/utils/StaticUtils.h>
+#include <faiss/gpu/utils/Timer.h>
 #include <faiss/gpu/utils/Transpose.cuh>
+#include <faiss/utils/instrumentation.h>
+#include <algorithm>
+#include <cstring>
 #include <limits>
 #include <thrust/host_vector.h>
 #include <unordered_map>
@@ -31,6 +37,7 @@ IVFFlat::IVFFlat(GpuResources* res,
                  float metricArg,
                  bool useResidual,
                  faiss::ScalarQuantizer* scalarQ,
+                 bool interleavedLayout,
                  IndicesOptions indicesOptions,
                  MemorySpace space) :
     IVFBase(res,
@@ -40,7 +47,8 @@ IVFFlat::IVFFlat(GpuResources* res,
             indicesOptions,
             space),
     useResidual_(useResidual),
-    scalarQ_(scalarQ ? new GpuScalarQuantizer(res, *scalarQ) : nullptr) {
+    scalarQ_(scalarQ ? new GpuScalarQuantizer(res, *scalarQ) : nullptr),
+    interleavedLayout_(interleavedLayout) {
 }
 
 IVFFlat::~IVFFlat() {
@@ -48,6 +56,14 @@ IVFFlat::~IVFFlat() {
 
 size_t
 IVFFlat::getGpuVectorsEncodingSize_(int numVecs) const {
+  if (interleavedLayout_) {
+    // Whole groups of kWarpSize vectors, with whole codec units
+    int unitBytes = getCodecUnitBytes(scalarQ_.get());
+
+    return utils::roundUp((size_t) numVecs, (size_t) kWarpSize) *
+      utils::roundUp(getCpuVectorsEncodingSize_(1), (size_t) unitBytes);
+  }
+
   return (size_t) numVecs *
     // size per encoded vector
     (scalarQ_ ? scalarQ_->code_size : sizeof(float) * getDim());
@@ -60,18 +76,84 @@ IVFFlat::getCpuVectorsEncodingSize_(int numVecs) const {
     (scalarQ_ ? scalarQ_->code_size : sizeof(float) * getDim());
 }
 
+namespace {
+
+// Byte offset of unit `unit` of vector `vec` in the interleaved layout
+size_t interleavedOffset(size_t vec, size_t unit,
+                         size_t unitBytes, size_t numUnits) {
+  return ((vec / kWarpSize) * numUnits * kWarpSize +
+          unit * kWarpSize + vec % kWarpSize) * unitBytes;
+}
+
+}
+
 std::vector<uint8_t>
 IVFFlat::translateCodesToGpu_(std::vector<uint8_t> codes,
                               size_t numVecs) const {
-  // nothing to do
-  return codes;
+  if (!interleavedLayout_) {
+    // nothing to do
+    return codes;
+  }
+
+  size_t codeSize = getCpuVectorsEncodingSize_(1);
+  size_t unitBytes = getCodecUnitBytes(scalarQ_.get());
+  size_t numUnits = utils::divUp(codeSize, unitBytes);
+
+  // The padding of the last unit and of the last group is zero
+  std::vector<uint8_t> out(getGpuVectorsEncodingSize_(numVecs));
+
+  for (size_t i = 0; i < numVecs; ++i) {
+    for (size_t u = 0; u < numUnits; ++u) {
+      size_t n = std::min(unitBytes, codeSize - u * unitBytes);
+
+      std::memcpy(out.data() + interleavedOffset(i, u, unitBytes, numUnits),
+                  codes.data() + i * codeSize + u * unitBytes,
+                  n);
+    }
+  }
+
+  return out;
 }
 
 std::vector<uint8_t>
 IVFFlat::translateCodesFromGpu_(std::vector<uint8_t> codes,
                                 size_t numVecs) const {
-  // nothing to do
-  return codes;
+  if (!interleavedLayout_) {
+    // nothing to do
+    return codes;
+  }
+
+  size_t codeSize = getCpuVectorsEncodingSize_(1);
+  size_t unitBytes = getCodecUnitBytes(scalarQ_.get());
+  size_t numUnits = utils::divUp(codeSize, unitBytes);
+
+  std::vector<uint8_t> out(getCpuVectorsEncodingSize_(numVecs));
+
+  for (size_t i = 0; i < numVecs; ++i) {
+    for (size_t u = 0; u < numUnits; ++u) {
+      size_t n = std::min(unitBytes, codeSize - u * unitBytes);
+
+      std::memcpy(out.data() + i * codeSize + u * unitBytes,
+                  codes.data() + interleavedOffset(i, u, unitBytes, numUnits),
+                  n);
+    }
+  }
+
+  return out;
+}
+
+IVFListCodeLayout
+IVFFlat::getListCodeLayout_() const {
+  int codeSize = (int) getCpuVectorsEncodingSize_(1);
+
+  if (interleavedLayout_) {
+    int unitBytes = getCodecUnitBytes(scalarQ_.get());
+
+    return IVFListCodeLayout{kWarpSize, unitBytes,
+                             utils::divUp(codeSize, unitBytes)};
+  }
+
+  return IVFListCodeLayout{1, codeSize, 1};
 }
 
 void
@@ -103,6 +185,7 @@ IVFFlat::appendVectors_(Tensor<float, 2, true>& vecs,
                                deviceListDataPointers_,
                                deviceListIndexPointers_,
                                indicesOptions_,
+                               interleavedLayout_,
                                stream);
 }
 
@@ -116,7 +199,7 @@ IVFFlat::query(Tensor<float, 2, true>& queries,
 
   // These are caught at a higher level
   FAISS_ASSERT(nprobe <= GPU_MAX_SELECTION_K);
-  FAISS_ASSERT(k <= GPU_MAX_SELECTION_K);
+  FAISS_ASSERT(k <= GPU_MAX_LARGE_SELECTION_K);
   nprobe = std::min(nprobe, quantizer_->getSize());
 
   FAISS_ASSERT(queries.getSize(1) == dim_);
@@ -132,38 +215,88 @@ IVFFlat::query(Tensor<float, 2, true>& queries,
 
   // Find the `nprobe` closest lists; we can use int indices both
   // internally and externally
-  quantizer_->query(queries,
-                    nprobe,
-                    metric_,
-                    metricArg_,
-                    coarseDistances,
-                    coarseIndices,
-                    false);
+  {
+    GpuStageTimer timer(STAGE_COARSE_QUANTIZE, stream);
+    quantizer_->query(queries,
+                      nprobe,
+                      metric_,
+                      metricArg_,
+                      coarseDistances,
+                      coarseIndices,
+                      false);
+  }
 
-  DeviceTensor<float, 3, true> residualBase(
-    resources_, makeTempAlloc(AllocType::Other, stream),
-    {queries.getSize(0), nprobe, dim_});
+  queryPreassigned(queries,
+                   coarseIndices,
+                   k,
+                   outDistances,
+                   outIndices);
+}
 
-  if (useResidual_) {
-    // Reconstruct vectors from the quantizer
-    quantizer_->reconstruct(coarseIndices, residualBase);
-  }
+void
+IVFFlat::queryPreassigned(Tensor<float, 2, true>& queries,
+                          Tensor<int, 2, true>& coarseIndices,
+                          int k,
+                          Tensor<float, 2, true>& outDistances,
+                          Tensor<Index::idx_t, 2, true>& outIndices) {
+  auto stream = resources_->getDefaultStreamCurrentDevice();
+  int nprobe = coarseIndices.getSize(1);
+
+  FAISS_ASSERT(nprobe <= GPU_MAX_SELECTION_K);
+  FAISS_ASSERT(k <= GPU_MAX_LARGE_SELECTION_K);
+  FAISS_ASSERT(coarseIndices.getSize(0) == queries.getSize(0));
+
+  // Bring the probed lists to the GPU if they are in managed memory
+  prefetchProbedLists_(coarseIndices, stream);
+
+  // Small batches over uncompressed lists are latency bound; scan and
+  // select them in fused kernels
+  bool useFused =
+    queries.getSize(0) < kIVFFlatFusedQueryLimit &&
+    k <= kIVFFlatFusedMaxK &&
+    !scalarQ_ &&
+    !useResidual_ &&
+    !interleavedLayout_;
+
+  if (useFused) {
+    runIVFFlatScanFused(queries,
+                        coarseIndices,
+                        deviceListDataPointers_,
+                        deviceListIndexPointers_,
+                        indicesOptions_,
+                        deviceListLengths_,
+                        k,
+                        metric_,
+                        outDistances,
+                        outIndices,
+                        resources_);
+  } else {
+    DeviceTensor<float, 3, true> residualBase(
+      resources_, makeTempAlloc(AllocType::Other, stream),
+      {queries.getSize(0), nprobe, dim_});
+
+    if (useResidual_) {
+      // Reconstruct vectors from the quantizer
+      quantizer_->reconstruct(coarseIndices, residualBase);
+    }
 
-  runIVFFlatScan(queries,
-                 coarseIndices,
-                 deviceListDataPointers_,
-                 deviceListIndexPointers_,
-                 indicesOptions_,
-                 deviceListLengths_,
-                 maxListLength_,
-                 k,
-                 metric_,
-                 useResidual_,
-                 residualBase,
-                 scalarQ_.get(),
-                 outDistances,
-                 outIndices,
-                 resources_);
+    runIVFFlatScan(queries,
+                   coarseIndices,
+                   deviceListDataPointers_,
+                   deviceListIndexPointers_,
+                   indicesOptions_,
+                   deviceListLengths_,
+                   maxListLength_,
+                   k,
+                   metric_,
+                   useResidual_,
+                   residualBase,
+                   scalarQ_.get(),
+                   interleavedLayout_,
+                   outDistances,
+                   outIndices,
+                   resources_);
+  }
 
   // If the GPU isn't storing indices (they are on the CPU side), we
   // need to perform the re-mapping here
@@ -184,4 +317,86 @@ IVFFlat::query(Tensor<float, 2, true>& queries,
   }
 }
 
+void
+IVFFlat::rangeQuery(Tensor<float, 2, true>& queries,
+                    int nprobe,
+                    float radius,
+                    int maxResults,
+                    RangeSearchResult* result) {
+  auto stream = resources_->getDefaultStreamCurrentDevice();
+
+  // These are caught at a higher level
+  FAISS_ASSERT(nprobe <= GPU_MAX_SELECTION_K);
+  FAISS_ASSERT(maxResults <= GPU_MAX_LARGE_SELECTION_K);
+  nprobe = std::min(nprobe, quantizer_->getSize());
+
+  FAISS_ASSERT(queries.getSize(1) == dim_);
+
+  DeviceTensor<float, 2, true> coarseDistances(
+    resources_, makeTempAlloc(AllocType::Other, stream),
+    {queries.getSize(0), nprobe});
+  DeviceTensor<int, 2, true> coarseIndices(
+    resources_, makeTempAlloc(AllocType::Other, stream),
+    {queries.getSize(0), nprobe});
+
+  {
+    GpuStageTimer timer(STAGE_COARSE_QUANTIZE, stream);
+    quantizer_->query(queries,
+                      nprobe,
+                      metric_,
+                      metricArg_,
+                      coarseDistances,
+                      coarseIndices,
+                      false);
+  }
+
+  prefetchProbedLists_(coarseIndices, stream);
+
+  DeviceTensor<float, 3, true> residualBase(
+    resources_, makeTempAlloc(AllocType::Other, stream),
+    {queries.getSize(0), nprobe, dim_});
+
+  if (useResidual_) {
+    quantizer_->reconstruct(coarseIndices, residualBase);
+  }
+
+  // Both passes scan the same lists
+  auto scan = [&](RangeScanOutput& out) {
+    runIVFFlatRangeScan(queries,
+                        coarseIndices,
+                        deviceListDataPointers_,
+                        deviceListIndexPointers_,
+                        indicesOptions_,
+                        deviceListLengths_,
+                        maxListLength_,
+                        metric_,
+                        useResidual_,
+                        residualBase,
+                        scalarQ_.get(),
+                        interleavedLayout_,
+                        radius,
+                        out,
+                        resources_);
+  };
+
+  // The truncated queries are searched again over their nprobe lists
+  auto knn = [&](Tensor<float, 2, true>& knnQueries,
+                 int k,
+                 Tensor<float, 2, true>& outDistances,
+                 Tensor<Index::idx_t, 2, true>& outIndices) {
+    query(knnQueries, nprobe, k, outDistances, outIndices);
+  };
+
+  RangeRemapFn remap;
+
+  if (indicesOptions_ == INDICES_CPU) {
+    remap = [this](Index::idx_t* labels, size_t num) {
+      ivfOffsetToUserIndex(
+        labels, numLists_, 1, (int) num, listOffsetToUserIndex_);
+    };
+  }
+
+  runRangeSearch(resources_, queries, maxResults, scan, knn, remap, result);
+}
+
 } } // namespace
@@ -24,6 +24,9 @@ class IVFFlat : public IVFBase {
           bool useResidual,
           /// Optional ScalarQuantizer
           faiss::ScalarQuantizer* scalarQ,
+          /// Store the lists by groups of 32 vectors, dimension-major
+          /// within a group (see InterleavedCodec)
+          bool interleavedLayout,
           IndicesOptions indicesOptions,
           MemorySpace space);
 
@@ -37,6 +40,22 @@ class IVFFlat : public IVFBase {
              Tensor<float, 2, true>& outDistances,
              Tensor<Index::idx_t, 2, true>& outIndices);
 
+  /// As query, but with the `nprobe` coarse centroids of each query already
+  /// given; centroid ids may be -1 to skip a probe
+  void queryPreassigned(Tensor<float, 2, true>& queries,
+                        Tensor<int, 2, true>& coarseIndices,
+                        int k,
+                        Tensor<float, 2, true>& outDistances,
+                        Tensor<Index::idx_t, 2, true>& outIndices);
+
+  /// Range search of `queries` over their `nprobe` closest lists into
+  /// `result` (on the host); see runRangeSearch for maxResults
+  void rangeQuery(Tensor<float, 2, true>& queries,
+                  int nprobe,
+                  float radius,
+                  int maxResults,
+                  RangeSearchResult* result);
+
  protected:
   /// Returns the number of bytes in which an IVF list containing numVecs
   /// vectors is encoded on the device. Note that due to padding this is not the
@@ -53,6 +72,9 @@ class IVFFlat : public IVFBase {
   std::vector<uint8_t> translateCodesFromGpu_(std::vector<uint8_t> codes,
                                               size_t numVecs) const override;
 
+  /// Layout of the encoded vectors in our lists
+  IVFListCodeLayout getListCodeLayout_() const override;
+
   /// Encode the vectors that we're adding and append to our IVF lists
   void appendVectors_(Tensor<float, 2, true>& vecs,
                       Tensor<Index::idx_t, 1, true>& indices,
@@ -66,6 +88,9 @@ class IVFFlat : public IVFBase {
 
   /// Scalar quantizer for encoded vectors, if any
   std::unique_ptr<GpuScalarQuantizer> scalarQ_;
+
+  /// Are the lists in the interleaved layout?
+  bool interleavedLayout_;
 };
 
 } } // namespace
@@ -15,12 +15,17 @@
 #include <faiss/gpu/utils/DeviceUtils.h>
 #include <faiss/gpu/utils/DeviceTensor.cuh>
 #include <faiss/gpu/utils/Float16.cuh>
+#include <faiss/gpu/utils/Limits.cuh>
 #include <faiss/gpu/utils/MathOperators.cuh>
 #include <faiss/gpu/utils/LoadStoreOperators.cuh>
 #include <faiss/gpu/utils/PtxUtils.cuh>
 #include <faiss/gpu/utils/Reductions.cuh>
+#include <faiss/gpu/utils/Select.cuh>
 #include <faiss/gpu/utils/StaticUtils.h>
+#include <faiss/gpu/utils/Timer.h>
+#include <faiss/utils/instrumentation.h>
 #include <thrust/host_vector.h>
+#include <type_traits>
 
 namespace faiss { namespace gpu {
 
@@ -127,7 +132,70 @@ struct IVFFlatScan {
   }
 };
 
+// For the interleaved list layout (see InterleavedCodec): each lane handles
+// one vector of a group of kWarpSize, so the loads of a warp are coalesced
+// and no reduction across lanes is needed
 template <typename Codec, typename Metric>
+struct IVFFlatInterleavedScan {
+  static __device__ void scan(float* query,
+                              bool useResidual,
+                              float* residualBaseSlice,
+                              void* vecData,
+                              const Codec& codec,
+                              const Metric& metric,
+                              int numVecs,
+                              int dim,
+                              float* distanceOut) {
+    int limit = utils::divDown(dim, Codec::kDimPerIter);
+
+    int warpId = threadIdx.x / kWarpSize;
+    int laneId = threadIdx.x % kWarpSize;
+
+    int numGroups = utils::divUp(numVecs, kWarpSize);
+
+    // The warps take the groups of vectors in turn
+    for (int group = warpId; group < numGroups; group += kIVFFlatScanWarps) {
+      // The padding of the last group is allocated, its lanes compute a
+      // distance that is not written out
+      int vec = group * kWarpSize + laneId;
+      Metric dist = metric.zero();
+
+      for (int d = 0; d < limit; ++d) {
+        int realDim = d * Codec::kDimPerIter;
+        float vecVal[Codec::kDimPerIter];
+
+        codec.decode(vecData, vec, d, vecVal);
+
+#pragma unroll
+        for (int j = 0; j < Codec::kDimPerIter; ++j) {
+          vecVal[j] += useResidual ? residualBaseSlice[realDim + j] : 0.0f;
+        }
+
+#pragma unroll
+        for (int j = 0; j < Codec::kDimPerIter; ++j) {
+          dist.handle(query[realDim + j], vecVal[j]);
+        }
+      }
+
+      // Remainder of the last decoder unit, handled by the same lane
+      if (Codec::kDimPerIter > 1) {
+        for (int realDim = limit * Codec::kDimPerIter; realDim < dim;
+             ++realDim) {
+          float vecVal = codec.decodePartial(
+            vecData, vec, limit, realDim - limit * Codec::kDimPerIter);
+          vecVal += useResidual ? residualBaseSlice[realDim] : 0.0f;
+          dist.handle(query[realDim], vecVal);
+        }
+      }
+
+      if (vec < numVecs) {
+        distanceOut[vec] = dist.reduce();
+      }
+    }
+  }
+};
+
+template <typename Codec, typename Metric, bool Interleaved>
 __global__ void
 ivfFlatScan(Tensor<float, 2, true> queries,
             bool useResidual,
@@ -164,52 +232,59 @@ ivfFlatScan(Tensor<float, 2, true> queries,
 
   codec.setSmem(smem, dim);
 
-  IVFFlatScan<Codec, Metric>::scan(query,
-                                   useResidual,
-                                   residualBaseSlice,
-                                   vecs,
-                                   codec,
-                                   metric,
-                                   numVecs,
-                                   dim,
-                                   distanceOut);
+  using Scan = typename std::conditional<
+    Interleaved,
+    IVFFlatInterleavedScan<Codec, Metric>,
+    IVFFlatScan<Codec, Metric>>::type;
+
+  Scan::scan(query,
+             useResidual,
+             residualBaseSlice,
+             vecs,
+             codec,
+             metric,
+             numVecs,
+             dim,
+             distanceOut);
 }
 
+// Computes the distances between each query of the tile and all the
+// entries of its probed lists, concatenated in allDistances at the offsets
+// given by prefixSumOffsets
 void
-runIVFFlatScanTile(GpuResources* res,
-                   Tensor<float, 2, true>& queries,
-                   Tensor<int, 2, true>& listIds,
-                   thrust::device_vector<void*>& listData,
-                   thrust::device_vector<void*>& listIndices,
-                   IndicesOptions indicesOptions,
-                   thrust::device_vector<int>& listLengths,
-                   Tensor<char, 1, true>& thrustMem,
-                   Tensor<int, 2, true>& prefixSumOffsets,
-                   Tensor<float, 1, true>& allDistances,
-                   Tensor<float, 3, true>& heapDistances,
-                   Tensor<int, 3, true>& heapIndices,
-                   int k,
-                   faiss::MetricType metricType,
-                   bool useResidual,
-                   Tensor<float, 3, true>& residualBase,
-                   GpuScalarQuantizer* scalarQ,
-                   Tensor<float, 2, true>& outDistances,
-                   Tensor<Index::idx_t, 2, true>& outIndices,
-                   cudaStream_t stream) {
+runIVFFlatListDistances(GpuResources* res,
+                        Tensor<float, 2, true>& queries,
+                        Tensor<int, 2, true>& listIds,
+                        thrust::device_vector<void*>& listData,
+                        thrust::device_vector<int>& listLengths,
+                        Tensor<char, 1, true>& thrustMem,
+                        Tensor<int, 2, true>& prefixSumOffsets,
+                        Tensor<float, 1, true>& allDistances,
+                        faiss::MetricType metricType,
+                        bool useResidual,
+                        Tensor<float, 3, true>& residualBase,
+                        GpuScalarQuantizer* scalarQ,
+                        bool interleavedLayout,
+                        cudaStream_t stream) {
   int dim = queries.getSize(1);
 
+  // Size of an encoded vector in the row-major layout
+  int codeSize = scalarQ ? scalarQ->code_size : dim * sizeof(float);
+
   // Check the amount of shared memory per block available based on our type is
   // sufficient
   if (scalarQ &&
       (scalarQ->qtype == ScalarQuantizer::QuantizerType::QT_8bit ||
-       scalarQ->qtype == ScalarQuantizer::QuantizerType::QT_4bit)) {
+       scalarQ->qtype == ScalarQuantizer::QuantizerType::QT_4bit ||
+       scalarQ->qtype == ScalarQuantizer::QuantizerType::QT_6bit)) {
     int maxDim = getMaxSharedMemPerBlockCurrentDevice() /
       (sizeof(float) * 2);
 
     FAISS_THROW_IF_NOT_FMT(dim < maxDim,
                            "Insufficient shared memory available on the GPU "
-                           "for QT_8bit or QT_4bit with %d dimensions; "
-                           "maximum dimensions possible is %d", dim, maxDim);
+                           "for QT_8bit, QT_6bit or QT_4bit with %d "
+                           "dimensions; maximum dimensions possible is %d",
+                           dim, maxDim);
   }
 
 
@@ -221,22 +296,33 @@ runIVFFlatScanTile(GpuResources* res,
   auto grid = dim3(listIds.getSize(1), listIds.getSize(0));
   auto block = dim3(kWarpSize * kIVFFlatScanWarps);
 
-#define RUN_IVF_FLAT                                                    \
+#define LAUNCH_IVF_FLAT(CODEC, INTERLEAVED)                             \
   do {                                                                  \
-    ivfFlatScan                                                         \
-      <<<grid, block, codec.getSmemSize(dim), stream>>>(                \
+    ivfFlatScan<decltype(CODEC), decltype(metric), INTERLEAVED>         \
+      <<<grid, block, CODEC.getSmemSize(dim), stream>>>(                \
         queries,                                                        \
         useResidual,                                                    \
         residualBase,                                                   \
         listIds,                                                        \
         listData.data().get(),                                          \
         listLengths.data().get(),                                       \
-        codec,                                                          \
+        CODEC,                                                          \
         metric,                                                         \
         prefixSumOffsets,                                               \
         allDistances);                                                  \
   } while (0)
 
+#define RUN_IVF_FLAT                                                    \
+  do {                                                                  \
+    if (interleavedLayout) {                                            \
+      auto icodec = makeInterleavedCodec(                               \
+        codec, getCodecUnitBytes(scalarQ), codeSize);                   \
+      LAUNCH_IVF_FLAT(icodec, true);                                    \
+    } else {                                                            \
+      LAUNCH_IVF_FLAT(codec, false);                                    \
+    }                                                                   \
+  } while (0)
+
 #define HANDLE_METRICS                                  \
     do {                                                \
       if (metricType == MetricType::METRIC_L2) {        \
@@ -323,6 +409,15 @@ runIVFFlatScanTile(GpuResources* res,
         HANDLE_METRICS;
       }
       break;
+      case ScalarQuantizer::QuantizerType::QT_6bit:
+      {
+        Codec<ScalarQuantizer::QuantizerType::QT_6bit, 1>
+          codec(scalarQ->code_size,
+                scalarQ->gpuTrained.data(),
+                scalarQ->gpuTrained.data() + dim);
+        HANDLE_METRICS;
+      }
+      break;
       default:
         // unimplemented, should be handled at a higher level
         FAISS_ASSERT(false);
@@ -333,6 +428,66 @@ runIVFFlatScanTile(GpuResources* res,
 
 #undef HANDLE_METRICS
 #undef RUN_IVF_FLAT
+#undef LAUNCH_IVF_FLAT
+}
+
+void
+runIVFFlatScanTile(GpuResources* res,
+                   Tensor<float, 2, true>& queries,
+                   Tensor<int, 2, true>& listIds,
+                   thrust::device_vector<void*>& listData,
+                   thrust::device_vector<void*>& listIndices,
+                   IndicesOptions indicesOptions,
+                   thrust::device_vector<int>& listLengths,
+                   Tensor<char, 1, true>& thrustMem,
+                   Tensor<int, 2, true>& prefixSumOffsets,
+                   Tensor<float, 1, true>& allDistances,
+                   Tensor<float, 3, true>& heapDistances,
+                   Tensor<int, 3, true>& heapIndices,
+                   int k,
+                   faiss::MetricType metricType,
+                   bool useResidual,
+                   Tensor<float, 3, true>& residualBase,
+                   GpuScalarQuantizer* scalarQ,
+                   bool interleavedLayout,
+                   Tensor<float, 2, true>& outDistances,
+                   Tensor<Index::idx_t, 2, true>& outIndices,
+                   cudaStream_t stream) {
+  GpuStageTimer scanTimer(STAGE_LIST_SCAN, stream);
+  runIVFFlatListDistances(res,
+                          queries,
+                          listIds,
+                          listData,
+                          listLengths,
+                          thrustMem,
+                          prefixSumOffsets,
+                          allDistances,
+                          metricType,
+                          useResidual,
+                          residualBase,
+                          scalarQ,
+                          interleavedLayout,
+                          stream);
+  scanTimer.stop();
+
+  GpuStageTimer selectTimer(STAGE_SELECT, stream);
+
+  if (k > GPU_MAX_SELECTION_K) {
+    // Beyond the heap-based selection; select directly over the
+    // concatenated list distances of each query
+    runLargeSelectLists(prefixSumOffsets,
+                        allDistances,
+                        listIndices,
+                        indicesOptions,
+                        listIds,
+                        k,
+                        metricToSortDirection(metricType),
+                        outDistances,
+                        outIndices,
+                        res,
+                        stream);
+    return;
+  }
 
   // k-select the output in chunks, to increase parallelism
   runPass1SelectLists(prefixSumOffsets,
@@ -374,6 +529,7 @@ runIVFFlatScan(Tensor<float, 2, true>& queries,
                bool useResidual,
                Tensor<float, 3, true>& residualBase,
                GpuScalarQuantizer* scalarQ,
+               bool interleavedLayout,
                // output
                Tensor<float, 2, true>& outDistances,
                // output
@@ -403,7 +559,9 @@ runIVFFlatScan(Tensor<float, 2, true>& queries,
   // We run two passes of heap selection
   // This is the size of the first-level heap passes
   constexpr int kNProbeSplit = 8;
-  int pass2Chunks = std::min(nprobe, kNProbeSplit);
+  // The large-k selection does not use the first-level heaps
+  int pass2Chunks =
+    k > GPU_MAX_SELECTION_K ? 1 : std::min(nprobe, kNProbeSplit);
 
   size_t sizeForFirstSelectPass =
     pass2Chunks * k * (sizeof(float) + sizeof(int));
@@ -529,6 +687,7 @@ runIVFFlatScan(Tensor<float, 2, true>& queries,
                        useResidual,
                        residualBaseView,
                        scalarQ,
+                       interleavedLayout,
                        outDistanceView,
                        outIndicesView,
                        streams[curStream]);
@@ -539,4 +698,357 @@ runIVFFlatScan(Tensor<float, 2, true>& queries,
   streamWait({stream}, streams);
 }
 
+void
+runIVFFlatRangeScan(Tensor<float, 2, true>& queries,
+                    Tensor<int, 2, true>& listIds,
+                    thrust::device_vector<void*>& listData,
+                    thrust::device_vector<void*>& listIndices,
+                    IndicesOptions indicesOptions,
+                    thrust::device_vector<int>& listLengths,
+                    int maxListLength,
+                    faiss::MetricType metric,
+                    bool useResidual,
+                    Tensor<float, 3, true>& residualBase,
+                    GpuScalarQuantizer* scalarQ,
+                    bool interleavedLayout,
+                    float radius,
+                    RangeScanOutput& out,
+                    GpuResources* res) {
+  constexpr int kMinQueryTileSize = 8;
+  constexpr int kMaxQueryTileSize = 128;
+  constexpr int kThrustMemSize = 16384;
+
+  int nprobe = listIds.getSize(1);
+
+  auto stream = res->getDefaultStreamCurrentDevice();
+
+  DeviceTensor<char, 1, true> thrustMem(
+    res, makeTempAlloc(AllocType::Other, stream), {kThrustMemSize});
+
+  // There is no k-selection; the tiles are compacted on a single stream as
+  // the results of each query must be written in order
+  size_t sizePerQuery =
+    (nprobe * sizeof(int) + sizeof(int)) + // prefixSumOffsets
+    nprobe * maxListLength * sizeof(float); // allDistances
+
+  int queryTileSize =
+    (int) (res->getTempMemoryAvailableCurrentDevice() / sizePerQuery);
+  queryTileSize =
+    std::min(std::max(queryTileSize, kMinQueryTileSize), kMaxQueryTileSize);
+
+  FAISS_ASSERT(queryTileSize * nprobe * maxListLength <
+         std::numeric_limits<int>::max());
+
+  // The element before the start of prefixSumOffsets is 0
+  DeviceTensor<int, 1, true> prefixSumOffsetSpace(
+    res, makeTempAlloc(AllocType::Other, stream), {queryTileSize * nprobe + 1});
+  DeviceTensor<int, 2, true> prefixSumOffsets(
+    prefixSumOffsetSpace[1].data(),
+    {queryTileSize, nprobe});
+  CUDA_VERIFY(cudaMemsetAsync(prefixSumOffsetSpace.data(),
+                              0,
+                              sizeof(int),
+                              stream));
+
+  DeviceTensor<float, 1, true> allDistances(
+    res, makeTempAlloc(AllocType::Other, stream),
+    {queryTileSize * nprobe * maxListLength});
+
+  for (int query = 0; query < queries.getSize(0); query += queryTileSize) {
+    int numQueriesInTile =
+      std::min(queryTileSize, queries.getSize(0) - query);
+
+    auto prefixSumOffsetsView =
+      prefixSumOffsets.narrowOutermost(0, numQueriesInTile);
+    auto listIdsView =
+      listIds.narrowOutermost(query, numQueriesInTile);
+    auto queryView =
+      queries.narrowOutermost(query, numQueriesInTile);
+    auto residualBaseView =
+      residualBase.narrowOutermost(query, numQueriesInTile);
+
+    runIVFFlatListDistances(res,
+                            queryView,
+                            listIdsView,
+                            listData,
+                            listLengths,
+                            thrustMem,
+                            prefixSumOffsetsView,
+                            allDistances,
+                            metric,
+                            useResidual,
+                            residualBaseView,
+                            scalarQ,
+                            interleavedLayout,
+                            stream);
+
+    runRangeCompactLists(prefixSumOffsetsView,
+                         allDistances,
+                         listIdsView,
+                         listIndices,
+                         indicesOptions,
+                         query,
+                         metricToSortDirection(metric),
+                         radius,
+                         out,
+                         stream);
+  }
+}
+
+//
+// Low-latency path for small query batches
+//
+
+// Scans a single (query, probe) list of uncompressed float vectors and
+// k-selects its distances in the same kernel, so no intermediate
+// distance buffer or list prefix sums are needed
+template <typename Metric,
+          int ThreadsPerBlock,
+          int NumWarpQ,
+          int NumThreadQ,
+          bool Dir>
+__global__ void
+ivfFlatScanSelect(Tensor<float, 2, true> queries,
+                  Tensor<int, 2, true> listIds,
+                  void** allListData,
+                  int* listLengths,
+                  int k,
+                  Tensor<float, 3, true> heapDistances,
+                  Tensor<int, 3, true> heapIndices) {
+  constexpr int kNumWarps = ThreadsPerBlock / kWarpSize;
+
+  __shared__ float smemK[kNumWarps * NumWarpQ];
+  __shared__ int smemV[kNumWarps * NumWarpQ];
+
+  // Distances for the current chunk of list vectors
+  __shared__ float smemDist[ThreadsPerBlock];
+
+  constexpr auto kInit = Dir ? kFloatMin : kFloatMax;
+  BlockSelect<float, int, Dir, Comparator<float>,
+              NumWarpQ, NumThreadQ, ThreadsPerBlock>
+    heap(kInit, -1, smemK, smemV, k);
+
+  auto queryId = blockIdx.y;
+  auto probeId = blockIdx.x;
+
+  auto listId = listIds[queryId][probeId];
+
+  // Safety guard in case NaNs in input cause no list ID to be
+  // generated; the heap is then written out with its initial values
+  int numVecs = listId == -1 ? 0 : listLengths[listId];
+  auto vecs = listId == -1 ? nullptr : (const float*) allListData[listId];
+
+  auto query = queries[queryId].data();
+  int dim = queries.getSize(1);
+
+  int warpId = threadIdx.x / kWarpSize;
+  int laneId = threadIdx.x % kWarpSize;
+
+  // The loop bounds are uniform across the block, so every thread takes
+  // part in each BlockSelect add
+  for (int base = 0; base < numVecs; base += ThreadsPerBlock) {
+    int num = min(ThreadsPerBlock, numVecs - base);
+
+    // Each warp handles a separate vector at a time
+    for (int i = warpId; i < num; i += kNumWarps) {
+      auto vec = vecs + (size_t) (base + i) * dim;
+      Metric dist;
+
+      for (int d = laneId; d < dim; d += kWarpSize) {
+        dist.handle(query[d], vec[d]);
+      }
+
+      auto warpDist = warpReduceAllSum(dist.reduce());
+
+      if (laneId == 0) {
+        smemDist[i] = warpDist;
+      }
+    }
+
+    __syncthreads();
+
+    bool valid = threadIdx.x < num;
+    heap.add(valid ? smemDist[threadIdx.x] : kInit,
+             valid ? base + threadIdx.x : -1);
+
+    // smemDist is overwritten by the next chunk
+    __syncthreads();
+  }
+
+  heap.reduce();
+
+  for (int i = threadIdx.x; i < k; i += blockDim.x) {
+    heapDistances[queryId][probeId][i] = smemK[i];
+    heapIndices[queryId][probeId][i] = smemV[i];
+  }
+}
+
+// Merges the k results of all probes of a query, and translates the
+// selected list offsets into user indices
+template <int ThreadsPerBlock,
+          int NumWarpQ,
+          int NumThreadQ,
+          bool Dir>
+__global__ void
+ivfFlatMergeSelect(Tensor<float, 2, true> heapDistances,
+                   Tensor<int, 2, true> heapIndices,
+                   Tensor<int, 2, true> listIds,
+                   void** listIndices,
+                   int k,
+                   IndicesOptions opt,
+                   Tensor<float, 2, true> outDistances,
+                   Tensor<Index::idx_t, 2, true> outIndices) {
+  constexpr int kNumWarps = ThreadsPerBlock / kWarpSize;
+
+  __shared__ float smemK[kNumWarps * NumWarpQ];
+  __shared__ int smemV[kNumWarps * NumWarpQ];
+
+  constexpr auto kInit = Dir ? kFloatMin : kFloatMax;
+  BlockSelect<float, int, Dir, Comparator<float>,
+              NumWarpQ, NumThreadQ, ThreadsPerBlock>
+    heap(kInit, -1, smemK, smemV, k);
+
+  auto queryId = blockIdx.x;
+  int num = heapDistances.getSize(1);
+  int limit = utils::roundDown(num, kWarpSize);
+
+  int i = threadIdx.x;
+  auto heapDistanceStart = heapDistances[queryId];
+
+  // BlockSelect add cannot be used in a warp divergent circumstance; we
+  // handle the remainder warp below
+  for (; i < limit; i += blockDim.x) {
+    heap.add(heapDistanceStart[i], i);
+  }
+
+  if (i < num) {
+    heap.addThreadQ(heapDistanceStart[i], i);
+  }
+
+  heap.reduce();
+
+  for (int i = threadIdx.x; i < k; i += blockDim.x) {
+    outDistances[queryId][i] = smemK[i];
+
+    // `v` is the index in `heapIndices`, which holds k entries per
+    // probe; the entry itself is the offset within the probed list
+    int v = smemV[i];
+    int listOffset = v == -1 ? -1 : heapIndices[queryId][v];
+    Index::idx_t index = -1;
+
+    if (listOffset != -1) {
+      int listId = listIds[queryId][v / k];
+
+      if (opt == INDICES_32_BIT) {
+        index = (Index::idx_t) ((int*) listIndices[listId])[listOffset];
+      } else if (opt == INDICES_64_BIT) {
+        index = ((Index::idx_t*) listIndices[listId])[listOffset];
+      } else {
+        index = ((Index::idx_t) listId << 32 | (Index::idx_t) listOffset);
+      }
+    }
+
+    outIndices[queryId][i] = index;
+  }
+}
+
+void
+runIVFFlatScanFused(Tensor<float, 2, true>& queries,
+                    Tensor<int, 2, true>& listIds,
+                    thrust::device_vector<void*>& listData,
+                    thrust::device_vector<void*>& listIndices,
+                    IndicesOptions indicesOptions,
+                    thrust::device_vector<int>& listLengths,
+                    int k,
+                    faiss::MetricType metric,
+                    // output
+                    Tensor<float, 2, true>& outDistances,
+                    // output
+                    Tensor<Index::idx_t, 2, true>& outIndices,
+                    GpuResources* res) {
+  // These are caught at a higher level
+  FAISS_ASSERT(queries.getSize(0) < kIVFFlatFusedQueryLimit);
+  FAISS_ASSERT(k <= kIVFFlatFusedMaxK);
+
+  int numQueries = queries.getSize(0);
+  int nprobe = listIds.getSize(1);
+
+  auto stream = res->getDefaultStreamCurrentDevice();
+
+  // The scan and the selection are fused
+  GpuStageTimer scanTimer(STAGE_LIST_SCAN, stream);
+
+  // k results per (query, probe) pair
+  DeviceTensor<float, 3, true> heapDistances(
+    res, makeTempAlloc(AllocType::Other, stream), {numQueries, nprobe, k});
+  DeviceTensor<int, 3, true> heapIndices(
+    res, makeTempAlloc(AllocType::Other, stream), {numQueries, nprobe, k});
+
+  auto flatHeapDistances = heapDistances.downcastInner<2>();
+  auto flatHeapIndices = heapIndices.downcastInner<2>();
+
+  bool dir = metricToSortDirection(metric);
+
+  auto scanGrid = dim3(nprobe, numQueries);
+  auto mergeGrid = dim3(numQueries);
+
+#define RUN_FUSED(NUM_WARP_Q, NUM_THREAD_Q, DIR)                        \
+  do {                                                                  \
+    if (metric == MetricType::METRIC_L2) {                              \
+      ivfFlatScanSelect<L2Distance, 128, NUM_WARP_Q, NUM_THREAD_Q, DIR> \
+        <<<scanGrid, 128, 0, stream>>>(queries,                         \
+                                       listIds,                         \
+                                       listData.data().get(),           \
+                                       listLengths.data().get(),        \
+                                       k,                               \
+                                       heapDistances,                   \
+                                       heapIndices);                    \
+    } else {                                                            \
+      ivfFlatScanSelect<IPDistance, 128, NUM_WARP_Q, NUM_THREAD_Q, DIR> \
+        <<<scanGrid, 128, 0, stream>>>(queries,                         \
+                                       listIds,                         \
+                                       listData.data().get(),           \
+                                       listLengths.data().get(),        \
+                                       k,                               \
+                                       heapDistances,                   \
+                                       heapIndices);                    \
+    }                                                                   \
+    ivfFlatMergeSelect<128, NUM_WARP_Q, NUM_THREAD_Q, DIR>              \
+      <<<mergeGrid, 128, 0, stream>>>(flatHeapDistances,                \
+                                      flatHeapIndices,                  \
+                                      listIds,                          \
+                                      listIndices.data().get(),         \
+                                      k,                                \
+                                      indicesOptions,                   \
+                                      outDistances,                     \
+                                      outIndices);                      \
+    CUDA_TEST_ERROR();                                                  \
+    return; /* success */                                               \
+  } while (0)
+
+#define RUN_FUSED_DIR(DIR)                                \
+  do {                                                    \
+    if (k == 1) {                                         \
+      RUN_FUSED(1, 1, DIR);                               \
+    } else if (k <= 32) {                                 \
+      RUN_FUSED(32, 2, DIR);                              \
+    } else if (k <= 64) {                                 \
+      RUN_FUSED(64, 3, DIR);                              \
+    } else if (k <= 128) {                                \
+      RUN_FUSED(128, 3, DIR);                             \
+    } else if (k <= 256) {                                \
+      RUN_FUSED(256, 4, DIR);                             \
+    }                                                     \
+  } while (0)
+
+  if (dir) {
+    RUN_FUSED_DIR(true);
+  } else {
+    RUN_FUSED_DIR(false);
+  }
+
+#undef RUN_FUSED_DIR
+#undef RUN_FUSED
+}
+
 } } // namespace
@@ -11,6 +11,7 @@
 #include <faiss/MetricType.h>
 #include <faiss/gpu/GpuIndicesOptions.h>
 #include <faiss/gpu/impl/GpuScalarQuantizer.cuh>
+#include <faiss/gpu/impl/RangeSearch.cuh>
 #include <faiss/gpu/utils/Tensor.cuh>
 #include <thrust/device_vector.h>
 
@@ -30,10 +31,57 @@ void runIVFFlatScan(Tensor<float, 2, true>& queries,
                     bool useResidual,
                     Tensor<float, 3, true>& residualBase,
                     GpuScalarQuantizer* scalarQ,
+                    /// codes stored in the interleaved layout (see
+                    /// InterleavedCodec)
+                    bool interleavedLayout,
                     // output
                     Tensor<float, 2, true>& outDistances,
                     // output
                     Tensor<Index::idx_t, 2, true>& outIndices,
                     GpuResources* res);
 
+/// Range search variant of runIVFFlatScan: the distances to the entries of
+/// the probed lists are compacted into `out` instead of k-selected (see
+/// runRangeSearch)
+void runIVFFlatRangeScan(Tensor<float, 2, true>& queries,
+                         Tensor<int, 2, true>& listIds,
+                         thrust::device_vector<void*>& listData,
+                         thrust::device_vector<void*>& listIndices,
+                         IndicesOptions indicesOptions,
+                         thrust::device_vector<int>& listLengths,
+                         int maxListLength,
+                         faiss::MetricType metric,
+                         bool useResidual,
+                         Tensor<float, 3, true>& residualBase,
+                         GpuScalarQuantizer* scalarQ,
+                         bool interleavedLayout,
+                         float radius,
+                         RangeScanOutput& out,
+                         GpuResources* res);
+
+/// Batches of fewer queries than this may use runIVFFlatScanFused
+constexpr int kIVFFlatFusedQueryLimit = 64;
+
+/// Largest k handled by runIVFFlatScanFused
+constexpr int kIVFFlatFusedMaxK = 256;
+
+/// Low-latency variant of runIVFFlatScan for small query batches over
+/// uncompressed float lists. Each (query, probe) list is scanned and
+/// k-selected in a single kernel, followed by one merge kernel per query,
+/// instead of the tiled multi-stream scan with intermediate distance
+/// buffers, list prefix sums and two selection passes
+void runIVFFlatScanFused(Tensor<float, 2, true>& queries,
+                         Tensor<int, 2, true>& listIds,
+                         thrust::device_vector<void*>& listData,
+                         thrust::device_vector<void*>& listIndices,
+                         IndicesOptions indicesOptions,
+                         thrust::device_vector<int>& listLengths,
+                         int k,
+                         faiss::MetricType metric,
+                         // output
+                         Tensor<float, 2, true>& outDistances,
+                         // output
+                         Tensor<Index::idx_t, 2, true>& outIndices,
+                         GpuResources* res);
+
 } } // namespace
@@ -24,7 +24,11 @@
 #include <faiss/gpu/utils/HostTensor.cuh>
 #include <faiss/gpu/utils/MatrixMult.cuh>
 #include <faiss/gpu/utils/NoTypeTensor.cuh>
+#include <faiss/gpu/utils/Timer.h>
 #include <faiss/gpu/utils/Transpose.cuh>
+#include <faiss/impl/ProductQuantizer.h>
+#include <faiss/impl/pq4_fast_scan.h>
+#include <faiss/utils/instrumentation.h>
 #include <limits>
 #include <thrust/host_vector.h>
 #include <type_traits>
@@ -41,6 +45,7 @@ IVFPQ::IVFPQ(GpuResources* resources,
              bool useFloat16LookupTables,
              bool useMMCodeDistance,
              bool alternativeLayout,
+             bool fastScanLayout,
              float* pqCentroidData,
              IndicesOptions indicesOptions,
              MemorySpace space) :
@@ -53,16 +58,21 @@ IVFPQ::IVFPQ(GpuResources* resources,
     numSubQuantizers_(numSubQuantizers),
     bitsPerSubQuantizer_(bitsPerSubQuantizer),
     numSubQuantizerCodes_(utils::pow2(bitsPerSubQuantizer_)),
+    bytesPerSubQuantizerCode_(bitsPerSubQuantizer_ <= 8 ? 1 : 2),
     dimPerSubQuantizer_(dim_ / numSubQuantizers),
     useFloat16LookupTables_(useFloat16LookupTables),
     useMMCodeDistance_(useMMCodeDistance),
     alternativeLayout_(alternativeLayout),
-    precomputedCodes_(false) {
+    fastScanLayout_(fastScanLayout),
+    precomputedCodes_(false),
+    precomputedTableMaxBytes_((size_t) 1 << 31),
+    precomputedCodesOnTheFly_(false) {
   FAISS_ASSERT(pqCentroidData);
 
-  FAISS_ASSERT(bitsPerSubQuantizer_ <= 8);
+  FAISS_ASSERT(isSupportedBitsPerCode(bitsPerSubQuantizer_));
   FAISS_ASSERT(dim_ % numSubQuantizers_ == 0);
-  FAISS_ASSERT(isSupportedPQCodeLength(numSubQuantizers_));
+  FAISS_ASSERT(!fastScanLayout_ ||
+               (bitsPerSubQuantizer_ == 4 && !alternativeLayout_));
 
   setPQCentroids_(pqCentroidData);
 }
@@ -95,6 +105,11 @@ IVFPQ::isSupportedPQCodeLength(int size) {
   }
 }
 
+bool
+IVFPQ::isSupportedBitsPerCode(int bits) {
+  return bits >= 1 && bits <= 16;
+}
+
 void
 IVFPQ::setPrecomputedCodes(bool enable) {
   if (enable && metric_ == MetricType::METRIC_INNER_PRODUCT) {
@@ -103,6 +118,12 @@ IVFPQ::setPrecomputedCodes(bool enable) {
     return;
   }
 
+  if (enable && fastScanLayout_) {
+    fprintf(stderr, "Precomputed codes are not supported for GpuIndexIVFPQ "
+                    "with the fast-scan layout");
+    return;
+  }
+
   if (precomputedCodes_ != enable) {
     precomputedCodes_ = enable;
 
@@ -112,16 +133,80 @@ IVFPQ::setPrecomputedCodes(bool enable) {
       // Clear out old precomputed code data
       precomputedCode_ = DeviceTensor<float, 3, true>();
       precomputedCodeHalf_ = DeviceTensor<half, 3, true>();
+      precomputedCodesOnTheFly_ = false;
     }
   }
 }
 
+void
+IVFPQ::setPrecomputedTableMaxBytes(size_t bytes) {
+  precomputedTableMaxBytes_ = bytes;
+
+  if (precomputedCodes_) {
+    precomputeCodes_();
+  }
+}
+
+bool
+IVFPQ::getPrecomputedCodesOnTheFly() const {
+  return precomputedCodes_ && precomputedCodesOnTheFly_;
+}
+
+IVFListCodeLayout
+IVFPQ::getListCodeLayout_() const {
+  // The 4-bit codes of the fast-scan blocks are packed and permuted within
+  // a block
+  FAISS_THROW_IF_NOT_MSG(!fastScanLayout_,
+                         "removing entries is not supported with the "
+                         "fast-scan list layout");
+
+  if (alternativeLayout_) {
+    return IVFListCodeLayout{32, bytesPerSubQuantizerCode_, numSubQuantizers_};
+  }
+
+  return IVFListCodeLayout{
+    1, numSubQuantizers_ * bytesPerSubQuantizerCode_, 1};
+}
+
 void
 IVFPQ::appendVectors_(Tensor<float, 2, true>& vecs,
                       Tensor<Index::idx_t, 1, true>& indices,
                       Tensor<int, 1, true>& listIds,
                       Tensor<int, 1, true>& listOffset,
                       cudaStream_t stream) {
+  // If the codebook of a sub-quantizer fits in shared memory, the residuals
+  // and the encodings are computed on the fly by the append kernel
+  size_t smem = getIVFPQEncodeAppendSharedMem(numSubQuantizerCodes_,
+                                              dimPerSubQuantizer_);
+
+  if (smem <= getMaxSharedMemPerBlockCurrentDevice()) {
+    int numSubQuantizersPadded =
+      fastScanLayout_ ? utils::roundUp(numSubQuantizers_, 2) : 0;
+
+    if (quantizer_->getUseFloat16()) {
+      auto& coarseCentroids = quantizer_->getVectorsFloat16Ref();
+      runIVFPQEncodeAppend(vecs, coarseCentroids, pqCentroidsMiddleCode_,
+                           listIds, listOffset, indices,
+                           alternativeLayout_, numSubQuantizersPadded,
+                           bytesPerSubQuantizerCode_,
+                           deviceListDataPointers_,
+                           deviceListIndexPointers_,
+                           indicesOptions_,
+                           stream);
+    } else {
+      auto& coarseCentroids = quantizer_->getVectorsFloat32Ref();
+      runIVFPQEncodeAppend(vecs, coarseCentroids, pqCentroidsMiddleCode_,
+                           listIds, listOffset, indices,
+                           alternativeLayout_, numSubQuantizersPadded,
+                           bytesPerSubQuantizerCode_,
+                           deviceListDataPointers_,
+                           deviceListIndexPointers_,
+                           indicesOptions_,
+                           stream);
+    }
+    return;
+  }
+
   //
   // Determine the encodings of the vectors
   //
@@ -205,11 +290,25 @@ IVFPQ::appendVectors_(Tensor<float, 2, true>& vecs,
   // Append the new encodings
   // This kernel will handle appending each encoded vector + index to
   // the appropriate list
+  if (fastScanLayout_) {
+    runIVFPQFastScanInvertedListAppend(listIds,
+                                       listOffset,
+                                       encodings,
+                                       indices,
+                                       utils::roundUp(numSubQuantizers_, 2),
+                                       deviceListDataPointers_,
+                                       deviceListIndexPointers_,
+                                       indicesOptions_,
+                                       stream);
+    return;
+  }
+
   runIVFPQInvertedListAppend(listIds,
                              listOffset,
                              encodings,
                              indices,
                              alternativeLayout_,
+                             bytesPerSubQuantizerCode_,
                              deviceListDataPointers_,
                              deviceListIndexPointers_,
                              indicesOptions_,
@@ -218,39 +317,69 @@ IVFPQ::appendVectors_(Tensor<float, 2, true>& vecs,
 
 size_t
 IVFPQ::getGpuVectorsEncodingSize_(int numVecs) const {
-  if (alternativeLayout_) {
+  if (fastScanLayout_) {
+    return utils::divUp((size_t) numVecs, faiss::pq4_bbs) *
+      faiss::pq4_block_size(utils::roundUp(numSubQuantizers_, 2));
+  } else if (alternativeLayout_) {
     return utils::roundUp(
-      (size_t) numVecs, (size_t) 32) * numSubQuantizers_;
+      (size_t) numVecs, (size_t) 32) * numSubQuantizers_ *
+      bytesPerSubQuantizerCode_;
   } else {
-    return (size_t) numVecs * numSubQuantizers_;
+    return (size_t) numVecs * numSubQuantizers_ * bytesPerSubQuantizerCode_;
   }
 }
 
 size_t
 IVFPQ::getCpuVectorsEncodingSize_(int numVecs) const {
-  return (size_t) numVecs * numSubQuantizers_;
+  if (fastScanLayout_) {
+    // Same blocks as the CPU BlockInvertedLists
+    return getGpuVectorsEncodingSize_(numVecs);
+  }
+
+  // The CPU packs the codes of each vector into whole bytes
+  return (size_t) numVecs *
+    utils::divUp(numSubQuantizers_ * bitsPerSubQuantizer_, 8);
 }
 
 // Convert the CPU layout to the GPU layout
 std::vector<uint8_t>
 IVFPQ::translateCodesToGpu_(std::vector<uint8_t> codes,
                             size_t numVecs) const {
-  if (!alternativeLayout_) {
+  if ((bitsPerSubQuantizer_ == 8 && !alternativeLayout_) || fastScanLayout_) {
     return codes;
   }
 
   auto totalSize = getGpuVectorsEncodingSize_(numVecs);
   std::vector<uint8_t> out(totalSize);
 
+  auto cpuCodeSize = getCpuVectorsEncodingSize_(1);
+  auto out16 = (uint16_t*) out.data();
+
   for (int i = 0; i < numVecs; ++i) {
+    // The CPU codes are a bit stream, we unpack them into one byte (or two
+    // bytes above 8 bits) per sub-quantizer
+    faiss::PQDecoderGeneric decoder(codes.data() + (size_t) i * cpuCodeSize,
+                                    bitsPerSubQuantizer_);
+
     for (int j = 0; j < numSubQuantizers_; ++j) {
-      int block = (i / 32) * numSubQuantizers_ + j;
-      int withinBlock = i % 32;
+      size_t dstOffset;
+
+      if (alternativeLayout_) {
+        int block = (i / 32) * numSubQuantizers_ + j;
+        int withinBlock = i % 32;
 
-      size_t srcOffset = (size_t) i * numSubQuantizers_ + j;
-      size_t dstOffset = (size_t) block * 32 + withinBlock;
+        dstOffset = (size_t) block * 32 + withinBlock;
+      } else {
+        dstOffset = (size_t) i * numSubQuantizers_ + j;
+      }
 
-      out[dstOffset] = codes[srcOffset];
+      auto code = decoder.decode();
+
+      if (bytesPerSubQuantizerCode_ == 1) {
+        out[dstOffset] = (uint8_t) code;
+      } else {
+        out16[dstOffset] = (uint16_t) code;
+      }
     }
   }
 
@@ -261,22 +390,53 @@ IVFPQ::translateCodesToGpu_(std::vector<uint8_t> codes,
 std::vector<uint8_t>
 IVFPQ::translateCodesFromGpu_(std::vector<uint8_t> codes,
                               size_t numVecs) const {
-  if (!alternativeLayout_) {
+  if (fastScanLayout_) {
+    // The GPU leaves garbage in the nibbles past the end of the last block;
+    // the CPU expects zeros there
+    int M2 = utils::roundUp(numSubQuantizers_, 2);
+
+    for (size_t i = numVecs; i < utils::roundUp(numVecs, faiss::pq4_bbs);
+         ++i) {
+      for (int j = 0; j < M2; ++j) {
+        faiss::pq4_set_packed_element(codes.data(), M2, i, j, 0);
+      }
+    }
+
+    return codes;
+  }
+
+  if (bitsPerSubQuantizer_ == 8 && !alternativeLayout_) {
     return codes;
   }
 
   auto totalSize = getCpuVectorsEncodingSize_(numVecs);
   std::vector<uint8_t> out(totalSize);
 
-  for (int i = 0; i < numVecs; ++i) {
-    for (int j = 0; j < numSubQuantizers_; ++j) {
-      int block = (i / 32) * numSubQuantizers_ + j;
-      int withinBlock = i % 32;
+  auto cpuCodeSize = getCpuVectorsEncodingSize_(1);
+  auto codes16 = (const uint16_t*) codes.data();
 
-      size_t srcOffset = (size_t) block * 32 + withinBlock;
-      size_t dstOffset = (size_t) i * numSubQuantizers_ + j;
+  for (int i = 0; i < numVecs; ++i) {
+    // Flushes the last partial byte on destruction
+    faiss::PQEncoderGeneric encoder(out.data() + (size_t) i * cpuCodeSize,
+                                    bitsPerSubQuantizer_);
 
-      out[dstOffset] = codes[srcOffset];
+    for (int j = 0; j < numSubQuantizers_; ++j) {
+      size_t srcOffset;
+
+      if (alternativeLayout_) {
+        int block = (i / 32) * numSubQuantizers_ + j;
+        int withinBlock = i % 32;
+
+        srcOffset = (size_t) block * 32 + withinBlock;
+      } else {
+        srcOffset = (size_t) i * numSubQuantizers_ + j;
+      }
+
+      if (bytesPerSubQuantizerCode_ == 1) {
+        encoder.encode(codes[srcOffset]);
+      } else {
+        encoder.encode(codes16[srcOffset]);
+      }
     }
   }
 
@@ -332,11 +492,9 @@ IVFPQ::setPQCentroids_(float* data) {
 
 template <typename CentroidT>
 void
-IVFPQ::precomputeCodesT_() {
-  FAISS_ASSERT(metric_ == MetricType::METRIC_L2);
-
-  auto stream = resources_->getDefaultStreamCurrentDevice();
-
+IVFPQ::computeTerm2_(Tensor<CentroidT, 2, true>& centroids,
+                     Tensor<float, 3, true>& term2,
+                     cudaStream_t stream) {
   //
   //    d = || x - y_C ||^2 + || y_R ||^2 + 2 * (y_C|y_R) - 2 * (x|y_R)
   //        ---------------   ---------------------------       -------
@@ -345,6 +503,8 @@ IVFPQ::precomputeCodesT_() {
 
   // Terms 1 and 3 are available only at query time. We compute term 2
   // here.
+  int numCentroids = centroids.getSize(0);
+  FAISS_ASSERT(term2.getSize(0) == numCentroids);
 
   // Compute 2 * (y_C|y_R) via batch matrix multiplication
   // batch size (sub q) x {(centroid id)(sub dim) x (code id)(sub dim)'}
@@ -355,23 +515,22 @@ IVFPQ::precomputeCodesT_() {
   //      (centroid id)(sub q)(dim)
   // Transpose (centroid id)(sub q)(sub dim) to
   //           (sub q)(centroid id)(sub dim)
-  auto& coarseCentroids = quantizer_->template getVectorsRef<CentroidT>();
 
   // Create the coarse PQ product
   DeviceTensor<float, 3, true> coarsePQProduct(
     resources_,
     makeTempAlloc(AllocType::QuantizerPrecomputedCodes, stream),
-    {numSubQuantizers_, coarseCentroids.getSize(0), numSubQuantizerCodes_});
+    {numSubQuantizers_, numCentroids, numSubQuantizerCodes_});
 
   {
-    auto centroidView = coarseCentroids.template view<3>(
-      {coarseCentroids.getSize(0), numSubQuantizers_, dimPerSubQuantizer_});
+    auto centroidView = centroids.template view<3>(
+      {numCentroids, numSubQuantizers_, dimPerSubQuantizer_});
 
     // This is only needed temporarily
     DeviceTensor<CentroidT, 3, true> centroidsTransposed(
       resources_,
       makeTempAlloc(AllocType::QuantizerPrecomputedCodes, stream),
-      {numSubQuantizers_, coarseCentroids.getSize(0), dimPerSubQuantizer_});
+      {numSubQuantizers_, numCentroids, dimPerSubQuantizer_});
 
     runTransposeAny(centroidView, 0, 1, centroidsTransposed, stream);
 
@@ -381,7 +540,7 @@ IVFPQ::precomputeCodesT_() {
       DeviceTensor<float, 3, true> centroidsTransposedF32(
         resources_,
         makeTempAlloc(AllocType::QuantizerPrecomputedCodes, stream),
-        {numSubQuantizers_, coarseCentroids.getSize(0), dimPerSubQuantizer_});
+        {numSubQuantizers_, numCentroids, dimPerSubQuantizer_});
 
       convertTensor(stream, centroidsTransposed, centroidsTransposedF32);
 
@@ -404,18 +563,13 @@ IVFPQ::precomputeCodesT_() {
 
   // Transpose (sub q)(centroid id)(code id) to
   //           (centroid id)(sub q)(code id)
-  // This will become our precomputed code output
-  DeviceTensor<float, 3, true> coarsePQProductTransposed(
-    resources_,
-    makeDevAlloc(AllocType::QuantizerPrecomputedCodes, stream),
-    {coarseCentroids.getSize(0), numSubQuantizers_, numSubQuantizerCodes_});
-  runTransposeAny(coarsePQProduct, 0, 1, coarsePQProductTransposed,
-                  stream);
+  // This is our output
+  runTransposeAny(coarsePQProduct, 0, 1, term2, stream);
 
   // View (centroid id)(sub q)(code id) as
   //      (centroid id)(sub q * code id)
-  auto coarsePQProductTransposedView = coarsePQProductTransposed.view<2>(
-    {coarseCentroids.getSize(0), numSubQuantizers_ * numSubQuantizerCodes_});
+  auto term2View = term2.view<2>(
+    {numCentroids, numSubQuantizers_ * numSubQuantizerCodes_});
 
   // Sum || y_R ||^2 + 2 * (y_C|y_R)
   // i.e., add norms                              (sub q * code id)
@@ -435,27 +589,89 @@ IVFPQ::precomputeCodesT_() {
               subQuantizerNorms, true,
               stream);
 
-    runSumAlongColumns(subQuantizerNorms, coarsePQProductTransposedView,
-                       stream);
+    runSumAlongColumns(subQuantizerNorms, term2View, stream);
   }
+}
+
+template <typename CentroidT>
+void
+IVFPQ::precomputeCodesT_() {
+  FAISS_ASSERT(metric_ == MetricType::METRIC_L2);
+
+  auto stream = resources_->getDefaultStreamCurrentDevice();
+
+  auto& coarseCentroids = quantizer_->template getVectorsRef<CentroidT>();
+  int numCentroids = coarseCentroids.getSize(0);
+
+  DeviceTensor<float, 3, true> table;
+  DeviceTensor<half, 3, true> tableHalf;
 
-  // We added into the view, so `coarsePQProductTransposed` is now our
-  // precomputed term 2.
   if (useFloat16LookupTables_) {
-    precomputedCodeHalf_ =
-      DeviceTensor<half, 3, true>(
+    tableHalf = DeviceTensor<half, 3, true>(
+      resources_,
+      makeDevAlloc(AllocType::QuantizerPrecomputedCodes, stream),
+      {numCentroids, numSubQuantizers_, numSubQuantizerCodes_});
+  } else {
+    table = DeviceTensor<float, 3, true>(
+      resources_,
+      makeDevAlloc(AllocType::QuantizerPrecomputedCodes, stream),
+      {numCentroids, numSubQuantizers_, numSubQuantizerCodes_});
+  }
+
+  // The table is computed by tiles of centroids, so that the temporary
+  // memory (the float product of the centroids and the PQ centroids, its
+  // transposition and the transposed centroids) does not depend on the
+  // number of lists
+  size_t bytesPerCentroid =
+    3 * numSubQuantizers_ * numSubQuantizerCodes_ * sizeof(float) +
+    2 * dim_ * sizeof(float);
+  size_t tileSize =
+    resources_->getTempMemoryAvailableCurrentDevice() / bytesPerCentroid;
+  tileSize = std::min(std::max(tileSize, (size_t) 1), (size_t) numCentroids);
+
+  for (int i = 0; i < numCentroids; i += tileSize) {
+    int numInTile = std::min((int) tileSize, numCentroids - i);
+    auto centroidsView = coarseCentroids.narrowOutermost(i, numInTile);
+
+    if (useFloat16LookupTables_) {
+      DeviceTensor<float, 3, true> term2(
         resources_,
-        makeDevAlloc(AllocType::QuantizerPrecomputedCodes, stream),
-        {coarseCentroids.getSize(0), numSubQuantizers_, numSubQuantizerCodes_});
+        makeTempAlloc(AllocType::QuantizerPrecomputedCodes, stream),
+        {numInTile, numSubQuantizers_, numSubQuantizerCodes_});
+      computeTerm2_(centroidsView, term2, stream);
 
-    convertTensor(stream, coarsePQProductTransposed, precomputedCodeHalf_);
-  } else {
-    precomputedCode_ = std::move(coarsePQProductTransposed);
+      auto tableView = tableHalf.narrowOutermost(i, numInTile);
+      convertTensor(stream, term2, tableView);
+    } else {
+      auto tableView = table.narrowOutermost(i, numInTile);
+      computeTerm2_(centroidsView, tableView, stream);
+    }
   }
+
+  precomputedCode_ = std::move(table);
+  precomputedCodeHalf_ = std::move(tableHalf);
 }
 
 void
 IVFPQ::precomputeCodes_() {
+  // Clear out old precomputed code data
+  precomputedCode_ = DeviceTensor<float, 3, true>();
+  precomputedCodeHalf_ = DeviceTensor<half, 3, true>();
+
+  size_t numEntries =
+    (size_t) numLists_ * numSubQuantizers_ * numSubQuantizerCodes_;
+  size_t tableBytes =
+    numEntries * (useFloat16LookupTables_ ? sizeof(half) : sizeof(float));
+
+  // The table is also indexed with 32-bit ints
+  precomputedCodesOnTheFly_ =
+    tableBytes > precomputedTableMaxBytes_ ||
+    numEntries > (size_t) std::numeric_limits<int>::max();
+
+  if (precomputedCodesOnTheFly_) {
+    return;
+  }
+
   if (quantizer_->getUseFloat16()) {
     precomputeCodesT_<half>();
   } else {
@@ -471,7 +687,7 @@ IVFPQ::query(Tensor<float, 2, true>& queries,
              Tensor<Index::idx_t, 2, true>& outIndices) {
   // These are caught at a higher level
   FAISS_ASSERT(nprobe <= GPU_MAX_SELECTION_K);
-  FAISS_ASSERT(k <= GPU_MAX_SELECTION_K);
+  FAISS_ASSERT(k <= GPU_MAX_LARGE_SELECTION_K);
 
   auto stream = resources_->getDefaultStreamCurrentDevice();
   nprobe = std::min(nprobe, quantizer_->getSize());
@@ -492,13 +708,43 @@ IVFPQ::query(Tensor<float, 2, true>& queries,
 
   // Find the `nprobe` closest coarse centroids; we can use int
   // indices both internally and externally
-  quantizer_->query(queries,
-                    nprobe,
-                    metric_,
-                    metricArg_,
-                    coarseDistances,
-                    coarseIndices,
-                    true);
+  {
+    GpuStageTimer timer(STAGE_COARSE_QUANTIZE, stream);
+    quantizer_->query(queries,
+                      nprobe,
+                      metric_,
+                      metricArg_,
+                      coarseDistances,
+                      coarseIndices,
+                      true);
+  }
+
+  queryPreassigned(queries,
+                   coarseDistances,
+                   coarseIndices,
+                   k,
+                   outDistances,
+                   outIndices);
+}
+
+void
+IVFPQ::queryPreassigned(Tensor<float, 2, true>& queries,
+                        Tensor<float, 2, true>& coarseDistances,
+                        Tensor<int, 2, true>& coarseIndices,
+                        int k,
+                        Tensor<float, 2, true>& outDistances,
+                        Tensor<Index::idx_t, 2, true>& outIndices) {
+  FAISS_ASSERT(coarseIndices.getSize(1) <= GPU_MAX_SELECTION_K);
+  FAISS_ASSERT(k <= GPU_MAX_LARGE_SELECTION_K);
+
+  auto stream = resources_->getDefaultStreamCurrentDevice();
+
+  FAISS_ASSERT(coarseDistances.getSize(0) == queries.getSize(0));
+  FAISS_ASSERT(coarseIndices.getSize(0) == queries.getSize(0));
+  FAISS_ASSERT(coarseDistances.getSize(1) == coarseIndices.getSize(1));
+
+  // Bring the probed lists to the GPU if they are in managed memory
+  prefetchProbedLists_(coarseIndices, stream);
 
   if (precomputedCodes_) {
     FAISS_ASSERT(metric_ == MetricType::METRIC_L2);
@@ -542,11 +788,28 @@ IVFPQ::getPQCentroids() {
   return pqCentroidsMiddleCode_;
 }
 
+MemoryUsage
+IVFPQ::getMemoryUsage() const {
+  MemoryUsage mu = IVFBase::getMemoryUsage();
+
+  size_t centroids = pqCentroidsInnermostCode_.getSizeInBytes() +
+    pqCentroidsMiddleCode_.getSizeInBytes();
+  mu.add_device("pq_centroids", centroids, centroids);
+
+  size_t precomputed = precomputedCode_.getSizeInBytes() +
+    precomputedCodeHalf_.getSizeInBytes();
+  if (precomputed > 0) {
+    mu.add_device("precomputed_table", precomputed, precomputed);
+  }
+
+  return mu;
+}
+
 void
 IVFPQ::runPQPrecomputedCodes_(
   Tensor<float, 2, true>& queries,
-  DeviceTensor<float, 2, true>& coarseDistances,
-  DeviceTensor<int, 2, true>& coarseIndices,
+  Tensor<float, 2, true>& coarseDistances,
+  Tensor<int, 2, true>& coarseIndices,
   int k,
   Tensor<float, 2, true>& outDistances,
   Tensor<Index::idx_t, 2, true>& outIndices) {
@@ -565,6 +828,8 @@ IVFPQ::runPQPrecomputedCodes_(
   // These allocations within are only temporary, so release them when
   // we're done to maximize free space
   {
+    GpuStageTimer timer(STAGE_LUT, stream);
+
     auto querySubQuantizerView = queries.view<3>(
       {queries.getSize(0), numSubQuantizers_, dimPerSubQuantizer_});
     DeviceTensor<float, 3, true> queriesTransposed(
@@ -602,11 +867,23 @@ IVFPQ::runPQPrecomputedCodes_(
     term3 = NoTypeTensor<3, true>(term3Transposed);
   }
 
+  if (precomputedCodesOnTheFly_) {
+    runPQPrecomputedCodesOnTheFly_(queries,
+                                   coarseDistances,
+                                   coarseIndices,
+                                   term3,
+                                   k,
+                                   outDistances,
+                                   outIndices);
+    return;
+  }
+
   runPQScanMultiPassPrecomputed(queries,
                                 coarseDistances, // term 1
                                 term2, // term 2
                                 term3, // term 3
                                 coarseIndices,
+                                coarseIndices, // term 2 row = list id
                                 useFloat16LookupTables_,
                                 alternativeLayout_,
                                 numSubQuantizers_,
@@ -622,12 +899,146 @@ IVFPQ::runPQPrecomputedCodes_(
                                 resources_);
 }
 
+void
+IVFPQ::runPQPrecomputedCodesOnTheFly_(
+  Tensor<float, 2, true>& queries,
+  Tensor<float, 2, true>& coarseDistances,
+  Tensor<int, 2, true>& coarseIndices,
+  NoTypeTensor<3, true>& term3,
+  int k,
+  Tensor<float, 2, true>& outDistances,
+  Tensor<Index::idx_t, 2, true>& outIndices) {
+  auto stream = resources_->getDefaultStreamCurrentDevice();
+
+  int numQueries = queries.getSize(0);
+  int nprobe = coarseIndices.getSize(1);
+
+  // Term 2 is computed for the distinct lists probed by a tile of
+  // queries, at most nprobe per query. The tile size bounds the memory
+  // for the term 2 rows, in float and possibly half, the gathered
+  // centroids and the temporaries of computeTerm2_
+  size_t bytesPerRow =
+    numSubQuantizers_ * numSubQuantizerCodes_ *
+    (3 * sizeof(float) + (useFloat16LookupTables_ ? sizeof(half) : 0)) +
+    3 * dim_ * sizeof(float);
+  size_t sizeAvailable = std::min(
+    precomputedTableMaxBytes_,
+    resources_->getTempMemoryAvailableCurrentDevice());
+  size_t queryTileSize = sizeAvailable / (bytesPerRow * nprobe);
+  queryTileSize =
+    std::min(std::max(queryTileSize, (size_t) 1), (size_t) numQueries);
+
+  // The probed lists of the tile are deduplicated on the host
+  HostTensor<int, 2, true> hostCoarseIndices(coarseIndices, stream);
+  HostTensor<int, 2, true> hostTerm2Rows({numQueries, nprobe});
+  std::vector<int> rowOfList(numLists_, -1);
+
+  for (int query = 0; query < numQueries; query += queryTileSize) {
+    int numQueriesInTile =
+      std::min((int) queryTileSize, numQueries - query);
+
+    std::vector<int> probedLists;
+    for (int i = query * nprobe;
+         i < (query + numQueriesInTile) * nprobe; ++i) {
+      int listId = hostCoarseIndices.data()[i];
+      int row = 0;
+
+      // -1 is used for queries with fewer lists than nprobe, these
+      // entries are skipped by the scan
+      if (listId >= 0) {
+        if (rowOfList[listId] < 0) {
+          rowOfList[listId] = probedLists.size();
+          probedLists.push_back(listId);
+        }
+        row = rowOfList[listId];
+      }
+
+      hostTerm2Rows.data()[i] = row;
+    }
+
+    for (int listId : probedLists) {
+      rowOfList[listId] = -1;
+    }
+
+    if (probedLists.empty()) {
+      probedLists.push_back(0);
+    }
+
+    int numProbed = probedLists.size();
+
+    HostTensor<int, 1, true> hostProbedLists(probedLists.data(), {numProbed});
+    DeviceTensor<int, 1, true> probedListsDev(
+      resources_, makeTempAlloc(AllocType::Other, stream), hostProbedLists);
+
+    auto hostTerm2RowsView =
+      hostTerm2Rows.narrowOutermost(query, numQueriesInTile);
+    DeviceTensor<int, 2, true> term2Rows(
+      resources_, makeTempAlloc(AllocType::Other, stream), hostTerm2RowsView);
+
+    DeviceTensor<float, 3, true> term2Float(
+      resources_, makeTempAlloc(AllocType::Other, stream),
+      {numProbed, numSubQuantizers_, numSubQuantizerCodes_});
+
+    {
+      GpuStageTimer timer(STAGE_LUT, stream);
+
+      DeviceTensor<float, 2, true> centroids(
+        resources_, makeTempAlloc(AllocType::Other, stream),
+        {numProbed, dim_});
+      quantizer_->reconstruct(probedListsDev, centroids);
+
+      computeTerm2_(centroids, term2Float, stream);
+    }
+
+    NoTypeTensor<3, true> term2;
+    DeviceTensor<half, 3, true> term2Half;
+
+    if (useFloat16LookupTables_) {
+      term2Half =
+        convertTensorTemporary<float, half, 3>(
+          resources_, stream, term2Float);
+      term2 = NoTypeTensor<3, true>(term2Half);
+    } else {
+      term2 = NoTypeTensor<3, true>(term2Float);
+    }
+
+    auto queryView = queries.narrowOutermost(query, numQueriesInTile);
+    auto term1View = coarseDistances.narrowOutermost(query, numQueriesInTile);
+    auto term3View = term3.narrowOutermost(query, numQueriesInTile);
+    auto coarseIndicesView =
+      coarseIndices.narrowOutermost(query, numQueriesInTile);
+    auto outDistancesView =
+      outDistances.narrowOutermost(query, numQueriesInTile);
+    auto outIndicesView = outIndices.narrowOutermost(query, numQueriesInTile);
+
+    runPQScanMultiPassPrecomputed(queryView,
+                                  term1View,
+                                  term2,
+                                  term3View,
+                                  coarseIndicesView,
+                                  term2Rows,
+                                  useFloat16LookupTables_,
+                                  alternativeLayout_,
+                                  numSubQuantizers_,
+                                  numSubQuantizerCodes_,
+                                  deviceListDataPointers_,
+                                  deviceListIndexPointers_,
+                                  indicesOptions_,
+                                  deviceListLengths_,
+                                  maxListLength_,
+                                  k,
+                                  outDistancesView,
+                                  outIndicesView,
+                                  resources_);
+  }
+}
+
 template <typename CentroidT>
 void
 IVFPQ::runPQNoPrecomputedCodesT_(
   Tensor<float, 2, true>& queries,
-  DeviceTensor<float, 2, true>& coarseDistances,
-  DeviceTensor<int, 2, true>& coarseIndices,
+  Tensor<float, 2, true>& coarseDistances,
+  Tensor<int, 2, true>& coarseIndices,
   int k,
   Tensor<float, 2, true>& outDistances,
   Tensor<Index::idx_t, 2, true>& outIndices) {
@@ -641,6 +1052,7 @@ IVFPQ::runPQNoPrecomputedCodesT_(
                                   useFloat16LookupTables_,
                                   useMMCodeDistance_,
                                   alternativeLayout_,
+                                  fastScanLayout_,
                                   numSubQuantizers_,
                                   numSubQuantizerCodes_,
                                   deviceListDataPointers_,
@@ -658,8 +1070,8 @@ IVFPQ::runPQNoPrecomputedCodesT_(
 void
 IVFPQ::runPQNoPrecomputedCodes_(
   Tensor<float, 2, true>& queries,
-  DeviceTensor<float, 2, true>& coarseDistances,
-  DeviceTensor<int, 2, true>& coarseIndices,
+  Tensor<float, 2, true>& coarseDistances,
+  Tensor<int, 2, true>& coarseIndices,
   int k,
   Tensor<float, 2, true>& outDistances,
   Tensor<Index::idx_t, 2, true>& outIndices) {
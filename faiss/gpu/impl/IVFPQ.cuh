@@ -12,6 +12,7 @@
 #include <faiss/MetricType.h>
 #include <faiss/gpu/impl/IVFBase.cuh>
 #include <faiss/gpu/utils/Float16.cuh>
+#include <faiss/gpu/utils/NoTypeTensor.cuh>
 
 namespace faiss { namespace gpu {
 
@@ -28,18 +29,32 @@ class IVFPQ : public IVFBase {
         bool useFloat16LookupTables,
         bool useMMCodeDistance,
         bool alternativeLayout,
+        bool fastScanLayout,
         float* pqCentroidData,
         IndicesOptions indicesOptions,
         MemorySpace space);
 
-  /// Returns true if we support PQ in this size
+  /// Returns true if we have specialized list scanning kernels for this
+  /// number of sub-quantizers; other sizes use the generic kernels
   static bool isSupportedPQCodeLength(int size);
 
+  /// Returns true if we support this number of bits per sub-quantizer code
+  static bool isSupportedBitsPerCode(int bits);
+
   ~IVFPQ() override;
 
   /// Enable or disable pre-computed codes
   void setPrecomputedCodes(bool enable);
 
+  /// Precomputed term 2 tables larger than this are not stored: each
+  /// search computes the term 2 of the lists that its queries probe
+  void setPrecomputedTableMaxBytes(size_t bytes);
+
+  /// Whether precomputed codes are enabled, but computed at search time
+  /// for the probed lists only (this copies the probed list ids to the
+  /// host during the search)
+  bool getPrecomputedCodesOnTheFly() const;
+
   /// Find the approximate k nearest neigbors for `queries` against
   /// our database
   void query(Tensor<float, 2, true>& queries,
@@ -48,10 +63,23 @@ class IVFPQ : public IVFBase {
              Tensor<float, 2, true>& outDistances,
              Tensor<Index::idx_t, 2, true>& outIndices);
 
+  /// As query, but with the `nprobe` coarse centroids of each query (and
+  /// their distances, as computed by the coarse quantizer) already given;
+  /// centroid ids may be -1 to skip a probe
+  void queryPreassigned(Tensor<float, 2, true>& queries,
+                        Tensor<float, 2, true>& coarseDistances,
+                        Tensor<int, 2, true>& coarseIndices,
+                        int k,
+                        Tensor<float, 2, true>& outDistances,
+                        Tensor<Index::idx_t, 2, true>& outIndices);
+
   /// Returns our set of sub-quantizers of the form
   /// (sub q)(code id)(sub dim)
   Tensor<float, 3, true> getPQCentroids();
 
+  /// Adds the PQ centroids and the precomputed term 2 tables
+  MemoryUsage getMemoryUsage() const override;
+
  protected:
   /// Returns the encoding size for a PQ-encoded IVF list
   size_t getGpuVectorsEncodingSize_(int numVecs) const override;
@@ -65,6 +93,9 @@ class IVFPQ : public IVFBase {
   std::vector<uint8_t> translateCodesFromGpu_(std::vector<uint8_t> codes,
                                               size_t numVecs) const override;
 
+  /// Layout of the encoded vectors in our lists
+  IVFListCodeLayout getListCodeLayout_() const override;
+
   /// Encode the vectors that we're adding and append to our IVF lists
   void appendVectors_(Tensor<float, 2, true>& vecs,
                       Tensor<Index::idx_t, 1, true>& indices,
@@ -87,18 +118,36 @@ class IVFPQ : public IVFBase {
   template <typename CentroidT>
   void precomputeCodesT_();
 
+  /// Term 2 for a set of coarse centroids
+  /// centroids: (centroid id)(dim)
+  /// term2: output, (centroid id)(sub q)(code id)
+  template <typename CentroidT>
+  void computeTerm2_(Tensor<CentroidT, 2, true>& centroids,
+                     Tensor<float, 3, true>& term2,
+                     cudaStream_t stream);
+
   /// Runs kernels for scanning inverted lists with precomputed codes
   void runPQPrecomputedCodes_(Tensor<float, 2, true>& queries,
-                              DeviceTensor<float, 2, true>& coarseDistances,
-                              DeviceTensor<int, 2, true>& coarseIndices,
+                              Tensor<float, 2, true>& coarseDistances,
+                              Tensor<int, 2, true>& coarseIndices,
                               int k,
                               Tensor<float, 2, true>& outDistances,
                               Tensor<Index::idx_t, 2, true>& outIndices);
 
+  /// As runPQPrecomputedCodes_, when term 2 is not stored: it is computed
+  /// for the lists probed by each tile of queries
+  void runPQPrecomputedCodesOnTheFly_(Tensor<float, 2, true>& queries,
+                                      Tensor<float, 2, true>& coarseDistances,
+                                      Tensor<int, 2, true>& coarseIndices,
+                                      NoTypeTensor<3, true>& term3,
+                                      int k,
+                                      Tensor<float, 2, true>& outDistances,
+                                      Tensor<Index::idx_t, 2, true>& outIndices);
+
   /// Runs kernels for scanning inverted lists without precomputed codes
   void runPQNoPrecomputedCodes_(Tensor<float, 2, true>& queries,
-                                DeviceTensor<float, 2, true>& coarseDistances,
-                                DeviceTensor<int, 2, true>& coarseIndices,
+                                Tensor<float, 2, true>& coarseDistances,
+                                Tensor<int, 2, true>& coarseIndices,
                                 int k,
                                 Tensor<float, 2, true>& outDistances,
                                 Tensor<Index::idx_t, 2, true>& outIndices);
@@ -107,8 +156,8 @@ class IVFPQ : public IVFBase {
   /// different coarse centroid type)
   template <typename CentroidT>
   void runPQNoPrecomputedCodesT_(Tensor<float, 2, true>& queries,
-                                 DeviceTensor<float, 2, true>& coarseDistances,
-                                 DeviceTensor<int, 2, true>& coarseIndices,
+                                 Tensor<float, 2, true>& coarseDistances,
+                                 Tensor<int, 2, true>& coarseIndices,
                                  int k,
                                  Tensor<float, 2, true>& outDistances,
                                  Tensor<Index::idx_t, 2, true>& outIndices);
@@ -123,6 +172,10 @@ class IVFPQ : public IVFBase {
   /// Number of per sub-quantizer codes (2^bits)
   const int numSubQuantizerCodes_;
 
+  /// Number of bytes in which each sub-quantizer code is stored on the
+  /// GPU (1 up to 8 bits, 2 above)
+  const int bytesPerSubQuantizerCode_;
+
   /// Number of dimensions per each sub-quantizer
   const int dimPerSubQuantizer_;
 
@@ -145,6 +198,12 @@ class IVFPQ : public IVFBase {
   /// so the list length is always a multiple of numSubQuantizers * 32
   const bool alternativeLayout_;
 
+  /// The 4-bit fast-scan layout is the one of the CPU IndexIVFPQFastScan
+  /// (see faiss/impl/pq4_fast_scan.h): blocks of 32 vectors, with the codes
+  /// of each pair of sub-quantizers packed by nibbles in 32 bytes. The
+  /// number of sub-quantizers is padded to an even number
+  const bool fastScanLayout_;
+
   /// On the GPU, we prefer different PQ centroid data layouts for
   /// different purposes.
   ///
@@ -164,6 +223,12 @@ class IVFPQ : public IVFBase {
 
   /// Precomputed term 2 in half form
   DeviceTensor<half, 3, true> precomputedCodeHalf_;
+
+  /// Above this size, term 2 is computed at search time
+  size_t precomputedTableMaxBytes_;
+
+  /// Is term 2 computed at search time for the probed lists?
+  bool precomputedCodesOnTheFly_;
 };
 
 } } // namespace
@@ -7,12 +7,13 @@
 
 
 #include <faiss/gpu/impl/IVFUtils.cuh>
+#include <faiss/gpu/GpuResources.h>
+#include <faiss/gpu/utils/DeviceTensor.cuh>
 #include <faiss/gpu/utils/DeviceUtils.h>
 #include <faiss/gpu/utils/StaticUtils.h>
 #include <faiss/gpu/utils/Tensor.cuh>
-#include <faiss/gpu/utils/ThrustAllocator.cuh>
-#include <thrust/scan.h>
-#include <thrust/execution_policy.h>
+#include <faiss/utils/instrumentation.h>
+#include <cub/device/device_scan.cuh>
 
 namespace faiss { namespace gpu {
 
@@ -64,18 +65,48 @@ void runCalcListOffsets(GpuResources* res,
 
   // Prefix sum of the indices, so we know where the intermediate
   // results should be maintained
-  // Thrust wants a place for its temporary allocations, so provide
-  // one, so it won't call cudaMalloc/Free if we size it sufficiently
-  GpuResourcesThrustAllocator alloc(res,
-                                    stream,
-                                    thrustMem.data(),
-                                    thrustMem.getSizeInBytes());
-
-  thrust::inclusive_scan(thrust::cuda::par(alloc).on(stream),
-                         prefixSumOffsets.data(),
-                         prefixSumOffsets.data() + totalSize,
-                         prefixSumOffsets.data());
+  // Use cub directly rather than thrust, as thrust synchronizes the stream
+  // after the scan, which both costs latency and prevents capturing the
+  // search into a CUDA graph. The scan temporary storage comes out of
+  // `thrustMem` if it is large enough
+  size_t scanTempBytes = 0;
+  CUDA_VERIFY(cub::DeviceScan::InclusiveSum(nullptr,
+                                            scanTempBytes,
+                                            prefixSumOffsets.data(),
+                                            prefixSumOffsets.data(),
+                                            totalSize,
+                                            stream));
+
+  DeviceTensor<char, 1, true> scanTempOverflow;
+  void* scanTemp = thrustMem.data();
+
+  if (scanTempBytes > thrustMem.getSizeInBytes()) {
+    scanTempOverflow = DeviceTensor<char, 1, true>(
+      res, makeTempAlloc(AllocType::Other, stream), {(int) scanTempBytes});
+    scanTemp = scanTempOverflow.data();
+  }
+
+  CUDA_VERIFY(cub::DeviceScan::InclusiveSum(scanTemp,
+                                            scanTempBytes,
+                                            prefixSumOffsets.data(),
+                                            prefixSumOffsets.data(),
+                                            totalSize,
+                                            stream));
   CUDA_TEST_ERROR();
+
+  if (faiss::instrumentation_enabled) {
+    // The last offset is the number of codes scanned for the tile
+    int numCodes = 0;
+    CUDA_VERIFY(cudaMemcpyAsync(&numCodes,
+                                prefixSumOffsets.data() + totalSize - 1,
+                                sizeof(int),
+                                cudaMemcpyDeviceToHost,
+                                stream));
+    CUDA_VERIFY(cudaStreamSynchronize(stream));
+
+    faiss::instrumentation_count(COUNTER_NLIST, totalSize);
+    faiss::instrumentation_count(COUNTER_NDIS, numCodes);
+  }
 }
 
 } } // namespace
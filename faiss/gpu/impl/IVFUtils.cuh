@@ -19,6 +19,67 @@ namespace faiss { namespace gpu {
 
 class GpuResources;
 
+// This is warp divergence central, but this is really a final step
+// and happening a small number of times
+inline __device__ int binarySearchForBucket(int* prefixSumOffsets,
+                                            int size,
+                                            int val) {
+  int start = 0;
+  int end = size;
+
+  while (end - start > 0) {
+    int mid = start + (end - start) / 2;
+
+    int midVal = prefixSumOffsets[mid];
+
+    // Find the first bucket that we are <=
+    if (midVal <= val) {
+      start = mid + 1;
+    } else {
+      end = mid;
+    }
+  }
+
+  // We must find the bucket that it is in
+  assert(start != size);
+
+  return start;
+}
+
+/// Translates `offset`, the offset of an intermediate result among the
+/// concatenated lists probed by a query (as produced by the list scans),
+/// into the user index of the list entry
+inline __device__ Index::idx_t
+ivfOffsetToListIndex(int offset,
+                     int* prefixSumOffsets,
+                     int* queryToCentroid,
+                     int nprobe,
+                     void** listIndices,
+                     IndicesOptions opt) {
+  // In order to determine the actual user index, we need to first
+  // determine what list it was in.
+  // We do this by binary search in the prefix sum list.
+  int probe = binarySearchForBucket(prefixSumOffsets, nprobe, offset);
+
+  // This is then the probe for the query; we can find the actual
+  // list ID from this
+  int listId = queryToCentroid[probe];
+
+  // Now, we need to know the offset within the list
+  // We ensure that before the array (at offset -1), there is a 0 value
+  int listStart = *(prefixSumOffsets + probe - 1);
+  int listOffset = offset - listStart;
+
+  // This gives us our final index
+  if (opt == INDICES_32_BIT) {
+    return (Index::idx_t) ((int*) listIndices[listId])[listOffset];
+  } else if (opt == INDICES_64_BIT) {
+    return ((Index::idx_t*) listIndices[listId])[listOffset];
+  } else {
+    return ((Index::idx_t) listId << 32 | (Index::idx_t) listOffset);
+  }
+}
+
 /// Function for multi-pass scanning that collects the length of
 /// intermediate results for all (query, probe) pair
 void runCalcListOffsets(GpuResources* res,
@@ -52,4 +113,19 @@ void runPass2SelectLists(Tensor<float, 2, true>& heapDistances,
                          Tensor<Index::idx_t, 2, true>& outIndices,
                          cudaStream_t stream);
 
+/// Performs both passes of k-selection for k > GPU_MAX_SELECTION_K, directly
+/// over the concatenated list distances of each query, producing the final
+/// indices
+void runLargeSelectLists(Tensor<int, 2, true>& prefixSumOffsets,
+                         Tensor<float, 1, true>& distance,
+                         thrust::device_vector<void*>& listIndices,
+                         IndicesOptions indicesOptions,
+                         Tensor<int, 2, true>& topQueryToCentroid,
+                         int k,
+                         bool chooseLargest,
+                         Tensor<float, 2, true>& outDistances,
+                         Tensor<Index::idx_t, 2, true>& outIndices,
+                         GpuResources* res,
+                         cudaStream_t stream);
+
 } } // namespace
@@ -0,0 +1,102 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#include <faiss/gpu/impl/IVFUtils.cuh>
+#include <faiss/gpu/GpuResources.h>
+#include <faiss/gpu/utils/DeviceTensor.cuh>
+#include <faiss/gpu/utils/DeviceUtils.h>
+#include <faiss/gpu/utils/LargeSelect.cuh>
+#include <faiss/gpu/utils/Tensor.cuh>
+
+namespace faiss { namespace gpu {
+
+// The row of a query is the concatenation of the distances of all of its
+// probed lists; the value of an entry is its offset, as in pass 1
+struct LargeSelectListRows {
+  const float* keys;
+  const int* prefixSumOffsets;
+  int nprobe;
+
+  inline __device__ int begin(int row) const {
+    // We ensure that before the array (at offset -1), there is a 0 value
+    return prefixSumOffsets[row * nprobe - 1];
+  }
+
+  inline __device__ int end(int row) const {
+    return prefixSumOffsets[row * nprobe + nprobe - 1];
+  }
+
+  inline __device__ int value(int row, int pos) const {
+    return pos;
+  }
+};
+
+__global__ void
+largeSelectListIndices(Tensor<int, 2, true> offsets,
+                       void** listIndices,
+                       Tensor<int, 2, true> prefixSumOffsets,
+                       Tensor<int, 2, true> topQueryToCentroid,
+                       IndicesOptions opt,
+                       Tensor<Index::idx_t, 2, true> outIndices) {
+  int queryId = blockIdx.y;
+
+  for (int i = blockIdx.x * blockDim.x + threadIdx.x;
+       i < offsets.getSize(1);
+       i += gridDim.x * blockDim.x) {
+    int offset = offsets[queryId][i];
+
+    outIndices[queryId][i] = offset == -1 ? -1 :
+      ivfOffsetToListIndex(offset,
+                           prefixSumOffsets[queryId].data(),
+                           topQueryToCentroid[queryId].data(),
+                           prefixSumOffsets.getSize(1),
+                           listIndices,
+                           opt);
+  }
+}
+
+void
+runLargeSelectLists(Tensor<int, 2, true>& prefixSumOffsets,
+                    Tensor<float, 1, true>& distance,
+                    thrust::device_vector<void*>& listIndices,
+                    IndicesOptions indicesOptions,
+                    Tensor<int, 2, true>& topQueryToCentroid,
+                    int k,
+                    bool chooseLargest,
+                    Tensor<float, 2, true>& outDistances,
+                    Tensor<Index::idx_t, 2, true>& outIndices,
+                    GpuResources* res,
+                    cudaStream_t stream) {
+  int numQueries = prefixSumOffsets.getSize(0);
+
+  LargeSelectListRows rows;
+  rows.keys = distance.data();
+  rows.prefixSumOffsets = prefixSumOffsets.data();
+  rows.nprobe = prefixSumOffsets.getSize(1);
+
+  // Offsets of the selected results, before translation to user indices
+  DeviceTensor<int, 2, true> offsets(
+    res, makeTempAlloc(AllocType::Other, stream), {numQueries, k});
+
+  runLargeSelectRows(rows, numQueries, outDistances, offsets,
+                     chooseLargest, k, res, stream);
+
+  auto block = dim3(std::min(k, getMaxThreadsCurrentDevice()));
+  auto grid = dim3(std::min(utils::divUp(k, (int) block.x), 16), numQueries);
+
+  largeSelectListIndices<<<grid, block, 0, stream>>>(
+    offsets,
+    listIndices.data().get(),
+    prefixSumOffsets,
+    topQueryToCentroid,
+    indicesOptions,
+    outIndices);
+  CUDA_TEST_ERROR();
+}
+
+} } // namespace
@@ -569,9 +569,14 @@ runPQCodeDistances(GpuResources* res,
   const auto codesPerSubQuantizer = pqCentroids.getSize(2);
 
   // Only a certain number of dimensions per sub quantizer are supported by the
-  // specialized implementation. Every other value falls back to the generalized
-  // MM implementation.
+  // specialized implementation, which also uses one thread per code. Every
+  // other case falls back to the generalized MM implementation.
+  bool specializedFits =
+    codesPerSubQuantizer + utils::roundUp(dimsPerSubQuantizer, kWarpSize) <=
+    getMaxThreadsCurrentDevice();
+
   if (!isSpecializedPQCodeDistanceDims(dimsPerSubQuantizer) ||
+      !specializedFits ||
       useMMImplementation) {
     // Use the general purpose matrix multiplication implementation which
     // handles any number of sub-quantizers and dimensions per sub-quantizer
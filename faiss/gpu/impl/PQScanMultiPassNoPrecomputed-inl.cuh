@@ -7,38 +7,51 @@
 
 
 #include <faiss/gpu/GpuResources.h>
+#include <faiss/gpu/impl/IVFPQ.cuh>
 #include <faiss/gpu/impl/PQCodeDistances.cuh>
 #include <faiss/gpu/impl/PQCodeLoad.cuh>
 #include <faiss/gpu/impl/IVFUtils.cuh>
 #include <faiss/gpu/utils/ConversionOperators.cuh>
+#include <faiss/gpu/utils/DeviceDefs.cuh>
 #include <faiss/gpu/utils/DeviceTensor.cuh>
 #include <faiss/gpu/utils/DeviceUtils.h>
 #include <faiss/gpu/utils/Float16.cuh>
 #include <faiss/gpu/utils/LoadStoreOperators.cuh>
 #include <faiss/gpu/utils/NoTypeTensor.cuh>
+#include <faiss/gpu/utils/PtxUtils.cuh>
 #include <faiss/gpu/utils/StaticUtils.h>
+#include <faiss/gpu/utils/Timer.h>
+#include <faiss/gpu/utils/WarpShuffles.cuh>
+#include <faiss/utils/instrumentation.h>
 
 #include <faiss/gpu/utils/HostTensor.cuh>
 
 namespace faiss { namespace gpu {
 
-// A basic implementation that works for the interleaved by vector layout for
-// any number of sub-quantizers
-template <typename CodeDistanceT>
+// A basic implementation that works for both the interleaved by vector and
+// the vector-major layouts, for any number of sub-quantizers and any code
+// width (CodeT is uint8_t up to 8 bits per code, uint16_t above). The code
+// distances are staged in shared memory if SmemLookup, otherwise they are read
+// from global memory
+template <typename CodeT, typename CodeDistanceT, bool Interleaved,
+          bool SmemLookup>
 __global__ void
-pqScanInterleaved(Tensor<float, 2, true> queries,
-                  Tensor<float, 3, true> pqCentroids,
-                  Tensor<int, 2, true> topQueryToCentroid,
-                  Tensor<CodeDistanceT, 4, true> codeDistances,
-                  void** listCodes,
-                  int* listLengths,
-                  Tensor<int, 2, true> prefixSumOffsets,
-                  Tensor<float, 1, true> distance) {
+pqScanGeneric(Tensor<float, 2, true> queries,
+              Tensor<float, 3, true> pqCentroids,
+              Tensor<int, 2, true> topQueryToCentroid,
+              Tensor<CodeDistanceT, 4, true> codeDistances,
+              void** listCodes,
+              int* listLengths,
+              Tensor<int, 2, true> prefixSumOffsets,
+              Tensor<float, 1, true> distance) {
+  extern __shared__ char smemCodeDistances[];
+
   // Each block handles a single query
   auto queryId = blockIdx.y;
   auto probeId = blockIdx.x;
 
   int numSubQuantizers = codeDistances.getSize(2);
+  int codesPerSubQuantizer = codeDistances.getSize(3);
 
   // This is where we start writing out data
   // We ensure that before the array (at offset -1), there is a 0 value
@@ -55,20 +68,39 @@ pqScanInterleaved(Tensor<float, 2, true> queries,
   int numVecs = listLengths[listId];
 
   // This is where the codes for our list start
-  auto codes = (uint8_t*) listCodes[listId];
+  auto codes = (CodeT*) listCodes[listId];
+
+  CodeDistanceT* localCodeDistances = codeDistances[queryId][probeId].data();
+
+  if (SmemLookup) {
+    auto smem = (CodeDistanceT*) smemCodeDistances;
+    int numCodes = numSubQuantizers * codesPerSubQuantizer;
+
+    for (int i = threadIdx.x; i < numCodes; i += blockDim.x) {
+      smem[i] = localCodeDistances[i];
+    }
 
-  auto localCodeDistances = codeDistances[queryId][probeId];
+    localCodeDistances = smem;
+    __syncthreads();
+  }
 
   for (int vec = threadIdx.x; vec < numVecs; vec += blockDim.x) {
     float dist = 0;
 
-    // This is where we start for this vector with the first sub-quantizer
-    int startCode = (vec / 32) * numSubQuantizers * 32 + (vec % 32);
+    // This is where we start for this vector with the first sub-quantizer,
+    // and the distance between its sub-quantizer codes
+    int startCode = Interleaved ?
+      (vec / 32) * numSubQuantizers * 32 + (vec % 32) :
+      vec * numSubQuantizers;
+    constexpr int kCodeStride = Interleaved ? 32 : 1;
+
+    const CodeDistanceT* subQCodeDistances = localCodeDistances;
 
     for (int sq = 0; sq < numSubQuantizers; ++sq) {
-      auto code = codes[startCode + sq * 32];
+      int code = codes[startCode + sq * kCodeStride];
 
-      dist += ConvertTo<float>::to(localCodeDistances[sq][code]);
+      dist += ConvertTo<float>::to(subQCodeDistances[code]);
+      subQCodeDistances += codesPerSubQuantizer;
     }
 
     // We're done with this vector
@@ -76,6 +108,97 @@ pqScanInterleaved(Tensor<float, 2, true> queries,
   }
 }
 
+// Scan of the 4-bit fast-scan block layout (see faiss/impl/pq4_fast_scan.h).
+// Each warp handles a block of 32 vectors, one vector per lane: the warp
+// loads the codes of the block by 128-byte chunks (8 sub-quantizers), and
+// each lane gathers the bytes that hold its nibbles from the chunk with a
+// shuffle and __byte_perm. The 16-entry code distance tables of the
+// (query, list) pair are staged in shared memory.
+template <typename LookupT>
+__global__ void
+pqScanFastScan(Tensor<int, 2, true> topQueryToCentroid,
+               Tensor<LookupT, 4, true> codeDistances,
+               void** listCodes,
+               int* listLengths,
+               Tensor<int, 2, true> prefixSumOffsets,
+               Tensor<float, 1, true> distance) {
+  extern __shared__ char smemCodeDistances[];
+
+  // Each block handles a single query
+  auto queryId = blockIdx.y;
+  auto probeId = blockIdx.x;
+
+  int numSubQuantizers = codeDistances.getSize(2);
+  int numSubQuantizersPadded = utils::roundUp(numSubQuantizers, 2);
+
+  // This is where we start writing out data
+  // We ensure that before the array (at offset -1), there is a 0 value
+  int outBase = *(prefixSumOffsets[queryId][probeId].data() - 1);
+  float* distanceOut = distance[outBase].data();
+
+  auto listId = topQueryToCentroid[queryId][probeId];
+  // Safety guard in case NaNs in input cause no list ID to be generated
+  if (listId == -1) {
+    return;
+  }
+
+  int numVecs = listLengths[listId];
+  auto codes = (const unsigned int*) listCodes[listId];
+
+  auto lut = (LookupT*) smemCodeDistances;
+  auto lutSrc = codeDistances[queryId][probeId].data();
+
+  for (int i = threadIdx.x; i < numSubQuantizers * 16; i += blockDim.x) {
+    lut[i] = lutSrc[i];
+  }
+
+  __syncthreads();
+
+  int laneId = getLaneId();
+  int warpId = threadIdx.x / kWarpSize;
+  int numWarps = blockDim.x / kWarpSize;
+
+  // Where the nibble of our vector is in each 16-byte half
+  int byteInHalf = 2 * (laneId % 8) + (laneId % 16) / 8;
+  bool highNibble = laneId >= 16;
+
+  int wordsPerBlock = numSubQuantizersPadded * 4;
+  int numBlocks = utils::divUp(numVecs, kWarpSize);
+
+  for (int block = warpId; block < numBlocks; block += numWarps) {
+    auto blockCodes = codes + block * wordsPerBlock;
+    float dist = 0;
+
+    for (int chunk = 0; chunk < wordsPerBlock; chunk += kWarpSize) {
+      unsigned int word = chunk + laneId < wordsPerBlock ?
+        blockCodes[chunk + laneId] : 0;
+
+      // 4 words per sub-quantizer
+      int firstSubQ = chunk / 4;
+
+#pragma unroll
+      for (int i = 0; i < 8; ++i) {
+        int byteOffset = (i / 2) * 32 + (i % 2) * 16 + byteInHalf;
+
+        // All lanes take part in the shuffle
+        unsigned int w = shfl(word, byteOffset / 4);
+
+        if (firstSubQ + i < numSubQuantizers) {
+          unsigned int byte = __byte_perm(w, 0, 0x4440 | (byteOffset & 3));
+          int code = highNibble ? (byte >> 4) : (byte & 0xf);
+
+          dist += ConvertTo<float>::to(lut[(firstSubQ + i) * 16 + code]);
+        }
+      }
+    }
+
+    int vec = block * kWarpSize + laneId;
+    if (vec < numVecs) {
+      distanceOut[vec] = dist;
+    }
+  }
+}
+
 template <typename LookupT, typename LookupVecT>
 struct LoadCodeDistances {
   static inline __device__ void load(LookupT* smem,
@@ -258,6 +381,7 @@ runMultiPassTile(GpuResources* res,
                  bool useFloat16Lookup,
                  bool useMMCodeDistance,
                  bool interleavedCodeLayout,
+                 bool fastScanCodeLayout,
                  int numSubQuantizers,
                  int numSubQuantizerCodes,
                  thrust::device_vector<void*>& listCodes,
@@ -287,6 +411,7 @@ runMultiPassTile(GpuResources* res,
 
   // Calculate residual code distances, since this is without
   // precomputed codes
+  GpuStageTimer lutTimer(STAGE_LUT, stream);
   runPQCodeDistances(res,
                      pqCentroidsInnermostCode,
                      queries,
@@ -298,9 +423,30 @@ runMultiPassTile(GpuResources* res,
                      l2Distance,
                      useFloat16Lookup,
                      stream);
+  lutTimer.stop();
+
+  GpuStageTimer scanTimer(STAGE_LIST_SCAN, stream);
+
+  // pq centroid distances
+  size_t smem = useFloat16Lookup ? sizeof(half) : sizeof(float);
+  smem *= numSubQuantizers * numSubQuantizerCodes;
+
+  bool smemFits = smem <= getMaxSharedMemPerBlockCurrentDevice();
+
+  // The specialized kernel handles the vector-major layout with byte codes,
+  // for some numbers of sub-quantizers, with the lookup table in shared memory
+  bool useSpecialized =
+    !interleavedCodeLayout &&
+    !fastScanCodeLayout &&
+    numSubQuantizerCodes <= 256 &&
+    IVFPQ::isSupportedPQCodeLength(numSubQuantizers) &&
+    smemFits;
+
+  if (fastScanCodeLayout) {
+    // 4-bit codes in blocks of 32 vectors, one block per warp
+    FAISS_ASSERT(numSubQuantizerCodes == 16);
+    FAISS_ASSERT(smemFits);
 
-  if (interleavedCodeLayout) {
-    // The vector interleaved layout implementation
     auto kThreadsPerBlock = 256;
 
     auto grid = dim3(coarseIndices.getSize(1),
@@ -310,28 +456,88 @@ runMultiPassTile(GpuResources* res,
     if (useFloat16Lookup) {
       auto codeDistancesT = codeDistances.toTensor<half>();
 
-      pqScanInterleaved<half>
-        <<<grid, block, 0, stream>>>(queries,
-                                     pqCentroidsInnermostCode,
-                                     coarseIndices,
-                                     codeDistancesT,
-                                     listCodes.data().get(),
-                                     listLengths.data().get(),
-                                     prefixSumOffsets,
-                                     allDistances);
+      pqScanFastScan<half><<<grid, block, smem, stream>>>(
+        coarseIndices,
+        codeDistancesT,
+        listCodes.data().get(),
+        listLengths.data().get(),
+        prefixSumOffsets,
+        allDistances);
     } else {
       auto codeDistancesT = codeDistances.toTensor<float>();
 
-      pqScanInterleaved<float>
-        <<<grid, block, 0, stream>>>(queries,
-                                     pqCentroidsInnermostCode,
-                                     coarseIndices,
-                                     codeDistancesT,
-                                     listCodes.data().get(),
-                                     listLengths.data().get(),
-                                     prefixSumOffsets,
-                                     allDistances);
+      pqScanFastScan<float><<<grid, block, smem, stream>>>(
+        coarseIndices,
+        codeDistancesT,
+        listCodes.data().get(),
+        listLengths.data().get(),
+        prefixSumOffsets,
+        allDistances);
     }
+  } else if (!useSpecialized) {
+    // Any other case is handled by the generic kernel, which pages the lookup
+    // table from global memory if it doesn't fit in shared memory
+    auto kThreadsPerBlock = 256;
+
+    auto grid = dim3(coarseIndices.getSize(1),
+                     coarseIndices.getSize(0));
+    auto block = dim3(kThreadsPerBlock);
+
+    bool codes16 = numSubQuantizerCodes > 256;
+
+#define RUN_PQ_GENERIC(CODE_T, LOOKUP_T, INTERLEAVED, SMEM)             \
+    do {                                                                \
+      auto codeDistancesT = codeDistances.toTensor<LOOKUP_T>();         \
+                                                                        \
+      pqScanGeneric<CODE_T, LOOKUP_T, INTERLEAVED, SMEM>                \
+        <<<grid, block, SMEM ? smem : 0, stream>>>(                     \
+          queries,                                                      \
+          pqCentroidsInnermostCode,                                     \
+          coarseIndices,                                                \
+          codeDistancesT,                                               \
+          listCodes.data().get(),                                       \
+          listLengths.data().get(),                                     \
+          prefixSumOffsets,                                             \
+          allDistances);                                                \
+    } while (0)
+
+#define RUN_PQ_GENERIC_SMEM(CODE_T, LOOKUP_T, INTERLEAVED)              \
+    do {                                                                \
+      if (smemFits) {                                                   \
+        RUN_PQ_GENERIC(CODE_T, LOOKUP_T, INTERLEAVED, true);            \
+      } else {                                                          \
+        RUN_PQ_GENERIC(CODE_T, LOOKUP_T, INTERLEAVED, false);           \
+      }                                                                 \
+    } while (0)
+
+#define RUN_PQ_GENERIC_LAYOUT(CODE_T, LOOKUP_T)                         \
+    do {                                                                \
+      if (interleavedCodeLayout) {                                      \
+        RUN_PQ_GENERIC_SMEM(CODE_T, LOOKUP_T, true);                    \
+      } else {                                                          \
+        RUN_PQ_GENERIC_SMEM(CODE_T, LOOKUP_T, false);                   \
+      }                                                                 \
+    } while (0)
+
+#define RUN_PQ_GENERIC_LOOKUP(CODE_T)                                   \
+    do {                                                                \
+      if (useFloat16Lookup) {                                           \
+        RUN_PQ_GENERIC_LAYOUT(CODE_T, half);                            \
+      } else {                                                          \
+        RUN_PQ_GENERIC_LAYOUT(CODE_T, float);                           \
+      }                                                                 \
+    } while (0)
+
+    if (codes16) {
+      RUN_PQ_GENERIC_LOOKUP(uint16_t);
+    } else {
+      RUN_PQ_GENERIC_LOOKUP(uint8_t);
+    }
+
+#undef RUN_PQ_GENERIC_LOOKUP
+#undef RUN_PQ_GENERIC_LAYOUT
+#undef RUN_PQ_GENERIC_SMEM
+#undef RUN_PQ_GENERIC
   } else {
     // Convert all codes to a distance, and write out (distance,
     // index) values for all intermediate results
@@ -341,12 +547,6 @@ runMultiPassTile(GpuResources* res,
                      coarseIndices.getSize(0));
     auto block = dim3(kThreadsPerBlock);
 
-    // pq centroid distances
-    auto smem = useFloat16Lookup ? sizeof(half) : sizeof(float);
-
-    smem *= numSubQuantizers * numSubQuantizerCodes;
-    FAISS_ASSERT(smem <= getMaxSharedMemPerBlockCurrentDevice());
-
 #define RUN_PQ_OPT(NUM_SUB_Q, LOOKUP_T, LOOKUP_VEC_T)                   \
     do {                                                                \
       auto codeDistancesT = codeDistances.toTensor<LOOKUP_T>();         \
@@ -431,6 +631,26 @@ runMultiPassTile(GpuResources* res,
   }
 
   CUDA_TEST_ERROR();
+  scanTimer.stop();
+
+  GpuStageTimer selectTimer(STAGE_SELECT, stream);
+
+  if (k > GPU_MAX_SELECTION_K) {
+    // Beyond the heap-based selection; select directly over the
+    // concatenated list distances of each query
+    runLargeSelectLists(prefixSumOffsets,
+                        allDistances,
+                        listIndices,
+                        indicesOptions,
+                        coarseIndices,
+                        k,
+                        !l2Distance,
+                        outDistances,
+                        outIndices,
+                        res,
+                        stream);
+    return;
+  }
 
   // k-select the output in chunks, to increase parallelism
   runPass1SelectLists(prefixSumOffsets,
@@ -469,6 +689,7 @@ runPQScanMultiPassNoPrecomputed(Tensor<float, 2, true>& queries,
                                 bool useFloat16Lookup,
                                 bool useMMCodeDistance,
                                 bool interleavedCodeLayout,
+                                bool fastScanCodeLayout,
                                 int numSubQuantizers,
                                 int numSubQuantizerCodes,
                                 thrust::device_vector<void*>& listCodes,
@@ -509,7 +730,9 @@ runPQScanMultiPassNoPrecomputed(Tensor<float, 2, true>& queries,
   // We run two passes of heap selection
   // This is the size of the first-level heap passes
   constexpr int kNProbeSplit = 8;
-  int pass2Chunks = std::min(nprobe, kNProbeSplit);
+  // The large-k selection does not use the first-level heaps
+  int pass2Chunks =
+    k > GPU_MAX_SELECTION_K ? 1 : std::min(nprobe, kNProbeSplit);
 
   size_t sizeForFirstSelectPass =
     pass2Chunks * k * (sizeof(float) + sizeof(int));
@@ -525,8 +748,12 @@ runPQScanMultiPassNoPrecomputed(Tensor<float, 2, true>& queries,
 
   int queryTileSize = (int) (sizeAvailable / sizePerQuery);
 
-  if (queryTileSize < kMinQueryTileSize) {
-    queryTileSize = kMinQueryTileSize;
+  // The lookup tables of large codebooks (more than 8 bits per code) may
+  // only leave room for a few queries at a time
+  int minQueryTileSize = numSubQuantizerCodes > 256 ? 1 : kMinQueryTileSize;
+
+  if (queryTileSize < minQueryTileSize) {
+    queryTileSize = minQueryTileSize;
   } else if (queryTileSize > kMaxQueryTileSize) {
     queryTileSize = kMaxQueryTileSize;
   }
@@ -568,13 +795,15 @@ runPQScanMultiPassNoPrecomputed(Tensor<float, 2, true>& queries,
 
   int codeDistanceTypeSize = useFloat16Lookup ? sizeof(half) : sizeof(float);
 
-  int totalCodeDistancesSize =
-    queryTileSize * nprobe * numSubQuantizers * numSubQuantizerCodes *
+  size_t totalCodeDistancesSize =
+    (size_t) queryTileSize * nprobe * numSubQuantizers * numSubQuantizerCodes *
     codeDistanceTypeSize;
+  FAISS_ASSERT(totalCodeDistancesSize <
+               (size_t) std::numeric_limits<int>::max());
 
   DeviceTensor<char, 1, true> codeDistances1Mem(
     res, makeTempAlloc(AllocType::Other, stream),
-    {totalCodeDistancesSize});
+    {(int) totalCodeDistancesSize});
   NoTypeTensor<4, true> codeDistances1(
     codeDistances1Mem.data(),
     codeDistanceTypeSize,
@@ -582,7 +811,7 @@ runPQScanMultiPassNoPrecomputed(Tensor<float, 2, true>& queries,
 
   DeviceTensor<char, 1, true> codeDistances2Mem(
     res, makeTempAlloc(AllocType::Other, stream),
-    {totalCodeDistancesSize});
+    {(int) totalCodeDistancesSize});
   NoTypeTensor<4, true> codeDistances2(
     codeDistances2Mem.data(),
     codeDistanceTypeSize,
@@ -659,6 +888,7 @@ runPQScanMultiPassNoPrecomputed(Tensor<float, 2, true>& queries,
                      useFloat16Lookup,
                      useMMCodeDistance,
                      interleavedCodeLayout,
+                     fastScanCodeLayout,
                      numSubQuantizers,
                      numSubQuantizerCodes,
                      listCodes,
@@ -27,6 +27,7 @@ void runPQScanMultiPassNoPrecomputed(Tensor<float, 2, true>& queries,
                                      bool useFloat16Lookup,
                                      bool useMMCodeDistance,
                                      bool interleavedCodeLayout,
+                                     bool fastScanCodeLayout,
                                      int numSubQuantizers,
                                      int numSubQuantizerCodes,
                                      thrust::device_vector<void*>& listCodes,
@@ -8,40 +8,51 @@
 
 #include <faiss/gpu/impl/PQScanMultiPassPrecomputed.cuh>
 #include <faiss/gpu/GpuResources.h>
+#include <faiss/gpu/impl/IVFPQ.cuh>
 #include <faiss/gpu/impl/PQCodeLoad.cuh>
 #include <faiss/gpu/impl/IVFUtils.cuh>
 #include <faiss/gpu/utils/ConversionOperators.cuh>
+#include <faiss/gpu/utils/DeviceDefs.cuh>
 #include <faiss/gpu/utils/DeviceTensor.cuh>
 #include <faiss/gpu/utils/DeviceUtils.h>
 #include <faiss/gpu/utils/Float16.cuh>
 #include <faiss/gpu/utils/LoadStoreOperators.cuh>
 #include <faiss/gpu/utils/MathOperators.cuh>
 #include <faiss/gpu/utils/StaticUtils.h>
+#include <faiss/gpu/utils/Timer.h>
+#include <faiss/utils/instrumentation.h>
 #include <limits>
 
 namespace faiss { namespace gpu {
 
-// A basic implementation that works for the interleaved by vector layout for
-// any number of sub-quantizers
-template <typename LookupT>
+// A basic implementation that works for both the interleaved by vector and
+// the vector-major layouts, for any number of sub-quantizers and any code
+// width (CodeT is uint8_t up to 8 bits per code, uint16_t above). The summed
+// terms 2 and 3 are staged in shared memory if SmemLookup, otherwise both are
+// read from global memory
+template <typename CodeT, typename LookupT, bool Interleaved, bool SmemLookup>
 __global__ void
-pqScanPrecomputedInterleaved(Tensor<float, 2, true> queries,
-                             // (query id)(probe id)
-                             Tensor<float, 2, true> precompTerm1,
-                             // (centroid id)(sub q)(code id)
-                             Tensor<LookupT, 3, true> precompTerm2,
-                             // (query id)(sub q)(code id)
-                             Tensor<LookupT, 3, true> precompTerm3,
-                             Tensor<int, 2, true> topQueryToCentroid,
-                             void** listCodes,
-                             int* listLengths,
-                             Tensor<int, 2, true> prefixSumOffsets,
-                             Tensor<float, 1, true> distance) {
+pqScanPrecomputedGeneric(Tensor<float, 2, true> queries,
+                         // (query id)(probe id)
+                         Tensor<float, 2, true> precompTerm1,
+                         // (term 2 row)(sub q)(code id)
+                         Tensor<LookupT, 3, true> precompTerm2,
+                         // (query id)(sub q)(code id)
+                         Tensor<LookupT, 3, true> precompTerm3,
+                         Tensor<int, 2, true> topQueryToCentroid,
+                         // (query id)(probe id) => term 2 row
+                         Tensor<int, 2, true> precompTerm2Rows,
+                         void** listCodes,
+                         int* listLengths,
+                         Tensor<int, 2, true> prefixSumOffsets,
+                         Tensor<float, 1, true> distance) {
+  extern __shared__ char smemTerm23[];
+
   // Each block handles a single query versus single list
   auto queryId = blockIdx.y;
   auto probeId = blockIdx.x;
-  auto numSubQuantizers = precompTerm2.getSize(1);
-  auto codesPerSubQuantizer = precompTerm2.getSize(2);
+  int numSubQuantizers = precompTerm2.getSize(1);
+  int codesPerSubQuantizer = precompTerm2.getSize(2);
 
   // This is where we start writing out data
   // We ensure that before the array (at offset -1), there is a 0 value
@@ -54,29 +65,49 @@ pqScanPrecomputedInterleaved(Tensor<float, 2, true> queries,
     return;
   }
 
-  auto* codes = (uint8_t*) listCodes[listId];
+  auto* codes = (CodeT*) listCodes[listId];
   int numVecs = listLengths[listId];
 
   float term1 = precompTerm1[queryId][probeId];
 
+  auto term2Start =
+    precompTerm2[precompTerm2Rows[queryId][probeId]].data();
+  auto term3Start = precompTerm3[queryId].data();
+  auto term23 = (LookupT*) smemTerm23;
+
+  if (SmemLookup) {
+    int numCodes = numSubQuantizers * codesPerSubQuantizer;
+
+    for (int i = threadIdx.x; i < numCodes; i += blockDim.x) {
+      term23[i] = Math<LookupT>::add(term2Start[i], term3Start[i]);
+    }
+
+    __syncthreads();
+  }
+
   for (int vec = threadIdx.x; vec < numVecs; vec += blockDim.x) {
     float dist = term1;
 
-    // This is where we start for this vector with the first sub-quantizer
-    int startCode = (vec / 32) * numSubQuantizers * 32 + (vec % 32);
-    auto term2Base = precompTerm2[listId].data();
-    auto term3Base = precompTerm3[queryId].data();
+    // This is where we start for this vector with the first sub-quantizer,
+    // and the distance between its sub-quantizer codes
+    int startCode = Interleaved ?
+      (vec / 32) * numSubQuantizers * 32 + (vec % 32) :
+      vec * numSubQuantizers;
+    constexpr int kCodeStride = Interleaved ? 32 : 1;
 
-    for (int sq = 0; sq < numSubQuantizers; ++sq) {
-      auto code = codes[startCode + sq * 32];
+    int offset = 0;
 
-      float term2 = ConvertTo<float>::to(term2Base[code]);
-      float term3 = ConvertTo<float>::to(term3Base[code]);
+    for (int sq = 0; sq < numSubQuantizers; ++sq) {
+      int code = codes[startCode + sq * kCodeStride];
 
-      term2Base += codesPerSubQuantizer;
-      term3Base += codesPerSubQuantizer;
+      if (SmemLookup) {
+        dist += ConvertTo<float>::to(term23[offset + code]);
+      } else {
+        dist += ConvertTo<float>::to(term2Start[offset + code]) +
+          ConvertTo<float>::to(term3Start[offset + code]);
+      }
 
-      dist += term2 + term3;
+      offset += codesPerSubQuantizer;
     }
 
     // We're done with this vector
@@ -179,6 +210,7 @@ pqScanPrecomputedMultiPass(Tensor<float, 2, true> queries,
                            Tensor<LookupT, 3, true> precompTerm2,
                            Tensor<LookupT, 3, true> precompTerm3,
                            Tensor<int, 2, true> topQueryToCentroid,
+                           Tensor<int, 2, true> precompTerm2Rows,
                            void** listCodes,
                            int* listLengths,
                            Tensor<int, 2, true> prefixSumOffsets,
@@ -220,8 +252,9 @@ pqScanPrecomputedMultiPass(Tensor<float, 2, true> queries,
 
   // Load precomputed terms 1, 2, 3
   float term1 = precompTerm1[queryId][probeId];
+  int term2Row = precompTerm2Rows[queryId][probeId];
   loadPrecomputedTerm<LookupT, LookupVecT>(term23,
-                                           precompTerm2[listId].data(),
+                                           precompTerm2[term2Row].data(),
                                            precompTerm3[queryId].data(),
                                            precompTermSize);
 
@@ -283,6 +316,7 @@ runMultiPassTile(GpuResources* res,
                  NoTypeTensor<3, true>& precompTerm2,
                  NoTypeTensor<3, true>& precompTerm3,
                  Tensor<int, 2, true>& topQueryToCentroid,
+                 Tensor<int, 2, true>& precompTerm2Rows,
                  bool useFloat16Lookup,
                  bool interleavedCodeLayout,
                  int numSubQuantizers,
@@ -305,45 +339,91 @@ runMultiPassTile(GpuResources* res,
   runCalcListOffsets(res, topQueryToCentroid, listLengths, prefixSumOffsets,
                      thrustMem, stream);
 
-  // The vector interleaved layout implementation
-  if (interleavedCodeLayout) {
+  GpuStageTimer scanTimer(STAGE_LIST_SCAN, stream);
+
+  // pq precomputed terms (2 + 3)
+  size_t smem = useFloat16Lookup ? sizeof(half) : sizeof(float);
+  smem *= numSubQuantizers * numSubQuantizerCodes;
+
+  bool smemFits = smem <= getMaxSharedMemPerBlockCurrentDevice();
+
+  // The specialized kernel handles the vector-major layout with byte codes,
+  // for some numbers of sub-quantizers, with the terms in shared memory
+  bool useSpecialized =
+    !interleavedCodeLayout &&
+    numSubQuantizerCodes <= 256 &&
+    IVFPQ::isSupportedPQCodeLength(numSubQuantizers) &&
+    smemFits;
+
+  if (!useSpecialized) {
+    // Any other case is handled by the generic kernel, which pages the terms
+    // from global memory if they don't fit in shared memory
     auto kThreadsPerBlock = 256;
 
     auto grid = dim3(topQueryToCentroid.getSize(1),
                      topQueryToCentroid.getSize(0));
     auto block = dim3(kThreadsPerBlock);
 
-    if (useFloat16Lookup) {
-      auto precompTerm2T = precompTerm2.toTensor<half>();
-      auto precompTerm3T = precompTerm3.toTensor<half>();
-
-      pqScanPrecomputedInterleaved<half>
-        <<<grid, block, 0, stream>>>(
-        queries,
-        precompTerm1,
-        precompTerm2T,
-        precompTerm3T,
-        topQueryToCentroid,
-        listCodes.data().get(),
-        listLengths.data().get(),
-        prefixSumOffsets,
-        allDistances);
+    bool codes16 = numSubQuantizerCodes > 256;
+
+#define RUN_PQ_GENERIC(CODE_T, LOOKUP_T, INTERLEAVED, SMEM)             \
+    do {                                                                \
+      auto precompTerm2T = precompTerm2.toTensor<LOOKUP_T>();           \
+      auto precompTerm3T = precompTerm3.toTensor<LOOKUP_T>();           \
+                                                                        \
+      pqScanPrecomputedGeneric<CODE_T, LOOKUP_T, INTERLEAVED, SMEM>     \
+        <<<grid, block, SMEM ? smem : 0, stream>>>(                     \
+          queries,                                                      \
+          precompTerm1,                                                 \
+          precompTerm2T,                                                \
+          precompTerm3T,                                                \
+          topQueryToCentroid,                                           \
+          precompTerm2Rows,                                             \
+          listCodes.data().get(),                                       \
+          listLengths.data().get(),                                     \
+          prefixSumOffsets,                                             \
+          allDistances);                                                \
+    } while (0)
+
+#define RUN_PQ_GENERIC_SMEM(CODE_T, LOOKUP_T, INTERLEAVED)              \
+    do {                                                                \
+      if (smemFits) {                                                   \
+        RUN_PQ_GENERIC(CODE_T, LOOKUP_T, INTERLEAVED, true);            \
+      } else {                                                          \
+        RUN_PQ_GENERIC(CODE_T, LOOKUP_T, INTERLEAVED, false);           \
+      }                                                                 \
+    } while (0)
+
+#define RUN_PQ_GENERIC_LAYOUT(CODE_T, LOOKUP_T)                         \
+    do {                                                                \
+      if (interleavedCodeLayout) {                                      \
+        RUN_PQ_GENERIC_SMEM(CODE_T, LOOKUP_T, true);                    \
+      } else {                                                          \
+        RUN_PQ_GENERIC_SMEM(CODE_T, LOOKUP_T, false);                   \
+      }                                                                 \
+    } while (0)
+
+#define RUN_PQ_GENERIC_LOOKUP(CODE_T)                                   \
+    do {                                                                \
+      if (useFloat16Lookup) {                                           \
+        RUN_PQ_GENERIC_LAYOUT(CODE_T, half);                            \
+      } else {                                                          \
+        RUN_PQ_GENERIC_LAYOUT(CODE_T, float);                           \
+      }                                                                 \
+    } while (0)
+
+    if (codes16) {
+      RUN_PQ_GENERIC_LOOKUP(uint16_t);
     } else {
-      auto precompTerm2T = precompTerm2.toTensor<float>();
-      auto precompTerm3T = precompTerm3.toTensor<float>();
-
-      pqScanPrecomputedInterleaved<float>
-        <<<grid, block, 0, stream>>>(
-        queries,
-        precompTerm1,
-        precompTerm2T,
-        precompTerm3T,
-        topQueryToCentroid,
-        listCodes.data().get(),
-        listLengths.data().get(),
-        prefixSumOffsets,
-        allDistances);
+      RUN_PQ_GENERIC_LOOKUP(uint8_t);
     }
+
+    CUDA_TEST_ERROR();
+
+#undef RUN_PQ_GENERIC_LOOKUP
+#undef RUN_PQ_GENERIC_LAYOUT
+#undef RUN_PQ_GENERIC_SMEM
+#undef RUN_PQ_GENERIC
   } else {
     // Convert all codes to a distance, and write out (distance,
     // index) values for all intermediate results
@@ -353,12 +433,6 @@ runMultiPassTile(GpuResources* res,
                      topQueryToCentroid.getSize(0));
     auto block = dim3(kThreadsPerBlock);
 
-    // pq precomputed terms (2 + 3)
-    auto smem = useFloat16Lookup ? sizeof(half) : sizeof(float);
-
-    smem *= numSubQuantizers * numSubQuantizerCodes;
-    FAISS_ASSERT(smem <= getMaxSharedMemPerBlockCurrentDevice());
-
 #define RUN_PQ_OPT(NUM_SUB_Q, LOOKUP_T, LOOKUP_VEC_T)                   \
     do {                                                                \
       auto precompTerm2T = precompTerm2.toTensor<LOOKUP_T>();           \
@@ -371,6 +445,7 @@ runMultiPassTile(GpuResources* res,
           precompTerm2T,                                                \
           precompTerm3T,                                                \
           topQueryToCentroid,                                           \
+          precompTerm2Rows,                                             \
           listCodes.data().get(),                                       \
           listLengths.data().get(),                                     \
           prefixSumOffsets,                                             \
@@ -446,6 +521,27 @@ runMultiPassTile(GpuResources* res,
 #undef RUN_PQ_OPT
   }
 
+  scanTimer.stop();
+
+  GpuStageTimer selectTimer(STAGE_SELECT, stream);
+
+  if (k > GPU_MAX_SELECTION_K) {
+    // Beyond the heap-based selection; select directly over the
+    // concatenated list distances of each query
+    runLargeSelectLists(prefixSumOffsets,
+                        allDistances,
+                        listIndices,
+                        indicesOptions,
+                        topQueryToCentroid,
+                        k,
+                        false,
+                        outDistances,
+                        outIndices,
+                        res,
+                        stream);
+    return;
+  }
+
   // k-select the output in chunks, to increase parallelism
   runPass1SelectLists(prefixSumOffsets,
                       allDistances,
@@ -478,11 +574,13 @@ runMultiPassTile(GpuResources* res,
 void runPQScanMultiPassPrecomputed(Tensor<float, 2, true>& queries,
                                    // (query id)(probe id)
                                    Tensor<float, 2, true>& precompTerm1,
-                                   // (centroid id)(sub q)(code id)
+                                   // (term 2 row)(sub q)(code id)
                                    NoTypeTensor<3, true>& precompTerm2,
                                    // (query id)(sub q)(code id)
                                    NoTypeTensor<3, true>& precompTerm3,
                                    Tensor<int, 2, true>& topQueryToCentroid,
+                                   // (query id)(probe id) => term 2 row
+                                   Tensor<int, 2, true>& precompTerm2Rows,
                                    bool useFloat16Lookup,
                                    bool interleavedCodeLayout,
                                    int numSubQuantizers,
@@ -524,7 +622,9 @@ void runPQScanMultiPassPrecomputed(Tensor<float, 2, true>& queries,
   // We run two passes of heap selection
   // This is the size of the first-level heap passes
   constexpr int kNProbeSplit = 8;
-  int pass2Chunks = std::min(nprobe, kNProbeSplit);
+  // The large-k selection does not use the first-level heaps
+  int pass2Chunks =
+    k > GPU_MAX_SELECTION_K ? 1 : std::min(nprobe, kNProbeSplit);
 
   size_t sizeForFirstSelectPass =
     pass2Chunks * k * (sizeof(float) + sizeof(int));
@@ -620,6 +720,8 @@ void runPQScanMultiPassPrecomputed(Tensor<float, 2, true>& queries,
 
     auto coarseIndicesView =
       topQueryToCentroid.narrowOutermost(query, numQueriesInTile);
+    auto term2RowsView =
+      precompTerm2Rows.narrowOutermost(query, numQueriesInTile);
     auto queryView =
       queries.narrowOutermost(query, numQueriesInTile);
     auto term1View =
@@ -643,6 +745,7 @@ void runPQScanMultiPassPrecomputed(Tensor<float, 2, true>& queries,
                      precompTerm2,
                      term3View,
                      coarseIndicesView,
+                     term2RowsView,
                      useFloat16Lookup,
                      interleavedCodeLayout,
                      numSubQuantizers,
@@ -23,6 +23,10 @@ void runPQScanMultiPassPrecomputed(Tensor<float, 2, true>& queries,
                                    NoTypeTensor<3, true>& precompTerm2,
                                    NoTypeTensor<3, true>& precompTerm3,
                                    Tensor<int, 2, true>& topQueryToCentroid,
+                                   // (query id)(probe id) => row of
+                                   // precompTerm2, the list id if the
+                                   // table has a row per list
+                                   Tensor<int, 2, true>& precompTerm2Rows,
                                    bool useFloat16Lookup,
                                    bool interleavedCodeLayout,
                                    int numSubQuantizers,
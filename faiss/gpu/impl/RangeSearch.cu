@@ -0,0 +1,461 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#include <faiss/gpu/impl/RangeSearch.cuh>
+#include <faiss/gpu/impl/BroadcastSum.cuh>
+#include <faiss/gpu/impl/DistanceUtils.cuh>
+#include <faiss/gpu/impl/IVFUtils.cuh>
+#include <faiss/gpu/impl/L2Norm.cuh>
+#include <faiss/gpu/impl/VectorResidual.cuh>
+#include <faiss/gpu/GpuResources.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/gpu/utils/CopyUtils.cuh>
+#include <faiss/gpu/utils/DeviceTensor.cuh>
+#include <faiss/gpu/utils/DeviceUtils.h>
+#include <faiss/gpu/utils/MatrixMult.cuh>
+#include <faiss/gpu/utils/StaticUtils.h>
+#include <cub/block/block_scan.cuh>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+namespace faiss { namespace gpu {
+
+constexpr int kRangeCompactThreads = 256;
+
+// Scans the `num` candidates of query `queryId` in order with one block,
+// counting or writing out those within the radius. The positions of the
+// results within each chunk of the block are given by a block-wide scan, so
+// the output is in candidate order
+template <int ThreadsPerBlock, typename DistanceOp, typename LabelOp>
+__device__ void
+rangeCompactBlock(int queryId,
+                  int num,
+                  float radius,
+                  bool keepLargest,
+                  const DistanceOp& getDistance,
+                  const LabelOp& getLabel,
+                  RangeScanOutput& out) {
+  typedef cub::BlockScan<int, ThreadsPerBlock> BlockScan;
+  __shared__ typename BlockScan::TempStorage scanTemp;
+
+  bool fill = out.cursors != nullptr;
+
+  if (fill && out.maxResults > 0 && out.counts[queryId] > out.maxResults) {
+    // answered by the k-NN search
+    return;
+  }
+
+  size_t cursor = fill ? out.cursors[queryId] : 0;
+  int total = 0;
+
+  for (int base = 0; base < num; base += ThreadsPerBlock) {
+    int i = base + threadIdx.x;
+
+    float dist = 0;
+    bool keep = false;
+
+    if (i < num) {
+      dist = getDistance(i);
+      keep = keepLargest ? dist > radius : dist < radius;
+    }
+
+    int pos;
+    int chunkTotal;
+    BlockScan(scanTemp).ExclusiveSum(keep ? 1 : 0, pos, chunkTotal);
+
+    if (fill && keep) {
+      out.distances[cursor + total + pos] = dist;
+      out.labels[cursor + total + pos] = getLabel(i);
+    }
+
+    total += chunkTotal;
+
+    // scanTemp is reused
+    __syncthreads();
+  }
+
+  if (threadIdx.x == 0) {
+    if (fill) {
+      out.cursors[queryId] = cursor + total;
+    } else {
+      out.counts[queryId] += total;
+    }
+  }
+}
+
+// One block per row of a (query, vector) distance tile
+template <int ThreadsPerBlock>
+__global__ void
+rangeCompactRows(Tensor<float, 2, true> distances,
+                 float* queryNorms,
+                 int queryOffset,
+                 int vectorOffset,
+                 bool keepLargest,
+                 float radius,
+                 RangeScanOutput out) {
+  int row = blockIdx.x;
+  float* rowDistances = distances[row].data();
+
+  // L2: the tile holds ||c||^2 - 2qc
+  float queryNorm = queryNorms ? queryNorms[row] : 0;
+
+  auto getDistance = [&](int i) {
+    float d = rowDistances[i];
+    return queryNorms ? fmaxf(d + queryNorm, 0.0f) : d;
+  };
+  auto getLabel = [&](int i) {
+    return (Index::idx_t) (vectorOffset + i);
+  };
+
+  rangeCompactBlock<ThreadsPerBlock>(queryOffset + row,
+                                     distances.getSize(1),
+                                     radius,
+                                     keepLargest,
+                                     getDistance,
+                                     getLabel,
+                                     out);
+}
+
+// One block per query of an IVF tile
+template <int ThreadsPerBlock>
+__global__ void
+rangeCompactLists(Tensor<int, 2, true> prefixSumOffsets,
+                  Tensor<float, 1, true> distances,
+                  Tensor<int, 2, true> listIds,
+                  void** listIndices,
+                  IndicesOptions opt,
+                  int queryOffset,
+                  bool keepLargest,
+                  float radius,
+                  RangeScanOutput out) {
+  int queryId = blockIdx.x;
+  int nprobe = prefixSumOffsets.getSize(1);
+  int* queryOffsets = prefixSumOffsets[queryId].data();
+
+  // The element before the first offset is 0, or the end of the previous
+  // query
+  int start = *(queryOffsets - 1);
+  int num = queryOffsets[nprobe - 1] - start;
+
+  float* queryDistances = distances.data() + start;
+
+  auto getDistance = [&](int i) {
+    return queryDistances[i];
+  };
+  auto getLabel = [&](int i) {
+    return ivfOffsetToListIndex(start + i,
+                                queryOffsets,
+                                listIds[queryId].data(),
+                                nprobe,
+                                listIndices,
+                                opt);
+  };
+
+  rangeCompactBlock<ThreadsPerBlock>(queryOffset + queryId,
+                                     num,
+                                     radius,
+                                     keepLargest,
+                                     getDistance,
+                                     getLabel,
+                                     out);
+}
+
+void
+runRangeCompactRows(Tensor<float, 2, true>& distances,
+                    float* queryNorms,
+                    int queryOffset,
+                    int vectorOffset,
+                    bool keepLargest,
+                    float radius,
+                    RangeScanOutput& out,
+                    cudaStream_t stream) {
+  auto grid = dim3(distances.getSize(0));
+  auto block = dim3(kRangeCompactThreads);
+
+  rangeCompactRows<kRangeCompactThreads><<<grid, block, 0, stream>>>(
+    distances, queryNorms, queryOffset, vectorOffset,
+    keepLargest, radius, out);
+  CUDA_TEST_ERROR();
+}
+
+void
+runRangeCompactLists(Tensor<int, 2, true>& prefixSumOffsets,
+                     Tensor<float, 1, true>& distances,
+                     Tensor<int, 2, true>& listIds,
+                     thrust::device_vector<void*>& listIndices,
+                     IndicesOptions indicesOptions,
+                     int queryOffset,
+                     bool keepLargest,
+                     float radius,
+                     RangeScanOutput& out,
+                     cudaStream_t stream) {
+  auto grid = dim3(prefixSumOffsets.getSize(0));
+  auto block = dim3(kRangeCompactThreads);
+
+  rangeCompactLists<kRangeCompactThreads><<<grid, block, 0, stream>>>(
+    prefixSumOffsets, distances, listIds, listIndices.data().get(),
+    indicesOptions, queryOffset, keepLargest, radius, out);
+  CUDA_TEST_ERROR();
+}
+
+template <typename T>
+void
+runFlatRangeScanImpl(GpuResources* res,
+                     Tensor<T, 2, true>& vectors,
+                     bool vectorsRowMajor,
+                     Tensor<float, 1, true>* vectorNorms,
+                     Tensor<T, 2, true>& queries,
+                     bool computeL2,
+                     float radius,
+                     RangeScanOutput& out) {
+  int numVectors = vectors.getSize(vectorsRowMajor ? 0 : 1);
+  int numQueries = queries.getSize(0);
+  int dim = queries.getSize(1);
+
+  if (numVectors == 0 || numQueries == 0) {
+    return;
+  }
+
+  auto stream = res->getDefaultStreamCurrentDevice();
+
+  // L2: If ||c||^2 is not pre-computed, calculate it
+  DeviceTensor<float, 1, true> vNorms;
+  if (computeL2 && !vectorNorms) {
+    vNorms = DeviceTensor<float, 1, true>(
+      res, makeTempAlloc(AllocType::Other, stream), {numVectors});
+    runL2Norm(vectors, vectorsRowMajor, vNorms, true, stream);
+    vectorNorms = &vNorms;
+  }
+
+  DeviceTensor<float, 1, true> queryNorms(
+    res, makeTempAlloc(AllocType::Other, stream), {numQueries});
+
+  if (computeL2) {
+    runL2Norm(queries, true, queryNorms, true, stream);
+  }
+
+  int tileRows = 0;
+  int tileCols = 0;
+  chooseTileSize(numQueries,
+                 numVectors,
+                 dim,
+                 sizeof(T),
+                 res->getTempMemoryAvailableCurrentDevice(),
+                 tileRows,
+                 tileCols);
+
+  // The tiles of a query row are compacted in order on a single stream, so
+  // that the results of each query are in id order
+  DeviceTensor<float, 2, true> distanceBuf(
+    res, makeTempAlloc(AllocType::Other, stream), {tileRows, tileCols});
+
+  for (int i = 0; i < numQueries; i += tileRows) {
+    int curQuerySize = std::min(tileRows, numQueries - i);
+    auto queryView = queries.narrow(0, i, curQuerySize);
+
+    for (int j = 0; j < numVectors; j += tileCols) {
+      int curVectorSize = std::min(tileCols, numVectors - j);
+
+      auto vectorsView =
+        sliceCentroids(vectors, vectorsRowMajor, j, curVectorSize);
+      auto distanceBufView =
+        distanceBuf.narrow(0, 0, curQuerySize).narrow(1, 0, curVectorSize);
+
+      // L2: distance is ||c||^2 - 2qc + ||q||^2, we compute -2qc
+      // IP: just compute qc
+      runMatrixMult(distanceBufView,
+                    false, // not transposed
+                    queryView,
+                    false, // queries are row major
+                    vectorsView,
+                    vectorsRowMajor, // transposed MM if row major
+                    computeL2 ? -2.0f : 1.0f,
+                    0.0f,
+                    res->getBlasHandleCurrentDevice(),
+                    stream);
+
+      if (computeL2) {
+        // ||c||^2 - 2qc; ||q||^2 is added by the compaction
+        auto vectorNormsView = vectorNorms->narrow(0, j, curVectorSize);
+        runSumAlongColumns(vectorNormsView, distanceBufView, stream);
+      }
+
+      runRangeCompactRows(distanceBufView,
+                          computeL2 ? queryNorms.data() + i : nullptr,
+                          i,
+                          j,
+                          !computeL2,
+                          radius,
+                          out,
+                          stream);
+    }
+  }
+}
+
+void
+runFlatRangeScan(GpuResources* res,
+                 Tensor<float, 2, true>& vectors,
+                 bool vectorsRowMajor,
+                 Tensor<float, 1, true>* vectorNorms,
+                 Tensor<float, 2, true>& queries,
+                 bool computeL2,
+                 float radius,
+                 RangeScanOutput& out) {
+  runFlatRangeScanImpl<float>(res, vectors, vectorsRowMajor, vectorNorms,
+                              queries, computeL2, radius, out);
+}
+
+void
+runFlatRangeScan(GpuResources* res,
+                 Tensor<half, 2, true>& vectors,
+                 bool vectorsRowMajor,
+                 Tensor<float, 1, true>* vectorNorms,
+                 Tensor<half, 2, true>& queries,
+                 bool computeL2,
+                 float radius,
+                 RangeScanOutput& out) {
+  runFlatRangeScanImpl<half>(res, vectors, vectorsRowMajor, vectorNorms,
+                             queries, computeL2, radius, out);
+}
+
+void
+runRangeSearch(GpuResources* res,
+               Tensor<float, 2, true>& queries,
+               int maxResults,
+               const RangeScanFn& scan,
+               const RangeKnnFn& knn,
+               const RangeRemapFn& remap,
+               RangeSearchResult* result) {
+  FAISS_THROW_IF_NOT_MSG(!result->callback,
+                         "range search callbacks not supported on the GPU");
+
+  auto stream = res->getDefaultStreamCurrentDevice();
+  int numQueries = queries.getSize(0);
+
+  // Count pass
+  DeviceTensor<int, 1, true> counts(
+    res, makeTempAlloc(AllocType::Other, stream), {numQueries});
+  counts.zero(stream);
+
+  RangeScanOutput out;
+  out.counts = counts.data();
+  out.cursors = nullptr;
+  out.distances = nullptr;
+  out.labels = nullptr;
+  out.maxResults = maxResults;
+
+  scan(out);
+
+  std::vector<int> hostCounts(numQueries);
+  fromDevice(counts.data(), hostCounts.data(), numQueries, stream);
+
+  // Queries that are truncated to their maxResults nearest results
+  std::vector<int> overflow;
+
+  for (int q = 0; q < numQueries; ++q) {
+    int n = hostCounts[q];
+
+    if (maxResults > 0 && n > maxResults) {
+      overflow.push_back(q);
+      n = maxResults;
+    }
+
+    result->lims[q] = n;
+  }
+
+  result->do_allocation();
+  size_t total = result->lims[numQueries];
+
+  // The device tensors are indexed in int
+  FAISS_THROW_IF_NOT_FMT(total <= (size_t) std::numeric_limits<int>::max(),
+                         "GPU range search supports up to %d results",
+                         std::numeric_limits<int>::max());
+
+  if (total > 0) {
+    // Fill pass, into buffers of the final size
+    DeviceTensor<size_t, 1, true> cursors(
+      res, makeTempAlloc(AllocType::Other, stream), {numQueries});
+    CUDA_VERIFY(cudaMemcpyAsync(cursors.data(),
+                                result->lims,
+                                numQueries * sizeof(size_t),
+                                cudaMemcpyHostToDevice,
+                                stream));
+
+    DeviceTensor<float, 1, true> distances(
+      res, makeTempAlloc(AllocType::Other, stream), {(int) total});
+    DeviceTensor<Index::idx_t, 1, true> labels(
+      res, makeTempAlloc(AllocType::Other, stream), {(int) total});
+
+    // The rows of the truncated queries are filled below; they are -1
+    // meanwhile, which the remapping skips
+    CUDA_VERIFY(cudaMemsetAsync(labels.data(),
+                                0xff,
+                                total * sizeof(Index::idx_t),
+                                stream));
+
+    out.cursors = cursors.data();
+    out.distances = distances.data();
+    out.labels = labels.data();
+
+    scan(out);
+
+    fromDevice(distances.data(), result->distances, total, stream);
+    fromDevice(labels.data(), result->labels, total, stream);
+
+    if (remap) {
+      remap(result->labels, total);
+    }
+  }
+
+  if (!overflow.empty()) {
+    int numOverflow = (int) overflow.size();
+
+    DeviceTensor<int, 1, true> overflowIds(
+      res, makeTempAlloc(AllocType::Other, stream), {numOverflow});
+    CUDA_VERIFY(cudaMemcpyAsync(overflowIds.data(),
+                                overflow.data(),
+                                numOverflow * sizeof(int),
+                                cudaMemcpyHostToDevice,
+                                stream));
+
+    DeviceTensor<float, 2, true> overflowQueries(
+      res, makeTempAlloc(AllocType::Other, stream),
+      {numOverflow, queries.getSize(1)});
+    runReconstruct(overflowIds, queries, overflowQueries, stream);
+
+    DeviceTensor<float, 2, true> knnDistances(
+      res, makeTempAlloc(AllocType::Other, stream),
+      {numOverflow, maxResults});
+    DeviceTensor<Index::idx_t, 2, true> knnLabels(
+      res, makeTempAlloc(AllocType::Other, stream),
+      {numOverflow, maxResults});
+
+    knn(overflowQueries, maxResults, knnDistances, knnLabels);
+
+    std::vector<float> hostDistances(knnDistances.numElements());
+    std::vector<Index::idx_t> hostLabels(knnLabels.numElements());
+    fromDevice(knnDistances, hostDistances.data(), stream);
+    fromDevice(knnLabels, hostLabels.data(), stream);
+
+    for (int i = 0; i < numOverflow; ++i) {
+      size_t offset = result->lims[overflow[i]];
+
+      memcpy(result->distances + offset,
+             hostDistances.data() + (size_t) i * maxResults,
+             maxResults * sizeof(float));
+      memcpy(result->labels + offset,
+             hostLabels.data() + (size_t) i * maxResults,
+             maxResults * sizeof(Index::idx_t));
+    }
+  }
+}
+
+} } // namespace
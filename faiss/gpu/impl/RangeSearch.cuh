@@ -0,0 +1,104 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#pragma once
+
+#include <faiss/Index.h>
+#include <faiss/gpu/GpuIndicesOptions.h>
+#include <faiss/gpu/utils/Tensor.cuh>
+#include <functional>
+#include <thrust/device_vector.h>
+
+namespace faiss {
+struct RangeSearchResult;
+}
+
+namespace faiss { namespace gpu {
+
+class GpuResources;
+
+/// Device-side output of a range search scan.
+/// The candidates of each query are scanned twice. The count pass
+/// (cursors == nullptr) adds the number of results of query q to counts[q].
+/// The fill pass writes the results of query q in candidate order at
+/// cursors[q], which starts at the CSR offset of the query and is advanced
+/// as results are written. If maxResults > 0, the queries with more than
+/// maxResults results are skipped by the fill pass.
+struct RangeScanOutput {
+  int* counts;
+  size_t* cursors;
+  float* distances;
+  Index::idx_t* labels;
+  int maxResults;
+};
+
+/// Scans the candidates of all queries into the given output
+using RangeScanFn = std::function<void(RangeScanOutput& out)>;
+
+/// k-NN search of a subset of the queries, (query, k) outputs on the device
+using RangeKnnFn =
+  std::function<void(Tensor<float, 2, true>& queries,
+                     int k,
+                     Tensor<float, 2, true>& outDistances,
+                     Tensor<Index::idx_t, 2, true>& outLabels)>;
+
+/// Translates the labels written by the scan, on the host
+using RangeRemapFn = std::function<void(Index::idx_t* labels, size_t num)>;
+
+/// Range search of `queries` (on the device) into `result` (on the host),
+/// in two passes of `scan`: the per-query counts give the CSR offsets
+/// (result->lims), then the results are compacted directly into a device
+/// buffer of that size and copied back once.
+/// Queries with more than maxResults results (if > 0) return their
+/// maxResults nearest results instead, from `knn` with k = maxResults; they
+/// are all within the radius.
+void runRangeSearch(GpuResources* res,
+                    Tensor<float, 2, true>& queries,
+                    int maxResults,
+                    const RangeScanFn& scan,
+                    const RangeKnnFn& knn,
+                    const RangeRemapFn& remap,
+                    RangeSearchResult* result);
+
+/// Range scan of the queries against all `vectors` by tiles of
+/// queries x vectors, as for k-NN (runL2Distance / runIPDistance). L2 keeps
+/// distances < radius, IP keeps similarities > radius, as on the CPU
+void runFlatRangeScan(GpuResources* res,
+                      Tensor<float, 2, true>& vectors,
+                      bool vectorsRowMajor,
+                      Tensor<float, 1, true>* vectorNorms,
+                      Tensor<float, 2, true>& queries,
+                      bool computeL2,
+                      float radius,
+                      RangeScanOutput& out);
+
+void runFlatRangeScan(GpuResources* res,
+                      Tensor<half, 2, true>& vectors,
+                      bool vectorsRowMajor,
+                      Tensor<float, 1, true>* vectorNorms,
+                      Tensor<half, 2, true>& queries,
+                      bool computeL2,
+                      float radius,
+                      RangeScanOutput& out);
+
+/// Range compaction of the distances of a tile of queries over their probed
+/// lists, concatenated as produced by the IVF list scans (see
+/// runCalcListOffsets). Row q of the tile is query queryOffset + q of `out`.
+/// The labels are the list indices (see ivfOffsetToListIndex)
+void runRangeCompactLists(Tensor<int, 2, true>& prefixSumOffsets,
+                          Tensor<float, 1, true>& distances,
+                          Tensor<int, 2, true>& listIds,
+                          thrust::device_vector<void*>& listIndices,
+                          IndicesOptions indicesOptions,
+                          int queryOffset,
+                          bool keepLargest,
+                          float radius,
+                          RangeScanOutput& out,
+                          cudaStream_t stream);
+
+} } // namespace
@@ -0,0 +1,491 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// GPU performance regression suite.
+//
+// Sweeps the search parameters of the GPU flat, IVFFlat and IVFPQ
+// indexes on synthetic data and writes one JSON object per configuration
+// (JSON lines), so that the results of several runs (CUDA versions,
+// architectures, commits) can be compared by a script. For each
+// configuration it reports:
+//
+// - the time to add the database to the GPU index (also covers the
+//   encoding kernels of PerfIVFPQAdd)
+// - the throughput and the latency percentiles over --reps searches of a
+//   batch of nq queries (after one warmup search)
+// - the k-recall@k against the exact CPU ground truth, and the overlap
+//   with the results of the same index searched on the CPU (that
+//   catches GPU-specific accuracy regressions, eg. in float16 paths),
+//   and the CPU throughput for the largest nq and k as a reference
+// - the peak GPU temporary memory and the GPU time per search stage,
+//   from an additional search with faiss::instrumentation_enabled
+//
+// The k sweep with the flat index exercises the k-selection kernels
+// (PerfSelect). A configuration that fails (eg. k above the GPU limit,
+// or an unsupported M) produces a record with an "error" field and the
+// sweep continues.
+//
+// Example:
+//
+//   perf_suite --index flat,ivfpq --d 64,128 --M 16,32 --nq 1,64,4096
+//       --k 10,100,1024 --nprobe 1,16,64 --float16 0,1 --out results.jsonl
+
+#include <faiss/AutoTune.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVFFlat.h>
+#include <faiss/IndexIVFPQ.h>
+#include <faiss/clone_index.h>
+#include <faiss/gpu/GpuAutoTune.h>
+#include <faiss/gpu/GpuCloner.h>
+#include <faiss/gpu/GpuClonerOptions.h>
+#include <faiss/gpu/StandardGpuResources.h>
+#include <faiss/gpu/utils/DeviceUtils.h>
+#include <faiss/impl/FaissException.h>
+#include <faiss/utils/instrumentation.h>
+#include <faiss/utils/random.h>
+
+#include <cuda_runtime.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+using idx_t = faiss::Index::idx_t;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct Options {
+  std::vector<std::string> indexTypes = {"flat", "ivfflat", "ivfpq"};
+  std::vector<int> dims = {64};
+  std::vector<int> Ms = {16};
+  std::vector<int> nqs = {1, 64, 4096};
+  std::vector<int> ks = {10, 100};
+  std::vector<int> nprobes = {1, 16, 64};
+  std::vector<int> float16s = {0, 1};
+  size_t nb = 100000;
+  size_t nt = 50000;
+  int ncentroids = 1024;
+  int reps = 20;
+  int device = 0;
+  long tempMem = -1;
+  long seed = 1234;
+  const char* out = nullptr;
+};
+
+void usage() {
+  printf(
+    "usage: perf_suite [options], lists are comma-separated\n"
+    "  --index l         index types among flat,ivfflat,ivfpq\n"
+    "                    (default flat,ivfflat,ivfpq)\n"
+    "  --d l             dimensions (default 64)\n"
+    "  --M l             IVFPQ sub-quantizers (default 16)\n"
+    "  --nq l            query batch sizes (default 1,64,4096)\n"
+    "  --k l             nb of results (default 10,100)\n"
+    "  --nprobe l        IVF nprobe (default 1,16,64)\n"
+    "  --float16 l       0 and/or 1: float16 storage (flat, ivfflat) or\n"
+    "                    lookup tables (ivfpq) (default 0,1)\n"
+    "  --nb n            database size (default 100000)\n"
+    "  --nt n            training set size (default 50000)\n"
+    "  --ncentroids n    IVF lists (default 1024)\n"
+    "  --reps n          timed searches per configuration (default 20)\n"
+    "  --gpu n           device (default 0)\n"
+    "  --tempmem bytes   GPU temporary memory (default: library default)\n"
+    "  --seed n          data seed (default 1234)\n"
+    "  --out f           output file (default stdout)\n");
+}
+
+std::vector<std::string> splitList(const char* s) {
+  std::vector<std::string> out;
+  std::string cur;
+  for (const char* p = s; ; p++) {
+    if (*p == ',' || *p == 0) {
+      if (!cur.empty()) {
+        out.push_back(cur);
+      }
+      cur.clear();
+      if (*p == 0) {
+        break;
+      }
+    } else {
+      cur += *p;
+    }
+  }
+  return out;
+}
+
+std::vector<int> intList(const char* s) {
+  std::vector<int> out;
+  for (auto& v : splitList(s)) {
+    out.push_back(atoi(v.c_str()));
+  }
+  return out;
+}
+
+bool parseArgs(int argc, char** argv, Options& opt) {
+  for (int i = 1; i < argc; i++) {
+    std::string a = argv[i];
+    if (i + 1 >= argc) {
+      return false;
+    }
+    const char* v = argv[++i];
+    if (a == "--index") {
+      opt.indexTypes = splitList(v);
+    } else if (a == "--d") {
+      opt.dims = intList(v);
+    } else if (a == "--M") {
+      opt.Ms = intList(v);
+    } else if (a == "--nq") {
+      opt.nqs = intList(v);
+    } else if (a == "--k") {
+      opt.ks = intList(v);
+    } else if (a == "--nprobe") {
+      opt.nprobes = intList(v);
+    } else if (a == "--float16") {
+      opt.float16s = intList(v);
+    } else if (a == "--nb") {
+      opt.nb = strtoul(v, nullptr, 10);
+    } else if (a == "--nt") {
+      opt.nt = strtoul(v, nullptr, 10);
+    } else if (a == "--ncentroids") {
+      opt.ncentroids = atoi(v);
+    } else if (a == "--reps") {
+      opt.reps = atoi(v);
+    } else if (a == "--gpu") {
+      opt.device = atoi(v);
+    } else if (a == "--tempmem") {
+      opt.tempMem = atol(v);
+    } else if (a == "--seed") {
+      opt.seed = atol(v);
+    } else if (a == "--out") {
+      opt.out = v;
+    } else {
+      return false;
+    }
+  }
+  for (auto& t : opt.indexTypes) {
+    if (t != "flat" && t != "ivfflat" && t != "ivfpq") {
+      return false;
+    }
+  }
+  return !opt.nqs.empty() && !opt.ks.empty() && opt.reps > 0;
+}
+
+double percentile(const std::vector<double>& sorted, double p) {
+  size_t i = size_t(p * (sorted.size() - 1) + 0.5);
+  return sorted[std::min(i, sorted.size() - 1)];
+}
+
+// average over the queries of |I[:k] & Iref[:k]| / k, both with kmax
+// results per query
+double overlap(const std::vector<idx_t>& I, int kI,
+               const std::vector<idx_t>& Iref, int kref,
+               int nq, int k) {
+  double tot = 0;
+  for (int q = 0; q < nq; q++) {
+    std::unordered_set<idx_t> ref(Iref.begin() + (size_t) q * kref,
+                                  Iref.begin() + (size_t) q * kref + k);
+    int n = 0;
+    for (int j = 0; j < k; j++) {
+      n += ref.count(I[(size_t) q * kI + j]);
+    }
+    tot += double(n) / k;
+  }
+  return tot / nq;
+}
+
+/// data and exact ground truth for one dimension
+struct Dataset {
+  int d;
+  std::vector<float> xt, xb, xq;
+  int kmax;
+  std::vector<idx_t> gt;  // size nqmax * kmax
+
+  Dataset(const Options& opt, int d, int nqmax, int kmax)
+      : d(d), xt(opt.nt * d), xb(opt.nb * d), xq((size_t) nqmax * d),
+        kmax(kmax), gt((size_t) nqmax * kmax) {
+    faiss::float_rand(xt.data(), xt.size(), opt.seed);
+    faiss::float_rand(xb.data(), xb.size(), opt.seed + 1);
+    faiss::float_rand(xq.data(), xq.size(), opt.seed + 2);
+
+    faiss::IndexFlatL2 index(d);
+    index.add(opt.nb, xb.data());
+    std::vector<float> D(gt.size());
+    index.search(nqmax, xq.data(), kmax, D.data(), gt.data());
+  }
+};
+
+struct Config {
+  std::string indexType;
+  int d;
+  int M;
+  int float16;
+  int nprobe;
+  int nq;
+  int k;
+};
+
+/// output of the JSON records
+struct Reporter {
+  FILE* f;
+  std::string common;  // fields of all records
+
+  void record(const Config& c, const std::string& fields) {
+    fprintf(f, "{%s, \"index\": \"%s\", \"d\": %d, \"M\": %d, "
+            "\"float16\": %d, \"nprobe\": %d, \"nq\": %d, \"k\": %d, %s}\n",
+            common.c_str(), c.indexType.c_str(), c.d, c.M, c.float16,
+            c.nprobe, c.nq, c.k, fields.c_str());
+    fflush(f);
+  }
+
+  void error(const Config& c, const char* what) {
+    std::string msg;
+    // the messages may contain quotes or newlines
+    for (const char* p = what; *p; p++) {
+      if (*p == '"' || *p == '\\') {
+        msg += '\\';
+        msg += *p;
+      } else if (*p == '\n') {
+        msg += "\\n";
+      } else {
+        msg += *p;
+      }
+    }
+    record(c, "\"error\": \"" + msg + "\"");
+  }
+};
+
+std::string fmt(const char* f, ...) __attribute__((format(printf, 1, 2)));
+
+std::string fmt(const char* f, ...) {
+  char buf[1024];
+  va_list args;
+  va_start(args, f);
+  vsnprintf(buf, sizeof(buf), f, args);
+  va_end(args);
+  return buf;
+}
+
+/// empty trained CPU index
+std::unique_ptr<faiss::Index> makeCpuIndex(const Options& opt,
+                                           const Dataset& ds,
+                                           const std::string& type,
+                                           int M) {
+  std::unique_ptr<faiss::Index> index;
+  if (type == "flat") {
+    index.reset(new faiss::IndexFlatL2(ds.d));
+  } else {
+    auto quantizer = new faiss::IndexFlatL2(ds.d);
+    faiss::IndexIVF* ivf;
+    if (type == "ivfflat") {
+      ivf = new faiss::IndexIVFFlat(quantizer, ds.d, opt.ncentroids);
+    } else {
+      ivf = new faiss::IndexIVFPQ(quantizer, ds.d, opt.ncentroids, M, 8);
+    }
+    ivf->own_fields = true;
+    index.reset(ivf);
+    index->train(opt.nt, ds.xt.data());
+  }
+  return index;
+}
+
+void runIndex(const Options& opt, const Dataset& ds,
+              const std::string& type, int M,
+              faiss::gpu::StandardGpuResources& res, Reporter& rep) {
+  bool isIVF = type != "flat";
+  std::vector<int> nprobes = isIVF ? opt.nprobes : std::vector<int>{0};
+  int nqmax = *std::max_element(opt.nqs.begin(), opt.nqs.end());
+  int kmax = ds.kmax;
+  Config c{type, ds.d, type == "ivfpq" ? M : 0, 0, 0, 0, 0};
+
+  std::unique_ptr<faiss::Index> cpuIndex;
+  try {
+    cpuIndex = makeCpuIndex(opt, ds, type, M);
+  } catch (const faiss::FaissException& e) {
+    rep.error(c, e.what());
+    return;
+  }
+  std::unique_ptr<faiss::Index> emptyIndex(faiss::clone_index(cpuIndex.get()));
+  cpuIndex->add(opt.nb, ds.xb.data());
+
+  // CPU baseline results for each nprobe, with nqmax queries and kmax
+  // results (the smaller nq and k use a prefix)
+  faiss::ParameterSpace ps;
+  std::map<int, std::vector<idx_t>> cpuI;
+  std::map<int, double> cpuQps;
+  for (int nprobe : nprobes) {
+    if (isIVF) {
+      ps.set_index_parameter(cpuIndex.get(), "nprobe", nprobe);
+    }
+    std::vector<float> D((size_t) nqmax * kmax);
+    std::vector<idx_t> I((size_t) nqmax * kmax);
+    auto t0 = Clock::now();
+    cpuIndex->search(nqmax, ds.xq.data(), kmax, D.data(), I.data());
+    double s = std::chrono::duration<double>(Clock::now() - t0).count();
+    cpuI[nprobe] = std::move(I);
+    cpuQps[nprobe] = nqmax / s;
+  }
+
+  for (int float16 : opt.float16s) {
+    c.float16 = float16;
+    c.nprobe = c.nq = c.k = 0;
+
+    faiss::gpu::GpuClonerOptions co;
+    co.useFloat16 = float16;
+    std::unique_ptr<faiss::Index> gpuIndex;
+    double addMs;
+    try {
+      gpuIndex.reset(faiss::gpu::index_cpu_to_gpu(
+                       &res, opt.device, emptyIndex.get(), &co));
+      auto t0 = Clock::now();
+      gpuIndex->add(opt.nb, ds.xb.data());
+      faiss::gpu::synchronizeAllDevices();
+      addMs = std::chrono::duration<double, std::milli>(
+        Clock::now() - t0).count();
+    } catch (const faiss::FaissException& e) {
+      rep.error(c, e.what());
+      continue;
+    }
+
+    faiss::gpu::GpuParameterSpace gps;
+    for (int nprobe : nprobes) {
+      c.nprobe = nprobe;
+      for (int nq : opt.nqs) {
+        c.nq = nq;
+        for (int k : opt.ks) {
+          c.k = k;
+          try {
+            if (isIVF) {
+              gps.set_index_parameter(gpuIndex.get(), "nprobe", nprobe);
+            }
+            std::vector<float> D((size_t) nq * k);
+            std::vector<idx_t> I((size_t) nq * k);
+
+            // warmup, then the timed searches
+            gpuIndex->search(nq, ds.xq.data(), k, D.data(), I.data());
+            std::vector<double> times;
+            for (int r = 0; r < opt.reps; r++) {
+              auto t0 = Clock::now();
+              gpuIndex->search(nq, ds.xq.data(), k, D.data(), I.data());
+              times.push_back(std::chrono::duration<double, std::milli>(
+                                Clock::now() - t0).count());
+            }
+            double mean = 0;
+            for (double t : times) {
+              mean += t;
+            }
+            mean /= times.size();
+            std::sort(times.begin(), times.end());
+
+            // the instrumented search (it synchronizes on the stages, so
+            // it is not part of the timings)
+            faiss::instrumentation_reset();
+            faiss::instrumentation_enabled = true;
+            gpuIndex->search(nq, ds.xq.data(), k, D.data(), I.data());
+            faiss::instrumentation_enabled = false;
+            faiss::InstrumentationStats st;
+            faiss::instrumentation_get(&st);
+
+            std::string stages;
+            for (int s = 0; s < faiss::STAGE_N; s++) {
+              if (st.stage_calls[s] == 0) {
+                continue;
+              }
+              stages += fmt("%s\"%s\": %.4f", stages.empty() ? "" : ", ",
+                            faiss::InstrumentationStats::stage_name(s),
+                            st.stage_ms[s]);
+            }
+
+            double recall = overlap(I, k, ds.gt, kmax, nq, k);
+            double cpuAgreement = overlap(I, k, cpuI[nprobe], kmax, nq, k);
+
+            rep.record(c, fmt(
+              "\"add_ms\": %.3f, \"qps\": %.1f, \"mean_ms\": %.4f, "
+              "\"p50_ms\": %.4f, \"p90_ms\": %.4f, \"p99_ms\": %.4f, "
+              "\"max_ms\": %.4f, \"recall\": %.4f, "
+              "\"cpu_agreement\": %.4f, \"cpu_qps\": %.1f, "
+              "\"temp_mem_peak\": %zd, \"stage_ms\": {%s}",
+              addMs, nq / mean * 1000, mean,
+              percentile(times, 0.5), percentile(times, 0.9),
+              percentile(times, 0.99), times.back(),
+              recall, cpuAgreement, cpuQps[nprobe],
+              (size_t) st.peaks[faiss::PEAK_GPU_TEMP_MEM],
+              stages.c_str()));
+          } catch (const faiss::FaissException& e) {
+            faiss::instrumentation_enabled = false;
+            rep.error(c, e.what());
+          }
+        }
+      }
+    }
+  }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  if (!parseArgs(argc, argv, opt)) {
+    usage();
+    return 1;
+  }
+
+  FILE* f = stdout;
+  if (opt.out) {
+    f = fopen(opt.out, "w");
+    if (!f) {
+      fprintf(stderr, "could not open %s\n", opt.out);
+      return 1;
+    }
+  }
+
+  faiss::gpu::StandardGpuResources res;
+  if (opt.tempMem >= 0) {
+    res.setTempMemory(opt.tempMem);
+  }
+
+  // environment fields, repeated in all records
+  const cudaDeviceProp& prop = faiss::gpu::getDeviceProperties(opt.device);
+  int runtimeVersion = 0, driverVersion = 0;
+  cudaRuntimeGetVersion(&runtimeVersion);
+  cudaDriverGetVersion(&driverVersion);
+  Reporter rep;
+  rep.f = f;
+  rep.common = fmt(
+    "\"gpu\": \"%s\", \"sm\": %d%d, \"cuda_runtime\": %d, "
+    "\"cuda_driver\": %d, \"nb\": %zd, \"ncentroids\": %d, \"reps\": %d",
+    prop.name, prop.major, prop.minor, runtimeVersion, driverVersion,
+    opt.nb, opt.ncentroids, opt.reps);
+
+  int nqmax = *std::max_element(opt.nqs.begin(), opt.nqs.end());
+  int kmax = *std::max_element(opt.ks.begin(), opt.ks.end());
+
+  for (int d : opt.dims) {
+    fprintf(stderr, "d=%d: generating data and ground truth\n", d);
+    Dataset ds(opt, d, nqmax, kmax);
+    for (auto& type : opt.indexTypes) {
+      std::vector<int> Ms = type == "ivfpq" ? opt.Ms : std::vector<int>{0};
+      for (int M : Ms) {
+        fprintf(stderr, "d=%d: %s M=%d\n", d, type.c_str(), M);
+        runIndex(opt, ds, type, M, res, rep);
+      }
+    }
+  }
+
+  if (f != stdout) {
+    fclose(f);
+  }
+  return 0;
+}
@@ -0,0 +1,105 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#include <faiss/Clustering.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/gpu/GpuClustering.h>
+#include <faiss/gpu/StandardGpuResources.h>
+#include <faiss/gpu/utils/DeviceUtils.h>
+#include <faiss/gpu/test/TestUtils.h>
+#include <cmath>
+#include <gtest/gtest.h>
+#include <vector>
+
+void testGpuClustering(int numShards, bool streamed, bool weighted) {
+  int dim = faiss::gpu::randVal(16, 100);
+  int numCentroids = faiss::gpu::randVal(50, 200);
+  int numTrain = numCentroids * 40;
+
+  std::vector<float> trainVecs = faiss::gpu::randVecs(numTrain, dim);
+  std::vector<float> weights;
+  if (weighted) {
+    weights = faiss::gpu::randVecs(numTrain, 1);
+    for (auto& w : weights) {
+      w = 0.5f + std::abs(w);
+    }
+  }
+
+  faiss::ClusteringParameters cp;
+  cp.niter = 10;
+
+  // The same initial centroids, so that both should converge to about the
+  // same objective
+  faiss::Clustering cpuClus(dim, numCentroids, cp);
+  faiss::IndexFlatL2 cpuIndex(dim);
+  cpuClus.train(numTrain, trainVecs.data(), cpuIndex,
+                weighted ? weights.data() : nullptr);
+
+  // Several shards can share a device
+  std::vector<faiss::gpu::StandardGpuResources> res(numShards);
+  std::vector<faiss::gpu::GpuResourcesProvider*> providers;
+  std::vector<int> devices;
+
+  for (int i = 0; i < numShards; ++i) {
+    res[i].noTempMemory();
+    providers.push_back(&res[i]);
+    devices.push_back(i % faiss::gpu::getNumDevices());
+  }
+
+  faiss::gpu::GpuClustering gpuClus(dim, numCentroids, cp,
+                                    providers, devices);
+  if (streamed) {
+    gpuClus.maxResidentBytes = 1;
+    gpuClus.chunkSize = 1000;
+  }
+
+  faiss::IndexFlatL2 gpuOutIndex(dim);
+  gpuClus.train(numTrain, trainVecs.data(), gpuOutIndex,
+                weighted ? weights.data() : nullptr);
+
+  EXPECT_EQ(gpuOutIndex.ntotal, numCentroids);
+  EXPECT_EQ(gpuClus.centroids.size(), (size_t) numCentroids * dim);
+  EXPECT_EQ(gpuClus.iteration_stats.size(), (size_t) cp.niter);
+
+  float cpuObj = cpuClus.iteration_stats.back().obj;
+  float gpuObj = gpuClus.iteration_stats.back().obj;
+
+  EXPECT_NEAR(cpuObj, gpuObj, cpuObj * 0.01f);
+
+  // The objective should not increase over the iterations
+  EXPECT_LE(gpuObj, gpuClus.iteration_stats.front().obj);
+}
+
+TEST(TestGpuClustering, Resident) {
+  testGpuClustering(1, false, false);
+}
+
+TEST(TestGpuClustering, Streamed) {
+  testGpuClustering(1, true, false);
+}
+
+TEST(TestGpuClustering, Weighted) {
+  testGpuClustering(1, false, true);
+}
+
+TEST(TestGpuClustering, MultiShard) {
+  testGpuClustering(3, false, false);
+}
+
+TEST(TestGpuClustering, MultiShardStreamed) {
+  testGpuClustering(2, true, true);
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+
+  // just run with a fixed test seed
+  faiss::gpu::setTestSeed(100);
+
+  return RUN_ALL_TESTS();
+}
@@ -14,13 +14,17 @@
 #include <faiss/gpu/utils/Transpose.cuh>
 #include <faiss/gpu/test/TestUtils.h>
 #include <gtest/gtest.h>
+#include <memory>
 #include <sstream>
 #include <vector>
 
 void testTransposition(bool colMajorVecs,
                        bool colMajorQueries,
                        faiss::MetricType metric,
-                       float metricArg = 0) {
+                       float metricArg = 0,
+                       int numQueryOverride = -1,
+                       int kOverride = -1,
+                       int dimOverride = -1) {
   using namespace faiss::gpu;
 
   int device = randVal(0, getNumDevices() - 1);
@@ -28,10 +32,10 @@ void testTransposition(bool colMajorVecs,
   StandardGpuResources res;
   res.noTempMemory();
 
-  int dim = randVal(20, 150);
+  int dim = dimOverride > 0 ? dimOverride : randVal(20, 150);
   int numVecs = randVal(10, 30000);
-  int numQuery = randVal(1, 1024);
-  int k = std::min(numVecs, randVal(20, 70));
+  int numQuery = numQueryOverride > 0 ? numQueryOverride : randVal(1, 1024);
+  int k = std::min(numVecs, kOverride > 0 ? kOverride : randVal(20, 70));
 
   // Input data for CPU
   std::vector<float> vecs = randVecs(numVecs, dim);
@@ -126,6 +130,20 @@ TEST(TestGpuDistance, Transposition_RR) {
   testTransposition(false, false, faiss::MetricType::METRIC_INNER_PRODUCT);
 }
 
+// Small k and dimension with row-major data use the fused distance +
+// k-selection kernel; small query batches split the vectors across blocks
+TEST(TestGpuDistance, FusedSelect) {
+  for (auto metric : {faiss::MetricType::METRIC_L2,
+                      faiss::MetricType::METRIC_INNER_PRODUCT}) {
+    for (int numQuery : {1, 7, 500}) {
+      for (int k : {1, 20, 64}) {
+        testTransposition(false, false, metric, 0, numQuery, k,
+                          faiss::gpu::randVal(1, 128));
+      }
+    }
+  }
+}
+
 TEST(TestGpuDistance, Transposition_RC) {
   testTransposition(false, true, faiss::MetricType::METRIC_L2);
 }
@@ -176,6 +194,78 @@ TEST(TestGpuDistance, JensenShannon) {
   testTransposition(false, false, faiss::MetricType::METRIC_JensenShannon);
 }
 
+void testStreaming(faiss::MetricType metric, int numDevices, int tileSize) {
+  using namespace faiss::gpu;
+
+  int dim = randVal(20, 100);
+  int numVecs = randVal(5000, 30000);
+  int numQuery = randVal(1, 500);
+  int k = randVal(1, 100);
+
+  std::vector<float> vecs = randVecs(numVecs, dim);
+  std::vector<float> queries = randVecs(numQuery, dim);
+
+  faiss::IndexFlat cpuIndex(dim, metric);
+  cpuIndex.add(numVecs, vecs.data());
+
+  std::vector<float> cpuDistance(numQuery * k, 0);
+  std::vector<faiss::Index::idx_t> cpuIndices(numQuery * k, -1);
+
+  cpuIndex.search(numQuery, queries.data(), k,
+                  cpuDistance.data(), cpuIndices.data());
+
+  // several shards may run on the same device
+  int device = randVal(0, getNumDevices() - 1);
+  std::vector<std::unique_ptr<StandardGpuResources>> res;
+  std::vector<GpuResourcesProvider*> providers;
+  std::vector<int> devices;
+  for (int i = 0; i < numDevices; ++i) {
+    res.emplace_back(new StandardGpuResources);
+    providers.push_back(res.back().get());
+    devices.push_back((device + i) % getNumDevices());
+  }
+
+  std::vector<float> gpuDistance(numQuery * k, 0);
+  std::vector<faiss::Index::idx_t> gpuIndices(numQuery * k, -1);
+
+  GpuDistanceParams args;
+  args.metric = metric;
+  args.k = k;
+  args.dims = dim;
+  args.vectors = vecs.data();
+  args.numVectors = numVecs;
+  args.queries = queries.data();
+  args.numQueries = numQuery;
+  args.outDistances = gpuDistance.data();
+  args.outIndices = gpuIndices.data();
+
+  bfKnnStreaming(providers, devices, args, tileSize);
+
+  std::stringstream str;
+  str << "streaming metric " << metric
+      << " numDevices " << numDevices
+      << " tileSize " << tileSize;
+
+  compareLists(cpuDistance.data(),
+               cpuIndices.data(),
+               gpuDistance.data(),
+               gpuIndices.data(),
+               numQuery, k,
+               str.str(),
+               false, false, true,
+               6e-3f, 0.1f, 0.015f);
+}
+
+// Database streamed from the host by tiles that do not divide it
+TEST(TestGpuDistance, Streaming) {
+  for (auto metric : {faiss::MetricType::METRIC_L2,
+                      faiss::MetricType::METRIC_INNER_PRODUCT}) {
+    testStreaming(metric, 1, 1000);
+    testStreaming(metric, 2, 999);
+    testStreaming(metric, 1, 0);
+  }
+}
+
 int main(int argc, char** argv) {
   testing::InitGoogleTest(&argc, argv);
 
@@ -0,0 +1,113 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#include <faiss/IndexBinaryFlat.h>
+#include <faiss/IndexBinaryIVF.h>
+#include <faiss/gpu/GpuIndexBinaryIVF.h>
+#include <faiss/gpu/StandardGpuResources.h>
+#include <faiss/gpu/utils/DeviceUtils.h>
+#include <faiss/gpu/test/TestUtils.h>
+#include <gtest/gtest.h>
+#include <vector>
+
+void testGpuIndexBinaryIVF(int dims, int nlist, int nprobe) {
+  faiss::gpu::StandardGpuResources res;
+
+  faiss::gpu::GpuIndexBinaryIVFConfig config;
+  config.device = faiss::gpu::randVal(0, faiss::gpu::getNumDevices() - 1);
+
+  int numTrain = nlist * 40;
+  int numVecs = faiss::gpu::randVal(nlist * 50, 20000);
+  int numQuery = faiss::gpu::randVal(1, 500);
+  int k = faiss::gpu::randVal(1, 100);
+
+  auto trainVecs = faiss::gpu::randBinaryVecs(numTrain, dims);
+  auto data = faiss::gpu::randBinaryVecs(numVecs, dims);
+  auto query = faiss::gpu::randBinaryVecs(numQuery, dims);
+
+  faiss::IndexBinaryFlat cpuQuantizer(dims);
+  faiss::IndexBinaryIVF cpuIndex(&cpuQuantizer, dims, nlist);
+  cpuIndex.train(numTrain, trainVecs.data());
+  cpuIndex.add(numVecs, data.data());
+  cpuIndex.nprobe = nprobe;
+
+  faiss::gpu::GpuIndexBinaryIVF gpuIndex(&res, &cpuIndex, config);
+  EXPECT_EQ(cpuIndex.ntotal, gpuIndex.ntotal);
+  EXPECT_EQ(nprobe, gpuIndex.getNumProbes());
+
+  std::vector<int> cpuDist(numQuery * k);
+  std::vector<faiss::IndexBinary::idx_t> cpuLabels(numQuery * k);
+  cpuIndex.search(numQuery, query.data(), k,
+                  cpuDist.data(), cpuLabels.data());
+
+  std::vector<int> gpuDist(numQuery * k);
+  std::vector<faiss::IndexBinary::idx_t> gpuLabels(numQuery * k);
+  gpuIndex.search(numQuery, query.data(), k,
+                  gpuDist.data(), gpuLabels.data());
+
+  // Hamming distances are exact, but the coarse step may break ties between
+  // equidistant centroids differently, so only compare when all lists are
+  // probed
+  if (nprobe == nlist) {
+    EXPECT_EQ(cpuDist, gpuDist);
+  }
+
+  // Copying back to the CPU gives the same inverted lists
+  faiss::IndexBinaryIVF cpuCopy;
+  gpuIndex.copyTo(&cpuCopy);
+  EXPECT_EQ(cpuIndex.ntotal, cpuCopy.ntotal);
+  for (int i = 0; i < nlist; ++i) {
+    EXPECT_EQ(cpuIndex.invlists->list_size(i),
+              cpuCopy.invlists->list_size(i));
+  }
+}
+
+TEST(TestGpuIndexBinaryIVF, Exhaustive) {
+  for (int tries = 0; tries < 3; ++tries) {
+    testGpuIndexBinaryIVF(faiss::gpu::randVal(1, 8) * 32, 32, 32);
+  }
+}
+
+TEST(TestGpuIndexBinaryIVF, Dim8) {
+  testGpuIndexBinaryIVF(faiss::gpu::randVal(1, 8) * 8, 32, 32);
+}
+
+TEST(TestGpuIndexBinaryIVF, Probes) {
+  testGpuIndexBinaryIVF(64, 64, 8);
+}
+
+TEST(TestGpuIndexBinaryIVF, TrainAdd) {
+  faiss::gpu::StandardGpuResources res;
+  int dims = 128, nlist = 16, numVecs = 5000, numQuery = 100, k = 10;
+
+  faiss::gpu::GpuIndexBinaryIVF gpuIndex(&res, dims, nlist);
+  auto data = faiss::gpu::randBinaryVecs(numVecs, dims);
+  gpuIndex.train(numVecs, data.data());
+  EXPECT_TRUE(gpuIndex.is_trained);
+  EXPECT_EQ(nlist, gpuIndex.getQuantizer()->ntotal);
+
+  gpuIndex.add(numVecs, data.data());
+  gpuIndex.setNumProbes(nlist);
+
+  // each database vector finds itself at distance 0
+  std::vector<int> dist(numQuery * k);
+  std::vector<faiss::IndexBinary::idx_t> labels(numQuery * k);
+  gpuIndex.search(numQuery, data.data(), k, dist.data(), labels.data());
+  for (int i = 0; i < numQuery; ++i) {
+    EXPECT_EQ(0, dist[i * k]);
+  }
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+
+  // just run with a fixed test seed
+  faiss::gpu::setTestSeed(100);
+
+  return RUN_ALL_TESTS();
+}
@@ -7,11 +7,14 @@
 
 
 #include <faiss/IndexFlat.h>
+#include <faiss/MetaIndexes.h>
+#include <faiss/impl/AuxIndexStructures.h>
 #include <faiss/gpu/GpuIndexFlat.h>
 #include <faiss/gpu/StandardGpuResources.h>
 #include <faiss/gpu/utils/DeviceUtils.h>
 #include <faiss/gpu/test/TestUtils.h>
 #include <gtest/gtest.h>
+#include <algorithm>
 #include <sstream>
 #include <vector>
 
@@ -229,6 +232,27 @@ TEST(TestGpuIndexFlat, L2_Tiling) {
   }
 }
 
+// test the radix-based selection beyond the BlockSelect limit, with and
+// without tiling along the vector set
+TEST(TestGpuIndexFlat, LargeK) {
+  for (auto metric : {faiss::MetricType::METRIC_L2,
+                      faiss::MetricType::METRIC_INNER_PRODUCT}) {
+    for (int numVecs : {20000, 1000000}) {
+      TestFlatOptions opt;
+      opt.metric = metric;
+      opt.useFloat16 = false;
+      opt.useTransposed = false;
+      opt.numVecsOverride = numVecs;
+
+      opt.numQueriesOverride = 4;
+      opt.dimOverride = 32;
+      opt.kOverride = faiss::gpu::getMaxKSelection() + 1000;
+
+      testFlat(opt);
+    }
+  }
+}
+
 TEST(TestGpuIndexFlat, QueryEmpty) {
   faiss::gpu::StandardGpuResources res;
   res.noTempMemory();
@@ -341,6 +365,81 @@ TEST(TestGpuIndexFlat, CopyTo) {
   EXPECT_EQ(gpuVals, cpuVals);
 }
 
+TEST(TestGpuIndexFlat, ReconstructBatch) {
+  faiss::gpu::StandardGpuResources res;
+  res.noTempMemory();
+
+  int numVecs = faiss::gpu::randVal(100, 200);
+  int dim = faiss::gpu::randVal(1, 1000);
+
+  int device = faiss::gpu::randVal(0, faiss::gpu::getNumDevices() - 1);
+
+  for (bool useFloat16 : {false, true}) {
+    faiss::gpu::GpuIndexFlatConfig config;
+    config.device = device;
+    config.useFloat16 = useFloat16;
+
+    faiss::gpu::GpuIndexFlatL2 gpuIndex(&res, dim, config);
+
+    std::vector<float> vecs = faiss::gpu::randVecs(numVecs, dim);
+    gpuIndex.add(numVecs, vecs.data());
+
+    // arbitrary ids, with repetitions
+    int n = 50;
+    std::vector<faiss::Index::idx_t> keys(n);
+    for (int i = 0; i < n; ++i) {
+      keys[i] = faiss::gpu::randVal(0, numVecs - 1);
+    }
+
+    std::vector<float> gpuVals(n * dim);
+    gpuIndex.reconstruct_batch(n, keys.data(), gpuVals.data());
+
+    std::vector<float> refVals(dim);
+    for (int i = 0; i < n; ++i) {
+      gpuIndex.reconstruct(keys[i], refVals.data());
+      EXPECT_EQ(std::vector<float>(gpuVals.begin() + i * dim,
+                                   gpuVals.begin() + (i + 1) * dim),
+                refVals);
+    }
+
+    keys[0] = numVecs;
+    EXPECT_THROW(gpuIndex.reconstruct_batch(n, keys.data(), gpuVals.data()),
+                 faiss::FaissException);
+  }
+}
+
+TEST(TestGpuIndexFlat, MemoryUsage) {
+  faiss::gpu::StandardGpuResources res;
+  res.noTempMemory();
+
+  int numVecs = faiss::gpu::randVal(100, 200);
+  int dim = faiss::gpu::randVal(1, 1000);
+
+  for (bool useFloat16 : {false, true}) {
+    faiss::gpu::GpuIndexFlatConfig config;
+    config.device = faiss::gpu::randVal(0, faiss::gpu::getNumDevices() - 1);
+    config.useFloat16 = useFloat16;
+
+    faiss::gpu::GpuIndexFlatL2 gpuIndex(&res, dim, config);
+
+    std::vector<float> vecs = faiss::gpu::randVecs(numVecs, dim);
+    gpuIndex.add(numVecs, vecs.data());
+
+    faiss::MemoryUsage mu = gpuIndex.memory_usage();
+    const faiss::MemoryUsage* stored = mu.find("storage/vectors");
+    ASSERT_TRUE(stored);
+
+    size_t bytes = (size_t) numVecs * dim * (useFloat16 ? 2 : 4);
+    EXPECT_EQ(stored->size, bytes);
+    EXPECT_GE(stored->device, bytes);
+    EXPECT_GE(mu.total_device(), bytes);
+    EXPECT_EQ(mu.total_capacity(), 0);
+
+    gpuIndex.reset();
+    EXPECT_EQ(gpuIndex.memory_usage().total_device(), 0);
+  }
+}
+
 TEST(TestGpuIndexFlat, UnifiedMemory) {
   // Construct on a random device to test multi-device, if we have
   // multiple devices
@@ -383,6 +482,260 @@ TEST(TestGpuIndexFlat, UnifiedMemory) {
                              0.015f);
 }
 
+TEST(TestGpuIndexFlat, PipelinedSearch) {
+  int device = faiss::gpu::randVal(0, faiss::gpu::getNumDevices() - 1);
+
+  int dim = 64;
+  int numVecs = 5000;
+  int numQuery = 3000;
+  int k = 10;
+
+  faiss::IndexFlatL2 cpuIndexL2(dim);
+
+  // A small pinned buffer splits the queries into many tiles
+  faiss::gpu::StandardGpuResources res;
+  res.setPinnedMemory((size_t) 64 * 1024);
+
+  faiss::gpu::GpuIndexFlatConfig config;
+  config.device = device;
+
+  faiss::gpu::GpuIndexFlatL2 gpuIndexL2(&res, dim, config);
+
+  std::vector<float> vecs = faiss::gpu::randVecs(numVecs, dim);
+  cpuIndexL2.add(numVecs, vecs.data());
+  gpuIndexL2.add(numVecs, vecs.data());
+
+  faiss::gpu::compareIndices(cpuIndexL2, gpuIndexL2,
+                             numQuery, dim, k, "Pipelined",
+                             kF32MaxRelErr,
+                             0.1f,
+                             0.015f);
+}
+
+TEST(TestGpuIndexFlat, TensorCoreMath) {
+  int device = faiss::gpu::randVal(0, faiss::gpu::getNumDevices() - 1);
+
+  int dim = 128;
+  int numVecs = 5000;
+  int numQuery = 100;
+  int k = 10;
+
+  faiss::IndexFlatL2 cpuIndexL2(dim);
+
+  faiss::gpu::StandardGpuResources res;
+  res.setTensorCoreMath(true);
+
+  faiss::gpu::GpuIndexFlatConfig config;
+  config.device = device;
+
+  faiss::gpu::GpuIndexFlatL2 gpuIndexL2(&res, dim, config);
+
+  std::vector<float> vecs = faiss::gpu::randVecs(numVecs, dim);
+  cpuIndexL2.add(numVecs, vecs.data());
+  gpuIndexL2.add(numVecs, vecs.data());
+
+  // The f32 inputs are rounded to TF32 or f16
+  faiss::gpu::compareIndices(cpuIndexL2, gpuIndexL2,
+                             numQuery, dim, k, "TensorCoreMath",
+                             kF16MaxRelErr,
+                             0.3f,
+                             0.015f);
+
+  // The cuBLAS handles exist now
+  EXPECT_THROW(res.setTensorCoreMath(false), faiss::FaissException);
+}
+
+void testRangeSearch(faiss::MetricType metric, bool useFloat16) {
+  int device = faiss::gpu::randVal(0, faiss::gpu::getNumDevices() - 1);
+
+  int dim = faiss::gpu::randVal(8, 128);
+  int numVecs = faiss::gpu::randVal(1000, 20000);
+  int numQuery = faiss::gpu::randVal(1, 300);
+
+  faiss::IndexFlat cpuIndex(dim, metric);
+
+  faiss::gpu::StandardGpuResources res;
+  res.noTempMemory();
+
+  faiss::gpu::GpuIndexFlatConfig config;
+  config.device = device;
+  config.useFloat16 = useFloat16;
+
+  faiss::gpu::GpuIndexFlat gpuIndex(&res, dim, metric, config);
+
+  std::vector<float> vecs = faiss::gpu::randVecs(numVecs, dim);
+  cpuIndex.add(numVecs, vecs.data());
+  gpuIndex.add(numVecs, vecs.data());
+
+  std::vector<float> queries = faiss::gpu::randVecs(numQuery, dim);
+
+  // Radius around the distance of the 20th neighbor of the first query
+  int k = 20;
+  std::vector<float> dist(k);
+  std::vector<faiss::Index::idx_t> ind(k);
+  cpuIndex.search(1, queries.data(), k, dist.data(), ind.data());
+  float radius = dist[k - 1];
+
+  faiss::RangeSearchResult cpuRes(numQuery);
+  faiss::RangeSearchResult gpuRes(numQuery);
+  cpuIndex.range_search(numQuery, queries.data(), radius, &cpuRes);
+  gpuIndex.range_search(numQuery, queries.data(), radius, &gpuRes);
+
+  faiss::gpu::compareRangeSearch(cpuRes, gpuRes, numQuery, radius,
+                                 metric == faiss::METRIC_L2,
+                                 useFloat16 ? kF16MaxRelErr : kF32MaxRelErr);
+
+  // The results are in id order
+  for (int q = 0; q < numQuery; ++q) {
+    for (size_t i = gpuRes.lims[q] + 1; i < gpuRes.lims[q + 1]; ++i) {
+      EXPECT_LT(gpuRes.labels[i - 1], gpuRes.labels[i]);
+    }
+  }
+}
+
+TEST(TestGpuIndexFlat, L2_RangeSearch) {
+  testRangeSearch(faiss::METRIC_L2, false);
+}
+
+TEST(TestGpuIndexFlat, IP_RangeSearch) {
+  testRangeSearch(faiss::METRIC_INNER_PRODUCT, false);
+}
+
+TEST(TestGpuIndexFlat, L2_RangeSearch_Float16) {
+  testRangeSearch(faiss::METRIC_L2, true);
+}
+
+TEST(TestGpuIndexFlat, RangeSearchMaxResults) {
+  int device = faiss::gpu::randVal(0, faiss::gpu::getNumDevices() - 1);
+
+  int dim = 32;
+  int numVecs = 5000;
+  int numQuery = 100;
+  int maxResults = 10;
+
+  faiss::gpu::StandardGpuResources res;
+
+  faiss::gpu::GpuIndexFlatConfig config;
+  config.device = device;
+
+  faiss::gpu::GpuIndexFlatL2 gpuIndex(&res, dim, config);
+
+  std::vector<float> vecs = faiss::gpu::randVecs(numVecs, dim);
+  gpuIndex.add(numVecs, vecs.data());
+
+  std::vector<float> queries = faiss::gpu::randVecs(numQuery, dim);
+
+  std::vector<float> dist(numQuery * maxResults);
+  std::vector<faiss::Index::idx_t> ind(numQuery * maxResults);
+  gpuIndex.search(numQuery, queries.data(), maxResults,
+                  dist.data(), ind.data());
+
+  // Half of the queries have more than maxResults results
+  std::vector<float> lastDist(numQuery);
+  for (int q = 0; q < numQuery; ++q) {
+    lastDist[q] = dist[q * maxResults + maxResults - 1];
+  }
+  std::nth_element(lastDist.begin(), lastDist.begin() + numQuery / 2,
+                   lastDist.end());
+  float radius = lastDist[numQuery / 2];
+
+  faiss::RangeSearchResult fullRes(numQuery);
+  gpuIndex.range_search(numQuery, queries.data(), radius, &fullRes);
+
+  gpuIndex.setMaxRangeResults(maxResults);
+  EXPECT_EQ(gpuIndex.getMaxRangeResults(), maxResults);
+
+  faiss::RangeSearchResult gpuRes(numQuery);
+  gpuIndex.range_search(numQuery, queries.data(), radius, &gpuRes);
+
+  int numTruncated = 0;
+
+  for (int q = 0; q < numQuery; ++q) {
+    size_t fullNum = fullRes.lims[q + 1] - fullRes.lims[q];
+    size_t num = gpuRes.lims[q + 1] - gpuRes.lims[q];
+
+    if (fullNum <= (size_t) maxResults) {
+      // Unchanged
+      ASSERT_EQ(num, fullNum);
+      for (size_t i = 0; i < num; ++i) {
+        EXPECT_EQ(gpuRes.labels[gpuRes.lims[q] + i],
+                  fullRes.labels[fullRes.lims[q] + i]);
+      }
+    } else {
+      // The maxResults nearest neighbors
+      ++numTruncated;
+      ASSERT_EQ(num, (size_t) maxResults);
+      for (size_t i = 0; i < num; ++i) {
+        EXPECT_EQ(gpuRes.labels[gpuRes.lims[q] + i],
+                  ind[q * maxResults + i]);
+        EXPECT_LE(gpuRes.distances[gpuRes.lims[q] + i], radius);
+      }
+    }
+  }
+
+  EXPECT_GT(numTruncated, 0);
+}
+
+TEST(TestGpuIndexFlat, RemoveIds) {
+  int device = faiss::gpu::randVal(0, faiss::gpu::getNumDevices() - 1);
+  int dim = faiss::gpu::randVal(10, 100);
+  int numVecs = faiss::gpu::randVal(1000, 3000);
+  int numQuery = 50;
+  int k = 10;
+
+  std::vector<float> vecs = faiss::gpu::randVecs(numVecs, dim);
+
+  faiss::IndexFlatL2 cpuIndex(dim);
+  cpuIndex.add(numVecs, vecs.data());
+
+  faiss::gpu::StandardGpuResources res;
+  res.noTempMemory();
+
+  faiss::gpu::GpuIndexFlatConfig config;
+  config.device = device;
+  config.storeTransposed = faiss::gpu::randBool();
+
+  faiss::gpu::GpuIndexFlatL2 gpuIndex(&res, dim, config);
+  gpuIndex.copyFrom(&cpuIndex);
+
+  // The remaining vectors are renumbered in order, as on the CPU
+  faiss::IDSelectorRange sel(numVecs / 4, numVecs / 2);
+  size_t numRemoved = cpuIndex.remove_ids(sel);
+  EXPECT_EQ(gpuIndex.remove_ids(sel), numRemoved);
+  EXPECT_EQ(gpuIndex.ntotal, cpuIndex.ntotal);
+
+  std::vector<float> gpuVals(cpuIndex.ntotal * dim);
+  gpuIndex.reconstruct_n(0, cpuIndex.ntotal, gpuVals.data());
+  EXPECT_EQ(gpuVals, cpuIndex.xb);
+
+  faiss::gpu::compareIndices(cpuIndex, gpuIndex,
+                             numQuery, dim, k, "RemoveIds",
+                             0.03f, 0.1f, 0.015f);
+
+  // Through an IndexIDMap, the removal keeps the user ids
+  faiss::IndexFlatL2 cpuIndex2(dim);
+  faiss::IndexIDMap cpuIdMap(&cpuIndex2);
+  faiss::gpu::GpuIndexFlatL2 gpuIndex2(&res, dim, config);
+  faiss::IndexIDMap gpuIdMap(&gpuIndex2);
+
+  std::vector<faiss::Index::idx_t> ids(numVecs);
+  for (int i = 0; i < numVecs; ++i) {
+    ids[i] = 1000 + 3 * i;
+  }
+
+  cpuIdMap.add_with_ids(numVecs, vecs.data(), ids.data());
+  gpuIdMap.add_with_ids(numVecs, vecs.data(), ids.data());
+
+  faiss::IDSelectorRange idSel(1000 + numVecs, 1000 + 2 * numVecs);
+  numRemoved = cpuIdMap.remove_ids(idSel);
+  EXPECT_EQ(gpuIdMap.remove_ids(idSel), numRemoved);
+  EXPECT_EQ(gpuIdMap.id_map, cpuIdMap.id_map);
+
+  faiss::gpu::compareIndices(cpuIdMap, gpuIdMap,
+                             numQuery, dim, k, "RemoveIds IndexIDMap",
+                             0.03f, 0.1f, 0.015f);
+}
+
 int main(int argc, char** argv) {
   testing::InitGoogleTest(&argc, argv);
 
@@ -0,0 +1,123 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexHNSW.h>
+#include <faiss/IndexNSG.h>
+#include <faiss/gpu/GpuIndexGraph.h>
+#include <faiss/gpu/StandardGpuResources.h>
+#include <faiss/gpu/utils/DeviceUtils.h>
+#include <faiss/gpu/test/TestUtils.h>
+#include <gtest/gtest.h>
+#include <set>
+#include <vector>
+
+constexpr int kDim = 32;
+constexpr int kNumVecs = 5000;
+constexpr int kNumQuery = 200;
+constexpr int kK = 10;
+
+// fraction of the exact k nearest neighbors found by the index
+float recallAtK(faiss::Index& index,
+                faiss::MetricType metric,
+                const std::vector<float>& data,
+                const std::vector<float>& query) {
+  faiss::IndexFlat ref(kDim, metric);
+  ref.add(kNumVecs, data.data());
+
+  std::vector<float> refDist(kNumQuery * kK), dist(kNumQuery * kK);
+  std::vector<faiss::Index::idx_t> refLabels(kNumQuery * kK),
+    labels(kNumQuery * kK);
+  ref.search(kNumQuery, query.data(), kK, refDist.data(), refLabels.data());
+  index.search(kNumQuery, query.data(), kK, dist.data(), labels.data());
+
+  int found = 0;
+  for (int i = 0; i < kNumQuery; ++i) {
+    std::set<faiss::Index::idx_t> gt(refLabels.begin() + i * kK,
+                                     refLabels.begin() + (i + 1) * kK);
+    for (int j = 0; j < kK; ++j) {
+      found += gt.count(labels[i * kK + j]);
+    }
+
+    // results are sorted by increasing distance (decreasing for IP)
+    for (int j = 1; j < kK; ++j) {
+      if (metric == faiss::METRIC_L2) {
+        EXPECT_LE(dist[i * kK + j - 1], dist[i * kK + j]);
+      } else {
+        EXPECT_GE(dist[i * kK + j - 1], dist[i * kK + j]);
+      }
+    }
+  }
+
+  return (float) found / (kNumQuery * kK);
+}
+
+void testHNSW(faiss::MetricType metric) {
+  faiss::gpu::StandardGpuResources res;
+
+  auto data = faiss::gpu::randVecs(kNumVecs, kDim);
+  auto query = faiss::gpu::randVecs(kNumQuery, kDim);
+
+  faiss::IndexHNSWFlat cpuIndex(kDim, 16, metric);
+  cpuIndex.add(kNumVecs, data.data());
+
+  faiss::gpu::GpuIndexGraphConfig config;
+  config.device = faiss::gpu::randVal(0, faiss::gpu::getNumDevices() - 1);
+
+  faiss::gpu::GpuIndexGraph gpuIndex(&res, &cpuIndex, config);
+  EXPECT_EQ(cpuIndex.ntotal, gpuIndex.ntotal);
+  EXPECT_EQ(32, gpuIndex.getDegree());
+
+  gpuIndex.searchWidth = 128;
+  EXPECT_GT(recallAtK(gpuIndex, metric, data, query), 0.9);
+
+  // a wider beam does not lose recall
+  float recall = recallAtK(gpuIndex, metric, data, query);
+  gpuIndex.searchWidth = 256;
+  EXPECT_GE(recallAtK(gpuIndex, metric, data, query) + 0.01, recall);
+}
+
+TEST(TestGpuIndexGraph, HNSW_L2) {
+  testHNSW(faiss::METRIC_L2);
+}
+
+TEST(TestGpuIndexGraph, HNSW_IP) {
+  testHNSW(faiss::METRIC_INNER_PRODUCT);
+}
+
+TEST(TestGpuIndexGraph, NSG) {
+  faiss::gpu::StandardGpuResources res;
+
+  auto data = faiss::gpu::randVecs(kNumVecs, kDim);
+  auto query = faiss::gpu::randVecs(kNumQuery, kDim);
+
+  faiss::IndexNSGFlat cpuIndex(kDim, 32);
+  cpuIndex.add(kNumVecs, data.data());
+
+  faiss::gpu::GpuIndexGraph gpuIndex(&res, &cpuIndex);
+  gpuIndex.searchWidth = 128;
+  EXPECT_GT(recallAtK(gpuIndex, faiss::METRIC_L2, data, query), 0.9);
+
+  // a single query gives the same result as in a batch
+  std::vector<float> dist(kNumQuery * kK), dist1(kK);
+  std::vector<faiss::Index::idx_t> labels(kNumQuery * kK), labels1(kK);
+  gpuIndex.search(kNumQuery, query.data(), kK, dist.data(), labels.data());
+  gpuIndex.search(1, query.data(), kK, dist1.data(), labels1.data());
+  EXPECT_EQ(std::vector<faiss::Index::idx_t>(labels.begin(),
+                                             labels.begin() + kK),
+            labels1);
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+
+  // just run with a fixed test seed
+  faiss::gpu::setTestSeed(100);
+
+  return RUN_ALL_TESTS();
+}
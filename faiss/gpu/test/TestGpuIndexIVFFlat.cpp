@@ -8,11 +8,17 @@
 
 #include <faiss/IndexFlat.h>
 #include <faiss/IndexIVFFlat.h>
+#include <faiss/IndexReplicas.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/gpu/GpuCloner.h>
 #include <faiss/gpu/GpuIndexIVFFlat.h>
+#include <faiss/gpu/GpuIndexIVFListShards.h>
 #include <faiss/gpu/StandardGpuResources.h>
 #include <faiss/gpu/utils/DeviceUtils.h>
 #include <faiss/gpu/test/TestUtils.h>
 #include <cmath>
+#include <cstring>
+#include <memory>
 #include <gtest/gtest.h>
 #include <sstream>
 #include <vector>
@@ -71,10 +77,12 @@ struct Options {
 
 void queryTest(faiss::MetricType metricType,
                bool useFloat16CoarseQuantizer,
-               int dimOverride = -1) {
+               int dimOverride = -1,
+               int numQueryOverride = -1) {
   for (int tries = 0; tries < 2; ++tries) {
     Options opt;
     opt.dim = dimOverride != -1 ? dimOverride : opt.dim;
+    opt.numQuery = numQueryOverride != -1 ? numQueryOverride : opt.numQuery;
 
     std::vector<float> trainVecs = faiss::gpu::randVecs(opt.numTrain, opt.dim);
     std::vector<float> addVecs = faiss::gpu::randVecs(opt.numAdd, opt.dim);
@@ -327,6 +335,20 @@ TEST(TestGpuIndexIVFFlat, Float32_Query_IP_128) {
   queryTest(faiss::METRIC_INNER_PRODUCT, false, 128);
 }
 
+//
+// Small query batches go through the fused low-latency scan
+//
+
+TEST(TestGpuIndexIVFFlat, Float32_Query_L2_SmallBatch) {
+  queryTest(faiss::METRIC_L2, false, -1, 1);
+  queryTest(faiss::METRIC_L2, false, -1, 17);
+}
+
+TEST(TestGpuIndexIVFFlat, Float32_Query_IP_SmallBatch) {
+  queryTest(faiss::METRIC_INNER_PRODUCT, false, -1, 1);
+  queryTest(faiss::METRIC_INNER_PRODUCT, false, -1, 17);
+}
+
 //
 // Copy tests
 //
@@ -491,6 +513,233 @@ TEST(TestGpuIndexIVFFlat, AddNaN) {
                   distance.data(), indices.data());
 }
 
+TEST(TestGpuIndexIVFFlat, AddListOrder) {
+  Options opt;
+  std::vector<float> trainVecs = faiss::gpu::randVecs(opt.numTrain, opt.dim);
+
+  faiss::IndexFlatL2 cpuQuantizer(opt.dim);
+  faiss::IndexIVFFlat cpuIndex(&cpuQuantizer,
+                               opt.dim,
+                               opt.numCentroids,
+                               faiss::METRIC_L2);
+  cpuIndex.train(opt.numTrain, trainVecs.data());
+
+  faiss::gpu::StandardGpuResources res;
+  res.noTempMemory();
+
+  faiss::gpu::GpuIndexIVFFlatConfig config;
+  config.device = opt.device;
+  config.indicesOptions = opt.indicesOpt;
+
+  faiss::gpu::GpuIndexIVFFlat gpuIndex(&res,
+                                       1,
+                                       1,
+                                       faiss::METRIC_L2,
+                                       config);
+  gpuIndex.copyFrom(&cpuIndex);
+
+  // Vectors close to the centroids, so that the CPU and the GPU assign them
+  // to the same lists; many vectors go to each list in a single batch
+  std::vector<float> addVecs = faiss::gpu::randVecs(opt.numAdd, opt.dim);
+  const float* centroids = cpuQuantizer.xb.data();
+
+  for (int i = 0; i < opt.numAdd; ++i) {
+    int c = (i * 7) % opt.numCentroids;
+    for (int j = 0; j < opt.dim; ++j) {
+      addVecs[i * opt.dim + j] =
+        centroids[c * opt.dim + j] + 0.01f * addVecs[i * opt.dim + j];
+    }
+  }
+
+  // Two batches, so that the second one appends to non-empty lists
+  int numFirst = opt.numAdd / 3;
+  cpuIndex.add(numFirst, addVecs.data());
+  cpuIndex.add(opt.numAdd - numFirst, addVecs.data() + numFirst * opt.dim);
+  gpuIndex.add(numFirst, addVecs.data());
+  gpuIndex.add(opt.numAdd - numFirst, addVecs.data() + numFirst * opt.dim);
+
+  EXPECT_EQ(cpuIndex.ntotal, gpuIndex.ntotal);
+
+  // The vectors of each list are in the same order as on the CPU
+  testIVFEquality(cpuIndex, gpuIndex);
+}
+
+TEST(TestGpuIndexIVFFlat, InterleavedLayout) {
+  for (auto metricType : {faiss::METRIC_L2, faiss::METRIC_INNER_PRODUCT}) {
+    Options opt;
+    // Small dimensions are where the interleaved layout matters
+    opt.dim = faiss::gpu::randVal(3, 40);
+
+    std::vector<float> trainVecs = faiss::gpu::randVecs(opt.numTrain, opt.dim);
+    std::vector<float> addVecs = faiss::gpu::randVecs(opt.numAdd, opt.dim);
+
+    faiss::IndexFlat cpuQuantizer(opt.dim, metricType);
+    faiss::IndexIVFFlat cpuIndex(&cpuQuantizer,
+                                 opt.dim,
+                                 opt.numCentroids,
+                                 metricType);
+    cpuIndex.train(opt.numTrain, trainVecs.data());
+    cpuIndex.nprobe = opt.nprobe;
+
+    // Half of the vectors are converted from the CPU layout, the other half
+    // are appended on the GPU
+    int numFirst = opt.numAdd / 2;
+    cpuIndex.add(numFirst, addVecs.data());
+
+    faiss::gpu::StandardGpuResources res;
+    res.noTempMemory();
+
+    faiss::gpu::GpuIndexIVFFlatConfig config;
+    config.device = opt.device;
+    config.indicesOptions = opt.indicesOpt;
+    config.interleavedLayout = true;
+
+    faiss::gpu::GpuIndexIVFFlat gpuIndex(&res,
+                                         cpuIndex.d,
+                                         cpuIndex.nlist,
+                                         cpuIndex.metric_type,
+                                         config);
+    gpuIndex.copyFrom(&cpuIndex);
+    gpuIndex.setNumProbes(opt.nprobe);
+
+    testIVFEquality(cpuIndex, gpuIndex);
+
+    cpuIndex.add(opt.numAdd - numFirst, addVecs.data() + numFirst * opt.dim);
+    gpuIndex.add(opt.numAdd - numFirst, addVecs.data() + numFirst * opt.dim);
+
+    faiss::gpu::compareIndices(cpuIndex, gpuIndex,
+                               opt.numQuery, opt.dim, opt.k, opt.toString(),
+                               kF32MaxRelErr,
+                               0.1f,
+                               0.015f);
+  }
+}
+
+TEST(TestGpuIndexIVFFlat, RangeSearch) {
+  for (auto metricType : {faiss::METRIC_L2, faiss::METRIC_INNER_PRODUCT}) {
+    Options opt;
+
+    std::vector<float> trainVecs = faiss::gpu::randVecs(opt.numTrain, opt.dim);
+    std::vector<float> addVecs = faiss::gpu::randVecs(opt.numAdd, opt.dim);
+
+    faiss::IndexFlat cpuQuantizer(opt.dim, metricType);
+    faiss::IndexIVFFlat cpuIndex(&cpuQuantizer,
+                                 opt.dim,
+                                 opt.numCentroids,
+                                 metricType);
+    cpuIndex.train(opt.numTrain, trainVecs.data());
+    cpuIndex.add(opt.numAdd, addVecs.data());
+    cpuIndex.nprobe = opt.nprobe;
+
+    faiss::gpu::StandardGpuResources res;
+    res.noTempMemory();
+
+    faiss::gpu::GpuIndexIVFFlatConfig config;
+    config.device = opt.device;
+    config.indicesOptions = opt.indicesOpt;
+
+    faiss::gpu::GpuIndexIVFFlat gpuIndex(&res,
+                                         cpuIndex.d,
+                                         cpuIndex.nlist,
+                                         cpuIndex.metric_type,
+                                         config);
+    gpuIndex.copyFrom(&cpuIndex);
+    gpuIndex.setNumProbes(opt.nprobe);
+
+    std::vector<float> queries = faiss::gpu::randVecs(opt.numQuery, opt.dim);
+
+    // Radius around the distance of the k-th neighbor of the first query
+    std::vector<float> dist(opt.k);
+    std::vector<faiss::Index::idx_t> ind(opt.k);
+    cpuIndex.search(1, queries.data(), opt.k, dist.data(), ind.data());
+    float radius = dist[opt.k - 1];
+
+    faiss::RangeSearchResult cpuRes(opt.numQuery);
+    faiss::RangeSearchResult gpuRes(opt.numQuery);
+    cpuIndex.range_search(opt.numQuery, queries.data(), radius, &cpuRes);
+    gpuIndex.range_search(opt.numQuery, queries.data(), radius, &gpuRes);
+
+    faiss::gpu::compareRangeSearch(cpuRes, gpuRes, opt.numQuery, radius,
+                                   metricType == faiss::METRIC_L2,
+                                   kF32MaxRelErr);
+  }
+}
+
+TEST(TestGpuIndexIVFFlat, RemoveIds) {
+  for (bool interleaved : {false, true}) {
+    Options opt;
+
+    std::vector<float> trainVecs = faiss::gpu::randVecs(opt.numTrain, opt.dim);
+    std::vector<float> addVecs = faiss::gpu::randVecs(opt.numAdd, opt.dim);
+
+    faiss::IndexFlatL2 cpuQuantizer(opt.dim);
+    faiss::IndexIVFFlat cpuIndex(&cpuQuantizer,
+                                 opt.dim,
+                                 opt.numCentroids,
+                                 faiss::METRIC_L2);
+    cpuIndex.train(opt.numTrain, trainVecs.data());
+    cpuIndex.add(opt.numAdd, addVecs.data());
+    cpuIndex.nprobe = opt.nprobe;
+
+    faiss::gpu::StandardGpuResources res;
+    res.noTempMemory();
+
+    faiss::gpu::GpuIndexIVFFlatConfig config;
+    config.device = opt.device;
+    config.indicesOptions = opt.indicesOpt;
+    config.interleavedLayout = interleaved;
+
+    faiss::gpu::GpuIndexIVFFlat gpuIndex(&res,
+                                         cpuIndex.d,
+                                         cpuIndex.nlist,
+                                         cpuIndex.metric_type,
+                                         config);
+    gpuIndex.copyFrom(&cpuIndex);
+    gpuIndex.setNumProbes(opt.nprobe);
+
+    faiss::IDSelectorRange sel(opt.numAdd / 4, opt.numAdd / 2);
+    size_t numRemoved = cpuIndex.remove_ids(sel);
+    EXPECT_EQ(gpuIndex.remove_ids(sel), numRemoved);
+    EXPECT_EQ(gpuIndex.ntotal, cpuIndex.ntotal);
+
+    // The removed ids are gone from the lists
+    for (int i = 0; i < cpuIndex.nlist; ++i) {
+      EXPECT_EQ(gpuIndex.getListLength(i), cpuIndex.invlists->list_size(i));
+
+      for (auto id : gpuIndex.getListIndices(i)) {
+        EXPECT_FALSE(sel.is_member(id));
+      }
+    }
+
+    faiss::gpu::compareIndices(cpuIndex, gpuIndex,
+                               opt.numQuery, opt.dim, opt.k, opt.toString(),
+                               kF32MaxRelErr,
+                               0.1f,
+                               0.015f);
+
+    // Replace some of the remaining vectors, and add back some of the
+    // removed ids
+    int numUpdate = opt.numAdd / 4;
+    std::vector<float> updateVecs = faiss::gpu::randVecs(numUpdate, opt.dim);
+    std::vector<faiss::Index::idx_t> updateIds(numUpdate);
+    for (int i = 0; i < numUpdate; ++i) {
+      updateIds[i] = opt.numAdd / 8 + i;
+    }
+
+    faiss::IDSelectorBatch updateSel(numUpdate, updateIds.data());
+    cpuIndex.remove_ids(updateSel);
+    cpuIndex.add_with_ids(numUpdate, updateVecs.data(), updateIds.data());
+    gpuIndex.update_vectors(numUpdate, updateIds.data(), updateVecs.data());
+    EXPECT_EQ(gpuIndex.ntotal, cpuIndex.ntotal);
+
+    faiss::gpu::compareIndices(cpuIndex, gpuIndex,
+                               opt.numQuery, opt.dim, opt.k, opt.toString(),
+                               kF32MaxRelErr,
+                               0.1f,
+                               0.015f);
+  }
+}
+
 TEST(TestGpuIndexIVFFlat, UnifiedMemory) {
   // Construct on a random device to test multi-device, if we have
   // multiple devices
@@ -544,6 +793,235 @@ TEST(TestGpuIndexIVFFlat, UnifiedMemory) {
                              0.015f);
 }
 
+TEST(TestGpuIndexIVFFlat, UnifiedMemoryHotLists) {
+  int device = faiss::gpu::randVal(0, faiss::gpu::getNumDevices() - 1);
+
+  if (!faiss::gpu::getFullUnifiedMemSupport(device)) {
+    return;
+  }
+
+  int dim = 64;
+  int numCentroids = 128;
+  size_t numAdd = 20000;
+  size_t numTrain = numCentroids * 40;
+  int numQuery = 20;
+  int k = 10;
+  int nprobe = 4;
+
+  std::vector<float> trainVecs = faiss::gpu::randVecs(numTrain, dim);
+  std::vector<float> addVecs = faiss::gpu::randVecs(numAdd, dim);
+
+  faiss::IndexFlatL2 quantizer(dim);
+  faiss::IndexIVFFlat cpuIndex(&quantizer, dim, numCentroids, faiss::METRIC_L2);
+
+  cpuIndex.train(numTrain, trainVecs.data());
+  cpuIndex.add(numAdd, addVecs.data());
+  cpuIndex.nprobe = nprobe;
+
+  faiss::gpu::StandardGpuResources res;
+  res.noTempMemory();
+
+  faiss::gpu::GpuIndexIVFFlatConfig config;
+  config.device = device;
+  config.memorySpace = faiss::gpu::MemorySpace::Unified;
+  // room for about a quarter of the lists
+  config.unifiedHotListBytes = numAdd * dim * sizeof(float) / 4;
+
+  faiss::gpu::GpuIndexIVFFlat gpuIndex(&res,
+                                       dim,
+                                       numCentroids,
+                                       faiss::METRIC_L2,
+                                       config);
+  gpuIndex.copyFrom(&cpuIndex);
+  gpuIndex.setNumProbes(nprobe);
+
+  // enough query batches to update the hot lists several times
+  for (int i = 0; i < 40; ++i) {
+    faiss::gpu::compareIndices(cpuIndex, gpuIndex,
+                               numQuery, dim, k, "Unified Memory hot lists",
+                               kF32MaxRelErr,
+                               0.1f,
+                               0.015f);
+  }
+}
+
+TEST(TestGpuIndexIVFFlat, ListShards) {
+  // Shards the lists across all of our devices, with two shards per device
+  // so that routing is exercised with a single GPU
+  int numShards = 2 * faiss::gpu::getNumDevices();
+
+  int dim = 64;
+  int numCentroids = 256;
+  size_t numAdd = 20000;
+  size_t numTrain = numCentroids * 40;
+  int numQuery = 100;
+  int k = 10;
+  int nprobe = 16;
+
+  std::vector<float> trainVecs = faiss::gpu::randVecs(numTrain, dim);
+  std::vector<float> addVecs = faiss::gpu::randVecs(numAdd, dim);
+
+  faiss::IndexFlatL2 quantizer(dim);
+  faiss::IndexIVFFlat cpuIndex(&quantizer, dim, numCentroids, faiss::METRIC_L2);
+
+  cpuIndex.train(numTrain, trainVecs.data());
+  cpuIndex.add(numAdd, addVecs.data());
+  cpuIndex.nprobe = nprobe;
+
+  std::vector<faiss::gpu::StandardGpuResources> res(numShards);
+  std::vector<faiss::gpu::GpuResourcesProvider*> providers;
+  std::vector<int> devices;
+
+  for (int i = 0; i < numShards; ++i) {
+    res[i].noTempMemory();
+    providers.push_back(&res[i]);
+    devices.push_back(i % faiss::gpu::getNumDevices());
+  }
+
+  faiss::gpu::GpuMultipleClonerOptions options;
+  options.shard = true;
+  options.shard_type = 3;
+
+  std::unique_ptr<faiss::Index> gpuIndex(
+    faiss::gpu::index_cpu_to_gpu_multiple(providers, devices,
+                                          &cpuIndex, &options));
+
+  auto listShards =
+    dynamic_cast<faiss::gpu::GpuIndexIVFListShards*>(gpuIndex.get());
+  EXPECT_NE(listShards, nullptr);
+  EXPECT_EQ(listShards->ntotal, cpuIndex.ntotal);
+  EXPECT_EQ(listShards->nprobe, nprobe);
+
+  faiss::gpu::compareIndices(cpuIndex, *gpuIndex,
+                             numQuery, dim, k, "List shards",
+                             kF32MaxRelErr,
+                             0.1f,
+                             0.015f);
+
+  // Adding through the shards routes each vector to the owner of its list
+  std::vector<float> moreVecs = faiss::gpu::randVecs(1000, dim);
+  cpuIndex.add(1000, moreVecs.data());
+  gpuIndex->add(1000, moreVecs.data());
+  EXPECT_EQ(gpuIndex->ntotal, cpuIndex.ntotal);
+
+  faiss::gpu::compareIndices(cpuIndex, *gpuIndex,
+                             numQuery, dim, k, "List shards add",
+                             kF32MaxRelErr,
+                             0.1f,
+                             0.015f);
+}
+
+TEST(TestGpuIndexIVFFlat, CopyRoundTrip) {
+  Options opt;
+  std::vector<float> trainVecs = faiss::gpu::randVecs(opt.numTrain, opt.dim);
+  std::vector<float> addVecs = faiss::gpu::randVecs(opt.numAdd, opt.dim);
+
+  faiss::IndexFlatL2 cpuQuantizer(opt.dim);
+  faiss::IndexIVFFlat cpuIndex(&cpuQuantizer,
+                               opt.dim,
+                               opt.numCentroids,
+                               faiss::METRIC_L2);
+  cpuIndex.train(opt.numTrain, trainVecs.data());
+  cpuIndex.add(opt.numAdd, addVecs.data());
+
+  faiss::gpu::StandardGpuResources res;
+  res.noTempMemory();
+
+  // The lists are copied in batches in both directions, whatever the
+  // storage of the indices
+  for (auto indicesOpt : {faiss::gpu::INDICES_32_BIT,
+                          faiss::gpu::INDICES_64_BIT,
+                          faiss::gpu::INDICES_CPU}) {
+    for (bool interleaved : {false, true}) {
+      faiss::gpu::GpuIndexIVFFlatConfig config;
+      config.device = opt.device;
+      config.indicesOptions = indicesOpt;
+      config.interleavedLayout = interleaved;
+
+      faiss::gpu::GpuIndexIVFFlat gpuIndex(&res,
+                                           cpuIndex.d,
+                                           cpuIndex.nlist,
+                                           cpuIndex.metric_type,
+                                           config);
+      gpuIndex.copyFrom(&cpuIndex);
+      testIVFEquality(cpuIndex, gpuIndex);
+
+      faiss::IndexFlatL2 cpuQuantizer2(opt.dim);
+      faiss::IndexIVFFlat cpuIndex2(&cpuQuantizer2, 1, 1, faiss::METRIC_L2);
+      gpuIndex.copyTo(&cpuIndex2);
+      EXPECT_EQ(cpuIndex2.ntotal, cpuIndex.ntotal);
+
+      for (int l = 0; l < cpuIndex.nlist; ++l) {
+        size_t ls = cpuIndex.invlists->list_size(l);
+        ASSERT_EQ(ls, cpuIndex2.invlists->list_size(l));
+
+        EXPECT_EQ(0, memcmp(cpuIndex.invlists->get_ids(l),
+                            cpuIndex2.invlists->get_ids(l),
+                            ls * sizeof(faiss::Index::idx_t)));
+        EXPECT_EQ(0, memcmp(cpuIndex.invlists->get_codes(l),
+                            cpuIndex2.invlists->get_codes(l),
+                            ls * cpuIndex.code_size));
+      }
+    }
+  }
+}
+
+TEST(TestGpuIndexIVFFlat, ParallelClone) {
+  // Replicates the index to all of our devices, with two replicas per
+  // device so that concurrent cloning is exercised with a single GPU
+  int numReplicas = 2 * faiss::gpu::getNumDevices();
+
+  Options opt;
+  std::vector<float> trainVecs = faiss::gpu::randVecs(opt.numTrain, opt.dim);
+  std::vector<float> addVecs = faiss::gpu::randVecs(opt.numAdd, opt.dim);
+
+  faiss::IndexFlatL2 quantizer(opt.dim);
+  faiss::IndexIVFFlat cpuIndex(&quantizer, opt.dim, opt.numCentroids,
+                               faiss::METRIC_L2);
+  cpuIndex.train(opt.numTrain, trainVecs.data());
+  cpuIndex.add(opt.numAdd, addVecs.data());
+  cpuIndex.nprobe = opt.nprobe;
+
+  std::vector<faiss::gpu::StandardGpuResources> res(numReplicas);
+  std::vector<faiss::gpu::GpuResourcesProvider*> providers;
+  std::vector<int> devices;
+
+  for (int i = 0; i < numReplicas; ++i) {
+    res[i].noTempMemory();
+    providers.push_back(&res[i]);
+    devices.push_back(i % faiss::gpu::getNumDevices());
+  }
+
+  for (bool shard : {false, true}) {
+    faiss::gpu::GpuMultipleClonerOptions options;
+    options.shard = shard;
+    options.parallelClone = true;
+
+    std::unique_ptr<faiss::Index> gpuIndex(
+      faiss::gpu::index_cpu_to_gpu_multiple(providers, devices,
+                                            &cpuIndex, &options));
+    EXPECT_EQ(gpuIndex->ntotal, cpuIndex.ntotal);
+
+    if (!shard) {
+      auto replicas = dynamic_cast<faiss::IndexReplicas*>(gpuIndex.get());
+      ASSERT_NE(replicas, nullptr);
+
+      for (int i = 0; i < replicas->count(); ++i) {
+        auto replica =
+          dynamic_cast<faiss::gpu::GpuIndexIVFFlat*>(replicas->at(i));
+        ASSERT_NE(replica, nullptr);
+        testIVFEquality(cpuIndex, *replica);
+      }
+    }
+
+    faiss::gpu::compareIndices(cpuIndex, *gpuIndex,
+                               opt.numQuery, opt.dim, opt.k, opt.toString(),
+                               kF32MaxRelErr,
+                               0.1f,
+                               0.015f);
+  }
+}
+
 int main(int argc, char** argv) {
   testing::InitGoogleTest(&argc, argv);
 
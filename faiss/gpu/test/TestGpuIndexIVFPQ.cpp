@@ -6,12 +6,15 @@
  */
 
 
+#include <faiss/BlockInvertedLists.h>
 #include <faiss/IndexFlat.h>
 #include <faiss/IndexIVFPQ.h>
+#include <faiss/IndexIVFPQFastScan.h>
 #include <faiss/gpu/GpuIndexIVFPQ.h>
 #include <faiss/gpu/StandardGpuResources.h>
 #include <faiss/gpu/utils/DeviceUtils.h>
 #include <faiss/gpu/test/TestUtils.h>
+#include <faiss/utils/instrumentation.h>
 #include <cmath>
 #include <gtest/gtest.h>
 #include <sstream>
@@ -151,6 +154,43 @@ TEST(TestGpuIndexIVFPQ, Query_L2) {
   }
 }
 
+TEST(TestGpuIndexIVFPQ, Query_L2_PrecomputedOnTheFly) {
+  for (int tries = 0; tries < 2; ++tries) {
+    Options opt;
+
+    std::vector<float> trainVecs = faiss::gpu::randVecs(opt.numTrain, opt.dim);
+    std::vector<float> addVecs = faiss::gpu::randVecs(opt.numAdd, opt.dim);
+
+    faiss::IndexFlatL2 coarseQuantizer(opt.dim);
+    faiss::IndexIVFPQ cpuIndex(&coarseQuantizer, opt.dim, opt.numCentroids,
+                               opt.codes, opt.bitsPerCode);
+    cpuIndex.nprobe = opt.nprobe;
+    cpuIndex.train(opt.numTrain, trainVecs.data());
+    cpuIndex.add(opt.numAdd, addVecs.data());
+
+    faiss::gpu::StandardGpuResources res;
+
+    faiss::gpu::GpuIndexIVFPQConfig config;
+    config.device = opt.device;
+    config.usePrecomputedTables = true;
+    config.indicesOptions = opt.indicesOpt;
+    config.useFloat16LookupTables = opt.useFloat16;
+    // The table is not stored; the first try computes term 2 one query at
+    // a time, the second for all queries at once
+    config.precomputedTableMaxBytes = (tries == 0) ? 1 :
+      (size_t) opt.numQuery * opt.nprobe * opt.codes * 256 * 32;
+
+    faiss::gpu::GpuIndexIVFPQ gpuIndex(&res, &cpuIndex, config);
+    gpuIndex.setNumProbes(opt.nprobe);
+
+    faiss::gpu::compareIndices(cpuIndex, gpuIndex,
+                               opt.numQuery, opt.dim, opt.k, opt.toString(),
+                               opt.getCompareEpsilon(),
+                               opt.getPctMaxDiff1(),
+                               opt.getPctMaxDiffN());
+  }
+}
+
 void testMMCodeDistance(faiss::MetricType mt) {
   // Explicitly test the code distance via batch matrix multiplication route
   // (even for dimension sizes that would otherwise be handled by the
@@ -382,6 +422,107 @@ TEST(TestGpuIndexIVFPQ, Add_IP) {
   }
 }
 
+TEST(TestGpuIndexIVFPQ, Add_Codes) {
+  // The codes written by the fused residual + encoding append kernel are
+  // those of the CPU, except for a few near ties
+  for (int tries = 0; tries < 2; ++tries) {
+    Options opt;
+
+    std::vector<float> trainVecs = faiss::gpu::randVecs(opt.numTrain, opt.dim);
+    std::vector<float> addVecs = faiss::gpu::randVecs(opt.numAdd, opt.dim);
+
+    faiss::IndexFlatL2 coarseQuantizer(opt.dim);
+    faiss::IndexIVFPQ cpuIndex(&coarseQuantizer, opt.dim, opt.numCentroids,
+                               opt.codes, opt.bitsPerCode);
+    cpuIndex.train(opt.numTrain, trainVecs.data());
+
+    faiss::gpu::StandardGpuResources res;
+
+    faiss::gpu::GpuIndexIVFPQConfig config;
+    config.device = opt.device;
+    config.alternativeLayout = (tries == 1);
+    config.indicesOptions = faiss::gpu::INDICES_64_BIT;
+
+    faiss::gpu::GpuIndexIVFPQ gpuIndex(&res, &cpuIndex, config);
+    gpuIndex.add(opt.numAdd, addVecs.data());
+    cpuIndex.add(opt.numAdd, addVecs.data());
+
+    faiss::IndexFlatL2 copyQuantizer(opt.dim);
+    faiss::IndexIVFPQ cpuCopy(&copyQuantizer, opt.dim, opt.numCentroids,
+                              opt.codes, opt.bitsPerCode);
+    gpuIndex.copyTo(&cpuCopy);
+    EXPECT_EQ(cpuCopy.ntotal, cpuIndex.ntotal);
+
+    size_t numCompared = 0;
+    size_t numEqual = 0;
+
+    for (int i = 0; i < opt.numCentroids; ++i) {
+      size_t size = cpuIndex.invlists->list_size(i);
+      if (size != cpuCopy.invlists->list_size(i)) {
+        // different coarse assignment
+        continue;
+      }
+
+      const uint8_t* ref = cpuIndex.invlists->get_codes(i);
+      const uint8_t* codes = cpuCopy.invlists->get_codes(i);
+      for (size_t j = 0; j < size * cpuIndex.code_size; ++j) {
+        numEqual += ref[j] == codes[j];
+      }
+      numCompared += size * cpuIndex.code_size;
+    }
+
+    EXPECT_GT(numCompared, 0);
+    EXPECT_GE(numEqual, 0.99 * numCompared) << opt.toString();
+  }
+}
+
+TEST(TestGpuIndexIVFPQ, Instrumentation) {
+  Options opt;
+
+  std::vector<float> trainVecs = faiss::gpu::randVecs(opt.numTrain, opt.dim);
+  std::vector<float> addVecs = faiss::gpu::randVecs(opt.numAdd, opt.dim);
+
+  faiss::IndexFlatL2 coarseQuantizer(opt.dim);
+  faiss::IndexIVFPQ cpuIndex(&coarseQuantizer, opt.dim, opt.numCentroids,
+                             opt.codes, opt.bitsPerCode);
+  cpuIndex.train(opt.numTrain, trainVecs.data());
+  cpuIndex.add(opt.numAdd, addVecs.data());
+
+  faiss::gpu::StandardGpuResources res;
+
+  faiss::gpu::GpuIndexIVFPQConfig config;
+  config.device = opt.device;
+  config.usePrecomputedTables = opt.usePrecomputed;
+
+  faiss::gpu::GpuIndexIVFPQ gpuIndex(&res, &cpuIndex, config);
+  gpuIndex.setNumProbes(opt.nprobe);
+
+  auto queries = faiss::gpu::randVecs(opt.numQuery, opt.dim);
+  std::vector<float> distances(opt.numQuery * opt.k);
+  std::vector<faiss::Index::idx_t> labels(opt.numQuery * opt.k);
+
+  faiss::instrumentation_reset();
+  faiss::instrumentation_enabled = true;
+  gpuIndex.search(opt.numQuery, queries.data(), opt.k,
+                  distances.data(), labels.data());
+  faiss::instrumentation_enabled = false;
+
+  faiss::InstrumentationStats stats;
+  faiss::instrumentation_get(&stats);
+
+  EXPECT_EQ(stats.counters[faiss::COUNTER_NQ], opt.numQuery);
+  EXPECT_EQ(stats.counters[faiss::COUNTER_NLIST],
+            (uint64_t) opt.numQuery * opt.nprobe);
+  EXPECT_GT(stats.counters[faiss::COUNTER_NDIS], 0);
+  EXPECT_LE(stats.counters[faiss::COUNTER_NDIS],
+            (uint64_t) opt.numQuery * opt.numAdd);
+  EXPECT_EQ(stats.stage_calls[faiss::STAGE_COARSE_QUANTIZE], 1);
+  EXPECT_GE(stats.stage_calls[faiss::STAGE_LIST_SCAN], 1);
+  EXPECT_GE(stats.stage_calls[faiss::STAGE_SELECT], 1);
+  EXPECT_GE(stats.stage_calls[faiss::STAGE_COPY], 2);
+  EXPECT_GT(stats.peaks[faiss::PEAK_GPU_TEMP_MEM], 0);
+}
+
 TEST(TestGpuIndexIVFPQ, CopyTo) {
   for (int tries = 0; tries < 2; ++tries) {
     Options opt;
@@ -488,6 +629,177 @@ TEST(TestGpuIndexIVFPQ, CopyFrom) {
                              opt.getPctMaxDiffN());
 }
 
+TEST(TestGpuIndexIVFPQ, CopyFrom_BitsPerCode) {
+  // Bits per code other than 8, with a number of sub-quantizers that has no
+  // specialized kernel
+  for (int bits : {4, 6, 10}) {
+    for (int tries = 0; tries < 2; ++tries) {
+      Options opt;
+      opt.codes = 6;
+      opt.dim = 6 * 16;
+      opt.bitsPerCode = bits;
+      opt.numTrain = std::max(opt.numTrain, 40 << bits);
+
+      std::vector<float> trainVecs =
+        faiss::gpu::randVecs(opt.numTrain, opt.dim);
+      std::vector<float> addVecs = faiss::gpu::randVecs(opt.numAdd, opt.dim);
+
+      faiss::IndexFlatL2 coarseQuantizer(opt.dim);
+      faiss::IndexIVFPQ cpuIndex(&coarseQuantizer, opt.dim, opt.numCentroids,
+                                 opt.codes, opt.bitsPerCode);
+      cpuIndex.nprobe = opt.nprobe;
+      cpuIndex.train(opt.numTrain, trainVecs.data());
+      cpuIndex.add(opt.numAdd, addVecs.data());
+
+      faiss::gpu::StandardGpuResources res;
+
+      faiss::gpu::GpuIndexIVFPQConfig config;
+      config.device = opt.device;
+      config.usePrecomputedTables = (tries % 2 == 0);
+      config.alternativeLayout = (tries % 2 == 1);
+      config.indicesOptions = opt.indicesOpt;
+      config.useFloat16LookupTables = opt.useFloat16;
+
+      faiss::gpu::GpuIndexIVFPQ gpuIndex(&res, &cpuIndex, config);
+      gpuIndex.setNumProbes(opt.nprobe);
+
+      EXPECT_EQ(gpuIndex.getBitsPerCode(), bits);
+
+      // The packed CPU codes survive the round trip through the GPU layout
+      testIVFEquality(cpuIndex, gpuIndex);
+
+      faiss::gpu::compareIndices(cpuIndex, gpuIndex,
+                                 opt.numQuery, opt.dim, opt.k, opt.toString(),
+                                 opt.getCompareEpsilon(),
+                                 opt.getPctMaxDiff1(),
+                                 opt.getPctMaxDiffN());
+    }
+  }
+}
+
+TEST(TestGpuIndexIVFPQ, FastScan) {
+  for (int tries = 0; tries < 2; ++tries) {
+    Options opt;
+    // An odd number of sub-quantizers is padded in the block layout
+    opt.codes = tries == 0 ? 16 : 7;
+    opt.dim = opt.codes * 8;
+    opt.bitsPerCode = 4;
+
+    std::vector<float> trainVecs = faiss::gpu::randVecs(opt.numTrain, opt.dim);
+    std::vector<float> addVecs = faiss::gpu::randVecs(opt.numAdd, opt.dim);
+
+    faiss::IndexFlatL2 coarseQuantizer(opt.dim);
+    faiss::IndexIVFPQ cpuIndex(&coarseQuantizer, opt.dim, opt.numCentroids,
+                               opt.codes, opt.bitsPerCode);
+    cpuIndex.nprobe = opt.nprobe;
+    cpuIndex.train(opt.numTrain, trainVecs.data());
+
+    // Empty fast-scan index, filled by the GPU
+    faiss::IndexIVFPQFastScan cpuFastScanEmpty(cpuIndex);
+
+    cpuIndex.add(opt.numAdd, addVecs.data());
+    faiss::IndexIVFPQFastScan cpuFastScan(cpuIndex);
+
+    faiss::gpu::StandardGpuResources res;
+
+    faiss::gpu::GpuIndexIVFPQConfig config;
+    config.device = opt.device;
+    config.indicesOptions = opt.indicesOpt;
+    config.useFloat16LookupTables = opt.useFloat16;
+
+    // The lists are copied as is
+    faiss::gpu::GpuIndexIVFPQ gpuIndex(&res, &cpuFastScan, config);
+    gpuIndex.setNumProbes(opt.nprobe);
+    EXPECT_TRUE(gpuIndex.getFastScanLayout());
+
+    // The GPU distances are not quantized, compare to the regular IVFPQ
+    faiss::gpu::compareIndices(cpuIndex, gpuIndex,
+                               opt.numQuery, opt.dim, opt.k, opt.toString(),
+                               opt.getCompareEpsilon(),
+                               opt.getPctMaxDiff1(),
+                               opt.getPctMaxDiffN());
+
+    // Round trip back to the CPU blocks
+    faiss::IndexIVFPQFastScan cpuCopy;
+    gpuIndex.copyTo(&cpuCopy);
+    EXPECT_EQ(cpuCopy.ntotal, cpuFastScan.ntotal);
+
+    auto srcLists =
+      dynamic_cast<const faiss::BlockInvertedLists*>(cpuFastScan.invlists);
+    auto dstLists =
+      dynamic_cast<const faiss::BlockInvertedLists*>(cpuCopy.invlists);
+    ASSERT_TRUE(srcLists && dstLists);
+
+    for (int i = 0; i < opt.numCentroids; ++i) {
+      EXPECT_EQ(srcLists->codes[i], dstLists->codes[i]);
+      EXPECT_EQ(srcLists->ids[i], dstLists->ids[i]);
+    }
+
+    // Vectors added on the GPU in the fast-scan layout
+    faiss::gpu::GpuIndexIVFPQ gpuAddIndex(&res, &cpuFastScanEmpty, config);
+    gpuAddIndex.setNumProbes(opt.nprobe);
+    gpuAddIndex.add(opt.numAdd, addVecs.data());
+
+    faiss::gpu::compareIndices(cpuIndex, gpuAddIndex,
+                               opt.numQuery, opt.dim, opt.k, opt.toString(),
+                               opt.getCompareEpsilon(),
+                               opt.getPctMaxDiff1(),
+                               opt.getPctMaxDiffN());
+  }
+}
+
+TEST(TestGpuIndexIVFPQ, SearchGraphs) {
+  for (int tries = 0; tries < 2; ++tries) {
+    Options opt;
+
+    std::vector<float> trainVecs = faiss::gpu::randVecs(opt.numTrain, opt.dim);
+    std::vector<float> addVecs = faiss::gpu::randVecs(opt.numAdd, opt.dim);
+
+    faiss::IndexFlatL2 coarseQuantizer(opt.dim);
+    faiss::IndexIVFPQ cpuIndex(&coarseQuantizer, opt.dim, opt.numCentroids,
+                               opt.codes, opt.bitsPerCode);
+    cpuIndex.nprobe = opt.nprobe;
+    cpuIndex.train(opt.numTrain, trainVecs.data());
+    cpuIndex.add(opt.numAdd / 2, addVecs.data());
+
+    faiss::gpu::StandardGpuResources res;
+
+    faiss::gpu::GpuIndexIVFPQConfig config;
+    config.device = opt.device;
+    config.usePrecomputedTables = (tries % 2 == 0);
+    // INDICES_CPU cannot be captured
+    config.indicesOptions = faiss::gpu::INDICES_64_BIT;
+    config.useFloat16LookupTables = opt.useFloat16;
+    config.useSearchGraphs = true;
+
+    faiss::gpu::GpuIndexIVFPQ gpuIndex(&res, &cpuIndex, config);
+    gpuIndex.setNumProbes(opt.nprobe);
+
+    // The first search of a shape captures its graph, the following ones
+    // replay it
+    for (int i = 0; i < 3; ++i) {
+      faiss::gpu::compareIndices(cpuIndex, gpuIndex,
+                                 opt.numQuery, opt.dim, opt.k, opt.toString(),
+                                 opt.getCompareEpsilon(),
+                                 opt.getPctMaxDiff1(),
+                                 opt.getPctMaxDiffN());
+    }
+
+    // Adding drops the graphs, which are captured again with the new lists
+    int numAdd2 = opt.numAdd - opt.numAdd / 2;
+    cpuIndex.add(numAdd2, addVecs.data() + (opt.numAdd / 2) * opt.dim);
+    gpuIndex.add(numAdd2, addVecs.data() + (opt.numAdd / 2) * opt.dim);
+
+    for (int i = 0; i < 2; ++i) {
+      faiss::gpu::compareIndices(cpuIndex, gpuIndex,
+                                 opt.numQuery, opt.dim, opt.k, opt.toString(),
+                                 opt.getCompareEpsilon(),
+                                 opt.getPctMaxDiff1(),
+                                 opt.getPctMaxDiffN());
+    }
+  }
+}
+
 TEST(TestGpuIndexIVFPQ, QueryNaN) {
   Options opt;
 
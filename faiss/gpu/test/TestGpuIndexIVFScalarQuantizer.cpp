@@ -71,6 +71,7 @@ TEST(TestGpuIndexIVFScalarQuantizer, CopyTo) {
   using namespace faiss::gpu;
 
   for (auto qtype : {ScalarQuantizer::QuantizerType::QT_8bit,
+      ScalarQuantizer::QuantizerType::QT_6bit,
       ScalarQuantizer::QuantizerType::QT_4bit}) {
     Options opt;
     std::vector<float> trainVecs = randVecs(opt.numTrain, opt.dim);
@@ -128,6 +129,7 @@ TEST(TestGpuIndexIVFScalarQuantizer, CopyFrom) {
   using namespace faiss::gpu;
 
   for (auto qtype : {ScalarQuantizer::QuantizerType::QT_8bit,
+      ScalarQuantizer::QuantizerType::QT_6bit,
       ScalarQuantizer::QuantizerType::QT_4bit}) {
     Options opt;
     std::vector<float> trainVecs = randVecs(opt.numTrain, opt.dim);
@@ -180,6 +182,70 @@ TEST(TestGpuIndexIVFScalarQuantizer, CopyFrom) {
   }
 }
 
+TEST(TestGpuIndexIVFScalarQuantizer, InterleavedLayout) {
+  using namespace faiss;
+  using namespace faiss::gpu;
+
+  for (auto qtype : {ScalarQuantizer::QuantizerType::QT_8bit,
+      ScalarQuantizer::QuantizerType::QT_8bit_uniform,
+      ScalarQuantizer::QuantizerType::QT_fp16,
+      ScalarQuantizer::QuantizerType::QT_6bit,
+      ScalarQuantizer::QuantizerType::QT_4bit}) {
+    Options opt;
+    // Odd dimension, so that the codecs handling several dimensions at once
+    // have a remainder
+    opt.dim = 2 * randVal(4, 40) + 1;
+
+    std::vector<float> trainVecs = randVecs(opt.numTrain, opt.dim);
+    std::vector<float> addVecs = randVecs(opt.numAdd, opt.dim);
+
+    IndexFlatL2 cpuQuantizer(opt.dim);
+    IndexIVFScalarQuantizer cpuIndex(&cpuQuantizer, opt.dim, opt.numCentroids,
+                                     qtype,
+                                     METRIC_L2);
+
+    cpuIndex.nprobe = opt.nprobe;
+    cpuIndex.train(opt.numTrain, trainVecs.data());
+
+    // Half of the vectors are converted from the CPU layout, the other half
+    // are encoded on the GPU
+    int numFirst = opt.numAdd / 2;
+    cpuIndex.add(numFirst, addVecs.data());
+
+    StandardGpuResources res;
+    res.noTempMemory();
+
+    auto config = GpuIndexIVFScalarQuantizerConfig();
+    config.device = opt.device;
+    config.indicesOptions = opt.indicesOpt;
+    config.interleavedLayout = true;
+
+    GpuIndexIVFScalarQuantizer gpuIndex(
+      &res, opt.dim, opt.numCentroids, qtype, METRIC_L2, true, config);
+    gpuIndex.copyFrom(&cpuIndex);
+    gpuIndex.setNumProbes(opt.nprobe);
+
+    testIVFEquality(cpuIndex, gpuIndex);
+
+    cpuIndex.add(opt.numAdd - numFirst, addVecs.data() + numFirst * opt.dim);
+    gpuIndex.add(opt.numAdd - numFirst, addVecs.data() + numFirst * opt.dim);
+
+    compareIndices(cpuIndex, gpuIndex,
+                   opt.numQuery, opt.dim, opt.k, opt.toString(),
+                   kF32MaxRelErr,
+                   0.1f,
+                   0.015f);
+
+    // The lists come back in the CPU layout
+    IndexFlatL2 copyQuantizer(1);
+    IndexIVFScalarQuantizer cpuCopy(&copyQuantizer, 1, 1,
+                                    ScalarQuantizer::QuantizerType::QT_6bit,
+                                    METRIC_L2);
+    gpuIndex.copyTo(&cpuCopy);
+    testIVFEquality(cpuCopy, gpuIndex);
+  }
+}
+
 int main(int argc, char** argv) {
   testing::InitGoogleTest(&argc, argv);
 
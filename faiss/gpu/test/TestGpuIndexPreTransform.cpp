@@ -0,0 +1,119 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVFPQ.h>
+#include <faiss/IndexPreTransform.h>
+#include <faiss/VectorTransform.h>
+#include <faiss/index_factory.h>
+#include <faiss/gpu/GpuCloner.h>
+#include <faiss/gpu/GpuIndexIVFPQ.h>
+#include <faiss/gpu/GpuIndexPreTransform.h>
+#include <faiss/gpu/StandardGpuResources.h>
+#include <faiss/gpu/test/TestUtils.h>
+#include <faiss/gpu/utils/DeviceUtils.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <vector>
+
+namespace {
+
+std::unique_ptr<faiss::Index>
+makeCpuIndex(const char* key, int dim, int numTrain, int numAdd) {
+  std::unique_ptr<faiss::Index> index(faiss::index_factory(dim, key));
+  auto xt = faiss::gpu::randVecs(numTrain, dim);
+  index->train(numTrain, xt.data());
+  auto xb = faiss::gpu::randVecs(numAdd, dim);
+  index->add(numAdd, xb.data());
+  return index;
+}
+
+} // namespace
+
+TEST(TestGpuIndexPreTransform, OPQ_IVFPQ) {
+  int device = faiss::gpu::randVal(0, faiss::gpu::getNumDevices() - 1);
+  int dim = 64;
+  auto cpuIndex = makeCpuIndex("OPQ16_64,IVF64,PQ16", dim, 10000, 20000);
+  dynamic_cast<faiss::IndexIVF*>(
+    dynamic_cast<faiss::IndexPreTransform*>(cpuIndex.get())->index)->nprobe =
+    8;
+
+  faiss::gpu::StandardGpuResources res;
+  faiss::gpu::GpuClonerOptions options;
+  options.usePrecomputed = false;
+
+  std::unique_ptr<faiss::Index> gpuIndex(
+    faiss::gpu::index_cpu_to_gpu(&res, device, cpuIndex.get(), &options));
+
+  auto gpt = dynamic_cast<faiss::gpu::GpuIndexPreTransform*>(gpuIndex.get());
+  ASSERT_NE(nullptr, gpt);
+  EXPECT_NE(nullptr,
+            dynamic_cast<faiss::gpu::GpuIndexIVFPQ*>(gpt->getIndex()));
+  EXPECT_EQ(cpuIndex->ntotal, gpuIndex->ntotal);
+
+  faiss::gpu::compareIndices(*cpuIndex, *gpuIndex, 100, dim, 10,
+                             "OPQ_IVFPQ", 0.015f, 0.1f, 0.015f);
+
+  // back to the CPU
+  std::unique_ptr<faiss::Index> cpuCopy(
+    faiss::gpu::index_gpu_to_cpu(gpuIndex.get()));
+  auto ipt = dynamic_cast<faiss::IndexPreTransform*>(cpuCopy.get());
+  ASSERT_NE(nullptr, ipt);
+  ASSERT_EQ(1, ipt->chain.size());
+  EXPECT_NE(nullptr, dynamic_cast<faiss::OPQMatrix*>(ipt->chain[0]));
+  EXPECT_EQ(cpuIndex->ntotal, cpuCopy->ntotal);
+}
+
+TEST(TestGpuIndexPreTransform, FusedChainAdd) {
+  int device = faiss::gpu::randVal(0, faiss::gpu::getNumDevices() - 1);
+  int dim = 64;
+
+  // PCA with bias followed by a random rotation: fused on the CPU
+  auto cpuIndex = makeCpuIndex("PCA32,RR32,Flat", dim, 5000, 0);
+
+  faiss::gpu::StandardGpuResources res;
+  std::unique_ptr<faiss::Index> gpuIndex(
+    faiss::gpu::index_cpu_to_gpu(&res, device, cpuIndex.get()));
+  ASSERT_NE(nullptr,
+            dynamic_cast<faiss::gpu::GpuIndexPreTransform*>(gpuIndex.get()));
+
+  // vectors added through the GPU chain
+  int numAdd = 5000;
+  auto xb = faiss::gpu::randVecs(numAdd, dim);
+  cpuIndex->add(numAdd, xb.data());
+  gpuIndex->add(numAdd, xb.data());
+  EXPECT_EQ(numAdd, gpuIndex->ntotal);
+
+  faiss::gpu::compareIndices(*cpuIndex, *gpuIndex, 100, dim, 10,
+                             "FusedChainAdd");
+}
+
+TEST(TestGpuIndexPreTransform, CpuChain) {
+  int device = faiss::gpu::randVal(0, faiss::gpu::getNumDevices() - 1);
+  int dim = 32;
+
+  // L2 normalization is not a LinearTransform: the chain stays on the CPU
+  auto cpuIndex = makeCpuIndex("L2norm,Flat", dim, 0, 1000);
+
+  faiss::gpu::StandardGpuResources res;
+  std::unique_ptr<faiss::Index> gpuIndex(
+    faiss::gpu::index_cpu_to_gpu(&res, device, cpuIndex.get()));
+  EXPECT_NE(nullptr,
+            dynamic_cast<faiss::IndexPreTransform*>(gpuIndex.get()));
+
+  faiss::gpu::compareIndices(*cpuIndex, *gpuIndex, 100, dim, 10, "CpuChain");
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+
+  // just run with a fixed test seed
+  faiss::gpu::setTestSeed(100);
+
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,175 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#include <faiss/IndexFlat.h>
+#include <faiss/gpu/GpuIndexFlat.h>
+#include <faiss/gpu/GpuIndexIVFFlat.h>
+#include <faiss/gpu/GpuMemoryAllocator.h>
+#include <faiss/gpu/StandardGpuResources.h>
+#include <faiss/gpu/utils/DeviceUtils.h>
+#include <faiss/gpu/test/TestUtils.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <thread>
+#include <vector>
+
+TEST(TestGpuMemoryAllocator, BinSize) {
+  using faiss::gpu::CachingGpuMemoryAllocator;
+
+  EXPECT_EQ(512, CachingGpuMemoryAllocator::binSize(1));
+  EXPECT_EQ(512, CachingGpuMemoryAllocator::binSize(512));
+  EXPECT_EQ(640, CachingGpuMemoryAllocator::binSize(513));
+  EXPECT_EQ(1024, CachingGpuMemoryAllocator::binSize(1000));
+  EXPECT_EQ(1280, CachingGpuMemoryAllocator::binSize(1025));
+
+  for (size_t sz = 1; sz < (1 << 24); sz = sz * 3 + 1) {
+    size_t bin = CachingGpuMemoryAllocator::binSize(sz);
+    EXPECT_GE(bin, sz);
+    EXPECT_LE(bin, std::max((size_t) 512, sz + sz / 4));
+  }
+}
+
+TEST(TestGpuMemoryAllocator, IVFFlatAdd) {
+  int device = faiss::gpu::randVal(0, faiss::gpu::getNumDevices() - 1);
+  int dim = 64, nlist = 64, numVecs = 20000, numQuery = 100, k = 10;
+
+  auto trainVecs = faiss::gpu::randVecs(nlist * 40, dim);
+  auto data = faiss::gpu::randVecs(numVecs, dim);
+  auto query = faiss::gpu::randVecs(numQuery, dim);
+
+  faiss::gpu::GpuIndexIVFFlatConfig config;
+  config.device = device;
+
+  std::vector<float> refDist(numQuery * k), dist(numQuery * k);
+  std::vector<faiss::Index::idx_t> refLabels(numQuery * k),
+    labels(numQuery * k);
+
+  {
+    faiss::gpu::StandardGpuResources res;
+    faiss::gpu::GpuIndexIVFFlat index(&res, dim, nlist,
+                                      faiss::METRIC_L2, config);
+    index.train(nlist * 40, trainVecs.data());
+    index.nprobe = 8;
+    for (int i = 0; i < numVecs; i += 1000) {
+      index.add(1000, data.data() + (size_t) i * dim);
+    }
+    index.search(numQuery, query.data(), k, refDist.data(), refLabels.data());
+  }
+
+  auto allocator = std::make_shared<faiss::gpu::CachingGpuMemoryAllocator>();
+
+  {
+    faiss::gpu::StandardGpuResources res;
+    res.setMemoryAllocator(allocator);
+
+    faiss::gpu::GpuIndexIVFFlat index(&res, dim, nlist,
+                                      faiss::METRIC_L2, config);
+    index.train(nlist * 40, trainVecs.data());
+    index.nprobe = 8;
+
+    // growing the lists frees and allocates blocks of repeated sizes
+    for (int i = 0; i < numVecs; i += 1000) {
+      index.add(1000, data.data() + (size_t) i * dim);
+    }
+    index.search(numQuery, query.data(), k, dist.data(), labels.data());
+
+    auto stats = allocator->getStats(device);
+    auto& lists = stats[faiss::gpu::AllocType::IVFLists];
+    EXPECT_GT(lists.numMisses, 0);
+    EXPECT_GT(lists.numHits, 0);
+    EXPECT_GE(lists.bytesAllocated, lists.bytesRequested);
+
+    auto info = res.getMemoryInfo();
+    EXPECT_EQ(1, info[device].count("IVFLists pool hits"));
+  }
+
+  // the allocator does not change the results
+  EXPECT_EQ(refLabels, labels);
+
+  // all blocks were returned to the cache
+  EXPECT_GT(allocator->getCachedMemory(device).first, 0);
+
+  allocator->releaseCachedMemory(device);
+  EXPECT_EQ(0, allocator->getCachedMemory(device).first);
+  EXPECT_EQ(0, allocator->getCachedMemory(device).second);
+}
+
+TEST(TestGpuMemoryAllocator, SetAfterUse) {
+  faiss::gpu::StandardGpuResources res;
+  faiss::gpu::GpuIndexFlatL2 index(&res, 16);
+
+  // the resources are now initialized for the device
+  EXPECT_THROW(
+    res.setMemoryAllocator(
+      std::make_shared<faiss::gpu::CachingGpuMemoryAllocator>()),
+    faiss::FaissException);
+}
+
+TEST(TestGpuMemoryAllocator, PerThreadContexts) {
+  int device = faiss::gpu::randVal(0, faiss::gpu::getNumDevices() - 1);
+  int dim = 64, numVecs = 20000, numQuery = 200, k = 10, numThreads = 4;
+
+  auto data = faiss::gpu::randVecs(numVecs, dim);
+  auto query = faiss::gpu::randVecs(numQuery, dim);
+
+  faiss::gpu::GpuIndexFlatConfig config;
+  config.device = device;
+
+  std::vector<float> refDist(numQuery * k);
+  std::vector<faiss::Index::idx_t> refLabels(numQuery * k);
+
+  {
+    faiss::gpu::StandardGpuResources res;
+    faiss::gpu::GpuIndexFlatL2 index(&res, dim, config);
+    index.add(numVecs, data.data());
+    index.search(numQuery, query.data(), k, refDist.data(), refLabels.data());
+  }
+
+  faiss::gpu::StandardGpuResources res;
+  res.setPerThreadContexts(true, 64 * 1024 * 1024);
+
+  faiss::gpu::GpuIndexFlatL2 index(&res, dim, config);
+  index.add(numVecs, data.data());
+
+  std::vector<std::vector<float>> dist(numThreads);
+  std::vector<std::vector<faiss::Index::idx_t>> labels(numThreads);
+  std::vector<std::thread> threads;
+
+  for (int t = 0; t < numThreads; ++t) {
+    threads.emplace_back([&, t]() {
+      dist[t].resize(numQuery * k);
+      labels[t].resize(numQuery * k);
+      for (int rep = 0; rep < 5; ++rep) {
+        index.search(numQuery, query.data(), k,
+                     dist[t].data(), labels[t].data());
+      }
+    });
+  }
+
+  for (auto& th : threads) {
+    th.join();
+  }
+
+  // each thread searched in its own streams and temporary memory
+  for (int t = 0; t < numThreads; ++t) {
+    EXPECT_EQ(refLabels, labels[t]);
+    EXPECT_EQ(refDist, dist[t]);
+  }
+
+  // cannot be changed once the device is in use
+  EXPECT_THROW(res.setPerThreadContexts(false, 0), faiss::FaissException);
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+
+  // just run with a fixed test seed
+  faiss::gpu::setTestSeed(100);
+
+  return RUN_ALL_TESTS();
+}
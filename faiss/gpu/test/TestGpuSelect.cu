@@ -13,6 +13,7 @@
 #include <faiss/gpu/utils/DeviceTensor.cuh>
 #include <faiss/gpu/utils/DeviceUtils.h>
 #include <faiss/gpu/utils/HostTensor.cuh>
+#include <faiss/gpu/utils/LargeSelect.cuh>
 #include <faiss/gpu/utils/WarpSelectKernel.cuh>
 #include <algorithm>
 #include <gtest/gtest.h>
@@ -20,7 +21,8 @@
 #include <unordered_map>
 #include <vector>
 
-void testForSize(int rows, int cols, int k, bool dir, bool warp) {
+void testForSize(int rows, int cols, int k, bool dir, bool warp,
+                 bool large = false) {
   using namespace faiss::gpu;
 
   StandardGpuResources res;
@@ -67,7 +69,10 @@ void testForSize(int rows, int cols, int k, bool dir, bool warp) {
     gpuOutInd(res.getResources().get(),
               makeDevAlloc(AllocType::Other, 0), {rows, k});
 
-  if (warp) {
+  if (large) {
+    runLargeSelect(gpuVal, gpuOutVal, gpuOutInd, dir, k,
+                   res.getResources().get(), 0);
+  } else if (warp) {
     runWarpSelect(gpuVal, gpuOutVal, gpuOutInd, dir, k, 0);
   } else {
     runBlockSelect(gpuVal, gpuOutVal, gpuOutInd, dir, k, 0);
@@ -191,6 +196,31 @@ TEST(TestGpuSelect, testExactWarp) {
   }
 }
 
+// Test for k > GPU_MAX_SELECTION_K, using the radix-based selection
+TEST(TestGpuSelect, testLarge) {
+  for (int i = 0; i < 5; ++i) {
+    int rows = faiss::gpu::randVal(10, 100);
+    int cols = faiss::gpu::randVal(GPU_MAX_SELECTION_K + 1, 30000);
+    int k = faiss::gpu::randVal(GPU_MAX_SELECTION_K + 1, cols);
+    bool dir = faiss::gpu::randBool();
+
+    testForSize(rows, cols, k, dir, false, true);
+  }
+}
+
+// The radix-based selection also handles small k and k = #cols
+TEST(TestGpuSelect, testLargeSmallK) {
+  for (int i = 0; i < 5; ++i) {
+    int rows = faiss::gpu::randVal(10, 100);
+    int cols = faiss::gpu::randVal(1, 30000);
+    int k = std::min(cols, faiss::gpu::randVal(1, 100));
+    bool dir = faiss::gpu::randBool();
+
+    testForSize(rows, cols, k, dir, false, true);
+    testForSize(rows, cols, cols, dir, false, true);
+  }
+}
+
 int main(int argc, char** argv) {
   testing::InitGoogleTest(&argc, argv);
 
@@ -0,0 +1,139 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#include <faiss/IndexFlat.h>
+#include <faiss/gpu/GpuTenantPool.h>
+#include <faiss/gpu/test/TestUtils.h>
+#include <faiss/gpu/utils/DeviceUtils.h>
+#include <faiss/impl/FaissException.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <vector>
+
+namespace {
+
+constexpr int kDim = 32;
+constexpr int kNumVecs = 2000;
+
+std::unique_ptr<faiss::IndexFlatL2> makeTenant() {
+  std::unique_ptr<faiss::IndexFlatL2> index(new faiss::IndexFlatL2(kDim));
+  auto vecs = faiss::gpu::randVecs(kNumVecs, kDim);
+  index->add(kNumVecs, vecs.data());
+  return index;
+}
+
+}
+
+TEST(TestGpuTenantPool, SearchBatch) {
+  int device = faiss::gpu::randVal(0, faiss::gpu::getNumDevices() - 1);
+  int numTenants = 20, numQuery = 10, k = 5;
+
+  std::vector<std::unique_ptr<faiss::IndexFlatL2>> cpuIndexes;
+  for (int i = 0; i < numTenants; ++i) {
+    cpuIndexes.emplace_back(makeTenant());
+  }
+
+  // Room for all the tenants
+  faiss::gpu::GpuTenantPool pool(device, (size_t) 1 << 30);
+  for (int i = 0; i < numTenants; ++i) {
+    pool.addTenant(i, cpuIndexes[i].get());
+  }
+
+  // Two searches per tenant, that are merged
+  int numSearches = 2 * numTenants;
+  auto query = faiss::gpu::randVecs(numSearches * numQuery, kDim);
+
+  std::vector<float> dist(numSearches * numQuery * k);
+  std::vector<faiss::Index::idx_t> labels(numSearches * numQuery * k);
+  std::vector<faiss::gpu::TenantSearch> searches(numSearches);
+
+  for (int i = 0; i < numSearches; ++i) {
+    auto& s = searches[i];
+    s.tenant = i % numTenants;
+    s.n = numQuery;
+    s.x = query.data() + (size_t) i * numQuery * kDim;
+    s.k = k;
+    s.distances = dist.data() + (size_t) i * numQuery * k;
+    s.labels = labels.data() + (size_t) i * numQuery * k;
+  }
+
+  pool.searchBatch(searches);
+  EXPECT_EQ(numTenants, pool.getNumLoads());
+  EXPECT_EQ(0, pool.getNumEvictions());
+
+  for (int i = 0; i < numSearches; ++i) {
+    std::vector<float> refDist(numQuery * k);
+    std::vector<faiss::Index::idx_t> refLabels(numQuery * k);
+    cpuIndexes[i % numTenants]->search(numQuery, searches[i].x, k,
+                                       refDist.data(), refLabels.data());
+
+    std::vector<faiss::Index::idx_t> gpuLabels(
+      searches[i].labels, searches[i].labels + numQuery * k);
+    EXPECT_EQ(refLabels, gpuLabels);
+  }
+
+  EXPECT_THROW(pool.search(numTenants, 1, query.data(), k,
+                           dist.data(), labels.data()),
+               faiss::FaissException);
+}
+
+TEST(TestGpuTenantPool, Eviction) {
+  int device = faiss::gpu::randVal(0, faiss::gpu::getNumDevices() - 1);
+  int numTenants = 8, k = 5;
+
+  std::vector<std::unique_ptr<faiss::IndexFlatL2>> cpuIndexes;
+  for (int i = 0; i < numTenants; ++i) {
+    cpuIndexes.emplace_back(makeTenant());
+  }
+
+  // Room for 3 tenants
+  size_t tenantBytes =
+    faiss::gpu::GpuTenantPool::estimateGpuBytes(cpuIndexes[0].get());
+  faiss::gpu::GpuTenantPool pool(device, 3 * tenantBytes, 2);
+
+  for (int i = 0; i < numTenants; ++i) {
+    pool.addTenant(i, cpuIndexes[i].get());
+  }
+
+  auto query = faiss::gpu::randVecs(1, kDim);
+  std::vector<float> dist(k);
+  std::vector<faiss::Index::idx_t> labels(k);
+
+  for (int i = 0; i < numTenants; ++i) {
+    pool.search(i, 1, query.data(), k, dist.data(), labels.data());
+    EXPECT_LE(pool.getResidentBytes(), 3 * tenantBytes);
+  }
+
+  // The last 3 tenants searched are resident
+  for (int i = 0; i < numTenants; ++i) {
+    EXPECT_EQ(i >= numTenants - 3, pool.isResident(i));
+  }
+  EXPECT_EQ(numTenants, pool.getNumLoads());
+  EXPECT_EQ(numTenants - 3, pool.getNumEvictions());
+
+  // A search of an evicted tenant reloads it
+  pool.search(0, 1, query.data(), k, dist.data(), labels.data());
+  EXPECT_TRUE(pool.isResident(0));
+  EXPECT_FALSE(pool.isResident(numTenants - 3));
+
+  pool.evict(0);
+  EXPECT_FALSE(pool.isResident(0));
+  EXPECT_EQ(2 * tenantBytes, pool.getResidentBytes());
+
+  pool.removeTenant(numTenants - 1);
+  EXPECT_EQ(tenantBytes, pool.getResidentBytes());
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+
+  // just run with a fixed test seed
+  faiss::gpu::setTestSeed(100);
+
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,74 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+
+#include <faiss/VectorTransform.h>
+#include <faiss/gpu/GpuVectorTransform.h>
+#include <faiss/gpu/StandardGpuResources.h>
+#include <faiss/gpu/test/TestUtils.h>
+#include <faiss/gpu/utils/DeviceUtils.h>
+#include <faiss/utils/distances.h>
+#include <gtest/gtest.h>
+#include <cmath>
+#include <vector>
+
+TEST(TestGpuVectorTransform, PCA) {
+  int device = faiss::gpu::randVal(0, faiss::gpu::getNumDevices() - 1);
+  int dim = 64, dOut = 16, numTrain = 20000;
+  auto xt = faiss::gpu::randVecs(numTrain, dim);
+
+  faiss::PCAMatrix cpuPca(dim, dOut);
+  cpuPca.train(numTrain, xt.data());
+
+  faiss::gpu::StandardGpuResources res;
+  faiss::PCAMatrix gpuPca(dim, dOut);
+  faiss::gpu::trainVectorTransform(&res, device, &gpuPca,
+                                   numTrain, xt.data());
+  EXPECT_EQ(nullptr, gpuPca.train_gemm);
+
+  for (int i = 0; i < dOut; ++i) {
+    EXPECT_NEAR(cpuPca.eigenvalues[i], gpuPca.eigenvalues[i],
+                1e-3 * cpuPca.eigenvalues[0]);
+  }
+}
+
+TEST(TestGpuVectorTransform, OPQ) {
+  int device = faiss::gpu::randVal(0, faiss::gpu::getNumDevices() - 1);
+  int dim = 32, numSub = 4, numTrain = 5000;
+  auto xt = faiss::gpu::randVecs(numTrain, dim);
+
+  faiss::OPQMatrix cpuOpq(dim, numSub);
+  cpuOpq.niter = 5;
+  cpuOpq.train(numTrain, xt.data());
+
+  faiss::gpu::StandardGpuResources res;
+  faiss::OPQMatrix gpuOpq(dim, numSub);
+  gpuOpq.niter = 5;
+  faiss::gpu::trainVectorTransform(&res, device, &gpuOpq,
+                                   numTrain, xt.data());
+  EXPECT_EQ(nullptr, gpuOpq.pq);
+  EXPECT_TRUE(gpuOpq.is_orthonormal);
+
+  // The rotation is orthonormal
+  std::vector<float> ata(dim * dim);
+  for (int i = 0; i < dim; ++i) {
+    for (int j = 0; j < dim; ++j) {
+      ata[i * dim + j] = faiss::fvec_inner_product(
+        gpuOpq.A.data() + i * dim, gpuOpq.A.data() + j * dim, dim);
+      EXPECT_NEAR(i == j ? 1.0f : 0.0f, ata[i * dim + j], 1e-3);
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+
+  // just run with a fixed test seed
+  faiss::gpu::setTestSeed(100);
+
+  return RUN_ALL_TESTS();
+}
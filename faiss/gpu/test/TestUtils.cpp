@@ -7,6 +7,7 @@
 
 
 #include <faiss/gpu/test/TestUtils.h>
+#include <faiss/impl/AuxIndexStructures.h>
 #include <faiss/utils/random.h>
 #include <cmath>
 #include <gtest/gtest.h>
@@ -314,4 +315,48 @@ void compareLists(const float* refDist,
   }
 }
 
+void compareRangeSearch(const faiss::RangeSearchResult& ref,
+                        const faiss::RangeSearchResult& test,
+                        int numQuery,
+                        float radius,
+                        bool isL2,
+                        float maxRelativeError) {
+  for (int q = 0; q < numQuery; ++q) {
+    std::unordered_map<faiss::Index::idx_t, float> refResults;
+    for (size_t i = ref.lims[q]; i < ref.lims[q + 1]; ++i) {
+      refResults[ref.labels[i]] = ref.distances[i];
+    }
+
+    for (size_t i = test.lims[q]; i < test.lims[q + 1]; ++i) {
+      float d = test.distances[i];
+      EXPECT_TRUE(isL2 ? d < radius : d > radius);
+
+      auto it = refResults.find(test.labels[i]);
+      if (it != refResults.end()) {
+        EXPECT_LE(relativeError(d, it->second), maxRelativeError);
+      } else {
+        // Only near the radius
+        EXPECT_LE(relativeError(d, radius), maxRelativeError)
+          << "query " << q << " label " << test.labels[i];
+      }
+    }
+
+    // The ref results missing from test are near the radius as well
+    for (size_t i = ref.lims[q]; i < ref.lims[q + 1]; ++i) {
+      bool found = false;
+      for (size_t j = test.lims[q]; j < test.lims[q + 1]; ++j) {
+        if (test.labels[j] == ref.labels[i]) {
+          found = true;
+          break;
+        }
+      }
+
+      if (!found) {
+        EXPECT_LE(relativeError(ref.distances[i], radius), maxRelativeError)
+          << "query " << q << " label " << ref.labels[i];
+      }
+    }
+  }
+}
+
 } }
@@ -81,6 +81,15 @@ void compareIndices(faiss::Index& refIndex,
                     float pctMaxDiff1 = 0.1f,
                     float pctMaxDiffN = 0.005f);
 
+/// Compare two range search results; entries may only be missing from either
+/// side if their distance is within maxRelativeError of the radius
+void compareRangeSearch(const faiss::RangeSearchResult& ref,
+                        const faiss::RangeSearchResult& test,
+                        int numQuery,
+                        float radius,
+                        bool isL2,
+                        float maxRelativeError);
+
 /// Display specific differences in the two (distance, index) lists
 void compareLists(const float* refDist,
                   const faiss::Index::idx_t* refInd,
@@ -10,6 +10,12 @@ import unittest
 import numpy as np
 import faiss
 import math
+from multiprocessing.pool import ThreadPool
+
+try:
+    import torch
+except ImportError:
+    torch = None
 
 class EvalIVFPQAccuracy(unittest.TestCase):
 
@@ -661,5 +667,86 @@ class TestIVFIndices(unittest.TestCase):
         # This will strip the high bit
         self.assertTrue(np.array_equal(xb_indices_base[10:20], I[:, 0]))
 
+
+class TestThreadedSearch(unittest.TestCase):
+
+    def test_python_threads(self):
+        # the GPU wrappers release the GIL: searches from several Python
+        # threads run concurrently, each with its own GPU context
+        d = 32
+        nb = 5000
+        rs = np.random.RandomState(123)
+        xb = rs.rand(nb, d).astype('float32')
+        xq = rs.rand(400, d).astype('float32')
+
+        res = faiss.StandardGpuResources()
+        res.setPerThreadContexts(True, 64 * 1024 * 1024)
+        index = faiss.GpuIndexIVFFlat(res, d, 16, faiss.METRIC_L2)
+        index.train(xb)
+        index.add(xb)
+        index.setNumProbes(4)
+        res.syncDefaultStreamCurrentDevice()
+
+        Dref, Iref = index.search(xq, 10)
+
+        def search(i):
+            return index.search(xq[i * 100:(i + 1) * 100], 10)
+
+        results = ThreadPool(4).map(search, range(4))
+        D = np.vstack([r[0] for r in results])
+        I = np.vstack([r[1] for r in results])
+        np.testing.assert_array_equal(I, Iref)
+        np.testing.assert_array_equal(D, Dref)
+
+
+@unittest.skipIf(torch is None, "arrays in CUDA memory are made with torch")
+class TestCudaArrayInterface(unittest.TestCase):
+
+    def test_search(self):
+        # torch.Tensor is used through __cuda_array_interface__ only, as
+        # contrib.torch_utils is not imported
+        d = 32
+        rs = np.random.RandomState(123)
+        xb = rs.rand(2000, d).astype('float32')
+        xq = rs.rand(50, d).astype('float32')
+        ids = np.arange(2000, dtype='int64') + 1000
+
+        index = faiss.GpuIndexIVFFlat(
+            faiss.StandardGpuResources(), d, 16, faiss.METRIC_L2)
+        index.train(xb)
+        index.add_with_ids(xb, ids)
+        index.setNumProbes(4)
+        Dref, Iref = index.search(xq, 10)
+
+        dev = torch.device('cuda', index.getDevice())
+        xb_gpu = torch.from_numpy(xb).to(dev)
+        xq_gpu = torch.from_numpy(xq).to(dev)
+        ids_gpu = torch.from_numpy(ids).to(dev)
+
+        index.reset()
+        index.add_with_ids(xb_gpu, ids_gpu)
+
+        # outputs in host memory
+        D, I = index.search(xq_gpu, 10)
+        np.testing.assert_array_equal(I, Iref)
+        np.testing.assert_array_equal(D, Dref)
+
+        # pre-allocated outputs in device memory
+        D_gpu = torch.empty(50, 10, device=dev, dtype=torch.float32)
+        I_gpu = torch.empty(50, 10, device=dev, dtype=torch.int64)
+        D2, I2 = index.search(xq_gpu, 10, D=D_gpu, I=I_gpu)
+        self.assertIs(D2, D_gpu)
+        np.testing.assert_array_equal(I_gpu.cpu().numpy(), Iref)
+        np.testing.assert_array_equal(D_gpu.cpu().numpy(), Dref)
+
+        # only C-contiguous float32 arrays are accepted
+        self.assertRaises(AssertionError, index.search, xq_gpu.half(), 10)
+
+        lims, _, I = index.range_search(xq_gpu, 4.0)
+        lims_ref, _, I_ref = index.range_search(xq, 4.0)
+        np.testing.assert_array_equal(lims, lims_ref)
+        np.testing.assert_array_equal(np.sort(I), np.sort(I_ref))
+
+
 if __name__ == '__main__':
     unittest.main()
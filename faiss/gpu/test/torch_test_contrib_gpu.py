@@ -201,8 +201,54 @@ class TestTorchUtilsGPU(unittest.TestCase):
 
     # tests range_search
     def test_range_search(self):
-        # This is not currently implemented on GPU indices
-        return
+        torch.manual_seed(10)
+        d = 32
+        res = faiss.StandardGpuResources()
+        res.noTempMemory()
+
+        index = faiss.GpuIndexFlatL2(res, d)
+        xb = torch.rand(1000, d, device=torch.device('cuda', 0), dtype=torch.float32)
+        index.add(xb)
+        xq = xb[:20]
+
+        lims, D, I = index.range_search(xq, 1.0)
+
+        # the results are CPU tensors
+        self.assertFalse(lims.is_cuda)
+        self.assertEqual(lims.shape, (21, ))
+
+        cpu_index = faiss.IndexFlatL2(d)
+        cpu_index.add(xb.cpu())
+        lims_ref, D_ref, I_ref = cpu_index.range_search(xq.cpu(), 1.0)
+        self.assertTrue(torch.equal(lims, lims_ref))
+        for i in range(20):
+            ref = set(I_ref[lims_ref[i]:lims_ref[i + 1]].tolist())
+            new = set(I[lims[i]:lims[i + 1]].tolist())
+            self.assertEqual(ref, new)
+
+    # tests CUDA tensors that are not contiguous float32
+    def test_convert_on_device(self):
+        torch.manual_seed(10)
+        d = 32
+        res = faiss.StandardGpuResources()
+        res.noTempMemory()
+
+        index = faiss.GpuIndexFlatL2(res, d)
+        xb = torch.rand(1000, d, device=torch.device('cuda', 0), dtype=torch.float32)
+        index.add(xb.half())
+
+        xq = xb[:10].half()
+        D, I = index.search(xq, 5)
+        D_ref, I_ref = index.search(xq.float(), 5)
+        self.assertTrue(torch.equal(I, I_ref))
+        self.assertTrue(torch.equal(D, D_ref))
+
+        # column-major queries
+        xq = to_column_major_torch(xb[:10])
+        D, I = index.search(xq, 5)
+        D_ref, I_ref = index.search(xb[:10].contiguous(), 5)
+        self.assertTrue(torch.equal(I, I_ref))
+        self.assertTrue(torch.equal(D, D_ref))
 
     # tests search_and_reconstruct
     def test_search_and_reconstruct(self):
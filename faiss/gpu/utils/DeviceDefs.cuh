@@ -50,4 +50,8 @@ __forceinline__ __device__ void warpFence() {
 #define GPU_MAX_SELECTION_K 1024
 #endif
 
+// Maximum k for the radix-based selection (LargeSelect.cuh), which the
+// brute-force and IVF searches use above GPU_MAX_SELECTION_K
+#define GPU_MAX_LARGE_SELECTION_K 65536
+
 } } // namespace
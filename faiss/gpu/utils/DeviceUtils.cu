@@ -154,6 +154,10 @@ int getMaxKSelection() {
   return GPU_MAX_SELECTION_K;
 }
 
+int getMaxLargeKSelection() {
+  return GPU_MAX_LARGE_SELECTION_K;
+}
+
 DeviceScope::DeviceScope(int device) {
   prevDevice_ = getCurrentDevice();
 
@@ -75,6 +75,11 @@ bool getTensorCoreSupportCurrentDevice();
 /// non-CUDA files
 int getMaxKSelection();
 
+/// Returns the maximum k-selection value supported by the indices that fall
+/// back to a radix-based selection beyond getMaxKSelection() (GpuIndexFlat,
+/// GpuIndexIVFFlat, GpuIndexIVFScalarQuantizer, GpuIndexIVFPQ)
+int getMaxLargeKSelection();
+
 /// RAII object to set the current device, and restore the previous
 /// device upon destruction
 class DeviceScope {
@@ -96,11 +96,15 @@ class DeviceVector {
   }
 
   // Returns true if we actually reallocated memory
-  bool resize(size_t newSize, cudaStream_t stream) {
+  // If `reserveExact` is true, then we reserve only the memory that
+  // we need for the new size
+  bool resize(size_t newSize,
+              cudaStream_t stream,
+              bool reserveExact = false) {
     bool mem = false;
 
     if (num_ < newSize) {
-      mem = reserve(getNewCapacity_(newSize), stream);
+      mem = reserve(reserveExact ? newSize : getNewCapacity_(newSize), stream);
     }
 
     // Don't bother zero initializing the newly accessible memory
@@ -0,0 +1,129 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <faiss/gpu/utils/LargeSelect.cuh>
+#include <cub/device/device_segmented_radix_sort.cuh>
+
+namespace faiss { namespace gpu {
+
+// Segment boundaries of the rows of a contiguous (rows x k) matrix
+__global__ void largeSelectRowOffsets(int* offsets, int numRows, int k) {
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+
+  if (i <= numRows) {
+    offsets[i] = i * k;
+  }
+}
+
+// Copies the contiguous sorted results into the (possibly strided) output
+__global__ void largeSelectCopyOut(Tensor<float, 2, true> sortedK,
+                                   Tensor<int, 2, true> sortedV,
+                                   Tensor<float, 2, true> outK,
+                                   Tensor<int, 2, true> outV) {
+  int row = blockIdx.y;
+
+  for (int i = blockIdx.x * blockDim.x + threadIdx.x;
+       i < sortedK.getSize(1);
+       i += gridDim.x * blockDim.x) {
+    outK[row][i] = sortedK[row][i];
+    outV[row][i] = sortedV[row][i];
+  }
+}
+
+void runLargeSelectSort(Tensor<float, 2, true>& selK,
+                        Tensor<int, 2, true>& selV,
+                        Tensor<float, 2, true>& outK,
+                        Tensor<int, 2, true>& outV,
+                        bool dir,
+                        GpuResources* res,
+                        cudaStream_t stream) {
+  int numRows = selK.getSize(0);
+  int k = selK.getSize(1);
+
+  DeviceTensor<int, 1, true> offsets(
+    res, makeTempAlloc(AllocType::Other, stream), {numRows + 1});
+
+  int numThreads = std::min(numRows + 1, getMaxThreadsCurrentDevice());
+  largeSelectRowOffsets<<<utils::divUp(numRows + 1, numThreads), numThreads,
+    0, stream>>>(offsets.data(), numRows, k);
+
+  DeviceTensor<float, 2, true> sortedK(
+    res, makeTempAlloc(AllocType::Other, stream), {numRows, k});
+  DeviceTensor<int, 2, true> sortedV(
+    res, makeTempAlloc(AllocType::Other, stream), {numRows, k});
+
+#define RUN_SORT(FN, TEMP, TEMP_BYTES)                                  \
+  do {                                                                  \
+    CUDA_VERIFY(cub::DeviceSegmentedRadixSort::FN(                      \
+                  TEMP, TEMP_BYTES,                                     \
+                  selK.data(), sortedK.data(),                          \
+                  selV.data(), sortedV.data(),                          \
+                  numRows * k, numRows,                                 \
+                  offsets.data(), offsets.data() + 1,                   \
+                  0, sizeof(float) * 8, stream));                       \
+  } while (0)
+
+  size_t tempBytes = 0;
+
+  if (dir) {
+    RUN_SORT(SortPairsDescending, nullptr, tempBytes);
+  } else {
+    RUN_SORT(SortPairs, nullptr, tempBytes);
+  }
+
+  DeviceTensor<char, 1, true> temp(
+    res, makeTempAlloc(AllocType::Other, stream), {(int) tempBytes});
+
+  if (dir) {
+    RUN_SORT(SortPairsDescending, temp.data(), tempBytes);
+  } else {
+    RUN_SORT(SortPairs, temp.data(), tempBytes);
+  }
+
+#undef RUN_SORT
+
+  auto block = dim3(std::min(k, getMaxThreadsCurrentDevice()));
+  auto grid = dim3(std::min(utils::divUp(k, (int) block.x), 16), numRows);
+
+  largeSelectCopyOut<<<grid, block, 0, stream>>>(sortedK, sortedV, outK, outV);
+  CUDA_TEST_ERROR();
+}
+
+void runLargeSelect(Tensor<float, 2, true>& in,
+                    Tensor<float, 2, true>& outK,
+                    Tensor<int, 2, true>& outV,
+                    bool dir, int k,
+                    GpuResources* res,
+                    cudaStream_t stream) {
+  LargeSelectDenseRows rows;
+  rows.keys = in.data();
+  rows.values = nullptr;
+  rows.stride = in.getStride(0);
+  rows.num = in.getSize(1);
+
+  runLargeSelectRows(rows, in.getSize(0), outK, outV, dir, k, res, stream);
+}
+
+void runLargeSelectPair(Tensor<float, 2, true>& inK,
+                        Tensor<int, 2, true>& inV,
+                        Tensor<float, 2, true>& outK,
+                        Tensor<int, 2, true>& outV,
+                        bool dir, int k,
+                        GpuResources* res,
+                        cudaStream_t stream) {
+  FAISS_ASSERT(inK.getStride(0) == inV.getStride(0));
+
+  LargeSelectDenseRows rows;
+  rows.keys = inK.data();
+  rows.values = inV.data();
+  rows.stride = inK.getStride(0);
+  rows.num = inK.getSize(1);
+
+  runLargeSelectRows(rows, inK.getSize(0), outK, outV, dir, k, res, stream);
+}
+
+} } // namespace
@@ -0,0 +1,228 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <faiss/gpu/GpuResources.h>
+#include <faiss/gpu/utils/DeviceDefs.cuh>
+#include <faiss/gpu/utils/DeviceTensor.cuh>
+#include <faiss/gpu/utils/DeviceUtils.h>
+#include <faiss/gpu/utils/Limits.cuh>
+#include <faiss/gpu/utils/StaticUtils.h>
+#include <faiss/gpu/utils/Tensor.cuh>
+
+//
+// k-selection for k > GPU_MAX_SELECTION_K, where the register and shared
+// memory queues of WarpSelect / BlockSelect no longer fit.
+//
+// Each row is handled by a block that radix-selects the k-th smallest (or
+// largest) key in four passes of 8 bits over the row, then gathers the keys
+// that precede it. The k results of all rows are finally sorted with a cub
+// segmented radix sort.
+//
+
+namespace faiss { namespace gpu {
+
+/// Threads per row in the large-k selection kernel
+constexpr int kLargeSelectThreads = 256;
+
+/// Maps a float to an unsigned integer whose order is the selection order:
+/// ascending for Dir = false (smallest first), descending for Dir = true
+template <bool Dir>
+inline __device__ unsigned int largeSelectOrderedKey(float v) {
+  unsigned int u = __float_as_uint(v);
+  u = (u & 0x80000000U) ? ~u : (u | 0x80000000U);
+  return Dir ? ~u : u;
+}
+
+/// Rows of a row-major matrix of keys; the value of an entry is its column,
+/// or the matching entry of a value matrix if given
+struct LargeSelectDenseRows {
+  const float* keys;
+  const int* values;
+  int stride;
+  int num;
+
+  inline __device__ int begin(int row) const {
+    return row * stride;
+  }
+
+  inline __device__ int end(int row) const {
+    return row * stride + num;
+  }
+
+  inline __device__ int value(int row, int pos) const {
+    return values ? values[pos] : pos - row * stride;
+  }
+};
+
+/// Per-row radix select; `outK` / `outV` receive the k selected entries of
+/// each row in no particular order, padded with (initK, -1) for rows with
+/// fewer than k entries
+template <bool Dir, typename Rows>
+__global__ void largeSelectRows(Rows rows,
+                                int k,
+                                Tensor<float, 2, true> outK,
+                                Tensor<int, 2, true> outV) {
+  __shared__ int smemHist[256];
+  __shared__ unsigned int smemPrefix;
+  __shared__ int smemRemaining;
+  __shared__ int smemNumBefore;
+  __shared__ int smemNumEqual;
+
+  constexpr float kInit = Dir ? kFloatMin : kFloatMax;
+
+  int row = blockIdx.x;
+  int begin = rows.begin(row);
+  int end = rows.end(row);
+  int num = end - begin;
+
+  if (num <= k) {
+    // All entries are selected
+    for (int i = threadIdx.x; i < k; i += blockDim.x) {
+      bool valid = i < num;
+      outK[row][i] = valid ? rows.keys[begin + i] : kInit;
+      outV[row][i] = valid ? rows.value(row, begin + i) : -1;
+    }
+
+    return;
+  }
+
+  // Find the ordered key of the k-th entry, 8 bits at a time from the most
+  // significant bits; `remaining` is its rank among the entries sharing the
+  // prefix found so far
+  unsigned int prefix = 0;
+  unsigned int mask = 0;
+  int remaining = k;
+
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    for (int i = threadIdx.x; i < 256; i += blockDim.x) {
+      smemHist[i] = 0;
+    }
+
+    __syncthreads();
+
+    for (int i = begin + threadIdx.x; i < end; i += blockDim.x) {
+      unsigned int u = largeSelectOrderedKey<Dir>(rows.keys[i]);
+
+      if ((u & mask) == prefix) {
+        atomicAdd(&smemHist[(u >> shift) & 0xffU], 1);
+      }
+    }
+
+    __syncthreads();
+
+    if (threadIdx.x == 0) {
+      int r = remaining;
+      unsigned int bucket = 0;
+
+      for (; bucket < 255; ++bucket) {
+        if (smemHist[bucket] >= r) {
+          break;
+        }
+
+        r -= smemHist[bucket];
+      }
+
+      smemPrefix = prefix | (bucket << shift);
+      smemRemaining = r;
+      smemNumBefore = 0;
+      smemNumEqual = 0;
+    }
+
+    __syncthreads();
+
+    prefix = smemPrefix;
+    remaining = smemRemaining;
+    mask |= 0xffU << shift;
+  }
+
+  // `prefix` is now the full ordered key of the k-th entry. All entries
+  // before it are selected, along with the first `remaining` entries equal to
+  // it
+  int numBefore = k - remaining;
+
+  for (int i = begin + threadIdx.x; i < end; i += blockDim.x) {
+    float key = rows.keys[i];
+    unsigned int u = largeSelectOrderedKey<Dir>(key);
+    int pos = -1;
+
+    if (u < prefix) {
+      pos = atomicAdd(&smemNumBefore, 1);
+    } else if (u == prefix) {
+      int equal = atomicAdd(&smemNumEqual, 1);
+      pos = equal < remaining ? numBefore + equal : -1;
+    }
+
+    if (pos >= 0) {
+      outK[row][pos] = key;
+      outV[row][pos] = rows.value(row, i);
+    }
+  }
+}
+
+/// Sorts the k selected entries of each row of `selK` / `selV` (which are
+/// contiguous) into `outK` / `outV`
+void runLargeSelectSort(Tensor<float, 2, true>& selK,
+                        Tensor<int, 2, true>& selV,
+                        Tensor<float, 2, true>& outK,
+                        Tensor<int, 2, true>& outV,
+                        bool dir,
+                        GpuResources* res,
+                        cudaStream_t stream);
+
+/// Selects the k entries of each row described by `rows`, sorted, into
+/// `outK` / `outV`
+template <typename Rows>
+void runLargeSelectRows(Rows rows,
+                        int numRows,
+                        Tensor<float, 2, true>& outK,
+                        Tensor<int, 2, true>& outV,
+                        bool dir,
+                        int k,
+                        GpuResources* res,
+                        cudaStream_t stream) {
+  FAISS_ASSERT(outK.getSize(0) == numRows && outK.getSize(1) == k);
+  FAISS_ASSERT(outV.getSize(0) == numRows && outV.getSize(1) == k);
+
+  DeviceTensor<float, 2, true> selK(
+    res, makeTempAlloc(AllocType::Other, stream), {numRows, k});
+  DeviceTensor<int, 2, true> selV(
+    res, makeTempAlloc(AllocType::Other, stream), {numRows, k});
+
+  auto grid = dim3(numRows);
+  auto block = dim3(kLargeSelectThreads);
+
+  if (dir) {
+    largeSelectRows<true><<<grid, block, 0, stream>>>(rows, k, selK, selV);
+  } else {
+    largeSelectRows<false><<<grid, block, 0, stream>>>(rows, k, selK, selV);
+  }
+
+  CUDA_TEST_ERROR();
+
+  runLargeSelectSort(selK, selV, outK, outV, dir, res, stream);
+}
+
+/// Equivalent of runBlockSelect for any k
+void runLargeSelect(Tensor<float, 2, true>& in,
+                    Tensor<float, 2, true>& outKeys,
+                    Tensor<int, 2, true>& outIndices,
+                    bool dir, int k,
+                    GpuResources* res,
+                    cudaStream_t stream);
+
+/// Equivalent of runBlockSelectPair for any k
+void runLargeSelectPair(Tensor<float, 2, true>& inKeys,
+                        Tensor<int, 2, true>& inIndices,
+                        Tensor<float, 2, true>& outKeys,
+                        Tensor<int, 2, true>& outIndices,
+                        bool dir, int k,
+                        GpuResources* res,
+                        cudaStream_t stream);
+
+} } // namespace
@@ -29,6 +29,32 @@ struct GetCudaType<half> {
   static constexpr cudaDataType_t Type = CUDA_R_16F;
 };
 
+// f16 x f16 products with f32 accumulation are run on tensor cores where
+// available; this loses no precision beyond that of the f16 inputs, unlike
+// tensor core math for f32 inputs (see
+// StandardGpuResources::setTensorCoreMath).
+// On CUDA 11 and later, cuBLAS picks tensor core kernels for f16 inputs with
+// the default algorithm and the 32F compute type (the _TENSOR_OP algorithms
+// are deprecated and behave as the default ones). Before CUDA 11, tensor
+// cores are only used with a _TENSOR_OP algorithm or math mode.
+#if CUDA_VERSION >= 11000
+constexpr cublasComputeType_t kGemmCompute32F = CUBLAS_COMPUTE_32F;
+#else
+constexpr cudaDataType_t kGemmCompute32F = CUDA_R_32F;
+#endif
+
+template <typename AT, typename BT>
+struct GetGemmAlgo {
+  static constexpr cublasGemmAlgo_t Algo = CUBLAS_GEMM_DEFAULT;
+};
+
+#if CUDA_VERSION < 11000
+template <>
+struct GetGemmAlgo<half, half> {
+  static constexpr cublasGemmAlgo_t Algo = CUBLAS_GEMM_DEFAULT_TENSOR_OP;
+};
+#endif
+
 template <typename AT, typename BT>
 cublasStatus_t
 rawGemm(cublasHandle_t handle,
@@ -56,6 +82,31 @@ rawGemm(cublasHandle_t handle,
                        C, CUDA_R_32F, ldc);
 }
 
+template <>
+inline cublasStatus_t
+rawGemm<half, half>(cublasHandle_t handle,
+                    cublasOperation_t transa,
+                    cublasOperation_t transb,
+                    int m,
+                    int n,
+                    int k,
+                    const float fAlpha,
+                    const void *A,
+                    int lda,
+                    const void *B,
+                    int ldb,
+                    const float fBeta,
+                    float *C,
+                    int ldc) {
+  // Always accumulate in f32, on tensor cores
+  return cublasGemmEx(handle, transa, transb, m, n, k,
+                      &fAlpha, A, CUDA_R_16F, lda,
+                      B, CUDA_R_16F, ldb,
+                      &fBeta,
+                      C, CUDA_R_32F, ldc,
+                      kGemmCompute32F, GetGemmAlgo<half, half>::Algo);
+}
+
 template <typename AT, typename BT>
 cublasStatus_t
 rawBatchGemm(cublasHandle_t handle,
@@ -84,7 +135,7 @@ rawBatchGemm(cublasHandle_t handle,
                                     &fAlpha, A, cAT, lda, strideA,
                                     B, cBT, ldb, strideB, &fBeta,
                                     C, CUDA_R_32F, ldc, strideC, batchCount,
-                                    CUDA_R_32F, CUBLAS_GEMM_DEFAULT);
+                                    kGemmCompute32F, GetGemmAlgo<AT, BT>::Algo);
 }
 
 template <typename AT, typename BT>
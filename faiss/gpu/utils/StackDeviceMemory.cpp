@@ -10,6 +10,7 @@
 #include <faiss/gpu/utils/DeviceUtils.h>
 #include <faiss/gpu/utils/StaticUtils.h>
 #include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/instrumentation.h>
 #include <sstream>
 
 namespace faiss { namespace gpu {
@@ -123,6 +124,10 @@ StackDeviceMemory::Stack::getAlloc(size_t size,
 
   highWaterMemoryUsed_ = std::max(highWaterMemoryUsed_,
                                   (size_t) (head_ - start_));
+  if (faiss::instrumentation_enabled) {
+    // the usage since the statistics were last reset
+    faiss::instrumentation_peak(PEAK_GPU_TEMP_MEM, head_ - start_);
+  }
   FAISS_ASSERT(startAlloc);
   return startAlloc;
 }
@@ -9,6 +9,11 @@
 #include <faiss/gpu/utils/Timer.h>
 #include <faiss/gpu/utils/DeviceUtils.h>
 #include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/instrumentation.h>
+
+#ifdef FAISS_ENABLE_NVTX
+#include <nvToolsExt.h>
+#endif
 
 namespace faiss { namespace gpu {
 
@@ -42,6 +47,52 @@ KernelTimer::elapsedMilliseconds() {
   return time;
 }
 
+GpuStageTimer::GpuStageTimer(int stage, cudaStream_t stream)
+    : stage_(stage),
+      stream_(stream),
+      startEvent_(0),
+      active_(true),
+      timing_(faiss::instrumentation_enabled) {
+#ifdef FAISS_ENABLE_NVTX
+  nvtxRangePushA(InstrumentationStats::stage_name(stage_));
+#endif
+
+  if (timing_) {
+    CUDA_VERIFY(cudaEventCreate(&startEvent_));
+    CUDA_VERIFY(cudaEventRecord(startEvent_, stream_));
+  }
+}
+
+GpuStageTimer::~GpuStageTimer() {
+  stop();
+}
+
+void
+GpuStageTimer::stop() {
+  if (!active_) {
+    return;
+  }
+  active_ = false;
+
+#ifdef FAISS_ENABLE_NVTX
+  nvtxRangePop();
+#endif
+
+  if (timing_) {
+    cudaEvent_t stopEvent;
+    CUDA_VERIFY(cudaEventCreate(&stopEvent));
+    CUDA_VERIFY(cudaEventRecord(stopEvent, stream_));
+    CUDA_VERIFY(cudaEventSynchronize(stopEvent));
+
+    auto time = 0.0f;
+    CUDA_VERIFY(cudaEventElapsedTime(&time, startEvent_, stopEvent));
+    CUDA_VERIFY(cudaEventDestroy(stopEvent));
+    CUDA_VERIFY(cudaEventDestroy(startEvent_));
+
+    faiss::instrumentation_record(stage_, time);
+  }
+}
+
 CpuTimer::CpuTimer() {
   clock_gettime(CLOCK_REALTIME, &start_);
 }
@@ -36,6 +36,35 @@ class KernelTimer {
   bool valid_;
 };
 
+/// Marks a stage (faiss::InstrumentedStage) of a GPU search or add. If faiss
+/// is built with FAISS_ENABLE_NVTX, an NVTX range named after the stage is
+/// open between construction and stop(), so that the kernels are attributed
+/// to the stage in Nsight. If faiss::instrumentation_enabled, the GPU time of
+/// the work queued on `stream` in between is recorded in the instrumentation
+/// statistics; this synchronizes on the stream, so the timing (unlike the
+/// NVTX ranges) is not compatible with CUDA graph capture.
+class GpuStageTimer {
+ public:
+  GpuStageTimer(int stage, cudaStream_t stream);
+
+  /// Calls stop()
+  ~GpuStageTimer();
+
+  /// Ends the stage; can be called several times
+  void stop();
+
+ private:
+  int stage_;
+  cudaStream_t stream_;
+  cudaEvent_t startEvent_;
+
+  /// Whether the stage is in progress
+  bool active_;
+
+  /// Whether startEvent_ was recorded
+  bool timing_;
+};
+
 /// CPU wallclock elapsed timer
 class CpuTimer {
  public:
@@ -0,0 +1,279 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/impl/AdditiveQuantizer.h>
+
+#include <cmath>
+#include <cstring>
+
+#include <algorithm>
+
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/pq_code_distance.h>
+#include <faiss/utils/distances.h>
+#include <faiss/utils/hamming.h>
+#include <faiss/utils/utils.h>
+
+
+extern "C" {
+
+// this is to keep the clang syntax checker happy
+#ifndef FINTEGER
+#define FINTEGER int
+#endif
+
+/* declare BLAS functions, see http://www.netlib.org/clapack/cblas/ */
+
+int sgemm_ (const char *transa, const char *transb, FINTEGER *m, FINTEGER *
+            n, FINTEGER *k, const float *alpha, const float *a,
+            FINTEGER *lda, const float *b, FINTEGER *
+            ldb, float *beta, float *c, FINTEGER *ldc);
+
+}
+
+
+namespace faiss {
+
+
+AdditiveQuantizer::AdditiveQuantizer (size_t d, size_t M, size_t nbits,
+                                      Search_type_t search_type):
+    d (d), M (M), nbits (nbits),
+    verbose (false), is_trained (false),
+    search_type (search_type),
+    norm_min (NAN), norm_max (NAN)
+{
+    set_derived_values ();
+}
+
+AdditiveQuantizer::AdditiveQuantizer ():
+    AdditiveQuantizer (0, 1, 8)
+{}
+
+void AdditiveQuantizer::set_derived_values ()
+{
+    FAISS_THROW_IF_NOT_MSG (nbits > 0 && nbits <= 16,
+                            "nbits should be in 1..16");
+    K = size_t(1) << nbits;
+    norm_bits =
+        search_type == ST_norm_float ? 32 :
+        search_type == ST_norm_qint8 ? 8 : 0;
+    tot_bits = M * nbits + norm_bits;
+    code_size = (tot_bits + 7) / 8;
+}
+
+AdditiveQuantizer::~AdditiveQuantizer ()
+{}
+
+
+/****************************************************************
+ * Packing, decoding
+ ****************************************************************/
+
+uint64_t AdditiveQuantizer::encode_norm (float norm) const
+{
+    switch (search_type) {
+    case ST_norm_float: {
+        uint32_t bits;
+        memcpy (&bits, &norm, 4);
+        return bits;
+    }
+    case ST_norm_qint8: {
+        float v = (norm - norm_min) / (norm_max - norm_min) * 255;
+        v = std::max (0.f, std::min (255.f, std::round (v)));
+        return uint64_t (v);
+    }
+    default:
+        return 0;
+    }
+}
+
+float AdditiveQuantizer::decode_norm (const uint8_t *code) const
+{
+    BitstringReader bsr (code, code_size);
+    bsr.i = M * nbits;
+    uint64_t v = bsr.read (norm_bits);
+    switch (search_type) {
+    case ST_norm_float: {
+        uint32_t bits = v;
+        float norm;
+        memcpy (&norm, &bits, 4);
+        return norm;
+    }
+    case ST_norm_qint8:
+        return norm_min + (norm_max - norm_min) * v / 255.f;
+    default:
+        return 0;
+    }
+}
+
+void AdditiveQuantizer::train_norm (size_t n, const float *norms)
+{
+    if (n == 0) {
+        return;
+    }
+    norm_min = norm_max = norms[0];
+    for (size_t i = 1; i < n; i++) {
+        norm_min = std::min (norm_min, norms[i]);
+        norm_max = std::max (norm_max, norms[i]);
+    }
+    if (norm_max == norm_min) {
+        norm_max = norm_min + 1;
+    }
+}
+
+void AdditiveQuantizer::pack_codes (size_t n, const int32_t *codes,
+                                    uint8_t *packed_codes,
+                                    const float *norms) const
+{
+    FAISS_THROW_IF_NOT (norm_bits == 0 || norms);
+
+#pragma omp parallel for if (n > 1000)
+    for (int64_t i = 0; i < n; i++) {
+        const int32_t *codes1 = codes + i * M;
+        BitstringWriter bsw (packed_codes + i * code_size, code_size);
+        for (size_t m = 0; m < M; m++) {
+            bsw.write (codes1[m], nbits);
+        }
+        if (norm_bits > 0) {
+            bsw.write (encode_norm (norms[i]), norm_bits);
+        }
+    }
+}
+
+void AdditiveQuantizer::decode (const uint8_t *codes, float *x,
+                                size_t n) const
+{
+    FAISS_THROW_IF_NOT_MSG (is_trained, "quantizer not trained");
+
+#pragma omp parallel for if (n > 1000)
+    for (int64_t i = 0; i < n; i++) {
+        BitstringReader bsr (codes + i * code_size, code_size);
+        float *xi = x + i * d;
+        for (size_t m = 0; m < M; m++) {
+            int idx = bsr.read (nbits);
+            const float *c = codebooks.data() + (m * K + idx) * d;
+            if (m == 0) {
+                memcpy (xi, c, sizeof (*x) * d);
+            } else {
+                fvec_madd (d, xi, 1.0, c, xi);
+            }
+        }
+    }
+}
+
+void AdditiveQuantizer::decode_unpacked (const int32_t *codes, float *x,
+                                         size_t n) const
+{
+#pragma omp parallel for if (n > 1000)
+    for (int64_t i = 0; i < n; i++) {
+        const int32_t *codesi = codes + i * M;
+        float *xi = x + i * d;
+        for (size_t m = 0; m < M; m++) {
+            const float *c = codebooks.data() + (m * K + codesi[m]) * d;
+            if (m == 0) {
+                memcpy (xi, c, sizeof (*x) * d);
+            } else {
+                fvec_madd (d, xi, 1.0, c, xi);
+            }
+        }
+    }
+}
+
+void AdditiveQuantizer::compute_norms (const int32_t *codes, size_t n,
+                                       const float *centroids,
+                                       float *norms) const
+{
+    std::vector<float> x (n * d);
+    decode_unpacked (codes, x.data(), n);
+    if (centroids) {
+        fvec_madd (n * d, x.data(), 1.0, centroids, x.data());
+    }
+    fvec_norms_L2sqr (norms, x.data(), d, n);
+}
+
+
+/****************************************************************
+ * Look-up tables
+ ****************************************************************/
+
+void AdditiveQuantizer::compute_LUT (size_t n, const float *xq,
+                                     float *LUT) const
+{
+    // LUT = xq * codebooks^T, in column-major: codebooks^T * xq
+    FINTEGER nqi = n, ncb = M * K, di = d;
+    float one = 1, zero = 0;
+
+    sgemm_ ("Transposed", "Not transposed",
+            &ncb, &nqi, &di,
+            &one, codebooks.data(), &di,
+            xq, &di,
+            &zero, LUT, &ncb);
+}
+
+bool AdditiveQuantizer::scan_8bit () const
+{
+    return nbits == 8 && (norm_bits == 0 || norm_bits == 8);
+}
+
+size_t AdditiveQuantizer::scan_tables_size () const
+{
+    return scan_8bit () ? code_size * 256 : M * K;
+}
+
+void AdditiveQuantizer::compute_scan_tables (const float *LUT, bool is_IP,
+                                             float *tables) const
+{
+    if (is_IP) {
+        memcpy (tables, LUT, sizeof (*LUT) * M * K);
+    } else {
+        for (size_t i = 0; i < M * K; i++) {
+            tables[i] = -2 * LUT[i];
+        }
+    }
+    if (scan_8bit () && norm_bits == 8) {
+        // the norm is scanned as an additional codebook
+        float *norm_table = tables + M * K;
+        for (int v = 0; v < 256; v++) {
+            norm_table[v] = is_IP ? 0 :
+                norm_min + (norm_max - norm_min) * v / 255.f;
+        }
+    }
+}
+
+void AdditiveQuantizer::scan_codes (const float *tables, bool is_IP,
+                                    const uint8_t *codes, size_t n,
+                                    float *dis) const
+{
+    FAISS_THROW_IF_NOT_MSG (
+          is_IP || norm_bits > 0 || search_type == ST_LUT_nonorm,
+          "L2 distances from look-up tables need a norm");
+
+    if (scan_8bit ()) {
+        pq_code_distances_8bit (code_size, tables, codes, n, dis);
+        return;
+    }
+
+    for (size_t j = 0; j < n; j++) {
+        const uint8_t *code = codes + j * code_size;
+        BitstringReader bsr (code, code_size);
+        const float *tab = tables;
+        float accu = 0;
+        for (size_t m = 0; m < M; m++) {
+            accu += tab[bsr.read (nbits)];
+            tab += K;
+        }
+        if (!is_IP && norm_bits > 0) {
+            accu += decode_norm (code);
+        }
+        dis[j] = accu;
+    }
+}
+
+
+} // namespace faiss
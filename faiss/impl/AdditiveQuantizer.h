@@ -0,0 +1,154 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include <faiss/Index.h>
+
+namespace faiss {
+
+/** Abstract structure for additive quantizers
+ *
+ * Different from the product quantizer in which the decoded vector is
+ * the concatenation of M sub-vectors, additive quantizers sum M
+ * full-dimensional codebook entries to get the decoded vector:
+ *
+ *    x ~= C_0[i_0] + C_1[i_1] + ... + C_(M-1)[i_(M-1)]
+ *
+ * The code of a vector is the M codebook indices of nbits each,
+ * optionally followed by the squared norm of the reconstruction, that is
+ * needed to compute L2 distances from the look-up tables.
+ */
+struct AdditiveQuantizer {
+
+    using idx_t = Index::idx_t;
+
+    size_t d;          ///< size of the input vectors
+    size_t M;          ///< number of codebooks
+    size_t nbits;      ///< bits per codebook index
+
+    // values derived from the above
+    size_t K;          ///< entries per codebook (1 << nbits)
+    size_t norm_bits;  ///< bits of the norm field of the codes
+    size_t tot_bits;   ///< total number of bits (indices + norm)
+    size_t code_size;  ///< bytes per code
+
+    bool verbose;
+    bool is_trained;
+
+    /// codebooks, size M * K * d
+    std::vector<float> codebooks;
+
+    /// how the distances are computed, and which norm is stored
+    enum Search_type_t {
+        ST_decompress,   ///< decompress the database vectors
+        ST_LUT_nonorm,   ///< LUT, no norm (IP or normalized vectors)
+        ST_norm_float,   ///< LUT, the norm is stored as a float32
+        ST_norm_qint8,   ///< LUT, the norm is quantized to 8 bits
+    };
+
+    Search_type_t search_type;
+
+    /// range of the squared norms, for ST_norm_qint8
+    float norm_min, norm_max;
+
+    AdditiveQuantizer (size_t d, size_t M, size_t nbits,
+                       Search_type_t search_type = ST_decompress);
+
+    AdditiveQuantizer ();
+
+    /// compute derived values when d, M, nbits and search_type are set
+    void set_derived_values ();
+
+    /// train the codebooks (and the norm quantizer)
+    virtual void train (size_t n, const float *x) = 0;
+
+    /** Encode a set of vectors
+     *
+     * @param x          vectors to encode, size n * d
+     * @param codes      output codes, size n * code_size
+     * @param centroids  centroids to add to the reconstructions for the
+     *                   norms (IVF by residual), size n * d or nullptr
+     */
+    virtual void compute_codes (const float *x, uint8_t *codes, size_t n,
+                                const float *centroids = nullptr) const = 0;
+
+    /** pack the codebook indices and the norms
+     *
+     * @param codes         codebook indices, size n * M
+     * @param packed_codes  output codes, size n * code_size
+     * @param norms         squared norms of the reconstructions, size n,
+     *                      ignored if there is no norm field
+     */
+    void pack_codes (size_t n, const int32_t *codes, uint8_t *packed_codes,
+                     const float *norms = nullptr) const;
+
+    /// decode a set of codes (the norms are ignored)
+    void decode (const uint8_t *codes, float *x, size_t n) const;
+
+    /// decode a set of unpacked codes, size n * M
+    void decode_unpacked (const int32_t *codes, float *x, size_t n) const;
+
+    /** compute the squared norms of the reconstructions of the unpacked
+     * codes (+ the centroids if not nullptr), size n */
+    void compute_norms (const int32_t *codes, size_t n,
+                        const float *centroids, float *norms) const;
+
+    /// set the range of the norm quantizer from a sample of squared norms
+    void train_norm (size_t n, const float *norms);
+
+    /// quantized value of a squared norm, on norm_bits bits
+    uint64_t encode_norm (float norm) const;
+
+    /// squared norm stored in a code
+    float decode_norm (const uint8_t *code) const;
+
+    /** compute the look-up tables of a set of queries
+     *
+     *    LUT[i * M * K + m * K + j] = <xq_i, C_m[j]>
+     *
+     * @param xq   queries, size n * d
+     * @param LUT  output tables, size n * M * K
+     */
+    void compute_LUT (size_t n, const float *xq, float *LUT) const;
+
+    /* Distances from look-up tables. The tables of a query are derived
+     * from its LUT, such that:
+     *
+     *  - for the inner product, the distance is <q, x>
+     *  - for L2, the distance is ||x||^2 - 2 <q, x>, ie. without the
+     *    ||q||^2 term
+     *
+     * When the indices are on 8 bits and the norm, if any, on 8 bits, the
+     * norm gets its own table and the codes are scanned with
+     * pq_code_distances_8bit. */
+
+    /// size of the tables of a query
+    size_t scan_tables_size () const;
+
+    /// tables of a query from its LUT (size M * K)
+    void compute_scan_tables (const float *LUT, bool is_IP,
+                              float *tables) const;
+
+    /// distances of n codes with the tables of a query
+    void scan_codes (const float *tables, bool is_IP,
+                     const uint8_t *codes, size_t n, float *dis) const;
+
+    virtual ~AdditiveQuantizer ();
+
+  private:
+    /// whether the codes can be scanned with pq_code_distances_8bit
+    bool scan_8bit () const;
+};
+
+} // namespace faiss
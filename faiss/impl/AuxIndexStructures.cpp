@@ -32,6 +32,14 @@ RangeSearchResult::RangeSearchResult (idx_t nq, bool alloc_lims): nq (nq) {
     labels = nullptr;
     distances = nullptr;
     buffer_size = 1024 * 256;
+    callback = nullptr;
+}
+
+RangeSearchResult::RangeSearchResult (idx_t nq,
+                                      RangeSearchCallback *callback):
+    RangeSearchResult (nq, false)
+{
+    this->callback = callback;
 }
 
 /// called when lims contains the nb of elements result entries
@@ -122,7 +130,11 @@ void BufferList::copy_range (size_t ofs, size_t n,
 
 void RangeQueryResult::add (float dis, idx_t id) {
     nres++;
-    pres->add (id, dis);
+    if (pres->res->callback) {
+        pres->stream_add (qno, id, dis);
+    } else {
+        pres->add (id, dis);
+    }
 }
 
 
@@ -130,7 +142,39 @@ void RangeQueryResult::add (float dis, idx_t id) {
 RangeSearchPartialResult::RangeSearchPartialResult (RangeSearchResult * res_in):
     BufferList(res_in->buffer_size),
     res(res_in)
-{}
+{
+    if (res->callback) {
+        append_buffer ();
+        stream_qnos.resize (buffer_size);
+    }
+}
+
+
+void RangeSearchPartialResult::stream_add (idx_t qno, idx_t id, float dis)
+{
+    if (wp == buffer_size) {
+        stream_flush ();
+    }
+    Buffer & buf = buffers[0];
+    stream_qnos [wp] = qno;
+    buf.ids [wp] = id;
+    buf.dis [wp] = dis;
+    wp++;
+}
+
+void RangeSearchPartialResult::stream_flush ()
+{
+    if (wp == 0) {
+        return;
+    }
+    RangeSearchCallback *callback = res->callback;
+    {
+        std::lock_guard<std::mutex> lock (callback->mutex);
+        callback->process (wp, stream_qnos.data(),
+                           buffers[0].ids, buffers[0].dis);
+    }
+    wp = 0;
+}
 
 
 /// begin a new result
@@ -145,6 +189,10 @@ RangeQueryResult &
 
 void RangeSearchPartialResult::finalize ()
 {
+    if (res->callback) {
+        stream_flush ();
+        return;
+    }
     set_lims ();
 #pragma omp barrier
 
@@ -191,6 +239,18 @@ void RangeSearchPartialResult::merge (std::vector <RangeSearchPartialResult *> &
     RangeSearchResult *result = partial_results[0]->res;
     size_t nx = result->nq;
 
+    if (result->callback) {
+        for (int j = 0; j < npres; j++) {
+            if (!partial_results[j]) continue;
+            partial_results[j]->stream_flush ();
+            if (do_delete) {
+                delete partial_results[j];
+                partial_results[j] = nullptr;
+            }
+        }
+        return;
+    }
+
     // count
     for (const RangeSearchPartialResult * pres : partial_results) {
         if (!pres) continue;
@@ -215,6 +275,36 @@ void RangeSearchPartialResult::merge (std::vector <RangeSearchPartialResult *> &
     result->lims [0] = 0;
 }
 
+/***********************************************************************
+ * RangeQueryTopResults
+ ***********************************************************************/
+
+RangeQueryTopResults::RangeQueryTopResults (float threshold,
+                                            size_t max_results):
+    threshold (threshold), max_results (max_results)
+{}
+
+void RangeQueryTopResults::shrink ()
+{
+    if (max_results == 0 || results.size() <= max_results) {
+        return;
+    }
+    std::nth_element (results.begin(), results.begin() + max_results - 1,
+                      results.end());
+    results.resize (max_results);
+    threshold = results[max_results - 1].first;
+}
+
+void RangeQueryTopResults::flush (RangeQueryResult & qres, bool negate)
+{
+    shrink ();
+    for (const auto & r: results) {
+        qres.add (negate ? -r.first : r.first, r.second);
+    }
+    results.clear ();
+}
+
+
 /***********************************************************************
  * IDSelectorRange
  ***********************************************************************/
@@ -247,6 +337,25 @@ bool IDSelectorArray::is_member (idx_t id) const
 }
 
 
+/***********************************************************************
+ * IDSelectorBitmap
+ ***********************************************************************/
+
+IDSelectorBitmap::IDSelectorBitmap (size_t n, const uint8_t *bitmap):
+    n (n), bitmap (bitmap)
+{
+}
+
+bool IDSelectorBitmap::is_member (idx_t id) const
+{
+    uint64_t i = id;
+    if ((i >> 3) >= n) {
+        return false;
+    }
+    return (bitmap[i >> 3] >> (i & 7)) & 1;
+}
+
+
 /***********************************************************************
  * IDSelectorBatch
  ***********************************************************************/
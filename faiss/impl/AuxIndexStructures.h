@@ -26,6 +26,8 @@
 
 namespace faiss {
 
+struct RangeSearchCallback;
+
 /** The objective is to have a simple result structure while
  *  minimizing the number of mem copies in the result. The method
  *  do_allocation can be overloaded to allocate the result tables in
@@ -41,9 +43,17 @@ struct RangeSearchResult {
 
     size_t buffer_size; ///< size of the result buffers used
 
+    /** if non-null, the results are streamed to the callback as they
+     * are produced and lims, labels and distances are not filled in.
+     * Not owned. */
+    RangeSearchCallback *callback;
+
     /// lims must be allocated on input to range_search.
     explicit RangeSearchResult (idx_t nq, bool alloc_lims=true);
 
+    /// streaming result: lims is not allocated
+    RangeSearchResult (idx_t nq, RangeSearchCallback *callback);
+
     /// called when lims contains the nb of elements result entries
     /// for each query
 
@@ -53,6 +63,28 @@ struct RangeSearchResult {
 };
 
 
+/** Consumer of streamed range search results. Each search thread
+ * accumulates its results in a single buffer of
+ * RangeSearchResult::buffer_size entries and hands it over to the
+ * callback when it is full, so the memory used does not depend on the
+ * nb of results. The calls are serialized by the mutex, so process
+ * does not need to be thread-safe. The results of a query may be
+ * split over several calls. */
+struct RangeSearchCallback {
+    typedef Index::idx_t idx_t;
+
+    std::mutex mutex;
+
+    /** consume n results: distance distances[i] between query qnos[i]
+     * and database vector labels[i]. The arrays are valid only during
+     * the call. */
+    virtual void process (size_t n, const idx_t *qnos,
+                          const idx_t *labels, const float *distances) = 0;
+
+    virtual ~RangeSearchCallback () {}
+};
+
+
 /** Encapsulates a set of ids to remove. */
 struct IDSelector {
     typedef Index::idx_t idx_t;
@@ -85,6 +117,21 @@ struct IDSelectorArray: IDSelector {
     ~IDSelectorArray() override {}
 };
 
+/** One bit per id. Useful for large allow-lists of dense ids: the test
+ * is a single memory access.
+ *
+ * An id is selected iff id / 8 < n and bit number (id % 8) of
+ * bitmap[id / 8] is 1. The bitmap is not owned.
+ */
+struct IDSelectorBitmap: IDSelector {
+    size_t n;               ///< size of the bitmap array (in bytes)
+    const uint8_t *bitmap;
+
+    IDSelectorBitmap (size_t n, const uint8_t *bitmap);
+    bool is_member(idx_t id) const override;
+    ~IDSelectorBitmap() override {}
+};
+
 /** Remove ids from a set. Repetitions of ids in the indices set
  * passed to the constructor does not hurt performance. The hash
  * function used for the bloom filter and GCC's implementation of
@@ -174,9 +221,19 @@ struct RangeSearchPartialResult: BufferList {
     /// begin a new result
     RangeQueryResult & new_result (idx_t qno);
 
+    /// streaming mode (res->callback != nullptr): the only buffer is
+    /// reused and stream_qnos stores the query of each entry
+    std::vector<idx_t> stream_qnos;
+
+    /// add one result in streaming mode, flushing the buffer if full
+    void stream_add (idx_t qno, idx_t id, float dis);
+
+    /// pass the buffered results to the callback
+    void stream_flush ();
+
     /*****************************************
      * functions used at the end of the search to merge the result
-     * lists */
+     * lists. In streaming mode, they just flush the buffers. */
     void finalize ();
 
     /// called by range_search before do_allocation
@@ -193,6 +250,38 @@ struct RangeSearchPartialResult: BufferList {
 };
 
 
+/** Collects the results of one query of a range search, keeping only
+ * the max_results nearest ones if max_results > 0. The distances are
+ * "lower is better" (similarities should be negated). When the cap is
+ * reached, threshold decreases to the distance of the worst result
+ * kept, so that the search can stop early.
+ */
+struct RangeQueryTopResults {
+    using idx_t = Index::idx_t;
+
+    float threshold;   ///< only results with dis < threshold are kept
+    size_t max_results;
+    std::vector<std::pair<float, idx_t> > results;
+
+    RangeQueryTopResults (float threshold, size_t max_results = 0);
+
+    void add (float dis, idx_t id) {
+        if (dis < threshold) {
+            results.push_back (std::make_pair (dis, id));
+            if (max_results > 0 && results.size() >= 2 * max_results) {
+                shrink ();
+            }
+        }
+    }
+
+    /// keep only the max_results best results (if there are more)
+    void shrink ();
+
+    /// store the results in qres, negating the distances if negate
+    void flush (RangeQueryResult & qres, bool negate = false);
+};
+
+
 /***********************************************************
  * The distance computer maintains a current query and computes
  * distances to elements in an index that supports random access.
@@ -213,6 +302,10 @@ struct DistanceComputer {
      /// compute distance between two stored vectors
      virtual float symmetric_dis (idx_t i, idx_t j) = 0;
 
+     /// hint that the distance to vector i will be computed soon
+     /// (default: does nothing)
+     virtual void prefetch (idx_t /* i */) {}
+
      virtual ~DistanceComputer() {}
 };
 
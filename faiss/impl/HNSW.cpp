@@ -9,9 +9,12 @@
 
 #include <faiss/impl/HNSW.h>
 
+#include <memory>
 #include <string>
 
 #include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/utils/scratch.h>
+#include <faiss/utils/utils.h>
 
 namespace faiss {
 
@@ -43,6 +46,8 @@ int HNSW::cum_nb_neighbors(int layer_no) const
 void HNSW::neighbor_range(idx_t no, int layer_no,
                           size_t * begin, size_t * end) const
 {
+  FAISS_THROW_IF_NOT_MSG(!links_compressed,
+                         "the links are compressed, call decompress_links");
   size_t o = offsets[no];
   *begin = o + cum_nb_neighbors(layer_no);
   *end = o + cum_nb_neighbors(layer_no + 1);
@@ -107,6 +112,24 @@ void HNSW::reset() {
   offsets.push_back(0);
   levels.clear();
   neighbors.clear();
+  links_compressed = false;
+  compressed_links.clear();
+  deleted.clear();
+  ndeleted = 0;
+  free_slots.clear();
+}
+
+MemoryUsage HNSW::memory_usage() const {
+  MemoryUsage mu = MemoryUsage::object("HNSW");
+  mu.add("neighbors", neighbors);
+  mu.add("compressed_links", compressed_links);
+  mu.add("offsets", offsets);
+  mu.add("levels", levels);
+  mu.add("assign_probas", assign_probas);
+  mu.add("cum_nneighbor_per_level", cum_nneighbor_per_level);
+  mu.add("deleted", deleted);
+  mu.add("free_slots", free_slots);
+  return mu;
 }
 
 
@@ -205,6 +228,8 @@ void HNSW::fill_with_random_links(size_t n)
 
 int HNSW::prepare_level_tab(size_t n, bool preset_levels)
 {
+  FAISS_THROW_IF_NOT_MSG(!links_compressed,
+                         "cannot add to a graph with compressed links");
   size_t n0 = offsets.size() - 1;
 
   if (preset_levels) {
@@ -350,7 +375,7 @@ void add_link(HNSW& hnsw,
 
 /// search neighbors on a single level, starting from an entry point
 void search_neighbors_to_add(
-  HNSW& hnsw,
+  const HNSW& hnsw,
   DistanceComputer& qdis,
   std::priority_queue<NodeDistCloser>& results,
   int entry_point,
@@ -414,13 +439,15 @@ void greedy_update_nearest(const HNSW& hnsw,
                            storage_idx_t& nearest,
                            float& d_nearest)
 {
+  storage_idx_t links_buf[256];
   for(;;) {
     storage_idx_t prev_nearest = nearest;
 
-    size_t begin, end;
-    hnsw.neighbor_range(nearest, level, &begin, &end);
-    for(size_t i = begin; i < end; i++) {
-      storage_idx_t v = hnsw.neighbors[i];
+    size_t nneigh;
+    const storage_idx_t *neigh =
+      hnsw.neighbor_list(nearest, level, links_buf, &nneigh);
+    for(size_t i = 0; i < nneigh; i++) {
+      storage_idx_t v = neigh[i];
       if (v < 0) break;
       float dis = qdis(v);
       if (dis < d_nearest) {
@@ -478,7 +505,7 @@ void HNSW::add_links_starting_from(DistanceComputer& ptdis,
 
 void HNSW::add_with_locks(DistanceComputer& ptdis, int pt_level, int pt_id,
                           std::vector<omp_lock_t>& locks,
-                          VisitedTable& vt)
+                          VisitedTable& vt, int min_level)
 {
   //  greedy search on upper levels
 
@@ -506,7 +533,7 @@ void HNSW::add_with_locks(DistanceComputer& ptdis, int pt_level, int pt_id,
     greedy_update_nearest(*this, ptdis, level, nearest, d_nearest);
   }
 
-  for(; level >= 0; level--) {
+  for(; level >= min_level; level--) {
     add_links_starting_from(ptdis, pt_id, nearest, d_nearest,
                             level, locks.data(), vt);
   }
@@ -520,6 +547,809 @@ void HNSW::add_with_locks(DistanceComputer& ptdis, int pt_level, int pt_id,
 }
 
 
+/**************************************************************
+ * Deletion
+ **************************************************************/
+
+bool HNSW::mark_deleted(storage_idx_t no)
+{
+  FAISS_THROW_IF_NOT(no >= 0 && no < levels.size());
+  if (deleted.size() < levels.size()) {
+    deleted.resize(levels.size(), 0);
+  }
+  if (deleted[no]) {
+    return false;
+  }
+  deleted[no] = 1;
+  ndeleted++;
+  return true;
+}
+
+bool HNSW::repair_neighbors(DistanceComputer& qdis, storage_idx_t pt_id,
+                            int level, VisitedTable& vt)
+{
+  size_t begin, end;
+  neighbor_range(pt_id, level, &begin, &end);
+
+  bool has_deleted = false;
+  for (size_t i = begin; i < end && neighbors[i] >= 0; i++) {
+    if (is_deleted(neighbors[i])) {
+      has_deleted = true;
+      break;
+    }
+  }
+  if (!has_deleted) {
+    return false;
+  }
+
+  // the live nodes are candidates, the deleted nodes are expanded. A
+  // slot may have been reused by a node that does not reach this level.
+  int max_size = end - begin;
+  std::priority_queue<NodeDistFarther> input;
+  std::vector<storage_idx_t> to_expand;
+
+  auto visit = [&](storage_idx_t v) {
+    if (vt.get(v) || levels[v] <= level) {
+      return;
+    }
+    vt.set(v);
+    if (is_deleted(v)) {
+      to_expand.push_back(v);
+    } else {
+      input.emplace(qdis.symmetric_dis(pt_id, v), v);
+    }
+  };
+
+  vt.set(pt_id);
+  for (size_t i = begin; i < end && neighbors[i] >= 0; i++) {
+    visit(neighbors[i]);
+  }
+  // follow chains of deleted nodes, but not too far
+  for (size_t j = 0; j < to_expand.size() && j < max_size; j++) {
+    size_t begin2, end2;
+    neighbor_range(to_expand[j], level, &begin2, &end2);
+    for (size_t i = begin2; i < end2 && neighbors[i] >= 0; i++) {
+      visit(neighbors[i]);
+    }
+  }
+  vt.advance();
+
+  std::vector<NodeDistFarther> output;
+  if (input.size() <= max_size) {
+    while (!input.empty()) {
+      output.push_back(input.top());
+      input.pop();
+    }
+  } else {
+    shrink_neighbor_list(qdis, input, output, max_size);
+  }
+
+  size_t i = begin;
+  for (const NodeDistFarther& node : output) {
+    neighbors[i++] = node.id;
+  }
+  while (i < end) {
+    neighbors[i++] = -1;
+  }
+  return true;
+}
+
+size_t HNSW::detach_deleted()
+{
+  if (ndeleted == 0) {
+    return 0;
+  }
+  size_t ndetached = 0;
+  for (storage_idx_t i = 0; i < deleted.size(); i++) {
+    if (deleted[i] != 1) {
+      continue;
+    }
+    for (int level = 0; level < levels[i]; level++) {
+      size_t begin, end;
+      neighbor_range(i, level, &begin, &end);
+      for (size_t j = begin; j < end; j++) {
+        neighbors[j] = -1;
+      }
+    }
+    deleted[i] = 2;
+    free_slots.push_back(i);
+    ndetached++;
+  }
+
+  if (entry_point >= 0 && is_deleted(entry_point)) {
+    entry_point = -1;
+    max_level = -1;
+    for (storage_idx_t i = 0; i < levels.size(); i++) {
+      if (!is_deleted(i) && levels[i] - 1 > max_level) {
+        max_level = levels[i] - 1;
+        entry_point = i;
+      }
+    }
+  }
+  return ndetached;
+}
+
+
+/**************************************************************
+ * Reordering
+ **************************************************************/
+
+namespace {
+
+/// level 0 links in compressed sparse row format
+struct Level0Graph {
+  std::vector<size_t> lims;
+  std::vector<HNSW::storage_idx_t> adj;
+
+  size_t degree(HNSW::storage_idx_t i) const {
+    return lims[i + 1] - lims[i];
+  }
+};
+
+Level0Graph get_level_0_links(const HNSW& hnsw, bool reverse)
+{
+  size_t n = hnsw.levels.size();
+  Level0Graph g;
+  g.lims.resize(n + 1, 0);
+  for (size_t i = 0; i < n; i++) {
+    size_t begin, end;
+    hnsw.neighbor_range(i, 0, &begin, &end);
+    for (size_t j = begin; j < end && hnsw.neighbors[j] >= 0; j++) {
+      g.lims[(reverse ? hnsw.neighbors[j] : i) + 1]++;
+    }
+  }
+  for (size_t i = 0; i < n; i++) {
+    g.lims[i + 1] += g.lims[i];
+  }
+  g.adj.resize(g.lims[n]);
+  std::vector<size_t> ofs(g.lims.begin(), g.lims.end() - 1);
+  for (size_t i = 0; i < n; i++) {
+    size_t begin, end;
+    hnsw.neighbor_range(i, 0, &begin, &end);
+    for (size_t j = begin; j < end && hnsw.neighbors[j] >= 0; j++) {
+      storage_idx_t v = hnsw.neighbors[j];
+      if (reverse) {
+        g.adj[ofs[v]++] = i;
+      } else {
+        g.adj[ofs[i]++] = v;
+      }
+    }
+  }
+  return g;
+}
+
+/** Priority queue of nodes with small integer priorities that can be
+ * incremented and decremented in O(1): the nodes are stored in one
+ * doubly-linked list per priority (this is the "unit heap" of Gorder). */
+struct UnitHeap {
+  std::vector<int> key;  // -1 = popped
+  std::vector<storage_idx_t> prev, next;
+  std::vector<storage_idx_t> head;
+  int top;
+
+  explicit UnitHeap(size_t n): key(n, 0), prev(n), next(n), head(1, -1),
+                               top(0) {
+    for (storage_idx_t i = n - 1; i >= 0; i--) {
+      insert(i);
+    }
+  }
+
+  void insert(storage_idx_t v) {
+    if (key[v] >= head.size()) {
+      head.resize(key[v] + 1, -1);
+    }
+    prev[v] = -1;
+    next[v] = head[key[v]];
+    if (next[v] >= 0) {
+      prev[next[v]] = v;
+    }
+    head[key[v]] = v;
+    top = std::max(top, key[v]);
+  }
+
+  void remove(storage_idx_t v) {
+    if (prev[v] >= 0) {
+      next[prev[v]] = next[v];
+    } else {
+      head[key[v]] = next[v];
+    }
+    if (next[v] >= 0) {
+      prev[next[v]] = prev[v];
+    }
+  }
+
+  void update(storage_idx_t v, int delta) {
+    if (key[v] < 0) {
+      return;
+    }
+    remove(v);
+    key[v] += delta;
+    insert(v);
+  }
+
+  void pop(storage_idx_t v) {
+    remove(v);
+    key[v] = -1;
+  }
+
+  /// node with the highest key, -1 if empty
+  storage_idx_t pop_max() {
+    while (top > 0 && head[top] < 0) {
+      top--;
+    }
+    storage_idx_t v = head[top];
+    if (v >= 0) {
+      pop(v);
+    }
+    return v;
+  }
+};
+
+}  // namespace
+
+void HNSW::locality_order(ReorderType type, idx_t *perm, int window) const
+{
+  size_t n = levels.size();
+  if (n == 0) {
+    return;
+  }
+  Level0Graph out = get_level_0_links(*this, false);
+  size_t np = 0;
+
+  if (type == REORDER_BFS || type == REORDER_RCM) {
+    bool rcm = type == REORDER_RCM;
+    std::vector<bool> placed(n);
+
+    // Cuthill-McKee starts the components from low-degree nodes and
+    // visits the neighbors by increasing degree
+    std::vector<storage_idx_t> starts(n);
+    for (size_t i = 0; i < n; i++) {
+      starts[i] = i;
+    }
+    if (rcm) {
+      std::stable_sort(starts.begin(), starts.end(),
+        [&](storage_idx_t a, storage_idx_t b) {
+          return out.degree(a) < out.degree(b);
+        });
+    } else if (entry_point >= 0) {
+      std::swap(starts[0], starts[entry_point]);
+    }
+
+    std::vector<storage_idx_t> nbs;
+    for (storage_idx_t start : starts) {
+      if (placed[start]) {
+        continue;
+      }
+      placed[start] = true;
+      perm[np++] = start;
+      for (size_t q = np - 1; q < np; q++) {
+        storage_idx_t v0 = perm[q];
+        nbs.clear();
+        for (size_t j = out.lims[v0]; j < out.lims[v0 + 1]; j++) {
+          storage_idx_t v = out.adj[j];
+          if (!placed[v]) {
+            placed[v] = true;
+            nbs.push_back(v);
+          }
+        }
+        if (rcm) {
+          std::stable_sort(nbs.begin(), nbs.end(),
+            [&](storage_idx_t a, storage_idx_t b) {
+              return out.degree(a) < out.degree(b);
+            });
+        }
+        for (storage_idx_t v : nbs) {
+          perm[np++] = v;
+        }
+      }
+    }
+    if (rcm) {
+      std::reverse(perm, perm + n);
+    }
+  } else if (type == REORDER_GORDER) {
+    FAISS_THROW_IF_NOT(window > 0);
+    Level0Graph in = get_level_0_links(*this, true);
+    UnitHeap heap(n);
+
+    // the score of a node is the nb of links and of common in-neighbors
+    // it has with the nodes of the window
+    auto update_window = [&](storage_idx_t v, int delta) {
+      for (size_t j = out.lims[v]; j < out.lims[v + 1]; j++) {
+        heap.update(out.adj[j], delta);
+      }
+      for (size_t j = in.lims[v]; j < in.lims[v + 1]; j++) {
+        storage_idx_t u = in.adj[j];
+        heap.update(u, delta);
+        for (size_t l = out.lims[u]; l < out.lims[u + 1]; l++) {
+          if (out.adj[l] != v) {
+            heap.update(out.adj[l], delta);
+          }
+        }
+      }
+    };
+
+    storage_idx_t v = entry_point >= 0 ? entry_point : 0;
+    heap.pop(v);
+    for (;;) {
+      perm[np] = v;
+      update_window(v, 1);
+      if (np >= window) {
+        update_window(perm[np - window], -1);
+      }
+      np++;
+      v = heap.pop_max();
+      if (v < 0) {
+        break;
+      }
+    }
+  } else {
+    FAISS_THROW_MSG("unknown reorder type");
+  }
+  FAISS_ASSERT(np == n);
+}
+
+void HNSW::permute_entries(const idx_t *perm)
+{
+  FAISS_THROW_IF_NOT_MSG(!links_compressed,
+                         "cannot renumber a graph with compressed links");
+  size_t n = levels.size();
+  std::vector<storage_idx_t> inv(n, -1);
+  for (size_t i = 0; i < n; i++) {
+    FAISS_THROW_IF_NOT_MSG(perm[i] >= 0 && perm[i] < n && inv[perm[i]] < 0,
+                           "not a permutation");
+    inv[perm[i]] = i;
+  }
+
+  std::vector<int> new_levels(n);
+  std::vector<size_t> new_offsets(n + 1, 0);
+  for (size_t i = 0; i < n; i++) {
+    new_levels[i] = levels[perm[i]];
+    new_offsets[i + 1] = new_offsets[i] +
+        offsets[perm[i] + 1] - offsets[perm[i]];
+  }
+
+  MaybeOwnedVector<storage_idx_t> new_neighbors(new_offsets[n]);
+#pragma omp parallel for
+  for (idx_t i = 0; i < n; i++) {
+    const storage_idx_t *src = neighbors.data() + offsets[perm[i]];
+    storage_idx_t *dest = new_neighbors.data() + new_offsets[i];
+    for (size_t j = 0; j < new_offsets[i + 1] - new_offsets[i]; j++) {
+      dest[j] = src[j] < 0 ? -1 : inv[src[j]];
+    }
+  }
+
+  levels.swap(new_levels);
+  offsets.swap(new_offsets);
+  neighbors = std::move(new_neighbors);
+  if (entry_point >= 0) {
+    entry_point = inv[entry_point];
+  }
+
+  if (!deleted.empty()) {
+    std::vector<uint8_t> new_deleted(n, 0);
+    for (size_t i = 0; i < n; i++) {
+      if (perm[i] < deleted.size()) {
+        new_deleted[i] = deleted[perm[i]];
+      }
+    }
+    deleted.swap(new_deleted);
+  }
+  for (storage_idx_t & slot : free_slots) {
+    slot = inv[slot];
+  }
+}
+
+
+/**************************************************************
+ * VisitedTable
+ **************************************************************/
+
+VisitedTable::VisitedTable(int size, size_t nvisit_hint):
+  visno(1), sparse(use_sparse(size, nvisit_hint)), nhash(0)
+{
+  if (sparse) {
+    size_t capacity = 16;
+    while (capacity < 2 * nvisit_hint) {
+      capacity *= 2;
+    }
+    hash_table.resize(capacity, -1);
+  } else {
+    visited.resize(size);
+  }
+}
+
+bool VisitedTable::use_sparse(size_t size, size_t nvisit_hint)
+{
+  // the hash table takes about 8 bytes per visit and is slower to
+  // access than the dense table (2 bytes per node)
+  return nvisit_hint > 0 && nvisit_hint * 256 < size;
+}
+
+void VisitedTable::hash_insert(int no)
+{
+  if (2 * (nhash + 1) > hash_table.size()) {
+    // keep the load factor below 1/2
+    std::vector<int> old_table(2 * hash_table.size(), -1);
+    std::swap(old_table, hash_table);
+    nhash = 0;
+    for (int v: old_table) {
+      if (v != -1) {
+        hash_insert(v);
+      }
+    }
+  }
+  size_t i = hash_slot(no);
+  while (hash_table[i] != -1) {
+    if (hash_table[i] == no) return;
+    i = (i + 1) & (hash_table.size() - 1);
+  }
+  hash_table[i] = no;
+  nhash++;
+}
+
+
+namespace {
+
+/// tables that are not in use, see ScratchVisitedTable
+thread_local std::vector<std::unique_ptr<VisitedTable>> visited_table_pool;
+
+} // namespace
+
+ScratchVisitedTable::ScratchVisitedTable(int size, size_t nvisit_hint):
+  vt(nullptr)
+{
+  bool sparse = VisitedTable::use_sparse(size, nvisit_hint);
+  auto& pool = visited_table_pool;
+  for (size_t i = pool.size(); i-- > 0; ) {
+    if (pool[i]->sparse == sparse) {
+      vt = pool[i].release();
+      pool.erase(pool.begin() + i);
+      break;
+    }
+  }
+  if (!vt) {
+    vt = new VisitedTable(size, nvisit_hint);
+    return;
+  }
+  if (!sparse && vt->visited.size() < size) {
+    // the new entries are 0, ie. not visited
+    vt->visited.resize(size);
+  }
+  // the previous user may have left nodes tagged visno + 1
+  vt->advance();
+  vt->advance();
+}
+
+ScratchVisitedTable::~ScratchVisitedTable()
+{
+  size_t nbytes = vt->visited.size() * sizeof(vt->visited[0]) +
+    vt->hash_table.size() * sizeof(vt->hash_table[0]);
+  if (nbytes > scratch_max_kept_bytes) {
+    delete vt;
+    return;
+  }
+  try {
+    visited_table_pool.emplace_back(vt);
+  } catch (...) {
+    delete vt;
+  }
+}
+
+
+/**************************************************************
+ * Building by batches
+ **************************************************************/
+
+bool HNSW::LinkUpdate::operator < (const LinkUpdate & other) const
+{
+  if (src != other.src) {
+    return src < other.src;
+  }
+  return level < other.level;
+}
+
+void HNSW::search_link_updates(DistanceComputer& ptdis, int pt_level,
+                               storage_idx_t pt_id, VisitedTable& vt,
+                               std::vector<LinkUpdate>& updates,
+                               storage_idx_t entry) const
+{
+  FAISS_ASSERT(entry_point >= 0);
+  storage_idx_t nearest = entry_point;
+  int level = max_level;
+  if (entry >= 0) {
+    nearest = entry;
+    level = levels[entry] - 1;
+  }
+  float d_nearest = ptdis(nearest);
+
+  for(; level > pt_level; level--) {
+    greedy_update_nearest(*this, ptdis, level, nearest, d_nearest);
+  }
+
+  for(; level >= 0; level--) {
+    std::priority_queue<NodeDistCloser> link_targets;
+    search_neighbors_to_add(*this, ptdis, link_targets, nearest, d_nearest,
+                            level, vt);
+    ::faiss::shrink_neighbor_list(ptdis, link_targets, nb_neighbors(level));
+
+    while (!link_targets.empty()) {
+      storage_idx_t other_id = link_targets.top().id;
+      updates.push_back(LinkUpdate{other_id, pt_id, level});
+      updates.push_back(LinkUpdate{pt_id, other_id, level});
+      link_targets.pop();
+    }
+  }
+}
+
+void HNSW::apply_link_updates(DistanceComputer& qdis,
+                              const LinkUpdate *updates, size_t n)
+{
+  for (size_t i = 0; i < n; i++) {
+    add_link(*this, qdis, updates[i].src, updates[i].dest, updates[i].level);
+  }
+}
+
+void HNSW::reprune_link_updates(DistanceComputer& qdis,
+                                const LinkUpdate *updates, size_t n)
+{
+  size_t i0 = 0;
+  while (i0 < n) {
+    storage_idx_t src = updates[i0].src;
+    int level = updates[i0].level;
+    size_t i1 = i0;
+    while (i1 < n && updates[i1].level == level) {
+      i1++;
+    }
+
+    size_t begin, end;
+    neighbor_range(src, level, &begin, &end);
+    std::vector<storage_idx_t> cands;
+    for (size_t i = begin; i < end && neighbors[i] >= 0; i++) {
+      cands.push_back(neighbors[i]);
+    }
+    for (size_t i = i0; i < i1; i++) {
+      cands.push_back(updates[i].dest);
+    }
+    std::sort(cands.begin(), cands.end());
+    cands.erase(std::unique(cands.begin(), cands.end()), cands.end());
+
+    std::priority_queue<NodeDistFarther> input;
+    for (storage_idx_t v : cands) {
+      if (v != src) {
+        input.emplace(qdis.symmetric_dis(src, v), v);
+      }
+    }
+    std::vector<NodeDistFarther> output;
+    shrink_neighbor_list(qdis, input, output, end - begin);
+
+    size_t i = begin;
+    for (const NodeDistFarther& node : output) {
+      neighbors[i++] = node.id;
+    }
+    while (i < end) {
+      neighbors[i++] = -1;
+    }
+    i0 = i1;
+  }
+}
+
+void HNSW::append_graph(const HNSW& other)
+{
+  FAISS_THROW_IF_NOT_MSG(cum_nneighbor_per_level ==
+                         other.cum_nneighbor_per_level,
+                         "graphs with different numbers of neighbors");
+  FAISS_THROW_IF_NOT_MSG(deleted.empty() && other.deleted.empty(),
+                         "cannot append graphs with deleted nodes");
+  FAISS_THROW_IF_NOT_MSG(!links_compressed && !other.links_compressed,
+                         "cannot append graphs with compressed links");
+  storage_idx_t n0 = levels.size();
+  size_t nb0 = neighbors.size();
+  size_t n1 = other.levels.size();
+
+  levels.insert(levels.end(), other.levels.begin(), other.levels.end());
+  for (size_t i = 1; i <= n1; i++) {
+    offsets.push_back(nb0 + other.offsets[i]);
+  }
+  neighbors.resize(nb0 + other.neighbors.size());
+  storage_idx_t *dest = neighbors.data() + nb0;
+  for (size_t i = 0; i < other.neighbors.size(); i++) {
+    storage_idx_t v = other.neighbors[i];
+    dest[i] = v < 0 ? -1 : v + n0;
+  }
+
+  if (other.entry_point >= 0 &&
+      (entry_point < 0 || other.max_level > max_level)) {
+    entry_point = other.entry_point + n0;
+    max_level = other.max_level;
+  }
+}
+
+
+/**************************************************************
+ * Compressed links
+ *
+ * The lists of a node are stored one level after the other. A list
+ * with n links is stored as:
+ *   uint8 n, then if n > 0:
+ *   uint8 nbits_first, uint8 nbits_gap,
+ *   the bit-packed zigzag encoding of (first id - node id) on
+ *   nbits_first bits followed by the n - 1 gaps on nbits_gap bits.
+ * The table is padded so that the bits can be read with unaligned
+ * 64-bit loads.
+ **************************************************************/
+
+namespace {
+
+int nbits_for(uint64_t v)
+{
+  int nbits = 0;
+  while (v >> nbits) {
+    nbits++;
+  }
+  return nbits;
+}
+
+uint64_t zigzag_encode(int64_t v)
+{
+  return v < 0 ? ((uint64_t)(-(v + 1)) << 1) | 1 : (uint64_t)v << 1;
+}
+
+int64_t zigzag_decode(uint64_t v)
+{
+  return v & 1 ? -(int64_t)(v >> 1) - 1 : (int64_t)(v >> 1);
+}
+
+uint64_t read_bits(const uint8_t *data, size_t bitpos, int nbits)
+{
+  uint64_t w;
+  memcpy(&w, data + (bitpos >> 3), sizeof(w));
+  return (w >> (bitpos & 7)) & ((uint64_t(1) << nbits) - 1);
+}
+
+/// encode the lists of all levels of node no, returns the size. If
+/// out is null, only compute the size
+size_t encode_node_links(const HNSW& hnsw, HNSW::storage_idx_t no,
+                         uint8_t *out)
+{
+  size_t size = 0;
+  std::vector<HNSW::storage_idx_t> ids;
+  for (int level = 0; level < hnsw.levels[no]; level++) {
+    size_t begin, end;
+    hnsw.neighbor_range(no, level, &begin, &end);
+    ids.clear();
+    for (size_t j = begin; j < end && hnsw.neighbors[j] >= 0; j++) {
+      ids.push_back(hnsw.neighbors[j]);
+    }
+    std::sort(ids.begin(), ids.end());
+    size_t n = ids.size();
+    if (out) {
+      out[size] = n;
+    }
+    size++;
+    if (n == 0) {
+      continue;
+    }
+    uint64_t first = zigzag_encode((int64_t)ids[0] - no);
+    uint64_t max_gap = 0;
+    for (size_t j = 1; j < n; j++) {
+      max_gap = std::max(max_gap, (uint64_t)(ids[j] - ids[j - 1]));
+    }
+    int nbits_first = nbits_for(first), nbits_gap = nbits_for(max_gap);
+    size_t nbits = nbits_first + (n - 1) * nbits_gap;
+    if (out) {
+      uint8_t *data = out + size + 2;
+      out[size] = nbits_first;
+      out[size + 1] = nbits_gap;
+      memset(data, 0, (nbits + 7) / 8);
+      size_t bitpos = 0;
+      auto write_bits = [&](uint64_t v, int nb) {
+        for (int b = 0; b < nb; b++, bitpos++) {
+          if ((v >> b) & 1) {
+            data[bitpos >> 3] |= 1 << (bitpos & 7);
+          }
+        }
+      };
+      write_bits(first, nbits_first);
+      for (size_t j = 1; j < n; j++) {
+        write_bits(ids[j] - ids[j - 1], nbits_gap);
+      }
+    }
+    size += 2 + (nbits + 7) / 8;
+  }
+  return size;
+}
+
+}  // namespace
+
+size_t HNSW::decode_links(storage_idx_t no, int layer_no,
+                          storage_idx_t *out) const
+{
+  const uint8_t *p = compressed_links.data() + offsets[no];
+  // skip the lower levels
+  for (int level = 0; level < layer_no; level++) {
+    int n = p[0];
+    if (n == 0) {
+      p++;
+    } else {
+      p += 3 + (p[1] + (n - 1) * p[2] + 7) / 8;
+    }
+  }
+  int n = p[0];
+  if (n == 0) {
+    return 0;
+  }
+  int nbits_first = p[1], nbits_gap = p[2];
+  const uint8_t *data = p + 3;
+  // the gaps are unpacked without branches, then summed
+  storage_idx_t v = no + zigzag_decode(read_bits(data, 0, nbits_first));
+  out[0] = v;
+  size_t bitpos = nbits_first;
+  for (int j = 1; j < n; j++) {
+    out[j] = read_bits(data, bitpos, nbits_gap);
+    bitpos += nbits_gap;
+  }
+  for (int j = 1; j < n; j++) {
+    v += out[j];
+    out[j] = v;
+  }
+  return n;
+}
+
+void HNSW::compress_links()
+{
+  FAISS_THROW_IF_NOT_MSG(!links_compressed, "links already compressed");
+  for (int level = 0; level + 1 < cum_nneighbor_per_level.size(); level++) {
+    FAISS_THROW_IF_NOT_MSG(nb_neighbors(level) <= 255,
+                           "too many neighbors per level to compress");
+  }
+  size_t n = levels.size();
+  std::vector<size_t> new_offsets(n + 1, 0);
+#pragma omp parallel for
+  for (idx_t i = 0; i < n; i++) {
+    new_offsets[i + 1] = encode_node_links(*this, i, nullptr);
+  }
+  for (size_t i = 0; i < n; i++) {
+    new_offsets[i + 1] += new_offsets[i];
+  }
+  std::vector<uint8_t> codes(new_offsets[n] + compressed_links_padding, 0);
+#pragma omp parallel for
+  for (idx_t i = 0; i < n; i++) {
+    encode_node_links(*this, i, codes.data() + new_offsets[i]);
+  }
+  offsets.swap(new_offsets);
+  compressed_links.swap(codes);
+  neighbors = MaybeOwnedVector<storage_idx_t>();
+  links_compressed = true;
+}
+
+void HNSW::decompress_links()
+{
+  FAISS_THROW_IF_NOT_MSG(links_compressed, "links are not compressed");
+  size_t n = levels.size();
+  std::vector<size_t> new_offsets(n + 1, 0);
+  for (size_t i = 0; i < n; i++) {
+    new_offsets[i + 1] = new_offsets[i] + cum_nb_neighbors(levels[i]);
+  }
+  MaybeOwnedVector<storage_idx_t> new_neighbors(new_offsets[n]);
+#pragma omp parallel for
+  for (idx_t i = 0; i < n; i++) {
+    for (int level = 0; level < levels[i]; level++) {
+      storage_idx_t *dest =
+        new_neighbors.data() + new_offsets[i] + cum_nb_neighbors(level);
+      size_t nneigh = decode_links(i, level, dest);
+      for (size_t j = nneigh; j < nb_neighbors(level); j++) {
+        dest[j] = -1;
+      }
+    }
+  }
+  offsets.swap(new_offsets);
+  neighbors = std::move(new_neighbors);
+  compressed_links.clear();
+  compressed_links.shrink_to_fit();
+  links_compressed = false;
+}
+
+
 /** Do a BFS on the candidates list */
 
 int HNSW::search_from_candidates(
@@ -528,25 +1358,55 @@ int HNSW::search_from_candidates(
   MinimaxHeap& candidates,
   VisitedTable& vt,
   HNSWStats& stats,
-  int level, int nres_in) const
+  int level, int nres_in,
+  const SearchParametersHNSW *params) const
 {
   int nres = nres_in;
   int ndis = 0;
+
+  // the ids that are not selected are still traversed but are not added
+  // to the results. The upper levels only provide entry points.
+  const IDSelector *sel = level == 0 && params ? params->sel : nullptr;
+
   for (int i = 0; i < candidates.size(); i++) {
     idx_t v1 = candidates.ids[i];
     float d = candidates.dis[i];
     FAISS_ASSERT(v1 >= 0);
-    if (nres < k) {
-      faiss::maxheap_push(++nres, D, I, d, v1);
-    } else if (d < D[0]) {
-      faiss::maxheap_pop(nres--, D, I);
-      faiss::maxheap_push(++nres, D, I, d, v1);
+    if (!sel || sel->is_member(v1)) {
+      if (nres < k) {
+        faiss::maxheap_push(++nres, D, I, d, v1);
+      } else if (d < D[0]) {
+        faiss::maxheap_pop(nres--, D, I);
+        faiss::maxheap_push(++nres, D, I, d, v1);
+      }
     }
     vt.set(v1);
   }
 
-  bool do_dis_check = check_relative_distance;
+  bool do_dis_check = params ?
+      params->check_relative_distance : check_relative_distance;
+  int efSearch = params ? params->efSearch : this->efSearch;
   int nstep = 0;
+  // the clock is checked every 16 expansions
+  double deadline_ms = level == 0 && params ? params->deadline_ms : 0;
+
+  auto add_to_results = [&](storage_idx_t v1, float d) {
+    if (!sel || sel->is_member(v1)) {
+      if (nres < k) {
+        faiss::maxheap_push(++nres, D, I, d, v1);
+      } else if (d < D[0]) {
+        faiss::maxheap_pop(nres--, D, I);
+        faiss::maxheap_push(++nres, D, I, d, v1);
+      }
+    }
+    candidates.push(v1, d);
+  };
+
+  std::vector<storage_idx_t> new_ids;
+  if (search_prefetch) {
+    new_ids.resize(nb_neighbors(level));
+  }
+  storage_idx_t links_buf[256];
 
   while (candidates.size() > 0) {
     float d0 = 0;
@@ -563,31 +1423,48 @@ int HNSW::search_from_candidates(
       }
     }
 
-    size_t begin, end;
-    neighbor_range(v0, level, &begin, &end);
-
-    for (size_t j = begin; j < end; j++) {
-      int v1 = neighbors[j];
-      if (v1 < 0) break;
-      if (vt.get(v1)) {
-        continue;
+    size_t nneigh;
+    const storage_idx_t *neigh = neighbor_list(v0, level, links_buf, &nneigh);
+
+    if (search_prefetch) {
+      // the vectors are loaded while the previous distances are computed
+      size_t nnew = 0;
+      for (size_t j = 0; j < nneigh; j++) {
+        int v1 = neigh[j];
+        if (v1 < 0) break;
+        if (vt.get(v1)) {
+          continue;
+        }
+        vt.set(v1);
+        qdis.prefetch(v1);
+        new_ids[nnew++] = v1;
       }
-      vt.set(v1);
-      ndis++;
-      float d = qdis(v1);
-      if (nres < k) {
-        faiss::maxheap_push(++nres, D, I, d, v1);
-      } else if (d < D[0]) {
-        faiss::maxheap_pop(nres--, D, I);
-        faiss::maxheap_push(++nres, D, I, d, v1);
+      for (size_t j = 0; j < nnew; j++) {
+        add_to_results(new_ids[j], qdis(new_ids[j]));
+      }
+      ndis += nnew;
+    } else {
+      for (size_t j = 0; j < nneigh; j++) {
+        int v1 = neigh[j];
+        if (v1 < 0) break;
+        if (vt.get(v1)) {
+          continue;
+        }
+        vt.set(v1);
+        ndis++;
+        add_to_results(v1, qdis(v1));
       }
-      candidates.push(v1, d);
     }
 
     nstep++;
     if (!do_dis_check && nstep > efSearch) {
       break;
     }
+    if (deadline_ms > 0 && nstep % 16 == 0 && candidates.size() > 0 &&
+        getmillisecs() > deadline_ms) {
+      stats.ntruncated++;
+      break;
+    }
   }
 
   if (level == 0) {
@@ -621,6 +1498,7 @@ std::priority_queue<HNSW::Node> HNSW::search_from_candidate_unbounded(
   candidates.push(node);
 
   vt->set(node.second);
+  storage_idx_t links_buf[256];
 
   while (!candidates.empty()) {
     float d0;
@@ -633,11 +1511,11 @@ std::priority_queue<HNSW::Node> HNSW::search_from_candidate_unbounded(
 
     candidates.pop();
 
-    size_t begin, end;
-    neighbor_range(v0, 0, &begin, &end);
+    size_t nneigh;
+    const storage_idx_t *neigh = neighbor_list(v0, 0, links_buf, &nneigh);
 
-    for (size_t j = begin; j < end; ++j) {
-      int v1 = neighbors[j];
+    for (size_t j = 0; j < nneigh; ++j) {
+      int v1 = neigh[j];
 
       if (v1 < 0) {
         break;
@@ -671,11 +1549,138 @@ std::priority_queue<HNSW::Node> HNSW::search_from_candidate_unbounded(
   return top_candidates;
 }
 
+namespace {
+
+/// skips the deleted nodes, then applies sel if any
+struct IDSelectorNotDeleted: IDSelector {
+  const HNSW& hnsw;
+  const IDSelector *sel;
+
+  IDSelectorNotDeleted(const HNSW& hnsw, const IDSelector *sel):
+    hnsw(hnsw), sel(sel) {}
+
+  bool is_member(idx_t id) const override {
+    return !hnsw.is_deleted(id) && (!sel || sel->is_member(id));
+  }
+};
+
+}  // namespace
+
+HNSWStats HNSW::range_search(DistanceComputer& qdis,
+                             RangeQueryTopResults& res,
+                             VisitedTable& vt,
+                             const SearchParametersHNSW *params) const
+{
+  HNSWStats stats;
+  if (entry_point < 0) {
+    return stats;
+  }
+  int ef = params ? params->efSearch : this->efSearch;
+  const IDSelector *sel = params ? params->sel : nullptr;
+  IDSelectorNotDeleted sel_not_deleted(*this, sel);
+  if (ndeleted > 0) {
+    sel = &sel_not_deleted;
+  }
+
+  //  greedy search on upper levels
+  storage_idx_t nearest = entry_point;
+  float d_nearest = qdis(nearest);
+  for(int level = max_level; level >= 1; level--) {
+    greedy_update_nearest(*this, qdis, level, nearest, d_nearest);
+  }
+
+  std::priority_queue<Node> top_candidates;
+  std::priority_queue<Node, std::vector<Node>, std::greater<Node>> candidates;
+  top_candidates.emplace(d_nearest, nearest);
+  candidates.emplace(d_nearest, nearest);
+  vt.set(nearest);
+  if (!sel || sel->is_member(nearest)) {
+    res.add(d_nearest, nearest);
+  }
+
+  size_t ndis = 0;
+  storage_idx_t links_buf[256];
+  while (!candidates.empty()) {
+    float d0;
+    storage_idx_t v0;
+    std::tie(d0, v0) = candidates.top();
+
+    // outside of the radius and of the beam
+    if (d0 >= res.threshold && d0 > top_candidates.top().first) {
+      break;
+    }
+    candidates.pop();
+
+    size_t nneigh;
+    const storage_idx_t *neigh = neighbor_list(v0, 0, links_buf, &nneigh);
+
+    for (size_t j = 0; j < nneigh; ++j) {
+      int v1 = neigh[j];
+      if (v1 < 0) {
+        break;
+      }
+      if (vt.get(v1)) {
+        continue;
+      }
+      vt.set(v1);
+
+      float d1 = qdis(v1);
+      ++ndis;
+
+      if (d1 < res.threshold && (!sel || sel->is_member(v1))) {
+        res.add(d1, v1);
+      }
+
+      if (d1 < res.threshold || top_candidates.size() < ef ||
+          d1 < top_candidates.top().first) {
+        candidates.emplace(d1, v1);
+        top_candidates.emplace(d1, v1);
+        if (top_candidates.size() > ef) {
+          top_candidates.pop();
+        }
+      }
+    }
+  }
+  vt.advance();
+
+  ++stats.n1;
+  if (candidates.size() == 0) {
+    ++stats.n2;
+  }
+  stats.n3 += ndis;
+  stats.ndis += ndis;
+  return stats;
+}
+
 HNSWStats HNSW::search(DistanceComputer& qdis, int k,
                        idx_t *I, float *D,
-                       VisitedTable& vt) const
+                       VisitedTable& vt,
+                       const SearchParametersHNSW *params) const
 {
   HNSWStats stats;
+  if (entry_point < 0) {
+    return stats;
+  }
+  int efSearch = params ? params->efSearch : this->efSearch;
+
+  // the stopping condition of the level 0 search is based on efSearch,
+  // so it has to follow k (eg. the nprobe of a coarse quantizer)
+  int ef = std::max(efSearch, k);
+  SearchParametersHNSW params_k;
+  // the deleted nodes are traversed but not returned
+  IDSelectorNotDeleted sel_not_deleted(*this, params ? params->sel : nullptr);
+  if (ef != efSearch || ndeleted > 0) {
+    if (params) {
+      params_k = *params;
+    } else {
+      params_k.check_relative_distance = check_relative_distance;
+    }
+    params_k.efSearch = ef;
+    if (ndeleted > 0) {
+      params_k.sel = &sel_not_deleted;
+    }
+    params = &params_k;
+  }
 
   if (upper_beam == 1) {
 
@@ -687,18 +1692,32 @@ HNSWStats HNSW::search(DistanceComputer& qdis, int k,
       greedy_update_nearest(*this, qdis, level, nearest, d_nearest);
     }
 
-    int ef = std::max(efSearch, k);
     if (search_bounded_queue) {
-      MinimaxHeap candidates(ef);
+      // reused by the successive queries of the thread
+      static thread_local MinimaxHeap candidates(0);
+      candidates.reset(ef);
 
       candidates.push(nearest, d_nearest);
 
-      search_from_candidates(qdis, k, I, D, candidates, vt, stats, 0);
+      search_from_candidates(qdis, k, I, D, candidates, vt, stats, 0, 0,
+                             params);
     } else {
       std::priority_queue<Node> top_candidates =
         search_from_candidate_unbounded(Node(d_nearest, nearest),
                                         qdis, ef, &vt, stats);
 
+      if (params && params->sel) {
+        // the traversal is not filtered, only the returned results
+        std::priority_queue<Node> selected;
+        while (!top_candidates.empty()) {
+          if (params->sel->is_member(top_candidates.top().second)) {
+            selected.push(top_candidates.top());
+          }
+          top_candidates.pop();
+        }
+        std::swap(top_candidates, selected);
+      }
+
       while (top_candidates.size() > k) {
         top_candidates.pop();
       }
@@ -717,7 +1736,8 @@ HNSWStats HNSW::search(DistanceComputer& qdis, int k,
 
   } else {
     int candidates_size = upper_beam;
-    MinimaxHeap candidates(candidates_size);
+    static thread_local MinimaxHeap candidates(0);
+    candidates.reset(candidates_size);
 
     std::vector<idx_t> I_to_next(candidates_size);
     std::vector<float> D_to_next(candidates_size);
@@ -737,12 +1757,13 @@ HNSWStats HNSW::search(DistanceComputer& qdis, int k,
       }
 
       if (level == 0) {
-        nres = search_from_candidates(qdis, k, I, D, candidates, vt, stats, 0);
+        nres = search_from_candidates(qdis, k, I, D, candidates, vt, stats,
+                                      0, 0, params);
       } else  {
         nres = search_from_candidates(
           qdis, candidates_size,
           I_to_next.data(), D_to_next.data(),
-          candidates, vt, stats, level
+          candidates, vt, stats, level, 0, params
         );
       }
       vt.advance();
@@ -775,6 +1796,15 @@ void HNSW::MinimaxHeap::clear() {
   nvalid = k = 0;
 }
 
+void HNSW::MinimaxHeap::reset(int n) {
+  this->n = n;
+  if (ids.size() < n) {
+    ids.resize(n);
+    dis.resize(n);
+  }
+  clear();
+}
+
 int HNSW::MinimaxHeap::pop_min(float *vmin_out) {
   assert(k > 0);
   // returns min. This is an O(n) operation
@@ -9,6 +9,9 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <vector>
 #include <unordered_set>
 #include <queue>
@@ -17,6 +20,7 @@
 
 #include <faiss/Index.h>
 #include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/maybe_owned_vector.h>
 #include <faiss/utils/random.h>
 #include <faiss/utils/Heap.h>
 #include <faiss/impl/platform_macros.h>
@@ -44,8 +48,21 @@ namespace faiss {
 
 struct VisitedTable;
 struct DistanceComputer; // from AuxIndexStructures
+struct RangeQueryTopResults; // from AuxIndexStructures
 struct HNSWStats;
 
+/// search parameters that override the HNSW fields for one search call
+struct SearchParametersHNSW: SearchParameters {
+  /// expansion factor at search time
+  int efSearch;
+
+  /// do we check whether the next best distance is good enough?
+  bool check_relative_distance;
+
+  SearchParametersHNSW(): efSearch(16), check_relative_distance(true) {}
+  ~SearchParametersHNSW() {}
+};
+
 struct HNSW {
   /// internal storage of vectors (32 bits: this is expensive)
   typedef int storage_idx_t;
@@ -76,6 +93,9 @@ struct HNSW {
 
     void clear();
 
+    /// clear and set the capacity to n, reusing the allocated memory
+    void reset(int n);
+
     int pop_min(float *vmin_out = nullptr);
 
     int count_below(float thresh);
@@ -114,7 +134,16 @@ struct HNSW {
 
   /// neighbors[offsets[i]:offsets[i+1]] is the list of neighbors of vector i
   /// for all levels. this is where all storage goes.
-  std::vector<storage_idx_t> neighbors;
+  MaybeOwnedVector<storage_idx_t> neighbors;
+
+  /** if true, the links are stored compressed (see compress_links):
+   * neighbors is empty and offsets[i] is the offset in
+   * compressed_links of the lists of vector i for all its levels */
+  bool links_compressed = false;
+  std::vector<uint8_t> compressed_links;
+
+  /// compressed_links is padded so that it can be read by 64-bit words
+  static const size_t compressed_links_padding = 8;
 
   /// entry point in the search structure (one of the points with maximum level
   storage_idx_t entry_point;
@@ -139,6 +168,29 @@ struct HNSW {
   /// use bounded queue during exploration
   bool search_bounded_queue = true;
 
+  /// during search: collect the unvisited neighbors of a node and
+  /// prefetch their vectors before computing the distances
+  bool search_prefetch = false;
+
+  /// if > 0, the points are added by batches of at most this size: the
+  /// links of all the points of a batch are searched in parallel in the
+  /// graph built so far, then they are applied grouped per node, which
+  /// requires no locks. Otherwise, points are added one by one with
+  /// per-node locks.
+  int add_batch_size = 0;
+
+  /** soft deletion: deleted[i] != 0 if node i is deleted (1 = still
+   * linked in the graph, 2 = detached by repair_deleted). The deleted
+   * nodes are traversed by the search but never returned. Empty if no
+   * node was ever deleted. */
+  std::vector<uint8_t> deleted;
+
+  /// nb of nodes marked as deleted
+  size_t ndeleted = 0;
+
+  /// detached nodes whose slot can be reused by a new point
+  std::vector<storage_idx_t> free_slots;
+
   // methods that initialize the tree sizes
 
   /// initialize the assign_probas and cum_nneighbor_per_level to
@@ -157,9 +209,91 @@ struct HNSW {
   int cum_nb_neighbors(int layer_no) const;
 
   /// range of entries in the neighbors table of vertex no at layer_no
+  /// (not available with compressed links)
   void neighbor_range(idx_t no, int layer_no,
                       size_t * begin, size_t * end) const;
 
+  /** neighbors of vertex no at layer_no, with compressed or uncompressed
+   * links. Returns *n entries, that may end with -1s: either directly in
+   * the neighbors table or decoded to buf, of size >= nb_neighbors(layer_no)
+   * (at most 255 with compressed links). */
+  const storage_idx_t* neighbor_list(storage_idx_t no, int layer_no,
+                                     storage_idx_t* buf, size_t* n) const {
+    if (links_compressed) {
+      *n = decode_links(no, layer_no, buf);
+      return buf;
+    }
+    size_t begin = offsets[no] + cum_nneighbor_per_level[layer_no];
+    *n = cum_nneighbor_per_level[layer_no + 1] -
+        cum_nneighbor_per_level[layer_no];
+    return neighbors.data() + begin;
+  }
+
+  /// decode the compressed links of vertex no at layer_no to out
+  /// @return nb of neighbors
+  size_t decode_links(storage_idx_t no, int layer_no,
+                      storage_idx_t* out) const;
+
+  bool is_deleted(storage_idx_t no) const {
+    return no < deleted.size() && deleted[no] != 0;
+  }
+
+  /// returns false if the node was already deleted
+  bool mark_deleted(storage_idx_t no);
+
+  /** replace the deleted neighbors of node pt_id at this level with
+   * the live nodes reachable through them, the new list is pruned
+   * with shrink_neighbor_list. Only the list of pt_id is written,
+   * so different nodes can be repaired in parallel.
+   *
+   * @return false if there was no deleted neighbor to replace */
+  bool repair_neighbors(DistanceComputer& qdis, storage_idx_t pt_id,
+                        int level, VisitedTable& vt);
+
+  /** clear the links of the deleted nodes, to be called once all the
+   * lists of live nodes were repaired. The detached nodes are appended
+   * to free_slots and the entry point is moved if it was deleted.
+   *
+   * @return nb of nodes detached by this call */
+  size_t detach_deleted();
+
+  /// node orders that place the nodes visited together close in memory
+  enum ReorderType {
+    REORDER_BFS,     ///< breadth-first traversal from the entry point
+    REORDER_RCM,     ///< reverse Cuthill-McKee
+    REORDER_GORDER,  ///< Gorder (Wei et al., SIGMOD'16)
+  };
+
+  /** compute a locality-improving order of the nodes from the level 0
+   * links: new node i is old node perm[i]
+   *
+   * @param window  window size for REORDER_GORDER
+   */
+  void locality_order(ReorderType type, idx_t *perm, int window = 5) const;
+
+  /// renumber the nodes: new node i is old node perm[i]
+  void permute_entries(const idx_t *perm);
+
+  /** append the nodes of other after the current ones (node i of other
+   * becomes node levels.size() + i), without any link between the two
+   * graphs. The entry point is the one of the graph with the highest
+   * level. Neither graph may have deleted nodes. */
+  void append_graph(const HNSW& other);
+
+  /** compress the links, which reduces the memory of the graph 2-4x.
+   * Each neighbor list is sorted and stored as the difference between
+   * its first id and the vertex id, followed by the gaps between
+   * consecutive ids, bit-packed with the smallest width that fits the
+   * list. The ids and gaps are small if the vertices were renumbered
+   * with locality_order / permute_entries first. The lists are decoded
+   * on the fly by the searches. The graph cannot be modified anymore
+   * (adding, repairing or renumbering raise an error) until
+   * decompress_links is called. */
+  void compress_links();
+
+  /// back to uncompressed links, the neighbor lists stay sorted by id
+  void decompress_links();
+
   /// only mandatory parameter: nb of neighbors
   explicit HNSW(int M = 32);
 
@@ -179,17 +313,52 @@ struct HNSW {
 
 
   /** add point pt_id on all levels <= pt_level and build the link
-   * structure for them. */
+   * structure for them. The levels below min_level are not linked. */
   void add_with_locks(DistanceComputer& ptdis, int pt_level, int pt_id,
                       std::vector<omp_lock_t>& locks,
-                      VisitedTable& vt);
+                      VisitedTable& vt, int min_level = 0);
+
+  /// for batched addition: dest should be added to the neighbors of src
+  struct LinkUpdate {
+    storage_idx_t src, dest;
+    int level;
+    bool operator < (const LinkUpdate & other) const;
+  };
+
+  /** batched addition, first phase: search the neighbors of pt_id in
+   * the current graph, without modifying it. The links in both
+   * directions are appended to updates. The graph must not be empty.
+   *
+   * @param entry  if >= 0, start the search from this node at its top
+   *               level instead of the entry point, eg. to search only
+   *               the subgraph of a merged graph that contains it
+   */
+  void search_link_updates(DistanceComputer& ptdis, int pt_level,
+                           storage_idx_t pt_id, VisitedTable& vt,
+                           std::vector<LinkUpdate>& updates,
+                           storage_idx_t entry = -1) const;
+
+  /** batched addition, second phase: apply n updates that all have
+   * the same src. Updates with different src can be applied in
+   * parallel. */
+  void apply_link_updates(DistanceComputer& qdis,
+                          const LinkUpdate *updates, size_t n);
+
+  /** same as apply_link_updates, but at each level the current
+   * neighbors of src and all the new ones are pruned together with
+   * shrink_neighbor_list, instead of adding the links one by one. The
+   * updates must be sorted by level. */
+  void reprune_link_updates(DistanceComputer& qdis,
+                            const LinkUpdate *updates, size_t n);
 
   int search_from_candidates(DistanceComputer& qdis, int k,
                              idx_t *I, float *D,
                              MinimaxHeap& candidates,
                              VisitedTable &vt,
                              HNSWStats &stats,
-                             int level, int nres_in = 0) const;
+                             int level, int nres_in = 0,
+                             const SearchParametersHNSW *params = nullptr
+                             ) const;
 
   std::priority_queue<Node> search_from_candidate_unbounded(
     const Node& node,
@@ -198,16 +367,31 @@ struct HNSW {
     VisitedTable *vt,
     HNSWStats &stats) const;
 
-  /// search interface
+  /** search interface. If params->sel is set, the non-selected nodes are
+   * still visited by the graph traversal but are not returned */
   HNSWStats search(DistanceComputer& qdis, int k,
                    idx_t *I, float *D,
-                   VisitedTable &vt) const;
+                   VisitedTable &vt,
+                   const SearchParametersHNSW *params = nullptr) const;
+
+  /** range search interface: the vectors with distance <
+   * res.threshold are added to res. At level 0, the beam of size
+   * efSearch is extended with all the visited nodes that are within the
+   * radius, so that the search goes on as long as it finds results. It
+   * stops earlier when res reaches its max_results. */
+  HNSWStats range_search(DistanceComputer& qdis,
+                         RangeQueryTopResults& res,
+                         VisitedTable &vt,
+                         const SearchParametersHNSW *params = nullptr) const;
 
   void reset();
 
   void clear_neighbor_tables(int level);
   void print_neighbor_stats(int level) const;
 
+  /// links, per-node levels and offsets, deletion state
+  MemoryUsage memory_usage() const;
+
   int prepare_level_tab(size_t n, bool preset_levels = false);
 
   static void shrink_neighbor_list(
@@ -224,32 +408,99 @@ struct HNSW {
  **************************************************************/
 
 /// set implementation optimized for fast access.
+/** Set of the nodes visited by a graph traversal.
+ *
+ * In dense mode, there is a 16-bit tag per node and the visited nodes are
+ * the ones whose tag is visno, so that advance() just increments visno.
+ *
+ * In sparse mode, the visited nodes are stored in an open-addressing hash
+ * table whose size depends only on the number of visited nodes. It is
+ * chosen when few nodes are visited per traversal w.r.t. the graph size.
+ */
 struct VisitedTable {
-  std::vector<uint8_t> visited;
+  /// dense mode: tag per node
+  std::vector<uint16_t> visited;
   int visno;
 
-  explicit VisitedTable(int size)
-    : visited(size), visno(1) {}
+  /// sparse mode: hash table of the visited nodes (-1 = empty slot)
+  bool sparse;
+  std::vector<int> hash_table;
+  size_t nhash;  ///< nb of nodes in the hash table
+
+  /** @param size         nb of nodes of the graph
+   *  @param nvisit_hint   expected max nb of visited nodes per traversal,
+   *                       0 if unknown (then the dense mode is used)
+   */
+  explicit VisitedTable(int size, size_t nvisit_hint = 0);
+
+  /// is the sparse mode used for this graph size and nb of visits
+  static bool use_sparse(size_t size, size_t nvisit_hint);
 
   /// set flog #no to true
   void set(int no) {
-    visited[no] = visno;
+    if (sparse) {
+      hash_insert(no);
+    } else {
+      visited[no] = visno;
+    }
   }
 
   /// get flag #no
   bool get(int no) const {
+    if (sparse) {
+      return hash_find(no);
+    }
     return visited[no] == visno;
   }
 
   /// reset all flags to false
   void advance() {
+    if (sparse) {
+      if (nhash > 0) {
+        std::fill(hash_table.begin(), hash_table.end(), -1);
+        nhash = 0;
+      }
+      return;
+    }
     visno++;
-    if (visno == 250) {
-      // 250 rather than 255 because sometimes we use visno and visno+1
+    if (visno == 65530) {
+      // not 65535 because sometimes we use visno and visno+1
       memset(visited.data(), 0, sizeof(visited[0]) * visited.size());
       visno = 1;
     }
   }
+
+  // sparse mode implementation
+  size_t hash_slot(int no) const {
+    return (uint32_t(no) * 0x9E3779B1U) & (hash_table.size() - 1);
+  }
+
+  bool hash_find(int no) const {
+    for (size_t i = hash_slot(no); ; i = (i + 1) & (hash_table.size() - 1)) {
+      if (hash_table[i] == no) return true;
+      if (hash_table[i] == -1) return false;
+    }
+  }
+
+  void hash_insert(int no);
+};
+
+
+/** A VisitedTable taken from a pool of the current thread and given back
+ * at destruction, so that searches do not allocate and clear a table of
+ * ntotal entries per call. The table is reset when it is acquired.
+ */
+struct ScratchVisitedTable {
+  explicit ScratchVisitedTable(int size, size_t nvisit_hint = 0);
+  ~ScratchVisitedTable();
+
+  ScratchVisitedTable(const ScratchVisitedTable&) = delete;
+  ScratchVisitedTable& operator=(const ScratchVisitedTable&) = delete;
+
+  VisitedTable& operator*() { return *vt; }
+
+ private:
+  VisitedTable* vt;
 };
 
 
@@ -257,14 +508,18 @@ struct HNSWStats {
   size_t n1, n2, n3;
   size_t ndis;
   size_t nreorder;
+  size_t ntruncated; ///< nb of searches cut by their deadline
 
-  HNSWStats(size_t n1 = 0, size_t n2 = 0, size_t n3 = 0, size_t ndis = 0, size_t nreorder = 0)
-    : n1(n1), n2(n2), n3(n3), ndis(ndis), nreorder(nreorder) {}
+  HNSWStats(size_t n1 = 0, size_t n2 = 0, size_t n3 = 0, size_t ndis = 0,
+            size_t nreorder = 0, size_t ntruncated = 0)
+    : n1(n1), n2(n2), n3(n3), ndis(ndis), nreorder(nreorder),
+      ntruncated(ntruncated) {}
 
   void reset() {
     n1 = n2 = n3 = 0;
     ndis = 0;
     nreorder = 0;
+    ntruncated = 0;
   }
 
   void combine(const HNSWStats& other) {
@@ -273,6 +528,7 @@ struct HNSWStats {
     n3 += other.n3;
     ndis += other.ndis;
     nreorder += other.nreorder;
+    ntruncated += other.ntruncated;
   }
 };
 
@@ -0,0 +1,305 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/impl/LocalSearchQuantizer.h>
+
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/distances.h>
+#include <faiss/utils/random.h>
+#include <faiss/utils/utils.h>
+
+
+extern "C" {
+
+// this is to keep the clang syntax checker happy
+#ifndef FINTEGER
+#define FINTEGER int
+#endif
+
+/* declare BLAS functions, see http://www.netlib.org/clapack/cblas/ */
+
+int sgemm_ (const char *transa, const char *transb, FINTEGER *m, FINTEGER *
+            n, FINTEGER *k, const float *alpha, const float *a,
+            FINTEGER *lda, const float *b, FINTEGER *
+            ldb, float *beta, float *c, FINTEGER *ldc);
+
+/* Lapack functions from http://www.netlib.org/clapack/old/single/ */
+
+int sposv_ (const char *uplo, FINTEGER *n, FINTEGER *nrhs,
+            float *a, FINTEGER *lda, float *b, FINTEGER *ldb,
+            FINTEGER *info);
+
+}
+
+
+namespace faiss {
+
+LocalSearchQuantizer::LocalSearchQuantizer (size_t d, size_t M, size_t nbits,
+                                            Search_type_t search_type):
+    AdditiveQuantizer (d, M, nbits, search_type),
+    train_iters (25),
+    encode_ils_iters (16),
+    train_ils_iters (8),
+    icm_iters (4),
+    nperts (4),
+    lambd (1e-2),
+    chunk_size (1024),
+    random_seed (0x12345)
+{}
+
+LocalSearchQuantizer::LocalSearchQuantizer ():
+    LocalSearchQuantizer (0, 1, 8)
+{}
+
+
+namespace {
+
+/* The objective for the codes b of a vector x is
+ *
+ *    ||x - sum_m C_m[b_m]||^2 - ||x||^2 =
+ *         sum_m U[m, b_m] + sum_(m < m') B[m, b_m, m', b_m']
+ *
+ * with the unary terms U[m, k] = ||C_m[k]||^2 - 2 <x, C_m[k]> and the
+ * binary terms B[m, k, m', k'] = 2 <C_m[k], C_m'[k']>. B is stored as a
+ * symmetric MK * MK matrix.
+ */
+struct ICMEncoder {
+    size_t M, K;
+    const float *binaries;
+    size_t icm_iters, nperts;
+
+    float evaluate (const float *unaries, const int32_t *codes) const
+    {
+        size_t MK = M * K;
+        float obj = 0;
+        for (size_t m = 0; m < M; m++) {
+            const float *row = binaries + (m * K + codes[m]) * MK;
+            obj += unaries[m * K + codes[m]];
+            for (size_t m2 = m + 1; m2 < M; m2++) {
+                obj += row[m2 * K + codes[m2]];
+            }
+        }
+        return obj;
+    }
+
+    /// optimize each code in turn, the other ones being fixed
+    void icm (const float *unaries, int32_t *codes, float *costs) const
+    {
+        size_t MK = M * K;
+        for (size_t it = 0; it < icm_iters; it++) {
+            for (size_t m = 0; m < M; m++) {
+                memcpy (costs, unaries + m * K, sizeof (*costs) * K);
+                for (size_t m2 = 0; m2 < M; m2++) {
+                    if (m2 == m) {
+                        continue;
+                    }
+                    const float *row =
+                        binaries + (m2 * K + codes[m2]) * MK + m * K;
+                    for (size_t k = 0; k < K; k++) {
+                        costs[k] += row[k];
+                    }
+                }
+                codes[m] = std::min_element (costs, costs + K) - costs;
+            }
+        }
+    }
+
+    void encode (const float *unaries, int32_t *codes, size_t ils_iters,
+                 RandomGenerator & rng) const
+    {
+        std::vector<float> costs (K);
+        std::vector<int32_t> cur (M);
+
+        icm (unaries, codes, costs.data());
+        float best_obj = evaluate (unaries, codes);
+
+        for (size_t it = 0; it < ils_iters; it++) {
+            memcpy (cur.data(), codes, sizeof (*codes) * M);
+            for (size_t p = 0; p < nperts; p++) {
+                cur[rng.rand_int (M)] = rng.rand_int (K);
+            }
+            icm (unaries, cur.data(), costs.data());
+            float obj = evaluate (unaries, cur.data());
+            if (obj < best_obj) {
+                best_obj = obj;
+                memcpy (codes, cur.data(), sizeof (*codes) * M);
+            }
+        }
+    }
+};
+
+} // anonymous namespace
+
+
+void LocalSearchQuantizer::icm_encode (const float *x, int32_t *codes,
+                                       size_t n, size_t ils_iters,
+                                       int64_t seed) const
+{
+    size_t MK = M * K;
+    FINTEGER mki = MK, di = d;
+
+    // binary terms
+    std::vector<float> binaries (MK * MK);
+    {
+        float two = 2, zero = 0;
+        sgemm_ ("Transposed", "Not transposed", &mki, &mki, &di,
+                &two, codebooks.data(), &di, codebooks.data(), &di,
+                &zero, binaries.data(), &mki);
+    }
+
+    std::vector<float> cb_norms (MK);
+    fvec_norms_L2sqr (cb_norms.data(), codebooks.data(), d, MK);
+
+    ICMEncoder encoder = {M, K, binaries.data(), icm_iters, nperts};
+
+    std::vector<float> unaries (std::min (n, chunk_size) * MK);
+
+    for (size_t i0 = 0; i0 < n; i0 += chunk_size) {
+        size_t i1 = std::min (n, i0 + chunk_size);
+        FINTEGER ni = i1 - i0;
+
+        // unaries = cb_norms - 2 x * codebooks^T
+        for (size_t i = 0; i < i1 - i0; i++) {
+            memcpy (unaries.data() + i * MK, cb_norms.data(),
+                    sizeof (float) * MK);
+        }
+        float minus_two = -2, one = 1;
+        sgemm_ ("Transposed", "Not transposed", &mki, &ni, &di,
+                &minus_two, codebooks.data(), &di, x + i0 * d, &di,
+                &one, unaries.data(), &mki);
+
+#pragma omp parallel for
+        for (int64_t i = i0; i < i1; i++) {
+            RandomGenerator rng (seed + i);
+            encoder.encode (unaries.data() + (i - i0) * MK,
+                            codes + i * M, ils_iters, rng);
+        }
+    }
+}
+
+
+void LocalSearchQuantizer::update_codebooks (const float *x,
+                                             const int32_t *codes, size_t n)
+{
+    size_t MK = M * K;
+
+    // normal equations of the least-squares problem
+    //     min_C ||X - B C||^2 + lambd ||C||^2
+    // where B is the n * MK one-hot encoding of the codes
+    std::vector<float> BtB (MK * MK);
+    std::vector<float> BtX (MK * d);
+
+    for (size_t i = 0; i < n; i++) {
+        const int32_t *ci = codes + i * M;
+        for (size_t m1 = 0; m1 < M; m1++) {
+            float *row = BtB.data() + (m1 * K + ci[m1]) * MK;
+            for (size_t m2 = 0; m2 < M; m2++) {
+                row[m2 * K + ci[m2]] += 1;
+            }
+            fvec_madd (d, BtX.data() + (m1 * K + ci[m1]) * d,
+                       1.0, x + i * d,
+                       BtX.data() + (m1 * K + ci[m1]) * d);
+        }
+    }
+    for (size_t i = 0; i < MK; i++) {
+        BtB[i * MK + i] += lambd;
+    }
+
+    // sposv expects the right-hand side in column-major order
+    std::vector<float> rhs (MK * d);
+    for (size_t i = 0; i < MK; i++) {
+        for (size_t j = 0; j < d; j++) {
+            rhs[i + j * MK] = BtX[i * d + j];
+        }
+    }
+
+    FINTEGER mki = MK, di = d, info;
+    sposv_ ("Upper", &mki, &di, BtB.data(), &mki, rhs.data(), &mki, &info);
+    FAISS_THROW_IF_NOT_FMT (info == 0, "sposv failed with info=%d",
+                            int(info));
+
+    for (size_t i = 0; i < MK; i++) {
+        for (size_t j = 0; j < d; j++) {
+            codebooks[i * d + j] = rhs[i + j * MK];
+        }
+    }
+}
+
+
+void LocalSearchQuantizer::train (size_t n, const float *x)
+{
+    codebooks.resize (M * K * d);
+
+    std::vector<int32_t> codes (n * M);
+    {
+        RandomGenerator rng (random_seed);
+        for (size_t i = 0; i < n * M; i++) {
+            codes[i] = rng.rand_int (K);
+        }
+    }
+
+    double t0 = getmillisecs ();
+    std::vector<float> x_recons (n * d);
+
+    for (size_t it = 0; it < train_iters; it++) {
+        update_codebooks (x, codes.data(), n);
+        icm_encode (x, codes.data(), n, train_ils_iters,
+                    random_seed + (it + 1) * n);
+
+        if (verbose) {
+            decode_unpacked (codes.data(), x_recons.data(), n);
+            float mse = fvec_L2sqr (x, x_recons.data(), n * d) / n;
+            printf ("[%.3f s] LSQ iteration %zd/%zd, MSE %g\n",
+                    (getmillisecs () - t0) / 1000,
+                    it + 1, train_iters, mse);
+        }
+    }
+
+    // final codebooks for the last codes
+    update_codebooks (x, codes.data(), n);
+    is_trained = true;
+
+    if (norm_bits > 0) {
+        std::vector<float> norms (n);
+        compute_norms (codes.data(), n, nullptr, norms.data());
+        train_norm (n, norms.data());
+    }
+}
+
+
+void LocalSearchQuantizer::compute_codes (const float *x, uint8_t *codes_out,
+                                          size_t n,
+                                          const float *centroids) const
+{
+    FAISS_THROW_IF_NOT_MSG (is_trained, "LSQ is not trained yet");
+
+    std::vector<int32_t> codes (n * M);
+    {
+        RandomGenerator rng (random_seed);
+        for (size_t i = 0; i < n * M; i++) {
+            codes[i] = rng.rand_int (K);
+        }
+    }
+    icm_encode (x, codes.data(), n, encode_ils_iters, random_seed);
+
+    std::vector<float> norms;
+    if (norm_bits > 0) {
+        norms.resize (n);
+        compute_norms (codes.data(), n, centroids, norms.data());
+    }
+    pack_codes (n, codes.data(), codes_out,
+                norms.empty() ? nullptr : norms.data());
+}
+
+} // namespace faiss
@@ -0,0 +1,72 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include <faiss/impl/AdditiveQuantizer.h>
+
+namespace faiss {
+
+/** Local Search Quantization (LSQ++)
+ *
+ * Julieta Martinez, et al., "LSQ++: Lower running time and higher recall
+ * in multi-codebook quantization", ECCV 2018.
+ *
+ * The training alternates between the update of the codebooks, a
+ * regularized least-squares problem, and the update of the codes. The
+ * codes are optimized with iterated conditional modes (ICM), restarted
+ * from random perturbations of the best codes (iterated local search).
+ */
+struct LocalSearchQuantizer: AdditiveQuantizer {
+
+    size_t train_iters;       ///< nb of iterations of the training
+    size_t encode_ils_iters;  ///< nb of local search iterations to encode
+    size_t train_ils_iters;   ///< same, in each training iteration
+    size_t icm_iters;         ///< nb of ICM iterations of a local search
+    size_t nperts;            ///< nb of codes perturbed in a local search
+
+    float lambd;              ///< regularization of the codebook update
+
+    size_t chunk_size;        ///< nb of vectors encoded at a time
+    int random_seed;          ///< seed of the random number generators
+
+    LocalSearchQuantizer (size_t d, size_t M, size_t nbits,
+                          Search_type_t search_type = ST_decompress);
+
+    LocalSearchQuantizer ();
+
+    /// train the codebooks and the norm quantizer
+    void train (size_t n, const float *x) override;
+
+    void compute_codes (const float *x, uint8_t *codes, size_t n,
+                        const float *centroids = nullptr) const override;
+
+    /** update the codebooks given the codes of the training vectors
+     *
+     * @param x      training vectors, size n * d
+     * @param codes  their codebook indices, size n * M
+     */
+    void update_codebooks (const float *x, const int32_t *codes, size_t n);
+
+    /** optimize the codes of a set of vectors with the current codebooks
+     *
+     * @param x          vectors, size n * d
+     * @param codes      initial codes on input, size n * M
+     * @param ils_iters  nb of local search iterations
+     * @param seed       seed for the perturbations
+     */
+    void icm_encode (const float *x, int32_t *codes, size_t n,
+                     size_t ils_iters, int64_t seed) const;
+};
+
+} // namespace faiss
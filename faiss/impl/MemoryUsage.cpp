@@ -0,0 +1,129 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/impl/MemoryUsage.h>
+
+#include <cstdio>
+
+
+namespace faiss {
+
+
+size_t MemoryUsage::total_size () const
+{
+    size_t tot = size;
+    for (const MemoryUsage & c: children) {
+        tot += c.total_size ();
+    }
+    return tot;
+}
+
+size_t MemoryUsage::total_capacity () const
+{
+    size_t tot = capacity;
+    for (const MemoryUsage & c: children) {
+        tot += c.total_capacity ();
+    }
+    return tot;
+}
+
+size_t MemoryUsage::total_mapped () const
+{
+    size_t tot = mapped;
+    for (const MemoryUsage & c: children) {
+        tot += c.total_mapped ();
+    }
+    return tot;
+}
+
+size_t MemoryUsage::total_device () const
+{
+    size_t tot = device;
+    for (const MemoryUsage & c: children) {
+        tot += c.total_device ();
+    }
+    return tot;
+}
+
+MemoryUsage MemoryUsage::object (const std::string & type)
+{
+    std::string t = type.compare (0, 7, "faiss::") == 0 ?
+        type.substr (7) : type;
+    MemoryUsage mu (t);
+    mu.type = t;
+    return mu;
+}
+
+MemoryUsage & MemoryUsage::add (const MemoryUsage & child)
+{
+    children.push_back (child);
+    return children.back ();
+}
+
+MemoryUsage & MemoryUsage::add (
+        const std::string & name, const MemoryUsage & child)
+{
+    MemoryUsage & c = add (child);
+    c.name = name;
+    return c;
+}
+
+const MemoryUsage * MemoryUsage::find (const std::string & path) const
+{
+    size_t slash = path.find ('/');
+    std::string head = path.substr (0, slash);
+    for (const MemoryUsage & c: children) {
+        if (c.name == head) {
+            return slash == std::string::npos ? &c :
+                c.find (path.substr (slash + 1));
+        }
+    }
+    return nullptr;
+}
+
+namespace {
+
+void append_lines (const MemoryUsage & mu, int depth, std::string & out)
+{
+    out.append (2 * depth, ' ');
+    out += mu.name;
+    if (!mu.type.empty() && mu.type != mu.name) {
+        out += " (" + mu.type + ")";
+    }
+    char buf[128];
+    snprintf (buf, sizeof(buf), ": size=%zd capacity=%zd",
+              mu.total_size(), mu.total_capacity());
+    out += buf;
+    size_t mapped = mu.total_mapped ();
+    if (mapped > 0) {
+        snprintf (buf, sizeof(buf), " mapped=%zd", mapped);
+        out += buf;
+    }
+    size_t device = mu.total_device ();
+    if (device > 0) {
+        snprintf (buf, sizeof(buf), " device=%zd", device);
+        out += buf;
+    }
+    out += "\n";
+    for (const MemoryUsage & c: mu.children) {
+        append_lines (c, depth + 1, out);
+    }
+}
+
+} // anonymous namespace
+
+std::string MemoryUsage::to_string () const
+{
+    std::string out;
+    append_lines (*this, 0, out);
+    return out;
+}
+
+
+} // namespace faiss
@@ -0,0 +1,135 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+
+namespace faiss {
+
+template <typename T>
+struct MaybeOwnedVector;
+
+
+/** Memory used by an index or one of its components, in bytes, with the
+ * breakdown over its sub-components (see Index::memory_usage).
+ *
+ * For each node:
+ * - size: bytes of the stored data
+ * - capacity: bytes allocated on the heap for it, including the unused
+ *   capacity of the containers and the allocator overhead of the node
+ *   containers (hash tables). capacity >= size for heap data.
+ * - mapped: bytes of memory-mapped files that hold the data. They are
+ *   not in capacity, since the OS pages them in and out.
+ * - device: bytes allocated on the GPU (or in unified memory) for the
+ *   data of the GPU indexes. They are not in capacity either.
+ *
+ * The totals of a node include its children. The nodes of objects
+ * (indexes, inverted lists) have a type, the class name. The name of
+ * the root node is the type, the name of the other nodes is the role of
+ * the component in its parent (eg. "quantizer", "codes").
+ */
+struct MemoryUsage {
+    std::string name;
+    std::string type;
+    size_t size = 0;
+    size_t capacity = 0;
+    size_t mapped = 0;
+    size_t device = 0;
+    std::vector<MemoryUsage> children;
+
+    MemoryUsage () {}
+
+    explicit MemoryUsage (const std::string & name,
+                          size_t size = 0, size_t capacity = 0):
+        name (name), size (size), capacity (capacity) {}
+
+    size_t total_size () const;
+    size_t total_capacity () const;
+    size_t total_mapped () const;
+    size_t total_device () const;
+
+    /// node of an object, named after its type (without the faiss::
+    /// namespace)
+    static MemoryUsage object (const std::string & type);
+
+    /// append a child, returns a reference to it
+    MemoryUsage & add (const MemoryUsage & child);
+
+    /// append a child with a new name (eg. a sub-index)
+    MemoryUsage & add (const std::string & name, const MemoryUsage & child);
+
+    MemoryUsage & add (const std::string & name,
+                       size_t size, size_t capacity) {
+        return add (MemoryUsage (name, size, capacity));
+    }
+
+    template <class T, class A>
+    MemoryUsage & add (const std::string & name,
+                       const std::vector<T, A> & v) {
+        return add (name, v.size() * sizeof(T), v.capacity() * sizeof(T));
+    }
+
+    /// the inner vectors are separate heap blocks (eg. inverted lists)
+    template <class T, class A, class B>
+    MemoryUsage & add (const std::string & name,
+                       const std::vector<std::vector<T, A>, B> & vv) {
+        size_t sz = vv.size() * sizeof(vv[0]);
+        size_t cap = vv.capacity() * sizeof(vv[0]);
+        for (const auto & v: vv) {
+            sz += v.size() * sizeof(T);
+            cap += v.capacity() * sizeof(T);
+        }
+        return add (name, sz, cap);
+    }
+
+    /// views on memory-mapped files are counted as mapped
+    template <class T>
+    MemoryUsage & add (const std::string & name,
+                       const MaybeOwnedVector<T> & v) {
+        if (v.is_owned) {
+            return add (name, v.owned_data);
+        }
+        MemoryUsage & c = add (MemoryUsage (name, v.size() * sizeof(T), 0));
+        c.mapped = v.size() * sizeof(T);
+        return c;
+    }
+
+    /// data stored in GPU allocations, size bytes out of device bytes
+    MemoryUsage & add_device (const std::string & name,
+                              size_t size, size_t device) {
+        MemoryUsage & c = add (MemoryUsage (name, size, 0));
+        c.device = device;
+        return c;
+    }
+
+    /** std::unordered_map-like hash table. The capacity is estimated
+     * for node-based tables: the buckets, plus a next pointer and a
+     * cached hash per entry. */
+    template <class M>
+    MemoryUsage & add_hash_table (const std::string & name, const M & m) {
+        size_t entry_size = sizeof(typename M::value_type);
+        return add (name, m.size() * entry_size,
+                    m.bucket_count() * sizeof(void*) +
+                    m.size() * (entry_size + sizeof(void*) + sizeof(size_t)));
+    }
+
+    /** child by path, eg. "invlists/codes", nullptr if there is none.
+     * The first child with a matching name is used at each level. */
+    const MemoryUsage * find (const std::string & path) const;
+
+    /// one line per node, indented by depth, with the totals of the node
+    std::string to_string () const;
+};
+
+
+} // namespace faiss
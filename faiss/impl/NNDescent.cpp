@@ -0,0 +1,251 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/impl/NNDescent.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <iterator>
+#include <limits>
+#include <memory>
+
+#include <omp.h>
+
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/random.h>
+#include <faiss/utils/utils.h>
+
+namespace faiss {
+
+
+namespace {
+
+typedef NNDescent::storage_idx_t storage_idx_t;
+
+struct Neighbor {
+  storage_idx_t id;
+  float dis;
+  bool is_new;  ///< not joined yet
+
+  Neighbor(storage_idx_t id, float dis, bool is_new):
+    id(id), dis(dis), is_new(is_new) {}
+
+  bool operator < (const Neighbor &other) const {
+    return dis < other.dis || (dis == other.dis && id < other.id);
+  }
+};
+
+struct Nhood {
+  /// current neighbors, sorted by increasing distance
+  std::vector<Neighbor> pool;
+
+  /// sampled neighbors and reverse neighbors of the iteration
+  std::vector<storage_idx_t> nn_new, nn_old, rnn_new, rnn_old;
+};
+
+/// insert a neighbor in a pool of size at most L, returns 1 if it was
+/// inserted
+int insert_neighbor(std::vector<Neighbor>& pool, int L,
+                    storage_idx_t id, float dis)
+{
+  if (pool.size() >= L && !(dis < pool.back().dis)) {
+    return 0;
+  }
+  for (const Neighbor& nb : pool) {
+    if (nb.id == id) {
+      return 0;
+    }
+  }
+  Neighbor nn(id, dis, true);
+  size_t pos = std::upper_bound(pool.begin(), pool.end(), nn) - pool.begin();
+  pool.insert(pool.begin() + pos, nn);
+  if (pool.size() > L) {
+    pool.pop_back();
+  }
+  return 1;
+}
+
+/// sorted union of two lists without duplicates
+void merge_lists(const std::vector<storage_idx_t>& a,
+                 const std::vector<storage_idx_t>& b,
+                 std::vector<storage_idx_t>& out)
+{
+  out.assign(a.begin(), a.end());
+  out.insert(out.end(), b.begin(), b.end());
+  std::sort(out.begin(), out.end());
+  out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+
+}  // namespace
+
+
+NNDescent::NNDescent(int K):
+  K(K), L(K), S(10), R(100), niter(10), delta(0.002), seed(1234),
+  verbose(false)
+{}
+
+
+void NNDescent::build(const Index *storage, idx_t *I, float *D) const
+{
+  FAISS_THROW_IF_NOT(K > 0 && L >= K && S > 0 && R >= 0);
+  idx_t n = storage->ntotal;
+  FAISS_THROW_IF_NOT(n < std::numeric_limits<storage_idx_t>::max());
+  // smaller is better inside the algorithm
+  float sign = storage->metric_type == METRIC_INNER_PRODUCT ? -1 : 1;
+
+  std::vector<Nhood> graph(n);
+  std::vector<omp_lock_t> locks(n);
+  // largest distance of each pool once it is full, read without locking
+  // to discard most of the pairs of the local join cheaply
+  std::unique_ptr<std::atomic<float>[]> radius(new std::atomic<float>[n]);
+  for (idx_t i = 0; i < n; i++) {
+    omp_init_lock(&locks[i]);
+  }
+  double t0 = getmillisecs();
+
+  // random initial graph
+  int ninit = std::min((idx_t)L, n - 1);
+#pragma omp parallel
+  {
+    std::unique_ptr<DistanceComputer> dis(storage->get_distance_computer());
+#pragma omp for
+    for (idx_t i = 0; i < n; i++) {
+      RandomGenerator rng(seed + i);
+      std::vector<Neighbor>& pool = graph[i].pool;
+      pool.reserve(L + 1);
+      while (pool.size() < ninit) {
+        storage_idx_t j = rng.rand_int((int)n);
+        if (j != i) {
+          insert_neighbor(pool, L, j, sign * dis->symmetric_dis(i, j));
+        }
+      }
+      radius[i].store(pool.size() >= L ? pool.back().dis :
+                      std::numeric_limits<float>::infinity(),
+                      std::memory_order_relaxed);
+    }
+  }
+
+  for (int iter = 0; iter < niter; iter++) {
+
+    // sample at most S new neighbors per node, they become old
+#pragma omp parallel for
+    for (idx_t i = 0; i < n; i++) {
+      Nhood& nh = graph[i];
+      nh.nn_new.clear();
+      nh.nn_old.clear();
+      nh.rnn_new.clear();
+      nh.rnn_old.clear();
+      for (Neighbor& nb : nh.pool) {
+        if (!nb.is_new) {
+          nh.nn_old.push_back(nb.id);
+        } else if (nh.nn_new.size() < S) {
+          nh.nn_new.push_back(nb.id);
+          nb.is_new = false;
+        }
+      }
+    }
+
+    // reverse neighbors
+#pragma omp parallel for
+    for (idx_t i = 0; i < n; i++) {
+      for (int is_new = 0; is_new < 2; is_new++) {
+        const std::vector<storage_idx_t>& nn =
+          is_new ? graph[i].nn_new : graph[i].nn_old;
+        for (storage_idx_t j : nn) {
+          std::vector<storage_idx_t>& rnn =
+            is_new ? graph[j].rnn_new : graph[j].rnn_old;
+          omp_set_lock(&locks[j]);
+          if (rnn.size() < R) {
+            rnn.push_back(i);
+          }
+          omp_unset_lock(&locks[j]);
+        }
+      }
+    }
+
+    // local join: compare the new neighbors with each other and with
+    // the old neighbors
+    size_t nupdate = 0;
+#pragma omp parallel reduction(+: nupdate)
+    {
+      std::unique_ptr<DistanceComputer> dis(storage->get_distance_computer());
+      std::vector<storage_idx_t> nn_new, nn_old, old_only;
+
+      auto try_insert = [&](storage_idx_t a, storage_idx_t b, float d) {
+        if (!(d < radius[a].load(std::memory_order_relaxed))) {
+          return;
+        }
+        omp_set_lock(&locks[a]);
+        std::vector<Neighbor>& pool = graph[a].pool;
+        if (insert_neighbor(pool, L, b, d)) {
+          nupdate++;
+          if (pool.size() >= L) {
+            radius[a].store(pool.back().dis, std::memory_order_relaxed);
+          }
+        }
+        omp_unset_lock(&locks[a]);
+      };
+
+      auto join = [&](storage_idx_t a, storage_idx_t b) {
+        float d = sign * dis->symmetric_dis(a, b);
+        try_insert(a, b, d);
+        try_insert(b, a, d);
+      };
+
+#pragma omp for schedule(dynamic, 64)
+      for (idx_t i = 0; i < n; i++) {
+        const Nhood& nh = graph[i];
+        merge_lists(nh.nn_new, nh.rnn_new, nn_new);
+        merge_lists(nh.nn_old, nh.rnn_old, nn_old);
+        old_only.clear();
+        std::set_difference(nn_old.begin(), nn_old.end(),
+                            nn_new.begin(), nn_new.end(),
+                            std::back_inserter(old_only));
+        for (size_t p = 0; p < nn_new.size(); p++) {
+          for (size_t q = p + 1; q < nn_new.size(); q++) {
+            join(nn_new[p], nn_new[q]);
+          }
+          for (storage_idx_t b : old_only) {
+            join(nn_new[p], b);
+          }
+        }
+      }
+    }
+
+    if (verbose) {
+      printf("NNDescent iter %d: %zd updates (%.3f s)\n",
+             iter, nupdate, (getmillisecs() - t0) / 1000);
+    }
+    if (nupdate <= delta * n * K) {
+      break;
+    }
+  }
+
+  for (idx_t i = 0; i < n; i++) {
+    omp_destroy_lock(&locks[i]);
+  }
+
+#pragma omp parallel for
+  for (idx_t i = 0; i < n; i++) {
+    const std::vector<Neighbor>& pool = graph[i].pool;
+    for (int j = 0; j < K; j++) {
+      bool valid = j < pool.size();
+      I[i * K + j] = valid ? pool[j].id : -1;
+      if (D) {
+        D[i * K + j] = sign * (valid ? pool[j].dis :
+                               std::numeric_limits<float>::max());
+      }
+    }
+  }
+}
+
+
+}  // namespace faiss
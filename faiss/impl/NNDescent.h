@@ -0,0 +1,74 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <vector>
+
+#include <faiss/Index.h>
+
+
+namespace faiss {
+
+
+/** Approximate k-nearest neighbor graph construction with NN-descent:
+ *
+ *  Efficient K-Nearest Neighbor Graph Construction for Generic
+ *  Similarity Measures, W. Dong, M. Charikar, K. Li, WWW 2011
+ *
+ * Starting from a random graph, each iteration compares the neighbors
+ * of each node with each other ("local join") and updates their lists
+ * with the pairs that are closer. Only the pairs that involve a
+ * neighbor that was added at the previous iteration are compared. The
+ * iterations are parallel over the nodes.
+ *
+ * The distances are computed with the distance computer of a storage
+ * index, so that any storage that supports symmetric_dis can be used.
+ */
+struct NNDescent {
+  typedef int storage_idx_t;
+  typedef Index::idx_t idx_t;
+
+  /// nb of neighbors in the output graph
+  int K;
+
+  /// size of the neighbor lists during construction (>= K)
+  int L;
+
+  /// nb of new neighbors of each node joined per iteration
+  int S;
+
+  /// max nb of reverse neighbors of each node joined per iteration
+  int R;
+
+  /// max nb of iterations
+  int niter;
+
+  /// stop when less than delta * n * K neighbors were updated
+  float delta;
+
+  /// seed of the random initial graph
+  int64_t seed;
+
+  bool verbose;
+
+  explicit NNDescent(int K = 32);
+
+  /** build the graph of the ntotal vectors of storage
+   *
+   * @param I   output neighbors, size storage->ntotal * K, sorted by
+   *            increasing distance and padded with -1
+   * @param D   output distances (similarities for inner product), same
+   *            size, may be null
+   */
+  void build(const Index *storage, idx_t *I, float *D) const;
+};
+
+
+}  // namespace faiss
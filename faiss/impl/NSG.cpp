@@ -0,0 +1,357 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/impl/NSG.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <limits>
+#include <memory>
+
+#include <omp.h>
+
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/HNSW.h>
+#include <faiss/utils/distances.h>
+#include <faiss/utils/random.h>
+#include <faiss/utils/utils.h>
+
+namespace faiss {
+
+
+/**************************************************************
+ * NSG structure implementation
+ **************************************************************/
+
+NSG::NSG(int R):
+  ntotal(0), R(R), build_L(64), alpha(1.2), search_L(16),
+  enterpoint(-1), seed(1234), is_built(false)
+{
+  FAISS_THROW_IF_NOT(R > 0);
+}
+
+int NSG::nb_neighbors(storage_idx_t i) const
+{
+  const storage_idx_t *neigh = get_neighbors(i);
+  int n = 0;
+  while (n < R && neigh[n] >= 0) {
+    n++;
+  }
+  return n;
+}
+
+void NSG::reset()
+{
+  ntotal = 0;
+  enterpoint = -1;
+  final_graph.clear();
+  is_built = false;
+}
+
+
+/**************************************************************
+ * Searching
+ **************************************************************/
+
+void NSG::search_on_graph(DistanceComputer& dis, int L, VisitedTable& vt,
+                          std::vector<Neighbor>& retset,
+                          std::vector<Neighbor> *fullset) const
+{
+  retset.clear();
+  float d0 = dis(enterpoint);
+  vt.set(enterpoint);
+  retset.emplace_back(enterpoint, d0, true);
+  if (fullset) {
+    fullset->emplace_back(enterpoint, d0, true);
+  }
+
+  // retset is kept sorted, k is the first candidate that is not expanded
+  size_t k = 0;
+  while (k < retset.size()) {
+    if (!retset[k].flag) {
+      k++;
+      continue;
+    }
+    retset[k].flag = false;
+    const storage_idx_t *neigh = get_neighbors(retset[k].id);
+
+    size_t nk = retset.size();
+    for (int j = 0; j < R; j++) {
+      storage_idx_t v = neigh[j];
+      if (v < 0) {
+        break;
+      }
+      if (vt.get(v)) {
+        continue;
+      }
+      vt.set(v);
+
+      float d = dis(v);
+      if (fullset) {
+        fullset->emplace_back(v, d, true);
+      }
+      if (retset.size() >= L && !(d < retset.back().distance)) {
+        continue;
+      }
+      Neighbor nn(v, d, true);
+      auto pos = std::upper_bound(retset.begin(), retset.end(), nn);
+      size_t r = pos - retset.begin();
+      retset.insert(pos, nn);
+      if (retset.size() > L) {
+        retset.pop_back();
+      }
+      if (r < nk) {
+        nk = r;
+      }
+    }
+
+    // restart from the best node that was inserted before k, if any
+    k = nk <= k ? nk : k + 1;
+  }
+
+  vt.advance();
+}
+
+
+void NSG::search(DistanceComputer& dis, int k,
+                 idx_t *I, float *D, VisitedTable& vt,
+                 const SearchParametersNSG *params) const
+{
+  FAISS_THROW_IF_NOT(is_built);
+  int L = params ? params->search_L : search_L;
+  const IDSelector *sel = params ? params->sel : nullptr;
+  if (L < k) {
+    L = k;
+  }
+
+  std::vector<Neighbor> retset;
+  retset.reserve(L + 1);
+  search_on_graph(dis, L, vt, retset, nullptr);
+
+  int nres = 0;
+  for (size_t i = 0; i < retset.size() && nres < k; i++) {
+    if (sel && !sel->is_member(retset[i].id)) {
+      continue;
+    }
+    I[nres] = retset[i].id;
+    D[nres] = retset[i].distance;
+    nres++;
+  }
+  for (; nres < k; nres++) {
+    I[nres] = -1;
+    D[nres] = std::numeric_limits<float>::max();
+  }
+}
+
+
+/**************************************************************
+ * Building
+ **************************************************************/
+
+void NSG::robust_prune(DistanceComputer& dis, storage_idx_t q,
+                       std::vector<Neighbor>& pool, float alpha,
+                       storage_idx_t *neighbors) const
+{
+  std::sort(pool.begin(), pool.end());
+
+  std::vector<storage_idx_t> result;
+  result.reserve(R);
+
+  for (size_t i = 0; i < pool.size() && result.size() < R; i++) {
+    const Neighbor& p = pool[i];
+    // same ids have the same distance, so duplicates are contiguous
+    if (p.id == q || (i > 0 && pool[i - 1].id == p.id)) {
+      continue;
+    }
+    bool occluded = false;
+    for (storage_idx_t r: result) {
+      if (alpha * dis.symmetric_dis(r, p.id) <= p.distance) {
+        occluded = true;
+        break;
+      }
+    }
+    if (!occluded) {
+      result.push_back(p.id);
+    }
+  }
+
+  for (int i = 0; i < R; i++) {
+    neighbors[i] = i < result.size() ? result[i] : -1;
+  }
+}
+
+
+void NSG::add_reverse_link(DistanceComputer& dis, storage_idx_t j,
+                           storage_idx_t q, float alpha,
+                           std::vector<Neighbor>& tmp)
+{
+  storage_idx_t *neigh = get_neighbors(j);
+  int i;
+  for (i = 0; i < R; i++) {
+    if (neigh[i] == q) {
+      return;
+    }
+    if (neigh[i] < 0) {
+      break;
+    }
+  }
+  if (i < R) {
+    neigh[i] = q;
+    return;
+  }
+
+  // no free slot: prune the neighbors of j together with q
+  tmp.clear();
+  for (i = 0; i < R; i++) {
+    tmp.emplace_back(neigh[i], dis.symmetric_dis(j, neigh[i]), false);
+  }
+  tmp.emplace_back(q, dis.symmetric_dis(j, q), false);
+  robust_prune(dis, j, tmp, alpha, neigh);
+}
+
+
+void NSG::build(const Index *storage, idx_t n, const float *x, bool verbose)
+{
+  FAISS_THROW_IF_NOT_MSG(!is_built, "NSG does not support incremental adds");
+  FAISS_THROW_IF_NOT(storage->ntotal == n);
+  FAISS_THROW_IF_NOT(n < std::numeric_limits<storage_idx_t>::max());
+  if (n == 0) {
+    return;
+  }
+  size_t d = storage->d;
+  ntotal = n;
+
+  // the medoid is approximated by the vector that is nearest to the mean
+  {
+    std::vector<float> mean(d);
+    std::vector<double> sum(d);
+    for (idx_t i = 0; i < n; i++) {
+      for (size_t j = 0; j < d; j++) {
+        sum[j] += x[i * d + j];
+      }
+    }
+    for (size_t j = 0; j < d; j++) {
+      mean[j] = sum[j] / n;
+    }
+    float best_dis = std::numeric_limits<float>::max();
+    storage_idx_t best = 0;
+#pragma omp parallel
+    {
+      float local_dis = std::numeric_limits<float>::max();
+      storage_idx_t local_best = 0;
+#pragma omp for nowait
+      for (idx_t i = 0; i < n; i++) {
+        float dis = fvec_L2sqr(mean.data(), x + i * d, d);
+        if (dis < local_dis) {
+          local_dis = dis;
+          local_best = i;
+        }
+      }
+#pragma omp critical
+      {
+        if (local_dis < best_dis ||
+            (local_dis == best_dis && local_best < best)) {
+          best_dis = local_dis;
+          best = local_best;
+        }
+      }
+    }
+    enterpoint = best;
+  }
+
+  // random initial graph
+  final_graph.assign((size_t)n * R, -1);
+  int nrand = std::min((idx_t)R, n - 1);
+#pragma omp parallel for
+  for (idx_t i = 0; i < n; i++) {
+    RandomGenerator rng(seed + i);
+    storage_idx_t *neigh = get_neighbors(i);
+    int nn = 0;
+    while (nn < nrand) {
+      storage_idx_t j = rng.rand_int((int)n);
+      if (j == i || std::find(neigh, neigh + nn, j) != neigh + nn) {
+        continue;
+      }
+      neigh[nn++] = j;
+    }
+  }
+
+  std::vector<int> order(n);
+  rand_perm(order.data(), n, seed);
+
+  std::vector<omp_lock_t> locks(n);
+  for (idx_t i = 0; i < n; i++) {
+    omp_init_lock(&locks[i]);
+  }
+
+  // first pass with alpha = 1 (as NSG), then with the relaxed alpha
+  for (int pass = 0; pass < 2; pass++) {
+    float pass_alpha = pass == 0 ? 1.0 : alpha;
+    double t0 = getmillisecs();
+
+#pragma omp parallel
+    {
+      VisitedTable vt(n);
+      DistanceComputer *dis = storage->get_distance_computer();
+      ScopeDeleter1<DistanceComputer> del(dis);
+      std::vector<Neighbor> retset, pool, tmp;
+      std::vector<storage_idx_t> neigh(R);
+
+#pragma omp for schedule(dynamic, 64)
+      for (idx_t i = 0; i < n; i++) {
+        storage_idx_t q = order[i];
+        dis->set_query(x + q * d);
+
+        pool.clear();
+        search_on_graph(*dis, build_L, vt, retset, &pool);
+
+        omp_set_lock(&locks[q]);
+        storage_idx_t *qneigh = get_neighbors(q);
+        for (int j = 0; j < R && qneigh[j] >= 0; j++) {
+          pool.emplace_back(qneigh[j], (*dis)(qneigh[j]), false);
+        }
+        robust_prune(*dis, q, pool, pass_alpha, qneigh);
+        std::copy(qneigh, qneigh + R, neigh.begin());
+        omp_unset_lock(&locks[q]);
+
+        for (int j = 0; j < R && neigh[j] >= 0; j++) {
+          storage_idx_t v = neigh[j];
+          omp_set_lock(&locks[v]);
+          add_reverse_link(*dis, v, q, pass_alpha, tmp);
+          omp_unset_lock(&locks[v]);
+        }
+      }
+    }
+
+    if (verbose) {
+      printf("  NSG pass %d (alpha=%g) done in %.3f s\n",
+             pass, pass_alpha, (getmillisecs() - t0) / 1000);
+    }
+  }
+
+  for (idx_t i = 0; i < n; i++) {
+    omp_destroy_lock(&locks[i]);
+  }
+
+  if (verbose) {
+    size_t tot = 0;
+    for (idx_t i = 0; i < n; i++) {
+      tot += nb_neighbors(i);
+    }
+    printf("  NSG: %" PRId64 " nodes, %.2f neighbors per node (max %d)\n",
+           n, tot / double(n), R);
+  }
+
+  is_built = true;
+}
+
+
+}  // namespace faiss
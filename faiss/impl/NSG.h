@@ -0,0 +1,155 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <vector>
+
+#include <faiss/Index.h>
+#include <faiss/impl/maybe_owned_vector.h>
+
+
+namespace faiss {
+
+
+struct VisitedTable;     // from HNSW.h
+struct DistanceComputer; // from AuxIndexStructures
+
+/// search parameters that override the NSG fields for one search call
+struct SearchParametersNSG: SearchParameters {
+  /// size of the candidate pool at search time
+  int search_L;
+
+  SearchParametersNSG(): search_L(16) {}
+  ~SearchParametersNSG() {}
+};
+
+
+/** Single-layer navigable graph with a fixed out-degree.
+ *
+ * Each node has exactly R neighbor slots, stored in one ntotal * R array
+ * (unused slots are -1 and come last). The adjacency list of a node is
+ * thus a fixed-size record, that can be stored next to the vector code in
+ * a block-aligned file layout.
+ *
+ * The graph is built with the Vamana algorithm of
+ *
+ *  DiskANN: Fast Accurate Billion-point Nearest Neighbor Search on a
+ *  Single Node, S. J. Subramanya et al., NeurIPS 2019
+ *
+ * which, like NSG (C. Fu et al., VLDB 2019), connects each node to a
+ * pruned set of the nodes visited by a greedy search towards it. The
+ * search starts from the medoid of the dataset.
+ *
+ * The NSG object stores only the link structure, see IndexNSG.h for the
+ * full index object.
+ */
+struct NSG {
+  /// internal storage of vectors (32 bits)
+  typedef int storage_idx_t;
+
+  /// Faiss results are 64-bit
+  typedef Index::idx_t idx_t;
+
+  /// element of the candidate pools
+  struct Neighbor {
+    storage_idx_t id;
+    float distance;
+    bool flag;  ///< not expanded yet
+
+    Neighbor() {}
+    Neighbor(storage_idx_t id, float distance, bool flag):
+      id(id), distance(distance), flag(flag) {}
+
+    bool operator < (const Neighbor &other) const {
+      return distance < other.distance ||
+        (distance == other.distance && id < other.id);
+    }
+  };
+
+  /// nb of nodes in the graph
+  idx_t ntotal;
+
+  /// out-degree of the nodes
+  int R;
+
+  /// size of the candidate pool at construction time
+  int build_L;
+
+  /// pruning relaxation of the second construction pass (>= 1). Larger
+  /// values keep more long-range links.
+  float alpha;
+
+  /// size of the candidate pool at search time
+  int search_L;
+
+  /// where all searches start (medoid of the data)
+  storage_idx_t enterpoint;
+
+  /// seed of the random initial graph and of the insertion order
+  int64_t seed;
+
+  /// neighbors of node i are final_graph[i * R : (i + 1) * R]
+  MaybeOwnedVector<storage_idx_t> final_graph;
+
+  bool is_built;
+
+  explicit NSG(int R = 32);
+
+  storage_idx_t *get_neighbors(storage_idx_t i) {
+    return final_graph.data() + (size_t)i * R;
+  }
+
+  const storage_idx_t *get_neighbors(storage_idx_t i) const {
+    return final_graph.data() + (size_t)i * R;
+  }
+
+  /// nb of used neighbor slots of node i
+  int nb_neighbors(storage_idx_t i) const;
+
+  /** build the graph for the n vectors of storage
+   *
+   * @param storage  provides the distance computers, must contain n vectors
+   * @param x        the same n vectors, size n * d
+   */
+  void build(const Index *storage, idx_t n, const float *x, bool verbose);
+
+  /** search the k nearest neighbors of the query of dis, the results are
+   * sorted by increasing distance and padded with -1 */
+  void search(DistanceComputer& dis, int k,
+              idx_t *I, float *D, VisitedTable& vt,
+              const SearchParametersNSG *params = nullptr) const;
+
+  /** greedy search from the enterpoint with a pool of L candidates
+   *
+   * @param retset   the L best nodes found, sorted by increasing distance
+   * @param fullset  if not null, all the nodes whose distance was computed
+   *                 are appended to it
+   */
+  void search_on_graph(DistanceComputer& dis, int L, VisitedTable& vt,
+                       std::vector<Neighbor>& retset,
+                       std::vector<Neighbor> *fullset) const;
+
+  /** select at most R neighbors of node q from pool (distances to q)
+   * and store them in neighbors. A candidate is dropped if a selected
+   * neighbor is more than alpha times closer to it than q is. */
+  void robust_prune(DistanceComputer& dis, storage_idx_t q,
+                    std::vector<Neighbor>& pool, float alpha,
+                    storage_idx_t *neighbors) const;
+
+  void reset();
+
+  /// add link j -> q, prune the neighbors of j if they are full
+  void add_reverse_link(DistanceComputer& dis, storage_idx_t j,
+                        storage_idx_t q, float alpha,
+                        std::vector<Neighbor>& tmp);
+};
+
+
+}  // namespace faiss
@@ -15,6 +15,7 @@
 #include <stdint.h>
 
 #include <algorithm>
+#include <memory>
 
 #include <faiss/utils/random.h>
 #include <faiss/utils/utils.h>
@@ -88,61 +89,89 @@ SimulatedAnnealingOptimizer::~SimulatedAnnealingOptimizer ()
 // run the optimization and return the best result in best_perm
 double SimulatedAnnealingOptimizer::run_optimization (int * best_perm)
 {
-    double min_cost = 1e30;
+    std::vector<int> perms (size_t(n_redo) * n);
+    std::vector<double> costs (n_redo), init_costs (n_redo);
 
     // just do a few runs of the annealing and keep the lowest output cost
+#pragma omp parallel for if(!logfile && n_redo > 1)
+    for (int it = 0; it < n_redo; it++) {
+        costs[it] = run_one_optimization (
+              it, perms.data() + size_t(it) * n, &init_costs[it]);
+    }
+
+    double min_cost = 1e30;
     for (int it = 0; it < n_redo; it++) {
-        std::vector<int> perm(n);
-        for (int i = 0; i < n; i++)
-            perm[i] = i;
-         if (init_random) {
-            for (int i = 0; i < n; i++) {
-                int j = i + rnd->rand_int (n - i);
-                std::swap (perm[i], perm[j]);
-            }
-        }
-         float cost = optimize (perm.data());
-        if (logfile) fprintf (logfile, "\n");
         if(verbose > 1) {
             printf ("    optimization run %d: cost=%g %s\n",
-                    it, cost, cost < min_cost ? "keep" : "");
+                    it, costs[it], costs[it] < min_cost ? "keep" : "");
         }
-        if (cost < min_cost) {
-            memcpy (best_perm, perm.data(), sizeof(perm[0]) * n);
-            min_cost = cost;
+        if (costs[it] < min_cost) {
+            memcpy (best_perm, perms.data() + size_t(it) * n,
+                    sizeof(perms[0]) * n);
+            min_cost = costs[it];
         }
     }
-     return min_cost;
+    if (n_redo > 0) {
+        init_cost = init_costs[0];
+    }
+    return min_cost;
+}
+
+double SimulatedAnnealingOptimizer::run_one_optimization (
+        int redo, int *perm, double *init_cost_out) const
+{
+    RandomGenerator rng (seed + redo);
+    for (int i = 0; i < n; i++)
+        perm[i] = i;
+    if (init_random) {
+        for (int i = 0; i < n; i++) {
+            int j = i + rng.rand_int (n - i);
+            std::swap (perm[i], perm[j]);
+        }
+    }
+    double cost = obj->compute_cost (perm);
+    if (init_cost_out) {
+        *init_cost_out = cost;
+    }
+    cost = anneal (perm, cost, rng);
+    if (logfile) fprintf (logfile, "\n");
+    return cost;
 }
 
 // perform the optimization loop, starting from and modifying
 // permutation in-place
 double SimulatedAnnealingOptimizer::optimize (int *perm)
 {
-    double cost = init_cost = obj->compute_cost (perm);
+    init_cost = obj->compute_cost (perm);
+    return anneal (perm, init_cost, *rnd);
+}
+
+double SimulatedAnnealingOptimizer::anneal (
+        int *perm, double cost, RandomGenerator & rng) const
+{
     int log2n = 0;
     while (!(n <= (1 << log2n))) log2n++;
     double temperature = init_temperature;
-     int n_swap = 0, n_hot = 0;
+    int n_swap = 0, n_hot = 0;
     for (int it = 0; it < n_iter; it++) {
         temperature = temperature * temperature_decay;
         int iw, jw;
         if (only_bit_flips) {
-            iw = rnd->rand_int (n);
-            jw = iw ^ (1 << rnd->rand_int (log2n));
+            iw = rng.rand_int (n);
+            jw = iw ^ (1 << rng.rand_int (log2n));
         } else {
-            iw = rnd->rand_int (n);
-            jw = rnd->rand_int (n - 1);
+            iw = rng.rand_int (n);
+            jw = rng.rand_int (n - 1);
             if (jw == iw) jw++;
         }
-         double delta_cost = obj->cost_update (perm, iw, jw);
-         if (delta_cost < 0 || rnd->rand_float () < temperature) {
+        double delta_cost = obj->cost_update (perm, iw, jw);
+        if (delta_cost < 0 || rng.rand_float () < temperature) {
             std::swap (perm[iw], perm[jw]);
             cost += delta_cost;
             n_swap++;
             if (delta_cost >= 0) n_hot++;
         }
-         if (verbose > 2 || (verbose > 1 && it % 10000 == 0)) {
+        if (verbose > 2 || (verbose > 1 && it % 10000 == 0)) {
             printf ("      iteration %d cost %g temp %g n_swap %d "
                     "(%d hot)     \r",
                     it, cost, temperature, n_swap, n_hot);
@@ -152,7 +181,7 @@ double SimulatedAnnealingOptimizer::optimize (int *perm)
             fprintf (logfile, "%d %g %g %d %d\n",
                     it, cost, temperature, n_swap, n_hot);
         }
-     }
+    }
     if (verbose > 1) printf("\n");
     return cost;
 }
@@ -177,6 +206,87 @@ static inline int hamming_dis (uint64_t a, uint64_t b)
 
 namespace {
 
+inline double sqr (double x) { return x * x; }
+
+/// transposed copy of a n * n table, empty if the table is symmetric
+std::vector<double> transpose_table (int n, const double *tab)
+{
+    std::vector<double> tab_t (size_t(n) * n);
+    bool symmetric = true;
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            tab_t[i * n + j] = tab[j * n + i];
+            symmetric = symmetric && tab[i * n + j] == tab[j * n + i];
+        }
+    }
+    if (symmetric) {
+        tab_t.clear ();
+    }
+    return tab_t;
+}
+
+/** update of the cost sum_ij w_ij (t_ij - dis(perm_i, perm_j))^2 when
+ * perm[iw] and perm[jw] are swapped. Only the rows and columns iw and jw
+ * change: they are visited in a single branch-free loop, then the 4
+ * cells at their crossings are corrected.
+ *
+ * @param tt, wt   transposed t and w (= t and w if they are symmetric)
+ */
+template<class Dis>
+double swap_cost_update (int n, const double *t, const double *w,
+                         const double *tt, const double *wt,
+                         const int *perm, int iw, int jw, const Dis & dis)
+{
+    int pi = perm[iw], pj = perm[jw];
+    const double *t_i = t + iw * n, *t_j = t + jw * n;
+    const double *w_i = w + iw * n, *w_j = w + jw * n;
+    const double *tt_i = tt + iw * n, *tt_j = tt + jw * n;
+    const double *wt_i = wt + iw * n, *wt_j = wt + jw * n;
+
+    // update of cells (iw, k), (jw, k), (k, iw) and (k, jw)
+    auto line_update = [&] (int k) {
+        int pk = perm[k];
+        double r_i = dis (pi, pk), r_j = dis (pj, pk);
+        double c_i = dis (pk, pi), c_j = dis (pk, pj);
+        return w_i[k] * (sqr (t_i[k] - r_j) - sqr (t_i[k] - r_i)) +
+            w_j[k] * (sqr (t_j[k] - r_i) - sqr (t_j[k] - r_j)) +
+            wt_i[k] * (sqr (tt_i[k] - c_j) - sqr (tt_i[k] - c_i)) +
+            wt_j[k] * (sqr (tt_j[k] - c_i) - sqr (tt_j[k] - c_j));
+    };
+
+    double delta_cost = 0;
+    for (int k = 0; k < n; k++) {
+        delta_cost += line_update (k);
+    }
+    delta_cost -= line_update (iw) + line_update (jw);
+
+    int rows[2] = {iw, jw}, new_p[2] = {pj, pi};
+    for (int a = 0; a < 2; a++) {
+        for (int b = 0; b < 2; b++) {
+            size_t ij = rows[a] * n + rows[b];
+            double actual = dis (perm[rows[a]], perm[rows[b]]);
+            double new_actual = dis (new_p[a], new_p[b]);
+            delta_cost += w[ij] * (sqr (t[ij] - new_actual) -
+                                   sqr (t[ij] - actual));
+        }
+    }
+    return delta_cost;
+}
+
+struct HammingDis {
+    double operator () (int a, int b) const {
+        return hamming_dis (a, b);
+    }
+};
+
+struct TableDis {
+    int n;
+    const double *tab;
+    double operator () (int a, int b) const {
+        return tab[a * n + b];
+    }
+};
+
 /// optimize permutation to reproduce a distance table with Hamming distances
 struct ReproduceWithHammingObjective : PermutationObjective {
     int nbits;
@@ -213,50 +323,15 @@ struct ReproduceWithHammingObjective : PermutationObjective {
     // what would the cost update be if iw and jw were swapped?
     // computed in O(n) instead of O(n^2) for the full re-computation
     double cost_update(const int* perm, int iw, int jw) const override {
-      double delta_cost = 0;
-
-      for (int i = 0; i < n; i++) {
-        if (i == iw) {
-          for (int j = 0; j < n; j++) {
-            double wanted = target_dis[i * n + j], w = weights[i * n + j];
-            double actual = hamming_dis(perm[i], perm[j]);
-            delta_cost -= w * sqr(wanted - actual);
-            double new_actual =
-                hamming_dis(perm[jw], perm[j == iw ? jw : j == jw ? iw : j]);
-            delta_cost += w * sqr(wanted - new_actual);
-          }
-        } else if (i == jw) {
-          for (int j = 0; j < n; j++) {
-            double wanted = target_dis[i * n + j], w = weights[i * n + j];
-            double actual = hamming_dis(perm[i], perm[j]);
-            delta_cost -= w * sqr(wanted - actual);
-            double new_actual =
-                hamming_dis(perm[iw], perm[j == iw ? jw : j == jw ? iw : j]);
-            delta_cost += w * sqr(wanted - new_actual);
-          }
-        } else {
-          int j = iw;
-          {
-            double wanted = target_dis[i * n + j], w = weights[i * n + j];
-            double actual = hamming_dis(perm[i], perm[j]);
-            delta_cost -= w * sqr(wanted - actual);
-            double new_actual = hamming_dis(perm[i], perm[jw]);
-            delta_cost += w * sqr(wanted - new_actual);
-          }
-          j = jw;
-          {
-            double wanted = target_dis[i * n + j], w = weights[i * n + j];
-            double actual = hamming_dis(perm[i], perm[j]);
-            delta_cost -= w * sqr(wanted - actual);
-            double new_actual = hamming_dis(perm[i], perm[iw]);
-            delta_cost += w * sqr(wanted - new_actual);
-          }
-        }
-      }
-
-      return delta_cost;
+      return swap_cost_update(
+          n, target_dis.data(), weights.data(),
+          target_dis_t.empty() ? target_dis.data() : target_dis_t.data(),
+          weights_t.empty() ? weights.data() : weights_t.data(),
+          perm, iw, jw, HammingDis());
     }
 
+    std::vector<double> target_dis_t, weights_t; // empty if symmetric
+
 
 
     ReproduceWithHammingObjective (
@@ -291,7 +366,8 @@ struct ReproduceWithHammingObjective : PermutationObjective {
             // compute a weight
             weights.push_back (dis_weight (td));
         }
-
+        target_dis_t = transpose_table (n, target_dis.data());
+        weights_t = transpose_table (n, weights.data());
     }
 
     ~ReproduceWithHammingObjective() override {}
@@ -332,52 +408,11 @@ double ReproduceDistancesObjective::compute_cost (const int *perm) const
 double ReproduceDistancesObjective::cost_update(
         const int *perm, int iw, int jw) const
 {
-    double delta_cost = 0;
-     for (int i = 0; i < n; i++) {
-        if (i == iw) {
-            for (int j = 0; j < n; j++) {
-                double wanted = target_dis [i * n + j],
-                    w = weights [i * n + j];
-                double actual = get_source_dis (perm[i], perm[j]);
-                delta_cost -= w * sqr (wanted - actual);
-                double new_actual = get_source_dis (
-                       perm[jw],
-                       perm[j == iw ? jw : j == jw ? iw : j]);
-                delta_cost += w * sqr (wanted - new_actual);
-            }
-        } else if (i == jw) {
-            for (int j = 0; j < n; j++) {
-                double wanted = target_dis [i * n + j],
-                    w = weights [i * n + j];
-                double actual = get_source_dis (perm[i], perm[j]);
-                delta_cost -= w * sqr (wanted - actual);
-                double new_actual = get_source_dis (
-                       perm[iw],
-                       perm[j == iw ? jw : j == jw ? iw : j]);
-                delta_cost += w * sqr (wanted - new_actual);
-            }
-        } else  {
-            int j = iw;
-            {
-                double wanted = target_dis [i * n + j],
-                    w = weights [i * n + j];
-                double actual = get_source_dis (perm[i], perm[j]);
-                delta_cost -= w * sqr (wanted - actual);
-                double new_actual = get_source_dis (perm[i], perm[jw]);
-                delta_cost += w * sqr (wanted - new_actual);
-            }
-            j = jw;
-            {
-                double wanted = target_dis [i * n + j],
-                    w = weights [i * n + j];
-                double actual = get_source_dis (perm[i], perm[j]);
-                delta_cost -= w * sqr (wanted - actual);
-                double new_actual = get_source_dis (perm[i], perm[iw]);
-                delta_cost += w * sqr (wanted - new_actual);
-            }
-        }
-    }
-     return delta_cost;
+    return swap_cost_update (
+          n, target_dis, weights.data(),
+          target_dis_t.empty() ? target_dis : target_dis_t.data(),
+          weights_t.empty() ? weights.data() : weights_t.data(),
+          perm, iw, jw, TableDis {n, source_dis.data()});
 }
 
 
@@ -434,6 +469,8 @@ void ReproduceDistancesObjective::set_affine_target_dis (
         // compute a weight
         weights [i] = dis_weight (target_dis[i]);
     }
+    target_dis_t = transpose_table (n, target_dis);
+    weights_t = transpose_table (n, weights.data());
 
 }
 
@@ -772,13 +809,14 @@ void PolysemousTraining::optimize_reproduce_distances (
 
     int n = pq.ksub;
     int nbits = pq.nbits;
+    int M = pq.M;
+
+    std::vector<std::unique_ptr<ReproduceWithHammingObjective> > objs (M);
 
 #pragma omp parallel for
-    for (int m = 0; m < pq.M; m++) {
+    for (int m = 0; m < M; m++) {
         std::vector<double> dis_table;
 
-        // printf ("Optimizing quantizer %d\n", m);
-
         float * centroids = pq.get_centroids (m, 0);
 
         for (int i = 0; i < n; i++) {
@@ -789,29 +827,59 @@ void PolysemousTraining::optimize_reproduce_distances (
             }
         }
 
-        std::vector<int> perm (n);
-        ReproduceWithHammingObjective obj (
+        objs[m].reset (new ReproduceWithHammingObjective (
                nbits, dis_table,
-               dis_weight_factor);
-
-
-        SimulatedAnnealingOptimizer optim (&obj, *this);
+               dis_weight_factor));
+    }
 
+    std::vector<std::unique_ptr<SimulatedAnnealingOptimizer> > optims (M);
+    for (int m = 0; m < M; m++) {
+        optims[m].reset (new SimulatedAnnealingOptimizer (
+               objs[m].get(), *this));
         if (log_pattern.size()) {
             char fname[256];
             snprintf (fname, 256, log_pattern.c_str(), m);
             printf ("opening log file %s\n", fname);
-            optim.logfile = fopen (fname, "w");
-            FAISS_THROW_IF_NOT_MSG (optim.logfile, "could not open logfile");
+            optims[m]->logfile = fopen (fname, "w");
+            FAISS_THROW_IF_NOT_MSG (optims[m]->logfile,
+                                    "could not open logfile");
+        }
+    }
+
+    // the M * n_redo annealing runs are independent: do them all in
+    // parallel, so that the threads are busy also when M is small
+    int n_run = M * n_redo;
+    std::vector<int> perms (size_t(n_run) * n);
+    std::vector<double> costs (n_run), init_costs (n_run);
+
+#pragma omp parallel for schedule(dynamic) if(log_pattern.empty())
+    for (int r = 0; r < n_run; r++) {
+        int m = r / n_redo;
+        costs[r] = optims[m]->run_one_optimization (
+               r % n_redo, perms.data() + size_t(r) * n, &init_costs[r]);
+    }
+
+    for (int m = 0; m < M; m++) {
+        if (log_pattern.size()) fclose (optims[m]->logfile);
+
+        // keep the best run
+        int best = -1;
+        for (int r = m * n_redo; r < (m + 1) * n_redo; r++) {
+            if (best < 0 || costs[r] < costs[best]) {
+                best = r;
+            }
+        }
+        if (best < 0) {
+            continue;
         }
-        double final_cost = optim.run_optimization (perm.data());
 
         if (verbose > 0) {
             printf ("SimulatedAnnealingOptimizer for m=%d: %g -> %g\n",
-                    m, optim.init_cost, final_cost);
+                    m, init_costs[m * n_redo], costs[best]);
         }
 
-        if (log_pattern.size()) fclose (optim.logfile);
+        const int *perm = perms.data() + size_t(best) * n;
+        float * centroids = pq.get_centroids (m, 0);
 
         std::vector<float> centroids_copy;
         for (int i = 0; i < dsub * n; i++)
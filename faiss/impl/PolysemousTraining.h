@@ -65,6 +65,9 @@ struct ReproduceDistancesObjective : PermutationObjective {
     const double *      target_dis; ///< wanted distances (size n^2)
     std::vector<double> weights;    ///< weights for each distance (size n^2)
 
+    /// transposed target_dis and weights, empty if they are symmetric
+    std::vector<double> target_dis_t, weights_t;
+
     double get_source_dis (int i, int j) const;
 
     // cost = quadratic difference between actual distance and Hamming distance
@@ -108,9 +111,24 @@ struct RandomGenerator;
     // and modifying permutation in-place
     double optimize (int *perm);
 
-    // run the optimization and return the best result in best_perm
+    // run the optimization and return the best result in best_perm.
+    // The n_redo runs are done in parallel if there is no logfile
     double run_optimization (int * best_perm);
 
+    /** run number redo of run_optimization, from its initial permutation
+     * and with its own random generator, so that the runs can be done
+     * in parallel (but logfile should then be NULL).
+     *
+     * @param perm          output permutation, size n
+     * @param init_cost_out if non-NULL, cost of the initial permutation
+     * @return              final cost
+     */
+    double run_one_optimization (int redo, int *perm,
+                                 double *init_cost_out = nullptr) const;
+
+    /// annealing loop from perm (of cost cost), modifying it in-place
+    double anneal (int *perm, double cost, RandomGenerator & rng) const;
+
     virtual ~SimulatedAnnealingOptimizer ();
 };
 
@@ -16,11 +16,17 @@
 #include <memory>
 
 #include <algorithm>
+#include <exception>
+#include <mutex>
+
+#include <omp.h>
 
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/VectorTransform.h>
 #include <faiss/IndexFlat.h>
 #include <faiss/utils/distances.h>
+#include <faiss/utils/utils.h>
+#include <faiss/impl/pq_code_distance.h>
 
 
 extern "C" {
@@ -138,6 +144,32 @@ static inline void pq_estimators_from_tables (const ProductQuantizer& pq,
     }
 }
 
+/* compute the distances of blocks of codes with pq_code_distances_8bit,
+ * each byte of a code indexes a table of 256 entries */
+template <class C>
+static void pq_estimators_from_tables_blocked (size_t code_size,
+                                               const uint8_t *codes,
+                                               size_t ncodes,
+                                               const float *dis_table,
+                                               size_t k,
+                                               float *heap_dis,
+                                               int64_t *heap_ids)
+{
+    const size_t bs = 256;
+    float dis[bs];
+    for (size_t j0 = 0; j0 < ncodes; j0 += bs) {
+        size_t j1 = std::min (j0 + bs, ncodes);
+        pq_code_distances_8bit (code_size, dis_table,
+                                codes + j0 * code_size, j1 - j0, dis);
+        for (size_t j = j0; j < j1; j++) {
+            if (C::cmp (heap_dis[0], dis[j - j0])) {
+                heap_pop<C> (k, heap_dis, heap_ids);
+                heap_push<C> (k, heap_dis, heap_ids, dis[j - j0], j);
+            }
+        }
+    }
+}
+
 template <class C>
 static inline void pq_estimators_from_tables_generic(const ProductQuantizer& pq,
                                                      size_t nbits,
@@ -266,47 +298,68 @@ void ProductQuantizer::train (int n, const float * x)
             }
         }
 
-        float * xslice = new float[n * dsub];
-        ScopeDeleter<float> del (xslice);
-        for (int m = 0; m < M; m++) {
-            for (int j = 0; j < n; j++)
-                memcpy (xslice + j * dsub,
-                        x + j * d + m * dsub,
-                        dsub * sizeof(float));
+        // With small ksub, each k-means is too small to use all the
+        // threads, so the sub-quantizers are trained in parallel, each
+        // with a single thread. The results are the same.
+        bool parallel = !assign_index && M > 1 && ksub <= 1024 &&
+                        omp_get_max_threads() > 1 && !omp_in_parallel();
 
-            Clustering clus (dsub, ksub, cp);
+        if (verbose && parallel) {
+            printf ("Training %zd PQ slices in parallel\n", M);
+        }
 
-            // we have some initialization for the centroids
-            if (final_train_type != Train_default) {
-                clus.centroids.resize (dsub * ksub);
-            }
+        std::vector<std::pair<int, std::exception_ptr> > exceptions;
+        std::mutex exceptions_mutex;
 
-            switch (final_train_type) {
-            case Train_hypercube:
-                init_hypercube (dsub, nbits, n, xslice,
-                                clus.centroids.data ());
-                break;
-            case  Train_hypercube_pca:
-                init_hypercube_pca (dsub, nbits, n, xslice,
+#pragma omp parallel for schedule(dynamic) if(parallel)
+        for (int m = 0; m < M; m++) {
+            try {
+                std::vector<float> xslice (size_t(n) * dsub);
+                for (int j = 0; j < n; j++)
+                    memcpy (xslice.data() + j * dsub,
+                            x + j * d + m * dsub,
+                            dsub * sizeof(float));
+
+                Clustering clus (dsub, ksub, cp);
+
+                // we have some initialization for the centroids
+                if (final_train_type != Train_default) {
+                    clus.centroids.resize (dsub * ksub);
+                }
+
+                switch (final_train_type) {
+                case Train_hypercube:
+                    init_hypercube (dsub, nbits, n, xslice.data(),
                                     clus.centroids.data ());
-                break;
-            case  Train_hot_start:
-                memcpy (clus.centroids.data(),
-                        get_centroids (m, 0),
-                        dsub * ksub * sizeof (float));
-                break;
-            default: ;
-            }
-
-            if(verbose) {
-                clus.verbose = true;
-                printf ("Training PQ slice %d/%zd\n", m, M);
+                    break;
+                case  Train_hypercube_pca:
+                    init_hypercube_pca (dsub, nbits, n, xslice.data(),
+                                        clus.centroids.data ());
+                    break;
+                case  Train_hot_start:
+                    memcpy (clus.centroids.data(),
+                            get_centroids (m, 0),
+                            dsub * ksub * sizeof (float));
+                    break;
+                default: ;
+                }
+
+                if(verbose && !parallel) {
+                    clus.verbose = true;
+                    printf ("Training PQ slice %d/%zd\n", m, M);
+                }
+                IndexFlatL2 index (dsub);
+                clus.train (n, xslice.data(),
+                            assign_index ? *assign_index : index);
+                set_params (clus.centroids.data(), m);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock (exceptions_mutex);
+                exceptions.push_back (std::make_pair (
+                      m, std::current_exception()));
             }
-            IndexFlatL2 index (dsub);
-            clus.train (n, xslice, assign_index ? *assign_index : index);
-            set_params (clus.centroids.data(), m);
         }
 
+        handleExceptions (exceptions);
 
     } else {
 
@@ -397,7 +450,8 @@ void ProductQuantizer::decode (const uint8_t *code, float *x) const
 
 void ProductQuantizer::decode (const uint8_t *code, float *x, size_t n) const
 {
-    for (size_t i = 0; i < n; i++) {
+#pragma omp parallel for if (n > 1000)
+    for (int64_t i = 0; i < n; i++) {
         this->decode (code + code_size * i, x + d * i);
     }
 }
@@ -479,20 +533,72 @@ void ProductQuantizer::compute_codes_with_assign_index (
 
 }
 
-void ProductQuantizer::compute_codes (const float * x,
-                                      uint8_t * codes,
-                                      size_t n)  const
+/* Batched encoding: the vectors are processed by blocks of bs and each
+ * (block, sub-quantizer) pair is an independent task. The inner products
+ * with the ksub centroids come from one sgemm per task, and the nearest
+ * centroid minimizes ||c||^2 - 2 <x, c> (||x||^2 is the same for all
+ * centroids). The assignments are packed into codes once all
+ * sub-quantizers of a chunk are done. */
+template<class PQEncoder>
+static void compute_codes_gemm (const ProductQuantizer & pq,
+                                const float * x, uint8_t * codes, size_t n)
 {
-  // process by blocks to avoid using too much RAM
-    size_t bs = 256 * 1024;
-    if (n > bs) {
-        for (size_t i0 = 0; i0 < n; i0 += bs) {
-            size_t i1 = std::min(i0 + bs, n);
-            compute_codes (x + d * i0, codes + code_size * i0, i1 - i0);
+    size_t d = pq.d, M = pq.M, dsub = pq.dsub, ksub = pq.ksub;
+
+    std::vector<float> c_norms (M * ksub);
+    fvec_norms_L2sqr (c_norms.data(), pq.centroids.data(), dsub, M * ksub);
+
+    // keep the per-thread inner product tile around 1 MiB
+    size_t bs = std::max (size_t(1), std::min (size_t(1024),
+                                               (256 * 1024) / ksub));
+    size_t chunk_size = 65536;
+    std::vector<int32_t> assign (std::min (n, chunk_size) * M);
+
+    for (size_t c0 = 0; c0 < n; c0 += chunk_size) {
+        size_t c1 = std::min (n, c0 + chunk_size);
+        int64_t nblock = (c1 - c0 + bs - 1) / bs;
+
+#pragma omp parallel
+        {
+            std::vector<float> ip (bs * ksub);
+#pragma omp for schedule(dynamic)
+            for (int64_t task = 0; task < nblock * M; task++) {
+                size_t m = task % M;
+                size_t i0 = c0 + (task / M) * bs;
+                size_t i1 = std::min (c1, i0 + bs);
+
+                FINTEGER ksubi = ksub, nbi = i1 - i0, dsubi = dsub, di = d;
+                float one = 1.0, zero = 0;
+                sgemm_ ("Transposed", "Not transposed",
+                        &ksubi, &nbi, &dsubi,
+                        &one, pq.get_centroids (m, 0), &dsubi,
+                        x + i0 * d + m * dsub, &di,
+                        &zero, ip.data(), &ksubi);
+
+                for (size_t i = i0; i < i1; i++) {
+                    float *ipi = ip.data() + (i - i0) * ksub;
+                    assign[(i - c0) * M + m] = fvec_madd_and_argmin (
+                          ksub, c_norms.data() + m * ksub, -2.0, ipi, ipi);
+                }
+            }
+
+#pragma omp for
+            for (int64_t i = c0; i < c1; i++) {
+                PQEncoder encoder (codes + i * pq.code_size, pq.nbits);
+                const int32_t *ai = assign.data() + (i - c0) * M;
+                for (size_t m = 0; m < M; m++) {
+                    encoder.encode (ai[m]);
+                }
+            }
         }
-        return;
     }
+}
+
 
+void ProductQuantizer::compute_codes (const float * x,
+                                      uint8_t * codes,
+                                      size_t n)  const
+{
     if (dsub < 16) { // simple direct computation
 
 #pragma omp parallel for
@@ -500,15 +606,16 @@ void ProductQuantizer::compute_codes (const float * x,
             compute_code (x + i * d, codes + i * code_size);
 
     } else { // worthwile to use BLAS
-        float *dis_tables = new float [n * ksub * M];
-        ScopeDeleter<float> del (dis_tables);
-        compute_distance_tables (n, x, dis_tables);
-
-#pragma omp parallel for
-        for (int64_t i = 0; i < n; i++) {
-            uint8_t * code = codes + i * code_size;
-            const float * tab = dis_tables + i * ksub * M;
-            compute_code_from_distance_table (tab, code);
+        switch (nbits) {
+        case 8:
+            compute_codes_gemm<PQEncoder8> (*this, x, codes, n);
+            break;
+        case 16:
+            compute_codes_gemm<PQEncoder16> (*this, x, codes, n);
+            break;
+        default:
+            compute_codes_gemm<PQEncoderGeneric> (*this, x, codes, n);
+            break;
         }
     }
 }
@@ -614,6 +721,124 @@ void ProductQuantizer::compute_inner_prod_tables (
     }
 }
 
+/* add the ncodes codes to the heap of a query, with the look-up tables
+ * of the query */
+template <class C>
+static void pq_scan_codes_with_table (
+      const ProductQuantizer& pq,
+      size_t nbits,
+      const float *dis_table,
+      const uint8_t * codes,
+      size_t ncodes,
+      size_t k,
+      float *heap_dis,
+      int64_t *heap_ids)
+{
+    size_t M = pq.M;
+
+    // 4-bit codes: the sub-quantizers are combined by pairs, so that
+    // each byte of the code indexes a table of 256 entries
+    if (nbits == 4 && ncodes > 256) {
+        std::vector<float> pair_tables (pq.code_size * 256);
+        pq_pair_tables_4bit (M, dis_table, pair_tables.data());
+        pq_estimators_from_tables_blocked<C> (pq.code_size,
+                                              codes, ncodes,
+                                              pair_tables.data(),
+                                              k, heap_dis, heap_ids);
+        return;
+    }
+
+    switch (nbits) {
+      case 8:
+          if (pq_code_distances_8bit_is_simd (M)) {
+              pq_estimators_from_tables_blocked<C> (M,
+                                                    codes, ncodes,
+                                                    dis_table,
+                                                    k, heap_dis, heap_ids);
+              break;
+          }
+          pq_estimators_from_tables<uint8_t, C> (pq,
+                                                 codes, ncodes,
+                                                 dis_table,
+                                                 k, heap_dis, heap_ids);
+          break;
+
+      case 16:
+          pq_estimators_from_tables<uint16_t, C> (pq,
+                                                  (uint16_t*)codes, ncodes,
+                                                  dis_table,
+                                                  k, heap_dis, heap_ids);
+          break;
+
+      default:
+          pq_estimators_from_tables_generic<C> (pq,
+                                                nbits,
+                                                codes, ncodes,
+                                                dis_table,
+                                                k, heap_dis, heap_ids);
+          break;
+    }
+}
+
+/* For fewer queries than threads: each thread scans a slice of the
+ * codes for all the queries, collecting the results in its own heaps,
+ * then the heaps are merged into the result (as for the exhaustive
+ * distance computations). */
+template <class C>
+static void pq_knn_search_split_database (
+      const ProductQuantizer& pq,
+      size_t nbits,
+      const float *dis_tables,
+      const uint8_t * codes,
+      const size_t ncodes,
+      HeapArray<C> * res,
+      bool init_finalize_heap)
+{
+    size_t k = res->k, nx = res->nh;
+    size_t ksub = pq.ksub, M = pq.M;
+    int nt = std::min (size_t(omp_get_max_threads()), ncodes / k);
+
+    std::vector<float> th_dis (nt * nx * k);
+    std::vector<int64_t> th_ids (nt * nx * k);
+
+#pragma omp parallel num_threads(nt)
+    {
+        int rank = omp_get_thread_num ();
+        size_t j0 = ncodes * rank / nt;
+        size_t j1 = ncodes * (rank + 1) / nt;
+
+        for (size_t i = 0; i < nx; i++) {
+            float * dis = th_dis.data() + (rank * nx + i) * k;
+            int64_t * ids = th_ids.data() + (rank * nx + i) * k;
+            heap_heapify<C> (k, dis, ids);
+            pq_scan_codes_with_table<C> (pq, nbits, dis_tables + i * ksub * M,
+                                         codes + j0 * pq.code_size, j1 - j0,
+                                         k, dis, ids);
+            for (size_t j = 0; j < k; j++) {
+                if (ids[j] >= 0) {
+                    ids[j] += j0;
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < nx; i++) {
+        float * heap_dis = res->val + i * k;
+        int64_t * heap_ids = res->ids + i * k;
+        if (init_finalize_heap) {
+            heap_heapify<C> (k, heap_dis, heap_ids);
+        }
+        for (int rank = 0; rank < nt; rank++) {
+            size_t ofs = (rank * nx + i) * k;
+            heap_addn<C> (k, heap_dis, heap_ids,
+                          th_dis.data() + ofs, th_ids.data() + ofs, k);
+        }
+        if (init_finalize_heap) {
+            heap_reorder<C> (k, heap_dis, heap_ids);
+        }
+    }
+}
+
 template <class C>
 static void pq_knn_search_with_tables (
       const ProductQuantizer& pq,
@@ -627,6 +852,15 @@ static void pq_knn_search_with_tables (
     size_t k = res->k, nx = res->nh;
     size_t ksub = pq.ksub, M = pq.M;
 
+    int nt = omp_get_max_threads ();
+    if (nt > 1 && nx < nt && !omp_in_parallel () &&
+        ncodes >= distance_compute_split_database_min_ny &&
+        ncodes >= 2 * k) {
+        pq_knn_search_split_database<C> (pq, nbits, dis_tables,
+                                         codes, ncodes,
+                                         res, init_finalize_heap);
+        return;
+    }
 
 #pragma omp parallel for
     for (int64_t i = 0; i < nx; i++) {
@@ -641,29 +875,9 @@ static void pq_knn_search_with_tables (
             heap_heapify<C> (k, heap_dis, heap_ids);
         }
 
-        switch (nbits) {
-          case 8:
-              pq_estimators_from_tables<uint8_t, C> (pq,
-                                                     codes, ncodes,
-                                                     dis_table,
-                                                     k, heap_dis, heap_ids);
-              break;
-
-          case 16:
-              pq_estimators_from_tables<uint16_t, C> (pq,
-                                                      (uint16_t*)codes, ncodes,
-                                                      dis_table,
-                                                      k, heap_dis, heap_ids);
-              break;
-
-          default:
-              pq_estimators_from_tables_generic<C> (pq,
-                                                    nbits,
-                                                    codes, ncodes,
-                                                    dis_table,
-                                                    k, heap_dis, heap_ids);
-              break;
-        }
+        pq_scan_codes_with_table<C> (pq, nbits, dis_table,
+                                     codes, ncodes,
+                                     k, heap_dis, heap_ids);
 
         if (init_finalize_heap) {
             heap_reorder<C> (k, heap_dis, heap_ids);
@@ -707,6 +921,14 @@ static float sqr (float x) {
     return x * x;
 }
 
+MemoryUsage ProductQuantizer::memory_usage () const
+{
+    MemoryUsage mu = MemoryUsage::object ("ProductQuantizer");
+    mu.add ("centroids", centroids);
+    mu.add ("sdc_table", sdc_table);
+    return mu;
+}
+
 void ProductQuantizer::compute_sdc_table ()
 {
     sdc_table.resize (M * ksub * ksub);
@@ -739,39 +961,26 @@ void ProductQuantizer::search_sdc (const uint8_t * qcodes,
 {
     FAISS_THROW_IF_NOT (sdc_table.size() == M * ksub * ksub);
     FAISS_THROW_IF_NOT (nbits == 8);
-    size_t k = res->k;
+    FAISS_THROW_IF_NOT (nq == res->nh);
 
+    // the sdc_table entries of a query code are a look-up table of the
+    // same layout as the asymmetric ones: row qcode[m] of the table of
+    // sub-quantizer m. The codes are then scanned as for search.
+    std::unique_ptr<float[]> dis_tables(new float [nq * ksub * M]);
 
-#pragma omp parallel for
+#pragma omp parallel for if (nq > 100)
     for (int64_t i = 0; i < nq; i++) {
-
-        /* Compute distances and keep smallest values */
-        idx_t * heap_ids = res->ids + i * k;
-        float *  heap_dis = res->val + i * k;
         const uint8_t * qcode = qcodes + i * code_size;
-
-        if (init_finalize_heap)
-            maxheap_heapify (k, heap_dis, heap_ids);
-
-        const uint8_t * bcode = bcodes;
-        for (size_t j = 0; j < nb; j++) {
-            float dis = 0;
-            const float * tab = sdc_table.data();
-            for (int m = 0; m < M; m++) {
-                dis += tab[bcode[m] + qcode[m] * ksub];
-                tab += ksub * ksub;
-            }
-            if (dis < heap_dis[0]) {
-                maxheap_pop (k, heap_dis, heap_ids);
-                maxheap_push (k, heap_dis, heap_ids, dis, j);
-            }
-            bcode += code_size;
+        float * dis_table = dis_tables.get() + i * ksub * M;
+        for (size_t m = 0; m < M; m++) {
+            memcpy (dis_table + m * ksub,
+                    sdc_table.data() + (m * ksub + qcode[m]) * ksub,
+                    sizeof (float) * ksub);
         }
-
-        if (init_finalize_heap)
-            maxheap_reorder (k, heap_dis, heap_ids);
     }
 
+    pq_knn_search_with_tables<CMax<float, int64_t>> (
+      *this, nbits, dis_tables.get(), bcodes, nb, res, init_finalize_heap);
 }
 
 
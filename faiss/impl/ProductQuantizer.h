@@ -166,6 +166,9 @@ struct ProductQuantizer {
     // intitialize the SDC table from the centroids
     void compute_sdc_table ();
 
+    /// centroids and SDC table
+    MemoryUsage memory_usage () const;
+
     void search_sdc (const uint8_t * qcodes,
                      size_t nq,
                      const uint8_t * bcodes,
@@ -0,0 +1,456 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/impl/RangeIOReader.h>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef FAISS_ENABLE_CURL
+#include <curl/curl.h>
+#endif
+
+#include <faiss/impl/FaissAssert.h>
+
+namespace faiss {
+
+
+/***********************************************************************
+ * FileRangeSource
+ ***********************************************************************/
+
+FileRangeSource::FileRangeSource (const char *fname)
+{
+    name = fname;
+    fd = open (fname, O_RDONLY);
+    FAISS_THROW_IF_NOT_FMT (fd >= 0, "could not open %s for reading: %s",
+                            fname, strerror(errno));
+}
+
+size_t FileRangeSource::size ()
+{
+    struct stat buf;
+    int ret = fstat (fd, &buf);
+    FAISS_THROW_IF_NOT_FMT (ret == 0, "fstat failed: %s", strerror(errno));
+    return buf.st_size;
+}
+
+void FileRangeSource::read_range (size_t offset, size_t nbytes, void *dst)
+{
+    uint8_t *p = (uint8_t*)dst;
+    while (nbytes > 0) {
+        ssize_t ret = pread (fd, p, nbytes, offset);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        FAISS_THROW_IF_NOT_FMT (ret > 0, "read error in %s: %s",
+                                name.c_str(),
+                                ret == 0 ? "file too short" : strerror(errno));
+        p += ret;
+        offset += ret;
+        nbytes -= ret;
+    }
+}
+
+FileRangeSource::~FileRangeSource ()
+{
+    close (fd);
+}
+
+
+/***********************************************************************
+ * HTTPRangeSource
+ ***********************************************************************/
+
+#ifdef FAISS_ENABLE_CURL
+
+namespace {
+
+std::once_flag curl_init_flag;
+
+struct TransferState {
+    uint8_t *dst;
+    size_t capacity;
+    size_t received;
+    size_t total;    ///< from the Content-Range header
+};
+
+size_t write_callback (char *data, size_t size, size_t nmemb, void *arg)
+{
+    TransferState *ts = (TransferState*)arg;
+    size_t n = size * nmemb;
+    if (ts->received + n > ts->capacity) {
+        return 0; // aborts the transfer
+    }
+    memcpy (ts->dst + ts->received, data, n);
+    ts->received += n;
+    return n;
+}
+
+size_t header_callback (char *data, size_t size, size_t nmemb, void *arg)
+{
+    TransferState *ts = (TransferState*)arg;
+    size_t n = size * nmemb;
+    std::string line (data, n);
+    // Content-Range: bytes <first>-<last>/<total>
+    const char *key = "content-range:";
+    if (line.size() > strlen (key) &&
+        strncasecmp (line.c_str(), key, strlen (key)) == 0) {
+        size_t slash = line.find ('/');
+        if (slash != std::string::npos) {
+            ts->total = strtoull (line.c_str() + slash + 1, nullptr, 10);
+        }
+    }
+    return n;
+}
+
+} // anonymous namespace
+
+/// curl handles that are not in use, reusing them keeps the
+/// connections open
+struct HTTPRangeSource::HandlePool {
+    std::mutex mutex;
+    std::vector<CURL*> free_handles;
+    std::once_flag size_flag;
+
+    CURL *get () {
+        std::lock_guard<std::mutex> lock (mutex);
+        if (free_handles.empty()) {
+            CURL *h = curl_easy_init ();
+            FAISS_THROW_IF_NOT_MSG (h, "curl_easy_init failed");
+            return h;
+        }
+        CURL *h = free_handles.back();
+        free_handles.pop_back();
+        return h;
+    }
+
+    void release (CURL *h) {
+        std::lock_guard<std::mutex> lock (mutex);
+        free_handles.push_back (h);
+    }
+
+    ~HandlePool () {
+        for (CURL *h : free_handles) {
+            curl_easy_cleanup (h);
+        }
+    }
+};
+
+HTTPRangeSource::HTTPRangeSource (const char *url):
+    url (url), max_retries (3), timeout_ms (0), total_size (0),
+    handles (nullptr)
+{
+    name = url;
+    std::call_once (curl_init_flag, [] () {
+        curl_global_init (CURL_GLOBAL_DEFAULT);
+    });
+    handles = new HandlePool ();
+}
+
+std::string HTTPRangeSource::try_read_range (
+        size_t offset, size_t nbytes, void *dst, size_t *total)
+{
+    CURL *h = handles->get ();
+    curl_easy_reset (h);
+
+    TransferState ts;
+    ts.dst = (uint8_t*)dst;
+    ts.capacity = nbytes;
+    ts.received = 0;
+    ts.total = 0;
+
+    char range[64];
+    snprintf (range, sizeof(range), "%zd-%zd", offset, offset + nbytes - 1);
+
+    struct curl_slist *hlist = nullptr;
+    for (const std::string & hd : headers) {
+        hlist = curl_slist_append (hlist, hd.c_str());
+    }
+
+    curl_easy_setopt (h, CURLOPT_URL, url.c_str());
+    curl_easy_setopt (h, CURLOPT_RANGE, range);
+    curl_easy_setopt (h, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt (h, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt (h, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt (h, CURLOPT_WRITEDATA, &ts);
+    curl_easy_setopt (h, CURLOPT_HEADERFUNCTION, header_callback);
+    curl_easy_setopt (h, CURLOPT_HEADERDATA, &ts);
+    if (hlist) {
+        curl_easy_setopt (h, CURLOPT_HTTPHEADER, hlist);
+    }
+    if (timeout_ms > 0) {
+        curl_easy_setopt (h, CURLOPT_TIMEOUT_MS, timeout_ms);
+    }
+    if (!aws_sigv4.empty()) {
+#if LIBCURL_VERSION_NUM >= 0x074b00
+        curl_easy_setopt (h, CURLOPT_AWS_SIGV4, aws_sigv4.c_str());
+#else
+        FAISS_THROW_MSG ("aws_sigv4 requires libcurl >= 7.75");
+#endif
+    }
+    if (!userpwd.empty()) {
+        curl_easy_setopt (h, CURLOPT_USERPWD, userpwd.c_str());
+    }
+
+    CURLcode res = curl_easy_perform (h);
+    long status = 0;
+    curl_easy_getinfo (h, CURLINFO_RESPONSE_CODE, &status);
+    curl_slist_free_all (hlist);
+    handles->release (h);
+
+    char buf[256];
+    if (res != CURLE_OK) {
+        snprintf (buf, sizeof(buf), "%s", curl_easy_strerror (res));
+        return buf;
+    }
+    // 200 = the server ignored the range, acceptable for the whole file
+    bool whole_file = status == 200 && offset == 0 && ts.received == nbytes;
+    if (status != 206 && !whole_file) {
+        snprintf (buf, sizeof(buf), "HTTP status %ld", status);
+        return buf;
+    }
+    if (ts.received != nbytes) {
+        snprintf (buf, sizeof(buf), "received %zd bytes instead of %zd",
+                  ts.received, nbytes);
+        return buf;
+    }
+    if (total) {
+        *total = ts.total;
+    }
+    return "";
+}
+
+void HTTPRangeSource::read_range (size_t offset, size_t nbytes, void *dst)
+{
+    if (nbytes == 0) {
+        return;
+    }
+    std::string err;
+    for (int attempt = 0; attempt <= max_retries; attempt++) {
+        if (attempt > 0) {
+            std::this_thread::sleep_for (
+                  std::chrono::milliseconds (100 << std::min (attempt, 6)));
+        }
+        err = try_read_range (offset, nbytes, dst, nullptr);
+        if (err.empty()) {
+            return;
+        }
+        // client errors (eg. 403, 404, 416) are not transient
+        const char *client_error = "HTTP status 4";
+        if (err.compare (0, strlen (client_error), client_error) == 0) {
+            break;
+        }
+    }
+    FAISS_THROW_FMT ("could not read %zd bytes at offset %zd of %s: %s",
+                     nbytes, offset, url.c_str(), err.c_str());
+}
+
+size_t HTTPRangeSource::size ()
+{
+    // HEAD requests are not allowed on URLs presigned for GET, so read
+    // the first byte and get the size from the Content-Range
+    std::call_once (handles->size_flag, [this] () {
+        uint8_t byte;
+        std::string err = try_read_range (0, 1, &byte, &total_size);
+        FAISS_THROW_IF_NOT_FMT (err.empty(), "could not get the size of "
+                                "%s: %s", url.c_str(), err.c_str());
+        FAISS_THROW_IF_NOT_FMT (total_size > 0, "%s: no Content-Range in "
+                                "the response", url.c_str());
+    });
+    return total_size;
+}
+
+HTTPRangeSource::~HTTPRangeSource ()
+{
+    delete handles;
+}
+
+#else // FAISS_ENABLE_CURL
+
+struct HTTPRangeSource::HandlePool {};
+
+HTTPRangeSource::HTTPRangeSource (const char *url):
+    url (url), max_retries (3), timeout_ms (0), total_size (0),
+    handles (nullptr)
+{
+    FAISS_THROW_MSG ("HTTPRangeSource: faiss was built without libcurl");
+}
+
+std::string HTTPRangeSource::try_read_range (
+        size_t, size_t, void *, size_t *)
+{
+    return "not supported";
+}
+
+void HTTPRangeSource::read_range (size_t, size_t, void *)
+{
+    FAISS_THROW_MSG ("not supported");
+}
+
+size_t HTTPRangeSource::size ()
+{
+    FAISS_THROW_MSG ("not supported");
+}
+
+HTTPRangeSource::~HTTPRangeSource ()
+{}
+
+#endif // FAISS_ENABLE_CURL
+
+
+/***********************************************************************
+ * RangeIOReader
+ ***********************************************************************/
+
+struct RangeIOReader::Block {
+    size_t offset, nbytes;
+    std::vector<uint8_t> data;
+    // protected by the pool mutex
+    bool done = false;
+    bool cancelled = false;
+    std::exception_ptr error;
+};
+
+/// threads that fetch the blocks in the order they were requested
+struct RangeIOReader::Pool {
+    std::mutex mutex;
+    std::condition_variable cv_request, cv_done;
+    std::deque<std::shared_ptr<Block> > requests;
+    bool stop = false;
+    std::vector<std::thread> threads;
+
+    void run (RangeSource *source) {
+        std::unique_lock<std::mutex> lock (mutex);
+        for (;;) {
+            cv_request.wait (lock, [this] () {
+                return stop || !requests.empty();
+            });
+            if (stop) {
+                return;
+            }
+            std::shared_ptr<Block> b = requests.front();
+            requests.pop_front();
+            if (b->cancelled) {
+                continue;
+            }
+            lock.unlock ();
+            std::exception_ptr error;
+            try {
+                b->data.resize (b->nbytes);
+                source->read_range (b->offset, b->nbytes, b->data.data());
+            } catch (...) {
+                error = std::current_exception();
+            }
+            lock.lock ();
+            b->error = error;
+            b->done = true;
+            cv_done.notify_all ();
+        }
+    }
+};
+
+RangeIOReader::RangeIOReader (RangeSource *source, int max_inflight,
+                              size_t block_size):
+    source (source), offset (0), block_size (block_size),
+    max_inflight (max_inflight), pool (nullptr)
+{
+    FAISS_THROW_IF_NOT (max_inflight > 0 && block_size > 0);
+    name = source->name;
+    source_size = source->size ();
+    pool = new Pool ();
+    for (int i = 0; i < max_inflight; i++) {
+        pool->threads.emplace_back ([this] () { pool->run (this->source); });
+    }
+}
+
+void RangeIOReader::update_readahead ()
+{
+    size_t bno = offset / block_size;
+    std::lock_guard<std::mutex> lock (pool->mutex);
+    while (!blocks.empty() && blocks.begin()->first < bno) {
+        blocks.begin()->second->cancelled = true;
+        blocks.erase (blocks.begin());
+    }
+    for (size_t i = bno; i < bno + max_inflight; i++) {
+        if (i * block_size >= source_size) {
+            break;
+        }
+        if (blocks.count (i)) {
+            continue;
+        }
+        std::shared_ptr<Block> b (new Block ());
+        b->offset = i * block_size;
+        b->nbytes = std::min (block_size, source_size - b->offset);
+        blocks[i] = b;
+        pool->requests.push_back (b);
+    }
+    pool->cv_request.notify_all ();
+}
+
+size_t RangeIOReader::operator()(void *ptr, size_t size, size_t nitems)
+{
+    size_t n = size * nitems;
+    if (n == 0) return 0;
+    uint8_t *dst = (uint8_t*)ptr;
+    size_t nb = 0;
+    while (nb < n && offset < source_size) {
+        update_readahead ();
+        std::shared_ptr<Block> b = blocks.at (offset / block_size);
+        {
+            std::unique_lock<std::mutex> lock (pool->mutex);
+            pool->cv_done.wait (lock, [&b] () { return b->done; });
+        }
+        if (b->error) {
+            std::rethrow_exception (b->error);
+        }
+        size_t nb2 = std::min (n - nb, b->offset + b->nbytes - offset);
+        memcpy (dst + nb, b->data.data() + (offset - b->offset), nb2);
+        offset += nb2;
+        nb += nb2;
+    }
+    return nb / size;
+}
+
+void RangeIOReader::skip (size_t nbytes)
+{
+    offset += nbytes;
+    update_readahead ();
+}
+
+RangeIOReader::~RangeIOReader ()
+{
+    {
+        std::lock_guard<std::mutex> lock (pool->mutex);
+        pool->stop = true;
+        pool->cv_request.notify_all ();
+    }
+    for (auto & t : pool->threads) {
+        t.join ();
+    }
+    delete pool;
+}
+
+
+} // namespace faiss
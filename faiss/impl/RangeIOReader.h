@@ -0,0 +1,144 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <faiss/impl/io.h>
+
+namespace faiss {
+
+
+/** A byte array that supports reads of arbitrary ranges, eg. a file in
+ * object storage. read_range is called concurrently from several
+ * threads.
+ */
+struct RangeSource {
+    /// name that can be used in error messages
+    std::string name;
+
+    /// total size in bytes
+    virtual size_t size () = 0;
+
+    /// read exactly nbytes from offset into dst, throws on error
+    virtual void read_range (size_t offset, size_t nbytes, void *dst) = 0;
+
+    virtual ~RangeSource () {}
+};
+
+
+/// range reads from a local file, with pread
+struct FileRangeSource: RangeSource {
+    int fd;
+
+    explicit FileRangeSource (const char *fname);
+
+    size_t size () override;
+
+    void read_range (size_t offset, size_t nbytes, void *dst) override;
+
+    ~FileRangeSource () override;
+};
+
+
+/** Range reads over HTTP or HTTPS (requests with a Range header), with
+ * libcurl. This covers S3-compatible object stores with presigned
+ * URLs, or with the signature computed by curl (aws_sigv4), and other
+ * object stores that take an authorization header.
+ *
+ * The connections are reused across requests. Failed requests are
+ * retried. Throws if faiss was built without libcurl.
+ */
+struct HTTPRangeSource: RangeSource {
+    std::string url;
+
+    /// extra request headers, eg. "Authorization: Bearer <token>"
+    std::vector<std::string> headers;
+
+    /** if not empty, sign the requests with AWS signature V4, eg.
+     * "aws:amz:us-east-1:s3" (see CURLOPT_AWS_SIGV4), with userpwd =
+     * "<access key>:<secret key>" */
+    std::string aws_sigv4;
+    std::string userpwd;
+
+    int max_retries;      ///< nb of retries of a failed request
+    long timeout_ms;      ///< timeout of a request, 0 = none
+
+    explicit HTTPRangeSource (const char *url);
+
+    /// fetched with the first request, as curl does not support HEAD
+    /// on presigned URLs
+    size_t size () override;
+
+    void read_range (size_t offset, size_t nbytes, void *dst) override;
+
+    ~HTTPRangeSource () override;
+
+    // private
+    size_t total_size;
+    struct HandlePool;
+    HandlePool *handles;
+
+    /// one attempt, returns an error message or "" on success
+    std::string try_read_range (size_t offset, size_t nbytes, void *dst,
+                                size_t *total);
+};
+
+
+/** Sequential reader over a RangeSource, eg. to call read_index
+ * directly on an index in object storage instead of downloading it to
+ * a local file first.
+ *
+ * The data is fetched by blocks of block_size bytes, and up to
+ * max_inflight blocks after the current position are fetched in
+ * parallel by a pool of threads (readahead), so that large arrays are
+ * transferred with many concurrent requests.
+ *
+ * With IO_FLAG_REMOTE_INVLISTS (see RemoteInvertedLists.h), the
+ * inverted lists of an IVF index are not read but fetched lazily from
+ * the source when they are accessed.
+ */
+struct RangeIOReader: IOReader {
+    RangeSource *source;   ///< not owned
+    size_t offset;         ///< position of the next byte returned
+    size_t block_size;
+    int max_inflight;
+
+    /** local file (eg. on SSD) where RemoteInvertedLists stores the
+     * lists it fetched, empty = keep them in memory */
+    std::string invlists_cache_filename;
+
+    explicit RangeIOReader (RangeSource *source, int max_inflight = 16,
+                            size_t block_size = 4 * 1024 * 1024);
+
+    size_t operator()(void *ptr, size_t size, size_t nitems) override;
+
+    /// skip nbytes without fetching them
+    void skip (size_t nbytes);
+
+    ~RangeIOReader () override;
+
+    // private
+    struct Block;
+    struct Pool;
+    Pool *pool;
+    /// blocks fetched or being fetched, by block number
+    std::map<size_t, std::shared_ptr<Block> > blocks;
+    size_t source_size;
+
+    /// drop the blocks before offset and request those after it
+    void update_readahead ();
+};
+
+
+} // namespace faiss
@@ -0,0 +1,234 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/impl/ResidualQuantizer.h>
+
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/Heap.h>
+#include <faiss/utils/utils.h>
+
+namespace faiss {
+
+ResidualQuantizer::ResidualQuantizer (size_t d, size_t M, size_t nbits,
+                                      Search_type_t search_type):
+    AdditiveQuantizer (d, M, nbits, search_type),
+    max_beam_size (5)
+{}
+
+ResidualQuantizer::ResidualQuantizer ():
+    ResidualQuantizer (0, 1, 8)
+{}
+
+
+void beam_search_encode_step (
+        size_t d, size_t K, const float *cent,
+        size_t n, size_t beam_size, const float *residuals,
+        size_t m, const int32_t *codes,
+        size_t new_beam_size,
+        int32_t *new_codes, float *new_residuals, float *new_distances)
+{
+    using idx_t = Index::idx_t;
+    FAISS_THROW_IF_NOT (new_beam_size <= beam_size * K);
+
+    // nearest codebook entries of each beam
+    size_t kk = std::min (new_beam_size, K);
+    std::vector<float> cent_dis (n * beam_size * kk);
+    std::vector<idx_t> cent_ids (n * beam_size * kk);
+    {
+        IndexFlatL2 assign_index (d);
+        assign_index.add (K, cent);
+        assign_index.search (n * beam_size, residuals, kk,
+                             cent_dis.data(), cent_ids.data());
+    }
+
+#pragma omp parallel for if (n > 100)
+    for (int64_t i = 0; i < n; i++) {
+        // best new_beam_size (beam, entry) combinations for vector i
+        std::vector<float> heap_dis (new_beam_size);
+        std::vector<idx_t> heap_ids (new_beam_size);
+        heap_heapify<CMax<float, idx_t>> (
+              new_beam_size, heap_dis.data(), heap_ids.data());
+
+        const float *cd = cent_dis.data() + i * beam_size * kk;
+        const idx_t *ci = cent_ids.data() + i * beam_size * kk;
+        for (size_t b = 0; b < beam_size; b++) {
+            for (size_t j = 0; j < kk; j++) {
+                float dis = cd[b * kk + j];
+                if (dis < heap_dis[0]) {
+                    heap_pop<CMax<float, idx_t>> (
+                          new_beam_size, heap_dis.data(), heap_ids.data());
+                    heap_push<CMax<float, idx_t>> (
+                          new_beam_size, heap_dis.data(), heap_ids.data(),
+                          dis, b * K + ci[b * kk + j]);
+                }
+            }
+        }
+        heap_reorder<CMax<float, idx_t>> (
+              new_beam_size, heap_dis.data(), heap_ids.data());
+
+        for (size_t nb = 0; nb < new_beam_size; nb++) {
+            idx_t b = heap_ids[nb] / K;
+            idx_t c = heap_ids[nb] % K;
+            int32_t *nc = new_codes + (i * new_beam_size + nb) * (m + 1);
+            if (m > 0) {
+                memcpy (nc, codes + (i * beam_size + b) * m,
+                        sizeof (*codes) * m);
+            }
+            nc[m] = c;
+            fvec_madd (d, residuals + (i * beam_size + b) * d,
+                       -1.0, cent + c * d,
+                       new_residuals + (i * new_beam_size + nb) * d);
+            new_distances[i * new_beam_size + nb] = heap_dis[nb];
+        }
+    }
+}
+
+
+void ResidualQuantizer::train (size_t n, const float *x)
+{
+    codebooks.resize (M * K * d);
+
+    size_t beam_size = 1;
+    std::vector<float> residuals (x, x + n * d);
+    std::vector<int32_t> codes;
+    std::vector<float> distances;
+
+    double t0 = getmillisecs ();
+
+    for (size_t m = 0; m < M; m++) {
+        // codebook m is the k-means of the residuals of all the beams
+        float *cb = codebooks.data() + m * K * d;
+        {
+            Clustering clus (d, K, cp);
+            IndexFlatL2 assign_index (d);
+            clus.train (n * beam_size, residuals.data(), assign_index);
+            memcpy (cb, clus.centroids.data(), sizeof (*cb) * K * d);
+        }
+
+        size_t new_beam_size = std::min (beam_size * K,
+                                         size_t (max_beam_size));
+        std::vector<int32_t> new_codes (n * new_beam_size * (m + 1));
+        std::vector<float> new_residuals (n * new_beam_size * d);
+        distances.resize (n * new_beam_size);
+
+        beam_search_encode_step (
+              d, K, cb, n, beam_size, residuals.data(),
+              m, codes.data(),
+              new_beam_size,
+              new_codes.data(), new_residuals.data(), distances.data());
+
+        codes.swap (new_codes);
+        residuals.swap (new_residuals);
+        beam_size = new_beam_size;
+
+        if (verbose) {
+            double mse = 0;
+            for (size_t i = 0; i < n; i++) {
+                mse += distances[i * beam_size];
+            }
+            printf ("[%.3f s] train stage %zd, %zd bits, beam size %zd, "
+                    "MSE %g\n", (getmillisecs () - t0) / 1000,
+                    m, nbits, beam_size, mse / n);
+        }
+    }
+
+    is_trained = true;
+
+    if (norm_bits > 0) {
+        // norms of the best encodings
+        std::vector<int32_t> best_codes (n * M);
+        for (size_t i = 0; i < n; i++) {
+            memcpy (best_codes.data() + i * M,
+                    codes.data() + i * beam_size * M,
+                    sizeof (int32_t) * M);
+        }
+        std::vector<float> norms (n);
+        compute_norms (best_codes.data(), n, nullptr, norms.data());
+        train_norm (n, norms.data());
+    }
+}
+
+
+void ResidualQuantizer::refine_beam (size_t n, const float *x, int beam_size,
+                                     int32_t *out_codes,
+                                     float *out_residuals) const
+{
+    size_t cur_beam_size = 1;
+    std::vector<float> residuals (x, x + n * d);
+    std::vector<int32_t> codes;
+    std::vector<float> distances;
+
+    for (size_t m = 0; m < M; m++) {
+        size_t new_beam_size = std::min (cur_beam_size * K,
+                                         size_t (beam_size));
+        std::vector<int32_t> new_codes (n * new_beam_size * (m + 1));
+        std::vector<float> new_residuals (n * new_beam_size * d);
+        distances.resize (n * new_beam_size);
+
+        beam_search_encode_step (
+              d, K, codebooks.data() + m * K * d,
+              n, cur_beam_size, residuals.data(),
+              m, codes.data(),
+              new_beam_size,
+              new_codes.data(), new_residuals.data(), distances.data());
+
+        codes.swap (new_codes);
+        residuals.swap (new_residuals);
+        cur_beam_size = new_beam_size;
+    }
+
+    // the beams are sorted, keep the first one
+    for (size_t i = 0; i < n; i++) {
+        memcpy (out_codes + i * M, codes.data() + i * cur_beam_size * M,
+                sizeof (*out_codes) * M);
+        if (out_residuals) {
+            memcpy (out_residuals + i * d,
+                    residuals.data() + i * cur_beam_size * d,
+                    sizeof (*out_residuals) * d);
+        }
+    }
+}
+
+
+void ResidualQuantizer::compute_codes (const float *x, uint8_t *codes_out,
+                                       size_t n,
+                                       const float *centroids) const
+{
+    FAISS_THROW_IF_NOT_MSG (is_trained, "RQ is not trained yet");
+
+    // limit the memory used by the beams
+    size_t bs = std::max (size_t (1), size_t (65536) / max_beam_size);
+    if (n > bs) {
+        for (size_t i0 = 0; i0 < n; i0 += bs) {
+            size_t i1 = std::min (n, i0 + bs);
+            compute_codes (x + i0 * d, codes_out + i0 * code_size, i1 - i0,
+                           centroids ? centroids + i0 * d : nullptr);
+        }
+        return;
+    }
+
+    std::vector<int32_t> codes (n * M);
+    refine_beam (n, x, max_beam_size, codes.data());
+
+    std::vector<float> norms;
+    if (norm_bits > 0) {
+        norms.resize (n);
+        compute_norms (codes.data(), n, centroids, norms.data());
+    }
+    pack_codes (n, codes.data(), codes_out,
+                norms.empty() ? nullptr : norms.data());
+}
+
+} // namespace faiss
@@ -0,0 +1,78 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include <faiss/Clustering.h>
+#include <faiss/impl/AdditiveQuantizer.h>
+
+namespace faiss {
+
+/** Residual quantizer with variable number of bits per sub-quantizer
+ *
+ * The codebooks are trained sequentially: codebook m is the k-means of
+ * the residuals of the encoding with the first m codebooks. The
+ * encoding is a beam search that keeps the max_beam_size best partial
+ * encodings of each vector at each step.
+ */
+struct ResidualQuantizer: AdditiveQuantizer {
+
+    /// beam size used for training and for encoding
+    int max_beam_size;
+
+    /// clustering parameters of the codebooks
+    ClusteringParameters cp;
+
+    ResidualQuantizer (size_t d, size_t M, size_t nbits,
+                       Search_type_t search_type = ST_decompress);
+
+    ResidualQuantizer ();
+
+    /// train the codebooks and the norm quantizer
+    void train (size_t n, const float *x) override;
+
+    void compute_codes (const float *x, uint8_t *codes, size_t n,
+                        const float *centroids = nullptr) const override;
+
+    /** beam search encoding of a set of vectors
+     *
+     * @param x          vectors to encode, size n * d
+     * @param beam_size  beam size of the search
+     * @param codes      output codebook indices, size n * M
+     * @param residuals  output residuals of the encoding, size n * d
+     *                   or nullptr
+     */
+    void refine_beam (size_t n, const float *x, int beam_size,
+                      int32_t *codes, float *residuals = nullptr) const;
+};
+
+
+/** one step of the beam search: extend the beams of n vectors with
+ * the entries of a codebook
+ *
+ * @param cent           codebook, size K * d
+ * @param residuals      residuals of the beams, size n * beam_size * d
+ * @param codes          codes of the beams, size n * beam_size * m
+ * @param new_codes      output codes, size n * new_beam_size * (m + 1)
+ * @param new_residuals  output residuals, size n * new_beam_size * d
+ * @param new_distances  output squared norms of the new residuals,
+ *                       size n * new_beam_size, sorted for each vector
+ */
+void beam_search_encode_step (
+        size_t d, size_t K, const float *cent,
+        size_t n, size_t beam_size, const float *residuals,
+        size_t m, const int32_t *codes,
+        size_t new_beam_size,
+        int32_t *new_codes, float *new_residuals, float *new_distances);
+
+} // namespace faiss
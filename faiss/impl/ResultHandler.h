@@ -131,6 +131,103 @@ struct HeapResultHandler {
 
 };
 
+/*****************************************************************
+ * Single best result handler (k = 1)
+ *
+ * A running min (or max) per query instead of a heap of size 1. The
+ * ties are resolved as with the heap: the first result is kept.
+ *****************************************************************/
+
+
+template<class C>
+struct SingleBestResultHandler {
+
+    using T = typename C::T;
+    using TI = typename C::TI;
+
+    int nq;
+    T *dis_tab;   ///< size nq
+    TI *ids_tab;  ///< size nq
+
+    SingleBestResultHandler(size_t nq, T * dis_tab, TI * ids_tab):
+        nq(nq), dis_tab(dis_tab), ids_tab(ids_tab)
+    {}
+
+    /******************************************************
+     * API for 1 result at a time (each SingleResultHandler is
+     * called from 1 thread)
+     */
+
+    struct SingleResultHandler {
+        SingleBestResultHandler & hr;
+
+        T min_dis;
+        TI min_idx;
+        size_t i;
+
+        SingleResultHandler(SingleBestResultHandler &hr): hr(hr) {}
+
+        /// begin results for query # i
+        void begin(size_t i) {
+            this->i = i;
+            min_dis = C::neutral();
+            min_idx = -1;
+        }
+
+        /// add one result for query i
+        void add_result(T dis, TI idx) {
+            if (C::cmp(min_dis, dis)) {
+                min_dis = dis;
+                min_idx = idx;
+            }
+        }
+
+        /// series of results for query i is done
+        void end() {
+            hr.dis_tab[i] = min_dis;
+            hr.ids_tab[i] = min_idx;
+        }
+    };
+
+    /******************************************************
+     * API for multiple results (called from 1 thread)
+     */
+
+    size_t i0, i1;
+
+    /// begin
+    void begin_multiple(size_t i0, size_t i1) {
+        this->i0 = i0;
+        this->i1 = i1;
+        for (size_t i = i0; i < i1; i++) {
+            dis_tab[i] = C::neutral();
+            ids_tab[i] = -1;
+        }
+    }
+
+    /// add results for query i0..i1 and j0..j1
+    void add_results(size_t j0, size_t j1, const T *dis_tab_in) {
+        for (size_t i = i0; i < i1; i++) {
+            T min_dis = dis_tab[i];
+            TI min_idx = ids_tab[i];
+            for (size_t j = j0; j < j1; j++) {
+                T dis = *dis_tab_in++;
+                if (C::cmp(min_dis, dis)) {
+                    min_dis = dis;
+                    min_idx = j;
+                }
+            }
+            dis_tab[i] = min_dis;
+            ids_tab[i] = min_idx;
+        }
+    }
+
+    /// series of results for queries i0..i1 is done
+    void end_multiple() {}
+
+};
+
+
 /*****************************************************************
  * Reservoir result handler
  *
@@ -192,6 +289,19 @@ struct ReservoirTopN {
 
     void to_result(T *heap_dis, TI *heap_ids) const {
 
+        // sort the whole reservoir in place (the ties are by id, so the
+        // result does not depend on the arrival order) and keep the n best
+        if (HeapPackedSort<C>::sort(i, vals, ids)) {
+            size_t nres = std::min(i, n);
+            memcpy(heap_dis, vals, nres * sizeof(T));
+            memcpy(heap_ids, ids, nres * sizeof(TI));
+            for (size_t j = nres; j < n; j++) {
+                heap_dis[j] = C::neutral();
+                heap_ids[j] = -1;
+            }
+            return;
+        }
+
         for (int j = 0; j < std::min(i, n); j++) {
             heap_push<C>(
                 j + 1, heap_dis, heap_ids,
@@ -408,7 +518,13 @@ struct RangeSearchResultHandler {
         // it is a bit tricky to find the poper PartialResult structure
         // because the inner loop is on db not on queries.
 
-        if (pr < j0s.size() && j0 == j0s[pr]) {
+        if (res->callback) {
+            // streaming: the order of the results does not matter
+            if (partial_results.empty()) {
+                partial_results.push_back(new RangeSearchPartialResult (res));
+            }
+            pres = partial_results[0];
+        } else if (pr < j0s.size() && j0 == j0s[pr]) {
             pres = partial_results[pr];
             pr++;
         } else if (j0 == 0 && j0s.size() > 0) {
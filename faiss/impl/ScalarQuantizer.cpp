@@ -10,15 +10,20 @@
 #include <faiss/impl/ScalarQuantizer.h>
 
 #include <cstdio>
+#include <cstring>
+#include <cmath>
 #include <algorithm>
 
 #include <omp.h>
 
-#ifdef __SSE__
-#include <immintrin.h>
+#include <faiss/utils/simd_x86.h>
+
+#ifdef __aarch64__
+#include <faiss/utils/simdlib.h>
 #endif
 
 #include <faiss/utils/utils.h>
+#include <faiss/utils/prefetch.h>
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/impl/AuxIndexStructures.h>
 
@@ -31,18 +36,35 @@ namespace faiss {
  * variants without incurring runtime tests or virtual function calls:
  *
  * - 4 / 8 bits per code component
- * - uniform / non-uniform
+ * - uniform / non-uniform / 1D k-means codebooks
  * - IP / L2 distance search
- * - scalar / AVX distance computation
+ * - scalar / AVX / AVX-512 distance computation
  *
  * The appropriate Quantizer object is returned via select_quantizer
  * that hides the template mess.
+ *
+ * The AVX2 (SIMDWIDTH = 8) and AVX-512 (SIMDWIDTH = 16) variants are
+ * compiled with function target attributes and selected at runtime, see
+ * utils/cpu_dispatch.h. On aarch64, the SIMDWIDTH = 8 variant is
+ * implemented with NEON, on the simd8float32 type of utils/simdlib.h.
  ********************************************************************/
 
 #if defined(__F16C__) && defined(__AVX2__)
 #define USE_F16C
 #endif
 
+// the 8-wide AVX2 code is compiled if the build targets AVX2, or with
+// target attributes when it can be selected at runtime
+#if defined(USE_F16C) || defined(FAISS_X86_DISPATCH)
+#define USE_SIMD8
+#elif defined(__aarch64__)
+#define USE_SIMD8_NEON
+#endif
+
+#if defined(USE_SIMD8) || defined(USE_SIMD8_NEON)
+#define USE_SIMD8_ANY
+#endif
+
 
 namespace {
 
@@ -51,6 +73,19 @@ typedef ScalarQuantizer::QuantizerType QuantizerType;
 typedef ScalarQuantizer::RangeStat RangeStat;
 using SQDistanceComputer = ScalarQuantizer::SQDistanceComputer;
 
+#ifdef USE_SIMD8_ANY
+// whether the SIMDWIDTH = 8 code can be used
+inline bool use_simd8 ()
+{
+#ifdef USE_SIMD8
+    return use_avx2 ();
+#else
+    // NEON is always available on aarch64
+    return true;
+#endif
+}
+#endif
+
 
 /*******************************************************************
  * Codec: converts between values in [0, 1] and an index in a code
@@ -58,6 +93,43 @@ using SQDistanceComputer = ScalarQuantizer::SQDistanceComputer;
  * index).
  */
 
+#ifdef USE_SIMD8
+/// (int)(x * scale) for 8 components, as 8 * 16 bits. The products are
+/// computed in double precision, like in the scalar encoders.
+FAISS_AVX2_TARGET
+inline __m128i truncate_8_components (__m256 x, double scale) {
+    __m256d s = _mm256_set1_pd (scale);
+    __m128i lo = _mm256_cvttpd_epi32 (
+          _mm256_mul_pd (_mm256_cvtps_pd (_mm256_castps256_ps128 (x)), s));
+    __m128i hi = _mm256_cvttpd_epi32 (
+          _mm256_mul_pd (_mm256_cvtps_pd (_mm256_extractf128_ps (x, 1)), s));
+    return _mm_packus_epi32 (lo, hi);
+}
+#endif
+
+#ifdef FAISS_X86_DISPATCH
+/// same for 16 components, as 16 * 32 bits
+FAISS_AVX512_TARGET
+inline __m512i truncate_16_components (__m512 x, double scale) {
+    __m512d s = _mm512_set1_pd (scale);
+    __m256i lo = _mm512_cvttpd_epi32 (_mm512_mul_pd (
+          _mm512_cvtps_pd (_mm512_extractf32x8_ps (x, 0)), s));
+    __m256i hi = _mm512_cvttpd_epi32 (_mm512_mul_pd (
+          _mm512_cvtps_pd (_mm512_extractf32x8_ps (x, 1)), s));
+    return _mm512_inserti64x4 (_mm512_castsi256_si512 (lo), hi, 1);
+}
+#endif
+
+/// packs 8 6-bit values into 6 bytes, in the layout of Codec6bit
+template<class T>
+inline void pack_8_6bit (const T *c, uint8_t *code) {
+    uint64_t bits = 0;
+    for (int j = 0; j < 8; j++) {
+        bits |= uint64_t(c[j]) << (6 * j);
+    }
+    memcpy (code, &bits, 6);
+}
+
 struct Codec8bit {
 
     static void encode_component (float x, uint8_t *code, int i) {
@@ -68,7 +140,8 @@ struct Codec8bit {
         return (code[i] + 0.5f) / 255.0f;
     }
 
-#ifdef __AVX2__
+#ifdef USE_SIMD8
+    FAISS_AVX2_TARGET
     static __m256 decode_8_components (const uint8_t *code, int i) {
         uint64_t c8 = *(uint64_t*)(code + i);
         __m128i c4lo = _mm_cvtepu8_epi32 (_mm_set1_epi32(c8));
@@ -82,6 +155,45 @@ struct Codec8bit {
         __m256 one_255 = _mm256_set1_ps (1.f / 255.f);
         return f8 * one_255;
     }
+
+    /// 8 components in [0, 1] to 8 bytes
+    FAISS_AVX2_TARGET
+    static __m128i encode_8_components_bytes (__m256 x) {
+        __m256i c8 = _mm256_cvttps_epi32 (x * _mm256_set1_ps (255.f));
+        __m128i c16 = _mm_packus_epi32 (_mm256_castsi256_si128 (c8),
+                                        _mm256_extracti128_si256 (c8, 1));
+        return _mm_packus_epi16 (c16, c16);
+    }
+
+    FAISS_AVX2_TARGET
+    static void encode_8_components (__m256 x, uint8_t *code, int i) {
+        _mm_storel_epi64 ((__m128i*)(code + i), encode_8_components_bytes (x));
+    }
+#elif defined(USE_SIMD8_NEON)
+    static simd8float32 decode_8_components (const uint8_t *code, int i) {
+        uint16x8_t c8 = vmovl_u8 (vld1_u8 (code + i));
+        float32x4_t flo = vcvtq_f32_u32 (vmovl_u16 (vget_low_u16 (c8)));
+        float32x4_t fhi = vcvtq_f32_u32 (vmovl_u16 (vget_high_u16 (c8)));
+        simd8float32 f8 (flo, fhi);
+        return (f8 + simd8float32 (0.5f)) * simd8float32 (1.f / 255.f);
+    }
+#endif
+
+#ifdef FAISS_X86_DISPATCH
+    FAISS_AVX512_TARGET
+    static __m512 decode_16_components (const uint8_t *code, int i) {
+        __m128i c16 = _mm_loadu_si128 ((const __m128i*)(code + i));
+        __m512 f16 = _mm512_cvtepi32_ps (_mm512_cvtepu8_epi32 (c16));
+        f16 = _mm512_add_ps (f16, _mm512_set1_ps (0.5f));
+        return _mm512_mul_ps (f16, _mm512_set1_ps (1.f / 255.f));
+    }
+
+    FAISS_AVX512_TARGET
+    static void encode_16_components (__m512 x, uint8_t *code, int i) {
+        __m512i c16 = _mm512_cvttps_epi32 (
+              _mm512_mul_ps (x, _mm512_set1_ps (255.f)));
+        _mm_storeu_si128 ((__m128i*)(code + i), _mm512_cvtepi32_epi8 (c16));
+    }
 #endif
 };
 
@@ -97,7 +209,8 @@ struct Codec4bit {
     }
 
 
-#ifdef __AVX2__
+#ifdef USE_SIMD8
+    FAISS_AVX2_TARGET
     static __m256 decode_8_components (const uint8_t *code, int i) {
         uint32_t c4 = *(uint32_t*)(code + (i >> 1));
         uint32_t mask = 0x0f0f0f0f;
@@ -117,6 +230,59 @@ struct Codec4bit {
         __m256 one_255 = _mm256_set1_ps (1.f / 15.f);
         return f8 * one_255;
     }
+
+    FAISS_AVX2_TARGET
+    static void encode_8_components (__m256 x, uint8_t *code, int i) {
+        __m128i c8 = truncate_8_components (x, 15.0);
+        // c8 contains 8 * 16-bit values, combine them by pairs
+        __m128i c4 = _mm_or_si128 (
+              _mm_and_si128 (c8, _mm_set1_epi32 (0xf)),
+              _mm_and_si128 (_mm_srli_epi32 (c8, 12), _mm_set1_epi32 (0xf0)));
+        c4 = _mm_packus_epi32 (c4, c4);
+        c4 = _mm_packus_epi16 (c4, c4);
+        *(uint32_t*)(code + (i >> 1)) = _mm_cvtsi128_si32 (c4);
+    }
+#elif defined(USE_SIMD8_NEON)
+    static simd8float32 decode_8_components (const uint8_t *code, int i) {
+        uint32_t c4 = *(uint32_t*)(code + (i >> 1));
+        uint32_t mask = 0x0f0f0f0f;
+        uint32_t c4ev = c4 & mask;
+        uint32_t c4od = (c4 >> 4) & mask;
+
+        // interleave the even and odd components
+        uint8x8_t c8 = vzip1_u8 (vcreate_u8 (c4ev), vcreate_u8 (c4od));
+        uint16x8_t c16 = vmovl_u8 (c8);
+        float32x4_t flo = vcvtq_f32_u32 (vmovl_u16 (vget_low_u16 (c16)));
+        float32x4_t fhi = vcvtq_f32_u32 (vmovl_u16 (vget_high_u16 (c16)));
+        simd8float32 f8 (flo, fhi);
+        return (f8 + simd8float32 (0.5f)) * simd8float32 (1.f / 15.f);
+    }
+#endif
+
+#ifdef FAISS_X86_DISPATCH
+    FAISS_AVX512_TARGET
+    static __m512 decode_16_components (const uint8_t *code, int i) {
+        uint64_t c8 = *(const uint64_t*)(code + (i >> 1));
+        uint64_t mask = 0x0f0f0f0f0f0f0f0fULL;
+        // even components are in the low nibbles
+        __m128i c16 = _mm_unpacklo_epi8 (_mm_set1_epi64x (c8 & mask),
+                                         _mm_set1_epi64x ((c8 >> 4) & mask));
+        __m512 f16 = _mm512_cvtepi32_ps (_mm512_cvtepu8_epi32 (c16));
+        f16 = _mm512_add_ps (f16, _mm512_set1_ps (0.5f));
+        return _mm512_mul_ps (f16, _mm512_set1_ps (1.f / 15.f));
+    }
+
+    FAISS_AVX512_TARGET
+    static void encode_16_components (__m512 x, uint8_t *code, int i) {
+        __m512i c16 = truncate_16_components (x, 15.0);
+        // combine the components by pairs in 64-bit lanes
+        __m512i c8 = _mm512_or_si512 (
+              _mm512_and_si512 (c16, _mm512_set1_epi64 (0xf)),
+              _mm512_and_si512 (_mm512_srli_epi64 (c16, 28),
+                                _mm512_set1_epi64 (0xf0)));
+        _mm_storel_epi64 ((__m128i*)(code + (i >> 1)),
+                          _mm512_cvtepi64_epi8 (c8));
+    }
 #endif
 };
 
@@ -165,10 +331,11 @@ struct Codec6bit {
         return (bits + 0.5f) / 63.0f;
     }
 
-#ifdef __AVX2__
+#ifdef USE_SIMD8
 
     /* Load 6 bytes that represent 8 6-bit values, return them as a
      * 8*32 bit vector register */
+    FAISS_AVX2_TARGET
     static __m256i load6 (const uint16_t *code16) {
         const __m128i perm = _mm_set_epi8(-1, 5, 5, 4, 4, 3, -1, 3, -1, 2, 2, 1, 1, 0, -1, 0);
         const __m256i shifts = _mm256_set_epi32(2, 4, 6, 0, 2, 4, 6, 0);
@@ -186,6 +353,7 @@ struct Codec6bit {
         return c5;
     }
 
+    FAISS_AVX2_TARGET
     static __m256 decode_8_components (const uint8_t *code, int i) {
         __m256i i8 = load6 ((const uint16_t *)(code + (i >> 2) * 3));
         __m256 f8 = _mm256_cvtepi32_ps (i8);
@@ -197,6 +365,44 @@ struct Codec6bit {
         return f8 * one_63;
     }
 
+    FAISS_AVX2_TARGET
+    static void encode_8_components (__m256 x, uint8_t *code, int i) {
+        uint16_t c8[8];
+        _mm_storeu_si128 ((__m128i*)c8, truncate_8_components (x, 63.0));
+        pack_8_6bit (c8, code + (i >> 2) * 3);
+    }
+
+#elif defined(USE_SIMD8_NEON)
+
+    // no specific NEON code for the unpacking, the scalar code is used
+    static simd8float32 decode_8_components (const uint8_t *code, int i) {
+        float xi[8];
+        for (int j = 0; j < 8; j++) {
+            xi[j] = decode_component (code, i + j);
+        }
+        return simd8float32 (xi);
+    }
+
+#endif
+
+#ifdef FAISS_X86_DISPATCH
+    // no specific AVX-512 code, the scalar code is used
+    FAISS_AVX512_TARGET
+    static __m512 decode_16_components (const uint8_t *code, int i) {
+        float xi[16];
+        for (int j = 0; j < 16; j++) {
+            xi[j] = decode_component (code, i + j);
+        }
+        return _mm512_loadu_ps (xi);
+    }
+
+    FAISS_AVX512_TARGET
+    static void encode_16_components (__m512 x, uint8_t *code, int i) {
+        int32_t c16[16];
+        _mm512_storeu_si512 (c16, truncate_16_components (x, 63.0));
+        pack_8_6bit (c16, code + (i >> 2) * 3);
+        pack_8_6bit (c16 + 8, code + (i >> 2) * 3 + 6);
+    }
 #endif
 };
 
@@ -340,7 +546,7 @@ struct QuantizerTemplate<Codec, true, 1>: ScalarQuantizer::Quantizer {
     {
     }
 
-    void encode_vector(const float* x, uint8_t* code) const final {
+    void encode_vector(const float* x, uint8_t* code) const override {
         for (size_t i = 0; i < d; i++) {
             float xi = 0;
             if (vdiff != 0) {
@@ -356,7 +562,7 @@ struct QuantizerTemplate<Codec, true, 1>: ScalarQuantizer::Quantizer {
         }
     }
 
-    void decode_vector(const uint8_t* code, float* x) const final {
+    void decode_vector(const uint8_t* code, float* x) const override {
         for (size_t i = 0; i < d; i++) {
             float xi = Codec::decode_component(code, i);
             x[i] = vmin + xi * vdiff;
@@ -373,7 +579,7 @@ struct QuantizerTemplate<Codec, true, 1>: ScalarQuantizer::Quantizer {
 
 
 
-#ifdef __AVX2__
+#ifdef USE_SIMD8
 
 template<class Codec>
 struct QuantizerTemplate<Codec, true, 8>: QuantizerTemplate<Codec, true, 1> {
@@ -381,6 +587,23 @@ struct QuantizerTemplate<Codec, true, 8>: QuantizerTemplate<Codec, true, 1> {
     QuantizerTemplate (size_t d, const std::vector<float> &trained):
         QuantizerTemplate<Codec, true, 1> (d, trained) {}
 
+    FAISS_AVX2_TARGET
+    void encode_vector(const float* x, uint8_t* code) const override {
+        __m256 vmin = _mm256_set1_ps (this->vmin);
+        __m256 vdiff = _mm256_set1_ps (this->vdiff);
+        __m256 zero = _mm256_setzero_ps ();
+        __m256 one = _mm256_set1_ps (1.0f);
+        for (size_t i = 0; i < this->d; i += 8) {
+            __m256 xi = zero;
+            if (this->vdiff != 0) {
+                xi = (_mm256_loadu_ps (x + i) - vmin) / vdiff;
+                xi = _mm256_min_ps (_mm256_max_ps (xi, zero), one);
+            }
+            Codec::encode_8_components (xi, code, i);
+        }
+    }
+
+    FAISS_AVX2_TARGET
     __m256 reconstruct_8_components (const uint8_t * code, int i) const
     {
         __m256 xi = Codec::decode_8_components (code, i);
@@ -389,6 +612,67 @@ struct QuantizerTemplate<Codec, true, 8>: QuantizerTemplate<Codec, true, 1> {
 
 };
 
+#elif defined(USE_SIMD8_NEON)
+
+template<class Codec>
+struct QuantizerTemplate<Codec, true, 8>: QuantizerTemplate<Codec, true, 1> {
+
+    QuantizerTemplate (size_t d, const std::vector<float> &trained):
+        QuantizerTemplate<Codec, true, 1> (d, trained) {}
+
+    simd8float32 reconstruct_8_components (const uint8_t * code, int i) const
+    {
+        simd8float32 xi = Codec::decode_8_components (code, i);
+        return fmadd (xi, simd8float32 (this->vdiff),
+                      simd8float32 (this->vmin));
+    }
+
+};
+
+#endif
+
+#ifdef FAISS_X86_DISPATCH
+
+template<class Codec>
+struct QuantizerTemplate<Codec, true, 16>: QuantizerTemplate<Codec, true, 1> {
+
+    QuantizerTemplate (size_t d, const std::vector<float> &trained):
+        QuantizerTemplate<Codec, true, 1> (d, trained) {}
+
+    FAISS_AVX512_TARGET
+    void encode_vector(const float* x, uint8_t* code) const override {
+        __m512 vmin = _mm512_set1_ps (this->vmin);
+        __m512 vdiff = _mm512_set1_ps (this->vdiff);
+        __m512 zero = _mm512_setzero_ps ();
+        __m512 one = _mm512_set1_ps (1.0f);
+        for (size_t i = 0; i < this->d; i += 16) {
+            __m512 xi = zero;
+            if (this->vdiff != 0) {
+                xi = _mm512_div_ps (
+                      _mm512_sub_ps (_mm512_loadu_ps (x + i), vmin), vdiff);
+                xi = _mm512_min_ps (_mm512_max_ps (xi, zero), one);
+            }
+            Codec::encode_16_components (xi, code, i);
+        }
+    }
+
+    FAISS_AVX512_TARGET
+    void decode_vector(const uint8_t* code, float* x) const override {
+        for (size_t i = 0; i < this->d; i += 16) {
+            _mm512_storeu_ps (x + i, reconstruct_16_components (code, i));
+        }
+    }
+
+    FAISS_AVX512_TARGET
+    __m512 reconstruct_16_components (const uint8_t * code, int i) const
+    {
+        __m512 xi = Codec::decode_16_components (code, i);
+        return _mm512_fmadd_ps (xi, _mm512_set1_ps (this->vdiff),
+                                _mm512_set1_ps (this->vmin));
+    }
+
+};
+
 #endif
 
 
@@ -401,7 +685,7 @@ struct QuantizerTemplate<Codec, false, 1>: ScalarQuantizer::Quantizer {
     QuantizerTemplate (size_t d, const std::vector<float> &trained):
         d(d), vmin(trained.data()), vdiff(trained.data() + d) {}
 
-    void encode_vector(const float* x, uint8_t* code) const final {
+    void encode_vector(const float* x, uint8_t* code) const override {
         for (size_t i = 0; i < d; i++) {
             float xi = 0;
             if (vdiff[i] != 0) {
@@ -417,7 +701,7 @@ struct QuantizerTemplate<Codec, false, 1>: ScalarQuantizer::Quantizer {
         }
     }
 
-    void decode_vector(const uint8_t* code, float* x) const final {
+    void decode_vector(const uint8_t* code, float* x) const override {
         for (size_t i = 0; i < d; i++) {
             float xi = Codec::decode_component(code, i);
             x[i] = vmin[i] + xi * vdiff[i];
@@ -433,7 +717,7 @@ struct QuantizerTemplate<Codec, false, 1>: ScalarQuantizer::Quantizer {
 };
 
 
-#ifdef __AVX2__
+#ifdef USE_SIMD8
 
 template<class Codec>
 struct QuantizerTemplate<Codec, false, 8>: QuantizerTemplate<Codec, false, 1> {
@@ -441,6 +725,23 @@ struct QuantizerTemplate<Codec, false, 8>: QuantizerTemplate<Codec, false, 1> {
     QuantizerTemplate (size_t d, const std::vector<float> &trained):
         QuantizerTemplate<Codec, false, 1> (d, trained) {}
 
+    FAISS_AVX2_TARGET
+    void encode_vector(const float* x, uint8_t* code) const override {
+        __m256 zero = _mm256_setzero_ps ();
+        __m256 one = _mm256_set1_ps (1.0f);
+        for (size_t i = 0; i < this->d; i += 8) {
+            __m256 vdiff = _mm256_loadu_ps (this->vdiff + i);
+            __m256 xi = (_mm256_loadu_ps (x + i) -
+                         _mm256_loadu_ps (this->vmin + i)) / vdiff;
+            xi = _mm256_min_ps (_mm256_max_ps (xi, zero), one);
+            // components with vdiff = 0 are encoded as 0
+            xi = _mm256_and_ps (
+                  xi, _mm256_cmp_ps (vdiff, zero, _CMP_NEQ_UQ));
+            Codec::encode_8_components (xi, code, i);
+        }
+    }
+
+    FAISS_AVX2_TARGET
     __m256 reconstruct_8_components (const uint8_t * code, int i) const
     {
         __m256 xi = Codec::decode_8_components (code, i);
@@ -450,6 +751,66 @@ struct QuantizerTemplate<Codec, false, 8>: QuantizerTemplate<Codec, false, 1> {
 
 };
 
+#elif defined(USE_SIMD8_NEON)
+
+template<class Codec>
+struct QuantizerTemplate<Codec, false, 8>: QuantizerTemplate<Codec, false, 1> {
+
+    QuantizerTemplate (size_t d, const std::vector<float> &trained):
+        QuantizerTemplate<Codec, false, 1> (d, trained) {}
+
+    simd8float32 reconstruct_8_components (const uint8_t * code, int i) const
+    {
+        simd8float32 xi = Codec::decode_8_components (code, i);
+        return fmadd (xi, simd8float32 (this->vdiff + i),
+                      simd8float32 (this->vmin + i));
+    }
+
+};
+
+#endif
+
+#ifdef FAISS_X86_DISPATCH
+
+template<class Codec>
+struct QuantizerTemplate<Codec, false, 16>: QuantizerTemplate<Codec, false, 1> {
+
+    QuantizerTemplate (size_t d, const std::vector<float> &trained):
+        QuantizerTemplate<Codec, false, 1> (d, trained) {}
+
+    FAISS_AVX512_TARGET
+    void encode_vector(const float* x, uint8_t* code) const override {
+        __m512 zero = _mm512_setzero_ps ();
+        __m512 one = _mm512_set1_ps (1.0f);
+        for (size_t i = 0; i < this->d; i += 16) {
+            __m512 vdiff = _mm512_loadu_ps (this->vdiff + i);
+            // components with vdiff = 0 are encoded as 0
+            __mmask16 nz = _mm512_cmp_ps_mask (vdiff, zero, _CMP_NEQ_UQ);
+            __m512 xi = _mm512_sub_ps (_mm512_loadu_ps (x + i),
+                                       _mm512_loadu_ps (this->vmin + i));
+            xi = _mm512_maskz_div_ps (nz, xi, vdiff);
+            xi = _mm512_min_ps (_mm512_max_ps (xi, zero), one);
+            Codec::encode_16_components (xi, code, i);
+        }
+    }
+
+    FAISS_AVX512_TARGET
+    void decode_vector(const uint8_t* code, float* x) const override {
+        for (size_t i = 0; i < this->d; i += 16) {
+            _mm512_storeu_ps (x + i, reconstruct_16_components (code, i));
+        }
+    }
+
+    FAISS_AVX512_TARGET
+    __m512 reconstruct_16_components (const uint8_t * code, int i) const
+    {
+        __m512 xi = Codec::decode_16_components (code, i);
+        return _mm512_fmadd_ps (xi, _mm512_loadu_ps (this->vdiff + i),
+                                _mm512_loadu_ps (this->vmin + i));
+    }
+
+};
+
 #endif
 
 /*******************************************************************
@@ -466,13 +827,13 @@ struct QuantizerFP16<1>: ScalarQuantizer::Quantizer {
     QuantizerFP16(size_t d, const std::vector<float> & /* unused */):
         d(d) {}
 
-    void encode_vector(const float* x, uint8_t* code) const final {
+    void encode_vector(const float* x, uint8_t* code) const override {
         for (size_t i = 0; i < d; i++) {
             ((uint16_t*)code)[i] = encode_fp16(x[i]);
         }
     }
 
-    void decode_vector(const uint8_t* code, float* x) const final {
+    void decode_vector(const uint8_t* code, float* x) const override {
         for (size_t i = 0; i < d; i++) {
             x[i] = decode_fp16(((uint16_t*)code)[i]);
         }
@@ -485,7 +846,7 @@ struct QuantizerFP16<1>: ScalarQuantizer::Quantizer {
 
 };
 
-#ifdef USE_F16C
+#ifdef USE_SIMD8
 
 template<>
 struct QuantizerFP16<8>: QuantizerFP16<1> {
@@ -493,6 +854,17 @@ struct QuantizerFP16<8>: QuantizerFP16<1> {
     QuantizerFP16 (size_t d, const std::vector<float> &trained):
         QuantizerFP16<1> (d, trained) {}
 
+    FAISS_AVX2_TARGET
+    void encode_vector(const float* x, uint8_t* code) const override {
+        for (size_t i = 0; i < d; i += 8) {
+            __m128i c8 = _mm256_cvtps_ph (
+                _mm256_loadu_ps (x + i),
+                _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+            _mm_storeu_si128 ((__m128i*)(code + 2 * i), c8);
+        }
+    }
+
+    FAISS_AVX2_TARGET
     __m256 reconstruct_8_components (const uint8_t * code, int i) const
     {
         __m128i codei = _mm_loadu_si128 ((const __m128i*)(code + 2 * i));
@@ -501,6 +873,60 @@ struct QuantizerFP16<8>: QuantizerFP16<1> {
 
 };
 
+#elif defined(USE_SIMD8_NEON)
+
+template<>
+struct QuantizerFP16<8>: QuantizerFP16<1> {
+
+    QuantizerFP16 (size_t d, const std::vector<float> &trained):
+        QuantizerFP16<1> (d, trained) {}
+
+    simd8float32 reconstruct_8_components (const uint8_t * code, int i) const
+    {
+        const uint16_t *code16 = (const uint16_t*)code + i;
+        float16x4_t hlo = vreinterpret_f16_u16 (vld1_u16 (code16));
+        float16x4_t hhi = vreinterpret_f16_u16 (vld1_u16 (code16 + 4));
+        return simd8float32 (vcvt_f32_f16 (hlo), vcvt_f32_f16 (hhi));
+    }
+
+};
+
+#endif
+
+#ifdef FAISS_X86_DISPATCH
+
+template<>
+struct QuantizerFP16<16>: QuantizerFP16<1> {
+
+    QuantizerFP16 (size_t d, const std::vector<float> &trained):
+        QuantizerFP16<1> (d, trained) {}
+
+    FAISS_AVX512_TARGET
+    void encode_vector(const float* x, uint8_t* code) const override {
+        for (size_t i = 0; i < d; i += 16) {
+            __m256i c16 = _mm512_cvtps_ph (
+                _mm512_loadu_ps (x + i),
+                _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+            _mm256_storeu_si256 ((__m256i*)(code + 2 * i), c16);
+        }
+    }
+
+    FAISS_AVX512_TARGET
+    void decode_vector(const uint8_t* code, float* x) const override {
+        for (size_t i = 0; i < d; i += 16) {
+            _mm512_storeu_ps (x + i, reconstruct_16_components (code, i));
+        }
+    }
+
+    FAISS_AVX512_TARGET
+    __m512 reconstruct_16_components (const uint8_t * code, int i) const
+    {
+        __m256i codei = _mm256_loadu_si256 ((const __m256i*)(code + 2 * i));
+        return _mm512_cvtph_ps (codei);
+    }
+
+};
+
 #endif
 
 /*******************************************************************
@@ -537,7 +963,7 @@ struct Quantizer8bitDirect<1>: ScalarQuantizer::Quantizer {
 
 };
 
-#ifdef __AVX2__
+#ifdef USE_SIMD8
 
 template<>
 struct Quantizer8bitDirect<8>: Quantizer8bitDirect<1> {
@@ -545,6 +971,7 @@ struct Quantizer8bitDirect<8>: Quantizer8bitDirect<1> {
     Quantizer8bitDirect (size_t d, const std::vector<float> &trained):
         Quantizer8bitDirect<1> (d, trained) {}
 
+    FAISS_AVX2_TARGET
     __m256 reconstruct_8_components (const uint8_t * code, int i) const
     {
         __m128i x8 = _mm_loadl_epi64((__m128i*)(code + i)); // 8 * int8
@@ -554,6 +981,321 @@ struct Quantizer8bitDirect<8>: Quantizer8bitDirect<1> {
 
 };
 
+#elif defined(USE_SIMD8_NEON)
+
+template<>
+struct Quantizer8bitDirect<8>: Quantizer8bitDirect<1> {
+
+    Quantizer8bitDirect (size_t d, const std::vector<float> &trained):
+        Quantizer8bitDirect<1> (d, trained) {}
+
+    simd8float32 reconstruct_8_components (const uint8_t * code, int i) const
+    {
+        uint16x8_t y8 = vmovl_u8 (vld1_u8 (code + i)); // 8 * uint16
+        return simd8float32 (
+               vcvtq_f32_u32 (vmovl_u16 (vget_low_u16 (y8))),
+               vcvtq_f32_u32 (vmovl_u16 (vget_high_u16 (y8))));
+    }
+
+};
+
+#endif
+
+#ifdef FAISS_X86_DISPATCH
+
+template<>
+struct Quantizer8bitDirect<16>: Quantizer8bitDirect<1> {
+
+    Quantizer8bitDirect (size_t d, const std::vector<float> &trained):
+        Quantizer8bitDirect<1> (d, trained) {}
+
+    FAISS_AVX512_TARGET
+    __m512 reconstruct_16_components (const uint8_t * code, int i) const
+    {
+        __m128i x16 = _mm_loadu_si128((const __m128i*)(code + i));
+        return _mm512_cvtepi32_ps (_mm512_cvtepu8_epi32 (x16));
+    }
+
+};
+
+#endif
+
+/*******************************************************************
+ * 8bit_direct_signed quantizer: the int8 components are stored with an
+ * offset of 128, so that the codes are the same uint8s as 8bit_direct
+ *******************************************************************/
+
+template<int SIMDWIDTH>
+struct Quantizer8bitDirectSigned {};
+
+template<>
+struct Quantizer8bitDirectSigned<1>: ScalarQuantizer::Quantizer {
+    const size_t d;
+
+    Quantizer8bitDirectSigned(size_t d,
+                              const std::vector<float> & /* unused */):
+        d(d) {}
+
+
+    void encode_vector(const float* x, uint8_t* code) const final {
+        for (size_t i = 0; i < d; i++) {
+            float xi = std::min (std::max (x[i], -128.f), 127.f);
+            code[i] = (uint8_t)((int)xi + 128);
+        }
+    }
+
+    void decode_vector(const uint8_t* code, float* x) const final {
+        for (size_t i = 0; i < d; i++) {
+            x[i] = (int)code[i] - 128;
+        }
+    }
+
+    float reconstruct_component (const uint8_t * code, int i) const
+    {
+        return (int)code[i] - 128;
+    }
+
+};
+
+#ifdef USE_SIMD8
+
+template<>
+struct Quantizer8bitDirectSigned<8>: Quantizer8bitDirectSigned<1> {
+
+    Quantizer8bitDirectSigned (size_t d, const std::vector<float> &trained):
+        Quantizer8bitDirectSigned<1> (d, trained) {}
+
+    FAISS_AVX2_TARGET
+    __m256 reconstruct_8_components (const uint8_t * code, int i) const
+    {
+        __m128i x8 = _mm_loadl_epi64((__m128i*)(code + i)); // 8 * uint8
+        __m256i y8 = _mm256_sub_epi32 (_mm256_cvtepu8_epi32 (x8),
+                                       _mm256_set1_epi32 (128));
+        return _mm256_cvtepi32_ps (y8); // 8 * float32
+    }
+
+};
+
+#elif defined(USE_SIMD8_NEON)
+
+template<>
+struct Quantizer8bitDirectSigned<8>: Quantizer8bitDirectSigned<1> {
+
+    Quantizer8bitDirectSigned (size_t d, const std::vector<float> &trained):
+        Quantizer8bitDirectSigned<1> (d, trained) {}
+
+    simd8float32 reconstruct_8_components (const uint8_t * code, int i) const
+    {
+        // flipping the high bit maps c to the int8 c - 128
+        int8x8_t x8 = vreinterpret_s8_u8 (
+              veor_u8 (vld1_u8 (code + i), vdup_n_u8 (0x80)));
+        int16x8_t y8 = vmovl_s8 (x8); // 8 * int16
+        return simd8float32 (
+               vcvtq_f32_s32 (vmovl_s16 (vget_low_s16 (y8))),
+               vcvtq_f32_s32 (vmovl_s16 (vget_high_s16 (y8))));
+    }
+
+};
+
+#endif
+
+#ifdef FAISS_X86_DISPATCH
+
+template<>
+struct Quantizer8bitDirectSigned<16>: Quantizer8bitDirectSigned<1> {
+
+    Quantizer8bitDirectSigned (size_t d, const std::vector<float> &trained):
+        Quantizer8bitDirectSigned<1> (d, trained) {}
+
+    FAISS_AVX512_TARGET
+    __m512 reconstruct_16_components (const uint8_t * code, int i) const
+    {
+        __m128i x16 = _mm_loadu_si128((const __m128i*)(code + i));
+        __m512i y16 = _mm512_sub_epi32 (_mm512_cvtepu8_epi32 (x16),
+                                        _mm512_set1_epi32 (128));
+        return _mm512_cvtepi32_ps (y16);
+    }
+
+};
+
+#endif
+
+/*******************************************************************
+ * Codebook quantizer: each component is encoded on nbits[i] bits
+ * (0 to 8), the codes are packed in a bitstream. The components are
+ * decoded with a lookup in a per-dimension codebook of 2^nbits[i]
+ * sorted values, trained with 1D k-means (Lloyd-Max).
+ *
+ * trained = [nbits (d values)] + [codebooks, concatenated]
+ *******************************************************************/
+
+template<int SIMDWIDTH>
+struct QuantizerCodebook {};
+
+template<>
+struct QuantizerCodebook<1>: ScalarQuantizer::Quantizer {
+    const size_t d;
+    const float *codebooks;
+    std::vector<int32_t> bit_offsets; ///< offset of component i in the code
+    std::vector<int32_t> masks;       ///< (1 << nbits[i]) - 1
+    std::vector<int32_t> cb_offsets;  ///< offset of codebook i in codebooks
+
+    /// the SIMD decoders load 4 bytes per component, this is safe for
+    /// the first d_simd components
+    size_t d_simd;
+
+    QuantizerCodebook (size_t d, const std::vector<float> &trained):
+        d(d), codebooks (trained.data() + d),
+        bit_offsets (d), masks (d), cb_offsets (d), d_simd (0)
+    {
+        FAISS_THROW_IF_NOT_MSG (trained.size() >= d,
+                                "codebook quantizer not trained");
+        int32_t bo = 0, co = 0;
+        for (size_t i = 0; i < d; i++) {
+            int nbit = int(trained[i]);
+            bit_offsets[i] = bo;
+            masks[i] = (1 << nbit) - 1;
+            cb_offsets[i] = co;
+            bo += nbit;
+            co += 1 << nbit;
+        }
+        FAISS_THROW_IF_NOT (trained.size() == d + co);
+        size_t code_size = (bo + 7) / 8;
+        while (d_simd < d &&
+               (bit_offsets[d_simd] >> 3) + 4 <= code_size) {
+            d_simd++;
+        }
+    }
+
+    int32_t decode_index (const uint8_t *code, size_t i) const
+    {
+        if (masks[i] == 0) {
+            return 0;
+        }
+        int32_t o = bit_offsets[i];
+        const uint8_t *c = code + (o >> 3);
+        uint32_t w = c[0];
+        if ((o & 7) + __builtin_popcount (masks[i]) > 8) {
+            w |= uint32_t(c[1]) << 8;
+        }
+        return (w >> (o & 7)) & masks[i];
+    }
+
+    void encode_vector(const float* x, uint8_t* code) const override {
+        for (size_t i = 0; i < d; i++) {
+            if (masks[i] == 0) {
+                continue;
+            }
+            const float *cb = codebooks + cb_offsets[i];
+            int32_t k = masks[i] + 1;
+            // nearest entry of the sorted codebook
+            int32_t j = std::upper_bound (cb, cb + k, x[i]) - cb;
+            if (j == k || (j > 0 && x[i] - cb[j - 1] < cb[j] - x[i])) {
+                j--;
+            }
+            int32_t o = bit_offsets[i];
+            uint32_t w = uint32_t(j) << (o & 7);
+            code[o >> 3] |= w & 0xff;
+            if (w > 0xff) {
+                code[(o >> 3) + 1] |= w >> 8;
+            }
+        }
+    }
+
+    void decode_vector(const uint8_t* code, float* x) const override {
+        for (size_t i = 0; i < d; i++) {
+            x[i] = reconstruct_component (code, i);
+        }
+    }
+
+    float reconstruct_component (const uint8_t * code, int i) const
+    {
+        return codebooks[cb_offsets[i] + decode_index (code, i)];
+    }
+
+};
+
+#ifdef USE_SIMD8
+
+template<>
+struct QuantizerCodebook<8>: QuantizerCodebook<1> {
+
+    QuantizerCodebook (size_t d, const std::vector<float> &trained):
+        QuantizerCodebook<1> (d, trained) {}
+
+    FAISS_AVX2_TARGET
+    __m256 reconstruct_8_components (const uint8_t * code, int i) const
+    {
+        if (i + 8 > d_simd) {
+            float x8[8];
+            for (int j = 0; j < 8; j++) {
+                x8[j] = reconstruct_component (code, i + j);
+            }
+            return _mm256_loadu_ps (x8);
+        }
+        __m256i bo = _mm256_loadu_si256 ((const __m256i*)(bit_offsets.data() + i));
+        __m256i w = _mm256_i32gather_epi32 (
+             (const int*)code, _mm256_srli_epi32 (bo, 3), 1);
+        w = _mm256_srlv_epi32 (w, _mm256_and_si256 (bo, _mm256_set1_epi32 (7)));
+        w = _mm256_and_si256 (
+             w, _mm256_loadu_si256 ((const __m256i*)(masks.data() + i)));
+        w = _mm256_add_epi32 (
+             w, _mm256_loadu_si256 ((const __m256i*)(cb_offsets.data() + i)));
+        return _mm256_i32gather_ps (codebooks, w, 4);
+    }
+
+};
+
+#elif defined(USE_SIMD8_NEON)
+
+template<>
+struct QuantizerCodebook<8>: QuantizerCodebook<1> {
+
+    QuantizerCodebook (size_t d, const std::vector<float> &trained):
+        QuantizerCodebook<1> (d, trained) {}
+
+    simd8float32 reconstruct_8_components (const uint8_t * code, int i) const
+    {
+        float x8[8];
+        for (int j = 0; j < 8; j++) {
+            x8[j] = reconstruct_component (code, i + j);
+        }
+        return simd8float32 (x8);
+    }
+
+};
+
+#endif
+
+#ifdef FAISS_X86_DISPATCH
+
+template<>
+struct QuantizerCodebook<16>: QuantizerCodebook<1> {
+
+    QuantizerCodebook (size_t d, const std::vector<float> &trained):
+        QuantizerCodebook<1> (d, trained) {}
+
+    FAISS_AVX512_TARGET
+    __m512 reconstruct_16_components (const uint8_t * code, int i) const
+    {
+        if (i + 16 > d_simd) {
+            float x16[16];
+            for (int j = 0; j < 16; j++) {
+                x16[j] = reconstruct_component (code, i + j);
+            }
+            return _mm512_loadu_ps (x16);
+        }
+        __m512i bo = _mm512_loadu_si512 (bit_offsets.data() + i);
+        __m512i w = _mm512_i32gather_epi32 (
+             _mm512_srli_epi32 (bo, 3), code, 1);
+        w = _mm512_srlv_epi32 (w, _mm512_and_si512 (bo, _mm512_set1_epi32 (7)));
+        w = _mm512_and_si512 (w, _mm512_loadu_si512 (masks.data() + i));
+        w = _mm512_add_epi32 (w, _mm512_loadu_si512 (cb_offsets.data() + i));
+        return _mm512_i32gather_ps (w, codebooks, 4);
+    }
+
+};
+
 #endif
 
 
@@ -577,6 +1319,12 @@ ScalarQuantizer::Quantizer *select_quantizer_1 (
         return new QuantizerFP16<SIMDWIDTH> (d, trained);
     case ScalarQuantizer::QT_8bit_direct:
         return new Quantizer8bitDirect<SIMDWIDTH> (d, trained);
+    case ScalarQuantizer::QT_8bit_direct_signed:
+        return new Quantizer8bitDirectSigned<SIMDWIDTH> (d, trained);
+    case ScalarQuantizer::QT_4bit_lloyd:
+    case ScalarQuantizer::QT_3bit_vbits:
+    case ScalarQuantizer::QT_4bit_vbits:
+        return new QuantizerCodebook<SIMDWIDTH> (d, trained);
     }
     FAISS_THROW_MSG ("unknown qtype");
 }
@@ -602,17 +1350,19 @@ void train_Uniform(RangeStat rs, float rs_arg,
     float & vmax = trained[1];
 
     if (rs == ScalarQuantizer::RS_minmax) {
-        vmin = HUGE_VAL; vmax = -HUGE_VAL;
-        for (size_t i = 0; i < n; i++) {
-            if (x[i] < vmin) vmin = x[i];
-            if (x[i] > vmax) vmax = x[i];
-        }
-        float vexp = (vmax - vmin) * rs_arg;
-        vmin -= vexp;
-        vmax += vexp;
+        float mn = HUGE_VAL, mx = -HUGE_VAL;
+#pragma omp parallel for reduction(min: mn) reduction(max: mx) if (n > 100000)
+        for (idx_t i = 0; i < n; i++) {
+            if (x[i] < mn) mn = x[i];
+            if (x[i] > mx) mx = x[i];
+        }
+        float vexp = (mx - mn) * rs_arg;
+        vmin = mn - vexp;
+        vmax = mx + vexp;
     } else if (rs == ScalarQuantizer::RS_meanstd) {
         double sum = 0, sum2 = 0;
-        for (size_t i = 0; i < n; i++) {
+#pragma omp parallel for reduction(+: sum, sum2) if (n > 100000)
+        for (idx_t i = 0; i < n; i++) {
             sum += x[i];
             sum2 += x[i] * x[i];
         }
@@ -625,12 +1375,14 @@ void train_Uniform(RangeStat rs, float rs_arg,
     } else if (rs == ScalarQuantizer::RS_quantiles) {
         std::vector<float> x_copy(n);
         memcpy(x_copy.data(), x, n * sizeof(*x));
-        // TODO just do a qucikselect
-        std::sort(x_copy.begin(), x_copy.end());
-        int o = int(rs_arg * n);
+        idx_t o = idx_t(rs_arg * n);
         if (o < 0) o = 0;
         if (o > n - o) o = n / 2;
+        // only the 2 quantiles are needed
+        std::nth_element(x_copy.begin(), x_copy.begin() + o, x_copy.end());
         vmin = x_copy[o];
+        std::nth_element(x_copy.begin() + o, x_copy.begin() + (n - 1 - o),
+                         x_copy.end());
         vmax = x_copy[n - 1 - o];
 
     } else if (rs == ScalarQuantizer::RS_optim) {
@@ -703,11 +1455,23 @@ void train_NonUniform(RangeStat rs, float rs_arg,
     if (rs == ScalarQuantizer::RS_minmax) {
         memcpy (vmin, x, sizeof(*x) * d);
         memcpy (vmax, x, sizeof(*x) * d);
-        for (size_t i = 1; i < n; i++) {
-            const float *xi = x + i * d;
+        // each thread handles a slice of the vectors
+#pragma omp parallel if (n * d > 100000)
+        {
+            std::vector<float> vmin_t (vmin, vmin + d);
+            std::vector<float> vmax_t (vmax, vmax + d);
+#pragma omp for
+            for (idx_t i = 1; i < n; i++) {
+                const float *xi = x + i * d;
+                for (size_t j = 0; j < d; j++) {
+                    if (xi[j] < vmin_t[j]) vmin_t[j] = xi[j];
+                    if (xi[j] > vmax_t[j]) vmax_t[j] = xi[j];
+                }
+            }
+#pragma omp critical
             for (size_t j = 0; j < d; j++) {
-                if (xi[j] < vmin[j]) vmin[j] = xi[j];
-                if (xi[j] > vmax[j]) vmax[j] = xi[j];
+                if (vmin_t[j] < vmin[j]) vmin[j] = vmin_t[j];
+                if (vmax_t[j] > vmax[j]) vmax[j] = vmax_t[j];
             }
         }
         float *vdiff = vmax;
@@ -720,15 +1484,17 @@ void train_NonUniform(RangeStat rs, float rs_arg,
     } else {
         // transpose
         std::vector<float> xt(n * d);
-        for (size_t i = 1; i < n; i++) {
+#pragma omp parallel for if (n * d > 100000)
+        for (idx_t i = 0; i < n; i++) {
             const float *xi = x + i * d;
             for (size_t j = 0; j < d; j++) {
                 xt[j * n + i] = xi[j];
             }
         }
-        std::vector<float> trained_d(2);
-#pragma omp parallel for
+        // the dimensions are trained in parallel
+#pragma omp parallel for schedule(dynamic)
         for (int j = 0; j < d; j++) {
+            std::vector<float> trained_d(2);
             train_Uniform(rs, rs_arg,
                           n, k, xt.data() + j * n,
                           trained_d);
@@ -739,6 +1505,106 @@ void train_NonUniform(RangeStat rs, float rs_arg,
 }
 
 
+/// 1D k-means (Lloyd-Max) of n values, the k centroids are sorted
+void train_Lloyd (size_t n, int k, const float *x_in, float *centroids)
+{
+    std::vector<float> x (x_in, x_in + n);
+    std::sort (x.begin(), x.end());
+    std::vector<double> cum (n + 1);
+    cum[0] = 0;
+    for (size_t i = 0; i < n; i++) {
+        cum[i + 1] = cum[i] + x[i];
+    }
+    // init with the quantiles
+    for (int j = 0; j < k; j++) {
+        centroids[j] = x[(2 * j + 1) * n / (2 * k)];
+    }
+    std::vector<size_t> bounds (k + 1);
+    bounds[0] = 0;
+    bounds[k] = n;
+    for (int iter = 0; iter < 100; iter++) {
+        // the cells are intervals of the sorted values
+        for (int j = 1; j < k; j++) {
+            float t = (centroids[j - 1] + centroids[j]) / 2;
+            bounds[j] = std::upper_bound (x.begin(), x.end(), t) - x.begin();
+        }
+        bool changed = false;
+        for (int j = 0; j < k; j++) {
+            size_t n1 = bounds[j + 1] - bounds[j];
+            if (n1 == 0) {
+                continue; // empty cell: keep the centroid
+            }
+            float c = (cum[bounds[j + 1]] - cum[bounds[j]]) / n1;
+            if (c != centroids[j]) {
+                centroids[j] = c;
+                changed = true;
+            }
+        }
+        if (!changed) {
+            break;
+        }
+        std::sort (centroids, centroids + k);
+    }
+}
+
+void train_Codebook (size_t n, size_t d, int bits_per_dim, bool variable,
+                     const float *x, std::vector<float> & trained)
+{
+    std::vector<float> xt (n * d);
+#pragma omp parallel for if (n * d > 100000)
+    for (int64_t i = 0; i < n; i++) {
+        for (size_t j = 0; j < d; j++) {
+            xt[j * n + i] = x[i * d + j];
+        }
+    }
+
+    std::vector<int> nbits (d, bits_per_dim);
+    if (variable) {
+        // greedy allocation of the bits: with b bits, the distortion
+        // of a dimension is about var * 2^(-2b)
+        std::vector<double> distortion (d);
+        for (size_t j = 0; j < d; j++) {
+            double sum = 0, sum2 = 0;
+            for (size_t i = 0; i < n; i++) {
+                float v = xt[j * n + i];
+                sum += v;
+                sum2 += v * v;
+            }
+            double mean = sum / n;
+            distortion[j] = sum2 / n - mean * mean;
+            nbits[j] = 0;
+        }
+        for (size_t b = 0; b < d * bits_per_dim; b++) {
+            size_t jmax = 0;
+            double dmax = -1;
+            for (size_t j = 0; j < d; j++) {
+                if (nbits[j] < 8 && distortion[j] > dmax) {
+                    jmax = j;
+                    dmax = distortion[j];
+                }
+            }
+            nbits[jmax]++;
+            distortion[jmax] /= 4;
+        }
+    }
+
+    std::vector<size_t> offsets (d + 1);
+    offsets[0] = d;
+    for (size_t j = 0; j < d; j++) {
+        offsets[j + 1] = offsets[j] + (1 << nbits[j]);
+    }
+    trained.resize (offsets[d]);
+    for (size_t j = 0; j < d; j++) {
+        trained[j] = nbits[j];
+    }
+
+#pragma omp parallel for
+    for (int64_t j = 0; j < d; j++) {
+        train_Lloyd (n, 1 << nbits[j], xt.data() + j * n,
+                     trained.data() + offsets[j]);
+    }
+}
+
 
 /*******************************************************************
  * Similarity: gets vector components and computes a similarity wrt. a
@@ -784,7 +1650,7 @@ struct SimilarityL2<1> {
 };
 
 
-#ifdef __AVX2__
+#ifdef USE_SIMD8
 template<>
 struct SimilarityL2<8> {
     static constexpr int simdwidth = 8;
@@ -795,11 +1661,13 @@ struct SimilarityL2<8> {
     explicit SimilarityL2 (const float * y): y(y) {}
     __m256 accu8;
 
+    FAISS_AVX2_TARGET
     void begin_8 () {
         accu8 = _mm256_setzero_ps();
         yi = y;
     }
 
+    FAISS_AVX2_TARGET
     void add_8_components (__m256 x) {
         __m256 yiv = _mm256_loadu_ps (yi);
         yi += 8;
@@ -807,11 +1675,13 @@ struct SimilarityL2<8> {
         accu8 += tmp * tmp;
     }
 
+    FAISS_AVX2_TARGET
     void add_8_components_2 (__m256 x, __m256 y) {
         __m256 tmp = y - x;
         accu8 += tmp * tmp;
     }
 
+    FAISS_AVX2_TARGET
     float result_8 () {
         __m256 sum = _mm256_hadd_ps(accu8, accu8);
         __m256 sum2 = _mm256_hadd_ps(sum, sum);
@@ -823,6 +1693,78 @@ struct SimilarityL2<8> {
 
 };
 
+#elif defined(USE_SIMD8_NEON)
+template<>
+struct SimilarityL2<8> {
+    static constexpr int simdwidth = 8;
+    static constexpr MetricType metric_type = METRIC_L2;
+
+    const float *y, *yi;
+
+    explicit SimilarityL2 (const float * y): y(y) {}
+    simd8float32 accu8;
+
+    void begin_8 () {
+        accu8.clear();
+        yi = y;
+    }
+
+    void add_8_components (simd8float32 x) {
+        simd8float32 yiv (yi);
+        yi += 8;
+        simd8float32 tmp = yiv - x;
+        accu8 = fmadd (tmp, tmp, accu8);
+    }
+
+    void add_8_components_2 (simd8float32 x, simd8float32 y) {
+        simd8float32 tmp = y - x;
+        accu8 = fmadd (tmp, tmp, accu8);
+    }
+
+    float result_8 () {
+        return vaddvq_f32 (vaddq_f32 (accu8.lo(), accu8.hi()));
+    }
+
+};
+
+#endif
+
+#ifdef FAISS_X86_DISPATCH
+template<>
+struct SimilarityL2<16> {
+    static constexpr int simdwidth = 16;
+    static constexpr MetricType metric_type = METRIC_L2;
+
+    const float *y, *yi;
+
+    explicit SimilarityL2 (const float * y): y(y) {}
+    __m512 accu16;
+
+    FAISS_AVX512_TARGET
+    void begin_16 () {
+        accu16 = _mm512_setzero_ps();
+        yi = y;
+    }
+
+    FAISS_AVX512_TARGET
+    void add_16_components (__m512 x) {
+        __m512 tmp = _mm512_sub_ps (_mm512_loadu_ps (yi), x);
+        yi += 16;
+        accu16 = _mm512_fmadd_ps (tmp, tmp, accu16);
+    }
+
+    FAISS_AVX512_TARGET
+    void add_16_components_2 (__m512 x, __m512 y) {
+        __m512 tmp = _mm512_sub_ps (y, x);
+        accu16 = _mm512_fmadd_ps (tmp, tmp, accu16);
+    }
+
+    FAISS_AVX512_TARGET
+    float result_16 () {
+        return horizontal_sum_avx512 (accu16);
+    }
+
+};
 #endif
 
 
@@ -859,7 +1801,7 @@ struct SimilarityIP<1> {
     }
 };
 
-#ifdef __AVX2__
+#ifdef USE_SIMD8
 
 template<>
 struct SimilarityIP<8> {
@@ -875,21 +1817,25 @@ struct SimilarityIP<8> {
 
     __m256 accu8;
 
+    FAISS_AVX2_TARGET
     void begin_8 () {
         accu8 = _mm256_setzero_ps();
         yi = y;
     }
 
+    FAISS_AVX2_TARGET
     void add_8_components (__m256 x) {
         __m256 yiv = _mm256_loadu_ps (yi);
         yi += 8;
         accu8 += yiv * x;
     }
 
+    FAISS_AVX2_TARGET
     void add_8_components_2 (__m256 x1, __m256 x2) {
         accu8 += x1 * x2;
     }
 
+    FAISS_AVX2_TARGET
     float result_8 () {
         __m256 sum = _mm256_hadd_ps(accu8, accu8);
         __m256 sum2 = _mm256_hadd_ps(sum, sum);
@@ -899,6 +1845,77 @@ struct SimilarityIP<8> {
             _mm_cvtss_f32 (_mm256_extractf128_ps(sum2, 1));
     }
 };
+
+#elif defined(USE_SIMD8_NEON)
+
+template<>
+struct SimilarityIP<8> {
+    static constexpr int simdwidth = 8;
+    static constexpr MetricType metric_type = METRIC_INNER_PRODUCT;
+
+    const float *y, *yi;
+
+    explicit SimilarityIP (const float * y):
+        y (y) {}
+
+    simd8float32 accu8;
+
+    void begin_8 () {
+        accu8.clear();
+        yi = y;
+    }
+
+    void add_8_components (simd8float32 x) {
+        simd8float32 yiv (yi);
+        yi += 8;
+        accu8 = fmadd (yiv, x, accu8);
+    }
+
+    void add_8_components_2 (simd8float32 x1, simd8float32 x2) {
+        accu8 = fmadd (x1, x2, accu8);
+    }
+
+    float result_8 () {
+        return vaddvq_f32 (vaddq_f32 (accu8.lo(), accu8.hi()));
+    }
+};
+#endif
+
+#ifdef FAISS_X86_DISPATCH
+template<>
+struct SimilarityIP<16> {
+    static constexpr int simdwidth = 16;
+    static constexpr MetricType metric_type = METRIC_INNER_PRODUCT;
+
+    const float *y, *yi;
+
+    explicit SimilarityIP (const float * y):
+        y (y) {}
+
+    __m512 accu16;
+
+    FAISS_AVX512_TARGET
+    void begin_16 () {
+        accu16 = _mm512_setzero_ps();
+        yi = y;
+    }
+
+    FAISS_AVX512_TARGET
+    void add_16_components (__m512 x) {
+        accu16 = _mm512_fmadd_ps (_mm512_loadu_ps (yi), x, accu16);
+        yi += 16;
+    }
+
+    FAISS_AVX512_TARGET
+    void add_16_components_2 (__m512 x1, __m512 x2) {
+        accu16 = _mm512_fmadd_ps (x1, x2, accu16);
+    }
+
+    FAISS_AVX512_TARGET
+    float result_16 () {
+        return horizontal_sum_avx512 (accu16);
+    }
+};
 #endif
 
 
@@ -929,19 +1946,77 @@ struct DCTemplate<Quantizer, Similarity, 1> : SQDistanceComputer
             float xi = quant.reconstruct_component(code, i);
             sim.add_component(xi);
         }
-        return sim.result();
+        return sim.result();
+    }
+
+    float compute_code_distance(const uint8_t* code1, const uint8_t* code2)
+        const {
+        Similarity sim(nullptr);
+        sim.begin();
+        for (size_t i = 0; i < quant.d; i++) {
+            float x1 = quant.reconstruct_component(code1, i);
+            float x2 = quant.reconstruct_component(code2, i);
+            sim.add_component_2(x1, x2);
+        }
+        return sim.result();
+    }
+
+    void set_query (const float *x) final {
+        q = x;
+    }
+
+    /// compute distance of vector i to current query
+    float operator () (idx_t i) final {
+        return compute_distance (q, codes + i * code_size);
+    }
+
+    float symmetric_dis (idx_t i, idx_t j) override {
+        return compute_code_distance (codes + i * code_size,
+                                      codes + j * code_size);
+    }
+
+    float query_to_code (const uint8_t * code) const {
+        return compute_distance (q, code);
+    }
+
+};
+
+#ifdef USE_SIMD8_ANY
+
+template<class Quantizer, class Similarity>
+struct DCTemplate<Quantizer, Similarity, 8> : SQDistanceComputer
+{
+    using Sim = Similarity;
+
+    Quantizer quant;
+
+    DCTemplate(size_t d, const std::vector<float> &trained):
+        quant(d, trained)
+    {}
+
+    FAISS_AVX2_TARGET
+    float compute_distance(const float* x, const uint8_t* code) const {
+
+        Similarity sim(x);
+        sim.begin_8();
+        for (size_t i = 0; i < quant.d; i += 8) {
+            auto xi = quant.reconstruct_8_components(code, i);
+            sim.add_8_components(xi);
+        }
+        return sim.result_8();
     }
 
+    FAISS_AVX2_TARGET
     float compute_code_distance(const uint8_t* code1, const uint8_t* code2)
         const {
         Similarity sim(nullptr);
-        sim.begin();
-        for (size_t i = 0; i < quant.d; i++) {
-            float x1 = quant.reconstruct_component(code1, i);
-            float x2 = quant.reconstruct_component(code2, i);
-            sim.add_component_2(x1, x2);
+        sim.begin_8();
+        for (size_t i = 0; i < quant.d; i += 8) {
+            auto x1 = quant.reconstruct_8_components(code1, i);
+            auto x2 = quant.reconstruct_8_components(code2, i);
+            sim.add_8_components_2(x1, x2);
         }
-        return sim.result();
+        return sim.result_8();
     }
 
     void set_query (const float *x) final {
@@ -964,10 +2039,12 @@ struct DCTemplate<Quantizer, Similarity, 1> : SQDistanceComputer
 
 };
 
-#ifdef USE_F16C
+#endif
+
+#ifdef FAISS_X86_DISPATCH
 
 template<class Quantizer, class Similarity>
-struct DCTemplate<Quantizer, Similarity, 8> : SQDistanceComputer
+struct DCTemplate<Quantizer, Similarity, 16> : SQDistanceComputer
 {
     using Sim = Similarity;
 
@@ -977,27 +2054,29 @@ struct DCTemplate<Quantizer, Similarity, 8> : SQDistanceComputer
         quant(d, trained)
     {}
 
+    FAISS_AVX512_TARGET
     float compute_distance(const float* x, const uint8_t* code) const {
 
         Similarity sim(x);
-        sim.begin_8();
-        for (size_t i = 0; i < quant.d; i += 8) {
-            __m256 xi = quant.reconstruct_8_components(code, i);
-            sim.add_8_components(xi);
+        sim.begin_16();
+        for (size_t i = 0; i < quant.d; i += 16) {
+            __m512 xi = quant.reconstruct_16_components(code, i);
+            sim.add_16_components(xi);
         }
-        return sim.result_8();
+        return sim.result_16();
     }
 
+    FAISS_AVX512_TARGET
     float compute_code_distance(const uint8_t* code1, const uint8_t* code2)
         const {
         Similarity sim(nullptr);
-        sim.begin_8();
-        for (size_t i = 0; i < quant.d; i += 8) {
-            __m256 x1 = quant.reconstruct_8_components(code1, i);
-            __m256 x2 = quant.reconstruct_8_components(code2, i);
-            sim.add_8_components_2(x1, x2);
+        sim.begin_16();
+        for (size_t i = 0; i < quant.d; i += 16) {
+            __m512 x1 = quant.reconstruct_16_components(code1, i);
+            __m512 x2 = quant.reconstruct_16_components(code2, i);
+            sim.add_16_components_2(x1, x2);
         }
-        return sim.result_8();
+        return sim.result_16();
     }
 
     void set_query (const float *x) final {
@@ -1025,137 +2104,395 @@ struct DCTemplate<Quantizer, Similarity, 8> : SQDistanceComputer
 
 
 /*******************************************************************
- * DistanceComputerByte: computes distances in the integer domain
+ * DCQuantizedQuery: the query is quantized once to integers in the
+ * domain of the 8-bit codes, and the distances are computed in the
+ * integer domain, without decoding the codes.
+ *
+ * With a_i = vdiff_i / 255, the component i of a code decodes to
+ * vmin_i + a_i * (c_i + 0.5). Therefore:
+ *
+ * - L2 (uniform range only): ||x - decode(c)||^2 = a^2 sum_i (t_i - c_i)^2
+ *   with t_i = (x_i - vmin) / a - 0.5, rounded to an integer
+ *
+ * - IP: <x, decode(c)> = sum_i x_i (vmin_i + a_i / 2) + sum_i y_i c_i
+ *   with y_i = x_i a_i, scaled and rounded to an integer
+ *
+ * The rounded query components are int16, so the products with the
+ * code components are computed exactly with 16-bit multiply-adds.
  *******************************************************************/
 
-template<class Similarity, int SIMDWIDTH>
-struct DistanceComputerByte : SQDistanceComputer {};
+/// maximum dimension for which the integer accumulators cannot overflow
+const size_t quantized_query_max_d = 8192;
 
-template<class Similarity>
-struct DistanceComputerByte<Similarity, 1> : SQDistanceComputer {
-    using Sim = Similarity;
+/// integer kernels: sum_i (q_i - c_i)^2 for L2, sum_i q_i c_i for IP
+template<int SIMDWIDTH>
+struct QuantizedQueryKernels {};
+
+template<>
+struct QuantizedQueryKernels<1> {
+    template<MetricType mt>
+    static int32_t distance (const int16_t *q, const uint8_t *c, size_t d) {
+        int32_t accu = 0;
+        for (size_t i = 0; i < d; i++) {
+            if (mt == METRIC_INNER_PRODUCT) {
+                accu += int32_t(q[i]) * c[i];
+            } else {
+                int32_t diff = int32_t(q[i]) - c[i];
+                accu += diff * diff;
+            }
+        }
+        return accu;
+    }
+};
+
+#ifdef USE_SIMD8
+
+template<>
+struct QuantizedQueryKernels<8> {
+    // d is a multiple of 8
+    template<MetricType mt>
+    FAISS_AVX2_TARGET
+    static int32_t distance (const int16_t *q, const uint8_t *c, size_t d) {
+        __m256i accu = _mm256_setzero_si256 ();
+        size_t i = 0;
+        for (; i + 16 <= d; i += 16) {
+            __m256i qi = _mm256_loadu_si256 ((const __m256i*)(q + i));
+            __m256i ci = _mm256_cvtepu8_epi16
+                (_mm_loadu_si128 ((const __m128i*)(c + i)));
+            if (mt == METRIC_INNER_PRODUCT) {
+                accu = _mm256_add_epi32 (accu, _mm256_madd_epi16 (qi, ci));
+            } else {
+                __m256i diff = _mm256_sub_epi16 (qi, ci);
+                accu = _mm256_add_epi32 (accu,
+                                         _mm256_madd_epi16 (diff, diff));
+            }
+        }
+        __m128i sum = _mm_add_epi32 (_mm256_castsi256_si128 (accu),
+                                     _mm256_extracti128_si256 (accu, 1));
+        if (i < d) {
+            __m128i qi = _mm_loadu_si128 ((const __m128i*)(q + i));
+            __m128i ci = _mm_cvtepu8_epi16
+                (_mm_loadl_epi64 ((const __m128i*)(c + i)));
+            if (mt == METRIC_INNER_PRODUCT) {
+                sum = _mm_add_epi32 (sum, _mm_madd_epi16 (qi, ci));
+            } else {
+                __m128i diff = _mm_sub_epi16 (qi, ci);
+                sum = _mm_add_epi32 (sum, _mm_madd_epi16 (diff, diff));
+            }
+        }
+        sum = _mm_hadd_epi32 (sum, sum);
+        sum = _mm_hadd_epi32 (sum, sum);
+        return _mm_cvtsi128_si32 (sum);
+    }
+};
 
-    int d;
-    std::vector<uint8_t> tmp;
+#elif defined(USE_SIMD8_NEON)
 
-    DistanceComputerByte(int d, const std::vector<float> &): d(d), tmp(d) {
+template<>
+struct QuantizedQueryKernels<8> {
+    // d is a multiple of 8
+    template<MetricType mt>
+    static int32_t distance (const int16_t *q, const uint8_t *c, size_t d) {
+        int32x4_t accu0 = vdupq_n_s32 (0);
+        int32x4_t accu1 = vdupq_n_s32 (0);
+        for (size_t i = 0; i < d; i += 8) {
+            int16x8_t a = vld1q_s16 (q + i);
+            int16x8_t b = vreinterpretq_s16_u16 (vmovl_u8 (vld1_u8 (c + i)));
+            if (mt == METRIC_L2) {
+                a = b = vsubq_s16 (a, b);
+            }
+            accu0 = vmlal_s16 (accu0, vget_low_s16 (a), vget_low_s16 (b));
+            accu1 = vmlal_s16 (accu1, vget_high_s16 (a), vget_high_s16 (b));
+        }
+        return vaddvq_s32 (vaddq_s32 (accu0, accu1));
     }
+};
 
-    int compute_code_distance(const uint8_t* code1, const uint8_t* code2)
-        const {
-        int accu = 0;
-        for (int i = 0; i < d; i++) {
-            if (Sim::metric_type == METRIC_INNER_PRODUCT) {
-                accu += int(code1[i]) * code2[i];
+#endif
+
+#ifdef FAISS_X86_DISPATCH
+
+template<>
+struct QuantizedQueryKernels<16> {
+    // d is a multiple of 16
+    template<MetricType mt>
+    FAISS_AVX512_TARGET
+    static int32_t distance (const int16_t *q, const uint8_t *c, size_t d) {
+        __m512i accu = _mm512_setzero_si512 ();
+        size_t i = 0;
+        for (; i + 32 <= d; i += 32) {
+            __m512i qi = _mm512_loadu_si512 ((const void*)(q + i));
+            __m512i ci = _mm512_cvtepu8_epi16
+                (_mm256_loadu_si256 ((const __m256i*)(c + i)));
+            if (mt == METRIC_INNER_PRODUCT) {
+                accu = _mm512_add_epi32 (accu, _mm512_madd_epi16 (qi, ci));
             } else {
-                int diff = int(code1[i]) - code2[i];
-                accu += diff * diff;
+                __m512i diff = _mm512_sub_epi16 (qi, ci);
+                accu = _mm512_add_epi32 (accu,
+                                         _mm512_madd_epi16 (diff, diff));
             }
         }
-        return accu;
+        int32_t res = horizontal_sum_epi32_avx512 (accu);
+        if (i < d) {
+            __m256i qi = _mm256_loadu_si256 ((const __m256i*)(q + i));
+            __m256i ci = _mm256_cvtepu8_epi16
+                (_mm_loadu_si128 ((const __m128i*)(c + i)));
+            __m256i prod32;
+            if (mt == METRIC_INNER_PRODUCT) {
+                prod32 = _mm256_madd_epi16 (qi, ci);
+            } else {
+                __m256i diff = _mm256_sub_epi16 (qi, ci);
+                prod32 = _mm256_madd_epi16 (diff, diff);
+            }
+            __m128i sum = _mm_add_epi32 (_mm256_castsi256_si128 (prod32),
+                                         _mm256_extracti128_si256 (prod32, 1));
+            sum = _mm_hadd_epi32 (sum, sum);
+            sum = _mm_hadd_epi32 (sum, sum);
+            res += _mm_cvtsi128_si32 (sum);
+        }
+        return res;
+    }
+};
+
+#endif
+
+// range of the 8-bit quantizers, per dimension or shared
+inline float range_vmin (const QuantizerTemplate<Codec8bit, true, 1> &q,
+                         size_t) {
+    return q.vmin;
+}
+
+inline float range_vmin (const QuantizerTemplate<Codec8bit, false, 1> &q,
+                         size_t i) {
+    return q.vmin[i];
+}
+
+inline float range_vdiff (const QuantizerTemplate<Codec8bit, true, 1> &q,
+                          size_t) {
+    return q.vdiff;
+}
+
+inline float range_vdiff (const QuantizerTemplate<Codec8bit, false, 1> &q,
+                          size_t i) {
+    return q.vdiff[i];
+}
+
+template<class Similarity, bool uniform, int SIMDWIDTH>
+struct DCQuantizedQuery : SQDistanceComputer {
+    using Sim = Similarity;
+    using Kernels = QuantizedQueryKernels<SIMDWIDTH>;
+
+    QuantizerTemplate<Codec8bit, uniform, 1> quant;
+
+    /// quantized query
+    std::vector<int16_t> qint;
+
+    /// distance = bias + scale * (integer distance)
+    float bias, scale;
+
+    /// scratch space for set_query
+    std::vector<float> tmp;
+
+    DCQuantizedQuery (size_t d, const std::vector<float> &trained):
+        quant (d, trained), qint (d), bias (0), scale (0), tmp (d)
+    {
+        FAISS_THROW_IF_NOT (d <= quantized_query_max_d);
+        FAISS_THROW_IF_NOT_MSG (
+             uniform || Sim::metric_type == METRIC_INNER_PRODUCT,
+             "L2 with quantized queries requires a uniform range");
     }
 
     void set_query (const float *x) final {
-        for (int i = 0; i < d; i++) {
-            tmp[i] = int(x[i]);
+        q = x;
+        size_t d = quant.d;
+        bias = 0;
+        if (Sim::metric_type == METRIC_L2) {
+            float vmin = range_vmin (quant, 0);
+            float a = range_vdiff (quant, 0) / 255.f;
+            if (a == 0) {
+                // all codes decode to vmin
+                for (size_t i = 0; i < d; i++) {
+                    bias += (x[i] - vmin) * (x[i] - vmin);
+                    qint[i] = 0;
+                }
+                scale = 0;
+                return;
+            }
+            // clamp the components far out of the range, so that the
+            // differences with the codes fit in 16 bits
+            for (size_t i = 0; i < d; i++) {
+                float t = (x[i] - vmin) / a - 0.5f;
+                t = std::min (std::max (t, -255.f), 510.f);
+                qint[i] = (int16_t)lrintf (t);
+            }
+            scale = a * a;
+        } else {
+            float ymax = 0;
+            for (size_t i = 0; i < d; i++) {
+                float a = range_vdiff (quant, i) / 255.f;
+                bias += x[i] * (range_vmin (quant, i) + 0.5f * a);
+                tmp[i] = x[i] * a;
+                ymax = std::max (ymax, std::fabs (tmp[i]));
+            }
+            // largest integer such that the accumulators do not overflow
+            int32_t qmax = std::min (
+                  size_t(2047), size_t(INT32_MAX / 255) / d);
+            scale = ymax / qmax;
+            for (size_t i = 0; i < d; i++) {
+                qint[i] = scale > 0 ? (int16_t)lrintf (tmp[i] / scale) : 0;
+            }
         }
     }
 
-    int compute_distance(const float* x, const uint8_t* code) {
-        set_query(x);
-        return compute_code_distance(tmp.data(), code);
+    float query_to_code (const uint8_t * code) const {
+        int32_t accu = Kernels::template distance<Sim::metric_type>
+            (qint.data(), code, quant.d);
+        return bias + scale * accu;
     }
 
     /// compute distance of vector i to current query
     float operator () (idx_t i) final {
-        return compute_distance (q, codes + i * code_size);
+        return query_to_code (codes + i * code_size);
     }
 
+    /// the symmetric distances are computed on the decoded vectors
     float symmetric_dis (idx_t i, idx_t j) override {
-        return compute_code_distance (codes + i * code_size,
-                                      codes + j * code_size);
-    }
-
-    float query_to_code (const uint8_t * code) const {
-        return compute_code_distance (tmp.data(), code);
+        const uint8_t *code1 = codes + i * code_size;
+        const uint8_t *code2 = codes + j * code_size;
+        float accu = 0;
+        for (size_t l = 0; l < quant.d; l++) {
+            float x1 = quant.reconstruct_component (code1, l);
+            float x2 = quant.reconstruct_component (code2, l);
+            if (Sim::metric_type == METRIC_INNER_PRODUCT) {
+                accu += x1 * x2;
+            } else {
+                accu += (x1 - x2) * (x1 - x2);
+            }
+        }
+        return accu;
     }
 
 };
 
-#ifdef __AVX2__
 
+/*******************************************************************
+ * DCDirect: distances of the 8bit_direct codes (uint8 or int8 with an
+ * offset of 128) in the integer domain.
+ *
+ * The query components are rounded to integers (the distances are exact
+ * for integer queries in the range of the codes). The codes are offset
+ * by o = 0 or 128, ie. component i decodes to c_i - o:
+ *
+ * - L2: sum_i (x_i - (c_i - o))^2 = sum_i ((x_i + o) - c_i)^2
+ *
+ * - IP: sum_i x_i (c_i - o) = sum_i x_i c_i - o sum_i x_i
+ *
+ * so the same kernels as DCQuantizedQuery apply to the stored uint8s.
+ * The d % SIMDWIDTH last components are handled by the scalar kernel,
+ * so the SIMD kernels are used for any d.
+ *******************************************************************/
 
-template<class Similarity>
-struct DistanceComputerByte<Similarity, 8> : SQDistanceComputer {
+template<class Similarity, bool is_signed, int SIMDWIDTH>
+struct DCDirect : SQDistanceComputer {
     using Sim = Similarity;
+    using Kernels = QuantizedQueryKernels<SIMDWIDTH>;
 
-    int d;
-    std::vector<uint8_t> tmp;
+    static constexpr int32_t offset = is_signed ? 128 : 0;
 
-    DistanceComputerByte(int d, const std::vector<float> &): d(d), tmp(d) {
-    }
+    size_t d;
+    size_t d_simd;   ///< components handled by the SIMD kernel
 
-    int compute_code_distance(const uint8_t* code1, const uint8_t* code2)
-        const {
-        // __m256i accu = _mm256_setzero_ps ();
-        __m256i accu = _mm256_setzero_si256 ();
-        for (int i = 0; i < d; i += 16) {
-            // load 16 bytes, convert to 16 uint16_t
-            __m256i c1 = _mm256_cvtepu8_epi16
-                (_mm_loadu_si128((__m128i*)(code1 + i)));
-            __m256i c2 = _mm256_cvtepu8_epi16
-                (_mm_loadu_si128((__m128i*)(code2 + i)));
-            __m256i prod32;
-            if (Sim::metric_type == METRIC_INNER_PRODUCT) {
-                prod32 = _mm256_madd_epi16(c1, c2);
-            } else {
-                __m256i diff = _mm256_sub_epi16(c1, c2);
-                prod32 = _mm256_madd_epi16(diff, diff);
-            }
-            accu = _mm256_add_epi32 (accu, prod32);
+    /// rounded query, and scratch for symmetric_dis
+    std::vector<int16_t> qint, tmp;
+
+    /// added to the integer IP
+    int32_t bias;
+
+    DCDirect (size_t d, const std::vector<float> &):
+        d (d), d_simd (d - d % SIMDWIDTH), qint (d), tmp (d), bias (0)
+    {
+        FAISS_THROW_IF_NOT (d <= quantized_query_max_d);
+    }
 
+    int32_t distance (const int16_t *x, const uint8_t *code) const {
+        int32_t accu = 0;
+        if (d_simd > 0) {
+            accu = Kernels::template distance<Sim::metric_type>
+                (x, code, d_simd);
         }
-        __m128i sum = _mm256_extractf128_si256(accu, 0);
-        sum = _mm_add_epi32 (sum, _mm256_extractf128_si256(accu, 1));
-        sum = _mm_hadd_epi32 (sum, sum);
-        sum = _mm_hadd_epi32 (sum, sum);
-        return _mm_cvtsi128_si32 (sum);
+        if (d_simd < d) {
+            accu += QuantizedQueryKernels<1>::template distance
+                <Sim::metric_type> (x + d_simd, code + d_simd, d - d_simd);
+        }
+        return accu;
     }
 
     void set_query (const float *x) final {
-        /*
-        for (int i = 0; i < d; i += 8) {
-            __m256 xi = _mm256_loadu_ps (x + i);
-            __m256i ci = _mm256_cvtps_epi32(xi);
-        */
-        for (int i = 0; i < d; i++) {
-            tmp[i] = int(x[i]);
+        q = x;
+        int32_t sum = 0;
+        for (size_t i = 0; i < d; i++) {
+            // the clamping keeps the accumulators from overflowing
+            float t = std::min (std::max (x[i], -510.f), 510.f);
+            int32_t xi = lrintf (t);
+            if (Sim::metric_type == METRIC_L2) {
+                qint[i] = std::min (std::max (xi + offset, -255), 510);
+            } else {
+                qint[i] = xi;
+                sum += xi;
+            }
         }
+        bias = -offset * sum;
     }
 
-    int compute_distance(const float* x, const uint8_t* code) {
-        set_query(x);
-        return compute_code_distance(tmp.data(), code);
+    float query_to_code (const uint8_t * code) const {
+        return bias + distance (qint.data(), code);
     }
 
     /// compute distance of vector i to current query
     float operator () (idx_t i) final {
-        return compute_distance (q, codes + i * code_size);
+        return query_to_code (codes + i * code_size);
     }
 
     float symmetric_dis (idx_t i, idx_t j) override {
-        return compute_code_distance (codes + i * code_size,
-                                      codes + j * code_size);
+        const uint8_t *code1 = codes + i * code_size;
+        const uint8_t *code2 = codes + j * code_size;
+        int32_t sum = 0;
+        for (size_t l = 0; l < d; l++) {
+            // the offset cancels out for L2
+            tmp[l] = Sim::metric_type == METRIC_L2 ?
+                code1[l] : int32_t(code1[l]) - offset;
+            sum += tmp[l];
+        }
+        int32_t accu = distance (tmp.data(), code2);
+        if (Sim::metric_type == METRIC_INNER_PRODUCT) {
+            accu -= offset * sum;
+        }
+        return accu;
     }
 
-    float query_to_code (const uint8_t * code) const {
-        return compute_code_distance (tmp.data(), code);
-    }
+};
 
+template<class Similarity>
+SQDistanceComputer *select_DCDirect (QuantizerType qtype, size_t d,
+                                     const std::vector<float> & trained)
+{
+    constexpr int SIMDWIDTH = Similarity::simdwidth;
+    if (qtype == ScalarQuantizer::QT_8bit_direct_signed) {
+        return new DCDirect<Similarity, true, SIMDWIDTH>(d, trained);
+    } else {
+        return new DCDirect<Similarity, false, SIMDWIDTH>(d, trained);
+    }
+}
 
-};
+/// the integer distances are used for the direct types, except for
+/// large d where the accumulators could overflow
+inline bool use_DCDirect (QuantizerType qtype, size_t d)
+{
+    return (qtype == ScalarQuantizer::QT_8bit_direct ||
+            qtype == ScalarQuantizer::QT_8bit_direct_signed) &&
+        d <= quantized_query_max_d;
+}
 
-#endif
 
 /*******************************************************************
  * select_distance_computer: runtime selection of template
@@ -1195,12 +2532,18 @@ SQDistanceComputer *select_distance_computer (
             <QuantizerFP16<SIMDWIDTH>, Sim, SIMDWIDTH>(d, trained);
 
     case ScalarQuantizer::QT_8bit_direct:
-        if (d % 16 == 0) {
-            return new DistanceComputerByte<Sim, SIMDWIDTH>(d, trained);
-        } else {
-            return new DCTemplate
-                <Quantizer8bitDirect<SIMDWIDTH>, Sim, SIMDWIDTH>(d, trained);
-        }
+        return new DCTemplate
+            <Quantizer8bitDirect<SIMDWIDTH>, Sim, SIMDWIDTH>(d, trained);
+
+    case ScalarQuantizer::QT_8bit_direct_signed:
+        return new DCTemplate
+            <Quantizer8bitDirectSigned<SIMDWIDTH>, Sim, SIMDWIDTH>(d, trained);
+
+    case ScalarQuantizer::QT_4bit_lloyd:
+    case ScalarQuantizer::QT_3bit_vbits:
+    case ScalarQuantizer::QT_4bit_vbits:
+        return new DCTemplate
+            <QuantizerCodebook<SIMDWIDTH>, Sim, SIMDWIDTH>(d, trained);
     }
     FAISS_THROW_MSG ("unknown qtype");
     return nullptr;
@@ -1226,6 +2569,7 @@ ScalarQuantizer::ScalarQuantizer
     case QT_8bit:
     case QT_8bit_uniform:
     case QT_8bit_direct:
+    case QT_8bit_direct_signed:
         code_size = d;
         break;
     case QT_4bit:
@@ -1238,6 +2582,13 @@ ScalarQuantizer::ScalarQuantizer
     case QT_fp16:
         code_size = d * 2;
         break;
+    case QT_4bit_lloyd:
+    case QT_4bit_vbits:
+        code_size = (d + 1) / 2;
+        break;
+    case QT_3bit_vbits:
+        code_size = (d * 3 + 7) / 8;
+        break;
     }
 
 }
@@ -1247,6 +2598,13 @@ ScalarQuantizer::ScalarQuantizer ():
     rangestat(RS_minmax), rangestat_arg(0), d (0), code_size(0)
 {}
 
+MemoryUsage ScalarQuantizer::memory_usage () const
+{
+    MemoryUsage mu = MemoryUsage::object ("ScalarQuantizer");
+    mu.add ("trained", trained);
+    return mu;
+}
+
 void ScalarQuantizer::train (size_t n, const float *x)
 {
     int bit_per_dim =
@@ -1265,8 +2623,16 @@ void ScalarQuantizer::train (size_t n, const float *x)
         train_NonUniform (rangestat, rangestat_arg,
                           n, d, 1 << bit_per_dim, x, trained);
         break;
+    case QT_4bit_lloyd:
+        train_Codebook (n, d, 4, false, x, trained);
+        break;
+    case QT_3bit_vbits: case QT_4bit_vbits:
+        train_Codebook (n, d, qtype == QT_3bit_vbits ? 3 : 4, true,
+                        x, trained);
+        break;
     case QT_fp16:
     case QT_8bit_direct:
+    case QT_8bit_direct_signed:
         // no training necessary
         break;
     }
@@ -1303,8 +2669,13 @@ void ScalarQuantizer::train_residual(size_t n,
 
 ScalarQuantizer::Quantizer *ScalarQuantizer::select_quantizer () const
 {
-#ifdef USE_F16C
-    if (d % 8 == 0) {
+#ifdef FAISS_X86_DISPATCH
+    if (d % 16 == 0 && use_avx512 ()) {
+        return select_quantizer_1<16> (qtype, d, trained);
+    } else
+#endif
+#ifdef USE_SIMD8_ANY
+    if (d % 8 == 0 && use_simd8 ()) {
         return select_quantizer_1<8> (qtype, d, trained);
     } else
 #endif
@@ -1336,12 +2707,55 @@ void ScalarQuantizer::decode (const uint8_t *codes, float *x, size_t n) const
 }
 
 
+void ScalarQuantizer::SQDistanceComputer::prefetch (idx_t i)
+{
+    prefetch_L1 (codes + i * code_size, code_size);
+}
+
+
 SQDistanceComputer *
 ScalarQuantizer::get_distance_computer (MetricType metric) const
 {
     FAISS_THROW_IF_NOT(metric == METRIC_L2 || metric == METRIC_INNER_PRODUCT);
-#ifdef USE_F16C
-    if (d % 8 == 0) {
+    if (use_DCDirect (qtype, d)) {
+        // the integer kernels support any d
+#ifdef FAISS_X86_DISPATCH
+        if (use_avx512 ()) {
+            if (metric == METRIC_L2) {
+                return select_DCDirect<SimilarityL2<16> > (qtype, d, trained);
+            } else {
+                return select_DCDirect<SimilarityIP<16> > (qtype, d, trained);
+            }
+        }
+#endif
+#ifdef USE_SIMD8_ANY
+        if (use_simd8 ()) {
+            if (metric == METRIC_L2) {
+                return select_DCDirect<SimilarityL2<8> > (qtype, d, trained);
+            } else {
+                return select_DCDirect<SimilarityIP<8> > (qtype, d, trained);
+            }
+        }
+#endif
+        if (metric == METRIC_L2) {
+            return select_DCDirect<SimilarityL2<1> > (qtype, d, trained);
+        } else {
+            return select_DCDirect<SimilarityIP<1> > (qtype, d, trained);
+        }
+    }
+#ifdef FAISS_X86_DISPATCH
+    if (d % 16 == 0 && use_avx512 ()) {
+        if (metric == METRIC_L2) {
+            return select_distance_computer<SimilarityL2<16> >
+                (qtype, d, trained);
+        } else {
+            return select_distance_computer<SimilarityIP<16> >
+                (qtype, d, trained);
+        }
+    } else
+#endif
+#ifdef USE_SIMD8_ANY
+    if (d % 8 == 0 && use_simd8 ()) {
         if (metric == METRIC_L2) {
             return select_distance_computer<SimilarityL2<8> >
                 (qtype, d, trained);
@@ -1414,7 +2828,10 @@ struct IVFSQScannerIP: InvertedListScanner {
         size_t nup = 0;
 
         for (size_t j = 0; j < list_size; j++) {
-
+            if (sel && !sel->is_member (ids[j])) {
+                codes += code_size;
+                continue;
+            }
             float accu = accu0 + dc.query_to_code (codes);
 
             if (accu > simi [0]) {
@@ -1435,6 +2852,10 @@ struct IVFSQScannerIP: InvertedListScanner {
                            RangeQueryResult & res) const override
     {
         for (size_t j = 0; j < list_size; j++) {
+            if (sel && !sel->is_member (ids[j])) {
+                codes += code_size;
+                continue;
+            }
             float accu = accu0 + dc.query_to_code (codes);
             if (accu > radius) {
                 int64_t id = store_pairs ? (list_no << 32 | j) : ids[j];
@@ -1502,7 +2923,10 @@ struct IVFSQScannerL2: InvertedListScanner {
     {
         size_t nup = 0;
         for (size_t j = 0; j < list_size; j++) {
-
+            if (sel && !sel->is_member (ids[j])) {
+                codes += code_size;
+                continue;
+            }
             float dis = dc.query_to_code (codes);
 
             if (dis < simi [0]) {
@@ -1523,6 +2947,10 @@ struct IVFSQScannerL2: InvertedListScanner {
                            RangeQueryResult & res) const override
     {
         for (size_t j = 0; j < list_size; j++) {
+            if (sel && !sel->is_member (ids[j])) {
+                codes += code_size;
+                continue;
+            }
             float dis = dc.query_to_code (codes);
             if (dis < radius) {
                 int64_t id = store_pairs ? (list_no << 32 | j) : ids[j];
@@ -1567,9 +2995,22 @@ InvertedListScanner* sel12_InvertedListScanner
 template<class Similarity>
 InvertedListScanner* sel1_InvertedListScanner
         (const ScalarQuantizer *sq, const Index *quantizer,
-         bool store_pairs, bool r)
+         bool store_pairs, bool r, bool quantized_query)
 {
     constexpr int SIMDWIDTH = Similarity::simdwidth;
+    if (quantized_query && sq->d <= quantized_query_max_d) {
+        if (sq->qtype == ScalarQuantizer::QT_8bit_uniform) {
+            return sel2_InvertedListScanner
+                <DCQuantizedQuery<Similarity, true, SIMDWIDTH> >
+                (sq, quantizer, store_pairs, r);
+        }
+        if (sq->qtype == ScalarQuantizer::QT_8bit &&
+            Similarity::metric_type == METRIC_INNER_PRODUCT) {
+            return sel2_InvertedListScanner
+                <DCQuantizedQuery<Similarity, false, SIMDWIDTH> >
+                (sq, quantizer, store_pairs, r);
+        }
+    }
     switch(sq->qtype) {
     case ScalarQuantizer::QT_8bit_uniform:
         return sel12_InvertedListScanner
@@ -1591,34 +3032,73 @@ InvertedListScanner* sel1_InvertedListScanner
             <DCTemplate<QuantizerFP16<SIMDWIDTH>, Similarity, SIMDWIDTH> >
             (sq, quantizer, store_pairs, r);
     case ScalarQuantizer::QT_8bit_direct:
-        if (sq->d % 16 == 0) {
+        return sel2_InvertedListScanner
+            <DCTemplate<Quantizer8bitDirect<SIMDWIDTH>,
+                        Similarity, SIMDWIDTH> >
+            (sq, quantizer, store_pairs, r);
+    case ScalarQuantizer::QT_8bit_direct_signed:
+        return sel2_InvertedListScanner
+            <DCTemplate<Quantizer8bitDirectSigned<SIMDWIDTH>,
+                        Similarity, SIMDWIDTH> >
+            (sq, quantizer, store_pairs, r);
+    case ScalarQuantizer::QT_4bit_lloyd:
+    case ScalarQuantizer::QT_3bit_vbits:
+    case ScalarQuantizer::QT_4bit_vbits:
+        return sel2_InvertedListScanner
+            <DCTemplate<QuantizerCodebook<SIMDWIDTH>, Similarity, SIMDWIDTH> >
+            (sq, quantizer, store_pairs, r);
+
+    }
+
+    FAISS_THROW_MSG ("unknown qtype");
+    return nullptr;
+}
+
+template<int SIMDWIDTH>
+InvertedListScanner* sel_direct_InvertedListScanner
+        (MetricType mt, const ScalarQuantizer *sq,
+         const Index *quantizer, bool store_pairs, bool r)
+{
+    bool is_signed = sq->qtype == ScalarQuantizer::QT_8bit_direct_signed;
+    if (mt == METRIC_L2) {
+        using Sim = SimilarityL2<SIMDWIDTH>;
+        if (is_signed) {
             return sel2_InvertedListScanner
-                <DistanceComputerByte<Similarity, SIMDWIDTH> >
+                <DCDirect<Sim, true, SIMDWIDTH> >
                 (sq, quantizer, store_pairs, r);
         } else {
             return sel2_InvertedListScanner
-                <DCTemplate<Quantizer8bitDirect<SIMDWIDTH>,
-                            Similarity, SIMDWIDTH> >
+                <DCDirect<Sim, false, SIMDWIDTH> >
                 (sq, quantizer, store_pairs, r);
         }
-
+    } else if (mt == METRIC_INNER_PRODUCT) {
+        using Sim = SimilarityIP<SIMDWIDTH>;
+        if (is_signed) {
+            return sel2_InvertedListScanner
+                <DCDirect<Sim, true, SIMDWIDTH> >
+                (sq, quantizer, store_pairs, r);
+        } else {
+            return sel2_InvertedListScanner
+                <DCDirect<Sim, false, SIMDWIDTH> >
+                (sq, quantizer, store_pairs, r);
+        }
+    } else {
+        FAISS_THROW_MSG("unsupported metric type");
     }
-
-    FAISS_THROW_MSG ("unknown qtype");
-    return nullptr;
 }
 
 template<int SIMDWIDTH>
 InvertedListScanner* sel0_InvertedListScanner
         (MetricType mt, const ScalarQuantizer *sq,
-         const Index *quantizer, bool store_pairs, bool by_residual)
+         const Index *quantizer, bool store_pairs, bool by_residual,
+         bool quantized_query)
 {
     if (mt == METRIC_L2) {
         return sel1_InvertedListScanner<SimilarityL2<SIMDWIDTH> >
-            (sq, quantizer, store_pairs, by_residual);
+            (sq, quantizer, store_pairs, by_residual, quantized_query);
     } else if (mt == METRIC_INNER_PRODUCT) {
         return sel1_InvertedListScanner<SimilarityIP<SIMDWIDTH> >
-            (sq, quantizer, store_pairs, by_residual);
+            (sq, quantizer, store_pairs, by_residual, quantized_query);
     } else {
         FAISS_THROW_MSG("unsupported metric type");
     }
@@ -1631,17 +3111,43 @@ InvertedListScanner* sel0_InvertedListScanner
 
 InvertedListScanner* ScalarQuantizer::select_InvertedListScanner
         (MetricType mt, const Index *quantizer,
-         bool store_pairs, bool by_residual) const
+         bool store_pairs, bool by_residual, bool quantized_query) const
 {
-#ifdef USE_F16C
-    if (d % 8 == 0) {
-        return sel0_InvertedListScanner<8>
+    if (use_DCDirect (qtype, d)) {
+        // the integer kernels support any d
+#ifdef FAISS_X86_DISPATCH
+        if (use_avx512 ()) {
+            return sel_direct_InvertedListScanner<16>
+                (mt, this, quantizer, store_pairs, by_residual);
+        }
+#endif
+#ifdef USE_SIMD8_ANY
+        if (use_simd8 ()) {
+            return sel_direct_InvertedListScanner<8>
+                (mt, this, quantizer, store_pairs, by_residual);
+        }
+#endif
+        return sel_direct_InvertedListScanner<1>
             (mt, this, quantizer, store_pairs, by_residual);
+    }
+#ifdef FAISS_X86_DISPATCH
+    if (d % 16 == 0 && use_avx512 ()) {
+        return sel0_InvertedListScanner<16>
+            (mt, this, quantizer, store_pairs, by_residual,
+             quantized_query);
+    } else
+#endif
+#ifdef USE_SIMD8_ANY
+    if (d % 8 == 0 && use_simd8 ()) {
+        return sel0_InvertedListScanner<8>
+            (mt, this, quantizer, store_pairs, by_residual,
+             quantized_query);
     } else
 #endif
     {
         return sel0_InvertedListScanner<1>
-            (mt, this, quantizer, store_pairs, by_residual);
+            (mt, this, quantizer, store_pairs, by_residual,
+             quantized_query);
     }
 }
 
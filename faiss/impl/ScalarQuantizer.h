@@ -19,6 +19,12 @@ namespace faiss {
  * The uniform quantizer has a range [vmin, vmax]. The range can be
  * the same for all dimensions (uniform) or specific per dimension
  * (default).
+ *
+ * The _lloyd and _vbits types are non-uniform: each dimension is
+ * decoded through a codebook of 2^nbit values trained with 1D k-means
+ * (Lloyd-Max). For the _vbits types, the number of bits per dimension
+ * (0 to 8) is allocated depending on the variance of the dimension.
+ * The RangeStat is not used for these types.
  */
 
 struct ScalarQuantizer {
@@ -31,6 +37,11 @@ struct ScalarQuantizer {
         QT_fp16,
         QT_8bit_direct,      ///< fast indexing of uint8s
         QT_6bit,             ///< 6 bits per component
+        QT_4bit_lloyd,       ///< 4 bits per component, 1D k-means codebooks
+        QT_3bit_vbits,       ///< 3 bits per component on average, allocated
+                             ///< per dimension by variance, 1D k-means
+        QT_4bit_vbits,       ///< same, 4 bits per component on average
+        QT_8bit_direct_signed, ///< fast indexing of int8s
     };
 
     QuantizerType qtype;
@@ -64,6 +75,8 @@ struct ScalarQuantizer {
 
     void train (size_t n, const float *x);
 
+    MemoryUsage memory_usage () const;
+
     /// Used by an IVF index to train based on the residuals
     void train_residual (size_t n,
                          const float *x,
@@ -104,14 +117,20 @@ struct ScalarQuantizer {
         SQDistanceComputer (): q(nullptr), codes (nullptr), code_size (0)
         {}
 
+        void prefetch (idx_t i) override;
+
     };
 
     SQDistanceComputer *get_distance_computer (MetricType metric = METRIC_L2)
         const;
 
+    /** @param quantized_query  compute the distances in the integer
+     *         domain, with the query quantized to 8 bits (supported for
+     *         QT_8bit_uniform, and QT_8bit with inner product only, other
+     *         types ignore it) */
     InvertedListScanner *select_InvertedListScanner
         (MetricType mt, const Index *quantizer, bool store_pairs,
-         bool by_residual=false) const;
+         bool by_residual=false, bool quantized_query=false) const;
 
 };
 
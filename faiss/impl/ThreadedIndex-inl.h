@@ -6,11 +6,28 @@
  */
 
 #include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/parallel.h>
+#include <algorithm>
 #include <exception>
 #include <iostream>
+#include <mutex>
+#include <omp.h>
 
 namespace faiss {
 
+inline ScopedOmpThreads::ScopedOmpThreads(int nt) : prevThreads_(0) {
+  if (nt > 0) {
+    prevThreads_ = omp_get_max_threads();
+    omp_set_num_threads(nt);
+  }
+}
+
+inline ScopedOmpThreads::~ScopedOmpThreads() {
+  if (prevThreads_ > 0) {
+    omp_set_num_threads(prevThreads_);
+  }
+}
+
 template <typename IndexT>
 ThreadedIndex<IndexT>::ThreadedIndex(bool threaded)
     // 0 is default dimension
@@ -21,6 +38,7 @@ template <typename IndexT>
 ThreadedIndex<IndexT>::ThreadedIndex(int d, bool threaded)
     : IndexT(d),
       own_fields(false),
+      omp_threads_per_index(-1),
       isThreaded_(threaded) {
   }
 
@@ -117,13 +135,45 @@ void ThreadedIndex<IndexT>::removeIndex(IndexT* index) {
 
 template <typename IndexT>
 void ThreadedIndex<IndexT>::runOnIndex(std::function<void(int, IndexT*)> f) {
-  if (isThreaded_) {
+  if (isThreaded_ && use_parallel_executor(this->indices_.size())) {
+    // A shared executor is installed (see set_parallel_executor): the
+    // sub-indices are tasks of the executor instead of using their worker
+    // threads, and their own parallel loops go to the same executor, so
+    // that the total nb of threads is that of the executor
+    std::vector<std::pair<int, std::exception_ptr>> exceptions;
+    std::mutex exceptionsMutex;
+    int nt = getOmpThreadsPerIndex_();
+
+    get_parallel_executor()->run(this->indices_.size(), [&](size_t i) {
+      ScopedOmpThreads ompThreads(nt);
+      try {
+        f(i, this->indices_[i].first);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(exceptionsMutex);
+        exceptions.emplace_back(std::make_pair(i, std::current_exception()));
+      }
+    });
+
+    std::sort(exceptions.begin(), exceptions.end(),
+              [](const std::pair<int, std::exception_ptr>& a,
+                 const std::pair<int, std::exception_ptr>& b) {
+                return a.first < b.first;
+              });
+    handleExceptions(exceptions);
+  } else if (isThreaded_) {
     std::vector<std::future<bool>> v;
 
+    // The OpenMP thread count is per calling thread, so it is set in the
+    // worker before the call
+    int nt = getOmpThreadsPerIndex_();
+
     for (int i = 0; i < this->indices_.size(); ++i) {
       auto& p = this->indices_[i];
       auto indexPtr = p.first;
-      v.emplace_back(p.second->add([f, i, indexPtr](){ f(i, indexPtr); }));
+      v.emplace_back(p.second->add([f, i, indexPtr, nt](){
+            ScopedOmpThreads ompThreads(nt);
+            f(i, indexPtr);
+          }));
     }
 
     waitAndHandleFutures(v);
@@ -152,6 +202,14 @@ void ThreadedIndex<IndexT>::runOnIndex(
     [f](int i, IndexT* idx){ f(i, idx); });
 }
 
+template <typename IndexT>
+int ThreadedIndex<IndexT>::getOmpThreadsPerIndex_() const {
+  if (omp_threads_per_index == 0) {
+    return std::max(1, omp_get_max_threads() / std::max(1, count()));
+  }
+  return omp_threads_per_index;
+}
+
 template <typename IndexT>
 void ThreadedIndex<IndexT>::reset() {
   runOnIndex([](int, IndexT* index){ index->reset(); });
@@ -159,6 +217,19 @@ void ThreadedIndex<IndexT>::reset() {
   this->is_trained = false;
 }
 
+template <typename IndexT>
+MemoryUsage ThreadedIndex<IndexT>::memory_usage() const {
+  MemoryUsage mu = IndexT::memory_usage();
+  std::vector<MemoryUsage> subs(this->count());
+  runOnIndex([&subs](int i, const IndexT* index) {
+    subs[i] = index->memory_usage();
+  });
+  for (int i = 0; i < (int)subs.size(); ++i) {
+    mu.add("index." + std::to_string(i), subs[i]);
+  }
+  return mu;
+}
+
 template <typename IndexT>
 void
 ThreadedIndex<IndexT>::onAfterAddIndex(IndexT* index) {
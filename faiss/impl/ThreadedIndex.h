@@ -15,6 +15,16 @@
 
 namespace faiss {
 
+/// Sets the OpenMP thread count of the calling thread for the lifetime of
+/// the object (if nt > 0), and restores the previous one. The count is a
+/// per-thread setting that would otherwise persist in the worker threads.
+struct ScopedOmpThreads {
+  explicit ScopedOmpThreads(int nt);
+  ~ScopedOmpThreads();
+
+  int prevThreads_;  ///< 0 if unchanged
+};
+
 /// A holder of indices in a collection of threads
 /// The interface to this class itself is not thread safe
 template <typename IndexT>
@@ -29,7 +39,7 @@ class ThreadedIndex : public IndexT {
   /// WARNING: once an index is added, it becomes unsafe to touch it from any
   /// other thread than that on which is managing it, until we are shut
   /// down. Use runOnIndex to perform work on it instead.
-  void addIndex(IndexT* index);
+  virtual void addIndex(IndexT* index);
 
   /// Remove an index that is managed by ourselves.
   /// This will flush all pending work on that index, and then shut
@@ -37,7 +47,10 @@ class ThreadedIndex : public IndexT {
   void removeIndex(IndexT* index);
 
   /// Run a function on all indices, in the thread that the index is
-  /// managed in.
+  /// managed in. When threaded and a shared executor is installed with
+  /// set_parallel_executor (utils/parallel.h), the calls are tasks of the
+  /// executor instead, and the parallel loops of the sub-indices run on
+  /// the same executor.
   /// Function arguments are (index in collection, index pointer)
   void runOnIndex(std::function<void(int, IndexT*)> f);
   void runOnIndex(std::function<void(int, const IndexT*)> f) const;
@@ -46,6 +59,9 @@ class ThreadedIndex : public IndexT {
   /// All indices receive the same call
   void reset() override;
 
+  /// the sub-indices are children named index.i
+  MemoryUsage memory_usage() const override;
+
   /// Returns the number of sub-indices
   int count() const { return indices_.size(); }
 
@@ -58,6 +74,14 @@ class ThreadedIndex : public IndexT {
   /// Whether or not we are responsible for deleting our contained indices
   bool own_fields;
 
+  /// Number of OpenMP threads used by each worker thread during a call
+  /// when threaded. -1 (default) leaves the OpenMP setting of the worker
+  /// threads unchanged; 0 divides omp_get_max_threads() of the caller
+  /// among the sub-indices, so that shards x OpenMP threads does not
+  /// oversubscribe the cores. The setting of the worker is restored after
+  /// each call.
+  int omp_threads_per_index;
+
  protected:
   /// Called just after an index is added
   virtual void onAfterAddIndex(IndexT* index);
@@ -66,6 +90,10 @@ class ThreadedIndex : public IndexT {
   virtual void onAfterRemoveIndex(IndexT* index);
 
 protected:
+  /// Number of OpenMP threads to set in the worker threads (see
+  /// omp_threads_per_index), or -1 to leave it unchanged
+  int getOmpThreadsPerIndex_() const;
+
   static void waitAndHandleFutures(std::vector<std::future<bool>>& v);
 
   /// Collection of Index instances, with their managing worker thread if any
@@ -25,20 +25,28 @@
 #include <faiss/utils/hamming.h>
 
 #include <faiss/IndexFlat.h>
+#include <faiss/IndexFlatHalf.h>
 #include <faiss/VectorTransform.h>
 #include <faiss/IndexPreTransform.h>
+#include <faiss/IndexRefine.h>
 #include <faiss/IndexLSH.h>
 #include <faiss/IndexPQ.h>
+#include <faiss/IndexPQFastScan.h>
 #include <faiss/IndexIVF.h>
+#include <faiss/IVFlib.h>
 #include <faiss/IndexIVFPQ.h>
 #include <faiss/IndexIVFPQR.h>
+#include <faiss/IndexIVFPQFastScan.h>
 #include <faiss/Index2Layer.h>
 #include <faiss/IndexIVFFlat.h>
 #include <faiss/IndexIVFSpectralHash.h>
 #include <faiss/MetaIndexes.h>
 #include <faiss/IndexScalarQuantizer.h>
 #include <faiss/IndexHNSW.h>
+#include <faiss/IndexNSG.h>
+#include <faiss/IndexDiskGraph.h>
 #include <faiss/IndexLattice.h>
+#include <faiss/IndexAdditiveQuantizer.h>
 #include <faiss/IndexBinaryFlat.h>
 #include <faiss/IndexBinaryFromFloat.h>
 #include <faiss/IndexBinaryHNSW.h>
@@ -47,7 +55,11 @@
 
 #ifndef _MSC_VER
 #include <faiss/OnDiskInvertedLists.h>
+#include <faiss/RemoteInvertedLists.h>
 #endif // !_MSC_VER
+#include <faiss/BlockInvertedLists.h>
+#include <faiss/CompactIdsInvertedLists.h>
+#include <faiss/EntropyCodedInvertedLists.h>
 
 
 namespace faiss {
@@ -57,6 +69,40 @@ namespace faiss {
  * Read
  **************************************************************/
 
+/* Read a vector that is memory-mapped instead of copied when the
+ * IO_FLAG_MMAP flag is set and the input is a file. The file format does
+ * not align the arrays, so the view may not be aligned on sizeof(T): this
+ * is fine for the platforms that support mmap, and the SIMD code uses
+ * unaligned loads anyways. Otherwise large vectors are read from a file
+ * with parallel positional reads. */
+template <class T>
+static void read_vector_maybe_mmap (
+        MaybeOwnedVector<T> & v, IOReader *f, int io_flags) {
+#ifndef _MSC_VER
+    FileIOReader *reader = dynamic_cast<FileIOReader*>(f);
+    if (reader) {
+        size_t size;
+        READANDCHECK (&size, 1);
+        FAISS_THROW_IF_NOT (size < (uint64_t{1} << 40));
+        if ((io_flags & IO_FLAG_MMAP) == IO_FLAG_MMAP) {
+            std::shared_ptr<MmappedFileRange> range =
+                mmap_next_range (reader, size * sizeof(T));
+            T *ptr = (T*)range->data;
+            v = MaybeOwnedVector<T>::create_view (ptr, size, range);
+            return;
+        }
+        v.resize (size);
+        if (!pread_next_ranges (reader, {v.data()}, {size * sizeof(T)})) {
+            READANDCHECK (v.data(), size);
+        }
+        return;
+    }
+#endif // !_MSC_VER
+    READVECTOR (v);
+}
+
+#define READVECTOR_MAYBE_MMAP(vec) read_vector_maybe_mmap (vec, f, io_flags)
+
 static void read_index_header (Index *idx, IOReader *f) {
     READ1 (idx->d);
     READ1 (idx->ntotal);
@@ -120,6 +166,11 @@ VectorTransform* read_VectorTransform (IOReader *f) {
         CenteringTransform *ct = new CenteringTransform ();
         READVECTOR (ct->mean);
         vt = ct;
+    } else if (h == fourcc ("HRot")) {
+        HadamardRotation *hr = new HadamardRotation ();
+        READ1 (hr->nrounds);
+        READVECTOR (hr->signs);
+        vt = hr;
     } else if (h == fourcc ("Viqt")) {
         ITQTransform *itqt = new ITQTransform ();
 
@@ -178,6 +229,15 @@ InvertedLists *read_InvertedLists (IOReader *f, int io_flags) {
         fprintf(stderr, "read_InvertedLists:"
                 " WARN! inverted lists not stored with IVF object\n");
         return nullptr;
+    } else if (h == fourcc ("ilsk")) {
+        // stored in a separate section of an index container
+        return nullptr;
+    } else if (h == fourcc ("IxCz")) {
+        // compressed section of an index container
+        CompressedIOReader cz (f);
+        InvertedLists *ils = read_InvertedLists (&cz, io_flags & ~IO_FLAG_MMAP);
+        cz.finish ();
+        return ils;
     } else if (h == fourcc ("ilar") && !(io_flags & IO_FLAG_SKIP_IVF_DATA)) {
         auto ails = new ArrayInvertedLists (0, 0);
         READ1 (ails->nlist);
@@ -186,9 +246,23 @@ InvertedLists *read_InvertedLists (IOReader *f, int io_flags) {
         ails->codes.resize (ails->nlist);
         std::vector<size_t> sizes (ails->nlist);
         read_ArrayInvertedLists_sizes (f, sizes);
+        // the list sizes give the position of each list in the file, so
+        // large lists can be read in parallel
+        std::vector<void*> ptrs;
+        std::vector<size_t> nbytes;
         for (size_t i = 0; i < ails->nlist; i++) {
             ails->ids[i].resize (sizes[i]);
             ails->codes[i].resize (sizes[i] * ails->code_size);
+            if (sizes[i] > 0) {
+                ptrs.push_back (ails->codes[i].data());
+                nbytes.push_back (sizes[i] * ails->code_size);
+                ptrs.push_back (ails->ids[i].data());
+                nbytes.push_back (sizes[i] * sizeof(Index::idx_t));
+            }
+        }
+        FileIOReader *reader = dynamic_cast<FileIOReader*>(f);
+        if (reader && pread_next_ranges (reader, ptrs, nbytes)) {
+            return ails;
         }
         for (size_t i = 0; i < ails->nlist; i++) {
             size_t n = ails->ids[i].size();
@@ -199,6 +273,29 @@ InvertedLists *read_InvertedLists (IOReader *f, int io_flags) {
         }
         return ails;
 
+    } else if (h == fourcc ("ilci")) {
+        size_t nlist, code_size;
+        READ1 (nlist);
+        READ1 (code_size);
+        int id_storage;
+        READ1 (id_storage);
+        Index::idx_t id_base;
+        READ1 (id_base);
+        auto cils = new CompactIdsInvertedLists (
+              nlist, code_size,
+              CompactIdsInvertedLists::IdStorage (id_storage), id_base);
+        for (size_t i = 0; i < nlist; i++) {
+            READVECTOR (cils->codes[i]);
+            if (cils->id_storage == CompactIdsInvertedLists::IDS_32BIT) {
+                READVECTOR (cils->ids32[i]);
+                FAISS_THROW_IF_NOT (cils->ids32[i].size () * code_size ==
+                                    cils->codes[i].size ());
+            } else {
+                READVECTOR (cils->id_runs[i]);
+            }
+        }
+        return cils;
+
 #ifdef _MSC_VER
     } else {
         FAISS_THROW_MSG("Unsupported inverted list format for Windows");
@@ -226,10 +323,16 @@ InvertedLists *read_InvertedLists (IOReader *f, int io_flags) {
 static void read_InvertedLists (
         IndexIVF *ivf, IOReader *f, int io_flags) {
     InvertedLists *ils = read_InvertedLists (f, io_flags);
-    FAISS_THROW_IF_NOT (!ils || (ils->nlist == ivf->nlist &&
-                                 ils->code_size == ivf->code_size));
+    FAISS_THROW_IF_NOT (!ils || (ils->nlist == ivf->nlist && (
+                   ils->code_size == ivf->code_size ||
+                   ils->code_size == InvertedLists::INVALID_CODE_SIZE)));
     ivf->invlists = ils;
     ivf->own_invlists = true;
+    // entries marked as deleted are still in the lists but not in ntotal
+    if (ils) {
+        size_t nstored = ils->compute_ntotal ();
+        ivf->ntombstones = nstored > ivf->ntotal ? nstored - ivf->ntotal : 0;
+    }
 }
 
 static void read_ProductQuantizer (ProductQuantizer *pq, IOReader *f) {
@@ -250,12 +353,43 @@ static void read_ScalarQuantizer (ScalarQuantizer *ivsc, IOReader *f) {
 }
 
 
-static void read_HNSW (HNSW *hnsw, IOReader *f) {
+static void read_AdditiveQuantizer (AdditiveQuantizer *aq, IOReader *f) {
+    READ1 (aq->d);
+    READ1 (aq->M);
+    READ1 (aq->nbits);
+    READ1 (aq->is_trained);
+    READVECTOR (aq->codebooks);
+    READ1 (aq->search_type);
+    READ1 (aq->norm_min);
+    READ1 (aq->norm_max);
+    aq->set_derived_values ();
+}
+
+static void read_ResidualQuantizer (ResidualQuantizer *rq, IOReader *f) {
+    read_AdditiveQuantizer (rq, f);
+    READ1 (rq->max_beam_size);
+}
+
+static void read_LocalSearchQuantizer (
+        LocalSearchQuantizer *lsq, IOReader *f) {
+    read_AdditiveQuantizer (lsq, f);
+    READ1 (lsq->train_iters);
+    READ1 (lsq->encode_ils_iters);
+    READ1 (lsq->train_ils_iters);
+    READ1 (lsq->icm_iters);
+    READ1 (lsq->nperts);
+    READ1 (lsq->lambd);
+    READ1 (lsq->chunk_size);
+    READ1 (lsq->random_seed);
+}
+
+
+static void read_HNSW (HNSW *hnsw, IOReader *f, int io_flags) {
     READVECTOR (hnsw->assign_probas);
     READVECTOR (hnsw->cum_nneighbor_per_level);
     READVECTOR (hnsw->levels);
     READVECTOR (hnsw->offsets);
-    READVECTOR (hnsw->neighbors);
+    READVECTOR_MAYBE_MMAP (hnsw->neighbors);
 
     READ1 (hnsw->entry_point);
     READ1 (hnsw->max_level);
@@ -264,6 +398,19 @@ static void read_HNSW (HNSW *hnsw, IOReader *f) {
     READ1 (hnsw->upper_beam);
 }
 
+static void read_NSG (NSG *nsg, IOReader *f, int io_flags) {
+    READ1 (nsg->ntotal);
+    READ1 (nsg->R);
+    READ1 (nsg->build_L);
+    READ1 (nsg->alpha);
+    READ1 (nsg->search_L);
+    READ1 (nsg->enterpoint);
+    READ1 (nsg->seed);
+    READ1 (nsg->is_built);
+    READVECTOR_MAYBE_MMAP (nsg->final_graph);
+    FAISS_THROW_IF_NOT (nsg->final_graph.size() == nsg->ntotal * nsg->R);
+}
+
 ProductQuantizer * read_ProductQuantizer (const char*fname) {
     FileIOReader reader(fname);
     return read_ProductQuantizer(&reader);
@@ -293,6 +440,17 @@ static void read_direct_map (DirectMap *dm, IOReader *f) {
             map [it.first] = it.second;
         }
     }
+    if (dm->type == DirectMap::Compact) {
+        using idx_t = Index::idx_t;
+        std::vector<std::pair<idx_t, idx_t>> v;
+        READVECTOR (v);
+        std::vector<idx_t> ids (v.size()), lo (v.size());
+        for (size_t i = 0; i < v.size(); i++) {
+            ids[i] = v[i].first;
+            lo[i] = v[i].second;
+        }
+        dm->compact.build (v.size(), ids.data(), lo.data());
+    }
 
 }
 
@@ -365,11 +523,161 @@ static IndexIVFPQ *read_ivfpq (IOReader *f, uint32_t h, int io_flags)
 
 int read_old_fmt_hack = 0;
 
+/*************************************************************
+ * Index container (the format is described in index_write.cpp)
+ **************************************************************/
+
+static void check_container_section (
+        const ChecksumIOReader & cr, uint64_t size, uint64_t checksum)
+{
+    FAISS_THROW_IF_NOT_FMT (cr.nbytes == size &&
+                            cr.checksum.value() == checksum,
+                            "index container %s: checksum mismatch",
+                            cr.name.c_str());
+}
+
+/// section i is the index or its inverted lists, maybe compressed
+static bool is_section_type (uint32_t type, size_t i) {
+    return i == 0 ? type == fourcc ("indx") || type == fourcc ("indz") :
+                    type == fourcc ("ivfl") || type == fourcc ("ivfz");
+}
+
+static void container_seek (FILE *fp, long ofs) {
+    int ret = fseek (fp, ofs, SEEK_SET);
+    FAISS_THROW_IF_NOT_FMT (ret == 0, "fseek failed: %s", strerror(errno));
+}
+
+static Index *read_index_container (IOReader *f, int io_flags) {
+    // the fourcc was read by read_index
+    uint32_t version;
+    READ1 (version);
+    FAISS_THROW_IF_NOT_FMT (version == 1,
+                            "unsupported index container version %d",
+                            (int)version);
+    uint64_t toc_offset, nsection;
+    READ1 (toc_offset);
+    READ1 (nsection);
+    FAISS_THROW_IF_NOT (nsection == 1 || nsection == 2);
+    size_t header_size = 2 * sizeof(uint32_t) + 2 * sizeof(uint64_t);
+
+    bool mmap = (io_flags & IO_FLAG_MMAP) == IO_FLAG_MMAP;
+    // the inverted lists are loaded by an InvertedListsIOHook
+    bool ivf_hook = (io_flags & IO_FLAG_SKIP_IVF_DATA) &&
+                    (io_flags & 0xffff0000);
+    bool skip_ivf = (io_flags & IO_FLAG_SKIP_IVF_DATA) && !ivf_hook;
+
+    FileIOReader *reader = dynamic_cast<FileIOReader*> (f);
+    long start = -1;
+    if (reader && toc_offset != 0) {
+        start = ftell (reader->f);
+        if (start >= 0) {
+            start -= header_size;
+        }
+    }
+
+    if (start < 0) {
+        // sequential read, all sections are read and verified
+        std::vector<uint64_t> sizes, checksums;
+
+        ChecksumIOReader cr (f);
+        Index *idx = read_index (&cr, io_flags & ~IO_FLAG_MMAP);
+        ScopeDeleter1<Index> del (idx);
+        sizes.push_back (cr.nbytes);
+        checksums.push_back (cr.checksum.value());
+
+        if (nsection == 2) {
+            IndexIVF *ivf = ivflib::try_extract_index_ivf (idx);
+            FAISS_THROW_IF_NOT (ivf && !ivf->invlists);
+            ChecksumIOReader cr_ivf (f);
+            InvertedLists *ils = read_InvertedLists (&cr_ivf);
+            if (skip_ivf) {
+                delete ils;
+            } else {
+                ivf->replace_invlists (ils, true);
+            }
+            sizes.push_back (cr_ivf.nbytes);
+            checksums.push_back (cr_ivf.checksum.value());
+        }
+
+        uint64_t offset = header_size;
+        for (size_t i = 0; i < nsection; i++) {
+            uint32_t type;
+            uint64_t toc_ofs, toc_size, toc_checksum;
+            READ1 (type);
+            READ1 (toc_ofs);
+            READ1 (toc_size);
+            READ1 (toc_checksum);
+            FAISS_THROW_IF_NOT_FMT (is_section_type (type, i) &&
+                                    toc_ofs == offset &&
+                                    toc_size == sizes[i] &&
+                                    toc_checksum == checksums[i],
+                                    "index container %s: checksum mismatch",
+                                    f->name.c_str());
+            offset += toc_size;
+        }
+        del.release ();
+        return idx;
+    }
+
+    FILE *fp = reader->f;
+    container_seek (fp, start + toc_offset);
+    std::vector<uint32_t> types (nsection);
+    std::vector<uint64_t> offsets (nsection), sizes (nsection),
+        checksums (nsection);
+    for (size_t i = 0; i < nsection; i++) {
+        READ1 (types[i]);
+        READ1 (offsets[i]);
+        READ1 (sizes[i]);
+        READ1 (checksums[i]);
+    }
+    long end = ftell (fp);
+    FAISS_THROW_IF_NOT (is_section_type (types[0], 0) &&
+                        (nsection == 1 || is_section_type (types[1], 1)));
+
+    // the mmapped data is not read, so its checksum is not verified
+    container_seek (fp, start + offsets[0]);
+    Index *idx;
+    if (mmap && types[0] == fourcc ("indx")) {
+        idx = read_index (f, io_flags);
+    } else {
+        ChecksumIOReader cr (f);
+        idx = read_index (&cr, io_flags);
+        check_container_section (cr, sizes[0], checksums[0]);
+    }
+    ScopeDeleter1<Index> del (idx);
+
+    if (nsection == 2 && !skip_ivf) {
+        IndexIVF *ivf = ivflib::try_extract_index_ivf (idx);
+        FAISS_THROW_IF_NOT (ivf && !ivf->invlists);
+        container_seek (fp, start + offsets[1]);
+        if (ivf_hook && types[1] == fourcc ("ivfl")) {
+            read_InvertedLists (ivf, f, io_flags);
+        } else {
+            ChecksumIOReader cr (f);
+            read_InvertedLists (ivf, &cr, io_flags);
+            check_container_section (cr, sizes[1], checksums[1]);
+        }
+    }
+
+    container_seek (fp, end);
+    del.release ();
+    return idx;
+}
+
 Index *read_index (IOReader *f, int io_flags) {
     Index * idx = nullptr;
     uint32_t h;
     READ1 (h);
-    if (h == fourcc ("IxFI") || h == fourcc ("IxF2") || h == fourcc("IxFl")) {
+    if (h == fourcc ("IxCt")) {
+        return read_index_container (f, io_flags);
+    } else if (h == fourcc ("IxCz")) {
+        // the data cannot be mapped
+        CompressedIOReader cz (f);
+        idx = read_index (&cz, io_flags & ~IO_FLAG_MMAP);
+        ScopeDeleter1<Index> del (idx);
+        cz.finish ();
+        del.release ();
+    } else if (h == fourcc ("IxFI") || h == fourcc ("IxF2") || h == fourcc("IxFl")) {
         IndexFlat *idxf;
         if (h == fourcc ("IxFI")) {
             idxf = new IndexFlatIP ();
@@ -379,10 +687,21 @@ Index *read_index (IOReader *f, int io_flags) {
             idxf = new IndexFlat ();
         }
         read_index_header (idxf, f);
-        READVECTOR (idxf->xb);
+        READVECTOR_MAYBE_MMAP (idxf->xb);
         FAISS_THROW_IF_NOT (idxf->xb.size() == idxf->ntotal * idxf->d);
         // leak!
         idx = idxf;
+    } else if (h == fourcc ("IxFh") || h == fourcc ("IxFb")) {
+        IndexFlatHalf *idxh;
+        if (h == fourcc ("IxFh")) {
+            idxh = new IndexFlatFP16 ();
+        } else {
+            idxh = new IndexFlatBF16 ();
+        }
+        read_index_header (idxh, f);
+        READVECTOR (idxh->codes);
+        FAISS_THROW_IF_NOT (idxh->codes.size() == idxh->ntotal * idxh->d);
+        idx = idxh;
     } else if (h == fourcc("IxHE") || h == fourcc("IxHe")) {
         IndexLSH * idxl = new IndexLSH ();
         read_index_header (idxl, f);
@@ -418,7 +737,7 @@ Index *read_index (IOReader *f, int io_flags) {
         IndexPQ * idxp =new IndexPQ ();
         read_index_header (idxp, f);
         read_ProductQuantizer (&idxp->pq, f);
-        READVECTOR (idxp->codes);
+        READVECTOR_MAYBE_MMAP (idxp->codes);
         if (h == fourcc ("IxPo") || h == fourcc ("IxPq")) {
             READ1 (idxp->search_type);
             READ1 (idxp->encode_signs);
@@ -431,6 +750,14 @@ Index *read_index (IOReader *f, int io_flags) {
             idxp->metric_type = METRIC_L2;
         }
         idx = idxp;
+    } else if (h == fourcc ("IPfs")) {
+        IndexPQFastScan * idxp = new IndexPQFastScan ();
+        read_index_header (idxp, f);
+        read_ProductQuantizer (&idxp->pq, f);
+        READ1 (idxp->M2);
+        READVECTOR (idxp->codes);
+        FAISS_THROW_IF_NOT (idxp->M2 == (idxp->pq.M + 1) / 2 * 2);
+        idx = idxp;
     } else if (h == fourcc ("IvFl") || h == fourcc("IvFL")) { // legacy
         IndexIVFFlat * ivfl = new IndexIVFFlat ();
         std::vector<std::vector<Index::idx_t> > ids;
@@ -467,6 +794,13 @@ Index *read_index (IOReader *f, int io_flags) {
         }
         read_InvertedLists (ivfl, f, io_flags);
         idx = ivfl;
+    } else if (h == fourcc ("IwFs")) {
+        IndexIVFFlatSorted * ivfl = new IndexIVFFlatSorted ();
+        read_ivf_header (ivfl, f);
+        ivfl->code_size = ivfl->d * sizeof(float);
+        read_InvertedLists (ivfl, f, io_flags);
+        ivfl->sort_lists ();
+        idx = ivfl;
     } else if (h == fourcc ("IwFl")) {
         IndexIVFFlat * ivfl = new IndexIVFFlat ();
         read_ivf_header (ivfl, f);
@@ -477,10 +811,22 @@ Index *read_index (IOReader *f, int io_flags) {
         IndexScalarQuantizer * idxs = new IndexScalarQuantizer ();
         read_index_header (idxs, f);
         read_ScalarQuantizer (&idxs->sq, f);
-        READVECTOR (idxs->codes);
+        READVECTOR_MAYBE_MMAP (idxs->codes);
         idxs->code_size = idxs->sq.code_size;
         idx = idxs;
-    } else if (h == fourcc ("IxLa")) {
+    } else if (h == fourcc ("IxRQ")) {
+        IndexResidual * idxr = new IndexResidual ();
+        read_index_header (idxr, f);
+        read_ResidualQuantizer (&idxr->rq, f);
+        READVECTOR (idxr->codes);
+        idx = idxr;
+    } else if (h == fourcc ("IxLS")) {
+        IndexLocalSearchQuantizer * idxl = new IndexLocalSearchQuantizer ();
+        read_index_header (idxl, f);
+        read_LocalSearchQuantizer (&idxl->lsq, f);
+        READVECTOR (idxl->codes);
+        idx = idxl;
+    } else if (h == fourcc ("IxLa") || h == fourcc ("IxLc")) {
         int d, nsq, scale_nbit, r2;
         READ1 (d);
         READ1 (nsq);
@@ -489,6 +835,11 @@ Index *read_index (IOReader *f, int io_flags) {
         IndexLattice *idxl = new IndexLattice (d, nsq, scale_nbit, r2);
         read_index_header (idxl, f);
         READVECTOR (idxl->trained);
+        if (h == fourcc ("IxLc")) {
+            READVECTOR (idxl->codes);
+            FAISS_THROW_IF_NOT (
+                idxl->codes.size() == idxl->ntotal * idxl->code_size);
+        }
         idx = idxl;
     } else if(h == fourcc ("IvSQ")) { // legacy
         IndexIVFScalarQuantizer * ivsc = new IndexIVFScalarQuantizer();
@@ -512,6 +863,23 @@ Index *read_index (IOReader *f, int io_flags) {
         }
         read_InvertedLists (ivsc, f, io_flags);
         idx = ivsc;
+    } else if(h == fourcc ("IwRQ")) {
+        IndexIVFResidual * ivrq = new IndexIVFResidual ();
+        read_ivf_header (ivrq, f);
+        read_ResidualQuantizer (&ivrq->rq, f);
+        READ1 (ivrq->code_size);
+        READ1 (ivrq->by_residual);
+        read_InvertedLists (ivrq, f, io_flags);
+        idx = ivrq;
+    } else if(h == fourcc ("IwLS")) {
+        IndexIVFLocalSearchQuantizer * ivls =
+            new IndexIVFLocalSearchQuantizer ();
+        read_ivf_header (ivls, f);
+        read_LocalSearchQuantizer (&ivls->lsq, f);
+        READ1 (ivls->code_size);
+        READ1 (ivls->by_residual);
+        read_InvertedLists (ivls, f, io_flags);
+        idx = ivls;
     } else if(h == fourcc ("IwSh")) {
         IndexIVFSpectralHash *ivsp = new IndexIVFSpectralHash ();
         read_ivf_header (ivsp, f);
@@ -530,6 +898,15 @@ Index *read_index (IOReader *f, int io_flags) {
 
         idx = read_ivfpq (f, h, io_flags);
 
+    } else if(h == fourcc ("IwPf")) {
+        IndexIVFPQFastScan * ivpq = new IndexIVFPQFastScan ();
+        read_ivf_header (ivpq, f);
+        READ1 (ivpq->by_residual);
+        READ1 (ivpq->code_size);
+        READ1 (ivpq->M2);
+        read_ProductQuantizer (&ivpq->pq, f);
+        read_InvertedLists (ivpq, f, io_flags);
+        idx = ivpq;
     } else if(h == fourcc ("IxPT")) {
         IndexPreTransform * ixpt = new IndexPreTransform();
         ixpt->own_fields = true;
@@ -544,6 +921,7 @@ Index *read_index (IOReader *f, int io_flags) {
             ixpt->chain.push_back (read_VectorTransform (f));
         }
         ixpt->index = read_index (f, io_flags);
+        ixpt->fuse_chain ();
         idx = ixpt;
     } else if(h == fourcc ("Imiq")) {
         MultiIndexQuantizer * imiq = new MultiIndexQuantizer ();
@@ -560,6 +938,19 @@ Index *read_index (IOReader *f, int io_flags) {
         delete rf;
         READ1 (idxrf->k_factor);
         idx = idxrf;
+    } else if(h == fourcc ("IxRe") || h == fourcc ("IxRa")) {
+        IndexRefine *idxr = new IndexRefine ();
+        read_index_header (idxr, f);
+        idxr->base_index = read_index (f, io_flags);
+        idxr->refine_index = read_index (f, io_flags);
+        idxr->own_fields = true;
+        idxr->own_refine_index = true;
+        READ1 (idxr->k_factor);
+        if (h == fourcc ("IxRa")) {
+            idxr->adaptive_refine = true;
+            READVECTOR (idxr->base_errors);
+        }
+        idx = idxr;
     } else if(h == fourcc ("IxMp") || h == fourcc ("IxM2")) {
         bool is_map2 = h == fourcc ("IxM2");
         IndexIDMap * idxmap = is_map2 ? new IndexIDMap2 () : new IndexIDMap ();
@@ -582,6 +973,7 @@ Index *read_index (IOReader *f, int io_flags) {
         READ1 (idxp->code_size_2);
         READ1 (idxp->code_size);
         READVECTOR (idxp->codes);
+        idxp->precompute_table ();
         idx = idxp;
     } else if(h == fourcc("IHNf") || h == fourcc("IHNp") ||
               h == fourcc("IHNs") || h == fourcc("IHN2")) {
@@ -591,13 +983,98 @@ Index *read_index (IOReader *f, int io_flags) {
         if (h == fourcc("IHNs")) idxhnsw = new IndexHNSWSQ ();
         if (h == fourcc("IHN2")) idxhnsw = new IndexHNSW2Level ();
         read_index_header (idxhnsw, f);
-        read_HNSW (&idxhnsw->hnsw, f);
+        read_HNSW (&idxhnsw->hnsw, f, io_flags);
         idxhnsw->storage = read_index (f, io_flags);
         idxhnsw->own_fields = true;
         if (h == fourcc("IHNp")) {
             dynamic_cast<IndexPQ*>(idxhnsw->storage)->pq.compute_sdc_table ();
         }
         idx = idxhnsw;
+    } else if(h == fourcc("IHNl")) {
+        std::vector<HNSW::storage_idx_t> node_to_label;
+        READVECTOR (node_to_label);
+        Index *sub = read_index (f, io_flags);
+        IndexHNSW *idxhnsw = dynamic_cast<IndexHNSW*> (sub);
+        if (!idxhnsw || node_to_label.size() != sub->ntotal) {
+            delete sub;
+            FAISS_THROW_MSG ("IHNl record not followed by a matching "
+                             "HNSW index");
+        }
+        idxhnsw->node_to_label.swap (node_to_label);
+        idxhnsw->label_to_node.resize (idxhnsw->ntotal);
+        for (size_t i = 0; i < idxhnsw->ntotal; i++) {
+            idxhnsw->label_to_node[idxhnsw->node_to_label[i]] = i;
+        }
+        idx = idxhnsw;
+    } else if(h == fourcc("IHNd")) {
+        std::vector<uint8_t> deleted;
+        size_t ndeleted;
+        std::vector<HNSW::storage_idx_t> free_slots;
+        READVECTOR (deleted);
+        READ1 (ndeleted);
+        READVECTOR (free_slots);
+        Index *sub = read_index (f, io_flags);
+        IndexHNSW *idxhnsw = dynamic_cast<IndexHNSW*> (sub);
+        if (!idxhnsw) {
+            delete sub;
+            FAISS_THROW_MSG ("IHNd record not followed by a HNSW index");
+        }
+        idxhnsw->hnsw.deleted.swap (deleted);
+        idxhnsw->hnsw.ndeleted = ndeleted;
+        idxhnsw->hnsw.free_slots.swap (free_slots);
+        idx = idxhnsw;
+    } else if(h == fourcc("IHNc")) {
+        std::vector<uint8_t> compressed_links;
+        READVECTOR (compressed_links);
+        Index *sub = read_index (f, io_flags);
+        IndexHNSW *idxhnsw = dynamic_cast<IndexHNSW*> (sub);
+        if (!idxhnsw || !idxhnsw->hnsw.neighbors.empty() ||
+            idxhnsw->hnsw.offsets.size() != sub->ntotal + 1 ||
+            idxhnsw->hnsw.offsets.back() + HNSW::compressed_links_padding !=
+                  compressed_links.size()) {
+            delete sub;
+            FAISS_THROW_MSG ("IHNc record not followed by a matching "
+                             "HNSW index");
+        }
+        idxhnsw->hnsw.compressed_links.swap (compressed_links);
+        idxhnsw->hnsw.links_compressed = true;
+        idx = idxhnsw;
+    } else if(h == fourcc("INSf") || h == fourcc("INSp") ||
+              h == fourcc("INSs")) {
+        IndexNSG *idxnsg = nullptr;
+        if (h == fourcc("INSf")) idxnsg = new IndexNSGFlat ();
+        if (h == fourcc("INSp")) idxnsg = new IndexNSGPQ ();
+        if (h == fourcc("INSs")) idxnsg = new IndexNSGSQ ();
+        read_index_header (idxnsg, f);
+        read_NSG (&idxnsg->nsg, f, io_flags);
+        idxnsg->storage = read_index (f, io_flags);
+        idxnsg->own_fields = true;
+        if (h == fourcc("INSp")) {
+            dynamic_cast<IndexPQ*>(idxnsg->storage)->pq.compute_sdc_table ();
+        }
+        idx = idxnsg;
+    } else if (h == fourcc ("IxDG")) {
+        IndexDiskGraph *idxdg = new IndexDiskGraph ();
+        ScopeDeleter1<IndexDiskGraph> del (idxdg);
+        read_index_header (idxdg, f);
+        READ1 (idxdg->R);
+        idxdg->record_size = sizeof(float) * idxdg->d +
+            sizeof(IndexDiskGraph::storage_idx_t) * idxdg->R;
+        read_ProductQuantizer (&idxdg->pq, f);
+        READVECTOR (idxdg->codes);
+        READVECTOR (idxdg->node_to_label);
+        READ1 (idxdg->entry_point);
+        READ1 (idxdg->search_L);
+        READ1 (idxdg->beam_width);
+        std::vector<char> fname;
+        READVECTOR (fname);
+        if (idxdg->ntotal > 0) {
+            idxdg->open (std::string (fname.begin(), fname.end()).c_str());
+        } else {
+            idxdg->filename.assign (fname.begin(), fname.end());
+        }
+        del.release ();
+        idx = idxdg;
     } else {
         FAISS_THROW_FMT("Index type 0x%08x not supported\n", h);
         idx = nullptr;
@@ -667,7 +1144,7 @@ static void read_binary_ivf_header (
 }
 
 static void read_binary_hash_invlists (
-        IndexBinaryHash::InvertedListMap &invlists,
+        BinaryHashTable &invlists,
         int b, IOReader *f)
 {
     size_t sz;
@@ -678,15 +1155,24 @@ static void read_binary_hash_invlists (
     std::vector<uint8_t> buf((b + il_nbit) * sz);
     READVECTOR (buf);
     BitstringReader rd (buf.data(), buf.size());
-    invlists.reserve (sz);
+    // accumulate all entries and add them in one go
+    std::vector<uint64_t> keys;
+    std::vector<Index::idx_t> ids;
+    std::vector<uint8_t> codes;
     for (size_t i = 0; i < sz; i++) {
         uint64_t hash = rd.read(b);
         uint64_t ilsz = rd.read(il_nbit);
-        auto & il = invlists[hash];
-        READVECTOR (il.ids);
-        FAISS_THROW_IF_NOT (il.ids.size() == ilsz);
-        READVECTOR (il.vecs);
+        std::vector<Index::idx_t> il_ids;
+        std::vector<uint8_t> il_vecs;
+        READVECTOR (il_ids);
+        FAISS_THROW_IF_NOT (il_ids.size() == ilsz);
+        READVECTOR (il_vecs);
+        FAISS_THROW_IF_NOT (il_vecs.size() == ilsz * invlists.code_size);
+        keys.resize (keys.size() + ilsz, hash);
+        ids.insert (ids.end(), il_ids.begin(), il_ids.end());
+        codes.insert (codes.end(), il_vecs.begin(), il_vecs.end());
     }
+    invlists.add (keys.size(), keys.data(), ids.data(), codes.data());
 }
 
 static void read_binary_multi_hash_map(
@@ -703,15 +1189,17 @@ static void read_binary_multi_hash_map(
     size_t nbit = (b + id_bits) * sz + ntotal * id_bits;
     FAISS_THROW_IF_NOT (buf.size() == (nbit + 7) / 8);
     BitstringReader rd (buf.data(), buf.size());
-    map.reserve (sz);
+    std::vector<uint64_t> keys;
+    std::vector<Index::idx_t> ids;
     for (size_t i = 0; i < sz; i++) {
         uint64_t hash = rd.read(b);
         uint64_t ilsz = rd.read(id_bits);
-        auto & il = map[hash];
         for (size_t j = 0; j < ilsz; j++) {
-            il.push_back (rd.read (id_bits));
+            keys.push_back (hash);
+            ids.push_back (rd.read (id_bits));
         }
     }
+    map.add (keys.size(), keys.data(), ids.data(), nullptr);
 }
 
 
@@ -741,7 +1229,7 @@ IndexBinary *read_index_binary (IOReader *f, int io_flags) {
     } else if (h == fourcc ("IBHf")) {
         IndexBinaryHNSW *idxhnsw = new IndexBinaryHNSW ();
         read_index_binary_header (idxhnsw, f);
-        read_HNSW (&idxhnsw->hnsw, f);
+        read_HNSW (&idxhnsw->hnsw, f, io_flags);
         idxhnsw->storage = read_index_binary (f, io_flags);
         idxhnsw->own_fields = true;
         idx = idxhnsw;
@@ -762,6 +1250,7 @@ IndexBinary *read_index_binary (IOReader *f, int io_flags) {
         read_index_binary_header (idxh, f);
         READ1 (idxh->b);
         READ1 (idxh->nflip);
+        idxh->invlists.code_size = idxh->code_size;
         read_binary_hash_invlists(idxh->invlists, idxh->b, f);
         idx = idxh;
     } else if(h == fourcc("IBHm")) {
@@ -815,6 +1304,10 @@ struct IOHookTable: std::vector<InvertedListsIOHook*> {
 
     IOHookTable() {
         push_back(new OnDiskInvertedListsIOHook());
+        push_back(new OnDiskCompressedInvertedListsIOHook());
+        push_back(new BlockInvertedListsIOHook());
+        push_back(new EntropyCodedInvertedListsIOHook());
+        push_back(new RemoteInvertedListsIOHook());
     }
 
     ~IOHookTable() {
@@ -17,6 +17,10 @@
 
 #ifndef _MSC_VER
 #include <sys/mman.h>
+#ifndef _MSC_VER
+#include <fcntl.h>
+#include <unistd.h>
+#endif // !_MSC_VER
 #endif // !_MSC_VER
 
 #include <faiss/impl/FaissAssert.h>
@@ -25,20 +29,28 @@
 #include <faiss/utils/hamming.h>
 
 #include <faiss/IndexFlat.h>
+#include <faiss/IndexFlatHalf.h>
 #include <faiss/VectorTransform.h>
 #include <faiss/IndexPreTransform.h>
+#include <faiss/IndexRefine.h>
 #include <faiss/IndexLSH.h>
 #include <faiss/IndexPQ.h>
+#include <faiss/IndexPQFastScan.h>
 #include <faiss/IndexIVF.h>
+#include <faiss/IVFlib.h>
 #include <faiss/IndexIVFPQ.h>
 #include <faiss/IndexIVFPQR.h>
+#include <faiss/IndexIVFPQFastScan.h>
 #include <faiss/Index2Layer.h>
 #include <faiss/IndexIVFFlat.h>
 #include <faiss/IndexIVFSpectralHash.h>
 #include <faiss/MetaIndexes.h>
 #include <faiss/IndexScalarQuantizer.h>
 #include <faiss/IndexHNSW.h>
+#include <faiss/IndexNSG.h>
+#include <faiss/IndexDiskGraph.h>
 #include <faiss/IndexLattice.h>
+#include <faiss/IndexAdditiveQuantizer.h>
 
 #include <faiss/IndexBinaryFlat.h>
 #include <faiss/IndexBinaryFromFloat.h>
@@ -46,8 +58,12 @@
 #include <faiss/IndexBinaryIVF.h>
 #include <faiss/IndexBinaryHash.h>
 
+#include <faiss/CompactIdsInvertedLists.h>
+#include <faiss/ConcurrentInvertedLists.h>
+
 #ifndef _MSC_VER
 #include <faiss/OnDiskInvertedLists.h>
+#include <faiss/RemoteInvertedLists.h>
 #endif // !_MSC_VER
 
 
@@ -137,6 +153,12 @@ void write_VectorTransform (const VectorTransform *vt, IOWriter *f) {
         uint32_t h = fourcc ("VCnt");
         WRITE1 (h);
         WRITEVECTOR (ct->mean);
+    } else if (const HadamardRotation *hr =
+               dynamic_cast<const HadamardRotation *>(vt)) {
+        uint32_t h = fourcc ("HRot");
+        WRITE1 (h);
+        WRITE1 (hr->nrounds);
+        WRITEVECTOR (hr->signs);
     } else if (const ITQTransform *itqt =
                dynamic_cast<const ITQTransform*> (vt)) {
         uint32_t h = fourcc ("Viqt");
@@ -171,36 +193,74 @@ static void write_ScalarQuantizer (
     WRITEVECTOR (ivsc->trained);
 }
 
+static void write_AdditiveQuantizer (
+        const AdditiveQuantizer *aq, IOWriter *f) {
+    WRITE1 (aq->d);
+    WRITE1 (aq->M);
+    WRITE1 (aq->nbits);
+    WRITE1 (aq->is_trained);
+    WRITEVECTOR (aq->codebooks);
+    WRITE1 (aq->search_type);
+    WRITE1 (aq->norm_min);
+    WRITE1 (aq->norm_max);
+}
+
+static void write_ResidualQuantizer (
+        const ResidualQuantizer *rq, IOWriter *f) {
+    write_AdditiveQuantizer (rq, f);
+    WRITE1 (rq->max_beam_size);
+}
+
+static void write_LocalSearchQuantizer (
+        const LocalSearchQuantizer *lsq, IOWriter *f) {
+    write_AdditiveQuantizer (lsq, f);
+    WRITE1 (lsq->train_iters);
+    WRITE1 (lsq->encode_ils_iters);
+    WRITE1 (lsq->train_ils_iters);
+    WRITE1 (lsq->icm_iters);
+    WRITE1 (lsq->nperts);
+    WRITE1 (lsq->lambd);
+    WRITE1 (lsq->chunk_size);
+    WRITE1 (lsq->random_seed);
+}
+
 void write_InvertedLists (const InvertedLists *ils, IOWriter *f) {
     if (ils == nullptr) {
         uint32_t h = fourcc ("il00");
         WRITE1 (h);
-    } else if (const auto & ails =
-               dynamic_cast<const ArrayInvertedLists *>(ils)) {
+    } else if (dynamic_cast<const ArrayInvertedLists *>(ils) ||
+               dynamic_cast<const CompactedInvertedLists *>(ils) ||
+               dynamic_cast<const ConcurrentInvertedLists *>(ils)
+#ifndef _MSC_VER
+               || dynamic_cast<const RemoteInvertedLists *>(ils)
+#endif // !_MSC_VER
+               ) {
+        // all are stored as plain arrays, that are read back as
+        // ArrayInvertedLists
         uint32_t h = fourcc ("ilar");
         WRITE1 (h);
-        WRITE1 (ails->nlist);
-        WRITE1 (ails->code_size);
+        WRITE1 (ils->nlist);
+        WRITE1 (ils->code_size);
         // here we store either as a full or a sparse data buffer
         size_t n_non0 = 0;
-        for (size_t i = 0; i < ails->nlist; i++) {
-            if (ails->ids[i].size() > 0)
+        for (size_t i = 0; i < ils->nlist; i++) {
+            if (ils->list_size(i) > 0)
                 n_non0++;
         }
-        if (n_non0 > ails->nlist / 2) {
+        if (n_non0 > ils->nlist / 2) {
             uint32_t list_type = fourcc("full");
             WRITE1 (list_type);
             std::vector<size_t> sizes;
-            for (size_t i = 0; i < ails->nlist; i++) {
-                sizes.push_back (ails->ids[i].size());
+            for (size_t i = 0; i < ils->nlist; i++) {
+                sizes.push_back (ils->list_size(i));
             }
             WRITEVECTOR (sizes);
         } else {
             int list_type = fourcc("sprs"); // sparse
             WRITE1 (list_type);
             std::vector<size_t> sizes;
-            for (size_t i = 0; i < ails->nlist; i++) {
-                size_t n = ails->ids[i].size();
+            for (size_t i = 0; i < ils->nlist; i++) {
+                size_t n = ils->list_size(i);
                 if (n > 0) {
                     sizes.push_back (i);
                     sizes.push_back (n);
@@ -209,11 +269,43 @@ void write_InvertedLists (const InvertedLists *ils, IOWriter *f) {
             WRITEVECTOR (sizes);
         }
         // make a single contiguous data buffer (useful for mmapping)
-        for (size_t i = 0; i < ails->nlist; i++) {
-            size_t n = ails->ids[i].size();
+        std::vector<const void*> ptrs;
+        std::vector<size_t> nbytes;
+        for (size_t i = 0; i < ils->nlist; i++) {
+            size_t n = ils->list_size(i);
+            if (n > 0) {
+                ptrs.push_back (ils->get_codes(i));
+                nbytes.push_back (n * ils->code_size);
+                ptrs.push_back (ils->get_ids(i));
+                nbytes.push_back (n * sizeof(Index::idx_t));
+            }
+        }
+        FileIOWriter *writer = dynamic_cast<FileIOWriter*>(f);
+        if (writer && pwrite_next_ranges (writer, ptrs, nbytes)) {
+            return;
+        }
+        for (size_t i = 0; i < ils->nlist; i++) {
+            size_t n = ils->list_size(i);
             if (n > 0) {
-                WRITEANDCHECK (ails->codes[i].data(), n * ails->code_size);
-                WRITEANDCHECK (ails->ids[i].data(), n);
+                WRITEANDCHECK (ils->get_codes(i), n * ils->code_size);
+                WRITEANDCHECK (ils->get_ids(i), n);
+            }
+        }
+    } else if (const CompactIdsInvertedLists * cils =
+               dynamic_cast<const CompactIdsInvertedLists *>(ils)) {
+        uint32_t h = fourcc ("ilci");
+        WRITE1 (h);
+        WRITE1 (cils->nlist);
+        WRITE1 (cils->code_size);
+        int id_storage = cils->id_storage;
+        WRITE1 (id_storage);
+        WRITE1 (cils->id_base);
+        for (size_t i = 0; i < cils->nlist; i++) {
+            WRITEVECTOR (cils->codes[i]);
+            if (cils->id_storage == CompactIdsInvertedLists::IDS_32BIT) {
+                WRITEVECTOR (cils->ids32[i]);
+            } else {
+                WRITEVECTOR (cils->id_runs[i]);
             }
         }
 #ifndef _MSC_VER
@@ -238,13 +330,29 @@ void write_ProductQuantizer (const ProductQuantizer*pq, const char *fname) {
     write_ProductQuantizer (pq, &writer);
 }
 
+/* Write a large vector with parallel positional writes when the output
+ * is a file, in the same format as WRITEVECTOR. */
+template <class VectorT>
+static void write_vector_maybe_parallel (const VectorT & v, IOWriter *f) {
+    size_t size = v.size ();
+    WRITEANDCHECK (&size, 1);
+    FileIOWriter *writer = dynamic_cast<FileIOWriter*>(f);
+    if (writer && pwrite_next_ranges (
+            writer, {v.data()}, {size * sizeof(v[0])})) {
+        return;
+    }
+    WRITEANDCHECK (v.data (), size);
+}
+
+#define WRITEVECTOR_MAYBE_PARALLEL(vec) write_vector_maybe_parallel (vec, f)
+
 static void write_HNSW (const HNSW *hnsw, IOWriter *f) {
 
     WRITEVECTOR (hnsw->assign_probas);
     WRITEVECTOR (hnsw->cum_nneighbor_per_level);
     WRITEVECTOR (hnsw->levels);
     WRITEVECTOR (hnsw->offsets);
-    WRITEVECTOR (hnsw->neighbors);
+    WRITEVECTOR_MAYBE_PARALLEL (hnsw->neighbors);
 
     WRITE1 (hnsw->entry_point);
     WRITE1 (hnsw->max_level);
@@ -253,6 +361,18 @@ static void write_HNSW (const HNSW *hnsw, IOWriter *f) {
     WRITE1 (hnsw->upper_beam);
 }
 
+static void write_NSG (const NSG *nsg, IOWriter *f) {
+    WRITE1 (nsg->ntotal);
+    WRITE1 (nsg->R);
+    WRITE1 (nsg->build_L);
+    WRITE1 (nsg->alpha);
+    WRITE1 (nsg->search_L);
+    WRITE1 (nsg->enterpoint);
+    WRITE1 (nsg->seed);
+    WRITE1 (nsg->is_built);
+    WRITEVECTOR_MAYBE_PARALLEL (nsg->final_graph);
+}
+
 static void write_direct_map (const DirectMap *dm, IOWriter *f) {
     char maintain_direct_map = (char)dm->type; // for backwards compatibility with bool
     WRITE1 (maintain_direct_map);
@@ -265,24 +385,54 @@ static void write_direct_map (const DirectMap *dm, IOWriter *f) {
         std::copy(map.begin(), map.end(), v.begin());
         WRITEVECTOR (v);
     }
+    if (dm->type == DirectMap::Compact) {
+        using idx_t = Index::idx_t;
+        std::vector<std::pair<idx_t, idx_t>> v;
+        dm->compact.get_entries (v);
+        WRITEVECTOR (v);
+    }
 }
 
-static void write_ivf_header (const IndexIVF *ivf, IOWriter *f) {
+static void write_index (const Index *idx, IOWriter *f,
+                         const InvertedLists *detached);
+
+static void write_ivf_header (const IndexIVF *ivf, IOWriter *f,
+                              const InvertedLists *detached) {
     write_index_header (ivf, f);
     WRITE1 (ivf->nlist);
     WRITE1 (ivf->nprobe);
-    write_index (ivf->quantizer, f);
+    write_index (ivf->quantizer, f, detached);
     write_direct_map (&ivf->direct_map, f);
 }
 
-void write_index (const Index *idx, IOWriter *f) {
+/* The detached inverted lists are stored in a separate section of an
+ * index container, a placeholder is written in their place */
+static void write_ivf_invlists (const IndexIVF *ivf, IOWriter *f,
+                                const InvertedLists *detached) {
+    if (detached && ivf->invlists == detached) {
+        uint32_t h = fourcc ("ilsk");
+        WRITE1 (h);
+    } else {
+        write_InvertedLists (ivf->invlists, f);
+    }
+}
+
+static void write_index (const Index *idx, IOWriter *f,
+                         const InvertedLists *detached) {
     if (const IndexFlat * idxf = dynamic_cast<const IndexFlat *> (idx)) {
         uint32_t h = fourcc (
               idxf->metric_type == METRIC_INNER_PRODUCT ? "IxFI" :
               idxf->metric_type == METRIC_L2 ? "IxF2" : "IxFl");
         WRITE1 (h);
         write_index_header (idx, f);
-        WRITEVECTOR (idxf->xb);
+        WRITEVECTOR_MAYBE_PARALLEL (idxf->xb);
+    } else if (const IndexFlatHalf * idxh =
+               dynamic_cast<const IndexFlatHalf *> (idx)) {
+        uint32_t h = fourcc (
+              idxh->half_type == IndexFlatHalf::HALF_FP16 ? "IxFh" : "IxFb");
+        WRITE1 (h);
+        write_index_header (idx, f);
+        WRITEVECTOR_MAYBE_PARALLEL (idxh->codes);
     } else if(const IndexLSH * idxl = dynamic_cast<const IndexLSH *> (idx)) {
         uint32_t h = fourcc ("IxHe");
         WRITE1 (h);
@@ -299,17 +449,25 @@ void write_index (const Index *idx, IOWriter *f) {
         WRITE1 (h);
         write_index_header (idx, f);
         write_ProductQuantizer (&idxp->pq, f);
-        WRITEVECTOR (idxp->codes);
+        WRITEVECTOR_MAYBE_PARALLEL (idxp->codes);
         // search params -- maybe not useful to store?
         WRITE1 (idxp->search_type);
         WRITE1 (idxp->encode_signs);
         WRITE1 (idxp->polysemous_ht);
+    } else if(const IndexPQFastScan * idxp =
+              dynamic_cast<const IndexPQFastScan *> (idx)) {
+        uint32_t h = fourcc ("IPfs");
+        WRITE1 (h);
+        write_index_header (idx, f);
+        write_ProductQuantizer (&idxp->pq, f);
+        WRITE1 (idxp->M2);
+        WRITEVECTOR (idxp->codes);
     } else if(const Index2Layer * idxp =
               dynamic_cast<const Index2Layer *> (idx)) {
         uint32_t h = fourcc ("Ix2L");
         WRITE1 (h);
         write_index_header (idx, f);
-        write_index (idxp->q1.quantizer, f);
+        write_index (idxp->q1.quantizer, f, detached);
         WRITE1 (idxp->q1.nlist);
         WRITE1 (idxp->q1.quantizer_trains_alone);
         write_ProductQuantizer (&idxp->pq, f);
@@ -323,10 +481,25 @@ void write_index (const Index *idx, IOWriter *f) {
         WRITE1 (h);
         write_index_header (idx, f);
         write_ScalarQuantizer (&idxs->sq, f);
-        WRITEVECTOR (idxs->codes);
+        WRITEVECTOR_MAYBE_PARALLEL (idxs->codes);
+    } else if(const IndexResidual * idxr =
+              dynamic_cast<const IndexResidual *> (idx)) {
+        uint32_t h = fourcc ("IxRQ");
+        WRITE1 (h);
+        write_index_header (idx, f);
+        write_ResidualQuantizer (&idxr->rq, f);
+        WRITEVECTOR_MAYBE_PARALLEL (idxr->codes);
+    } else if(const IndexLocalSearchQuantizer * idxl =
+              dynamic_cast<const IndexLocalSearchQuantizer *> (idx)) {
+        uint32_t h = fourcc ("IxLS");
+        WRITE1 (h);
+        write_index_header (idx, f);
+        write_LocalSearchQuantizer (&idxl->lsq, f);
+        WRITEVECTOR_MAYBE_PARALLEL (idxl->codes);
     } else if(const IndexLattice * idxl =
               dynamic_cast<const IndexLattice *> (idx)) {
-        uint32_t h = fourcc ("IxLa");
+        // IxLc also stores the codes, IxLa is kept for empty indexes
+        uint32_t h = fourcc (idxl->ntotal > 0 ? "IxLc" : "IxLa");
         WRITE1 (h);
         WRITE1 (idxl->d);
         WRITE1 (idxl->nsq);
@@ -334,11 +507,14 @@ void write_index (const Index *idx, IOWriter *f) {
         WRITE1 (idxl->zn_sphere_codec.r2);
         write_index_header (idx, f);
         WRITEVECTOR (idxl->trained);
+        if (idxl->ntotal > 0) {
+            WRITEVECTOR (idxl->codes);
+        }
     } else if(const IndexIVFFlatDedup * ivfl =
               dynamic_cast<const IndexIVFFlatDedup *> (idx)) {
         uint32_t h = fourcc ("IwFd");
         WRITE1 (h);
-        write_ivf_header (ivfl, f);
+        write_ivf_header (ivfl, f, detached);
         {
             std::vector<Index::idx_t> tab (2 * ivfl->instances.size());
             long i = 0;
@@ -349,50 +525,85 @@ void write_index (const Index *idx, IOWriter *f) {
             }
             WRITEVECTOR (tab);
         }
-        write_InvertedLists (ivfl->invlists, f);
+        write_ivf_invlists (ivfl, f, detached);
+    } else if(const IndexIVFFlatSorted * ivfl =
+              dynamic_cast<const IndexIVFFlatSorted *> (idx)) {
+        // the distances to the centroids are recomputed when reading
+        uint32_t h = fourcc ("IwFs");
+        WRITE1 (h);
+        write_ivf_header (ivfl, f, detached);
+        write_ivf_invlists (ivfl, f, detached);
     } else if(const IndexIVFFlat * ivfl =
               dynamic_cast<const IndexIVFFlat *> (idx)) {
         uint32_t h = fourcc ("IwFl");
         WRITE1 (h);
-        write_ivf_header (ivfl, f);
-        write_InvertedLists (ivfl->invlists, f);
+        write_ivf_header (ivfl, f, detached);
+        write_ivf_invlists (ivfl, f, detached);
     } else if(const IndexIVFScalarQuantizer * ivsc =
               dynamic_cast<const IndexIVFScalarQuantizer *> (idx)) {
         uint32_t h = fourcc ("IwSq");
         WRITE1 (h);
-        write_ivf_header (ivsc, f);
+        write_ivf_header (ivsc, f, detached);
         write_ScalarQuantizer (&ivsc->sq, f);
         WRITE1 (ivsc->code_size);
         WRITE1 (ivsc->by_residual);
-        write_InvertedLists (ivsc->invlists, f);
+        write_ivf_invlists (ivsc, f, detached);
+    } else if(const IndexIVFResidual * ivrq =
+              dynamic_cast<const IndexIVFResidual *> (idx)) {
+        uint32_t h = fourcc ("IwRQ");
+        WRITE1 (h);
+        write_ivf_header (ivrq, f, detached);
+        write_ResidualQuantizer (&ivrq->rq, f);
+        WRITE1 (ivrq->code_size);
+        WRITE1 (ivrq->by_residual);
+        write_ivf_invlists (ivrq, f, detached);
+    } else if(const IndexIVFLocalSearchQuantizer * ivls =
+              dynamic_cast<const IndexIVFLocalSearchQuantizer *> (idx)) {
+        uint32_t h = fourcc ("IwLS");
+        WRITE1 (h);
+        write_ivf_header (ivls, f, detached);
+        write_LocalSearchQuantizer (&ivls->lsq, f);
+        WRITE1 (ivls->code_size);
+        WRITE1 (ivls->by_residual);
+        write_ivf_invlists (ivls, f, detached);
     } else if(const IndexIVFSpectralHash *ivsp =
               dynamic_cast<const IndexIVFSpectralHash *>(idx)) {
         uint32_t h = fourcc ("IwSh");
         WRITE1 (h);
-        write_ivf_header (ivsp, f);
+        write_ivf_header (ivsp, f, detached);
         write_VectorTransform (ivsp->vt, f);
         WRITE1 (ivsp->nbit);
         WRITE1 (ivsp->period);
         WRITE1 (ivsp->threshold_type);
         WRITEVECTOR (ivsp->trained);
-        write_InvertedLists (ivsp->invlists, f);
+        write_ivf_invlists (ivsp, f, detached);
     } else if(const IndexIVFPQ * ivpq =
               dynamic_cast<const IndexIVFPQ *> (idx)) {
         const IndexIVFPQR * ivfpqr = dynamic_cast<const IndexIVFPQR *> (idx);
 
         uint32_t h = fourcc (ivfpqr ? "IwQR" : "IwPQ");
         WRITE1 (h);
-        write_ivf_header (ivpq, f);
+        write_ivf_header (ivpq, f, detached);
         WRITE1 (ivpq->by_residual);
         WRITE1 (ivpq->code_size);
         write_ProductQuantizer (&ivpq->pq, f);
-        write_InvertedLists (ivpq->invlists, f);
+        write_ivf_invlists (ivpq, f, detached);
         if (ivfpqr) {
             write_ProductQuantizer (&ivfpqr->refine_pq, f);
             WRITEVECTOR (ivfpqr->refine_codes);
             WRITE1 (ivfpqr->k_factor);
         }
 
+    } else if(const IndexIVFPQFastScan * ivpq =
+              dynamic_cast<const IndexIVFPQFastScan *> (idx)) {
+        uint32_t h = fourcc ("IwPf");
+        WRITE1 (h);
+        write_ivf_header (ivpq, f, detached);
+        WRITE1 (ivpq->by_residual);
+        WRITE1 (ivpq->code_size);
+        WRITE1 (ivpq->M2);
+        write_ProductQuantizer (&ivpq->pq, f);
+        write_ivf_invlists (ivpq, f, detached);
     } else if(const IndexPreTransform * ixpt =
               dynamic_cast<const IndexPreTransform *> (idx)) {
         uint32_t h = fourcc ("IxPT");
@@ -402,7 +613,7 @@ void write_index (const Index *idx, IOWriter *f) {
         WRITE1 (nt);
         for (int i = 0; i < nt; i++)
             write_VectorTransform (ixpt->chain[i], f);
-        write_index (ixpt->index, f);
+        write_index (ixpt->index, f, detached);
     } else if(const MultiIndexQuantizer * imiq =
               dynamic_cast<const MultiIndexQuantizer *> (idx)) {
         uint32_t h = fourcc ("Imiq");
@@ -414,9 +625,21 @@ void write_index (const Index *idx, IOWriter *f) {
         uint32_t h = fourcc ("IxRF");
         WRITE1 (h);
         write_index_header (idxrf, f);
-        write_index (idxrf->base_index, f);
-        write_index (&idxrf->refine_index, f);
+        write_index (idxrf->base_index, f, detached);
+        write_index (&idxrf->refine_index, f, detached);
         WRITE1 (idxrf->k_factor);
+    } else if(const IndexRefine * idxr =
+              dynamic_cast<const IndexRefine *> (idx)) {
+        // with the reconstruction errors of the adaptive refinement
+        uint32_t h = idxr->adaptive_refine ? fourcc ("IxRa") : fourcc ("IxRe");
+        WRITE1 (h);
+        write_index_header (idxr, f);
+        write_index (idxr->base_index, f, detached);
+        write_index (idxr->refine_index, f, detached);
+        WRITE1 (idxr->k_factor);
+        if (idxr->adaptive_refine) {
+            WRITEVECTOR (idxr->base_errors);
+        }
     } else if(const IndexIDMap * idxmap =
               dynamic_cast<const IndexIDMap *> (idx)) {
         uint32_t h =
@@ -425,7 +648,7 @@ void write_index (const Index *idx, IOWriter *f) {
         // no need to store additional info for IndexIDMap2
         WRITE1 (h);
         write_index_header (idxmap, f);
-        write_index (idxmap->index, f);
+        write_index (idxmap->index, f, detached);
         WRITEVECTOR (idxmap->id_map);
     } else if(const IndexHNSW * idxhnsw =
               dynamic_cast<const IndexHNSW *> (idx)) {
@@ -436,23 +659,222 @@ void write_index (const Index *idx, IOWriter *f) {
             dynamic_cast<const IndexHNSW2Level*>(idx) ? fourcc("IHN2") :
             0;
         FAISS_THROW_IF_NOT (h != 0);
+        if (!idxhnsw->node_to_label.empty()) {
+            uint32_t hl = fourcc ("IHNl");
+            WRITE1 (hl);
+            WRITEVECTOR (idxhnsw->node_to_label);
+        }
+        if (idxhnsw->hnsw.ndeleted > 0) {
+            // the deleted nodes and the labels are stored in prefix
+            // records, so that the other indexes keep the same format
+            uint32_t hd = fourcc ("IHNd");
+            WRITE1 (hd);
+            WRITEVECTOR (idxhnsw->hnsw.deleted);
+            WRITE1 (idxhnsw->hnsw.ndeleted);
+            WRITEVECTOR (idxhnsw->hnsw.free_slots);
+        }
+        if (idxhnsw->hnsw.links_compressed) {
+            // write_HNSW stores the offsets in the compressed links
+            uint32_t hc = fourcc ("IHNc");
+            WRITE1 (hc);
+            WRITEVECTOR (idxhnsw->hnsw.compressed_links);
+        }
         WRITE1 (h);
         write_index_header (idxhnsw, f);
         write_HNSW (&idxhnsw->hnsw, f);
-        write_index (idxhnsw->storage, f);
+        write_index (idxhnsw->storage, f, detached);
+    } else if(const IndexNSG * idxnsg =
+              dynamic_cast<const IndexNSG *> (idx)) {
+        uint32_t h =
+            dynamic_cast<const IndexNSGFlat*>(idx) ? fourcc("INSf") :
+            dynamic_cast<const IndexNSGPQ*>(idx)   ? fourcc("INSp") :
+            dynamic_cast<const IndexNSGSQ*>(idx)   ? fourcc("INSs") :
+            0;
+        FAISS_THROW_IF_NOT (h != 0);
+        WRITE1 (h);
+        write_index_header (idxnsg, f);
+        write_NSG (&idxnsg->nsg, f);
+        write_index (idxnsg->storage, f, detached);
+    } else if(const IndexDiskGraph * idxdg =
+              dynamic_cast<const IndexDiskGraph *> (idx)) {
+        // the file of vectors and links is referenced by name
+        uint32_t h = fourcc ("IxDG");
+        WRITE1 (h);
+        write_index_header (idxdg, f);
+        WRITE1 (idxdg->R);
+        write_ProductQuantizer (&idxdg->pq, f);
+        WRITEVECTOR (idxdg->codes);
+        WRITEVECTOR (idxdg->node_to_label);
+        WRITE1 (idxdg->entry_point);
+        WRITE1 (idxdg->search_L);
+        WRITE1 (idxdg->beam_width);
+        std::vector<char> fname (idxdg->filename.begin(),
+                                 idxdg->filename.end());
+        WRITEVECTOR (fname);
     } else {
       FAISS_THROW_MSG ("don't know how to serialize this type of index");
     }
 }
 
-void write_index (const Index *idx, FILE *f) {
+/// codec of the IO_FLAG_COMPRESS_* flags, 0 if none
+static int io_flags_codec (int io_flags) {
+    return (io_flags >> 8) & 3;
+}
+
+/* A compressed index is the fourcc "IxCz" followed by a compressed
+ * stream (see CompressedIOWriter) that contains the index. */
+void write_index (const Index *idx, IOWriter *f, int io_flags) {
+    int codec = io_flags_codec (io_flags);
+    if (codec == 0) {
+        write_index (idx, f, nullptr);
+        return;
+    }
+    uint32_t h = fourcc ("IxCz");
+    WRITE1 (h);
+    CompressedIOWriter cw (f, codec);
+    write_index (idx, &cw, nullptr);
+    cw.finish ();
+}
+
+void write_index (const Index *idx, FILE *f, int io_flags) {
     FileIOWriter writer(f);
-    write_index (idx, &writer);
+    write_index (idx, &writer, io_flags);
 }
 
-void write_index (const Index *idx, const char *fname) {
+void write_index (const Index *idx, const char *fname, int io_flags) {
     FileIOWriter writer(fname);
-    write_index (idx, &writer);
+    write_index (idx, &writer, io_flags);
+}
+
+/*************************************************************
+ * Index container
+ *
+ * header:    "IxCt", uint32 version, uint64 toc_offset, uint64 nsection
+ * sections:  "indx" the index, where the inverted lists of its IVF
+ *            index (if any) are replaced with a placeholder
+ *            "ivfl" these inverted lists (if any)
+ * toc:       for each section: fourcc type, uint64 offset, uint64 size,
+ *            uint64 checksum (IOChecksum)
+ *
+ * Compressed sections have the types "indz" and "ivfz" and contain the
+ * fourcc "IxCz" followed by a compressed stream (CompressedIOWriter),
+ * the size and checksum are those of the stored bytes.
+ *
+ * Offsets are relative to the start of the container. The sections
+ * are stored in this order, so the container can also be read
+ * sequentially. toc_offset is 0 when the writer cannot seek back to
+ * fill it in (eg. a pipe), the reader then reads sequentially.
+ **************************************************************/
+
+void write_index_container (const Index *idx, IOWriter *writer,
+                            int io_flags) {
+    int codec = io_flags_codec (io_flags);
+    const IndexIVF *ivf = ivflib::try_extract_index_ivf (idx);
+    const InvertedLists *detached = ivf ? ivf->invlists : nullptr;
+
+    // position of the container in the output, if toc_offset can be
+    // filled in there afterwards
+    VectorIOWriter *vwriter = dynamic_cast<VectorIOWriter*> (writer);
+    FileIOWriter *fwriter = dynamic_cast<FileIOWriter*> (writer);
+    long start = -1;
+    if (vwriter) {
+        start = vwriter->data.size();
+    }
+#ifndef _MSC_VER
+    if (fwriter && fflush (fwriter->f) == 0 &&
+        !(fcntl (::fileno (fwriter->f), F_GETFL) & O_APPEND)) {
+        start = ftell (fwriter->f);
+    }
+#endif // !_MSC_VER
+
+    ChecksumIOWriter cw (writer);
+    IOWriter *f = &cw;
+
+    uint32_t h = fourcc ("IxCt");
+    WRITE1 (h);
+    uint32_t version = 1;
+    WRITE1 (version);
+    uint64_t toc_offset = 0;
+    WRITE1 (toc_offset);
+    uint64_t nsection = detached ? 2 : 1;
+    WRITE1 (nsection);
+
+    std::vector<uint32_t> types;
+    std::vector<uint64_t> offsets, sizes, checksums;
+
+    auto begin_section = [&] (const char *type) {
+        types.push_back (fourcc (type));
+        offsets.push_back (cw.nbytes);
+        cw.checksum = IOChecksum ();
+    };
+    auto end_section = [&] () {
+        sizes.push_back (cw.nbytes - offsets.back());
+        checksums.push_back (cw.checksum.value());
+    };
+
+    uint32_t hz = fourcc ("IxCz");
+    if (codec) {
+        begin_section ("indz");
+        WRITE1 (hz);
+        CompressedIOWriter cz (f, codec);
+        write_index (idx, &cz, detached);
+        cz.finish ();
+    } else {
+        begin_section ("indx");
+        write_index (idx, f, detached);
+    }
+    end_section ();
+
+    if (detached && codec) {
+        begin_section ("ivfz");
+        WRITE1 (hz);
+        CompressedIOWriter cz (f, codec);
+        write_InvertedLists (detached, &cz);
+        cz.finish ();
+        end_section ();
+    } else if (detached) {
+        begin_section ("ivfl");
+        write_InvertedLists (detached, f);
+        end_section ();
+    }
+
+    toc_offset = cw.nbytes;
+    for (size_t i = 0; i < types.size(); i++) {
+        WRITE1 (types[i]);
+        WRITE1 (offsets[i]);
+        WRITE1 (sizes[i]);
+        WRITE1 (checksums[i]);
+    }
+
+    // toc_offset follows the fourcc and version
+    size_t toc_offset_pos = 2 * sizeof(uint32_t);
+    if (vwriter && start >= 0) {
+        memcpy (vwriter->data.data() + start + toc_offset_pos,
+                &toc_offset, sizeof(toc_offset));
+    }
+#ifndef _MSC_VER
+    if (fwriter && start >= 0) {
+        FAISS_THROW_IF_NOT_FMT (fflush (fwriter->f) == 0,
+                                "write error in %s: %s",
+                                writer->name.c_str(), strerror(errno));
+        ssize_t ret = pwrite (::fileno (fwriter->f), &toc_offset,
+                              sizeof(toc_offset), start + toc_offset_pos);
+        FAISS_THROW_IF_NOT_FMT (ret == sizeof(toc_offset),
+                                "write error in %s: %s",
+                                writer->name.c_str(), strerror(errno));
+    }
+#endif // !_MSC_VER
+}
+
+void write_index_container (const Index *idx, FILE *f, int io_flags) {
+    FileIOWriter writer(f);
+    write_index_container (idx, &writer, io_flags);
+}
+
+void write_index_container (const Index *idx, const char *fname,
+                            int io_flags) {
+    FileIOWriter writer(fname);
+    write_index_container (idx, &writer, io_flags);
 }
 
 void write_VectorTransform (const VectorTransform *vt, const char *fname) {
@@ -483,15 +905,16 @@ static void write_binary_ivf_header (const IndexBinaryIVF *ivf, IOWriter *f) {
 }
 
 static void write_binary_hash_invlists (
-        const IndexBinaryHash::InvertedListMap &invlists,
+        const BinaryHashTable &invlists,
         int b, IOWriter *f)
 {
-    size_t sz = invlists.size();
+    size_t sz = invlists.nkeys;
     WRITE1 (sz);
     size_t maxil = 0;
-    for (auto it = invlists.begin(); it != invlists.end(); ++it) {
-        if(it->second.ids.size() > maxil) {
-            maxil = it->second.ids.size();
+    for (size_t s = 0; s < invlists.capacity(); s++) {
+        if (invlists.keys[s] != BinaryHashTable::empty_key &&
+            invlists.bucket_size(s) > maxil) {
+            maxil = invlists.bucket_size(s);
         }
     }
     int il_nbit = 0;
@@ -506,15 +929,25 @@ static void write_binary_hash_invlists (
     // buffer for bitstrings
     std::vector<uint8_t> buf (((b + il_nbit) * sz + 7) / 8);
     BitstringWriter wr (buf.data(), buf.size());
-    for (auto it = invlists.begin(); it != invlists.end(); ++it) {
-        wr.write (it->first, b);
-        wr.write (it->second.ids.size(), il_nbit);
+    for (size_t s = 0; s < invlists.capacity(); s++) {
+        if (invlists.keys[s] != BinaryHashTable::empty_key) {
+            wr.write (invlists.keys[s], b);
+            wr.write (invlists.bucket_size(s), il_nbit);
+        }
     }
     WRITEVECTOR (buf);
 
-    for (auto it = invlists.begin(); it != invlists.end(); ++it) {
-        WRITEVECTOR (it->second.ids);
-        WRITEVECTOR (it->second.vecs);
+    // same layout as a pair of vectors per bucket
+    for (size_t s = 0; s < invlists.capacity(); s++) {
+        if (invlists.keys[s] == BinaryHashTable::empty_key) {
+            continue;
+        }
+        size_t nid = invlists.bucket_size(s);
+        WRITE1 (nid);
+        WRITEANDCHECK (invlists.bucket_ids(s), nid);
+        size_t ncode = nid * invlists.code_size;
+        WRITE1 (ncode);
+        WRITEANDCHECK (invlists.bucket_codes(s), ncode);
     }
 }
 
@@ -528,16 +961,20 @@ static void write_binary_multi_hash_map(
         id_bits++;
     }
     WRITE1(id_bits);
-    size_t sz = map.size();
+    size_t sz = map.nkeys;
     WRITE1(sz);
     size_t nbit = (b + id_bits) * sz + ntotal * id_bits;
     std::vector<uint8_t> buf((nbit + 7) / 8);
     BitstringWriter wr (buf.data(), buf.size());
-    for (auto it = map.begin(); it != map.end(); ++it) {
-        wr.write(it->first, b);
-        wr.write(it->second.size(), id_bits);
-        for (auto id : it->second) {
-            wr.write(id, id_bits);
+    for (size_t s = 0; s < map.capacity(); s++) {
+        if (map.keys[s] == BinaryHashTable::empty_key) {
+            continue;
+        }
+        wr.write(map.keys[s], b);
+        wr.write(map.bucket_size(s), id_bits);
+        const Index::idx_t *ids = map.bucket_ids(s);
+        for (size_t j = 0; j < map.bucket_size(s); j++) {
+            wr.write(ids[j], id_bits);
         }
     }
     WRITEVECTOR (buf);
@@ -564,6 +1001,8 @@ void write_index_binary (const IndexBinary *idx, IOWriter *f) {
         write_index (idxff->index, f);
     } else if (const IndexBinaryHNSW *idxhnsw =
                dynamic_cast<const IndexBinaryHNSW *> (idx)) {
+        FAISS_THROW_IF_NOT_MSG (!idxhnsw->hnsw.links_compressed,
+                                "cannot write compressed binary HNSW links");
         uint32_t h = fourcc ("IBHf");
         WRITE1 (h);
         write_index_binary_header (idxhnsw, f);
@@ -10,9 +10,30 @@
 #include <algorithm>
 #include <cstring>
 #include <cassert>
+#include <exception>
+
+#ifndef _MSC_VER
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <omp.h>
+
+#ifdef FAISS_ENABLE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef FAISS_ENABLE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef FAISS_ENABLE_LZ4
+#include <lz4.h>
+#endif
 
 #include <faiss/impl/io.h>
 #include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/utils.h>
 
 
 namespace faiss {
@@ -241,6 +262,631 @@ BufferedIOWriter::~BufferedIOWriter()
 
 
 
+/***********************************************************************
+ * Checksummed reader + writer
+ ***********************************************************************/
+
+void IOChecksum::update (const void *data, size_t nbytes)
+{
+    const uint8_t *p = (const uint8_t*)data;
+    uint64_t a = this->a, b = this->b;
+    for (size_t i = 0; i < nbytes; i++) {
+        a += p[i];
+        b += a;
+    }
+    this->a = a;
+    this->b = b;
+}
+
+uint64_t IOChecksum::value () const
+{
+    return (b * 0x9E3779B97F4A7C15ULL) ^ a;
+}
+
+ChecksumIOReader::ChecksumIOReader(IOReader *reader): reader(reader)
+{
+    name = reader->name;
+}
+
+size_t ChecksumIOReader::operator()(void *ptr, size_t size, size_t nitems)
+{
+    size_t ret = (*reader)(ptr, size, nitems);
+    checksum.update (ptr, size * ret);
+    nbytes += size * ret;
+    return ret;
+}
+
+ChecksumIOWriter::ChecksumIOWriter(IOWriter *writer): writer(writer)
+{
+    name = writer->name;
+}
+
+size_t ChecksumIOWriter::operator()(
+        const void *ptr, size_t size, size_t nitems)
+{
+    size_t ret = (*writer)(ptr, size, nitems);
+    checksum.update (ptr, size * ret);
+    nbytes += size * ret;
+    return ret;
+}
+
+/***********************************************************************
+ * Compressed reader + writer
+ ***********************************************************************/
+
+size_t compressed_io_block_size = 4 * 1024 * 1024;
+int compressed_io_level = 0;
+
+bool io_codec_available (int codec)
+{
+    switch (codec) {
+#ifdef FAISS_ENABLE_ZLIB
+      case IO_CODEC_ZLIB: return true;
+#endif
+#ifdef FAISS_ENABLE_ZSTD
+      case IO_CODEC_ZSTD: return true;
+#endif
+#ifdef FAISS_ENABLE_LZ4
+      case IO_CODEC_LZ4: return true;
+#endif
+      default: return false;
+    }
+}
+
+namespace {
+
+size_t compress_bound (int codec, size_t n)
+{
+    switch (codec) {
+#ifdef FAISS_ENABLE_ZLIB
+      case IO_CODEC_ZLIB: return compressBound (n);
+#endif
+#ifdef FAISS_ENABLE_ZSTD
+      case IO_CODEC_ZSTD: return ZSTD_compressBound (n);
+#endif
+#ifdef FAISS_ENABLE_LZ4
+      case IO_CODEC_LZ4: return LZ4_compressBound (n);
+#endif
+      default: return 0;
+    }
+}
+
+/// @return the compressed size, 0 if compression failed
+size_t compress_block (int codec, const uint8_t *src, size_t n,
+                       uint8_t *dst, size_t capacity)
+{
+    int level = compressed_io_level;
+    switch (codec) {
+#ifdef FAISS_ENABLE_ZLIB
+      case IO_CODEC_ZLIB: {
+          uLongf size = capacity;
+          int ret = compress2 (dst, &size, src, n,
+                               level == 0 ? Z_DEFAULT_COMPRESSION : level);
+          return ret == Z_OK ? size : 0;
+      }
+#endif
+#ifdef FAISS_ENABLE_ZSTD
+      case IO_CODEC_ZSTD: {
+          size_t ret = ZSTD_compress (dst, capacity, src, n, level);
+          return ZSTD_isError (ret) ? 0 : ret;
+      }
+#endif
+#ifdef FAISS_ENABLE_LZ4
+      case IO_CODEC_LZ4: {
+          // for lz4 the level is the acceleration factor
+          int ret = LZ4_compress_fast ((const char*)src, (char*)dst, n,
+                                       capacity, std::max (level, 1));
+          return ret > 0 ? ret : 0;
+      }
+#endif
+      default: return 0;
+    }
+}
+
+/// @return whether exactly n_raw bytes were decompressed
+bool decompress_block (int codec, const uint8_t *src, size_t n,
+                       uint8_t *dst, size_t n_raw)
+{
+    switch (codec) {
+#ifdef FAISS_ENABLE_ZLIB
+      case IO_CODEC_ZLIB: {
+          uLongf size = n_raw;
+          int ret = uncompress (dst, &size, src, n);
+          return ret == Z_OK && size == n_raw;
+      }
+#endif
+#ifdef FAISS_ENABLE_ZSTD
+      case IO_CODEC_ZSTD: {
+          size_t ret = ZSTD_decompress (dst, n_raw, src, n);
+          return !ZSTD_isError (ret) && ret == n_raw;
+      }
+#endif
+#ifdef FAISS_ENABLE_LZ4
+      case IO_CODEC_LZ4: {
+          int ret = LZ4_decompress_safe ((const char*)src, (char*)dst,
+                                         n, n_raw);
+          return ret >= 0 && size_t(ret) == n_raw;
+      }
+#endif
+      default: return false;
+    }
+}
+
+// blocks are limited by the int sizes of lz4
+const size_t max_compressed_block_size = size_t(1) << 30;
+
+} // anonymous namespace
+
+CompressedIOWriter::CompressedIOWriter (IOWriter *writer, int codec):
+    writer (writer), codec (codec)
+{
+    name = writer->name;
+    FAISS_THROW_IF_NOT_FMT (io_codec_available (codec),
+                            "compression codec %d not available in this "
+                            "build", codec);
+    uint32_t c = codec;
+    FAISS_THROW_IF_NOT_FMT ((*writer)(&c, sizeof(c), 1) == 1,
+                            "write error in %s", name.c_str());
+}
+
+size_t CompressedIOWriter::operator()(
+        const void *ptr, size_t size, size_t nitems)
+{
+    FAISS_THROW_IF_NOT (!finished);
+    FAISS_THROW_IF_NOT (compressed_io_block_size > 0 &&
+                        compressed_io_block_size <=
+                            max_compressed_block_size);
+    size_t capacity = compressed_io_block_size * omp_get_max_threads ();
+    const uint8_t *src = (const uint8_t*)ptr;
+    size_t n = size * nitems;
+    while (n > 0) {
+        size_t nb = std::min (n, capacity - std::min (capacity, buffer.size()));
+        buffer.insert (buffer.end(), src, src + nb);
+        src += nb;
+        n -= nb;
+        if (buffer.size() >= capacity) {
+            flush ();
+        }
+    }
+    nbytes += size * nitems;
+    return nitems;
+}
+
+void CompressedIOWriter::flush ()
+{
+    size_t bs = compressed_io_block_size;
+    size_t nblock = (buffer.size() + bs - 1) / bs;
+    std::vector<std::vector<uint8_t> > stored (nblock);
+    std::vector<size_t> stored_sizes (nblock);
+
+#pragma omp parallel for schedule(dynamic)
+    for (size_t i = 0; i < nblock; i++) {
+        size_t n = std::min (bs, buffer.size() - i * bs);
+        std::vector<uint8_t> & out = stored[i];
+        out.resize (compress_bound (codec, n));
+        stored_sizes[i] = compress_block (codec, buffer.data() + i * bs, n,
+                                          out.data(), out.size());
+    }
+
+    for (size_t i = 0; i < nblock; i++) {
+        const uint8_t *raw = buffer.data() + i * bs;
+        uint64_t raw_size = std::min (bs, buffer.size() - i * bs);
+        // incompressible blocks are stored as is
+        uint64_t stored_size = stored_sizes[i];
+        const uint8_t *data = stored[i].data();
+        if (stored_size == 0 || stored_size >= raw_size) {
+            stored_size = raw_size;
+            data = raw;
+        }
+        bool ok =
+            (*writer)(&raw_size, sizeof(raw_size), 1) == 1 &&
+            (*writer)(&stored_size, sizeof(stored_size), 1) == 1 &&
+            (*writer)(data, 1, stored_size) == stored_size;
+        FAISS_THROW_IF_NOT_FMT (ok, "write error in %s", name.c_str());
+    }
+    buffer.clear ();
+}
+
+void CompressedIOWriter::finish ()
+{
+    if (finished) {
+        return;
+    }
+    flush ();
+    uint64_t end = 0;
+    FAISS_THROW_IF_NOT_FMT ((*writer)(&end, sizeof(end), 1) == 1,
+                            "write error in %s", name.c_str());
+    finished = true;
+}
+
+CompressedIOWriter::~CompressedIOWriter ()
+{
+    // do not throw while an exception is propagated
+    if (!finished && !std::uncaught_exception ()) {
+        finish ();
+    }
+}
+
+CompressedIOReader::CompressedIOReader (IOReader *reader): reader (reader)
+{
+    name = reader->name;
+    uint32_t c;
+    FAISS_THROW_IF_NOT_FMT ((*reader)(&c, sizeof(c), 1) == 1,
+                            "read error in %s", name.c_str());
+    codec = c;
+    FAISS_THROW_IF_NOT_FMT (io_codec_available (codec),
+                            "%s: compression codec %d not available in "
+                            "this build", name.c_str(), codec);
+}
+
+size_t CompressedIOReader::operator()(void *ptr, size_t size, size_t nitems)
+{
+    size_t n = size * nitems;
+    if (n == 0) return 0;
+    uint8_t *dst = (uint8_t*)ptr;
+    size_t nb = 0;
+    while (nb < n) {
+        if (b0 == buffer.size()) {
+            if (at_end) {
+                break;
+            }
+            // read the next blocks, one per thread
+            std::vector<uint64_t> raw_sizes;
+            std::vector<std::vector<uint8_t> > stored;
+            int nt = omp_get_max_threads ();
+            while (raw_sizes.size() < size_t(nt)) {
+                uint64_t raw_size, stored_size;
+                FAISS_THROW_IF_NOT_FMT (
+                      (*reader)(&raw_size, sizeof(raw_size), 1) == 1,
+                      "read error in %s: truncated compressed stream",
+                      name.c_str());
+                if (raw_size == 0) {
+                    at_end = true;
+                    break;
+                }
+                FAISS_THROW_IF_NOT_FMT (
+                      (*reader)(&stored_size, sizeof(stored_size), 1) == 1 &&
+                      raw_size <= max_compressed_block_size &&
+                      stored_size <= raw_size,
+                      "read error in %s: invalid compressed block",
+                      name.c_str());
+                stored.emplace_back (stored_size);
+                FAISS_THROW_IF_NOT_FMT (
+                      (*reader)(stored.back().data(), 1, stored_size) ==
+                          stored_size,
+                      "read error in %s: truncated compressed stream",
+                      name.c_str());
+                raw_sizes.push_back (raw_size);
+            }
+
+            std::vector<size_t> offsets (raw_sizes.size() + 1);
+            for (size_t i = 0; i < raw_sizes.size(); i++) {
+                offsets[i + 1] = offsets[i] + raw_sizes[i];
+            }
+            buffer.resize (offsets.back());
+            b0 = 0;
+            bool ok = true;
+
+#pragma omp parallel for schedule(dynamic)
+            for (size_t i = 0; i < raw_sizes.size(); i++) {
+                uint8_t *out = buffer.data() + offsets[i];
+                const std::vector<uint8_t> & in = stored[i];
+                if (in.size() == raw_sizes[i]) {
+                    memcpy (out, in.data(), in.size());
+                } else if (!decompress_block (codec, in.data(), in.size(),
+                                              out, raw_sizes[i])) {
+#pragma omp critical
+                    ok = false;
+                }
+            }
+            FAISS_THROW_IF_NOT_FMT (ok, "read error in %s: corrupted "
+                                    "compressed block", name.c_str());
+            continue;
+        }
+        size_t nb2 = std::min (buffer.size() - b0, n - nb);
+        memcpy (dst + nb, buffer.data() + b0, nb2);
+        b0 += nb2;
+        nb += nb2;
+    }
+    return nb / size;
+}
+
+void CompressedIOReader::finish ()
+{
+    FAISS_THROW_IF_NOT_FMT (b0 == buffer.size(),
+                            "%s: compressed data was not read completely",
+                            name.c_str());
+    if (at_end) {
+        return;
+    }
+    uint64_t end;
+    FAISS_THROW_IF_NOT_FMT ((*reader)(&end, sizeof(end), 1) == 1 && end == 0,
+                            "%s: compressed data was not read completely",
+                            name.c_str());
+    at_end = true;
+}
+
+/***********************************************************************
+ * Memory-mapped reads
+ ***********************************************************************/
+
+MmappedFileRange::MmappedFileRange(): ptr(nullptr), size(0), data(nullptr)
+{}
+
+MmappedFileRange::~MmappedFileRange()
+{
+#ifndef _MSC_VER
+    if (ptr) {
+        munmap (ptr, size);
+    }
+#endif
+}
+
+std::shared_ptr<MmappedFileRange> mmap_next_range (
+        FileIOReader *reader, size_t nbytes)
+{
+#ifdef _MSC_VER
+    FAISS_THROW_MSG ("memory mapping not supported on Windows");
+#else
+    FILE *f = reader->f;
+    long ofs = ftell (f);
+    FAISS_THROW_IF_NOT_FMT (ofs >= 0, "ftell failed on %s: %s",
+                            reader->name.c_str(), strerror(errno));
+
+    struct stat buf;
+    int ret = fstat (::fileno (f), &buf);
+    FAISS_THROW_IF_NOT_FMT (ret == 0, "fstat failed: %s", strerror(errno));
+    FAISS_THROW_IF_NOT_FMT (ofs + nbytes <= (size_t)buf.st_size,
+                            "read error in %s: file too short",
+                            reader->name.c_str());
+
+    std::shared_ptr<MmappedFileRange> range (new MmappedFileRange());
+    if (nbytes > 0) {
+        size_t page_size = sysconf (_SC_PAGESIZE);
+        size_t ofs0 = ofs / page_size * page_size;
+        range->size = ofs - ofs0 + nbytes;
+        void *ptr = mmap (nullptr, range->size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE, ::fileno (f), ofs0);
+        FAISS_THROW_IF_NOT_FMT (ptr != MAP_FAILED,
+                                "could not mmap %s: %s",
+                                reader->name.c_str(), strerror(errno));
+        range->ptr = ptr;
+        range->data = (uint8_t*)ptr + (ofs - ofs0);
+    }
+
+    ret = fseek (f, ofs + nbytes, SEEK_SET);
+    FAISS_THROW_IF_NOT_FMT (ret == 0, "fseek failed: %s", strerror(errno));
+    return range;
+#endif
+}
+
+
+/***********************************************************************
+ * Parallel positional reads and writes
+ ***********************************************************************/
+
+size_t parallel_io_min_size = 64 * 1024 * 1024;
+size_t parallel_io_block_size = 16 * 1024 * 1024;
+
+#ifndef _MSC_VER
+
+namespace {
+
+/// a piece of a transfer, handled by one thread
+struct IOBlock {
+    uint8_t *ptr;
+    size_t ofs;     ///< offset in the file
+    size_t nbytes;
+};
+
+/// cut the ranges, stored contiguously in the file from ofs, into blocks
+std::vector<IOBlock> make_io_blocks (
+        const std::vector<uint8_t*> & ptrs,
+        const std::vector<size_t> & sizes,
+        size_t ofs)
+{
+    std::vector<IOBlock> blocks;
+    for (size_t i = 0; i < ptrs.size(); i++) {
+        for (size_t j = 0; j < sizes[i]; j += parallel_io_block_size) {
+            IOBlock b;
+            b.ptr = ptrs[i] + j;
+            b.ofs = ofs + j;
+            b.nbytes = std::min (parallel_io_block_size, sizes[i] - j);
+            blocks.push_back (b);
+        }
+        ofs += sizes[i];
+    }
+    return blocks;
+}
+
+/// run pread or pwrite on all blocks, returns the errno of a failure or 0
+template <class TransferFn>
+int run_io_blocks (const std::vector<IOBlock> & blocks, TransferFn fn)
+{
+    int err = 0;
+
+#pragma omp parallel for schedule(dynamic)
+    for (size_t i = 0; i < blocks.size(); i++) {
+        const IOBlock & b = blocks[i];
+        size_t done = 0;
+        while (done < b.nbytes) {
+            ssize_t ret = fn (b.ptr + done, b.nbytes - done, b.ofs + done);
+            if (ret <= 0) {
+                if (ret < 0 && errno == EINTR) continue;
+#pragma omp critical
+                err = ret < 0 ? errno : EIO;
+                break;
+            }
+            done += ret;
+        }
+    }
+
+    return err;
+}
+
+size_t total_size (const std::vector<size_t> & sizes)
+{
+    size_t tot = 0;
+    for (size_t s : sizes) {
+        tot += s;
+    }
+    return tot;
+}
+
+} // anonymous namespace
+
+#endif // !_MSC_VER
+
+bool pread_next_ranges (
+        FileIOReader *reader,
+        const std::vector<void*> & ptrs,
+        const std::vector<size_t> & sizes)
+{
+#ifdef _MSC_VER
+    return false;
+#else
+    FAISS_THROW_IF_NOT (ptrs.size() == sizes.size());
+    size_t nbytes = total_size (sizes);
+    if (nbytes < parallel_io_min_size) {
+        return false;
+    }
+
+    FILE *f = reader->f;
+    long ofs = ftell (f);
+    if (ofs < 0) { // not seekable
+        return false;
+    }
+
+    struct stat buf;
+    int ret = fstat (::fileno (f), &buf);
+    FAISS_THROW_IF_NOT_FMT (ret == 0, "fstat failed: %s", strerror(errno));
+    if (!S_ISREG (buf.st_mode)) {
+        return false;
+    }
+    FAISS_THROW_IF_NOT_FMT (ofs + nbytes <= (size_t)buf.st_size,
+                            "read error in %s: file too short",
+                            reader->name.c_str());
+
+    std::vector<uint8_t*> ptrs8 (ptrs.size());
+    for (size_t i = 0; i < ptrs.size(); i++) {
+        ptrs8[i] = (uint8_t*)ptrs[i];
+    }
+
+    int fd = ::fileno (f);
+    int err = run_io_blocks (
+        make_io_blocks (ptrs8, sizes, ofs),
+        [fd] (uint8_t *p, size_t n, size_t o) {
+            return ::pread (fd, p, n, o);
+        });
+    FAISS_THROW_IF_NOT_FMT (err == 0, "read error in %s: %s",
+                            reader->name.c_str(), strerror(err));
+
+    ret = fseek (f, ofs + nbytes, SEEK_SET);
+    FAISS_THROW_IF_NOT_FMT (ret == 0, "fseek failed: %s", strerror(errno));
+    return true;
+#endif
+}
+
+bool pwrite_next_ranges (
+        FileIOWriter *writer,
+        const std::vector<const void*> & ptrs,
+        const std::vector<size_t> & sizes)
+{
+#ifdef _MSC_VER
+    return false;
+#else
+    FAISS_THROW_IF_NOT (ptrs.size() == sizes.size());
+    size_t nbytes = total_size (sizes);
+    if (nbytes < parallel_io_min_size) {
+        return false;
+    }
+
+    FILE *f = writer->f;
+    int fd = ::fileno (f);
+
+    // pwrite ignores the offset for files opened in append mode
+    struct stat buf;
+    if (fstat (fd, &buf) != 0 || !S_ISREG (buf.st_mode) ||
+        (fcntl (fd, F_GETFL) & O_APPEND)) {
+        return false;
+    }
+
+    int ret = fflush (f);
+    FAISS_THROW_IF_NOT_FMT (ret == 0, "write error in %s: %s",
+                            writer->name.c_str(), strerror(errno));
+    long ofs = ftell (f);
+    if (ofs < 0) {
+        return false;
+    }
+
+    // pwrite does not modify the data
+    std::vector<uint8_t*> ptrs8 (ptrs.size());
+    for (size_t i = 0; i < ptrs.size(); i++) {
+        ptrs8[i] = (uint8_t*)ptrs[i];
+    }
+
+    int err = run_io_blocks (
+        make_io_blocks (ptrs8, sizes, ofs),
+        [fd] (uint8_t *p, size_t n, size_t o) {
+            return ::pwrite (fd, p, n, o);
+        });
+    FAISS_THROW_IF_NOT_FMT (err == 0, "write error in %s: %s",
+                            writer->name.c_str(), strerror(err));
+
+    ret = fseek (f, ofs + nbytes, SEEK_SET);
+    FAISS_THROW_IF_NOT_FMT (ret == 0, "fseek failed: %s", strerror(errno));
+    return true;
+#endif
+}
+
+/***********************************************************************
+ * Sampled reads
+ ***********************************************************************/
+
+void read_rows_subset (
+        IOReader *f, size_t line_size,
+        const int64_t *ids, size_t k, uint8_t *out)
+{
+    if (k == 0) {
+        return;
+    }
+    for (size_t i = 1; i < k; i++) {
+        FAISS_THROW_IF_NOT_MSG (ids[i - 1] < ids[i],
+                                "row ids must be increasing");
+    }
+    FAISS_THROW_IF_NOT (ids[0] >= 0);
+    size_t nrow = ids[k - 1] + 1;
+
+#ifndef _MSC_VER
+    FileIOReader *fr = dynamic_cast<FileIOReader*> (f);
+    struct stat st;
+    if (fr && ftell (fr->f) >= 0 &&
+        fstat (::fileno (fr->f), &st) == 0 && S_ISREG (st.st_mode)) {
+        std::shared_ptr<MmappedFileRange> range =
+            mmap_next_range (fr, nrow * line_size);
+        gather_rows (line_size, range->data, ids, k, out);
+        return;
+    }
+#endif
+
+    // sequential reads by blocks of about 1 MiB
+    size_t bs = std::max (size_t(1), (size_t(1) << 20) / line_size);
+    std::vector<uint8_t> buf (bs * line_size);
+    size_t j = 0;
+    for (size_t i0 = 0; i0 < nrow; i0 += bs) {
+        size_t i1 = std::min (i0 + bs, nrow);
+        size_t nr = (*f) (buf.data(), line_size, i1 - i0);
+        FAISS_THROW_IF_NOT_FMT (nr == i1 - i0,
+                                "read error in %s: %zd != %zd (%s)",
+                                f->name.c_str(), nr, i1 - i0,
+                                strerror(errno));
+        for (; j < k && ids[j] < i1; j++) {
+            memcpy (out + j * line_size,
+                    buf.data() + (ids[j] - i0) * line_size, line_size);
+        }
+    }
+}
+
 uint32_t fourcc (const  char sx[4]) {
     assert(4 == strlen(sx));
     const unsigned char *x = (unsigned char*)sx;
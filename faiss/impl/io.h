@@ -18,6 +18,7 @@
 
 #include <string>
 #include <cstdio>
+#include <memory>
 #include <vector>
 
 #include <faiss/Index.h>
@@ -142,6 +143,191 @@ struct BufferedIOWriter: IOWriter {
     ~BufferedIOWriter() override;
 };
 
+/*******************************************************
+ * Checksummed reader + writer
+ *
+ * They forward to another reader or writer, and count and checksum
+ * the bytes that go through. Used for the sections of index
+ * containers.
+ *******************************************************/
+
+/** Fletcher-style checksum of a byte stream, with sums modulo 2^64. It
+ * can be updated incrementally and does not depend on how the stream
+ * is split in calls to update. */
+struct IOChecksum {
+    uint64_t a = 0, b = 0;
+
+    void update (const void *data, size_t nbytes);
+
+    uint64_t value () const;
+};
+
+struct ChecksumIOReader: IOReader {
+    IOReader *reader;
+    size_t nbytes = 0;   ///< number of bytes read
+    IOChecksum checksum;
+
+    explicit ChecksumIOReader(IOReader *reader);
+
+    size_t operator()(void *ptr, size_t size, size_t nitems) override;
+};
+
+struct ChecksumIOWriter: IOWriter {
+    IOWriter *writer;
+    size_t nbytes = 0;   ///< number of bytes written
+    IOChecksum checksum;
+
+    explicit ChecksumIOWriter(IOWriter *writer);
+
+    size_t operator()(const void *ptr, size_t size, size_t nitems) override;
+};
+
+/*******************************************************
+ * Compressed reader + writer
+ *
+ * The stream is cut into blocks of compressed_io_block_size bytes that
+ * are compressed independently, so that several blocks can be
+ * (de)compressed in parallel. The format is:
+ *
+ *   uint32 codec
+ *   for each block: uint64 raw_size, uint64 stored_size, stored data
+ *   uint64 0  (end of stream)
+ *
+ * A block is stored uncompressed when stored_size == raw_size.
+ *******************************************************/
+
+/// compression codecs, the available ones depend on the build
+enum IOCompressionCodec {
+    IO_CODEC_ZLIB = 1,
+    IO_CODEC_ZSTD = 2,
+    IO_CODEC_LZ4 = 3,
+};
+
+/// whether faiss was built with this codec
+bool io_codec_available (int codec);
+
+/// size of the independently compressed blocks
+extern size_t compressed_io_block_size;
+
+/// compression level, 0 = default level of the codec
+extern int compressed_io_level;
+
+struct CompressedIOWriter: IOWriter {
+    IOWriter *writer;
+    int codec;
+    bool finished = false;
+    size_t nbytes = 0;    ///< number of bytes received from caller
+    /// uncompressed data, flushed when it contains as many blocks as
+    /// there are threads
+    std::vector<uint8_t> buffer;
+
+    /// writes the codec to writer
+    CompressedIOWriter (IOWriter *writer, int codec);
+
+    size_t operator()(const void *ptr, size_t size, size_t nitems) override;
+
+    /// compress and write the buffer
+    void flush ();
+
+    /// flush and write the end of stream, called by the destructor if
+    /// needed
+    void finish ();
+
+    ~CompressedIOWriter() override;
+};
+
+struct CompressedIOReader: IOReader {
+    IOReader *reader;
+    int codec;
+    bool at_end = false;  ///< the end of stream was read
+    std::vector<uint8_t> buffer;  ///< decompressed data
+    size_t b0 = 0;        ///< nb of bytes of buffer returned to caller
+
+    /// reads the codec from reader
+    explicit CompressedIOReader (IOReader *reader);
+
+    size_t operator()(void *ptr, size_t size, size_t nitems) override;
+
+    /// read the end of stream, so that reader is just after it. Throws
+    /// if the caller did not read all the data
+    void finish ();
+};
+
+/*******************************************************
+ * Memory-mapped reads
+ *******************************************************/
+
+/// a range of a file mapped in memory, unmapped when destroyed
+struct MmappedFileRange {
+    void *ptr;       ///< start of the mapping (page-aligned)
+    size_t size;     ///< size of the mapping
+    uint8_t *data;   ///< start of the requested range in the mapping
+
+    MmappedFileRange();
+    ~MmappedFileRange();
+};
+
+/** map the next nbytes of the file in memory and skip them in the
+ * reader. The mapping is private and copy-on-write: modifications of the
+ * data are not written back to the file. */
+std::shared_ptr<MmappedFileRange> mmap_next_range (
+        FileIOReader *reader, size_t nbytes);
+
+
+/*******************************************************
+ * Parallel positional reads and writes
+ *
+ * Large arrays whose position in the file is known in advance (the
+ * inverted lists, whose sizes are stored before the data, and the flat
+ * codes) are transferred with pread / pwrite from several threads, by
+ * blocks of at most parallel_io_block_size bytes. This does not change
+ * the file format.
+ *******************************************************/
+
+/// transfers smaller than this are done sequentially
+extern size_t parallel_io_min_size;
+
+/// size of the blocks transferred by one thread
+extern size_t parallel_io_block_size;
+
+/** read the next bytes of the file into the buffers ptrs[i] of sizes
+ * sizes[i] (which are contiguous and in this order in the file), and
+ * skip them in the reader.
+ *
+ * @return  false, without reading anything, if the total size is below
+ *          parallel_io_min_size or the file does not support positional
+ *          reads (eg. a pipe). The caller should then read sequentially.
+ */
+bool pread_next_ranges (
+        FileIOReader *reader,
+        const std::vector<void*> & ptrs,
+        const std::vector<size_t> & sizes);
+
+/// same as pread_next_ranges, for writes
+bool pwrite_next_ranges (
+        FileIOWriter *writer,
+        const std::vector<const void*> & ptrs,
+        const std::vector<size_t> & sizes);
+
+
+/*******************************************************
+ * Sampled reads
+ *******************************************************/
+
+/** read the rows ids[0..k-1] of a stream of rows of line_size bytes into
+ * out (size k * line_size), and skip the stream up to the end of the
+ * last one.
+ *
+ * The ids must be increasing (eg. from rand_subset), so that a training
+ * set is sampled in one pass from a file that does not fit in RAM. A
+ * regular file read by a FileIOReader is memory-mapped and the rows are
+ * copied by several threads, other readers are read sequentially.
+ */
+void read_rows_subset (
+        IOReader *f, size_t line_size,
+        const int64_t *ids, size_t k, uint8_t *out);
+
+
 /// cast a 4-character string to a uint32_t that can be written and read easily
 uint32_t fourcc (const char sx[4]);
 uint32_t fourcc (const std::string & sx);
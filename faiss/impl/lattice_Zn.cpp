@@ -446,13 +446,18 @@ ZnSphereCodec::ZnSphereCodec(int dim, int r2):
 }
 
 uint64_t ZnSphereCodec::search_and_encode(const float *x) const {
-    std::vector<float> tmp(dim * 2);
+    std::vector<float> tmp(dim * 4);
     std::vector<int> tmp_int(dim);
+    return search_and_encode(x, tmp.data(), tmp_int.data());
+}
+
+uint64_t ZnSphereCodec::search_and_encode(const float *x,
+                                          float *tmp, int *tmp_int) const {
     int ano; // atom number
-    std::vector<float> c(dim);
-    search(x, c.data(), tmp.data(), tmp_int.data(), &ano);
+    float *c = tmp + 2 * dim;
+    float *cabs = tmp + 3 * dim;
+    search(x, c, tmp, tmp_int, &ano);
     uint64_t signs = 0;
-    std::vector<float> cabs(dim);
     int nnz = 0;
     for (int i = 0; i < dim; i++) {
         cabs[i] = fabs(c[i]);
@@ -466,7 +471,7 @@ uint64_t ZnSphereCodec::search_and_encode(const float *x) const {
     const CodeSegment &cs = code_segments[ano];
     assert(nnz == cs.signbits);
     uint64_t code = cs.c0 + signs;
-    code += cs.encode(cabs.data()) << cs.signbits;
+    code += cs.encode(cabs) << cs.signbits;
     return code;
 }
 
@@ -599,6 +604,13 @@ uint64_t ZnSphereCodecRec::encode_centroid(const float *c) const
 {
     std::vector<uint64_t> codes(dim);
     std::vector<int> norm2s(dim);
+    return encode_centroid(c, codes.data(), norm2s.data());
+}
+
+uint64_t ZnSphereCodecRec::encode_centroid(const float *c,
+                                           uint64_t *codes,
+                                           int *norm2s) const
+{
     for(int i = 0; i < dim; i++) {
         if (c[i] == 0) {
             codes[i] = 0;
@@ -635,6 +647,12 @@ void ZnSphereCodecRec::decode(uint64_t code, float *c) const
 {
     std::vector<uint64_t> codes(dim);
     std::vector<int> norm2s(dim);
+    decode(code, c, codes.data(), norm2s.data());
+}
+
+void ZnSphereCodecRec::decode(uint64_t code, float *c,
+                              uint64_t *codes, int *norm2s) const
+{
     codes[0] = code;
     norm2s[0] = r2;
 
@@ -724,5 +742,47 @@ void ZnSphereCodecAlt::decode(uint64_t code, float *c) const
     }
 }
 
+void ZnSphereCodecAlt::encode_multi(size_t n, const float *x,
+                                    uint64_t *codes) const
+{
+#pragma omp parallel if (n > 1000)
+    {
+        std::vector<float> tmp(dim * 4);
+        std::vector<int> tmp_int(dim);
+        std::vector<uint64_t> tmp_codes(dim);
+#pragma omp for
+        for (int64_t i = 0; i < n; i++) {
+            const float *xi = x + i * dim;
+            if (!use_rec) {
+                codes[i] = search_and_encode(xi, tmp.data(), tmp_int.data());
+            } else {
+                float *centroid = tmp.data() + 2 * dim;
+                search(xi, centroid, tmp.data(), tmp_int.data());
+                codes[i] = znc_rec.encode_centroid(
+                     centroid, tmp_codes.data(), tmp_int.data());
+            }
+        }
+    }
+}
+
+void ZnSphereCodecAlt::decode_multi(size_t n, const uint64_t *codes,
+                                    float *c) const
+{
+#pragma omp parallel if (n > 1000)
+    {
+        std::vector<uint64_t> tmp_codes(dim);
+        std::vector<int> tmp_int(dim);
+#pragma omp for
+        for (int64_t i = 0; i < n; i++) {
+            if (!use_rec) {
+                ZnSphereCodec::decode(codes[i], c + i * dim);
+            } else {
+                znc_rec.decode(codes[i], c + i * dim,
+                               tmp_codes.data(), tmp_int.data());
+            }
+        }
+    }
+}
+
 
 } // namespace faiss
@@ -69,12 +69,12 @@ struct EnumeratedVectors {
     virtual void decode(uint64_t code, float *c) const = 0;
 
     // call encode on nc vectors
-    void encode_multi (size_t nc, const float *c,
-                       uint64_t * codes) const;
+    virtual void encode_multi (size_t nc, const float *c,
+                               uint64_t * codes) const;
 
     // call decode on nc codes
-    void decode_multi (size_t nc, const uint64_t * codes,
-                       float *c) const;
+    virtual void decode_multi (size_t nc, const uint64_t * codes,
+                               float *c) const;
 
     // find the nearest neighbor of each xq
     // (decodes and computes distances)
@@ -132,6 +132,12 @@ struct ZnSphereCodec: ZnSphereSearch, EnumeratedVectors {
 
     uint64_t search_and_encode(const float *x) const;
 
+    /// full call. Requires externally-allocated temp space
+    uint64_t search_and_encode(const float *x,
+                               float *tmp, // size 4 * dim
+                               int *tmp_int // size dim
+                               ) const;
+
     void decode(uint64_t code, float *c) const override;
 
     /// takes vectors that do not need to be centroids
@@ -156,8 +162,20 @@ struct ZnSphereCodecRec: EnumeratedVectors {
 
     uint64_t encode_centroid(const float *c) const;
 
+    /// full call. Requires externally-allocated temp space
+    uint64_t encode_centroid(const float *c,
+                             uint64_t *tmp_codes, // size dim
+                             int *tmp_norm2s // size dim
+                             ) const;
+
     void decode(uint64_t code, float *c) const override;
 
+    /// full call. Requires externally-allocated temp space
+    void decode(uint64_t code, float *c,
+                uint64_t *tmp_codes, // size dim
+                int *tmp_norm2s // size dim
+                ) const;
+
     /// vectors need to be centroids (does not work on arbitrary
     /// vectors)
     uint64_t encode(const float *x) const override;
@@ -190,6 +208,13 @@ struct ZnSphereCodecAlt: ZnSphereCodec {
 
     void decode(uint64_t code, float *c) const override;
 
+    /// batched versions that allocate the temp space once per thread
+    void encode_multi (size_t nc, const float *c,
+                       uint64_t * codes) const override;
+
+    void decode_multi (size_t nc, const uint64_t * codes,
+                       float *c) const override;
+
 };
 
 
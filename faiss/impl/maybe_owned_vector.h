@@ -0,0 +1,189 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include <faiss/utils/hugepages.h>
+
+namespace faiss {
+
+/** Array that either owns its data in a std::vector or is a view on
+ * memory owned by someone else, typically a memory-mapped index file.
+ *
+ * The view keeps a reference to the owner of the memory, so that the
+ * mapping stays valid as long as it is used. The elements of a view can be
+ * modified in place (the file mappings are copy-on-write), but any
+ * operation that changes the size first copies the data to an owned
+ * vector. Copies of a MaybeOwnedVector are always owned, so that they are
+ * independent of the original.
+ *
+ * The owned data is allocated with HugePageAllocator, so that it can be
+ * backed by huge pages (see hugepage_mode).
+ *
+ * The interface is the subset of std::vector that is used on the large
+ * index arrays.
+ */
+template <typename T>
+struct MaybeOwnedVector {
+    typedef T value_type;
+    typedef T *iterator;
+    typedef const T *const_iterator;
+
+    typedef std::vector<T, HugePageAllocator<T> > owned_vector_t;
+    owned_vector_t owned_data;
+
+    /// view mode: the data is not in owned_data
+    bool is_owned = true;
+    T *view_data = nullptr;
+    size_t view_size = 0;
+    std::shared_ptr<void> owner;
+
+    MaybeOwnedVector() {}
+
+    explicit MaybeOwnedVector(size_t n): owned_data(n) {}
+
+    MaybeOwnedVector(const std::vector<T> & v):
+        owned_data(v.begin(), v.end()) {}
+
+    MaybeOwnedVector(owned_vector_t && v): owned_data(std::move(v)) {}
+
+    MaybeOwnedVector(const MaybeOwnedVector & other):
+        owned_data(other.begin(), other.end()) {}
+
+    MaybeOwnedVector(MaybeOwnedVector && other) = default;
+
+    MaybeOwnedVector & operator = (const MaybeOwnedVector & other) {
+        if (this != &other) {
+            owned_vector_t tmp(other.begin(), other.end());
+            *this = MaybeOwnedVector(std::move(tmp));
+        }
+        return *this;
+    }
+
+    MaybeOwnedVector & operator = (MaybeOwnedVector && other) = default;
+
+    /// make a view on n elements at ptr, owner keeps the memory alive
+    static MaybeOwnedVector create_view(
+            T *ptr, size_t n, std::shared_ptr<void> owner) {
+        MaybeOwnedVector v;
+        v.is_owned = false;
+        v.view_data = ptr;
+        v.view_size = n;
+        v.owner = std::move(owner);
+        return v;
+    }
+
+    /// copy the data of a view to an owned vector
+    void make_owned() {
+        if (!is_owned) {
+            owned_data.assign(view_data, view_data + view_size);
+            is_owned = true;
+            view_data = nullptr;
+            view_size = 0;
+            owner.reset();
+        }
+    }
+
+    T *data() {
+        return is_owned ? owned_data.data() : view_data;
+    }
+
+    const T *data() const {
+        return is_owned ? owned_data.data() : view_data;
+    }
+
+    size_t size() const {
+        return is_owned ? owned_data.size() : view_size;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    T & operator [] (size_t i) {
+        return data()[i];
+    }
+
+    const T & operator [] (size_t i) const {
+        return data()[i];
+    }
+
+    T *begin() { return data(); }
+    T *end() { return data() + size(); }
+    const T *begin() const { return data(); }
+    const T *end() const { return data() + size(); }
+
+    T & back() { return data()[size() - 1]; }
+    const T & back() const { return data()[size() - 1]; }
+
+    void resize(size_t n) {
+        make_owned();
+        owned_data.resize(n);
+    }
+
+    void resize(size_t n, const T & value) {
+        make_owned();
+        owned_data.resize(n, value);
+    }
+
+    void assign(size_t n, const T & value) {
+        make_owned();
+        owned_data.assign(n, value);
+    }
+
+    void reserve(size_t n) {
+        make_owned();
+        owned_data.reserve(n);
+    }
+
+    void clear() {
+        *this = MaybeOwnedVector();
+    }
+
+    void push_back(const T & value) {
+        make_owned();
+        owned_data.push_back(value);
+    }
+
+    /// insert the range [first, last) before pos, which is a pointer in
+    /// this array
+    template <class InputIt>
+    T *insert(const T *pos, InputIt first, InputIt last) {
+        size_t ofs = pos - data();
+        make_owned();
+        auto it = owned_data.insert(owned_data.begin() + ofs, first, last);
+        return owned_data.data() + (it - owned_data.begin());
+    }
+
+    void swap(MaybeOwnedVector & other) {
+        std::swap(*this, other);
+    }
+
+    bool operator == (const MaybeOwnedVector & other) const {
+        if (size() != other.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < size(); i++) {
+            if (!(data()[i] == other.data()[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool operator != (const MaybeOwnedVector & other) const {
+        return !(*this == other);
+    }
+};
+
+} // namespace faiss
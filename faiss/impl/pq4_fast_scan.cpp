@@ -0,0 +1,199 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <faiss/impl/pq4_fast_scan.h>
+
+#include <cstring>
+
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/simd_result_handlers.h>
+#include <faiss/utils/simdlib.h>
+
+
+namespace faiss {
+
+
+/***************************************************************
+ * Packing functions for codes
+ ***************************************************************/
+
+namespace {
+
+// byte that contains sub-quantizer sq of vector vector_id
+inline size_t packed_byte_offset (size_t M2, size_t vector_id, size_t sq) {
+    size_t b = vector_id / pq4_bbs;
+    size_t v = vector_id % 16;
+    size_t p = 2 * (v % 8) + v / 8;
+    return b * pq4_block_size(M2) + (sq / 2) * 32 + (sq % 2) * 16 + p;
+}
+
+// the first 16 vectors of a block are in the low nibbles
+inline bool packed_is_high_nibble (size_t vector_id) {
+    return (vector_id % pq4_bbs) >= 16;
+}
+
+} // anonymous namespace
+
+
+uint8_t pq4_get_packed_element (
+        const uint8_t *blocks, size_t M2,
+        size_t vector_id, size_t sq)
+{
+    uint8_t byte = blocks[packed_byte_offset (M2, vector_id, sq)];
+    return packed_is_high_nibble (vector_id) ? byte >> 4 : byte & 15;
+}
+
+
+void pq4_set_packed_element (
+        uint8_t *blocks, size_t M2,
+        size_t vector_id, size_t sq, uint8_t code)
+{
+    uint8_t & byte = blocks[packed_byte_offset (M2, vector_id, sq)];
+    if (packed_is_high_nibble (vector_id)) {
+        byte = (byte & 0x0f) | (code << 4);
+    } else {
+        byte = (byte & 0xf0) | (code & 15);
+    }
+}
+
+
+void pq4_pack_codes_range (
+        const uint8_t *codes, size_t M,
+        size_t i0, size_t i1, size_t M2,
+        uint8_t *blocks)
+{
+    FAISS_THROW_IF_NOT (M2 >= M && M2 % 2 == 0);
+    size_t code_size = (M + 1) / 2;
+    for (size_t i = i0; i < i1; i++) {
+        const uint8_t *code = codes + (i - i0) * code_size;
+        for (size_t sq = 0; sq < M; sq++) {
+            uint8_t c = (code[sq / 2] >> ((sq & 1) * 4)) & 15;
+            pq4_set_packed_element (blocks, M2, i, sq, c);
+        }
+        for (size_t sq = M; sq < M2; sq++) {
+            pq4_set_packed_element (blocks, M2, i, sq, 0);
+        }
+    }
+}
+
+
+void pq4_get_code (
+        const uint8_t *blocks, size_t M, size_t M2,
+        size_t vector_id, uint8_t *code)
+{
+    memset (code, 0, (M + 1) / 2);
+    for (size_t sq = 0; sq < M; sq++) {
+        uint8_t c = pq4_get_packed_element (blocks, M2, vector_id, sq);
+        code[sq / 2] |= c << ((sq & 1) * 4);
+    }
+}
+
+
+/***************************************************************
+ * Packing functions for Look-Up Tables
+ ***************************************************************/
+
+void pq4_pack_LUT (int nq, size_t M2, const uint8_t *src, uint8_t *dest)
+{
+    // for each pair of sub-quantizers, the LUTs of the nq queries are
+    // consecutive so that the kernel reads them sequentially
+    for (size_t j = 0; j < M2 / 2; j++) {
+        for (int q = 0; q < nq; q++) {
+            for (int l = 0; l < 2; l++) {
+                memcpy (dest + ((j * nq + q) * 2 + l) * 16,
+                        src + (q * M2 + 2 * j + l) * 16,
+                        16);
+            }
+        }
+    }
+}
+
+
+/***************************************************************
+ * Accumulation kernel
+ ***************************************************************/
+
+namespace {
+
+template<int NQ>
+void accumulate_fixed_nq (
+        size_t nb, size_t M2,
+        const uint8_t *codes, const uint8_t *LUT,
+        SIMDResultHandler & res)
+{
+    const simd32uint8 mask (0xf);
+
+    for (size_t b = 0; b < nb; b++) {
+        simd16uint16 accu[NQ][4];
+        for (int q = 0; q < NQ; q++) {
+            for (int i = 0; i < 4; i++) {
+                accu[q][i].clear();
+            }
+        }
+
+        const uint8_t *LUTp = LUT;
+        for (size_t sq = 0; sq < M2; sq += 2) {
+            simd32uint8 c;
+            c.loadu (codes);
+            codes += 32;
+
+            simd32uint8 clo = c & mask;
+            simd32uint8 chi = simd32uint8 (simd16uint16 (c) >> 4) & mask;
+
+            for (int q = 0; q < NQ; q++) {
+                simd32uint8 lut;
+                lut.loadu (LUTp);
+                LUTp += 32;
+
+                simd32uint8 res0 = lut.lookup_2_lanes (clo);
+                simd32uint8 res1 = lut.lookup_2_lanes (chi);
+
+                // the even bytes are recovered from the 16-bit sums by
+                // subtracting the odd ones, see below
+                accu[q][0] += simd16uint16 (res0);
+                accu[q][1] += simd16uint16 (res0) >> 8;
+                accu[q][2] += simd16uint16 (res1);
+                accu[q][3] += simd16uint16 (res1) >> 8;
+            }
+        }
+
+        for (int q = 0; q < NQ; q++) {
+            accu[q][0] -= accu[q][1] << 8;
+            simd16uint16 dis0 = combine2x2 (accu[q][0], accu[q][1]);
+            accu[q][2] -= accu[q][3] << 8;
+            simd16uint16 dis1 = combine2x2 (accu[q][2], accu[q][3]);
+            res.handle (q, b, dis0, dis1);
+        }
+    }
+}
+
+} // anonymous namespace
+
+
+void pq4_accumulate_loop (
+        int nq, size_t nb, size_t M2,
+        const uint8_t *codes, const uint8_t *LUT,
+        SIMDResultHandler & res)
+{
+    FAISS_THROW_IF_NOT (M2 % 2 == 0 && M2 <= 256);
+    switch (nq) {
+#define DISPATCH(NQ)                                            \
+    case NQ:                                                    \
+        accumulate_fixed_nq<NQ> (nb, M2, codes, LUT, res);      \
+        break
+        DISPATCH(1);
+        DISPATCH(2);
+        DISPATCH(3);
+        DISPATCH(4);
+#undef DISPATCH
+    default:
+        FAISS_THROW_FMT ("accumulate nq=%d not instanciated", nq);
+    }
+}
+
+
+} // namespace faiss
@@ -0,0 +1,110 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+
+
+/** PQ4 SIMD packing and accumulation functions
+ *
+ * The basic kernel accumulates nq query vectors with 32 database vectors
+ * (one block) and writes the results in two simd16uint16 registers that are
+ * passed to a SIMDResultHandler (see simd_result_handlers.h).
+ *
+ * The codes are 4-bit PQ codes with M2 sub-quantizers (M rounded up to an
+ * even number). For each block of 32 vectors and each pair of sub-quantizers
+ * (2j, 2j + 1), 32 bytes are stored: bytes 0..15 hold the codes of
+ * sub-quantizer 2j and bytes 16..31 those of 2j + 1. Within a 16-byte half,
+ * byte 2e + o (0 <= e < 8, o = 0 or 1) contains the code of vector e + 8 * o
+ * in its low nibble and the code of vector 16 + e + 8 * o in its high nibble.
+ *
+ * With this layout, the LUTs of 2 sub-quantizers fit in one 256-bit register
+ * and the lookups are done with one pshufb per nibble. The order of the
+ * vectors is chosen so that the 16-bit accumulators come out in the natural
+ * order without additional shuffling.
+ *
+ * The LUTs of all queries are uint8, with M2 * 16 entries per query.
+ */
+
+namespace faiss {
+
+/// number of database vectors per block in the packed layout
+constexpr size_t pq4_bbs = 32;
+
+/// size in bytes of a block of pq4_bbs packed codes
+inline size_t pq4_block_size (size_t M2) {
+    return M2 * pq4_bbs / 2;
+}
+
+/** Pack codes for consumption by the SIMD kernels.
+ *
+ * @param codes   input codes of vectors i0..i1-1, in the ProductQuantizer
+ *                nbits=4 format, size (i1 - i0) * ceil(M / 2)
+ * @param M       number of sub-quantizers of the input codes
+ * @param i0      first vector number to write in the packed array
+ * @param i1      end of the range of vectors to write
+ * @param M2      number of sub-quantizers of the packed array (M rounded up
+ *                to a multiple of 2)
+ * @param blocks  output array, size at least
+ *                ceil(i1 / pq4_bbs) * pq4_block_size(M2). The unused nibbles
+ *                of the last block are left untouched (should be 0).
+ */
+void pq4_pack_codes_range (
+        const uint8_t *codes, size_t M,
+        size_t i0, size_t i1, size_t M2,
+        uint8_t *blocks);
+
+/// get sub-quantizer sq of vector vector_id in the packed array
+uint8_t pq4_get_packed_element (
+        const uint8_t *blocks, size_t M2,
+        size_t vector_id, size_t sq);
+
+/// set sub-quantizer sq of vector vector_id in the packed array
+void pq4_set_packed_element (
+        uint8_t *blocks, size_t M2,
+        size_t vector_id, size_t sq, uint8_t code);
+
+/** extract the ProductQuantizer-format code of a vector from the packed array
+ *
+ * @param code  output code, size ceil(M / 2)
+ */
+void pq4_get_code (
+        const uint8_t *blocks, size_t M, size_t M2,
+        size_t vector_id, uint8_t *code);
+
+/** Pack the LUTs of nq queries for the kernel.
+ *
+ * @param nq    number of queries, at most 4
+ * @param M2    number of sub-quantizers (even)
+ * @param src   input LUTs, size nq * M2 * 16
+ * @param dest  output, same size
+ */
+void pq4_pack_LUT (int nq, size_t M2, const uint8_t *src, uint8_t *dest);
+
+struct SIMDResultHandler;
+
+/** Run the accumulation kernel on nb blocks of packed codes.
+ *
+ * The handler is called for each (query, block) pair.
+ *
+ * @param nq      number of queries, at most 4
+ * @param nb      number of blocks of pq4_bbs database vectors
+ * @param M2      number of sub-quantizers (even, at most 256)
+ * @param codes   packed codes, size nb * pq4_block_size(M2)
+ * @param LUT     LUTs packed with pq4_pack_LUT
+ */
+void pq4_accumulate_loop (
+        int nq, size_t nb, size_t M2,
+        const uint8_t *codes, const uint8_t *LUT,
+        SIMDResultHandler & res);
+
+/// maximum number of queries handled by one pq4_accumulate_loop call
+constexpr int pq4_max_nq = 4;
+
+} // namespace faiss
@@ -0,0 +1,390 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/impl/pq_code_distance.h>
+
+#include <faiss/utils/cpu_dispatch.h>
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef FAISS_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+namespace faiss {
+
+namespace {
+
+void pq_code_distances_8bit_ref (size_t code_size, const float *tab,
+                                 const uint8_t *codes, size_t n, float *dis)
+{
+    for (size_t j = 0; j < n; j++) {
+        const float *t = tab;
+        float accu = 0;
+        for (size_t m = 0; m < code_size; m++) {
+            accu += t[*codes++];
+            t += 256;
+        }
+        dis[j] = accu;
+    }
+}
+
+void pq_code_distances_8bit_u16_ref (size_t code_size,
+                                     const uint16_t *tab_q,
+                                     const uint8_t *codes, size_t n,
+                                     uint32_t *dis)
+{
+    for (size_t j = 0; j < n; j++) {
+        const uint16_t *t = tab_q;
+        uint32_t accu = 0;
+        for (size_t m = 0; m < code_size; m++) {
+            accu += t[*codes++];
+            t += 256;
+        }
+        dis[j] = accu;
+    }
+}
+
+} // anonymous namespace
+
+
+/*********************************************************
+ * AVX2 implementation, selected at runtime
+ */
+
+#ifdef FAISS_X86_DISPATCH
+
+namespace {
+
+// offsets of the tables of 8 consecutive sub-quantizers
+FAISS_AVX2_TARGET
+inline __m256i table_offsets_avx2 ()
+{
+    return _mm256_setr_epi32 (0, 256, 512, 768, 1024, 1280, 1536, 1792);
+}
+
+/// table entries of the 8 sub-quantizers starting at code
+FAISS_AVX2_TARGET
+inline __m256 gather_8_avx2 (const float *tab, const uint8_t *code,
+                             __m256i offsets)
+{
+    __m256i idx = _mm256_cvtepu8_epi32 (
+          _mm_loadl_epi64 ((const __m128i*)code));
+    return _mm256_i32gather_ps (tab, _mm256_add_epi32 (idx, offsets), 4);
+}
+
+/// horizontal sum of a, in the same order as each of the sums of
+/// horizontal_sums_8_avx2: ((a0 + a1) + (a2 + a3)) + ((a4 + a5) + (a6 + a7))
+FAISS_AVX2_TARGET
+inline float horizontal_sum_8_avx2 (__m256 a)
+{
+    __m256 h = _mm256_hadd_ps (a, a);
+    h = _mm256_hadd_ps (h, h);
+    return _mm_cvtss_f32 (_mm_add_ss (_mm256_castps256_ps128 (h),
+                                      _mm256_extractf128_ps (h, 1)));
+}
+
+/// the 8 horizontal sums of a[0..7], in order
+FAISS_AVX2_TARGET
+inline __m256 horizontal_sums_8_avx2 (const __m256 *a)
+{
+    __m256 h01 = _mm256_hadd_ps (a[0], a[1]);
+    __m256 h23 = _mm256_hadd_ps (a[2], a[3]);
+    __m256 h45 = _mm256_hadd_ps (a[4], a[5]);
+    __m256 h67 = _mm256_hadd_ps (a[6], a[7]);
+    __m256 h0123 = _mm256_hadd_ps (h01, h23);
+    __m256 h4567 = _mm256_hadd_ps (h45, h67);
+    return _mm256_add_ps (_mm256_permute2f128_ps (h0123, h4567, 0x20),
+                          _mm256_permute2f128_ps (h0123, h4567, 0x31));
+}
+
+// CS > 0 is the code size, known at compile time. Same summation order
+// as the codes processed by 8 in pq_code_distances_8bit_avx2, so that
+// the distance of a code does not depend on its position. Requires
+// code_size >= 8.
+template<size_t CS>
+FAISS_AVX2_TARGET
+float code_distance_avx2 (size_t code_size, const float *tab,
+                          const uint8_t *code)
+{
+    if (CS > 0) {
+        code_size = CS;
+    }
+    const __m256i offsets = table_offsets_avx2 ();
+    __m256 accu = gather_8_avx2 (tab, code, offsets);
+    size_t m = 8;
+    for (; m + 8 <= code_size; m += 8) {
+        accu = _mm256_add_ps (accu,
+              gather_8_avx2 (tab + m * 256, code + m, offsets));
+    }
+    float dis = horizontal_sum_8_avx2 (accu);
+    for (; m < code_size; m++) {
+        dis += tab[m * 256 + code[m]];
+    }
+    return dis;
+}
+
+FAISS_AVX2_TARGET
+float sum_entries_avx2 (size_t code_size, const float *entries)
+{
+    __m256 accu = _mm256_loadu_ps (entries);
+    size_t m = 8;
+    for (; m + 8 <= code_size; m += 8) {
+        accu = _mm256_add_ps (accu, _mm256_loadu_ps (entries + m));
+    }
+    float dis = horizontal_sum_8_avx2 (accu);
+    for (; m < code_size; m++) {
+        dis += entries[m];
+    }
+    return dis;
+}
+
+template<size_t CS>
+FAISS_AVX2_TARGET
+void pq_code_distances_8bit_avx2 (size_t code_size, const float *tab,
+                                  const uint8_t *codes, size_t n, float *dis)
+{
+    if (CS > 0) {
+        code_size = CS;
+    }
+    const __m256i offsets = table_offsets_avx2 ();
+    size_t m8 = code_size & ~size_t(7);
+    size_t j = 0;
+
+    // 8 codes at a time, so that their sums are reduced together
+    for (; j + 8 <= n; j += 8) {
+        const uint8_t *c = codes + j * code_size;
+        __m256 accu[8];
+        for (int i = 0; i < 8; i++) {
+            accu[i] = gather_8_avx2 (tab, c + i * code_size, offsets);
+        }
+        for (size_t m = 8; m < m8; m += 8) {
+            for (int i = 0; i < 8; i++) {
+                accu[i] = _mm256_add_ps (accu[i], gather_8_avx2 (
+                      tab + m * 256, c + i * code_size + m, offsets));
+            }
+        }
+        __m256 sums = horizontal_sums_8_avx2 (accu);
+        _mm256_storeu_ps (dis + j, sums);
+        for (size_t m = m8; m < code_size; m++) {
+            const float *t = tab + m * 256;
+            for (int i = 0; i < 8; i++) {
+                dis[j + i] += t[c[i * code_size + m]];
+            }
+        }
+    }
+
+    for (; j < n; j++) {
+        dis[j] = code_distance_avx2<CS> (
+              code_size, tab, codes + j * code_size);
+    }
+}
+
+/// the loops over the sub-quantizers are unrolled for the common M
+void pq_code_distances_8bit_avx2_dispatch (
+        size_t code_size, const float *tab,
+        const uint8_t *codes, size_t n, float *dis)
+{
+    switch (code_size) {
+#define DISPATCH(CS) \
+    case CS: \
+        pq_code_distances_8bit_avx2<CS> (code_size, tab, codes, n, dis); \
+        return;
+        DISPATCH (8)
+        DISPATCH (16)
+        DISPATCH (32)
+        DISPATCH (64)
+#undef DISPATCH
+    default:
+        pq_code_distances_8bit_avx2<0> (code_size, tab, codes, n, dis);
+    }
+}
+
+/// 16-bit table entries of the 8 sub-quantizers starting at code. The
+/// 32-bit loads read one entry past the table of the last sub-quantizer,
+/// hence the padding of the tables
+FAISS_AVX2_TARGET
+inline __m256i gather_8_u16_avx2 (const uint16_t *tab_q, const uint8_t *code,
+                                  __m256i offsets)
+{
+    __m256i idx = _mm256_add_epi32 (
+          _mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((const __m128i*)code)),
+          offsets);
+    __m256i v = _mm256_i32gather_epi32 ((const int*)tab_q, idx, 2);
+    return _mm256_and_si256 (v, _mm256_set1_epi32 (0xffff));
+}
+
+/// the 8 horizontal sums of a[0..7], in order
+FAISS_AVX2_TARGET
+inline __m256i horizontal_sums_8_epi32_avx2 (const __m256i *a)
+{
+    __m256i h01 = _mm256_hadd_epi32 (a[0], a[1]);
+    __m256i h23 = _mm256_hadd_epi32 (a[2], a[3]);
+    __m256i h45 = _mm256_hadd_epi32 (a[4], a[5]);
+    __m256i h67 = _mm256_hadd_epi32 (a[6], a[7]);
+    __m256i h0123 = _mm256_hadd_epi32 (h01, h23);
+    __m256i h4567 = _mm256_hadd_epi32 (h45, h67);
+    return _mm256_add_epi32 (
+          _mm256_permute2x128_si256 (h0123, h4567, 0x20),
+          _mm256_permute2x128_si256 (h0123, h4567, 0x31));
+}
+
+FAISS_AVX2_TARGET
+void pq_code_distances_8bit_u16_avx2 (size_t code_size,
+                                      const uint16_t *tab_q,
+                                      const uint8_t *codes, size_t n,
+                                      uint32_t *dis)
+{
+    const __m256i offsets = table_offsets_avx2 ();
+    size_t m8 = code_size & ~size_t(7);
+    size_t j = 0;
+
+    // 8 codes at a time, so that their sums are reduced together
+    for (; j + 8 <= n; j += 8) {
+        const uint8_t *c = codes + j * code_size;
+        __m256i accu[8];
+        for (int i = 0; i < 8; i++) {
+            accu[i] = gather_8_u16_avx2 (tab_q, c + i * code_size, offsets);
+        }
+        for (size_t m = 8; m < m8; m += 8) {
+            for (int i = 0; i < 8; i++) {
+                accu[i] = _mm256_add_epi32 (accu[i], gather_8_u16_avx2 (
+                      tab_q + m * 256, c + i * code_size + m, offsets));
+            }
+        }
+        __m256i sums = horizontal_sums_8_epi32_avx2 (accu);
+        _mm256_storeu_si256 ((__m256i*)(dis + j), sums);
+        for (size_t m = m8; m < code_size; m++) {
+            const uint16_t *t = tab_q + m * 256;
+            for (int i = 0; i < 8; i++) {
+                dis[j + i] += t[c[i * code_size + m]];
+            }
+        }
+    }
+
+    pq_code_distances_8bit_u16_ref (code_size, tab_q, codes + j * code_size,
+                                    n - j, dis + j);
+}
+
+} // anonymous namespace
+
+#endif
+
+
+/*********************************************************
+ * Runtime dispatch
+ */
+
+bool pq_code_distances_8bit_is_simd (size_t code_size)
+{
+#ifdef FAISS_X86_DISPATCH
+    // below 8 sub-quantizers the scalar lookups are as fast
+    return code_size >= 8 && use_avx2 ();
+#else
+    return false;
+#endif
+}
+
+void pq_code_distances_8bit (size_t code_size, const float *tab,
+                             const uint8_t *codes, size_t n, float *dis)
+{
+#ifdef FAISS_X86_DISPATCH
+    // the 16-wide AVX-512 gathers are not faster than 2 AVX2 gathers
+    if (code_size >= 8 && use_avx2 ()) {
+        pq_code_distances_8bit_avx2_dispatch (code_size, tab, codes, n, dis);
+        return;
+    }
+#endif
+    pq_code_distances_8bit_ref (code_size, tab, codes, n, dis);
+}
+
+float pq_sum_entries_8bit (size_t code_size, const float *entries)
+{
+#ifdef FAISS_X86_DISPATCH
+    if (code_size >= 8 && use_avx2 ()) {
+        return sum_entries_avx2 (code_size, entries);
+    }
+#endif
+    float accu = 0;
+    for (size_t m = 0; m < code_size; m++) {
+        accu += entries[m];
+    }
+    return accu;
+}
+
+void pq_quantize_tables_u16 (size_t code_size, const float *tab,
+                             uint16_t *tab_q, float *scale, float *bias)
+{
+    // a shared scale, so that the integer sums are comparable
+    float max_span = 0;
+    float sum_min = 0;
+    for (size_t m = 0; m < code_size; m++) {
+        const float *t = tab + m * 256;
+        float vmin = t[0], vmax = t[0];
+        for (int c = 1; c < 256; c++) {
+            vmin = std::min (vmin, t[c]);
+            vmax = std::max (vmax, t[c]);
+        }
+        max_span = std::max (max_span, vmax - vmin);
+        sum_min += vmin;
+    }
+
+    float s = max_span > 0 ? max_span / 65535 : 1;
+    float inv_s = 1 / s;
+    for (size_t m = 0; m < code_size; m++) {
+        const float *t = tab + m * 256;
+        float vmin = *std::min_element (t, t + 256);
+        uint16_t *tq = tab_q + m * 256;
+        for (int c = 0; c < 256; c++) {
+            float v = std::floor ((t[c] - vmin) * inv_s + 0.5f);
+            tq[c] = (uint16_t)std::min (v, 65535.0f);
+        }
+    }
+    tab_q[code_size * 256] = 0;
+
+    *scale = s;
+    *bias = sum_min;
+}
+
+void pq_code_distances_8bit_u16 (size_t code_size, const uint16_t *tab_q,
+                                 const uint8_t *codes, size_t n,
+                                 uint32_t *dis)
+{
+#ifdef FAISS_X86_DISPATCH
+    if (code_size >= 8 && use_avx2 ()) {
+        pq_code_distances_8bit_u16_avx2 (code_size, tab_q, codes, n, dis);
+        return;
+    }
+#endif
+    pq_code_distances_8bit_u16_ref (code_size, tab_q, codes, n, dis);
+}
+
+void pq_pair_tables_4bit (size_t M, const float *tab, float *pair_tab)
+{
+    for (size_t i = 0; i + 1 < M; i += 2) {
+        const float *t0 = tab + i * 16;
+        const float *t1 = t0 + 16;
+        for (int c1 = 0; c1 < 16; c1++) {
+            for (int c0 = 0; c0 < 16; c0++) {
+                pair_tab[c1 * 16 + c0] = t0[c0] + t1[c1];
+            }
+        }
+        pair_tab += 256;
+    }
+    if (M % 2 == 1) {
+        // the high bits of the last byte are 0
+        const float *t0 = tab + (M - 1) * 16;
+        for (int c = 0; c < 256; c++) {
+            pair_tab[c] = t0[c & 15];
+        }
+    }
+}
+
+} // namespace faiss
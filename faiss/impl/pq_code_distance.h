@@ -0,0 +1,84 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Distance estimation from look-up tables for PQ codes where each byte
+ * of the code indexes a table of 256 entries (8-bit PQ, or pairs of
+ * 4-bit sub-quantizers combined in a single table).
+ *
+ * With AVX2 (see cpu_dispatch.h), the table entries of 8 sub-quantizers
+ * are fetched with a single gather, and the sums of 8 codes are reduced
+ * together. The distance of a code does not depend on its position among
+ * the n codes.
+ */
+
+namespace faiss {
+
+/** dis[j] = sum_m tab[m * 256 + codes[j * code_size + m]]
+ *
+ * @param code_size  nb of bytes per code (= M for 8-bit PQ)
+ * @param tab        look-up tables, size code_size * 256
+ * @param codes      codes, size n * code_size
+ * @param dis        output distances, size n
+ */
+void pq_code_distances_8bit (size_t code_size, const float *tab,
+                             const uint8_t *codes, size_t n, float *dis);
+
+/** sum of the code_size table entries of one code, entries[m] =
+ * tab[m * 256 + code[m]], with the same rounding as
+ * pq_code_distances_8bit. For codes whose entries are not stored in
+ * tables of 256 (eg. 4-bit codes whose pair tables are not built). */
+float pq_sum_entries_8bit (size_t code_size, const float *entries);
+
+/// whether pq_code_distances_8bit uses SIMD gathers for this code size,
+/// otherwise it is not faster than the scalar loops
+bool pq_code_distances_8bit_is_simd (size_t code_size);
+
+/** quantize look-up tables of 256 entries to 16 bits, with a scale
+ * shared by all the tables and a per-table offset, so that
+ *
+ * sum_m tab[m * 256 + c_m] ~= bias + scale * sum_m tab_q[m * 256 + c_m]
+ *
+ * @param code_size  nb of tables
+ * @param tab        input tables, size code_size * 256
+ * @param tab_q      output tables, size code_size * 256 + 1 (the last
+ *                   entry is padding for the SIMD gathers)
+ * @param scale      output scale
+ * @param bias       output bias, sum of the minima of the tables
+ */
+void pq_quantize_tables_u16 (size_t code_size, const float *tab,
+                             uint16_t *tab_q, float *scale, float *bias);
+
+/** integer version of pq_code_distances_8bit, with tables quantized by
+ * pq_quantize_tables_u16. The sums are exact, so the result does not
+ * depend on the SIMD level.
+ *
+ * dis[j] = sum_m tab_q[m * 256 + codes[j * code_size + m]]
+ */
+void pq_code_distances_8bit_u16 (size_t code_size, const uint16_t *tab_q,
+                                 const uint8_t *codes, size_t n,
+                                 uint32_t *dis);
+
+/** combine the tables of 4-bit sub-quantizers 2i and 2i+1 into one table
+ * of 256 entries, indexed by the byte that holds their two codes (low
+ * bits first, as in PQEncoderGeneric)
+ *
+ * pair_tab[i * 256 + (c1 << 4 | c0)] = tab[2i * 16 + c0] + tab[(2i+1) * 16 + c1]
+ *
+ * @param M         nb of sub-quantizers, if odd the last one is alone
+ * @param tab       input tables, size M * 16
+ * @param pair_tab  output tables, size (M + 1) / 2 * 256
+ */
+void pq_pair_tables_4bit (size_t M, const float *tab, float *pair_tab);
+
+} // namespace faiss
@@ -0,0 +1,149 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <faiss/Index.h>
+#include <faiss/utils/Heap.h>
+#include <faiss/utils/simdlib.h>
+
+
+/** This file contains callbacks for kernels that compute distances in SIMD
+ * registers (see pq4_fast_scan.h). The kernels produce 16-bit distances for
+ * blocks of 32 database vectors, the handlers decide what to keep.
+ */
+
+namespace faiss {
+
+
+struct SIMDResultHandler {
+
+    /** called when 32 distances are computed and provided in two
+     *  simd16uint16. (q, b) indicate which query (in the batch of queries
+     *  handled by the kernel) and which database block the distances belong
+     *  to. Distances of vectors b * 32 .. b * 32 + 15 are in d0, the next 16
+     *  are in d1. */
+    virtual void handle(size_t q, size_t b, simd16uint16 d0, simd16uint16 d1) = 0;
+
+    virtual ~SIMDResultHandler() {}
+};
+
+
+/** Heap-based handler that collects the k smallest distances per query.
+ *
+ * The 16-bit distances are quantized: the float distance is recovered as
+ *
+ *     dis = bias + d16 / scale
+ *
+ * where scale is per query and bias is per query and can be changed between
+ * calls to the kernel (eg. per inverted list). The results are accumulated in
+ * float max-heaps. The threshold of each heap is maintained in the 16-bit
+ * domain so that most candidates are discarded with one SIMD comparison.
+ */
+struct DequantizingHeapHandler: SIMDResultHandler {
+    using idx_t = Index::idx_t;
+    using C = CMax<float, idx_t>;
+
+    size_t k;            ///< number of results per query
+
+    /// number of valid entries in the scanned blocks (the last block is
+    /// padded)
+    size_t ntotal;
+
+    /// if non-null, ids of the scanned entries, otherwise
+    /// id_offset + the offset in the scanned array is used as id
+    const idx_t *ids;
+    idx_t id_offset;
+
+    // per-query fields, indexed by the query number in the batch
+    std::vector<float *> heap_dis;
+    std::vector<idx_t *> heap_ids;
+    std::vector<float> scale;
+    std::vector<float> bias;
+    std::vector<uint16_t> thresholds;
+
+    size_t nup;          ///< number of heap updates performed
+
+    DequantizingHeapHandler(size_t nq, size_t k):
+        k(k), ntotal(0), ids(nullptr), id_offset(0),
+        heap_dis(nq), heap_ids(nq), scale(nq), bias(nq),
+        thresholds(nq), nup(0)
+    {}
+
+    /// set the output heap of query q (the heap is not initialized)
+    void set_heap(size_t q, float *hd, idx_t *hi) {
+        heap_dis[q] = hd;
+        heap_ids[q] = hi;
+    }
+
+    /// set the quantization parameters of query q
+    void set_normalizers(size_t q, float scale_q, float bias_q) {
+        scale[q] = scale_q;
+        bias[q] = bias_q;
+        update_threshold(q);
+    }
+
+    /// does the current heap threshold of query q allow any result?
+    /// (all 16-bit distances are >= 0 so dis >= bias)
+    bool can_improve(size_t q) const {
+        return C::cmp(heap_dis[q][0], bias[q]);
+    }
+
+    void update_threshold(size_t q) {
+        float t = (heap_dis[q][0] - bias[q]) * scale[q];
+        if (!(t < 65535)) { // also covers the infinite / nan case
+            thresholds[q] = 65535;
+        } else if (t < 0) {
+            thresholds[q] = 0;
+        } else {
+            thresholds[q] = std::min(int(std::floor(t)) + 1, 65535);
+        }
+    }
+
+    void handle(size_t q, size_t b, simd16uint16 d0, simd16uint16 d1) override
+    {
+        simd16uint16 thr(thresholds[q]);
+        uint32_t lt_mask = cmp_le32(d0, d1, thr);
+        if (!lt_mask) {
+            return;
+        }
+
+        uint16_t d32tab[32];
+        d0.storeu(d32tab);
+        d1.storeu(d32tab + 16);
+
+        float *hd = heap_dis[q];
+        idx_t *hi = heap_ids[q];
+        size_t j0 = b * 32;
+
+        while (lt_mask) {
+            // find first non-zero
+            int j = __builtin_ctz(lt_mask);
+            lt_mask -= 1u << j;
+            size_t ofs = j0 + j;
+            if (ofs >= ntotal) {
+                break;
+            }
+            float dis = bias[q] + d32tab[j] / scale[q];
+            if (C::cmp(hd[0], dis)) {
+                heap_pop<C>(k, hd, hi);
+                heap_push<C>(k, hd, hi, dis,
+                             ids ? ids[ofs] : id_offset + ofs);
+                nup++;
+            }
+        }
+        update_threshold(q);
+    }
+
+};
+
+
+} // namespace faiss
@@ -15,25 +15,32 @@
 
 #include <cinttypes>
 #include <cmath>
+#include <memory>
 
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/utils/utils.h>
 #include <faiss/utils/random.h>
 
 #include <faiss/IndexFlat.h>
+#include <faiss/IndexFlatHalf.h>
 #include <faiss/VectorTransform.h>
 #include <faiss/IndexPreTransform.h>
+#include <faiss/IndexRefine.h>
 #include <faiss/IndexLSH.h>
 #include <faiss/IndexPQ.h>
+#include <faiss/IndexPQFastScan.h>
 #include <faiss/IndexIVF.h>
 #include <faiss/IndexIVFPQ.h>
 #include <faiss/IndexIVFPQR.h>
+#include <faiss/IndexIVFPQFastScan.h>
 #include <faiss/Index2Layer.h>
 #include <faiss/IndexIVFFlat.h>
 #include <faiss/MetaIndexes.h>
 #include <faiss/IndexScalarQuantizer.h>
 #include <faiss/IndexHNSW.h>
+#include <faiss/IndexNSG.h>
 #include <faiss/IndexLattice.h>
+#include <faiss/IndexAdditiveQuantizer.h>
 
 #include <faiss/IndexBinaryFlat.h>
 #include <faiss/IndexBinaryHNSW.h>
@@ -79,6 +86,7 @@ Index *index_factory (int d, const char *description_in, MetricType metric)
     Index *index = nullptr;
     bool add_idmap = false;
     bool make_IndexRefineFlat = false;
+    std::string refine_description;
 
     ScopeDeleter1<Index> del_coarse_quantizer, del_index;
 
@@ -88,6 +96,7 @@ Index *index_factory (int d, const char *description_in, MetricType metric)
     int64_t ncentroids = -1;
     bool use_2layer = false;
     int hnsw_M = -1;
+    int nsg_R = -1;
 
     for (char *tok = strtok_r (&description[0], " ,", &ptr);
          tok;
@@ -113,6 +122,11 @@ Index *index_factory (int d, const char *description_in, MetricType metric)
         } else if (sscanf (tok, "RR%d", &d_out) == 1) {
             vt_1 = new RandomRotationMatrix (d, d_out);
             d = d_out;
+        } else if (sscanf (tok, "HR%d", &d_out) == 1) {
+            vt_1 = new HadamardRotation (d, d_out);
+            d = d_out;
+        } else if (stok == "HR") {
+            vt_1 = new HadamardRotation (d, d);
         } else if (sscanf (tok, "PCAW%d", &d_out) == 1) {
             vt_1 = new PCAMatrix (d, d_out, -0.5, false);
             d = d_out;
@@ -142,6 +156,11 @@ Index *index_factory (int d, const char *description_in, MetricType metric)
                    sscanf (tok, "IVF%" PRId64 "_HNSW%d", &ncentroids, &M) == 2) {
             coarse_quantizer_1 = new IndexHNSWFlat (d, M);
 
+        } else if (!coarse_quantizer && stok.size() > 5 &&
+                   stok.compare (stok.size() - 5, 5, "_HNSW") == 0 &&
+                   sscanf (tok, "IVF%" PRId64, &ncentroids) == 1) {
+            coarse_quantizer_1 = new IndexHNSWFlat (d, 32);
+
         } else if (!coarse_quantizer &&
                    sscanf (tok, "IVF%" PRId64, &ncentroids) == 1) {
             if (metric == METRIC_L2) {
@@ -172,14 +191,36 @@ Index *index_factory (int d, const char *description_in, MetricType metric)
             add_idmap = true;
 
         // IVFs
-        } else if (!index && (stok == "Flat" || stok == "FlatDedup")) {
+        } else if (!index && (stok == "Flat" || stok == "FlatDedup" ||
+                              stok == "FlatSorted" || stok == "FlatEA")) {
+            size_t early_abort_block = 0;
+            if (stok == "FlatEA") {
+                FAISS_THROW_IF_NOT_MSG (metric == METRIC_L2 &&
+                                        hnsw_M <= 0 && nsg_R <= 0,
+                       "FlatEA supports only L2 IndexFlat and IVFFlat");
+                early_abort_block = 64;
+                if (vts.chain.empty()) {
+                    // order the dimensions by decreasing variance
+                    vt_1 = new PCAMatrix (d, d);
+                }
+            }
             if (coarse_quantizer) {
                 // if there was an IVF in front, then it is an IVFFlat
-                IndexIVF *index_ivf = stok == "Flat" ?
-                    new IndexIVFFlat (
-                          coarse_quantizer, d, ncentroids, metric) :
-                    new IndexIVFFlatDedup (
+                IndexIVF *index_ivf;
+                if (stok == "Flat" || stok == "FlatEA") {
+                    IndexIVFFlat *index_ivfflat = new IndexIVFFlat (
                           coarse_quantizer, d, ncentroids, metric);
+                    index_ivfflat->early_abort_block = early_abort_block;
+                    index_ivf = index_ivfflat;
+                } else if (stok == "FlatDedup") {
+                    index_ivf = new IndexIVFFlatDedup (
+                          coarse_quantizer, d, ncentroids, metric);
+                } else {
+                    FAISS_THROW_IF_NOT_MSG (metric == METRIC_L2,
+                           "IVFFlatSorted supports only L2");
+                    index_ivf = new IndexIVFFlatSorted (
+                          coarse_quantizer, d, ncentroids);
+                }
                 index_ivf->quantizer_trains_alone =
                     get_trains_alone (coarse_quantizer);
                 index_ivf->cp.spherical = metric == METRIC_INNER_PRODUCT;
@@ -188,18 +229,35 @@ Index *index_factory (int d, const char *description_in, MetricType metric)
                 index_1 = index_ivf;
             } else if (hnsw_M > 0) {
                 index_1 = new IndexHNSWFlat (d, hnsw_M, metric);
+            } else if (nsg_R > 0) {
+                index_1 = new IndexNSGFlat (d, nsg_R, metric);
+            } else {
+                FAISS_THROW_IF_NOT_FMT (stok == "Flat" || stok == "FlatEA",
+                                        "%s supported only for IVFFlat",
+                                        stok.c_str());
+                IndexFlat *index_flat = new IndexFlat (d, metric);
+                index_flat->early_abort_block = early_abort_block;
+                index_1 = index_flat;
+            }
+        } else if (!index && !coarse_quantizer && hnsw_M <= 0 &&
+                   nsg_R <= 0 &&
+                   (stok == "FlatFP16" || stok == "FlatBF16")) {
+            if (stok == "FlatFP16") {
+                index_1 = new IndexFlatFP16 (d, metric);
             } else {
-                FAISS_THROW_IF_NOT_MSG (stok != "FlatDedup",
-                                        "dedup supported only for IVFFlat");
-                index_1 = new IndexFlat (d, metric);
+                index_1 = new IndexFlatBF16 (d, metric);
             }
         } else if (!index && (stok == "SQ8" || stok == "SQ4" || stok == "SQ6" ||
-                              stok == "SQfp16")) {
+                              stok == "SQfp16" || stok == "SQ4lloyd" ||
+                              stok == "SQ3vbits" || stok == "SQ4vbits")) {
             ScalarQuantizer::QuantizerType qt =
                 stok == "SQ8" ? ScalarQuantizer::QT_8bit :
                 stok == "SQ6" ? ScalarQuantizer::QT_6bit :
                 stok == "SQ4" ? ScalarQuantizer::QT_4bit :
                 stok == "SQfp16" ? ScalarQuantizer::QT_fp16 :
+                stok == "SQ4lloyd" ? ScalarQuantizer::QT_4bit_lloyd :
+                stok == "SQ3vbits" ? ScalarQuantizer::QT_3bit_vbits :
+                stok == "SQ4vbits" ? ScalarQuantizer::QT_4bit_vbits :
                 ScalarQuantizer::QT_4bit;
             if (coarse_quantizer) {
                 FAISS_THROW_IF_NOT (!use_2layer);
@@ -213,9 +271,44 @@ Index *index_factory (int d, const char *description_in, MetricType metric)
                 index_1 = index_ivf;
             } else if (hnsw_M > 0) {
                 index_1 = new IndexHNSWSQ(d, qt, hnsw_M, metric);
+            } else if (nsg_R > 0) {
+                index_1 = new IndexNSGSQ(d, qt, nsg_R, metric);
             } else {
                 index_1 = new IndexScalarQuantizer (d, qt, metric);
             }
+        } else if (!index && (sscanf (tok, "RQ%dx%d", &M, &nbit) == 2 ||
+                              sscanf (tok, "LSQ%dx%d", &M, &nbit) == 2)) {
+            // additive quantizers, the suffix selects the search type
+            bool is_lsq = stok[0] == 'L';
+            AdditiveQuantizer::Search_type_t st =
+                metric == METRIC_L2 ? AdditiveQuantizer::ST_norm_float :
+                                      AdditiveQuantizer::ST_LUT_nonorm;
+            if (stok.find ("_Nqint8") != std::string::npos) {
+                st = AdditiveQuantizer::ST_norm_qint8;
+            } else if (stok.find ("_Nfloat") != std::string::npos) {
+                st = AdditiveQuantizer::ST_norm_float;
+            } else if (stok.find ("_Nnone") != std::string::npos) {
+                st = AdditiveQuantizer::ST_LUT_nonorm;
+            } else if (stok.find ("_Ndecompress") != std::string::npos) {
+                st = AdditiveQuantizer::ST_decompress;
+            }
+            if (coarse_quantizer) {
+                IndexIVFAdditiveQuantizer *index_ivf = is_lsq ?
+                    (IndexIVFAdditiveQuantizer*)new IndexIVFLocalSearchQuantizer (
+                        coarse_quantizer, d, ncentroids, M, nbit, metric, st) :
+                    (IndexIVFAdditiveQuantizer*)new IndexIVFResidual (
+                        coarse_quantizer, d, ncentroids, M, nbit, metric, st);
+                index_ivf->quantizer_trains_alone =
+                    get_trains_alone (coarse_quantizer);
+                index_ivf->cp.spherical = metric == METRIC_INNER_PRODUCT;
+                del_coarse_quantizer.release ();
+                index_ivf->own_fields = true;
+                index_1 = index_ivf;
+            } else if (is_lsq) {
+                index_1 = new IndexLocalSearchQuantizer (d, M, nbit, metric, st);
+            } else {
+                index_1 = new IndexResidual (d, M, nbit, metric, st);
+            }
         } else if (!index && sscanf (tok, "PQ%d+%d", &M, &M2) == 2) {
             FAISS_THROW_IF_NOT_MSG(coarse_quantizer,
                              "PQ with + works only with an IVF");
@@ -228,6 +321,21 @@ Index *index_factory (int d, const char *description_in, MetricType metric)
             del_coarse_quantizer.release ();
             index_ivf->own_fields = true;
             index_1 = index_ivf;
+        } else if (!index && sscanf (tok, "PQ%dx4fs", &M) == 1 &&
+                   stok.find ("x4fs") != std::string::npos) {
+            // 4-bit PQ with fast-scan code layout
+            if (coarse_quantizer) {
+                IndexIVFPQFastScan *index_ivf = new IndexIVFPQFastScan (
+                    coarse_quantizer, d, ncentroids, M, 4, metric);
+                index_ivf->quantizer_trains_alone =
+                    get_trains_alone (coarse_quantizer);
+                index_ivf->cp.spherical = metric == METRIC_INNER_PRODUCT;
+                del_coarse_quantizer.release ();
+                index_ivf->own_fields = true;
+                index_1 = index_ivf;
+            } else {
+                index_1 = new IndexPQFastScan (d, M, 4, metric);
+            }
         } else if (!index && (sscanf (tok, "PQ%dx%d", &M, &nbit) == 2 ||
                               sscanf (tok, "PQ%d", &M) == 1 ||
                               sscanf (tok, "PQ%dnp", &M) == 1)) {
@@ -257,6 +365,11 @@ Index *index_factory (int d, const char *description_in, MetricType metric)
                 dynamic_cast<IndexPQ*>(ipq->storage)->do_polysemous_training =
                     do_polysemous_training;
                 index_1 = ipq;
+            } else if (nsg_R > 0) {
+                IndexNSGPQ *ipq = new IndexNSGPQ(d, M, nsg_R);
+                dynamic_cast<IndexPQ*>(ipq->storage)->do_polysemous_training =
+                    do_polysemous_training;
+                index_1 = ipq;
             } else {
                 IndexPQ *index_pq = new IndexPQ (d, M, nbit, metric);
                 index_pq->do_polysemous_training = do_polysemous_training;
@@ -289,6 +402,10 @@ Index *index_factory (int d, const char *description_in, MetricType metric)
                    sscanf (tok, "HNSW%d", &M) == 1) {
             hnsw_M = M;
             // here it is unclear what we want: HNSW flat or HNSWx,Y ?
+        } else if (!index &&
+                   sscanf (tok, "NSG%d", &M) == 1) {
+            // as for HNSW, the storage is given by the next token, if any
+            nsg_R = M;
         } else if (!index && (stok == "LSH" || stok == "LSHr" ||
                               stok == "LSHrt" || stok == "LSHt")) {
             bool rotate_data = strstr(tok, "r") != nullptr;
@@ -300,6 +417,10 @@ Index *index_factory (int d, const char *description_in, MetricType metric)
             index_1 = new IndexLattice(d, M, nbit, r2);
         } else if (stok == "RFlat") {
             make_IndexRefineFlat = true;
+        } else if (stok.size() > 8 && stok.compare (0, 7, "Refine(") == 0 &&
+                   stok.back() == ')') {
+            // the refine index description should be a single token
+            refine_description = stok.substr (7, stok.size() - 8);
         } else {
             FAISS_THROW_FMT( "could not parse token \"%s\" in %s\n",
                              tok, description_in);
@@ -333,6 +454,11 @@ Index *index_factory (int d, const char *description_in, MetricType metric)
         del_index.set (index);
     }
 
+    if (!index && nsg_R > 0) {
+        index = new IndexNSGFlat (d, nsg_R, metric);
+        del_index.set (index);
+    }
+
     FAISS_THROW_IF_NOT_FMT(index, "description %s did not generate an index",
                     description_in);
 
@@ -362,6 +488,17 @@ Index *index_factory (int d, const char *description_in, MetricType metric)
         index = index_rf;
     }
 
+    if (!refine_description.empty()) {
+        std::unique_ptr<Index> del_base (index);
+        Index *refine_index =
+            index_factory (d, refine_description.c_str(), metric);
+        IndexRefine *index_r = new IndexRefine (index, refine_index);
+        del_base.release ();
+        index_r->own_fields = true;
+        index_r->own_refine_index = true;
+        index = index_r;
+    }
+
     return index;
 }
 
@@ -372,7 +509,18 @@ IndexBinary *index_binary_factory(int d, const char *description)
     int ncentroids = -1;
     int M, nhash, b;
 
-    if (sscanf(description, "BIVF%d_HNSW%d", &ncentroids, &M) == 2) {
+    // "BIVF<nlist>_HNSW" without M: HNSW coarse quantizer with M=32
+    std::string desc = description;
+    bool hnsw_no_M = desc.size() > 5 &&
+        (desc.compare(desc.size() - 5, 5, "_HNSW") == 0 ||
+         desc.compare(desc.size() - 6, 6, "_BHNSW") == 0);
+
+    if (sscanf(description, "BIVF%d_HNSW%d", &ncentroids, &M) == 2 ||
+        sscanf(description, "BIVF%d_BHNSW%d", &ncentroids, &M) == 2 ||
+        (hnsw_no_M && sscanf(description, "BIVF%d", &ncentroids) == 1)) {
+        if (hnsw_no_M) {
+            M = 32;
+        }
         IndexBinaryIVF *index_ivf = new IndexBinaryIVF(
             new IndexBinaryHNSW(d, M), d, ncentroids
         );
@@ -36,9 +36,36 @@ struct IOReader;
 struct IOWriter;
 struct InvertedLists;
 
-void write_index (const Index *idx, const char *fname);
-void write_index (const Index *idx, FILE *f);
-void write_index (const Index *idx, IOWriter *writer);
+// write_index flags: compress the index in independent blocks (see
+// CompressedIOWriter) with the given codec. read_index recognizes
+// compressed indexes. The codecs available depend on the build.
+const int IO_FLAG_COMPRESS_ZLIB = 0x100;
+const int IO_FLAG_COMPRESS_ZSTD = 0x200;
+const int IO_FLAG_COMPRESS_LZ4 = 0x300;
+
+void write_index (const Index *idx, const char *fname, int io_flags = 0);
+void write_index (const Index *idx, FILE *f, int io_flags = 0);
+void write_index (const Index *idx, IOWriter *writer, int io_flags = 0);
+
+/** Write the index in a container, that stores it in sections listed
+ * in a table of contents with the offset, size and checksum of each.
+ * The inverted lists of an IVF index are stored in their own section.
+ *
+ * read_index recognizes containers. When the container is read from a
+ * file, IO_FLAG_SKIP_IVF_DATA reads only the quantizer and metadata of
+ * the index (leaving its invlists null), and IO_FLAG_MMAP maps the
+ * inverted lists without reading them. The checksums of the sections
+ * that are read in memory are verified.
+ *
+ * With an IO_FLAG_COMPRESS_* flag, each section is compressed on its
+ * own, so the sections can still be read independently. Compressed
+ * sections are read in memory instead of being mapped.
+ */
+void write_index_container (const Index *idx, const char *fname,
+                            int io_flags = 0);
+void write_index_container (const Index *idx, FILE *f, int io_flags = 0);
+void write_index_container (const Index *idx, IOWriter *writer,
+                            int io_flags = 0);
 
 void write_index_binary (const IndexBinary *idx, const char *fname);
 void write_index_binary (const IndexBinary *idx, FILE *f);
@@ -51,7 +78,9 @@ const int IO_FLAG_READ_ONLY = 2;
 const int IO_FLAG_ONDISK_SAME_DIR = 4;
 // don't load IVF data to RAM, only list sizes
 const int IO_FLAG_SKIP_IVF_DATA = 8;
-// try to memmap data (useful to load an ArrayInvertedLists as an OnDiskInvertedLists)
+// try to memmap data (useful to load an ArrayInvertedLists as an OnDiskInvertedLists).
+// When reading from a file, the flat vectors, PQ and SQ codes and graph
+// links of the index are also mapped instead of copied (copy-on-write).
 const int IO_FLAG_MMAP = IO_FLAG_SKIP_IVF_DATA | 0x646f0000;
 
 
@@ -0,0 +1,374 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/index_warmup.h>
+
+#include <cstdint>
+#include <cstdio>
+
+#include <algorithm>
+#include <set>
+
+#include <omp.h>
+
+#ifndef _MSC_VER
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/utils.h>
+#include <faiss/Index2Layer.h>
+#include <faiss/IndexAdditiveQuantizer.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexFlatHalf.h>
+#include <faiss/IndexHNSW.h>
+#include <faiss/IndexIVF.h>
+#include <faiss/IndexIVFPQ.h>
+#include <faiss/IndexIVFPQR.h>
+#include <faiss/IndexLSH.h>
+#include <faiss/IndexLattice.h>
+#include <faiss/IndexNSG.h>
+#include <faiss/IndexPQ.h>
+#include <faiss/IndexPQFastScan.h>
+#include <faiss/IndexPreTransform.h>
+#include <faiss/IndexRefine.h>
+#include <faiss/IndexScalarQuantizer.h>
+#include <faiss/MetaIndexes.h>
+#include <faiss/VectorTransform.h>
+#include <faiss/BlockInvertedLists.h>
+#include <faiss/CompactIdsInvertedLists.h>
+#include <faiss/InvertedLists.h>
+#include <faiss/impl/ThreadedIndex.h>
+
+#ifndef _MSC_VER
+#include <faiss/OnDiskInvertedLists.h>
+#endif // !_MSC_VER
+
+namespace faiss {
+
+/*************************************************************
+ * Enumeration of the arrays
+ *************************************************************/
+
+namespace {
+
+void add_range (std::vector<IndexMemoryRange> & ranges,
+                const void *ptr, size_t size, const char *name)
+{
+    if (ptr && size > 0) {
+        ranges.push_back (IndexMemoryRange {ptr, size, name});
+    }
+}
+
+template<class Vec>
+void add_vector (std::vector<IndexMemoryRange> & ranges,
+                 const Vec & v, const char *name)
+{
+    add_range (ranges, v.data(),
+               v.size() * sizeof (typename Vec::value_type), name);
+}
+
+template<class VecVec>
+void add_vectors (std::vector<IndexMemoryRange> & ranges,
+                  const VecVec & vv, const char *name)
+{
+    for (const auto & v: vv) {
+        add_vector (ranges, v, name);
+    }
+}
+
+} // namespace
+
+
+void get_invlists_memory_ranges (const InvertedLists *il,
+                                 std::vector<IndexMemoryRange> & ranges)
+{
+    if (auto ail = dynamic_cast<const ArrayInvertedLists *>(il)) {
+        add_vectors (ranges, ail->ids, "invlists.ids");
+        add_vectors (ranges, ail->codes, "invlists.codes");
+    } else if (auto cil = dynamic_cast<const CompactedInvertedLists *>(il)) {
+        add_vector (ranges, cil->offsets, "invlists.offsets");
+        add_vector (ranges, cil->buffer, "invlists.buffer");
+    } else if (auto bil = dynamic_cast<const BlockInvertedLists *>(il)) {
+        add_vectors (ranges, bil->ids, "invlists.ids");
+        add_vectors (ranges, bil->codes, "invlists.codes");
+    } else if (auto cil = dynamic_cast<const CompactIdsInvertedLists *>(il)) {
+        add_vectors (ranges, cil->ids32, "invlists.ids32");
+        add_vectors (ranges, cil->id_runs, "invlists.id_runs");
+        add_vectors (ranges, cil->codes, "invlists.codes");
+#ifndef _MSC_VER
+    } else if (auto oil = dynamic_cast<const OnDiskInvertedLists *>(il)) {
+        add_vector (ranges, oil->lists, "invlists.lists");
+        add_range (ranges, oil->ptr, oil->totsize, "invlists.mmap");
+    } else if (auto oil = dynamic_cast<
+                   const OnDiskCompressedInvertedLists *>(il)) {
+        add_vector (ranges, oil->lists, "invlists.lists");
+        add_range (ranges, oil->ptr, oil->totsize, "invlists.mmap");
+#endif // !_MSC_VER
+    }
+}
+
+
+void get_index_memory_ranges (const Index *index,
+                              std::vector<IndexMemoryRange> & ranges)
+{
+    if (!index) {
+        return;
+    }
+    if (auto ip = dynamic_cast<const IndexPreTransform *>(index)) {
+        for (const VectorTransform *vt: ip->chain) {
+            if (auto lt = dynamic_cast<const LinearTransform *>(vt)) {
+                add_vector (ranges, lt->A, "transform.A");
+                add_vector (ranges, lt->b, "transform.b");
+            }
+        }
+        get_index_memory_ranges (ip->index, ranges);
+    } else if (auto iim = dynamic_cast<const IndexIDMap *>(index)) {
+        get_index_memory_ranges (iim->index, ranges);
+        add_vector (ranges, iim->id_map, "id_map");
+    } else if (auto ir = dynamic_cast<const IndexRefine *>(index)) {
+        get_index_memory_ranges (ir->base_index, ranges);
+        get_index_memory_ranges (ir->refine_index, ranges);
+    } else if (auto irf = dynamic_cast<const IndexRefineFlat *>(index)) {
+        get_index_memory_ranges (irf->base_index, ranges);
+        get_index_memory_ranges (&irf->refine_index, ranges);
+    } else if (auto ti = dynamic_cast<const ThreadedIndex<Index> *>(index)) {
+        // shards or replicas
+        for (int i = 0; i < ti->count(); i++) {
+            get_index_memory_ranges (ti->at(i), ranges);
+        }
+    } else if (auto ivf = dynamic_cast<const IndexIVF *>(index)) {
+        get_index_memory_ranges (ivf->quantizer, ranges);
+        if (auto ivfpq = dynamic_cast<const IndexIVFPQ *>(ivf)) {
+            add_vector (ranges, ivfpq->pq.centroids, "pq.centroids");
+            add_vector (ranges, ivfpq->precomputed_table,
+                        "precomputed_table");
+        }
+        get_invlists_memory_ranges (ivf->invlists, ranges);
+        add_vector (ranges, ivf->direct_map.array, "direct_map.array");
+        if (auto ivfpqr = dynamic_cast<const IndexIVFPQR *>(ivf)) {
+            add_vector (ranges, ivfpqr->refine_codes, "refine_codes");
+        }
+    } else if (auto ihnsw = dynamic_cast<const IndexHNSW *>(index)) {
+        const HNSW & hnsw = ihnsw->hnsw;
+        add_vector (ranges, hnsw.levels, "hnsw.levels");
+        add_vector (ranges, hnsw.offsets, "hnsw.offsets");
+        add_vector (ranges, hnsw.neighbors, "hnsw.neighbors");
+        add_vector (ranges, hnsw.compressed_links, "hnsw.compressed_links");
+        get_index_memory_ranges (ihnsw->storage, ranges);
+    } else if (auto insg = dynamic_cast<const IndexNSG *>(index)) {
+        add_vector (ranges, insg->nsg.final_graph, "nsg.final_graph");
+        get_index_memory_ranges (insg->storage, ranges);
+    } else if (auto if1d = dynamic_cast<const IndexFlat1D *>(index)) {
+        add_vector (ranges, if1d->perm, "perm");
+        add_vector (ranges, if1d->xb, "xb");
+    } else if (auto iflat = dynamic_cast<const IndexFlat *>(index)) {
+        add_vector (ranges, iflat->xb, "xb");
+    } else if (auto ifh = dynamic_cast<const IndexFlatHalf *>(index)) {
+        add_vector (ranges, ifh->codes, "codes");
+    } else if (auto ipq = dynamic_cast<const IndexPQ *>(index)) {
+        add_vector (ranges, ipq->pq.centroids, "pq.centroids");
+        add_vector (ranges, ipq->codes, "codes");
+    } else if (auto ipqfs = dynamic_cast<const IndexPQFastScan *>(index)) {
+        add_vector (ranges, ipqfs->pq.centroids, "pq.centroids");
+        add_vector (ranges, ipqfs->codes, "codes");
+    } else if (auto isq = dynamic_cast<const IndexScalarQuantizer *>(index)) {
+        add_vector (ranges, isq->sq.trained, "sq.trained");
+        add_vector (ranges, isq->codes, "codes");
+    } else if (auto iaq = dynamic_cast<const IndexAdditiveQuantizer *>(
+                   index)) {
+        add_vector (ranges, iaq->codes, "codes");
+    } else if (auto ilsh = dynamic_cast<const IndexLSH *>(index)) {
+        add_vector (ranges, ilsh->codes, "codes");
+    } else if (auto il = dynamic_cast<const IndexLattice *>(index)) {
+        add_vector (ranges, il->codes, "codes");
+    } else if (auto i2l = dynamic_cast<const Index2Layer *>(index)) {
+        get_index_memory_ranges (i2l->q1.quantizer, ranges);
+        add_vector (ranges, i2l->pq.centroids, "pq.centroids");
+        add_vector (ranges, i2l->codes, "codes");
+    }
+}
+
+
+/*************************************************************
+ * Warmup
+ *************************************************************/
+
+WarmupParameters::WarmupParameters ():
+    nthread (0), lock (false), lock_budget (0), verbose (false)
+{}
+
+WarmupStats::WarmupStats ():
+    nrange (0), touched_bytes (0), major_faults (0),
+    locked_bytes (0), nlock_skipped (0), nlock_failed (0), time (0)
+{}
+
+
+namespace {
+
+size_t get_page_size ()
+{
+#ifndef _MSC_VER
+    long ps = sysconf (_SC_PAGESIZE);
+    if (ps > 0) {
+        return ps;
+    }
+#endif
+    return 4096;
+}
+
+size_t get_major_faults ()
+{
+#ifndef _MSC_VER
+    struct rusage ru;
+    if (getrusage (RUSAGE_SELF, &ru) == 0) {
+        return ru.ru_majflt;
+    }
+#endif
+    return 0;
+}
+
+/// the ranges without duplicates (the same sub-index may appear several
+/// times, eg. a quantizer shared by shards)
+std::vector<IndexMemoryRange> get_unique_ranges (const Index *index)
+{
+    std::vector<IndexMemoryRange> ranges;
+    get_index_memory_ranges (index, ranges);
+    std::set<const void *> seen;
+    size_t n = 0;
+    for (const IndexMemoryRange & r: ranges) {
+        if (seen.insert (r.ptr).second) {
+            ranges[n++] = r;
+        }
+    }
+    ranges.resize (n);
+    return ranges;
+}
+
+} // namespace
+
+
+WarmupStats warmup_index (const Index *index,
+                          const WarmupParameters & params)
+{
+    FAISS_THROW_IF_NOT (index);
+    double t0 = getmillisecs ();
+    WarmupStats stats;
+    size_t majflt0 = get_major_faults ();
+
+    std::vector<IndexMemoryRange> ranges = get_unique_ranges (index);
+    stats.nrange = ranges.size();
+
+    // split the large ranges in chunks so that the threads are balanced
+    const size_t chunk_size = size_t(64) << 20;
+    struct Chunk {
+        const volatile uint8_t *ptr;
+        size_t size;
+    };
+    std::vector<Chunk> chunks;
+    for (const IndexMemoryRange & r: ranges) {
+        stats.touched_bytes += r.size;
+        const uint8_t *p = (const uint8_t *)r.ptr;
+        for (size_t ofs = 0; ofs < r.size; ofs += chunk_size) {
+            chunks.push_back (Chunk {
+                p + ofs, std::min (chunk_size, r.size - ofs)});
+        }
+    }
+
+    if (params.verbose) {
+        printf ("warmup_index: %zd arrays, %.3f MiB\n",
+                ranges.size(), stats.touched_bytes / double(1 << 20));
+    }
+
+    size_t page_size = get_page_size ();
+    size_t done = 0, next_report = stats.touched_bytes / 10;
+    int nt = params.nthread > 0 ? params.nthread : omp_get_max_threads ();
+
+#pragma omp parallel for schedule(dynamic) num_threads(nt)
+    for (int64_t i = 0; i < chunks.size(); i++) {
+        const Chunk & c = chunks[i];
+        // one read per page faults it in, the volatile read can not be
+        // optimized away. The ranges are not page-aligned, hence the
+        // last byte.
+        uint8_t accu = 0;
+        for (size_t ofs = 0; ofs < c.size; ofs += page_size) {
+            accu ^= c.ptr[ofs];
+        }
+        accu ^= c.ptr[c.size - 1];
+        (void)accu;
+
+        if (params.verbose) {
+#pragma omp critical
+            {
+                done += c.size;
+                if (done >= next_report) {
+                    printf ("  touched %.3f / %.3f MiB (%.1f s)\r",
+                            done / double(1 << 20),
+                            stats.touched_bytes / double(1 << 20),
+                            (getmillisecs () - t0) / 1000);
+                    fflush (stdout);
+                    next_report = done + stats.touched_bytes / 10;
+                }
+            }
+        }
+    }
+    if (params.verbose) {
+        printf ("\n");
+    }
+
+    if (params.lock) {
+#ifndef _MSC_VER
+        for (const IndexMemoryRange & r: ranges) {
+            if (params.lock_budget > 0 &&
+                stats.locked_bytes + r.size > params.lock_budget) {
+                stats.nlock_skipped++;
+                continue;
+            }
+            if (mlock (r.ptr, r.size) == 0) {
+                stats.locked_bytes += r.size;
+            } else {
+                stats.nlock_failed++;
+            }
+        }
+#else
+        stats.nlock_failed = ranges.size();
+#endif
+        if (params.verbose) {
+            printf ("  locked %.3f MiB, %zd arrays over budget, "
+                    "%zd mlock failures\n",
+                    stats.locked_bytes / double(1 << 20),
+                    stats.nlock_skipped, stats.nlock_failed);
+        }
+    }
+
+    stats.major_faults = get_major_faults () - majflt0;
+    stats.time = getmillisecs () - t0;
+    if (params.verbose) {
+        printf ("warmup_index: done in %.3f s, %zd major page faults\n",
+                stats.time / 1000, stats.major_faults);
+    }
+    return stats;
+}
+
+
+void unlock_index (const Index *index)
+{
+    FAISS_THROW_IF_NOT (index);
+#ifndef _MSC_VER
+    for (const IndexMemoryRange & r: get_unique_ranges (index)) {
+        // fails harmlessly for the ranges that were not locked
+        munlock (r.ptr, r.size);
+    }
+#endif
+}
+
+
+} // namespace faiss
@@ -0,0 +1,102 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <stddef.h>
+
+#include <vector>
+
+/* Warmup and pinning of the memory of an index that is served.
+ *
+ * After a long idle period, the pages of a large index may have been
+ * evicted (mmapped OnDiskInvertedLists, indexes read with IO_FLAG_MMAP)
+ * or swapped out by other processes, and the first queries that touch
+ * them pay the page faults. warmup_index faults all the arrays of an
+ * index in with several threads and optionally locks them in RAM with
+ * mlock, so that the latency after a deployment or a failover is
+ * predictable.
+ */
+
+namespace faiss {
+
+struct Index;
+struct InvertedLists;
+
+/// a contiguous array of an index
+struct IndexMemoryRange {
+    const void *ptr;
+    size_t size;        ///< in bytes
+    const char *name;   ///< static string, eg. "invlists.codes"
+};
+
+/** append the arrays of an index and of its sub-indexes to ranges.
+ *
+ * The small arrays that are accessed by every search (quantizers, graph
+ * structure) come before the large ones (vectors, codes, inverted
+ * lists). Arrays of unknown index and inverted list types are ignored.
+ */
+void get_index_memory_ranges (const Index *index,
+                              std::vector<IndexMemoryRange> & ranges);
+
+/// same for inverted lists
+void get_invlists_memory_ranges (const InvertedLists *invlists,
+                                 std::vector<IndexMemoryRange> & ranges);
+
+
+struct WarmupParameters {
+    /// nb of threads that touch the pages (0 = OpenMP default)
+    int nthread;
+
+    /// lock the ranges in RAM with mlock
+    bool lock;
+
+    /** max nb of bytes to lock (0 = no limit). The ranges are locked in
+     * order and those that do not fit in the remaining budget are
+     * skipped, so that the quantizers and graphs are locked first. Note
+     * that the amount that can be locked is also limited by
+     * RLIMIT_MEMLOCK. */
+    size_t lock_budget;
+
+    /// print progress (about every 10%)
+    bool verbose;
+
+    WarmupParameters ();
+};
+
+
+struct WarmupStats {
+    size_t nrange;          ///< nb of arrays of the index
+    size_t touched_bytes;   ///< size of these arrays
+    size_t major_faults;    ///< page faults that required I/O (whole process)
+    size_t locked_bytes;
+    size_t nlock_skipped;   ///< ranges that did not fit in the budget
+    size_t nlock_failed;    ///< ranges for which mlock failed
+    double time;            ///< in ms
+
+    WarmupStats ();
+};
+
+/** fault in all the pages of the index arrays (and lock them if
+ * params.lock). Locking is best effort: a failing mlock (eg. because
+ * RLIMIT_MEMLOCK is exceeded) is counted in the stats, not an error.
+ *
+ * The locked pages remain locked until unlock_index is called, or the
+ * memory is deallocated or unmapped. mlock is not supported on Windows,
+ * where only the warmup is done.
+ */
+WarmupStats warmup_index (const Index *index,
+                          const WarmupParameters & params =
+                                WarmupParameters ());
+
+/// unlock the arrays of an index locked by warmup_index
+void unlock_index (const Index *index);
+
+
+} // namespace faiss
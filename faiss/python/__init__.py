@@ -11,6 +11,7 @@
 import numpy as np
 import sys
 import inspect
+import contextlib
 
 # We import * so that the symbol foo can be accessed as faiss.foo.
 from .loader import *
@@ -40,6 +41,139 @@ def replace_method(the_class, name, replacement, ignore_missing=False):
     setattr(the_class, name + '_c', orig_method)
     setattr(the_class, name, replacement)
 
+
+##################################################################
+# Zero-copy inputs and outputs: numpy arrays with any strides and
+# objects that export DLPack or the array interface (CPU torch
+# tensors, pyarrow buffers, ...) are passed to the C++ code without
+# intermediate copy
+##################################################################
+
+# element types of utils/vector_view.h that have a numpy equivalent
+_vector_view_types = {
+    np.dtype('float32'): VET_float32,
+    np.dtype('float16'): VET_float16,
+    np.dtype('uint8'): VET_uint8,
+    np.dtype('int8'): VET_int8,
+}
+
+
+def as_numpy_array(x):
+    """ numpy array that shares the memory of x, if x exports DLPack or
+    the array interface """
+    if isinstance(x, np.ndarray):
+        return x
+    if hasattr(x, '__dlpack__') and hasattr(np, 'from_dlpack'):
+        return np.from_dlpack(x)
+    return np.asarray(x)
+
+
+def vector_array_view(x):
+    """ VectorArrayView on the rows of the 2D array x, or None if its
+    type or strides are not supported. x must be kept alive while the
+    view is used. """
+    if x.ndim != 2 or x.dtype not in _vector_view_types:
+        return None
+    n, d = x.shape
+    itemsize = x.dtype.itemsize
+    if d > 1 and x.strides[1] != itemsize:
+        return None
+    if n > 1:
+        if x.strides[0] % itemsize != 0 or x.strides[0] < d * itemsize:
+            return None
+        stride = x.strides[0] // itemsize
+    else:
+        stride = d
+    ptr = cast_integer_to_void_ptr(x.__array_interface__['data'][0])
+    return VectorArrayView(_vector_view_types[x.dtype], ptr, n, d, stride)
+
+
+def output_array(x, shape, dtype):
+    """ allocates an output array, or checks that the pre-allocated x
+    can be written to directly by the C++ code """
+    if x is None:
+        return np.empty(shape, dtype=dtype)
+    xa = as_numpy_array(x)
+    assert xa.shape == shape, 'output has shape %s, expected %s' % (
+        xa.shape, shape)
+    assert xa.dtype == dtype, 'output has dtype %s, expected %s' % (
+        xa.dtype, dtype)
+    assert xa.flags.c_contiguous and xa.flags.writeable, \
+        'output must be a writeable C-contiguous array'
+    return xa
+
+
+# Arrays in CUDA memory (cupy, numba, pytorch...) are passed to the
+# GpuIndex methods through __cuda_array_interface__: the GPU indexes
+# accept device pointers for their inputs and outputs.
+
+def cuda_array_interface(x):
+    """ __cuda_array_interface__ of x if it is an array in CUDA memory,
+    else None """
+    try:
+        return x.__cuda_array_interface__
+    except AttributeError:
+        return None
+
+
+def cuda_array_ptr(cai, shape, dtype):
+    """ device pointer of a C-contiguous CUDA array, after checking its
+    shape and dtype """
+    typestr = np.dtype(dtype).str
+    assert tuple(cai['shape']) == shape, 'array has shape %s, expected %s' % (
+        tuple(cai['shape']), shape)
+    assert cai['typestr'] == typestr, 'array has type %s, expected %s' % (
+        cai['typestr'], typestr)
+    strides = cai.get('strides')
+    if strides is not None:
+        step = np.dtype(dtype).itemsize
+        for size, stride in reversed(list(zip(shape, strides))):
+            assert size <= 1 or stride == step, \
+                'CUDA array must be C-contiguous'
+            step *= size
+    return cai['data'][0]
+
+
+def cuda_input(index, x):
+    """ (n, device pointer) of the vectors x if they are in CUDA memory,
+    else None """
+    cai = cuda_array_interface(x)
+    if cai is None:
+        return None
+    assert hasattr(index, 'getDevice'), 'CUDA array passed to a CPU index'
+    n = cai['shape'][0]
+    return n, cuda_array_ptr(cai, (n, index.d), np.float32)
+
+
+def cuda_output(x, shape, dtype):
+    """ (array, pointer) of an output of a GpuIndex method: x is a
+    pre-allocated CUDA or host array, or None for a new numpy array """
+    cai = cuda_array_interface(x)
+    if cai is not None:
+        return x, cuda_array_ptr(cai, shape, dtype)
+    xa = output_array(x, shape, dtype)
+    return (xa if x is None else x), xa.__array_interface__['data'][0]
+
+
+@contextlib.contextmanager
+def using_cuda_array_stream(index, x):
+    """ orders the work of the GpuIndex on the stream of the CUDA array x,
+    if it has one (version 3 of the interface), as
+    contrib.torch_utils.using_stream """
+    stream = cuda_array_interface(x).get('stream')
+    if stream is None:
+        yield
+        return
+    res = index.getResources()
+    device = index.getDevice()
+    prior_stream = res.getDefaultStream(device)
+    res.setDefaultStream(device, cast_integer_to_cudastream_t(stream))
+    try:
+        yield
+    finally:
+        res.setDefaultStream(device, prior_stream)
+
+
 def handle_Clustering():
     def replacement_train(self, x, index, weights=None):
         n, d = x.shape
@@ -98,11 +232,38 @@ handle_Quantizer(ScalarQuantizer)
 def handle_Index(the_class):
 
     def replacement_add(self, x):
+        inp = cuda_input(self, x)
+        if inp is not None:
+            n, x_ptr = inp
+            with using_cuda_array_stream(self, x):
+                self.add_c(n, cast_integer_to_float_ptr(x_ptr))
+            return
+        x = as_numpy_array(x)
         n, d = x.shape
         assert d == self.d
+        if not (x.dtype == 'float32' and x.flags.c_contiguous):
+            view = vector_array_view(x)
+            if view is not None:
+                self.add_view(view)
+                return
+            x = np.ascontiguousarray(x, dtype='float32')
         self.add_c(n, swig_ptr(x))
 
     def replacement_add_with_ids(self, x, ids):
+        inp = cuda_input(self, x)
+        if inp is not None:
+            n, x_ptr = inp
+            ids_cai = cuda_array_interface(ids)
+            if ids_cai is not None:
+                ids_ptr = cuda_array_ptr(ids_cai, (n, ), np.int64)
+            else:
+                ids = np.ascontiguousarray(ids, dtype='int64')
+                assert ids.shape == (n, ), 'not same nb of vectors as ids'
+                ids_ptr = ids.__array_interface__['data'][0]
+            with using_cuda_array_stream(self, x):
+                self.add_with_ids_c(n, cast_integer_to_float_ptr(x_ptr),
+                                    cast_integer_to_idx_t_ptr(ids_ptr))
+            return
         n, d = x.shape
         assert d == self.d
 
@@ -127,20 +288,35 @@ def handle_Index(the_class):
         self.train_c(n, swig_ptr(x))
 
     def replacement_search(self, x, k, D=None, I=None):
+        """ D and I can be pre-allocated numpy arrays or DLPack objects,
+        they are filled in place and returned. For a GpuIndex, x, D and I
+        can also be arrays in CUDA memory """
+        inp = cuda_input(self, x)
+        if inp is not None:
+            n, x_ptr = inp
+            D, D_ptr = cuda_output(D, (n, k), np.float32)
+            I, I_ptr = cuda_output(I, (n, k), np.int64)
+            with using_cuda_array_stream(self, x):
+                self.search_c(n, cast_integer_to_float_ptr(x_ptr), k,
+                              cast_integer_to_float_ptr(D_ptr),
+                              cast_integer_to_idx_t_ptr(I_ptr))
+            return D, I
+        x = as_numpy_array(x)
         n, d = x.shape
         assert d == self.d
 
-        if D is None:
-            D = np.empty((n, k), dtype=np.float32)
-        else:
-            assert D.shape == (n, k)
-
-        if I is None:
-            I = np.empty((n, k), dtype=np.int64)
-        else:
-            assert I.shape == (n, k)
-
-        self.search_c(n, swig_ptr(x), k, swig_ptr(D), swig_ptr(I))
+        Da = output_array(D, (n, k), np.float32)
+        Ia = output_array(I, (n, k), np.int64)
+        D = Da if D is None else D
+        I = Ia if I is None else I
+
+        if not (x.dtype == 'float32' and x.flags.c_contiguous):
+            view = vector_array_view(x)
+            if view is not None:
+                self.search_view(view, k, swig_ptr(Da), swig_ptr(Ia))
+                return D, I
+            x = np.ascontiguousarray(x, dtype='float32')
+        self.search_c(n, swig_ptr(x), k, swig_ptr(Da), swig_ptr(Ia))
         return D, I
 
     def replacement_search_and_reconstruct(self, x, k, D=None, I=None, R=None):
@@ -198,6 +374,17 @@ def handle_Index(the_class):
         self.reconstruct_n_c(n0, ni, swig_ptr(x))
         return x
 
+    def replacement_reconstruct_batch(self, keys, x=None):
+        keys = np.ascontiguousarray(keys, dtype='int64')
+        n, = keys.shape
+        if x is None:
+            x = np.empty((n, self.d), dtype=np.float32)
+        else:
+            assert x.shape == (n, self.d)
+
+        self.reconstruct_batch_c(n, swig_ptr(keys), swig_ptr(x))
+        return x
+
     def replacement_update_vectors(self, keys, x):
         n = keys.size
         assert keys.shape == (n, )
@@ -205,18 +392,28 @@ def handle_Index(the_class):
 
         self.update_vectors_c(n, swig_ptr(keys), swig_ptr(x))
 
-    # The CPU does not support passed-in output buffers
+    # The size of the output is not known in advance, so the result
+    # arrays are not passed in. They are returned without copy instead,
+    # and keep the RangeSearchResult alive.
     def replacement_range_search(self, x, thresh):
-        n, d = x.shape
-        assert d == self.d
+        inp = cuda_input(self, x)
+        if inp is not None:
+            n, x_ptr = inp
+            res = RangeSearchResult(n)
+            with using_cuda_array_stream(self, x):
+                self.range_search_c(n, cast_integer_to_float_ptr(x_ptr),
+                                    thresh, res)
+        else:
+            x = np.ascontiguousarray(as_numpy_array(x), dtype='float32')
+            n, d = x.shape
+            assert d == self.d
 
-        res = RangeSearchResult(n)
-        self.range_search_c(n, swig_ptr(x), thresh, res)
-        # get pointers and copy them
-        lims = rev_swig_ptr(res.lims, n + 1).copy()
+            res = RangeSearchResult(n)
+            self.range_search_c(n, swig_ptr(x), thresh, res)
+        lims = array_with_owner(rev_swig_ptr(res.lims, n + 1), res)
         nd = int(lims[-1])
-        D = rev_swig_ptr(res.distances, nd).copy()
-        I = rev_swig_ptr(res.labels, nd).copy()
+        D = array_with_owner(rev_swig_ptr(res.distances, nd), res)
+        I = array_with_owner(rev_swig_ptr(res.labels, nd), res)
         return lims, D, I
 
     def replacement_sa_encode(self, x, codes=None):
@@ -251,6 +448,8 @@ def handle_Index(the_class):
     replace_method(the_class, 'remove_ids', replacement_remove_ids)
     replace_method(the_class, 'reconstruct', replacement_reconstruct)
     replace_method(the_class, 'reconstruct_n', replacement_reconstruct_n)
+    replace_method(the_class, 'reconstruct_batch',
+                   replacement_reconstruct_batch)
     replace_method(the_class, 'range_search', replacement_range_search)
     replace_method(the_class, 'update_vectors', replacement_update_vectors,
                    ignore_missing=True)
@@ -480,6 +679,7 @@ def add_ref_in_function(function_name, parameter_no):
 
 add_ref_in_constructor(IndexIVFFlat, 0)
 add_ref_in_constructor(IndexIVFFlatDedup, 0)
+add_ref_in_constructor(IndexIVFFlatSorted, 0)
 add_ref_in_constructor(IndexPreTransform, {2: [0, 1], 1: [0]})
 add_ref_in_method(IndexPreTransform, 'prepend_transform', 0)
 add_ref_in_constructor(IndexIVFPQ, 0)
@@ -639,7 +839,10 @@ vector_name_map = {
     'Uint64': 'uint64',
     'Long': 'int64',
     'Int': 'int32',
-    'Double': 'float64'
+    'Double': 'float64',
+    'MaybeOwnedFloat': 'float32',
+    'MaybeOwnedByte': 'uint8',
+    'MaybeOwnedInt': 'int32',
     }
 
 def vector_to_array(v):
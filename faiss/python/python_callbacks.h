@@ -11,7 +11,10 @@
 #include <faiss/impl/io.h>
 #include <faiss/InvertedLists.h>
 
-//  all callbacks have to acquire the GIL on input
+//  all callbacks have to acquire the GIL on input. The IO callbacks
+//  acquire it once per call: read_index and write_index make many small
+//  calls, so wrap them in a BufferedIOReader / BufferedIOWriter to let
+//  other Python threads run during serialization.
 
 
 /***********************************************************
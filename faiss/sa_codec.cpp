@@ -0,0 +1,94 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/sa_codec.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <future>
+#include <vector>
+
+#include <faiss/impl/FaissAssert.h>
+
+
+namespace faiss {
+
+typedef Index::idx_t idx_t;
+
+
+void sa_encode_chunked (const Index *index, idx_t n, const float *x,
+                        uint8_t *bytes, idx_t chunk_size)
+{
+    FAISS_THROW_IF_NOT (chunk_size > 0);
+    size_t code_size = index->sa_code_size ();
+    for (idx_t i0 = 0; i0 < n; i0 += chunk_size) {
+        idx_t i1 = std::min (n, i0 + chunk_size);
+        index->sa_encode (i1 - i0, x + i0 * index->d,
+                          bytes + i0 * code_size);
+    }
+}
+
+
+void sa_decode_chunked (const Index *index, idx_t n, const uint8_t *bytes,
+                        float *x, idx_t chunk_size)
+{
+    FAISS_THROW_IF_NOT (chunk_size > 0);
+    size_t code_size = index->sa_code_size ();
+    for (idx_t i0 = 0; i0 < n; i0 += chunk_size) {
+        idx_t i1 = std::min (n, i0 + chunk_size);
+        index->sa_decode (i1 - i0, bytes + i0 * code_size,
+                          x + i0 * index->d);
+    }
+}
+
+
+size_t sa_encode_stream (const Index *index, idx_t chunk_size,
+                         const SAReadFn & read, const SAWriteFn & write)
+{
+    FAISS_THROW_IF_NOT (chunk_size > 0);
+    size_t d = index->d;
+    size_t code_size = index->sa_code_size ();
+
+    // double buffering of the input vectors
+    std::vector<float> x[2];
+    x[0].resize (chunk_size * d);
+    x[1].resize (chunk_size * d);
+    std::vector<uint8_t> codes (chunk_size * code_size);
+
+    auto read_chunk = [&] (int slot) {
+        idx_t ni = read (chunk_size, x[slot].data());
+        FAISS_THROW_IF_NOT_FMT (ni >= 0 && ni <= chunk_size,
+                                "read returned %" PRId64 " vectors",
+                                int64_t(ni));
+        return ni;
+    };
+
+    size_t ntotal = 0;
+    int slot = 0;
+    idx_t ni = read_chunk (slot);
+    while (ni > 0) {
+        std::future<idx_t> next = std::async (
+              std::launch::async, read_chunk, 1 - slot);
+        try {
+            index->sa_encode (ni, x[slot].data(), codes.data());
+            write (ni, codes.data());
+        } catch (...) {
+            // the reader uses the other buffer
+            next.wait ();
+            throw;
+        }
+        ntotal += ni;
+        ni = next.get ();
+        slot = 1 - slot;
+    }
+    return ntotal;
+}
+
+
+} // namespace faiss
@@ -0,0 +1,51 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+// Chunked and streaming versions of the standalone codec interface
+
+#pragma once
+
+#include <functional>
+
+#include <faiss/Index.h>
+
+
+namespace faiss {
+
+/** same as index->sa_encode, by chunks of chunk_size vectors. The
+ * temporary memory of the codecs (coarse assignment, transformed
+ * vectors, residuals) grows with the number of vectors encoded at once,
+ * this bounds it. Each chunk is encoded with all the threads. */
+void sa_encode_chunked (const Index *index, Index::idx_t n, const float *x,
+                        uint8_t *bytes, Index::idx_t chunk_size = 65536);
+
+/// same as index->sa_decode, by chunks of chunk_size vectors
+void sa_decode_chunked (const Index *index, Index::idx_t n,
+                        const uint8_t *bytes, float *x,
+                        Index::idx_t chunk_size = 65536);
+
+/// fills a buffer of at most chunk_size vectors, returns the nb of
+/// vectors read (0 at the end of the stream)
+using SAReadFn = std::function<Index::idx_t (Index::idx_t chunk_size,
+                                             float *x)>;
+
+/// consumes the codes of n vectors (n * sa_code_size bytes)
+using SAWriteFn = std::function<void (Index::idx_t n, const uint8_t *bytes)>;
+
+/** Encodes a stream of vectors of unknown length in chunks of
+ * chunk_size. The next chunk is read in a separate thread while the
+ * current one is encoded, then the codes are passed to write, in the
+ * order of the stream.
+ *
+ * @return  total nb of vectors encoded
+ */
+size_t sa_encode_stream (const Index *index, Index::idx_t chunk_size,
+                         const SAReadFn & read, const SAWriteFn & write);
+
+} // namespace faiss
@@ -31,7 +31,9 @@
 #include <cstdio>
 #include <stdint.h>
 
+#include <algorithm>
 #include <limits>
+#include <vector>
 
 #include <faiss/utils/ordered_key_value.h>
 
@@ -252,6 +254,149 @@ void maxheap_addn (size_t k, T * bh_val, int64_t * bh_ids,
  *******************************************************************/
 
 
+/* Above this size, heap_reorder sorts packed keys instead of popping
+   the heap one element at a time (for the value types that have a
+   packed key). */
+static const size_t heap_reorder_sort_threshold = 128;
+
+/* 32-bit keys whose unsigned order is the order of the values, to sort
+   the (value, position) pairs as 64-bit integers */
+template <typename T>
+struct HeapPackedKey {
+    static const bool supported = false;
+    static uint32_t encode (T) { return 0; }
+    static T decode (uint32_t) { return T(); }
+};
+
+template <>
+struct HeapPackedKey<float> {
+    static const bool supported = true;
+    static uint32_t encode (float x) {
+        uint32_t u;
+        memcpy (&u, &x, sizeof (u));
+        // negative floats are in reverse order
+        return (u & 0x80000000u) ? ~u : u | 0x80000000u;
+    }
+    static float decode (uint32_t e) {
+        uint32_t u = (e & 0x80000000u) ? e & 0x7fffffffu : ~e;
+        float x;
+        memcpy (&x, &u, sizeof (x));
+        return x;
+    }
+};
+
+template <>
+struct HeapPackedKey<int32_t> {
+    static const bool supported = true;
+    static uint32_t encode (int32_t x) { return uint32_t (x) ^ 0x80000000u; }
+    static int32_t decode (uint32_t e) { return int32_t (e ^ 0x80000000u); }
+};
+
+template <>
+struct HeapPackedKey<uint16_t> {
+    static const bool supported = true;
+    static uint32_t encode (uint16_t x) { return x; }
+    static uint16_t decode (uint32_t e) { return uint16_t (e); }
+};
+
+/* Sorts the n pairs best first (increasing values for CMax), equal
+   values by increasing id. The values and positions are packed in
+   64-bit integers, so the sort does integer comparisons without
+   indirection. */
+template <typename C>
+void sort_pairs (size_t n, typename C::T * val, typename C::TI * ids)
+{
+    typedef typename C::T T;
+    typedef typename C::TI TI;
+    typedef HeapPackedKey<T> PK;
+    static_assert (PK::supported || sizeof (T) == 0,
+                   "no packed key for this type");
+
+    std::vector<uint64_t> keys (n);
+    for (size_t i = 0; i < n; i++) {
+        uint32_t kv = PK::encode (val[i]);
+        // best first: decreasing values for CMin
+        kv = C::is_max ? kv : ~kv;
+        keys[i] = (uint64_t (kv) << 32) | i;
+    }
+    std::sort (keys.begin(), keys.end());
+
+    // the values are decoded from the keys, only the ids are permuted
+    std::vector<TI> ids_in (ids, ids + n);
+    for (size_t i = 0; i < n; i++) {
+        uint32_t kv = keys[i] >> 32;
+        val[i] = PK::decode (C::is_max ? kv : ~kv);
+        ids[i] = ids_in[keys[i] & 0xffffffff];
+    }
+
+    // the heap layout must not decide the order of ties
+    for (size_t i0 = 0; i0 < n; ) {
+        size_t i1 = i0 + 1;
+        while (i1 < n && (keys[i1] >> 32) == (keys[i0] >> 32)) {
+            i1++;
+        }
+        if (i1 - i0 > 1) {
+            std::sort (ids + i0, ids + i1);
+        }
+        i0 = i1;
+    }
+}
+
+/* heap_reorder for large heaps: the valid results (id != -1) are
+   sorted with sort_pairs */
+template <typename C>
+size_t heap_reorder_sort (size_t k, typename C::T * bh_val,
+                          typename C::TI * bh_ids)
+{
+    size_t nel = 0;
+    for (size_t i = 0; i < k; i++) {
+        if (bh_ids[i] != -1) {
+            bh_val[nel] = bh_val[i];
+            bh_ids[nel] = bh_ids[i];
+            nel++;
+        }
+    }
+    sort_pairs<C> (nel, bh_val, bh_ids);
+    for (size_t i = nel; i < k; i++) {
+        bh_val[i] = C::neutral();
+        bh_ids[i] = -1;
+    }
+    return nel;
+}
+
+/* dispatches to the packed-key sorts when the value type supports it
+   and the arrays are large enough; returns false otherwise */
+template <typename C, bool packed = HeapPackedKey<typename C::T>::supported>
+struct HeapPackedSort {
+    static bool reorder (size_t, typename C::T *, typename C::TI *,
+                         size_t *) {
+        return false;
+    }
+    static bool sort (size_t, typename C::T *, typename C::TI *) {
+        return false;
+    }
+};
+
+template <typename C>
+struct HeapPackedSort<C, true> {
+    static bool reorder (size_t k, typename C::T * bh_val,
+                         typename C::TI * bh_ids, size_t *nel) {
+        if (k < heap_reorder_sort_threshold) {
+            return false;
+        }
+        *nel = heap_reorder_sort<C> (k, bh_val, bh_ids);
+        return true;
+    }
+    static bool sort (size_t n, typename C::T * val, typename C::TI * ids) {
+        if (n < heap_reorder_sort_threshold) {
+            return false;
+        }
+        sort_pairs<C> (n, val, ids);
+        return true;
+    }
+};
+
+
 /* This function maps a binary heap into an sorted structure.
    It returns the number  */
 template <typename C> inline
@@ -259,6 +404,10 @@ size_t heap_reorder (size_t k, typename C::T * bh_val, typename C::TI * bh_ids)
 {
     size_t i, ii;
 
+    if (HeapPackedSort<C>::reorder (k, bh_val, bh_ids, &ii)) {
+        return ii;
+    }
+
     for (i = 0, ii = 0; i < k; i++) {
         /* top element should be put at the end of the list */
         typename C::T val = bh_val[0];
@@ -0,0 +1,129 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/utils/cpu_dispatch.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <faiss/impl/FaissAssert.h>
+
+namespace faiss {
+
+namespace {
+
+SIMDLevel detect_simd_level ()
+{
+#if defined(FAISS_X86_DISPATCH)
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx512f") &&
+        __builtin_cpu_supports ("avx512bw") &&
+        __builtin_cpu_supports ("avx512dq") &&
+        __builtin_cpu_supports ("avx512vl")) {
+        return SIMD_AVX512;
+    }
+    // all the CPUs with AVX2 and FMA also have F16C
+    if (__builtin_cpu_supports ("avx2") &&
+        __builtin_cpu_supports ("fma") &&
+        __builtin_cpu_supports ("popcnt")) {
+        return SIMD_AVX2;
+    }
+    return SIMD_GENERIC;
+#elif defined(__aarch64__)
+    return SIMD_NEON;
+#else
+    return SIMD_GENERIC;
+#endif
+}
+
+bool is_supported (SIMDLevel level, SIMDLevel supported)
+{
+    if (level == SIMD_GENERIC) {
+        return supported != SIMD_NEON;
+    }
+    if (level == SIMD_NEON || supported == SIMD_NEON) {
+        return level == supported;
+    }
+    return level <= supported;
+}
+
+SIMDLevel initial_simd_level ()
+{
+    SIMDLevel level = supported_simd_level ();
+    const char *env = getenv ("FAISS_SIMD_LEVEL");
+    if (env) {
+        for (int l = SIMD_GENERIC; l <= SIMD_NEON; l++) {
+            if (!strcmp (env, simd_level_name (SIMDLevel (l)))) {
+                if (is_supported (SIMDLevel (l), level)) {
+                    return SIMDLevel (l);
+                }
+                fprintf (stderr, "FAISS_SIMD_LEVEL=%s not supported "
+                         "by this CPU, using %s\n",
+                         env, simd_level_name (level));
+                return level;
+            }
+        }
+        fprintf (stderr, "FAISS_SIMD_LEVEL=%s: unknown level, using %s\n",
+                 env, simd_level_name (level));
+    }
+    return level;
+}
+
+} // anonymous namespace
+
+// dynamically initialized at load time. Before that it is zero, ie.
+// SIMD_GENERIC, so the kernels called by other static initializers are
+// safe.
+SIMDLevel simd_level = initial_simd_level ();
+
+SIMDLevel supported_simd_level ()
+{
+    static const SIMDLevel supported = detect_simd_level ();
+    return supported;
+}
+
+void set_simd_level (SIMDLevel level)
+{
+    FAISS_THROW_IF_NOT_FMT (
+           is_supported (level, supported_simd_level ()),
+           "SIMD level %s not supported (best level is %s)",
+           simd_level_name (level),
+           simd_level_name (supported_simd_level ()));
+    simd_level = level;
+}
+
+SIMDLevel get_simd_level ()
+{
+    return simd_level;
+}
+
+bool use_avx512_vpopcnt ()
+{
+#ifdef FAISS_X86_DISPATCH
+    static const bool supported =
+        (__builtin_cpu_init (), __builtin_cpu_supports ("avx512vpopcntdq"));
+    return use_avx512 () && supported;
+#else
+    return false;
+#endif
+}
+
+const char *simd_level_name (SIMDLevel level)
+{
+    switch (level) {
+    case SIMD_GENERIC: return "generic";
+    case SIMD_AVX2: return "avx2";
+    case SIMD_AVX512: return "avx512";
+    case SIMD_NEON: return "neon";
+    }
+    return "unknown";
+}
+
+} // namespace faiss
@@ -0,0 +1,108 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <faiss/impl/platform_macros.h>
+
+/* Runtime selection of the instruction set.
+ *
+ * On x86-64 with GCC or Clang, the hot kernels are compiled several
+ * times with function target attributes: for the baseline of the build
+ * (FAISS_OPT_LEVEL), for AVX2 and for AVX-512. The variant is selected
+ * at runtime from the SIMD level, that is initialized at library load
+ * from cpuid. So the same binary runs on all machines and uses the best
+ * code for each. On aarch64, the NEON kernels are always compiled in.
+ *
+ * Functions that use AVX2 or AVX-512 intrinsics must be declared with
+ * FAISS_AVX2_TARGET or FAISS_AVX512_TARGET, and may only be called when
+ * use_avx2() or use_avx512() is true.
+ */
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__)) && \
+    !defined(_MSC_VER)
+#define FAISS_X86_DISPATCH
+#define FAISS_AVX2_TARGET \
+    __attribute__((target("avx2,fma,f16c,popcnt")))
+#define FAISS_AVX512_TARGET \
+    __attribute__((target("avx512f,avx512bw,avx512dq,avx512vl,fma")))
+// VPOPCNTDQ is not part of SIMD_AVX512, see use_avx512_vpopcnt
+#define FAISS_AVX512_VPOPCNT_TARGET \
+    __attribute__((target("avx512f,avx512vl,avx512vpopcntdq,avx2,popcnt")))
+#else
+#define FAISS_AVX2_TARGET
+#endif
+
+/* The Hamming kernels only need POPCNT. They are cloned by the compiler
+ * and the clone is selected by the dynamic loader (ifunc), independently
+ * of simd_level. */
+#if defined(FAISS_X86_DISPATCH) && !defined(__POPCNT__) && \
+    !defined(__clang__) && defined(__linux__)
+#define FAISS_POPCNT_CLONES \
+    __attribute__((target_clones("popcnt", "default")))
+#else
+#define FAISS_POPCNT_CLONES
+#endif
+
+namespace faiss {
+
+enum SIMDLevel {
+    SIMD_GENERIC = 0,  ///< baseline of the build, no runtime dispatch
+    SIMD_AVX2,         ///< AVX2, FMA, F16C and POPCNT
+    SIMD_AVX512,       ///< AVX-512 F, BW, DQ and VL
+    SIMD_NEON,         ///< aarch64 with NEON (always compiled in)
+};
+
+/// SIMD level that is used. Do not set it directly, see set_simd_level
+FAISS_API extern SIMDLevel simd_level;
+
+/// best SIMD level that the CPU and the build support
+SIMDLevel supported_simd_level ();
+
+/** change the SIMD level, eg. to benchmark the variants of the kernels.
+ *
+ * Throws if the level is not supported by the CPU. The level can also be
+ * set with the FAISS_SIMD_LEVEL environment variable ("generic", "avx2",
+ * "avx512") at library load.
+ */
+void set_simd_level (SIMDLevel level);
+
+SIMDLevel get_simd_level ();
+
+/// lowercase name of the level, as accepted by FAISS_SIMD_LEVEL
+const char *simd_level_name (SIMDLevel level);
+
+/// whether the AVX2 code paths should be used
+inline bool use_avx2 ()
+{
+#if defined(__AVX2__)
+    // part of the baseline
+    return true;
+#elif defined(FAISS_X86_DISPATCH)
+    return simd_level == SIMD_AVX2 || simd_level == SIMD_AVX512;
+#else
+    return false;
+#endif
+}
+
+/// whether the AVX-512 code paths should be used
+inline bool use_avx512 ()
+{
+#ifdef FAISS_X86_DISPATCH
+    return simd_level == SIMD_AVX512;
+#else
+    return false;
+#endif
+}
+
+/// whether the AVX-512 VPOPCNTDQ code paths should be used: the SIMD
+/// level is SIMD_AVX512 and the CPU supports the extension (Ice Lake+)
+bool use_avx512_vpopcnt ();
+
+} // namespace faiss
@@ -14,12 +14,15 @@
 #include <cassert>
 #include <cstring>
 #include <cmath>
+#include <type_traits>
 
 #include <omp.h>
 
 #include <faiss/impl/AuxIndexStructures.h>
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/impl/ResultHandler.h>
+#include <faiss/utils/fp16.h>
+#include <faiss/utils/vector_view.h>
 
 
 
@@ -111,14 +114,60 @@ namespace {
 
 
 
+/* Distances between the float query x and the vectors j0 .. j1 - 1 of
+ * y. The float32 vectors are used in place, the fp16 and bf16 vectors
+ * are converted inside the distance functions, and the integer vectors
+ * are converted to tmp (size (j1 - j0) * d) first. */
+template<bool is_L2>
+void distances_to_view (float *dis, const float *x,
+                        const VectorArrayView & y, size_t j0, size_t j1,
+                        std::vector<float> & tmp)
+{
+    size_t d = y.d;
+    switch (y.type) {
+    case VET_float32:
+        for (size_t j = j0; j < j1; j++) {
+            const float *y_j = (const float*)y.get (j);
+            dis[j - j0] = is_L2 ? fvec_L2sqr (x, y_j, d) :
+                                  fvec_inner_product (x, y_j, d);
+        }
+        break;
+    case VET_float16:
+        for (size_t j = j0; j < j1; j++) {
+            const uint16_t *y_j = (const uint16_t*)y.get (j);
+            dis[j - j0] = is_L2 ? fvec_L2sqr_fp16 (x, y_j, d) :
+                                  fvec_inner_product_fp16 (x, y_j, d);
+        }
+        break;
+    case VET_bfloat16:
+        for (size_t j = j0; j < j1; j++) {
+            const uint16_t *y_j = (const uint16_t*)y.get (j);
+            dis[j - j0] = is_L2 ? fvec_L2sqr_bf16 (x, y_j, d) :
+                                  fvec_inner_product_bf16 (x, y_j, d);
+        }
+        break;
+    default: {
+        const float *yb = y.get_float (j0, j1, tmp);
+        if (is_L2) {
+            fvec_L2sqr_ny (dis, x, yb, d, j1 - j0);
+        } else {
+            fvec_inner_products_ny (dis, x, yb, d, j1 - j0);
+        }
+    }
+    }
+}
+
+// nb of database vectors handled at once by distances_to_view
+const size_t view_bs = 256;
+
 /* Find the nearest neighbors for nx queries in a set of ny vectors */
-template<class ResultHandler>
-void exhaustive_inner_product_seq (
-        const float * x,
-        const float * y,
-        size_t d, size_t nx, size_t ny,
-        ResultHandler &res)
+template<bool is_L2, class ResultHandler>
+void exhaustive_seq (
+        const VectorArrayView & x,
+        const VectorArrayView & y,
+        ResultHandler & res)
 {
+    size_t nx = x.n, ny = y.n, d = x.d;
     size_t check_period = InterruptCallback::get_period_hint (ny * d);
 
     check_period *= omp_get_max_threads();
@@ -131,17 +180,19 @@ void exhaustive_inner_product_seq (
 #pragma omp parallel
         {
             SingleResultHandler resi(res);
+            std::vector<float> xbuf, tmp, dis (view_bs);
 #pragma omp for
             for (int64_t i = i0; i < i1; i++) {
-                const float * x_i = x + i * d;
-                const float * y_j = y;
+                const float * x_i = x.get_float (i, i + 1, xbuf);
 
                 resi.begin(i);
 
-                for (size_t j = 0; j < ny; j++) {
-                    float ip = fvec_inner_product (x_i, y_j, d);
-                    resi.add_result(ip, j);
-                    y_j += d;
+                for (size_t j0 = 0; j0 < ny; j0 += view_bs) {
+                    size_t j1 = std::min (j0 + view_bs, ny);
+                    distances_to_view<is_L2> (dis.data(), x_i, y, j0, j1, tmp);
+                    for (size_t j = j0; j < j1; j++) {
+                        resi.add_result(dis[j - j0], j);
+                    }
                 }
                 resi.end();
             }
@@ -151,54 +202,112 @@ void exhaustive_inner_product_seq (
 
 }
 
-template<class ResultHandler>
-void exhaustive_L2sqr_seq (
-                const float * x,
-                const float * y,
-                size_t d, size_t nx, size_t ny,
-                ResultHandler & res)
+
+/* For fewer queries than threads: each thread scans a slice of the
+ * database vectors for all the queries, collecting the results in its
+ * own heaps, then the heaps are merged into the result. The slices are
+ * processed by blocks. */
+template<class C, bool is_L2>
+void exhaustive_split_database (
+        const VectorArrayView & x,
+        const VectorArrayView & y,
+        HeapArray<C> * ha)
 {
+    size_t nx = x.n, ny = y.n;
+    size_t k = ha->k;
+    int nt = std::min (size_t(omp_get_max_threads()), ny / k);
 
-    size_t check_period = InterruptCallback::get_period_hint (ny * d);
-    check_period *= omp_get_max_threads();
-    using SingleResultHandler = typename ResultHandler::SingleResultHandler;
+    // there are few queries, convert them all
+    std::vector<float> xbuf;
+    const float *xf = x.get_float (0, nx, xbuf);
 
-    for (size_t i0 = 0; i0 < nx; i0 += check_period) {
-        size_t i1 = std::min(i0 + check_period, nx);
+    std::vector<float> th_dis (nt * nx * k);
+    std::vector<int64_t> th_ids (nt * nx * k);
 
-#pragma omp parallel
-        {
-            SingleResultHandler resi(res);
-#pragma omp for
-            for (int64_t i = i0; i < i1; i++) {
-                const float * x_i = x + i * d;
-                const float * y_j = y;
-                resi.begin(i);
-                for (size_t j = 0; j < ny; j++) {
-                    float disij = fvec_L2sqr (x_i, y_j, d);
-                    resi.add_result(disij, j);
-                    y_j += d;
+#pragma omp parallel num_threads(nt)
+    {
+        int rank = omp_get_thread_num ();
+        size_t j0 = ny * rank / nt;
+        size_t j1 = ny * (rank + 1) / nt;
+        float * dis = th_dis.data() + rank * nx * k;
+        int64_t * ids = th_ids.data() + rank * nx * k;
+        std::vector<float> buf (view_bs), tmp;
+
+        for (size_t i = 0; i < nx; i++) {
+            heap_heapify<C> (k, dis + i * k, ids + i * k);
+        }
+
+        for (size_t jb = j0; jb < j1; jb += view_bs) {
+            size_t jb1 = std::min (jb + view_bs, j1);
+            for (size_t i = 0; i < nx; i++) {
+                const float * x_i = xf + i * x.d;
+                distances_to_view<is_L2> (buf.data(), x_i, y, jb, jb1, tmp);
+                float * dis_i = dis + i * k;
+                int64_t * ids_i = ids + i * k;
+                for (size_t j = jb; j < jb1; j++) {
+                    float v = buf[j - jb];
+                    if (C::cmp (dis_i[0], v)) {
+                        heap_pop<C> (k, dis_i, ids_i);
+                        heap_push<C> (k, dis_i, ids_i, v, j);
+                    }
                 }
-                resi.end();
             }
         }
-        InterruptCallback::check ();
     }
 
-};
+    for (size_t i = 0; i < nx; i++) {
+        float * dis_i = ha->val + i * k;
+        int64_t * ids_i = ha->ids + i * k;
+        heap_heapify<C> (k, dis_i, ids_i,
+                         th_dis.data() + i * k, th_ids.data() + i * k, k);
+        for (int rank = 1; rank < nt; rank++) {
+            size_t ofs = (rank * nx + i) * k;
+            heap_addn<C> (k, dis_i, ids_i,
+                          th_dis.data() + ofs, th_ids.data() + ofs, k);
+        }
+        heap_reorder<C> (k, dis_i, ids_i);
+    }
+    InterruptCallback::check ();
+}
 
+// whether to parallelize over database vectors rather than queries
+bool use_split_database (size_t nx, size_t ny, size_t k)
+{
+    int nt = omp_get_max_threads ();
+    return nt > 1 && nx < nt &&
+           ny >= distance_compute_split_database_min_ny &&
+           ny >= 2 * k;
+}
 
 
 
 
-/** Find the nearest neighbors for nx queries in a set of ny vectors */
+
+/* sgemm of the blocks of vectors, possibly strided.
+ * ip_block[i * ny + j] = <x_i, y_j> */
+void ip_block_sgemm (const float *xb, size_t ldx, size_t nx,
+                     const float *yb, size_t ldy, size_t ny,
+                     size_t d, float *ip_block)
+{
+    float one = 1, zero = 0;
+    FINTEGER nyi = ny, nxi = nx, di = d;
+    FINTEGER ldxi = ldx, ldyi = ldy;
+    sgemm_ ("Transpose", "Not transpose", &nyi, &nxi, &di, &one,
+            yb, &ldyi,
+            xb, &ldxi, &zero,
+            ip_block, &nyi);
+}
+
+/** Find the nearest neighbors for nx queries in a set of ny vectors.
+ * The blocks of vectors that are not float32 are converted just before
+ * their sgemm. */
 template<class ResultHandler>
 void exhaustive_inner_product_blas (
-        const float * x,
-        const float * y,
-        size_t d, size_t nx, size_t ny,
+        const VectorArrayView & x,
+        const VectorArrayView & y,
         ResultHandler & res)
 {
+    size_t nx = x.n, ny = y.n, d = x.d;
     // BLAS does not like empty matrices
     if (nx == 0 || ny == 0) return;
 
@@ -206,25 +315,25 @@ void exhaustive_inner_product_blas (
     const size_t bs_x = distance_compute_blas_query_bs;
     const size_t bs_y = distance_compute_blas_database_bs;
     std::unique_ptr<float[]> ip_block(new float[bs_x * bs_y]);
+    std::vector<float> xbuf, ybuf;
 
     for (size_t i0 = 0; i0 < nx; i0 += bs_x) {
         size_t i1 = i0 + bs_x;
         if(i1 > nx) i1 = nx;
+        size_t ldx;
+        const float *xb = x.get_float (i0, i1, xbuf, &ldx);
 
         res.begin_multiple(i0, i1);
 
         for (size_t j0 = 0; j0 < ny; j0 += bs_y) {
             size_t j1 = j0 + bs_y;
             if (j1 > ny) j1 = ny;
+            size_t ldy;
+            const float *yb = y.get_float (j0, j1, ybuf, &ldy);
+
             /* compute the actual dot products */
-            {
-                float one = 1, zero = 0;
-                FINTEGER nyi = j1 - j0, nxi = i1 - i0, di = d;
-                sgemm_ ("Transpose", "Not transpose", &nyi, &nxi, &di, &one,
-                        y + j0 * d, &di,
-                        x + i0 * d, &di, &zero,
-                        ip_block.get(), &nyi);
-            }
+            ip_block_sgemm (xb, ldx, i1 - i0, yb, ldy, j1 - j0, d,
+                            ip_block.get());
 
             res.add_results(j0, j1, ip_block.get());
 
@@ -238,71 +347,224 @@ void exhaustive_inner_product_blas (
 
 
 
-// distance correction is an operator that can be applied to transform
-// the distances
+/* Fold a block of inner products ip_block (size (i1 - i0) * (j1 - j0))
+ * into the results, as L2 distances. The generic version converts the
+ * block in place and passes it to the result handler. The versions for
+ * the heap and reservoir handlers do the conversion on the fly, one query
+ * row at a time (in parallel over the queries), and compare
+ * y_norm - 2 * ip to threshold - x_norm so that the distance is fully
+ * computed only for the candidates that enter the results. */
+template<class ResultHandler>
+void add_results_L2sqr (
+        ResultHandler & res,
+        size_t i0, size_t i1, size_t j0, size_t j1,
+        float *ip_block, const float *x_norms, const float *y_norms)
+{
+#pragma omp parallel for if ((i1 - i0) * (j1 - j0) > 100000)
+    for (int64_t i = i0; i < i1; i++) {
+        float *ip_line = ip_block + (i - i0) * (j1 - j0);
+
+        for (size_t j = j0; j < j1; j++) {
+            float ip = *ip_line;
+            float dis = x_norms[i] + y_norms[j] - 2 * ip;
+
+            // negative values can occur for identical vectors
+            // due to roundoff errors
+            if (dis < 0) dis = 0;
+
+            *ip_line = dis;
+            ip_line++;
+        }
+    }
+    res.add_results(j0, j1, ip_block);
+}
+
+template<class C>
+void add_results_L2sqr (
+        HeapResultHandler<C> & res,
+        size_t i0, size_t i1, size_t j0, size_t j1,
+        float *ip_block, const float *x_norms, const float *y_norms)
+{
+    size_t k = res.k;
+#pragma omp parallel for if ((i1 - i0) * (j1 - j0) > 100000)
+    for (int64_t i = i0; i < i1; i++) {
+        const float *ip_line = ip_block + (i - i0) * (j1 - j0);
+        float *heap_dis = res.heap_dis_tab + i * k;
+        int64_t *heap_ids = res.heap_ids_tab + i * k;
+        float xn = x_norms[i];
+        float thresh = heap_dis[0] - xn;
+        for (size_t j = j0; j < j1; j++) {
+            float v = y_norms[j] - 2 * ip_line[j - j0];
+            if (C::cmp (thresh, v)) {
+                float dis = std::max (v + xn, 0.0f);
+                heap_pop<C> (k, heap_dis, heap_ids);
+                heap_push<C> (k, heap_dis, heap_ids, dis, j);
+                thresh = heap_dis[0] - xn;
+            }
+        }
+    }
+}
+
+template<class C>
+void add_results_L2sqr (
+        ReservoirResultHandler<C> & res,
+        size_t i0, size_t i1, size_t j0, size_t j1,
+        float *ip_block, const float *x_norms, const float *y_norms)
+{
+#pragma omp parallel for if ((i1 - i0) * (j1 - j0) > 100000)
+    for (int64_t i = i0; i < i1; i++) {
+        const float *ip_line = ip_block + (i - i0) * (j1 - j0);
+        ReservoirTopN<C> & reservoir = res.reservoirs[i - i0];
+        float xn = x_norms[i];
+        for (size_t j = j0; j < j1; j++) {
+            float v = y_norms[j] - 2 * ip_line[j - j0];
+            // reservoir.threshold changes when the reservoir is shrunk
+            if (C::cmp (reservoir.threshold - xn, v)) {
+                reservoir.add (std::max (v + xn, 0.0f), j);
+            }
+        }
+    }
+}
+
+/* k = 1: running argmin per query row, with the norm addition fused in
+ * the comparison (the norm of x_i does not change the argmin, it is added
+ * to the final distance only). The row is processed by blocks whose min
+ * is computed without branches, the argmin is searched only in the
+ * blocks that improve on the current best. */
+template<class C>
+void add_results_L2sqr (
+        SingleBestResultHandler<C> & res,
+        size_t i0, size_t i1, size_t j0, size_t j1,
+        float *ip_block, const float *x_norms, const float *y_norms)
+{
+    static_assert (std::is_same<typename C::T, float>::value &&
+                   C::is_max, "L2 distances are minimized");
+    const size_t bs = 16;
+#pragma omp parallel for if ((i1 - i0) * (j1 - j0) > 100000)
+    for (int64_t i = i0; i < i1; i++) {
+        const float *ip_line = ip_block + (i - i0) * (j1 - j0);
+        float xn = x_norms[i];
+        float thresh = res.dis_tab[i] - xn;
+        int64_t best = -1;
+        size_t j = j0;
+        for (; j + bs <= j1; j += bs) {
+            float v[bs];
+            for (size_t l = 0; l < bs; l++) {
+                v[l] = y_norms[j + l] - 2 * ip_line[j - j0 + l];
+            }
+            float vmin[4] = {v[0], v[1], v[2], v[3]};
+            for (size_t l = 4; l < bs; l += 4) {
+                for (size_t m = 0; m < 4; m++) {
+                    vmin[m] = v[l + m] < vmin[m] ? v[l + m] : vmin[m];
+                }
+            }
+            float mi = std::min (std::min (vmin[0], vmin[1]),
+                                 std::min (vmin[2], vmin[3]));
+            if (mi < thresh) {
+                for (size_t l = 0; l < bs; l++) {
+                    if (v[l] < thresh) {
+                        thresh = v[l];
+                        best = j + l;
+                    }
+                }
+            }
+        }
+        for (; j < j1; j++) {
+            float v = y_norms[j] - 2 * ip_line[j - j0];
+            if (v < thresh) {
+                thresh = v;
+                best = j;
+            }
+        }
+        // thresh + xn may round to the current best: keep the first one
+        float dis = std::max (thresh + xn, 0.0f);
+        if (best >= 0 && dis < res.dis_tab[i]) {
+            res.dis_tab[i] = dis;
+            res.ids_tab[i] = best;
+        }
+    }
+}
+
+// squared norms of n vectors whose starts are ld floats apart
+void norms_L2sqr_strided (float *nr, const float *x,
+                          size_t d, size_t n, size_t ld)
+{
+    if (ld == d) {
+        fvec_norms_L2sqr (nr, x, d, n);
+        return;
+    }
+#pragma omp parallel for if (n > 1000)
+    for (int64_t i = 0; i < n; i++) {
+        nr[i] = fvec_norm_L2sqr (x + i * ld, d);
+    }
+}
+
+// nb of queries per block of inner products
+template<class ResultHandler>
+size_t blas_query_bs (const ResultHandler &)
+{
+    return distance_compute_blas_query_bs;
+}
+
+// k = 1: the block is read once by the argmin, keep it in the L2 cache
+template<class C>
+size_t blas_query_bs (const SingleBestResultHandler<C> &)
+{
+    return std::min (distance_compute_blas_query_bs, 256);
+}
+
 template<class ResultHandler>
 void exhaustive_L2sqr_blas (
-        const float * x,
-        const float * y,
-        size_t d, size_t nx, size_t ny,
+        const VectorArrayView & x,
+        const VectorArrayView & y,
         ResultHandler & res,
         const float *y_norms = nullptr)
 {
+    size_t nx = x.n, ny = y.n, d = x.d;
     // BLAS does not like empty matrices
     if (nx == 0 || ny == 0) return;
 
     /* block sizes */
-    const size_t bs_x = distance_compute_blas_query_bs;
+    const size_t bs_x = blas_query_bs (res);
     const size_t bs_y = distance_compute_blas_database_bs;
     // const size_t bs_x = 16, bs_y = 16;
     std::unique_ptr<float []> ip_block(new float[bs_x * bs_y]);
     std::unique_ptr<float []> x_norms(new float[nx]);
     std::unique_ptr<float []> del2;
+    std::vector<float> xbuf, ybuf;
 
-    fvec_norms_L2sqr (x_norms.get(), x, d, nx);
-
-    if (!y_norms) {
+    // the norms of y are computed on the blocks of the first pass
+    bool compute_y_norms = !y_norms;
+    if (compute_y_norms) {
         float *y_norms2 = new float[ny];
         del2.reset(y_norms2);
-        fvec_norms_L2sqr (y_norms2, y, d, ny);
         y_norms = y_norms2;
     }
 
     for (size_t i0 = 0; i0 < nx; i0 += bs_x) {
         size_t i1 = i0 + bs_x;
         if(i1 > nx) i1 = nx;
+        size_t ldx;
+        const float *xb = x.get_float (i0, i1, xbuf, &ldx);
+        norms_L2sqr_strided (x_norms.get() + i0, xb, d, i1 - i0, ldx);
 
         res.begin_multiple(i0, i1);
 
         for (size_t j0 = 0; j0 < ny; j0 += bs_y) {
             size_t j1 = j0 + bs_y;
             if (j1 > ny) j1 = ny;
-            /* compute the actual dot products */
-            {
-                float one = 1, zero = 0;
-                FINTEGER nyi = j1 - j0, nxi = i1 - i0, di = d;
-                sgemm_ ("Transpose", "Not transpose", &nyi, &nxi, &di, &one,
-                        y + j0 * d, &di,
-                        x + i0 * d, &di, &zero,
-                        ip_block.get(), &nyi);
+            size_t ldy;
+            const float *yb = y.get_float (j0, j1, ybuf, &ldy);
+            if (compute_y_norms && i0 == 0) {
+                norms_L2sqr_strided (del2.get() + j0, yb, d, j1 - j0, ldy);
             }
 
-            for (int64_t i = i0; i < i1; i++) {
-                float *ip_line = ip_block.get() + (i - i0) * (j1 - j0);
-
-                for (size_t j = j0; j < j1; j++) {
-                    float ip = *ip_line;
-                    float dis = x_norms[i] + y_norms[j] - 2 * ip;
-
-                    // negative values can occur for identical vectors
-                    // due to roundoff errors
-                    if (dis < 0) dis = 0;
+            /* compute the actual dot products */
+            ip_block_sgemm (xb, ldx, i1 - i0, yb, ldy, j1 - j0, d,
+                            ip_block.get());
 
-                    *ip_line = dis;
-                    ip_line++;
-                }
-            }
-            res.add_results(j0, j1, ip_block.get());
+            add_results_L2sqr (res, i0, i1, j0, j1, ip_block.get(),
+                               x_norms.get(), y_norms);
         }
         res.end_multiple();
         InterruptCallback::check ();
@@ -325,62 +587,103 @@ int distance_compute_blas_threshold = 20;
 int distance_compute_blas_query_bs = 4096;
 int distance_compute_blas_database_bs = 1024;
 int distance_compute_min_k_reservoir = 100;
+int distance_compute_split_database_min_ny = 4096;
 
-void knn_inner_product (const float * x,
-        const float * y,
-        size_t d, size_t nx, size_t ny,
-        float_minheap_array_t * ha)
+void knn_inner_product (const VectorArrayView & x,
+                        const VectorArrayView & y,
+                        float_minheap_array_t * ha)
 {
-    if (ha->k < distance_compute_min_k_reservoir) {
+    FAISS_THROW_IF_NOT (x.d == y.d && ha->nh == x.n);
+    size_t nx = x.n, ny = y.n;
+    if (use_split_database (nx, ny, ha->k)) {
+        exhaustive_split_database<CMin<float, int64_t>, false> (x, y, ha);
+    } else if (ha->k == 1) {
+        SingleBestResultHandler<CMin<float, int64_t>> res(
+            ha->nh, ha->val, ha->ids);
+        if (nx < distance_compute_blas_threshold) {
+            exhaustive_seq<false> (x, y, res);
+        } else {
+            exhaustive_inner_product_blas (x, y, res);
+        }
+    } else if (ha->k < distance_compute_min_k_reservoir) {
         HeapResultHandler<CMin<float, int64_t>> res(
             ha->nh, ha->val, ha->ids, ha->k);
         if (nx < distance_compute_blas_threshold) {
-            exhaustive_inner_product_seq (x, y, d, nx, ny, res);
+            exhaustive_seq<false> (x, y, res);
         } else {
-            exhaustive_inner_product_blas (x, y, d, nx, ny, res);
+            exhaustive_inner_product_blas (x, y, res);
         }
     } else {
         ReservoirResultHandler<CMin<float, int64_t>> res(
             ha->nh, ha->val, ha->ids, ha->k);
         if (nx < distance_compute_blas_threshold) {
-            exhaustive_inner_product_seq (x, y, d, nx, ny, res);
+            exhaustive_seq<false> (x, y, res);
         } else {
-            exhaustive_inner_product_blas (x, y, d, nx, ny, res);
+            exhaustive_inner_product_blas (x, y, res);
         }
     }
 }
 
-
+void knn_inner_product (const float * x,
+        const float * y,
+        size_t d, size_t nx, size_t ny,
+        float_minheap_array_t * ha)
+{
+    knn_inner_product (VectorArrayView (x, nx, d),
+                       VectorArrayView (y, ny, d), ha);
+}
 
 
 void knn_L2sqr (
-        const float * x,
-        const float * y,
-        size_t d, size_t nx, size_t ny,
+        const VectorArrayView & x,
+        const VectorArrayView & y,
         float_maxheap_array_t * ha,
-        const float *y_norm2
-) {
-
-    if (ha->k < distance_compute_min_k_reservoir) {
+        const float *y_norm2)
+{
+    FAISS_THROW_IF_NOT (x.d == y.d && ha->nh == x.n);
+    size_t nx = x.n, ny = y.n;
+    if (use_split_database (nx, ny, ha->k)) {
+        exhaustive_split_database<CMax<float, int64_t>, true> (x, y, ha);
+    } else if (ha->k == 1) {
+        // nearest centroid assignment (k-means, IVF add): no heaps
+        SingleBestResultHandler<CMax<float, int64_t>> res(
+            ha->nh, ha->val, ha->ids);
+        if (nx < distance_compute_blas_threshold) {
+            exhaustive_seq<true> (x, y, res);
+        } else {
+            exhaustive_L2sqr_blas (x, y, res, y_norm2);
+        }
+    } else if (ha->k < distance_compute_min_k_reservoir) {
         HeapResultHandler<CMax<float, int64_t>> res(
             ha->nh, ha->val, ha->ids, ha->k);
 
         if (nx < distance_compute_blas_threshold) {
-            exhaustive_L2sqr_seq (x, y, d, nx, ny, res);
+            exhaustive_seq<true> (x, y, res);
         } else {
-            exhaustive_L2sqr_blas (x, y, d, nx, ny, res, y_norm2);
+            exhaustive_L2sqr_blas (x, y, res, y_norm2);
         }
     } else {
         ReservoirResultHandler<CMax<float, int64_t>> res(
             ha->nh, ha->val, ha->ids, ha->k);
         if (nx < distance_compute_blas_threshold) {
-            exhaustive_L2sqr_seq (x, y, d, nx, ny, res);
+            exhaustive_seq<true> (x, y, res);
         } else {
-            exhaustive_L2sqr_blas (x, y, d, nx, ny, res, y_norm2);
+            exhaustive_L2sqr_blas (x, y, res, y_norm2);
         }
     }
 }
 
+void knn_L2sqr (
+        const float * x,
+        const float * y,
+        size_t d, size_t nx, size_t ny,
+        float_maxheap_array_t * ha,
+        const float *y_norm2
+) {
+    knn_L2sqr (VectorArrayView (x, nx, d), VectorArrayView (y, ny, d),
+               ha, y_norm2);
+}
+
 
 /***************************************************************************
  * Range search
@@ -397,10 +700,11 @@ void range_search_L2sqr (
         RangeSearchResult *res)
 {
     RangeSearchResultHandler<CMax<float, int64_t>> resh(res, radius);
+    VectorArrayView xv (x, nx, d), yv (y, ny, d);
     if (nx < distance_compute_blas_threshold) {
-        exhaustive_L2sqr_seq (x, y, d, nx, ny, resh);
+        exhaustive_seq<true> (xv, yv, resh);
     } else {
-        exhaustive_L2sqr_blas (x, y, d, nx, ny, resh);
+        exhaustive_L2sqr_blas (xv, yv, resh);
     }
 }
 
@@ -413,10 +717,11 @@ void range_search_inner_product (
 {
 
     RangeSearchResultHandler<CMin<float, int64_t>> resh(res, radius);
+    VectorArrayView xv (x, nx, d), yv (y, ny, d);
     if (nx < distance_compute_blas_threshold) {
-        exhaustive_inner_product_seq (x, y, d, nx, ny, resh);
+        exhaustive_seq<false> (xv, yv, resh);
     } else {
-        exhaustive_inner_product_blas (x, y, d, nx, ny, resh);
+        exhaustive_inner_product_blas (xv, yv, resh);
     }
 }
 
@@ -80,6 +80,52 @@ void fvec_L2sqr_ny (
         size_t d, size_t ny);
 
 
+/** compute the L2 distances / inner products between x and 4 vectors
+ * at once, which saves loads of x. The results are bit-exact with
+ * fvec_L2sqr / fvec_inner_product on each vector. */
+void fvec_L2sqr_batch_4 (
+        const float * x,
+        const float * y0, const float * y1,
+        const float * y2, const float * y3,
+        size_t d,
+        float & dis0, float & dis1, float & dis2, float & dis3);
+
+void fvec_inner_product_batch_4 (
+        const float * x,
+        const float * y0, const float * y1,
+        const float * y2, const float * y3,
+        size_t d,
+        float & dis0, float & dis1, float & dis2, float & dis3);
+
+/** distances / inner products between x and ny contiguous vectors y,
+ * bit-exact with fvec_L2sqr / fvec_inner_product. The common dimensions
+ * (64, 96, 128, 256, 384, 512, 768, 1024) use kernels where d is a
+ * compile-time constant. */
+void fvec_L2sqr_ny_batch_4 (
+        float * dis,
+        const float * x,
+        const float * y,
+        size_t d, size_t ny);
+
+void fvec_inner_products_ny_batch_4 (
+        float * ip,
+        const float * x,
+        const float * y,
+        size_t d, size_t ny);
+
+/** squared L2 distance computed by blocks of block_size dimensions,
+ * that stops after the first block where the partial sum exceeds
+ * threshold. The partial sum is then returned: it is a lower bound of
+ * the distance, larger than threshold. Most effective when the first
+ * dimensions have the largest variance (eg. after a PCA).
+ */
+float fvec_L2sqr_early_abort (
+        const float * x,
+        const float * y,
+        size_t d, float threshold,
+        size_t block_size = 64);
+
+
 /** squared norm of a vector */
 float fvec_norm_L2sqr (const float * x,
                        size_t d);
@@ -164,6 +210,11 @@ FAISS_API extern int distance_compute_blas_database_bs;
 // rather than a heap
 FAISS_API extern int distance_compute_min_k_reservoir;
 
+// when there are fewer queries than threads, the search is parallelized
+// over the database vectors if there are at least this many of them (also
+// for the PQ code scans of ProductQuantizer and IndexPQ)
+FAISS_API extern int distance_compute_split_database_min_ny;
+
 /** Return the k nearest neighors of each of the nx vectors x among the ny
  *  vector y, w.r.t to max inner product
  *
@@ -187,6 +238,27 @@ void knn_L2sqr (
         float_maxheap_array_t * res,
         const float *y_norm2 = nullptr);
 
+/// Forward declaration, see vector_view.h
+struct VectorArrayView;
+
+/** Same as knn_inner_product and knn_L2sqr, for vectors of any element
+ * type and stride. The vectors that are not float32 are converted by
+ * blocks inside the distance computations, without a full copy.
+ *
+ * @param x    query vectors, res->nh vectors
+ * @param y    database vectors, same dimension as x
+ */
+void knn_inner_product (
+        const VectorArrayView & x,
+        const VectorArrayView & y,
+        float_minheap_array_t * res);
+
+void knn_L2sqr (
+        const VectorArrayView & x,
+        const VectorArrayView & y,
+        float_maxheap_array_t * res,
+        const float *y_norm2 = nullptr);
+
 
 /* Find the nearest neighbors for nx queries in a set of ny vectors
  * indexed by ids. May be useful for re-ranking a pre-selected vector list
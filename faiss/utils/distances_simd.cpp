@@ -14,13 +14,10 @@
 #include <cstring>
 #include <cmath>
 
+#include <faiss/utils/simd_x86.h>
 #include <faiss/utils/simdlib.h>
 #include <faiss/impl/FaissAssert.h>
 
-#ifdef __SSE3__
-#include <immintrin.h>
-#endif
-
 #ifdef __aarch64__
 #include <arm_neon.h>
 #endif
@@ -327,7 +324,7 @@ void fvec_op_ny_D12 (float * dis, const float * x,
 
 } // anonymous namespace
 
-void fvec_L2sqr_ny (float * dis, const float * x,
+static void fvec_L2sqr_ny_default (float * dis, const float * x,
                         const float * y, size_t d, size_t ny) {
     // optimized for a few special cases
 
@@ -394,7 +391,7 @@ static inline __m256 masked_read_8 (int d, const float *x)
     }
 }
 
-float fvec_inner_product (const float * x,
+static float fvec_inner_product_default (const float * x,
                           const float * y,
                           size_t d)
 {
@@ -428,7 +425,7 @@ float fvec_inner_product (const float * x,
     return  _mm_cvtss_f32 (msum2);
 }
 
-float fvec_L2sqr (const float * x,
+static float fvec_L2sqr_default (const float * x,
                  const float * y,
                  size_t d)
 {
@@ -465,7 +462,7 @@ float fvec_L2sqr (const float * x,
     return  _mm_cvtss_f32 (msum2);
 }
 
-float fvec_L1 (const float * x, const float * y, size_t d)
+static float fvec_L1_default (const float * x, const float * y, size_t d)
 {
     __m256 msum1 = _mm256_setzero_ps();
     __m256 signmask = __m256(_mm256_set1_epi32 (0x7fffffffUL));
@@ -502,7 +499,7 @@ float fvec_L1 (const float * x, const float * y, size_t d)
     return  _mm_cvtss_f32 (msum2);
 }
 
-float fvec_Linf (const float * x, const float * y, size_t d)
+static float fvec_Linf_default (const float * x, const float * y, size_t d)
 {
     __m256 msum1 = _mm256_setzero_ps();
     __m256 signmask = __m256(_mm256_set1_epi32 (0x7fffffffUL));
@@ -541,18 +538,18 @@ float fvec_Linf (const float * x, const float * y, size_t d)
 
 #elif defined(__SSE3__) // But not AVX
 
-float fvec_L1 (const float * x, const float * y, size_t d)
+static float fvec_L1_default (const float * x, const float * y, size_t d)
 {
     return fvec_L1_ref (x, y, d);
 }
 
-float fvec_Linf (const float * x, const float * y, size_t d)
+static float fvec_Linf_default (const float * x, const float * y, size_t d)
 {
     return fvec_Linf_ref (x, y, d);
 }
 
 
-float fvec_L2sqr (const float * x,
+static float fvec_L2sqr_default (const float * x,
                  const float * y,
                  size_t d)
 {
@@ -580,7 +577,7 @@ float fvec_L2sqr (const float * x,
 }
 
 
-float fvec_inner_product (const float * x,
+static float fvec_inner_product_default (const float * x,
                          const float * y,
                          size_t d)
 {
@@ -608,88 +605,171 @@ float fvec_inner_product (const float * x,
 
 #elif defined(__aarch64__)
 
+namespace {
 
-float fvec_L2sqr (const float * x,
+// sum of the 4 components
+inline float horizontal_sum_neon (float32x4_t v)
+{
+    return vaddvq_f32 (v);
+}
+
+} // anonymous namespace
+
+static float fvec_L2sqr_default (const float * x,
                   const float * y,
                   size_t d)
 {
-    if (d & 3) return fvec_L2sqr_ref (x, y, d);
-    float32x4_t accu = vdupq_n_f32 (0);
-    for (size_t i = 0; i < d; i += 4) {
-        float32x4_t xi = vld1q_f32 (x + i);
-        float32x4_t yi = vld1q_f32 (y + i);
-        float32x4_t sq = vsubq_f32 (xi, yi);
-        accu = vfmaq_f32 (accu, sq, sq);
+    float32x4_t accu0 = vdupq_n_f32 (0);
+    float32x4_t accu1 = vdupq_n_f32 (0);
+    size_t i = 0;
+    for (; i + 8 <= d; i += 8) {
+        float32x4_t sq0 = vsubq_f32 (vld1q_f32 (x + i), vld1q_f32 (y + i));
+        float32x4_t sq1 = vsubq_f32 (vld1q_f32 (x + i + 4),
+                                     vld1q_f32 (y + i + 4));
+        accu0 = vfmaq_f32 (accu0, sq0, sq0);
+        accu1 = vfmaq_f32 (accu1, sq1, sq1);
+    }
+    if (i + 4 <= d) {
+        float32x4_t sq = vsubq_f32 (vld1q_f32 (x + i), vld1q_f32 (y + i));
+        accu0 = vfmaq_f32 (accu0, sq, sq);
+        i += 4;
+    }
+    float res = horizontal_sum_neon (vaddq_f32 (accu0, accu1));
+    for (; i < d; i++) {
+        float tmp = x[i] - y[i];
+        res += tmp * tmp;
     }
-    float32x4_t a2 = vpaddq_f32 (accu, accu);
-    return vdups_laneq_f32 (a2, 0) + vdups_laneq_f32 (a2, 1);
+    return res;
 }
 
-float fvec_inner_product (const float * x,
+static float fvec_inner_product_default (const float * x,
                           const float * y,
                           size_t d)
 {
-    if (d & 3) return fvec_inner_product_ref (x, y, d);
-    float32x4_t accu = vdupq_n_f32 (0);
-    for (size_t i = 0; i < d; i += 4) {
-        float32x4_t xi = vld1q_f32 (x + i);
-        float32x4_t yi = vld1q_f32 (y + i);
-        accu = vfmaq_f32 (accu, xi, yi);
+    float32x4_t accu0 = vdupq_n_f32 (0);
+    float32x4_t accu1 = vdupq_n_f32 (0);
+    size_t i = 0;
+    for (; i + 8 <= d; i += 8) {
+        accu0 = vfmaq_f32 (accu0, vld1q_f32 (x + i), vld1q_f32 (y + i));
+        accu1 = vfmaq_f32 (accu1, vld1q_f32 (x + i + 4),
+                           vld1q_f32 (y + i + 4));
+    }
+    if (i + 4 <= d) {
+        accu0 = vfmaq_f32 (accu0, vld1q_f32 (x + i), vld1q_f32 (y + i));
+        i += 4;
     }
-    float32x4_t a2 = vpaddq_f32 (accu, accu);
-    return vdups_laneq_f32 (a2, 0) + vdups_laneq_f32 (a2, 1);
+    float res = horizontal_sum_neon (vaddq_f32 (accu0, accu1));
+    for (; i < d; i++) {
+        res += x[i] * y[i];
+    }
+    return res;
 }
 
 float fvec_norm_L2sqr (const float *x, size_t d)
 {
-    if (d & 3) return fvec_norm_L2sqr_ref (x, d);
     float32x4_t accu = vdupq_n_f32 (0);
-    for (size_t i = 0; i < d; i += 4) {
+    size_t i = 0;
+    for (; i + 4 <= d; i += 4) {
         float32x4_t xi = vld1q_f32 (x + i);
         accu = vfmaq_f32 (accu, xi, xi);
     }
-    float32x4_t a2 = vpaddq_f32 (accu, accu);
-    return vdups_laneq_f32 (a2, 0) + vdups_laneq_f32 (a2, 1);
+    float res = horizontal_sum_neon (accu);
+    for (; i < d; i++) {
+        res += x[i] * x[i];
+    }
+    return res;
 }
 
-// not optimized for ARM
-void fvec_L2sqr_ny (float * dis, const float * x,
+// the query is kept in registers for the small dimensions that are
+// frequent for PQ sub-vectors
+static void fvec_L2sqr_ny_default (float * dis, const float * x,
                         const float * y, size_t d, size_t ny) {
-    fvec_L2sqr_ny_ref (dis, x, y, d, ny);
+    if (d == 4) {
+        float32x4_t x0 = vld1q_f32 (x);
+        for (size_t i = 0; i < ny; i++) {
+            float32x4_t sq = vsubq_f32 (x0, vld1q_f32 (y));
+            dis[i] = horizontal_sum_neon (vmulq_f32 (sq, sq));
+            y += 4;
+        }
+    } else if (d == 8) {
+        float32x4_t x0 = vld1q_f32 (x);
+        float32x4_t x1 = vld1q_f32 (x + 4);
+        for (size_t i = 0; i < ny; i++) {
+            float32x4_t sq0 = vsubq_f32 (x0, vld1q_f32 (y));
+            float32x4_t sq1 = vsubq_f32 (x1, vld1q_f32 (y + 4));
+            float32x4_t accu = vmulq_f32 (sq0, sq0);
+            accu = vfmaq_f32 (accu, sq1, sq1);
+            dis[i] = horizontal_sum_neon (accu);
+            y += 8;
+        }
+    } else {
+        for (size_t i = 0; i < ny; i++) {
+            dis[i] = fvec_L2sqr_default (x, y, d);
+            y += d;
+        }
+    }
 }
 
-float fvec_L1 (const float * x, const float * y, size_t d)
+void fvec_inner_products_ny (float * dis, const float * x,
+                        const float * y, size_t d, size_t ny) {
+    for (size_t i = 0; i < ny; i++) {
+        dis[i] = fvec_inner_product_default (x, y, d);
+        y += d;
+    }
+}
+
+static float fvec_L1_default (const float * x, const float * y, size_t d)
 {
-    return fvec_L1_ref (x, y, d);
+    float32x4_t accu = vdupq_n_f32 (0);
+    size_t i = 0;
+    for (; i + 4 <= d; i += 4) {
+        accu = vaddq_f32 (accu, vabdq_f32 (vld1q_f32 (x + i),
+                                           vld1q_f32 (y + i)));
+    }
+    float res = horizontal_sum_neon (accu);
+    for (; i < d; i++) {
+        res += fabs (x[i] - y[i]);
+    }
+    return res;
 }
 
-float fvec_Linf (const float * x, const float * y, size_t d)
+static float fvec_Linf_default (const float * x, const float * y, size_t d)
 {
-    return fvec_Linf_ref (x, y, d);
+    float32x4_t accu = vdupq_n_f32 (0);
+    size_t i = 0;
+    for (; i + 4 <= d; i += 4) {
+        accu = vmaxq_f32 (accu, vabdq_f32 (vld1q_f32 (x + i),
+                                           vld1q_f32 (y + i)));
+    }
+    float res = vmaxvq_f32 (accu);
+    for (; i < d; i++) {
+        res = fmax (res, fabs (x[i] - y[i]));
+    }
+    return res;
 }
 
 
 #else
 // scalar implementation
 
-float fvec_L2sqr (const float * x,
+static float fvec_L2sqr_default (const float * x,
                   const float * y,
                   size_t d)
 {
     return fvec_L2sqr_ref (x, y, d);
 }
 
-float fvec_L1 (const float * x, const float * y, size_t d)
+static float fvec_L1_default (const float * x, const float * y, size_t d)
 {
     return fvec_L1_ref (x, y, d);
 }
 
-float fvec_Linf (const float * x, const float * y, size_t d)
+static float fvec_Linf_default (const float * x, const float * y, size_t d)
 {
     return fvec_Linf_ref (x, y, d);
 }
 
-float fvec_inner_product (const float * x,
+static float fvec_inner_product_default (const float * x,
                              const float * y,
                              size_t d)
 {
@@ -701,7 +781,7 @@ float fvec_norm_L2sqr (const float *x, size_t d)
     return fvec_norm_L2sqr_ref (x, d);
 }
 
-void fvec_L2sqr_ny (float * dis, const float * x,
+static void fvec_L2sqr_ny_default (float * dis, const float * x,
                         const float * y, size_t d, size_t ny) {
     fvec_L2sqr_ny_ref (dis, x, y, d, ny);
 }
@@ -714,6 +794,672 @@ void fvec_inner_products_ny (float * dis, const float * x,
 
 #endif
 
+/*********************************************************
+ * AVX2 implementations, selected at runtime
+ */
+
+#ifdef FAISS_X86_DISPATCH
+
+namespace {
+
+// reads 0 <= d < 8 floats as __m256, without reading beyond x + d
+FAISS_AVX2_TARGET
+__m256 masked_read_8_avx2 (size_t d, const float *x)
+{
+    const __m256i lane = _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i mask = _mm256_cmpgt_epi32 (_mm256_set1_epi32 (d), lane);
+    return _mm256_maskload_ps (x, mask);
+}
+
+FAISS_AVX2_TARGET
+float horizontal_sum_avx2 (__m256 v)
+{
+    __m128 s = _mm_add_ps (_mm256_castps256_ps128 (v),
+                           _mm256_extractf128_ps (v, 1));
+    s = _mm_hadd_ps (s, s);
+    s = _mm_hadd_ps (s, s);
+    return _mm_cvtss_f32 (s);
+}
+
+FAISS_AVX2_TARGET
+float fvec_L2sqr_avx2 (const float * x,
+                       const float * y,
+                       size_t d)
+{
+    __m256 msum1 = _mm256_setzero_ps ();
+    __m256 msum2 = _mm256_setzero_ps ();
+
+    while (d >= 16) {
+        __m256 a_m_b1 = _mm256_sub_ps (_mm256_loadu_ps (x),
+                                       _mm256_loadu_ps (y));
+        __m256 a_m_b2 = _mm256_sub_ps (_mm256_loadu_ps (x + 8),
+                                       _mm256_loadu_ps (y + 8));
+        msum1 = _mm256_fmadd_ps (a_m_b1, a_m_b1, msum1);
+        msum2 = _mm256_fmadd_ps (a_m_b2, a_m_b2, msum2);
+        x += 16; y += 16; d -= 16;
+    }
+
+    if (d >= 8) {
+        __m256 a_m_b1 = _mm256_sub_ps (_mm256_loadu_ps (x),
+                                       _mm256_loadu_ps (y));
+        msum1 = _mm256_fmadd_ps (a_m_b1, a_m_b1, msum1);
+        x += 8; y += 8; d -= 8;
+    }
+
+    if (d > 0) {
+        __m256 a_m_b1 = _mm256_sub_ps (masked_read_8_avx2 (d, x),
+                                       masked_read_8_avx2 (d, y));
+        msum2 = _mm256_fmadd_ps (a_m_b1, a_m_b1, msum2);
+    }
+
+    return horizontal_sum_avx2 (_mm256_add_ps (msum1, msum2));
+}
+
+FAISS_AVX2_TARGET
+float fvec_inner_product_avx2 (const float * x,
+                               const float * y,
+                               size_t d)
+{
+    __m256 msum1 = _mm256_setzero_ps ();
+    __m256 msum2 = _mm256_setzero_ps ();
+
+    while (d >= 16) {
+        msum1 = _mm256_fmadd_ps (_mm256_loadu_ps (x),
+                                 _mm256_loadu_ps (y), msum1);
+        msum2 = _mm256_fmadd_ps (_mm256_loadu_ps (x + 8),
+                                 _mm256_loadu_ps (y + 8), msum2);
+        x += 16; y += 16; d -= 16;
+    }
+
+    if (d >= 8) {
+        msum1 = _mm256_fmadd_ps (_mm256_loadu_ps (x),
+                                 _mm256_loadu_ps (y), msum1);
+        x += 8; y += 8; d -= 8;
+    }
+
+    if (d > 0) {
+        msum2 = _mm256_fmadd_ps (masked_read_8_avx2 (d, x),
+                                 masked_read_8_avx2 (d, y), msum2);
+    }
+
+    return horizontal_sum_avx2 (_mm256_add_ps (msum1, msum2));
+}
+
+FAISS_AVX2_TARGET
+void fvec_L2sqr_ny_avx2 (float * dis, const float * x,
+                         const float * y, size_t d, size_t ny)
+{
+    for (size_t i = 0; i < ny; i++) {
+        dis[i] = fvec_L2sqr_avx2 (x, y, d);
+        y += d;
+    }
+}
+
+FAISS_AVX2_TARGET
+float fvec_L1_avx2 (const float * x, const float * y, size_t d)
+{
+    const __m256 signmask = _mm256_castsi256_ps (
+          _mm256_set1_epi32 (0x7fffffff));
+    __m256 msum1 = _mm256_setzero_ps ();
+    __m256 msum2 = _mm256_setzero_ps ();
+
+    while (d >= 16) {
+        __m256 a_m_b1 = _mm256_sub_ps (_mm256_loadu_ps (x),
+                                       _mm256_loadu_ps (y));
+        __m256 a_m_b2 = _mm256_sub_ps (_mm256_loadu_ps (x + 8),
+                                       _mm256_loadu_ps (y + 8));
+        msum1 = _mm256_add_ps (msum1, _mm256_and_ps (signmask, a_m_b1));
+        msum2 = _mm256_add_ps (msum2, _mm256_and_ps (signmask, a_m_b2));
+        x += 16; y += 16; d -= 16;
+    }
+
+    if (d >= 8) {
+        __m256 a_m_b1 = _mm256_sub_ps (_mm256_loadu_ps (x),
+                                       _mm256_loadu_ps (y));
+        msum1 = _mm256_add_ps (msum1, _mm256_and_ps (signmask, a_m_b1));
+        x += 8; y += 8; d -= 8;
+    }
+
+    if (d > 0) {
+        __m256 a_m_b1 = _mm256_sub_ps (masked_read_8_avx2 (d, x),
+                                       masked_read_8_avx2 (d, y));
+        msum2 = _mm256_add_ps (msum2, _mm256_and_ps (signmask, a_m_b1));
+    }
+
+    return horizontal_sum_avx2 (_mm256_add_ps (msum1, msum2));
+}
+
+FAISS_AVX2_TARGET
+float fvec_Linf_avx2 (const float * x, const float * y, size_t d)
+{
+    const __m256 signmask = _mm256_castsi256_ps (
+          _mm256_set1_epi32 (0x7fffffff));
+    __m256 mmax = _mm256_setzero_ps ();
+
+    while (d >= 8) {
+        __m256 a_m_b = _mm256_sub_ps (_mm256_loadu_ps (x),
+                                      _mm256_loadu_ps (y));
+        mmax = _mm256_max_ps (mmax, _mm256_and_ps (signmask, a_m_b));
+        x += 8; y += 8; d -= 8;
+    }
+
+    if (d > 0) {
+        // the masked lanes are 0 - 0
+        __m256 a_m_b = _mm256_sub_ps (masked_read_8_avx2 (d, x),
+                                      masked_read_8_avx2 (d, y));
+        mmax = _mm256_max_ps (mmax, _mm256_and_ps (signmask, a_m_b));
+    }
+
+    __m128 m = _mm_max_ps (_mm256_castps256_ps128 (mmax),
+                           _mm256_extractf128_ps (mmax, 1));
+    m = _mm_max_ps (m, _mm_movehl_ps (m, m));
+    m = _mm_max_ps (m, _mm_shuffle_ps (m, m, 1));
+    return _mm_cvtss_f32 (m);
+}
+
+// The batch kernels compute the 4 distances with the same accumulators
+// and reductions as fvec_L2sqr_avx2 / fvec_inner_product_avx2, so that
+// the distance of a vector does not depend on whether it is computed in
+// a batch or alone (eg. with distance_to_code, or in the last ny % 4).
+// They only save the loads of x.
+
+template<bool is_L2>
+FAISS_AVX2_TARGET
+inline __m256 op_accu_avx2 (__m256 mx, __m256 my, __m256 accu)
+{
+    if (is_L2) {
+        __m256 a_m_b = _mm256_sub_ps (mx, my);
+        return _mm256_fmadd_ps (a_m_b, a_m_b, accu);
+    } else {
+        return _mm256_fmadd_ps (mx, my, accu);
+    }
+}
+
+// D > 0 is the dimension, known at compile time. Requires d >= 8.
+template<bool is_L2, size_t D = 0>
+FAISS_AVX2_TARGET
+void fvec_op_batch_4_avx2 (const float * x,
+                           const float * y0, const float * y1,
+                           const float * y2, const float * y3,
+                           size_t d,
+                           float & dis0, float & dis1,
+                           float & dis2, float & dis3)
+{
+    if (D > 0) {
+        d = D;
+    }
+    const float *y[4] = {y0, y1, y2, y3};
+    __m256 msum1[4], msum2[4];
+    for (int b = 0; b < 4; b++) {
+        msum1[b] = _mm256_setzero_ps ();
+        msum2[b] = _mm256_setzero_ps ();
+    }
+
+    size_t i = 0;
+    for (; i + 16 <= d; i += 16) {
+        __m256 mx1 = _mm256_loadu_ps (x + i);
+        __m256 mx2 = _mm256_loadu_ps (x + i + 8);
+        for (int b = 0; b < 4; b++) {
+            msum1[b] = op_accu_avx2<is_L2> (
+                  mx1, _mm256_loadu_ps (y[b] + i), msum1[b]);
+            msum2[b] = op_accu_avx2<is_L2> (
+                  mx2, _mm256_loadu_ps (y[b] + i + 8), msum2[b]);
+        }
+    }
+
+    if (i + 8 <= d) {
+        __m256 mx = _mm256_loadu_ps (x + i);
+        for (int b = 0; b < 4; b++) {
+            msum1[b] = op_accu_avx2<is_L2> (
+                  mx, _mm256_loadu_ps (y[b] + i), msum1[b]);
+        }
+        i += 8;
+    }
+
+    if (i < d) {
+        size_t r = d - i;
+        __m256 mx = masked_read_8_avx2 (r, x + i);
+        for (int b = 0; b < 4; b++) {
+            msum2[b] = op_accu_avx2<is_L2> (
+                  mx, masked_read_8_avx2 (r, y[b] + i), msum2[b]);
+        }
+    }
+
+    float *dis[4] = {&dis0, &dis1, &dis2, &dis3};
+    for (int b = 0; b < 4; b++) {
+        *dis[b] = horizontal_sum_avx2 (_mm256_add_ps (msum1[b], msum2[b]));
+    }
+}
+
+template<bool is_L2, size_t D>
+FAISS_AVX2_TARGET
+void fvec_op_ny_batch_4_avx2 (float * dis, const float * x,
+                              const float * y, size_t d, size_t ny)
+{
+    if (D > 0) {
+        d = D;
+    }
+    size_t j = 0;
+    for (; j + 4 <= ny; j += 4) {
+        const float *yj = y + j * d;
+        fvec_op_batch_4_avx2<is_L2, D> (
+              x, yj, yj + d, yj + 2 * d, yj + 3 * d, d,
+              dis[j], dis[j + 1], dis[j + 2], dis[j + 3]);
+    }
+    for (; j < ny; j++) {
+        dis[j] = is_L2 ? fvec_L2sqr_avx2 (x, y + j * d, d) :
+                         fvec_inner_product_avx2 (x, y + j * d, d);
+    }
+}
+
+} // anonymous namespace
+
+#endif
+
+
+/*********************************************************
+ * AVX-512 implementations, selected at runtime
+ */
+
+#ifdef FAISS_X86_DISPATCH
+
+namespace {
+
+FAISS_AVX512_TARGET
+float fvec_L2sqr_avx512 (const float * x,
+                         const float * y,
+                         size_t d)
+{
+    // 2 accumulators to hide the latency of the FMAs
+    __m512 msum1 = _mm512_setzero_ps ();
+    __m512 msum2 = _mm512_setzero_ps ();
+
+    while (d >= 32) {
+        __m512 a_m_b1 = _mm512_sub_ps (_mm512_loadu_ps (x),
+                                       _mm512_loadu_ps (y));
+        __m512 a_m_b2 = _mm512_sub_ps (_mm512_loadu_ps (x + 16),
+                                       _mm512_loadu_ps (y + 16));
+        msum1 = _mm512_fmadd_ps (a_m_b1, a_m_b1, msum1);
+        msum2 = _mm512_fmadd_ps (a_m_b2, a_m_b2, msum2);
+        x += 32; y += 32; d -= 32;
+    }
+
+    if (d >= 16) {
+        __m512 a_m_b1 = _mm512_sub_ps (_mm512_loadu_ps (x),
+                                       _mm512_loadu_ps (y));
+        msum1 = _mm512_fmadd_ps (a_m_b1, a_m_b1, msum1);
+        x += 16; y += 16; d -= 16;
+    }
+
+    if (d > 0) {
+        // masked loads do not read beyond the end of the arrays
+        __mmask16 mask = (1 << d) - 1;
+        __m512 a_m_b1 = _mm512_sub_ps (_mm512_maskz_loadu_ps (mask, x),
+                                       _mm512_maskz_loadu_ps (mask, y));
+        msum2 = _mm512_fmadd_ps (a_m_b1, a_m_b1, msum2);
+    }
+
+    return horizontal_sum_avx512 (_mm512_add_ps (msum1, msum2));
+}
+
+FAISS_AVX512_TARGET
+float fvec_inner_product_avx512 (const float * x,
+                                 const float * y,
+                                 size_t d)
+{
+    __m512 msum1 = _mm512_setzero_ps ();
+    __m512 msum2 = _mm512_setzero_ps ();
+
+    while (d >= 32) {
+        msum1 = _mm512_fmadd_ps (_mm512_loadu_ps (x),
+                                 _mm512_loadu_ps (y), msum1);
+        msum2 = _mm512_fmadd_ps (_mm512_loadu_ps (x + 16),
+                                 _mm512_loadu_ps (y + 16), msum2);
+        x += 32; y += 32; d -= 32;
+    }
+
+    if (d >= 16) {
+        msum1 = _mm512_fmadd_ps (_mm512_loadu_ps (x),
+                                 _mm512_loadu_ps (y), msum1);
+        x += 16; y += 16; d -= 16;
+    }
+
+    if (d > 0) {
+        __mmask16 mask = (1 << d) - 1;
+        msum2 = _mm512_fmadd_ps (_mm512_maskz_loadu_ps (mask, x),
+                                 _mm512_maskz_loadu_ps (mask, y), msum2);
+    }
+
+    return horizontal_sum_avx512 (_mm512_add_ps (msum1, msum2));
+}
+
+FAISS_AVX512_TARGET
+void fvec_L2sqr_ny_avx512 (float * dis, const float * x,
+                           const float * y, size_t d, size_t ny)
+{
+    if (d <= 16) {
+        // the query fits in one register
+        __mmask16 mask = d == 16 ? 0xffff : (1 << d) - 1;
+        __m512 mx = _mm512_maskz_loadu_ps (mask, x);
+        for (size_t i = 0; i < ny; i++) {
+            __m512 a_m_b = _mm512_sub_ps (mx, _mm512_maskz_loadu_ps (mask, y));
+            dis[i] = horizontal_sum_avx512 (_mm512_mul_ps (a_m_b, a_m_b));
+            y += d;
+        }
+    } else {
+        for (size_t i = 0; i < ny; i++) {
+            dis[i] = fvec_L2sqr_avx512 (x, y, d);
+            y += d;
+        }
+    }
+}
+
+// same as the AVX2 batch kernels, with the accumulators and reductions
+// of fvec_L2sqr_avx512 / fvec_inner_product_avx512. Requires d >= 16.
+
+template<bool is_L2>
+FAISS_AVX512_TARGET
+inline __m512 op_accu_avx512 (__m512 mx, __m512 my, __m512 accu)
+{
+    if (is_L2) {
+        __m512 a_m_b = _mm512_sub_ps (mx, my);
+        return _mm512_fmadd_ps (a_m_b, a_m_b, accu);
+    } else {
+        return _mm512_fmadd_ps (mx, my, accu);
+    }
+}
+
+template<bool is_L2, size_t D = 0>
+FAISS_AVX512_TARGET
+void fvec_op_batch_4_avx512 (const float * x,
+                             const float * y0, const float * y1,
+                             const float * y2, const float * y3,
+                             size_t d,
+                             float & dis0, float & dis1,
+                             float & dis2, float & dis3)
+{
+    if (D > 0) {
+        d = D;
+    }
+    const float *y[4] = {y0, y1, y2, y3};
+    __m512 msum1[4], msum2[4];
+    for (int b = 0; b < 4; b++) {
+        msum1[b] = _mm512_setzero_ps ();
+        msum2[b] = _mm512_setzero_ps ();
+    }
+
+    size_t i = 0;
+    for (; i + 32 <= d; i += 32) {
+        __m512 mx1 = _mm512_loadu_ps (x + i);
+        __m512 mx2 = _mm512_loadu_ps (x + i + 16);
+        for (int b = 0; b < 4; b++) {
+            msum1[b] = op_accu_avx512<is_L2> (
+                  mx1, _mm512_loadu_ps (y[b] + i), msum1[b]);
+            msum2[b] = op_accu_avx512<is_L2> (
+                  mx2, _mm512_loadu_ps (y[b] + i + 16), msum2[b]);
+        }
+    }
+
+    if (i + 16 <= d) {
+        __m512 mx = _mm512_loadu_ps (x + i);
+        for (int b = 0; b < 4; b++) {
+            msum1[b] = op_accu_avx512<is_L2> (
+                  mx, _mm512_loadu_ps (y[b] + i), msum1[b]);
+        }
+        i += 16;
+    }
+
+    if (i < d) {
+        __mmask16 mask = (1 << (d - i)) - 1;
+        __m512 mx = _mm512_maskz_loadu_ps (mask, x + i);
+        for (int b = 0; b < 4; b++) {
+            msum2[b] = op_accu_avx512<is_L2> (
+                  mx, _mm512_maskz_loadu_ps (mask, y[b] + i), msum2[b]);
+        }
+    }
+
+    float *dis[4] = {&dis0, &dis1, &dis2, &dis3};
+    for (int b = 0; b < 4; b++) {
+        *dis[b] = horizontal_sum_avx512 (
+              _mm512_add_ps (msum1[b], msum2[b]));
+    }
+}
+
+template<bool is_L2, size_t D>
+FAISS_AVX512_TARGET
+void fvec_op_ny_batch_4_avx512 (float * dis, const float * x,
+                                const float * y, size_t d, size_t ny)
+{
+    if (D > 0) {
+        d = D;
+    }
+    size_t j = 0;
+    for (; j + 4 <= ny; j += 4) {
+        const float *yj = y + j * d;
+        fvec_op_batch_4_avx512<is_L2, D> (
+              x, yj, yj + d, yj + 2 * d, yj + 3 * d, d,
+              dis[j], dis[j + 1], dis[j + 2], dis[j + 3]);
+    }
+    for (; j < ny; j++) {
+        dis[j] = is_L2 ? fvec_L2sqr_avx512 (x, y + j * d, d) :
+                         fvec_inner_product_avx512 (x, y + j * d, d);
+    }
+}
+
+// the common dimensions are compiled with d known, for the AVX-512
+// kernels if avx512, else the AVX2 ones
+template<bool is_L2, bool avx512>
+void fvec_op_ny_batch_4_dispatch (float * dis, const float * x,
+                                  const float * y, size_t d, size_t ny)
+{
+    switch (d) {
+#define DISPATCH(D) \
+    case D: \
+        if (avx512) { \
+            fvec_op_ny_batch_4_avx512<is_L2, D> (dis, x, y, d, ny); \
+        } else { \
+            fvec_op_ny_batch_4_avx2<is_L2, D> (dis, x, y, d, ny); \
+        } \
+        return;
+        DISPATCH (64)
+        DISPATCH (96)
+        DISPATCH (128)
+        DISPATCH (256)
+        DISPATCH (384)
+        DISPATCH (512)
+        DISPATCH (768)
+        DISPATCH (1024)
+#undef DISPATCH
+    default:
+        if (avx512) {
+            fvec_op_ny_batch_4_avx512<is_L2, 0> (dis, x, y, d, ny);
+        } else {
+            fvec_op_ny_batch_4_avx2<is_L2, 0> (dis, x, y, d, ny);
+        }
+    }
+}
+
+} // anonymous namespace
+
+#endif
+
+
+/*********************************************************
+ * Runtime dispatch
+ */
+
+float fvec_L2sqr (const float * x,
+                  const float * y,
+                  size_t d)
+{
+#ifdef FAISS_X86_DISPATCH
+    if (d >= 16 && use_avx512 ()) {
+        return fvec_L2sqr_avx512 (x, y, d);
+    }
+    if (d >= 8 && use_avx2 ()) {
+        return fvec_L2sqr_avx2 (x, y, d);
+    }
+#endif
+    return fvec_L2sqr_default (x, y, d);
+}
+
+float fvec_inner_product (const float * x,
+                          const float * y,
+                          size_t d)
+{
+#ifdef FAISS_X86_DISPATCH
+    if (d >= 16 && use_avx512 ()) {
+        return fvec_inner_product_avx512 (x, y, d);
+    }
+    if (d >= 8 && use_avx2 ()) {
+        return fvec_inner_product_avx2 (x, y, d);
+    }
+#endif
+    return fvec_inner_product_default (x, y, d);
+}
+
+// the batch kernels are selected under the same conditions as the
+// single-vector ones in fvec_L2sqr / fvec_inner_product, with which they
+// are bit-exact
+
+void fvec_L2sqr_batch_4 (const float * x,
+                         const float * y0, const float * y1,
+                         const float * y2, const float * y3,
+                         size_t d,
+                         float & dis0, float & dis1,
+                         float & dis2, float & dis3)
+{
+#ifdef FAISS_X86_DISPATCH
+    if (d >= 16 && use_avx512 ()) {
+        fvec_op_batch_4_avx512<true> (x, y0, y1, y2, y3, d,
+                                      dis0, dis1, dis2, dis3);
+        return;
+    }
+    if (d >= 8 && use_avx2 ()) {
+        fvec_op_batch_4_avx2<true> (x, y0, y1, y2, y3, d,
+                                    dis0, dis1, dis2, dis3);
+        return;
+    }
+#endif
+    dis0 = fvec_L2sqr (x, y0, d);
+    dis1 = fvec_L2sqr (x, y1, d);
+    dis2 = fvec_L2sqr (x, y2, d);
+    dis3 = fvec_L2sqr (x, y3, d);
+}
+
+void fvec_inner_product_batch_4 (const float * x,
+                                 const float * y0, const float * y1,
+                                 const float * y2, const float * y3,
+                                 size_t d,
+                                 float & dis0, float & dis1,
+                                 float & dis2, float & dis3)
+{
+#ifdef FAISS_X86_DISPATCH
+    if (d >= 16 && use_avx512 ()) {
+        fvec_op_batch_4_avx512<false> (x, y0, y1, y2, y3, d,
+                                       dis0, dis1, dis2, dis3);
+        return;
+    }
+    if (d >= 8 && use_avx2 ()) {
+        fvec_op_batch_4_avx2<false> (x, y0, y1, y2, y3, d,
+                                     dis0, dis1, dis2, dis3);
+        return;
+    }
+#endif
+    dis0 = fvec_inner_product (x, y0, d);
+    dis1 = fvec_inner_product (x, y1, d);
+    dis2 = fvec_inner_product (x, y2, d);
+    dis3 = fvec_inner_product (x, y3, d);
+}
+
+void fvec_L2sqr_ny_batch_4 (float * dis, const float * x,
+                            const float * y, size_t d, size_t ny)
+{
+#ifdef FAISS_X86_DISPATCH
+    if (d >= 16 && use_avx512 ()) {
+        fvec_op_ny_batch_4_dispatch<true, true> (dis, x, y, d, ny);
+        return;
+    }
+    if (d >= 8 && use_avx2 ()) {
+        fvec_op_ny_batch_4_dispatch<true, false> (dis, x, y, d, ny);
+        return;
+    }
+#endif
+    for (size_t j = 0; j < ny; j++) {
+        dis[j] = fvec_L2sqr (x, y + j * d, d);
+    }
+}
+
+void fvec_inner_products_ny_batch_4 (float * ip, const float * x,
+                                     const float * y, size_t d, size_t ny)
+{
+#ifdef FAISS_X86_DISPATCH
+    if (d >= 16 && use_avx512 ()) {
+        fvec_op_ny_batch_4_dispatch<false, true> (ip, x, y, d, ny);
+        return;
+    }
+    if (d >= 8 && use_avx2 ()) {
+        fvec_op_ny_batch_4_dispatch<false, false> (ip, x, y, d, ny);
+        return;
+    }
+#endif
+    for (size_t j = 0; j < ny; j++) {
+        ip[j] = fvec_inner_product (x, y + j * d, d);
+    }
+}
+
+void fvec_L2sqr_ny (float * dis, const float * x,
+                    const float * y, size_t d, size_t ny)
+{
+#ifdef FAISS_X86_DISPATCH
+    // the SSE version has special cases for d = 1, 2, 4 and 8
+    if (d > 8 && use_avx512 ()) {
+        fvec_L2sqr_ny_avx512 (dis, x, y, d, ny);
+        return;
+    }
+    if (d > 8 && use_avx2 ()) {
+        fvec_L2sqr_ny_avx2 (dis, x, y, d, ny);
+        return;
+    }
+#endif
+    fvec_L2sqr_ny_default (dis, x, y, d, ny);
+}
+
+float fvec_L2sqr_early_abort (const float * x, const float * y, size_t d,
+                              float threshold, size_t block_size)
+{
+    float dis = 0;
+    for (size_t i = 0; i < d; i += block_size) {
+        size_t bs = d - i < block_size ? d - i : block_size;
+        dis += fvec_L2sqr (x + i, y + i, bs);
+        if (dis > threshold) {
+            break;
+        }
+    }
+    return dis;
+}
+
+float fvec_L1 (const float * x, const float * y, size_t d)
+{
+#ifdef FAISS_X86_DISPATCH
+    if (d >= 8 && use_avx2 ()) {
+        return fvec_L1_avx2 (x, y, d);
+    }
+#endif
+    return fvec_L1_default (x, y, d);
+}
+
+float fvec_Linf (const float * x, const float * y, size_t d)
+{
+#ifdef FAISS_X86_DISPATCH
+    if (d >= 8 && use_avx2 ()) {
+        return fvec_Linf_avx2 (x, y, d);
+    }
+#endif
+    return fvec_Linf_default (x, y, d);
+}
+
+
 
 
 
@@ -0,0 +1,79 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+/** Functors that compute the distance between two vectors for the
+ * metrics of extra_distances.h. They are the template arguments of the
+ * brute-force, distance computer and IVFFlat scanning code, so that all
+ * of them use the same (SIMD) kernels. */
+
+#include <faiss/utils/distances.h>
+#include <faiss/utils/extra_distances.h>
+
+namespace faiss {
+
+struct VectorDistanceL2 {
+    size_t d;
+
+    float operator () (const float *x, const float *y) const {
+        return fvec_L2sqr (x, y, d);
+    }
+};
+
+struct VectorDistanceL1 {
+    size_t d;
+
+    float operator () (const float *x, const float *y) const {
+        return fvec_L1 (x, y, d);
+    }
+};
+
+struct VectorDistanceLinf {
+    size_t d;
+
+    float operator () (const float *x, const float *y) const {
+        return fvec_Linf (x, y, d);
+    }
+};
+
+struct VectorDistanceLp {
+    size_t d;
+    const float p;
+
+    float operator () (const float *x, const float *y) const {
+        return fvec_Lp (x, y, d, p);
+    }
+};
+
+struct VectorDistanceCanberra {
+    size_t d;
+
+    float operator () (const float *x, const float *y) const {
+        return fvec_Canberra (x, y, d);
+    }
+};
+
+struct VectorDistanceBrayCurtis {
+    size_t d;
+
+    float operator () (const float *x, const float *y) const {
+        return fvec_BrayCurtis (x, y, d);
+    }
+};
+
+struct VectorDistanceJensenShannon {
+    size_t d;
+
+    float operator () (const float *x, const float *y) const {
+        return fvec_JensenShannon (x, y, d);
+    }
+};
+
+} // namespace faiss
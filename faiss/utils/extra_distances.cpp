@@ -7,123 +7,345 @@
 
 // -*- c++ -*-
 
-#include <faiss/utils/distances.h>
+#include <faiss/utils/extra_distances.h>
 
 #include <algorithm>
 #include <cmath>
 #include <omp.h>
 
-
+#include <faiss/utils/cpu_dispatch.h>
+#include <faiss/utils/extra_distances-inl.h>
 #include <faiss/utils/utils.h>
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/impl/AuxIndexStructures.h>
 
+#ifdef FAISS_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
 namespace faiss {
 
 /***************************************************************************
  * Distance functions (other than L2 and IP)
  ***************************************************************************/
 
-struct VectorDistanceL2 {
-    size_t d;
+namespace {
 
-    float operator () (const float *x, const float *y) const {
-        return fvec_L2sqr (x, y, d);
+float fvec_Lp_default (const float *x, const float *y, size_t d, float p)
+{
+    float accu = 0;
+    for (size_t i = 0; i < d; i++) {
+        float diff = fabs (x[i] - y[i]);
+        accu += powf (diff, p);
     }
-};
+    return accu;
+}
 
-struct VectorDistanceL1 {
-    size_t d;
+float fvec_Canberra_default (const float *x, const float *y, size_t d)
+{
+    float accu = 0;
+    for (size_t i = 0; i < d; i++) {
+        float xi = x[i], yi = y[i];
+        float den = fabs(xi) + fabs(yi);
+        // the term is 0 when both components are 0
+        if (den > 0) {
+            accu += fabs (xi - yi) / den;
+        }
+    }
+    return accu;
+}
 
-    float operator () (const float *x, const float *y) const {
-        return fvec_L1 (x, y, d);
+float fvec_BrayCurtis_default (const float *x, const float *y, size_t d)
+{
+    float accu_num = 0, accu_den = 0;
+    for (size_t i = 0; i < d; i++) {
+        float xi = x[i], yi = y[i];
+        accu_num += fabs (xi - yi);
+        accu_den += fabs (xi + yi);
     }
-};
+    return accu_num / accu_den;
+}
 
-struct VectorDistanceLinf {
-    size_t d;
+// x log (x / m), with 0 log 0 = 0
+inline float kl_term (float x, float m)
+{
+    return x > 0 ? x * logf (x / m) : 0;
+}
 
-    float operator () (const float *x, const float *y) const {
-        return fvec_Linf (x, y, d);
-        /*
-        float vmax = 0;
-        for (size_t i = 0; i < d; i++) {
-            float diff = fabs (x[i] - y[i]);
-            if (diff > vmax) vmax = diff;
-        }
-        return vmax;*/
+float fvec_JensenShannon_default (const float *x, const float *y, size_t d)
+{
+    float accu = 0;
+    for (size_t i = 0; i < d; i++) {
+        float xi = x[i], yi = y[i];
+        float mi = 0.5 * (xi + yi);
+        accu += kl_term (xi, mi) + kl_term (yi, mi);
     }
-};
+    return 0.5 * accu;
+}
 
-struct VectorDistanceLp {
-    size_t d;
-    const float p;
+#ifdef FAISS_X86_DISPATCH
 
-    float operator () (const float *x, const float *y) const {
-        float accu = 0;
-        for (size_t i = 0; i < d; i++) {
-            float diff = fabs (x[i] - y[i]);
-            accu += powf (diff, p);
-        }
-        return accu;
-    }
-};
+/* logf and expf on 8 floats, polynomial approximations of the Cephes
+ * library. log_avx2 is valid for normalized positive inputs, exp_avx2
+ * saturates outside of [-88.37, 88.37]. */
 
-struct VectorDistanceCanberra {
-    size_t d;
+FAISS_AVX2_TARGET
+__m256 log_avx2 (__m256 x)
+{
+    const __m256 one = _mm256_set1_ps (1.0f);
+    __m256i xi = _mm256_castps_si256 (x);
+    // x = m * 2^e with m in [0.5, 1)
+    __m256i e = _mm256_sub_epi32 (_mm256_srli_epi32 (xi, 23),
+                                  _mm256_set1_epi32 (126));
+    __m256 m = _mm256_castsi256_ps (_mm256_or_si256 (
+          _mm256_and_si256 (xi, _mm256_set1_epi32 (0x007fffff)),
+          _mm256_set1_epi32 (0x3f000000)));
+    __m256 fe = _mm256_cvtepi32_ps (e);
+
+    // m in [sqrt(0.5), sqrt(2)), f = m - 1
+    __m256 small = _mm256_cmp_ps (m, _mm256_set1_ps (0.707106781186547524f),
+                                  _CMP_LT_OQ);
+    fe = _mm256_sub_ps (fe, _mm256_and_ps (one, small));
+    __m256 f = _mm256_add_ps (_mm256_sub_ps (m, one),
+                              _mm256_and_ps (m, small));
+
+    __m256 z = _mm256_mul_ps (f, f);
+    __m256 p = _mm256_set1_ps (7.0376836292E-2f);
+    p = _mm256_fmadd_ps (p, f, _mm256_set1_ps (-1.1514610310E-1f));
+    p = _mm256_fmadd_ps (p, f, _mm256_set1_ps (1.1676998740E-1f));
+    p = _mm256_fmadd_ps (p, f, _mm256_set1_ps (-1.2420140846E-1f));
+    p = _mm256_fmadd_ps (p, f, _mm256_set1_ps (1.4249322787E-1f));
+    p = _mm256_fmadd_ps (p, f, _mm256_set1_ps (-1.6668057665E-1f));
+    p = _mm256_fmadd_ps (p, f, _mm256_set1_ps (2.0000714765E-1f));
+    p = _mm256_fmadd_ps (p, f, _mm256_set1_ps (-2.4999993993E-1f));
+    p = _mm256_fmadd_ps (p, f, _mm256_set1_ps (3.3333331174E-1f));
+    p = _mm256_mul_ps (_mm256_mul_ps (p, f), z);
+
+    p = _mm256_fmadd_ps (fe, _mm256_set1_ps (-2.12194440e-4f), p);
+    p = _mm256_fmadd_ps (z, _mm256_set1_ps (-0.5f), p);
+    f = _mm256_add_ps (f, p);
+    return _mm256_fmadd_ps (fe, _mm256_set1_ps (0.693359375f), f);
+}
 
-    float operator () (const float *x, const float *y) const {
-        float accu = 0;
-        for (size_t i = 0; i < d; i++) {
-            float xi = x[i], yi = y[i];
-            accu += fabs (xi - yi) / (fabs(xi) + fabs(yi));
-        }
-        return accu;
-    }
-};
+FAISS_AVX2_TARGET
+__m256 exp_avx2 (__m256 x)
+{
+    x = _mm256_min_ps (x, _mm256_set1_ps (88.3762626647949f));
+    x = _mm256_max_ps (x, _mm256_set1_ps (-88.3762626647949f));
+
+    // x = n * log(2) + r
+    __m256 n = _mm256_floor_ps (_mm256_fmadd_ps (
+          x, _mm256_set1_ps (1.44269504088896341f), _mm256_set1_ps (0.5f)));
+    x = _mm256_fnmadd_ps (n, _mm256_set1_ps (0.693359375f), x);
+    x = _mm256_fnmadd_ps (n, _mm256_set1_ps (-2.12194440e-4f), x);
+
+    __m256 z = _mm256_mul_ps (x, x);
+    __m256 p = _mm256_set1_ps (1.9875691500E-4f);
+    p = _mm256_fmadd_ps (p, x, _mm256_set1_ps (1.3981999507E-3f));
+    p = _mm256_fmadd_ps (p, x, _mm256_set1_ps (8.3334519073E-3f));
+    p = _mm256_fmadd_ps (p, x, _mm256_set1_ps (4.1665795894E-2f));
+    p = _mm256_fmadd_ps (p, x, _mm256_set1_ps (1.6666665459E-1f));
+    p = _mm256_fmadd_ps (p, x, _mm256_set1_ps (5.0000001201E-1f));
+    p = _mm256_fmadd_ps (p, z, _mm256_add_ps (x, _mm256_set1_ps (1.0f)));
+
+    __m256i pow2n = _mm256_slli_epi32 (_mm256_add_epi32 (
+          _mm256_cvttps_epi32 (n), _mm256_set1_epi32 (127)), 23);
+    return _mm256_mul_ps (p, _mm256_castsi256_ps (pow2n));
+}
 
-struct VectorDistanceBrayCurtis {
-    size_t d;
+// reads 0 <= d < 8 floats, the other lanes are 0
+FAISS_AVX2_TARGET
+__m256 masked_read_avx2 (size_t d, const float *x)
+{
+    const __m256i lane = _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i mask = _mm256_cmpgt_epi32 (_mm256_set1_epi32 (d), lane);
+    return _mm256_maskload_ps (x, mask);
+}
 
-    float operator () (const float *x, const float *y) const {
-        float accu_num = 0, accu_den = 0;
-        for (size_t i = 0; i < d; i++) {
-            float xi = x[i], yi = y[i];
-            accu_num += fabs (xi - yi);
-            accu_den += fabs (xi + yi);
-        }
-        return accu_num / accu_den;
+FAISS_AVX2_TARGET
+float horizontal_sum_avx2 (__m256 v)
+{
+    __m128 s = _mm_add_ps (_mm256_castps256_ps128 (v),
+                           _mm256_extractf128_ps (v, 1));
+    s = _mm_hadd_ps (s, s);
+    s = _mm_hadd_ps (s, s);
+    return _mm_cvtss_f32 (s);
+}
+
+FAISS_AVX2_TARGET
+inline __m256 abs_avx2 (__m256 x)
+{
+    return _mm256_andnot_ps (_mm256_set1_ps (-0.0f), x);
+}
+
+// |x - y|^p = exp(p * log|x - y|) for p > 0
+FAISS_AVX2_TARGET
+inline __m256 pow_diff_avx2 (__m256 x, __m256 y, __m256 p)
+{
+    __m256 diff = abs_avx2 (_mm256_sub_ps (x, y));
+    __m256 nz = _mm256_cmp_ps (diff, _mm256_setzero_ps (), _CMP_NEQ_OQ);
+    __m256 r = exp_avx2 (_mm256_mul_ps (p, log_avx2 (diff)));
+    return _mm256_and_ps (r, nz);
+}
+
+FAISS_AVX2_TARGET
+float fvec_Lp_avx2 (const float *x, const float *y, size_t d, float p)
+{
+    __m256 mp = _mm256_set1_ps (p);
+    __m256 msum = _mm256_setzero_ps ();
+    while (d >= 8) {
+        msum = _mm256_add_ps (msum, pow_diff_avx2 (
+                 _mm256_loadu_ps (x), _mm256_loadu_ps (y), mp));
+        x += 8; y += 8; d -= 8;
     }
-};
+    if (d > 0) {
+        msum = _mm256_add_ps (msum, pow_diff_avx2 (
+                 masked_read_avx2 (d, x), masked_read_avx2 (d, y), mp));
+    }
+    return horizontal_sum_avx2 (msum);
+}
 
-struct VectorDistanceJensenShannon {
-    size_t d;
+FAISS_AVX2_TARGET
+inline __m256 canberra_term_avx2 (__m256 x, __m256 y)
+{
+    __m256 num = abs_avx2 (_mm256_sub_ps (x, y));
+    __m256 den = _mm256_add_ps (abs_avx2 (x), abs_avx2 (y));
+    __m256 nz = _mm256_cmp_ps (den, _mm256_setzero_ps (), _CMP_GT_OQ);
+    return _mm256_and_ps (_mm256_div_ps (num, den), nz);
+}
 
-    float operator () (const float *x, const float *y) const {
-        float accu = 0;
+FAISS_AVX2_TARGET
+float fvec_Canberra_avx2 (const float *x, const float *y, size_t d)
+{
+    __m256 msum = _mm256_setzero_ps ();
+    while (d >= 8) {
+        msum = _mm256_add_ps (msum, canberra_term_avx2 (
+                 _mm256_loadu_ps (x), _mm256_loadu_ps (y)));
+        x += 8; y += 8; d -= 8;
+    }
+    if (d > 0) {
+        msum = _mm256_add_ps (msum, canberra_term_avx2 (
+                 masked_read_avx2 (d, x), masked_read_avx2 (d, y)));
+    }
+    return horizontal_sum_avx2 (msum);
+}
 
-        for (size_t i = 0; i < d; i++) {
-            float xi = x[i], yi = y[i];
-            float mi = 0.5 * (xi + yi);
-            float kl1 = - xi * log(mi / xi);
-            float kl2 = - yi * log(mi / yi);
-            accu += kl1 + kl2;
+FAISS_AVX2_TARGET
+float fvec_BrayCurtis_avx2 (const float *x, const float *y, size_t d)
+{
+    __m256 msum_num = _mm256_setzero_ps ();
+    __m256 msum_den = _mm256_setzero_ps ();
+    while (d > 0) {
+        __m256 mx, my;
+        if (d >= 8) {
+            mx = _mm256_loadu_ps (x);
+            my = _mm256_loadu_ps (y);
+            x += 8; y += 8; d -= 8;
+        } else {
+            mx = masked_read_avx2 (d, x);
+            my = masked_read_avx2 (d, y);
+            d = 0;
         }
-        return 0.5 * accu;
+        msum_num = _mm256_add_ps (msum_num,
+                                  abs_avx2 (_mm256_sub_ps (mx, my)));
+        msum_den = _mm256_add_ps (msum_den,
+                                  abs_avx2 (_mm256_add_ps (mx, my)));
     }
-};
+    return horizontal_sum_avx2 (msum_num) / horizontal_sum_avx2 (msum_den);
+}
 
+FAISS_AVX2_TARGET
+inline __m256 kl_term_avx2 (__m256 x, __m256 m)
+{
+    __m256 pos = _mm256_cmp_ps (x, _mm256_setzero_ps (), _CMP_GT_OQ);
+    __m256 t = _mm256_mul_ps (x, log_avx2 (_mm256_div_ps (x, m)));
+    return _mm256_and_ps (t, pos);
+}
 
+FAISS_AVX2_TARGET
+float fvec_JensenShannon_avx2 (const float *x, const float *y, size_t d)
+{
+    __m256 msum = _mm256_setzero_ps ();
+    size_t i = 0;
+    for (; i + 8 <= d; i += 8) {
+        __m256 mx = _mm256_loadu_ps (x + i);
+        __m256 my = _mm256_loadu_ps (y + i);
+        __m256 mm = _mm256_mul_ps (_mm256_add_ps (mx, my),
+                                   _mm256_set1_ps (0.5f));
+        msum = _mm256_add_ps (msum, kl_term_avx2 (mx, mm));
+        msum = _mm256_add_ps (msum, kl_term_avx2 (my, mm));
+    }
+    float accu = 0.5 * horizontal_sum_avx2 (msum);
+    return accu + fvec_JensenShannon_default (x + i, y + i, d - i);
+}
+
+#endif
 
+} // anonymous namespace
 
 
+float fvec_Lp (const float *x, const float *y, size_t d, float p)
+{
+    if (p == 1) {
+        return fvec_L1 (x, y, d);
+    } else if (p == 2) {
+        return fvec_L2sqr (x, y, d);
+    }
+#ifdef FAISS_X86_DISPATCH
+    if (p > 0 && d >= 8 && use_avx2 ()) {
+        return fvec_Lp_avx2 (x, y, d, p);
+    }
+#endif
+    return fvec_Lp_default (x, y, d, p);
+}
 
+float fvec_Canberra (const float *x, const float *y, size_t d)
+{
+#ifdef FAISS_X86_DISPATCH
+    if (d >= 8 && use_avx2 ()) {
+        return fvec_Canberra_avx2 (x, y, d);
+    }
+#endif
+    return fvec_Canberra_default (x, y, d);
+}
 
+float fvec_BrayCurtis (const float *x, const float *y, size_t d)
+{
+#ifdef FAISS_X86_DISPATCH
+    if (d >= 8 && use_avx2 ()) {
+        return fvec_BrayCurtis_avx2 (x, y, d);
+    }
+#endif
+    return fvec_BrayCurtis_default (x, y, d);
+}
 
+float fvec_JensenShannon (const float *x, const float *y, size_t d)
+{
+#ifdef FAISS_X86_DISPATCH
+    if (d >= 8 && use_avx2 ()) {
+        return fvec_JensenShannon_avx2 (x, y, d);
+    }
+#endif
+    return fvec_JensenShannon_default (x, y, d);
+}
 
 
 namespace {
 
+/* The brute-force functions compare blocks of queries with blocks of
+ * database vectors that fit in the L2 cache, so that each database
+ * vector is loaded from memory once per block of queries rather than
+ * once per query. */
+
+// nb of queries and nb of bytes of database vectors per block
+const int64_t extra_bs_x = 32;
+const int64_t extra_bs_y_bytes = 1 << 17;
+
+int64_t extra_bs_y (int64_t d)
+{
+    return std::max (int64_t(1), extra_bs_y_bytes / int64_t(d * sizeof(float)));
+}
+
 template<class VD>
 void pairwise_extra_distances_template (
                      VD vd,
@@ -132,16 +354,24 @@ void pairwise_extra_distances_template (
                      float *dis,
                      int64_t ldq, int64_t ldb, int64_t ldd)
 {
+    int64_t bs_y = extra_bs_y (vd.d);
+    int64_t nbx = (nq + extra_bs_x - 1) / extra_bs_x;
 
 #pragma omp parallel for if(nq > 10)
-    for (int64_t i = 0; i < nq; i++) {
-        const float *xqi = xq + i * ldq;
-        const float *xbj = xb;
-        float *disi = dis + ldd * i;
-
-        for (int64_t j = 0; j < nb; j++) {
-            disi[j] = vd (xqi, xbj);
-            xbj += ldb;
+    for (int64_t bi = 0; bi < nbx; bi++) {
+        int64_t i0 = bi * extra_bs_x;
+        int64_t i1 = std::min (i0 + extra_bs_x, nq);
+        for (int64_t j0 = 0; j0 < nb; j0 += bs_y) {
+            int64_t j1 = std::min (j0 + bs_y, nb);
+            for (int64_t i = i0; i < i1; i++) {
+                const float *xqi = xq + i * ldq;
+                const float *xbj = xb + j0 * ldb;
+                float *disi = dis + ldd * i;
+                for (int64_t j = j0; j < j1; j++) {
+                    disi[j] = vd (xqi, xbj);
+                    xbj += ldb;
+                }
+            }
         }
     }
 }
@@ -157,31 +387,48 @@ void knn_extra_metrics_template (
 {
     size_t k = res->k;
     size_t d = vd.d;
+    size_t bs_y = extra_bs_y (d);
     size_t check_period = InterruptCallback::get_period_hint (ny * d);
     check_period *= omp_get_max_threads();
+    // whole blocks of queries between the checks
+    check_period = (check_period + extra_bs_x - 1) / extra_bs_x * extra_bs_x;
 
     for (size_t i0 = 0; i0 < nx; i0 += check_period) {
         size_t i1 = std::min(i0 + check_period, nx);
+        int64_t nbx = (i1 - i0 + extra_bs_x - 1) / extra_bs_x;
 
 #pragma omp parallel for
-        for (int64_t i = i0; i < i1; i++) {
-            const float * x_i = x + i * d;
-            const float * y_j = y;
-            size_t j;
-            float * simi = res->get_val(i);
-            int64_t * idxi = res->get_ids (i);
-
-            maxheap_heapify (k, simi, idxi);
-            for (j = 0; j < ny; j++) {
-                float disij = vd (x_i, y_j);
-
-                if (disij < simi[0]) {
-                    maxheap_pop (k, simi, idxi);
-                    maxheap_push (k, simi, idxi, disij, j);
+        for (int64_t bi = 0; bi < nbx; bi++) {
+            size_t ib0 = i0 + bi * extra_bs_x;
+            size_t ib1 = std::min (ib0 + extra_bs_x, i1);
+
+            for (size_t i = ib0; i < ib1; i++) {
+                maxheap_heapify (k, res->get_val (i), res->get_ids (i));
+            }
+
+            for (size_t j0 = 0; j0 < ny; j0 += bs_y) {
+                size_t j1 = std::min (j0 + bs_y, ny);
+                for (size_t i = ib0; i < ib1; i++) {
+                    const float * x_i = x + i * d;
+                    const float * y_j = y + j0 * d;
+                    float * simi = res->get_val(i);
+                    int64_t * idxi = res->get_ids (i);
+
+                    for (size_t j = j0; j < j1; j++) {
+                        float disij = vd (x_i, y_j);
+
+                        if (disij < simi[0]) {
+                            maxheap_pop (k, simi, idxi);
+                            maxheap_push (k, simi, idxi, disij, j);
+                        }
+                        y_j += d;
+                    }
                 }
-                y_j += d;
             }
-            maxheap_reorder (k, simi, idxi);
+
+            for (size_t i = ib0; i < ib1; i++) {
+                maxheap_reorder (k, res->get_val (i), res->get_ids (i));
+            }
         }
         InterruptCallback::check ();
     }
@@ -213,21 +460,6 @@ struct ExtraDistanceComputer : DistanceComputer {
     }
 };
 
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
 } // anonymous namespace
 
 void pairwise_extra_distances (
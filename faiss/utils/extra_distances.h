@@ -24,6 +24,24 @@
 namespace faiss {
 
 
+/* Distance between two vectors for the extra metrics (L1 and Linf are
+ * in distances.h). They use AVX2 when it is available at runtime. */
+
+/// sum_i |x_i - y_i|^p
+float fvec_Lp (const float *x, const float *y, size_t d, float p);
+
+/// sum_i |x_i - y_i| / (|x_i| + |y_i|), the terms with x_i = y_i = 0 are 0
+float fvec_Canberra (const float *x, const float *y, size_t d);
+
+/// sum_i |x_i - y_i| / sum_i |x_i + y_i|
+float fvec_BrayCurtis (const float *x, const float *y, size_t d);
+
+/** Jensen-Shannon divergence between two distributions (vectors with
+ * non-negative components). The terms of the components that are 0
+ * are 0. */
+float fvec_JensenShannon (const float *x, const float *y, size_t d);
+
+
 void pairwise_extra_distances (
                      int64_t d,
                      int64_t nq, const float *xq,
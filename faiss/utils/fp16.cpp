@@ -0,0 +1,501 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/utils/fp16.h>
+
+#include <cstring>
+
+#include <faiss/utils/simd_x86.h>
+
+namespace faiss {
+
+/*********************************************************
+ * Scalar conversions
+ */
+
+namespace {
+
+inline uint32_t fp32_to_bits (float f) {
+    uint32_t u;
+    memcpy (&u, &f, sizeof (u));
+    return u;
+}
+
+inline float fp32_from_bits (uint32_t u) {
+    float f;
+    memcpy (&f, &u, sizeof (f));
+    return f;
+}
+
+} // anonymous namespace
+
+// the fp16 conversions are adapted from the FP16 library by Marat
+// Dukhan, https://github.com/Maratyszcza/FP16 (MIT license)
+
+uint16_t encode_fp16 (float f)
+{
+    const float scale_to_inf = fp32_from_bits (0x77800000);  // 2^112
+    const float scale_to_zero = fp32_from_bits (0x08800000); // 2^-110
+    float base = ((f < 0 ? -f : f) * scale_to_inf) * scale_to_zero;
+
+    const uint32_t w = fp32_to_bits (f);
+    const uint32_t shl1_w = w + w;
+    const uint32_t sign = w & 0x80000000u;
+    uint32_t bias = shl1_w & 0xff000000u;
+    if (bias < 0x71000000u) {
+        bias = 0x71000000u;
+    }
+
+    base = fp32_from_bits ((bias >> 1) + 0x07800000u) + base;
+    const uint32_t bits = fp32_to_bits (base);
+    const uint32_t exp_bits = (bits >> 13) & 0x00007c00u;
+    const uint32_t mantissa_bits = bits & 0x00000fffu;
+    const uint32_t nonsign = exp_bits + mantissa_bits;
+    return (sign >> 16) | (shl1_w > 0xff000000u ? 0x7e00 : nonsign);
+}
+
+float decode_fp16 (uint16_t h)
+{
+    const uint32_t w = (uint32_t)h << 16;
+    const uint32_t sign = w & 0x80000000u;
+    const uint32_t two_w = w + w;
+
+    const uint32_t exp_offset = 0xe0u << 23;
+    const float exp_scale = fp32_from_bits (0x07800000); // 2^-112
+    const float normalized_value =
+        fp32_from_bits ((two_w >> 4) + exp_offset) * exp_scale;
+
+    const uint32_t magic_mask = 126u << 23;
+    const float magic_bias = 0.5f;
+    const float denormalized_value =
+        fp32_from_bits ((two_w >> 17) | magic_mask) - magic_bias;
+
+    const uint32_t denormalized_cutoff = 1u << 27;
+    const uint32_t result = sign |
+        (two_w < denormalized_cutoff ? fp32_to_bits (denormalized_value)
+                                     : fp32_to_bits (normalized_value));
+    return fp32_from_bits (result);
+}
+
+uint16_t encode_bf16 (float f)
+{
+    uint32_t u = fp32_to_bits (f);
+    if ((u & 0x7fffffffu) > 0x7f800000u) {
+        // NaN, keep it quiet
+        return (u >> 16) | 0x40;
+    }
+    u += 0x7fff + ((u >> 16) & 1);
+    return u >> 16;
+}
+
+float decode_bf16 (uint16_t x)
+{
+    return fp32_from_bits ((uint32_t)x << 16);
+}
+
+
+/*********************************************************
+ * Reference implementations
+ */
+
+namespace {
+
+void fp32_to_fp16_ref (uint16_t * out, const float * x, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        out[i] = encode_fp16 (x[i]);
+    }
+}
+
+void fp16_to_fp32_ref (float * out, const uint16_t * x, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        out[i] = decode_fp16 (x[i]);
+    }
+}
+
+void bf16_to_fp32_ref (float * out, const uint16_t * x, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        out[i] = decode_bf16 (x[i]);
+    }
+}
+
+template<class Decode>
+float fvec_L2sqr_half_ref (const float * x, const uint16_t * y, size_t d,
+                           Decode decode)
+{
+    float res = 0;
+    for (size_t i = 0; i < d; i++) {
+        float tmp = x[i] - decode (y[i]);
+        res += tmp * tmp;
+    }
+    return res;
+}
+
+template<class Decode>
+float fvec_inner_product_half_ref (const float * x, const uint16_t * y,
+                                   size_t d, Decode decode)
+{
+    float res = 0;
+    for (size_t i = 0; i < d; i++) {
+        res += x[i] * decode (y[i]);
+    }
+    return res;
+}
+
+} // anonymous namespace
+
+
+/*********************************************************
+ * AVX2 implementations, selected at runtime
+ */
+
+#ifdef FAISS_X86_DISPATCH
+
+namespace {
+
+FAISS_AVX2_TARGET
+inline __m256 load8_fp16_avx2 (const uint16_t * y)
+{
+    return _mm256_cvtph_ps (_mm_loadu_si128 ((const __m128i*)y));
+}
+
+FAISS_AVX2_TARGET
+inline __m256 load8_bf16_avx2 (const uint16_t * y)
+{
+    __m256i yi = _mm256_cvtepu16_epi32 (_mm_loadu_si128 ((const __m128i*)y));
+    return _mm256_castsi256_ps (_mm256_slli_epi32 (yi, 16));
+}
+
+FAISS_AVX2_TARGET
+inline float horizontal_sum_8_avx2 (__m256 v)
+{
+    __m128 s = _mm_add_ps (_mm256_castps256_ps128 (v),
+                           _mm256_extractf128_ps (v, 1));
+    s = _mm_hadd_ps (s, s);
+    s = _mm_hadd_ps (s, s);
+    return _mm_cvtss_f32 (s);
+}
+
+// the remaining d < 8 components are loaded through a zero-padded copy
+template<bool is_bf16>
+FAISS_AVX2_TARGET
+inline void load_tail_avx2 (const float * x, const uint16_t * y, size_t d,
+                            __m256 & mx, __m256 & my)
+{
+    float xbuf[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    uint16_t ybuf[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    memcpy (xbuf, x, d * sizeof (float));
+    memcpy (ybuf, y, d * sizeof (uint16_t));
+    mx = _mm256_loadu_ps (xbuf);
+    my = is_bf16 ? load8_bf16_avx2 (ybuf) : load8_fp16_avx2 (ybuf);
+}
+
+template<bool is_bf16>
+FAISS_AVX2_TARGET
+float fvec_L2sqr_half_avx2 (const float * x, const uint16_t * y, size_t d)
+{
+    __m256 msum1 = _mm256_setzero_ps ();
+    __m256 msum2 = _mm256_setzero_ps ();
+
+    while (d >= 16) {
+        __m256 y1 = is_bf16 ? load8_bf16_avx2 (y) : load8_fp16_avx2 (y);
+        __m256 y2 = is_bf16 ? load8_bf16_avx2 (y + 8) :
+                              load8_fp16_avx2 (y + 8);
+        __m256 a_m_b1 = _mm256_sub_ps (_mm256_loadu_ps (x), y1);
+        __m256 a_m_b2 = _mm256_sub_ps (_mm256_loadu_ps (x + 8), y2);
+        msum1 = _mm256_fmadd_ps (a_m_b1, a_m_b1, msum1);
+        msum2 = _mm256_fmadd_ps (a_m_b2, a_m_b2, msum2);
+        x += 16; y += 16; d -= 16;
+    }
+
+    if (d >= 8) {
+        __m256 y1 = is_bf16 ? load8_bf16_avx2 (y) : load8_fp16_avx2 (y);
+        __m256 a_m_b1 = _mm256_sub_ps (_mm256_loadu_ps (x), y1);
+        msum1 = _mm256_fmadd_ps (a_m_b1, a_m_b1, msum1);
+        x += 8; y += 8; d -= 8;
+    }
+
+    if (d > 0) {
+        __m256 mx, my;
+        load_tail_avx2<is_bf16> (x, y, d, mx, my);
+        __m256 a_m_b1 = _mm256_sub_ps (mx, my);
+        msum2 = _mm256_fmadd_ps (a_m_b1, a_m_b1, msum2);
+    }
+
+    return horizontal_sum_8_avx2 (_mm256_add_ps (msum1, msum2));
+}
+
+template<bool is_bf16>
+FAISS_AVX2_TARGET
+float fvec_inner_product_half_avx2 (const float * x, const uint16_t * y,
+                                    size_t d)
+{
+    __m256 msum1 = _mm256_setzero_ps ();
+    __m256 msum2 = _mm256_setzero_ps ();
+
+    while (d >= 16) {
+        __m256 y1 = is_bf16 ? load8_bf16_avx2 (y) : load8_fp16_avx2 (y);
+        __m256 y2 = is_bf16 ? load8_bf16_avx2 (y + 8) :
+                              load8_fp16_avx2 (y + 8);
+        msum1 = _mm256_fmadd_ps (_mm256_loadu_ps (x), y1, msum1);
+        msum2 = _mm256_fmadd_ps (_mm256_loadu_ps (x + 8), y2, msum2);
+        x += 16; y += 16; d -= 16;
+    }
+
+    if (d >= 8) {
+        __m256 y1 = is_bf16 ? load8_bf16_avx2 (y) : load8_fp16_avx2 (y);
+        msum1 = _mm256_fmadd_ps (_mm256_loadu_ps (x), y1, msum1);
+        x += 8; y += 8; d -= 8;
+    }
+
+    if (d > 0) {
+        __m256 mx, my;
+        load_tail_avx2<is_bf16> (x, y, d, mx, my);
+        msum2 = _mm256_fmadd_ps (mx, my, msum2);
+    }
+
+    return horizontal_sum_8_avx2 (_mm256_add_ps (msum1, msum2));
+}
+
+FAISS_AVX2_TARGET
+void fp32_to_fp16_avx2 (uint16_t * out, const float * x, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i h = _mm256_cvtps_ph (
+              _mm256_loadu_ps (x + i),
+              _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        _mm_storeu_si128 ((__m128i*)(out + i), h);
+    }
+    fp32_to_fp16_ref (out + i, x + i, n - i);
+}
+
+FAISS_AVX2_TARGET
+void fp16_to_fp32_avx2 (float * out, const uint16_t * x, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps (out + i, load8_fp16_avx2 (x + i));
+    }
+    fp16_to_fp32_ref (out + i, x + i, n - i);
+}
+
+FAISS_AVX2_TARGET
+void bf16_to_fp32_avx2 (float * out, const uint16_t * x, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps (out + i, load8_bf16_avx2 (x + i));
+    }
+    bf16_to_fp32_ref (out + i, x + i, n - i);
+}
+
+} // anonymous namespace
+
+#endif
+
+
+/*********************************************************
+ * AVX-512 implementations, selected at runtime
+ */
+
+#ifdef FAISS_X86_DISPATCH
+
+namespace {
+
+template<bool is_bf16>
+FAISS_AVX512_TARGET
+inline __m512 load16_half_avx512 (const uint16_t * y, __mmask16 mask)
+{
+    // masked loads do not read beyond the end of the arrays
+    __m256i yi = _mm256_maskz_loadu_epi16 (mask, y);
+    if (is_bf16) {
+        return _mm512_castsi512_ps (
+              _mm512_slli_epi32 (_mm512_cvtepu16_epi32 (yi), 16));
+    } else {
+        return _mm512_cvtph_ps (yi);
+    }
+}
+
+template<bool is_bf16>
+FAISS_AVX512_TARGET
+float fvec_L2sqr_half_avx512 (const float * x, const uint16_t * y, size_t d)
+{
+    __m512 msum1 = _mm512_setzero_ps ();
+    __m512 msum2 = _mm512_setzero_ps ();
+
+    while (d >= 32) {
+        __m512 a_m_b1 = _mm512_sub_ps (
+              _mm512_loadu_ps (x), load16_half_avx512<is_bf16> (y, 0xffff));
+        __m512 a_m_b2 = _mm512_sub_ps (
+              _mm512_loadu_ps (x + 16),
+              load16_half_avx512<is_bf16> (y + 16, 0xffff));
+        msum1 = _mm512_fmadd_ps (a_m_b1, a_m_b1, msum1);
+        msum2 = _mm512_fmadd_ps (a_m_b2, a_m_b2, msum2);
+        x += 32; y += 32; d -= 32;
+    }
+
+    if (d >= 16) {
+        __m512 a_m_b1 = _mm512_sub_ps (
+              _mm512_loadu_ps (x), load16_half_avx512<is_bf16> (y, 0xffff));
+        msum1 = _mm512_fmadd_ps (a_m_b1, a_m_b1, msum1);
+        x += 16; y += 16; d -= 16;
+    }
+
+    if (d > 0) {
+        __mmask16 mask = (1 << d) - 1;
+        __m512 a_m_b1 = _mm512_sub_ps (
+              _mm512_maskz_loadu_ps (mask, x),
+              load16_half_avx512<is_bf16> (y, mask));
+        msum2 = _mm512_fmadd_ps (a_m_b1, a_m_b1, msum2);
+    }
+
+    return horizontal_sum_avx512 (_mm512_add_ps (msum1, msum2));
+}
+
+template<bool is_bf16>
+FAISS_AVX512_TARGET
+float fvec_inner_product_half_avx512 (const float * x, const uint16_t * y,
+                                      size_t d)
+{
+    __m512 msum1 = _mm512_setzero_ps ();
+    __m512 msum2 = _mm512_setzero_ps ();
+
+    while (d >= 32) {
+        msum1 = _mm512_fmadd_ps (
+              _mm512_loadu_ps (x),
+              load16_half_avx512<is_bf16> (y, 0xffff), msum1);
+        msum2 = _mm512_fmadd_ps (
+              _mm512_loadu_ps (x + 16),
+              load16_half_avx512<is_bf16> (y + 16, 0xffff), msum2);
+        x += 32; y += 32; d -= 32;
+    }
+
+    if (d >= 16) {
+        msum1 = _mm512_fmadd_ps (
+              _mm512_loadu_ps (x),
+              load16_half_avx512<is_bf16> (y, 0xffff), msum1);
+        x += 16; y += 16; d -= 16;
+    }
+
+    if (d > 0) {
+        __mmask16 mask = (1 << d) - 1;
+        msum2 = _mm512_fmadd_ps (
+              _mm512_maskz_loadu_ps (mask, x),
+              load16_half_avx512<is_bf16> (y, mask), msum2);
+    }
+
+    return horizontal_sum_avx512 (_mm512_add_ps (msum1, msum2));
+}
+
+} // anonymous namespace
+
+#endif
+
+
+/*********************************************************
+ * Runtime dispatch
+ */
+
+void fp32_to_fp16 (uint16_t * out, const float * x, size_t n)
+{
+#ifdef FAISS_X86_DISPATCH
+    if (use_avx2 ()) {
+        fp32_to_fp16_avx2 (out, x, n);
+        return;
+    }
+#endif
+    fp32_to_fp16_ref (out, x, n);
+}
+
+void fp16_to_fp32 (float * out, const uint16_t * x, size_t n)
+{
+#ifdef FAISS_X86_DISPATCH
+    if (use_avx2 ()) {
+        fp16_to_fp32_avx2 (out, x, n);
+        return;
+    }
+#endif
+    fp16_to_fp32_ref (out, x, n);
+}
+
+void fp32_to_bf16 (uint16_t * out, const float * x, size_t n)
+{
+    // not a hot path, the loop is vectorized by the compiler
+    for (size_t i = 0; i < n; i++) {
+        out[i] = encode_bf16 (x[i]);
+    }
+}
+
+void bf16_to_fp32 (float * out, const uint16_t * x, size_t n)
+{
+#ifdef FAISS_X86_DISPATCH
+    if (use_avx2 ()) {
+        bf16_to_fp32_avx2 (out, x, n);
+        return;
+    }
+#endif
+    bf16_to_fp32_ref (out, x, n);
+}
+
+float fvec_L2sqr_fp16 (const float * x, const uint16_t * y, size_t d)
+{
+#ifdef FAISS_X86_DISPATCH
+    if (d >= 16 && use_avx512 ()) {
+        return fvec_L2sqr_half_avx512<false> (x, y, d);
+    }
+    if (use_avx2 ()) {
+        return fvec_L2sqr_half_avx2<false> (x, y, d);
+    }
+#endif
+    return fvec_L2sqr_half_ref (x, y, d, decode_fp16);
+}
+
+float fvec_inner_product_fp16 (const float * x, const uint16_t * y, size_t d)
+{
+#ifdef FAISS_X86_DISPATCH
+    if (d >= 16 && use_avx512 ()) {
+        return fvec_inner_product_half_avx512<false> (x, y, d);
+    }
+    if (use_avx2 ()) {
+        return fvec_inner_product_half_avx2<false> (x, y, d);
+    }
+#endif
+    return fvec_inner_product_half_ref (x, y, d, decode_fp16);
+}
+
+float fvec_L2sqr_bf16 (const float * x, const uint16_t * y, size_t d)
+{
+#ifdef FAISS_X86_DISPATCH
+    if (d >= 16 && use_avx512 ()) {
+        return fvec_L2sqr_half_avx512<true> (x, y, d);
+    }
+    if (use_avx2 ()) {
+        return fvec_L2sqr_half_avx2<true> (x, y, d);
+    }
+#endif
+    return fvec_L2sqr_half_ref (x, y, d, decode_bf16);
+}
+
+float fvec_inner_product_bf16 (const float * x, const uint16_t * y, size_t d)
+{
+#ifdef FAISS_X86_DISPATCH
+    if (d >= 16 && use_avx512 ()) {
+        return fvec_inner_product_half_avx512<true> (x, y, d);
+    }
+    if (use_avx2 ()) {
+        return fvec_inner_product_half_avx2<true> (x, y, d);
+    }
+#endif
+    return fvec_inner_product_half_ref (x, y, d, decode_bf16);
+}
+
+} // namespace faiss
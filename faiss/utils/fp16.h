@@ -0,0 +1,57 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Conversions between float32 and the 16-bit floating point formats,
+ * and distances between a float32 query and 16-bit database vectors,
+ * converted on-the-fly (F16C / AVX-512 when available, see
+ * cpu_dispatch.h).
+ *
+ * fp16 is IEEE half precision (5 bits exponent, 10 bits mantissa).
+ * bf16 is bfloat16, the 16 upper bits of a float32 (8 bits exponent, 7
+ * bits mantissa). Both conversions from float32 round to nearest even.
+ */
+
+namespace faiss {
+
+uint16_t encode_fp16 (float x);
+float decode_fp16 (uint16_t x);
+
+uint16_t encode_bf16 (float x);
+float decode_bf16 (uint16_t x);
+
+/// convert n floats to fp16
+void fp32_to_fp16 (uint16_t * out, const float * x, size_t n);
+
+/// convert n fp16 values to floats
+void fp16_to_fp32 (float * out, const uint16_t * x, size_t n);
+
+/// convert n floats to bf16
+void fp32_to_bf16 (uint16_t * out, const float * x, size_t n);
+
+/// convert n bf16 values to floats
+void bf16_to_fp32 (float * out, const uint16_t * x, size_t n);
+
+/// squared L2 distance between a float vector and a fp16 vector
+float fvec_L2sqr_fp16 (const float * x, const uint16_t * y, size_t d);
+
+/// inner product between a float vector and a fp16 vector
+float fvec_inner_product_fp16 (const float * x, const uint16_t * y, size_t d);
+
+/// squared L2 distance between a float vector and a bf16 vector
+float fvec_L2sqr_bf16 (const float * x, const uint16_t * y, size_t d);
+
+/// inner product between a float vector and a bf16 vector
+float fvec_inner_product_bf16 (const float * x, const uint16_t * y, size_t d);
+
+} // namespace faiss
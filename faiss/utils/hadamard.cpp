@@ -0,0 +1,86 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/utils/hadamard.h>
+
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/cpu_dispatch.h>
+
+#ifdef FAISS_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+namespace faiss {
+
+namespace {
+
+void fwht_ref (float *x, size_t d)
+{
+    for (size_t h = 1; h < d; h *= 2) {
+        for (size_t i = 0; i < d; i += 2 * h) {
+            for (size_t j = i; j < i + h; j++) {
+                float a = x[j], b = x[j + h];
+                x[j] = a + b;
+                x[j + h] = a - b;
+            }
+        }
+    }
+}
+
+#ifdef FAISS_X86_DISPATCH
+
+/* The butterfly stages commute, so the 3 stages within 8 consecutive
+ * elements are done in registers first, then the stages h >= 8 operate
+ * on full vectors. */
+FAISS_AVX2_TARGET
+void fwht_avx2 (float *x, size_t d)
+{
+    const __m256 s1 = _mm256_setr_ps (1, -1, 1, -1, 1, -1, 1, -1);
+    const __m256 s2 = _mm256_setr_ps (1, 1, -1, -1, 1, 1, -1, -1);
+    const __m256 s4 = _mm256_setr_ps (1, 1, 1, 1, -1, -1, -1, -1);
+
+    for (size_t i = 0; i < d; i += 8) {
+        __m256 v = _mm256_loadu_ps (x + i);
+        v = _mm256_fmadd_ps (v, s1, _mm256_permute_ps (v, 0xb1));
+        v = _mm256_fmadd_ps (v, s2, _mm256_permute_ps (v, 0x4e));
+        v = _mm256_fmadd_ps (v, s4, _mm256_permute2f128_ps (v, v, 1));
+        _mm256_storeu_ps (x + i, v);
+    }
+
+    for (size_t h = 8; h < d; h *= 2) {
+        for (size_t i = 0; i < d; i += 2 * h) {
+            for (size_t j = i; j < i + h; j += 8) {
+                __m256 a = _mm256_loadu_ps (x + j);
+                __m256 b = _mm256_loadu_ps (x + j + h);
+                _mm256_storeu_ps (x + j, _mm256_add_ps (a, b));
+                _mm256_storeu_ps (x + j + h, _mm256_sub_ps (a, b));
+            }
+        }
+    }
+}
+
+#endif
+
+} // anonymous namespace
+
+
+void fwht_inplace (float *x, size_t d)
+{
+    FAISS_THROW_IF_NOT_MSG (d > 0 && (d & (d - 1)) == 0,
+                            "dimension should be a power of 2");
+#ifdef FAISS_X86_DISPATCH
+    if (d >= 8 && use_avx2 ()) {
+        fwht_avx2 (x, d);
+        return;
+    }
+#endif
+    fwht_ref (x, d);
+}
+
+} // namespace faiss
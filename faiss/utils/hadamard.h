@@ -0,0 +1,26 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <stddef.h>
+
+namespace faiss {
+
+/** In-place fast Walsh-Hadamard transform of a vector, in O(d log d).
+ *
+ * The transform is not normalized: applying it twice multiplies the
+ * vector by d.
+ *
+ * @param x  vector to transform, size d
+ * @param d  must be a power of 2
+ */
+void fwht_inplace (float *x, size_t d);
+
+} // namespace faiss
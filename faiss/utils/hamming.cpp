@@ -27,16 +27,24 @@
 #include <faiss/utils/hamming.h>
 
 #include <algorithm>
+#include <limits>
 #include <vector>
 #include <memory>
 #include <stdio.h>
 #include <math.h>
 
+#include <omp.h>
+
 #include <faiss/utils/Heap.h>
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/utils/utils.h>
+#include <faiss/utils/cpu_dispatch.h>
 #include <faiss/impl/AuxIndexStructures.h>
 
+#ifdef FAISS_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
 static const size_t BLOCKSIZE_QUERY = 8192;
 
 
@@ -262,9 +270,199 @@ size_t match_hamming_thres (
 }
 
 
+/******************************************************************
+ * Hamming distances from one code to a block of codes.
+ *
+ * The codes are processed by chunks of 32 bytes. The 4 64-bit popcounts
+ * of a chunk are accumulated in a __m256i per code, and the sums of 4
+ * codes are reduced together.
+ ******************************************************************/
+
+namespace {
+
+#ifdef FAISS_X86_DISPATCH
+
+/// popcounts of the 4 64-bit words of x
+FAISS_AVX2_TARGET
+inline __m256i popcount_4x64_avx2 (__m256i x)
+{
+    const __m256i lookup = _mm256_setr_epi8 (
+            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8 (0x0f);
+    __m256i lo = _mm256_and_si256 (x, low_mask);
+    __m256i hi = _mm256_and_si256 (_mm256_srli_epi16 (x, 4), low_mask);
+    __m256i cnt = _mm256_add_epi8 (_mm256_shuffle_epi8 (lookup, lo),
+                                   _mm256_shuffle_epi8 (lookup, hi));
+    // sum the byte counts of each 64-bit word
+    return _mm256_sad_epu8 (cnt, _mm256_setzero_si256 ());
+}
+
+/// dis[c] = sum of the 4 64-bit elements of s_c
+FAISS_AVX2_TARGET
+inline void store_sums_4 (__m256i s0, __m256i s1, __m256i s2, __m256i s3,
+                          hamdis_t *dis)
+{
+    __m256i p01 = _mm256_add_epi64 (_mm256_unpacklo_epi64 (s0, s1),
+                                    _mm256_unpackhi_epi64 (s0, s1));
+    __m256i p23 = _mm256_add_epi64 (_mm256_unpacklo_epi64 (s2, s3),
+                                    _mm256_unpackhi_epi64 (s2, s3));
+    __m256i t = _mm256_add_epi64 (
+            _mm256_permute2x128_si256 (p01, p23, 0x20),
+            _mm256_permute2x128_si256 (p01, p23, 0x31));
+    // the sums fit in 32 bits
+    t = _mm256_permutevar8x32_epi32 (
+            t, _mm256_setr_epi32 (0, 2, 4, 6, 0, 2, 4, 6));
+    _mm_storeu_si128 ((__m128i*)dis, _mm256_castsi256_si128 (t));
+}
+
+FAISS_AVX2_TARGET
+inline __m256i xor_chunk (const uint8_t *a, const uint8_t *b)
+{
+    return _mm256_xor_si256 (_mm256_loadu_si256 ((const __m256i*)a),
+                             _mm256_loadu_si256 ((const __m256i*)b));
+}
+
+FAISS_AVX2_TARGET
+void hammings_1_to_n_avx2 (const uint8_t *a, const uint8_t *b,
+                           size_t n, size_t code_size, hamdis_t *dis)
+{
+    size_t j = 0;
+    for (; j + 4 <= n; j += 4) {
+        __m256i s[4];
+        for (int c = 0; c < 4; c++) {
+            const uint8_t *bj = b + (j + c) * code_size;
+            s[c] = _mm256_setzero_si256 ();
+            for (size_t l = 0; l < code_size; l += 32) {
+                s[c] = _mm256_add_epi64 (
+                        s[c], popcount_4x64_avx2 (xor_chunk (a + l, bj + l)));
+            }
+        }
+        store_sums_4 (s[0], s[1], s[2], s[3], dis + j);
+    }
+    for (; j < n; j++) {
+        const uint8_t *bj = b + j * code_size;
+        __m256i s = _mm256_setzero_si256 ();
+        for (size_t l = 0; l < code_size; l += 32) {
+            s = _mm256_add_epi64 (
+                    s, popcount_4x64_avx2 (xor_chunk (a + l, bj + l)));
+        }
+        hamdis_t d4[4];
+        store_sums_4 (s, s, s, s, d4);
+        dis[j] = d4[0];
+    }
+}
+
+FAISS_AVX512_VPOPCNT_TARGET
+void hammings_1_to_n_vpopcnt (const uint8_t *a, const uint8_t *b,
+                              size_t n, size_t code_size, hamdis_t *dis)
+{
+    size_t j = 0;
+    for (; j + 4 <= n; j += 4) {
+        __m256i s[4];
+        for (int c = 0; c < 4; c++) {
+            const uint8_t *bj = b + (j + c) * code_size;
+            s[c] = _mm256_setzero_si256 ();
+            for (size_t l = 0; l < code_size; l += 32) {
+                s[c] = _mm256_add_epi64 (
+                        s[c], _mm256_popcnt_epi64 (xor_chunk (a + l, bj + l)));
+            }
+        }
+        store_sums_4 (s[0], s[1], s[2], s[3], dis + j);
+    }
+    for (; j < n; j++) {
+        const uint8_t *bj = b + j * code_size;
+        __m256i s = _mm256_setzero_si256 ();
+        for (size_t l = 0; l < code_size; l += 32) {
+            s = _mm256_add_epi64 (
+                    s, _mm256_popcnt_epi64 (xor_chunk (a + l, bj + l)));
+        }
+        hamdis_t d4[4];
+        store_sums_4 (s, s, s, s, d4);
+        dis[j] = d4[0];
+    }
+}
+
+#endif
+
+} // anonymous namespace
+
+bool hammings_1_to_n_is_simd (size_t code_size)
+{
+    return code_size > 0 && code_size % 32 == 0 && use_avx2 ();
+}
+
+void hammings_1_to_n (
+        const uint8_t * a,
+        const uint8_t * b,
+        size_t n,
+        size_t code_size,
+        hamdis_t * dis)
+{
+#ifdef FAISS_X86_DISPATCH
+    if (hammings_1_to_n_is_simd (code_size)) {
+        if (use_avx512_vpopcnt ()) {
+            hammings_1_to_n_vpopcnt (a, b, n, code_size, dis);
+        } else {
+            hammings_1_to_n_avx2 (a, b, n, code_size, dis);
+        }
+        return;
+    }
+#endif
+    HammingComputerDefault hc (a, code_size);
+    for (size_t j = 0; j < n; j++) {
+        dis[j] = hc.hamming (b + j * code_size);
+    }
+}
+
+
+namespace {
+
+/* same as hammings_knn_hc, computing the distances by blocks with
+ * hammings_1_to_n */
+void hammings_knn_hc_blocks (
+        int bytes_per_code,
+        int_maxheap_array_t * ha,
+        const uint8_t * bs1,
+        const uint8_t * bs2,
+        size_t n2,
+        bool order)
+{
+    size_t k = ha->k;
+    ha->heapify ();
+
+    const size_t block_size = hamming_batch_size;
+    for (size_t j0 = 0; j0 < n2; j0 += block_size) {
+      const size_t j1 = std::min(j0 + block_size, n2);
+#pragma omp parallel for
+      for (int64_t i = 0; i < ha->nh; i++) {
+        const uint8_t * q = bs1 + i * bytes_per_code;
+        hamdis_t * __restrict bh_val_ = ha->val + i * k;
+        int64_t * __restrict bh_ids_ = ha->ids + i * k;
+        hamdis_t dis[256];
+        for (size_t jb = j0; jb < j1; jb += 256) {
+          size_t nj = std::min(j1 - jb, size_t(256));
+          hammings_1_to_n (q, bs2 + jb * bytes_per_code, nj,
+                           bytes_per_code, dis);
+          for (size_t j = 0; j < nj; j++) {
+            if (dis[j] < bh_val_[0]) {
+              faiss::maxheap_pop<hamdis_t> (k, bh_val_, bh_ids_);
+              faiss::maxheap_push<hamdis_t> (k, bh_val_, bh_ids_,
+                                             dis[j], jb + j);
+            }
+          }
+        }
+      }
+    }
+    if (order) ha->reorder ();
+}
+
+} // anonymous namespace
+
+
 /* Return closest neighbors w.r.t Hamming distance, using a heap. */
 template <class HammingComputer>
-static
+static FAISS_POPCNT_CLONES
 void hammings_knn_hc (
         int bytes_per_code,
         int_maxheap_array_t * ha,
@@ -303,7 +501,7 @@ void hammings_knn_hc (
 
 /* Return closest neighbors w.r.t Hamming distance, using max count. */
 template <class HammingComputer>
-static
+static FAISS_POPCNT_CLONES
 void hammings_knn_mc (
         int bytes_per_code,
         const uint8_t *a,
@@ -362,7 +560,7 @@ void hammings_knn_mc (
 
 
 // works faster than the template version
-static
+static FAISS_POPCNT_CLONES
 void hammings_knn_hc_1 (
         int_maxheap_array_t * ha,
         const uint64_t * bs1,
@@ -412,32 +610,110 @@ void hammings_knn_hc_1 (
  * dimension 0 corresponds to the least significant bit of b[0], or
  * equivalently to the lsb of the first byte that is stored.
  */
-void fvec2bitvec (const float * x, uint8_t * b, size_t d)
+namespace {
+
+/// bit j of b is set iff x[j] >= th[j] (or 0 if th is null)
+template <bool has_th>
+void fvec2bitvec_ref (const float * x, const float * th,
+                      uint8_t * b, size_t d)
 {
     for (int i = 0; i < d; i += 8) {
         uint8_t w = 0;
-        uint8_t mask = 1;
         int nj = i + 8 <= d ? 8 : d - i;
         for (int j = 0; j < nj; j++) {
-            if (x[i + j] >= 0)
-                w |= mask;
-            mask <<= 1;
+            // branchless, the signs are unpredictable
+            w |= uint8_t (x[i + j] >= (has_th ? th[i + j] : 0)) << j;
         }
         *b = w;
         b++;
     }
 }
 
+void fvec2bitvec_ref (const float * x, const float * th,
+                      uint8_t * b, size_t d)
+{
+    if (th) {
+        fvec2bitvec_ref<true> (x, th, b, d);
+    } else {
+        fvec2bitvec_ref<false> (x, th, b, d);
+    }
+}
+
+#ifdef FAISS_X86_DISPATCH
+
+/// same with one comparison and movemask per 8 components
+FAISS_AVX2_TARGET
+void fvec2bitvec_avx2 (const float * x, const float * th,
+                       uint8_t * b, size_t d)
+{
+    size_t i = 0;
+    for (; i + 32 <= d; i += 32) {
+        uint32_t w = 0;
+        for (int l = 0; l < 4; l++) {
+            __m256 v = _mm256_loadu_ps (x + i + 8 * l);
+            __m256 t = th ? _mm256_loadu_ps (th + i + 8 * l) :
+                            _mm256_setzero_ps ();
+            w |= uint32_t (_mm256_movemask_ps (
+                    _mm256_cmp_ps (v, t, _CMP_GE_OQ))) << (8 * l);
+        }
+        // the bits are stored little-endian
+        b[i / 8] = w;
+        b[i / 8 + 1] = w >> 8;
+        b[i / 8 + 2] = w >> 16;
+        b[i / 8 + 3] = w >> 24;
+    }
+    for (; i + 8 <= d; i += 8) {
+        __m256 v = _mm256_loadu_ps (x + i);
+        __m256 t = th ? _mm256_loadu_ps (th + i) : _mm256_setzero_ps ();
+        b[i / 8] = _mm256_movemask_ps (_mm256_cmp_ps (v, t, _CMP_GE_OQ));
+    }
+    if (i < d) {
+        fvec2bitvec_ref (x + i, th ? th + i : nullptr, b + i / 8, d - i);
+    }
+}
+
+#endif
+
+void fvec2bitvec_threshold (const float * x, const float * th,
+                            uint8_t * b, size_t d)
+{
+#ifdef FAISS_X86_DISPATCH
+    if (use_avx2 ()) {
+        fvec2bitvec_avx2 (x, th, b, d);
+        return;
+    }
+#endif
+    fvec2bitvec_ref (x, th, b, d);
+}
+
+} // anonymous namespace
+
+void fvec2bitvec (const float * x, uint8_t * b, size_t d)
+{
+    fvec2bitvec_threshold (x, nullptr, b, d);
+}
+
 
 
 /* Same but for n vectors.
    Ensure that the ouptut b is byte-aligned (pad with 0s). */
 void fvecs2bitvecs (const float * x, uint8_t * b, size_t d, size_t n)
+{
+    fvecs2bitvecs_threshold (x, d, nullptr, b, d, n);
+}
+
+void fvecs2bitvecs_threshold (
+        const float * x,
+        size_t ldx,
+        const float * thresholds,
+        uint8_t * b,
+        size_t d,
+        size_t n)
 {
     const int64_t ncodes = ((d + 7) / 8);
-#pragma omp parallel for if(n > 100000)
+#pragma omp parallel for if(n * d > 1000000)
     for (int64_t i = 0; i < n; i++)
-        fvec2bitvec (x + i * d, b + i * ncodes, d);
+        fvec2bitvec_threshold (x + i * ldx, thresholds, b + i * ncodes, d);
 }
 
 
@@ -562,6 +838,10 @@ void hammings_knn_hc (
         size_t ncodes,
         int order)
 {
+    if (hammings_1_to_n_is_simd (ncodes)) {
+        hammings_knn_hc_blocks (ncodes, ha, a, b, nb, order);
+        return;
+    }
     switch (ncodes) {
     case 4:
         hammings_knn_hc<faiss::HammingComputer4>
@@ -637,8 +917,186 @@ void hammings_knn_mc(
         }
     }
 }
+/***************************************************************
+ * HammingKSelector
+ ***************************************************************/
+
+HammingKSelector::HammingKSelector (int nbits, size_t k):
+    nbits (nbits), k (k), hist (nbits + 1)
+{
+    reset ();
+}
+
+void HammingKSelector::reset ()
+{
+    // with k = 0 all candidates are rejected
+    thres = k == 0 ? -1 : nbits;
+    count_lt = 0;
+    std::fill (hist.begin(), hist.end(), 0);
+    dis.clear ();
+    ids.clear ();
+}
+
+void HammingKSelector::compact ()
+{
+    if (thres < 0) {
+        return;
+    }
+    size_t n_eq_max = k - count_lt, n_eq = 0;
+    size_t wp = 0;
+    for (size_t i = 0; i < dis.size(); i++) {
+        hamdis_t d = dis[i];
+        if (d < thres || (d == thres && n_eq++ < n_eq_max)) {
+            dis[wp] = d;
+            ids[wp] = ids[i];
+            wp++;
+        }
+    }
+    dis.resize (wp);
+    ids.resize (wp);
+    hist[thres] = std::min (n_eq, n_eq_max);
+    std::fill (hist.begin() + thres + 1, hist.end(), 0);
+}
+
+void HammingKSelector::merge (HammingKSelector & other)
+{
+    other.compact ();
+    for (size_t i = 0; i < other.dis.size(); i++) {
+        add (other.dis[i], other.ids[i]);
+    }
+}
+
+void HammingKSelector::get_results (int32_t *distances, int64_t *labels)
+{
+    compact ();
+    // counting sort, stable
+    std::vector<size_t> ofs (thres + 2);
+    for (int d = 0; d <= thres; d++) {
+        ofs[d + 1] = ofs[d] + hist[d];
+    }
+    for (size_t i = 0; i < dis.size(); i++) {
+        size_t o = ofs[dis[i]]++;
+        distances[o] = dis[i];
+        labels[o] = ids[i];
+    }
+    for (size_t i = dis.size(); i < k; i++) {
+        distances[i] = std::numeric_limits<int32_t>::max();
+        labels[i] = -1;
+    }
+}
+
+
+template <class HammingComputer>
+static FAISS_POPCNT_CLONES
+void hammings_knn_hist_template (
+        size_t code_size,
+        const uint8_t *a,
+        const uint8_t *b,
+        size_t na,
+        size_t nb,
+        size_t k,
+        int32_t *distances,
+        int64_t *labels)
+{
+    const size_t bs = 256;
+    bool simd = hammings_1_to_n_is_simd (code_size);
+    int nbits = code_size * 8;
+
+    // adds the codes j0:j1 to the selector of query i
+    auto scan = [&] (size_t i, size_t j0, size_t j1,
+                     HammingKSelector & sel) {
+        const uint8_t *q = a + i * code_size;
+        HammingComputer hc (q, code_size);
+        hamdis_t dis[bs];
+        for (size_t jb = j0; jb < j1; jb += bs) {
+            size_t nj = std::min (j1 - jb, bs);
+            const uint8_t *bj = b + jb * code_size;
+            if (simd) {
+                hammings_1_to_n (q, bj, nj, code_size, dis);
+            } else {
+                for (size_t j = 0; j < nj; j++) {
+                    dis[j] = hc.hamming (bj + j * code_size);
+                }
+            }
+            for (size_t j = 0; j < nj; j++) {
+                sel.add (dis[j], jb + j);
+            }
+        }
+    };
+
+    int nt = omp_get_max_threads ();
+
+    if (na >= nt || nb < nt * bs) {
+        // parallelize over the queries
+#pragma omp parallel
+        {
+            HammingKSelector sel (nbits, k);
+#pragma omp for
+            for (int64_t i = 0; i < na; i++) {
+                sel.reset ();
+                scan (i, 0, nb, sel);
+                sel.get_results (distances + i * k, labels + i * k);
+            }
+        }
+        return;
+    }
+
+    // parallelize over the database, one selector per thread and query
+    std::vector<HammingKSelector> sels (nt * na, HammingKSelector (nbits, k));
+
+#pragma omp parallel
+    {
+        int rank = omp_get_thread_num ();
+        int nth = omp_get_num_threads ();
+        size_t j0 = nb * rank / nth, j1 = nb * (rank + 1) / nth;
+        for (size_t i = 0; i < na; i++) {
+            scan (i, j0, j1, sels[rank * na + i]);
+        }
+    }
+
+    // the slices are merged in order, so the ties are resolved as in
+    // the sequential version
+#pragma omp parallel for
+    for (int64_t i = 0; i < na; i++) {
+        HammingKSelector & sel = sels[i];
+        for (int r = 1; r < nt; r++) {
+            sel.merge (sels[r * na + i]);
+        }
+        sel.get_results (distances + i * k, labels + i * k);
+    }
+}
+
+void hammings_knn_hist (
+    const uint8_t * a,
+    const uint8_t * b,
+    size_t na,
+    size_t nb,
+    size_t k,
+    size_t ncodes,
+    int32_t *distances,
+    int64_t *labels)
+{
+#define HC(name) hammings_knn_hist_template<name> \
+        (ncodes, a, b, na, nb, k, distances, labels)
+
+    switch (ncodes) {
+    case 4: HC(HammingComputer4); break;
+    case 8: HC(HammingComputer8); break;
+    case 16: HC(HammingComputer16); break;
+    case 32: HC(HammingComputer32); break;
+    default:
+        if (ncodes % 8 == 0) {
+            HC(HammingComputerM8);
+        } else {
+            HC(HammingComputerDefault);
+        }
+    }
+#undef HC
+}
+
+
 template <class HammingComputer>
-static
+static FAISS_POPCNT_CLONES
 void hamming_range_search_template (
     const uint8_t * a,
     const uint8_t * b,
@@ -671,6 +1129,40 @@ void hamming_range_search_template (
     }
 }
 
+static void hamming_range_search_blocks (
+    const uint8_t * a,
+    const uint8_t * b,
+    size_t na,
+    size_t nb,
+    int radius,
+    size_t code_size,
+    RangeSearchResult *res)
+{
+
+#pragma omp parallel
+    {
+        RangeSearchPartialResult pres (res);
+        hamdis_t dis[256];
+
+#pragma omp for
+        for (int64_t i = 0; i < na; i++) {
+            RangeQueryResult & qres = pres.new_result (i);
+
+            for (size_t j0 = 0; j0 < nb; j0 += 256) {
+                size_t nj = std::min(nb - j0, size_t(256));
+                hammings_1_to_n (a + i * code_size, b + j0 * code_size,
+                                 nj, code_size, dis);
+                for (size_t j = 0; j < nj; j++) {
+                    if (dis[j] < radius) {
+                        qres.add(dis[j], j0 + j);
+                    }
+                }
+            }
+        }
+        pres.finalize ();
+    }
+}
+
 void hamming_range_search (
     const uint8_t * a,
     const uint8_t * b,
@@ -681,6 +1173,11 @@ void hamming_range_search (
     RangeSearchResult *result)
 {
 
+    if (hammings_1_to_n_is_simd (code_size)) {
+        hamming_range_search_blocks (a, b, na, nb, radius, code_size, result);
+        return;
+    }
+
 #define HC(name) hamming_range_search_template<name> (a, b, na, nb, radius, code_size, result)
 
     switch(code_size) {
@@ -27,6 +27,8 @@
 
 #include <stdint.h>
 
+#include <vector>
+
 #ifdef _MSC_VER
 #include <intrin.h>
 #define __builtin_popcountl __popcnt64
@@ -63,6 +65,17 @@ void fvecs2bitvecs (
         size_t d,
         size_t n);
 
+/* Same for the first d components of n vectors of stride ldx, bit j
+   of a code is set iff x[j] >= thresholds[j] (thresholds may be null,
+   then the signs are used) */
+void fvecs2bitvecs_threshold (
+        const float * x,
+        size_t ldx,
+        const float * thresholds,
+        uint8_t * b,
+        size_t d,
+        size_t n);
+
 void bitvecs2fvecs (
         const uint8_t * b,
         float * x,
@@ -136,6 +149,26 @@ void hammings (
         size_t nbytespercode,
         hamdis_t * dis);
 
+/** Hamming distances between one code and a block of codes:
+ * dis[j] = hamming(a, b + j * code_size).
+ *
+ * For code sizes that are multiples of 32 bytes, this uses the AVX2
+ * kernel (pshufb nibble lookup popcount) or the AVX-512 VPOPCNTDQ
+ * kernel, depending on the SIMD level and the CPU.
+ *
+ * @param a          query code, size code_size
+ * @param b          database codes, size n * code_size
+ * @param dis        output distances, size n
+ */
+void hammings_1_to_n (
+        const uint8_t * a,
+        const uint8_t * b,
+        size_t n,
+        size_t code_size,
+        hamdis_t * dis);
+
+/// whether hammings_1_to_n uses a SIMD kernel for this code size
+bool hammings_1_to_n_is_simd (size_t code_size);
 
 
 
@@ -186,6 +219,83 @@ void hammings_knn_mc (
   int32_t *distances,
   int64_t *labels);
 
+/** k-selection for Hamming distances, that are integers in [0, nbits].
+ *
+ * The candidates are stored in a list and counted per distance. The
+ * threshold is lowered as soon as k candidates are below it, so that
+ * most candidates are rejected with a single comparison. The results
+ * are output by increasing distance with a counting sort. Ties are
+ * resolved in the order of addition.
+ */
+struct HammingKSelector {
+    int nbits;
+    size_t k;
+
+    int thres;        ///< candidates with distance > thres are rejected
+    size_t count_lt;  ///< nb of candidates with distance < thres
+
+    /// nb of candidates per distance, size nbits + 1 (only valid up
+    /// to thres)
+    std::vector<size_t> hist;
+
+    /// the candidates, in order of addition
+    std::vector<hamdis_t> dis;
+    std::vector<int64_t> ids;
+
+    HammingKSelector (int nbits, size_t k);
+
+    /// prepare for a new query
+    void reset ();
+
+    void add (hamdis_t d, int64_t id) {
+        if (d > thres || (d == thres && count_lt + hist[d] >= k)) {
+            return;
+        }
+        dis.push_back (d);
+        ids.push_back (id);
+        hist[d]++;
+        if (d < thres) {
+            count_lt++;
+            while (count_lt >= k) {
+                thres--;
+                count_lt -= hist[thres];
+            }
+        }
+        if (dis.size() >= 2 * k + 64) {
+            compact ();
+        }
+    }
+
+    /// remove the candidates that are not in the k best
+    void compact ();
+
+    /// add the candidates of another selector (after the ones of this)
+    void merge (HammingKSelector & other);
+
+    /** output the k results by increasing distance, padded with -1
+     * labels and INT_MAX distances */
+    void get_results (int32_t *distances, int64_t *labels);
+};
+
+/** Same output as hammings_knn_mc, with a HammingKSelector per query.
+ * When there are less queries than threads, the database is split
+ * between the threads and the selectors are merged.
+ *
+ * @param a       queries, size na * ncodes
+ * @param b       database, size nb * ncodes
+ * @param distances output distances, size na * k, in increasing order
+ * @param labels  output ids, size na * k
+ */
+void hammings_knn_hist (
+  const uint8_t * a,
+  const uint8_t * b,
+  size_t na,
+  size_t nb,
+  size_t k,
+  size_t ncodes,
+  int32_t *distances,
+  int64_t *labels);
+
 /** same as hammings_knn except we are doing a range search with radius */
 void hamming_range_search (
     const uint8_t * a,
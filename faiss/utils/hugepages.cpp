@@ -0,0 +1,201 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/utils/hugepages.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace faiss {
+
+int hugepage_mode = HUGEPAGES_NONE;
+
+size_t hugepage_min_bytes = size_t(32) << 20;
+
+namespace {
+
+const size_t huge_page_size = size_t(2) << 20;
+
+struct Mapping {
+    size_t size;  // length of the mapping
+    bool hugetlb;
+};
+
+// the mappings made by hugepage_alloc, by start address
+std::mutex mappings_mutex;
+std::map<uintptr_t, Mapping> mappings;
+
+#ifdef __linux__
+
+void *map_hugetlb (size_t size) {
+#ifdef MAP_HUGETLB
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#ifdef MAP_HUGE_SHIFT
+    flags |= 21 << MAP_HUGE_SHIFT; // 2 MiB pages, whatever the default
+#endif
+    void *p = mmap (nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    return p == MAP_FAILED ? nullptr : p;
+#else
+    return nullptr;
+#endif
+}
+
+// mapping of size bytes aligned on the huge page size, advised for
+// transparent huge pages
+void *map_thp (size_t size) {
+    size_t len = size + huge_page_size;
+    void *p = mmap (nullptr, len, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return nullptr;
+    }
+    uintptr_t begin = (uintptr_t)p;
+    uintptr_t aligned = (begin + huge_page_size - 1) & ~(huge_page_size - 1);
+    // unmap the unaligned head and the remaining tail
+    if (aligned > begin) {
+        munmap (p, aligned - begin);
+    }
+    uintptr_t end = begin + len;
+    if (end > aligned + size) {
+        munmap ((void*)(aligned + size), end - aligned - size);
+    }
+#ifdef MADV_HUGEPAGE
+    // may fail if THP is disabled: then the mapping is still usable
+    madvise ((void*)aligned, size, MADV_HUGEPAGE);
+#endif
+    return (void*)aligned;
+}
+
+#endif // __linux__
+
+} // namespace
+
+
+void *hugepage_alloc (size_t nbytes) {
+#ifdef __linux__
+    if (hugepage_mode != HUGEPAGES_NONE &&
+        nbytes >= std::max (hugepage_min_bytes, huge_page_size)) {
+        size_t size = (nbytes + huge_page_size - 1) & ~(huge_page_size - 1);
+        bool hugetlb = false;
+        void *p = nullptr;
+        if (hugepage_mode == HUGEPAGES_HUGETLB) {
+            p = map_hugetlb (size);
+            hugetlb = p != nullptr;
+        }
+        if (!p) {
+            p = map_thp (size);
+        }
+        if (!p) {
+            throw std::bad_alloc ();
+        }
+        std::lock_guard<std::mutex> lock (mappings_mutex);
+        mappings[(uintptr_t)p] = Mapping {size, hugetlb};
+        return p;
+    }
+#endif
+    return ::operator new (nbytes);
+}
+
+
+void hugepage_free (void *ptr, size_t nbytes) noexcept {
+    if (!ptr) {
+        return;
+    }
+#ifdef __linux__
+    // small blocks cannot be mappings, whatever the settings were at
+    // allocation time
+    if (nbytes >= huge_page_size) {
+        size_t size = 0;
+        {
+            std::lock_guard<std::mutex> lock (mappings_mutex);
+            auto it = mappings.find ((uintptr_t)ptr);
+            if (it != mappings.end ()) {
+                size = it->second.size;
+                mappings.erase (it);
+            }
+        }
+        if (size > 0) {
+            munmap (ptr, size);
+            return;
+        }
+    }
+#endif
+    ::operator delete (ptr);
+}
+
+
+HugePageStats get_hugepage_stats () {
+    HugePageStats stats;
+    memset (&stats, 0, sizeof (stats));
+
+    // transparent huge page ranges, to match with the smaps entries
+    std::vector<std::pair<uintptr_t, uintptr_t> > thp_ranges;
+    {
+        std::lock_guard<std::mutex> lock (mappings_mutex);
+        for (const auto & m: mappings) {
+            stats.n_mappings++;
+            stats.mapped_bytes += m.second.size;
+            if (m.second.hugetlb) {
+                stats.hugetlb_bytes += m.second.size;
+            } else {
+                thp_ranges.emplace_back (m.first, m.first + m.second.size);
+            }
+        }
+    }
+    stats.backed_bytes = stats.hugetlb_bytes;
+
+#ifdef __linux__
+    if (thp_ranges.empty ()) {
+        return stats;
+    }
+    FILE *f = fopen ("/proc/self/smaps", "r");
+    if (!f) {
+        return stats;
+    }
+    // the kernel may merge adjacent mappings, so each smaps entry is
+    // counted for its fraction that overlaps our mappings
+    char line[512];
+    unsigned long vma_begin = 0, vma_end = 0;
+    size_t overlap = 0;
+    while (fgets (line, sizeof (line), f)) {
+        unsigned long b, e, kb;
+        if (sscanf (line, "%lx-%lx ", &b, &e) == 2) {
+            vma_begin = b;
+            vma_end = e;
+            overlap = 0;
+            for (const auto & r: thp_ranges) {
+                uintptr_t lo = std::max<uintptr_t> (r.first, b);
+                uintptr_t hi = std::min<uintptr_t> (r.second, e);
+                if (hi > lo) {
+                    overlap += hi - lo;
+                }
+            }
+        } else if (overlap > 0 &&
+                   sscanf (line, "AnonHugePages: %lu kB", &kb) == 1) {
+            stats.backed_bytes += size_t (
+                  double (kb) * 1024 * overlap / (vma_end - vma_begin));
+        }
+    }
+    fclose (f);
+#endif
+    return stats;
+}
+
+
+} // namespace faiss
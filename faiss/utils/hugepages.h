@@ -0,0 +1,104 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <stddef.h>
+
+#include <new>
+
+#include <faiss/impl/platform_macros.h>
+
+/* Huge page backing for the large index arrays.
+ *
+ * The arrays of vectors, codes and graph links that are scanned at
+ * search time are allocated with HugePageAllocator (via
+ * MaybeOwnedVector), when they are built as well as when they are read
+ * with read_index. With 4 KiB pages, random accesses to a multi-GB array
+ * miss the TLB most of the time; 2 MiB pages cover 512x more memory per
+ * TLB entry.
+ *
+ * Allocations of at least hugepage_min_bytes are mmapped on a 2 MiB
+ * boundary and either advised with MADV_HUGEPAGE (transparent huge
+ * pages, that the kernel may or may not provide) or mapped from the
+ * hugetlbfs pool (MAP_HUGETLB, that must be reserved by the
+ * administrator in /proc/sys/vm/nr_hugepages). If the pool is
+ * exhausted, the allocation falls back to transparent huge pages.
+ *
+ * This is Linux-only, on other platforms the allocator is std::allocator.
+ */
+
+namespace faiss {
+
+enum HugePageMode {
+    HUGEPAGES_NONE = 0,    ///< use the default allocator
+    HUGEPAGES_MADVISE = 1, ///< transparent huge pages (madvise)
+    HUGEPAGES_HUGETLB = 2, ///< explicit huge pages (MAP_HUGETLB)
+};
+
+/// mode for the following allocations (default HUGEPAGES_NONE)
+FAISS_API extern int hugepage_mode;
+
+/// smaller allocations use the default allocator (default 32 MiB, at
+/// least the huge page size)
+FAISS_API extern size_t hugepage_min_bytes;
+
+/// allocate nbytes with the current hugepage_mode, throws std::bad_alloc
+void *hugepage_alloc (size_t nbytes);
+
+/// free a pointer returned by hugepage_alloc for the same nbytes
+void hugepage_free (void *ptr, size_t nbytes) noexcept;
+
+struct HugePageStats {
+    /// nb of live mappings made by hugepage_alloc
+    size_t n_mappings;
+    /// bytes in these mappings
+    size_t mapped_bytes;
+    /// bytes in the mappings from the hugetlbfs pool
+    size_t hugetlb_bytes;
+    /** bytes that are actually backed by huge pages: the hugetlbfs
+     * mappings and the transparent huge pages of the other mappings
+     * (AnonHugePages in /proc/self/smaps). Pages that were never touched
+     * are not backed at all. */
+    size_t backed_bytes;
+};
+
+/// statistics on the live huge page allocations (reads /proc/self/smaps)
+HugePageStats get_hugepage_stats ();
+
+/// std::allocator replacement that calls hugepage_alloc
+template <class T>
+struct HugePageAllocator {
+    typedef T value_type;
+
+    HugePageAllocator () noexcept {}
+
+    template <class U>
+    HugePageAllocator (const HugePageAllocator<U> &) noexcept {}
+
+    T *allocate (size_t n) {
+        return static_cast<T*> (hugepage_alloc (n * sizeof (T)));
+    }
+
+    void deallocate (T *p, size_t n) noexcept {
+        hugepage_free (p, n * sizeof (T));
+    }
+
+    template <class U>
+    bool operator == (const HugePageAllocator<U> &) const noexcept {
+        return true;
+    }
+
+    template <class U>
+    bool operator != (const HugePageAllocator<U> &) const noexcept {
+        return false;
+    }
+};
+
+} // namespace faiss
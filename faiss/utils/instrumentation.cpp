@@ -0,0 +1,243 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/utils/instrumentation.h>
+
+#include <cmath>
+#include <cstring>
+
+#include <algorithm>
+#include <mutex>
+#include <set>
+
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/utils.h>
+
+namespace faiss {
+
+bool instrumentation_enabled = false;
+
+/*****************************************
+ * InstrumentationStats
+ ******************************************/
+
+void InstrumentationStats::reset ()
+{
+    memset ((void*)this, 0, sizeof (*this));
+}
+
+void InstrumentationStats::add (const InstrumentationStats & other)
+{
+    for (int s = 0; s < STAGE_N; s++) {
+        stage_ms[s] += other.stage_ms[s];
+        stage_calls[s] += other.stage_calls[s];
+        for (int b = 0; b < nbucket; b++) {
+            stage_hist[s][b] += other.stage_hist[s][b];
+        }
+    }
+    for (int c = 0; c < COUNTER_N; c++) {
+        counters[c] += other.counters[c];
+    }
+    for (int p = 0; p < PEAK_N; p++) {
+        peaks[p] = std::max (peaks[p], other.peaks[p]);
+    }
+}
+
+double InstrumentationStats::latency_quantile (int stage, double q) const
+{
+    FAISS_THROW_IF_NOT (stage >= 0 && stage < STAGE_N);
+    uint64_t n = stage_calls[stage];
+    if (n == 0) {
+        return 0;
+    }
+    uint64_t target = uint64_t (std::ceil (q * n));
+    uint64_t cum = 0;
+    int b = 0;
+    for (; b < nbucket - 1; b++) {
+        cum += stage_hist[stage][b];
+        if (cum >= target) break;
+    }
+    return ldexp (1.0, b) * 1e-3;
+}
+
+const char * InstrumentationStats::stage_name (int stage)
+{
+    static const char * names[STAGE_N] = {
+        "coarse_quantize", "lut", "list_scan", "merge", "refine", "io",
+        "select", "copy", "encode"
+    };
+    FAISS_THROW_IF_NOT (stage >= 0 && stage < STAGE_N);
+    return names[stage];
+}
+
+const char * InstrumentationStats::counter_name (int counter)
+{
+    static const char * names[COUNTER_N] = {
+        "nq", "ndis", "nlist", "bytes_scanned", "gpu_pages"
+    };
+    FAISS_THROW_IF_NOT (counter >= 0 && counter < COUNTER_N);
+    return names[counter];
+}
+
+const char * InstrumentationStats::peak_name (int peak)
+{
+    static const char * names[PEAK_N] = {
+        "gpu_temp_mem"
+    };
+    FAISS_THROW_IF_NOT (peak >= 0 && peak < PEAK_N);
+    return names[peak];
+}
+
+/*****************************************
+ * per-thread collection
+ ******************************************/
+
+namespace {
+
+struct ThreadStats;
+
+/// the statistics of all live threads, and of the exited ones
+struct Registry {
+    std::mutex mutex;
+    std::set<ThreadStats*> threads;
+    InstrumentationStats exited;
+    InstrumentationHook hook = nullptr;
+    void *hook_arg = nullptr;
+};
+
+Registry & registry ()
+{
+    // never destroyed, threads may exit after the static destructors
+    static Registry *r = new Registry ();
+    return *r;
+}
+
+struct ThreadStats {
+    // only contended when the statistics are read
+    std::mutex mutex;
+    InstrumentationStats stats;
+
+    ThreadStats () {
+        Registry & r = registry ();
+        std::lock_guard<std::mutex> lock (r.mutex);
+        r.threads.insert (this);
+    }
+
+    ~ThreadStats () {
+        Registry & r = registry ();
+        std::lock_guard<std::mutex> lock (r.mutex);
+        r.exited.add (stats);
+        r.threads.erase (this);
+    }
+};
+
+ThreadStats & thread_stats ()
+{
+    static thread_local ThreadStats ts;
+    return ts;
+}
+
+} // anonymous namespace
+
+void instrumentation_record (int stage, double ms)
+{
+    ThreadStats & ts = thread_stats ();
+    double us = ms * 1e3;
+    int b = 0;
+    if (us >= 1) {
+        b = std::min (int (std::floor (std::log2 (us))) + 1,
+                      InstrumentationStats::nbucket - 1);
+    }
+    std::lock_guard<std::mutex> lock (ts.mutex);
+    ts.stats.stage_ms[stage] += ms;
+    ts.stats.stage_calls[stage]++;
+    ts.stats.stage_hist[stage][b]++;
+}
+
+void instrumentation_count (int counter, uint64_t n)
+{
+    ThreadStats & ts = thread_stats ();
+    std::lock_guard<std::mutex> lock (ts.mutex);
+    ts.stats.counters[counter] += n;
+}
+
+void instrumentation_peak (int peak, uint64_t value)
+{
+    ThreadStats & ts = thread_stats ();
+    std::lock_guard<std::mutex> lock (ts.mutex);
+    ts.stats.peaks[peak] = std::max (ts.stats.peaks[peak], value);
+}
+
+void instrumentation_get (InstrumentationStats *stats)
+{
+    Registry & r = registry ();
+    std::lock_guard<std::mutex> lock (r.mutex);
+    *stats = r.exited;
+    for (ThreadStats *ts : r.threads) {
+        std::lock_guard<std::mutex> lock2 (ts->mutex);
+        stats->add (ts->stats);
+    }
+}
+
+void instrumentation_reset ()
+{
+    Registry & r = registry ();
+    std::lock_guard<std::mutex> lock (r.mutex);
+    r.exited.reset ();
+    for (ThreadStats *ts : r.threads) {
+        std::lock_guard<std::mutex> lock2 (ts->mutex);
+        ts->stats.reset ();
+    }
+}
+
+void instrumentation_set_hook (InstrumentationHook hook, void *arg)
+{
+    Registry & r = registry ();
+    std::lock_guard<std::mutex> lock (r.mutex);
+    r.hook = hook;
+    r.hook_arg = arg;
+}
+
+void instrumentation_export ()
+{
+    InstrumentationStats stats;
+    instrumentation_get (&stats);
+    instrumentation_reset ();
+
+    InstrumentationHook hook;
+    void *arg;
+    {
+        Registry & r = registry ();
+        std::lock_guard<std::mutex> lock (r.mutex);
+        hook = r.hook;
+        arg = r.hook_arg;
+    }
+    if (hook) {
+        hook (stats, arg);
+    }
+}
+
+/*****************************************
+ * InstrumentationTimer
+ ******************************************/
+
+InstrumentationTimer::InstrumentationTimer (int stage):
+    stage (stage),
+    t0 (instrumentation_enabled ? getmillisecs () : -1)
+{}
+
+void InstrumentationTimer::stop ()
+{
+    if (t0 >= 0) {
+        instrumentation_record (stage, getmillisecs () - t0);
+        t0 = -1;
+    }
+}
+
+} // namespace faiss
@@ -0,0 +1,129 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <faiss/impl/platform_macros.h>
+
+/* Unified instrumentation of the search.
+ *
+ * The search code records the time spent in a few stages, some counters
+ * and a log2 histogram of the duration of each stage call. Collection is
+ * disabled by default (then the cost is a test on a global flag), and
+ * enabled with instrumentation_enabled = true.
+ *
+ * The statistics are accumulated per thread and aggregated on demand
+ * by instrumentation_get, so collection from OpenMP threads does not
+ * contend. The stages may nest: STAGE_LUT is included in
+ * STAGE_LIST_SCAN for IVFPQ. Timings within a parallel region are
+ * summed over threads.
+ *
+ * The GPU indexes report to the same statistics (see GpuStageTimer in
+ * gpu/utils/Timer.h), with the GPU time of their stages.
+ *
+ * This does not replace the index-specific statistics (indexIVF_stats,
+ * hnsw_stats, ...), that are kept for compatibility.
+ */
+
+namespace faiss {
+
+enum InstrumentedStage {
+    STAGE_COARSE_QUANTIZE = 0, ///< IVF coarse quantizer search
+    STAGE_LUT,                 ///< look-up table computation (PQ)
+    STAGE_LIST_SCAN,           ///< scan of the inverted lists
+    STAGE_MERGE,               ///< merge of the results of shards
+    STAGE_REFINE,              ///< re-ranking of IndexRefine
+    STAGE_IO,                  ///< prefetch of the inverted lists
+    STAGE_SELECT,              ///< k-selection of the scan results (GPU)
+    STAGE_COPY,                ///< host <-> device copies (GPU)
+    STAGE_ENCODE,              ///< encoding and append of added vectors (GPU)
+    STAGE_N
+};
+
+enum InstrumentedCounter {
+    COUNTER_NQ = 0,            ///< nb of queries searched
+    COUNTER_NDIS,              ///< nb of distances computed
+    COUNTER_NLIST,             ///< nb of inverted lists scanned
+    COUNTER_BYTES_SCANNED,     ///< nb of code bytes scanned
+    COUNTER_GPU_PAGES,         ///< nb of query pages copied to the GPU
+    COUNTER_N
+};
+
+/// high watermarks, aggregated with max instead of a sum
+enum InstrumentedPeak {
+    PEAK_GPU_TEMP_MEM = 0,     ///< GPU temporary memory used (bytes)
+    PEAK_N
+};
+
+struct InstrumentationStats {
+    /// bucket b of the histograms counts the durations in
+    /// [2^(b-1), 2^b) microseconds (bucket 0: < 1 us)
+    static const int nbucket = 32;
+
+    double stage_ms[STAGE_N];      ///< total time per stage
+    uint64_t stage_calls[STAGE_N]; ///< nb of timed calls per stage
+    uint64_t stage_hist[STAGE_N][nbucket];
+    uint64_t counters[COUNTER_N];
+    uint64_t peaks[PEAK_N];
+
+    InstrumentationStats () {reset (); }
+    void reset ();
+
+    void add (const InstrumentationStats & other);
+
+    /// approximate quantile q of the call durations of a stage (in ms),
+    /// the upper bound of the histogram bucket that contains it
+    double latency_quantile (int stage, double q) const;
+
+    static const char * stage_name (int stage);
+    static const char * counter_name (int counter);
+    static const char * peak_name (int peak);
+};
+
+/// collect the statistics (default false)
+FAISS_API extern bool instrumentation_enabled;
+
+/// record a stage call in the statistics of the calling thread
+void instrumentation_record (int stage, double ms);
+
+/// increment a counter of the calling thread
+void instrumentation_count (int counter, uint64_t n);
+
+/// raise a high watermark of the calling thread to at least value
+void instrumentation_peak (int peak, uint64_t value);
+
+/// aggregate the statistics of all threads
+void instrumentation_get (InstrumentationStats *stats);
+
+/// reset the statistics of all threads
+void instrumentation_reset ();
+
+typedef void (*InstrumentationHook) (const InstrumentationStats & stats,
+                                     void *arg);
+
+/// set the function called by instrumentation_export (nullptr = none)
+void instrumentation_set_hook (InstrumentationHook hook, void *arg);
+
+/// aggregate the statistics, pass them to the hook and reset them
+void instrumentation_export ();
+
+/// times a stage from construction to stop() or destruction
+struct InstrumentationTimer {
+    int stage;
+    double t0;     ///< < 0 if not timing
+
+    explicit InstrumentationTimer (int stage);
+    void stop ();
+    ~InstrumentationTimer () {stop (); }
+};
+
+} // namespace faiss
@@ -0,0 +1,210 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/utils/parallel.h>
+
+#include <omp.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <typeinfo>
+
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/WorkerThread.h>
+
+namespace faiss {
+
+/*****************************************************
+ * Executors
+ *****************************************************/
+
+void OpenMPExecutor::run (size_t ntask,
+                          const std::function<void (size_t)> & task)
+{
+#pragma omp parallel for schedule(dynamic) if(ntask > 1)
+    for (int64_t i = 0; i < (int64_t)ntask; i++) {
+        task (i);
+    }
+}
+
+int OpenMPExecutor::num_threads () const
+{
+    return omp_get_max_threads ();
+}
+
+void SerialExecutor::run (size_t ntask,
+                          const std::function<void (size_t)> & task)
+{
+    for (size_t i = 0; i < ntask; i++) {
+        task (i);
+    }
+}
+
+ThreadPoolExecutor::ThreadPoolExecutor (int nthread)
+{
+    FAISS_THROW_IF_NOT (nthread >= 1);
+    for (int i = 0; i < nthread - 1; i++) {
+        workers.emplace_back (new WorkerThread ());
+        // the OpenMP loops of the tasks run in the worker thread
+        workers.back()->add ([] () { omp_set_num_threads (1); });
+    }
+}
+
+namespace {
+
+/// shared with the workers, that may start after run returns
+struct PoolRun {
+    std::function<void (size_t)> task;
+    size_t ntask;
+    std::atomic<size_t> next;
+    std::atomic<size_t> ndone;
+    std::mutex mutex;
+    std::condition_variable done;
+
+    PoolRun (size_t ntask, const std::function<void (size_t)> & task):
+        task (task), ntask (ntask), next (0), ndone (0)
+    {}
+
+    void work ()
+    {
+        size_t nd = 0;
+        size_t i;
+        while ((i = next++) < ntask) {
+            task (i);
+            nd++;
+        }
+        if (nd > 0 && (ndone += nd) == ntask) {
+            std::lock_guard<std::mutex> lock (mutex);
+            done.notify_all ();
+        }
+    }
+};
+
+} // anonymous namespace
+
+void ThreadPoolExecutor::run (size_t ntask,
+                              const std::function<void (size_t)> & task)
+{
+    if (ntask == 0) {
+        return;
+    }
+    std::shared_ptr<PoolRun> pr (new PoolRun (ntask, task));
+    size_t nhelp = std::min (workers.size(), ntask - 1);
+    for (size_t i = 0; i < nhelp; i++) {
+        workers[i]->add ([pr] () { pr->work (); });
+    }
+    pr->work ();
+    std::unique_lock<std::mutex> lock (pr->mutex);
+    pr->done.wait (lock, [&pr] () { return pr->ndone == pr->ntask; });
+}
+
+int ThreadPoolExecutor::num_threads () const
+{
+    return workers.size() + 1;
+}
+
+ThreadPoolExecutor::~ThreadPoolExecutor ()
+{}
+
+
+/*****************************************************
+ * Parallel loops
+ *****************************************************/
+
+namespace {
+
+OpenMPExecutor default_executor;
+
+ParallelExecutor *current_executor = &default_executor;
+
+/// set while the thread runs a task of parallel_for
+thread_local bool in_parallel_task = false;
+
+/// context of a task: nested loops are serial
+struct ParallelTaskScope {
+    int omp_threads;
+
+    ParallelTaskScope (): omp_threads (omp_get_max_threads ())
+    {
+        in_parallel_task = true;
+        omp_set_num_threads (1);
+    }
+
+    ~ParallelTaskScope ()
+    {
+        omp_set_num_threads (omp_threads);
+        in_parallel_task = false;
+    }
+};
+
+} // anonymous namespace
+
+void set_parallel_executor (ParallelExecutor *executor)
+{
+    current_executor = executor ? executor : &default_executor;
+}
+
+ParallelExecutor *get_parallel_executor ()
+{
+    return current_executor;
+}
+
+bool use_parallel_executor (size_t n)
+{
+    return current_executor != &default_executor && n > 1 &&
+        !in_parallel_task;
+}
+
+void parallel_for (size_t n,
+                   const std::function<void (size_t i0, size_t i1)> & f,
+                   size_t min_slice)
+{
+    if (n == 0) {
+        return;
+    }
+    if (in_parallel_task) {
+        f (0, n);
+        return;
+    }
+    ParallelExecutor *executor = current_executor;
+    size_t nt = std::max (executor->num_threads (), 1);
+    size_t slice = std::max (std::max (min_slice, size_t(1)),
+                             (n + 4 * nt - 1) / (4 * nt));
+    size_t ntask = (n + slice - 1) / slice;
+
+    std::atomic<bool> interrupt (false);
+    std::mutex exception_mutex;
+    std::string exception_string;
+
+    executor->run (ntask, [&] (size_t t) {
+        if (interrupt) {
+            return;
+        }
+        ParallelTaskScope scope;
+        try {
+            f (t * slice, std::min (n, (t + 1) * slice));
+        } catch (const std::exception & e) {
+            std::lock_guard<std::mutex> lock (exception_mutex);
+            exception_string =
+                demangle_cpp_symbol (typeid(e).name()) + "  " + e.what();
+            interrupt = true;
+        }
+    });
+
+    if (interrupt) {
+        FAISS_THROW_FMT ("parallel loop failed with: %s",
+                         exception_string.c_str());
+    }
+}
+
+} // namespace faiss
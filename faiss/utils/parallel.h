@@ -0,0 +1,106 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace faiss {
+
+class WorkerThread;
+
+/** Runs the tasks of the parallel loops of faiss.
+ *
+ * By default, the loops are parallelized with OpenMP. An application that
+ * has its own scheduler (a thread pool, TBB) can install an executor that
+ * forwards the tasks to it, see set_parallel_executor. A TBB backend is
+ * eg. a subclass whose run calls
+ *
+ *   tbb::parallel_for (size_t(0), ntask, task);
+ */
+struct ParallelExecutor {
+    /** run task(0), ..., task(ntask - 1) and return when they are all
+     * done. The tasks may run concurrently on any threads, including
+     * the calling one. They do not throw. */
+    virtual void run (size_t ntask,
+                      const std::function<void (size_t)> & task) = 0;
+
+    /// nb of tasks that run concurrently, used to split the loops
+    virtual int num_threads () const = 0;
+
+    virtual ~ParallelExecutor () {}
+};
+
+/// the default: omp parallel for with a dynamic schedule
+struct OpenMPExecutor: ParallelExecutor {
+    void run (size_t ntask,
+              const std::function<void (size_t)> & task) override;
+    int num_threads () const override;
+};
+
+/// runs all tasks in the calling thread, for applications that
+/// parallelize over the requests
+struct SerialExecutor: ParallelExecutor {
+    void run (size_t ntask,
+              const std::function<void (size_t)> & task) override;
+    int num_threads () const override { return 1; }
+};
+
+/** Fixed pool of threads that wait on a condition variable when idle
+ * (no spinning, unlike the OpenMP threads). The calling thread runs
+ * tasks as well, so nthread - 1 threads are started. Several threads can
+ * call run concurrently.
+ */
+struct ThreadPoolExecutor: ParallelExecutor {
+    explicit ThreadPoolExecutor (int nthread);
+
+    void run (size_t ntask,
+              const std::function<void (size_t)> & task) override;
+    int num_threads () const override;
+
+    ~ThreadPoolExecutor () override;
+
+  private:
+    std::vector<std::unique_ptr<WorkerThread> > workers;
+};
+
+/** install the executor of the parallel loops (not owned, must outlive
+ * its use). nullptr restores the OpenMP default. Not thread-safe with
+ * respect to concurrent parallel loops.
+ */
+void set_parallel_executor (ParallelExecutor *executor);
+
+/// the current executor (never nullptr)
+ParallelExecutor *get_parallel_executor ();
+
+/** whether a loop of n items should be split over the executor: a
+ * non-default executor is installed, n > 1 and the caller is not
+ * already running a task of parallel_for. Used by the search functions
+ * that parallelize over the queries through the executor instead of
+ * their OpenMP loops.
+ */
+bool use_parallel_executor (size_t n);
+
+/** run f(i0, i1) on slices [i0, i1) that cover [0, n), with the current
+ * executor. The slices have at least min_slice items (except the last
+ * one), there are about 4 per thread to balance the load.
+ *
+ * In a task, the OpenMP loops run with a single thread and nested
+ * parallel_for calls run serially, so that the executor controls all
+ * the parallelism. If f throws, the exception is reported as a
+ * FaissException after all the tasks are done.
+ */
+void parallel_for (size_t n,
+                   const std::function<void (size_t i0, size_t i1)> & f,
+                   size_t min_slice = 1);
+
+} // namespace faiss
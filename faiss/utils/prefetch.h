@@ -0,0 +1,59 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#ifdef _MSC_VER
+#include <xmmintrin.h>
+#endif
+
+namespace faiss {
+
+/// software prefetch of the cache line that contains address (to L1)
+inline void prefetch_L1 (const void *address)
+{
+#ifdef _MSC_VER
+    _mm_prefetch ((const char*)address, _MM_HINT_T0);
+#else
+    __builtin_prefetch (address, 0, 3);
+#endif
+}
+
+/// prefetch all the cache lines of an array of nbytes bytes
+inline void prefetch_L1 (const void *address, size_t nbytes)
+{
+    const uint8_t *p = (const uint8_t*)address;
+    for (size_t i = 0; i < nbytes; i += 64) {
+        prefetch_L1 (p + i);
+    }
+}
+
+/// software prefetch of the cache line that contains address (to L2),
+/// for data that is used a bit later, eg. while other data is scanned
+inline void prefetch_L2 (const void *address)
+{
+#ifdef _MSC_VER
+    _mm_prefetch ((const char*)address, _MM_HINT_T1);
+#else
+    __builtin_prefetch (address, 0, 2);
+#endif
+}
+
+inline void prefetch_L2 (const void *address, size_t nbytes)
+{
+    const uint8_t *p = (const uint8_t*)address;
+    for (size_t i = 0; i < nbytes; i += 64) {
+        prefetch_L2 (p + i);
+    }
+}
+
+} // namespace faiss
@@ -0,0 +1,69 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <faiss/utils/quantize_lut.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include <faiss/impl/FaissAssert.h>
+
+namespace faiss {
+
+namespace quantize_lut {
+
+
+void quantize_LUT_and_bias(
+        size_t ntab, size_t M, size_t ksub,
+        const float *LUT, const float *bias,
+        size_t M2, uint8_t *LUTq,
+        float *a_out, float *b_out)
+{
+    FAISS_THROW_IF_NOT (M2 >= M);
+    std::vector<float> mins (ntab * M);
+
+    // the common scale is set by the largest span of any sub-table
+    float max_span = 0;
+    for (size_t t = 0; t < ntab; t++) {
+        for (size_t m = 0; m < M; m++) {
+            const float *tab = LUT + (t * M + m) * ksub;
+            float vmin = HUGE_VALF, vmax = -HUGE_VALF;
+            for (size_t j = 0; j < ksub; j++) {
+                vmin = std::min (vmin, tab[j]);
+                vmax = std::max (vmax, tab[j]);
+            }
+            mins[t * M + m] = vmin;
+            max_span = std::max (max_span, vmax - vmin);
+        }
+    }
+
+    float a = max_span > 0 ? 255 / max_span : 1;
+
+    for (size_t t = 0; t < ntab; t++) {
+        float b = bias ? bias[t] : 0;
+        for (size_t m = 0; m < M; m++) {
+            const float *tab = LUT + (t * M + m) * ksub;
+            uint8_t *tabq = LUTq + (t * M2 + m) * ksub;
+            float vmin = mins[t * M + m];
+            for (size_t j = 0; j < ksub; j++) {
+                float v = std::floor ((tab[j] - vmin) * a + 0.5f);
+                tabq[j] = (uint8_t) std::min (v, 255.0f);
+            }
+            b += vmin;
+        }
+        memset (LUTq + (t * M2 + M) * ksub, 0, (M2 - M) * ksub);
+        b_out[t] = b;
+    }
+    *a_out = a;
+}
+
+
+} // namespace quantize_lut
+
+} // namespace faiss
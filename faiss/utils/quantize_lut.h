@@ -0,0 +1,54 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+
+
+namespace faiss {
+
+/** Functions to quantize PQ floating-point Look Up Tables (LUT) to uint8, and
+ * biases to  uint16. The accumulation is supposed to take place in uint16.
+ * The quantization coefficients are float (a, b) such that
+ *
+ *      original_value = quantized_value / a + b
+ *
+ * The hardest part of the quantization is with multiple LUTs that need to be
+ * added up together. In that case, coefficient a has to be chosen so that
+ * the sum fits in a uint16 accumulator.
+ */
+
+namespace quantize_lut {
+
+/** Quantize a set of ntab LUTs, each of size M * ksub, with a common
+ * multiplicative coefficient so that the distances computed from different
+ * tables can be compared. The additive coefficient is per table.
+ *
+ *    dis(t, code) ~= b[t] + sum_m LUTq[t, m, code[m]] / a
+ *
+ * @param ntab   number of tables
+ * @param M      number of sub-quantizers per table
+ * @param ksub   number of entries per sub-quantizer
+ * @param LUT    input tables, size ntab * M * ksub
+ * @param bias   optional per-table bias added to the distances, size ntab
+ * @param M2     number of sub-quantizers in the output (>= M), the extra ones
+ *               are filled with 0s
+ * @param LUTq   output tables, size ntab * M2 * ksub
+ * @param a_out  output multiplicative coefficient
+ * @param b_out  output additive coefficients, size ntab
+ */
+void quantize_LUT_and_bias(
+        size_t ntab, size_t M, size_t ksub,
+        const float *LUT, const float *bias,
+        size_t M2, uint8_t *LUTq,
+        float *a_out, float *b_out);
+
+} // namespace quantize_lut
+
+} // namespace faiss
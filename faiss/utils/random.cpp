@@ -9,6 +9,11 @@
 
 #include <faiss/utils/random.h>
 
+#include <algorithm>
+#include <vector>
+
+#include <faiss/impl/FaissAssert.h>
+
 namespace faiss {
 
 /**************************************************
@@ -164,6 +169,42 @@ void rand_perm (int *perm, size_t n, int64_t seed)
     }
 }
 
+void rand_subset (int64_t *subset, size_t n, size_t k, int64_t seed)
+{
+    FAISS_THROW_IF_NOT_FMT (k <= n, "cannot sample %zd elements out of %zd",
+                            k, n);
+    if (k * 2 > n) {
+        // dense subset: selection sampling, O(n) time
+        RandomGenerator rng (seed);
+        size_t j = 0;
+        for (size_t i = 0; i < n && j < k; i++) {
+            if (uint64_t(rng.rand_int64 ()) % (n - i) < k - j) {
+                subset[j++] = i;
+            }
+        }
+        return;
+    }
+
+    // sparse subset: draw with replacement and draw again the missing
+    // elements until there are k distinct ones. The result is invariant by
+    // permutation of 0..n-1, so it is a uniform subset. Since k <= n / 2,
+    // each round at least halves the nb of missing elements on average.
+    std::vector<int64_t> sel, draws, merged;
+    for (int64_t round = 0; sel.size() < k; round++) {
+        draws.resize (k - sel.size());
+        int64_rand_max (draws.data(), draws.size(), n,
+                        seed + round * 15486557L);
+        std::sort (draws.begin(), draws.end());
+        merged.resize (sel.size() + draws.size());
+        std::merge (sel.begin(), sel.end(), draws.begin(), draws.end(),
+                    merged.begin());
+        merged.erase (std::unique (merged.begin(), merged.end()),
+                      merged.end());
+        std::swap (sel, merged);
+    }
+    std::copy (sel.begin(), sel.end(), subset);
+}
+
 
 
 
@@ -56,5 +56,16 @@ void int64_rand_max (int64_t * x, size_t n, uint64_t max, int64_t seed);
 /* random permutation */
 void rand_perm (int * perm, size_t n, int64_t seed);
 
+/** random subset of k distinct elements of 0..n-1, in increasing order.
+ *
+ * Unlike taking the k first elements of rand_perm(n), this uses O(k)
+ * memory and is multi-threaded, so it is suited to sample a training set
+ * from billions of vectors. The sorted order makes the reads of the
+ * sampled vectors sequential (eg. in a memory-mapped file).
+ *
+ * @param subset  output, size k
+ */
+void rand_subset (int64_t * subset, size_t n, size_t k, int64_t seed);
+
 
 } // namespace faiss
@@ -0,0 +1,68 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/utils/scratch.h>
+
+#include <memory>
+#include <vector>
+
+namespace faiss {
+
+size_t scratch_max_kept_bytes = 16 * 1024 * 1024;
+
+struct ScratchBuffer::Buffer {
+    std::unique_ptr<uint64_t[]> data;
+    size_t capacity = 0;  ///< in uint64_t
+};
+
+namespace {
+
+/* the buffers that are not in use. A ScratchBuffer may be destroyed in
+ * another thread than the one that created it, so the buffers are not
+ * tied to a thread, they are just returned to the current pool. */
+thread_local std::vector<std::unique_ptr<ScratchBuffer::Buffer> > free_pool;
+
+} // namespace
+
+ScratchBuffer::ScratchBuffer ()
+{
+    if (free_pool.empty ()) {
+        buf = new Buffer ();
+    } else {
+        buf = free_pool.back ().release ();
+        free_pool.pop_back ();
+    }
+}
+
+void *ScratchBuffer::get_bytes (size_t nbytes)
+{
+    size_t n = (nbytes + 7) / 8;
+    if (buf->capacity < n) {
+        // no need to copy the old contents
+        buf->data.reset ();
+        buf->data.reset (new uint64_t [n]);
+        buf->capacity = n;
+    }
+    return buf->data.get ();
+}
+
+ScratchBuffer::~ScratchBuffer ()
+{
+    if (buf->capacity * 8 > scratch_max_kept_bytes) {
+        delete buf;
+        return;
+    }
+    try {
+        free_pool.emplace_back (buf);
+    } catch (...) {
+        delete buf;
+    }
+}
+
+} // namespace faiss
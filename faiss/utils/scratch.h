@@ -0,0 +1,55 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <faiss/impl/platform_macros.h>
+
+namespace faiss {
+
+/// buffers larger than this (in bytes) are freed after use instead of
+/// being kept in the per-thread pools (default 16 MiB)
+FAISS_API extern size_t scratch_max_kept_bytes;
+
+/** Temporary memory for the search functions.
+ *
+ * Each thread keeps a pool of buffers. A ScratchBuffer takes one from
+ * the pool of the current thread and gives it back when it is destroyed,
+ * so that a sequence of searches allocates its temporaries once per
+ * thread rather than once per call. Several ScratchBuffers can be alive
+ * at the same time (eg. nested calls), they get distinct buffers.
+ *
+ * The memory is not initialized.
+ */
+struct ScratchBuffer {
+    ScratchBuffer ();
+    ~ScratchBuffer ();
+
+    ScratchBuffer (const ScratchBuffer &) = delete;
+    ScratchBuffer & operator = (const ScratchBuffer &) = delete;
+
+    /// array of n elements, valid until the next call to get or the
+    /// destruction. The previous contents are not preserved.
+    template<class T>
+    T *get (size_t n) {
+        return static_cast<T*> (get_bytes (n * sizeof (T)));
+    }
+
+    void *get_bytes (size_t nbytes);
+
+    struct Buffer;
+
+  private:
+    Buffer *buf;
+};
+
+} // namespace faiss
@@ -0,0 +1,76 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+/* Include this instead of <immintrin.h> in the files that use the
+ * AVX-512 kernels of cpu_dispatch.h (before any other include that may
+ * pull in <immintrin.h>).
+ *
+ * The AVX-512 intrinsics of GCC 12 start from undefined registers
+ * (__Y = __Y in avx512fintrin.h), which gives -Wuninitialized and
+ * -Wmaybe-uninitialized false positives wherever they are inlined. The
+ * warnings are disabled for the intrinsics headers only. */
+
+#include <stdint.h>
+
+#include <faiss/utils/cpu_dispatch.h>
+
+#if defined(__SSE__) || defined(FAISS_X86_DISPATCH)
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+#include <immintrin.h>
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif
+
+#ifdef FAISS_X86_DISPATCH
+
+namespace faiss {
+
+/* Horizontal sums, used instead of _mm512_reduce_add_ps /
+ * _mm512_reduce_add_epi32. The float sum adds the halves, then the
+ * quarters, then (v0 + v2) + (v1 + v3): the same order as the GCC
+ * intrinsic, for all compilers. */
+
+FAISS_AVX512_TARGET
+inline float horizontal_sum_avx512 (__m512 v)
+{
+    __m256 s8 = _mm256_add_ps (_mm512_extractf32x8_ps (v, 0),
+                               _mm512_extractf32x8_ps (v, 1));
+    __m128 s = _mm_add_ps (_mm256_castps256_ps128 (s8),
+                           _mm256_extractf128_ps (s8, 1));
+    s = _mm_add_ps (s, _mm_movehl_ps (s, s));
+    s = _mm_add_ss (s, _mm_shuffle_ps (s, s, 1));
+    return _mm_cvtss_f32 (s);
+}
+
+FAISS_AVX512_TARGET
+inline int32_t horizontal_sum_epi32_avx512 (__m512i v)
+{
+    __m256i s8 = _mm256_add_epi32 (_mm512_extracti64x4_epi64 (v, 0),
+                                   _mm512_extracti64x4_epi64 (v, 1));
+    __m128i s = _mm_add_epi32 (_mm256_castsi256_si128 (s8),
+                               _mm256_extracti128_si256 (s8, 1));
+    s = _mm_hadd_epi32 (s, s);
+    s = _mm_hadd_epi32 (s, s);
+    return _mm_cvtsi128_si32 (s);
+}
+
+} // namespace faiss
+
+#endif
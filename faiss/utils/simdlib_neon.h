@@ -0,0 +1,495 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstdio>
+
+#include <arm_neon.h>
+
+namespace faiss {
+
+/** NEON implementation of the 256-bit SIMD registers of simdlib_avx2.h
+ *
+ * A 256-bit register is represented as a pair of 128-bit NEON registers,
+ * that map to the two 128-bit lanes of the AVX2 version. The operations that
+ * work per 128-bit lane in AVX2 (lookup_2_lanes, hadd, unpacklo...) thus
+ * operate on each NEON register independently, and the results are
+ * bit-identical to the AVX2 and emulated versions.
+ */
+
+namespace simd_neon {
+
+// equivalent of _mm_movemask_epi8 for a vector with bytes 0x00 or 0xff
+inline uint32_t movemask_u8 (uint8x16_t x) {
+    static const uint8_t bits[16] = {
+        1, 2, 4, 8, 16, 32, 64, 128,
+        1, 2, 4, 8, 16, 32, 64, 128
+    };
+    uint8x16_t masked = vandq_u8 (x, vld1q_u8 (bits));
+    uint32_t lo = vaddv_u8 (vget_low_u8 (masked));
+    uint32_t hi = vaddv_u8 (vget_high_u8 (masked));
+    return lo | (hi << 8);
+}
+
+// 1 bit per 16-bit component of a comparison result
+inline uint32_t movemask_u16 (uint16x8_t lo, uint16x8_t hi) {
+    return movemask_u8 (vcombine_u8 (vmovn_u16 (lo), vmovn_u16 (hi)));
+}
+
+} // namespace simd_neon
+
+
+/// 256-bit representation without interpretation as a vector
+struct simd256bit {
+
+    uint8x16x2_t data;
+
+    simd256bit()   {}
+
+    explicit simd256bit(uint8x16x2_t data): data(data) {}
+
+    explicit simd256bit(const void *x) {
+        loadu(x);
+    }
+
+    void clear() {
+        data.val[0] = vdupq_n_u8 (0);
+        data.val[1] = vdupq_n_u8 (0);
+    }
+
+    void storeu(void *ptr) const {
+        vst1q_u8 ((uint8_t*)ptr, data.val[0]);
+        vst1q_u8 ((uint8_t*)ptr + 16, data.val[1]);
+    }
+
+    void loadu(const void *ptr) {
+        data.val[0] = vld1q_u8 ((const uint8_t*)ptr);
+        data.val[1] = vld1q_u8 ((const uint8_t*)ptr + 16);
+    }
+
+    void store(void *ptr) const {
+        storeu(ptr);
+    }
+
+    void bin(char bits[257]) const {
+        uint8_t bytes[32];
+        storeu(bytes);
+        for (int i = 0; i < 256; i++) {
+            bits[i] = '0' + ((bytes[i / 8] >> (i % 8)) & 1);
+        }
+        bits[256] = 0;
+    }
+
+    std::string bin() const {
+        char bits[257];
+        bin(bits);
+        return std::string(bits);
+    }
+
+};
+
+
+/// vector of 16 elements in uint16
+struct simd16uint16: simd256bit {
+    simd16uint16() {}
+
+    explicit simd16uint16(int x) {
+        set1(x);
+    }
+
+    explicit simd16uint16(uint16_t x) {
+        set1(x);
+    }
+
+    explicit simd16uint16(const simd256bit & x): simd256bit(x) {}
+
+    explicit simd16uint16(const uint16_t *x): simd256bit((const void*)x) {}
+
+    simd16uint16(uint16x8_t lo, uint16x8_t hi) {
+        data.val[0] = vreinterpretq_u8_u16 (lo);
+        data.val[1] = vreinterpretq_u8_u16 (hi);
+    }
+
+    uint16x8_t lo() const {
+        return vreinterpretq_u16_u8 (data.val[0]);
+    }
+
+    uint16x8_t hi() const {
+        return vreinterpretq_u16_u8 (data.val[1]);
+    }
+
+    std::string elements_to_string(const char * fmt) const {
+        uint16_t bytes[16];
+        storeu(bytes);
+        char res[1000], *ptr = res;
+        for(int i = 0; i < 16; i++) {
+            ptr += sprintf(ptr, fmt, bytes[i]);
+        }
+        // strip last ,
+        ptr[-1] = 0;
+        return std::string(res);
+    }
+
+    std::string hex() const {
+        return elements_to_string("%02x,");
+    }
+
+    std::string dec() const {
+        return elements_to_string("%3d,");
+    }
+
+    void set1(uint16_t x) {
+        uint16x8_t v = vdupq_n_u16 (x);
+        *this = simd16uint16 (v, v);
+    }
+
+    simd16uint16 operator >> (const int shift) const {
+        // vshlq with a negative count is a right shift
+        int16x8_t s = vdupq_n_s16 (-shift);
+        return simd16uint16 (vshlq_u16 (lo(), s), vshlq_u16 (hi(), s));
+    }
+
+    simd16uint16 operator << (const int shift) const {
+        int16x8_t s = vdupq_n_s16 (shift);
+        return simd16uint16 (vshlq_u16 (lo(), s), vshlq_u16 (hi(), s));
+    }
+
+    simd16uint16 operator += (simd16uint16 other) {
+        *this = *this + other;
+        return *this;
+    }
+
+    simd16uint16 operator -= (simd16uint16 other) {
+        *this = *this - other;
+        return *this;
+    }
+
+    simd16uint16 operator + (simd16uint16 other) const {
+        return simd16uint16 (vaddq_u16 (lo(), other.lo()),
+                             vaddq_u16 (hi(), other.hi()));
+    }
+
+    simd16uint16 operator - (simd16uint16 other) const {
+        return simd16uint16 (vsubq_u16 (lo(), other.lo()),
+                             vsubq_u16 (hi(), other.hi()));
+    }
+
+    simd16uint16 operator & (simd256bit other) const {
+        uint8x16x2_t c;
+        c.val[0] = vandq_u8 (data.val[0], other.data.val[0]);
+        c.val[1] = vandq_u8 (data.val[1], other.data.val[1]);
+        return simd16uint16 (simd256bit (c));
+    }
+
+    simd16uint16 operator | (simd256bit other) const {
+        uint8x16x2_t c;
+        c.val[0] = vorrq_u8 (data.val[0], other.data.val[0]);
+        c.val[1] = vorrq_u8 (data.val[1], other.data.val[1]);
+        return simd16uint16 (simd256bit (c));
+    }
+
+    simd16uint16 operator == (simd256bit other) const {
+        simd16uint16 o (other);
+        return simd16uint16 (vceqq_u16 (lo(), o.lo()),
+                             vceqq_u16 (hi(), o.hi()));
+    }
+
+    // get scalar at index 0
+    uint16_t get_scalar_0() const {
+        return vgetq_lane_u16 (lo(), 0);
+    }
+
+    // mask of elements where this >= thresh
+    // 2 bit per component: 16 * 2 = 32 bit
+    uint32_t ge_mask(simd16uint16 thresh) const {
+        uint8x16_t ge0 = vreinterpretq_u8_u16 (vcgeq_u16 (lo(), thresh.lo()));
+        uint8x16_t ge1 = vreinterpretq_u8_u16 (vcgeq_u16 (hi(), thresh.hi()));
+        return simd_neon::movemask_u8 (ge0) |
+               (simd_neon::movemask_u8 (ge1) << 16);
+    }
+
+    uint32_t le_mask(simd16uint16 thresh) const {
+        return thresh.ge_mask(*this);
+    }
+
+    uint32_t gt_mask(simd16uint16 thresh) const {
+        return ~le_mask(thresh);
+    }
+
+    bool all_gt(simd16uint16 thresh) const {
+        return le_mask(thresh) == 0;
+    }
+
+    // for debugging only
+    uint16_t operator [] (int i) const {
+        uint16_t tab[16];
+        storeu(tab);
+        return tab[i];
+    }
+
+    void accu_min(simd16uint16 incoming) {
+        *this = simd16uint16 (vminq_u16 (lo(), incoming.lo()),
+                              vminq_u16 (hi(), incoming.hi()));
+    }
+
+    void accu_max(simd16uint16 incoming) {
+        *this = simd16uint16 (vmaxq_u16 (lo(), incoming.lo()),
+                              vmaxq_u16 (hi(), incoming.hi()));
+    }
+
+};
+
+// decompose in 128-lanes: a = (a0, a1), b = (b0, b1)
+// return (a0 + a1, b0 + b1)
+// TODO find a better name
+inline simd16uint16 combine2x2(simd16uint16 a, simd16uint16 b) {
+    return simd16uint16 (vaddq_u16 (a.lo(), a.hi()),
+                         vaddq_u16 (b.lo(), b.hi()));
+}
+
+// compare d0 and d1 to thr, return 32 bits corresponding to the concatenation
+// of d0 and d1 with thr
+inline uint32_t cmp_ge32(simd16uint16 d0, simd16uint16 d1, simd16uint16 thr) {
+    uint32_t ge0 = simd_neon::movemask_u16 (
+            vcgeq_u16 (d0.lo(), thr.lo()), vcgeq_u16 (d0.hi(), thr.hi()));
+    uint32_t ge1 = simd_neon::movemask_u16 (
+            vcgeq_u16 (d1.lo(), thr.lo()), vcgeq_u16 (d1.hi(), thr.hi()));
+    return ge0 | (ge1 << 16);
+}
+
+
+inline uint32_t cmp_le32(simd16uint16 d0, simd16uint16 d1, simd16uint16 thr) {
+    uint32_t le0 = simd_neon::movemask_u16 (
+            vcleq_u16 (d0.lo(), thr.lo()), vcleq_u16 (d0.hi(), thr.hi()));
+    uint32_t le1 = simd_neon::movemask_u16 (
+            vcleq_u16 (d1.lo(), thr.lo()), vcleq_u16 (d1.hi(), thr.hi()));
+    return le0 | (le1 << 16);
+}
+
+
+
+// vector of 32 unsigned 8-bit integers
+struct simd32uint8: simd256bit {
+
+    simd32uint8() {}
+
+    explicit simd32uint8(int x) {
+        set1(x);
+    }
+
+    explicit simd32uint8(uint8_t x) {
+        set1(x);
+    }
+
+    explicit simd32uint8(const simd256bit & x): simd256bit(x) {}
+
+    explicit simd32uint8(const uint8_t *x): simd256bit((const void*)x) {}
+
+    simd32uint8(uint8x16_t lo, uint8x16_t hi) {
+        data.val[0] = lo;
+        data.val[1] = hi;
+    }
+
+    std::string elements_to_string(const char * fmt) const {
+        uint8_t bytes[32];
+        storeu(bytes);
+        char res[1000], *ptr = res;
+        for(int i = 0; i < 32; i++) {
+            ptr += sprintf(ptr, fmt, bytes[i]);
+        }
+        // strip last ,
+        ptr[-1] = 0;
+        return std::string(res);
+    }
+
+    std::string hex() const {
+        return elements_to_string("%02x,");
+    }
+
+    std::string dec() const {
+        return elements_to_string("%3d,");
+    }
+
+    void set1(uint8_t x) {
+        data.val[0] = vdupq_n_u8 (x);
+        data.val[1] = data.val[0];
+    }
+
+    simd32uint8 operator & (simd256bit other) const {
+        return simd32uint8 (vandq_u8 (data.val[0], other.data.val[0]),
+                            vandq_u8 (data.val[1], other.data.val[1]));
+    }
+
+    simd32uint8 operator + (simd32uint8 other) const {
+        return simd32uint8 (vaddq_u8 (data.val[0], other.data.val[0]),
+                            vaddq_u8 (data.val[1], other.data.val[1]));
+    }
+
+    // The very important operation that everything relies on
+    // (same semantics as _mm256_shuffle_epi8: lookup within 128-bit lanes)
+    simd32uint8 lookup_2_lanes(simd32uint8 idx) const {
+        // vqtbl1q returns 0 for indices >= 16, so keeping the high bit
+        // reproduces the zeroing of pshufb
+        const uint8x16_t m = vdupq_n_u8 (0x8f);
+        return simd32uint8 (
+                vqtbl1q_u8 (data.val[0], vandq_u8 (idx.data.val[0], m)),
+                vqtbl1q_u8 (data.val[1], vandq_u8 (idx.data.val[1], m)));
+    }
+
+    // extract + 0-extend lane
+    simd16uint16 lane0_as_uint16() const {
+        return simd16uint16 (vmovl_u8 (vget_low_u8 (data.val[0])),
+                             vmovl_u8 (vget_high_u8 (data.val[0])));
+    }
+
+    simd16uint16 lane1_as_uint16() const {
+        return simd16uint16 (vmovl_u8 (vget_low_u8 (data.val[1])),
+                             vmovl_u8 (vget_high_u8 (data.val[1])));
+    }
+
+    simd32uint8 operator += (simd32uint8 other) {
+        *this = *this + other;
+        return *this;
+    }
+
+    // for debugging only
+    uint8_t operator [] (int i) const {
+        uint8_t tab[32];
+        storeu(tab);
+        return tab[i];
+    }
+
+};
+
+
+/// vector of 8 unsigned 32-bit integers
+struct simd8uint32: simd256bit {
+    simd8uint32() {}
+
+    explicit simd8uint32(uint32_t x) {
+        set1(x);
+    }
+
+    explicit simd8uint32(const simd256bit & x): simd256bit(x) {}
+
+    explicit simd8uint32(const uint8_t *x): simd256bit((const void*)x) {}
+
+    std::string elements_to_string(const char * fmt) const {
+        uint32_t bytes[8];
+        storeu(bytes);
+        char res[1000], *ptr = res;
+        for(int i = 0; i < 8; i++) {
+            ptr += sprintf(ptr, fmt, bytes[i]);
+        }
+        // strip last ,
+        ptr[-1] = 0;
+        return std::string(res);
+    }
+
+    std::string hex() const {
+        return elements_to_string("%08x,");
+    }
+
+    std::string dec() const {
+        return elements_to_string("%10d,");
+    }
+
+    void set1(uint32_t x) {
+        data.val[0] = vreinterpretq_u8_u32 (vdupq_n_u32 (x));
+        data.val[1] = data.val[0];
+    }
+
+};
+
+struct simd8float32: simd256bit {
+
+    simd8float32() {}
+
+    explicit simd8float32(const simd256bit & x): simd256bit(x) {}
+
+    explicit simd8float32(float x) {
+        set1(x);
+    }
+
+    explicit simd8float32(const float *x) {
+        loadu((const void*)x);
+    }
+
+    simd8float32(float32x4_t lo, float32x4_t hi) {
+        data.val[0] = vreinterpretq_u8_f32 (lo);
+        data.val[1] = vreinterpretq_u8_f32 (hi);
+    }
+
+    float32x4_t lo() const {
+        return vreinterpretq_f32_u8 (data.val[0]);
+    }
+
+    float32x4_t hi() const {
+        return vreinterpretq_f32_u8 (data.val[1]);
+    }
+
+    void set1(float x) {
+        float32x4_t v = vdupq_n_f32 (x);
+        *this = simd8float32 (v, v);
+    }
+
+    simd8float32 operator * (simd8float32 other) const {
+        return simd8float32 (vmulq_f32 (lo(), other.lo()),
+                             vmulq_f32 (hi(), other.hi()));
+    }
+
+    simd8float32 operator + (simd8float32 other) const {
+        return simd8float32 (vaddq_f32 (lo(), other.lo()),
+                             vaddq_f32 (hi(), other.hi()));
+    }
+
+    simd8float32 operator - (simd8float32 other) const {
+        return simd8float32 (vsubq_f32 (lo(), other.lo()),
+                             vsubq_f32 (hi(), other.hi()));
+    }
+
+    std::string tostring() const {
+        float tab[8];
+        storeu(tab);
+        char res[1000], *ptr = res;
+        for(int i = 0; i < 8; i++) {
+            ptr += sprintf(ptr, "%g,", tab[i]);
+        }
+        // strip last ,
+        ptr[-1] = 0;
+        return std::string(res);
+    }
+
+};
+
+
+// hadd does not cross lanes
+inline simd8float32 hadd(simd8float32 a, simd8float32 b) {
+    return simd8float32 (vpaddq_f32 (a.lo(), b.lo()),
+                         vpaddq_f32 (a.hi(), b.hi()));
+}
+
+inline simd8float32 unpacklo(simd8float32 a, simd8float32 b) {
+    return simd8float32 (vzip1q_f32 (a.lo(), b.lo()),
+                         vzip1q_f32 (a.hi(), b.hi()));
+}
+
+inline simd8float32 unpackhi(simd8float32 a, simd8float32 b) {
+    return simd8float32 (vzip2q_f32 (a.lo(), b.lo()),
+                         vzip2q_f32 (a.hi(), b.hi()));
+}
+
+// compute a * b + c
+inline simd8float32 fmadd(simd8float32 a, simd8float32 b, simd8float32 c) {
+    return simd8float32 (vfmaq_f32 (c.lo(), a.lo(), b.lo()),
+                         vfmaq_f32 (c.hi(), a.hi(), b.hi()));
+}
+
+} // namespace faiss
@@ -25,6 +25,11 @@
 #include <unistd.h>
 #endif // !_MSC_VER
 
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 #include <omp.h>
 
 #include <algorithm>
@@ -89,6 +94,65 @@ double getmillisecs () {
 }
 #endif // _MSC_VER
 
+#ifdef __linux__
+
+int get_numa_node_count ()
+{
+    int n = 0;
+    for (;;) {
+        char fname[256];
+        snprintf (fname, 256, "/sys/devices/system/node/node%d", n);
+        if (access (fname, F_OK) != 0) break;
+        n++;
+    }
+    return n > 0 ? n : 1;
+}
+
+bool bind_thread_to_numa_node (int node)
+{
+    char fname[256];
+    snprintf (fname, 256, "/sys/devices/system/node/node%d/cpulist", node);
+    FILE *f = fopen (fname, "r");
+    if (!f) return false;
+    char buf[4096];
+    bool ok = fgets (buf, sizeof(buf), f) != nullptr;
+    fclose (f);
+    if (!ok) return false;
+
+    // format is eg. "0-23,48-71"
+    cpu_set_t set;
+    CPU_ZERO (&set);
+    int ncpu = 0;
+    char *saveptr = nullptr;
+    for (char *tok = strtok_r (buf, ",\n", &saveptr); tok;
+         tok = strtok_r (nullptr, ",\n", &saveptr)) {
+        int a, b;
+        int nf = sscanf (tok, "%d-%d", &a, &b);
+        if (nf < 1) continue;
+        if (nf == 1) b = a;
+        for (int c = a; c <= b && c < CPU_SETSIZE; c++) {
+            CPU_SET (c, &set);
+            ncpu++;
+        }
+    }
+    if (ncpu == 0) return false;
+    return pthread_setaffinity_np (pthread_self(), sizeof(set), &set) == 0;
+}
+
+#else
+
+int get_numa_node_count ()
+{
+    return 1;
+}
+
+bool bind_thread_to_numa_node (int)
+{
+    return false;
+}
+
+#endif
+
 uint64_t get_cycles () {
 #ifdef  __x86_64__
     uint32_t high, low;
@@ -600,17 +664,24 @@ const float *fvecs_maybe_subsample (
         printf ("  Input training set too big (max size is %zd), sampling "
                 "%zd / %zd vectors\n", nmax, n2, *n);
     }
-    std::vector<int> subset (*n);
-    rand_perm (subset.data (), *n, seed);
+    std::vector<int64_t> subset (n2);
+    rand_subset (subset.data (), *n, n2, seed);
     float *x_subset = new float[n2 * d];
-    for (int64_t i = 0; i < n2; i++)
-        memcpy (&x_subset[i * d],
-                &x[subset[i] * size_t(d)],
-                sizeof (x[0]) * d);
+    gather_rows (sizeof (x[0]) * d, (const uint8_t*)x, subset.data(), n2,
+                 (uint8_t*)x_subset);
     *n = n2;
     return x_subset;
 }
 
+void gather_rows (size_t line_size, const uint8_t *x,
+                  const int64_t *ids, size_t k, uint8_t *out)
+{
+#pragma omp parallel for if (k * line_size > 65536)
+    for (int64_t i = 0; i < k; i++) {
+        memcpy (out + i * line_size, x + ids[i] * line_size, line_size);
+    }
+}
+
 
 void binary_to_real(size_t d, const uint8_t *x_in, float *x_out) {
     for (size_t i = 0; i < d; ++i) {
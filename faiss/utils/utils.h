@@ -42,6 +42,19 @@ size_t get_mem_usage_kb ();
 
 uint64_t get_cycles ();
 
+/// nb of NUMA nodes of the machine (1 if unknown)
+int get_numa_node_count ();
+
+/** bind the calling thread to the CPUs of a NUMA node (Linux only).
+ *
+ * Memory that is first touched by the thread afterwards is allocated on
+ * that node, and threads it creates (including its OpenMP team) inherit
+ * the binding.
+ *
+ * @return false if the binding is not supported or failed
+ */
+bool bind_thread_to_numa_node (int node);
+
 /***************************************************************************
  * Misc  matrix and vector manipulation functions
  ***************************************************************************/
@@ -140,6 +153,16 @@ const float *fvecs_maybe_subsample (
        size_t d, size_t *n, size_t nmax, const float *x,
        bool verbose = false, int64_t seed = 1234);
 
+/** copy rows of a matrix, multi-threaded: out[i] = x[ids[i]]
+ *
+ * @param line_size  size of a row, in bytes
+ * @param x          input rows (can be a memory-mapped file)
+ * @param ids        rows to copy, size k
+ * @param out        output, size k * line_size
+ */
+void gather_rows (size_t line_size, const uint8_t *x,
+                  const int64_t *ids, size_t k, uint8_t *out);
+
 /** Convert binary vector to +1/-1 valued float vector.
  *
  * @param d      dimension of the vector (multiple of 8)
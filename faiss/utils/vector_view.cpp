@@ -0,0 +1,105 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/utils/vector_view.h>
+
+#include <cstring>
+
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/fp16.h>
+
+namespace faiss {
+
+VectorArrayView::VectorArrayView (VectorElementType type, const void *data,
+                                  size_t n, size_t d, size_t stride):
+    type (type), data (data), n (n), d (d), stride (stride ? stride : d)
+{
+    FAISS_THROW_IF_NOT_MSG (this->stride >= d, "stride smaller than d");
+    FAISS_THROW_IF_NOT (type >= VET_float32 && type <= VET_int8);
+}
+
+VectorArrayView::VectorArrayView (const float *data, size_t n, size_t d):
+    type (VET_float32), data (data), n (n), d (d), stride (d)
+{}
+
+size_t VectorArrayView::element_size () const
+{
+    switch (type) {
+    case VET_float32: return 4;
+    case VET_float16:
+    case VET_bfloat16: return 2;
+    default: return 1;
+    }
+}
+
+const void *VectorArrayView::get (size_t i) const
+{
+    return (const uint8_t*)data + i * stride * element_size ();
+}
+
+namespace {
+
+template<class T>
+void int_to_float (float *out, const T *x, size_t d)
+{
+    for (size_t j = 0; j < d; j++) {
+        out[j] = x[j];
+    }
+}
+
+} // anonymous namespace
+
+void VectorArrayView::to_float (size_t i0, size_t i1, float *out) const
+{
+    if (type == VET_float32 && stride == d) {
+        memcpy (out, get (i0), sizeof(float) * d * (i1 - i0));
+        return;
+    }
+    for (size_t i = i0; i < i1; i++) {
+        const void *xi = get (i);
+        float *outi = out + (i - i0) * d;
+        switch (type) {
+        case VET_float32:
+            memcpy (outi, xi, sizeof(float) * d);
+            break;
+        case VET_float16:
+            fp16_to_fp32 (outi, (const uint16_t*)xi, d);
+            break;
+        case VET_bfloat16:
+            bf16_to_fp32 (outi, (const uint16_t*)xi, d);
+            break;
+        case VET_uint8:
+            int_to_float (outi, (const uint8_t*)xi, d);
+            break;
+        case VET_int8:
+            int_to_float (outi, (const int8_t*)xi, d);
+            break;
+        }
+    }
+}
+
+const float *VectorArrayView::get_float (size_t i0, size_t i1,
+                                         std::vector<float> & buf,
+                                         size_t *ld) const
+{
+    if (type == VET_float32 && (ld || stride == d || i1 == i0 + 1)) {
+        if (ld) {
+            *ld = stride;
+        }
+        return (const float*)get (i0);
+    }
+    buf.resize ((i1 - i0) * d);
+    to_float (i0, i1, buf.data());
+    if (ld) {
+        *ld = d;
+    }
+    return buf.data();
+}
+
+} // namespace faiss
@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+namespace faiss {
+
+/// element type of the vectors of a VectorArrayView
+enum VectorElementType {
+    VET_float32 = 0,
+    VET_float16,     ///< IEEE half precision, see fp16.h
+    VET_bfloat16,    ///< bfloat16, see fp16.h
+    VET_uint8,
+    VET_int8,
+};
+
+/** Non-owning view on an array of n vectors of dimension d, with any
+ * element type and a stride between the vectors.
+ *
+ * It is accepted by the knn functions of distances.h and by
+ * Index::add_view / Index::search_view, that convert the vectors to
+ * float by blocks as they are used, instead of requiring a contiguous
+ * float32 copy of the whole array. float32 vectors with any stride are
+ * not converted at all.
+ */
+struct VectorArrayView {
+    VectorElementType type;
+    const void *data;
+    size_t n;         ///< nb of vectors
+    size_t d;         ///< dimension
+    /// nb of elements between the starts of 2 consecutive vectors (>= d)
+    size_t stride;
+
+    /// stride = 0 means d (contiguous vectors)
+    VectorArrayView (VectorElementType type, const void *data,
+                     size_t n, size_t d, size_t stride = 0);
+
+    /// contiguous float32 vectors, as in the rest of the library
+    VectorArrayView (const float *data, size_t n, size_t d);
+
+    /// size of an element in bytes
+    size_t element_size () const;
+
+    /// pointer to the first element of vector i
+    const void *get (size_t i) const;
+
+    /// convert vectors i0 .. i1 - 1 to floats, contiguous in out
+    void to_float (size_t i0, size_t i1, float *out) const;
+
+    /** vectors i0 .. i1 - 1 as floats. float32 vectors are returned in
+     * place, the others are converted in buf.
+     *
+     * @param ld  if non-null, set to the nb of floats between the starts
+     *            of 2 returned vectors. Otherwise, the returned vectors
+     *            are contiguous (strided float32 vectors are copied).
+     */
+    const float *get_float (size_t i0, size_t i1,
+                            std::vector<float> & buf,
+                            size_t *ld = nullptr) const;
+};
+
+} // namespace faiss
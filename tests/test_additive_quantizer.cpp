@@ -0,0 +1,240 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexAdditiveQuantizer.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexRefine.h>
+#include <faiss/index_factory.h>
+#include <faiss/index_io.h>
+#include <faiss/impl/ProductQuantizer.h>
+#include <faiss/impl/io.h>
+#include <faiss/utils/distances.h>
+#include <faiss/utils/random.h>
+
+namespace {
+
+typedef faiss::Index::idx_t idx_t;
+
+int d = 32;
+size_t nt = 4000;
+size_t nb = 2000;
+size_t nq = 20;
+int k = 10;
+
+/// vectors on a low-dimensional subspace, plus some noise
+std::vector<float> make_data (size_t n, int seed)
+{
+    int d1 = 8;
+    std::vector<float> proj (d1 * d);
+    faiss::float_randn (proj.data(), proj.size(), 123);
+    std::vector<float> x1 (n * d1);
+    faiss::float_randn (x1.data(), x1.size(), seed);
+    std::vector<float> x (n * d);
+    faiss::float_randn (x.data(), x.size(), seed + 1);
+    for (size_t i = 0; i < n; i++) {
+        for (int j = 0; j < d; j++) {
+            float v = 0;
+            for (int l = 0; l < d1; l++) {
+                v += x1[i * d1 + l] * proj[l * d + j];
+            }
+            x[i * d + j] = v + 0.1 * x[i * d + j];
+        }
+    }
+    return x;
+}
+
+float mse (const faiss::AdditiveQuantizer & aq, size_t n, const float *x)
+{
+    std::vector<uint8_t> codes (n * aq.code_size);
+    aq.compute_codes (x, codes.data(), n);
+    std::vector<float> x2 (n * d);
+    aq.decode (codes.data(), x2.data(), n);
+    return faiss::fvec_L2sqr (x, x2.data(), n * d) / n;
+}
+
+/// the search gives the same results as an IndexFlat on the decoded
+/// vectors, up to the error on the stored norms
+void test_search (faiss::Index & index, faiss::MetricType metric,
+                  float norm_tol)
+{
+    std::vector<float> xb = make_data (nb, 3);
+    std::vector<float> xq = make_data (nq, 4);
+    index.add (nb, xb.data());
+
+    std::vector<float> xb_dec (nb * d);
+    for (size_t i = 0; i < nb; i++) {
+        index.reconstruct (i, xb_dec.data() + i * d);
+    }
+    faiss::IndexFlat ref (d, metric);
+    ref.add (nb, xb_dec.data());
+
+    std::vector<float> D_ref (nq * k), D (nq * k);
+    std::vector<idx_t> I_ref (nq * k), I (nq * k);
+    ref.search (nq, xq.data(), k, D_ref.data(), I_ref.data());
+    index.search (nq, xq.data(), k, D.data(), I.data());
+
+    int nmiss = 0;
+    for (size_t i = 0; i < nq * k; i++) {
+        nmiss += I[i] != I_ref[i];
+        EXPECT_NEAR (D[i], D_ref[i], norm_tol + 1e-4 * std::fabs(D_ref[i]));
+    }
+    // with quantized norms, close neighbors may be swapped
+    if (norm_tol == 0) {
+        EXPECT_LT (nmiss, nq * k / 50);
+    }
+}
+
+}  // namespace
+
+
+TEST(ResidualQuantizer, mse_vs_pq) {
+    std::vector<float> xt = make_data (nt, 1);
+
+    faiss::ResidualQuantizer rq (d, 4, 6);
+    rq.train (nt, xt.data());
+
+    faiss::ProductQuantizer pq (d, 4, 6);
+    pq.train (nt, xt.data());
+    std::vector<uint8_t> codes (nt * pq.code_size);
+    pq.compute_codes (xt.data(), codes.data(), nt);
+    std::vector<float> x2 (nt * d);
+    pq.decode (codes.data(), x2.data(), nt);
+    float pq_mse = faiss::fvec_L2sqr (xt.data(), x2.data(), nt * d) / nt;
+
+    float rq_mse = mse (rq, nt, xt.data());
+    EXPECT_LT (rq_mse, pq_mse);
+
+    // a wider beam does not make the encoding worse
+    faiss::ResidualQuantizer rq1 = rq;
+    rq1.max_beam_size = 1;
+    EXPECT_LE (rq_mse, mse (rq1, nt, xt.data()) * 1.001);
+}
+
+TEST(LocalSearchQuantizer, train) {
+    std::vector<float> xt = make_data (nt, 1);
+
+    faiss::LocalSearchQuantizer lsq (d, 4, 4);
+    lsq.train_iters = 1;
+    lsq.train (nt, xt.data());
+    float mse1 = mse (lsq, nt, xt.data());
+
+    lsq.train_iters = 10;
+    lsq.train (nt, xt.data());
+    float mse10 = mse (lsq, nt, xt.data());
+    EXPECT_LT (mse10, mse1);
+}
+
+TEST(IndexResidual, search) {
+    std::vector<float> xt = make_data (nt, 1);
+    using AQ = faiss::AdditiveQuantizer;
+
+    for (int nbits : {5, 8}) {
+        faiss::IndexResidual index (d, 4, nbits, faiss::METRIC_L2,
+                                    AQ::ST_norm_float);
+        index.train (nt, xt.data());
+        test_search (index, faiss::METRIC_L2, 0);
+
+        // same codebooks, other norm encodings
+        faiss::IndexResidual index_q (d, 4, nbits, faiss::METRIC_L2,
+                                      AQ::ST_norm_qint8);
+        index_q.rq.codebooks = index.rq.codebooks;
+        index_q.rq.is_trained = index_q.is_trained = true;
+        index_q.rq.norm_min = index.rq.norm_min;
+        index_q.rq.norm_max = index.rq.norm_max;
+        float norm_step = (index.rq.norm_max - index.rq.norm_min) / 255;
+        test_search (index_q, faiss::METRIC_L2, norm_step);
+
+        faiss::IndexResidual index_d (d, 4, nbits, faiss::METRIC_L2,
+                                      AQ::ST_decompress);
+        index_d.rq.codebooks = index.rq.codebooks;
+        index_d.rq.is_trained = index_d.is_trained = true;
+        test_search (index_d, faiss::METRIC_L2, 0);
+
+        faiss::IndexResidual index_ip (d, 4, nbits,
+                                       faiss::METRIC_INNER_PRODUCT,
+                                       AQ::ST_LUT_nonorm);
+        index_ip.rq.codebooks = index.rq.codebooks;
+        index_ip.rq.is_trained = index_ip.is_trained = true;
+        test_search (index_ip, faiss::METRIC_INNER_PRODUCT, 0);
+    }
+}
+
+TEST(IndexIVFResidual, search) {
+    std::vector<float> xt = make_data (nt, 1);
+    std::vector<float> xb = make_data (nb, 3);
+    std::vector<float> xq = make_data (nq, 4);
+
+    for (const char *key : {"IVF16,RQ4x6", "IVF16,RQ4x8_Nqint8",
+                            "IVF16,LSQ4x4"}) {
+        std::unique_ptr<faiss::Index> index (faiss::index_factory (d, key));
+        auto *ivf = dynamic_cast<faiss::IndexIVFAdditiveQuantizer*> (
+              index.get());
+        ASSERT_TRUE (ivf) << key;
+        if (auto *ivf_lsq =
+                dynamic_cast<faiss::IndexIVFLocalSearchQuantizer*> (ivf)) {
+            ivf_lsq->lsq.train_iters = 4;
+        }
+        index->train (nt, xt.data());
+        index->add (nb, xb.data());
+        ivf->nprobe = 16;
+
+        // exhaustive search on the reconstructed vectors
+        std::vector<float> xb_dec (nb * d);
+        ivf->make_direct_map ();
+        index->reconstruct_n (0, nb, xb_dec.data());
+        faiss::IndexFlatL2 ref (d);
+        ref.add (nb, xb_dec.data());
+
+        std::vector<float> D_ref (nq * k), D (nq * k);
+        std::vector<idx_t> I_ref (nq * k), I (nq * k);
+        ref.search (nq, xq.data(), k, D_ref.data(), I_ref.data());
+        index->search (nq, xq.data(), k, D.data(), I.data());
+
+        float tol = ivf->aq->search_type == faiss::AdditiveQuantizer::
+            ST_norm_qint8 ? (ivf->aq->norm_max - ivf->aq->norm_min) / 255 : 0;
+        int nmiss = 0;
+        for (size_t i = 0; i < nq * k; i++) {
+            nmiss += I[i] != I_ref[i];
+            EXPECT_NEAR (D[i], D_ref[i], tol + 1e-3 * D_ref[i]) << key;
+        }
+        if (tol == 0) {
+            EXPECT_LT (nmiss, nq * k / 50) << key;
+        }
+    }
+}
+
+TEST(IndexResidual, factory_io) {
+    std::vector<float> xt = make_data (nt, 1);
+    std::vector<float> xb = make_data (nb, 3);
+    std::vector<float> xq = make_data (nq, 4);
+
+    for (const char *key : {"RQ4x6", "IVF16,RQ4x6", "LSQ2x4",
+                            "IVF16,PQ4np,Refine(RQ8x4)"}) {
+        std::unique_ptr<faiss::Index> index (faiss::index_factory (d, key));
+        index->train (nt, xt.data());
+        index->add (nb, xb.data());
+
+        faiss::VectorIOWriter writer;
+        faiss::write_index (index.get(), &writer);
+        faiss::VectorIOReader reader;
+        reader.data = writer.data;
+        std::unique_ptr<faiss::Index> index2 (faiss::read_index (&reader));
+
+        std::vector<float> D (nq * k), D2 (nq * k);
+        std::vector<idx_t> I (nq * k), I2 (nq * k);
+        index->search (nq, xq.data(), k, D.data(), I.data());
+        index2->search (nq, xq.data(), k, D2.data(), I2.data());
+        EXPECT_EQ (I, I2) << key;
+        EXPECT_EQ (D, D2) << key;
+    }
+}
@@ -0,0 +1,125 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <atomic>
+#include <future>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/AsyncSearchExecutor.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVFFlat.h>
+#include <faiss/impl/HNSW.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> distrib;
+    std::vector<float> x(n);
+    for (auto & v: x) {
+        v = distrib(rng);
+    }
+    return x;
+}
+
+} // namespace
+
+
+TEST(AsyncSearch, future_and_callback) {
+    size_t d = 32, nb = 2000, nq = 20, nlist = 16;
+    idx_t k = 5;
+    int nreq = 10;
+    std::vector<float> xb = make_data(nb * d, 1);
+    std::vector<float> xq = make_data(nq * d, 2);
+
+    IndexFlatL2 quantizer(d);
+    IndexIVFFlat index(&quantizer, d, nlist);
+    index.train(nb, xb.data());
+    index.add(nb, xb.data());
+    index.nprobe = 4;
+
+    std::vector<float> Dref(nq * k);
+    std::vector<idx_t> Iref(nq * k);
+    index.search(nq, xq.data(), k, Dref.data(), Iref.data());
+
+    AsyncSearchExecutor executor(&index, 3);
+
+    std::vector<std::vector<float>> D(nreq, std::vector<float>(nq * k));
+    std::vector<std::vector<idx_t>> I(nreq, std::vector<idx_t>(nq * k));
+    std::vector<std::future<void>> futures;
+    std::atomic<int> ncallback(0);
+    for (int r = 0; r < nreq; r++) {
+        if (r % 2 == 0) {
+            futures.push_back(executor.search(
+                  nq, xq.data(), k, D[r].data(), I[r].data()));
+        } else {
+            executor.search(nq, xq.data(), k, D[r].data(), I[r].data(),
+                            [&ncallback](std::exception_ptr error) {
+                                EXPECT_FALSE(error);
+                                ncallback++;
+                            });
+        }
+    }
+    for (auto & f: futures) {
+        f.get();
+    }
+    executor.wait();
+    EXPECT_EQ(executor.n_pending(), 0);
+    EXPECT_EQ(ncallback, nreq / 2);
+    for (int r = 0; r < nreq; r++) {
+        EXPECT_EQ(Iref, I[r]);
+        EXPECT_EQ(Dref, D[r]);
+    }
+}
+
+TEST(AsyncSearch, params_and_errors) {
+    size_t d = 16, nb = 1000, nq = 10, nlist = 8;
+    idx_t k = 3;
+    std::vector<float> xb = make_data(nb * d, 1);
+    std::vector<float> xq = make_data(nq * d, 2);
+
+    IndexFlatL2 quantizer(d);
+    IndexIVFFlat index(&quantizer, d, nlist);
+    index.train(nb, xb.data());
+    index.add(nb, xb.data());
+
+    AsyncSearchExecutor executor(&index);
+
+    // per-search parameters
+    IVFSearchParameters params;
+    params.nprobe = nlist;
+    std::vector<float> D(nq * k), Dref(nq * k);
+    std::vector<idx_t> I(nq * k), Iref(nq * k);
+    index.nprobe = nlist;
+    index.search(nq, xq.data(), k, Dref.data(), Iref.data());
+    index.nprobe = 1;
+    executor.search(nq, xq.data(), k, D.data(), I.data(), &params).get();
+    EXPECT_EQ(Iref, I);
+
+    // errors are reported through the future and the callback
+    SearchParametersHNSW wrong_params;
+    auto f = executor.search(nq, xq.data(), k, D.data(), I.data(),
+                             &wrong_params);
+    EXPECT_THROW(f.get(), FaissException);
+
+    std::promise<bool> got_error;
+    executor.search(nq, xq.data(), k, D.data(), I.data(),
+                    [&got_error](std::exception_ptr error) {
+                        got_error.set_value(bool(error));
+                    },
+                    &wrong_params);
+    EXPECT_TRUE(got_error.get_future().get());
+}
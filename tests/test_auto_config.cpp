@@ -0,0 +1,109 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/AutoConfig.h>
+#include <faiss/AutoTune.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVF.h>
+#include <faiss/index_factory.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 16;
+size_t n = 4000;
+
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector <float> x (n * d);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < n * d; i++) {
+        x[i] = distrib(rng);
+    }
+    return x;
+}
+
+} // namespace
+
+
+TEST(AutoConfig, default_candidates) {
+    AutoConfig ac(d, 1000000);
+    std::vector<std::string> keys = ac.default_candidates();
+    EXPECT_EQ(keys[0], "Flat");
+    bool has_ivf = false;
+    for (const std::string & key : keys) {
+        has_ivf = has_ivf || key == "IVF4096,PQ8";
+        std::unique_ptr<Index> index(index_factory(d, key.c_str()));
+    }
+    EXPECT_TRUE(has_ivf);
+
+    // too small for an IVF
+    AutoConfig ac_small(d, 100);
+    EXPECT_EQ(ac_small.default_candidates().size(), 2);
+}
+
+TEST(AutoConfig, memory_budget) {
+    std::vector<float> x = make_data(n, 1);
+
+    size_t ntotal = 100000;
+    AutoConfig ac(d, ntotal);
+    ac.candidates = {"Flat", "IVF256,Flat", "IVF256,PQ4x4"};
+    ac.recall_target = 0.2;
+    AutoConfigResult res = ac.configure(n, x.data());
+    EXPECT_TRUE(res.feasible);
+    EXPECT_GE(res.recall, 0.2);
+    EXPECT_GT(ac.all_results.size(), 3);
+
+    // the extrapolated memory of the flat index is that of ntotal vectors
+    for (const AutoConfigResult & r : ac.all_results) {
+        if (r.factory_key == "Flat") {
+            EXPECT_GE(r.memory, ntotal * d * sizeof(float));
+        }
+    }
+
+    // only the PQ fits in half the size of the vectors
+    ac.memory_budget = ntotal * d * sizeof(float) / 2;
+    res = ac.configure(n, x.data());
+    EXPECT_TRUE(res.feasible);
+    EXPECT_EQ(res.factory_key, "IVF256,PQ4x4");
+    EXPECT_LE(res.memory, ac.memory_budget);
+
+    // the sample is indexed with 64 lists, the nprobe is scaled to 256
+    std::unique_ptr<Index> index(index_factory(d, res.factory_key.c_str()));
+    ParameterSpace ps;
+    ps.set_index_parameters(index.get(), res.search_params.c_str());
+    IndexIVF *ivf = dynamic_cast<IndexIVF*>(index.get());
+    ASSERT_TRUE(ivf);
+    EXPECT_EQ(ivf->nprobe % 4, 0);
+}
+
+TEST(AutoConfig, infeasible) {
+    std::vector<float> x = make_data(n, 2);
+
+    AutoConfig ac(d, 50000);
+    ac.candidates = {"IVF64,Flat", "IVF64,PQ4x4"};
+    ac.recall_target = 1.01;
+    AutoConfigResult res = ac.configure(n, x.data());
+    EXPECT_FALSE(res.feasible);
+
+    // the best recall is returned
+    for (const AutoConfigResult & r : ac.all_results) {
+        EXPECT_LE(r.recall, res.recall);
+    }
+}
@@ -0,0 +1,83 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <memory>
+#include <vector>
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include <faiss/AutoTune.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/index_factory.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 16;
+size_t nb = 5000;
+size_t nq = 100;
+
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector <float> x (n * d);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < n * d; i++) {
+        x[i] = distrib(rng);
+    }
+    return x;
+}
+
+} // namespace
+
+
+TEST(AutoTune, cost_model) {
+    std::vector<float> xb = make_data(nb, 1);
+    std::vector<float> xq = make_data(nq, 2);
+
+    std::unique_ptr<Index> index(index_factory(d, "IVF32,Flat"));
+    index->train(nb, xb.data());
+    index->add(nb, xb.data());
+
+    IndexFlatL2 flat(d);
+    flat.add(nb, xb.data());
+    OneRecallAtRCriterion crit(nq, 1);
+    std::vector<float> gt_D(nq);
+    std::vector<idx_t> gt_I(nq);
+    flat.search(nq, xq.data(), 1, gt_D.data(), gt_I.data());
+    crit.set_groundtruth(1, gt_D.data(), gt_I.data());
+
+    ParameterSpace ps;
+    ps.verbose = 0;
+    ps.use_cost_model = true;
+    ps.n_experiments = 0;
+    ps.add_range("nprobe").values = {1, 2, 4, 8, 16, 32};
+
+    OperatingPoints ops1, ops2;
+    ps.explore(index.get(), nq, xq.data(), crit, &ops1);
+    ps.explore(index.get(), nq, xq.data(), crit, &ops2);
+
+    // the costs are deterministic and grow with nprobe
+    ASSERT_EQ(ops1.all_pts.size(), 6);
+    for (size_t i = 0; i < ops1.all_pts.size(); i++) {
+        EXPECT_EQ(ops1.all_pts[i].t, ops2.all_pts[i].t);
+        if (i > 0) {
+            EXPECT_GT(ops1.all_pts[i].t, ops1.all_pts[i - 1].t);
+        }
+    }
+    // nprobe=32 is exhaustive
+    EXPECT_EQ(ops1.all_pts.back().t, nb + 32 * ps.list_cost);
+    EXPECT_EQ(ops1.all_pts.back().perf, 1.0);
+}
@@ -0,0 +1,164 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexBinaryFlat.h>
+#include <faiss/IndexBinaryHash.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/io.h>
+#include <faiss/index_io.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+std::vector<uint8_t> make_codes(size_t n, size_t code_size, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector<uint8_t> codes(n * code_size);
+    for (auto & c: codes) {
+        c = rng() & 0xff;
+    }
+    return codes;
+}
+
+// sorted (distance, id) pairs of each query
+std::vector<std::vector<std::pair<float, idx_t> > >
+range_results(const IndexBinary & index, size_t nq, const uint8_t *xq,
+              int radius)
+{
+    RangeSearchResult res(nq);
+    index.range_search(nq, xq, radius, &res);
+    std::vector<std::vector<std::pair<float, idx_t> > > out(nq);
+    for (size_t i = 0; i < nq; i++) {
+        for (size_t j = res.lims[i]; j < res.lims[i + 1]; j++) {
+            out[i].emplace_back(res.distances[j], res.labels[j]);
+        }
+        std::sort(out[i].begin(), out[i].end());
+    }
+    return out;
+}
+
+// the k-NN distances must match the exhaustive search
+void check_knn(const IndexBinary & index, const IndexBinaryFlat & ref,
+               size_t nq, const uint8_t *xq, idx_t k)
+{
+    std::vector<int32_t> D(nq * k), Dref(nq * k);
+    std::vector<idx_t> I(nq * k), Iref(nq * k);
+    index.search(nq, xq, k, D.data(), I.data());
+    ref.search(nq, xq, k, Dref.data(), Iref.data());
+    EXPECT_EQ(Dref, D);
+}
+
+const int d = 64;
+const size_t nb = 3000, nq = 50;
+
+} // namespace
+
+
+// with nflip = b all buckets are visited, so the search is exhaustive
+TEST(BinaryHash, exhaustive) {
+    std::vector<uint8_t> xb = make_codes(nb, d / 8, 123);
+    std::vector<uint8_t> xq = make_codes(nq, d / 8, 456);
+
+    IndexBinaryFlat ref(d);
+    ref.add(nb, xb.data());
+
+    IndexBinaryHash index(d, 6);
+    index.nflip = 6;
+    // two adds, the second one reorganizes the arenas
+    index.add(nb / 3, xb.data());
+    index.add(nb - nb / 3, xb.data() + nb / 3 * index.code_size);
+    EXPECT_EQ(nb, index.ntotal);
+    EXPECT_LE(index.hashtable_size(), 64);
+
+    check_knn(index, ref, nq, xq.data(), 10);
+    index.use_heap = false;
+    check_knn(index, ref, nq, xq.data(), 10);
+
+    EXPECT_EQ(range_results(ref, nq, xq.data(), 25),
+              range_results(index, nq, xq.data(), 25));
+}
+
+TEST(BinaryHash, buckets) {
+    std::vector<uint8_t> xb = make_codes(nb, d / 8, 123);
+    IndexBinaryHash index(d, 10);
+    std::vector<idx_t> ids(nb);
+    for (size_t i = 0; i < nb; i++) {
+        ids[i] = 10 * i;
+    }
+    index.add_with_ids(nb, xb.data(), ids.data());
+
+    // each entry is found in the bucket of its hash value, with its code
+    const BinaryHashTable & table = index.invlists;
+    size_t nfound = 0;
+    for (size_t i = 0; i < nb; i++) {
+        const uint8_t *code = xb.data() + i * index.code_size;
+        uint64_t hash = *(const uint64_t*)code & 1023;
+        int64_t slot = table.find(hash);
+        ASSERT_GE(slot, 0);
+        for (size_t j = 0; j < table.bucket_size(slot); j++) {
+            if (table.bucket_ids(slot)[j] == ids[i]) {
+                EXPECT_TRUE(std::equal(code, code + index.code_size,
+                    table.bucket_codes(slot) + j * index.code_size));
+                nfound++;
+            }
+        }
+    }
+    EXPECT_EQ(nb, nfound);
+}
+
+TEST(BinaryHash, multihash_exhaustive) {
+    std::vector<uint8_t> xb = make_codes(nb, d / 8, 123);
+    std::vector<uint8_t> xq = make_codes(nq, d / 8, 456);
+
+    IndexBinaryFlat ref(d);
+    ref.add(nb, xb.data());
+
+    IndexBinaryMultiHash index(d, 3, 6);
+    index.nflip = 6;
+    index.add(nb / 2, xb.data());
+    index.add(nb - nb / 2, xb.data() + nb / 2 * index.code_size);
+
+    check_knn(index, ref, nq, xq.data(), 10);
+    EXPECT_EQ(range_results(ref, nq, xq.data(), 25),
+              range_results(index, nq, xq.data(), 25));
+}
+
+TEST(BinaryHash, io) {
+    std::vector<uint8_t> xb = make_codes(nb, d / 8, 123);
+    std::vector<uint8_t> xq = make_codes(nq, d / 8, 456);
+
+    IndexBinaryHash index(d, 12);
+    index.nflip = 2;
+    index.add(nb, xb.data());
+    IndexBinaryMultiHash mindex(d, 4, 12);
+    mindex.nflip = 1;
+    mindex.add(nb, xb.data());
+
+    for (const IndexBinary *idx: {(const IndexBinary*)&index,
+                                  (const IndexBinary*)&mindex}) {
+        VectorIOWriter writer;
+        write_index_binary(idx, &writer);
+        VectorIOReader reader;
+        reader.data = writer.data;
+        std::unique_ptr<IndexBinary> idx2(read_index_binary(&reader));
+
+        EXPECT_EQ(range_results(*idx, nq, xq.data(), 20),
+                  range_results(*idx2, nq, xq.data(), 20));
+    }
+}
@@ -0,0 +1,143 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexBinaryFlat.h>
+#include <faiss/IndexBinaryHNSW.h>
+#include <faiss/IndexBinaryIVF.h>
+#include <faiss/index_factory.h>
+#include <faiss/impl/FaissAssert.h>
+
+#include <omp.h>
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 128;
+size_t nt = 4000, nb = 10000, nq = 20;
+int nlist = 64;
+
+// vectors around a few random centers, so that the lists are meaningful
+std::vector<uint8_t> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    size_t code_size = d / 8;
+    std::vector<uint8_t> centers(nlist * code_size);
+    std::mt19937 rng_c(123);
+    for (auto & c : centers) {
+        c = rng_c() & 0xff;
+    }
+    std::vector<uint8_t> x(n * code_size);
+    for (size_t i = 0; i < n; i++) {
+        const uint8_t *c = centers.data() + (rng() % nlist) * code_size;
+        for (size_t j = 0; j < code_size; j++) {
+            // flip about 1 bit out of 8
+            uint8_t flip = 1 << (rng() % 8);
+            x[i * code_size + j] = rng() % 2 ? c[j] ^ flip : c[j];
+        }
+    }
+    return x;
+}
+
+void train_and_add(IndexBinaryIVF & index)
+{
+    std::vector<uint8_t> xt = make_data(nt, 1);
+    std::vector<uint8_t> xb = make_data(nb, 2);
+    index.cp.min_points_per_centroid = 5;
+    index.train(nt, xt.data());
+    index.add(nb, xb.data());
+}
+
+} // namespace
+
+
+TEST(BinaryIVFHNSW, factory) {
+    for (const char *key : {"BIVF64_HNSW16", "BIVF64_BHNSW16",
+                            "BIVF64_HNSW", "BIVF64_BHNSW"}) {
+        std::unique_ptr<IndexBinary> index(index_binary_factory(d, key));
+        auto ivf = dynamic_cast<IndexBinaryIVF*>(index.get());
+        ASSERT_TRUE(ivf) << key;
+        EXPECT_EQ(ivf->nlist, 64);
+        auto hnsw = dynamic_cast<IndexBinaryHNSW*>(ivf->quantizer);
+        ASSERT_TRUE(hnsw) << key;
+        EXPECT_EQ(hnsw->hnsw.nb_neighbors(1),
+                  key[strlen(key) - 1] == 'W' ? 32 : 16);
+    }
+    std::unique_ptr<IndexBinary> index(index_binary_factory(d, "BIVF64"));
+    auto ivf = dynamic_cast<IndexBinaryIVF*>(index.get());
+    ASSERT_TRUE(ivf);
+    EXPECT_TRUE(dynamic_cast<IndexBinaryFlat*>(ivf->quantizer));
+}
+
+TEST(BinaryIVFHNSW, same_as_flat_quantizer) {
+    IndexBinaryFlat qflat(d);
+    IndexBinaryIVF ivf_flat(&qflat, d, nlist);
+    train_and_add(ivf_flat);
+
+    // the HNSW graph is built on the k-means centroids
+    IndexBinaryHNSW qhnsw(d, 16);
+    IndexBinaryIVF ivf_hnsw(&qhnsw, d, nlist);
+    train_and_add(ivf_hnsw);
+    EXPECT_EQ(qhnsw.ntotal, nlist);
+    EXPECT_TRUE(ivf_hnsw.is_trained);
+
+    // nprobe > efSearch: the coarse search is exhaustive enough on such a
+    // small graph to find the same lists
+    ivf_flat.nprobe = ivf_hnsw.nprobe = 24;
+    ASSERT_LT(qhnsw.hnsw.efSearch, 24);
+
+    std::vector<uint8_t> xq = make_data(nq, 3);
+    idx_t k = 10;
+    std::vector<int32_t> D1(nq * k), D2(nq * k);
+    std::vector<idx_t> I1(nq * k), I2(nq * k);
+    ivf_flat.search(nq, xq.data(), k, D1.data(), I1.data());
+    ivf_hnsw.search(nq, xq.data(), k, D2.data(), I2.data());
+    EXPECT_EQ(D1, D2);
+}
+
+TEST(BinaryIVFHNSW, parallel_mode) {
+    IndexBinaryHNSW quantizer(d, 16);
+    IndexBinaryIVF index(&quantizer, d, nlist);
+    train_and_add(index);
+    index.nprobe = 8;
+
+    std::vector<uint8_t> xq = make_data(nq, 3);
+    idx_t k = 10;
+    std::vector<int32_t> D0(nq * k), D1(nq * k), D2(nq * k);
+    std::vector<idx_t> I0(nq * k), I1(nq * k), I2(nq * k);
+    index.search(nq, xq.data(), k, D0.data(), I0.data());
+
+    // the lists of each query are scanned in parallel
+    index.parallel_mode = 1;
+    index.search(nq, xq.data(), k, D1.data(), I1.data());
+    EXPECT_EQ(D0, D1);
+
+    // single query: mode 0 falls back to the per-list parallelism when
+    // there are several threads
+    index.parallel_mode = 0;
+    int nt0 = omp_get_max_threads();
+    omp_set_num_threads(4);
+    for (size_t i = 0; i < nq; i++) {
+        index.search(1, xq.data() + i * d / 8, k,
+                     D2.data() + i * k, I2.data() + i * k);
+    }
+    omp_set_num_threads(nt0);
+    EXPECT_EQ(D0, D2);
+
+    index.parallel_mode = 2;
+    EXPECT_THROW(index.search(nq, xq.data(), k, D1.data(), I1.data()),
+                 FaissException);
+}
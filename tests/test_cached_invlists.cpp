@@ -0,0 +1,190 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexIVF.h>
+#include <faiss/InvertedLists.h>
+#include <faiss/index_factory.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 32;
+size_t nb = 3000;
+size_t nq = 50;
+idx_t k = 10;
+
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector <float> x (n * d);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < n * d; i++) {
+        x[i] = distrib(rng);
+    }
+    return x;
+}
+
+std::unique_ptr<IndexIVF> make_index()
+{
+    std::vector<float> xb = make_data(nb, 1);
+    std::unique_ptr<Index> index(index_factory(d, "IVF16,Flat"));
+    index->train(nb, xb.data());
+    index->add(nb, xb.data());
+    std::unique_ptr<IndexIVF> ivf(dynamic_cast<IndexIVF*>(index.release()));
+    ivf->nprobe = 4;
+    return ivf;
+}
+
+size_t list_bytes(const InvertedLists *il, size_t list_no)
+{
+    return il->list_size(list_no) * (il->code_size + sizeof(idx_t));
+}
+
+/// 8 lists of the same size
+std::unique_ptr<InvertedLists> make_uniform_invlists()
+{
+    size_t nlist = 8, code_size = 8, list_size = 10;
+    std::unique_ptr<InvertedLists> il(
+            new ArrayInvertedLists(nlist, code_size));
+    std::vector<uint8_t> code(code_size);
+    for (size_t i = 0; i < nlist * list_size; i++) {
+        code[0] = i;
+        il->add_entry(i % nlist, i, code.data());
+    }
+    return il;
+}
+
+void test_search(CachedInvertedLists::EvictionPolicy policy)
+{
+    std::unique_ptr<IndexIVF> ivf = make_index();
+    std::vector<float> xq = make_data(nq, 2);
+
+    std::vector<float> D_ref(nq * k), D(nq * k);
+    std::vector<idx_t> I_ref(nq * k), I(nq * k);
+    ivf->search(nq, xq.data(), k, D_ref.data(), I_ref.data());
+
+    // room for about 4 lists out of 16
+    size_t max_bytes = list_bytes(ivf->invlists, 0) * 4;
+    InvertedLists *il = ivf->invlists;
+    ivf->own_invlists = false;
+    CachedInvertedLists cil(il, max_bytes, policy);
+    ivf->replace_invlists(&cil, false);
+
+    for (int run = 0; run < 2; run++) {
+        ivf->search(nq, xq.data(), k, D.data(), I.data());
+        EXPECT_EQ(I, I_ref);
+        EXPECT_EQ(D, D_ref);
+    }
+    EXPECT_EQ(cil.nhit() + cil.nmiss(), 2 * nq * ivf->nprobe);
+    EXPECT_GT(cil.nhit(), 0);
+    EXPECT_GT(cil.nevict(), 0);
+    // all lists are released, so the budget is respected
+    EXPECT_LE(cil.cached_bytes(), max_bytes);
+
+    cil.reset_stats();
+    EXPECT_EQ(cil.hit_rate(), 0);
+
+    ivf->replace_invlists(il, true);
+}
+
+}  // namespace
+
+
+TEST(CachedInvertedLists, search_lru) {
+    test_search(CachedInvertedLists::EVICT_LRU);
+}
+
+TEST(CachedInvertedLists, search_lfu) {
+    test_search(CachedInvertedLists::EVICT_LFU);
+}
+
+TEST(CachedInvertedLists, eviction_order) {
+    std::unique_ptr<InvertedLists> il = make_uniform_invlists();
+    size_t max_bytes = 3 * list_bytes(il.get(), 0);
+
+    {
+        CachedInvertedLists cil(il.get(), max_bytes,
+                                CachedInvertedLists::EVICT_LRU);
+        for (size_t list_no : {0, 1, 0, 2}) {
+            InvertedLists::ScopedCodes codes(&cil, list_no);
+        }
+        EXPECT_EQ(cil.nhit(), 1);
+        EXPECT_EQ(cil.nmiss(), 3);
+        // list 1 is the least recently used
+        { InvertedLists::ScopedCodes codes(&cil, 3); }
+        { InvertedLists::ScopedCodes codes(&cil, 0); }
+        EXPECT_EQ(cil.nhit(), 2);
+        { InvertedLists::ScopedCodes codes(&cil, 1); }
+        EXPECT_EQ(cil.nhit(), 2);
+        EXPECT_EQ(cil.nevict(), 2);
+    }
+
+    {
+        CachedInvertedLists cil(il.get(), max_bytes,
+                                CachedInvertedLists::EVICT_LFU);
+        for (size_t list_no : {0, 0, 1, 2, 2}) {
+            InvertedLists::ScopedCodes codes(&cil, list_no);
+        }
+        // list 1 is the least frequently used
+        { InvertedLists::ScopedCodes codes(&cil, 3); }
+        { InvertedLists::ScopedCodes codes(&cil, 0); }
+        { InvertedLists::ScopedCodes codes(&cil, 2); }
+        EXPECT_EQ(cil.nhit(), 4);
+    }
+}
+
+TEST(CachedInvertedLists, pinned_and_in_use) {
+    std::unique_ptr<InvertedLists> il = make_uniform_invlists();
+
+    CachedInvertedLists cil(il.get(), list_bytes(il.get(), 0));
+
+    cil.pin_list(1);
+    EXPECT_EQ(cil.cached_lists(), 1);
+
+    {
+        // a list that is in use is not evicted
+        InvertedLists::ScopedCodes codes0(&cil, 0);
+        InvertedLists::ScopedIds ids0(&cil, 0);
+        InvertedLists::ScopedCodes codes2(&cil, 2);
+        EXPECT_EQ(cil.cached_lists(), 3);
+        EXPECT_EQ(ids0[0], il->get_single_id(0, 0));
+        EXPECT_EQ(cil.get_single_id(0, 1), il->get_single_id(0, 1));
+        EXPECT_EQ(codes2.get()[0], il->get_codes(2)[0]);
+    }
+    cil.clear();
+    EXPECT_EQ(cil.cached_lists(), 1);
+    EXPECT_EQ(cil.cached_bytes(), list_bytes(il.get(), 1));
+
+    { InvertedLists::ScopedCodes codes(&cil, 1); }
+    EXPECT_EQ(cil.nhit(), 1);
+
+    cil.unpin_list(1);
+    EXPECT_LE(cil.cached_bytes(), list_bytes(il.get(), 0));
+    cil.clear();
+    EXPECT_EQ(cil.cached_lists(), 0);
+
+    // lists larger than the budget are not cached
+    CachedInvertedLists cil2(il.get(), 16);
+    {
+        InvertedLists::ScopedCodes codes(&cil2, 0);
+        EXPECT_EQ(codes.get(), il->get_codes(0));
+    }
+    EXPECT_EQ(cil2.cached_lists(), 0);
+}
@@ -0,0 +1,96 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/Clustering.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/utils/random.h>
+
+
+using namespace faiss;
+
+namespace {
+
+size_t d = 16;
+size_t n = 20000;
+size_t k = 200;
+
+// points around ncl random centers
+std::vector<float> make_blobs(size_t ncl, int seed)
+{
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> noise(0, 0.1);
+    std::uniform_real_distribution<float> distrib(-1, 1);
+    std::vector<float> centers(ncl * d);
+    for (auto & c: centers) {
+        c = distrib(rng);
+    }
+    std::vector<float> x(n * d);
+    for (size_t i = 0; i < n; i++) {
+        size_t c = rng() % ncl;
+        for (size_t j = 0; j < d; j++) {
+            x[i * d + j] = centers[c * d + j] + noise(rng);
+        }
+    }
+    return x;
+}
+
+float train(ClusteringParameters cp, const std::vector<float> & x,
+            std::vector<ClusteringIterationStats> *stats = nullptr)
+{
+    cp.niter = 15;
+    Clustering clus(d, k, cp);
+    IndexFlatL2 index(d);
+    clus.train(n, x.data(), index);
+    EXPECT_EQ(index.ntotal, k);
+    if (stats) {
+        *stats = clus.iteration_stats;
+    }
+    return clus.iteration_stats.back().obj;
+}
+
+} // namespace
+
+
+// skipping the stable points does not change the clustering
+TEST(ClusteringAssign, skip_stable_points) {
+    std::vector<float> x = make_blobs(k / 2, 123);
+
+    ClusteringParameters cp;
+    float obj_ref = train(cp, x);
+
+    cp.skip_stable_points = true;
+    std::vector<ClusteringIterationStats> stats;
+    float obj = train(cp, x, &stats);
+    EXPECT_NEAR(obj, obj_ref, 1e-3 * obj_ref);
+
+    EXPECT_EQ(stats[0].nsearch, n);
+    EXPECT_LT(stats.back().nsearch, n / 2);
+}
+
+
+// the approximate assignment is about as good as the exact one
+TEST(ClusteringAssign, hnsw) {
+    std::vector<float> x(n * d);
+    float_rand(x.data(), x.size(), 123);
+
+    ClusteringParameters cp;
+    float obj_ref = train(cp, x);
+
+    cp.assign_hnsw_M = 16;
+    cp.assign_hnsw_efSearch = 32;
+    float obj = train(cp, x);
+    EXPECT_LT(obj, obj_ref * 1.02);
+
+    cp.skip_stable_points = true;
+    obj = train(cp, x);
+    EXPECT_LT(obj, obj_ref * 1.02);
+}
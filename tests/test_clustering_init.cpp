@@ -0,0 +1,93 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/Clustering.h>
+#include <faiss/IndexFlat.h>
+
+
+using namespace faiss;
+
+namespace {
+
+size_t d = 16;
+size_t n = 10000;
+size_t k = 50;
+
+// skewed data: half of the points are in 2 of the k blobs
+std::vector<float> make_skewed_blobs(int seed)
+{
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> noise(0, 0.05);
+    std::uniform_real_distribution<float> distrib(-1, 1);
+    std::vector<float> centers(k * d);
+    for (auto & c: centers) {
+        c = distrib(rng);
+    }
+    std::vector<float> x(n * d);
+    for (size_t i = 0; i < n; i++) {
+        size_t c = i % 2 == 0 ? rng() % 2 : rng() % k;
+        for (size_t j = 0; j < d; j++) {
+            x[i * d + j] = centers[c * d + j] + noise(rng);
+        }
+    }
+    return x;
+}
+
+float train(bool kmeans_parallel, int niter, const std::vector<float> & x,
+            std::vector<float> *centroids = nullptr,
+            const Index *codec = nullptr)
+{
+    ClusteringParameters cp;
+    cp.niter = niter;
+    cp.init_kmeans_parallel = kmeans_parallel;
+    Clustering clus(d, k, cp);
+    IndexFlatL2 index(d);
+    if (codec) {
+        std::vector<uint8_t> codes(n * codec->sa_code_size());
+        codec->sa_encode(n, x.data(), codes.data());
+        clus.train_encoded(n, codes.data(), codec, index);
+    } else {
+        clus.train(n, x.data(), index);
+    }
+    EXPECT_EQ(index.ntotal, k);
+    if (centroids) {
+        *centroids = clus.centroids;
+    }
+    return clus.iteration_stats.back().obj;
+}
+
+} // namespace
+
+
+TEST(ClusteringInit, kmeans_parallel) {
+    std::vector<float> x = make_skewed_blobs(123);
+
+    // k-means|| finds almost all the blobs from the start
+    float obj_rand_1 = train(false, 1, x);
+    float obj_par_1 = train(true, 1, x);
+    EXPECT_LT(obj_par_1, obj_rand_1 * 0.5);
+
+    float obj_rand = train(false, 10, x);
+    float obj_par = train(true, 10, x);
+    EXPECT_LT(obj_par, obj_rand * 1.01);
+}
+
+
+TEST(ClusteringInit, kmeans_parallel_encoded) {
+    std::vector<float> x = make_skewed_blobs(1234);
+
+    std::vector<float> c_ref, c;
+    train(true, 2, x, &c_ref);
+    IndexFlatL2 codec(d);
+    train(true, 2, x, &c, &codec);
+    EXPECT_EQ(c_ref, c);
+}
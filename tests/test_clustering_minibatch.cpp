@@ -0,0 +1,146 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstring>
+
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/Clustering.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/impl/FaissException.h>
+#include <faiss/impl/io.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+// points around ncl random centers
+std::vector<float> make_blobs(size_t n, size_t d, size_t ncl, int seed)
+{
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> noise(0, 0.1);
+    std::uniform_real_distribution<float> distrib(-1, 1);
+    std::vector<float> centers(ncl * d);
+    for (auto & c: centers) {
+        c = distrib(rng);
+    }
+    std::vector<float> x(n * d);
+    for (size_t i = 0; i < n; i++) {
+        size_t c = rng() % ncl;
+        for (size_t j = 0; j < d; j++) {
+            x[i * d + j] = centers[c * d + j] + noise(rng);
+        }
+    }
+    return x;
+}
+
+// sum of distances of the points to their nearest centroid
+float quantization_error(size_t d, size_t n, const float *x,
+                         const std::vector<float> & centroids)
+{
+    IndexFlatL2 index(d);
+    index.add(centroids.size() / d, centroids.data());
+    std::vector<float> dis(n);
+    std::vector<idx_t> assign(n);
+    index.search(n, x, 1, dis.data(), assign.data());
+    float obj = 0;
+    for (float di: dis) {
+        obj += di;
+    }
+    return obj;
+}
+
+} // namespace
+
+
+TEST(ClusteringMiniBatch, compare_to_lloyd) {
+    size_t d = 16, n = 20000, k = 32;
+    std::vector<float> x = make_blobs(n, d, k, 123);
+
+    Clustering lloyd(d, k);
+    IndexFlatL2 index_lloyd(d);
+    lloyd.train(n, x.data(), index_lloyd);
+    float obj_lloyd = quantization_error(d, n, x.data(), lloyd.centroids);
+
+    Clustering mb(d, k);
+    mb.batch_size = 1000;
+    mb.niter = 5;
+    IndexFlatL2 index_mb(d);
+    mb.train_minibatch(n, x.data(), index_mb);
+    EXPECT_EQ(mb.iteration_stats.size(), 5 * n / 1000);
+    EXPECT_EQ(index_mb.ntotal, k);
+    float obj_mb = quantization_error(d, n, x.data(), mb.centroids);
+
+    EXPECT_LT(obj_mb, obj_lloyd * 1.2);
+}
+
+TEST(ClusteringMiniBatch, reader_source) {
+    size_t d = 8, n = 5000, k = 10;
+    std::vector<float> x = make_blobs(n, d, k, 456);
+
+    VectorIOReader reader;
+    reader.data.resize(n * d * sizeof(float));
+    memcpy(reader.data.data(), x.data(), reader.data.size());
+    ClusteringDataSourceReader source(&reader, d);
+
+    Clustering mb(d, k);
+    mb.batch_size = 512;
+    IndexFlatL2 index(d);
+    mb.train_minibatch(source, index);
+
+    // the first k vectors are used for initialization
+    EXPECT_EQ(mb.iteration_stats.size(), (n - k + 511) / 512);
+
+    // same as the in-RAM source with a single pass in order
+    Clustering ref(d, k);
+    ref.batch_size = 512;
+    IndexFlatL2 index_ref(d);
+    VectorIOReader reader2;
+    reader2.data = reader.data;
+    ClusteringDataSourceReader source2(&reader2, d);
+    ref.train_minibatch(source2, index_ref);
+    EXPECT_EQ(ref.centroids, mb.centroids);
+
+    float obj = quantization_error(d, n, x.data(), mb.centroids);
+    float obj_init = quantization_error(
+        d, n, x.data(), std::vector<float>(x.begin(), x.begin() + k * d));
+    EXPECT_LT(obj, obj_init);
+}
+
+TEST(ClusteringMiniBatch, frozen_centroids) {
+    size_t d = 8, n = 3000, k = 12;
+    std::vector<float> x = make_blobs(n, d, k, 789);
+
+    Clustering mb(d, k);
+    mb.batch_size = 256;
+    mb.frozen_centroids = true;
+    std::vector<float> input(x.end() - 4 * d, x.end());
+    mb.centroids = input;
+    IndexFlatL2 index(d);
+    mb.train_minibatch(n, x.data(), index);
+    ASSERT_EQ(mb.centroids.size(), k * d);
+    EXPECT_EQ(std::vector<float>(mb.centroids.begin(),
+                                 mb.centroids.begin() + 4 * d), input);
+}
+
+TEST(ClusteringMiniBatch, too_few_points) {
+    size_t d = 4, k = 10;
+    std::vector<float> x = make_blobs(5, d, 2, 1);
+    VectorIOReader reader;
+    reader.data.resize(x.size() * sizeof(float));
+    memcpy(reader.data.data(), x.data(), reader.data.size());
+    ClusteringDataSourceReader source(&reader, d);
+    Clustering mb(d, k);
+    IndexFlatL2 index(d);
+    EXPECT_THROW(mb.train_minibatch(source, index), FaissException);
+}
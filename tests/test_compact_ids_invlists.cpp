@@ -0,0 +1,215 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <faiss/CompactIdsInvertedLists.h>
+#include <faiss/IndexIVF.h>
+#include <faiss/clone_index.h>
+#include <faiss/index_factory.h>
+#include <faiss/index_io.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/FaissException.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 32;
+size_t nt = 2000;
+size_t nb = 3000;
+size_t nq = 20;
+idx_t k = 10;
+
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector <float> x (n * d);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < n * d; i++) {
+        x[i] = distrib(rng);
+    }
+    return x;
+}
+
+struct SearchResult {
+    std::vector<float> D;
+    std::vector<idx_t> I;
+    std::vector<size_t> lims;
+    std::vector<idx_t> range_I;
+};
+
+SearchResult search(const IndexIVF & ivf, const float *xq,
+                    const SearchParameters *params = nullptr)
+{
+    SearchResult res;
+    res.D.resize(nq * k);
+    res.I.resize(nq * k);
+    ivf.search(nq, xq, k, res.D.data(), res.I.data(), params);
+    if (!params) {
+        RangeSearchResult rres(nq);
+        ivf.range_search(nq, xq, res.D[nq * k / 2], &rres);
+        res.lims.assign(rres.lims, rres.lims + nq + 1);
+        res.range_I.assign(rres.labels, rres.labels + rres.lims[nq]);
+    }
+    return res;
+}
+
+void expect_same(const SearchResult & a, const SearchResult & b)
+{
+    EXPECT_EQ(a.I, b.I);
+    EXPECT_EQ(a.D, b.D);
+    EXPECT_EQ(a.lims, b.lims);
+    EXPECT_EQ(a.range_I, b.range_I);
+}
+
+void test_compact_ids(const char *index_key,
+                      CompactIdsInvertedLists::IdStorage id_storage)
+{
+    std::vector<float> xt = make_data(nt, 1);
+    std::vector<float> xb = make_data(nb, 2);
+    std::vector<float> xq = make_data(nq, 3);
+
+    std::unique_ptr<Index> index(index_factory(d, index_key));
+    IndexIVF *ivf = dynamic_cast<IndexIVF*>(index.get());
+    ASSERT_TRUE(ivf);
+    ivf->train(nt, xt.data());
+    std::vector<idx_t> ids(nb);
+    for (size_t i = 0; i < nb; i++) {
+        ids[i] = 1000000 + i;
+    }
+    ivf->add_with_ids(nb, xb.data(), ids.data());
+    ivf->nprobe = 4;
+
+    std::unique_ptr<IndexIVF> ref(dynamic_cast<IndexIVF*>(clone_index(ivf)));
+    SearchResult res_ref = search(*ref, xq.data());
+
+    auto *il = new CompactIdsInvertedLists(
+          *ivf->invlists, id_storage, 1000000);
+    ivf->replace_invlists(il, true);
+    expect_same(res_ref, search(*ivf, xq.data()));
+
+    if (id_storage == CompactIdsInvertedLists::IDS_32BIT) {
+        EXPECT_EQ(il->ids_bytes(), nb * sizeof(uint32_t));
+        // id_base is enforced
+        idx_t bad_id = 12;
+        EXPECT_THROW(ivf->add_with_ids(1, xb.data(), &bad_id),
+                     FaissException);
+        EXPECT_EQ(ivf->ntotal, nb);
+    }
+
+    { // with an id selector
+        IDSelectorRange sel(1000500, 1002000);
+        IVFSearchParameters params;
+        params.sel = &sel;
+        expect_same(search(*ref, xq.data(), &params),
+                    search(*ivf, xq.data(), &params));
+    }
+
+    { // remove + add
+        IDSelectorRange sel(1000100, 1000400);
+        EXPECT_EQ(ref->remove_ids(sel), 300);
+        EXPECT_EQ(ivf->remove_ids(sel), 300);
+        ref->add_with_ids(10, xb.data(), ids.data() + 200);
+        ivf->add_with_ids(10, xb.data(), ids.data() + 200);
+        expect_same(search(*ref, xq.data()), search(*ivf, xq.data()));
+    }
+
+    { // lazy removal: the removed entries get id -1
+        ref->lazy_remove = ivf->lazy_remove = true;
+        IDSelectorRange sel(1002500, 1002600);
+        EXPECT_EQ(ref->remove_ids(sel), 100);
+        EXPECT_EQ(ivf->remove_ids(sel), 100);
+        expect_same(search(*ref, xq.data()), search(*ivf, xq.data()));
+    }
+
+    { // I/O round trip
+        char fname[] = "/tmp/faiss_test_compact_ids_XXXXXX";
+        int fd = mkstemp(fname);
+        ASSERT_GE(fd, 0);
+        close(fd);
+        write_index(ivf, fname);
+        std::unique_ptr<IndexIVF> ivf2(
+              dynamic_cast<IndexIVF*>(read_index(fname)));
+        unlink(fname);
+        ASSERT_TRUE(ivf2);
+        auto *il2 = dynamic_cast<CompactIdsInvertedLists*>(ivf2->invlists);
+        ASSERT_TRUE(il2);
+        EXPECT_EQ(il2->id_storage, id_storage);
+        EXPECT_EQ(il2->ids_bytes(), il->ids_bytes());
+        expect_same(search(*ref, xq.data()), search(*ivf2, xq.data()));
+    }
+}
+
+} // namespace
+
+
+TEST(CompactIdsInvlists, IVFFlat_32bit) {
+    test_compact_ids("IVF32,Flat", CompactIdsInvertedLists::IDS_32BIT);
+}
+
+TEST(CompactIdsInvlists, IVFFlat_implicit) {
+    test_compact_ids("IVF32,Flat", CompactIdsInvertedLists::IDS_IMPLICIT);
+}
+
+TEST(CompactIdsInvlists, IVFPQ_32bit) {
+    test_compact_ids("IVF32,PQ8x4", CompactIdsInvertedLists::IDS_32BIT);
+}
+
+TEST(CompactIdsInvlists, IVFPQ_implicit) {
+    test_compact_ids("IVF32,PQ8x4", CompactIdsInvertedLists::IDS_IMPLICIT);
+}
+
+TEST(CompactIdsInvlists, implicit_runs) {
+    // entries added in id order, each list gets consecutive ids
+    size_t nlist = 4, n = 100;
+    CompactIdsInvertedLists il(
+          nlist, 1, CompactIdsInvertedLists::IDS_IMPLICIT);
+    std::vector<uint8_t> codes(n);
+    idx_t id = 0;
+    for (size_t l = 0; l < nlist; l++) {
+        for (size_t i = 0; i < n; i += 10) {
+            std::vector<idx_t> ids(10);
+            for (idx_t & v: ids) {
+                v = id++;
+            }
+            il.add_entries(l, 10, ids.data(), codes.data());
+        }
+    }
+    EXPECT_EQ(il.ids_bytes(), nlist * sizeof(CompactIdsInvertedLists::IdRun));
+
+    // a tombstone splits a run in three
+    idx_t tomb = -1;
+    il.update_entries(1, 50, 1, &tomb, codes.data());
+    EXPECT_EQ(il.id_runs[1].size(), 3);
+    EXPECT_EQ(il.get_single_id(1, 49), 149);
+    EXPECT_EQ(il.get_single_id(1, 50), -1);
+    EXPECT_EQ(il.get_single_id(1, 51), 151);
+
+    InvertedLists::ScopedIds sids(&il, 1);
+    for (size_t i = 0; i < n; i++) {
+        EXPECT_EQ(sids[i], i == 50 ? -1 : idx_t(100 + i));
+    }
+
+    il.resize(1, 40);
+    EXPECT_EQ(il.id_runs[1].size(), 1);
+    il.resize(1, 45);
+    EXPECT_EQ(il.get_single_id(1, 39), 139);
+    EXPECT_EQ(il.get_single_id(1, 44), -1);
+}
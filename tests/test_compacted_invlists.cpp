@@ -0,0 +1,124 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexIVF.h>
+#include <faiss/InvertedLists.h>
+#include <faiss/index_factory.h>
+#include <faiss/index_io.h>
+#include <faiss/impl/io.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 32;
+size_t nt = 2000;
+size_t nb = 3000;
+size_t nq = 20;
+idx_t k = 10;
+
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector <float> x (n * d);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < n * d; i++) {
+        x[i] = distrib(rng);
+    }
+    return x;
+}
+
+void test_compact(const char *index_key, bool test_add = false)
+{
+    std::vector<float> xt = make_data(nt, 1);
+    std::vector<float> xb = make_data(nb, 2);
+    std::vector<float> xq = make_data(nq, 3);
+
+    std::unique_ptr<Index> index(index_factory(d, index_key));
+    index->train(nt, xt.data());
+    index->add(nb, xb.data());
+    IndexIVF *ivf = dynamic_cast<IndexIVF*>(index.get());
+    ASSERT_TRUE(ivf);
+    ivf->nprobe = 4;
+
+    std::vector<float> D_ref(nq * k), D(nq * k);
+    std::vector<idx_t> I_ref(nq * k), I(nq * k);
+    ivf->search(nq, xq.data(), k, D_ref.data(), I_ref.data());
+
+    ivf->compact();
+    CompactedInvertedLists *cil =
+        dynamic_cast<CompactedInvertedLists*>(ivf->invlists);
+    ASSERT_TRUE(cil);
+    EXPECT_EQ((uintptr_t)cil->codes % 64, 0);
+    EXPECT_EQ((uintptr_t)cil->ids % 64, 0);
+    EXPECT_EQ(cil->offsets[ivf->nlist], nb);
+    EXPECT_EQ(cil->compute_ntotal(), nb);
+
+    ivf->search(nq, xq.data(), k, D.data(), I.data());
+    EXPECT_EQ(I, I_ref);
+    EXPECT_EQ(D, D_ref);
+
+    if (test_add) {
+        // the compacted lists are read-only
+        EXPECT_THROW(ivf->add(1, xb.data()), FaissException);
+    }
+
+    // stored in the ArrayInvertedLists format
+    VectorIOWriter wr;
+    write_index(index.get(), &wr);
+    VectorIOReader rd;
+    rd.data = wr.data;
+    std::unique_ptr<Index> index2(read_index(&rd));
+    IndexIVF *ivf2 = dynamic_cast<IndexIVF*>(index2.get());
+    ASSERT_TRUE(ivf2);
+    EXPECT_TRUE(dynamic_cast<ArrayInvertedLists*>(ivf2->invlists));
+    ivf2->nprobe = 4;
+    ivf2->search(nq, xq.data(), k, D.data(), I.data());
+    EXPECT_EQ(I, I_ref);
+    EXPECT_EQ(D, D_ref);
+}
+
+} // namespace
+
+
+TEST(CompactedInvertedLists, IVFFlat) {
+    test_compact("IVF32,Flat", true);
+}
+
+TEST(CompactedInvertedLists, IVFPQ) {
+    test_compact("IVF32,PQ8np");
+}
+
+TEST(CompactedInvertedLists, IVFSQ) {
+    // code size that is not a multiple of the alignment (12 bytes)
+    test_compact("IVF32,SQ4");
+}
+
+TEST(CompactedInvertedLists, empty_lists) {
+    ArrayInvertedLists ail(10, 3);
+    std::vector<uint8_t> code = {1, 2, 3};
+    ail.add_entry(4, 123, code.data());
+    CompactedInvertedLists cil(ail);
+    for (size_t i = 0; i < 10; i++) {
+        EXPECT_EQ(cil.list_size(i), i == 4 ? 1 : 0);
+    }
+    EXPECT_EQ(cil.get_single_id(4, 0), 123);
+    EXPECT_EQ(cil.get_single_code(4, 0)[2], 3);
+}
@@ -0,0 +1,244 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#include <memory>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexIVF.h>
+#include <faiss/IVFlib.h>
+#include <faiss/index_factory.h>
+#include <faiss/index_io.h>
+#include <faiss/impl/FaissException.h>
+#include <faiss/impl/io.h>
+
+
+namespace {
+
+typedef faiss::Index::idx_t idx_t;
+
+struct Tempfilename {
+
+    static pthread_mutex_t mutex;
+
+    std::string filename;
+
+    Tempfilename (const char *prefix = nullptr) {
+        pthread_mutex_lock (&mutex);
+        char *cfname = tempnam (nullptr, prefix);
+        filename = cfname;
+        free(cfname);
+        pthread_mutex_unlock (&mutex);
+    }
+
+    ~Tempfilename () {
+        if (access (filename.c_str(), F_OK) == 0) {
+            unlink (filename.c_str());
+        }
+    }
+
+    const char *c_str() {
+        return filename.c_str();
+    }
+
+};
+
+pthread_mutex_t Tempfilename::mutex = PTHREAD_MUTEX_INITIALIZER;
+
+int d = 32;
+size_t nb = 2000;
+size_t nq = 20;
+int k = 5;
+
+/// first codec of the build, 0 if there is none
+int first_codec ()
+{
+    for (int codec : {faiss::IO_CODEC_ZSTD, faiss::IO_CODEC_LZ4,
+                      faiss::IO_CODEC_ZLIB}) {
+        if (faiss::io_codec_available (codec)) {
+            return codec;
+        }
+    }
+    return 0;
+}
+
+/// sets compressed_io_block_size for the scope of the object
+struct BlockSizeSetter {
+    size_t old_size;
+
+    explicit BlockSizeSetter (size_t bs):
+        old_size (faiss::compressed_io_block_size) {
+        faiss::compressed_io_block_size = bs;
+    }
+
+    ~BlockSizeSetter () {
+        faiss::compressed_io_block_size = old_size;
+    }
+};
+
+std::vector<float> make_data (size_t n, int seed)
+{
+    std::vector<float> x (n * d);
+    std::mt19937 rng (seed);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < x.size(); i++) {
+        x[i] = distrib (rng);
+    }
+    return x;
+}
+
+std::unique_ptr<faiss::Index> make_index (const char *key)
+{
+    std::vector<float> xb = make_data (nb, 1);
+    std::unique_ptr<faiss::Index> index (faiss::index_factory (d, key));
+    index->train (nb, xb.data());
+    index->add (nb, xb.data());
+    return index;
+}
+
+void compare_search (const faiss::Index & ref, const faiss::Index & index)
+{
+    std::vector<float> xq = make_data (nq, 2);
+    std::vector<float> D_ref (nq * k), D (nq * k);
+    std::vector<idx_t> I_ref (nq * k), I (nq * k);
+    ref.search (nq, xq.data(), k, D_ref.data(), I_ref.data());
+    index.search (nq, xq.data(), k, D.data(), I.data());
+    EXPECT_EQ (I, I_ref);
+    EXPECT_EQ (D, D_ref);
+}
+
+}  // namespace
+
+
+TEST(CompressedIO, stream) {
+    int codec = first_codec ();
+    if (codec == 0) {
+        GTEST_SKIP ();
+    }
+    BlockSizeSetter bss (1000);
+
+    // compressible bytes followed by random (incompressible) bytes
+    std::mt19937 rng (123);
+    std::vector<uint8_t> data (20000);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = i < 12345 ? (i / 7) % 5 : rng ();
+    }
+
+    faiss::VectorIOWriter vw;
+    {
+        faiss::CompressedIOWriter cw (&vw, codec);
+        for (size_t i = 0; i < data.size(); i += 777) {
+            size_t n = std::min (data.size() - i, size_t(777));
+            EXPECT_EQ (n, cw (data.data() + i, 1, n));
+        }
+        cw.finish ();
+        EXPECT_EQ (data.size(), cw.nbytes);
+    }
+    EXPECT_LT (vw.data.size(), data.size());
+
+    faiss::VectorIOReader vr;
+    vr.data = vw.data;
+    faiss::CompressedIOReader cr (&vr);
+    std::vector<uint8_t> data2 (data.size());
+    for (size_t i = 0; i < data.size(); i += 1234) {
+        size_t n = std::min (data.size() - i, size_t(1234));
+        EXPECT_EQ (n, cr (data2.data() + i, 1, n));
+    }
+    cr.finish ();
+    EXPECT_EQ (data, data2);
+    // the reader is at the end of the stream
+    EXPECT_EQ (vr.rp, vr.data.size());
+
+    // truncated stream
+    faiss::VectorIOReader vr2;
+    vr2.data.assign (vw.data.begin(), vw.data.begin() + vw.data.size() / 2);
+    faiss::CompressedIOReader cr2 (&vr2);
+    EXPECT_THROW (cr2 (data2.data(), 1, data2.size()), faiss::FaissException);
+}
+
+TEST(CompressedIO, write_index) {
+    int codec = first_codec ();
+    if (codec == 0) {
+        GTEST_SKIP ();
+    }
+    BlockSizeSetter bss (4096);
+    int io_flags = codec << 8;
+
+    for (const char *key : {"Flat", "IVF16,Flat", "HNSW16"}) {
+        std::unique_ptr<faiss::Index> index = make_index (key);
+        faiss::VectorIOWriter writer;
+        faiss::write_index (index.get(), &writer, io_flags);
+        faiss::VectorIOReader reader;
+        reader.data = writer.data;
+        std::unique_ptr<faiss::Index> index2 (faiss::read_index (&reader));
+        compare_search (*index, *index2);
+        EXPECT_EQ (reader.rp, reader.data.size());
+    }
+
+    // consecutive indexes in a file
+    Tempfilename tmp;
+    std::unique_ptr<faiss::Index> index = make_index ("IVF16,Flat");
+    FILE *f = fopen (tmp.c_str(), "wb");
+    ASSERT_TRUE (f);
+    faiss::write_index (index.get(), f, io_flags);
+    faiss::write_index (index.get(), f);
+    fclose (f);
+
+    f = fopen (tmp.c_str(), "rb");
+    ASSERT_TRUE (f);
+    std::unique_ptr<faiss::Index> index2 (
+          faiss::read_index (f, faiss::IO_FLAG_MMAP));
+    std::unique_ptr<faiss::Index> index3 (faiss::read_index (f));
+    fclose (f);
+    compare_search (*index, *index2);
+    compare_search (*index, *index3);
+}
+
+TEST(CompressedIO, container) {
+    int codec = first_codec ();
+    if (codec == 0) {
+        GTEST_SKIP ();
+    }
+    BlockSizeSetter bss (4096);
+    int io_flags = codec << 8;
+
+    Tempfilename tmp;
+    std::unique_ptr<faiss::Index> index = make_index ("IVF16,SQ8");
+    faiss::write_index_container (index.get(), tmp.c_str(), io_flags);
+
+    std::unique_ptr<faiss::Index> index2 (faiss::read_index (tmp.c_str()));
+    compare_search (*index, *index2);
+
+    // the compressed sections are read instead of being mapped
+    std::unique_ptr<faiss::Index> index3 (
+          faiss::read_index (tmp.c_str(), faiss::IO_FLAG_MMAP));
+    compare_search (*index, *index3);
+
+    // the inverted lists section is not read
+    std::unique_ptr<faiss::Index> index4 (
+          faiss::read_index (tmp.c_str(), faiss::IO_FLAG_SKIP_IVF_DATA));
+    faiss::IndexIVF *ivf = faiss::ivflib::extract_index_ivf (index4.get());
+    EXPECT_EQ (ivf->ntotal, nb);
+    EXPECT_FALSE (ivf->invlists);
+
+    // sequential read
+    faiss::VectorIOWriter writer;
+    faiss::write_index_container (index.get(), &writer, io_flags);
+    faiss::VectorIOReader reader;
+    reader.data = writer.data;
+    reader.data.resize (reader.data.size() + 4);
+    std::unique_ptr<faiss::Index> index5 (faiss::read_index (&reader));
+    compare_search (*index, *index5);
+    EXPECT_EQ (reader.rp, writer.data.size());
+}
@@ -0,0 +1,168 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include <atomic>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/ConcurrentInvertedLists.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVFFlat.h>
+#include <faiss/index_io.h>
+#include <faiss/impl/io.h>
+#include <faiss/utils/distances.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 16;
+size_t nlist = 32;
+size_t nt = 2000;
+size_t nb = 6000;
+size_t nq = 10;
+idx_t k = 5;
+
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector <float> x (n * d);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < n * d; i++) {
+        x[i] = distrib(rng);
+    }
+    return x;
+}
+
+} // namespace
+
+
+TEST(ConcurrentInvertedLists, add_entries) {
+    ConcurrentInvertedLists cil(4, 3);
+    cil.min_capacity = 2;
+    for (int i = 0; i < 100; i++) {
+        uint8_t code[3] = {uint8_t(i), uint8_t(i + 1), uint8_t(i + 2)};
+        EXPECT_EQ(cil.add_entry(i % 4, i, code), i / 4);
+    }
+    EXPECT_GT(cil.retired_bytes(), 0);
+    for (int i = 0; i < 100; i++) {
+        EXPECT_EQ(cil.get_single_id(i % 4, i / 4), i);
+        EXPECT_EQ(cil.get_single_code(i % 4, i / 4)[2], uint8_t(i + 2));
+    }
+    cil.reclaim_memory();
+    EXPECT_EQ(cil.retired_bytes(), 0);
+    EXPECT_EQ(cil.compute_ntotal(), 100);
+
+    cil.resize(1, 30);
+    EXPECT_EQ(cil.list_size(1), 30);
+    EXPECT_EQ(cil.get_single_id(1, 29), 0);
+    EXPECT_EQ(cil.get_single_id(1, 24), 97);
+}
+
+
+TEST(ConcurrentInvertedLists, add_while_searching) {
+    std::vector<float> xt = make_data(nt, 1);
+    std::vector<float> xb = make_data(nb, 2);
+    std::vector<float> xq = make_data(nq, 3);
+
+    IndexFlatL2 quantizer(d);
+    IndexIVFFlat index(&quantizer, d, nlist);
+    index.train(nt, xt.data());
+    index.replace_invlists(
+          new ConcurrentInvertedLists(nlist, index.code_size), true);
+    index.nprobe = 4;
+
+    std::vector<idx_t> ids(nb);
+    for (size_t i = 0; i < nb; i++) {
+        ids[i] = i;
+    }
+
+    std::atomic<bool> done(false);
+    std::atomic<int> nerr(0);
+    std::atomic<int> nsearch(0);
+
+    auto reader = [&] () {
+        std::vector<float> D(nq * k);
+        std::vector<idx_t> I(nq * k);
+        while (!done.load()) {
+            index.search(nq, xq.data(), k, D.data(), I.data());
+            for (size_t i = 0; i < nq * k; i++) {
+                idx_t id = I[i];
+                if (id == -1) {
+                    continue;
+                }
+                if (id < 0 || id >= nb) {
+                    nerr++;
+                    continue;
+                }
+                float dis = fvec_L2sqr(xq.data() + i / k * d,
+                                       xb.data() + id * d, d);
+                if (std::fabs(dis - D[i]) > 1e-4) {
+                    nerr++;
+                }
+            }
+            nsearch++;
+        }
+    };
+
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 3; i++) {
+        readers.emplace_back(reader);
+    }
+
+    size_t bs = 100;
+    for (size_t i0 = 0; i0 < nb; i0 += bs) {
+        index.add_with_ids(bs, xb.data() + i0 * d, ids.data() + i0);
+    }
+    done = true;
+    for (auto & t: readers) {
+        t.join();
+    }
+
+    EXPECT_EQ(nerr.load(), 0);
+    EXPECT_GT(nsearch.load(), 0);
+    EXPECT_EQ(index.ntotal, nb);
+    EXPECT_EQ(index.invlists->compute_ntotal(), nb);
+
+    // after the adds, same results as an index built in one go
+    IndexFlatL2 quantizer_ref(d);
+    IndexIVFFlat index_ref(&quantizer_ref, d, nlist);
+    index_ref.train(nt, xt.data());
+    index_ref.add(nb, xb.data());
+    index_ref.nprobe = 4;
+
+    std::vector<float> D(nq * k), D_ref(nq * k);
+    std::vector<idx_t> I(nq * k), I_ref(nq * k);
+    index.search(nq, xq.data(), k, D.data(), I.data());
+    index_ref.search(nq, xq.data(), k, D_ref.data(), I_ref.data());
+    EXPECT_EQ(I, I_ref);
+    EXPECT_EQ(D, D_ref);
+
+    // stored as ArrayInvertedLists
+    VectorIOWriter wr;
+    write_index(&index, &wr);
+    VectorIOReader rd;
+    rd.data = wr.data;
+    std::unique_ptr<Index> index2(read_index(&rd));
+    IndexIVF *ivf2 = dynamic_cast<IndexIVF*>(index2.get());
+    ASSERT_TRUE(ivf2);
+    EXPECT_TRUE(dynamic_cast<ArrayInvertedLists*>(ivf2->invlists));
+    ivf2->nprobe = 4;
+    ivf2->search(nq, xq.data(), k, D.data(), I.data());
+    EXPECT_EQ(I, I_ref);
+}
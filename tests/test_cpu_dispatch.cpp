@@ -0,0 +1,280 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/FaissException.h>
+#include <faiss/impl/ScalarQuantizer.h>
+#include <faiss/utils/cpu_dispatch.h>
+#include <faiss/utils/distances.h>
+
+
+using namespace faiss;
+
+namespace {
+
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector <float> x (n);
+    std::uniform_real_distribution<> distrib(-1, 1);
+    for (size_t i = 0; i < n; i++) {
+        x[i] = distrib(rng);
+    }
+    return x;
+}
+
+// sets the SIMD level for the scope of the object
+struct ScopedSIMDLevel {
+    SIMDLevel prev;
+    explicit ScopedSIMDLevel(SIMDLevel level): prev(get_simd_level()) {
+        set_simd_level(level);
+    }
+    ~ScopedSIMDLevel() {
+        set_simd_level(prev);
+    }
+};
+
+// the levels to compare with SIMD_GENERIC
+std::vector<SIMDLevel> test_levels()
+{
+    std::vector<SIMDLevel> levels;
+    SIMDLevel best = supported_simd_level();
+    if (best == SIMD_AVX2 || best == SIMD_AVX512) {
+        levels.push_back(SIMD_AVX2);
+    }
+    if (best == SIMD_AVX512) {
+        levels.push_back(SIMD_AVX512);
+    }
+    if (levels.empty()) {
+        printf("no SIMD level to compare with on this CPU\n");
+    }
+    return levels;
+}
+
+} // namespace
+
+
+TEST(CPUDispatch, set_level) {
+    SIMDLevel best = supported_simd_level();
+    EXPECT_EQ(strcmp(simd_level_name(SIMD_AVX512), "avx512"), 0);
+    if (best != SIMD_NEON) {
+        ScopedSIMDLevel level(SIMD_GENERIC);
+        EXPECT_EQ(get_simd_level(), SIMD_GENERIC);
+        EXPECT_FALSE(use_avx512());
+        EXPECT_THROW(set_simd_level(SIMD_NEON), FaissException);
+    }
+    if (best != SIMD_AVX512) {
+        EXPECT_THROW(set_simd_level(SIMD_AVX512), FaissException);
+    }
+}
+
+
+TEST(CPUDispatch, fvec_distances) {
+    for (SIMDLevel simd: test_levels()) {
+        for (size_t d: {1, 3, 8, 12, 15, 16, 17, 31, 32, 33, 100, 128}) {
+            size_t ny = 50;
+            std::vector<float> x = make_data(d, 1);
+            std::vector<float> y = make_data(d * ny, 2);
+
+            std::vector<float> l2(ny), ip(ny), l2ny(ny);
+            {
+                ScopedSIMDLevel level(simd);
+                for (size_t i = 0; i < ny; i++) {
+                    l2[i] = fvec_L2sqr(x.data(), y.data() + i * d, d);
+                    ip[i] = fvec_inner_product(x.data(), y.data() + i * d, d);
+                }
+                fvec_L2sqr_ny(l2ny.data(), x.data(), y.data(), d, ny);
+            }
+
+            ScopedSIMDLevel level(SIMD_GENERIC);
+            std::vector<float> l2ny_ref(ny);
+            fvec_L2sqr_ny(l2ny_ref.data(), x.data(), y.data(), d, ny);
+            for (size_t i = 0; i < ny; i++) {
+                float l2_ref = fvec_L2sqr(x.data(), y.data() + i * d, d);
+                float ip_ref = fvec_inner_product(
+                        x.data(), y.data() + i * d, d);
+                EXPECT_NEAR(l2[i], l2_ref, 1e-5 * d);
+                EXPECT_NEAR(ip[i], ip_ref, 1e-5 * d);
+                EXPECT_NEAR(l2ny[i], l2ny_ref[i], 1e-5 * d);
+            }
+        }
+    }
+}
+
+
+// the contiguous kernels give the same results as fvec_L2sqr /
+// fvec_inner_product and fvec_*_batch_4 on each vector, also for the
+// dimensions that have specialized kernels
+TEST(CPUDispatch, fvec_ny_batch_4) {
+    std::vector<SIMDLevel> levels = test_levels();
+    levels.push_back(SIMD_GENERIC);
+    for (SIMDLevel simd: levels) {
+        ScopedSIMDLevel level(simd);
+        for (size_t d: {3, 8, 12, 16, 17, 64, 96, 100, 128, 256, 1024}) {
+            size_t ny = 51;
+            std::vector<float> x = make_data(d, 1);
+            std::vector<float> y = make_data(d * ny, 2);
+
+            std::vector<float> l2(ny), ip(ny), l2_ref(ny), ip_ref(ny);
+            fvec_L2sqr_ny_batch_4(l2.data(), x.data(), y.data(), d, ny);
+            fvec_inner_products_ny_batch_4(
+                    ip.data(), x.data(), y.data(), d, ny);
+
+            for (size_t j = 0; j < ny; j++) {
+                l2_ref[j] = fvec_L2sqr(x.data(), y.data() + j * d, d);
+                ip_ref[j] = fvec_inner_product(x.data(), y.data() + j * d, d);
+            }
+            EXPECT_EQ(l2, l2_ref) << "d=" << d;
+            EXPECT_EQ(ip, ip_ref) << "d=" << d;
+
+            // same with the groups of 4 at an offset of 1
+            for (size_t j = 1; j + 4 <= ny; j += 4) {
+                const float *yj = y.data() + j * d;
+                float l2b[4], ipb[4];
+                fvec_L2sqr_batch_4(x.data(), yj, yj + d, yj + 2 * d,
+                                   yj + 3 * d, d, l2b[0], l2b[1],
+                                   l2b[2], l2b[3]);
+                fvec_inner_product_batch_4(
+                        x.data(), yj, yj + d, yj + 2 * d, yj + 3 * d, d,
+                        ipb[0], ipb[1], ipb[2], ipb[3]);
+                for (size_t b = 0; b < 4; b++) {
+                    EXPECT_EQ(l2b[b], l2_ref[j + b]) << "d=" << d;
+                    EXPECT_EQ(ipb[b], ip_ref[j + b]) << "d=" << d;
+                }
+            }
+        }
+    }
+}
+
+
+namespace {
+
+void test_sq_level(SIMDLevel simd,
+                   ScalarQuantizer::QuantizerType qtype, size_t d)
+{
+    size_t n = 200;
+    std::vector<float> x = make_data(n * d, 3);
+    if (qtype == ScalarQuantizer::QT_8bit_direct) {
+        for (size_t i = 0; i < n * d; i++) {
+            x[i] = std::floor((x[i] + 1) * 127);
+        }
+    } else if (qtype == ScalarQuantizer::QT_8bit_direct_signed) {
+        for (size_t i = 0; i < n * d; i++) {
+            x[i] = std::floor(x[i] * 127);
+        }
+    }
+
+    ScalarQuantizer sq(d, qtype);
+    sq.train(n, x.data());
+
+    std::unique_ptr<ScopedSIMDLevel> level(new ScopedSIMDLevel(simd));
+    std::vector<uint8_t> codes(n * sq.code_size);
+    std::vector<float> decoded(n * d);
+    sq.compute_codes(x.data(), codes.data(), n);
+    sq.decode(codes.data(), decoded.data(), n);
+
+    std::vector<float> dis[2];
+    for (MetricType metric: {METRIC_L2, METRIC_INNER_PRODUCT}) {
+        std::unique_ptr<ScalarQuantizer::SQDistanceComputer> dc(
+                sq.get_distance_computer(metric));
+        dc->codes = codes.data();
+        dc->code_size = sq.code_size;
+        dc->set_query(x.data());
+        for (size_t i = 0; i < n; i++) {
+            dis[metric].push_back((*dc)(i));
+            dis[metric].push_back(dc->symmetric_dis(1, i));
+        }
+    }
+
+    level.reset(new ScopedSIMDLevel(SIMD_GENERIC));
+    std::vector<uint8_t> codes_ref(n * sq.code_size);
+    std::vector<float> decoded_ref(n * d);
+    sq.compute_codes(x.data(), codes_ref.data(), n);
+    sq.decode(codes_ref.data(), decoded_ref.data(), n);
+
+    EXPECT_EQ(codes, codes_ref);
+    for (size_t i = 0; i < n * d; i++) {
+        EXPECT_NEAR(decoded[i], decoded_ref[i], 1e-5);
+    }
+
+    for (MetricType metric: {METRIC_L2, METRIC_INNER_PRODUCT}) {
+        std::unique_ptr<ScalarQuantizer::SQDistanceComputer> dc(
+                sq.get_distance_computer(metric));
+        dc->codes = codes.data();
+        dc->code_size = sq.code_size;
+        dc->set_query(x.data());
+        for (size_t i = 0; i < n; i++) {
+            float tol = 1e-4 * d;
+            EXPECT_NEAR(dis[metric][2 * i], (*dc)(i), tol);
+            EXPECT_NEAR(dis[metric][2 * i + 1], dc->symmetric_dis(1, i), tol);
+        }
+    }
+}
+
+void test_sq(ScalarQuantizer::QuantizerType qtype, size_t d)
+{
+    for (SIMDLevel simd: test_levels()) {
+        test_sq_level(simd, qtype, d);
+    }
+}
+
+} // namespace
+
+
+TEST(CPUDispatch, SQ8) {
+    test_sq(ScalarQuantizer::QT_8bit, 32);
+}
+
+TEST(CPUDispatch, SQ8_uniform) {
+    test_sq(ScalarQuantizer::QT_8bit_uniform, 48);
+}
+
+TEST(CPUDispatch, SQ4) {
+    test_sq(ScalarQuantizer::QT_4bit, 32);
+}
+
+TEST(CPUDispatch, SQ4_uniform) {
+    test_sq(ScalarQuantizer::QT_4bit_uniform, 16);
+}
+
+TEST(CPUDispatch, SQ6) {
+    test_sq(ScalarQuantizer::QT_6bit, 32);
+}
+
+TEST(CPUDispatch, SQfp16) {
+    test_sq(ScalarQuantizer::QT_fp16, 64);
+}
+
+TEST(CPUDispatch, SQ8_direct) {
+    // 16 and 32-byte loads of DistanceComputerByte
+    test_sq(ScalarQuantizer::QT_8bit_direct, 48);
+}
+
+TEST(CPUDispatch, SQ8_direct_signed) {
+    // the integer kernels handle the 8 last components in scalar
+    test_sq(ScalarQuantizer::QT_8bit_direct_signed, 40);
+}
+
+TEST(CPUDispatch, SQ4_lloyd) {
+    test_sq(ScalarQuantizer::QT_4bit_lloyd, 32);
+}
+
+TEST(CPUDispatch, SQ3_vbits) {
+    // 3 * 48 bits: the last components are decoded with the scalar code
+    test_sq(ScalarQuantizer::QT_3bit_vbits, 48);
+}
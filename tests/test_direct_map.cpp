@@ -0,0 +1,173 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/DirectMap.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVFFlat.h>
+#include <faiss/MetaIndexes.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/io.h>
+#include <faiss/index_io.h>
+#include <faiss/utils/random.h>
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 16;
+size_t nb = 5000;
+
+std::vector<float> make_data (size_t n, int seed)
+{
+    std::vector<float> x (n * d);
+    float_rand (x.data(), x.size(), seed);
+    return x;
+}
+
+/// random non-sequential ids
+std::vector<idx_t> make_ids (size_t n, int seed)
+{
+    std::vector<idx_t> ids (n);
+    for (size_t i = 0; i < n; i++) {
+        ids[i] = i * 1000003 + 12345678;
+    }
+    std::mt19937 rng (seed);
+    std::shuffle (ids.begin(), ids.end(), rng);
+    return ids;
+}
+
+void check_reconstruct (const Index & index, const std::vector<idx_t> & ids,
+                        const std::vector<float> & x)
+{
+    std::vector<float> recons (d);
+    for (size_t i = 0; i < x.size() / d; i += 7) {
+        index.reconstruct (ids[i], recons.data());
+        for (int j = 0; j < d; j++) {
+            ASSERT_EQ (recons[j], x[i * d + j]);
+        }
+    }
+}
+
+}  // namespace
+
+
+TEST(CompactIdMap, vs_unordered_map) {
+    CompactIdMap cm;
+    std::unordered_map<idx_t, idx_t> ref;
+    std::mt19937 rng (123);
+    for (int iter = 0; iter < 100000; iter++) {
+        idx_t id = rng () % 20000;
+        int op = rng () % 4;
+        if (op < 2) {
+            idx_t v = rng () % 1000;
+            cm.set (id, v);
+            ref [id] = v;
+        } else if (op == 2) {
+            EXPECT_EQ (cm.erase (id), ref.erase (id) > 0);
+        } else {
+            auto it = ref.find (id);
+            EXPECT_EQ (cm.get (id), it == ref.end() ? -1 : it->second);
+        }
+        if (iter % 30000 == 0) {
+            cm.merge ();
+        }
+    }
+    EXPECT_EQ (cm.size(), ref.size());
+
+    std::vector<std::pair<idx_t, idx_t> > entries;
+    cm.get_entries (entries);
+    ASSERT_EQ (entries.size(), ref.size());
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (i > 0) {
+            EXPECT_LT (entries[i - 1].first, entries[i].first);
+        }
+        EXPECT_EQ (ref.at (entries[i].first), entries[i].second);
+    }
+}
+
+TEST(DirectMap, compact_ivf) {
+    std::vector<float> x = make_data (nb, 1);
+    std::vector<idx_t> ids = make_ids (nb, 2);
+
+    IndexFlatL2 quantizer (d);
+    IndexIVFFlat index (&quantizer, d, 32);
+    index.train (nb, x.data());
+    index.set_direct_map_type (DirectMap::Compact);
+    index.add_with_ids (nb / 2, x.data(), ids.data());
+    check_reconstruct (index, ids, std::vector<float> (x.begin(),
+                       x.begin() + nb / 2 * d));
+    index.add_with_ids (nb - nb / 2, x.data() + nb / 2 * d,
+                        ids.data() + nb / 2);
+    check_reconstruct (index, ids, x);
+
+    // the map can also be built from the inverted lists
+    index.set_direct_map_type (DirectMap::NoMap);
+    index.set_direct_map_type (DirectMap::Compact);
+    check_reconstruct (index, ids, x);
+
+    // update vectors in place
+    std::vector<float> x2 = make_data (100, 3);
+    index.update_vectors (100, ids.data(), x2.data());
+    std::copy (x2.begin(), x2.end(), x.begin());
+    check_reconstruct (index, ids, x);
+
+    // remove the first half
+    IDSelectorArray sel (nb / 2, ids.data());
+    EXPECT_EQ (index.remove_ids (sel), nb / 2);
+    EXPECT_EQ (index.ntotal, nb - nb / 2);
+    std::vector<float> recons (d);
+    EXPECT_THROW (index.reconstruct (ids[0], recons.data()), FaissException);
+    std::vector<idx_t> ids2 (ids.begin() + nb / 2, ids.end());
+    std::vector<float> xr (x.begin() + nb / 2 * d, x.end());
+    check_reconstruct (index, ids2, xr);
+
+    // IO round-trip
+    VectorIOWriter writer;
+    write_index (&index, &writer);
+    VectorIOReader reader;
+    reader.data = writer.data;
+    std::unique_ptr<IndexIVF> index2 (
+        dynamic_cast<IndexIVF*> (read_index (&reader)));
+    EXPECT_EQ (index2->direct_map.type, DirectMap::Compact);
+    EXPECT_EQ (index2->direct_map.compact.size(), nb - nb / 2);
+    check_reconstruct (*index2, ids2, xr);
+}
+
+TEST(DirectMap, compact_idmap2) {
+    std::vector<float> x = make_data (nb, 4);
+    std::vector<idx_t> ids = make_ids (nb, 5);
+
+    IndexFlatL2 sub (d);
+    IndexIDMap2 index (&sub);
+    index.set_compact_rev_map (true);
+    index.add_with_ids (nb, x.data(), ids.data());
+    EXPECT_TRUE (index.rev_map.empty());
+    EXPECT_EQ (index.compact_rev_map.size(), nb);
+    check_reconstruct (index, ids, x);
+
+    IDSelectorRange sel (0, ids[0]);
+    size_t nremove = index.remove_ids (sel);
+    std::vector<idx_t> ids2;
+    std::vector<float> x2;
+    for (size_t i = 0; i < nb; i++) {
+        if (ids[i] >= ids[0]) {
+            ids2.push_back (ids[i]);
+            x2.insert (x2.end(), x.begin() + i * d, x.begin() + (i + 1) * d);
+        }
+    }
+    EXPECT_EQ (nremove + ids2.size(), nb);
+    check_reconstruct (index, ids2, x2);
+}
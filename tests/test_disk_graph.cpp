@@ -0,0 +1,187 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexDiskGraph.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexNSG.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/FaissException.h>
+#include <faiss/index_io.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 32;
+size_t nb = 5000;
+size_t nq = 50;
+idx_t k = 10;
+
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector<float> x(n * d);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < n * d; i++) {
+        x[i] = distrib(rng);
+    }
+    return x;
+}
+
+std::string temp_name()
+{
+    char fname[] = "/tmp/faiss_test_disk_graph_XXXXXX";
+    int fd = mkstemp(fname);
+    EXPECT_GE(fd, 0);
+    close(fd);
+    return fname;
+}
+
+/// 1-recall@k
+double recall(const std::vector<idx_t>& I, const std::vector<idx_t>& I_ref)
+{
+    size_t nok = 0;
+    for (size_t q = 0; q < nq; q++) {
+        if (std::find(I.begin() + q * k, I.begin() + (q + 1) * k,
+                      I_ref[q]) != I.begin() + (q + 1) * k) {
+            nok++;
+        }
+    }
+    return nok / double(nq);
+}
+
+} // namespace
+
+
+TEST(DiskGraph, build_search) {
+    std::vector<float> xb = make_data(nb, 1);
+    std::vector<float> xq = make_data(nq, 2);
+
+    for (MetricType metric: {METRIC_L2, METRIC_INNER_PRODUCT}) {
+        IndexFlat ref(d, metric);
+        ref.add(nb, xb.data());
+        std::vector<float> D_ref(nq);
+        std::vector<idx_t> I_ref(nq);
+        ref.search(nq, xq.data(), 1, D_ref.data(), I_ref.data());
+
+        std::string fname = temp_name();
+        IndexDiskGraph index(d, 8, 32, metric);
+        index.train(nb, xb.data());
+        index.build(nb, xb.data(), fname.c_str());
+        EXPECT_EQ(index.ntotal, nb);
+
+        std::vector<float> D(nq * k);
+        std::vector<idx_t> I(nq * k);
+        diskgraph_stats.reset();
+        index.search(nq, xq.data(), k, D.data(), I.data());
+        EXPECT_GT(recall(I, I_ref), 0.9);
+        EXPECT_EQ(diskgraph_stats.nq, nq);
+        EXPECT_GT(diskgraph_stats.nread, 0);
+        // the beam reads several nodes per hop
+        EXPECT_GT(diskgraph_stats.nread, 2 * diskgraph_stats.nhops);
+
+        // the distances are exact
+        for (size_t q = 0; q < nq; q++) {
+            if (I[q * k] == I_ref[q]) {
+                EXPECT_NEAR(D[q * k], D_ref[q], 1e-4);
+            }
+        }
+
+        // a wider beam does not lose recall
+        index.beam_width = 8;
+        index.search_L = 128;
+        std::vector<idx_t> I2(nq * k);
+        index.search(nq, xq.data(), k, D.data(), I2.data());
+        EXPECT_GE(recall(I2, I_ref), recall(I, I_ref));
+
+        std::vector<float> recons(d);
+        index.reconstruct(12, recons.data());
+        EXPECT_EQ(recons, std::vector<float>(xb.begin() + 12 * d,
+                                             xb.begin() + 13 * d));
+
+        unlink(fname.c_str());
+    }
+}
+
+
+TEST(DiskGraph, selector_and_io) {
+    std::vector<float> xb = make_data(nb, 1);
+    std::vector<float> xq = make_data(nq, 2);
+
+    std::string fname = temp_name();
+    IndexDiskGraph index(d, 8, 32);
+    index.train(nb, xb.data());
+    index.build(nb, xb.data(), fname.c_str());
+
+    std::vector<float> D(nq * k), D2(nq * k);
+    std::vector<idx_t> I(nq * k), I2(nq * k);
+
+    IDSelectorRange sel(0, nb / 2);
+    SearchParameters params;
+    params.sel = &sel;
+    index.search(nq, xq.data(), k, D.data(), I.data(), &params);
+    for (idx_t i: I) {
+        EXPECT_TRUE(i >= 0 && i < nb / 2);
+    }
+
+    index.search(nq, xq.data(), k, D.data(), I.data());
+    std::string iname = temp_name();
+    write_index(&index, iname.c_str());
+    std::unique_ptr<Index> index2(read_index(iname.c_str()));
+    ASSERT_TRUE(dynamic_cast<IndexDiskGraph*>(index2.get()));
+    index2->search(nq, xq.data(), k, D2.data(), I2.data());
+    EXPECT_EQ(I, I2);
+    EXPECT_EQ(D, D2);
+
+    EXPECT_THROW(index.add(nb, xb.data()), FaissException);
+
+    unlink(iname.c_str());
+    unlink(fname.c_str());
+}
+
+
+TEST(DiskGraph, from_nsg) {
+    std::vector<float> xb = make_data(nb, 1);
+    std::vector<float> xq = make_data(nq, 2);
+
+    IndexFlatL2 ref(d);
+    ref.add(nb, xb.data());
+    std::vector<float> D_ref(nq);
+    std::vector<idx_t> I_ref(nq);
+    ref.search(nq, xq.data(), 1, D_ref.data(), I_ref.data());
+
+    IndexNSGFlat nsg(d, 32);
+    nsg.add(nb, xb.data());
+
+    // records larger than a block
+    std::string fname = temp_name();
+    IndexDiskGraph index(d, 8, 1100);
+    index.train(nb, xb.data());
+    EXPECT_GT(index.record_size, IndexDiskGraph::block_size);
+    index.build_from(&nsg, fname.c_str());
+
+    std::vector<float> D(nq * k);
+    std::vector<idx_t> I(nq * k);
+    index.search(nq, xq.data(), k, D.data(), I.data());
+    EXPECT_GT(recall(I, I_ref), 0.9);
+
+    unlink(fname.c_str());
+}
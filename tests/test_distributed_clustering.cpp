@@ -0,0 +1,234 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <exception>
+#include <functional>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/Clustering.h>
+#include <faiss/ClusteringCommTCP.h>
+#include <faiss/IndexFlat.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+size_t d = 8;
+size_t n = 6000;
+int nworker = 3;
+
+// points around ncl random centers
+std::vector<float> make_blobs(size_t n, size_t ncl, int seed)
+{
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> noise(0, 0.1);
+    std::uniform_real_distribution<float> distrib(-1, 1);
+    std::vector<float> centers(ncl * d);
+    for (auto & c: centers) {
+        c = distrib(rng);
+    }
+    std::vector<float> x(n * d);
+    for (size_t i = 0; i < n; i++) {
+        size_t c = rng() % ncl;
+        for (size_t j = 0; j < d; j++) {
+            x[i * d + j] = centers[c * d + j] + noise(rng);
+        }
+    }
+    return x;
+}
+
+float quantization_error(size_t n, const float *x,
+                         const std::vector<float> & centroids)
+{
+    IndexFlatL2 index(d);
+    index.add(centroids.size() / d, centroids.data());
+    std::vector<float> dis(n);
+    std::vector<idx_t> assign(n);
+    index.search(n, x, 1, dis.data(), assign.data());
+    float obj = 0;
+    for (float di: dis) {
+        obj += di;
+    }
+    return obj;
+}
+
+/// run f(comm, i0, i1) in nworker threads connected over localhost,
+/// worker r gets the slice [i0, i1) of the n vectors
+void run_workers(std::function<void(ClusteringComm &, size_t, size_t)> f)
+{
+    ClusteringCommTCP comm0(0, nworker, "localhost", 0);
+    std::vector<std::exception_ptr> errors(nworker);
+    std::vector<std::thread> threads;
+    for (int r = 0; r < nworker; r++) {
+        threads.emplace_back([&, r] () {
+            try {
+                std::unique_ptr<ClusteringCommTCP> comm;
+                if (r > 0) {
+                    comm.reset(new ClusteringCommTCP(
+                          r, nworker, "localhost", comm0.port));
+                }
+                ClusteringCommTCP & c = r == 0 ? comm0 : *comm;
+                c.connect();
+                f(c, n * r / nworker, n * (r + 1) / nworker);
+            } catch (...) {
+                errors[r] = std::current_exception();
+            }
+        });
+    }
+    for (auto & t: threads) {
+        t.join();
+    }
+    for (auto & e: errors) {
+        if (e) {
+            std::rethrow_exception(e);
+        }
+    }
+}
+
+} // namespace
+
+
+TEST(DistributedClustering, kmeans) {
+    size_t k = 20;
+    std::vector<float> x = make_blobs(n, k, 123);
+
+    Clustering clus_ref(d, k);
+    clus_ref.max_points_per_centroid = n;
+    IndexFlatL2 index_ref(d);
+    clus_ref.train(n, x.data(), index_ref);
+    float err_ref = quantization_error(n, x.data(), clus_ref.centroids);
+
+    std::vector<std::vector<float> > centroids(nworker);
+    std::vector<float> objs(nworker);
+    run_workers([&] (ClusteringComm & comm, size_t i0, size_t i1) {
+        Clustering clus(d, k);
+        clus.max_points_per_centroid = n;
+        IndexFlatL2 index(d);
+        clus.train_distributed(i1 - i0, x.data() + i0 * d, index, comm);
+        centroids[comm.rank] = clus.centroids;
+        objs[comm.rank] = clus.iteration_stats.back().obj;
+        EXPECT_EQ(k, index.ntotal);
+    });
+
+    // all the workers have the same centroids and the global objective
+    for (int r = 1; r < nworker; r++) {
+        EXPECT_EQ(centroids[0], centroids[r]);
+        EXPECT_EQ(objs[0], objs[r]);
+    }
+    // the objective is measured before the last centroid update
+    float err = quantization_error(n, x.data(), centroids[0]);
+    EXPECT_LE(err, objs[0] * 1.001);
+    EXPECT_GT(err, objs[0] * 0.9);
+    EXPECT_LT(err, 1.2 * err_ref);
+}
+
+TEST(DistributedClustering, single_worker) {
+    // one worker: same initialization as the local k-means
+    size_t k = 20;
+    std::vector<float> x = make_blobs(n, k, 1234);
+
+    Clustering clus_ref(d, k);
+    IndexFlatL2 index_ref(d);
+    clus_ref.train(n, x.data(), index_ref);
+
+    ClusteringCommTCP comm(0, 1, "localhost", 0);
+    comm.connect();
+    Clustering clus(d, k);
+    IndexFlatL2 index(d);
+    clus.train_distributed(n, x.data(), index, comm);
+
+    float err_ref = quantization_error(n, x.data(), clus_ref.centroids);
+    float err = quantization_error(n, x.data(), clus.centroids);
+    EXPECT_NEAR(err, err_ref, 1e-3 * err_ref);
+}
+
+TEST(DistributedClustering, minibatch) {
+    size_t k = 20;
+    std::vector<float> x = make_blobs(n, k, 345);
+
+    // with one worker, the batch updates give the same running means
+    // as the updates of train_minibatch
+    Clustering clus_ref(d, k);
+    clus_ref.batch_size = 256;
+    clus_ref.niter = 5;
+    IndexFlatL2 index_ref(d);
+    clus_ref.train_minibatch(n, x.data(), index_ref);
+    {
+        ClusteringCommTCP comm(0, 1, "localhost", 0);
+        comm.connect();
+        Clustering clus(d, k);
+        clus.batch_size = 256;
+        IndexFlatL2 index(d);
+        ClusteringDataSourceArray source(d, n, x.data(), 5, clus.seed + 1);
+        clus.train_minibatch_distributed(source, index, comm);
+        ASSERT_EQ(clus_ref.centroids.size(), clus.centroids.size());
+        for (size_t i = 0; i < clus.centroids.size(); i++) {
+            EXPECT_NEAR(clus_ref.centroids[i], clus.centroids[i], 1e-4);
+        }
+    }
+
+    std::vector<std::vector<float> > centroids(nworker);
+    std::vector<size_t> nbatch(nworker);
+    run_workers([&] (ClusteringComm & comm, size_t i0, size_t i1) {
+        Clustering clus(d, k);
+        clus.batch_size = 256;
+        IndexFlatL2 index(d);
+        ClusteringDataSourceArray source(
+              d, i1 - i0, x.data() + i0 * d, 5, 1234 + comm.rank);
+        clus.train_minibatch_distributed(source, index, comm);
+        centroids[comm.rank] = clus.centroids;
+        nbatch[comm.rank] = clus.iteration_stats.size();
+    });
+
+    for (int r = 1; r < nworker; r++) {
+        EXPECT_EQ(centroids[0], centroids[r]);
+        EXPECT_EQ(nbatch[0], nbatch[r]);
+    }
+    // 5 passes over 2000 vectors per worker
+    EXPECT_EQ((5 * 2000 + 255) / 256, nbatch[0]);
+}
+
+TEST(DistributedClustering, hierarchical) {
+    size_t k = 64;
+    std::vector<float> x = make_blobs(n, 100, 567);
+
+    HierarchicalClustering hc_ref(d, k);
+    IndexFlatL2 index_ref(d);
+    hc_ref.train(n, x.data(), index_ref);
+    float err_ref = quantization_error(n, x.data(), hc_ref.centroids);
+
+    std::vector<std::vector<float> > centroids(nworker);
+    std::vector<std::vector<size_t> > sub_k(nworker);
+    run_workers([&] (ClusteringComm & comm, size_t i0, size_t i1) {
+        HierarchicalClustering hc(d, k);
+        IndexFlatL2 index(d);
+        hc.train_distributed(i1 - i0, x.data() + i0 * d, index, comm);
+        centroids[comm.rank] = hc.centroids;
+        sub_k[comm.rank] = hc.sub_k;
+        EXPECT_EQ(k, index.ntotal);
+    });
+
+    for (int r = 1; r < nworker; r++) {
+        EXPECT_EQ(centroids[0], centroids[r]);
+        EXPECT_EQ(sub_k[0], sub_k[r]);
+    }
+    size_t ksum = 0;
+    for (size_t ki: sub_k[0]) {
+        ksum += ki;
+    }
+    EXPECT_EQ(k, ksum);
+    float err = quantization_error(n, x.data(), centroids[0]);
+    EXPECT_LT(err, 1.2 * err_ref);
+}
@@ -0,0 +1,145 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVFFlat.h>
+#include <faiss/IndexPreTransform.h>
+#include <faiss/VectorTransform.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/index_factory.h>
+#include <faiss/utils/distances.h>
+#include <faiss/utils/random.h>
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 96;
+size_t nb = 4000;
+size_t nq = 30;
+idx_t k = 10;
+
+/// the variance decreases with the dimension, as after a PCA
+std::vector<float> make_data (size_t n, int seed)
+{
+    std::vector<float> x (n * d);
+    float_randn (x.data(), x.size(), seed);
+    for (size_t i = 0; i < n; i++) {
+        for (int j = 0; j < d; j++) {
+            x[i * d + j] *= std::exp (-j / 16.0);
+        }
+    }
+    return x;
+}
+
+void expect_same_results (const std::vector<float> & Dref,
+                          const std::vector<idx_t> & Iref,
+                          const std::vector<float> & D,
+                          const std::vector<idx_t> & I)
+{
+    EXPECT_EQ (Iref, I);
+    for (size_t i = 0; i < Dref.size(); i++) {
+        EXPECT_NEAR (Dref[i], D[i], 1e-4 * (1 + Dref[i]));
+    }
+}
+
+} // namespace
+
+
+TEST(EarlyAbort, kernel) {
+    std::vector<float> x = make_data (2, 1);
+    const float *x0 = x.data(), *x1 = x.data() + d;
+    float ref = fvec_L2sqr (x0, x1, d);
+    EXPECT_NEAR (fvec_L2sqr_early_abort (x0, x1, d, HUGE_VALF, 32),
+                 ref, 1e-5 * ref);
+    // d is not a multiple of the block size
+    EXPECT_NEAR (fvec_L2sqr_early_abort (x0, x1, d, HUGE_VALF, 40),
+                 ref, 1e-5 * ref);
+    float partial = fvec_L2sqr_early_abort (x0, x1, d, ref / 10, 32);
+    EXPECT_GT (partial, ref / 10);
+    EXPECT_LE (partial, ref * (1 + 1e-5));
+}
+
+TEST(EarlyAbort, IndexFlat) {
+    std::vector<float> xb = make_data (nb, 2);
+    std::vector<float> xq = make_data (nq, 3);
+    IndexFlatL2 index (d);
+    index.add (nb, xb.data());
+
+    std::vector<float> Dref (nq * k), D (nq * k);
+    std::vector<idx_t> Iref (nq * k), I (nq * k);
+    index.search (nq, xq.data(), k, Dref.data(), Iref.data());
+    index.early_abort_block = 32;
+    index.search (nq, xq.data(), k, D.data(), I.data());
+    expect_same_results (Dref, Iref, D, I);
+}
+
+TEST(EarlyAbort, IndexIVFFlat) {
+    std::vector<float> xb = make_data (nb, 2);
+    std::vector<float> xq = make_data (nq, 3);
+    IndexFlatL2 quantizer (d);
+    IndexIVFFlat index (&quantizer, d, 16);
+    index.train (nb, xb.data());
+    index.add (nb, xb.data());
+    index.nprobe = 4;
+
+    std::vector<float> Dref (nq * k), D (nq * k);
+    std::vector<idx_t> Iref (nq * k), I (nq * k);
+    index.search (nq, xq.data(), k, Dref.data(), Iref.data());
+    float radius = (Dref[k / 2] + Dref[k / 2 + 1]) / 2;
+    RangeSearchResult rref (nq);
+    index.range_search (nq, xq.data(), radius, &rref);
+
+    index.early_abort_block = 32;
+    index.search (nq, xq.data(), k, D.data(), I.data());
+    expect_same_results (Dref, Iref, D, I);
+
+    RangeSearchResult res (nq);
+    index.range_search (nq, xq.data(), radius, &res);
+    for (size_t i = 0; i <= nq; i++) {
+        EXPECT_EQ (rref.lims[i], res.lims[i]);
+    }
+}
+
+TEST(EarlyAbort, factory) {
+    std::unique_ptr<Index> index (index_factory (d, "IVF16,FlatEA"));
+    auto ipt = dynamic_cast<IndexPreTransform*> (index.get());
+    ASSERT_TRUE (ipt);
+    auto pca = dynamic_cast<PCAMatrix*> (ipt->chain[0]);
+    ASSERT_TRUE (pca);
+    EXPECT_EQ (pca->d_out, d);
+    auto ivf = dynamic_cast<IndexIVFFlat*> (ipt->index);
+    ASSERT_TRUE (ivf);
+    EXPECT_EQ (ivf->early_abort_block, 64);
+
+    // no PCA is added after another transform
+    index.reset (index_factory (d, "PCA32,FlatEA"));
+    ipt = dynamic_cast<IndexPreTransform*> (index.get());
+    ASSERT_TRUE (ipt);
+    EXPECT_EQ (ipt->chain.size(), 1);
+    auto flat = dynamic_cast<IndexFlat*> (ipt->index);
+    ASSERT_TRUE (flat);
+    EXPECT_EQ (flat->early_abort_block, 64);
+
+    // the search works end to end
+    std::vector<float> xb = make_data (nb, 2);
+    index.reset (index_factory (d, "FlatEA"));
+    index->train (nb, xb.data());
+    index->add (nb, xb.data());
+    std::vector<float> D (k);
+    std::vector<idx_t> I (k);
+    index->search (1, xb.data() + 5 * d, k, D.data(), I.data());
+    EXPECT_EQ (I[0], 5);
+}
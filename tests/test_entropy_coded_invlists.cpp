@@ -0,0 +1,150 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <faiss/EntropyCodedInvertedLists.h>
+#include <faiss/IndexIVF.h>
+#include <faiss/clone_index.h>
+#include <faiss/index_factory.h>
+#include <faiss/index_io.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 32;
+size_t nt = 3000;
+size_t nb = 5000;
+size_t nq = 20;
+idx_t k = 10;
+
+/// clustered data, so that the codes are not uniform
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector<float> x(n * d);
+    std::normal_distribution<float> distrib;
+    for (size_t i = 0; i < n; i++) {
+        float scale = i % 3 == 0 ? 1.0 : 0.2;
+        for (size_t j = 0; j < d; j++) {
+            x[i * d + j] = distrib(rng) * scale + (j % 4 == 0 ? 1.0 : 0.0);
+        }
+    }
+    return x;
+}
+
+void test_entropy_coded(const char *index_key)
+{
+    std::vector<float> xt = make_data(nt, 1);
+    std::vector<float> xb = make_data(nb, 2);
+    std::vector<float> xq = make_data(nq, 3);
+
+    std::unique_ptr<Index> index(index_factory(d, index_key));
+    IndexIVF *ivf = dynamic_cast<IndexIVF*>(index.get());
+    ASSERT_TRUE(ivf);
+    ivf->train(nt, xt.data());
+    ivf->add(nb, xb.data());
+    ivf->nprobe = 4;
+
+    std::vector<float> Dref(nq * k), D(nq * k);
+    std::vector<idx_t> Iref(nq * k), I(nq * k);
+    ivf->search(nq, xq.data(), k, Dref.data(), Iref.data());
+
+    auto *il = new EntropyCodedInvertedLists(*ivf->invlists);
+
+    // the codes and ids decode exactly
+    for (size_t l = 0; l < ivf->nlist; l++) {
+        size_t n = ivf->invlists->list_size(l);
+        ASSERT_EQ(il->list_size(l), n);
+        if (n == 0) continue;
+        InvertedLists::ScopedCodes c0(ivf->invlists, l);
+        InvertedLists::ScopedCodes c1(il, l);
+        EXPECT_EQ(memcmp(c0.get(), c1.get(), n * il->code_size), 0);
+        InvertedLists::ScopedCodes s0(ivf->invlists, l, n - 1);
+        InvertedLists::ScopedCodes s1(il, l, n - 1);
+        EXPECT_EQ(memcmp(s0.get(), s1.get(), il->code_size), 0);
+        EXPECT_EQ(il->get_single_id(l, n / 2),
+                  ivf->invlists->get_single_id(l, n / 2));
+    }
+
+    // the codes are smaller
+    EXPECT_LT(il->coded_size(), nb * il->code_size);
+
+    ivf->replace_invlists(il, true);
+    ivf->search(nq, xq.data(), k, D.data(), I.data());
+    EXPECT_EQ(I, Iref);
+    EXPECT_EQ(D, Dref);
+
+    // I/O round trip
+    char fname[] = "/tmp/faiss_test_entropy_coded_XXXXXX";
+    int fd = mkstemp(fname);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    write_index(ivf, fname);
+    std::unique_ptr<IndexIVF> ivf2(
+          dynamic_cast<IndexIVF*>(read_index(fname)));
+    unlink(fname);
+    ASSERT_TRUE(ivf2);
+    auto *il2 = dynamic_cast<EntropyCodedInvertedLists*>(ivf2->invlists);
+    ASSERT_TRUE(il2);
+    EXPECT_EQ(il2->coded_size(), il->coded_size());
+    ivf2->search(nq, xq.data(), k, D.data(), I.data());
+    EXPECT_EQ(I, Iref);
+    EXPECT_EQ(D, Dref);
+}
+
+} // namespace
+
+
+TEST(EntropyCodedInvlists, IVFPQ) {
+    test_entropy_coded("IVF32,PQ8");
+}
+
+TEST(EntropyCodedInvlists, IVFPQ_4bit) {
+    test_entropy_coded("IVF32,PQ8x4");
+}
+
+TEST(EntropyCodedInvlists, IVFSQ8) {
+    test_entropy_coded("IVF32,SQ8");
+}
+
+TEST(EntropyCodedInvlists, skewed_bytes) {
+    // one list with a single byte value in the first position
+    size_t n = 1000, code_size = 3;
+    ArrayInvertedLists ail(2, code_size);
+    std::mt19937 rng(123);
+    std::vector<uint8_t> codes(n * code_size);
+    std::vector<idx_t> ids(n);
+    for (size_t i = 0; i < n; i++) {
+        codes[i * code_size] = 7;
+        codes[i * code_size + 1] = rng() % 4;
+        codes[i * code_size + 2] = rng();
+        ids[i] = i;
+    }
+    ail.add_entries(1, n, ids.data(), codes.data());
+
+    EntropyCodedInvertedLists il(ail);
+    EXPECT_EQ(il.list_size(0), 0);
+    // ~0 + 2 + 8 bits per code
+    EXPECT_LT(il.coded_size(), n * 11 / 8 + 16);
+    InvertedLists::ScopedCodes c(&il, 1);
+    EXPECT_EQ(memcmp(c.get(), codes.data(), n * code_size), 0);
+}
@@ -0,0 +1,242 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexHNSW.h>
+#include <faiss/IndexIVFFlat.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/utils/cpu_dispatch.h>
+#include <faiss/utils/distances.h>
+#include <faiss/utils/extra_distances.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+/// histogram-like vectors: non-negative, with some zero components
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> distrib;
+    std::vector<float> x(n);
+    for (size_t i = 0; i < n; i++) {
+        x[i] = rng() % 5 == 0 ? 0 : distrib(rng);
+    }
+    return x;
+}
+
+std::vector<SIMDLevel> x86_levels()
+{
+    std::vector<SIMDLevel> levels;
+    SIMDLevel best = supported_simd_level();
+    if (best == SIMD_NEON) {
+        return levels;
+    }
+    for (int l = SIMD_GENERIC; l <= best; l++) {
+        levels.push_back(SIMDLevel(l));
+    }
+    return levels;
+}
+
+/// reference implementation in double precision
+double ref_distance(MetricType mt, float p,
+                    const float *x, const float *y, size_t d)
+{
+    double accu = 0, accu_den = 0;
+    for (size_t i = 0; i < d; i++) {
+        double xi = x[i], yi = y[i], diff = std::fabs(xi - yi);
+        switch (mt) {
+        case METRIC_L1: accu += diff; break;
+        case METRIC_Linf: accu = std::max(accu, diff); break;
+        case METRIC_Lp: accu += std::pow(diff, double(p)); break;
+        case METRIC_Canberra:
+            if (xi != 0 || yi != 0) {
+                accu += diff / (std::fabs(xi) + std::fabs(yi));
+            }
+            break;
+        case METRIC_BrayCurtis:
+            accu += diff;
+            accu_den += std::fabs(xi + yi);
+            break;
+        case METRIC_JensenShannon: {
+            double mi = 0.5 * (xi + yi);
+            if (xi > 0) accu += 0.5 * xi * std::log(xi / mi);
+            if (yi > 0) accu += 0.5 * yi * std::log(yi / mi);
+            break;
+        }
+        default: break;
+        }
+    }
+    return mt == METRIC_BrayCurtis ? accu / accu_den : accu;
+}
+
+struct MetricAndArg {
+    MetricType mt;
+    float p;
+};
+
+std::vector<MetricAndArg> all_metrics()
+{
+    return {{METRIC_L1, 0}, {METRIC_Linf, 0}, {METRIC_Lp, 0.5},
+            {METRIC_Lp, 1}, {METRIC_Lp, 2}, {METRIC_Lp, 3},
+            {METRIC_Canberra, 0}, {METRIC_BrayCurtis, 0},
+            {METRIC_JensenShannon, 0}};
+}
+
+} // namespace
+
+
+TEST(ExtraDistances, kernels) {
+    SIMDLevel prev = get_simd_level();
+    size_t n = 20, maxd = 70;
+    // x and y share the first row so that some components are equal
+    std::vector<float> x = make_data(n * maxd, 123);
+    std::vector<float> y = make_data(n * maxd, 456);
+    std::copy(x.begin(), x.begin() + maxd, y.begin());
+
+    for (MetricAndArg m: all_metrics()) {
+        for (size_t d: {1, 5, 8, 13, 16, 31, 64, 70}) {
+            for (SIMDLevel level: x86_levels()) {
+                set_simd_level(level);
+                std::vector<float> dis(n * n);
+                pairwise_extra_distances(d, n, x.data(), n, y.data(),
+                                         m.mt, m.p, dis.data(), maxd, maxd);
+                for (size_t i = 0; i < n; i++) {
+                    for (size_t j = 0; j < n; j++) {
+                        double ref = ref_distance(
+                              m.mt, m.p, x.data() + i * maxd,
+                              y.data() + j * maxd, d);
+                        // Bray-Curtis of two null vectors
+                        if (std::isnan(ref)) {
+                            EXPECT_TRUE(std::isnan(dis[i * n + j]));
+                            continue;
+                        }
+                        EXPECT_NEAR(dis[i * n + j], ref,
+                                    1e-5 * std::fabs(ref) + 1e-6)
+                            << "metric=" << m.mt << " p=" << m.p
+                            << " d=" << d
+                            << " level=" << simd_level_name(level);
+                    }
+                }
+            }
+        }
+    }
+    set_simd_level(prev);
+}
+
+TEST(ExtraDistances, knn_blocked) {
+    // several database blocks and query blocks
+    size_t d = 64, nb = 3000, nq = 70;
+    idx_t k = 7;
+    std::vector<float> xb = make_data(nb * d, 1);
+    std::vector<float> xq = make_data(nq * d, 2);
+
+    for (MetricAndArg m: all_metrics()) {
+        std::vector<float> dis(nq * nb);
+        pairwise_extra_distances(d, nq, xq.data(), nb, xb.data(),
+                                 m.mt, m.p, dis.data());
+
+        std::vector<float> D(nq * k);
+        std::vector<idx_t> I(nq * k);
+        float_maxheap_array_t res = {size_t(nq), size_t(k),
+                                     I.data(), D.data()};
+        knn_extra_metrics(xq.data(), xb.data(), d, nq, nb,
+                          m.mt, m.p, &res);
+
+        for (size_t i = 0; i < nq; i++) {
+            std::vector<float> sorted(dis.begin() + i * nb,
+                                      dis.begin() + (i + 1) * nb);
+            std::sort(sorted.begin(), sorted.end());
+            for (idx_t j = 0; j < k; j++) {
+                EXPECT_EQ(D[i * k + j], sorted[j]);
+                EXPECT_EQ(D[i * k + j], dis[i * nb + I[i * k + j]]);
+            }
+        }
+    }
+}
+
+TEST(ExtraDistances, ivf_flat) {
+    size_t d = 32, nb = 2000, nq = 20, nlist = 16;
+    idx_t k = 10;
+    std::vector<float> xb = make_data(nb * d, 1);
+    std::vector<float> xq = make_data(nq * d, 2);
+
+    for (MetricAndArg m: all_metrics()) {
+        IndexFlat flat(d, m.mt);
+        flat.metric_arg = m.p;
+        flat.add(nb, xb.data());
+        std::vector<float> Dref(nq * k);
+        std::vector<idx_t> Iref(nq * k);
+        flat.search(nq, xq.data(), k, Dref.data(), Iref.data());
+
+        IndexFlat quantizer(d, m.mt);
+        quantizer.metric_arg = m.p;
+        IndexIVFFlat ivf(&quantizer, d, nlist, m.mt);
+        ivf.metric_arg = m.p;
+        ivf.train(nb, xb.data());
+        ivf.add(nb, xb.data());
+        ivf.nprobe = nlist;  // exhaustive
+
+        std::vector<float> D(nq * k);
+        std::vector<idx_t> I(nq * k);
+        ivf.search(nq, xq.data(), k, D.data(), I.data());
+        EXPECT_EQ(Dref, D) << "metric=" << m.mt << " p=" << m.p;
+
+        float radius = Dref[k - 1];
+        std::vector<float> dis(nq * nb);
+        pairwise_extra_distances(d, nq, xq.data(), nb, xb.data(),
+                                 m.mt, m.p, dis.data());
+        RangeSearchResult res(nq);
+        ivf.range_search(nq, xq.data(), radius, &res);
+        for (size_t i = 0; i < nq; i++) {
+            size_t nres = std::count_if(
+                  dis.begin() + i * nb, dis.begin() + (i + 1) * nb,
+                  [&](float v) { return v < radius; });
+            EXPECT_EQ(res.lims[i + 1] - res.lims[i], nres);
+        }
+    }
+}
+
+TEST(ExtraDistances, hnsw) {
+    size_t d = 32, nb = 3000, nq = 50;
+    std::vector<float> xb = make_data(nb * d, 1);
+    std::vector<float> xq = make_data(nq * d, 2);
+
+    for (MetricType mt: {METRIC_L1, METRIC_JensenShannon}) {
+        IndexFlat flat(d, mt);
+        flat.add(nb, xb.data());
+        std::vector<float> Dref(nq);
+        std::vector<idx_t> Iref(nq);
+        flat.search(nq, xq.data(), 1, Dref.data(), Iref.data());
+
+        IndexHNSWFlat hnsw(d, 16, mt);
+        hnsw.add(nb, xb.data());
+        hnsw.hnsw.efSearch = 64;
+        std::vector<float> D(nq);
+        std::vector<idx_t> I(nq);
+        hnsw.search(nq, xq.data(), 1, D.data(), I.data());
+
+        size_t n_ok = 0;
+        for (size_t i = 0; i < nq; i++) {
+            if (I[i] == Iref[i]) {
+                n_ok++;
+                EXPECT_EQ(D[i], Dref[i]);
+            }
+        }
+        EXPECT_GT(n_ok, nq * 0.9) << "metric=" << mt;
+    }
+}
@@ -0,0 +1,220 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexPQ.h>
+#include <faiss/IndexIVFPQ.h>
+#include <faiss/IndexPQFastScan.h>
+#include <faiss/IndexIVFPQFastScan.h>
+#include <faiss/clone_index.h>
+#include <faiss/index_factory.h>
+#include <faiss/index_io.h>
+#include <faiss/impl/io.h>
+#include <faiss/impl/pq4_fast_scan.h>
+
+
+namespace {
+
+typedef faiss::Index::idx_t idx_t;
+
+int d = 32;
+size_t nt = 4000;
+size_t nb = 2000;
+size_t nq = 50;
+int k = 10;
+
+std::vector<float> make_data (size_t n, int seed)
+{
+    std::vector<float> x (n * d);
+    std::mt19937 rng (seed);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < x.size(); i++) {
+        x[i] = distrib (rng);
+    }
+    return x;
+}
+
+// fraction of the reference 1-NN found in the top-k results
+double recall_at_k (const std::vector<idx_t> & ref,
+                    const std::vector<idx_t> & I)
+{
+    size_t n_ok = 0;
+    for (size_t q = 0; q < nq; q++) {
+        for (int j = 0; j < k; j++) {
+            if (I[q * k + j] == ref[q * k]) {
+                n_ok++;
+                break;
+            }
+        }
+    }
+    return n_ok / double (nq);
+}
+
+void search (const faiss::Index & index, const std::vector<float> & xq,
+             std::vector<float> & D, std::vector<idx_t> & I)
+{
+    D.resize (nq * k);
+    I.resize (nq * k);
+    index.search (nq, xq.data(), k, D.data(), I.data());
+}
+
+void test_pq_fast_scan (faiss::MetricType metric)
+{
+    std::vector<float> xt = make_data (nt, 1);
+    std::vector<float> xb = make_data (nb, 2);
+    std::vector<float> xq = make_data (nq, 3);
+
+    faiss::IndexPQ index_pq (d, 16, 4, metric);
+    index_pq.train (nt, xt.data());
+    index_pq.add (nb, xb.data());
+
+    faiss::IndexPQFastScan index_fs (index_pq);
+
+    std::vector<float> D_ref, D;
+    std::vector<idx_t> I_ref, I;
+    search (index_pq, xq, D_ref, I_ref);
+    search (index_fs, xq, D, I);
+
+    EXPECT_GE (recall_at_k (I_ref, I), 0.9);
+
+    // the distances are approximations of the PQ distances
+    for (size_t q = 0; q < nq; q++) {
+        EXPECT_NEAR (D[q * k], D_ref[q * k], 0.1 * fabs (D_ref[q * k]) + 0.1);
+    }
+
+    // adding directly gives the same index as converting
+    faiss::IndexPQFastScan index_fs2 (d, 16, 4, metric);
+    index_fs2.pq = index_pq.pq;
+    index_fs2.is_trained = true;
+    index_fs2.add (nb / 2, xb.data());
+    index_fs2.add (nb - nb / 2, xb.data() + nb / 2 * d);
+    EXPECT_EQ (index_fs.codes, index_fs2.codes);
+}
+
+void test_ivfpq_fast_scan (faiss::MetricType metric)
+{
+    std::vector<float> xt = make_data (nt, 1);
+    std::vector<float> xb = make_data (nb, 2);
+    std::vector<float> xq = make_data (nq, 3);
+
+    faiss::IndexFlat quantizer (d, metric);
+    faiss::IndexIVFPQ index_ivfpq (&quantizer, d, 16, 16, 4);
+    index_ivfpq.metric_type = metric;
+    index_ivfpq.train (nt, xt.data());
+    index_ivfpq.add (nb, xb.data());
+    index_ivfpq.nprobe = 4;
+
+    faiss::IndexIVFPQFastScan index_fs (index_ivfpq);
+    index_fs.nprobe = 4;
+
+    std::vector<float> D_ref, D;
+    std::vector<idx_t> I_ref, I;
+    search (index_ivfpq, xq, D_ref, I_ref);
+    search (index_fs, xq, D, I);
+
+    EXPECT_GE (recall_at_k (I_ref, I), 0.9);
+
+    faiss::IndexIVFPQFastScan index_fs2 (&quantizer, d, 16, 16, 4, metric);
+    index_fs2.pq = index_ivfpq.pq;
+    index_fs2.is_trained = true;
+    index_fs2.add (nb, xb.data());
+
+    std::vector<float> D2;
+    std::vector<idx_t> I2;
+    index_fs2.nprobe = 4;
+    search (index_fs2, xq, D2, I2);
+    EXPECT_EQ (I, I2);
+    EXPECT_EQ (D, D2);
+}
+
+} // namespace
+
+
+TEST(FastScan, pack_codes) {
+    size_t M = 7, M2 = 8, n = 100;
+    std::mt19937 rng (123);
+    size_t code_size = (M + 1) / 2;
+    std::vector<uint8_t> codes (n * code_size);
+    for (size_t i = 0; i < n; i++) {
+        for (size_t m = 0; m < M; m++) {
+            uint8_t c = rng () & 15;
+            codes[i * code_size + m / 2] |= c << (4 * (m % 2));
+        }
+    }
+
+    size_t nblock = (n + faiss::pq4_bbs - 1) / faiss::pq4_bbs;
+    std::vector<uint8_t> blocks (nblock * faiss::pq4_block_size (M2));
+    faiss::pq4_pack_codes_range (codes.data(), M, 0, n, M2, blocks.data());
+
+    std::vector<uint8_t> code (code_size);
+    for (size_t i = 0; i < n; i++) {
+        faiss::pq4_get_code (blocks.data(), M, M2, i, code.data());
+        for (size_t j = 0; j < code_size; j++) {
+            EXPECT_EQ (code[j], codes[i * code_size + j]);
+        }
+    }
+}
+
+TEST(FastScan, PQ_L2) {
+    test_pq_fast_scan (faiss::METRIC_L2);
+}
+
+TEST(FastScan, PQ_IP) {
+    test_pq_fast_scan (faiss::METRIC_INNER_PRODUCT);
+}
+
+TEST(FastScan, IVFPQ_L2) {
+    test_ivfpq_fast_scan (faiss::METRIC_L2);
+}
+
+TEST(FastScan, IVFPQ_IP) {
+    test_ivfpq_fast_scan (faiss::METRIC_INNER_PRODUCT);
+}
+
+TEST(FastScan, factory_io_clone) {
+    std::vector<float> xt = make_data (nt, 1);
+    std::vector<float> xb = make_data (nb, 2);
+    std::vector<float> xq = make_data (nq, 3);
+
+    const char *keys[] = {"PQ8x4fs", "IVF16,PQ8x4fs"};
+
+    for (const char *key: keys) {
+        std::unique_ptr<faiss::Index> index (faiss::index_factory (d, key));
+        index->train (nt, xt.data());
+        index->add (nb, xb.data());
+
+        std::vector<float> D_ref;
+        std::vector<idx_t> I_ref;
+        search (*index, xq, D_ref, I_ref);
+
+        faiss::VectorIOWriter wr;
+        faiss::write_index (index.get(), &wr);
+        faiss::VectorIOReader rd;
+        rd.data = wr.data;
+        std::unique_ptr<faiss::Index> index2 (faiss::read_index (&rd));
+
+        std::vector<float> D;
+        std::vector<idx_t> I;
+        search (*index2, xq, D, I);
+        EXPECT_EQ (I, I_ref);
+        EXPECT_EQ (D, D_ref);
+
+        std::unique_ptr<faiss::Index> index3 (faiss::clone_index (index.get()));
+        search (*index3, xq, D, I);
+        EXPECT_EQ (I, I_ref);
+        EXPECT_EQ (D, D_ref);
+    }
+}
@@ -0,0 +1,133 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexPreTransform.h>
+#include <faiss/VectorTransform.h>
+#include <faiss/index_factory.h>
+#include <faiss/index_io.h>
+#include <faiss/impl/io.h>
+#include <faiss/utils/cpu_dispatch.h>
+#include <faiss/utils/distances.h>
+#include <faiss/utils/hadamard.h>
+#include <faiss/utils/random.h>
+
+namespace {
+
+typedef faiss::Index::idx_t idx_t;
+
+std::vector<float> make_data (size_t n, int d, int seed)
+{
+    std::vector<float> x (n * d);
+    faiss::float_randn (x.data(), x.size(), seed);
+    return x;
+}
+
+}  // namespace
+
+
+TEST(HadamardRotation, fwht) {
+    // the SIMD kernel gives the same results as the generic one, and the
+    // transform applied twice multiplies by d
+    faiss::SIMDLevel level = faiss::get_simd_level ();
+    for (size_t d = 1; d <= 1024; d *= 2) {
+        std::vector<float> x = make_data (1, d, 1);
+        std::vector<float> y = x, y_ref = x;
+        faiss::set_simd_level (faiss::SIMD_GENERIC);
+        faiss::fwht_inplace (y_ref.data(), d);
+        faiss::set_simd_level (level);
+        faiss::fwht_inplace (y.data(), d);
+        for (size_t i = 0; i < d; i++) {
+            EXPECT_NEAR (y[i], y_ref[i], 1e-4 * std::sqrt (d));
+        }
+        faiss::fwht_inplace (y.data(), d);
+        for (size_t i = 0; i < d; i++) {
+            EXPECT_NEAR (y[i], x[i] * d, 1e-4 * d);
+        }
+    }
+}
+
+TEST(HadamardRotation, orthonormal) {
+    size_t n = 100;
+    int dims[][2] = {{64, 64}, {96, 96}, {50, 64}, {100, 128}, {7, 7}};
+    for (auto dd : dims) {
+        int d_in = dd[0], d_out = dd[1];
+        faiss::HadamardRotation hr (d_in, d_out);
+        hr.init (123);
+        std::vector<float> x = make_data (n, d_in, 2);
+        std::vector<float> xt (n * d_out), x2 (n * d_in);
+        hr.apply_noalloc (n, x.data(), xt.data());
+        hr.reverse_transform (n, xt.data(), x2.data());
+
+        for (size_t i = 0; i < n; i++) {
+            float nx = faiss::fvec_norm_L2sqr (x.data() + i * d_in, d_in);
+            float nxt = faiss::fvec_norm_L2sqr (xt.data() + i * d_out, d_out);
+            EXPECT_NEAR (nx, nxt, 1e-4 * nx);
+        }
+        for (size_t i = 0; i < n * d_in; i++) {
+            EXPECT_NEAR (x[i], x2[i], 1e-4);
+        }
+
+        // same as the dense matrix
+        std::vector<float> A (d_out * d_in);
+        hr.make_matrix (A.data());
+        for (int i = 0; i < d_out; i++) {
+            float v = faiss::fvec_inner_product (
+                  A.data() + i * d_in, x.data(), d_in);
+            EXPECT_NEAR (v, xt[i], 1e-4);
+        }
+    }
+}
+
+TEST(HadamardRotation, factory_io) {
+    int d = 48;
+    size_t nb = 1000, nq = 10;
+    int k = 5;
+    std::vector<float> xb = make_data (nb, d, 3);
+    std::vector<float> xq = make_data (nq, d, 4);
+
+    std::unique_ptr<faiss::Index> index (faiss::index_factory (d, "HR64,Flat"));
+    index->train (nb, xb.data());
+    index->add (nb, xb.data());
+    EXPECT_EQ (index->d, d);
+
+    // the rotation preserves the distances
+    std::unique_ptr<faiss::Index> ref (faiss::index_factory (d, "Flat"));
+    ref->add (nb, xb.data());
+    std::vector<float> D (nq * k), D_ref (nq * k), D2 (nq * k);
+    std::vector<idx_t> I (nq * k), I_ref (nq * k), I2 (nq * k);
+    index->search (nq, xq.data(), k, D.data(), I.data());
+    ref->search (nq, xq.data(), k, D_ref.data(), I_ref.data());
+    EXPECT_EQ (I, I_ref);
+
+    faiss::VectorIOWriter writer;
+    faiss::write_index (index.get(), &writer);
+    faiss::VectorIOReader reader;
+    reader.data = writer.data;
+    std::unique_ptr<faiss::Index> index2 (faiss::read_index (&reader));
+    index2->search (nq, xq.data(), k, D2.data(), I2.data());
+    EXPECT_EQ (I, I2);
+    EXPECT_EQ (D, D2);
+}
+
+TEST(HadamardRotation, opq_init) {
+    int d = 32;
+    size_t n = 2000;
+    std::vector<float> x = make_data (n, d, 5);
+    faiss::OPQMatrix opq (d, 4);
+    opq.hadamard_init = true;
+    opq.niter = 2;
+    opq.train (n, x.data());
+    EXPECT_TRUE (opq.is_trained);
+    opq.set_is_orthonormal ();
+    EXPECT_TRUE (opq.is_orthonormal);
+}
@@ -0,0 +1,176 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include <omp.h>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexBinaryFlat.h>
+#include <faiss/IndexBinaryHash.h>
+#include <faiss/IndexBinaryIVF.h>
+#include <faiss/utils/hamming.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+std::vector<uint8_t> make_codes(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector<uint8_t> codes(n);
+    for (size_t i = 0; i < n; i++) {
+        codes[i] = rng() & 0xff;
+    }
+    return codes;
+}
+
+// k smallest distances, ties in order of the ids
+void reference_knn(const std::vector<hamdis_t> & dis, size_t k,
+                   std::vector<int32_t> & D, std::vector<int64_t> & I)
+{
+    std::vector<int64_t> perm(dis.size());
+    std::iota(perm.begin(), perm.end(), 0);
+    std::stable_sort(perm.begin(), perm.end(),
+                     [&](int64_t a, int64_t b) { return dis[a] < dis[b]; });
+    D.resize(k);
+    I.resize(k);
+    for (size_t i = 0; i < k; i++) {
+        I[i] = i < perm.size() ? perm[i] : -1;
+        D[i] = i < perm.size() ? dis[perm[i]] :
+            std::numeric_limits<int32_t>::max();
+    }
+}
+
+} // namespace
+
+
+TEST(HammingKSelector, ties) {
+    int nbits = 64;
+    std::mt19937 rng(123);
+    for (size_t n: {0, 10, 1000, 20000}) {
+        std::vector<hamdis_t> dis(n);
+        for (size_t i = 0; i < n; i++) {
+            // concentrated around 32
+            dis[i] = 24 + rng() % 17;
+        }
+        for (size_t k: {1, 10, 100, 2000}) {
+            HammingKSelector sel(nbits, k);
+            for (size_t i = 0; i < n; i++) {
+                sel.add(dis[i], i);
+            }
+            std::vector<int32_t> D(k), Dref;
+            std::vector<int64_t> I(k), Iref;
+            sel.get_results(D.data(), I.data());
+            reference_knn(dis, k, Dref, Iref);
+            EXPECT_EQ(Dref, D) << "n=" << n << " k=" << k;
+            EXPECT_EQ(Iref, I) << "n=" << n << " k=" << k;
+        }
+    }
+}
+
+TEST(HammingKSelector, merge) {
+    std::mt19937 rng(123);
+    size_t n = 5000, k = 50;
+    std::vector<hamdis_t> dis(n);
+    for (size_t i = 0; i < n; i++) {
+        dis[i] = rng() % 65;
+    }
+    HammingKSelector sel0(64, k), sel1(64, k);
+    for (size_t i = 0; i < n; i++) {
+        (i < n / 3 ? sel0 : sel1).add(dis[i], i);
+    }
+    sel0.merge(sel1);
+    std::vector<int32_t> D(k), Dref;
+    std::vector<int64_t> I(k), Iref;
+    sel0.get_results(D.data(), I.data());
+    reference_knn(dis, k, Dref, Iref);
+    EXPECT_EQ(Dref, D);
+    EXPECT_EQ(Iref, I);
+}
+
+TEST(HammingKSelector, knn_hist) {
+    int prev_nt = omp_get_max_threads();
+    size_t nb = 5000;
+    for (size_t code_size: {8, 20, 32}) {
+        std::vector<uint8_t> xb = make_codes(nb * code_size, 123);
+        std::vector<uint8_t> xq = make_codes(10 * code_size, 456);
+        for (size_t k: {1, 20, 500}) {
+            // several queries per thread / less queries than threads
+            for (size_t nq: {10, 1}) {
+                omp_set_num_threads(4);
+                std::vector<int32_t> D(nq * k);
+                std::vector<int64_t> I(nq * k);
+                hammings_knn_hist(xq.data(), xb.data(), nq, nb, k,
+                                  code_size, D.data(), I.data());
+                for (size_t i = 0; i < nq; i++) {
+                    std::vector<hamdis_t> dis(nb);
+                    for (size_t j = 0; j < nb; j++) {
+                        HammingComputerDefault hc(
+                            xq.data() + i * code_size, code_size);
+                        dis[j] = hc.hamming(xb.data() + j * code_size);
+                    }
+                    std::vector<int32_t> Dref;
+                    std::vector<int64_t> Iref;
+                    reference_knn(dis, k, Dref, Iref);
+                    EXPECT_EQ(Dref, std::vector<int32_t>(
+                                  D.begin() + i * k, D.begin() + i * k + k));
+                    EXPECT_EQ(Iref, std::vector<int64_t>(
+                                  I.begin() + i * k, I.begin() + i * k + k));
+                }
+            }
+        }
+    }
+    omp_set_num_threads(prev_nt);
+}
+
+TEST(HammingKSelector, indexes) {
+    int d = 64;
+    size_t nb = 4000, nq = 30;
+    idx_t k = 50;
+    std::vector<uint8_t> xb = make_codes(nb * d / 8, 123);
+    std::vector<uint8_t> xq = make_codes(nq * d / 8, 456);
+
+    IndexBinaryFlat flat(d);
+    IndexBinaryFlat quantizer(d);
+    IndexBinaryIVF ivf(&quantizer, d, 8);
+    ivf.train(nb, xb.data());
+    ivf.nprobe = 3;
+    IndexBinaryHash hash(d, 8);
+    hash.nflip = 2;
+    IndexBinaryMultiHash mhash(d, 2, 8);
+    mhash.nflip = 1;
+
+    std::vector<IndexBinary*> indexes = {&flat, &ivf, &hash, &mhash};
+    for (IndexBinary *index: indexes) {
+        index->add(nb, xb.data());
+        std::vector<int32_t> Dref(nq * k), D(nq * k);
+        std::vector<idx_t> Iref(nq * k), I(nq * k);
+        index->search(nq, xq.data(), k, Dref.data(), Iref.data());
+
+        flat.use_heap = ivf.use_heap = false;
+        hash.use_heap = mhash.use_heap = false;
+        index->search(nq, xq.data(), k, D.data(), I.data());
+        flat.use_heap = ivf.use_heap = true;
+        hash.use_heap = mhash.use_heap = true;
+
+        for (size_t i = 0; i < nq; i++) {
+            // the hash indexes do not sort the heap results
+            std::sort(Dref.begin() + i * k, Dref.begin() + (i + 1) * k);
+            EXPECT_TRUE(std::is_sorted(D.begin() + i * k,
+                                       D.begin() + (i + 1) * k));
+        }
+        EXPECT_EQ(Dref, D);
+    }
+}
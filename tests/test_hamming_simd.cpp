@@ -0,0 +1,221 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexBinaryFlat.h>
+#include <faiss/IndexBinaryIVF.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVFSpectralHash.h>
+#include <faiss/IndexLSH.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/utils/cpu_dispatch.h>
+#include <faiss/utils/hamming.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+std::vector<uint8_t> make_codes(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector<uint8_t> codes(n);
+    for (size_t i = 0; i < n; i++) {
+        codes[i] = rng() & 0xff;
+    }
+    return codes;
+}
+
+std::vector<float> make_floats(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> distrib;
+    std::vector<float> x(n);
+    for (size_t i = 0; i < n; i++) {
+        x[i] = distrib(rng);
+    }
+    return x;
+}
+
+// the x86 levels supported by the CPU
+std::vector<SIMDLevel> x86_levels()
+{
+    std::vector<SIMDLevel> levels;
+    SIMDLevel best = supported_simd_level();
+    if (best == SIMD_NEON) {
+        return levels;
+    }
+    for (int l = SIMD_GENERIC; l <= best; l++) {
+        levels.push_back(SIMDLevel(l));
+    }
+    return levels;
+}
+
+} // namespace
+
+
+TEST(HammingSIMD, hammings_1_to_n) {
+    SIMDLevel prev = get_simd_level();
+    // n is not a multiple of 4 to test the leftover codes
+    size_t n = 103;
+    for (size_t code_size: {8, 24, 32, 64, 96, 128}) {
+        std::vector<uint8_t> q = make_codes(code_size, 123);
+        std::vector<uint8_t> b = make_codes(n * code_size, 456);
+        std::vector<hamdis_t> ref(n);
+        for (size_t j = 0; j < n; j++) {
+            for (size_t l = 0; l < code_size; l++) {
+                ref[j] += __builtin_popcount(q[l] ^ b[j * code_size + l]);
+            }
+        }
+
+        for (SIMDLevel level: x86_levels()) {
+            set_simd_level(level);
+            std::vector<hamdis_t> dis(n);
+            hammings_1_to_n(q.data(), b.data(), n, code_size, dis.data());
+            EXPECT_EQ(ref, dis) << "code_size=" << code_size
+                                << " level=" << simd_level_name(level);
+        }
+    }
+    set_simd_level(prev);
+}
+
+TEST(HammingSIMD, flat_and_ivf) {
+    SIMDLevel prev = get_simd_level();
+    int d = 256;
+    size_t nb = 3000, nq = 20, code_size = d / 8;
+    idx_t k = 10;
+    std::vector<uint8_t> xb = make_codes(nb * code_size, 123);
+    std::vector<uint8_t> xq = make_codes(nq * code_size, 456);
+
+    IndexBinaryFlat flat(d);
+    flat.add(nb, xb.data());
+
+    IndexBinaryFlat quantizer(d);
+    IndexBinaryIVF ivf(&quantizer, d, 16);
+    ivf.train(nb, xb.data());
+    ivf.add(nb, xb.data());
+    ivf.nprobe = 16;  // exhaustive
+
+    set_simd_level(SIMD_GENERIC);
+    std::vector<int32_t> Dref(nq * k);
+    std::vector<idx_t> Iref(nq * k);
+    flat.search(nq, xq.data(), k, Dref.data(), Iref.data());
+    RangeSearchResult rref(nq);
+    flat.range_search(nq, xq.data(), Dref[k - 1] + 1, &rref);
+
+    for (SIMDLevel level: x86_levels()) {
+        set_simd_level(level);
+        std::vector<int32_t> D(nq * k);
+        std::vector<idx_t> I(nq * k);
+        flat.search(nq, xq.data(), k, D.data(), I.data());
+        EXPECT_EQ(Dref, D);
+
+        ivf.search(nq, xq.data(), k, D.data(), I.data());
+        EXPECT_EQ(Dref, D);
+
+        RangeSearchResult res(nq);
+        ivf.range_search(nq, xq.data(), Dref[k - 1] + 1, &res);
+        for (size_t i = 0; i <= nq; i++) {
+            EXPECT_EQ(rref.lims[i], res.lims[i]);
+        }
+    }
+    set_simd_level(prev);
+}
+
+TEST(HammingSIMD, fvecs2bitvecs) {
+    SIMDLevel prev = get_simd_level();
+    size_t n = 50, ldx = 80;
+    std::vector<float> x = make_floats(n * ldx, 123);
+    std::vector<float> th = make_floats(ldx, 456);
+    x[3] = 0;
+    x[4] = -0.0f;
+    x[5] = th[5];
+    // the lengths exercise the 32-, 8- and 1-component steps
+    for (size_t d: {7, 8, 32, 45, 80}) {
+        size_t code_size = (d + 7) / 8;
+        const float *th_ptr = th.data();
+        for (const float *t: {(const float*)nullptr, th_ptr}) {
+            std::vector<uint8_t> ref(n * code_size);
+            for (size_t i = 0; i < n; i++) {
+                for (size_t j = 0; j < d; j++) {
+                    if (x[i * ldx + j] >= (t ? t[j] : 0)) {
+                        ref[i * code_size + j / 8] |= 1 << (j % 8);
+                    }
+                }
+            }
+            for (SIMDLevel level: x86_levels()) {
+                set_simd_level(level);
+                std::vector<uint8_t> codes(n * code_size);
+                fvecs2bitvecs_threshold(x.data(), ldx, t, codes.data(), d, n);
+                EXPECT_EQ(ref, codes) << "d=" << d
+                                      << " level=" << simd_level_name(level);
+            }
+        }
+    }
+    set_simd_level(prev);
+}
+
+TEST(HammingSIMD, lsh_and_spectral_hash) {
+    SIMDLevel prev = get_simd_level();
+    int d = 64;
+    size_t nb = 2000, nq = 10;
+    idx_t k = 5;
+    std::vector<float> xb = make_floats(nb * d, 123);
+    std::vector<float> xq = make_floats(nq * d, 456);
+
+    // nbits < d without rotation selects the first components
+    IndexLSH lsh(d, 40, false, true);
+    IndexLSH lsh_rot(d, 96, true, true);
+    IndexFlatL2 quantizer(d);
+    IndexIVFSpectralHash sh(&quantizer, d, 4, 60, 1.0);
+    sh.threshold_type = IndexIVFSpectralHash::Thresh_centroid;
+    for (Index *index: std::vector<Index*>{&lsh, &lsh_rot, &sh}) {
+        index->train(nb, xb.data());
+    }
+
+    // reference codes: preprocessing followed by the sign binarization
+    for (IndexLSH *index: {&lsh, &lsh_rot}) {
+        const float *xt = index->apply_preprocess(nb, xb.data());
+        std::vector<uint8_t> ref(nb * index->bytes_per_vec);
+        fvecs2bitvecs(xt, ref.data(), index->nbits, nb);
+        delete [] xt;
+        for (SIMDLevel level: x86_levels()) {
+            set_simd_level(level);
+            std::vector<uint8_t> codes(nb * index->bytes_per_vec);
+            index->sa_encode(nb, xb.data(), codes.data());
+            EXPECT_EQ(ref, codes);
+        }
+    }
+
+    std::vector<idx_t> list_nos(nb);
+    quantizer.assign(nb, xb.data(), list_nos.data());
+    set_simd_level(SIMD_GENERIC);
+    std::vector<uint8_t> sh_ref(nb * sh.code_size);
+    sh.encode_vectors(nb, xb.data(), list_nos.data(), sh_ref.data());
+    std::vector<float> Dref(nq * k);
+    std::vector<idx_t> Iref(nq * k);
+    sh.add(nb, xb.data());
+    sh.nprobe = 4;
+    sh.search(nq, xq.data(), k, Dref.data(), Iref.data());
+    for (SIMDLevel level: x86_levels()) {
+        set_simd_level(level);
+        std::vector<uint8_t> codes(nb * sh.code_size);
+        sh.encode_vectors(nb, xb.data(), list_nos.data(), codes.data());
+        EXPECT_EQ(sh_ref, codes);
+        std::vector<float> D(nq * k);
+        std::vector<idx_t> I(nq * k);
+        sh.search(nq, xq.data(), k, D.data(), I.data());
+        EXPECT_EQ(Dref, D);
+    }
+    set_simd_level(prev);
+}
@@ -0,0 +1,100 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/utils/Heap.h>
+
+
+using namespace faiss;
+
+namespace {
+
+/// fill a heap of size k with n random values (n may be < k), reorder it
+/// and compare with a sort of the values
+template <class C>
+void test_reorder(size_t k, size_t n, int seed)
+{
+    typedef typename C::T T;
+    std::mt19937 rng(seed);
+    // few distinct values to get ties
+    std::uniform_int_distribution<int> distrib(-50, 50);
+
+    std::vector<T> val(k);
+    std::vector<int64_t> ids(k);
+    heap_heapify<C>(k, val.data(), ids.data());
+    std::vector<std::pair<T, int64_t> > ref;
+    for (size_t i = 0; i < n; i++) {
+        T v = T(distrib(rng)) / 4;
+        ref.emplace_back(v, i);
+        if (C::cmp(val[0], v)) {
+            heap_pop<C>(k, val.data(), ids.data());
+            heap_push<C>(k, val.data(), ids.data(), v, i);
+        }
+    }
+    std::sort(ref.begin(), ref.end(),
+              [](const std::pair<T, int64_t> & a,
+                 const std::pair<T, int64_t> & b) {
+                  return C::cmp(b.first, a.first) ||
+                      (a.first == b.first && a.second < b.second);
+              });
+
+    size_t nel = heap_reorder<C>(k, val.data(), ids.data());
+    size_t nres = std::min(k, n);
+    ASSERT_EQ(nel, nres);
+    for (size_t i = 0; i < nres; i++) {
+        EXPECT_EQ(val[i], ref[i].first);
+        // the ties are ordered by id (the heap decides which of the
+        // values equal to the k-th one are kept)
+        if (k >= heap_reorder_sort_threshold && val[i] != val[nres - 1]) {
+            EXPECT_EQ(ids[i], ref[i].second);
+        }
+    }
+    for (size_t i = nres; i < k; i++) {
+        EXPECT_EQ(ids[i], -1);
+        EXPECT_EQ(val[i], C::neutral());
+    }
+}
+
+} // namespace
+
+
+TEST(HeapReorder, small) {
+    test_reorder<CMax<float, int64_t> >(10, 1000, 1);
+    test_reorder<CMin<float, int64_t> >(10, 1000, 2);
+    test_reorder<CMax<float, int64_t> >(10, 5, 3);
+}
+
+TEST(HeapReorder, sorted_float) {
+    test_reorder<CMax<float, int64_t> >(1000, 10000, 4);
+    test_reorder<CMin<float, int64_t> >(1000, 10000, 5);
+    // partially filled heap
+    test_reorder<CMax<float, int64_t> >(1000, 300, 6);
+    test_reorder<CMin<float, int64_t> >(1000, 300, 7);
+}
+
+TEST(HeapReorder, sorted_int) {
+    test_reorder<CMax<int, int64_t> >(500, 5000, 8);
+    test_reorder<CMin<int, int64_t> >(500, 5000, 9);
+}
+
+TEST(HeapReorder, sort_pairs) {
+    std::vector<float> val = {0.5f, -1.5f, 2.0f, -1e-30f, 1e-30f, 0.5f};
+    std::vector<int64_t> ids = {5, 1, 2, 3, 4, 0};
+    sort_pairs<CMax<float, int64_t> >(val.size(), val.data(), ids.data());
+    EXPECT_EQ(ids, std::vector<int64_t>({1, 3, 4, 0, 5, 2}));
+    EXPECT_EQ(val, std::vector<float>({-1.5f, -1e-30f, 1e-30f,
+                                       0.5f, 0.5f, 2.0f}));
+
+    sort_pairs<CMin<float, int64_t> >(val.size(), val.data(), ids.data());
+    EXPECT_EQ(ids, std::vector<int64_t>({2, 0, 5, 4, 3, 1}));
+}
@@ -0,0 +1,135 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/Clustering.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVFFlat.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+// points around ncl random centers with uneven populations
+std::vector<float> make_blobs(size_t n, size_t d, size_t ncl, int seed)
+{
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> noise(0, 0.2);
+    std::uniform_real_distribution<float> distrib(-1, 1);
+    std::exponential_distribution<float> pop(1.0);
+    std::vector<float> centers(ncl * d);
+    for (auto & c: centers) {
+        c = distrib(rng);
+    }
+    std::vector<float> weights(ncl);
+    for (auto & w: weights) {
+        w = pop(rng);
+    }
+    std::discrete_distribution<size_t> which(weights.begin(), weights.end());
+    std::vector<float> x(n * d);
+    for (size_t i = 0; i < n; i++) {
+        size_t c = which(rng);
+        for (size_t j = 0; j < d; j++) {
+            x[i * d + j] = centers[c * d + j] + noise(rng);
+        }
+    }
+    return x;
+}
+
+// sizes of the clusters when assigning x to the centroids of index
+std::vector<size_t> cluster_sizes(const Index & index, size_t n,
+                                  const float *x, float *obj)
+{
+    std::vector<float> dis(n);
+    std::vector<idx_t> assign(n);
+    index.search(n, x, 1, dis.data(), assign.data());
+    std::vector<size_t> sizes(index.ntotal);
+    *obj = 0;
+    for (size_t i = 0; i < n; i++) {
+        sizes[assign[i]]++;
+        *obj += dis[i];
+    }
+    return sizes;
+}
+
+} // namespace
+
+
+TEST(HierarchicalClustering, compare_to_flat) {
+    size_t d = 16, n = 20000, k = 100;
+    std::vector<float> x = make_blobs(n, d, 30, 123);
+
+    Clustering flat(d, k);
+    IndexFlatL2 index_flat(d);
+    flat.train(n, x.data(), index_flat);
+    float obj_flat;
+    cluster_sizes(index_flat, n, x.data(), &obj_flat);
+
+    HierarchicalClustering hc(d, k);
+    IndexFlatL2 index(d);
+    hc.train(n, x.data(), index);
+    EXPECT_EQ(hc.centroids.size(), k * d);
+    EXPECT_EQ(index.ntotal, k);
+    EXPECT_EQ(hc.sub_k.size(), 10);
+    size_t tot = 0;
+    for (size_t ki: hc.sub_k) {
+        tot += ki;
+    }
+    EXPECT_EQ(tot, k);
+
+    float obj;
+    cluster_sizes(index, n, x.data(), &obj);
+    EXPECT_LT(obj, obj_flat * 1.15);
+}
+
+TEST(HierarchicalClustering, balance) {
+    size_t d = 8, n = 20000, k = 64;
+    std::vector<float> x = make_blobs(n, d, 10, 456);
+
+    HierarchicalClustering hc(d, k);
+    IndexFlatL2 index(d);
+    hc.train(n, x.data(), index);
+    float obj;
+    std::vector<size_t> sizes = cluster_sizes(index, n, x.data(), &obj);
+    size_t max_unbalanced = *std::max_element(sizes.begin(), sizes.end());
+
+    HierarchicalClustering hcb(d, k);
+    hcb.balance_factor = 1.2;
+    IndexFlatL2 index_b(d);
+    hcb.train(n, x.data(), index_b);
+    float obj_b;
+    sizes = cluster_sizes(index_b, n, x.data(), &obj_b);
+    size_t max_balanced = *std::max_element(sizes.begin(), sizes.end());
+
+    EXPECT_LE(max_balanced, max_unbalanced);
+    EXPECT_LT(max_balanced, 2 * n / k);
+    EXPECT_LT(obj_b, obj * 1.5);
+}
+
+TEST(HierarchicalClustering, ivf_quantizer) {
+    size_t d = 8, n = 5000, nlist = 50;
+    std::vector<float> x = make_blobs(n, d, 20, 789);
+
+    IndexFlatL2 quantizer(d);
+    HierarchicalClustering hc(d, nlist);
+    hc.train(n, x.data(), quantizer);
+
+    IndexIVFFlat index(&quantizer, d, nlist);
+    // the quantizer is trained and populated, train only marks the index
+    index.train(n, x.data());
+    EXPECT_EQ(quantizer.ntotal, nlist);
+    index.add(n, x.data());
+    EXPECT_EQ(index.ntotal, n);
+}
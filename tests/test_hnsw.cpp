@@ -0,0 +1,534 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexHNSW.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/FaissException.h>
+#include <faiss/impl/io.h>
+#include <faiss/index_io.h>
+#include <faiss/utils/Heap.h>
+#include <faiss/utils/distances.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 16;
+size_t nb = 5000;
+size_t nq = 100;
+idx_t k = 10;
+
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector <float> x (n * d);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < n * d; i++) {
+        x[i] = distrib(rng);
+    }
+    return x;
+}
+
+/// 1-recall@k of an HNSW index built with the given batch size
+double build_and_search(int add_batch_size, int nsplit = 1)
+{
+    std::vector<float> xb = make_data(nb, 1);
+    std::vector<float> xq = make_data(nq, 2);
+
+    IndexFlatL2 ref(d);
+    ref.add(nb, xb.data());
+    std::vector<float> D_ref(nq);
+    std::vector<idx_t> I_ref(nq);
+    ref.search(nq, xq.data(), 1, D_ref.data(), I_ref.data());
+
+    IndexHNSWFlat index(d, 16);
+    index.hnsw.add_batch_size = add_batch_size;
+    for (int i = 0; i < nsplit; i++) {
+        size_t i0 = nb * i / nsplit, i1 = nb * (i + 1) / nsplit;
+        index.add(i1 - i0, xb.data() + i0 * d);
+    }
+    EXPECT_EQ(index.ntotal, nb);
+
+    std::vector<float> D(nq * k);
+    std::vector<idx_t> I(nq * k);
+    index.search(nq, xq.data(), k, D.data(), I.data());
+
+    size_t nok = 0;
+    for (size_t q = 0; q < nq; q++) {
+        for (idx_t j = 0; j < k; j++) {
+            if (I[q * k + j] == I_ref[q]) {
+                nok++;
+                break;
+            }
+        }
+    }
+    return nok / double(nq);
+}
+
+/// fraction of the level 0 links between nodes with close ids
+double frac_local_links(const HNSW& hnsw, int max_gap = 64)
+{
+    size_t nlocal = 0, nlink = 0;
+    for (int i = 0; i < hnsw.levels.size(); i++) {
+        size_t begin, end;
+        hnsw.neighbor_range(i, 0, &begin, &end);
+        for (size_t j = begin; j < end && hnsw.neighbors[j] >= 0; j++) {
+            if (std::abs(hnsw.neighbors[j] - i) <= max_gap) {
+                nlocal++;
+            }
+            nlink++;
+        }
+    }
+    return nlocal / double(nlink);
+}
+
+} // namespace
+
+
+TEST(HNSW, add_batches) {
+    double r_ref = build_and_search(0);
+    double r_batch = build_and_search(256);
+    EXPECT_GT(r_ref, 0.9);
+    EXPECT_GE(r_batch, r_ref - 0.05);
+}
+
+TEST(HNSW, add_batches_incremental) {
+    double r_batch = build_and_search(256, 3);
+    EXPECT_GT(r_batch, 0.85);
+}
+
+TEST(HNSW, search_prefetch) {
+    std::vector<float> xb = make_data(nb, 1);
+    std::vector<float> xq = make_data(nq, 2);
+
+    const char *keys[] = {"flat", "sq8"};
+    for (const char *key: keys) {
+        std::unique_ptr<IndexHNSW> index;
+        if (key[0] == 'f') {
+            index.reset(new IndexHNSWFlat(d, 16));
+        } else {
+            index.reset(new IndexHNSWSQ(d, ScalarQuantizer::QT_8bit, 16));
+        }
+        index->train(nb, xb.data());
+        index->add(nb, xb.data());
+
+        std::vector<float> D_ref(nq * k), D(nq * k);
+        std::vector<idx_t> I_ref(nq * k), I(nq * k);
+        index->search(nq, xq.data(), k, D_ref.data(), I_ref.data());
+
+        index->hnsw.search_prefetch = true;
+        index->search(nq, xq.data(), k, D.data(), I.data());
+        EXPECT_EQ(I_ref, I);
+        EXPECT_EQ(D_ref, D);
+    }
+}
+
+TEST(HNSW, visited_table_sparse) {
+    int size = 100000;
+    VisitedTable dense(size), sparse(size, 10);
+    EXPECT_FALSE(dense.sparse);
+    EXPECT_TRUE(sparse.sparse);
+
+    std::mt19937 rng(123);
+    for (int q = 0; q < 300; q++) {
+        // more visits than the hint: the hash table grows
+        for (int i = 0; i < 50; i++) {
+            int no = rng() % size;
+            dense.set(no);
+            sparse.set(no);
+        }
+        for (int i = 0; i < 200; i++) {
+            int no = rng() % size;
+            EXPECT_EQ(dense.get(no), sparse.get(no));
+        }
+        dense.advance();
+        sparse.advance();
+    }
+}
+
+TEST(HNSW, search_sparse_visited_table) {
+    std::vector<float> xb = make_data(nb, 1);
+    std::vector<float> xq = make_data(nq, 2);
+
+    IndexHNSWFlat index(d, 16);
+    index.add(nb, xb.data());
+
+    std::vector<float> D_ref(nq * k), D(nq * k);
+    std::vector<idx_t> I_ref(nq * k), I(nq * k);
+    index.search(nq, xq.data(), k, D_ref.data(), I_ref.data());
+
+    VisitedTable vt(nb, 1);
+    ASSERT_TRUE(vt.sparse);
+    std::unique_ptr<DistanceComputer> dis(
+        index.storage->get_distance_computer());
+    for (size_t q = 0; q < nq; q++) {
+        dis->set_query(xq.data() + q * d);
+        maxheap_heapify(k, D.data() + q * k, I.data() + q * k);
+        index.hnsw.search(*dis, k, I.data() + q * k, D.data() + q * k, vt);
+        maxheap_reorder(k, D.data() + q * k, I.data() + q * k);
+    }
+    EXPECT_EQ(I_ref, I);
+    EXPECT_EQ(D_ref, D);
+}
+
+TEST(HNSW, reorder_nodes) {
+    std::vector<float> xb = make_data(nb, 1);
+    std::vector<float> xq = make_data(nq, 2);
+
+    IndexHNSWFlat ref(d, 16);
+    ref.add(nb, xb.data());
+    std::vector<float> D_ref(nq * k), D(nq * k);
+    std::vector<idx_t> I_ref(nq * k), I(nq * k);
+    ref.search(nq, xq.data(), k, D_ref.data(), I_ref.data());
+    double local_ref = frac_local_links(ref.hnsw);
+
+    HNSW::ReorderType types[] = {
+        HNSW::REORDER_BFS, HNSW::REORDER_RCM, HNSW::REORDER_GORDER};
+    for (HNSW::ReorderType type: types) {
+        VectorIOWriter writer;
+        write_index(&ref, &writer);
+        VectorIOReader reader;
+        reader.data = writer.data;
+        std::unique_ptr<IndexHNSW> index(
+            dynamic_cast<IndexHNSW*>(read_index(&reader)));
+
+        // the graph is the same up to the numbering of the nodes
+        index->reorder_nodes(type);
+        EXPECT_GT(frac_local_links(index->hnsw), 2 * local_ref);
+        index->search(nq, xq.data(), k, D.data(), I.data());
+        EXPECT_EQ(I_ref, I);
+        EXPECT_EQ(D_ref, D);
+
+        std::vector<float> recons(d);
+        for (idx_t i = 0; i < nb; i += 97) {
+            index->reconstruct(i, recons.data());
+            EXPECT_TRUE(std::equal(recons.begin(), recons.end(),
+                                   xb.begin() + i * d));
+        }
+
+        // the labels are stored with the index
+        VectorIOWriter writer2;
+        write_index(index.get(), &writer2);
+        VectorIOReader reader2;
+        reader2.data = writer2.data;
+        std::unique_ptr<IndexHNSW> index2(
+            dynamic_cast<IndexHNSW*>(read_index(&reader2)));
+        EXPECT_EQ(index2->node_to_label, index->node_to_label);
+        index2->search(nq, xq.data(), k, D.data(), I.data());
+        EXPECT_EQ(I_ref, I);
+
+        // the vectors added after reordering get the next labels
+        index2->add(nq, xq.data());
+        index2->search(nq, xq.data(), 1, D.data(), I.data());
+        for (size_t q = 0; q < nq; q++) {
+            EXPECT_EQ(I[q], nb + q);
+        }
+    }
+}
+
+TEST(HNSW, add_with_knn_graph) {
+    std::vector<float> xb = make_data(nb, 1);
+    std::vector<float> xq = make_data(nq, 2);
+
+    for (MetricType metric: {METRIC_L2, METRIC_INNER_PRODUCT}) {
+        IndexFlat ref(d, metric);
+        ref.add(nb, xb.data());
+        std::vector<float> D_ref(nq);
+        std::vector<idx_t> I_ref(nq);
+        ref.search(nq, xq.data(), 1, D_ref.data(), I_ref.data());
+
+        // exact kNN graph, the vectors are their own nearest neighbor
+        int knn = 33;
+        std::vector<float> D_knn(nb * knn);
+        std::vector<idx_t> I_knn(nb * knn);
+        ref.search(nb, xb.data(), knn, D_knn.data(), I_knn.data());
+
+        // the kNN graph of NN-descent is close to the exact one
+        NNDescent nnd(knn - 1);
+        nnd.L = 48;
+        std::vector<idx_t> I_nnd(nb * nnd.K);
+        nnd.build(&ref, I_nnd.data(), nullptr);
+        size_t nfound = 0;
+        for (size_t i = 0; i < nb; i++) {
+            for (int j = 0; j < nnd.K; j++) {
+                const idx_t *ki = I_knn.data() + i * knn;
+                if (std::find(ki, ki + knn, I_nnd[i * nnd.K + j]) != ki + knn) {
+                    nfound++;
+                }
+            }
+        }
+        EXPECT_GT(nfound, 0.9 * nb * nnd.K);
+
+        for (int variant = 0; variant < 2; variant++) {
+            IndexHNSWFlat index(d, 16, metric);
+            if (variant == 0) {
+                index.add_with_knn_graph(nb, xb.data(), knn,
+                                         D_knn.data(), I_knn.data());
+            } else {
+                index.add_with_nndescent(nb, xb.data());
+            }
+            EXPECT_EQ(index.ntotal, nb);
+            EXPECT_GE(index.hnsw.entry_point, 0);
+
+            std::vector<float> D(nq * k);
+            std::vector<idx_t> I(nq * k);
+            index.search(nq, xq.data(), k, D.data(), I.data());
+            size_t nok = 0;
+            for (size_t q = 0; q < nq; q++) {
+                if (std::find(I.begin() + q * k, I.begin() + (q + 1) * k,
+                              I_ref[q]) != I.begin() + (q + 1) * k) {
+                    nok++;
+                }
+            }
+            EXPECT_GT(nok, 0.9 * nq);
+        }
+    }
+}
+
+TEST(HNSW, search_batch_size) {
+    std::vector<float> xb = make_data(nb, 1);
+    std::vector<float> xq = make_data(nq, 2);
+
+    for (MetricType metric: {METRIC_L2, METRIC_INNER_PRODUCT}) {
+        IndexFlat ref(d, metric);
+        ref.add(nb, xb.data());
+        std::vector<float> D_ref(nq);
+        std::vector<idx_t> I_ref(nq);
+        ref.search(nq, xq.data(), 1, D_ref.data(), I_ref.data());
+
+        IndexHNSWFlat index(d, 16, metric);
+        index.add(nb, xb.data());
+
+        auto recall = [&](const std::vector<idx_t> & I) {
+            size_t nok = 0;
+            for (size_t q = 0; q < nq; q++) {
+                if (std::find(I.begin() + q * k, I.begin() + (q + 1) * k,
+                              I_ref[q]) != I.begin() + (q + 1) * k) {
+                    nok++;
+                }
+            }
+            return nok / double(nq);
+        };
+
+        std::vector<float> D0(nq * k), D(nq * k);
+        std::vector<idx_t> I0(nq * k), I(nq * k);
+        index.search(nq, xq.data(), k, D0.data(), I0.data());
+
+        // the last group is incomplete
+        index.search_batch_size = 7;
+        index.search(nq, xq.data(), k, D.data(), I.data());
+        EXPECT_GE(recall(I), recall(I0) - 0.02);
+        for (size_t q = 0; q < nq; q++) {
+            for (idx_t j = 1; j < k; j++) {
+                if (metric == METRIC_L2) {
+                    EXPECT_LE(D[q * k + j - 1], D[q * k + j]);
+                } else {
+                    EXPECT_GE(D[q * k + j - 1], D[q * k + j]);
+                }
+            }
+        }
+
+        // the ID selector and the deleted vectors are respected
+        IDSelectorRange sel(0, nb / 2);
+        SearchParametersHNSW params;
+        params.efSearch = 32;
+        params.sel = &sel;
+        index.search(nq, xq.data(), k, D.data(), I.data(), &params);
+        for (idx_t i: I) {
+            EXPECT_TRUE(i >= 0 && i < nb / 2);
+        }
+
+        IDSelectorRange del(0, nb / 4);
+        index.remove_ids(del);
+        index.search(nq, xq.data(), k, D.data(), I.data(), &params);
+        for (idx_t i: I) {
+            EXPECT_TRUE(i >= nb / 4 && i < nb / 2);
+        }
+    }
+}
+
+TEST(HNSW, merge_from) {
+    std::vector<float> xb = make_data(nb, 1);
+    std::vector<float> xq = make_data(nq, 2);
+
+    IndexFlatL2 ref(d);
+    ref.add(nb, xb.data());
+    std::vector<float> D_ref(nq);
+    std::vector<idx_t> I_ref(nq);
+    ref.search(nq, xq.data(), 1, D_ref.data(), I_ref.data());
+
+    // two shards, the second one with renumbered nodes
+    size_t n0 = nb / 2;
+    IndexHNSWFlat index(d, 16), shard(d, 16);
+    index.add(n0, xb.data());
+    shard.add(nb - n0, xb.data() + n0 * d);
+    shard.reorder_nodes();
+    index.merge_from(shard);
+    EXPECT_EQ(index.ntotal, nb);
+    EXPECT_EQ(shard.ntotal, 0);
+
+    // most nodes are linked to the other shard at level 0
+    size_t ncross = 0;
+    for (idx_t i = 0; i < nb; i++) {
+        size_t begin, end;
+        index.hnsw.neighbor_range(i, 0, &begin, &end);
+        for (size_t j = begin; j < end; j++) {
+            HNSW::storage_idx_t v = index.hnsw.neighbors[j];
+            if (v >= 0 && (v < n0) != (i < n0)) {
+                ncross++;
+                break;
+            }
+        }
+    }
+    EXPECT_GT(ncross, nb * 9 / 10);
+
+    std::vector<float> D(nq * k);
+    std::vector<idx_t> I(nq * k);
+    index.search(nq, xq.data(), k, D.data(), I.data());
+    size_t nok = 0;
+    for (size_t q = 0; q < nq; q++) {
+        if (std::find(I.begin() + q * k, I.begin() + (q + 1) * k,
+                      I_ref[q]) != I.begin() + (q + 1) * k) {
+            nok++;
+        }
+    }
+    EXPECT_GE(nok / double(nq), build_and_search(0) - 0.05);
+
+    std::vector<float> recons(d);
+    for (idx_t i = 0; i < nb; i += 97) {
+        index.reconstruct(i, recons.data());
+        EXPECT_TRUE(std::equal(recons.begin(), recons.end(),
+                               xb.begin() + i * d));
+    }
+}
+
+TEST(HNSW, compress_links) {
+    std::vector<float> xb = make_data(nb, 1);
+    std::vector<float> xq = make_data(nq, 2);
+
+    IndexHNSWFlat ref(d, 16);
+    ref.add(nb, xb.data());
+    ref.reorder_nodes();
+
+    VectorIOWriter writer;
+    write_index(&ref, &writer);
+    VectorIOReader reader;
+    reader.data = writer.data;
+    std::unique_ptr<IndexHNSW> index(
+        dynamic_cast<IndexHNSW*>(read_index(&reader)));
+    index->hnsw.compress_links();
+    const HNSW & hnsw = index->hnsw;
+    EXPECT_TRUE(hnsw.neighbors.empty());
+    EXPECT_LT(2 * hnsw.compressed_links.size(),
+              ref.hnsw.neighbors.size() * sizeof(HNSW::storage_idx_t));
+
+    // same links, sorted by id
+    std::vector<HNSW::storage_idx_t> buf(256), buf_ref(256);
+    for (HNSW::storage_idx_t i = 0; i < nb; i++) {
+        for (int level = 0; level < hnsw.levels[i]; level++) {
+            size_t n, n_ref;
+            const HNSW::storage_idx_t *l =
+                hnsw.neighbor_list(i, level, buf.data(), &n);
+            const HNSW::storage_idx_t *l_ref =
+                ref.hnsw.neighbor_list(i, level, buf_ref.data(), &n_ref);
+            std::vector<HNSW::storage_idx_t> v(l, l + n);
+            std::vector<HNSW::storage_idx_t> v_ref(l_ref, l_ref + n_ref);
+            v_ref.erase(std::remove(v_ref.begin(), v_ref.end(), -1),
+                        v_ref.end());
+            std::sort(v_ref.begin(), v_ref.end());
+            EXPECT_EQ(v_ref, v);
+        }
+    }
+
+    // the order of the neighbors changes the search a little
+    std::vector<float> D_ref(nq * k), D(nq * k), D2(nq * k);
+    std::vector<idx_t> I_ref(nq * k), I(nq * k), I2(nq * k);
+    ref.search(nq, xq.data(), k, D_ref.data(), I_ref.data());
+    index->search(nq, xq.data(), k, D.data(), I.data());
+    size_t nsame = 0;
+    for (size_t i = 0; i < nq * k; i++) {
+        nsame += I[i] == I_ref[i];
+    }
+    EXPECT_GT(nsame, nq * k * 9 / 10);
+
+    // the decompressed graph has the same lists, so the same results
+    VectorIOWriter writer2;
+    write_index(index.get(), &writer2);
+    VectorIOReader reader2;
+    reader2.data = writer2.data;
+    std::unique_ptr<IndexHNSW> index2(
+        dynamic_cast<IndexHNSW*>(read_index(&reader2)));
+    EXPECT_TRUE(index2->hnsw.links_compressed);
+    index2->search(nq, xq.data(), k, D2.data(), I2.data());
+    EXPECT_EQ(I, I2);
+    EXPECT_EQ(D, D2);
+
+    index2->hnsw.decompress_links();
+    EXPECT_FALSE(index2->hnsw.links_compressed);
+    for (int batch_size: {1, 8}) {
+        index->search_batch_size = batch_size;
+        index2->search_batch_size = batch_size;
+        index->search(nq, xq.data(), k, D.data(), I.data());
+        index2->search(nq, xq.data(), k, D2.data(), I2.data());
+        EXPECT_EQ(I, I2);
+        EXPECT_EQ(D, D2);
+    }
+
+    RangeSearchResult res(nq), res2(nq);
+    index->range_search(nq, xq.data(), 0.1, &res);
+    index2->range_search(nq, xq.data(), 0.1, &res2);
+    EXPECT_EQ(res.lims[nq], res2.lims[nq]);
+
+    // the compressed graph is read-only
+    EXPECT_THROW(index->add(nq, xq.data()), FaissException);
+    index2->add(nq, xq.data());
+}
+
+TEST(HNSW, link_and_code) {
+    std::vector<float> xb = make_data(nb, 1);
+
+    IndexHNSWSQ index(d, ScalarQuantizer::QT_4bit, 16);
+    index.train(nb, xb.data());
+    index.add(nb, xb.data());
+    index.hnsw.compress_links();
+
+    double err_storage = 0;
+    std::vector<float> recons(d);
+    for (idx_t i = 0; i < nb; i++) {
+        index.storage->reconstruct(i, recons.data());
+        err_storage += fvec_L2sqr(recons.data(), xb.data() + i * d, d);
+    }
+
+    for (size_t nsq: {1, 2}) {
+        ReconstructFromNeighbors rfn(index, 16, nsq);
+        rfn.train(nb, xb.data(), 3);
+        rfn.add_codes(nb, xb.data());
+        EXPECT_EQ(rfn.ntotal, nb);
+
+        std::vector<float> tmp(d);
+        double err = 0;
+        for (idx_t i = 0; i < nb; i++) {
+            rfn.reconstruct(i, recons.data(), tmp.data());
+            err += fvec_L2sqr(recons.data(), xb.data() + i * d, d);
+        }
+        EXPECT_LT(err, 0.95 * err_storage);
+    }
+}
@@ -0,0 +1,178 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexHNSW.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/io.h>
+#include <faiss/index_io.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 16;
+size_t nb = 5000;
+size_t nq = 100;
+idx_t k = 10;
+
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector <float> x (n * d);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < n * d; i++) {
+        x[i] = distrib(rng);
+    }
+    return x;
+}
+
+bool is_removed(idx_t i) {
+    return i % 10 == 0;
+}
+
+/// check that no removed vector is returned and compute the 1-recall@k
+/// w.r.t. the live vectors
+double check_search(const IndexHNSW& index, const std::vector<float>& xb)
+{
+    std::vector<float> xq = make_data(nq, 2);
+
+    IndexFlatL2 ref(d);
+    std::vector<idx_t> ids;
+    for (size_t i = 0; i < nb; i++) {
+        if (!is_removed(i)) {
+            ref.add(1, xb.data() + i * d);
+            ids.push_back(i);
+        }
+    }
+    std::vector<float> D_ref(nq);
+    std::vector<idx_t> I_ref(nq);
+    ref.search(nq, xq.data(), 1, D_ref.data(), I_ref.data());
+
+    std::vector<float> D(nq * k);
+    std::vector<idx_t> I(nq * k);
+    index.search(nq, xq.data(), k, D.data(), I.data());
+
+    size_t n_ok = 0;
+    for (size_t q = 0; q < nq; q++) {
+        for (idx_t j = 0; j < k; j++) {
+            idx_t id = I[q * k + j];
+            EXPECT_GE(id, 0);
+            EXPECT_FALSE(is_removed(id));
+            if (id == ids[I_ref[q]]) {
+                n_ok++;
+            }
+        }
+    }
+
+    RangeSearchResult res(nq);
+    index.range_search(nq, xq.data(), D[k - 1], &res);
+    for (size_t i = 0; i < res.lims[nq]; i++) {
+        EXPECT_FALSE(is_removed(res.labels[i]));
+    }
+    return n_ok / double(nq);
+}
+
+}  // namespace
+
+
+TEST(HNSW, remove_and_repair) {
+    std::vector<float> xb = make_data(nb, 1);
+    IndexHNSWFlat index(d, 16);
+    index.add(nb, xb.data());
+
+    std::vector<idx_t> del;
+    for (size_t i = 0; i < nb; i++) {
+        if (is_removed(i)) {
+            del.push_back(i);
+        }
+    }
+    IDSelectorBatch sel_del(del.size(), del.data());
+    EXPECT_EQ(index.remove_ids(sel_del), del.size());
+    // already removed
+    EXPECT_EQ(index.remove_ids(sel_del), 0);
+    EXPECT_EQ(index.ntotal, nb);
+    EXPECT_EQ(index.hnsw.ndeleted, del.size());
+    EXPECT_GT(check_search(index, xb), 0.9);
+
+    // the deleted nodes are not reachable from the live ones anymore
+    EXPECT_EQ(index.repair_deleted(), del.size());
+    EXPECT_EQ(index.hnsw.free_slots.size(), del.size());
+    EXPECT_EQ(index.repair_deleted(), 0);
+    const HNSW& hnsw = index.hnsw;
+    EXPECT_FALSE(hnsw.is_deleted(hnsw.entry_point));
+    for (idx_t i = 0; i < nb; i++) {
+        for (int level = 0; level < hnsw.levels[i]; level++) {
+            size_t begin, end;
+            hnsw.neighbor_range(i, level, &begin, &end);
+            for (size_t j = begin; j < end; j++) {
+                if (is_removed(i)) {
+                    EXPECT_EQ(hnsw.neighbors[j], -1);
+                } else if (hnsw.neighbors[j] >= 0) {
+                    EXPECT_FALSE(is_removed(hnsw.neighbors[j]));
+                }
+            }
+        }
+    }
+    EXPECT_GT(check_search(index, xb), 0.9);
+
+    // the deleted nodes are stored with the index
+    VectorIOWriter writer;
+    write_index(&index, &writer);
+    VectorIOReader reader;
+    reader.data = writer.data;
+    std::unique_ptr<IndexHNSW> index2(
+        dynamic_cast<IndexHNSW*>(read_index(&reader)));
+    ASSERT_TRUE(index2);
+    EXPECT_EQ(index2->hnsw.ndeleted, del.size());
+    EXPECT_EQ(index2->hnsw.free_slots, hnsw.free_slots);
+    EXPECT_EQ(index2->hnsw.deleted, hnsw.deleted);
+    EXPECT_GT(check_search(*index2, xb), 0.9);
+}
+
+TEST(HNSW, reuse_free_slots) {
+    std::vector<float> xb = make_data(nb, 1);
+    IndexHNSWFlat index(d, 16);
+    index.add(nb, xb.data());
+
+    IDSelectorRange sel(0, nb / 10);
+    index.remove_ids(sel);
+    index.repair_deleted();
+
+    // more vectors than free slots: the others are appended
+    size_t nnew = nb / 10 + 100;
+    std::vector<float> xnew = make_data(nnew, 3);
+    std::vector<idx_t> labels(nnew);
+    index.add_in_free_slots(nnew, xnew.data(), labels.data());
+    EXPECT_EQ(index.ntotal, nb + 100);
+    EXPECT_EQ(index.hnsw.ndeleted, 0);
+    EXPECT_TRUE(index.hnsw.free_slots.empty());
+    for (size_t i = 0; i < nnew; i++) {
+        EXPECT_EQ(labels[i], i < nb / 10 ? i : nb + i - nb / 10);
+    }
+
+    // the new vectors are found at their slot
+    std::vector<float> D(nnew);
+    std::vector<idx_t> I(nnew);
+    index.search(nnew, xnew.data(), 1, D.data(), I.data());
+    size_t n_ok = 0;
+    for (size_t i = 0; i < nnew; i++) {
+        if (I[i] == labels[i]) {
+            n_ok++;
+        }
+    }
+    EXPECT_GT(n_ok, nnew * 0.95);
+}
@@ -0,0 +1,159 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexHNSW.h>
+#include <faiss/index_io.h>
+#include <faiss/utils/hugepages.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 64;
+size_t nb = 12000; // 3 MiB of vectors
+size_t nq = 20;
+idx_t k = 5;
+
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector<float> x(n * d);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < n * d; i++) {
+        x[i] = distrib(rng);
+    }
+    return x;
+}
+
+/// sets the huge page mode for the scope of a test
+struct HugePageScope {
+    int mode;
+    size_t min_bytes;
+
+    explicit HugePageScope(int new_mode):
+        mode(hugepage_mode), min_bytes(hugepage_min_bytes) {
+        hugepage_mode = new_mode;
+        hugepage_min_bytes = 0;
+    }
+
+    ~HugePageScope() {
+        hugepage_mode = mode;
+        hugepage_min_bytes = min_bytes;
+    }
+};
+
+bool is_2M_aligned(const void *p)
+{
+    return ((uintptr_t)p & ((1 << 21) - 1)) == 0;
+}
+
+void test_flat(int mode)
+{
+    std::vector<float> xb = make_data(nb, 1);
+    std::vector<float> xq = make_data(nq, 2);
+
+    IndexFlatL2 ref(d);
+    ref.add(nb, xb.data());
+    std::vector<float> Dref(nq * k);
+    std::vector<idx_t> Iref(nq * k);
+    ref.search(nq, xq.data(), k, Dref.data(), Iref.data());
+
+    HugePageScope scope(mode);
+    HugePageStats s0 = get_hugepage_stats();
+
+    std::unique_ptr<IndexFlatL2> index(new IndexFlatL2(d));
+    index->add(nb, xb.data());
+    EXPECT_TRUE(is_2M_aligned(index->xb.data()));
+
+    HugePageStats s1 = get_hugepage_stats();
+    EXPECT_EQ(s1.n_mappings, s0.n_mappings + 1);
+    EXPECT_GE(s1.mapped_bytes - s0.mapped_bytes, nb * d * sizeof(float));
+    EXPECT_LE(s1.backed_bytes, s1.mapped_bytes);
+
+    std::vector<float> D(nq * k);
+    std::vector<idx_t> I(nq * k);
+    index->search(nq, xq.data(), k, D.data(), I.data());
+    EXPECT_EQ(I, Iref);
+    EXPECT_EQ(D, Dref);
+
+    // the arrays of an index that is read are also mapped
+    char fname[] = "/tmp/faiss_test_hugepages_XXXXXX";
+    int fd = mkstemp(fname);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    write_index(index.get(), fname);
+    std::unique_ptr<IndexFlatL2> index2(
+          dynamic_cast<IndexFlatL2*>(read_index(fname)));
+    unlink(fname);
+    ASSERT_TRUE(index2);
+    EXPECT_TRUE(is_2M_aligned(index2->xb.data()));
+    EXPECT_EQ(get_hugepage_stats().n_mappings, s0.n_mappings + 2);
+    index2->search(nq, xq.data(), k, D.data(), I.data());
+    EXPECT_EQ(I, Iref);
+
+    index.reset();
+    index2.reset();
+    HugePageStats s2 = get_hugepage_stats();
+    EXPECT_EQ(s2.n_mappings, s0.n_mappings);
+    EXPECT_EQ(s2.mapped_bytes, s0.mapped_bytes);
+}
+
+} // namespace
+
+
+TEST(HugePages, flat_madvise) {
+    test_flat(HUGEPAGES_MADVISE);
+}
+
+TEST(HugePages, flat_hugetlb) {
+    // falls back to transparent huge pages if the pool is empty
+    test_flat(HUGEPAGES_HUGETLB);
+}
+
+TEST(HugePages, allocator_mode_change) {
+    // a block is freed correctly after the mode changed
+    std::vector<float, HugePageAllocator<float> > v;
+    {
+        HugePageScope scope(HUGEPAGES_MADVISE);
+        v.resize(1 << 20);
+    }
+    EXPECT_TRUE(is_2M_aligned(v.data()));
+    size_t n0 = get_hugepage_stats().n_mappings;
+    std::vector<float, HugePageAllocator<float> > v2(1 << 20);
+    EXPECT_EQ(get_hugepage_stats().n_mappings, n0);
+    v.clear();
+    v.shrink_to_fit();
+    EXPECT_EQ(get_hugepage_stats().n_mappings, n0 - 1);
+}
+
+TEST(HugePages, hnsw_neighbors) {
+    HugePageScope scope(HUGEPAGES_MADVISE);
+    size_t n = 10000;
+    std::vector<float> xb = make_data(n, 3);
+    IndexHNSWFlat index(d, 32);
+    size_t n0 = get_hugepage_stats().n_mappings;
+    index.add(n, xb.data());
+    // >= 10000 * 64 links of level 0
+    EXPECT_TRUE(is_2M_aligned(index.hnsw.neighbors.data()));
+    EXPECT_GE(get_hugepage_stats().n_mappings, n0 + 1);
+}
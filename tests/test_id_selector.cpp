@@ -0,0 +1,202 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexHNSW.h>
+#include <faiss/IndexIVF.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/index_factory.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 32;
+size_t nb = 2000;
+size_t nq = 20;
+idx_t k = 10;
+
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector <float> x (n * d);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < n * d; i++) {
+        x[i] = distrib(rng);
+    }
+    return x;
+}
+
+// selects the ids that are multiples of 3
+std::vector<uint8_t> make_bitmap()
+{
+    std::vector<uint8_t> bitmap((nb + 7) / 8);
+    for (size_t i = 0; i < nb; i += 3) {
+        bitmap[i >> 3] |= 1 << (i & 7);
+    }
+    return bitmap;
+}
+
+/// exact search restricted to the selected ids
+void search_ref(const std::vector<float> & xb, const std::vector<float> & xq,
+                std::vector<float> & D, std::vector<idx_t> & I)
+{
+    std::vector<float> xsub;
+    std::vector<idx_t> ids;
+    for (size_t i = 0; i < nb; i += 3) {
+        xsub.insert(xsub.end(), xb.begin() + i * d, xb.begin() + (i + 1) * d);
+        ids.push_back(i);
+    }
+    IndexFlatL2 index(d);
+    index.add(ids.size(), xsub.data());
+    D.resize(nq * k);
+    I.resize(nq * k);
+    index.search(nq, xq.data(), k, D.data(), I.data());
+    for (size_t i = 0; i < nq * k; i++) {
+        I[i] = ids[I[i]];
+    }
+}
+
+/// returns the fraction of results equal to the reference
+double test_selector(Index & index, const SearchParameters & params)
+{
+    std::vector<float> xb = make_data(nb, 1);
+    std::vector<float> xq = make_data(nq, 2);
+
+    index.train(nb, xb.data());
+    index.add(nb, xb.data());
+
+    std::vector<float> D(nq * k);
+    std::vector<idx_t> I(nq * k);
+    index.search(nq, xq.data(), k, D.data(), I.data(), &params);
+
+    std::vector<float> D_ref;
+    std::vector<idx_t> I_ref;
+    search_ref(xb, xq, D_ref, I_ref);
+
+    size_t nok = 0;
+    for (size_t i = 0; i < nq * k; i++) {
+        EXPECT_TRUE(I[i] == -1 || params.sel->is_member(I[i]));
+        nok += I[i] == I_ref[i];
+    }
+    return nok / double(nq * k);
+}
+
+double test_ivf_selector(const char *index_key, size_t reservoir_min_k = 0)
+{
+    std::unique_ptr<Index> index(index_factory(d, index_key));
+    IndexIVF *ivf = dynamic_cast<IndexIVF*>(index.get());
+    ivf->reservoir_min_k = reservoir_min_k;
+
+    std::vector<uint8_t> bitmap = make_bitmap();
+    IDSelectorBitmap sel(bitmap.size(), bitmap.data());
+    IVFSearchParameters params;
+    params.nprobe = ivf->nlist;
+    params.sel = &sel;
+
+    return test_selector(*index, params);
+}
+
+} // namespace
+
+
+TEST(IDSelector, bitmap) {
+    std::vector<uint8_t> bitmap = make_bitmap();
+    IDSelectorBitmap sel(bitmap.size(), bitmap.data());
+    for (idx_t i = 0; i < (idx_t)bitmap.size() * 8; i++) {
+        EXPECT_EQ(sel.is_member(i), i % 3 == 0);
+    }
+    EXPECT_FALSE(sel.is_member(-1));
+    EXPECT_FALSE(sel.is_member(bitmap.size() * 8 + 3));
+}
+
+TEST(IDSelector, IVFFlat) {
+    // exhaustive scan: the results are exact
+    EXPECT_EQ(test_ivf_selector("IVF16,Flat"), 1.0);
+}
+
+TEST(IDSelector, IVFFlat_reservoir) {
+    EXPECT_EQ(test_ivf_selector("IVF16,Flat", 5), 1.0);
+}
+
+TEST(IDSelector, IVFSQ) {
+    EXPECT_GT(test_ivf_selector("IVF16,SQ8"), 0.8);
+}
+
+TEST(IDSelector, IVFPQ) {
+    EXPECT_GT(test_ivf_selector("IVF16,PQ16np"), 0.3);
+}
+
+TEST(IDSelector, IVF_range_search) {
+    std::vector<float> xb = make_data(nb, 1);
+    std::vector<float> xq = make_data(nq, 2);
+    std::unique_ptr<Index> index(index_factory(d, "IVF16,Flat"));
+    IndexIVF *ivf = dynamic_cast<IndexIVF*>(index.get());
+    index->train(nb, xb.data());
+    index->add(nb, xb.data());
+
+    std::vector<uint8_t> bitmap = make_bitmap();
+    IDSelectorBitmap sel(bitmap.size(), bitmap.data());
+    IVFSearchParameters params;
+    params.nprobe = ivf->nlist;
+    params.sel = &sel;
+
+    std::vector<idx_t> keys(nq * ivf->nlist);
+    std::vector<float> coarse_dis(nq * ivf->nlist);
+    ivf->quantizer->search(nq, xq.data(), ivf->nlist,
+                           coarse_dis.data(), keys.data());
+
+    RangeSearchResult res(nq), res_all(nq);
+    ivf->range_search_preassigned(nq, xq.data(), 4.0, keys.data(),
+                                  coarse_dis.data(), &res, false, &params);
+    params.sel = nullptr;
+    ivf->range_search_preassigned(nq, xq.data(), 4.0, keys.data(),
+                                  coarse_dis.data(), &res_all, false, &params);
+
+    size_t nsel = 0;
+    for (size_t i = 0; i < res_all.lims[nq]; i++) {
+        nsel += sel.is_member(res_all.labels[i]);
+    }
+    EXPECT_GT(nsel, 0);
+    EXPECT_EQ(res.lims[nq], nsel);
+    for (size_t i = 0; i < res.lims[nq]; i++) {
+        EXPECT_TRUE(sel.is_member(res.labels[i]));
+    }
+}
+
+TEST(IDSelector, HNSW) {
+    IndexHNSWFlat index(d, 16);
+    std::vector<uint8_t> bitmap = make_bitmap();
+    IDSelectorBitmap sel(bitmap.size(), bitmap.data());
+    SearchParametersHNSW params;
+    params.efSearch = 64;
+    params.sel = &sel;
+    EXPECT_GT(test_selector(index, params), 0.9);
+}
+
+TEST(IDSelector, HNSW_unbounded_queue) {
+    IndexHNSWFlat index(d, 16);
+    index.hnsw.search_bounded_queue = false;
+    std::vector<uint8_t> bitmap = make_bitmap();
+    IDSelectorBitmap sel(bitmap.size(), bitmap.data());
+    SearchParametersHNSW params;
+    params.efSearch = 64;
+    params.sel = &sel;
+    EXPECT_GT(test_selector(index, params), 0.8);
+}
@@ -0,0 +1,135 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cmath>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/Index2Layer.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVFPQ.h>
+#include <faiss/IndexPQ.h>
+#include <faiss/utils/random.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 32;
+size_t nb = 2000;
+size_t nq = 20;
+idx_t k = 10;
+
+/// compare the search with a brute-force search on the reconstructed
+/// vectors
+void check_search(const Index2Layer& index, const float *xq)
+{
+    std::vector<float> recons(index.ntotal * d);
+    index.reconstruct_n(0, index.ntotal, recons.data());
+    IndexFlat ref(d, index.metric_type);
+    ref.add(index.ntotal, recons.data());
+
+    std::vector<float> D(nq * k), D_ref(nq * k);
+    std::vector<idx_t> I(nq * k), I_ref(nq * k);
+    index.search(nq, xq, k, D.data(), I.data());
+    ref.search(nq, xq, k, D_ref.data(), I_ref.data());
+
+    size_t n_same = 0;
+    for (size_t i = 0; i < nq * k; i++) {
+        EXPECT_NEAR(D[i], D_ref[i], 1e-3 * (1 + std::abs(D_ref[i])));
+        if (I[i] == I_ref[i]) {
+            n_same++;
+        }
+    }
+    EXPECT_GT(n_same, nq * k * 0.95);
+}
+
+void test_2layer(Index *quantizer, size_t nlist, int nbit, MetricType metric)
+{
+    std::vector<float> xb(nb * d), xq(nq * d);
+    float_randn(xb.data(), xb.size(), 1);
+    float_randn(xq.data(), xq.size(), 2);
+
+    Index2Layer index(quantizer, nlist, 8, nbit, metric);
+    index.train(nb, xb.data());
+    index.add(nb, xb.data());
+
+    EXPECT_EQ(index.precomputed_table.empty(), metric != METRIC_L2);
+    check_search(index, xq.data());
+    if (metric == METRIC_L2) {
+        // computed on the fly
+        index.precomputed_table.clear();
+        check_search(index, xq.data());
+    }
+}
+
+}  // namespace
+
+
+TEST(Index2Layer, search_L2) {
+    IndexFlatL2 quantizer(d);
+    test_2layer(&quantizer, 16, 8, METRIC_L2);
+}
+
+TEST(Index2Layer, search_L2_6bit) {
+    IndexFlatL2 quantizer(d);
+    test_2layer(&quantizer, 16, 6, METRIC_L2);
+}
+
+TEST(Index2Layer, search_IP) {
+    IndexFlatIP quantizer(d);
+    test_2layer(&quantizer, 16, 8, METRIC_INNER_PRODUCT);
+}
+
+TEST(Index2Layer, search_multi_index) {
+    std::vector<float> xt(nb * d);
+    float_randn(xt.data(), xt.size(), 3);
+    MultiIndexQuantizer quantizer(d, 2, 3);
+    quantizer.train(nb, xt.data());
+    test_2layer(&quantizer, 64, 8, METRIC_L2);
+}
+
+TEST(Index2Layer, transfer_to_IVFPQ) {
+    std::vector<float> xb(nb * d), xq(nq * d);
+    float_randn(xb.data(), xb.size(), 1);
+    float_randn(xq.data(), xq.size(), 2);
+    size_t nlist = 16;
+
+    IndexFlatL2 quantizer(d);
+    Index2Layer index(&quantizer, nlist, 8);
+    index.train(nb, xb.data());
+    index.add(nb, xb.data());
+
+    // the PQ is copied from the Index2Layer
+    IndexIVFPQ ivfpq(&quantizer, d, nlist, 8, 8);
+    index.transfer_to_IVFPQ(ivfpq);
+    EXPECT_TRUE(ivfpq.is_trained);
+    EXPECT_EQ(ivfpq.ntotal, nb);
+
+    ivfpq.make_direct_map();
+    std::vector<float> recons(d), recons_ref(d);
+    for (idx_t i = 0; i < nb; i += 97) {
+        ivfpq.reconstruct(i, recons.data());
+        index.reconstruct(i, recons_ref.data());
+        for (int j = 0; j < d; j++) {
+            EXPECT_NEAR(recons[j], recons_ref[j], 1e-5);
+        }
+    }
+
+    ivfpq.nprobe = nlist;
+    std::vector<float> D(nq * k), D_ref(nq * k);
+    std::vector<idx_t> I(nq * k), I_ref(nq * k);
+    ivfpq.search(nq, xq.data(), k, D.data(), I.data());
+    index.search(nq, xq.data(), k, D_ref.data(), I_ref.data());
+    for (size_t i = 0; i < nq * k; i++) {
+        EXPECT_NEAR(D[i], D_ref[i], 1e-3 * (1 + std::abs(D_ref[i])));
+    }
+}
@@ -0,0 +1,186 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexCached.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVF.h>
+#include <faiss/IndexReplicas.h>
+#include <faiss/IndexShards.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/index_factory.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 16;
+size_t nb = 2000;
+size_t nq = 20;
+idx_t k = 5;
+
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector<float> x(n * d);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < n * d; i++) {
+        x[i] = distrib(rng);
+    }
+    return x;
+}
+
+} // namespace
+
+
+TEST(IndexCached, hits_and_invalidation) {
+    std::vector<float> xb = make_data(nb, 1);
+    std::vector<float> xq = make_data(nq, 2);
+
+    IndexFlatL2 ref(d);
+    ref.add(nb, xb.data());
+    IndexCached index(new IndexFlatL2(d));
+    index.own_fields = true;
+    index.add(nb, xb.data());
+    EXPECT_EQ(index.ntotal, nb);
+
+    std::vector<float> D_ref(nq * k), D(nq * k);
+    std::vector<idx_t> I_ref(nq * k), I(nq * k);
+    ref.search(nq, xq.data(), k, D_ref.data(), I_ref.data());
+
+    index.search(nq, xq.data(), k, D.data(), I.data());
+    EXPECT_EQ(I, I_ref);
+    EXPECT_EQ(D, D_ref);
+    EXPECT_EQ(index.stats.nmiss, nq);
+    EXPECT_EQ(index.cache_size(), nq);
+
+    // all hits, also in another batch order
+    index.search(nq / 2, xq.data() + nq / 2 * d, k, D.data(), I.data());
+    index.search(nq / 2, xq.data(), k,
+                 D.data() + nq / 2 * k, I.data() + nq / 2 * k);
+    for (size_t q = 0; q < nq / 2; q++) {
+        for (idx_t j = 0; j < k; j++) {
+            EXPECT_EQ(I[q * k + j], I_ref[(q + nq / 2) * k + j]);
+            EXPECT_EQ(I[(q + nq / 2) * k + j], I_ref[q * k + j]);
+        }
+    }
+    EXPECT_EQ(index.stats.nhit, nq);
+    EXPECT_EQ(index.stats.hit_rate(), 0.5);
+
+    // another k is another key
+    std::vector<float> D1(nq);
+    std::vector<idx_t> I1(nq);
+    index.search(nq, xq.data(), 1, D1.data(), I1.data());
+    EXPECT_EQ(index.stats.nmiss, 2 * nq);
+
+    // adding invalidates the cache: the queries are now in the index
+    index.add(nq, xq.data());
+    EXPECT_EQ(index.cache_size(), 0);
+    index.search(nq, xq.data(), 1, D1.data(), I1.data());
+    for (size_t q = 0; q < nq; q++) {
+        EXPECT_EQ(I1[q], nb + q);
+    }
+
+}
+
+TEST(IndexCached, lru_eviction) {
+    std::vector<float> xb = make_data(nb, 1);
+    std::vector<float> xq = make_data(200, 2);
+
+    IndexFlatL2 flat(d);
+    flat.add(nb, xb.data());
+    IndexCached index(&flat, 32);
+
+    std::vector<float> D(k);
+    std::vector<idx_t> I(k);
+    for (size_t q = 0; q < 200; q++) {
+        index.search(1, xq.data() + q * d, k, D.data(), I.data());
+        // the first query stays in the cache because it is always used
+        index.search(1, xq.data(), k, D.data(), I.data());
+    }
+    EXPECT_LE(index.cache_size(), 32 + IndexCached::nsegment);
+    EXPECT_GT(index.stats.nevict, 0);
+    EXPECT_GE(index.stats.nhit, 199);
+}
+
+TEST(IndexCached, search_parameters) {
+    std::vector<float> xb = make_data(nb, 1);
+    std::vector<float> xq = make_data(nq, 2);
+
+    std::unique_ptr<Index> ivf(index_factory(d, "IVF32,Flat"));
+    ivf->train(nb, xb.data());
+    ivf->add(nb, xb.data());
+    IndexCached index(ivf.get());
+
+    std::vector<float> D(nq * k), D_ref(nq * k);
+    std::vector<idx_t> I(nq * k), I_ref(nq * k);
+    for (size_t nprobe: {1, 4, 1, 4}) {
+        IVFSearchParameters params;
+        params.nprobe = nprobe;
+        ivf->search(nq, xq.data(), k, D_ref.data(), I_ref.data(), &params);
+        index.search(nq, xq.data(), k, D.data(), I.data(), &params);
+        EXPECT_EQ(I, I_ref);
+        EXPECT_EQ(D, D_ref);
+    }
+    EXPECT_EQ(index.stats.nmiss, 2 * nq);
+    EXPECT_EQ(index.stats.nhit, 2 * nq);
+
+    // selectors are not cached
+    IDSelectorRange sel(0, nb / 2);
+    IVFSearchParameters params;
+    params.sel = &sel;
+    index.stats.reset();
+    index.search(nq, xq.data(), k, D.data(), I.data(), &params);
+    EXPECT_EQ(index.stats.nbypass, nq);
+    for (idx_t i: I) {
+        EXPECT_LT(i, (idx_t)nb / 2);
+    }
+}
+
+TEST(IndexCached, shards_and_replicas) {
+    std::vector<float> xb = make_data(nb, 1);
+    std::vector<float> xq = make_data(nq, 2);
+
+    IndexFlatL2 ref(d);
+    ref.add(nb, xb.data());
+    std::vector<float> D_ref(nq * k), D(nq * k);
+    std::vector<idx_t> I_ref(nq * k), I(nq * k);
+    ref.search(nq, xq.data(), k, D_ref.data(), I_ref.data());
+
+    // cache in front of shards
+    IndexShards shards(d, false, true);
+    IndexFlatL2 s0(d), s1(d);
+    shards.add_shard(&s0);
+    shards.add_shard(&s1);
+    IndexCached cached(&shards);
+    cached.add(nb, xb.data());
+    EXPECT_EQ(s0.ntotal + s1.ntotal, nb);
+    for (int run = 0; run < 2; run++) {
+        cached.search(nq, xq.data(), k, D.data(), I.data());
+        EXPECT_EQ(I, I_ref);
+    }
+    EXPECT_EQ(cached.stats.nhit, nq);
+
+    // cached replicas
+    IndexCached r0(&ref), r1(&ref);
+    IndexReplicas replicas(d);
+    replicas.add_replica(&r0);
+    replicas.add_replica(&r1);
+    for (int run = 0; run < 2; run++) {
+        replicas.search(nq, xq.data(), k, D.data(), I.data());
+        EXPECT_EQ(I, I_ref);
+    }
+    EXPECT_EQ(r0.stats.nhit + r1.stats.nhit, nq);
+}
@@ -0,0 +1,204 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#include <memory>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexIVF.h>
+#include <faiss/IVFlib.h>
+#include <faiss/index_factory.h>
+#include <faiss/index_io.h>
+#include <faiss/impl/FaissException.h>
+#include <faiss/impl/io.h>
+
+
+namespace {
+
+typedef faiss::Index::idx_t idx_t;
+
+struct Tempfilename {
+
+    static pthread_mutex_t mutex;
+
+    std::string filename;
+
+    Tempfilename (const char *prefix = nullptr) {
+        pthread_mutex_lock (&mutex);
+        char *cfname = tempnam (nullptr, prefix);
+        filename = cfname;
+        free(cfname);
+        pthread_mutex_unlock (&mutex);
+    }
+
+    ~Tempfilename () {
+        if (access (filename.c_str(), F_OK) == 0) {
+            unlink (filename.c_str());
+        }
+    }
+
+    const char *c_str() {
+        return filename.c_str();
+    }
+
+};
+
+pthread_mutex_t Tempfilename::mutex = PTHREAD_MUTEX_INITIALIZER;
+
+int d = 32;
+size_t nb = 2000;
+size_t nq = 20;
+int k = 5;
+
+std::vector<float> make_data (size_t n, int seed)
+{
+    std::vector<float> x (n * d);
+    std::mt19937 rng (seed);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < x.size(); i++) {
+        x[i] = distrib (rng);
+    }
+    return x;
+}
+
+std::unique_ptr<faiss::Index> make_index (const char *key)
+{
+    std::vector<float> xb = make_data (nb, 1);
+    std::unique_ptr<faiss::Index> index (faiss::index_factory (d, key));
+    index->train (nb, xb.data());
+    index->add (nb, xb.data());
+    return index;
+}
+
+void compare_search (const faiss::Index & ref, const faiss::Index & index)
+{
+    std::vector<float> xq = make_data (nq, 2);
+    std::vector<float> D_ref (nq * k), D (nq * k);
+    std::vector<idx_t> I_ref (nq * k), I (nq * k);
+    ref.search (nq, xq.data(), k, D_ref.data(), I_ref.data());
+    index.search (nq, xq.data(), k, D.data(), I.data());
+    EXPECT_EQ (I, I_ref);
+    EXPECT_EQ (D, D_ref);
+}
+
+}  // namespace
+
+
+TEST(IndexContainer, file) {
+    for (const char *key : {"Flat", "IVF16,Flat", "PCA16,IVF16,PQ4"}) {
+        Tempfilename tmp;
+        std::unique_ptr<faiss::Index> index = make_index (key);
+        faiss::write_index_container (index.get(), tmp.c_str());
+
+        std::unique_ptr<faiss::Index> index2 (faiss::read_index (tmp.c_str()));
+        compare_search (*index, *index2);
+    }
+}
+
+TEST(IndexContainer, skip_ivf_data) {
+    Tempfilename tmp;
+    std::unique_ptr<faiss::Index> index = make_index ("IVF16,Flat");
+    faiss::write_index_container (index.get(), tmp.c_str());
+
+    std::unique_ptr<faiss::Index> index2 (
+          faiss::read_index (tmp.c_str(), faiss::IO_FLAG_SKIP_IVF_DATA));
+    faiss::IndexIVF *ivf = faiss::ivflib::extract_index_ivf (index2.get());
+    EXPECT_EQ (ivf->ntotal, nb);
+    EXPECT_EQ (ivf->quantizer->ntotal, 16);
+    EXPECT_FALSE (ivf->invlists);
+}
+
+TEST(IndexContainer, mmap) {
+    Tempfilename tmp;
+    std::unique_ptr<faiss::Index> index = make_index ("IVF16,Flat");
+    faiss::write_index_container (index.get(), tmp.c_str());
+
+    std::unique_ptr<faiss::Index> index2 (
+          faiss::read_index (tmp.c_str(), faiss::IO_FLAG_MMAP));
+    compare_search (*index, *index2);
+}
+
+TEST(IndexContainer, vector_and_sequential) {
+    std::unique_ptr<faiss::Index> index = make_index ("IVF16,Flat");
+
+    faiss::VectorIOWriter writer;
+    faiss::write_index_container (index.get(), &writer);
+    faiss::VectorIOReader reader;
+    reader.data = writer.data;
+    std::unique_ptr<faiss::Index> index2 (faiss::read_index (&reader));
+    compare_search (*index, *index2);
+
+    // in append mode, the table of contents offset cannot be filled in
+    // and the containers are read sequentially
+    Tempfilename tmp;
+    FILE *f = fopen (tmp.c_str(), "ab");
+    ASSERT_TRUE (f);
+    faiss::write_index_container (index.get(), f);
+    faiss::write_index_container (index.get(), f);
+    fclose (f);
+
+    f = fopen (tmp.c_str(), "rb");
+    ASSERT_TRUE (f);
+    std::unique_ptr<faiss::Index> index3 (faiss::read_index (f));
+    std::unique_ptr<faiss::Index> index4 (faiss::read_index (f));
+    fclose (f);
+    compare_search (*index, *index3);
+    compare_search (*index, *index4);
+}
+
+TEST(IndexContainer, consecutive) {
+    // the reader is left at the end of the container
+    Tempfilename tmp;
+    std::unique_ptr<faiss::Index> index = make_index ("IVF16,Flat");
+    std::unique_ptr<faiss::Index> index_flat = make_index ("Flat");
+
+    FILE *f = fopen (tmp.c_str(), "wb");
+    ASSERT_TRUE (f);
+    faiss::write_index_container (index.get(), f);
+    faiss::write_index (index_flat.get(), f);
+    fclose (f);
+
+    f = fopen (tmp.c_str(), "rb");
+    ASSERT_TRUE (f);
+    std::unique_ptr<faiss::Index> index2 (
+          faiss::read_index (f, faiss::IO_FLAG_SKIP_IVF_DATA));
+    std::unique_ptr<faiss::Index> index3 (faiss::read_index (f));
+    fclose (f);
+    EXPECT_EQ (index2->ntotal, nb);
+    compare_search (*index_flat, *index3);
+}
+
+TEST(IndexContainer, checksum) {
+    Tempfilename tmp;
+    std::unique_ptr<faiss::Index> index = make_index ("IVF16,Flat");
+    faiss::write_index_container (index.get(), tmp.c_str());
+
+    // flip a byte in the middle of the file, in the inverted lists
+    FILE *f = fopen (tmp.c_str(), "r+b");
+    ASSERT_TRUE (f);
+    fseek (f, 0, SEEK_END);
+    long size = ftell (f);
+    fseek (f, size / 2, SEEK_SET);
+    int c = fgetc (f);
+    fseek (f, size / 2, SEEK_SET);
+    fputc (c ^ 0x10, f);
+    fclose (f);
+
+    EXPECT_THROW (faiss::read_index (tmp.c_str()), faiss::FaissException);
+
+    // the inverted lists are not read
+    std::unique_ptr<faiss::Index> index2 (
+          faiss::read_index (tmp.c_str(), faiss::IO_FLAG_SKIP_IVF_DATA));
+    EXPECT_EQ (index2->ntotal, nb);
+}
@@ -0,0 +1,176 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexFlatHalf.h>
+#include <faiss/index_factory.h>
+#include <faiss/index_io.h>
+#include <faiss/impl/io.h>
+#include <faiss/utils/cpu_dispatch.h>
+#include <faiss/utils/fp16.h>
+#include <faiss/utils/random.h>
+
+namespace {
+
+typedef faiss::Index::idx_t idx_t;
+
+int d = 37;
+size_t nb = 3000;
+size_t nq = 50;
+int k = 10;
+
+std::vector<float> make_data (size_t n, int seed)
+{
+    std::vector<float> x (n * d);
+    faiss::float_randn (x.data(), x.size(), seed);
+    return x;
+}
+
+/// the search gives the same results as an IndexFlat on the decoded
+/// vectors, both for the direct and the blocked search
+void test_search (const char *key, faiss::MetricType metric)
+{
+    std::vector<float> xb = make_data (nb, 1);
+    std::vector<float> xq = make_data (nq, 2);
+
+    std::unique_ptr<faiss::Index> index (
+          faiss::index_factory (d, key, metric));
+    auto *indexh = dynamic_cast<faiss::IndexFlatHalf*> (index.get());
+    ASSERT_TRUE (indexh);
+    // several database blocks
+    indexh->search_bs = 1000;
+    index->add (nb, xb.data());
+
+    std::vector<float> xb_dec (nb * d);
+    index->reconstruct_n (0, nb, xb_dec.data());
+    faiss::IndexFlat ref (d, metric);
+    ref.add (nb, xb_dec.data());
+
+    std::vector<float> D_ref (nq * k), D (nq * k);
+    std::vector<idx_t> I_ref (nq * k), I (nq * k);
+    ref.search (nq, xq.data(), k, D_ref.data(), I_ref.data());
+
+    // blocked
+    index->search (nq, xq.data(), k, D.data(), I.data());
+    int nmiss = 0;
+    for (size_t i = 0; i < nq * k; i++) {
+        nmiss += I[i] != I_ref[i];
+        EXPECT_NEAR (D[i], D_ref[i], 1e-3 * std::fabs(D_ref[i]) + 1e-3);
+    }
+    // ties from rounding may swap results
+    EXPECT_LT (nmiss, nq * k / 50) << key;
+
+    // direct, one query at a time
+    for (size_t q = 0; q < nq; q++) {
+        index->search (1, xq.data() + q * d, k, D.data() + q * k,
+                       I.data() + q * k);
+    }
+    nmiss = 0;
+    for (size_t i = 0; i < nq * k; i++) {
+        nmiss += I[i] != I_ref[i];
+        EXPECT_NEAR (D[i], D_ref[i], 1e-3 * std::fabs(D_ref[i]) + 1e-3);
+    }
+    EXPECT_LT (nmiss, nq * k / 50) << key;
+}
+
+}  // namespace
+
+
+TEST(IndexFlatHalf, conversions) {
+    std::vector<float> x = make_data (1000, 3);
+    x[0] = 0; x[1] = 1e-6; x[2] = 65504; x[3] = 1e9; x[4] = -2.5;
+
+    std::vector<uint16_t> h (x.size());
+    faiss::fp32_to_fp16 (h.data(), x.data(), x.size());
+
+    // rounded to the nearest fp16 value
+    for (size_t i = 5; i < x.size(); i++) {
+        float err = std::fabs (faiss::decode_fp16 (h[i]) - x[i]);
+        EXPECT_LE (err, std::fabs (faiss::decode_fp16 (h[i] + 1) - x[i]));
+        EXPECT_LE (err, std::fabs (faiss::decode_fp16 (h[i] - 1) - x[i]));
+    }
+
+    std::vector<float> y (x.size());
+    faiss::fp16_to_fp32 (y.data(), h.data(), x.size());
+    EXPECT_EQ (y[0], 0);
+    EXPECT_EQ (y[2], 65504);
+    EXPECT_TRUE (std::isinf (y[3]));
+    EXPECT_EQ (y[4], -2.5);
+    for (size_t i = 5; i < x.size(); i++) {
+        EXPECT_NEAR (y[i], x[i], std::fabs (x[i]) * 1e-3);
+        EXPECT_EQ (faiss::decode_fp16 (h[i]), y[i]);
+    }
+
+    faiss::fp32_to_bf16 (h.data(), x.data(), x.size());
+    faiss::bf16_to_fp32 (y.data(), h.data(), x.size());
+    EXPECT_EQ (y[3], 998244352);  // nearest bf16 of 1e9
+    for (size_t i = 5; i < x.size(); i++) {
+        EXPECT_NEAR (y[i], x[i], std::fabs (x[i]) * 1e-2);
+    }
+}
+
+TEST(IndexFlatHalf, kernels) {
+    // the SIMD kernels give the same results as the generic ones
+    std::vector<float> x = make_data (2, 4);
+    std::vector<uint16_t> h (d);
+    faiss::SIMDLevel level = faiss::get_simd_level ();
+    for (int is_bf16 = 0; is_bf16 < 2; is_bf16++) {
+        if (is_bf16) {
+            faiss::fp32_to_bf16 (h.data(), x.data() + d, d);
+        } else {
+            faiss::fp32_to_fp16 (h.data(), x.data() + d, d);
+        }
+        for (int dd = 1; dd <= d; dd += 3) {
+            faiss::set_simd_level (faiss::SIMD_GENERIC);
+            float l2_ref = is_bf16 ?
+                faiss::fvec_L2sqr_bf16 (x.data(), h.data(), dd) :
+                faiss::fvec_L2sqr_fp16 (x.data(), h.data(), dd);
+            float ip_ref = is_bf16 ?
+                faiss::fvec_inner_product_bf16 (x.data(), h.data(), dd) :
+                faiss::fvec_inner_product_fp16 (x.data(), h.data(), dd);
+            faiss::set_simd_level (level);
+            float l2 = is_bf16 ?
+                faiss::fvec_L2sqr_bf16 (x.data(), h.data(), dd) :
+                faiss::fvec_L2sqr_fp16 (x.data(), h.data(), dd);
+            float ip = is_bf16 ?
+                faiss::fvec_inner_product_bf16 (x.data(), h.data(), dd) :
+                faiss::fvec_inner_product_fp16 (x.data(), h.data(), dd);
+            EXPECT_NEAR (l2, l2_ref, 1e-4 * l2_ref + 1e-5);
+            EXPECT_NEAR (ip, ip_ref, 1e-4 * std::fabs(ip_ref) + 1e-4);
+        }
+    }
+}
+
+TEST(IndexFlatHalf, search) {
+    test_search ("FlatFP16", faiss::METRIC_L2);
+    test_search ("FlatFP16", faiss::METRIC_INNER_PRODUCT);
+    test_search ("FlatBF16", faiss::METRIC_L2);
+    test_search ("FlatBF16", faiss::METRIC_INNER_PRODUCT);
+}
+
+TEST(IndexFlatHalf, io) {
+    std::vector<float> xb = make_data (nb, 1);
+    faiss::IndexFlatBF16 index (d);
+    index.add (nb, xb.data());
+
+    faiss::VectorIOWriter writer;
+    faiss::write_index (&index, &writer);
+    faiss::VectorIOReader reader;
+    reader.data = writer.data;
+    std::unique_ptr<faiss::Index> index2 (faiss::read_index (&reader));
+
+    auto *index2h = dynamic_cast<faiss::IndexFlatBF16*> (index2.get());
+    ASSERT_TRUE (index2h);
+    EXPECT_EQ (index2h->codes, index.codes);
+    EXPECT_EQ (index2->ntotal, nb);
+}
@@ -0,0 +1,152 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexLattice.h>
+#include <faiss/impl/io.h>
+#include <faiss/index_io.h>
+#include <faiss/utils/random.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+/// the batched encoder and decoder give the same results as the
+/// one-vector-at-a-time ones
+void test_codec_multi(int dim, int r2)
+{
+    ZnSphereCodecAlt codec(dim, r2);
+    size_t n = 3000;
+    std::vector<float> x(n * dim);
+    float_randn(x.data(), x.size(), 123);
+
+    std::vector<uint64_t> codes(n);
+    codec.encode_multi(n, x.data(), codes.data());
+    std::vector<float> dec(n * dim), dec1(dim);
+    codec.decode_multi(n, codes.data(), dec.data());
+    for (size_t i = 0; i < n; i++) {
+        EXPECT_EQ(codes[i], codec.encode(x.data() + i * dim));
+        codec.decode(codes[i], dec1.data());
+        for (int j = 0; j < dim; j++) {
+            EXPECT_EQ(dec[i * dim + j], dec1[j]);
+        }
+    }
+}
+
+/// compare the lattice search with a brute-force search on the decoded
+/// vectors
+void test_search(int d, int nsq, int r2, MetricType metric,
+                 size_t max_codebook_size, size_t nb)
+{
+    size_t nq = 20;
+    idx_t k = 10;
+    IndexLattice index(d, nsq, 4, r2);
+    index.metric_type = metric;
+    index.set_codebook(max_codebook_size);
+
+    std::vector<float> xb(nb * d), xq(nq * d);
+    float_randn(xb.data(), xb.size(), 1);
+    float_randn(xq.data(), xq.size(), 2);
+    index.train(nb, xb.data());
+    index.add(nb, xb.data());
+
+    std::vector<float> decoded(nb * d);
+    index.reconstruct_n(0, nb, decoded.data());
+    IndexFlat ref(d, metric);
+    ref.add(nb, decoded.data());
+
+    std::vector<float> D(nq * k), D_ref(nq * k);
+    std::vector<idx_t> I(nq * k), I_ref(nq * k);
+    index.search(nq, xq.data(), k, D.data(), I.data());
+    ref.search(nq, xq.data(), k, D_ref.data(), I_ref.data());
+
+    size_t n_same = 0;
+    for (size_t i = 0; i < nq * k; i++) {
+        EXPECT_NEAR(D[i], D_ref[i], 1e-3 * (1 + std::abs(D_ref[i])));
+        if (I[i] == I_ref[i]) {
+            n_same++;
+        }
+    }
+    // only ties may be ordered differently
+    EXPECT_GT(n_same, nq * k * 0.95);
+
+    // the stored codes and the codebook survive serialization
+    VectorIOWriter writer;
+    write_index(&index, &writer);
+    VectorIOReader reader;
+    reader.data = writer.data;
+    std::unique_ptr<IndexLattice> index2(
+        dynamic_cast<IndexLattice*>(read_index(&reader)));
+    ASSERT_TRUE(index2);
+    index2->metric_type = metric;
+    index2->set_codebook(max_codebook_size);
+    EXPECT_EQ(index2->codes, index.codes);
+    std::vector<float> D2(nq * k);
+    std::vector<idx_t> I2(nq * k);
+    index2->search(nq, xq.data(), k, D2.data(), I2.data());
+    EXPECT_EQ(D2, D);
+    EXPECT_EQ(I2, I);
+}
+
+}  // namespace
+
+
+TEST(Lattice, codec_multi) {
+    test_codec_multi(8, 6);     // recursive codec
+    test_codec_multi(10, 6);    // atom-based codec
+}
+
+TEST(Lattice, decode_with_codebook) {
+    int d = 32;
+    size_t n = 1000;
+    IndexLattice index(d, 4, 4, 6);
+    EXPECT_FALSE(index.codebook.empty());
+    std::vector<float> x(n * d);
+    float_randn(x.data(), x.size(), 1);
+    index.train(n, x.data());
+
+    std::vector<uint8_t> codes(n * index.code_size);
+    index.sa_encode(n, x.data(), codes.data());
+    std::vector<float> dec(n * d), dec_ref(n * d);
+    index.sa_decode(n, codes.data(), dec.data());
+
+    index.set_codebook(0);
+    EXPECT_TRUE(index.codebook.empty());
+    index.sa_decode(n, codes.data(), dec_ref.data());
+    EXPECT_EQ(dec, dec_ref);
+
+    // small batches
+    index.bs = 7;
+    std::vector<uint8_t> codes2(n * index.code_size);
+    index.sa_encode(n, x.data(), codes2.data());
+    EXPECT_EQ(codes, codes2);
+    index.sa_decode(n, codes.data(), dec.data());
+    EXPECT_EQ(dec, dec_ref);
+}
+
+TEST(Lattice, search_lut) {
+    // more codes than lattice points
+    test_search(32, 4, 6, METRIC_L2, 1 << 18, 5000);
+    test_search(32, 4, 6, METRIC_INNER_PRODUCT, 1 << 18, 5000);
+}
+
+TEST(Lattice, search_codebook) {
+    test_search(32, 4, 6, METRIC_L2, 1 << 18, 1000);
+}
+
+TEST(Lattice, search_decode) {
+    test_search(32, 4, 6, METRIC_L2, 0, 1000);
+    test_search(30, 3, 6, METRIC_INNER_PRODUCT, 0, 1000);
+}
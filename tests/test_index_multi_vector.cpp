@@ -0,0 +1,188 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVFFlat.h>
+#include <faiss/IndexMultiVector.h>
+#include <faiss/impl/FaissException.h>
+#include <faiss/utils/distances.h>
+#include <faiss/utils/random.h>
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 16;
+idx_t ndoc = 300;
+idx_t nq = 10;
+idx_t k = 5;
+
+struct MultiVectorData {
+    std::vector<idx_t> doc_sizes, query_sizes;
+    std::vector<float> xb, xq;
+
+    MultiVectorData () {
+        std::mt19937 rng (123);
+        size_t nb = 0;
+        for (idx_t i = 0; i < ndoc; i++) {
+            doc_sizes.push_back (3 + rng() % 8);
+            nb += doc_sizes.back();
+        }
+        size_t nqv = 0;
+        for (idx_t i = 0; i < nq; i++) {
+            query_sizes.push_back (2 + rng() % 4);
+            nqv += query_sizes.back();
+        }
+        xb.resize (nb * d);
+        float_randn (xb.data(), xb.size(), 1);
+        xq.resize (nqv * d);
+        float_randn (xq.data(), xq.size(), 2);
+    }
+};
+
+/// exact top-k by brute force
+void reference_search (const MultiVectorData & data, MetricType metric,
+                       IndexMultiVector::Aggregation aggregation,
+                       std::vector<float> & scores,
+                       std::vector<idx_t> & labels)
+{
+    scores.resize (nq * k);
+    labels.resize (nq * k);
+    const float *xq = data.xq.data();
+    for (idx_t q = 0; q < nq; q++) {
+        std::vector<std::pair<float, idx_t> > res;
+        const float *xb = data.xb.data();
+        for (idx_t doc = 0; doc < ndoc; doc++) {
+            float total = 0, best = -1e30;
+            for (idx_t t = 0; t < data.query_sizes[q]; t++) {
+                float tmax = -1e30;
+                for (idx_t j = 0; j < data.doc_sizes[doc]; j++) {
+                    const float *y = xb + j * d;
+                    float sim = metric == METRIC_INNER_PRODUCT ?
+                        fvec_inner_product (xq + t * d, y, d) :
+                        -fvec_L2sqr (xq + t * d, y, d);
+                    tmax = std::max (tmax, sim);
+                }
+                total += tmax;
+                best = std::max (best, tmax);
+            }
+            res.emplace_back (
+                  aggregation == IndexMultiVector::AGG_SUM_MAX ? total : best,
+                  doc);
+            xb += data.doc_sizes[doc] * d;
+        }
+        std::sort (res.begin(), res.end(), std::greater<
+                   std::pair<float, idx_t> >());
+        for (idx_t j = 0; j < k; j++) {
+            scores[q * k + j] = res[j].first;
+            labels[q * k + j] = res[j].second;
+        }
+        xq += data.query_sizes[q] * d;
+    }
+}
+
+void check_search (const MultiVectorData & data, IndexMultiVector & mv)
+{
+    std::vector<float> ref_scores, scores (nq * k);
+    std::vector<idx_t> ref_labels, labels (nq * k);
+    reference_search (data, mv.index->metric_type, mv.aggregation,
+                      ref_scores, ref_labels);
+    mv.search (nq, data.query_sizes.data(), data.xq.data(), k,
+               scores.data(), labels.data());
+    EXPECT_EQ (ref_labels, labels);
+    for (idx_t i = 0; i < nq * k; i++) {
+        EXPECT_NEAR (ref_scores[i], scores[i], 1e-3);
+    }
+}
+
+} // namespace
+
+
+TEST(IndexMultiVector, doc_of) {
+    MultiVectorData data;
+    IndexFlatIP index (d);
+    IndexMultiVector mv (&index);
+    mv.add (ndoc, data.doc_sizes.data(), data.xb.data());
+    EXPECT_EQ (mv.ndoc(), ndoc);
+    EXPECT_EQ (mv.doc_of (0), 0);
+    EXPECT_EQ (mv.doc_of (data.doc_sizes[0]), 1);
+    EXPECT_EQ (mv.doc_of (index.ntotal - 1), ndoc - 1);
+}
+
+TEST(IndexMultiVector, flat_all_results) {
+    // with all the vectors in the results, the scores are exact
+    MultiVectorData data;
+    IndexFlatIP index (d);
+    IndexMultiVector mv (&index);
+    mv.add (ndoc, data.doc_sizes.data(), data.xb.data());
+    mv.k_token = index.ntotal;
+    check_search (data, mv);
+
+    mv.aggregation = IndexMultiVector::AGG_MAX;
+    check_search (data, mv);
+}
+
+TEST(IndexMultiVector, flat_rerank) {
+    // few results per query vector, the rerank makes the top-k exact
+    MultiVectorData data;
+    for (MetricType metric: {METRIC_INNER_PRODUCT, METRIC_L2}) {
+        IndexFlat index (d, metric);
+        IndexMultiVector mv (&index);
+        mv.add (ndoc, data.doc_sizes.data(), data.xb.data());
+        mv.k_token = 50;
+        mv.rerank = true;
+        check_search (data, mv);
+    }
+}
+
+TEST(IndexMultiVector, ivf_scan) {
+    // probing all lists scores all vectors
+    MultiVectorData data;
+    IndexFlatIP quantizer (d);
+    IndexIVFFlat index (&quantizer, d, 16, METRIC_INNER_PRODUCT);
+    index.train (data.xb.size() / d, data.xb.data());
+    IndexMultiVector mv (&index);
+    mv.add (ndoc, data.doc_sizes.data(), data.xb.data());
+    index.nprobe = 16;
+    check_search (data, mv);
+
+    // rerank needs the direct map
+    mv.rerank = true;
+    std::vector<float> scores (nq * k);
+    std::vector<idx_t> labels (nq * k);
+    EXPECT_THROW (mv.search (nq, data.query_sizes.data(), data.xq.data(),
+                             k, scores.data(), labels.data()),
+                  FaissException);
+    index.make_direct_map ();
+    check_search (data, mv);
+
+    // with fewer probes, the candidates are rescored exactly
+    index.nprobe = 4;
+    mv.search (nq, data.query_sizes.data(), data.xq.data(),
+               k, scores.data(), labels.data());
+    const float *xq = data.xq.data();
+    for (idx_t q = 0; q < nq; q++) {
+        for (idx_t j = 0; j < k; j++) {
+            ASSERT_GE (labels[q * k + j], 0);
+            EXPECT_EQ (scores[q * k + j], mv.score_document (
+                           labels[q * k + j], data.query_sizes[q], xq));
+            if (j > 0) {
+                EXPECT_GE (scores[q * k + j - 1], scores[q * k + j]);
+            }
+        }
+        xq += data.query_sizes[q] * d;
+    }
+}
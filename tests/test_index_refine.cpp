@@ -0,0 +1,217 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexHNSW.h>
+#include <faiss/IndexPQ.h>
+#include <faiss/IndexRefine.h>
+#include <faiss/IndexScalarQuantizer.h>
+#include <faiss/index_factory.h>
+#include <faiss/index_io.h>
+#include <faiss/impl/io.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> distrib(-1, 1);
+    std::vector<float> x(n);
+    for (auto & xi: x) {
+        xi = distrib(rng);
+    }
+    return x;
+}
+
+size_t d = 32, nb = 2000, nt = 3000, nq = 30;
+idx_t k = 10;
+
+// nb of results that are the same as the exact ones
+int n_correct(MetricType metric, const std::vector<idx_t> & I)
+{
+    std::vector<float> xb = make_data(nb * d, 123);
+    std::vector<float> xq = make_data(nq * d, 456);
+    IndexFlat gt(d, metric);
+    gt.add(nb, xb.data());
+    std::vector<float> D(nq * k);
+    std::vector<idx_t> Igt(nq * k);
+    gt.search(nq, xq.data(), k, D.data(), Igt.data());
+    int nok = 0;
+    for (size_t i = 0; i < nq * k; i++) {
+        nok += I[i] == Igt[i];
+    }
+    return nok;
+}
+
+std::vector<idx_t> search(Index & index, std::vector<float> *D = nullptr,
+                          const SearchParameters *params = nullptr)
+{
+    std::vector<float> xq = make_data(nq * d, 456);
+    std::vector<float> Dl(nq * k);
+    std::vector<idx_t> I(nq * k);
+    index.search(nq, xq.data(), k, Dl.data(), I.data(), params);
+    if (D) {
+        *D = Dl;
+    }
+    return I;
+}
+
+void train_and_add(Index & index)
+{
+    std::vector<float> xt = make_data(nt * d, 789);
+    std::vector<float> xb = make_data(nb * d, 123);
+    index.train(nt, xt.data());
+    index.add(nb, xb.data());
+}
+
+} // namespace
+
+
+TEST(IndexRefine, same_as_refine_flat) {
+    IndexPQ base1(d, 8, 6);
+    IndexRefineFlat ref(&base1);
+    ref.k_factor = 4;
+    train_and_add(ref);
+    std::vector<float> Dref;
+    std::vector<idx_t> Iref = search(ref, &Dref);
+
+    IndexPQ base2(d, 8, 6);
+    IndexFlatL2 rf(d);
+    IndexRefine index(&base2, &rf);
+    index.k_factor = 4;
+    train_and_add(index);
+    std::vector<float> D;
+    std::vector<idx_t> I = search(index, &D);
+
+    EXPECT_EQ(Iref, I);
+    EXPECT_EQ(Dref, D);
+}
+
+TEST(IndexRefine, SQ8_refine) {
+    for (MetricType metric: {METRIC_L2, METRIC_INNER_PRODUCT}) {
+        IndexPQ base(d, 4, 6, metric);
+        train_and_add(base);
+        int nok_base = n_correct(metric, search(base));
+
+        IndexPQ base2(d, 4, 6, metric);
+        IndexScalarQuantizer rf(d, ScalarQuantizer::QT_8bit, metric);
+        IndexRefine index(&base2, &rf);
+        index.k_factor = 10;
+        train_and_add(index);
+        int nok = n_correct(metric, search(index));
+        EXPECT_GT(nok, nok_base);
+
+        // the k_factor can be set per search
+        IndexRefineSearchParameters params;
+        params.k_factor = 1;
+        int nok_1 = n_correct(metric, search(index, nullptr, &params));
+        EXPECT_LT(nok_1, nok);
+    }
+}
+
+TEST(IndexRefine, factory_and_io) {
+    std::unique_ptr<Index> index(index_factory(d, "PQ4x6,Refine(SQ8)"));
+    IndexRefine *ir = dynamic_cast<IndexRefine*>(index.get());
+    ASSERT_TRUE(ir);
+    EXPECT_TRUE(dynamic_cast<IndexPQ*>(ir->base_index));
+    EXPECT_TRUE(dynamic_cast<IndexScalarQuantizer*>(ir->refine_index));
+    ir->k_factor = 8;
+    train_and_add(*index);
+    std::vector<float> D;
+    std::vector<idx_t> I = search(*index, &D);
+
+    VectorIOWriter writer;
+    write_index(index.get(), &writer);
+    VectorIOReader reader;
+    reader.data = writer.data;
+    std::unique_ptr<Index> index2(read_index(&reader));
+    EXPECT_EQ(dynamic_cast<IndexRefine*>(index2.get())->k_factor, 8);
+    std::vector<float> D2;
+    std::vector<idx_t> I2 = search(*index2, &D2);
+    EXPECT_EQ(I, I2);
+    EXPECT_EQ(D, D2);
+}
+
+TEST(IndexRefine, hnsw_candidates) {
+    std::unique_ptr<Index> index(
+        index_factory(d, "HNSW32_PQ8,Refine(SQfp16)"));
+    IndexRefine *ir = dynamic_cast<IndexRefine*>(index.get());
+    ASSERT_TRUE(ir);
+    IndexHNSWPQ *base = dynamic_cast<IndexHNSWPQ*>(ir->base_index);
+    ASSERT_TRUE(base);
+    EXPECT_TRUE(dynamic_cast<IndexScalarQuantizer*>(ir->refine_index));
+    train_and_add(*index);
+    base->hnsw.efSearch = 64;
+    int nok_base = n_correct(METRIC_L2, search(*base));
+
+    // the efSearch candidates are re-ranked even with k_factor = 1
+    std::vector<float> D;
+    std::vector<idx_t> I = search(*index, &D);
+    int nok = n_correct(METRIC_L2, I);
+    EXPECT_GT(nok, nok_base);
+
+    // same as requesting efSearch results from the base index
+    ir->rerank_hnsw_candidates = false;
+    ir->k_factor = 64.0 / k;
+    std::vector<float> D2;
+    EXPECT_EQ(I, search(*index, &D2));
+    EXPECT_EQ(D, D2);
+
+    ir->k_factor = 1;
+    EXPECT_LT(n_correct(METRIC_L2, search(*index)), nok);
+}
+
+TEST(IndexRefine, adaptive_refine) {
+    for (MetricType metric: {METRIC_L2, METRIC_INNER_PRODUCT}) {
+        // the bounds are tight enough to prune with a 6-bit SQ
+        IndexScalarQuantizer base(d, ScalarQuantizer::QT_6bit, metric);
+        IndexFlat rf(d, metric);
+        IndexRefine index(&base, &rf);
+        index.k_factor = 8;
+        index.adaptive_refine = true;
+        train_and_add(index);
+        ASSERT_EQ(index.base_errors.size(), nb);
+
+        indexRefine_stats.reset();
+        std::vector<float> D;
+        std::vector<idx_t> I = search(index, &D);
+        EXPECT_EQ(indexRefine_stats.ncandidates, nq * k * 8);
+        EXPECT_LT(indexRefine_stats.nrefine, indexRefine_stats.ncandidates);
+
+        // same results as the full re-ranking
+        index.adaptive_refine = false;
+        std::vector<float> Dref;
+        EXPECT_EQ(search(index, &Dref), I);
+        for (size_t i = 0; i < nq * k; i++) {
+            EXPECT_NEAR(Dref[i], D[i], 1e-5 * std::abs(Dref[i]));
+        }
+        index.adaptive_refine = true;
+
+        VectorIOWriter writer;
+        write_index(&index, &writer);
+        VectorIOReader reader;
+        reader.data = writer.data;
+        std::unique_ptr<Index> index2(read_index(&reader));
+        IndexRefine *ir2 = dynamic_cast<IndexRefine*>(index2.get());
+        ASSERT_TRUE(ir2);
+        EXPECT_TRUE(ir2->adaptive_refine);
+        EXPECT_EQ(ir2->base_errors, index.base_errors);
+        EXPECT_EQ(search(*index2), I);
+    }
+}
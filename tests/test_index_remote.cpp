@@ -0,0 +1,181 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <chrono>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVFFlat.h>
+#include <faiss/IndexRemote.h>
+#include <faiss/IndexShards.h>
+#include <faiss/impl/FaissException.h>
+
+
+namespace {
+
+typedef faiss::Index::idx_t idx_t;
+
+int d = 16;
+size_t nb = 2000;
+size_t nq = 30;
+int k = 10;
+
+std::vector<float> make_data (size_t n, int seed)
+{
+    std::vector<float> x (n * d);
+    std::mt19937 rng (seed);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < x.size(); i++) {
+        x[i] = distrib (rng);
+    }
+    return x;
+}
+
+/// flat index whose searches take sleep_ms
+struct SlowIndex: faiss::IndexFlatL2 {
+    int sleep_ms = 0;
+
+    explicit SlowIndex (int d): faiss::IndexFlatL2 (d) {}
+
+    void search (idx_t n, const float *x, idx_t k,
+                 float *distances, idx_t *labels,
+                 const faiss::SearchParameters *params = nullptr) const override {
+        std::this_thread::sleep_for (std::chrono::milliseconds (sleep_ms));
+        faiss::IndexFlatL2::search (n, x, k, distances, labels, params);
+    }
+};
+
+}  // namespace
+
+
+TEST(IndexRemote, shards) {
+    std::vector<float> xb = make_data (nb, 1);
+    std::vector<float> xq = make_data (nq, 2);
+
+    faiss::IndexFlatL2 ref (d);
+    ref.add (nb, xb.data());
+    std::vector<float> D_ref (nq * k), D (nq * k);
+    std::vector<idx_t> I_ref (nq * k), I (nq * k);
+    ref.search (nq, xq.data(), k, D_ref.data(), I_ref.data());
+
+    int nshard = 3;
+    std::vector<std::unique_ptr<faiss::IndexFlatL2> > indexes;
+    std::vector<std::unique_ptr<faiss::IndexServer> > servers;
+    faiss::IndexShards shards (d, true, true);
+    shards.own_fields = true;
+    for (int i = 0; i < nshard; i++) {
+        indexes.emplace_back (new faiss::IndexFlatL2 (d));
+        servers.emplace_back (new faiss::IndexServer (indexes.back().get()));
+        servers.back()->start ();
+        shards.add_shard (
+            new faiss::IndexRemote ("localhost", servers.back()->port));
+    }
+    shards.add (nb, xb.data());
+    EXPECT_EQ (shards.ntotal, nb);
+    for (int i = 0; i < nshard; i++) {
+        EXPECT_EQ (shards.at(i)->ntotal, indexes[i]->ntotal);
+    }
+
+    shards.search (nq, xq.data(), k, D.data(), I.data());
+    EXPECT_EQ (I, I_ref);
+    EXPECT_EQ (D, D_ref);
+
+    shards.reset ();
+    EXPECT_EQ (indexes[0]->ntotal, 0);
+}
+
+TEST(IndexRemote, pipelined) {
+    std::vector<float> xb = make_data (nb, 1);
+    std::vector<float> xq = make_data (nq, 2);
+
+    faiss::IndexFlatL2 index (d);
+    faiss::IndexServer server (&index);
+    server.start ();
+    faiss::IndexRemote remote ("localhost", server.port);
+    remote.add (nb, xb.data());
+    EXPECT_EQ (remote.ntotal, nb);
+
+    int nreq = 5;
+    std::vector<idx_t> req_ids;
+    for (int r = 0; r < nreq; r++) {
+        req_ids.push_back (remote.search_async (
+            nq - r, xq.data() + r * d, k));
+    }
+    // wait in reverse order
+    for (int r = nreq - 1; r >= 0; r--) {
+        std::vector<float> D (nq * k), D_ref (nq * k);
+        std::vector<idx_t> I (nq * k), I_ref (nq * k);
+        EXPECT_TRUE (remote.wait_result (req_ids[r], D.data(), I.data()));
+        index.search (nq - r, xq.data() + r * d, k,
+                      D_ref.data(), I_ref.data());
+        EXPECT_EQ (I, I_ref);
+        EXPECT_EQ (D, D_ref);
+    }
+}
+
+TEST(IndexRemote, timeout) {
+    std::vector<float> xb = make_data (nb, 1);
+    std::vector<float> xq = make_data (nq, 2);
+
+    faiss::IndexFlatL2 index0 (d);
+    SlowIndex index1 (d);
+    faiss::IndexServer server0 (&index0), server1 (&index1);
+    server0.start ();
+    server1.start ();
+
+    faiss::IndexShards shards (d, true, true);
+    shards.own_fields = true;
+    auto *remote1 = new faiss::IndexRemote ("localhost", server1.port, 100);
+    shards.add_shard (new faiss::IndexRemote ("localhost", server0.port));
+    shards.add_shard (remote1);
+    shards.add (nb, xb.data());
+
+    std::vector<float> D_ref (nq * k), D (nq * k);
+    std::vector<idx_t> I_ref (nq * k), I (nq * k);
+    index0.search (nq, xq.data(), k, D_ref.data(), I_ref.data());
+
+    // shard 1 times out, the results of shard 0 are returned
+    index1.sleep_ms = 1000;
+    shards.search (nq, xq.data(), k, D.data(), I.data());
+    EXPECT_EQ (remote1->n_timeout, 1);
+    EXPECT_EQ (I, I_ref);
+    EXPECT_EQ (D, D_ref);
+
+    // the late response is dropped and the connection is still usable
+    index1.sleep_ms = 0;
+    std::this_thread::sleep_for (std::chrono::milliseconds (1000));
+    index1.search (nq, xq.data(), k, D_ref.data(), I_ref.data());
+    remote1->search (nq, xq.data(), k, D.data(), I.data());
+    EXPECT_EQ (remote1->n_timeout, 1);
+    EXPECT_EQ (I, I_ref);
+}
+
+TEST(IndexRemote, errors) {
+    faiss::IndexFlatL2 quantizer (d);
+    faiss::IndexIVFFlat index (&quantizer, d, 10);
+    faiss::IndexServer server (&index);
+    server.start ();
+    faiss::IndexRemote remote ("localhost", server.port);
+    EXPECT_FALSE (remote.is_trained);
+
+    // not trained: the exception is forwarded to the client
+    std::vector<float> xb = make_data (100, 1);
+    EXPECT_THROW (remote.add (100, xb.data()), faiss::FaissException);
+
+    remote.train (100, xb.data());
+    EXPECT_TRUE (remote.is_trained);
+    remote.add (100, xb.data());
+    EXPECT_EQ (remote.ntotal, 100);
+
+    server.stop ();
+    EXPECT_THROW (remote.add (100, xb.data()), faiss::FaissException);
+}
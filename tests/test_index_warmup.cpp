@@ -0,0 +1,146 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <memory>
+#include <vector>
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexHNSW.h>
+#include <faiss/IndexIVF.h>
+#include <faiss/IndexPreTransform.h>
+#include <faiss/OnDiskInvertedLists.h>
+#include <faiss/index_factory.h>
+#include <faiss/index_warmup.h>
+#include <faiss/utils/random.h>
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 32;
+size_t nt = 2000;
+size_t nb = 3000;
+
+std::vector<float> make_data (size_t n, int seed)
+{
+    std::vector<float> x (n * d);
+    float_randn (x.data(), x.size(), seed);
+    return x;
+}
+
+Index *make_index (const char *key)
+{
+    std::vector<float> xt = make_data (nt, 1);
+    std::vector<float> xb = make_data (nb, 2);
+    Index *index = index_factory (d, key);
+    index->train (nt, xt.data());
+    index->add (nb, xb.data());
+    return index;
+}
+
+size_t total_size (const std::vector<IndexMemoryRange> & ranges,
+                   const char *name)
+{
+    size_t tot = 0;
+    for (const IndexMemoryRange & r: ranges) {
+        if (!strcmp (r.name, name)) {
+            tot += r.size;
+        }
+    }
+    return tot;
+}
+
+} // namespace
+
+
+TEST(IndexWarmup, ranges) {
+    std::unique_ptr<Index> index (make_index ("PCA16,IVF32,Flat"));
+    std::vector<IndexMemoryRange> ranges;
+    get_index_memory_ranges (index.get(), ranges);
+
+    EXPECT_EQ (16 * d * sizeof(float), total_size (ranges, "transform.A"));
+    // the quantizer comes before the inverted lists
+    EXPECT_EQ (std::string ("xb"), ranges[2].name);
+    EXPECT_EQ (32 * 16 * sizeof(float), ranges[2].size);
+    EXPECT_EQ (nb * sizeof(idx_t), total_size (ranges, "invlists.ids"));
+    EXPECT_EQ (nb * 16 * sizeof(float),
+               total_size (ranges, "invlists.codes"));
+
+    std::unique_ptr<Index> hnsw (make_index ("HNSW16"));
+    ranges.clear ();
+    get_index_memory_ranges (hnsw.get(), ranges);
+    const HNSW & h = dynamic_cast<IndexHNSW*> (hnsw.get())->hnsw;
+    EXPECT_EQ (h.neighbors.size() * sizeof(HNSW::storage_idx_t),
+               total_size (ranges, "hnsw.neighbors"));
+    EXPECT_EQ (nb * d * sizeof(float), total_size (ranges, "xb"));
+}
+
+TEST(IndexWarmup, warmup_and_lock) {
+    std::unique_ptr<Index> index (make_index ("IVF32,SQ8"));
+    std::vector<IndexMemoryRange> ranges;
+    get_index_memory_ranges (index.get(), ranges);
+    size_t tot = 0;
+    for (const IndexMemoryRange & r: ranges) {
+        tot += r.size;
+    }
+
+    WarmupStats stats = warmup_index (index.get());
+    EXPECT_EQ (ranges.size(), stats.nrange);
+    EXPECT_EQ (tot, stats.touched_bytes);
+    EXPECT_EQ (0, stats.locked_bytes);
+
+    // a budget that fits the quantizer but not all the inverted lists
+    WarmupParameters params;
+    params.lock = true;
+    params.lock_budget = tot / 2;
+    params.nthread = 2;
+    stats = warmup_index (index.get(), params);
+    EXPECT_LE (stats.locked_bytes, params.lock_budget);
+    EXPECT_GT (stats.nlock_skipped, 0);
+    // mlock may fail if RLIMIT_MEMLOCK is low, this is not an error
+    if (stats.nlock_failed == 0) {
+        EXPECT_GT (stats.locked_bytes, 0);
+    }
+    unlock_index (index.get());
+}
+
+TEST(IndexWarmup, ondisk) {
+    std::vector<float> xt = make_data (nt, 1);
+    std::vector<float> xb = make_data (nb, 2);
+    std::unique_ptr<Index> index (index_factory (d, "IVF16,Flat"));
+    auto *ivf = dynamic_cast<IndexIVF*> (index.get());
+    ivf->train (nt, xt.data());
+
+    char fname[] = "/tmp/faiss_test_index_warmup_XXXXXX";
+    int fd = mkstemp (fname);
+    ASSERT_GE (fd, 0);
+    close (fd);
+    auto *il = new OnDiskInvertedLists (ivf->nlist, ivf->code_size, fname);
+    ivf->replace_invlists (il, true);
+    ivf->add (nb, xb.data());
+
+    std::vector<IndexMemoryRange> ranges;
+    get_index_memory_ranges (index.get(), ranges);
+    EXPECT_EQ (il->totsize, total_size (ranges, "invlists.mmap"));
+
+    WarmupParameters params;
+    params.verbose = true;
+    WarmupStats stats = warmup_index (index.get(), params);
+    EXPECT_GE (stats.touched_bytes, nb * (ivf->code_size + sizeof(idx_t)));
+
+    index.reset ();
+    unlink (fname);
+}
@@ -0,0 +1,179 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <memory>
+#include <thread>
+#include <vector>
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexIVF.h>
+#include <faiss/IndexIVFPQ.h>
+#include <faiss/index_factory.h>
+#include <faiss/utils/instrumentation.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 32;
+size_t nb = 2000;
+size_t nq = 50;
+int k = 10;
+
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector <float> x (n * d);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < n * d; i++) {
+        x[i] = distrib(rng);
+    }
+    return x;
+}
+
+struct EnableInstrumentation {
+    EnableInstrumentation() {
+        instrumentation_reset();
+        instrumentation_enabled = true;
+    }
+    ~EnableInstrumentation() {
+        instrumentation_enabled = false;
+        instrumentation_set_hook(nullptr, nullptr);
+    }
+};
+
+void export_hook(const InstrumentationStats & stats, void *arg)
+{
+    *(InstrumentationStats*)arg = stats;
+}
+
+} // namespace
+
+
+TEST(Instrumentation, ivfpq_search) {
+    std::vector<float> xb = make_data(nb, 1);
+    std::vector<float> xq = make_data(nq, 2);
+    std::unique_ptr<Index> index(index_factory(d, "IVF16,PQ8x4"));
+    index->train(nb, xb.data());
+    index->add(nb, xb.data());
+    IndexIVF *ivf = dynamic_cast<IndexIVF*>(index.get());
+    ivf->nprobe = 4;
+
+    std::vector<float> D(nq * k);
+    std::vector<idx_t> I(nq * k);
+
+    // nothing is collected by default
+    instrumentation_reset();
+    index->search(nq, xq.data(), k, D.data(), I.data());
+    InstrumentationStats stats;
+    instrumentation_get(&stats);
+    EXPECT_EQ(stats.counters[COUNTER_NQ], 0);
+    EXPECT_EQ(stats.stage_calls[STAGE_LIST_SCAN], 0);
+
+    EnableInstrumentation enable;
+    indexIVF_stats.reset();
+    index->search(nq, xq.data(), k, D.data(), I.data());
+    instrumentation_get(&stats);
+
+    EXPECT_EQ(stats.counters[COUNTER_NQ], nq);
+    EXPECT_EQ(stats.counters[COUNTER_NLIST], indexIVF_stats.nlist);
+    EXPECT_EQ(stats.counters[COUNTER_NDIS], indexIVF_stats.ndis);
+    EXPECT_EQ(stats.counters[COUNTER_BYTES_SCANNED], indexIVF_stats.ndis * ivf->code_size);
+    EXPECT_EQ(stats.stage_calls[STAGE_COARSE_QUANTIZE], 1);
+    EXPECT_EQ(stats.stage_calls[STAGE_LIST_SCAN], 1);
+    // one LUT per query and one per list
+    EXPECT_EQ(stats.stage_calls[STAGE_LUT], nq + indexIVF_stats.nlist);
+
+    for (int s = 0; s < STAGE_N; s++) {
+        uint64_t tot = 0;
+        for (int b = 0; b < InstrumentationStats::nbucket; b++) {
+            tot += stats.stage_hist[s][b];
+        }
+        EXPECT_EQ(tot, stats.stage_calls[s]) << stats.stage_name(s);
+    }
+    EXPECT_GE(stats.latency_quantile(STAGE_LIST_SCAN, 0.5),
+              stats.stage_ms[STAGE_LIST_SCAN]);
+
+    // export passes the stats to the hook and resets them
+    InstrumentationStats exported;
+    instrumentation_set_hook(export_hook, &exported);
+    instrumentation_export();
+    EXPECT_EQ(exported.counters[COUNTER_NQ], nq);
+    instrumentation_get(&stats);
+    EXPECT_EQ(stats.counters[COUNTER_NQ], 0);
+
+    // the batched list tables (that replace the precomputed tables) are
+    // one more LUT per query
+    IndexIVFPQ *ivfpq = dynamic_cast<IndexIVFPQ*>(index.get());
+    ivfpq->use_precomputed_table = -1;
+    ivfpq->batched_list_tables = true;
+    indexIVF_stats.reset();
+    index->search(nq, xq.data(), k, D.data(), I.data());
+    instrumentation_get(&stats);
+    EXPECT_EQ(stats.stage_calls[STAGE_LUT], 2 * nq + indexIVF_stats.nlist);
+}
+
+TEST(Instrumentation, threads) {
+    EnableInstrumentation enable;
+
+    // the statistics of exited threads are kept
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([]() {
+            for (int i = 0; i < 100; i++) {
+                instrumentation_count(COUNTER_NDIS, 2);
+                instrumentation_record(STAGE_IO, 0.001 * i);
+            }
+        });
+    }
+    for (auto & th : threads) {
+        th.join();
+    }
+    instrumentation_count(COUNTER_NDIS, 1);
+
+    InstrumentationStats stats;
+    instrumentation_get(&stats);
+    EXPECT_EQ(stats.counters[COUNTER_NDIS], 801);
+    EXPECT_EQ(stats.stage_calls[STAGE_IO], 400);
+    // 0 and 1 us are in the first buckets, 99 us in bucket 7
+    EXPECT_EQ(stats.stage_hist[STAGE_IO][0], 4);
+    EXPECT_EQ(stats.stage_hist[STAGE_IO][7], 4 * (100 - 64));
+}
+
+TEST(Instrumentation, peaks) {
+    EnableInstrumentation enable;
+
+    // high watermarks are aggregated with max over the threads
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([t]() {
+            instrumentation_peak(PEAK_GPU_TEMP_MEM, 1000 * (t + 1));
+            instrumentation_peak(PEAK_GPU_TEMP_MEM, 10);
+        });
+    }
+    for (auto & th : threads) {
+        th.join();
+    }
+    instrumentation_peak(PEAK_GPU_TEMP_MEM, 2500);
+
+    InstrumentationStats stats;
+    instrumentation_get(&stats);
+    EXPECT_EQ(stats.peaks[PEAK_GPU_TEMP_MEM], 4000);
+    EXPECT_STREQ(stats.peak_name(PEAK_GPU_TEMP_MEM), "gpu_temp_mem");
+
+    instrumentation_reset();
+    instrumentation_get(&stats);
+    EXPECT_EQ(stats.peaks[PEAK_GPU_TEMP_MEM], 0);
+}
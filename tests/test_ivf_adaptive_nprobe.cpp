@@ -0,0 +1,118 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <memory>
+#include <vector>
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include <faiss/AutoTune.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVF.h>
+#include <faiss/index_factory.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 16;
+size_t nb = 10000;
+size_t nt = 2000;
+size_t nq = 200;
+
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector <float> x (n * d);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < n * d; i++) {
+        x[i] = distrib(rng);
+    }
+    return x;
+}
+
+std::vector<idx_t> ground_truth(const std::vector<float> & xb,
+                                const std::vector<float> & xq)
+{
+    IndexFlatL2 flat(d);
+    flat.add(xb.size() / d, xb.data());
+    size_t n = xq.size() / d;
+    std::vector<float> D(n);
+    std::vector<idx_t> I(n);
+    flat.search(n, xq.data(), 1, D.data(), I.data());
+    return I;
+}
+
+} // namespace
+
+
+TEST(IVFAdaptiveNprobe, fixed_nprobe) {
+    std::vector<float> xb = make_data(nb, 1);
+    std::vector<float> xq = make_data(nq, 2);
+    std::unique_ptr<Index> index(index_factory(d, "IVF64,Flat"));
+    index->train(nb, xb.data());
+    index->add(nb, xb.data());
+    IndexIVF *ivf = dynamic_cast<IndexIVF*>(index.get());
+
+    // a predictor that always returns the same nprobe gives the same
+    // results as the IndexIVF
+    IndexIVFAdaptiveNprobe adaptive(ivf, 64, 1);
+    adaptive.bin_nprobe.assign(1, 5);
+    ivf->nprobe = 5;
+
+    int k = 10;
+    std::vector<float> D_ref(nq * k), D(nq * k);
+    std::vector<idx_t> I_ref(nq * k), I(nq * k);
+    ivf->search(nq, xq.data(), k, D_ref.data(), I_ref.data());
+    adaptive.search(nq, xq.data(), k, D.data(), I.data());
+    EXPECT_EQ(I, I_ref);
+    EXPECT_EQ(D, D_ref);
+}
+
+TEST(IVFAdaptiveNprobe, target_recall) {
+    std::vector<float> xb = make_data(nb, 1);
+    std::vector<float> xt = make_data(nt, 2);
+    std::vector<float> xq = make_data(nq, 3);
+    std::unique_ptr<Index> index(index_factory(d, "IVF64,Flat"));
+    index->train(nb, xb.data());
+    index->add(nb, xb.data());
+    IndexIVF *ivf = dynamic_cast<IndexIVF*>(index.get());
+
+    IndexIVFAdaptiveNprobe adaptive(ivf, 64, 8);
+    std::vector<idx_t> gt_t = ground_truth(xb, xt);
+    adaptive.train_predictor(nt, xt.data(), gt_t.data(), 0.9);
+
+    ASSERT_EQ(adaptive.bin_nprobe.size(), 8);
+    size_t np_max = 0;
+    for (size_t np : adaptive.bin_nprobe) {
+        EXPECT_GE(np, 1);
+        EXPECT_LE(np, 64);
+        np_max = std::max(np_max, np);
+    }
+
+    std::vector<idx_t> gt_q = ground_truth(xb, xq);
+    std::vector<float> D(nq);
+    std::vector<idx_t> I(nq);
+    indexIVF_stats.reset();
+    adaptive.search(nq, xq.data(), 1, D.data(), I.data());
+
+    size_t n_ok = 0;
+    for (size_t i = 0; i < nq; i++) {
+        n_ok += I[i] == gt_q[i];
+    }
+    EXPECT_GE(n_ok, 0.8 * nq);
+
+    // on average, less lists are visited than with the largest nprobe
+    EXPECT_LT(indexIVF_stats.nlist, np_max * nq);
+}
@@ -0,0 +1,129 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IVFAddPipeline.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/clone_index.h>
+#include <faiss/impl/FaissException.h>
+#include <faiss/index_factory.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 16;
+size_t nt = 3000;
+size_t nb = 5000;
+
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector <float> x (n * d);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < n * d; i++) {
+        x[i] = distrib(rng);
+    }
+    return x;
+}
+
+void expect_same_invlists(const IndexIVF & a, const IndexIVF & b)
+{
+    ASSERT_EQ(a.ntotal, b.ntotal);
+    for (size_t l = 0; l < a.nlist; l++) {
+        size_t n = a.invlists->list_size(l);
+        ASSERT_EQ(n, b.invlists->list_size(l));
+        if (n == 0) continue;
+        InvertedLists::ScopedIds ia(a.invlists, l), ib(b.invlists, l);
+        EXPECT_EQ(memcmp(ia.get(), ib.get(), n * sizeof(idx_t)), 0);
+        InvertedLists::ScopedCodes ca(a.invlists, l), cb(b.invlists, l);
+        EXPECT_EQ(memcmp(ca.get(), cb.get(), n * a.code_size), 0);
+    }
+}
+
+void test_same_as_add(const char *index_key, bool with_ids)
+{
+    std::vector<float> xt = make_data(nt, 1);
+    std::vector<float> xb = make_data(nb, 2);
+    std::vector<idx_t> ids(nb);
+    for (size_t i = 0; i < nb; i++) {
+        ids[i] = 7 * i + 3;
+    }
+
+    std::unique_ptr<Index> ref(index_factory(d, index_key));
+    ref->train(nt, xt.data());
+    std::unique_ptr<Index> index(clone_index(ref.get()));
+    IndexIVF *ivf = dynamic_cast<IndexIVF*>(index.get());
+    ASSERT_TRUE(ivf);
+    if (!with_ids) {
+        ivf->make_direct_map(true);
+        dynamic_cast<IndexIVF*>(ref.get())->make_direct_map(true);
+    }
+
+    // a separate quantizer, and batches that do not divide nb
+    std::unique_ptr<Index> quantizer(clone_index(ivf->quantizer));
+    IVFAddPipeline pipeline(ivf, quantizer.get(), 700);
+    for (int run = 0; run < 2; run++) {
+        size_t i0 = run * nb / 2, i1 = (run + 1) * nb / 2;
+        const idx_t *xids = with_ids ? ids.data() + i0 : nullptr;
+        ref->add_with_ids(i1 - i0, xb.data() + i0 * d, xids);
+        pipeline.add(i1 - i0, xb.data() + i0 * d, xids);
+    }
+    expect_same_invlists(*dynamic_cast<IndexIVF*>(ref.get()), *ivf);
+
+    if (!with_ids) {
+        std::vector<float> r0(d), r1(d);
+        for (idx_t i = 0; i < nb; i += 101) {
+            ref->reconstruct(i, r0.data());
+            index->reconstruct(i, r1.data());
+            EXPECT_EQ(r0, r1);
+        }
+    }
+}
+
+} // namespace
+
+
+TEST(IVFAddPipeline, IVFFlat) {
+    test_same_as_add("IVF64,Flat", false);
+    test_same_as_add("IVF64,Flat", true);
+}
+
+TEST(IVFAddPipeline, IVFPQ) {
+    test_same_as_add("IVF64,PQ4x4", false);
+    test_same_as_add("IVF64,PQ4x4", true);
+}
+
+TEST(IVFAddPipeline, IVFSQ) {
+    test_same_as_add("IVF64,SQ8", true);
+}
+
+TEST(IVFAddPipeline, unsupported) {
+    std::unique_ptr<Index> index(index_factory(d, "IVF64,Flat"));
+    IndexIVF *ivf = dynamic_cast<IndexIVF*>(index.get());
+    std::vector<float> xt = make_data(nt, 1);
+    ivf->train(nt, xt.data());
+    ivf->max_list_size = 100;
+    IVFAddPipeline pipeline(ivf);
+    EXPECT_THROW(pipeline.add(nt, xt.data()), FaissException);
+
+    std::unique_ptr<Index> pqr(index_factory(d, "IVF64,PQ4+4"));
+    EXPECT_THROW(IVFAddPipeline(dynamic_cast<IndexIVF*>(pqr.get())),
+                 FaissException);
+}
@@ -0,0 +1,120 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <memory>
+#include <vector>
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexIVF.h>
+#include <faiss/index_factory.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 32;
+size_t nb = 5000;
+size_t nq = 50;
+idx_t k = 10;
+
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector <float> x (n * d);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < n * d; i++) {
+        x[i] = distrib(rng);
+    }
+    return x;
+}
+
+struct EarlyStopTest: ::testing::Test {
+    std::unique_ptr<Index> index;
+    IndexIVF *ivf;
+    std::vector<float> xq;
+    std::vector<float> D_ref;
+    std::vector<idx_t> I_ref;
+    size_t nlist_ref;
+
+    void SetUp() override {
+        std::vector<float> xb = make_data(nb, 1);
+        xq = make_data(nq, 2);
+
+        index.reset(index_factory(d, "IVF64,Flat"));
+        index->train(nb, xb.data());
+        index->add(nb, xb.data());
+        ivf = dynamic_cast<IndexIVF*>(index.get());
+        ivf->nprobe = 16;
+
+        D_ref.resize(nq * k);
+        I_ref.resize(nq * k);
+        indexIVF_stats.reset();
+        ivf->search(nq, xq.data(), k, D_ref.data(), I_ref.data());
+        nlist_ref = indexIVF_stats.nlist;
+        EXPECT_EQ(indexIVF_stats.nearly_stop, 0);
+    }
+
+    /// results come from a subset of the lists, so each rank can only
+    /// get worse; returns the nb of lists scanned
+    size_t search_and_check(const SearchParameters *params = nullptr) {
+        std::vector<float> D(nq * k);
+        std::vector<idx_t> I(nq * k);
+        indexIVF_stats.reset();
+        ivf->search(nq, xq.data(), k, D.data(), I.data(), params);
+        for (size_t i = 0; i < nq * k; i++) {
+            EXPECT_GE(D[i], D_ref[i]);
+        }
+        return indexIVF_stats.nlist;
+    }
+};
+
+} // namespace
+
+
+TEST_F(EarlyStopTest, ratio_large) {
+    ivf->early_stop_ratio = 1e10;
+    std::vector<float> D(nq * k);
+    std::vector<idx_t> I(nq * k);
+    indexIVF_stats.reset();
+    ivf->search(nq, xq.data(), k, D.data(), I.data());
+    EXPECT_EQ(I, I_ref);
+    EXPECT_EQ(D, D_ref);
+    EXPECT_EQ(indexIVF_stats.nearly_stop, 0);
+}
+
+TEST_F(EarlyStopTest, ratio) {
+    ivf->early_stop_ratio = 1.0;
+    size_t nlist = search_and_check();
+    EXPECT_GT(indexIVF_stats.nearly_stop, 0);
+    EXPECT_LT(nlist, nlist_ref);
+}
+
+TEST_F(EarlyStopTest, stable) {
+    ivf->early_stop_stable = 2;
+    size_t nlist = search_and_check();
+    EXPECT_GT(indexIVF_stats.nearly_stop, 0);
+    EXPECT_LT(nlist, nlist_ref);
+    // at least 2 lists visited per query
+    EXPECT_GE(nlist, 2 * nq);
+}
+
+TEST_F(EarlyStopTest, params) {
+    IVFSearchParameters params;
+    params.nprobe = ivf->nprobe;
+    params.early_stop_stable = 2;
+    size_t nlist = search_and_check(&params);
+    EXPECT_GT(indexIVF_stats.nearly_stop, 0);
+    EXPECT_LT(nlist, nlist_ref);
+}
@@ -0,0 +1,175 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVFFlat.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/utils/distances.h>
+#include <faiss/utils/random.h>
+
+namespace {
+
+typedef faiss::Index::idx_t idx_t;
+
+int d = 21;
+size_t nb = 5000;
+size_t nq = 200;
+int k = 10;
+
+/// the query-batched search returns the same results as the default one
+void test_batched (faiss::MetricType metric)
+{
+    std::vector<float> xb (nb * d), xq (nq * d);
+    faiss::float_rand (xb.data(), xb.size(), 1);
+    faiss::float_rand (xq.data(), xq.size(), 2);
+
+    faiss::IndexFlat quantizer (d, metric);
+    faiss::IndexIVFFlat index (&quantizer, d, 32, metric);
+    index.train (nb, xb.data());
+    index.add (nb, xb.data());
+    index.nprobe = 4;
+
+    std::vector<float> D_ref (nq * k), D (nq * k);
+    std::vector<idx_t> I_ref (nq * k), I (nq * k);
+    index.search (nq, xq.data(), k, D_ref.data(), I_ref.data());
+
+    index.batch_queries = true;
+    index.search (nq, xq.data(), k, D.data(), I.data());
+
+    int nmiss = 0;
+    for (size_t i = 0; i < nq * k; i++) {
+        nmiss += I[i] != I_ref[i];
+        // the GEMM computes L2 distances from the norms
+        EXPECT_NEAR (D[i], D_ref[i], 1e-4 * std::fabs (D_ref[i]) + 1e-4);
+    }
+    EXPECT_LT (nmiss, nq * k / 100);
+}
+
+}  // namespace
+
+
+TEST(IVFFlatBatched, batch_4) {
+    std::vector<float> x (5 * d);
+    faiss::float_rand (x.data(), x.size(), 3);
+    for (int dd = 1; dd <= d; dd++) {
+        float dis[4], ip[4];
+        const float *y = x.data() + d;
+        faiss::fvec_L2sqr_batch_4 (x.data(), y, y + d, y + 2 * d, y + 3 * d,
+                                   dd, dis[0], dis[1], dis[2], dis[3]);
+        faiss::fvec_inner_product_batch_4 (
+              x.data(), y, y + d, y + 2 * d, y + 3 * d,
+              dd, ip[0], ip[1], ip[2], ip[3]);
+        for (int b = 0; b < 4; b++) {
+            // bit-exact, so that the distances do not depend on the
+            // position of the vector in the list
+            EXPECT_EQ (dis[b], faiss::fvec_L2sqr (x.data(), y + b * d, dd));
+            EXPECT_EQ (ip[b],
+                       faiss::fvec_inner_product (x.data(), y + b * d, dd));
+        }
+    }
+}
+
+TEST(IVFFlatBatched, L2) {
+    test_batched (faiss::METRIC_L2);
+}
+
+TEST(IVFFlatBatched, IP) {
+    test_batched (faiss::METRIC_INNER_PRODUCT);
+}
+
+TEST(IVFFlatBatched, selector) {
+    // the scanner handles the vectors that pass the selector by groups
+    // of 4, check against a brute force search on the subset
+    std::vector<float> xb (nb * d), xq (nq * d);
+    faiss::float_rand (xb.data(), xb.size(), 1);
+    faiss::float_rand (xq.data(), xq.size(), 2);
+
+    faiss::IndexFlatL2 quantizer (d);
+    faiss::IndexIVFFlat index (&quantizer, d, 4);
+    index.train (nb, xb.data());
+    index.add (nb, xb.data());
+
+    faiss::IDSelectorRange sel (100, 1234);
+    faiss::IVFSearchParameters params;
+    params.nprobe = 4;
+    params.sel = &sel;
+    index.batch_queries = true;
+
+    std::vector<float> D (nq * k);
+    std::vector<idx_t> I (nq * k);
+    index.search (nq, xq.data(), k, D.data(), I.data(), &params);
+
+    faiss::IndexFlatL2 ref (d);
+    ref.add (1234 - 100, xb.data() + 100 * d);
+    std::vector<float> D_ref (nq * k);
+    std::vector<idx_t> I_ref (nq * k);
+    ref.search (nq, xq.data(), k, D_ref.data(), I_ref.data());
+    for (size_t i = 0; i < nq * k; i++) {
+        EXPECT_EQ (I[i], I_ref[i] + 100);
+        EXPECT_NEAR (D[i], D_ref[i], 1e-5);
+    }
+}
+
+TEST(IVFFlatBatched, specialized_dims) {
+    // the scan without selector uses the kernels specialized by
+    // dimension, it gives the same results as the selector path
+    for (int dd : {64, 100, 128}) {
+        size_t nb2 = 2000, nq2 = 20;
+        std::vector<float> xb (nb2 * dd), xq (nq2 * dd);
+        faiss::float_rand (xb.data(), xb.size(), 1);
+        faiss::float_rand (xq.data(), xq.size(), 2);
+
+        for (faiss::MetricType metric :
+                {faiss::METRIC_L2, faiss::METRIC_INNER_PRODUCT}) {
+            faiss::IndexFlat quantizer (dd, metric);
+            faiss::IndexIVFFlat index (&quantizer, dd, 8, metric);
+            index.train (nb2, xb.data());
+            index.add (nb2, xb.data());
+            index.nprobe = 3;
+
+            std::vector<float> D_ref (nq2 * k), D (nq2 * k);
+            std::vector<idx_t> I_ref (nq2 * k), I (nq2 * k);
+            index.search (nq2, xq.data(), k, D.data(), I.data());
+
+            faiss::IDSelectorRange sel (0, nb2);
+            faiss::IVFSearchParameters params;
+            params.nprobe = 3;
+            params.sel = &sel;
+            index.search (nq2, xq.data(), k, D_ref.data(), I_ref.data(),
+                          &params);
+            EXPECT_EQ (I, I_ref);
+            EXPECT_EQ (D, D_ref);
+
+            // the distances do not depend on the position of the vector
+            // in the groups of 4: a selector that shifts the groups gives
+            // the same distances as one vector at a time
+            faiss::IDSelectorRange sel_shift (1, nb2);
+            params.sel = &sel_shift;
+            index.search (nq2, xq.data(), k, D_ref.data(), I_ref.data(),
+                          &params);
+            for (size_t i = 0; i < nq2 * k; i++) {
+                const float *q = xq.data() + (i / k) * dd;
+                const float *y = xb.data() + I[i] * dd;
+                EXPECT_EQ (D[i], metric == faiss::METRIC_L2 ?
+                           faiss::fvec_L2sqr (q, y, dd) :
+                           faiss::fvec_inner_product (q, y, dd));
+                if (I_ref[i] >= 0) {
+                    y = xb.data() + I_ref[i] * dd;
+                    EXPECT_EQ (D_ref[i], metric == faiss::METRIC_L2 ?
+                               faiss::fvec_L2sqr (q, y, dd) :
+                               faiss::fvec_inner_product (q, y, dd));
+                }
+            }
+        }
+    }
+}
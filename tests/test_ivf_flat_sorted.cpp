@@ -0,0 +1,189 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexIVFFlat.h>
+#include <faiss/clone_index.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/index_factory.h>
+#include <faiss/index_io.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 32;
+size_t nt = 4000;
+size_t nb = 20000;
+size_t nq = 50;
+idx_t k = 10;
+
+/// clustered data: the pruning needs distances that do not concentrate
+std::vector<float> make_data(size_t n, int seed)
+{
+    int nc = 50;
+    std::mt19937 rng(123);
+    std::vector<float> centers(nc * d);
+    std::uniform_real_distribution<float> uniform;
+    for (float & c: centers) {
+        c = uniform(rng);
+    }
+    rng.seed(seed);
+    std::normal_distribution<float> normal(0, 0.05);
+    std::vector<float> x(n * d);
+    for (size_t i = 0; i < n; i++) {
+        const float *c = centers.data() + (rng() % nc) * d;
+        for (int j = 0; j < d; j++) {
+            x[i * d + j] = c[j] + normal(rng);
+        }
+    }
+    return x;
+}
+
+/// the same results as the reference, up to the rounding of the distances
+void compare_results(Index *index, Index *ref, const float *xq,
+                     const SearchParameters *params = nullptr)
+{
+    std::vector<float> Dref(nq * k), D(nq * k);
+    std::vector<idx_t> Iref(nq * k), I(nq * k);
+    ref->search(nq, xq, k, Dref.data(), Iref.data(), params);
+    index->search(nq, xq, k, D.data(), I.data(), params);
+    EXPECT_EQ(I, Iref);
+    for (size_t i = 0; i < nq * k; i++) {
+        EXPECT_NEAR(D[i], Dref[i], 1e-5);
+    }
+}
+
+void check_sorted(const IndexIVFFlatSorted & index)
+{
+    for (size_t l = 0; l < index.nlist; l++) {
+        const std::vector<float> & cdis = index.centroid_dis[l];
+        ASSERT_EQ(cdis.size(), index.get_list_size(l));
+        EXPECT_TRUE(std::is_sorted(cdis.begin(), cdis.end()));
+    }
+}
+
+} // namespace
+
+
+TEST(IVFFlatSorted, search) {
+    std::vector<float> xt = make_data(nt, 1);
+    std::vector<float> xb = make_data(nb, 2);
+    std::vector<float> xq = make_data(nq, 3);
+
+    std::unique_ptr<Index> ref(index_factory(d, "IVF32,Flat"));
+    std::unique_ptr<Index> index(index_factory(d, "IVF32,FlatSorted"));
+    IndexIVFFlatSorted *sorted = dynamic_cast<IndexIVFFlatSorted*>(index.get());
+    ASSERT_TRUE(sorted);
+
+    ref->train(nt, xt.data());
+    index->train(nt, xt.data());
+    // added in two batches, the lists are sorted again
+    for (Index *idx: {ref.get(), index.get()}) {
+        idx->add(nb / 2, xb.data());
+        idx->add(nb / 2, xb.data() + nb / 2 * d);
+    }
+    check_sorted(*sorted);
+
+    for (size_t nprobe: {1, 4, 32}) {
+        dynamic_cast<IndexIVF*>(ref.get())->nprobe = nprobe;
+        sorted->nprobe = nprobe;
+        compare_results(index.get(), ref.get(), xq.data());
+        std::vector<float> D(nq * k);
+        std::vector<idx_t> I(nq * k);
+        indexIVF_stats.reset();
+        index->search(nq, xq.data(), k, D.data(), I.data());
+        // the far lists are mostly skipped
+        if (nprobe == 32) {
+            EXPECT_LT(indexIVF_stats.ndis, nq * nb / 4);
+        }
+    }
+
+    IDSelectorRange sel(1000, 15000);
+    IVFSearchParameters params;
+    params.nprobe = 8;
+    params.sel = &sel;
+    compare_results(index.get(), ref.get(), xq.data(), &params);
+
+    // store_pairs returns the offsets in the lists
+    std::vector<float> coarse_dis(nq * 8), D(nq * k), D2(nq * k);
+    std::vector<idx_t> keys(nq * 8), I(nq * k), I2(nq * k);
+    sorted->quantizer->search(nq, xq.data(), 8,
+                              coarse_dis.data(), keys.data());
+    sorted->search_preassigned(nq, xq.data(), k, keys.data(),
+                               coarse_dis.data(), D.data(), I.data(), false,
+                               &params);
+    sorted->search_preassigned(nq, xq.data(), k, keys.data(),
+                               coarse_dis.data(), D2.data(), I2.data(), true,
+                               &params);
+    for (size_t i = 0; i < nq * k; i++) {
+        EXPECT_EQ(I[i], sorted->invlists->get_single_id(
+                        lo_listno(I2[i]), lo_offset(I2[i])));
+    }
+}
+
+
+TEST(IVFFlatSorted, remove_merge_io) {
+    std::vector<float> xt = make_data(nt, 1);
+    std::vector<float> xb = make_data(nb, 2);
+    std::vector<float> xq = make_data(nq, 3);
+
+    std::unique_ptr<Index> ref(index_factory(d, "IVF32,Flat"));
+    std::unique_ptr<Index> index(index_factory(d, "IVF32,FlatSorted"));
+    ref->train(nt, xt.data());
+    index->train(nt, xt.data());
+    ref->add(nb, xb.data());
+
+    // merge of two halves
+    std::unique_ptr<Index> index2(clone_index(index.get()));
+    index->add(nb / 2, xb.data());
+    std::vector<idx_t> ids2(nb / 2);
+    for (size_t i = 0; i < nb / 2; i++) {
+        ids2[i] = nb / 2 + i;
+    }
+    index2->add_with_ids(nb / 2, xb.data() + nb / 2 * d, ids2.data());
+    dynamic_cast<IndexIVF*>(index.get())->merge_from(
+          *dynamic_cast<IndexIVF*>(index2.get()), 0);
+    EXPECT_EQ(index->ntotal, nb);
+    EXPECT_EQ(index2->ntotal, 0);
+
+    IndexIVFFlatSorted *sorted = dynamic_cast<IndexIVFFlatSorted*>(index.get());
+    check_sorted(*sorted);
+    compare_results(index.get(), ref.get(), xq.data());
+
+    IDSelectorRange sel(0, nb / 3);
+    EXPECT_EQ(index->remove_ids(sel), nb / 3);
+    ref->remove_ids(sel);
+    check_sorted(*sorted);
+    compare_results(index.get(), ref.get(), xq.data());
+
+    char fname[] = "/tmp/faiss_test_ivf_flat_sorted_XXXXXX";
+    int fd = mkstemp(fname);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    write_index(index.get(), fname);
+    std::unique_ptr<Index> index3(read_index(fname));
+    unlink(fname);
+    IndexIVFFlatSorted *sorted3 =
+        dynamic_cast<IndexIVFFlatSorted*>(index3.get());
+    ASSERT_TRUE(sorted3);
+    EXPECT_EQ(sorted3->centroid_dis, sorted->centroid_dis);
+    compare_results(index3.get(), ref.get(), xq.data());
+}
@@ -0,0 +1,112 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexHNSW.h>
+#include <faiss/IndexIVFFlat.h>
+#include <faiss/index_factory.h>
+#include <faiss/utils/random.h>
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 32;
+size_t nlist = 1024;
+size_t nb = 20000, nq = 100;
+
+std::vector<float> make_data (size_t n, int seed)
+{
+    std::vector<float> x (n * d);
+    float_rand (x.data(), x.size(), seed);
+    return x;
+}
+
+/// fraction of the exact nearest centroids that are found by the quantizer
+double coarse_recall (const Index & quantizer, const std::vector<float> & xq,
+                      int nprobe)
+{
+    IndexFlatL2 ref (d);
+    std::vector<float> centroids (nlist * d);
+    quantizer.reconstruct_n (0, nlist, centroids.data());
+    ref.add (nlist, centroids.data());
+
+    std::vector<float> D (nq * nprobe), D_ref (nq * nprobe);
+    std::vector<idx_t> I (nq * nprobe), I_ref (nq * nprobe);
+    quantizer.search (nq, xq.data(), nprobe, D.data(), I.data());
+    ref.search (nq, xq.data(), nprobe, D_ref.data(), I_ref.data());
+
+    size_t nfound = 0;
+    for (size_t i = 0; i < nq; i++) {
+        std::vector<idx_t> a (I.begin() + i * nprobe,
+                              I.begin() + (i + 1) * nprobe);
+        std::vector<idx_t> b (I_ref.begin() + i * nprobe,
+                              I_ref.begin() + (i + 1) * nprobe);
+        EXPECT_EQ (std::count (a.begin(), a.end(), -1), 0);
+        std::sort (a.begin(), a.end());
+        std::sort (b.begin(), b.end());
+        std::vector<idx_t> common;
+        std::set_intersection (a.begin(), a.end(), b.begin(), b.end(),
+                               std::back_inserter (common));
+        nfound += common.size();
+    }
+    return nfound / double (nq * nprobe);
+}
+
+}  // namespace
+
+
+TEST(IVFHNSWQuantizer, factory) {
+    std::unique_ptr<Index> index (index_factory (d, "IVF1024_HNSW,Flat"));
+    IndexIVF *ivf = dynamic_cast<IndexIVF*> (index.get());
+    ASSERT_TRUE (ivf);
+    IndexHNSWFlat *q = dynamic_cast<IndexHNSWFlat*> (ivf->quantizer);
+    ASSERT_TRUE (q);
+    EXPECT_EQ (q->hnsw.nb_neighbors (1), 32);
+    EXPECT_EQ (ivf->quantizer_trains_alone, 2);
+
+    std::unique_ptr<Index> index2 (index_factory (d, "IVF1024_HNSW16,Flat"));
+    q = dynamic_cast<IndexHNSWFlat*> (
+        dynamic_cast<IndexIVF*> (index2.get())->quantizer);
+    ASSERT_TRUE (q);
+    EXPECT_EQ (q->hnsw.nb_neighbors (1), 16);
+}
+
+TEST(IVFHNSWQuantizer, efSearch_follows_nprobe) {
+    std::vector<float> xb = make_data (nb, 1);
+    std::vector<float> xq = make_data (nq, 2);
+
+    std::unique_ptr<Index> index (index_factory (d, "IVF1024_HNSW,Flat"));
+    IndexIVF *ivf = dynamic_cast<IndexIVF*> (index.get());
+    ivf->train (nb, xb.data());
+    ivf->add (nb, xb.data());
+    IndexHNSWFlat *q = dynamic_cast<IndexHNSWFlat*> (ivf->quantizer);
+    EXPECT_EQ (q->ntotal, nlist);
+    q->hnsw.efSearch = 16;
+
+    // the graph search is not cut off after efSearch steps when more
+    // than efSearch lists are visited
+    EXPECT_GT (coarse_recall (*q, xq, 128), 0.95);
+
+    // the IVF search results use the nprobe lists found by the quantizer
+    ivf->nprobe = 128;
+    int k = 10;
+    std::vector<float> D (nq * k);
+    std::vector<idx_t> I (nq * k);
+    ivf->search (nq, xq.data(), k, D.data(), I.data());
+    for (size_t i = 0; i < nq * k; i++) {
+        EXPECT_GE (I[i], 0);
+    }
+}
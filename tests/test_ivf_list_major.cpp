@@ -0,0 +1,111 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include <omp.h>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexIVF.h>
+#include <faiss/index_factory.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/utils/random.h>
+
+namespace {
+
+typedef faiss::Index::idx_t idx_t;
+
+int d = 16;
+size_t nb = 4000;
+size_t nq = 300;
+
+/// the list-major search (parallel_mode 3) returns the same results as
+/// the query-major one
+void test_list_major (const char *key, faiss::MetricType metric,
+                      int k, int nthread)
+{
+    std::vector<float> xb (nb * d), xq (nq * d);
+    faiss::float_rand (xb.data(), xb.size(), 1);
+    faiss::float_rand (xq.data(), xq.size(), 2);
+
+    std::unique_ptr<faiss::Index> index (
+          faiss::index_factory (d, key, metric));
+    index->train (nb, xb.data());
+    index->add (nb, xb.data());
+    auto ivf = dynamic_cast<faiss::IndexIVF*> (index.get());
+    ivf->nprobe = 5;
+
+    std::vector<float> D_ref (nq * k), D (nq * k);
+    std::vector<idx_t> I_ref (nq * k), I (nq * k);
+    index->search (nq, xq.data(), k, D_ref.data(), I_ref.data());
+
+    int nt0 = omp_get_max_threads ();
+    omp_set_num_threads (nthread);
+    ivf->parallel_mode = 3;
+    index->search (nq, xq.data(), k, D.data(), I.data());
+    omp_set_num_threads (nt0);
+
+    int nmiss = 0;
+    for (size_t i = 0; i < nq * k; i++) {
+        nmiss += I[i] != I_ref[i];
+        EXPECT_NEAR (D[i], D_ref[i], 1e-4 * std::fabs (D_ref[i]) + 1e-4)
+            << key;
+    }
+    // IVFFlat computes the L2 distances from the norms, which can swap
+    // near ties
+    EXPECT_LT (nmiss, nq * k / 100) << key;
+}
+
+}  // namespace
+
+
+TEST(IVFListMajor, IVFFlat) {
+    test_list_major ("IVF32,Flat", faiss::METRIC_L2, 10, 1);
+    test_list_major ("IVF32,Flat", faiss::METRIC_INNER_PRODUCT, 10, 3);
+}
+
+TEST(IVFListMajor, IVFSQ) {
+    test_list_major ("IVF32,SQ8", faiss::METRIC_L2, 10, 1);
+    test_list_major ("IVF32,SQ8", faiss::METRIC_L2, 10, 3);
+    test_list_major ("IVF32,SQ8", faiss::METRIC_INNER_PRODUCT, 50, 2);
+}
+
+TEST(IVFListMajor, IVFPQ) {
+    test_list_major ("IVF32,PQ4x4", faiss::METRIC_L2, 10, 3);
+}
+
+/// range search does not have a list-major mode, it runs as mode 0
+TEST(IVFListMajor, range_search) {
+    std::vector<float> xb (nb * d), xq (nq * d);
+    faiss::float_rand (xb.data(), xb.size(), 1);
+    faiss::float_rand (xq.data(), xq.size(), 2);
+
+    std::unique_ptr<faiss::Index> index (
+          faiss::index_factory (d, "IVF32,Flat"));
+    index->train (nb, xb.data());
+    index->add (nb, xb.data());
+    auto ivf = dynamic_cast<faiss::IndexIVF*> (index.get());
+    ivf->nprobe = 5;
+    float radius = 0.4;
+
+    faiss::RangeSearchResult ref (nq), res (nq);
+    index->range_search (nq, xq.data(), radius, &ref);
+    ivf->parallel_mode = 3;
+    index->range_search (nq, xq.data(), radius, &res);
+
+    EXPECT_GT (ref.lims[nq], 0);
+    for (size_t i = 0; i <= nq; i++) {
+        ASSERT_EQ (ref.lims[i], res.lims[i]);
+    }
+    for (size_t i = 0; i < ref.lims[nq]; i++) {
+        EXPECT_EQ (ref.labels[i], res.labels[i]);
+        EXPECT_EQ (ref.distances[i], res.distances[i]);
+    }
+}
@@ -0,0 +1,139 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVFFlat.h>
+#include <faiss/IndexIVFPQ.h>
+#include <faiss/IndexScalarQuantizer.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+// if skewed, most points are in a small region of the space
+std::vector<float> make_data(size_t n, size_t d, bool skewed, int seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> distrib(0, 1);
+    std::vector<float> x(n * d);
+    for (size_t i = 0; i < n; i++) {
+        float scale = skewed && i % 4 != 0 ? 0.1 : 1.0;
+        for (size_t j = 0; j < d; j++) {
+            x[i * d + j] = distrib(rng) * scale;
+        }
+    }
+    return x;
+}
+
+// nb of database vectors among the first nq that are in their own top-10
+size_t n_found(IndexIVF & index, const std::vector<float> & xb, size_t nq)
+{
+    idx_t k = 10;
+    index.nprobe = index.nlist;
+    std::vector<float> D(nq * k);
+    std::vector<idx_t> I(nq * k);
+    index.search(nq, xb.data(), k, D.data(), I.data());
+    size_t nok = 0;
+    for (size_t i = 0; i < nq; i++) {
+        nok += std::count(I.begin() + i * k, I.begin() + (i + 1) * k,
+                          idx_t(i));
+    }
+    return nok;
+}
+
+size_t max_list_size(const IndexIVF & index)
+{
+    size_t m = 0;
+    for (size_t l = 0; l < index.nlist; l++) {
+        m = std::max(m, index.invlists->list_size(l));
+    }
+    return m;
+}
+
+void test_cap(IndexIVF *index, const std::vector<float> & xt,
+              const std::vector<float> & xb)
+{
+    size_t d = index->d, nb = xb.size() / d;
+    index->train(xt.size() / d, xt.data());
+
+    index->add(nb, xb.data());
+    size_t m0 = max_list_size(*index);
+    size_t nok0 = n_found(*index, xb, 50);
+    index->reset();
+
+    size_t cap = 2 * nb / index->nlist;
+    ASSERT_GT(m0, cap);
+    index->max_list_size = cap;
+    index->spill_nprobe = index->nlist;
+    // add in several batches so that the cap takes into account the
+    // vectors already in the lists
+    index->add(nb / 2, xb.data());
+    index->add(nb - nb / 2, xb.data() + nb / 2 * d);
+    EXPECT_EQ(index->ntotal, nb);
+    EXPECT_LE(max_list_size(*index), cap);
+
+    // the vectors are still found with exhaustive probing (the residual
+    // encoders are less accurate for spilled vectors)
+    EXPECT_GE(n_found(*index, xb, 50), nok0 * 7 / 10);
+}
+
+} // namespace
+
+
+TEST(IVFMaxListSize, IVFFlat) {
+    size_t d = 16, nlist = 32;
+    std::vector<float> xt = make_data(4000, d, false, 123);
+    std::vector<float> xb = make_data(3000, d, true, 456);
+    IndexFlatL2 quantizer(d);
+    IndexIVFFlat index(&quantizer, d, nlist);
+    test_cap(&index, xt, xb);
+}
+
+TEST(IVFMaxListSize, IVFScalarQuantizer) {
+    size_t d = 16, nlist = 32;
+    std::vector<float> xt = make_data(4000, d, false, 123);
+    std::vector<float> xb = make_data(3000, d, true, 456);
+    IndexFlatL2 quantizer(d);
+    IndexIVFScalarQuantizer index(&quantizer, d, nlist,
+                                  ScalarQuantizer::QT_8bit);
+    test_cap(&index, xt, xb);
+}
+
+TEST(IVFMaxListSize, IVFPQ) {
+    size_t d = 16, nlist = 32;
+    std::vector<float> xt = make_data(10000, d, false, 123);
+    std::vector<float> xb = make_data(3000, d, true, 456);
+    IndexFlatL2 quantizer(d);
+    IndexIVFPQ index(&quantizer, d, nlist, 8, 8);
+    test_cap(&index, xt, xb);
+}
+
+// the lists that are full are skipped only up to spill_nprobe
+TEST(IVFMaxListSize, spill_nprobe) {
+    size_t d = 8, nlist = 16, nb = 2000;
+    std::vector<float> xb = make_data(nb, d, true, 789);
+    IndexFlatL2 quantizer(d);
+    IndexIVFFlat index(&quantizer, d, nlist);
+    std::vector<float> xt = make_data(nb, d, false, 123);
+    index.train(nb, xt.data());
+    index.max_list_size = nb / nlist;
+    index.spill_nprobe = 1;
+    std::vector<idx_t> a1(nb), a2(nb);
+    quantizer.assign(nb, xb.data(), a1.data());
+    index.assign_for_add(nb, xb.data(), a2.data());
+    EXPECT_EQ(a1, a2);
+}
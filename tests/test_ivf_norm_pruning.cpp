@@ -0,0 +1,128 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexIVF.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/index_factory.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 32;
+size_t nt = 4000;
+size_t nb = 10000;
+size_t nq = 50;
+idx_t k = 10;
+
+/// vectors with very uneven norms around a common direction, as for
+/// recommendation embeddings
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector<float> x(n * d);
+    std::normal_distribution<float> distrib;
+    for (size_t i = 0; i < n; i++) {
+        float scale = std::exp(distrib(rng));
+        for (int j = 0; j < d; j++) {
+            x[i * d + j] = scale * (1 + 0.5 * distrib(rng));
+        }
+    }
+    return x;
+}
+
+void test_pruning(const char *factory_string)
+{
+    std::vector<float> xt = make_data(nt, 1);
+    std::vector<float> xb = make_data(nb, 2);
+    std::vector<float> xq = make_data(nq, 3);
+
+    std::unique_ptr<Index> index(
+          index_factory(d, factory_string, METRIC_INNER_PRODUCT));
+    IndexIVF *ivf = dynamic_cast<IndexIVF*>(index.get());
+    ivf->train(nt, xt.data());
+    ivf->add(nb, xb.data());
+    ivf->nprobe = 16;
+
+    std::vector<float> Dref(nq * k), D(nq * k);
+    std::vector<idx_t> Iref(nq * k), I(nq * k);
+    ivf->search(nq, xq.data(), k, Dref.data(), Iref.data());
+
+    ivf->compute_norm_bounds(32);
+    indexIVF_stats.reset();
+    ivf->search(nq, xq.data(), k, D.data(), I.data());
+    // the scanners may sum the distances in a different order
+    EXPECT_EQ(I, Iref);
+    for (size_t i = 0; i < nq * k; i++) {
+        EXPECT_NEAR(D[i], Dref[i], 1e-5 * std::fabs(Dref[i]));
+    }
+    // most codes are skipped on this data
+    EXPECT_GT(indexIVF_stats.nnorm_pruned, indexIVF_stats.ndis);
+
+    // the added vectors are scanned without pruning, until the bounds
+    // are extended
+    std::vector<float> xb2 = make_data(nb / 4, 4);
+    ivf->add(nb / 4, xb2.data());
+    ivf->search(nq, xq.data(), k, D.data(), I.data());
+
+    IVFNormBounds bounds = ivf->norm_bounds;
+    ivf->norm_bounds.clear();
+    ivf->search(nq, xq.data(), k, Dref.data(), Iref.data());
+    EXPECT_EQ(I, Iref);
+
+    ivf->norm_bounds = bounds;
+    ivf->compute_norm_bounds(32);
+    for (size_t l = 0; l < ivf->nlist; l++) {
+        EXPECT_EQ(ivf->norm_bounds.ncovered[l], ivf->get_list_size(l));
+    }
+    ivf->search(nq, xq.data(), k, D.data(), I.data());
+    EXPECT_EQ(I, Iref);
+
+    // only the lists are pruned with store_pairs
+    std::vector<float> coarse_dis(nq * ivf->nprobe);
+    std::vector<idx_t> keys(nq * ivf->nprobe);
+    ivf->quantizer->search(nq, xq.data(), ivf->nprobe,
+                           coarse_dis.data(), keys.data());
+    ivf->search_preassigned(nq, xq.data(), k, keys.data(), coarse_dis.data(),
+                            D.data(), I.data(), true);
+    bounds = ivf->norm_bounds;
+    ivf->norm_bounds.clear();
+    ivf->search_preassigned(nq, xq.data(), k, keys.data(), coarse_dis.data(),
+                            Dref.data(), Iref.data(), true);
+    EXPECT_EQ(I, Iref);
+
+    // removals invalidate the bounds
+    ivf->norm_bounds = bounds;
+    IDSelectorRange sel(0, 10);
+    ivf->remove_ids(sel);
+    EXPECT_TRUE(ivf->norm_bounds.empty());
+}
+
+} // namespace
+
+
+TEST(IVFNormPruning, IVFFlat) {
+    test_pruning("IVF64,Flat");
+}
+
+TEST(IVFNormPruning, IVFPQ) {
+    test_pruning("IVF64,PQ8x4");
+}
+
+TEST(IVFNormPruning, IVFSQ) {
+    test_pruning("IVF64,SQ8");
+}
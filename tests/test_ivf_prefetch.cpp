@@ -0,0 +1,103 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexIVFPQ.h>
+#include <faiss/index_factory.h>
+#include <faiss/impl/AuxIndexStructures.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 32;
+size_t nt = 3000;
+size_t nb = 5000;
+size_t nq = 30;
+idx_t k = 10;
+
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector<float> x(n * d);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < n * d; i++) {
+        x[i] = distrib(rng);
+    }
+    return x;
+}
+
+void test_prefetch(const char *index_key, int use_precomputed_table = 0)
+{
+    std::vector<float> xt = make_data(nt, 1);
+    std::vector<float> xb = make_data(nb, 2);
+    std::vector<float> xq = make_data(nq, 3);
+
+    std::unique_ptr<Index> index(index_factory(d, index_key));
+    IndexIVF *ivf = dynamic_cast<IndexIVF*>(index.get());
+    ASSERT_TRUE(ivf);
+    ivf->train(nt, xt.data());
+    ivf->add(nb, xb.data());
+    ivf->nprobe = 8;
+    if (use_precomputed_table) {
+        IndexIVFPQ *ivfpq = dynamic_cast<IndexIVFPQ*>(ivf);
+        ASSERT_TRUE(ivfpq);
+        ivfpq->use_precomputed_table = use_precomputed_table;
+        ivfpq->precompute_table();
+    }
+
+    std::vector<float> Dref(nq * k), D(nq * k);
+    std::vector<idx_t> Iref(nq * k), I(nq * k);
+    ivf->prefetch_distance = 0;
+    ivf->search(nq, xq.data(), k, Dref.data(), Iref.data());
+    float radius = Dref[nq * k / 2];
+    RangeSearchResult rref(nq);
+    ivf->range_search(nq, xq.data(), radius, &rref);
+
+    for (size_t dist: {1, 3, 20}) {
+        ivf->prefetch_distance = dist;
+        ivf->search(nq, xq.data(), k, D.data(), I.data());
+        EXPECT_EQ(I, Iref);
+        EXPECT_EQ(D, Dref);
+
+        RangeSearchResult res(nq);
+        ivf->range_search(nq, xq.data(), radius, &res);
+        for (size_t i = 0; i <= nq; i++) {
+            ASSERT_EQ(res.lims[i], rref.lims[i]);
+        }
+        for (size_t j = 0; j < rref.lims[nq]; j++) {
+            EXPECT_EQ(res.labels[j], rref.labels[j]);
+        }
+    }
+}
+
+} // namespace
+
+
+TEST(IVFPrefetch, IVFFlat) {
+    test_prefetch("IVF64,Flat");
+}
+
+TEST(IVFPrefetch, IVFPQ) {
+    test_prefetch("IVF64,PQ8x4");
+}
+
+TEST(IVFPrefetch, IVFPQ_precomputed) {
+    test_prefetch("IVF64,PQ8x4", 1);
+}
+
+TEST(IVFPrefetch, IVFPQ_precomputed_fp16) {
+    test_prefetch("IVF64,PQ8x4", 3);
+}
@@ -0,0 +1,104 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <memory>
+#include <vector>
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexIVF.h>
+#include <faiss/index_factory.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 32;
+size_t nb = 5000;
+size_t nq = 20;
+
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector <float> x (n * d);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < n * d; i++) {
+        x[i] = distrib(rng);
+    }
+    return x;
+}
+
+/// search with the heap and with the reservoir and compare
+void test_reservoir(const char *index_key, MetricType metric,
+                    idx_t k, bool store_pairs = false)
+{
+    std::vector<float> xb = make_data(nb, 1);
+    std::vector<float> xq = make_data(nq, 2);
+
+    std::unique_ptr<Index> index(index_factory(d, index_key, metric));
+    index->train(nb, xb.data());
+    index->add(nb, xb.data());
+
+    IndexIVF *ivf = dynamic_cast<IndexIVF*>(index.get());
+    ASSERT_TRUE(ivf);
+    ivf->nprobe = 4;
+
+    std::vector<idx_t> keys(nq * ivf->nprobe);
+    std::vector<float> coarse_dis(nq * ivf->nprobe);
+    ivf->quantizer->search(nq, xq.data(), ivf->nprobe,
+                           coarse_dis.data(), keys.data());
+
+    std::vector<float> D_ref(nq * k), D(nq * k);
+    std::vector<idx_t> I_ref(nq * k), I(nq * k);
+
+    ivf->search_preassigned(nq, xq.data(), k, keys.data(), coarse_dis.data(),
+                            D_ref.data(), I_ref.data(), store_pairs);
+
+    ivf->reservoir_min_k = 10;
+    ivf->search_preassigned(nq, xq.data(), k, keys.data(), coarse_dis.data(),
+                            D.data(), I.data(), store_pairs);
+
+    // same results up to ties
+    for (size_t i = 0; i < nq * k; i++) {
+        EXPECT_EQ(D_ref[i], D[i]);
+        if (D_ref[i] != D[i]) {
+            break;
+        }
+    }
+    size_t ndiff = 0;
+    for (size_t i = 0; i < nq * k; i++) {
+        ndiff += I_ref[i] != I[i];
+    }
+    EXPECT_LE(ndiff, nq * k / 100);
+}
+
+} // namespace
+
+
+TEST(IVFReservoir, IVFFlat_L2) {
+    test_reservoir("IVF32,Flat", METRIC_L2, 100);
+}
+
+TEST(IVFReservoir, IVFFlat_IP) {
+    test_reservoir("IVF32,Flat", METRIC_INNER_PRODUCT, 100);
+}
+
+TEST(IVFReservoir, IVFPQ_L2_store_pairs) {
+    test_reservoir("IVF32,PQ8np", METRIC_L2, 200, true);
+}
+
+TEST(IVFReservoir, IVFSQ_k_larger_than_results) {
+    // fewer results than k: the tail must be filled with -1
+    test_reservoir("IVF32,SQ8", METRIC_L2, 1000);
+}
@@ -0,0 +1,127 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IVFSearchBatcher.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVFFlat.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 16;
+size_t nlist = 64;
+size_t nt = 3000;
+size_t nb = 5000;
+size_t nq = 64;
+
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector <float> x (n * d);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < n * d; i++) {
+        x[i] = distrib(rng);
+    }
+    return x;
+}
+
+} // namespace
+
+
+TEST(IVFSearchBatcher, concurrent_callers) {
+    std::vector<float> xt = make_data(nt, 1);
+    std::vector<float> xb = make_data(nb, 2);
+    std::vector<float> xq = make_data(nq, 3);
+
+    IndexFlatL2 quantizer(d);
+    IndexIVFFlat index(&quantizer, d, nlist);
+    index.train(nt, xt.data());
+    index.add(nb, xb.data());
+    index.nprobe = 8;
+
+    // queries i use k = 1 + i % 7
+    idx_t kmax = 7;
+    std::vector<float> D_ref(nq * kmax);
+    std::vector<idx_t> I_ref(nq * kmax);
+    index.search(nq, xq.data(), kmax, D_ref.data(), I_ref.data());
+
+    IVFSearchBatcher batcher(&index, 50.0, 16);
+
+    std::vector<float> D(nq * kmax, -1);
+    std::vector<idx_t> I(nq * kmax, -2);
+
+    int nthread = 8;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthread; t++) {
+        threads.emplace_back([&, t] () {
+            for (size_t i = t; i < nq; i += nthread) {
+                idx_t k = 1 + i % kmax;
+                batcher.search(1, xq.data() + i * d, k,
+                               D.data() + i * kmax, I.data() + i * kmax);
+            }
+        });
+    }
+    for (auto & t: threads) {
+        t.join();
+    }
+
+    for (size_t i = 0; i < nq; i++) {
+        idx_t k = 1 + i % kmax;
+        for (idx_t j = 0; j < k; j++) {
+            EXPECT_EQ(I[i * kmax + j], I_ref[i * kmax + j]);
+            EXPECT_EQ(D[i * kmax + j], D_ref[i * kmax + j]);
+        }
+        // the output is not written beyond k
+        for (idx_t j = k; j < kmax; j++) {
+            EXPECT_EQ(I[i * kmax + j], -2);
+        }
+    }
+    EXPECT_EQ(batcher.nquery, nq);
+    EXPECT_LT(batcher.nbatch, nq);
+}
+
+
+TEST(IVFSearchBatcher, single_caller) {
+    std::vector<float> xt = make_data(nt, 1);
+    std::vector<float> xb = make_data(nb, 2);
+    std::vector<float> xq = make_data(nq, 3);
+
+    IndexFlatL2 quantizer(d);
+    IndexIVFFlat index(&quantizer, d, nlist);
+    index.train(nt, xt.data());
+    index.add(nb, xb.data());
+
+    IVFSearchParameters params;
+    params.nprobe = 4;
+
+    idx_t k = 5;
+    std::vector<float> D_ref(nq * k), D(nq * k);
+    std::vector<idx_t> I_ref(nq * k), I(nq * k);
+    index.search(nq, xq.data(), k, D_ref.data(), I_ref.data(), &params);
+
+    // a batch larger than max_batch_size is processed without waiting
+    IVFSearchBatcher batcher(&index, 1000.0, 10);
+    batcher.params = &params;
+    batcher.search(nq, xq.data(), k, D.data(), I.data());
+    EXPECT_EQ(I, I_ref);
+    EXPECT_EQ(D, D_ref);
+    EXPECT_EQ(batcher.nbatch, 1);
+}
@@ -0,0 +1,87 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IVFSearchPipeline.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVFPQ.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 16;
+size_t nlist = 64;
+size_t nt = 3000;
+size_t nb = 5000;
+size_t nq = 100;
+idx_t k = 10;
+
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector <float> x (n * d);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < n * d; i++) {
+        x[i] = distrib(rng);
+    }
+    return x;
+}
+
+} // namespace
+
+
+TEST(IVFSearchPipeline, same_as_search) {
+    std::vector<float> xt = make_data(nt, 1);
+    std::vector<float> xb = make_data(nb, 2);
+    std::vector<float> xq = make_data(nq, 3);
+
+    IndexFlatL2 quantizer(d);
+    IndexIVFPQ index(&quantizer, d, nlist, 4, 4);
+    index.train(nt, xt.data());
+    index.add(nb, xb.data());
+    index.nprobe = 8;
+
+    std::vector<float> D_ref(nq * k);
+    std::vector<idx_t> I_ref(nq * k);
+    index.search(nq, xq.data(), k, D_ref.data(), I_ref.data());
+
+    // a replica of the quantizer, as a GPU index would be
+    IndexFlatL2 quantizer2(quantizer);
+
+    for (idx_t bs: {1, 7, 64, 1000}) {
+        IVFSearchPipeline pipeline(&index, &quantizer2, bs);
+        std::vector<float> D(nq * k, -1);
+        std::vector<idx_t> I(nq * k, -2);
+        pipeline.search(nq, xq.data(), k, D.data(), I.data());
+        EXPECT_EQ(I, I_ref);
+        for (size_t i = 0; i < nq * k; i++) {
+            EXPECT_NEAR(D[i], D_ref[i], 1e-5);
+        }
+    }
+
+    // search parameters
+    IVFSearchParameters params;
+    params.nprobe = 3;
+    index.search(nq, xq.data(), k, D_ref.data(), I_ref.data(), &params);
+    IVFSearchPipeline pipeline(&index, nullptr, 30);
+    pipeline.params = &params;
+    std::vector<float> D(nq * k);
+    std::vector<idx_t> I(nq * k);
+    pipeline.search(nq, xq.data(), k, D.data(), I.data());
+    EXPECT_EQ(I, I_ref);
+}
@@ -0,0 +1,203 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVFFlat.h>
+#include <faiss/IndexIVFPQ.h>
+#include <faiss/IndexScalarQuantizer.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/utils/distances.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+size_t d = 16, nt = 2000, nb = 4000;
+
+// if skewed, most points are in a small region of the space
+std::vector<float> make_data(size_t n, bool skewed, int seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> distrib(0, 1);
+    std::vector<float> x(n * d);
+    for (size_t i = 0; i < n; i++) {
+        float scale = skewed && i % 4 != 0 ? 0.1 : 1.0;
+        for (size_t j = 0; j < d; j++) {
+            x[i * d + j] = distrib(rng) * scale;
+        }
+    }
+    return x;
+}
+
+size_t largest_list(const IndexIVF & index, size_t *size = nullptr)
+{
+    size_t lmax = 0;
+    for (size_t l = 0; l < index.nlist; l++) {
+        if (index.get_list_size(l) > index.get_list_size(lmax)) {
+            lmax = l;
+        }
+    }
+    if (size) {
+        *size = index.get_list_size(lmax);
+    }
+    return lmax;
+}
+
+size_t total_size(const IndexIVF & index)
+{
+    size_t tot = 0;
+    for (size_t l = 0; l < index.nlist; l++) {
+        tot += index.get_list_size(l);
+    }
+    return tot;
+}
+
+void train_and_add(IndexIVF & index)
+{
+    // trained on uniform data, the skewed data falls in a few lists
+    std::vector<float> xt = make_data(nt, false, 1);
+    std::vector<float> xb = make_data(nb, true, 2);
+    index.train(nt, xt.data());
+    index.add(nb, xb.data());
+}
+
+} // namespace
+
+
+TEST(IVFSplitList, IVFFlat) {
+    IndexFlatL2 quantizer(d);
+    IndexIVFFlat index(&quantizer, d, 16);
+    train_and_add(index);
+    index.make_direct_map();
+
+    size_t size0;
+    size_t l0 = largest_list(index, &size0);
+    idx_t new_list = index.split_list(l0);
+    EXPECT_EQ(new_list, 16);
+    EXPECT_EQ(index.nlist, 17);
+    EXPECT_EQ(index.invlists->nlist, 17);
+    EXPECT_EQ(quantizer.ntotal, 17);
+    EXPECT_EQ(total_size(index), nb);
+    EXPECT_GT(index.get_list_size(new_list), 0);
+    EXPECT_LT(index.get_list_size(l0), size0);
+
+    // the vectors are moved as is and the direct map is up to date
+    std::vector<float> xb = make_data(nb, true, 2);
+    std::vector<float> recons(d);
+    for (idx_t i = 0; i < nb; i++) {
+        index.reconstruct(i, recons.data());
+        ASSERT_TRUE(std::equal(recons.begin(), recons.end(),
+                               xb.begin() + i * d));
+    }
+
+    // the vectors of the two lists are closer to their own centroid
+    std::vector<float> c0(d), c1(d);
+    quantizer.reconstruct(l0, c0.data());
+    quantizer.reconstruct(new_list, c1.data());
+    for (idx_t list_no : {idx_t(l0), new_list}) {
+        const float *own = list_no == new_list ? c1.data() : c0.data();
+        const float *other = list_no == new_list ? c0.data() : c1.data();
+        InvertedLists::ScopedCodes codes(index.invlists, list_no);
+        const float *x = (const float*)codes.get();
+        for (size_t j = 0; j < index.get_list_size(list_no); j++) {
+            EXPECT_LE(fvec_L2sqr(x + j * d, own, d),
+                      fvec_L2sqr(x + j * d, other, d));
+        }
+    }
+}
+
+TEST(IVFSplitList, IVFPQ_precomputed_table) {
+    IndexFlatL2 quantizer(d);
+    IndexIVFPQ index(&quantizer, d, 16, 8, 6);
+    index.use_precomputed_table = 1;
+    // the PQ is trained on the skewed data, so that the vectors of the
+    // largest lists are not all reconstructed to the same point
+    std::vector<float> xt = make_data(nt, false, 1);
+    std::vector<float> xb = make_data(nb, true, 2);
+    index.train(nt, xt.data());
+    index.train_residual(nb, xb.data());
+    index.add(nb, xb.data());
+    ASSERT_FALSE(index.precomputed_table.empty());
+
+    // the splits stop when the reconstructions of a list are too close
+    // to be separated, so the lists are not fully balanced
+    size_t size0, smax;
+    largest_list(index, &size0);
+    index.split_large_lists(2.0);
+    largest_list(index, &smax);
+    EXPECT_GT(index.nlist, 16);
+    EXPECT_LT(smax, size0 / 2);
+    EXPECT_EQ(total_size(index), nb);
+    EXPECT_EQ(index.precomputed_table.size(),
+              index.nlist * index.pq.M * index.pq.ksub);
+
+    // same results with the table as without
+    size_t nq = 50;
+    idx_t k = 5;
+    std::vector<float> xq = make_data(nq, true, 3);
+    index.nprobe = 4;
+    std::vector<float> D1(nq * k), D2(nq * k);
+    std::vector<idx_t> I1(nq * k), I2(nq * k);
+    index.search(nq, xq.data(), k, D1.data(), I1.data());
+    index.use_precomputed_table = 0;
+    index.precomputed_table.clear();
+    index.search(nq, xq.data(), k, D2.data(), I2.data());
+    for (size_t i = 0; i < nq * k; i++) {
+        EXPECT_NEAR(D1[i], D2[i], 1e-4);
+    }
+}
+
+TEST(IVFSplitList, IVFSQ_residual_tombstones) {
+    IndexFlatL2 quantizer(d);
+    IndexIVFScalarQuantizer index(&quantizer, d, 16,
+                                  ScalarQuantizer::QT_8bit);
+    train_and_add(index);
+    index.lazy_remove = true;
+
+    // delete 10 vectors of the largest list
+    size_t l0 = largest_list(index);
+    std::vector<idx_t> del;
+    {
+        InvertedLists::ScopedIds ids(index.invlists, l0);
+        del.assign(ids.get(), ids.get() + 10);
+    }
+    IDSelectorBatch sel(del.size(), del.data());
+    EXPECT_EQ(index.remove_ids(sel), 10);
+    EXPECT_EQ(index.ntombstones, 10);
+
+    // most vectors are still found after their re-encoding
+    index.nprobe = 4;
+    std::vector<float> xb = make_data(nb, true, 2);
+    std::vector<float> D(nb);
+    std::vector<idx_t> I(nb);
+    index.search(nb, xb.data(), 1, D.data(), I.data());
+    size_t nfound0 = 0;
+    for (idx_t i = 0; i < nb; i++) {
+        nfound0 += I[i] == i;
+    }
+
+    ASSERT_GE(index.split_list(l0), 0);
+    EXPECT_EQ(index.ntombstones, 0);
+    EXPECT_EQ(total_size(index), nb - 10);
+
+    index.search(nb, xb.data(), 1, D.data(), I.data());
+    size_t nfound = 0;
+    for (idx_t i = 0; i < nb; i++) {
+        nfound += I[i] == i;
+    }
+    EXPECT_GE(nfound, nfound0 * 0.98);
+}
@@ -0,0 +1,164 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVFFlat.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/FaissException.h>
+#include <faiss/impl/io.h>
+#include <faiss/index_io.h>
+#include <faiss/utils/random.h>
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 16;
+size_t nlist = 32;
+size_t nb = 10000, nq = 50;
+int k = 10;
+
+std::vector<float> make_data (size_t n, int seed)
+{
+    std::vector<float> x (n * d);
+    float_rand (x.data(), x.size(), seed);
+    return x;
+}
+
+struct TestIndex {
+    IndexFlatL2 quantizer;
+    IndexIVFFlat index;
+
+    explicit TestIndex (DirectMap::Type dm_type):
+        quantizer (d), index (&quantizer, d, nlist)
+    {
+        std::vector<float> xb = make_data (nb, 1);
+        index.train (nb, xb.data());
+        index.set_direct_map_type (dm_type);
+        std::vector<idx_t> ids (nb);
+        for (size_t i = 0; i < nb; i++) {
+            ids[i] = i * 7;
+        }
+        index.add_with_ids (nb, xb.data(), ids.data());
+        index.nprobe = 8;
+    }
+};
+
+/// the ids to remove, 1 out of 100 vectors
+std::vector<idx_t> to_remove ()
+{
+    std::vector<idx_t> ids;
+    for (size_t i = 0; i < nb; i += 100) {
+        ids.push_back (i * 7);
+    }
+    return ids;
+}
+
+void compare_search (const IndexIVF & index, const IndexIVF & ref)
+{
+    std::vector<float> xq = make_data (nq, 2);
+    std::vector<float> D (nq * k), D_ref (nq * k);
+    std::vector<idx_t> I (nq * k), I_ref (nq * k);
+    index.search (nq, xq.data(), k, D.data(), I.data());
+    ref.search (nq, xq.data(), k, D_ref.data(), I_ref.data());
+    EXPECT_EQ (I, I_ref);
+    for (size_t i = 0; i < nq * k; i++) {
+        EXPECT_NEAR (D[i], D_ref[i], 1e-5);
+    }
+
+    RangeSearchResult res (nq), res_ref (nq);
+    index.range_search (nq, xq.data(), D_ref[k - 1], &res);
+    ref.range_search (nq, xq.data(), D_ref[k - 1], &res_ref);
+    EXPECT_EQ (res.lims[nq], res_ref.lims[nq]);
+    for (size_t i = 0; i < res.lims[nq]; i++) {
+        EXPECT_NE (res.labels[i], -1);
+    }
+}
+
+}  // namespace
+
+
+TEST(IVFTombstones, scan) {
+    std::vector<idx_t> del = to_remove ();
+    IDSelectorBatch sel (del.size(), del.data());
+
+    TestIndex ref (DirectMap::NoMap);
+    EXPECT_EQ (ref.index.remove_ids (sel), del.size());
+
+    TestIndex tb (DirectMap::NoMap);
+    tb.index.lazy_remove = true;
+    EXPECT_EQ (tb.index.remove_ids (sel), del.size());
+    EXPECT_EQ (tb.index.ntotal, ref.index.ntotal);
+    EXPECT_EQ (tb.index.ntombstones, del.size());
+    EXPECT_EQ (tb.index.invlists->compute_ntotal(), nb);
+    compare_search (tb.index, ref.index);
+
+    // the nb of tombstones is recovered when reading the index
+    VectorIOWriter writer;
+    write_index (&tb.index, &writer);
+    VectorIOReader reader;
+    reader.data = writer.data;
+    std::unique_ptr<IndexIVF> index2 (
+        dynamic_cast<IndexIVF*> (read_index (&reader)));
+    EXPECT_EQ (index2->ntombstones, del.size());
+    EXPECT_TRUE (index2->list_ntombstones.empty());
+    compare_search (*index2, ref.index);
+
+    // purge only the lists with many tombstones
+    size_t nr = index2->purge_tombstones (0.01);
+    EXPECT_GT (nr, 0);
+    EXPECT_LT (nr, del.size());
+    EXPECT_EQ (index2->ntombstones, del.size() - nr);
+    EXPECT_EQ (index2->list_ntombstones.size(), nlist);
+    compare_search (*index2, ref.index);
+
+    EXPECT_EQ (index2->purge_tombstones (), del.size() - nr);
+    EXPECT_EQ (index2->ntombstones, 0);
+    EXPECT_EQ (index2->invlists->compute_ntotal(), ref.index.ntotal);
+    compare_search (*index2, ref.index);
+}
+
+TEST(IVFTombstones, direct_map) {
+    std::vector<idx_t> del = to_remove ();
+    IDSelectorArray sel (del.size(), del.data());
+
+    for (DirectMap::Type type : {DirectMap::Hashtable, DirectMap::Compact}) {
+        TestIndex ref (type);
+        EXPECT_EQ (ref.index.remove_ids (sel), del.size());
+
+        TestIndex tb (type);
+        tb.index.lazy_remove = true;
+        EXPECT_EQ (tb.index.remove_ids (sel), del.size());
+        // already removed
+        EXPECT_EQ (tb.index.remove_ids (sel), 0);
+        compare_search (tb.index, ref.index);
+
+        std::vector<float> recons (d), recons_ref (d);
+        EXPECT_THROW (tb.index.reconstruct (del[0], recons.data()),
+                      FaissException);
+
+        // the moved entries are updated in the direct map
+        tb.index.purge_tombstones ();
+        EXPECT_EQ (tb.index.ntombstones, 0);
+        compare_search (tb.index, ref.index);
+        for (size_t i = 1; i < nb; i += 37) {
+            if (i % 100 == 0) {
+                continue;
+            }
+            tb.index.reconstruct (i * 7, recons.data());
+            ref.index.reconstruct (i * 7, recons_ref.data());
+            EXPECT_EQ (recons, recons_ref);
+        }
+    }
+}
@@ -0,0 +1,139 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVFPQ.h>
+#include <faiss/utils/random.h>
+
+namespace {
+
+typedef faiss::Index::idx_t idx_t;
+
+int d = 32;
+size_t nb = 5000;
+size_t nq = 200;
+int k = 10;
+
+struct IVFPQFixture {
+    std::vector<float> xb, xq;
+    faiss::IndexFlatL2 quantizer;
+    faiss::IndexIVFPQ index;
+
+    IVFPQFixture ():
+        xb (nb * d), xq (nq * d),
+        quantizer (d),
+        index (&quantizer, d, 64, 8, 4)
+    {
+        faiss::float_rand (xb.data(), xb.size(), 1);
+        faiss::float_rand (xq.data(), xq.size(), 2);
+        index.train (nb, xb.data());
+        index.add (nb, xb.data());
+        index.nprobe = 8;
+    }
+
+    void search (std::vector<float> & D, std::vector<idx_t> & I) {
+        D.resize (nq * k);
+        I.resize (nq * k);
+        index.search (nq, xq.data(), k, D.data(), I.data());
+    }
+};
+
+void compare_results (const std::vector<float> & D_ref,
+                      const std::vector<idx_t> & I_ref,
+                      const std::vector<float> & D,
+                      const std::vector<idx_t> & I,
+                      float rtol, size_t max_miss)
+{
+    size_t nmiss = 0;
+    for (size_t i = 0; i < D.size(); i++) {
+        nmiss += I[i] != I_ref[i];
+        EXPECT_NEAR (D[i], D_ref[i], rtol * std::fabs (D_ref[i]) + 1e-4);
+    }
+    EXPECT_LE (nmiss, max_miss);
+}
+
+}  // namespace
+
+
+TEST(IVFPQPrecomputed, fp16_table) {
+    IVFPQFixture fx;
+    std::vector<float> D_ref, D;
+    std::vector<idx_t> I_ref, I;
+
+    fx.index.use_precomputed_table = 1;
+    fx.index.precompute_table ();
+    fx.search (D_ref, I_ref);
+
+    fx.index.use_precomputed_table = 3;
+    fx.index.precompute_table ();
+    EXPECT_EQ (fx.index.precomputed_table_fp16.size(),
+               64 * fx.index.pq.M * fx.index.pq.ksub);
+    fx.search (D, I);
+
+    // the fp16 rounding of the tables perturbs the distances slightly
+    compare_results (D_ref, I_ref, D, I, 2e-3, nq * k / 20);
+}
+
+TEST(IVFPQPrecomputed, batched_list_tables) {
+    IVFPQFixture fx;
+    std::vector<float> D_ref, D;
+    std::vector<idx_t> I_ref, I;
+
+    fx.index.use_precomputed_table = -1;
+    fx.search (D_ref, I_ref);
+
+    fx.index.batched_list_tables = true;
+    fx.search (D, I);
+
+    compare_results (D_ref, I_ref, D, I, 1e-4, nq * k / 100);
+
+    // with polysemous filtering
+    fx.index.polysemous_ht = 12;
+    fx.index.batched_list_tables = false;
+    fx.search (D_ref, I_ref);
+    fx.index.batched_list_tables = true;
+    fx.search (D, I);
+
+    compare_results (D_ref, I_ref, D, I, 1e-4, nq * k / 100);
+}
+
+TEST(IVFPQPrecomputed, polysemous_filter) {
+    IVFPQFixture fx;
+    std::vector<float> D_ref, D;
+    std::vector<idx_t> I_ref, I;
+
+    fx.search (D_ref, I_ref);
+
+    // 32-bit codes: a threshold of 33 lets all the codes through
+    faiss::indexIVFPQ_stats.reset ();
+    fx.index.polysemous_ht = 33;
+    fx.search (D, I);
+    EXPECT_EQ (I, I_ref);
+    EXPECT_EQ (D, D_ref);
+    size_t nscan = faiss::indexIVFPQ_stats.n_hamming_pass;
+    EXPECT_GT (nscan, 0);
+
+    // a lower threshold filters a part of them
+    faiss::indexIVFPQ_stats.reset ();
+    fx.index.polysemous_ht = 14;
+    fx.search (D, I);
+    size_t npass = faiss::indexIVFPQ_stats.n_hamming_pass;
+    EXPECT_GT (npass, 0);
+    EXPECT_LT (npass, nscan);
+    for (size_t i = 0; i < nq * k; i++) {
+        // the filtered results are a subset of the candidates
+        if (I[i] >= 0) {
+            EXPECT_GE (D[i], D_ref[i / k * k]);
+        }
+    }
+}
@@ -0,0 +1,77 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <omp.h>
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/utils/distances.h>
+#include <faiss/utils/random.h>
+
+namespace {
+
+int d = 24;
+size_t nb = 10000;
+size_t nq = 3;
+
+/// run with the split over database vectors enabled or not
+template<class HA, class F>
+void knn_split (bool split, size_t k, std::vector<float> & D,
+                std::vector<int64_t> & I, F f)
+{
+    int min_ny = faiss::distance_compute_split_database_min_ny;
+    int nt = omp_get_max_threads ();
+    faiss::distance_compute_split_database_min_ny = split ? 0 : nb + 1;
+    omp_set_num_threads (4);
+    D.resize (nq * k);
+    I.resize (nq * k);
+    HA res = {nq, k, I.data(), D.data()};
+    f (&res);
+    omp_set_num_threads (nt);
+    faiss::distance_compute_split_database_min_ny = min_ny;
+}
+
+void test_split (size_t k)
+{
+    std::vector<float> xb (nb * d), xq (nq * d);
+    faiss::float_rand (xb.data(), xb.size(), 123);
+    faiss::float_rand (xq.data(), xq.size(), 456);
+
+    std::vector<float> D_ref, D;
+    std::vector<int64_t> I_ref, I;
+
+    auto l2 = [&] (faiss::float_maxheap_array_t *res) {
+        faiss::knn_L2sqr (xq.data(), xb.data(), d, nq, nb, res);
+    };
+    knn_split<faiss::float_maxheap_array_t> (false, k, D_ref, I_ref, l2);
+    knn_split<faiss::float_maxheap_array_t> (true, k, D, I, l2);
+    EXPECT_EQ (I, I_ref);
+    EXPECT_EQ (D, D_ref);
+
+    auto ip = [&] (faiss::float_minheap_array_t *res) {
+        faiss::knn_inner_product (xq.data(), xb.data(), d, nq, nb, res);
+    };
+    knn_split<faiss::float_minheap_array_t> (false, k, D_ref, I_ref, ip);
+    knn_split<faiss::float_minheap_array_t> (true, k, D, I, ip);
+    EXPECT_EQ (I, I_ref);
+    EXPECT_EQ (D, D_ref);
+}
+
+}  // namespace
+
+
+TEST(KnnSplitDatabase, small_k) {
+    test_split (1);
+    test_split (10);
+}
+
+TEST(KnnSplitDatabase, large_k) {
+    // more results than the reservoir threshold
+    test_split (200);
+}
@@ -0,0 +1,79 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/utils/distances.h>
+#include <faiss/utils/random.h>
+
+namespace {
+
+int d = 20;
+size_t nb = 3000;
+
+/// the k = 1 results must be the first column of the k = 2 results, the
+/// smallest id for ties
+template<class HA, class F>
+void compare_k1_k2 (size_t nq, F f)
+{
+    std::vector<float> D1 (nq), D2 (nq * 2);
+    std::vector<int64_t> I1 (nq), I2 (nq * 2);
+    HA res1 = {nq, 1, I1.data(), D1.data()};
+    f (&res1);
+    HA res2 = {nq, 2, I2.data(), D2.data()};
+    f (&res2);
+    for (size_t i = 0; i < nq; i++) {
+        EXPECT_EQ (D1[i], D2[2 * i]);
+        if (D2[2 * i] == D2[2 * i + 1]) {
+            EXPECT_EQ (I1[i], std::min (I2[2 * i], I2[2 * i + 1]));
+        } else {
+            EXPECT_EQ (I1[i], I2[2 * i]);
+        }
+    }
+}
+
+void test_top1 (size_t nq)
+{
+    std::vector<float> xb (nb * d), xq (nq * d);
+    faiss::float_rand (xb.data(), xb.size(), 123);
+    faiss::float_rand (xq.data(), xq.size(), 456);
+    // duplicates: the first one is returned, as with a heap
+    for (size_t i = 0; i < 10; i++) {
+        std::copy (xb.begin() + i * d, xb.begin() + (i + 1) * d,
+                   xb.begin() + (nb - 1 - i) * d);
+        std::copy (xb.begin() + i * d, xb.begin() + (i + 1) * d,
+                   xq.begin() + i * d);
+    }
+
+    compare_k1_k2<faiss::float_maxheap_array_t> (nq,
+        [&] (faiss::float_maxheap_array_t *res) {
+            faiss::knn_L2sqr (xq.data(), xb.data(), d, nq, nb, res);
+        });
+    compare_k1_k2<faiss::float_minheap_array_t> (nq,
+        [&] (faiss::float_minheap_array_t *res) {
+            faiss::knn_inner_product (xq.data(), xb.data(), d, nq, nb, res);
+        });
+}
+
+}  // namespace
+
+
+TEST(KnnTop1, sequential) {
+    // below distance_compute_blas_threshold
+    test_top1 (15);
+}
+
+TEST(KnnTop1, blas) {
+    // several query blocks, database blocks and a partial last block
+    int bs_y = faiss::distance_compute_blas_database_bs;
+    faiss::distance_compute_blas_database_bs = 1000;
+    test_top1 (1000);
+    faiss::distance_compute_blas_database_bs = bs_y;
+}
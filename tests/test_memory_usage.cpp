@@ -0,0 +1,191 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <memory>
+#include <vector>
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexHNSW.h>
+#include <faiss/IndexIVFPQ.h>
+#include <faiss/IndexPreTransform.h>
+#include <faiss/IndexShards.h>
+#include <faiss/OnDiskInvertedLists.h>
+#include <faiss/index_factory.h>
+#include <faiss/utils/random.h>
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 32;
+size_t nt = 2000;
+size_t nb = 3000;
+
+std::vector<float> make_data (size_t n, int seed)
+{
+    std::vector<float> x (n * d);
+    float_randn (x.data(), x.size(), seed);
+    return x;
+}
+
+void check_consistent (const MemoryUsage & mu)
+{
+    EXPECT_LE (mu.size, mu.capacity + mu.mapped + mu.device) << mu.name;
+    for (const MemoryUsage & c: mu.children) {
+        check_consistent (c);
+    }
+}
+
+} // namespace
+
+
+TEST(MemoryUsage, flat) {
+    std::vector<float> xb = make_data (nb, 1);
+    IndexFlatL2 index (d);
+    index.add (nb, xb.data());
+
+    MemoryUsage mu = index.memory_usage ();
+    EXPECT_EQ (mu.type, "IndexFlatL2");
+    ASSERT_TRUE (mu.find ("xb"));
+    EXPECT_EQ (mu.find ("xb")->size, nb * d * sizeof(float));
+    EXPECT_EQ (mu.total_size (), nb * d * sizeof(float));
+    EXPECT_GE (mu.total_capacity (), mu.total_size ());
+    EXPECT_EQ (mu.total_mapped (), 0);
+    EXPECT_EQ (mu.total_device (), 0);
+}
+
+TEST(MemoryUsage, device) {
+    // the nodes of the GPU indexes
+    MemoryUsage mu = MemoryUsage::object ("gpu::GpuIndexIVFFlat");
+    mu.add ("ids_cpu", 80, 128);
+    MemoryUsage & inv = mu.add (MemoryUsage::object ("gpu::IVFFlat"));
+    inv.add_device ("codes", 1000, 1024);
+    inv.add_device ("ids", 80, 256);
+    check_consistent (mu);
+
+    EXPECT_EQ (mu.total_size (), 1160);
+    EXPECT_EQ (mu.total_capacity (), 128);
+    EXPECT_EQ (mu.total_device (), 1280);
+    EXPECT_EQ (mu.find ("gpu::IVFFlat/codes")->device, 1024);
+    EXPECT_EQ (mu.to_string (),
+               "gpu::GpuIndexIVFFlat: size=1160 capacity=128 device=1280\n"
+               "  ids_cpu: size=80 capacity=128\n"
+               "  gpu::IVFFlat: size=1080 capacity=0 device=1280\n"
+               "    codes: size=1000 capacity=0 device=1024\n"
+               "    ids: size=80 capacity=0 device=256\n");
+}
+
+TEST(MemoryUsage, IVFPQ) {
+    std::vector<float> xt = make_data (nt, 1);
+    std::vector<float> xb = make_data (nb, 2);
+    std::unique_ptr<Index> index (index_factory (d, "IVF16,PQ8x4"));
+    auto *ivf = dynamic_cast<IndexIVFPQ*> (index.get());
+    ivf->train (nt, xt.data());
+    ivf->add (nb, xb.data());
+    ivf->make_direct_map ();
+
+    MemoryUsage mu = index->memory_usage ();
+    check_consistent (mu);
+    EXPECT_EQ (mu.type, "IndexIVFPQ");
+
+    const MemoryUsage *quantizer = mu.find ("quantizer");
+    ASSERT_TRUE (quantizer);
+    EXPECT_EQ (quantizer->type, "IndexFlatL2");
+    EXPECT_EQ (quantizer->total_size (), 16 * d * sizeof(float));
+
+    const MemoryUsage *invlists = mu.find ("invlists");
+    ASSERT_TRUE (invlists);
+    EXPECT_EQ (invlists->type, "ArrayInvertedLists");
+    // the codes and the per-list vectors
+    EXPECT_EQ (mu.find ("invlists/codes")->size,
+               nb * ivf->code_size + 16 * sizeof(std::vector<uint8_t>));
+    EXPECT_EQ (mu.find ("invlists/ids")->size,
+               nb * sizeof(idx_t) + 16 * sizeof(std::vector<idx_t>));
+
+    ASSERT_TRUE (mu.find ("pq/centroids"));
+    EXPECT_EQ (mu.find ("pq/centroids")->size,
+               ivf->pq.centroids.size() * sizeof(float));
+    ASSERT_TRUE (mu.find ("direct_map/array"));
+    EXPECT_EQ (mu.find ("direct_map/array")->size, nb * sizeof(idx_t));
+
+    // the string has one line per node
+    std::string s = mu.to_string ();
+    EXPECT_NE (s.find ("invlists (ArrayInvertedLists)"), std::string::npos);
+}
+
+TEST(MemoryUsage, ondisk) {
+    std::vector<float> xt = make_data (nt, 1);
+    std::vector<float> xb = make_data (nb, 2);
+    std::unique_ptr<Index> index (index_factory (d, "IVF16,Flat"));
+    auto *ivf = dynamic_cast<IndexIVF*> (index.get());
+    ivf->train (nt, xt.data());
+
+    char fname[] = "/tmp/faiss_test_memory_usage_XXXXXX";
+    int fd = mkstemp (fname);
+    ASSERT_GE (fd, 0);
+    close (fd);
+    auto *il = new OnDiskInvertedLists (ivf->nlist, ivf->code_size, fname);
+    ivf->replace_invlists (il, true);
+    ivf->add (nb, xb.data());
+
+    MemoryUsage mu = index->memory_usage ();
+    check_consistent (mu);
+    const MemoryUsage *data = mu.find ("invlists/data");
+    ASSERT_TRUE (data);
+    EXPECT_EQ (data->size, nb * (ivf->code_size + sizeof(idx_t)));
+    EXPECT_GE (data->mapped, data->size);
+    EXPECT_EQ (mu.total_mapped (), il->map_size);
+
+    index.reset ();
+    unlink (fname);
+}
+
+TEST(MemoryUsage, HNSW_pretransform) {
+    std::vector<float> xt = make_data (nt, 1);
+    std::vector<float> xb = make_data (nb, 2);
+    std::unique_ptr<Index> index (index_factory (d, "PCA16,HNSW16"));
+    index->train (nt, xt.data());
+    index->add (nb, xb.data());
+
+    MemoryUsage mu = index->memory_usage ();
+    check_consistent (mu);
+    ASSERT_TRUE (mu.find ("chain.0/A"));
+    EXPECT_EQ (mu.find ("chain.0")->type, "PCAMatrix");
+    EXPECT_EQ (mu.find ("chain.0/A")->size, 16 * d * sizeof(float));
+
+    auto *hnsw = dynamic_cast<IndexHNSW*> (
+          dynamic_cast<IndexPreTransform*> (index.get())->index);
+    ASSERT_TRUE (mu.find ("index/hnsw/neighbors"));
+    EXPECT_EQ (mu.find ("index/hnsw/neighbors")->size,
+               hnsw->hnsw.neighbors.size() * sizeof(HNSW::storage_idx_t));
+    EXPECT_EQ (mu.find ("index/storage/xb")->size, nb * 16 * sizeof(float));
+}
+
+TEST(MemoryUsage, shards) {
+    std::vector<float> xb = make_data (nb, 2);
+    IndexShards shards (d, false, true);
+    IndexFlatL2 s0 (d), s1 (d);
+    shards.add_shard (&s0);
+    shards.add_shard (&s1);
+    shards.add (nb, xb.data());
+
+    MemoryUsage mu = shards.memory_usage ();
+    ASSERT_EQ (mu.children.size(), 2);
+    EXPECT_EQ (mu.children[0].name, "index.0");
+    EXPECT_EQ (mu.total_size (), nb * d * sizeof(float));
+    EXPECT_EQ (mu.children[0].total_size () + mu.children[1].total_size (),
+               mu.total_size ());
+}
@@ -8,6 +8,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <random>
+#include <algorithm>
 
 #include <gtest/gtest.h>
 
@@ -18,6 +19,8 @@
 #include <faiss/IndexPreTransform.h>
 #include <faiss/OnDiskInvertedLists.h>
 #include <faiss/IVFlib.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/FaissException.h>
 
 
 namespace {
@@ -94,7 +97,7 @@ CommonData cd;
 /// perform a search on shards, then merge and search again and
 /// compare results.
 int compare_merged (faiss::IndexShards *index_shards, bool shift_ids,
-                    bool standard_merge = true)
+                    bool standard_merge = true, bool nway = false)
 {
 
     std::vector<idx_t> refI(k * nq);
@@ -106,7 +109,17 @@ int compare_merged (faiss::IndexShards *index_shards, bool shift_ids,
     std::vector<idx_t> newI(k * nq);
     std::vector<float> newD(k * nq);
 
-    if (standard_merge) {
+    if (nway) {
+        std::vector<faiss::Index *> shards;
+        for (int i = 1; i < nindex; i++) {
+            shards.push_back (index_shards->at(i));
+        }
+        faiss::ivflib::merge_shards_into(
+               index_shards->at(0), shards.size(), shards.data(),
+               shift_ids);
+
+        index_shards->syncWithSubIndexes();
+    } else if (standard_merge) {
 
         for (int i = 1; i < nindex; i++) {
             faiss::ivflib::merge_into(
@@ -258,3 +271,157 @@ TEST(MERGE, merge_flat_ondisk_2) {
     int ndiff = compare_merged(&index_shards, false, false);
     EXPECT_GE(0, ndiff);
 }
+
+// N-way merge
+TEST(MERGE, merge_shards_no_ids) {
+    faiss::IndexShards index_shards(d);
+    index_shards.own_fields = true;
+    for (int i = 0; i < nindex; i++) {
+        index_shards.add_shard (
+            new faiss::IndexIVFFlat (&cd.quantizer, d, nlist));
+    }
+    index_shards.add(nb, cd.database.data());
+    size_t prev_ntotal = index_shards.ntotal;
+    int ndiff = compare_merged(&index_shards, true, true, true);
+    EXPECT_EQ (prev_ntotal, index_shards.ntotal);
+    EXPECT_EQ (prev_ntotal, index_shards.at(0)->ntotal);
+    EXPECT_EQ(0, ndiff);
+}
+
+TEST(MERGE, merge_shards_ondisk) {
+    faiss::IndexShards index_shards(d, false, false);
+    index_shards.own_fields = true;
+    Tempfilename filename;
+
+    for (int i = 0; i < nindex; i++) {
+        auto ivf = new faiss::IndexIVFFlat (&cd.quantizer, d, nlist);
+        if (i == 0) {
+            auto il = new faiss::OnDiskInvertedLists (
+                ivf->nlist, ivf->code_size,
+                filename.c_str());
+            ivf->replace_invlists(il, true);
+        }
+        index_shards.add_shard (ivf);
+    }
+    index_shards.add_with_ids(nb, cd.database.data(), cd.ids.data());
+    int ndiff = compare_merged(&index_shards, false, true, true);
+    EXPECT_EQ(ndiff, 0);
+}
+
+namespace {
+
+/// split an index and compare the search results on the shards
+void test_split (bool by_list_range)
+{
+    faiss::IndexIVFFlat index (&cd.quantizer, d, nlist);
+    index.nprobe = 4;
+    index.add(nb, cd.database.data());
+
+    std::vector<idx_t> refI(k * nq);
+    std::vector<float> refD(k * nq);
+    index.search(nq, cd.queries.data(), k, refD.data(), refI.data());
+
+    faiss::IndexShards index_shards(d, false, false);
+    index_shards.own_fields = true;
+    for (int i = 0; i < nindex; i++) {
+        auto ivf = new faiss::IndexIVFFlat (&cd.quantizer, d, nlist);
+        ivf->nprobe = 4;
+        index_shards.add_shard (ivf);
+    }
+    std::vector<faiss::Index *> shards;
+    for (int i = 0; i < nindex; i++) {
+        shards.push_back (index_shards.at(i));
+    }
+
+    if (by_list_range) {
+        faiss::ivflib::split_by_list_range (&index, nindex, shards.data());
+    } else {
+        faiss::ivflib::split_by_id_range (&index, nindex, shards.data());
+    }
+    index_shards.syncWithSubIndexes();
+    EXPECT_EQ (index.ntotal, 0);
+    EXPECT_EQ (index_shards.ntotal, nb);
+
+    for (int i = 0; i < nindex; i++) {
+        auto ivf = dynamic_cast<faiss::IndexIVF*>(shards[i]);
+        for (int j = 0; j < nlist; j++) {
+            faiss::InvertedLists::ScopedIds ids (ivf->invlists, j);
+            for (size_t o = 0; o < ivf->invlists->list_size(j); o++) {
+                if (by_list_range) {
+                    EXPECT_EQ (j * nindex / nlist, i);
+                } else {
+                    EXPECT_EQ (ids[o] * nindex / nb, i);
+                }
+            }
+        }
+    }
+
+    std::vector<idx_t> newI(k * nq);
+    std::vector<float> newD(k * nq);
+    index_shards.search(nq, cd.queries.data(), k, newD.data(), newI.data());
+    EXPECT_EQ (refI, newI);
+    EXPECT_EQ (refD, newD);
+}
+
+}  // namespace
+
+TEST(MERGE, split_by_list_range) {
+    test_split (true);
+}
+
+TEST(MERGE, split_by_id_range) {
+    test_split (false);
+}
+
+TEST(MERGE, tombstones) {
+    std::vector<faiss::IndexIVFFlat *> ivfs;
+    faiss::IndexShards index_shards(d, false, false);
+    index_shards.own_fields = true;
+    for (int i = 0; i < nindex; i++) {
+        auto ivf = new faiss::IndexIVFFlat (&cd.quantizer, d, nlist);
+        ivf->nprobe = 4;
+        ivf->lazy_remove = true;
+        ivfs.push_back (ivf);
+        index_shards.add_shard (ivf);
+    }
+    index_shards.add_with_ids(nb, cd.database.data(), cd.ids.data());
+
+    // lazily remove every other vector of the last shard
+    std::vector<idx_t> del;
+    faiss::InvertedLists *il = ivfs.back()->invlists;
+    for (int j = 0; j < nlist; j++) {
+        faiss::InvertedLists::ScopedIds ids (il, j);
+        for (size_t o = 0; o < il->list_size(j); o += 2) {
+            del.push_back (ids[o]);
+        }
+    }
+    faiss::IDSelectorArray sel (del.size(), del.data());
+    EXPECT_EQ (ivfs.back()->remove_ids (sel), del.size());
+    EXPECT_GT (ivfs.back()->ntombstones, 0);
+
+    std::vector<faiss::Index *> shards (ivfs.begin() + 1, ivfs.end());
+    EXPECT_THROW (
+        faiss::ivflib::merge_shards_into (
+            ivfs[0], shards.size(), shards.data(), false),
+        faiss::FaissException);
+
+    faiss::IndexIVFFlat other (&cd.quantizer, d, nlist);
+    faiss::Index *other_ptr = &other;
+    EXPECT_THROW (
+        faiss::ivflib::split_by_list_range (ivfs.back(), 1, &other_ptr),
+        faiss::FaissException);
+    EXPECT_EQ (other.ntotal, 0);
+
+    // once purged, the removed vectors are not merged back
+    ivfs.back()->purge_tombstones ();
+    int ndiff = compare_merged(&index_shards, false, true, true);
+    EXPECT_EQ(ndiff, 0);
+    EXPECT_EQ (ivfs[0]->ntotal, nb - del.size());
+    for (int j = 0; j < nlist; j++) {
+        faiss::InvertedLists::ScopedIds ids (ivfs[0]->invlists, j);
+        for (size_t o = 0; o < ivfs[0]->invlists->list_size(j); o++) {
+            EXPECT_TRUE (std::find (del.begin(), del.end(), ids[o]) ==
+                         del.end());
+        }
+    }
+}
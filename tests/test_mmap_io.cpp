@@ -0,0 +1,179 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#include <memory>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexHNSW.h>
+#include <faiss/IndexNSG.h>
+#include <faiss/IndexPQ.h>
+#include <faiss/IndexScalarQuantizer.h>
+#include <faiss/index_factory.h>
+#include <faiss/index_io.h>
+
+
+namespace {
+
+typedef faiss::Index::idx_t idx_t;
+
+struct Tempfilename {
+
+    static pthread_mutex_t mutex;
+
+    std::string filename;
+
+    Tempfilename (const char *prefix = nullptr) {
+        pthread_mutex_lock (&mutex);
+        char *cfname = tempnam (nullptr, prefix);
+        filename = cfname;
+        free(cfname);
+        pthread_mutex_unlock (&mutex);
+    }
+
+    ~Tempfilename () {
+        if (access (filename.c_str(), F_OK) == 0) {
+            unlink (filename.c_str());
+        }
+    }
+
+    const char *c_str() {
+        return filename.c_str();
+    }
+
+};
+
+pthread_mutex_t Tempfilename::mutex = PTHREAD_MUTEX_INITIALIZER;
+
+int d = 32;
+size_t nb = 2000;
+size_t nq = 20;
+int k = 5;
+
+std::vector<float> make_data (size_t n, int seed)
+{
+    std::vector<float> x (n * d);
+    std::mt19937 rng (seed);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < x.size(); i++) {
+        x[i] = distrib (rng);
+    }
+    return x;
+}
+
+void search (const faiss::Index & index, const std::vector<float> & xq,
+             std::vector<float> & D, std::vector<idx_t> & I)
+{
+    D.resize (nq * k);
+    I.resize (nq * k);
+    index.search (nq, xq.data(), k, D.data(), I.data());
+}
+
+/// write the index, read it back mmapped and compare search results
+std::unique_ptr<faiss::Index> write_and_mmap (
+        const char *key, Tempfilename & tmp)
+{
+    std::vector<float> xb = make_data (nb, 1);
+    std::vector<float> xq = make_data (nq, 2);
+
+    std::unique_ptr<faiss::Index> index (faiss::index_factory (d, key));
+    index->train (nb, xb.data());
+    index->add (nb, xb.data());
+    faiss::write_index (index.get(), tmp.c_str());
+
+    std::unique_ptr<faiss::Index> index2 (
+          faiss::read_index (tmp.c_str(), faiss::IO_FLAG_MMAP));
+
+    std::vector<float> D_ref, D;
+    std::vector<idx_t> I_ref, I;
+    search (*index, xq, D_ref, I_ref);
+    search (*index2, xq, D, I);
+    EXPECT_EQ (I, I_ref) << key;
+    EXPECT_EQ (D, D_ref) << key;
+    return index2;
+}
+
+}  // namespace
+
+
+TEST(MMAP, flat) {
+    Tempfilename tmp;
+    std::unique_ptr<faiss::Index> index = write_and_mmap ("Flat", tmp);
+    faiss::IndexFlat *index_flat = dynamic_cast<faiss::IndexFlat*> (index.get());
+    ASSERT_TRUE (index_flat);
+    EXPECT_FALSE (index_flat->xb.is_owned);
+
+    // write to the copy-on-write mapping
+    std::vector<float> x = make_data (1, 3);
+    std::copy (x.begin(), x.end(), index_flat->xb.data());
+    std::unique_ptr<faiss::Index> index2 (faiss::read_index (tmp.c_str()));
+    std::vector<float> y (d);
+    index2->reconstruct (0, y.data());
+    EXPECT_NE (x, y);
+
+    // adding makes the data owned
+    index->add (1, x.data());
+    EXPECT_TRUE (index_flat->xb.is_owned);
+    EXPECT_EQ (index->ntotal, nb + 1);
+    index->reconstruct (nb, y.data());
+    EXPECT_EQ (x, y);
+    index->reconstruct (0, y.data());
+    EXPECT_EQ (x, y);
+}
+
+TEST(MMAP, codes_and_graphs) {
+    {
+        Tempfilename tmp;
+        std::unique_ptr<faiss::Index> index = write_and_mmap ("PQ8np", tmp);
+        EXPECT_FALSE (dynamic_cast<faiss::IndexPQ*>
+                      (index.get())->codes.is_owned);
+    }
+    {
+        Tempfilename tmp;
+        std::unique_ptr<faiss::Index> index = write_and_mmap ("SQ8", tmp);
+        EXPECT_FALSE (dynamic_cast<faiss::IndexScalarQuantizer*>
+                      (index.get())->codes.is_owned);
+    }
+    {
+        Tempfilename tmp;
+        std::unique_ptr<faiss::Index> index = write_and_mmap ("HNSW16", tmp);
+        faiss::IndexHNSW *index_hnsw =
+            dynamic_cast<faiss::IndexHNSW*> (index.get());
+        EXPECT_FALSE (index_hnsw->hnsw.neighbors.is_owned);
+        EXPECT_FALSE (dynamic_cast<faiss::IndexFlat*>
+                      (index_hnsw->storage)->xb.is_owned);
+
+        // the index remains usable after the file is removed
+        unlink (tmp.c_str());
+        std::vector<float> xq = make_data (nq, 2);
+        std::vector<float> D;
+        std::vector<idx_t> I;
+        search (*index, xq, D, I);
+        EXPECT_GE (I[0], 0);
+    }
+    {
+        Tempfilename tmp;
+        std::unique_ptr<faiss::Index> index = write_and_mmap ("NSG16", tmp);
+        EXPECT_FALSE (dynamic_cast<faiss::IndexNSG*>
+                      (index.get())->nsg.final_graph.is_owned);
+    }
+}
+
+TEST(MMAP, ivf) {
+    // the inverted lists are mapped as OnDiskInvertedLists, the coarse
+    // quantizer as a flat index
+    Tempfilename tmp;
+    write_and_mmap ("IVF16,Flat", tmp);
+}
@@ -0,0 +1,76 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexPQ.h>
+#include <faiss/utils/random.h>
+
+namespace {
+
+typedef faiss::Index::idx_t idx_t;
+
+/// compare the search results with all the combinations of centroids
+void test_mi (int M, int nbits, int k)
+{
+    int d = 4 * M;
+    size_t nq = 20;
+    faiss::MultiIndexQuantizer q (d, M, nbits);
+    faiss::float_randn (q.pq.centroids.data(), q.pq.centroids.size(), 1);
+    q.is_trained = true;
+    q.ntotal = (idx_t)1 << (M * nbits);
+
+    std::vector<float> x (nq * d);
+    faiss::float_randn (x.data(), x.size(), 2);
+    std::vector<float> D (nq * k);
+    std::vector<idx_t> I (nq * k);
+    q.search (nq, x.data(), k, D.data(), I.data());
+
+    size_t ksub = q.pq.ksub;
+    std::vector<float> tab (nq * M * ksub);
+    q.pq.compute_distance_tables (nq, x.data(), tab.data());
+
+    for (size_t i = 0; i < nq; i++) {
+        const float *t = tab.data() + i * M * ksub;
+        auto sum_of = [&] (idx_t label) {
+            float s = 0;
+            for (int m = 0; m < M; m++) {
+                s += t[m * ksub + ((label >> (m * nbits)) & (ksub - 1))];
+            }
+            return s;
+        };
+        std::vector<float> all (q.ntotal);
+        for (idx_t l = 0; l < q.ntotal; l++) {
+            all[l] = sum_of (l);
+        }
+        std::sort (all.begin(), all.end());
+        std::vector<idx_t> labels (I.begin() + i * k, I.begin() + (i + 1) * k);
+        std::sort (labels.begin(), labels.end());
+        EXPECT_TRUE (std::unique (labels.begin(), labels.end()) ==
+                     labels.end());
+        for (int j = 0; j < k; j++) {
+            EXPECT_NEAR (D[i * k + j], all[j], 1e-5);
+            EXPECT_NEAR (D[i * k + j], sum_of (I[i * k + j]), 1e-5);
+        }
+    }
+}
+
+}  // namespace
+
+
+TEST(MultiIndexQuantizer, M2) {
+    test_mi (2, 6, 1);
+    test_mi (2, 6, 300);
+    test_mi (2, 6, 4096);
+}
+
+TEST(MultiIndexQuantizer, M3) {
+    test_mi (3, 4, 500);
+}
@@ -0,0 +1,189 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexNSG.h>
+#include <faiss/clone_index.h>
+#include <faiss/index_factory.h>
+#include <faiss/index_io.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/io.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 16;
+size_t nb = 5000;
+size_t nq = 100;
+idx_t k = 10;
+
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector <float> x (n * d);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < n * d; i++) {
+        x[i] = distrib(rng);
+    }
+    return x;
+}
+
+std::vector<idx_t> ground_truth(const std::vector<float>& xb,
+                                const std::vector<float>& xq)
+{
+    IndexFlatL2 ref(d);
+    ref.add(nb, xb.data());
+    std::vector<float> D(nq);
+    std::vector<idx_t> I(nq);
+    ref.search(nq, xq.data(), 1, D.data(), I.data());
+    return I;
+}
+
+/// fraction of the true nearest neighbors found in the top-k
+double recall_at_k(const std::vector<idx_t>& gt, const std::vector<idx_t>& I)
+{
+    size_t n_ok = 0;
+    for (size_t q = 0; q < nq; q++) {
+        for (idx_t j = 0; j < k; j++) {
+            if (I[q * k + j] == gt[q]) {
+                n_ok++;
+                break;
+            }
+        }
+    }
+    return n_ok / double(nq);
+}
+
+void search(const Index& index, const std::vector<float>& xq,
+            std::vector<float>& D, std::vector<idx_t>& I,
+            const SearchParameters *params = nullptr)
+{
+    D.resize(nq * k);
+    I.resize(nq * k);
+    index.search(nq, xq.data(), k, D.data(), I.data(), params);
+}
+
+} // namespace
+
+
+TEST(NSG, flat_recall_and_degree) {
+    std::vector<float> xb = make_data(nb, 1);
+    std::vector<float> xq = make_data(nq, 2);
+    std::vector<idx_t> gt = ground_truth(xb, xq);
+
+    IndexNSGFlat index(d, 16);
+    index.add(nb, xb.data());
+
+    // fixed out-degree
+    EXPECT_EQ(index.nsg.final_graph.size(), nb * 16);
+    size_t nempty = 0;
+    for (size_t i = 0; i < nb; i++) {
+        int nn = index.nsg.nb_neighbors(i);
+        EXPECT_LE(nn, 16);
+        nempty += nn == 0;
+    }
+    EXPECT_EQ(nempty, 0);
+
+    std::vector<float> D;
+    std::vector<idx_t> I;
+    index.nsg.search_L = 32;
+    search(index, xq, D, I);
+    EXPECT_GE(recall_at_k(gt, I), 0.95);
+
+    // results are sorted
+    for (size_t q = 0; q < nq; q++) {
+        for (idx_t j = 1; j < k; j++) {
+            EXPECT_LE(D[q * k + j - 1], D[q * k + j]);
+        }
+    }
+
+    // incremental adds are not supported
+    EXPECT_THROW(index.add(nb, xb.data()), FaissException);
+}
+
+TEST(NSG, search_params) {
+    std::vector<float> xb = make_data(nb, 1);
+    std::vector<float> xq = make_data(nq, 2);
+
+    IndexNSGFlat index(d, 16);
+    index.add(nb, xb.data());
+
+    std::vector<float> D_ref, D;
+    std::vector<idx_t> I_ref, I;
+    index.nsg.search_L = 48;
+    search(index, xq, D_ref, I_ref);
+
+    index.nsg.search_L = 16;
+    SearchParametersNSG params;
+    params.search_L = 48;
+    search(index, xq, D, I, &params);
+    EXPECT_EQ(I, I_ref);
+    EXPECT_EQ(D, D_ref);
+
+    // only even ids are returned
+    std::vector<idx_t> even;
+    for (idx_t i = 0; i < nb; i += 2) {
+        even.push_back(i);
+    }
+    IDSelectorBatch sel(even.size(), even.data());
+    params.sel = &sel;
+    search(index, xq, D, I, &params);
+    for (idx_t id: I) {
+        EXPECT_TRUE(id == -1 || id % 2 == 0);
+    }
+}
+
+TEST(NSG, factory_io_clone) {
+    std::vector<float> xb = make_data(nb, 1);
+    std::vector<float> xq = make_data(nq, 2);
+    std::vector<idx_t> gt = ground_truth(xb, xq);
+
+    const char *keys[] = {"NSG16", "NSG16,Flat", "NSG16,PQ8np", "NSG16,SQ8"};
+    double min_recall[] = {0.9, 0.9, 0.4, 0.8};
+
+    for (int i = 0; i < 4; i++) {
+        std::unique_ptr<Index> index(index_factory(d, keys[i]));
+        ASSERT_TRUE(dynamic_cast<IndexNSG*>(index.get()));
+        index->train(nb, xb.data());
+        index->add(nb, xb.data());
+
+        std::vector<float> D_ref;
+        std::vector<idx_t> I_ref;
+        search(*index, xq, D_ref, I_ref);
+        EXPECT_GE(recall_at_k(gt, I_ref), min_recall[i]) << keys[i];
+
+        VectorIOWriter wr;
+        write_index(index.get(), &wr);
+        VectorIOReader rd;
+        rd.data = wr.data;
+        std::unique_ptr<Index> index2(read_index(&rd));
+
+        std::vector<float> D;
+        std::vector<idx_t> I;
+        search(*index2, xq, D, I);
+        EXPECT_EQ(I, I_ref);
+        EXPECT_EQ(D, D_ref);
+
+        std::unique_ptr<Index> index3(clone_index(index.get()));
+        search(*index3, xq, D, I);
+        EXPECT_EQ(I, I_ref);
+        EXPECT_EQ(D, D_ref);
+    }
+}
@@ -7,20 +7,25 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <random>
 
 #include <omp.h>
 
+#include <algorithm>
+#include <memory>
 #include <unordered_map>
 #include <pthread.h>
 
 #include <gtest/gtest.h>
 
 #include <faiss/OnDiskInvertedLists.h>
+#include <faiss/IVFlib.h>
 #include <faiss/IndexIVFFlat.h>
 #include <faiss/IndexFlat.h>
 #include <faiss/utils/random.h>
 #include <faiss/index_io.h>
+#include <faiss/impl/io.h>
 
 
 namespace {
@@ -223,3 +228,438 @@ TEST(ONDISK, make_invlists_threaded) {
     EXPECT_EQ (ntot, nadd);
 
 };
+
+
+TEST(ONDISK, prefetch_readahead) {
+    int d = 8;
+    int nlist = 30, nq = 200, nb = 1500, k = 10;
+    faiss::IndexFlatL2 quantizer(d);
+    {
+        std::vector<float> x(d * nlist);
+        faiss::float_rand(x.data(), d * nlist, 12345);
+        quantizer.add(nlist, x.data());
+    }
+    std::vector<float> xb(d * nb);
+    faiss::float_rand(xb.data(), d * nb, 23456);
+    std::vector<float> xq(d * nq);
+    faiss::float_rand(xq.data(), d * nq, 34567);
+
+    faiss::IndexIVFFlat index(&quantizer, d, nlist);
+    index.nprobe = 4;
+    index.add(nb, xb.data());
+
+    std::vector<float> ref_D (nq * k);
+    std::vector<faiss::Index::idx_t> ref_I (nq * k);
+    index.search (nq, xq.data(), k, ref_D.data(), ref_I.data());
+
+    Tempfilename filename;
+    faiss::OnDiskInvertedLists ivf (
+            index.nlist, index.code_size, filename.c_str());
+    ivf.merge_from_1 (index.invlists);
+    index.replace_invlists (&ivf);
+
+    ivf.prefetch_mode = faiss::OnDiskInvertedLists::PREFETCH_READAHEAD;
+
+    std::vector<float> new_D (nq * k);
+    std::vector<faiss::Index::idx_t> new_I (nq * k);
+    index.search (nq, xq.data(), k, new_D.data(), new_I.data());
+
+    EXPECT_EQ (ref_D, new_D);
+    EXPECT_EQ (ref_I, new_I);
+
+    // all the lists are visited, they are merged in a single range
+    EXPECT_GE (ivf.prefetch_nbytes, nb * (index.code_size + 8));
+    EXPECT_LE (ivf.prefetch_nbytes, ivf.totsize);
+
+    // only the first list is requested
+    ivf.prefetch_nbytes = 0;
+    ivf.prefetch_max_bytes = 1;
+    ivf.prefetch_merge_gap = 0;
+    std::vector<faiss::Index::idx_t> list_nos = {3, 5, 7, -1};
+    ivf.prefetch_lists (list_nos.data(), list_nos.size());
+    EXPECT_GT (ivf.prefetch_nbytes, 0);
+    EXPECT_LT (ivf.prefetch_nbytes, ivf.totsize);
+};
+
+
+namespace {
+
+void test_compressed_ids (bool large_ids) {
+    int d = 8;
+    int nlist = 30, nq = 200, nb = 5000, k = 10;
+    faiss::IndexFlatL2 quantizer(d);
+    {
+        std::vector<float> x(d * nlist);
+        faiss::float_rand(x.data(), d * nlist, 12345);
+        quantizer.add(nlist, x.data());
+    }
+    std::vector<float> xb(d * nb);
+    faiss::float_rand(xb.data(), d * nb, 23456);
+    std::vector<float> xq(d * nq);
+    faiss::float_rand(xq.data(), d * nq, 34567);
+
+    // shuffled ids
+    std::vector<faiss::Index::idx_t> ids(nb);
+    std::mt19937 rng(123);
+    for (int i = 0; i < nb; i++) {
+        ids[i] = large_ids ? (faiss::Index::idx_t)(rng() >> 1) << 31 | rng()
+                           : i;
+    }
+    std::shuffle(ids.begin(), ids.end(), rng);
+
+    faiss::IndexIVFFlat index(&quantizer, d, nlist);
+    index.nprobe = 4;
+    index.add_with_ids(nb, xb.data(), ids.data());
+
+    std::vector<float> ref_D (nq * k);
+    std::vector<faiss::Index::idx_t> ref_I (nq * k);
+    index.search (nq, xq.data(), k, ref_D.data(), ref_I.data());
+
+    Tempfilename filename, filename2;
+    faiss::OnDiskCompressedInvertedLists *il =
+        new faiss::OnDiskCompressedInvertedLists (
+            index.nlist, index.code_size, filename.c_str());
+    EXPECT_EQ (il->merge_from_1 (index.invlists), nb);
+
+    size_t ids_size = 0;
+    for (int i = 0; i < nlist; i++) {
+        ids_size += il->ids_size (i);
+        faiss::InvertedLists::ScopedIds sids (il, i);
+        for (size_t j = 0; j < il->list_size (i); j++) {
+            if (j > 0) {
+                EXPECT_LT (sids[j - 1], sids[j]);
+            }
+            EXPECT_EQ (il->get_single_id (i, j), sids[j]);
+        }
+    }
+    if (!large_ids) {
+        EXPECT_LT (ids_size, nb * sizeof (faiss::Index::idx_t) / 2);
+    }
+
+    index.replace_invlists (il, true);
+
+    std::vector<float> new_D (nq * k);
+    std::vector<faiss::Index::idx_t> new_I (nq * k);
+    index.search (nq, xq.data(), k, new_D.data(), new_I.data());
+    EXPECT_EQ (ref_D, new_D);
+    EXPECT_EQ (ref_I, new_I);
+
+    write_index (&index, filename2.c_str());
+    std::unique_ptr<faiss::Index> index2 (
+            faiss::read_index (filename2.c_str()));
+    index2->search (nq, xq.data(), k, new_D.data(), new_I.data());
+    EXPECT_EQ (ref_D, new_D);
+    EXPECT_EQ (ref_I, new_I);
+}
+
+}  // namespace
+
+TEST(ONDISK, compressed_ids) {
+    test_compressed_ids (false);
+}
+
+TEST(ONDISK, compressed_ids_large) {
+    test_compressed_ids (true);
+}
+
+TEST(ONDISK, builder) {
+    int d = 8;
+    int nlist = 30, nq = 200, nb = 5000, k = 10;
+    faiss::IndexFlatL2 quantizer(d);
+    {
+        std::vector<float> x(d * nlist);
+        faiss::float_rand(x.data(), d * nlist, 12345);
+        quantizer.add(nlist, x.data());
+    }
+    std::vector<float> xb(d * nb);
+    faiss::float_rand(xb.data(), d * nb, 23456);
+    std::vector<float> xq(d * nq);
+    faiss::float_rand(xq.data(), d * nq, 34567);
+
+    faiss::IndexIVFFlat ref_index(&quantizer, d, nlist);
+    ref_index.nprobe = 4;
+    ref_index.add(nb, xb.data());
+
+    std::vector<float> ref_D (nq * k);
+    std::vector<faiss::Index::idx_t> ref_I (nq * k);
+    ref_index.search (nq, xq.data(), k, ref_D.data(), ref_I.data());
+
+    Tempfilename filename;
+    faiss::IndexIVFFlat index(&quantizer, d, nlist);
+    index.nprobe = 4;
+    {
+        faiss::OnDiskInvertedListsBuilder builder (&index, filename.c_str());
+        // small batches and runs so that the entries are spread over
+        // several run files
+        builder.batch_size = 300;
+        builder.max_buffer_size = 20000;
+        faiss::VectorIOReader reader;
+        reader.data.resize (xb.size() * sizeof(float));
+        memcpy (reader.data.data(), xb.data(), reader.data.size());
+        builder.add_from_reader (&reader, 2000);
+        builder.add (nb - 2000, xb.data() + 2000 * d);
+        EXPECT_GT (builder.run_files.size(), 5);
+        builder.finish ();
+    }
+    EXPECT_EQ (index.ntotal, nb);
+
+    for (int i = 0; i < nlist; i++) {
+        ASSERT_EQ (index.invlists->list_size (i),
+                   ref_index.invlists->list_size (i));
+        faiss::InvertedLists::ScopedIds ids (index.invlists, i);
+        faiss::InvertedLists::ScopedIds ref_ids (ref_index.invlists, i);
+        for (size_t j = 0; j < index.invlists->list_size (i); j++) {
+            EXPECT_EQ (ids[j], ref_ids[j]);
+        }
+    }
+
+    std::vector<float> new_D (nq * k);
+    std::vector<faiss::Index::idx_t> new_I (nq * k);
+    index.search (nq, xq.data(), k, new_D.data(), new_I.data());
+    EXPECT_EQ (ref_D, new_D);
+    EXPECT_EQ (ref_I, new_I);
+}
+
+TEST(ONDISK, compact) {
+    int nlist = 100;
+    int code_size = 16;
+    Tempfilename filename;
+
+    faiss::OnDiskInvertedLists ivf (nlist, code_size, filename.c_str());
+    std::vector<std::vector<faiss::Index::idx_t>> ref_ids (nlist);
+
+    std::mt19937 rng;
+    std::vector<uint8_t> code (code_size);
+    // add entries and shrink lists to fragment the file
+    for (int round = 0; round < 4; round++) {
+        for (int i = 0; i < 5000; i++) {
+            int list_no = rng() % nlist;
+            faiss::Index::idx_t id = round * 5000 + i;
+            memcpy (code.data(), &id, sizeof(id));
+            ivf.add_entry (list_no, id, code.data());
+            ref_ids[list_no].push_back (id);
+        }
+        for (int list_no = 0; list_no < nlist; list_no += 3) {
+            size_t new_size = ref_ids[list_no].size() / 4;
+            ivf.resize (list_no, new_size);
+            ref_ids[list_no].resize (new_size);
+        }
+    }
+    EXPECT_GT (ivf.free_bytes(), 0);
+
+    // largest lists first
+    std::vector<faiss::Index::idx_t> order (nlist);
+    for (int i = 0; i < nlist; i++) {
+        order[i] = i;
+    }
+    std::sort (order.begin(), order.end(),
+        [&](faiss::Index::idx_t a, faiss::Index::idx_t b) {
+            return ref_ids[a].size() > ref_ids[b].size();
+        });
+
+    size_t data_size = 0;
+    for (int i = 0; i < nlist; i++) {
+        data_size += ref_ids[i].size() *
+            (sizeof(faiss::Index::idx_t) + code_size);
+    }
+    EXPECT_EQ (ivf.compact (order.data()), data_size);
+    EXPECT_EQ (ivf.free_bytes(), 0);
+    EXPECT_EQ (ivf.totsize, data_size);
+
+    FILE *f = fopen (filename.c_str(), "r");
+    ASSERT_TRUE (f);
+    fseek (f, 0, SEEK_END);
+    EXPECT_EQ (ftell (f), data_size);
+    fclose (f);
+
+    // the lists are laid out in the requested order
+    for (int i = 1; i < nlist; i++) {
+        if (ref_ids[order[i]].size() > 0) {
+            EXPECT_LT (ivf.lists[order[i - 1]].offset,
+                       ivf.lists[order[i]].offset);
+        }
+    }
+
+    // the content is unchanged and the lists can still grow
+    for (int list_no = 0; list_no < nlist; list_no += 7) {
+        faiss::Index::idx_t id = 1000000 + list_no;
+        memcpy (code.data(), &id, sizeof(id));
+        ivf.add_entry (list_no, id, code.data());
+        ref_ids[list_no].push_back (id);
+    }
+    for (int list_no = 0; list_no < nlist; list_no++) {
+        ASSERT_EQ (ivf.list_size (list_no), ref_ids[list_no].size());
+        const faiss::Index::idx_t *ids = ivf.get_ids (list_no);
+        const uint8_t *codes = ivf.get_codes (list_no);
+        for (size_t j = 0; j < ref_ids[list_no].size(); j++) {
+            EXPECT_EQ (ids[j], ref_ids[list_no][j]);
+            faiss::Index::idx_t id;
+            memcpy (&id, codes + j * code_size, sizeof(id));
+            EXPECT_EQ (id, ref_ids[list_no][j]);
+        }
+    }
+}
+
+
+namespace {
+
+/// nb of contiguous byte ranges read by the queries
+size_t count_read_ranges (const faiss::OnDiskInvertedLists & ivf,
+                          int nq, int nprobe,
+                          const faiss::Index::idx_t *probes)
+{
+    size_t nrange = 0;
+    for (int q = 0; q < nq; q++) {
+        std::vector<std::pair<size_t, size_t> > ranges;
+        for (int i = 0; i < nprobe; i++) {
+            const faiss::OnDiskOneList & l = ivf.lists[probes[q * nprobe + i]];
+            if (l.size > 0) {
+                ranges.emplace_back (l.offset, l.offset +
+                    l.capacity * (ivf.code_size + sizeof(faiss::Index::idx_t)));
+            }
+        }
+        std::sort (ranges.begin(), ranges.end());
+        for (size_t i = 0; i < ranges.size(); i++) {
+            if (i == 0 || ranges[i].first != ranges[i - 1].second) {
+                nrange++;
+            }
+        }
+    }
+    return nrange;
+}
+
+}  // namespace
+
+
+TEST(ONDISK, relayout) {
+    int d = 2;
+    int nlist = 100, nq = 300, nb = 5000, k = 10, nprobe = 6;
+    faiss::IndexFlatL2 quantizer(d);
+    {
+        std::vector<float> x(d * nlist);
+        faiss::float_rand(x.data(), d * nlist, 12345);
+        quantizer.add(nlist, x.data());
+    }
+    std::vector<float> xb(d * nb);
+    faiss::float_rand(xb.data(), d * nb, 23456);
+    std::vector<float> xq(d * nq);
+    faiss::float_rand(xq.data(), d * nq, 34567);
+
+    faiss::IndexIVFFlat index(&quantizer, d, nlist);
+    index.nprobe = nprobe;
+    index.add(nb, xb.data());
+
+    std::vector<float> ref_D (nq * k);
+    std::vector<faiss::Index::idx_t> ref_I (nq * k);
+    index.search (nq, xq.data(), k, ref_D.data(), ref_I.data());
+
+    Tempfilename filename;
+    faiss::OnDiskInvertedLists ivf (
+            index.nlist, index.code_size, filename.c_str());
+    ivf.merge_from_1 (index.invlists);
+    index.replace_invlists (&ivf);
+
+    // probe log
+    std::vector<faiss::Index::idx_t> probes (nq * nprobe);
+    quantizer.assign (nq, xq.data(), probes.data(), nprobe);
+    size_t nrange_ref = count_read_ranges (ivf, nq, nprobe, probes.data());
+
+    std::vector<faiss::Index::idx_t> order (nlist);
+    for (int from_log = 0; from_log < 2; from_log++) {
+        if (from_log) {
+            faiss::ivflib::co_probe_list_order (
+                    nlist, nq, nprobe, probes.data(), order.data());
+        } else {
+            faiss::ivflib::centroid_graph_list_order (
+                    &index, nprobe, order.data());
+        }
+        std::vector<faiss::Index::idx_t> sorted (order);
+        std::sort (sorted.begin(), sorted.end());
+        for (int i = 0; i < nlist; i++) {
+            EXPECT_EQ (sorted[i], i);
+        }
+
+        faiss::ivflib::relayout_ondisk_invlists (&index, order.data());
+        size_t nrange = count_read_ranges (ivf, nq, nprobe, probes.data());
+        EXPECT_LT (nrange, nrange_ref * 3 / 4);
+
+        std::vector<float> new_D (nq * k);
+        std::vector<faiss::Index::idx_t> new_I (nq * k);
+        index.search (nq, xq.data(), k, new_D.data(), new_I.data());
+        EXPECT_EQ (ref_D, new_D);
+        EXPECT_EQ (ref_I, new_I);
+    }
+}
+
+
+TEST(ONDISK, reserved_mapping_threaded) {
+    int nlist = 1000;
+    int code_size = 16;
+    int nadd = 200000;
+
+    Tempfilename filename;
+
+    faiss::OnDiskInvertedLists ivf (
+                nlist, code_size,
+                filename.c_str());
+    ivf.reserve_size = (size_t)64 << 20;
+    ivf.max_grow_size = 1 << 20;
+
+    std::vector<int> list_nos (nadd);
+    std::mt19937 rng;
+    for (int i = 0; i < nadd; i++) {
+        list_nos[i] = rng() % nlist;
+    }
+
+    // the first entry maps the file
+    std::vector<uint8_t> code(code_size);
+    ((int*)code.data())[0] = -1;
+    ivf.add_entry (0, -1, code.data());
+    const uint8_t *ptr0 = ivf.ptr;
+
+#pragma omp parallel num_threads(4)
+    {
+        std::vector<uint8_t> code(code_size);
+#pragma omp for
+        for (int i = 0; i < nadd; i++) {
+            int * ar = (int*)code.data();
+            ar[0] = i;
+            ar[1] = list_nos[i];
+            ivf.add_entry (list_nos[i], i, code.data());
+        }
+    }
+
+    // the file grew within the reserved mapping
+    EXPECT_EQ (ivf.ptr, ptr0);
+    EXPECT_LE (ivf.totsize, ivf.reserve_size);
+
+    int ntot = 0;
+    for (int i = 0; i < nlist; i++) {
+        int size = ivf.list_size(i);
+        const faiss::Index::idx_t *ids = ivf.get_ids (i);
+        const uint8_t *codes = ivf.get_codes (i);
+        for (int j = 0; j < size; j++) {
+            faiss::Index::idx_t id = ids[j];
+            const int * ar = (const int*)&codes[code_size * j];
+            EXPECT_EQ (ar[0], id);
+            if (id >= 0) {
+                EXPECT_EQ (ar[1], i);
+                EXPECT_EQ (list_nos[id], i);
+            }
+            ntot ++;
+        }
+    }
+    EXPECT_EQ (ntot, nadd + 1);
+
+    // compaction keeps the reservation
+    ivf.compact ();
+    int nnew = 1000;
+    for (int i = 0; i < nnew; i++) {
+        ivf.add_entry (i % nlist, nadd + i, code.data());
+    }
+    size_t ntot2 = 0;
+    for (int i = 0; i < nlist; i++) {
+        ntot2 += ivf.list_size(i);
+    }
+    EXPECT_EQ (ntot2, nadd + 1 + nnew);
+}
@@ -0,0 +1,173 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexHNSW.h>
+#include <faiss/IndexIVF.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/index_factory.h>
+#include <faiss/utils/parallel.h>
+#include <faiss/utils/random.h>
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 32;
+size_t nt = 2000;
+size_t nb = 3000;
+size_t nq = 100;
+int k = 10;
+
+std::vector<float> make_data (size_t n, int seed)
+{
+    std::vector<float> x (n * d);
+    float_randn (x.data(), x.size(), seed);
+    return x;
+}
+
+/// forwards to the serial executor and counts the tasks
+struct CountingExecutor: SerialExecutor {
+    std::atomic<size_t> ntask {0};
+    std::atomic<size_t> nrun {0};
+
+    void run (size_t n,
+              const std::function<void (size_t)> & task) override {
+        nrun++;
+        ntask += n;
+        SerialExecutor::run (n, task);
+    }
+
+    int num_threads () const override { return 4; }
+};
+
+/// restores the default executor at the end of the test
+struct ExecutorGuard {
+    explicit ExecutorGuard (ParallelExecutor *executor) {
+        set_parallel_executor (executor);
+    }
+    ~ExecutorGuard () {
+        set_parallel_executor (nullptr);
+    }
+};
+
+void check_same_results (const char *factory_key)
+{
+    std::vector<float> xt = make_data (nt, 1);
+    std::vector<float> xb = make_data (nb, 2);
+    std::vector<float> xq = make_data (nq, 3);
+
+    std::unique_ptr<Index> index (index_factory (d, factory_key));
+    index->train (nt, xt.data());
+    index->add (nb, xb.data());
+    if (auto *ivf = dynamic_cast<IndexIVF*> (index.get())) {
+        ivf->nprobe = 4;
+    }
+
+    std::vector<float> Dref (nq * k);
+    std::vector<idx_t> Iref (nq * k);
+    index->search (nq, xq.data(), k, Dref.data(), Iref.data());
+
+    ThreadPoolExecutor pool (3);
+    SerialExecutor serial;
+    CountingExecutor counting;
+    ParallelExecutor *executors[] = {&pool, &serial, &counting};
+
+    for (ParallelExecutor *executor: executors) {
+        ExecutorGuard guard (executor);
+        std::vector<float> D (nq * k);
+        std::vector<idx_t> I (nq * k);
+        index->search (nq, xq.data(), k, D.data(), I.data());
+        // small query slices may use the non-BLAS distance code: the
+        // distances are equal up to rounding
+        EXPECT_EQ (I, Iref) << factory_key;
+        for (size_t i = 0; i < nq * k; i++) {
+            ASSERT_NEAR (D[i], Dref[i], 1e-4 * Dref[i]) << factory_key;
+        }
+    }
+
+    // the queries are split in several tasks, all run through the executor
+    EXPECT_EQ (counting.nrun, 1);
+    EXPECT_GT (counting.ntask, 1);
+}
+
+} // namespace
+
+
+TEST(ParallelExecutor, flat) {
+    check_same_results ("Flat");
+}
+
+TEST(ParallelExecutor, IVFFlat) {
+    check_same_results ("IVF32,Flat");
+}
+
+TEST(ParallelExecutor, HNSW) {
+    check_same_results ("HNSW16");
+}
+
+TEST(ParallelExecutor, parallel_for_slices) {
+    ThreadPoolExecutor pool (4);
+    ExecutorGuard guard (&pool);
+    size_t n = 1001;
+    std::vector<int> hits (n);
+    parallel_for (n, [&] (size_t i0, size_t i1) {
+        for (size_t i = i0; i < i1; i++) {
+            hits[i]++;
+        }
+    }, 7);
+    for (size_t i = 0; i < n; i++) {
+        EXPECT_EQ (hits[i], 1);
+    }
+}
+
+TEST(ParallelExecutor, nested_serial) {
+    CountingExecutor counting;
+    ExecutorGuard guard (&counting);
+    std::atomic<size_t> ninner (0);
+    parallel_for (8, [&] (size_t i0, size_t i1) {
+        EXPECT_FALSE (use_parallel_executor (100));
+        parallel_for (10, [&] (size_t j0, size_t j1) {
+            ninner += j1 - j0;
+        });
+    });
+    EXPECT_EQ (ninner, 80);
+    // only the outer loop went through the executor
+    EXPECT_EQ (counting.nrun, 1);
+}
+
+TEST(ParallelExecutor, exception) {
+    ThreadPoolExecutor pool (2);
+    ExecutorGuard guard (&pool);
+    EXPECT_THROW (
+        parallel_for (100, [] (size_t i0, size_t) {
+            if (i0 == 0) {
+                throw std::runtime_error ("task failed");
+            }
+        }),
+        FaissException);
+    // the executor is still usable
+    std::atomic<size_t> n (0);
+    parallel_for (100, [&] (size_t i0, size_t i1) { n += i1 - i0; });
+    EXPECT_EQ (n, 100);
+}
+
+TEST(ParallelExecutor, default_executor) {
+    set_parallel_executor (nullptr);
+    EXPECT_FALSE (use_parallel_executor (100));
+    EXPECT_NE (dynamic_cast<OpenMPExecutor*> (get_parallel_executor ()),
+               nullptr);
+}
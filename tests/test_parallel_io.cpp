@@ -0,0 +1,180 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#include <memory>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <faiss/Index.h>
+#include <faiss/index_factory.h>
+#include <faiss/index_io.h>
+#include <faiss/impl/io.h>
+
+
+namespace {
+
+typedef faiss::Index::idx_t idx_t;
+
+struct Tempfilename {
+
+    static pthread_mutex_t mutex;
+
+    std::string filename;
+
+    Tempfilename (const char *prefix = nullptr) {
+        pthread_mutex_lock (&mutex);
+        char *cfname = tempnam (nullptr, prefix);
+        filename = cfname;
+        free(cfname);
+        pthread_mutex_unlock (&mutex);
+    }
+
+    ~Tempfilename () {
+        if (access (filename.c_str(), F_OK) == 0) {
+            unlink (filename.c_str());
+        }
+    }
+
+    const char *c_str() {
+        return filename.c_str();
+    }
+
+};
+
+pthread_mutex_t Tempfilename::mutex = PTHREAD_MUTEX_INITIALIZER;
+
+int d = 32;
+size_t nb = 2000;
+size_t nq = 20;
+int k = 5;
+
+std::vector<float> make_data (size_t n, int seed)
+{
+    std::vector<float> x (n * d);
+    std::mt19937 rng (seed);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < x.size(); i++) {
+        x[i] = distrib (rng);
+    }
+    return x;
+}
+
+void search (const faiss::Index & index, const std::vector<float> & xq,
+             std::vector<float> & D, std::vector<idx_t> & I)
+{
+    D.resize (nq * k);
+    I.resize (nq * k);
+    index.search (nq, xq.data(), k, D.data(), I.data());
+}
+
+/// use parallel I/O for all arrays, by small blocks
+struct ParallelIOSettings {
+    size_t min_size, block_size;
+
+    ParallelIOSettings () {
+        min_size = faiss::parallel_io_min_size;
+        block_size = faiss::parallel_io_block_size;
+        faiss::parallel_io_min_size = 0;
+        faiss::parallel_io_block_size = 4096;
+    }
+
+    ~ParallelIOSettings () {
+        faiss::parallel_io_min_size = min_size;
+        faiss::parallel_io_block_size = block_size;
+    }
+};
+
+std::vector<uint8_t> read_file (const char *fname)
+{
+    faiss::FileIOReader reader (fname);
+    std::vector<uint8_t> data;
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = reader (buf, 1, sizeof(buf))) > 0) {
+        data.insert (data.end(), buf, buf + n);
+    }
+    return data;
+}
+
+/// the file written in parallel is the same as the sequential
+/// serialization, and reads back to an equivalent index
+void test_parallel_io (const char *key)
+{
+    ParallelIOSettings settings;
+    Tempfilename tmp;
+
+    std::vector<float> xb = make_data (nb, 1);
+    std::vector<float> xq = make_data (nq, 2);
+
+    std::unique_ptr<faiss::Index> index (faiss::index_factory (d, key));
+    index->train (nb, xb.data());
+    index->add (nb, xb.data());
+    faiss::write_index (index.get(), tmp.c_str());
+
+    faiss::VectorIOWriter writer;
+    faiss::write_index (index.get(), &writer);
+    EXPECT_EQ (read_file (tmp.c_str()), writer.data) << key;
+
+    std::unique_ptr<faiss::Index> index2 (faiss::read_index (tmp.c_str()));
+
+    std::vector<float> D_ref, D;
+    std::vector<idx_t> I_ref, I;
+    search (*index, xq, D_ref, I_ref);
+    search (*index2, xq, D, I);
+    EXPECT_EQ (I, I_ref) << key;
+    EXPECT_EQ (D, D_ref) << key;
+}
+
+}  // namespace
+
+
+TEST(ParallelIO, flat_codes) {
+    test_parallel_io ("Flat");
+    test_parallel_io ("PQ8np");
+    test_parallel_io ("SQ8");
+    test_parallel_io ("HNSW16");
+}
+
+TEST(ParallelIO, ivf) {
+    test_parallel_io ("IVF16,Flat");
+    test_parallel_io ("IVF16,PQ8");
+}
+
+TEST(ParallelIO, append_mode) {
+    // pwrite cannot be used with append mode, the write is sequential
+    ParallelIOSettings settings;
+    Tempfilename tmp;
+
+    std::vector<float> xb = make_data (nb, 1);
+    std::unique_ptr<faiss::Index> index (faiss::index_factory (d, "Flat"));
+    index->add (nb, xb.data());
+
+    FILE *f = fopen (tmp.c_str(), "ab");
+    ASSERT_TRUE (f);
+    faiss::write_index (index.get(), f);
+    faiss::write_index (index.get(), f);
+    fclose (f);
+
+    f = fopen (tmp.c_str(), "rb");
+    ASSERT_TRUE (f);
+    std::unique_ptr<faiss::Index> index2 (faiss::read_index (f));
+    std::unique_ptr<faiss::Index> index3 (faiss::read_index (f));
+    fclose (f);
+    EXPECT_EQ (index3->ntotal, nb);
+
+    std::vector<float> x (d), y (d);
+    index->reconstruct (nb - 1, x.data());
+    index3->reconstruct (nb - 1, y.data());
+    EXPECT_EQ (x, y);
+}
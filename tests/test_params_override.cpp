@@ -16,7 +16,12 @@
 
 #include <faiss/IndexIVF.h>
 #include <faiss/IndexBinaryIVF.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexHNSW.h>
+#include <faiss/IndexPQ.h>
+#include <faiss/IndexReplicas.h>
 #include <faiss/index_factory.h>
+#include <faiss/clone_index.h>
 #include <faiss/AutoTune.h>
 #include <faiss/IVFlib.h>
 
@@ -60,11 +65,12 @@ std::unique_ptr<Index> make_index(const char *index_type,
     return index;
 }
 
-std::vector<idx_t> search_index(Index *index, const float *xq) {
+std::vector<idx_t> search_index(Index *index, const float *xq,
+                                const SearchParameters *params = nullptr) {
     int k = 10;
     std::vector<idx_t> I(k * nq);
     std::vector<float> D(k * nq);
-    index->search (nq, xq, k, D.data(), I.data());
+    index->search (nq, xq, k, D.data(), I.data(), params);
     return I;
 }
 
@@ -151,6 +157,100 @@ TEST(TPO, IVFFlatPP) {
 }
 
 
+/*************************************************************
+ * Search parameters passed directly to Index::search
+ *************************************************************/
+
+namespace {
+
+/// the search parameters should give the same results as setting the
+/// index fields, and should not modify the index
+void test_search_params_ivf (const char *index_key, MetricType metric) {
+    std::vector<float> xb = make_data(nb);
+    auto index = make_index(index_key, metric, xb);
+    std::vector<float> xq = make_data(nq);
+
+    ParameterSpace ps;
+    ps.set_index_parameter(index.get(), "nprobe", 9);
+    auto res9ref = search_index(index.get(), xq.data());
+    ps.set_index_parameter(index.get(), "nprobe", 1);
+    auto res1ref = search_index(index.get(), xq.data());
+
+    IVFSearchParameters params;
+    params.nprobe = 9;
+    EXPECT_EQ(res9ref, search_index(index.get(), xq.data(), &params));
+    EXPECT_EQ(res1ref, search_index(index.get(), xq.data()));
+
+    // same through a replicated index
+    std::unique_ptr<Index> index2 (clone_index (index.get()));
+    IndexReplicas replicas (d, false);
+    replicas.addIndex (index.get());
+    replicas.addIndex (index2.get());
+    EXPECT_EQ(res9ref, search_index(&replicas, xq.data(), &params));
+}
+
+} // namespace
+
+TEST(TPO, SearchParamsIVF) {
+    test_search_params_ivf ("IVF32,Flat", METRIC_L2);
+    test_search_params_ivf ("IVF32,PQ8np", METRIC_INNER_PRODUCT);
+    test_search_params_ivf ("PCA16,IVF32,SQ8", METRIC_L2);
+}
+
+TEST(TPO, SearchParamsHNSW) {
+    std::vector<float> xb = make_data(nb);
+    auto index = make_index("HNSW32", METRIC_L2, xb);
+    std::vector<float> xq = make_data(nq);
+    IndexHNSW *index_hnsw = dynamic_cast<IndexHNSW*>(index.get());
+
+    index_hnsw->hnsw.efSearch = 64;
+    auto res64ref = search_index(index.get(), xq.data());
+    index_hnsw->hnsw.efSearch = 16;
+    auto res16ref = search_index(index.get(), xq.data());
+
+    SearchParametersHNSW params;
+    params.efSearch = 64;
+    EXPECT_EQ(res64ref, search_index(index.get(), xq.data(), &params));
+    EXPECT_EQ(res16ref, search_index(index.get(), xq.data()));
+    EXPECT_EQ(index_hnsw->hnsw.efSearch, 16);
+}
+
+TEST(TPO, SearchParamsPQ) {
+    std::vector<float> xb = make_data(nb);
+    auto index = make_index("PQ8np", METRIC_L2, xb);
+    std::vector<float> xq = make_data(nq);
+    IndexPQ *index_pq = dynamic_cast<IndexPQ*>(index.get());
+
+    index_pq->search_type = IndexPQ::ST_polysemous;
+    index_pq->polysemous_ht = 20;
+    auto res20ref = search_index(index.get(), xq.data());
+    index_pq->search_type = IndexPQ::ST_PQ;
+    auto resref = search_index(index.get(), xq.data());
+
+    SearchParametersPQ params;
+    params.search_type = IndexPQ::ST_polysemous;
+    params.polysemous_ht = 20;
+    EXPECT_EQ(res20ref, search_index(index.get(), xq.data(), &params));
+    EXPECT_EQ(resref, search_index(index.get(), xq.data()));
+}
+
+TEST(TPO, SearchParamsInvalid) {
+    std::vector<float> xb = make_data(nb);
+    std::vector<float> xq = make_data(nq);
+
+    auto index_flat = make_index("Flat", METRIC_L2, xb);
+    auto index_ivf = make_index("IVF32,Flat", METRIC_L2, xb);
+    SearchParametersHNSW params_hnsw;
+    IVFSearchParameters params_ivf;
+
+    // unsupported parameters and parameters of the wrong type throw
+    EXPECT_THROW(search_index(index_flat.get(), xq.data(), &params_ivf),
+                 FaissException);
+    EXPECT_THROW(search_index(index_ivf.get(), xq.data(), &params_hnsw),
+                 FaissException);
+}
+
+
 
 /*************************************************************
  * Same for binary indexes
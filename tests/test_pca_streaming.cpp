@@ -0,0 +1,202 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cmath>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/VectorTransform.h>
+#include <faiss/utils/distances.h>
+#include <faiss/utils/random.h>
+
+namespace {
+
+int d = 64;
+size_t n = 20000;
+
+/* The reference PCA is computed on centered data, because the training
+ * in single precision is inaccurate for vectors with a large mean. The
+ * streaming training is robust to it. */
+float offset = 100;
+
+/// data with a decaying spectrum and an offset
+std::vector<float> make_data (float offset)
+{
+    std::vector<float> x (n * d);
+    faiss::float_randn (x.data(), x.size(), 1234);
+    faiss::RandomRotationMatrix rr (d, d);
+    rr.init (5);
+    for (size_t i = 0; i < n; i++) {
+        for (int j = 0; j < d; j++) {
+            x[i * d + j] *= 10.0 / (j + 1);
+        }
+    }
+    std::vector<float> xr (n * d);
+    rr.apply_noalloc (n, x.data(), xr.data());
+    for (size_t i = 0; i < n * d; i++) {
+        xr[i] += offset;
+    }
+    return xr;
+}
+
+/// the first d_out components of both PCAs are the same up to the sign
+void compare_pca (const faiss::PCAMatrix & ref,
+                  const faiss::PCAMatrix & pca, float tol,
+                  float pca_offset = offset)
+{
+    for (int j = 0; j < d; j++) {
+        EXPECT_NEAR (pca.mean[j], ref.mean[j] + pca_offset, 1e-3);
+    }
+    for (int i = 0; i < pca.d_out; i++) {
+        EXPECT_NEAR (pca.eigenvalues[i], ref.eigenvalues[i],
+                     tol * ref.eigenvalues[i]);
+        float ip = faiss::fvec_inner_product (
+              pca.PCAMat.data() + i * d, ref.PCAMat.data() + i * d, d);
+        EXPECT_NEAR (std::fabs (ip), 1, tol);
+    }
+}
+
+}  // namespace
+
+
+TEST(PCAMatrix, streaming) {
+    std::vector<float> x = make_data (offset);
+    std::vector<float> x0 = make_data (0);
+
+    faiss::PCAMatrix ref (d, 16);
+    ref.train (n, x0.data());
+
+    faiss::PCAMatrix pca (d, 16);
+    pca.stream_chunk_size = 3000;
+    pca.train (n, x.data());
+    compare_pca (ref, pca, 1e-3);
+
+    // same with explicit calls
+    faiss::PCAMatrix pca2 (d, 16);
+    pca2.accumulate_covariance (n / 2, x.data());
+    pca2.accumulate_covariance (n - n / 2, x.data() + n / 2 * d);
+    pca2.train_from_covariance ();
+    compare_pca (ref, pca2, 1e-3);
+    EXPECT_EQ (pca2.cov_n, 0);
+}
+
+TEST(PCAMatrix, randomized) {
+    std::vector<float> x = make_data (offset);
+    std::vector<float> x0 = make_data (0);
+
+    faiss::PCAMatrix ref (d, 8);
+    ref.train (n, x0.data());
+
+    faiss::PCAMatrix pca (d, 8);
+    pca.randomized_niter = 4;
+    pca.train (n, x0.data());
+    compare_pca (ref, pca, 1e-2, 0);
+
+    faiss::PCAMatrix pca2 (d, 8, -0.5);
+    pca2.randomized_niter = 4;
+    pca2.stream_chunk_size = 5000;
+    pca2.train (n, x.data());
+    compare_pca (ref, pca2, 1e-2);
+
+    // the eigenvalues are not normalized by n, so the whitened
+    // components have a unit norm over the training set
+    std::vector<float> xt (n * 8);
+    pca2.apply_noalloc (n, x.data(), xt.data());
+    double var = 0;
+    for (size_t i = 0; i < n; i++) {
+        var += xt[i * 8] * xt[i * 8];
+    }
+    EXPECT_NEAR (var, 1, 1e-2);
+}
+
+namespace {
+
+/// BLAS products, counted
+struct CountingGemm: faiss::TrainingGemm {
+    mutable int nsgemm = 0, ndgemm = 0;
+
+    void sgemm (const char *transa, const char *transb,
+                int m, int n, int k,
+                float alpha, const float *a, int lda,
+                const float *b, int ldb,
+                float beta, float *c, int ldc) const override {
+        nsgemm++;
+        faiss::TrainingGemm::sgemm (transa, transb, m, n, k, alpha,
+                                    a, lda, b, ldb, beta, c, ldc);
+    }
+
+    void dgemm (const char *transa, const char *transb,
+                int m, int n, int k,
+                double alpha, const double *a, int lda,
+                const double *b, int ldb,
+                double beta, double *c, int ldc) const override {
+        ndgemm++;
+        faiss::TrainingGemm::dgemm (transa, transb, m, n, k, alpha,
+                                    a, lda, b, ldb, beta, c, ldc);
+    }
+};
+
+}  // namespace
+
+TEST(PCAMatrix, train_gemm) {
+    std::vector<float> x0 = make_data (0);
+
+    faiss::PCAMatrix ref (d, 16);
+    ref.train (n, x0.data());
+
+    CountingGemm gemm;
+    faiss::PCAMatrix pca (d, 16);
+    pca.train_gemm = &gemm;
+    pca.train (n, x0.data());
+    compare_pca (ref, pca, 1e-3, 0);
+    EXPECT_EQ (gemm.nsgemm, 1);
+
+    // fewer training vectors than dimensions: Gram matrix
+    size_t n2 = d / 2;
+    faiss::PCAMatrix ref2 (d, 16);
+    ref2.train (n2, x0.data());
+    faiss::PCAMatrix pca2 (d, 16);
+    pca2.train_gemm = &gemm;
+    pca2.train (n2, x0.data());
+    for (int i = 0; i < 16; i++) {
+        EXPECT_NEAR (pca2.eigenvalues[i], ref2.eigenvalues[i],
+                     1e-3 * ref2.eigenvalues[0]);
+    }
+    EXPECT_EQ (gemm.nsgemm, 3);
+}
+
+TEST(OPQMatrix, train_gemm) {
+    std::vector<float> x0 = make_data (0);
+    size_t nt = 2000;
+
+    faiss::OPQMatrix ref (d, 8);
+    ref.niter = 3;
+    ref.train (nt, x0.data());
+
+    CountingGemm gemm;
+    faiss::OPQMatrix opq (d, 8);
+    opq.niter = 3;
+    opq.train_gemm = &gemm;
+    opq.train (nt, x0.data());
+    EXPECT_EQ (gemm.nsgemm, 6);
+    EXPECT_EQ (opq.A, ref.A);
+}
+
+TEST(ITQTransform, train_gemm) {
+    std::vector<float> x0 = make_data (0);
+    size_t nt = 2000;
+
+    // the PCA and the 2 products of each ITQ iteration
+    CountingGemm gemm;
+    faiss::ITQTransform itqt (d, 16, true);
+    itqt.itq.train_gemm = &gemm;
+    itqt.train (nt, x0.data());
+    EXPECT_TRUE (itqt.is_trained);
+    EXPECT_EQ (gemm.nsgemm, 1);
+    EXPECT_EQ (gemm.ndgemm, 2 * itqt.itq.max_iter);
+}
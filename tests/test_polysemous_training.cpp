@@ -0,0 +1,116 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <omp.h>
+
+#include <gtest/gtest.h>
+
+#include <faiss/impl/PolysemousTraining.h>
+#include <faiss/utils/random.h>
+
+
+using namespace faiss;
+
+namespace {
+
+std::vector<double> make_table(int n, bool symmetric, int seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> distrib(0, 4);
+    std::vector<double> tab(n * n);
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            tab[i * n + j] = symmetric && j < i ? tab[j * n + i] :
+                distrib(rng);
+        }
+    }
+    return tab;
+}
+
+void test_cost_update(bool symmetric)
+{
+    int n = 16;
+    std::vector<double> source = make_table(n, symmetric, 123);
+    std::vector<double> target = make_table(n, symmetric, 456);
+    ReproduceDistancesObjective obj(n, source.data(), target.data(), 0.5);
+
+    std::vector<int> perm(n);
+    for (int i = 0; i < n; i++) {
+        perm[i] = i;
+    }
+    std::mt19937 rng(789);
+    std::shuffle(perm.begin(), perm.end(), rng);
+
+    double cost = obj.compute_cost(perm.data());
+    for (int iw = 0; iw < n; iw++) {
+        for (int jw = 0; jw < n; jw++) {
+            if (iw == jw) continue;
+            std::vector<int> perm2 = perm;
+            std::swap(perm2[iw], perm2[jw]);
+            double ref = obj.compute_cost(perm2.data()) - cost;
+            EXPECT_NEAR(ref, obj.cost_update(perm.data(), iw, jw),
+                        1e-9 * std::abs(cost));
+        }
+    }
+}
+
+} // namespace
+
+
+TEST(PolysemousTraining, cost_update) {
+    test_cost_update(false);
+    test_cost_update(true);
+}
+
+TEST(PolysemousTraining, annealing) {
+    int n = 16;
+    std::vector<double> source = make_table(n, true, 1);
+    std::vector<double> target = make_table(n, true, 2);
+    ReproduceDistancesObjective obj(n, source.data(), target.data(), 0.5);
+    SimulatedAnnealingParameters params;
+    params.n_iter = 5000;
+    params.n_redo = 4;
+    SimulatedAnnealingOptimizer optim(&obj, params);
+    std::vector<int> perm(n);
+    double cost = optim.run_optimization(perm.data());
+    EXPECT_LT(cost, optim.init_cost);
+    EXPECT_NEAR(cost, obj.compute_cost(perm.data()), 1e-6 * cost);
+    std::sort(perm.begin(), perm.end());
+    for (int i = 0; i < n; i++) {
+        EXPECT_EQ(perm[i], i);
+    }
+}
+
+// the result does not depend on the nb of threads
+TEST(PolysemousTraining, parallel) {
+    size_t d = 16, M = 2, nbits = 6, n = 3000;
+    std::vector<float> x(n * d);
+    float_rand(x.data(), x.size(), 123);
+    ProductQuantizer pq(d, M, nbits);
+    pq.train(n, x.data());
+
+    PolysemousTraining pt;
+    pt.n_iter = 20000;
+    pt.n_redo = 3;
+
+    int nt = omp_get_max_threads();
+    omp_set_num_threads(1);
+    ProductQuantizer pq_seq = pq;
+    pt.optimize_pq_for_hamming(pq_seq, n, x.data());
+
+    omp_set_num_threads(std::max(nt, 4));
+    ProductQuantizer pq_par = pq;
+    pt.optimize_pq_for_hamming(pq_par, n, x.data());
+    omp_set_num_threads(nt);
+
+    EXPECT_EQ(pq_seq.centroids, pq_par.centroids);
+    EXPECT_NE(pq.centroids, pq_par.centroids);
+}
@@ -0,0 +1,280 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVFPQ.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/ProductQuantizer.h>
+#include <faiss/impl/pq_code_distance.h>
+#include <faiss/utils/cpu_dispatch.h>
+#include <faiss/utils/random.h>
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+// sets the SIMD level for the scope of the object
+struct ScopedSIMDLevel {
+    SIMDLevel prev;
+    explicit ScopedSIMDLevel(SIMDLevel level): prev(get_simd_level()) {
+        set_simd_level(level);
+    }
+    ~ScopedSIMDLevel() {
+        set_simd_level(prev);
+    }
+};
+
+std::vector<SIMDLevel> all_levels()
+{
+    std::vector<SIMDLevel> levels = {SIMD_GENERIC};
+    SIMDLevel best = supported_simd_level();
+    if (best == SIMD_AVX2 || best == SIMD_AVX512) {
+        levels.push_back(SIMD_AVX2);
+    }
+    if (best == SIMD_AVX512) {
+        levels.push_back(SIMD_AVX512);
+    }
+    return levels;
+}
+
+}  // namespace
+
+
+TEST(PQCodeDistance, 8bit) {
+    std::mt19937 rng(123);
+    std::uniform_real_distribution<float> fdis(0, 1);
+
+    for (size_t code_size : {1, 4, 7, 8, 9, 15, 16, 17, 24, 32, 40, 64}) {
+        for (size_t n : {1, 5, 8, 13, 64}) {
+            std::vector<float> tab(code_size * 256);
+            for (auto & t : tab) {
+                t = fdis(rng);
+            }
+            std::vector<uint8_t> codes(n * code_size);
+            for (auto & c : codes) {
+                c = rng() & 255;
+            }
+
+            std::vector<float> ref(n);
+            for (size_t j = 0; j < n; j++) {
+                double accu = 0;
+                for (size_t m = 0; m < code_size; m++) {
+                    accu += tab[m * 256 + codes[j * code_size + m]];
+                }
+                ref[j] = accu;
+            }
+
+            for (SIMDLevel level : all_levels()) {
+                ScopedSIMDLevel scoped(level);
+                std::vector<float> dis(n);
+                pq_code_distances_8bit(
+                      code_size, tab.data(), codes.data(), n, dis.data());
+                for (size_t j = 0; j < n; j++) {
+                    EXPECT_NEAR(dis[j], ref[j], 1e-5 * code_size)
+                        << "code_size=" << code_size << " level=" << level;
+                    // same rounding for a code alone and from its entries
+                    const uint8_t *code = codes.data() + j * code_size;
+                    float dis1;
+                    pq_code_distances_8bit(
+                          code_size, tab.data(), code, 1, &dis1);
+                    EXPECT_EQ(dis[j], dis1);
+                    std::vector<float> entries(code_size);
+                    for (size_t m = 0; m < code_size; m++) {
+                        entries[m] = tab[m * 256 + code[m]];
+                    }
+                    EXPECT_EQ(dis[j], pq_sum_entries_8bit(
+                          code_size, entries.data()));
+                }
+            }
+        }
+    }
+}
+
+TEST(PQCodeDistance, pair_tables_4bit) {
+    for (size_t M : {2, 5, 8}) {
+        ProductQuantizer pq(M * 2, M, 4);
+        std::vector<float> tab(M * 16);
+        float_rand(tab.data(), tab.size(), 1);
+
+        size_t n = 20;
+        std::vector<uint8_t> codes(n * pq.code_size);
+        std::vector<float> ref(n);
+        std::mt19937 rng(M);
+        for (size_t j = 0; j < n; j++) {
+            PQEncoderGeneric encoder(codes.data() + j * pq.code_size, 4);
+            ref[j] = 0;
+            for (size_t m = 0; m < M; m++) {
+                int c = rng() & 15;
+                encoder.encode(c);
+                ref[j] += tab[m * 16 + c];
+            }
+        }
+
+        std::vector<float> pair_tab(pq.code_size * 256), dis(n);
+        pq_pair_tables_4bit(M, tab.data(), pair_tab.data());
+        pq_code_distances_8bit(pq.code_size, pair_tab.data(),
+                               codes.data(), n, dis.data());
+        for (size_t j = 0; j < n; j++) {
+            EXPECT_NEAR(dis[j], ref[j], 1e-5);
+        }
+    }
+}
+
+/// the SIMD scan of IndexIVFPQ gives the same results as the scalar one
+/// used with a selector, and as distance_to_code
+TEST(PQCodeDistance, IVFPQ) {
+    int d = 32;
+    size_t nb = 5000, nq = 50;
+    int k = 10;
+    std::vector<float> xb(nb * d), xq(nq * d);
+    float_rand(xb.data(), xb.size(), 1);
+    float_rand(xq.data(), xq.size(), 2);
+
+    for (int nbits : {4, 8}) {
+        IndexFlatL2 quantizer(d);
+        IndexIVFPQ index(&quantizer, d, 8, 16, nbits);
+        index.train(nb, xb.data());
+        index.add(nb, xb.data());
+        index.nprobe = 4;
+
+        std::vector<float> D_scalar(nq * k), D(nq * k);
+        std::vector<idx_t> I_scalar(nq * k), I(nq * k);
+        for (SIMDLevel level : all_levels()) {
+            ScopedSIMDLevel scoped(level);
+            // reference with the scalar scan, that is used with a selector
+            IDSelectorRange sel(0, nb);
+            IVFSearchParameters params;
+            params.nprobe = 4;
+            params.sel = &sel;
+            index.search(nq, xq.data(), k, D_scalar.data(),
+                         I_scalar.data(), &params);
+
+            index.search(nq, xq.data(), k, D.data(), I.data());
+            EXPECT_EQ(I, I_scalar) << "nbits=" << nbits;
+            EXPECT_EQ(D, D_scalar) << "nbits=" << nbits;
+
+            // distance_to_code on the results from the first list, with
+            // the coarse distances of the search
+            std::unique_ptr<InvertedListScanner> scanner(
+                  index.get_InvertedListScanner(false));
+            std::vector<idx_t> keys(nq);
+            std::vector<float> coarse_dis(nq);
+            quantizer.search(nq, xq.data(), 1, coarse_dis.data(),
+                             keys.data());
+            for (size_t q = 0; q < nq; q++) {
+                scanner->set_query(xq.data() + q * d);
+                scanner->set_list(keys[q], coarse_dis[q]);
+                size_t lsize = index.invlists->list_size(keys[q]);
+                const idx_t *ids = index.invlists->get_ids(keys[q]);
+                const uint8_t *codes = index.invlists->get_codes(keys[q]);
+                for (int i = 0; i < k; i++) {
+                    idx_t id = I[q * k + i];
+                    for (size_t j = 0; j < lsize; j++) {
+                        if (ids[j] == id) {
+                            EXPECT_EQ(D[q * k + i], scanner->distance_to_code(
+                                  codes + j * index.code_size));
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST(PQCodeDistance, 8bit_u16) {
+    std::mt19937 rng(123);
+    std::uniform_real_distribution<float> fdis(-1, 1);
+
+    for (size_t code_size : {1, 7, 8, 9, 16, 17, 64}) {
+        size_t n = 29;
+        std::vector<float> tab(code_size * 256);
+        for (auto & t : tab) {
+            t = fdis(rng);
+        }
+        std::vector<uint8_t> codes(n * code_size);
+        for (auto & c : codes) {
+            c = rng() & 255;
+        }
+
+        std::vector<uint16_t> tab_q(code_size * 256 + 1);
+        float scale, bias;
+        pq_quantize_tables_u16(code_size, tab.data(), tab_q.data(),
+                               &scale, &bias);
+
+        std::vector<uint32_t> ref(n);
+        for (size_t j = 0; j < n; j++) {
+            double accu = 0;
+            ref[j] = 0;
+            for (size_t m = 0; m < code_size; m++) {
+                accu += tab[m * 256 + codes[j * code_size + m]];
+                ref[j] += tab_q[m * 256 + codes[j * code_size + m]];
+            }
+            // each entry is within scale / 2 of the float table
+            EXPECT_NEAR(bias + scale * ref[j], accu,
+                        scale * code_size / 2 + 1e-5);
+        }
+
+        // the integer sums are exact at all the levels
+        for (SIMDLevel level : all_levels()) {
+            ScopedSIMDLevel scoped(level);
+            std::vector<uint32_t> dis(n);
+            pq_code_distances_8bit_u16(
+                  code_size, tab_q.data(), codes.data(), n, dis.data());
+            EXPECT_EQ(dis, ref) << "code_size=" << code_size;
+        }
+    }
+}
+
+/// the scan with quantized tables gives approximate results, that the
+/// re-ranking makes exact
+TEST(PQCodeDistance, IVFPQ_quantized_lut) {
+    int d = 32;
+    size_t nb = 5000, nq = 50;
+    int k = 10;
+    std::vector<float> xb(nb * d), xq(nq * d);
+    float_rand(xb.data(), xb.size(), 1);
+    float_rand(xq.data(), xq.size(), 2);
+
+    for (MetricType metric : {METRIC_L2, METRIC_INNER_PRODUCT}) {
+        IndexFlat quantizer(d, metric);
+        IndexIVFPQ index(&quantizer, d, 8, 16, 8, metric);
+        index.train(nb, xb.data());
+        index.add(nb, xb.data());
+        index.nprobe = 4;
+
+        std::vector<float> D_ref(nq * k), D(nq * k);
+        std::vector<idx_t> I_ref(nq * k), I(nq * k);
+        index.search(nq, xq.data(), k, D_ref.data(), I_ref.data());
+
+        index.quantized_lut = true;
+        index.search(nq, xq.data(), k, D.data(), I.data());
+        size_t nmiss = 0;
+        for (size_t i = 0; i < nq * k; i++) {
+            nmiss += I[i] != I_ref[i];
+            EXPECT_NEAR(D[i], D_ref[i], 1e-2 * std::fabs(D_ref[i]) + 1e-3);
+        }
+        EXPECT_LT(nmiss, nq * k / 10);
+
+        index.rerank_factor = 4;
+        index.search(nq, xq.data(), k, D.data(), I.data());
+        nmiss = 0;
+        for (size_t i = 0; i < nq * k; i++) {
+            nmiss += I[i] != I_ref[i];
+            EXPECT_NEAR(D[i], D_ref[i], 1e-4);
+        }
+        EXPECT_LT(nmiss, nq * k / 100 + 1);
+    }
+}
@@ -6,13 +6,18 @@
  */
 
 
+#include <cstring>
 #include <iostream>
 #include <vector>
 #include <memory>
 
+#include <omp.h>
+
 #include <gtest/gtest.h>
 
 #include <faiss/impl/ProductQuantizer.h>
+#include <faiss/utils/distances.h>
+#include <faiss/utils/random.h>
 
 
 namespace {
@@ -96,3 +101,61 @@ TEST(PQEncoder16, encode) {
     EXPECT_EQ(values[i] & mask, v);
   }
 }
+
+
+// the sub-quantizers trained in parallel are the same as sequentially
+TEST(ProductQuantizer, parallel_train) {
+  const size_t d = 32, M = 8, nbits = 6, n = 2000;
+  std::vector<float> x(n * d);
+  faiss::float_rand(x.data(), x.size(), 123);
+
+  int nt = omp_get_max_threads();
+  omp_set_num_threads(1);
+  faiss::ProductQuantizer pq_seq(d, M, nbits);
+  pq_seq.train(n, x.data());
+
+  omp_set_num_threads(std::max(nt, 4));
+  faiss::ProductQuantizer pq_par(d, M, nbits);
+  pq_par.train(n, x.data());
+  omp_set_num_threads(nt);
+
+  EXPECT_EQ(pq_seq.centroids, pq_par.centroids);
+}
+
+
+// the batched encoder (dsub >= 16) gives the same codes as compute_code,
+// up to rounding on near-ties
+TEST(ProductQuantizer, compute_codes_batched) {
+  const size_t d = 64, n = 3000;
+  std::vector<float> x(n * d);
+  faiss::float_rand(x.data(), x.size(), 1234);
+
+  for (size_t nbits : {5, 8, 10, 12}) {
+    faiss::ProductQuantizer pq(d, 4, nbits);
+    faiss::float_rand(pq.centroids.data(), pq.centroids.size(), nbits);
+
+    std::vector<uint8_t> codes(n * pq.code_size), ref(n * pq.code_size);
+    pq.compute_codes(x.data(), codes.data(), n);
+    for (size_t i = 0; i < n; i++) {
+      pq.compute_code(x.data() + i * d, ref.data() + i * pq.code_size);
+    }
+
+    size_t ndiff = 0;
+    std::vector<float> rec(d), rec_ref(d);
+    for (size_t i = 0; i < n; i++) {
+      const uint8_t *c = codes.data() + i * pq.code_size;
+      const uint8_t *cr = ref.data() + i * pq.code_size;
+      if (memcmp(c, cr, pq.code_size) == 0) {
+        continue;
+      }
+      ndiff++;
+      pq.decode(c, rec.data());
+      pq.decode(cr, rec_ref.data());
+      const float *xi = x.data() + i * d;
+      float err = faiss::fvec_L2sqr(xi, rec.data(), d);
+      float err_ref = faiss::fvec_L2sqr(xi, rec_ref.data(), d);
+      EXPECT_NEAR(err, err_ref, 1e-4 * err_ref);
+    }
+    EXPECT_LT(ndiff, n / 100) << "nbits=" << nbits;
+  }
+}
@@ -0,0 +1,122 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <omp.h>
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexPQ.h>
+#include <faiss/utils/distances.h>
+#include <faiss/utils/random.h>
+
+namespace {
+
+typedef faiss::Index::idx_t idx_t;
+
+int d = 32;
+size_t nb = 20000;
+size_t nt = 5000;
+size_t nq = 3;
+
+/// search with the split over the database codes enabled or not
+void search_split (const faiss::IndexPQ & index, bool split,
+                   const std::vector<float> & xq, size_t k,
+                   std::vector<float> & D, std::vector<idx_t> & I)
+{
+    int min_ny = faiss::distance_compute_split_database_min_ny;
+    int nthread = omp_get_max_threads ();
+    faiss::distance_compute_split_database_min_ny = split ? 0 : nb + 1;
+    omp_set_num_threads (4);
+    D.resize (nq * k);
+    I.resize (nq * k);
+    index.search (nq, xq.data(), k, D.data(), I.data());
+    omp_set_num_threads (nthread);
+    faiss::distance_compute_split_database_min_ny = min_ny;
+}
+
+void test_split (faiss::IndexPQ::Search_type_t search_type, size_t k)
+{
+    std::vector<float> xt (nt * d), xb (nb * d), xq (nq * d);
+    faiss::float_rand (xt.data(), xt.size(), 123);
+    faiss::float_rand (xb.data(), xb.size(), 456);
+    faiss::float_rand (xq.data(), xq.size(), 789);
+
+    faiss::IndexPQ index (d, 8, 8);
+    // the polysemous search works without the training of the code order
+    index.do_polysemous_training = false;
+    index.train (nt, xt.data());
+    index.pq.compute_sdc_table ();
+    index.add (nb, xb.data());
+    index.search_type = search_type;
+    index.polysemous_ht = 24;
+
+    std::vector<float> D_ref, D;
+    std::vector<idx_t> I_ref, I;
+    faiss::indexPQ_stats.reset ();
+    search_split (index, false, xq, k, D_ref, I_ref);
+    size_t n_pass_ref = faiss::indexPQ_stats.n_hamming_pass;
+    faiss::indexPQ_stats.reset ();
+    search_split (index, true, xq, k, D, I);
+
+    EXPECT_EQ (I, I_ref);
+    EXPECT_EQ (D, D_ref);
+    EXPECT_EQ (n_pass_ref, faiss::indexPQ_stats.n_hamming_pass);
+}
+
+}  // namespace
+
+
+TEST(PQSplitDatabase, ADC) {
+    test_split (faiss::IndexPQ::ST_PQ, 10);
+}
+
+TEST(PQSplitDatabase, SDC) {
+    test_split (faiss::IndexPQ::ST_SDC, 10);
+}
+
+TEST(PQSplitDatabase, polysemous) {
+    test_split (faiss::IndexPQ::ST_polysemous, 1);
+    test_split (faiss::IndexPQ::ST_polysemous, 10);
+}
+
+TEST(PQSplitDatabase, SDC_reference) {
+    // compare with a direct evaluation of the symmetric distances
+    std::vector<float> xt (nt * d), xq (nq * d);
+    faiss::float_rand (xt.data(), xt.size(), 123);
+    faiss::float_rand (xq.data(), xq.size(), 789);
+
+    faiss::IndexPQ index (d, 8, 8);
+    index.do_polysemous_training = false;
+    index.train (nt, xt.data());
+    index.pq.compute_sdc_table ();
+    index.add (nt, xt.data());
+    index.search_type = faiss::IndexPQ::ST_SDC;
+
+    size_t k = 5;
+    std::vector<float> D (nq * k);
+    std::vector<idx_t> I (nq * k);
+    index.search (nq, xq.data(), k, D.data(), I.data());
+
+    const faiss::ProductQuantizer & pq = index.pq;
+    std::vector<uint8_t> qcodes (nq * pq.code_size);
+    pq.compute_codes (xq.data(), qcodes.data(), nq);
+
+    for (size_t i = 0; i < nq; i++) {
+        for (size_t j = 0; j < k; j++) {
+            const uint8_t *bcode = index.codes.data() +
+                I[i * k + j] * pq.code_size;
+            float dis = 0;
+            for (size_t m = 0; m < pq.M; m++) {
+                size_t qc = qcodes[i * pq.code_size + m];
+                dis += pq.sdc_table[(m * pq.ksub + qc) * pq.ksub + bcode[m]];
+            }
+            EXPECT_NEAR (dis, D[i * k + j], 1e-5);
+        }
+    }
+}
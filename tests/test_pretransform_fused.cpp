@@ -0,0 +1,114 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexPreTransform.h>
+#include <faiss/clone_index.h>
+#include <faiss/index_factory.h>
+#include <faiss/index_io.h>
+#include <faiss/impl/io.h>
+#include <faiss/utils/random.h>
+
+namespace {
+
+typedef faiss::Index::idx_t idx_t;
+
+int d = 64;
+size_t nt = 3000, nq = 50;
+
+std::vector<float> make_data (size_t n, int seed)
+{
+    std::vector<float> x (n * d);
+    faiss::float_randn (x.data(), x.size(), seed);
+    for (size_t i = 0; i < x.size(); i++) {
+        x[i] += i % d == 0 ? 10 : 0;
+    }
+    return x;
+}
+
+/// compare the fused transform with the transforms applied one by one
+void check_fused (const faiss::IndexPreTransform & index, int nfused)
+{
+    EXPECT_EQ (index.fused_lt.size(), nfused);
+    std::vector<float> xq = make_data (nq, 2);
+    std::vector<float> xt (nq * index.index->d);
+    index.apply_chain_noalloc (nq, xq.data(), xt.data());
+
+    std::vector<float> ref = xq;
+    for (const faiss::VectorTransform *vt : index.chain) {
+        std::vector<float> tmp (nq * vt->d_out);
+        vt->apply_noalloc (nq, ref.data(), tmp.data());
+        ref.swap (tmp);
+    }
+    ASSERT_EQ (ref.size(), xt.size());
+    for (size_t i = 0; i < xt.size(); i++) {
+        EXPECT_NEAR (xt[i], ref[i], 1e-3);
+    }
+}
+
+std::unique_ptr<faiss::IndexPreTransform> make_index (const char *key)
+{
+    std::vector<float> xt = make_data (nt, 1);
+    faiss::Index *index = faiss::index_factory (d, key);
+    index->train (nt, xt.data());
+    index->add (nt, xt.data());
+    return std::unique_ptr<faiss::IndexPreTransform> (
+         dynamic_cast<faiss::IndexPreTransform*> (index));
+}
+
+}  // namespace
+
+
+TEST(IndexPreTransform, fused_chain) {
+    // PCA + OPQ are composed, RR + PCAW also
+    check_fused (*make_index ("PCA32,OPQ4_32,Flat"), 1);
+    check_fused (*make_index ("RR64,PCAW16,Flat"), 1);
+    check_fused (*make_index ("PCAR32,OPQ4_32,L2norm,RR32,OPQ4,Flat"), 2);
+    // expanding again after a reduction is not cheaper
+    check_fused (*make_index ("PCA8,RR64,Flat"), 0);
+    // not linear
+    check_fused (*make_index ("HR64,PCA16,Flat"), 0);
+}
+
+TEST(IndexPreTransform, fused_search) {
+    std::unique_ptr<faiss::IndexPreTransform> index =
+        make_index ("PCAR32,OPQ4_32,Flat");
+    std::vector<float> xq = make_data (nq, 2);
+    int k = 5;
+    std::vector<float> D (nq * k), D2 (nq * k);
+    std::vector<idx_t> I (nq * k), I2 (nq * k);
+    index->search (nq, xq.data(), k, D.data(), I.data());
+
+    // disabled fusion
+    index->fuse_linear = false;
+    index->fuse_chain ();
+    EXPECT_TRUE (index->fused_plan.empty());
+    index->search (nq, xq.data(), k, D2.data(), I2.data());
+    EXPECT_EQ (I, I2);
+
+    // fused again after a round-trip through IO and clone
+    faiss::VectorIOWriter writer;
+    faiss::write_index (index.get(), &writer);
+    faiss::VectorIOReader reader;
+    reader.data = writer.data;
+    std::unique_ptr<faiss::IndexPreTransform> index2 (
+        dynamic_cast<faiss::IndexPreTransform*> (faiss::read_index (&reader)));
+    EXPECT_EQ (index2->fused_lt.size(), 1);
+    std::unique_ptr<faiss::IndexPreTransform> index3 (
+        dynamic_cast<faiss::IndexPreTransform*> (
+            faiss::clone_index (index2.get())));
+    EXPECT_EQ (index3->fused_lt.size(), 1);
+    index3->search (nq, xq.data(), k, D2.data(), I2.data());
+    EXPECT_EQ (I, I2);
+    for (size_t i = 0; i < D.size(); i++) {
+        EXPECT_NEAR (D[i], D2[i], 1e-3 * D[i]);
+    }
+}
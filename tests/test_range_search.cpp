@@ -0,0 +1,309 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <random>
+#include <set>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexHNSW.h>
+#include <faiss/IndexIVFFlat.h>
+#include <faiss/IndexPQ.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/utils/distances.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector <float> x (n);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < n; i++) {
+        x[i] = distrib(rng);
+    }
+    return x;
+}
+
+// radius such that there are about nres results per query
+float pick_radius(const Index & index, size_t nq, const float *xq,
+                  idx_t nres)
+{
+    std::vector<float> D(nq * nres);
+    std::vector<idx_t> I(nq * nres);
+    index.search(nq, xq, nres, D.data(), I.data());
+    std::vector<float> last;
+    for (size_t i = 0; i < nq; i++) {
+        last.push_back(D[i * nres + nres - 1]);
+    }
+    std::sort(last.begin(), last.end());
+    return last[nq / 2];
+}
+
+std::set<idx_t> result_set(const RangeSearchResult & res, size_t i)
+{
+    return std::set<idx_t>(res.labels + res.lims[i],
+                           res.labels + res.lims[i + 1]);
+}
+
+// fraction of the reference results that are found
+double range_recall(const RangeSearchResult & ref,
+                    const RangeSearchResult & res)
+{
+    size_t nfound = 0;
+    for (size_t i = 0; i < ref.nq; i++) {
+        std::set<idx_t> s = result_set(res, i);
+        for (size_t j = ref.lims[i]; j < ref.lims[i + 1]; j++) {
+            nfound += s.count(ref.labels[j]);
+        }
+    }
+    return ref.lims[ref.nq] == 0 ? 1.0 : nfound / double(ref.lims[ref.nq]);
+}
+
+// all results are within the radius and the distances are correct
+void check_distances(const RangeSearchResult & res, float radius,
+                     bool is_ip)
+{
+    for (size_t j = 0; j < res.lims[res.nq]; j++) {
+        if (is_ip) {
+            EXPECT_GT(res.distances[j], radius);
+        } else {
+            EXPECT_LT(res.distances[j], radius);
+        }
+    }
+}
+
+// with max_results, each query gets the max_results best results of
+// the uncapped search. Returns the fraction of results that are among
+// them (for approximate indexes the capped search is pruned earlier)
+double check_capped(const RangeSearchResult & full,
+                    const RangeSearchResult & capped,
+                    size_t max_results, bool is_ip)
+{
+    size_t nok = 0, ntot = 0;
+    for (size_t i = 0; i < full.nq; i++) {
+        size_t nfull = full.lims[i + 1] - full.lims[i];
+        size_t ncapped = capped.lims[i + 1] - capped.lims[i];
+        EXPECT_LE(ncapped, max_results);
+        if (ncapped == 0) {
+            continue;
+        }
+        std::vector<float> D(full.distances + full.lims[i],
+                             full.distances + full.lims[i + 1]);
+        if (is_ip) {
+            std::sort(D.begin(), D.end(), std::greater<float>());
+        } else {
+            std::sort(D.begin(), D.end());
+        }
+        float worst = D[std::min(nfull, max_results) - 1];
+        for (size_t j = capped.lims[i]; j < capped.lims[i + 1]; j++) {
+            nok += is_ip ? capped.distances[j] >= worst :
+                           capped.distances[j] <= worst;
+            ntot++;
+        }
+    }
+    return ntot == 0 ? 1.0 : nok / double(ntot);
+}
+
+// collects the streamed results
+struct CollectCallback: RangeSearchCallback {
+    size_t ncall = 0;
+    std::vector<std::set<std::pair<idx_t, float> > > results;
+
+    explicit CollectCallback(size_t nq): results(nq) {}
+
+    void process(size_t n, const idx_t *qnos, const idx_t *labels,
+                 const float *distances) override {
+        ncall++;
+        for (size_t i = 0; i < n; i++) {
+            results[qnos[i]].insert(std::make_pair(labels[i], distances[i]));
+        }
+    }
+};
+
+// the streamed results are the same as the stored ones
+void check_streaming(const Index & index, size_t nq, const float *xq,
+                     float radius)
+{
+    RangeSearchResult ref(nq);
+    index.range_search(nq, xq, radius, &ref);
+
+    CollectCallback callback(nq);
+    RangeSearchResult res(nq, &callback);
+    res.buffer_size = 100;   // exercise the flushes
+    index.range_search(nq, xq, radius, &res);
+
+    EXPECT_EQ(nullptr, res.lims);
+    EXPECT_EQ(nullptr, res.labels);
+    EXPECT_GE(callback.ncall, ref.lims[nq] / 100);
+    for (size_t i = 0; i < nq; i++) {
+        std::set<std::pair<idx_t, float> > refi;
+        for (size_t j = ref.lims[i]; j < ref.lims[i + 1]; j++) {
+            refi.insert(std::make_pair(ref.labels[j], ref.distances[j]));
+        }
+        EXPECT_EQ(refi, callback.results[i]);
+    }
+}
+
+} // namespace
+
+
+TEST(RangeSearch, RangeQueryTopResults) {
+    RangeSearchResult result(1);
+    {
+        RangeSearchPartialResult pres(&result);
+        RangeQueryTopResults res(10.0, 5);
+        for (int i = 0; i < 100; i++) {
+            res.add((i * 37) % 100 * 0.1, i);
+        }
+        EXPECT_LE(res.threshold, 10.0);
+        res.flush(pres.new_result(0));
+        pres.finalize();
+    }
+    ASSERT_EQ(5, result.lims[1]);
+    std::vector<float> D(result.distances, result.distances + 5);
+    std::sort(D.begin(), D.end());
+    for (int j = 0; j < 5; j++) {
+        EXPECT_NEAR(j * 0.1, D[j], 1e-5);
+    }
+}
+
+TEST(RangeSearch, HNSW) {
+    size_t d = 16, nb = 5000, nq = 50;
+
+    for (MetricType mt: {METRIC_L2, METRIC_INNER_PRODUCT}) {
+        bool is_ip = mt == METRIC_INNER_PRODUCT;
+        std::vector<float> xb = make_data(nb * d, 123);
+        std::vector<float> xq = make_data(nq * d, 456);
+        if (is_ip) { // cosine similarity
+            fvec_renorm_L2(d, nb, xb.data());
+            fvec_renorm_L2(d, nq, xq.data());
+        }
+        IndexFlat ref_index(d, mt);
+        ref_index.add(nb, xb.data());
+        float radius = pick_radius(ref_index, nq, xq.data(), 30);
+
+        RangeSearchResult ref(nq);
+        ref_index.range_search(nq, xq.data(), radius, &ref);
+
+        IndexHNSWFlat index(d, 16, mt);
+        index.add(nb, xb.data());
+        RangeSearchResult res(nq);
+        index.range_search(nq, xq.data(), radius, &res);
+
+        check_distances(res, radius, is_ip);
+        EXPECT_GT(range_recall(ref, res), 0.9);
+
+        // the distances are the exact ones
+        for (size_t i = 0; i < nq; i++) {
+            for (size_t j = res.lims[i]; j < res.lims[i + 1]; j++) {
+                float dref = is_ip ?
+                    fvec_inner_product(xq.data() + i * d,
+                                       xb.data() + res.labels[j] * d, d) :
+                    fvec_L2sqr(xq.data() + i * d,
+                               xb.data() + res.labels[j] * d, d);
+                EXPECT_NEAR(dref, res.distances[j], 1e-4);
+            }
+        }
+
+        index.range_search_max_results = 10;
+        RangeSearchResult capped(nq);
+        index.range_search(nq, xq.data(), radius, &capped);
+        EXPECT_GT(check_capped(res, capped, 10, is_ip), 0.8);
+    }
+}
+
+TEST(RangeSearch, PQ) {
+    size_t d = 16, nb = 3000, nq = 30;
+    std::vector<float> xb = make_data(nb * d, 123);
+    std::vector<float> xq = make_data(nq * d, 456);
+
+    for (MetricType mt: {METRIC_L2, METRIC_INNER_PRODUCT}) {
+        bool is_ip = mt == METRIC_INNER_PRODUCT;
+        for (int nbits: {8, 6}) {
+            IndexPQ index(d, 4, nbits, mt);
+            index.train(nb, xb.data());
+            index.add(nb, xb.data());
+            float radius = pick_radius(index, nq, xq.data(), 20);
+
+            // the results are those of the brute-force search
+            std::vector<float> D(nq * nb);
+            std::vector<idx_t> I(nq * nb);
+            index.search(nq, xq.data(), nb, D.data(), I.data());
+
+            RangeSearchResult res(nq);
+            index.range_search(nq, xq.data(), radius, &res);
+            check_distances(res, radius, is_ip);
+
+            // (up to rounding differences at the radius)
+            float eps = 1e-4;
+            for (size_t i = 0; i < nq; i++) {
+                std::set<idx_t> found = result_set(res, i);
+                for (size_t j = 0; j < nb; j++) {
+                    float margin = is_ip ? D[i * nb + j] - radius :
+                        radius - D[i * nb + j];
+                    if (margin > eps) {
+                        EXPECT_EQ(1, found.count(I[i * nb + j]));
+                    } else if (margin < -eps) {
+                        EXPECT_EQ(0, found.count(I[i * nb + j]));
+                    }
+                }
+            }
+
+            index.range_search_max_results = 5;
+            RangeSearchResult capped(nq);
+            index.range_search(nq, xq.data(), radius, &capped);
+            EXPECT_EQ(1.0, check_capped(res, capped, 5, is_ip));
+            for (size_t i = 0; i < nq; i++) {
+                EXPECT_EQ(std::min(res.lims[i + 1] - res.lims[i], size_t(5)),
+                          capped.lims[i + 1] - capped.lims[i]);
+            }
+        }
+    }
+}
+
+TEST(RangeSearch, streaming_flat) {
+    size_t d = 16, nb = 2000;
+    std::vector<float> xb = make_data(nb * d, 123);
+    std::vector<float> xq = make_data(100 * d, 456);
+
+    for (MetricType mt: {METRIC_L2, METRIC_INNER_PRODUCT}) {
+        IndexFlat index(d, mt);
+        index.add(nb, xb.data());
+        float radius = pick_radius(index, 100, xq.data(), 20);
+        // sequential and BLAS code paths
+        for (size_t nq: {10, 100}) {
+            check_streaming(index, nq, xq.data(), radius);
+        }
+    }
+}
+
+TEST(RangeSearch, streaming_ivf) {
+    size_t d = 16, nb = 2000, nq = 40;
+    std::vector<float> xb = make_data(nb * d, 123);
+    std::vector<float> xq = make_data(nq * d, 456);
+
+    IndexFlatL2 coarse(d);
+    IndexIVFFlat index(&coarse, d, 20);
+    index.train(nb, xb.data());
+    index.add(nb, xb.data());
+    index.nprobe = 4;
+    float radius = pick_radius(index, nq, xq.data(), 20);
+
+    for (int parallel_mode: {0, 1, 2}) {
+        index.parallel_mode = parallel_mode;
+        check_streaming(index, nq, xq.data(), radius);
+    }
+}
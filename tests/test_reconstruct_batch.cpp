@@ -0,0 +1,143 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexIVF.h>
+#include <faiss/IndexScalarQuantizer.h>
+#include <faiss/index_factory.h>
+#include <faiss/utils/random.h>
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 16;
+size_t nt = 2000;
+size_t nb = 3000;
+
+std::vector<float> make_data (size_t n, int seed)
+{
+    std::vector<float> x (n * d);
+    float_rand (x.data(), x.size(), seed);
+    return x;
+}
+
+/// reconstruct_batch must give the same vectors as reconstruct, for
+/// random keys with duplicates
+void test_reconstruct_batch (const char *index_key)
+{
+    std::vector<float> xt = make_data (nt, 1);
+    std::vector<float> xb = make_data (nb, 2);
+
+    std::unique_ptr<Index> index (index_factory (d, index_key));
+    index->train (nt, xt.data());
+    index->add (nb, xb.data());
+    if (auto ivf = dynamic_cast<IndexIVF*> (index.get())) {
+        ivf->make_direct_map ();
+    }
+
+    // large enough to run in parallel
+    idx_t n = 2500;
+    std::vector<idx_t> keys (n);
+    std::mt19937 rng (123);
+    for (idx_t i = 0; i < n; i++) {
+        keys[i] = rng() % nb;
+    }
+
+    std::vector<float> ref (n * d), recons (n * d);
+    for (idx_t i = 0; i < n; i++) {
+        index->reconstruct (keys[i], ref.data() + i * d);
+    }
+    index->reconstruct_batch (n, keys.data(), recons.data());
+    EXPECT_EQ (ref, recons);
+
+    // small batch
+    index->reconstruct_batch (3, keys.data(), recons.data());
+    EXPECT_EQ (std::vector<float> (ref.begin(), ref.begin() + 3 * d),
+               std::vector<float> (recons.begin(),
+                                   recons.begin() + 3 * d));
+}
+
+} // namespace
+
+
+TEST(ReconstructBatch, Flat) {
+    test_reconstruct_batch ("Flat");
+}
+
+TEST(ReconstructBatch, PQ) {
+    test_reconstruct_batch ("PQ4x4");
+}
+
+TEST(ReconstructBatch, SQ8) {
+    test_reconstruct_batch ("SQ8");
+}
+
+TEST(ReconstructBatch, HNSW) {
+    test_reconstruct_batch ("HNSW16");
+}
+
+TEST(ReconstructBatch, PCA_Flat) {
+    test_reconstruct_batch ("PCA16,Flat");
+}
+
+TEST(ReconstructBatch, IVFFlat) {
+    test_reconstruct_batch ("IVF16,Flat");
+}
+
+TEST(ReconstructBatch, IVFSQ8) {
+    test_reconstruct_batch ("IVF16,SQ8");
+}
+
+TEST(ReconstructBatch, IVFSQ8_no_residual) {
+    std::vector<float> xt = make_data (nt, 1);
+    std::vector<float> xb = make_data (nb, 2);
+    std::unique_ptr<Index> index (index_factory (d, "IVF16,SQ8"));
+    auto ivf = dynamic_cast<IndexIVFScalarQuantizer*> (index.get());
+    ivf->by_residual = false;
+    index->train (nt, xt.data());
+    index->add (nb, xb.data());
+    ivf->make_direct_map ();
+
+    // the codes encode the vectors, not the residuals
+    std::vector<float> recons (nb * d);
+    std::vector<idx_t> keys (nb);
+    for (idx_t i = 0; i < nb; i++) {
+        keys[i] = i;
+    }
+    index->reconstruct_batch (nb, keys.data(), recons.data());
+    for (size_t i = 0; i < nb * d; i++) {
+        EXPECT_NEAR (recons[i], xb[i], 0.01);
+    }
+    std::vector<float> x1 (d);
+    index->reconstruct (nb - 1, x1.data());
+    EXPECT_EQ (x1, std::vector<float> (recons.end() - d, recons.end()));
+}
+
+TEST(ReconstructBatch, IVFPQ) {
+    // default per-entry reconstruct_from_offsets
+    test_reconstruct_batch ("IVF16,PQ4x4");
+}
+
+TEST(ReconstructBatch, IVF_missing_id) {
+    std::vector<float> xt = make_data (nt, 1);
+    std::unique_ptr<Index> index (index_factory (d, "IVF16,Flat"));
+    index->train (nt, xt.data());
+    index->add (nb, xt.data());
+    dynamic_cast<IndexIVF*> (index.get())->make_direct_map ();
+    idx_t keys[2] = {1, (idx_t)nb + 10};
+    std::vector<float> recons (2 * d);
+    EXPECT_THROW (index->reconstruct_batch (2, keys, recons.data()),
+                  FaissException);
+}
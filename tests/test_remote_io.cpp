@@ -0,0 +1,193 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#include <memory>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexIVF.h>
+#include <faiss/IVFlib.h>
+#include <faiss/RemoteInvertedLists.h>
+#include <faiss/index_factory.h>
+#include <faiss/index_io.h>
+#include <faiss/impl/FaissException.h>
+#include <faiss/impl/RangeIOReader.h>
+#include <faiss/impl/io.h>
+
+
+namespace {
+
+typedef faiss::Index::idx_t idx_t;
+
+struct Tempfilename {
+
+    static pthread_mutex_t mutex;
+
+    std::string filename;
+
+    Tempfilename (const char *prefix = nullptr) {
+        pthread_mutex_lock (&mutex);
+        char *cfname = tempnam (nullptr, prefix);
+        filename = cfname;
+        free(cfname);
+        pthread_mutex_unlock (&mutex);
+    }
+
+    ~Tempfilename () {
+        if (access (filename.c_str(), F_OK) == 0) {
+            unlink (filename.c_str());
+        }
+    }
+
+    const char *c_str() {
+        return filename.c_str();
+    }
+
+};
+
+pthread_mutex_t Tempfilename::mutex = PTHREAD_MUTEX_INITIALIZER;
+
+int d = 32;
+size_t nb = 2000;
+size_t nq = 20;
+int k = 5;
+
+std::vector<float> make_data (size_t n, int seed)
+{
+    std::vector<float> x (n * d);
+    std::mt19937 rng (seed);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < x.size(); i++) {
+        x[i] = distrib (rng);
+    }
+    return x;
+}
+
+std::unique_ptr<faiss::Index> make_index (const char *key)
+{
+    std::vector<float> xb = make_data (nb, 1);
+    std::unique_ptr<faiss::Index> index (faiss::index_factory (d, key));
+    index->train (nb, xb.data());
+    index->add (nb, xb.data());
+    return index;
+}
+
+void compare_search (const faiss::Index & ref, const faiss::Index & index)
+{
+    std::vector<float> xq = make_data (nq, 2);
+    std::vector<float> D_ref (nq * k), D (nq * k);
+    std::vector<idx_t> I_ref (nq * k), I (nq * k);
+    ref.search (nq, xq.data(), k, D_ref.data(), I_ref.data());
+    index.search (nq, xq.data(), k, D.data(), I.data());
+    EXPECT_EQ (I, I_ref);
+    EXPECT_EQ (D, D_ref);
+}
+
+/// fails all the reads after the first nok ones
+struct FailingRangeSource: faiss::FileRangeSource {
+    int nok;
+
+    FailingRangeSource (const char *fname, int nok):
+        faiss::FileRangeSource (fname), nok (nok) {}
+
+    void read_range (size_t offset, size_t nbytes, void *dst) override {
+        if (__sync_fetch_and_sub (&nok, 1) <= 0) {
+            FAISS_THROW_MSG ("simulated network error");
+        }
+        faiss::FileRangeSource::read_range (offset, nbytes, dst);
+    }
+};
+
+}  // namespace
+
+
+TEST(RemoteIO, range_reader) {
+    for (const char *key : {"Flat", "IVF16,Flat", "HNSW16"}) {
+        Tempfilename tmp;
+        std::unique_ptr<faiss::Index> index = make_index (key);
+        faiss::write_index (index.get(), tmp.c_str());
+
+        faiss::FileRangeSource source (tmp.c_str());
+        // small blocks, so that many are in flight
+        faiss::RangeIOReader reader (&source, 4, 4096);
+        std::unique_ptr<faiss::Index> index2 (faiss::read_index (&reader));
+        compare_search (*index, *index2);
+        EXPECT_EQ (source.size(), reader.offset);
+    }
+}
+
+TEST(RemoteIO, remote_invlists) {
+    Tempfilename tmp, tmp_cache;
+    std::unique_ptr<faiss::Index> index = make_index ("IVF16,SQ8");
+    faiss::ivflib::extract_index_ivf (index.get())->nprobe = 3;
+    faiss::write_index (index.get(), tmp.c_str());
+
+    for (bool use_cache_file : {false, true}) {
+        faiss::FileRangeSource source (tmp.c_str());
+        faiss::RangeIOReader reader (&source, 4, 4096);
+        if (use_cache_file) {
+            reader.invlists_cache_filename = tmp_cache.filename;
+        }
+        std::unique_ptr<faiss::Index> index2 (
+              faiss::read_index (&reader, faiss::IO_FLAG_REMOTE_INVLISTS));
+        // the reader skipped the inverted lists
+        EXPECT_EQ (source.size(), reader.offset);
+
+        faiss::IndexIVF *ivf = faiss::ivflib::extract_index_ivf (index2.get());
+        auto *ril = dynamic_cast<faiss::RemoteInvertedLists*> (ivf->invlists);
+        ASSERT_TRUE (ril);
+        EXPECT_EQ (0, ril->nfetch_lists ());
+
+        // only the visited lists are fetched
+        compare_search (*index, *index2);
+        size_t nfetch = ril->nfetch_lists ();
+        EXPECT_GT (nfetch, 0);
+        EXPECT_LE (nfetch, 16);
+        compare_search (*index, *index2);
+        EXPECT_EQ (nfetch, ril->nfetch_lists ());
+
+        // writing fetches all lists, the file is the same
+        faiss::VectorIOWriter writer;
+        faiss::write_index (index2.get(), &writer);
+        faiss::VectorIOWriter writer_ref;
+        faiss::write_index (index.get(), &writer_ref);
+        EXPECT_EQ (writer_ref.data, writer.data);
+        for (size_t i = 0; i < 16; i++) {
+            EXPECT_TRUE (ril->is_cached (i) || ril->list_size (i) == 0);
+        }
+    }
+}
+
+TEST(RemoteIO, errors) {
+    Tempfilename tmp;
+    std::unique_ptr<faiss::Index> index = make_index ("IVF16,Flat");
+    faiss::write_index (index.get(), tmp.c_str());
+
+    {
+        FailingRangeSource source (tmp.c_str(), 2);
+        faiss::RangeIOReader reader (&source, 2, 4096);
+        EXPECT_THROW (faiss::read_index (&reader), faiss::FaissException);
+    }
+
+    // the fetch of a list fails, then succeeds when retried
+    FailingRangeSource source (tmp.c_str(), 1000000);
+    faiss::RangeIOReader reader (&source, 2, 4096);
+    std::unique_ptr<faiss::Index> index2 (
+          faiss::read_index (&reader, faiss::IO_FLAG_REMOTE_INVLISTS));
+    faiss::IndexIVF *ivf = faiss::ivflib::extract_index_ivf (index2.get());
+    source.nok = 0;
+    EXPECT_THROW (ivf->invlists->get_codes (0), faiss::FaissException);
+    source.nok = 1000000;
+    compare_search (*index, *index2);
+}
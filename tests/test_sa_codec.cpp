@@ -0,0 +1,120 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstring>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/Index.h>
+#include <faiss/index_factory.h>
+#include <faiss/sa_codec.h>
+#include <faiss/utils/random.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 32;
+size_t nt = 2000;
+size_t nb = 2500;
+
+/// the chunked and streaming variants give the same codes as sa_encode
+void test_codec(const char *index_key, bool check_reconstruct)
+{
+    std::vector<float> xt(nt * d), xb(nb * d);
+    float_rand(xt.data(), xt.size(), 1);
+    float_rand(xb.data(), xb.size(), 2);
+
+    std::unique_ptr<Index> index(index_factory(d, index_key));
+    index->train(nt, xt.data());
+
+    size_t cs = index->sa_code_size();
+    ASSERT_GT(cs, 0);
+    std::vector<uint8_t> codes(nb * cs);
+    index->sa_encode(nb, xb.data(), codes.data());
+    std::vector<float> dec(nb * d);
+    index->sa_decode(nb, codes.data(), dec.data());
+
+    std::vector<uint8_t> codes2(nb * cs);
+    sa_encode_chunked(index.get(), nb, xb.data(), codes2.data(), 333);
+    EXPECT_EQ(codes, codes2);
+
+    std::vector<float> dec2(nb * d);
+    sa_decode_chunked(index.get(), nb, codes.data(), dec2.data(), 333);
+    EXPECT_EQ(dec, dec2);
+
+    // stream the vectors by reads of irregular sizes
+    size_t nread = 0;
+    std::vector<uint8_t> codes3;
+    size_t ntotal = sa_encode_stream(
+          index.get(), 400,
+          [&](idx_t chunk_size, float *x) {
+              size_t ni = std::min(nb - nread, size_t(chunk_size) - 7);
+              memcpy(x, xb.data() + nread * d, ni * d * sizeof(float));
+              nread += ni;
+              return idx_t(ni);
+          },
+          [&](idx_t n, const uint8_t *bytes) {
+              codes3.insert(codes3.end(), bytes, bytes + n * cs);
+          });
+    EXPECT_EQ(ntotal, nb);
+    EXPECT_EQ(codes, codes3);
+
+    if (check_reconstruct) {
+        // the codec reconstructs like the index
+        index->add(nb, xb.data());
+        std::vector<float> rec(d);
+        for (idx_t i = 0; i < nb; i += 97) {
+            index->reconstruct(i, rec.data());
+            for (int j = 0; j < d; j++) {
+                EXPECT_FLOAT_EQ(rec[j], dec[i * d + j]);
+            }
+        }
+    }
+}
+
+} // namespace
+
+
+TEST(SACodec, PQ) {
+    test_codec("PQ8x4", true);
+}
+
+TEST(SACodec, IVFFlat) {
+    test_codec("IVF16,Flat", false);
+}
+
+TEST(SACodec, IVFPQ) {
+    test_codec("IVF16,PQ8x4", false);
+}
+
+TEST(SACodec, PCA_SQ) {
+    test_codec("PCA16,SQ8", false);
+}
+
+TEST(SACodec, HNSWFlat) {
+    test_codec("HNSW16", true);
+}
+
+TEST(SACodec, HNSWSQ) {
+    test_codec("HNSW16_SQ8", true);
+}
+
+TEST(SACodec, Refine) {
+    test_codec("PQ4x4,Refine(SQ8)", true);
+}
+
+TEST(SACodec, RFlat) {
+    test_codec("PQ4x4,RFlat", false);
+}
@@ -0,0 +1,144 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <faiss/impl/FaissException.h>
+#include <faiss/impl/io.h>
+#include <faiss/utils/random.h>
+#include <faiss/utils/utils.h>
+
+
+namespace {
+
+struct Tempfilename {
+
+    static pthread_mutex_t mutex;
+
+    std::string filename;
+
+    Tempfilename (const char *prefix = nullptr) {
+        pthread_mutex_lock (&mutex);
+        char *cfname = tempnam (nullptr, prefix);
+        filename = cfname;
+        free(cfname);
+        pthread_mutex_unlock (&mutex);
+    }
+
+    ~Tempfilename () {
+        if (access (filename.c_str(), F_OK) == 0) {
+            unlink (filename.c_str());
+        }
+    }
+
+    const char *c_str() {
+        return filename.c_str();
+    }
+
+};
+
+pthread_mutex_t Tempfilename::mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void check_subset (const std::vector<int64_t> & subset, size_t n)
+{
+    for (size_t i = 0; i < subset.size(); i++) {
+        ASSERT_GE (subset[i], 0);
+        ASSERT_LT (subset[i], n);
+        if (i > 0) {
+            ASSERT_LT (subset[i - 1], subset[i]);
+        }
+    }
+}
+
+}  // namespace
+
+
+TEST(Sampling, rand_subset) {
+    size_t n = 100;
+    for (size_t k : {0, 1, 10, 50, 51, 99, 100}) {
+        // each element should be sampled with probability k / n
+        std::vector<int> count (n);
+        int nrun = 2000;
+        for (int run = 0; run < nrun; run++) {
+            std::vector<int64_t> subset (k);
+            faiss::rand_subset (subset.data(), n, k, run);
+            check_subset (subset, n);
+            for (int64_t i : subset) {
+                count[i]++;
+            }
+        }
+        double expected = double(nrun) * k / n;
+        for (size_t i = 0; i < n; i++) {
+            EXPECT_NEAR (expected, count[i], 5 * sqrt (expected) + 1e-6);
+        }
+    }
+
+    // large n, where a permutation would be too expensive
+    size_t nbig = size_t(1) << 40;
+    std::vector<int64_t> subset (100000);
+    faiss::rand_subset (subset.data(), nbig, subset.size(), 123);
+    check_subset (subset, nbig);
+
+    std::vector<int64_t> subset2 (subset.size());
+    faiss::rand_subset (subset2.data(), nbig, subset.size(), 123);
+    EXPECT_EQ (subset, subset2);
+
+    EXPECT_THROW (faiss::rand_subset (subset.data(), 10, 11, 1),
+                  faiss::FaissException);
+}
+
+TEST(Sampling, read_rows_subset) {
+    size_t n = 5000, line_size = 12;
+    std::vector<uint8_t> x (n * line_size);
+    faiss::byte_rand (x.data(), x.size(), 1);
+    // a row after the data
+    x.push_back (123);
+
+    std::vector<int64_t> subset (300);
+    faiss::rand_subset (subset.data(), n, subset.size(), 2);
+    std::vector<uint8_t> ref (subset.size() * line_size);
+    faiss::gather_rows (line_size, x.data(), subset.data(), subset.size(),
+                        ref.data());
+    for (size_t i = 0; i < subset.size(); i++) {
+        ASSERT_EQ (0, memcmp (ref.data() + i * line_size,
+                              x.data() + subset[i] * line_size, line_size));
+    }
+
+    Tempfilename tmp;
+    {
+        faiss::FileIOWriter writer (tmp.c_str());
+        writer (x.data(), 1, x.size());
+    }
+
+    for (bool use_file : {false, true}) {
+        faiss::VectorIOReader vreader;
+        vreader.data = x;
+        faiss::FileIOReader freader (tmp.c_str());
+        faiss::IOReader *reader = use_file ?
+            static_cast<faiss::IOReader*>(&freader) : &vreader;
+
+        std::vector<uint8_t> out (ref.size());
+        faiss::read_rows_subset (reader, line_size, subset.data(),
+                                 subset.size(), out.data());
+        EXPECT_EQ (ref, out);
+
+        // the reader is just after the last sampled row
+        size_t pos = (subset.back() + 1) * line_size;
+        std::vector<uint8_t> rest (x.size() - pos);
+        EXPECT_EQ (rest.size(), (*reader) (rest.data(), 1, rest.size()));
+        EXPECT_EQ (123, rest.back());
+    }
+}
@@ -0,0 +1,149 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexHNSW.h>
+#include <faiss/IndexIVFPQ.h>
+#include <faiss/utils/scratch.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+size_t d = 32;
+
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> u;
+    std::vector<float> x(n * d);
+    for (float & v: x) {
+        v = u(rng);
+    }
+    return x;
+}
+
+struct Results {
+    std::vector<float> D;
+    std::vector<idx_t> I;
+
+    Results(const Index & index, size_t nq, const float *xq, idx_t k):
+        D(nq * k), I(nq * k)
+    {
+        index.search(nq, xq, k, D.data(), I.data());
+    }
+};
+
+} // namespace
+
+
+TEST(Scratch, buffers) {
+    const void *p0, *p1;
+    {
+        ScratchBuffer b0;
+        p0 = b0.get<float>(1000);
+        // nested buffers are distinct
+        ScratchBuffer b1;
+        p1 = b1.get<idx_t>(1000);
+        EXPECT_NE(p0, p1);
+        // smaller sizes do not reallocate
+        EXPECT_EQ(p0, b0.get<float>(500));
+    }
+    {
+        // the buffers are reused
+        ScratchBuffer b0;
+        ScratchBuffer b1;
+        const void *q0 = b0.get<float>(1000);
+        const void *q1 = b1.get<float>(1000);
+        EXPECT_TRUE((q0 == p0 && q1 == p1) || (q0 == p1 && q1 == p0));
+    }
+
+    // too large to be kept, this just frees the buffer
+    size_t max_kept = scratch_max_kept_bytes;
+    scratch_max_kept_bytes = 1024;
+    {
+        ScratchBuffer b0;
+        b0.get<float>(1000);
+    }
+    scratch_max_kept_bytes = max_kept;
+
+    // buffers can be released in another thread
+    std::unique_ptr<ScratchBuffer> b(new ScratchBuffer());
+    b->get<float>(100);
+    std::thread t([&b] { b.reset(); });
+    t.join();
+}
+
+
+TEST(Scratch, ivfpq_repeated_search) {
+    size_t nb = 5000, nq = 40, nlist = 32;
+    idx_t k = 10;
+    std::vector<float> xb = make_data(nb, 1);
+    std::vector<float> xq = make_data(nq, 2);
+
+    IndexFlatL2 quantizer(d);
+    IndexIVFPQ index(&quantizer, d, nlist, 8, 8);
+    index.train(nb, xb.data());
+    index.add(nb, xb.data());
+    index.nprobe = 8;
+
+    for (int precomputed: {0, 1}) {
+        for (int ht: {0, 20}) {
+            index.use_precomputed_table = precomputed;
+            index.precompute_table();
+            index.polysemous_ht = ht;
+            // in a new thread, that has no scratch buffers yet
+            std::unique_ptr<Results> ref;
+            std::thread t([&] {
+                ref.reset(new Results(index, nq, xq.data(), k));
+            });
+            t.join();
+            for (int rep = 0; rep < 2; rep++) {
+                Results res(index, nq, xq.data(), k);
+                EXPECT_EQ(ref->I, res.I);
+                EXPECT_EQ(ref->D, res.D);
+                // leaves other contents in the buffers
+                Results res_small(index, 3, xq.data(), k);
+            }
+        }
+    }
+}
+
+
+TEST(Scratch, hnsw_different_sizes) {
+    size_t nq = 20;
+    idx_t k = 5;
+    std::vector<float> xq = make_data(nq, 2);
+
+    IndexHNSWFlat small(d, 16), large(d, 16);
+    std::vector<float> xb = make_data(3000, 1);
+    small.add(500, xb.data());
+    large.add(3000, xb.data());
+
+    Results ref_small(small, nq, xq.data(), k);
+    Results ref_large(large, nq, xq.data(), k);
+
+    // the visited tables are shared between the two indexes
+    for (int rep = 0; rep < 3; rep++) {
+        Results res_large(large, nq, xq.data(), k);
+        Results res_small(small, nq, xq.data(), k);
+        EXPECT_EQ(ref_small.I, res_small.I);
+        EXPECT_EQ(ref_small.D, res_small.D);
+        EXPECT_EQ(ref_large.I, res_large.I);
+        EXPECT_EQ(ref_large.D, res_large.D);
+    }
+}
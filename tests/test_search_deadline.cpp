@@ -0,0 +1,173 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexHNSW.h>
+#include <faiss/IndexIVF.h>
+#include <faiss/IndexShards.h>
+#include <faiss/index_factory.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/FaissException.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 32;
+size_t nt = 3000;
+size_t nb = 5000;
+size_t nq = 40;
+idx_t k = 10;
+
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector<float> x(n * d);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < n * d; i++) {
+        x[i] = distrib(rng);
+    }
+    return x;
+}
+
+/// flat index whose search fails
+struct FailingIndex: IndexFlatL2 {
+    explicit FailingIndex(int d): IndexFlatL2(d) {}
+
+    void search(idx_t, const float *, idx_t, float *, idx_t *,
+                const SearchParameters * = nullptr) const override {
+        FAISS_THROW_MSG("shard unavailable");
+    }
+};
+
+} // namespace
+
+
+TEST(SearchDeadline, IVF) {
+    std::vector<float> xt = make_data(nt, 1);
+    std::vector<float> xb = make_data(nb, 2);
+    std::vector<float> xq = make_data(nq, 3);
+
+    std::unique_ptr<Index> index(index_factory(d, "IVF32,Flat"));
+    IndexIVF *ivf = dynamic_cast<IndexIVF*>(index.get());
+    ivf->train(nt, xt.data());
+    ivf->add(nb, xb.data());
+
+    std::vector<float> Dref(nq * k), D(nq * k);
+    std::vector<idx_t> Iref(nq * k), I(nq * k);
+    std::vector<uint8_t> truncated(nq, 0);
+
+    IVFSearchParameters params;
+    params.nprobe = 1;
+    ivf->search(nq, xq.data(), k, Dref.data(), Iref.data(), &params);
+
+    // an expired deadline: only the first list is scanned
+    params.nprobe = 8;
+    params.deadline_ms = 1;
+    params.truncated = truncated.data();
+    indexIVF_stats.reset();
+    ivf->search(nq, xq.data(), k, D.data(), I.data(), &params);
+    EXPECT_EQ(I, Iref);
+    EXPECT_EQ(D, Dref);
+    EXPECT_EQ(truncated, std::vector<uint8_t>(nq, 1));
+    EXPECT_EQ(indexIVF_stats.ntruncated, nq);
+
+    // a generous budget does not change the results
+    ivf->nprobe = 8;
+    ivf->search(nq, xq.data(), k, Dref.data(), Iref.data());
+    params.set_time_budget(1e6);
+    truncated.assign(nq, 0);
+    ivf->search(nq, xq.data(), k, D.data(), I.data(), &params);
+    EXPECT_EQ(I, Iref);
+    EXPECT_EQ(truncated, std::vector<uint8_t>(nq, 0));
+}
+
+
+TEST(SearchDeadline, HNSW) {
+    std::vector<float> xb = make_data(nb, 2);
+    std::vector<float> xq = make_data(nq, 3);
+
+    IndexHNSWFlat index(d, 16);
+    index.add(nb, xb.data());
+
+    std::vector<float> D(nq * k);
+    std::vector<idx_t> I(nq * k);
+    std::vector<uint8_t> truncated(nq, 0);
+
+    SearchParametersHNSW params;
+    params.efSearch = 256;
+    params.deadline_ms = 1;
+    params.truncated = truncated.data();
+    hnsw_stats.reset();
+    index.search(nq, xq.data(), k, D.data(), I.data(), &params);
+    EXPECT_EQ(truncated, std::vector<uint8_t>(nq, 1));
+    EXPECT_EQ(hnsw_stats.ntruncated, nq);
+
+    // the partial results are valid and sorted
+    for (size_t i = 0; i < nq; i++) {
+        for (idx_t j = 0; j < k; j++) {
+            ASSERT_GE(I[i * k + j], 0);
+            ASSERT_LT(I[i * k + j], nb);
+            if (j > 0) {
+                EXPECT_LE(D[i * k + j - 1], D[i * k + j]);
+            }
+        }
+    }
+
+    params.set_time_budget(1e6);
+    truncated.assign(nq, 0);
+    index.search(nq, xq.data(), k, D.data(), I.data(), &params);
+    EXPECT_EQ(truncated, std::vector<uint8_t>(nq, 0));
+}
+
+
+TEST(SearchDeadline, shards) {
+    std::vector<float> xt = make_data(nt, 1);
+    std::vector<float> xb = make_data(nb, 2);
+    std::vector<float> xq = make_data(nq, 3);
+
+    std::unique_ptr<Index> shard0(index_factory(d, "IVF16,Flat"));
+    shard0->train(nt, xt.data());
+    shard0->add(nb, xb.data());
+    FailingIndex shard1(d);
+
+    std::vector<float> Dref(nq * k), D(nq * k);
+    std::vector<idx_t> Iref(nq * k), I(nq * k);
+    IVFSearchParameters params;
+    params.nprobe = 4;
+    shard0->search(nq, xq.data(), k, Dref.data(), Iref.data(), &params);
+
+    for (bool threaded: {false, true}) {
+        IndexShards shards(d, threaded, false);
+        shards.add_shard(shard0.get());
+        shards.add_shard(&shard1);
+
+        params.deadline_ms = 0;
+        params.truncated = nullptr;
+        EXPECT_THROW(shards.search(nq, xq.data(), k, D.data(), I.data(),
+                                   &params),
+                     FaissException);
+
+        // with a deadline, the results of the shards that answered
+        std::vector<uint8_t> truncated(nq, 0);
+        params.set_time_budget(1e6);
+        params.truncated = truncated.data();
+        shards.search(nq, xq.data(), k, D.data(), I.data(), &params);
+        EXPECT_EQ(I, Iref);
+        EXPECT_EQ(D, Dref);
+        EXPECT_EQ(truncated, std::vector<uint8_t>(nq, 1));
+    }
+}
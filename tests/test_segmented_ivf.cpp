@@ -0,0 +1,180 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVFFlat.h>
+#include <faiss/IndexSegmentedIVF.h>
+#include <faiss/impl/AuxIndexStructures.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+size_t d = 16;
+size_t nlist = 20;
+idx_t k = 10;
+
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> u;
+    std::vector<float> x(n * d);
+    for (float & v: x) {
+        v = u(rng);
+    }
+    return x;
+}
+
+struct TestData {
+    size_t nb = 3000, nq = 50;
+    std::vector<float> xb = make_data(nb, 1);
+    std::vector<float> xq = make_data(nq, 2);
+
+    IndexFlatL2 quantizer;
+    IndexIVFFlat ref;   ///< reference with all the vectors in one index
+    IndexIVFFlat tmpl;  ///< template for the segments
+
+    TestData(): quantizer(d), ref(&quantizer, d, nlist),
+                tmpl(&quantizer, d, nlist)
+    {
+        ref.train(nb, xb.data());
+        tmpl.is_trained = true;
+        ref.nprobe = tmpl.nprobe = 5;
+    }
+
+    void check_same(const Index & index) {
+        std::vector<float> Dref(nq * k), D(nq * k);
+        std::vector<idx_t> Iref(nq * k), I(nq * k);
+        ref.search(nq, xq.data(), k, Dref.data(), Iref.data());
+        index.search(nq, xq.data(), k, D.data(), I.data());
+        EXPECT_EQ(Iref, I);
+        // the reference may compute the distances with another kernel
+        for (size_t i = 0; i < nq * k; i++) {
+            EXPECT_NEAR(Dref[i], D[i], 1e-5);
+        }
+    }
+};
+
+} // namespace
+
+
+TEST(SegmentedIVF, add_and_merge) {
+    TestData td;
+    td.ref.add(td.nb, td.xb.data());
+
+    IndexSegmentedIVF index(&td.tmpl, 200, 3, false);
+    // batches that do not align with the segments
+    for (size_t i0 = 0; i0 < td.nb; ) {
+        size_t i1 = std::min(td.nb, i0 + 1 + i0 % 317);
+        index.add(i1 - i0, td.xb.data() + i0 * d);
+        i0 = i1;
+    }
+    EXPECT_EQ(index.ntotal, td.nb);
+    td.check_same(index);
+
+    // less than merge_factor segments per tier
+    std::vector<int> tier_count(10);
+    for (size_t s: index.sealed_segment_sizes()) {
+        int tier = 0;
+        for (size_t s1 = 200 * 3; s >= s1; s1 *= 3) {
+            tier++;
+        }
+        tier_count[tier]++;
+    }
+    for (int c: tier_count) {
+        EXPECT_LT(c, 3);
+    }
+
+    index.merge_all();
+    EXPECT_EQ(index.sealed_segment_sizes(),
+              std::vector<size_t>({td.nb}));
+    td.check_same(index);
+}
+
+
+TEST(SegmentedIVF, remove) {
+    TestData td;
+    td.ref.add(td.nb, td.xb.data());
+
+    IndexSegmentedIVF index(&td.tmpl, 500, 2, false);
+    index.add(td.nb, td.xb.data());
+
+    // in sealed segments and in the write segment
+    IDSelectorRange sel(400, 2800);
+    EXPECT_EQ(td.ref.remove_ids(sel), 2400);
+    EXPECT_EQ(index.remove_ids(sel), 2400);
+    EXPECT_EQ(index.remove_ids(sel), 0);
+    EXPECT_EQ(index.ntotal, td.nb - 2400);
+    EXPECT_EQ(index.ntombstones(), 2400);
+    td.check_same(index);
+
+    // re-add some of the removed vectors
+    std::vector<idx_t> ids = {2900, 2950, 450};
+    std::vector<float> x;
+    for (idx_t id: ids) {
+        x.insert(x.end(), td.xb.begin() + id * d, td.xb.begin() + (id + 1) * d);
+    }
+    index.add_with_ids(3, x.data(), ids.data());
+    td.ref.add_with_ids(3, x.data(), ids.data());
+    td.check_same(index);
+
+    index.merge_all();
+    EXPECT_EQ(index.ntombstones(), 0);
+    EXPECT_EQ(index.sealed_segment_sizes(),
+              std::vector<size_t>({td.nb - 2400 + 3}));
+    td.check_same(index);
+}
+
+
+TEST(SegmentedIVF, background_merge) {
+    TestData td;
+    td.ref.add(td.nb, td.xb.data());
+
+    IndexSegmentedIVF index(&td.tmpl, 100, 2, true);
+
+    // searches run concurrently with the adds and the merges
+    std::thread writer([&] {
+        for (size_t i0 = 0; i0 < td.nb; i0 += 50) {
+            index.add(50, td.xb.data() + i0 * d);
+        }
+    });
+    std::vector<float> D(td.nq * k);
+    std::vector<idx_t> I(td.nq * k);
+    for (int i = 0; i < 20; i++) {
+        index.search(td.nq, td.xq.data(), k, D.data(), I.data());
+        for (size_t q = 0; q < td.nq; q++) {
+            // a vector is never seen in two segments
+            std::vector<idx_t> Iq(I.begin() + q * k, I.begin() + (q + 1) * k);
+            std::sort(Iq.begin(), Iq.end());
+            for (idx_t j = 1; j < k; j++) {
+                EXPECT_TRUE(Iq[j] == -1 || Iq[j] != Iq[j - 1]);
+            }
+        }
+    }
+    writer.join();
+    index.wait_for_merges();
+
+    EXPECT_EQ(index.ntotal, td.nb);
+    size_t total = 0;
+    for (size_t s: index.sealed_segment_sizes()) {
+        total += s;
+    }
+    EXPECT_EQ(total, td.nb);
+    // at most one segment per tier
+    EXPECT_LE(index.sealed_segment_sizes().size(), 5);
+    td.check_same(index);
+}
@@ -0,0 +1,176 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVFFlat.h>
+#include <faiss/IndexShardsIVF.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/random.h>
+#include <faiss/utils/utils.h>
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+int d = 32;
+size_t nlist = 32;
+size_t nt = 3000;
+size_t nb = 4000;
+size_t nq = 50;
+int k = 10;
+int nshard = 3;
+
+std::vector<float> make_data (size_t n, int seed)
+{
+    std::vector<float> x (n * d);
+    float_randn (x.data(), x.size(), seed);
+    return x;
+}
+
+/// counts the vectors searched in the quantizer
+struct CountingFlat: IndexFlatL2 {
+    mutable size_t nsearch = 0;
+
+    explicit CountingFlat (idx_t d): IndexFlatL2 (d) {}
+
+    void search (idx_t n, const float *x, idx_t k,
+                 float *distances, idx_t *labels,
+                 const SearchParameters *params = nullptr) const override {
+        nsearch += n;
+        IndexFlatL2::search (n, x, k, distances, labels, params);
+    }
+};
+
+} // namespace
+
+
+TEST(ShardsIVF, same_as_single_index) {
+    std::vector<float> xt = make_data (nt, 1);
+    std::vector<float> xb = make_data (nb, 2);
+    std::vector<float> xq = make_data (nq, 3);
+
+    // reference: one IVF index with all the vectors
+    IndexFlatL2 quantizer_ref (d);
+    IndexIVFFlat ref (&quantizer_ref, d, nlist);
+    ref.train (nt, xt.data());
+    ref.add (nb, xb.data());
+    ref.nprobe = 5;
+
+    CountingFlat quantizer (d);
+    IndexShardsIVF shards (&quantizer, nlist, false, true);
+    std::vector<std::unique_ptr<IndexIVFFlat> > sub;
+    for (int i = 0; i < nshard; i++) {
+        // each shard has its own empty quantizer
+        sub.emplace_back (new IndexIVFFlat (new IndexFlatL2 (d), d, nlist));
+        sub.back()->own_fields = true;
+        sub.back()->nprobe = 5;
+        shards.add_shard (sub.back().get());
+    }
+    shards.train (nt, xt.data());
+    EXPECT_TRUE (shards.is_trained);
+    EXPECT_EQ (quantizer.ntotal, nlist);
+    for (int i = 0; i < nshard; i++) {
+        EXPECT_EQ (sub[i]->quantizer->ntotal, nlist);
+    }
+    shards.add (nb, xb.data());
+    EXPECT_EQ (shards.ntotal, nb);
+
+    std::vector<float> Dref (nq * k), D (nq * k);
+    std::vector<idx_t> Iref (nq * k), I (nq * k);
+    ref.search (nq, xq.data(), k, Dref.data(), Iref.data());
+
+    quantizer.nsearch = 0;
+    shards.search (nq, xq.data(), k, D.data(), I.data());
+    // the coarse quantization is done once for all shards
+    EXPECT_EQ (quantizer.nsearch, nq);
+
+    EXPECT_EQ (I, Iref);
+    for (size_t i = 0; i < nq * k; i++) {
+        EXPECT_NEAR (D[i], Dref[i], 1e-5 * Dref[i]);
+    }
+
+    // nprobe from the search parameters
+    IVFSearchParameters params;
+    params.nprobe = 12;
+    ref.search (nq, xq.data(), k, Dref.data(), Iref.data(), &params);
+    shards.search (nq, xq.data(), k, D.data(), I.data(), &params);
+    EXPECT_EQ (I, Iref);
+}
+
+TEST(ShardsIVF, shared_quantizer_from_shard) {
+    std::vector<float> xt = make_data (nt, 1);
+    std::vector<float> xb = make_data (nb, 2);
+    std::vector<float> xq = make_data (nq, 3);
+
+    // trained shards, eg. read from disk
+    IndexFlatL2 q0 (d), q1 (d);
+    IndexIVFFlat s0 (&q0, d, nlist);
+    s0.train (nt, xt.data());
+    s0.add (nb / 2, xb.data());
+    q1.add (nlist, q0.xb.data());
+    IndexIVFFlat s1 (&q1, d, nlist);
+    s1.train (nt, xt.data());
+    s1.add_with_ids (nb - nb / 2, xb.data() + nb / 2 * d, nullptr);
+    s0.nprobe = s1.nprobe = 4;
+
+    // the empty quantizer is filled with the centroids of s0
+    IndexFlatL2 quantizer (d);
+    IndexShardsIVF shards (&quantizer, nlist, true, true);
+    shards.add_shard (&s0);
+    shards.add_shard (&s1);
+    EXPECT_EQ (quantizer.ntotal, nlist);
+    EXPECT_TRUE (shards.is_trained);
+
+    IndexShards ref (d, false, true);
+    ref.add_shard (&s0);
+    ref.add_shard (&s1);
+
+    std::vector<float> Dref (nq * k), D (nq * k);
+    std::vector<idx_t> Iref (nq * k), I (nq * k);
+    ref.search (nq, xq.data(), k, Dref.data(), Iref.data());
+    shards.search (nq, xq.data(), k, D.data(), I.data());
+    EXPECT_EQ (I, Iref);
+    EXPECT_EQ (D, Dref);
+
+    // the shards must have the same nprobe
+    s1.nprobe = 8;
+    EXPECT_THROW (shards.search (nq, xq.data(), k, D.data(), I.data()),
+                  FaissException);
+}
+
+TEST(ShardsIVF, incompatible_shards) {
+    std::vector<float> xt = make_data (nt, 1);
+
+    IndexFlatL2 quantizer (d);
+    IndexShardsIVF shards (&quantizer, nlist);
+
+    // not an IVF index
+    IndexFlatL2 flat (d);
+    EXPECT_THROW (shards.add_shard (&flat), FaissException);
+
+    // wrong nb of lists
+    IndexFlatL2 q0 (d);
+    IndexIVFFlat s0 (&q0, d, nlist / 2);
+    EXPECT_THROW (shards.add_shard (&s0), FaissException);
+
+    // different centroids
+    IndexFlatL2 q1 (d), q2 (d);
+    IndexIVFFlat s1 (&q1, d, nlist), s2 (&q2, d, nlist);
+    s1.train (nt, xt.data());
+    s2.cp.seed = 4321;
+    s2.train (nt, xt.data());
+    shards.add_shard (&s1);
+    EXPECT_THROW (shards.add_shard (&s2), FaissException);
+    EXPECT_EQ (shards.count(), 1);
+}
@@ -0,0 +1,140 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cmath>
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVF.h>
+#include <faiss/IndexScalarQuantizer.h>
+#include <faiss/impl/io.h>
+#include <faiss/index_factory.h>
+#include <faiss/index_io.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+size_t d = 32;
+
+// heavy-tailed components, with a scale that depends on the dimension
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::student_t_distribution<float> distrib(4.0);
+    std::vector<float> x(n * d);
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = 0; j < d; j++) {
+            x[i * d + j] = distrib(rng) / (1 + j % 8);
+        }
+    }
+    return x;
+}
+
+double reconstruction_error(ScalarQuantizer::QuantizerType qtype,
+                            const std::vector<float> & xt,
+                            const std::vector<float> & x)
+{
+    ScalarQuantizer sq(d, qtype);
+    sq.train(xt.size() / d, xt.data());
+    size_t n = x.size() / d;
+    std::vector<uint8_t> codes(n * sq.code_size);
+    std::vector<float> x2(n * d);
+    sq.compute_codes(x.data(), codes.data(), n);
+    sq.decode(codes.data(), x2.data(), n);
+    double err = 0;
+    for (size_t i = 0; i < n * d; i++) {
+        err += (x[i] - x2[i]) * (x[i] - x2[i]);
+    }
+    return err / n;
+}
+
+} // namespace
+
+
+TEST(SQCodebook, code_size) {
+    EXPECT_EQ(ScalarQuantizer(d, ScalarQuantizer::QT_4bit_lloyd).code_size,
+              d / 2);
+    EXPECT_EQ(ScalarQuantizer(d, ScalarQuantizer::QT_4bit_vbits).code_size,
+              d / 2);
+    EXPECT_EQ(ScalarQuantizer(d, ScalarQuantizer::QT_3bit_vbits).code_size,
+              d * 3 / 8);
+}
+
+TEST(SQCodebook, reconstruction_error) {
+    std::vector<float> xt = make_data(5000, 1);
+    std::vector<float> x = make_data(1000, 2);
+
+    double err_4bit = reconstruction_error(ScalarQuantizer::QT_4bit, xt, x);
+    double err_lloyd = reconstruction_error(
+        ScalarQuantizer::QT_4bit_lloyd, xt, x);
+    double err_4vbits = reconstruction_error(
+        ScalarQuantizer::QT_4bit_vbits, xt, x);
+    double err_3vbits = reconstruction_error(
+        ScalarQuantizer::QT_3bit_vbits, xt, x);
+
+    // same code size, non-uniform steps
+    EXPECT_LT(err_lloyd, err_4bit);
+    // more bits for the dimensions with a large variance
+    EXPECT_LT(err_4vbits, err_lloyd);
+    // better than the uniform quantizer with a larger code size
+    EXPECT_LT(err_3vbits, err_4bit);
+}
+
+TEST(SQCodebook, ivf_search_and_io) {
+    std::vector<float> xt = make_data(5000, 1);
+    std::vector<float> xq = make_data(20, 3);
+    size_t nb = xt.size() / d, nq = xq.size() / d;
+    int k = 5;
+
+    std::unique_ptr<Index> index(index_factory(d, "IVF16,SQ3vbits"));
+    IndexIVFScalarQuantizer *ivf =
+        dynamic_cast<IndexIVFScalarQuantizer*>(index.get());
+    ASSERT_TRUE(ivf);
+    EXPECT_EQ(ivf->sq.qtype, ScalarQuantizer::QT_3bit_vbits);
+    index->train(nb, xt.data());
+    ivf->make_direct_map();
+    index->add(nb, xt.data());
+    ivf->nprobe = 16;
+
+    std::vector<float> D(nq * k);
+    std::vector<idx_t> I(nq * k);
+    index->search(nq, xq.data(), k, D.data(), I.data());
+
+    // the distances are those of the decoded vectors
+    std::vector<float> recons(d);
+    for (size_t i = 0; i < nq * k; i++) {
+        ASSERT_GE(I[i], 0);
+        index->reconstruct(I[i], recons.data());
+        float dis = 0;
+        for (size_t j = 0; j < d; j++) {
+            float diff = xq[i / k * d + j] - recons[j];
+            dis += diff * diff;
+        }
+        EXPECT_NEAR(D[i], dis, 1e-4 * (1 + dis));
+    }
+
+    VectorIOWriter writer;
+    write_index(index.get(), &writer);
+    VectorIOReader reader;
+    reader.data = writer.data;
+    std::unique_ptr<Index> index2(read_index(&reader));
+    std::vector<float> D2(nq * k);
+    std::vector<idx_t> I2(nq * k);
+    dynamic_cast<IndexIVF*>(index2.get())->nprobe = 16;
+    index2->search(nq, xq.data(), k, D2.data(), I2.data());
+    EXPECT_EQ(I, I2);
+    EXPECT_EQ(D, D2);
+}
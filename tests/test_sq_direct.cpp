@@ -0,0 +1,178 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cmath>
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexHNSW.h>
+#include <faiss/IndexIVFFlat.h>
+#include <faiss/IndexScalarQuantizer.h>
+#include <faiss/impl/AuxIndexStructures.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+size_t nb = 1000, nq = 20;
+int k = 10;
+
+// integer vectors in the range of the codes
+std::vector<float> make_data(size_t n, bool is_signed, int seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<> distrib(
+        is_signed ? -128 : 0, is_signed ? 127 : 255);
+    std::vector<float> x(n);
+    for (size_t i = 0; i < n; i++) {
+        x[i] = distrib(rng);
+    }
+    return x;
+}
+
+ScalarQuantizer::QuantizerType qtype_of(bool is_signed)
+{
+    return is_signed ? ScalarQuantizer::QT_8bit_direct_signed :
+        ScalarQuantizer::QT_8bit_direct;
+}
+
+void search(const Index & index, const std::vector<float> & xq,
+            std::vector<float> & D, std::vector<idx_t> & I)
+{
+    D.resize(nq * k);
+    I.resize(nq * k);
+    index.search(nq, xq.data(), k, D.data(), I.data());
+}
+
+// the integer distances are exact, so the results are the same as with
+// the float vectors
+void test_exact(bool is_signed, MetricType mt, size_t d)
+{
+    std::vector<float> xb = make_data(nb * d, is_signed, 1);
+    std::vector<float> xq = make_data(nq * d, is_signed, 2);
+
+    IndexFlat ref(d, mt);
+    ref.add(nb, xb.data());
+    std::vector<float> Dref, D;
+    std::vector<idx_t> Iref, I;
+    search(ref, xq, Dref, Iref);
+
+    IndexScalarQuantizer index(d, qtype_of(is_signed), mt);
+    index.add(nb, xb.data());
+    search(index, xq, D, I);
+    EXPECT_EQ(Dref, D) << "d=" << d;
+    EXPECT_EQ(Iref, I) << "d=" << d;
+
+    // symmetric distances of the distance computer
+    std::unique_ptr<DistanceComputer> dc(index.get_distance_computer());
+    for (idx_t i = 0; i < 10; i++) {
+        std::unique_ptr<DistanceComputer> dcref(ref.get_distance_computer());
+        EXPECT_EQ(dcref->symmetric_dis(i, i + 10),
+                  dc->symmetric_dis(i, i + 10));
+    }
+
+    // same with IVF
+    IndexFlat q1(d, mt), q2(d, mt);
+    IndexIVFFlat ivf_ref(&q1, d, 8, mt);
+    ivf_ref.train(nb, xb.data());
+    ivf_ref.add(nb, xb.data());
+    ivf_ref.nprobe = 3;
+    search(ivf_ref, xq, Dref, Iref);
+
+    IndexIVFScalarQuantizer ivf(&q2, d, 8, qtype_of(is_signed), mt, false);
+    ivf.train(nb, xb.data());
+    ivf.add(nb, xb.data());
+    ivf.nprobe = 3;
+    search(ivf, xq, D, I);
+    EXPECT_EQ(Dref, D) << "d=" << d;
+    EXPECT_EQ(Iref, I) << "d=" << d;
+}
+
+} // namespace
+
+
+TEST(SQDirect, exact_uint8) {
+    for (size_t d: {13, 16, 24, 100}) {
+        test_exact(false, METRIC_L2, d);
+        test_exact(false, METRIC_INNER_PRODUCT, d);
+    }
+}
+
+TEST(SQDirect, exact_int8) {
+    for (size_t d: {13, 16, 24, 100}) {
+        test_exact(true, METRIC_L2, d);
+        test_exact(true, METRIC_INNER_PRODUCT, d);
+    }
+}
+
+TEST(SQDirect, encode_int8) {
+    size_t d = 4;
+    ScalarQuantizer sq(d, ScalarQuantizer::QT_8bit_direct_signed);
+    EXPECT_EQ(d, sq.code_size);
+    // out of range values are clamped
+    std::vector<float> x = {-128, 127, -300, 300};
+    std::vector<uint8_t> codes(d);
+    sq.compute_codes(x.data(), codes.data(), 1);
+    std::vector<float> y(d);
+    sq.decode(codes.data(), y.data(), 1);
+    std::vector<float> expected = {-128, 127, -128, 127};
+    EXPECT_EQ(expected, y);
+}
+
+TEST(SQDirect, rounded_query) {
+    size_t d = 24;
+    std::vector<float> xb = make_data(nb * d, false, 1);
+    IndexScalarQuantizer index(d, ScalarQuantizer::QT_8bit_direct);
+    index.add(nb, xb.data());
+
+    // the query components are rounded to the nearest integer
+    std::vector<float> xq = make_data(d, false, 2);
+    std::vector<float> xq_shifted = xq;
+    for (size_t i = 0; i < d; i++) {
+        xq_shifted[i] += i % 2 ? 0.4 : -0.4;
+    }
+    std::unique_ptr<DistanceComputer> dc(index.get_distance_computer());
+    std::vector<float> dis(nb);
+    dc->set_query(xq.data());
+    for (size_t i = 0; i < nb; i++) {
+        dis[i] = (*dc)(i);
+    }
+    dc->set_query(xq_shifted.data());
+    for (size_t i = 0; i < nb; i++) {
+        EXPECT_EQ(dis[i], (*dc)(i));
+    }
+}
+
+TEST(SQDirect, HNSW) {
+    size_t d = 40;
+    std::vector<float> xb = make_data(nb * d, true, 1);
+    std::vector<float> xq = make_data(nq * d, true, 2);
+
+    IndexFlat ref(d);
+    ref.add(nb, xb.data());
+    std::vector<float> Dref, D;
+    std::vector<idx_t> Iref, I;
+    search(ref, xq, Dref, Iref);
+
+    IndexHNSWSQ index(d, ScalarQuantizer::QT_8bit_direct_signed, 16);
+    index.add(nb, xb.data());
+    index.hnsw.efSearch = 64;
+    search(index, xq, D, I);
+    int nok = 0;
+    for (size_t i = 0; i < nq * k; i++) {
+        nok += I[i] == Iref[i];
+    }
+    EXPECT_GT(nok, 0.9 * nq * k);
+}
@@ -0,0 +1,184 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cmath>
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexScalarQuantizer.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/utils/cpu_dispatch.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+std::vector<float> make_data(size_t n, int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector <float> x (n);
+    std::uniform_real_distribution<> distrib(-1, 1);
+    for (size_t i = 0; i < n; i++) {
+        x[i] = distrib(rng);
+    }
+    return x;
+}
+
+// distances of the query to all codes, computed by a scanner
+std::vector<float> scan_all(const ScalarQuantizer & sq, MetricType mt,
+                            const float *q, const std::vector<uint8_t> & codes,
+                            size_t nb, bool quantized_query)
+{
+    std::unique_ptr<InvertedListScanner> scanner(
+        sq.select_InvertedListScanner(mt, nullptr, false, false,
+                                      quantized_query));
+    scanner->set_query(q);
+    scanner->set_list(0, 0);
+    std::vector<float> dis(nb);
+    for (size_t i = 0; i < nb; i++) {
+        dis[i] = scanner->distance_to_code(codes.data() + i * sq.code_size);
+    }
+    return dis;
+}
+
+void test_scanner(ScalarQuantizer::QuantizerType qtype, MetricType mt,
+                  size_t d)
+{
+    size_t nb = 500;
+    ScalarQuantizer sq(d, qtype);
+    std::vector<float> xb = make_data(nb * d, 123);
+    sq.train(nb, xb.data());
+    std::vector<uint8_t> codes(nb * sq.code_size);
+    sq.compute_codes(xb.data(), codes.data(), nb);
+
+    std::vector<float> q = make_data(d, 456);
+    std::vector<float> ref = scan_all(sq, mt, q.data(), codes, nb, false);
+    std::vector<float> dis = scan_all(sq, mt, q.data(), codes, nb, true);
+
+    float maxref = 0;
+    for (size_t i = 0; i < nb; i++) {
+        maxref = std::max(maxref, std::fabs(ref[i]));
+    }
+    for (size_t i = 0; i < nb; i++) {
+        EXPECT_NEAR(ref[i], dis[i], 0.01 * maxref) << "i=" << i;
+    }
+}
+
+} // namespace
+
+
+TEST(SQQuantizedQuery, L2_uniform) {
+    for (size_t d: {20, 24, 32, 48}) {
+        test_scanner(ScalarQuantizer::QT_8bit_uniform, METRIC_L2, d);
+    }
+}
+
+TEST(SQQuantizedQuery, IP_uniform) {
+    for (size_t d: {20, 24, 32, 48}) {
+        test_scanner(ScalarQuantizer::QT_8bit_uniform,
+                     METRIC_INNER_PRODUCT, d);
+    }
+}
+
+TEST(SQQuantizedQuery, IP_non_uniform) {
+    for (size_t d: {20, 24, 32, 48}) {
+        test_scanner(ScalarQuantizer::QT_8bit, METRIC_INNER_PRODUCT, d);
+    }
+}
+
+// unsupported combination: the float distances are used
+TEST(SQQuantizedQuery, L2_non_uniform_fallback) {
+    size_t d = 32, nb = 100;
+    ScalarQuantizer sq(d, ScalarQuantizer::QT_8bit);
+    std::vector<float> xb = make_data(nb * d, 123);
+    sq.train(nb, xb.data());
+    std::vector<uint8_t> codes(nb * sq.code_size);
+    sq.compute_codes(xb.data(), codes.data(), nb);
+    std::vector<float> ref = scan_all(sq, METRIC_L2, xb.data(), codes, nb,
+                                      false);
+    std::vector<float> dis = scan_all(sq, METRIC_L2, xb.data(), codes, nb,
+                                      true);
+    EXPECT_EQ(ref, dis);
+}
+
+// the integer kernels give the same results for all SIMD levels
+TEST(SQQuantizedQuery, simd_levels) {
+    SIMDLevel prev = get_simd_level();
+    SIMDLevel best = supported_simd_level();
+    if (best == SIMD_NEON) {
+        return;
+    }
+    size_t nb = 200;
+    for (size_t d: {40, 48}) {
+        ScalarQuantizer sq(d, ScalarQuantizer::QT_8bit_uniform);
+        std::vector<float> xb = make_data(nb * d, 123);
+        sq.train(nb, xb.data());
+        std::vector<uint8_t> codes(nb * sq.code_size);
+        sq.compute_codes(xb.data(), codes.data(), nb);
+
+        for (MetricType mt: {METRIC_L2, METRIC_INNER_PRODUCT}) {
+            set_simd_level(SIMD_GENERIC);
+            std::vector<float> ref =
+                scan_all(sq, mt, xb.data(), codes, nb, true);
+            for (int l = SIMD_AVX2; l <= best; l++) {
+                set_simd_level(SIMDLevel(l));
+                std::vector<float> dis =
+                    scan_all(sq, mt, xb.data(), codes, nb, true);
+                EXPECT_EQ(ref, dis);
+            }
+        }
+    }
+    set_simd_level(prev);
+}
+
+TEST(SQQuantizedQuery, IVF_rerank) {
+    size_t d = 32, nb = 2000, nq = 20, nlist = 16;
+    idx_t k = 10;
+    std::vector<float> xb = make_data(nb * d, 123);
+    std::vector<float> xq = make_data(nq * d, 456);
+
+    for (MetricType mt: {METRIC_L2, METRIC_INNER_PRODUCT}) {
+        IndexFlat coarse(d, mt);
+        IndexIVFScalarQuantizer index(&coarse, d, nlist,
+                                      ScalarQuantizer::QT_8bit_uniform, mt);
+        index.train(nb, xb.data());
+        index.add(nb, xb.data());
+        index.nprobe = 4;
+
+        std::vector<float> Dref(nq * k), D(nq * k);
+        std::vector<idx_t> Iref(nq * k), I(nq * k);
+        index.search(nq, xq.data(), k, Dref.data(), Iref.data());
+
+        index.quantized_query = true;
+        index.search(nq, xq.data(), k, D.data(), I.data());
+        int nok = 0;
+        for (size_t i = 0; i < nq * k; i++) {
+            nok += Iref[i] == I[i];
+        }
+        EXPECT_GT(nok, nq * k * 8 / 10);
+
+        // with re-ranking the distances are the float ones
+        index.rerank_factor = 4;
+        index.search(nq, xq.data(), k, D.data(), I.data());
+        nok = 0;
+        for (size_t i = 0; i < nq * k; i++) {
+            if (Iref[i] == I[i]) {
+                nok++;
+                EXPECT_FLOAT_EQ(Dref[i], D[i]);
+            }
+        }
+        EXPECT_GT(nok, nq * k * 95 / 100);
+    }
+}
@@ -0,0 +1,100 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/impl/ScalarQuantizer.h>
+
+
+using namespace faiss;
+
+namespace {
+
+size_t d = 24;
+size_t n = 20000;
+
+std::vector<float> make_data(int seed)
+{
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> distrib;
+    std::vector<float> x(n * d);
+    for (size_t i = 0; i < n * d; i++) {
+        x[i] = distrib(rng) * (1 + i % d);
+    }
+    // the extreme values are in the first vector
+    for (size_t j = 0; j < d; j++) {
+        x[j] = -1000;
+    }
+    return x;
+}
+
+std::vector<float> train(ScalarQuantizer::QuantizerType qtype,
+                         ScalarQuantizer::RangeStat rs, float rs_arg,
+                         const std::vector<float> & x)
+{
+    ScalarQuantizer sq(d, qtype);
+    sq.rangestat = rs;
+    sq.rangestat_arg = rs_arg;
+    sq.train(n, x.data());
+    return sq.trained;
+}
+
+} // namespace
+
+
+TEST(SQTrain, minmax_vs_quantiles) {
+    std::vector<float> x = make_data(1);
+    for (auto qtype: {ScalarQuantizer::QT_8bit,
+                      ScalarQuantizer::QT_8bit_uniform}) {
+        std::vector<float> t_minmax =
+            train(qtype, ScalarQuantizer::RS_minmax, 0, x);
+        std::vector<float> t_quantiles =
+            train(qtype, ScalarQuantizer::RS_quantiles, 0, x);
+        EXPECT_EQ(t_minmax, t_quantiles);
+        for (size_t j = 0; j < t_minmax.size() / 2; j++) {
+            EXPECT_EQ(t_minmax[j], -1000);
+        }
+    }
+}
+
+TEST(SQTrain, quantiles) {
+    std::vector<float> x = make_data(2);
+    float rs_arg = 0.01;
+    std::vector<float> trained =
+        train(ScalarQuantizer::QT_8bit, ScalarQuantizer::RS_quantiles,
+              rs_arg, x);
+    size_t o = size_t(rs_arg * n);
+    for (size_t j = 0; j < d; j++) {
+        std::vector<float> xj(n);
+        for (size_t i = 0; i < n; i++) {
+            xj[i] = x[i * d + j];
+        }
+        std::sort(xj.begin(), xj.end());
+        EXPECT_EQ(trained[j], xj[o]);
+        EXPECT_EQ(trained[d + j], xj[n - 1 - o] - xj[o]);
+    }
+}
+
+TEST(SQTrain, meanstd) {
+    std::vector<float> x = make_data(3);
+    std::vector<float> trained =
+        train(ScalarQuantizer::QT_8bit_uniform, ScalarQuantizer::RS_meanstd,
+              2.0, x);
+    double sum = 0, sum2 = 0;
+    for (float v: x) {
+        sum += v;
+        sum2 += v * v;
+    }
+    double mean = sum / x.size();
+    double std = sqrt(sum2 / x.size() - mean * mean);
+    EXPECT_NEAR(trained[0], mean - 2 * std, 1e-3 * std);
+    EXPECT_NEAR(trained[1], 4 * std, 1e-3 * std);
+}
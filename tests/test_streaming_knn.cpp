@@ -0,0 +1,311 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/StreamingKnn.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/FaissException.h>
+
+
+namespace {
+
+typedef faiss::Index::idx_t idx_t;
+
+struct Tempfilename {
+
+    static pthread_mutex_t mutex;
+
+    std::string filename;
+
+    Tempfilename (const char *suffix) {
+        pthread_mutex_lock (&mutex);
+        char *cfname = tempnam (nullptr, nullptr);
+        filename = std::string (cfname) + suffix;
+        free(cfname);
+        pthread_mutex_unlock (&mutex);
+    }
+
+    ~Tempfilename () {
+        if (access (filename.c_str(), F_OK) == 0) {
+            unlink (filename.c_str());
+        }
+    }
+
+    const char *c_str() {
+        return filename.c_str();
+    }
+
+};
+
+pthread_mutex_t Tempfilename::mutex = PTHREAD_MUTEX_INITIALIZER;
+
+int d = 24;
+size_t nb = 1500;
+size_t nq = 70;
+int k = 10;
+
+std::vector<float> make_data (size_t n, int seed)
+{
+    std::vector<float> x (n * d);
+    std::mt19937 rng (seed);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < x.size(); i++) {
+        x[i] = distrib (rng);
+    }
+    return x;
+}
+
+void write_vecs (const char *fname, const std::vector<float> & x,
+                 bool bytes)
+{
+    FILE *f = fopen (fname, "wb");
+    ASSERT_TRUE (f);
+    for (size_t i = 0; i < x.size() / d; i++) {
+        fwrite (&d, sizeof(d), 1, f);
+        for (int j = 0; j < d; j++) {
+            if (bytes) {
+                uint8_t v = x[i * d + j];
+                fwrite (&v, 1, 1, f);
+            } else {
+                fwrite (&x[i * d + j], sizeof(float), 1, f);
+            }
+        }
+    }
+    fclose (f);
+}
+
+void write_npy (const char *fname, const std::vector<float> & x)
+{
+    char dict[128];
+    snprintf (dict, sizeof(dict),
+              "{'descr': '<f4', 'fortran_order': False, 'shape': (%zd, %d), }",
+              x.size() / d, d);
+    std::string header = dict;
+    header.append (63 - (10 + header.size()) % 64, ' ');
+    header += '\n';
+    FILE *f = fopen (fname, "wb");
+    ASSERT_TRUE (f);
+    fwrite ("\x93NUMPY\x01", 1, 7, f);
+    uint8_t v[3] = {0, uint8_t(header.size() & 0xff),
+                    uint8_t(header.size() >> 8)};
+    fwrite (v, 1, 3, f);
+    fwrite (header.data(), 1, header.size(), f);
+    fwrite (x.data(), sizeof(float), x.size(), f);
+    fclose (f);
+}
+
+/// reads the array of a .npy file written by search_to_files
+template<class T>
+std::vector<T> read_npy_data (const char *fname)
+{
+    FILE *f = fopen (fname, "rb");
+    FAISS_THROW_IF_NOT (f);
+    uint8_t pre[10];
+    FAISS_THROW_IF_NOT (fread (pre, 1, 10, f) == 10);
+    fseek (f, 10 + pre[8] + (pre[9] << 8), SEEK_SET);
+    std::vector<T> x (nq * k);
+    size_t nr = fread (x.data(), sizeof(T), x.size(), f);
+    fclose (f);
+    x.resize (nr);
+    return x;
+}
+
+void reference_search (const std::vector<float> & xb,
+                       const std::vector<float> & xq,
+                       faiss::MetricType mt, int kr,
+                       std::vector<float> & D, std::vector<idx_t> & I)
+{
+    faiss::IndexFlat index (d, mt);
+    index.add (xb.size() / d, xb.data());
+    size_t n = xq.size() / d;
+    D.resize (n * kr);
+    I.resize (n * kr);
+    index.search (n, xq.data(), kr, D.data(), I.data());
+}
+
+void check_results (const std::vector<float> & D_ref,
+                    const std::vector<idx_t> & I_ref,
+                    const std::vector<float> & D,
+                    const std::vector<idx_t> & I)
+{
+    ASSERT_EQ (I_ref.size(), I.size());
+    size_t ndiff = 0;
+    for (size_t i = 0; i < I.size(); i++) {
+        EXPECT_NEAR (D_ref[i], D[i], 1e-4 * (1 + fabs (D_ref[i])));
+        ndiff += I_ref[i] != I[i];
+    }
+    // ids may only differ because of ties and rounding
+    EXPECT_LE (ndiff, I.size() / 100);
+}
+
+/// an IndexFlat that fails after a given nb of searches
+struct FailingIndexFlat: faiss::IndexFlat {
+    mutable int nok;
+
+    FailingIndexFlat (int d, int nok): faiss::IndexFlat (d), nok (nok) {}
+
+    void search_view (const faiss::VectorArrayView & x, idx_t k,
+                      float *distances, idx_t *labels,
+                      const faiss::SearchParameters *params = nullptr)
+            const override {
+        if (nok-- <= 0) {
+            FAISS_THROW_MSG ("simulated failure");
+        }
+        faiss::IndexFlat::search_view (x, k, distances, labels, params);
+    }
+};
+
+}  // namespace
+
+
+TEST(StreamingKnn, file_formats) {
+    std::vector<float> xb = make_data (nb, 1);
+    std::vector<float> xq = make_data (nq, 2);
+    Tempfilename fvecs (".fvecs"), npy (".npy"), bvecs (".bvecs");
+    write_vecs (fvecs.c_str(), xb, false);
+    write_npy (npy.c_str(), xb);
+
+    faiss::ArrayVectorSource sq (faiss::VectorArrayView (xq.data(), nq, d));
+
+    for (faiss::MetricType mt : {faiss::METRIC_L2,
+                                 faiss::METRIC_INNER_PRODUCT}) {
+        std::vector<float> D_ref;
+        std::vector<idx_t> I_ref;
+        reference_search (xb, xq, mt, k, D_ref, I_ref);
+
+        faiss::StreamingKnn sk (k, mt);
+        // several blocks, the last ones incomplete
+        sk.query_block_size = 32;
+        sk.db_block_size = 400;
+
+        for (const char *fname : {fvecs.c_str(), npy.c_str()}) {
+            faiss::FileVectorSource sb (fname);
+            EXPECT_EQ (nb, sb.n);
+            EXPECT_EQ (d, sb.d);
+            std::vector<float> D (nq * k);
+            std::vector<idx_t> I (nq * k);
+            sk.search (sq, sb, D.data(), I.data());
+            check_results (D_ref, I_ref, D, I);
+        }
+
+        // with an index to compute the distances
+        faiss::IndexFlat index (d, mt);
+        sk.index = &index;
+        faiss::ArrayVectorSource sb (faiss::VectorArrayView (
+              xb.data(), nb, d));
+        std::vector<float> D (nq * k);
+        std::vector<idx_t> I (nq * k);
+        sk.search (sq, sb, D.data(), I.data());
+        check_results (D_ref, I_ref, D, I);
+    }
+
+    // uint8 vectors
+    std::vector<float> xb8 (xb.size()), xq8 (xq.size());
+    for (size_t i = 0; i < xb.size(); i++) {
+        xb8[i] = int(xb[i] * 256);
+    }
+    for (size_t i = 0; i < xq.size(); i++) {
+        xq8[i] = int(xq[i] * 256);
+    }
+    write_vecs (bvecs.c_str(), xb8, true);
+    std::vector<float> D_ref;
+    std::vector<idx_t> I_ref;
+    reference_search (xb8, xq8, faiss::METRIC_L2, k, D_ref, I_ref);
+
+    faiss::FileVectorSource sb (bvecs.c_str());
+    EXPECT_EQ (faiss::VET_uint8, sb.type);
+    faiss::StreamingKnn sk (k);
+    sk.db_block_size = 500;
+    std::vector<float> D (nq * k);
+    std::vector<idx_t> I (nq * k);
+    sk.search (faiss::ArrayVectorSource (
+                     faiss::VectorArrayView (xq8.data(), nq, d)),
+               sb, D.data(), I.data());
+    for (size_t i = 0; i < D.size(); i++) {
+        EXPECT_EQ (D_ref[i], D[i]);
+    }
+}
+
+TEST(StreamingKnn, knn_graph) {
+    std::vector<float> xb = make_data (nb, 3);
+    std::vector<float> D_ref;
+    std::vector<idx_t> I_ref;
+    reference_search (xb, xb, faiss::METRIC_L2, k + 1, D_ref, I_ref);
+
+    faiss::ArrayVectorSource sb (faiss::VectorArrayView (xb.data(), nb, d));
+    faiss::StreamingKnn sk (k);
+    sk.exclude_self = true;
+    sk.query_block_size = 300;
+    sk.db_block_size = 256;
+    std::vector<float> D (nb * k);
+    std::vector<idx_t> I (nb * k);
+    sk.search (sb, sb, D.data(), I.data());
+
+    for (size_t i = 0; i < nb; i++) {
+        // the nearest neighbor of a vector is itself
+        ASSERT_EQ (i, I_ref[i * (k + 1)]);
+        for (int j = 0; j < k; j++) {
+            EXPECT_NE (i, I[i * k + j]);
+            EXPECT_EQ (I_ref[i * (k + 1) + j + 1], I[i * k + j]);
+        }
+    }
+}
+
+TEST(StreamingKnn, checkpoint) {
+    std::vector<float> xb = make_data (nb, 4);
+    std::vector<float> xq = make_data (nq, 5);
+    std::vector<float> D_ref;
+    std::vector<idx_t> I_ref;
+    reference_search (xb, xq, faiss::METRIC_L2, k, D_ref, I_ref);
+
+    faiss::ArrayVectorSource sq (faiss::VectorArrayView (xq.data(), nq, d));
+    faiss::ArrayVectorSource sb (faiss::VectorArrayView (xb.data(), nb, d));
+    Tempfilename D_fname (".npy"), I_fname (".npy");
+
+    faiss::StreamingKnn sk (k);
+    sk.query_block_size = 20;
+    sk.db_block_size = 1000;
+
+    // 2 database blocks per query block: fails in the 3rd query block
+    FailingIndexFlat index (d, 5);
+    sk.index = &index;
+    EXPECT_THROW (sk.search_to_files (sq, sb, D_fname.c_str(),
+                                      I_fname.c_str()),
+                  faiss::FaissException);
+    EXPECT_EQ (40 * k, read_npy_data<idx_t> (I_fname.c_str()).size());
+
+    // resumes from the 3rd query block
+    index.nok = 4;
+    sk.search_to_files (sq, sb, D_fname.c_str(), I_fname.c_str());
+    EXPECT_EQ (0, index.nok);
+    check_results (D_ref, I_ref,
+                   read_npy_data<float> (D_fname.c_str()),
+                   read_npy_data<idx_t> (I_fname.c_str()));
+
+    // nothing left to do
+    sk.search_to_files (sq, sb, D_fname.c_str(), I_fname.c_str());
+    EXPECT_EQ (0, index.nok);
+
+    // the files are not a checkpoint for another k
+    faiss::StreamingKnn sk2 (k + 1);
+    EXPECT_THROW (sk2.search_to_files (sq, sb, D_fname.c_str(),
+                                       I_fname.c_str()),
+                  faiss::FaissException);
+}
@@ -8,12 +8,19 @@
 #include <faiss/impl/ThreadedIndex.h>
 #include <faiss/IndexReplicas.h>
 #include <faiss/IndexShards.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVFFlat.h>
+#include <faiss/utils/parallel.h>
+#include <faiss/utils/random.h>
 
+#include <algorithm>
 #include <chrono>
 #include <gtest/gtest.h>
 #include <memory>
 #include <vector>
 #include <thread>
+#include <tuple>
+#include <omp.h>
 
 namespace {
 
@@ -43,7 +50,8 @@ struct MockIndex : public faiss::Index {
               const float* x,
               idx_t k,
               float* distances,
-              idx_t* labels) const override {
+              idx_t* labels,
+              const faiss::SearchParameters* params) const override {
     nCalled = n;
     xCalled = x;
     kCalled = k;
@@ -71,7 +79,8 @@ struct MockThreadedIndex : public faiss::ThreadedIndex<IndexT> {
   }
 
   void add(idx_t, const float*) override { }
-  void search(idx_t, const float*, idx_t, float*, idx_t*) const override {}
+  void search(idx_t, const float*, idx_t, float*, idx_t*,
+              const faiss::SearchParameters*) const override {}
   void reset() override {}
 };
 
@@ -251,3 +260,349 @@ TEST(ThreadedIndex, TestShards) {
     }
   }
 }
+
+TEST(ThreadedIndex, OmpThreadsPerIndex) {
+  int nshard = 4;
+  int maxThreads = omp_get_max_threads();
+
+  std::vector<std::unique_ptr<MockIndex>> idxs;
+  MockThreadedIndex<MockIndex> ti(true);
+  for (int i = 0; i < nshard; ++i) {
+    idxs.emplace_back(new MockIndex(1));
+    ti.addIndex(idxs.back().get());
+  }
+
+  std::vector<int> nt(nshard);
+  auto fn = [&nt](int i, MockIndex*) { nt[i] = omp_get_max_threads(); };
+
+  // by default the OpenMP setting of the workers is not changed
+  ti.runOnIndex(fn);
+  std::vector<int> ntDefault = nt;
+
+  // 0 divides the threads among the sub-indices
+  ti.omp_threads_per_index = 0;
+  ti.runOnIndex(fn);
+  for (int i = 0; i < nshard; ++i) {
+    EXPECT_EQ(nt[i], std::max(1, maxThreads / nshard));
+  }
+
+  ti.omp_threads_per_index = 3;
+  ti.runOnIndex(fn);
+  for (int i = 0; i < nshard; ++i) {
+    EXPECT_EQ(nt[i], 3);
+  }
+
+  // the setting of the workers is restored after each call
+  ti.omp_threads_per_index = -1;
+  ti.runOnIndex(fn);
+  EXPECT_EQ(nt, ntDefault);
+
+  // also when 0 gives more threads than the default of the workers
+  omp_set_num_threads(2 * nshard * maxThreads);
+  ti.omp_threads_per_index = 0;
+  ti.runOnIndex(fn);
+  for (int i = 0; i < nshard; ++i) {
+    EXPECT_EQ(nt[i], 2 * maxThreads);
+  }
+  ti.omp_threads_per_index = -1;
+  ti.runOnIndex(fn);
+  EXPECT_EQ(nt, ntDefault);
+  omp_set_num_threads(maxThreads);
+
+  // the calling thread is not affected
+  EXPECT_EQ(omp_get_max_threads(), maxThreads);
+}
+
+TEST(ThreadedIndex, NumaReplicas) {
+  int d = 16, nlist = 10, nb = 1000, nq = 20, k = 5;
+  std::vector<float> xb(nb * d), xq(nq * d);
+  faiss::float_rand(xb.data(), xb.size(), 123);
+  faiss::float_rand(xq.data(), xq.size(), 456);
+
+  faiss::IndexFlatL2 quantizer(d);
+  faiss::IndexIVFFlat ref(&quantizer, d, nlist);
+  ref.train(nb, xb.data());
+  ref.add(nb, xb.data());
+  ref.nprobe = 4;
+
+  std::vector<float> refD(nq * k), D(nq * k);
+  std::vector<faiss::Index::idx_t> refI(nq * k), I(nq * k);
+  ref.search(nq, xq.data(), k, refD.data(), refI.data());
+
+  // the lists are reallocated but their content does not change
+  auto ails = dynamic_cast<faiss::ArrayInvertedLists*>(ref.invlists);
+  ails->first_touch_lists();
+  ref.search(nq, xq.data(), k, D.data(), I.data());
+  EXPECT_EQ(I, refI);
+  EXPECT_EQ(D, refD);
+
+  std::vector<std::unique_ptr<faiss::IndexIVFFlat>> idxs;
+  faiss::IndexReplicas replicas(d);
+  for (int i = 0; i < 2; ++i) {
+    idxs.emplace_back(new faiss::IndexIVFFlat(&quantizer, d, nlist));
+    idxs.back()->nprobe = 4;
+    faiss::ArrayInvertedLists* il =
+      new faiss::ArrayInvertedLists(nlist, ref.code_size);
+    for (int l = 0; l < nlist; ++l) {
+      il->add_entries(l, ails->list_size(l),
+                      ails->get_ids(l), ails->get_codes(l));
+    }
+    idxs.back()->replace_invlists(il, true);
+    idxs.back()->ntotal = nb;
+    replicas.addIndex(idxs.back().get());
+  }
+
+  replicas.bindToNumaNodes();
+  replicas.search(nq, xq.data(), k, D.data(), I.data());
+  EXPECT_EQ(I, refI);
+  EXPECT_EQ(D, refD);
+}
+
+namespace {
+
+/// Labels each query with the replica number, after a delay per query
+struct DelayIndex : public faiss::Index {
+  DelayIndex(idx_t d, int replica, int usPerQuery) :
+      faiss::Index(d), replica(replica), usPerQuery(usPerQuery),
+      nSearched(0) {
+  }
+
+  void add(idx_t, const float*) override { }
+
+  void search(idx_t n,
+              const float*,
+              idx_t k,
+              float* distances,
+              idx_t* labels,
+              const faiss::SearchParameters*) const override {
+    std::this_thread::sleep_for(std::chrono::microseconds(n * usPerQuery));
+    std::fill(distances, distances + n * k, 0);
+    std::fill(labels, labels + n * k, replica);
+    nSearched += n;
+  }
+
+  void reset() override { }
+
+  int replica;
+  int usPerQuery;
+  mutable idx_t nSearched;
+};
+
+}
+
+TEST(ThreadedIndex, DynamicDispatch) {
+  int d = 4;
+  int k = 2;
+  int n = 2000;
+
+  // replica 1 is 20x slower than replica 0
+  std::vector<std::unique_ptr<DelayIndex>> idxs;
+  faiss::IndexReplicas replicas(d);
+  for (int i = 0; i < 2; ++i) {
+    idxs.emplace_back(new DelayIndex(d, i, i == 0 ? 10 : 200));
+    replicas.addIndex(idxs.back().get());
+  }
+  replicas.dynamic_dispatch = true;
+  replicas.dispatch_chunk_size = 50;
+
+  std::vector<float> x(n * d);
+  std::vector<float> distances(n * k);
+  std::vector<faiss::Index::idx_t> labels(n * k, -1);
+
+  replicas.search(n, x.data(), k, distances.data(), labels.data());
+
+  // all queries are searched once, mostly by the fast replica
+  EXPECT_EQ(idxs[0]->nSearched + idxs[1]->nSearched, n);
+  EXPECT_GT(idxs[0]->nSearched, n / 2);
+  for (int i = 0; i < n * k; ++i) {
+    EXPECT_TRUE(labels[i] == 0 || labels[i] == 1);
+  }
+
+  EXPECT_GT(replicas.getReplicaLatency(0), 0);
+  EXPECT_GT(replicas.getReplicaLatency(1), replicas.getReplicaLatency(0));
+
+  // single queries go to the fastest idle replica
+  for (int i = 0; i < 10; ++i) {
+    replicas.search(1, x.data(), k, distances.data(), labels.data());
+    EXPECT_EQ(labels[0], 0);
+  }
+}
+
+TEST(ThreadedIndex, DynamicDispatchResults) {
+  int d = 16, nb = 1000, nq = 300, k = 5;
+  std::vector<float> xb(nb * d), xq(nq * d);
+  faiss::float_rand(xb.data(), xb.size(), 123);
+  faiss::float_rand(xq.data(), xq.size(), 456);
+
+  faiss::IndexFlatL2 ref(d);
+  ref.add(nb, xb.data());
+
+  std::vector<float> refD(nq * k), D(nq * k);
+  std::vector<faiss::Index::idx_t> refI(nq * k), I(nq * k);
+  ref.search(nq, xq.data(), k, refD.data(), refI.data());
+
+  std::vector<std::unique_ptr<faiss::IndexFlatL2>> idxs;
+  faiss::IndexReplicas replicas(d);
+  for (int i = 0; i < 3; ++i) {
+    idxs.emplace_back(new faiss::IndexFlatL2(d));
+    idxs.back()->add(nb, xb.data());
+    replicas.addIndex(idxs.back().get());
+  }
+  replicas.dynamic_dispatch = true;
+  // all chunks full, so that they use the same distance computation as
+  // the reference (see distance_compute_blas_threshold)
+  replicas.dispatch_chunk_size = 30;
+
+  replicas.search(nq, xq.data(), k, D.data(), I.data());
+  EXPECT_EQ(I, refI);
+  EXPECT_EQ(D, refD);
+
+  // concurrent searches
+  std::vector<std::thread> threads;
+  std::vector<std::vector<faiss::Index::idx_t>> Is(4);
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t]() {
+        std::vector<float> Dt(nq * k);
+        Is[t].resize(nq * k);
+        replicas.search(nq, xq.data(), k, Dt.data(), Is[t].data());
+      });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  for (auto& It : Is) {
+    EXPECT_EQ(It, refI);
+  }
+}
+
+TEST(ThreadedIndex, ShardsMerge) {
+  int d = 8, nq = 50;
+
+  std::vector<float> xb(2000 * d), xq(nq * d);
+  faiss::float_rand(xb.data(), xb.size(), 1234);
+  faiss::float_rand(xq.data(), xq.size(), 345);
+
+  for (auto metric : {faiss::METRIC_L2, faiss::METRIC_INNER_PRODUCT}) {
+    // shards of unequal sizes, some with fewer than k vectors
+    for (int nshard : {1, 3, 17}) {
+      for (int k : {1, 10, 100}) {
+        std::vector<std::unique_ptr<faiss::IndexFlat>> idxs;
+        faiss::IndexShards shards(d, false, true);
+        faiss::Index::idx_t nb = 0;
+
+        // reference: sort the results of all the shards, ties in shard
+        // order
+        std::vector<std::vector<std::tuple<float, int, int,
+                                           faiss::Index::idx_t>>> all(nq);
+
+        for (int s = 0; s < nshard; s++) {
+          int nbs = 1 + (s * 37) % 150;
+          idxs.emplace_back(new faiss::IndexFlat(d, metric));
+          idxs.back()->add(nbs, xb.data() + nb * d);
+          shards.addIndex(idxs.back().get());
+
+          std::vector<float> Ds(nq * k);
+          std::vector<faiss::Index::idx_t> Is(nq * k);
+          idxs.back()->search(nq, xq.data(), k, Ds.data(), Is.data());
+          for (int q = 0; q < nq; q++) {
+            for (int j = 0; j < k; j++) {
+              if (Is[q * k + j] >= 0) {
+                float key = metric == faiss::METRIC_L2 ?
+                  Ds[q * k + j] : -Ds[q * k + j];
+                all[q].emplace_back(key, s, j, nb + Is[q * k + j]);
+              }
+            }
+          }
+          nb += nbs;
+        }
+
+        std::vector<float> D(nq * k);
+        std::vector<faiss::Index::idx_t> I(nq * k);
+        shards.search(nq, xq.data(), k, D.data(), I.data());
+
+        for (int q = 0; q < nq; q++) {
+          std::sort(all[q].begin(), all[q].end());
+          for (int j = 0; j < k; j++) {
+            if (j < all[q].size()) {
+              float ref = std::get<0>(all[q][j]);
+              EXPECT_EQ(I[q * k + j], std::get<3>(all[q][j]));
+              EXPECT_EQ(D[q * k + j],
+                        metric == faiss::METRIC_L2 ? ref : -ref);
+            } else {
+              EXPECT_EQ(I[q * k + j], -1);
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST(ThreadedIndex, SharedExecutor) {
+  int nshard = 4;
+  std::vector<std::unique_ptr<MockIndex>> idxs;
+  MockThreadedIndex<MockIndex> ti(true);
+  for (int i = 0; i < nshard; ++i) {
+    idxs.emplace_back(new MockIndex(1));
+    ti.addIndex(idxs.back().get());
+  }
+
+  std::vector<std::thread::id> tid(nshard);
+  auto fn = [&tid](int i, MockIndex*) {
+    tid[i] = std::this_thread::get_id();
+  };
+
+  // the worker threads of the sub-indices
+  ti.runOnIndex(fn);
+  for (int i = 0; i < nshard; ++i) {
+    EXPECT_NE(tid[i], std::this_thread::get_id());
+  }
+
+  // the serial executor runs them in the calling thread
+  faiss::SerialExecutor serial;
+  faiss::set_parallel_executor(&serial);
+  ti.runOnIndex(fn);
+  for (int i = 0; i < nshard; ++i) {
+    EXPECT_EQ(tid[i], std::this_thread::get_id());
+  }
+
+  // exceptions are collected as with the worker threads
+  auto fnThrow = [](int i, MockIndex* index) {
+    if (i == 1) {
+      throw TestException();
+    }
+    index->flag = true;
+  };
+  EXPECT_THROW(ti.runOnIndex(fnThrow), TestException);
+  EXPECT_TRUE(idxs[0]->flag);
+  EXPECT_TRUE(idxs[3]->flag);
+  faiss::set_parallel_executor(nullptr);
+
+  // the sub-indices and their search loops share a thread pool
+  int d = 8, nq = 200, k = 10;
+  std::vector<float> xb(4000 * d), xq(nq * d);
+  faiss::float_rand(xb.data(), xb.size(), 1234);
+  faiss::float_rand(xq.data(), xq.size(), 345);
+
+  faiss::IndexShards shards(d, true, true);
+  shards.own_fields = true;
+  for (int i = 0; i < nshard; ++i) {
+    shards.addIndex(new faiss::IndexFlatL2(d));
+  }
+  shards.add(4000, xb.data());
+
+  std::vector<float> Dref(nq * k), D(nq * k);
+  std::vector<faiss::Index::idx_t> Iref(nq * k), I(nq * k);
+  shards.search(nq, xq.data(), k, Dref.data(), Iref.data());
+
+  faiss::ThreadPoolExecutor pool(3);
+  faiss::set_parallel_executor(&pool);
+  shards.search(nq, xq.data(), k, D.data(), I.data());
+  faiss::set_parallel_executor(nullptr);
+
+  // the query slices can be too small for the BLAS path
+  EXPECT_EQ(I, Iref);
+  for (int i = 0; i < nq * k; ++i) {
+    EXPECT_NEAR(D[i], Dref[i], 1e-5);
+  }
+}
@@ -0,0 +1,182 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexScalarQuantizer.h>
+#include <faiss/utils/distances.h>
+#include <faiss/utils/fp16.h>
+#include <faiss/utils/vector_view.h>
+
+
+using namespace faiss;
+
+namespace {
+
+typedef Index::idx_t idx_t;
+
+size_t d = 24;
+
+/** n vectors stored with the given type and stride, and the same
+ * vectors as contiguous floats */
+struct TypedData {
+    std::vector<uint8_t> storage;
+    std::vector<float> ref;
+    VectorArrayView view;
+
+    TypedData(VectorElementType type, size_t n, size_t stride, int seed):
+        ref(n * d), view(type, nullptr, n, d, stride)
+    {
+        std::mt19937 rng(seed);
+        storage.resize(n * stride * view.element_size());
+        for (size_t i = 0; i < n; i++) {
+            for (size_t j = 0; j < d; j++) {
+                int v = int(rng() % 256) - (type == VET_uint8 ? 0 : 128);
+                float f = type == VET_uint8 || type == VET_int8 ? v : v / 64.0;
+                uint8_t *p = storage.data() +
+                    (i * stride + j) * view.element_size();
+                switch (type) {
+                case VET_float32: memcpy(p, &f, 4); break;
+                case VET_float16: {
+                    uint16_t h = encode_fp16(f);
+                    memcpy(p, &h, 2);
+                    break;
+                }
+                case VET_bfloat16: {
+                    uint16_t h = encode_bf16(f);
+                    memcpy(p, &h, 2);
+                    break;
+                }
+                case VET_uint8: *p = v; break;
+                case VET_int8: *(int8_t*)p = v; break;
+                }
+                // the values are exactly representable in all the types
+                ref[i * d + j] = f;
+            }
+        }
+        view.data = storage.data();
+    }
+};
+
+std::vector<VectorElementType> all_types()
+{
+    return {VET_float32, VET_float16, VET_bfloat16, VET_uint8, VET_int8};
+}
+
+} // namespace
+
+
+TEST(VectorView, to_float) {
+    for (VectorElementType type: all_types()) {
+        for (size_t stride: {d, d + 5}) {
+            TypedData data(type, 50, stride, 123);
+            std::vector<float> out(20 * d);
+            data.view.to_float(10, 30, out.data());
+            EXPECT_TRUE(std::equal(out.begin(), out.end(),
+                                   data.ref.begin() + 10 * d));
+            std::vector<float> buf;
+            size_t ld;
+            const float *p = data.view.get_float(10, 30, buf, &ld);
+            EXPECT_EQ(ld, type == VET_float32 ? stride : d);
+            for (size_t i = 0; i < 20; i++) {
+                EXPECT_TRUE(std::equal(p + i * ld, p + i * ld + d,
+                                       data.ref.begin() + (10 + i) * d));
+            }
+        }
+    }
+}
+
+TEST(VectorView, knn) {
+    size_t nb = 3000;
+    idx_t k = 10;
+    // nq = 5 is handled with the sequential code (or by splitting the
+    // database with more threads than queries), nq = 50 with BLAS
+    for (size_t nq: {5, 50}) {
+        for (VectorElementType type: all_types()) {
+            TypedData xb(type, nb, d + 3, 1);
+            TypedData xq(type, nq, d, 2);
+
+            for (bool is_L2: {true, false}) {
+                std::vector<float> Dref(nq * k), D(nq * k);
+                std::vector<idx_t> Iref(nq * k), I(nq * k);
+                if (is_L2) {
+                    float_maxheap_array_t rref = {nq, size_t(k),
+                                                  Iref.data(), Dref.data()};
+                    knn_L2sqr(xq.ref.data(), xb.ref.data(), d, nq, nb, &rref);
+                    float_maxheap_array_t res = {nq, size_t(k),
+                                                 I.data(), D.data()};
+                    knn_L2sqr(xq.view, xb.view, &res);
+                } else {
+                    float_minheap_array_t rref = {nq, size_t(k),
+                                                  Iref.data(), Dref.data()};
+                    knn_inner_product(xq.ref.data(), xb.ref.data(),
+                                      d, nq, nb, &rref);
+                    float_minheap_array_t res = {nq, size_t(k),
+                                                 I.data(), D.data()};
+                    knn_inner_product(xq.view, xb.view, &res);
+                }
+                // the distances are computed in a different order
+                for (size_t i = 0; i < nq * k; i++) {
+                    EXPECT_NEAR(D[i], Dref[i], 1e-5 * fabs(Dref[i]) + 1e-5)
+                        << "type=" << type << " nq=" << nq;
+                }
+            }
+        }
+    }
+}
+
+TEST(VectorView, index_flat) {
+    size_t nb = 1000, nq = 30;
+    idx_t k = 5;
+    for (VectorElementType type: all_types()) {
+        TypedData xb(type, nb, d + 1, 1);
+        TypedData xq(type, nq, d + 2, 2);
+
+        IndexFlatL2 ref(d);
+        ref.add(nb, xb.ref.data());
+        IndexFlatL2 index(d);
+        index.add_view(xb.view);
+        EXPECT_EQ(index.ntotal, nb);
+        EXPECT_EQ(ref.xb, index.xb);
+
+        std::vector<float> Dref(nq * k), D(nq * k);
+        std::vector<idx_t> Iref(nq * k), I(nq * k);
+        ref.search(nq, xq.ref.data(), k, Dref.data(), Iref.data());
+        index.search_view(xq.view, k, D.data(), I.data());
+        for (size_t i = 0; i < nq * k; i++) {
+            EXPECT_NEAR(D[i], Dref[i], 1e-5 * Dref[i] + 1e-5);
+        }
+    }
+}
+
+TEST(VectorView, default_implementation) {
+    size_t nb = 1000, nq = 10;
+    idx_t k = 5;
+    TypedData xb(VET_float16, nb, d + 4, 1);
+    TypedData xq(VET_uint8, nq, d, 2);
+
+    IndexScalarQuantizer ref(d, ScalarQuantizer::QT_8bit);
+    ref.train(nb, xb.ref.data());
+    ref.add(nb, xb.ref.data());
+
+    IndexScalarQuantizer index(d, ScalarQuantizer::QT_8bit);
+    index.train(nb, xb.ref.data());
+    index.add_view(xb.view);
+    EXPECT_EQ(ref.codes, index.codes);
+
+    std::vector<float> Dref(nq * k), D(nq * k);
+    std::vector<idx_t> Iref(nq * k), I(nq * k);
+    ref.search(nq, xq.ref.data(), k, Dref.data(), Iref.data());
+    index.search_view(xq.view, k, D.data(), I.data());
+    EXPECT_EQ(Dref, D);
+    EXPECT_EQ(Iref, I);
+}